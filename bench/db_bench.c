@@ -28,18 +28,26 @@
 #include "util/crc32c.h"
 #include "util/env.h"
 #include "util/internal.h"
+#include "util/mergeop.h"
 #include "util/options.h"
 #include "util/port.h"
+#include "util/ratelimit.h"
+#include "util/prefix.h"
 #include "util/random.h"
 #include "util/slice.h"
 #include "util/snappy.h"
+#include "util/statistics.h"
 #include "util/status.h"
 #include "util/strutil.h"
 #include "util/testutil.h"
+#include "util/trace.h"
 
 #include "db_impl.h"
 #include "db_iter.h"
+#include "dbformat.h"
+#include "harness.h"
 #include "histogram.h"
+#include "memtable.h"
 #include "write_batch.h"
 
 /* Comma-separated list of operations to run in the specified order
@@ -54,16 +62,27 @@
  *      readseq       -- read N times sequentially
  *      readreverse   -- read N times in reverse order
  *      readrandom    -- read N times in random order
+ *      multireadrandom -- read N times in random order, 100 keys per batch
  *      readmissing   -- read N missing keys in random order
  *      readhot       -- read N times in random order from 1% section of DB
+ *      readmemtable  -- read N times in random order from a memtable of N
+ *                       entries (no DB; see the --memtable_* flags)
  *      seekrandom    -- N random seeks
  *      seekordered   -- N ordered seeks
+ *      replay        -- re-issue the operations in --trace_file
+ *      mixed         -- N reads, writes, scans and deletes per thread, in
+ *                       the proportions given by the --*_ratio flags
  *      open          -- cost of opening a DB
  *      crc32c        -- repeated crc32c of 4K of data
  *   Meta operations:
  *      compact     -- Compact the entire DB
  *      stats       -- Print DB stats
  *      sstables    -- Print sstable info
+ *      cachestats  -- Print block cache statistics
+ *   With --ops_per_sec, the fills, deletes, point reads, seekrandom
+ *   and mixed issue operations on a fixed schedule and measure their
+ *   latencies from when each was due, rather than from when the last
+ *   one finished.
  */
 static const char *FLAGS_benchmarks =
     "fillseq,"
@@ -121,14 +140,81 @@ static int FLAGS_block_size = 0;
    Negative means use default settings. */
 static int FLAGS_cache_size = -1;
 
+/* Log2 of the number of block cache shards. */
+static int FLAGS_cache_shard_bits = 4;
+
+/* If true, use the scan-resistant midpoint cache policy. */
+static int FLAGS_cache_midpoint = 0;
+
+/* Number of bytes to use as a cache of compressed data.
+   Negative means no compressed block cache. */
+static int FLAGS_compressed_cache_size = -1;
+
+/* If true, build one filter per table instead of one per 2KB. */
+static int FLAGS_full_filter = 0;
+
+/* If positive, add fixed-size key prefixes of this length to
+   whole-table filters. */
+static int FLAGS_prefix_size = 0;
+
+/* If true, seek benchmarks use prefix seeks. */
+static int FLAGS_prefix_seek = 0;
+
+/* Size of the bloom filter kept for each memtable (0 for none). */
+static int FLAGS_memtable_bloom_size = 0;
+
+/* Size of the regions memtables are allocated in (0 to use malloc). */
+static int FLAGS_memtable_huge_page_size = 0;
+
+/* Memtable index (0=skiplist, 1=vector, 2=hash of skiplists). */
+static int FLAGS_memtable_rep = 0;
+
+/* If true, memtable skiplist nodes carry a prefix of their key. */
+static int FLAGS_memtable_inline_prefix = 0;
+
+/* If true, add a hash index to every data block. */
+static int FLAGS_data_block_hash_index = 0;
+
+/* If true, partition the index block of each table. */
+static int FLAGS_partition_index = 0;
+
+/* If true, partition the filter block of each table
+   (requires --partition_index). */
+static int FLAGS_partition_filters = 0;
+
+/* If true, keep index and filter blocks in the block cache. */
+static int FLAGS_cache_index_and_filter_blocks = 0;
+
+/* If true, pin the index and filter blocks of level-0 tables
+   (requires --cache_index_and_filter_blocks). */
+static int FLAGS_pin_l0_filter_and_index_blocks = 0;
+
 /* Maximum number of files to keep open at the same time
    (use default if == 0) */
 static int FLAGS_open_files = 0;
 
+/* Maximum number of concurrent background compactions
+   (initialized to default value by "main") */
+static int FLAGS_max_background_compactions = 0;
+
+/* Maximum number of threads working on a single compaction
+   (initialized to default value by "main") */
+static int FLAGS_max_subcompactions = 0;
+
+/* Maximum number of parts of a manual compaction run at once
+   (initialized to default value by "main") */
+static int FLAGS_max_manual_compactions = 0;
+
 /* Bloom filter bits per key.
    Negative means use default settings. */
 static int FLAGS_bloom_bits = -1;
 
+/* If true, use the cache-blocked bloom filter. */
+static int FLAGS_bloom_blocked = 0;
+
+/* If true, use an xor filter (ignores bloom_bits, best with full_filter). */
+static int FLAGS_xor_filter = 0;
+
 /* Common key prefix length. */
 static int FLAGS_key_prefix = 0;
 
@@ -140,12 +226,174 @@ static int FLAGS_use_existing_db = 0;
 /* If true, reuse existing log/MANIFEST files when re-opening a database. */
 static int FLAGS_reuse_logs = 0;
 
-/* If true, use compression. */
+/* If true, pipeline log writes and memtable inserts. */
+static int FLAGS_pipelined_write = 0;
+
+/* If true, group members insert their own batches into the memtable. */
+static int FLAGS_concurrent_memtable_write = 0;
+
+/* Threads inserting a large batch into the memtable. */
+static int FLAGS_max_insert_threads = 1;
+
+/* Microseconds a sync write waits for others to join its group. */
+static int FLAGS_write_group_delay = 0;
+
+/* Maximum size of a write group (zero means the default). */
+static int FLAGS_max_write_group_size = 0;
+
+/* If true, asynchronous writes skip the log. */
+static int FLAGS_disable_wal = 0;
+
+/* Compression type to use (0=none, 1=snappy, 4=lz4, 7=zstd). */
 static int FLAGS_compression = 1;
 
+/* Comma-separated compression types for each level (overrides
+   FLAGS_compression). */
+static enum ldb_compression FLAGS_compression_per_level[16];
+static int FLAGS_compression_levels = 0;
+
+/* Compression type of write-ahead log records (0=none). */
+static int FLAGS_wal_compression = 0;
+
+/* If true, stop compressing blocks of a table which do not compress. */
+static int FLAGS_adaptive_compression = 0;
+
+/* If true, reserve the space of log and table files ahead of writes. */
+static int FLAGS_allow_fallocate = 1;
+
+/* Number of obsolete log files to keep for reuse. */
+static int FLAGS_recycle_log_file_num = 0;
+
+/* If true, leave log records buffered until the log is flushed. */
+static int FLAGS_manual_wal_flush = 0;
+
+/* Milliseconds between background log syncs (0=none). */
+static int FLAGS_wal_sync_interval = 0;
+
+/* Number of tables which may be mapped (0=process-wide limit). */
+static int FLAGS_max_mapped_tables = 0;
+
+/* If true, tell the OS that tables are read at random. */
+static int FLAGS_advise_random_on_open = 1;
+
+/* Size of the buffer checksummed by each crc32c op. */
+static int FLAGS_crc32c_size = 4096;
+
+/* If positive, snappyuncomp fails (and db_bench exits non-zero)
+   when decompression is slower than this many MB/s. */
+static int FLAGS_snappy_min_mbps = 0;
+
+/* Maximum size of the zstd dictionary trained during compaction
+   (0 disables dictionary compression). */
+static int FLAGS_zstd_max_dict_bytes = 0;
+
 /* If true, use memory-mapped reads. */
 static int FLAGS_use_mmap = 1;
 
+/* Readahead window for compaction input reads (0 disables readahead). */
+static int FLAGS_compaction_readahead_size = 2 * 1024 * 1024;
+
+/* Reads after which a table's compaction outputs are cached (0 disables). */
+static int FLAGS_compaction_warm_reads = 0;
+
+/* Cache the blocks of flushes (1), and of L0/L1 compactions (2). */
+static int FLAGS_prepopulate_block_cache = 0;
+
+/* If true, save the block cache on close and reload it on open. */
+static int FLAGS_block_cache_dump = 0;
+
+/* If true, read sstables with O_DIRECT. */
+static int FLAGS_use_direct_reads = 0;
+
+/* If true, write flush and compaction outputs with O_DIRECT. */
+static int FLAGS_use_direct_io_for_flush_and_compaction = 0;
+
+/* Background I/O rate limit in bytes per second (0 means unlimited). */
+static int FLAGS_rate_limit = 0;
+
+/* If true, --rate_limit is an upper bound tuned to compaction debt. */
+static int FLAGS_rate_limit_auto = 0;
+
+/* If true, remove obsolete files on a background thread. */
+static int FLAGS_background_deletes = 0;
+
+/* Rate of background file removal in bytes per second (0 means unlimited). */
+static int FLAGS_delete_rate = 0;
+
+/* Level-0 file counts which start compactions, slow down writes and
+   stop writes. */
+static int FLAGS_level0_file_num_compaction_trigger = 4;
+static int FLAGS_level0_slowdown_writes_trigger = 8;
+static int FLAGS_level0_stop_writes_trigger = 12;
+
+/* Write rate once writes are slowed down (0 means compaction rate). */
+static int FLAGS_delayed_write_rate = 0;
+
+/* Number of levels, level-1 target size and per-level size multiplier. */
+static int FLAGS_num_levels = 7;
+static int FLAGS_max_bytes_for_level_base = 10 * 1048576;
+static double FLAGS_max_bytes_for_level_multiplier = 10;
+
+/* Derive the level targets from the size of the last level. */
+static int FLAGS_level_compaction_dynamic_level_bytes = 0;
+
+/* Per-level output file size multiplier. */
+static double FLAGS_max_file_size_multiplier = 1;
+
+/* End compaction outputs at the file boundaries of the level below. */
+static int FLAGS_align_compaction_outputs = 0;
+
+/* Level file priority (0 = round robin, 1 = min overlapping ratio,
+   2 = oldest first). */
+static int FLAGS_compaction_pri = 0;
+
+/* Compact tables holding data older than this many seconds. */
+static int FLAGS_periodic_compaction_seconds = 0;
+
+/* Compact tables in which deletions make up this fraction of entries. */
+static double FLAGS_deletion_compaction_ratio = 0;
+
+/* Move values of at least this many bytes to blob files. */
+static int FLAGS_min_blob_size = 0;
+
+/* Fraction of the oldest blob files garbage collected by compactions. */
+static double FLAGS_blob_gc_age_cutoff = 0.25;
+
+/* Compaction style (0 = level, 1 = universal, 2 = fifo) and tuning. */
+static int FLAGS_compaction_style = 0;
+static int FLAGS_universal_size_ratio = 1;
+static int FLAGS_universal_max_size_amplification_percent = 200;
+static int FLAGS_fifo_max_table_files_size = 1 << 30;
+static int FLAGS_ttl = 0;
+
+/* Operation trace read by the replay benchmark (see ldb_start_trace()). */
+static const char *FLAGS_trace_file = NULL;
+
+/* Replay at this multiple of the traced speed (0 means as fast as
+   possible). */
+static double FLAGS_trace_replay_speed = 1;
+
+/* Drop the database's files from the page cache before each benchmark,
+   so that datasets larger than memory are read from the disk. Mapped
+   files stay cached while the database is open (use --use_mmap=0). */
+static int FLAGS_drop_caches = 0;
+
+/* Gather the library's statistics, and report the blocks read (block
+   cache misses) per get after each benchmark which does gets. Misses
+   include those of background compactions. Benchmarks which write also
+   report their write amplification (log, flush and compaction bytes
+   per user byte) and the database's space amplification (bytes in its
+   directory per byte of live table data). */
+static int FLAGS_statistics = 0;
+
+/* Report throughput, latency percentiles and compaction backlog every
+   this many seconds while a benchmark runs (0 means never). */
+static int FLAGS_stats_interval = 0;
+
+/* Write the interval reports to this file as CSV rather than printing
+   them. */
+static const char *FLAGS_stats_csv = NULL;
+
 /* Use the db with the following name. */
 static const char *FLAGS_db = NULL;
 
@@ -290,6 +538,104 @@ append_with_space(ldb_buffer_t *z, const ldb_slice_t *x) {
   ldb_buffer_concat(z, x);
 }
 
+/*
+ * Reporter
+ */
+
+/* Interval statistics shared by all threads of a benchmark. A report
+   is made by the first thread to finish an operation once an interval
+   has passed; a stall which lets no operation finish shows up as one
+   long, slow interval. */
+typedef struct reporter_s {
+  ldb_mutex_t mu;
+  const char *name;
+  ldb_t **db;
+  FILE *csv;
+  double start;
+  double last;
+  int64_t ops;
+  histogram_t hist;
+} reporter_t;
+
+static void
+reporter_init(reporter_t *rep, const char *name, ldb_t **db, FILE *csv) {
+  ldb_mutex_init(&rep->mu);
+
+  rep->name = name;
+  rep->db = db;
+  rep->csv = csv;
+  rep->start = ldb_now_usec();
+  rep->last = rep->start;
+  rep->ops = 0;
+
+  histogram_init(&rep->hist);
+}
+
+static void
+reporter_clear(reporter_t *rep) {
+  ldb_mutex_destroy(&rep->mu);
+}
+
+static uint64_t
+reporter_property(reporter_t *rep, const char *name) {
+  uint64_t result = 0;
+  char *value;
+
+  if (*rep->db != NULL && ldb_property(*rep->db, name, &value)) {
+    const char *xp = value;
+
+    if (!ldb_decode_int(&result, &xp))
+      result = 0;
+
+    ldb_free(value);
+  }
+
+  return result;
+}
+
+/* REQUIRES: rep->mu is held. */
+static void
+reporter_print(reporter_t *rep, double now) {
+  double rate = rep->ops * 1e6 / (now - rep->last);
+  double p50 = histogram_percentile(&rep->hist, 50.0);
+  double p99 = histogram_percentile(&rep->hist, 99.0);
+  double l0 = reporter_property(rep, "leveldb.num-files-at-level0");
+  double pending = reporter_property(rep,
+    "leveldb.estimate-pending-compaction-bytes");
+
+  if (rep->csv != NULL) {
+    fprintf(rep->csv, "%s,%.1f,%.0f,%.1f,%.1f,%.1f,%.0f,%.0f\n",
+                      rep->name, (now - rep->start) * 1e-6,
+                      (double)rep->ops, rate, p50, p99, l0, pending);
+    fflush(rep->csv);
+  } else {
+    fprintf(stdout, "%-12s : %7.1f s %10.1f ops/sec; p50 %.1f p99 %.1f"
+                    " micros; %.0f L0 files; %.1f MB pending\n",
+                    rep->name, (now - rep->start) * 1e-6, rate,
+                    p50, p99, l0, pending / 1048576.0);
+    fflush(stdout);
+  }
+
+  rep->last = now;
+  rep->ops = 0;
+
+  histogram_init(&rep->hist);
+}
+
+static void
+reporter_finished_op(reporter_t *rep, double now, double micros) {
+  ldb_mutex_lock(&rep->mu);
+
+  histogram_add(&rep->hist, micros);
+
+  rep->ops++;
+
+  if (now - rep->last >= FLAGS_stats_interval * 1e6)
+    reporter_print(rep, now);
+
+  ldb_mutex_unlock(&rep->mu);
+}
+
 /*
  * Stats
  */
@@ -304,6 +650,7 @@ typedef struct stats_s {
   double last_op_finish;
   histogram_t hist;
   ldb_buffer_t message;
+  reporter_t *reporter;
 } stats_t;
 
 static void
@@ -325,6 +672,7 @@ stats_start(stats_t *st) {
 static void
 stats_init(stats_t *st) {
   ldb_buffer_init(&st->message);
+  st->reporter = NULL;
   stats_start(st);
 }
 
@@ -367,11 +715,15 @@ stats_add_message(stats_t *st, const char *str) {
   append_with_space(&st->message, &msg);
 }
 
+/* Count an operation which began at `begin` (microseconds). */
 static void
-stats_finished_single_op(stats_t *st) {
-  if (FLAGS_histogram) {
+stats_finished_op(stats_t *st, double begin) {
+  if (FLAGS_histogram || st->reporter != NULL || harness_flags.json != NULL) {
     double now = ldb_now_usec();
-    double micros = now - st->last_op_finish;
+    double micros = now - (begin < 0 ? st->last_op_finish : begin);
+
+    if (st->reporter != NULL)
+      reporter_finished_op(st->reporter, now, micros);
 
     histogram_add(&st->hist, micros);
 
@@ -406,6 +758,11 @@ stats_finished_single_op(stats_t *st) {
   }
 }
 
+static void
+stats_finished_single_op(stats_t *st) {
+  stats_finished_op(st, -1);
+}
+
 static void
 stats_add_bytes(stats_t *st, int64_t n) {
   st->bytes += n;
@@ -453,6 +810,34 @@ stats_report(stats_t *st, const char *name) {
   fflush(stdout);
 }
 
+/* Write the results of a run on `threads` threads to --json. */
+static void
+stats_record(const stats_t *st, const char *name, int threads,
+             int num, int value_size) {
+  harness_result_t res;
+  ldb_buffer_t msg;
+
+  ldb_buffer_init(&msg);
+  ldb_buffer_copy(&msg, &st->message);
+  ldb_buffer_push(&msg, '\0');
+
+  res.engine = "lcdb";
+  res.name = name;
+  res.threads = threads;
+  res.num = num;
+  res.value_size = value_size;
+  res.done = st->done;
+  res.seconds = st->seconds;
+  res.elapsed = (st->finish - st->start) * 1e-6;
+  res.bytes = st->bytes;
+  res.hist = &st->hist;
+  res.message = (char *)msg.data;
+
+  harness_report(&res);
+
+  ldb_buffer_clear(&msg);
+}
+
 /*
  * SharedState
  */
@@ -522,7 +907,10 @@ thread_state_clear(thread_state_t *thread) {
 
 typedef struct bench_s {
   ldb_lru_t *cache;
+  ldb_lru_t *compressed_cache;
   ldb_bloom_t *filter_policy;
+  ldb_prefix_t *prefix_extractor;
+  ldb_ratelimit_t *rate_limiter;
   ldb_t *db;
   int num;
   int value_size;
@@ -533,17 +921,46 @@ typedef struct bench_s {
   counter_state_t count_state;
   ldb_comparator_t count_comparator;
   int total_thread_count;
+  int failed;
+  harness_mix_t mixed;
+  int mixed_done;
+  FILE *stats_csv;
+  ldb_statistics_t *statistics;
 } bench_t;
 
 static void
 bench_init(bench_t *bench) {
   bench->cache = FLAGS_cache_size >= 0
-               ? ldb_lru_create(FLAGS_cache_size)
+               ? ldb_lru_create_policy(FLAGS_cache_size,
+                                       FLAGS_cache_shard_bits,
+                                       FLAGS_cache_midpoint
+                                         ? LDB_LRU_MIDPOINT
+                                         : LDB_LRU_DEFAULT)
                : NULL;
 
-  bench->filter_policy = FLAGS_bloom_bits >= 0
-                       ? ldb_bloom_create(FLAGS_bloom_bits)
-                       : NULL;
+  bench->compressed_cache = FLAGS_compressed_cache_size >= 0
+                          ? ldb_lru_create(FLAGS_compressed_cache_size)
+                          : NULL;
+
+  if (FLAGS_bloom_bits < 0)
+    bench->filter_policy = NULL;
+  else if (FLAGS_xor_filter)
+    bench->filter_policy = ldb_bloom_create_xor();
+  else if (FLAGS_bloom_blocked)
+    bench->filter_policy = ldb_bloom_create_blocked(FLAGS_bloom_bits);
+  else
+    bench->filter_policy = ldb_bloom_create(FLAGS_bloom_bits);
+
+  bench->prefix_extractor = FLAGS_prefix_size > 0
+                          ? ldb_prefix_create_fixed(FLAGS_prefix_size)
+                          : NULL;
+
+  if (FLAGS_rate_limit <= 0)
+    bench->rate_limiter = NULL;
+  else if (FLAGS_rate_limit_auto)
+    bench->rate_limiter = ldb_ratelimit_create_auto(FLAGS_rate_limit);
+  else
+    bench->rate_limiter = ldb_ratelimit_create(FLAGS_rate_limit);
 
   bench->db = NULL;
   bench->num = FLAGS_num;
@@ -555,6 +972,22 @@ bench_init(bench_t *bench) {
   ldb_atomic_init(&bench->count_state.count, 0);
   count_comparator_init(&bench->count_comparator, &bench->count_state);
   bench->total_thread_count = 0;
+  bench->failed = 0;
+  bench->stats_csv = NULL;
+  bench->statistics = FLAGS_statistics ? ldb_statistics_create() : NULL;
+
+  if (FLAGS_stats_csv != NULL) {
+    bench->stats_csv = fopen(FLAGS_stats_csv, "w");
+
+    if (bench->stats_csv == NULL) {
+      fprintf(stderr, "cannot open %s\n", FLAGS_stats_csv);
+      exit(1);
+    }
+
+    fprintf(bench->stats_csv, "benchmark,seconds,ops,ops_per_sec,"
+                              "p50_micros,p99_micros,l0_files,"
+                              "pending_compaction_bytes\n");
+  }
 
   if (!FLAGS_use_existing_db)
     ldb_destroy(FLAGS_db, ldb_dbopt_default);
@@ -568,8 +1001,23 @@ bench_clear(bench_t *bench) {
   if (bench->cache != NULL)
     ldb_lru_destroy(bench->cache);
 
+  if (bench->compressed_cache != NULL)
+    ldb_lru_destroy(bench->compressed_cache);
+
   if (bench->filter_policy != NULL)
     ldb_bloom_destroy(bench->filter_policy);
+
+  if (bench->prefix_extractor != NULL)
+    ldb_prefix_destroy(bench->prefix_extractor);
+
+  if (bench->rate_limiter != NULL)
+    ldb_ratelimit_destroy(bench->rate_limiter);
+
+  if (bench->stats_csv != NULL)
+    fclose(bench->stats_csv);
+
+  if (bench->statistics != NULL)
+    ldb_statistics_destroy(bench->statistics);
 }
 
 static void
@@ -581,8 +1029,24 @@ bench_open(bench_t *bench) {
 
   options.create_if_missing = !FLAGS_use_existing_db;
   options.block_cache = bench->cache;
+  options.block_cache_compressed = bench->compressed_cache;
+  options.full_filter = FLAGS_full_filter;
+  options.prefix_extractor = bench->prefix_extractor;
+  options.memtable_bloom_size = FLAGS_memtable_bloom_size;
+  options.memtable_huge_page_size = FLAGS_memtable_huge_page_size;
+  options.memtable_rep = (enum ldb_memtable_rep)FLAGS_memtable_rep;
+  options.memtable_inline_prefix = FLAGS_memtable_inline_prefix;
+  options.data_block_hash_index = FLAGS_data_block_hash_index;
+  options.partition_index = FLAGS_partition_index;
+  options.partition_filters = FLAGS_partition_filters;
+  options.cache_index_and_filter_blocks = FLAGS_cache_index_and_filter_blocks;
+  options.pin_l0_filter_and_index_blocks =
+    FLAGS_pin_l0_filter_and_index_blocks;
   options.write_buffer_size = FLAGS_write_buffer_size;
   options.max_file_size = FLAGS_max_file_size;
+  options.max_background_compactions = FLAGS_max_background_compactions;
+  options.max_subcompactions = FLAGS_max_subcompactions;
+  options.max_manual_compactions = FLAGS_max_manual_compactions;
   options.block_size = FLAGS_block_size;
 
   if (FLAGS_comparisons)
@@ -591,8 +1055,62 @@ bench_open(bench_t *bench) {
   options.max_open_files = FLAGS_open_files;
   options.filter_policy = bench->filter_policy;
   options.reuse_logs = FLAGS_reuse_logs;
+  options.pipelined_write = FLAGS_pipelined_write;
+  options.concurrent_memtable_write = FLAGS_concurrent_memtable_write;
+  options.max_insert_threads = FLAGS_max_insert_threads;
+  options.write_group_delay = FLAGS_write_group_delay;
+
+  if (FLAGS_max_write_group_size > 0)
+    options.max_write_group_size = FLAGS_max_write_group_size;
+
   options.compression = (enum ldb_compression)FLAGS_compression;
+  options.compression_per_level = FLAGS_compression_per_level;
+  options.compression_levels = FLAGS_compression_levels;
+  options.zstd_max_dict_bytes = FLAGS_zstd_max_dict_bytes;
+  options.wal_compression = (enum ldb_compression)FLAGS_wal_compression;
+  options.adaptive_compression = FLAGS_adaptive_compression;
+  options.allow_fallocate = FLAGS_allow_fallocate;
+  options.recycle_log_file_num = FLAGS_recycle_log_file_num;
+  options.manual_wal_flush = FLAGS_manual_wal_flush;
+  options.wal_sync_interval = FLAGS_wal_sync_interval;
+  options.max_mapped_tables = FLAGS_max_mapped_tables;
+  options.advise_random_on_open = FLAGS_advise_random_on_open;
   options.use_mmap = FLAGS_use_mmap;
+  options.compaction_readahead_size = FLAGS_compaction_readahead_size;
+  options.compaction_warm_reads = FLAGS_compaction_warm_reads;
+  options.prepopulate_block_cache = FLAGS_prepopulate_block_cache;
+  options.block_cache_dump = FLAGS_block_cache_dump;
+  options.use_direct_reads = FLAGS_use_direct_reads;
+  options.rate_limiter = bench->rate_limiter;
+  options.background_deletes = FLAGS_background_deletes;
+  options.delete_rate = FLAGS_delete_rate;
+  options.level0_file_num_compaction_trigger =
+    FLAGS_level0_file_num_compaction_trigger;
+  options.level0_slowdown_writes_trigger = FLAGS_level0_slowdown_writes_trigger;
+  options.level0_stop_writes_trigger = FLAGS_level0_stop_writes_trigger;
+  options.delayed_write_rate = FLAGS_delayed_write_rate;
+  options.num_levels = FLAGS_num_levels;
+  options.max_bytes_for_level_base = FLAGS_max_bytes_for_level_base;
+  options.max_bytes_for_level_multiplier =
+    FLAGS_max_bytes_for_level_multiplier;
+  options.level_compaction_dynamic_level_bytes =
+    FLAGS_level_compaction_dynamic_level_bytes;
+  options.max_file_size_multiplier = FLAGS_max_file_size_multiplier;
+  options.align_compaction_outputs = FLAGS_align_compaction_outputs;
+  options.compaction_pri = (enum ldb_compaction_pri)FLAGS_compaction_pri;
+  options.periodic_compaction_seconds = FLAGS_periodic_compaction_seconds;
+  options.deletion_compaction_ratio = FLAGS_deletion_compaction_ratio;
+  options.min_blob_size = FLAGS_min_blob_size;
+  options.blob_gc_age_cutoff = FLAGS_blob_gc_age_cutoff;
+  options.compaction_style = (enum ldb_compaction_style)FLAGS_compaction_style;
+  options.universal_size_ratio = FLAGS_universal_size_ratio;
+  options.universal_max_size_amplification_percent =
+    FLAGS_universal_max_size_amplification_percent;
+  options.fifo_max_table_files_size = FLAGS_fifo_max_table_files_size;
+  options.ttl = FLAGS_ttl;
+  options.use_direct_io_for_flush_and_compaction =
+    FLAGS_use_direct_io_for_flush_and_compaction;
+  options.statistics = bench->statistics;
 
   rc = ldb_open(FLAGS_db, &options, &bench->db);
 
@@ -740,10 +1258,12 @@ static void
 run_benchmark(bench_t *bench, int n, const char *name,
               void (*method)(bench_t *, thread_state_t *)) {
   shared_state_t shared;
+  reporter_t reporter;
   thread_arg_t *arg;
   int i;
 
   shared_state_init(&shared, n);
+  reporter_init(&reporter, name, &bench->db, bench->stats_csv);
 
   arg = ldb_malloc(sizeof(thread_arg_t) * n);
 
@@ -763,6 +1283,9 @@ run_benchmark(bench_t *bench, int n, const char *name,
 
     arg[i].thread->shared = &shared;
 
+    if (FLAGS_stats_interval > 0)
+      arg[i].thread->stats.reporter = &reporter;
+
     {
       ldb_thread_t thread;
       ldb_thread_create(&thread, thread_body, &arg[i]);
@@ -775,6 +1298,9 @@ run_benchmark(bench_t *bench, int n, const char *name,
   while (shared.num_initialized < n)
     ldb_cond_wait(&shared.cv, &shared.mu);
 
+  reporter.start = ldb_now_usec();
+  reporter.last = reporter.start;
+
   shared.start = 1;
 
   ldb_cond_broadcast(&shared.cv);
@@ -788,6 +1314,7 @@ run_benchmark(bench_t *bench, int n, const char *name,
     stats_merge(&arg[0].thread->stats, &arg[i].thread->stats);
 
   stats_report(&arg[0].thread->stats, name);
+  stats_record(&arg[0].thread->stats, name, n, bench->num, bench->value_size);
 
   if (FLAGS_comparisons) {
     fprintf(stdout, "Comparisons: %lu\n",
@@ -805,6 +1332,7 @@ run_benchmark(bench_t *bench, int n, const char *name,
 
   ldb_free(arg);
 
+  reporter_clear(&reporter);
   shared_state_clear(&shared);
 }
 
@@ -815,20 +1343,26 @@ run_benchmark(bench_t *bench, int n, const char *name,
               void (*method)(bench_t *, thread_state_t *)) {
   shared_state_t shared;
   thread_state_t thread;
+  reporter_t reporter;
 
   ++bench->total_thread_count;
 
   shared_state_init(&shared, n);
   thread_state_init(&thread, 0, 1000 + bench->total_thread_count);
+  reporter_init(&reporter, name, &bench->db, bench->stats_csv);
 
   thread.shared = &shared;
 
+  if (FLAGS_stats_interval > 0)
+    thread.stats.reporter = &reporter;
+
   stats_start(&thread.stats);
 
   method(bench, &thread);
 
   stats_stop(&thread.stats);
   stats_report(&thread.stats, name);
+  stats_record(&thread.stats, name, n, bench->num, bench->value_size);
 
   if (FLAGS_comparisons) {
     fprintf(stdout, "Comparisons: %lu\n",
@@ -840,6 +1374,7 @@ run_benchmark(bench_t *bench, int n, const char *name,
   }
 
   thread_state_clear(&thread);
+  reporter_clear(&reporter);
   shared_state_clear(&shared);
 }
 
@@ -848,26 +1383,36 @@ run_benchmark(bench_t *bench, int n, const char *name,
 static void
 bench_crc32c(bench_t *bench, thread_state_t *thread) {
   /* Checksum about 500MB of data total. */
-  const char *label = "(4K per op)";
-  uint8_t data[4096];
+  size_t size = FLAGS_crc32c_size;
   int64_t bytes = 0;
   uint32_t crc = 0;
+  uint8_t *data;
+  char label[100];
 
   (void)bench;
 
-  memset(data, 'x', sizeof(data));
+  data = ldb_malloc(size);
+
+  memset(data, 'x', size);
 
   while (bytes < 500 * 1048576) {
-    crc = ldb_crc32c_value(data, sizeof(data));
+    crc = ldb_crc32c_value(data, size);
     stats_finished_single_op(&thread->stats);
-    bytes += sizeof(data);
+    bytes += size;
   }
 
   /* Print so result is not dead. */
   fprintf(stderr, "... crc=0x%x\r", (unsigned int)crc);
 
+  if (size % 1024 == 0)
+    sprintf(label, "(%dK per op)", (int)(size / 1024));
+  else
+    sprintf(label, "(%d bytes per op)", (int)size);
+
   stats_add_bytes(&thread->stats, bytes);
   stats_add_message(&thread->stats, label);
+
+  ldb_free(data);
 }
 
 static void
@@ -920,11 +1465,11 @@ bench_snappy_uncompress(bench_t *bench, thread_state_t *thread) {
   ldb_slice_t input;
   int64_t bytes = 0;
   size_t space = 0;
+  int64_t start;
+  double elapsed;
   rng_t gen;
   int ok;
 
-  (void)bench;
-
   ldb_buffer_init(&compressed);
   rng_init(&gen);
 
@@ -939,19 +1484,37 @@ bench_snappy_uncompress(bench_t *bench, thread_state_t *thread) {
 
   uncompressed = ldb_malloc(input.size);
 
+  start = ldb_now_usec();
+
   while (ok && bytes < 1024 * 1048576) { /* Compress 1G. */
     ok = snappy_decode(uncompressed, compressed.data, compressed.size);
     bytes += input.size;
     stats_finished_single_op(&thread->stats);
   }
 
+  elapsed = (ldb_now_usec() - start) * 1e-6;
+
   ldb_free(uncompressed);
 
-  if (!ok)
+  if (!ok) {
     stats_add_message(&thread->stats, "(snappy failure)");
-  else
+    bench->failed = 1;
+  } else {
     stats_add_bytes(&thread->stats, bytes);
 
+    /* Regression check for the decoder's fast paths. */
+    if (FLAGS_snappy_min_mbps > 0 && elapsed > 0
+        && (bytes / 1048576.0) / elapsed < FLAGS_snappy_min_mbps) {
+      char buf[100];
+
+      sprintf(buf, "(below %d MB/s)", FLAGS_snappy_min_mbps);
+
+      stats_add_message(&thread->stats, buf);
+
+      bench->failed = 1;
+    }
+  }
+
   ldb_buffer_clear(&compressed);
   rng_clear(&gen);
 }
@@ -974,6 +1537,7 @@ bench_open_db(bench_t *bench, thread_state_t *thread) {
 
 static void
 bench_do_write(bench_t *bench, thread_state_t *thread, int seq) {
+  harness_pace_t pace;
   ldb_batch_t batch;
   int64_t bytes = 0;
   char buffer[1024];
@@ -983,6 +1547,7 @@ bench_do_write(bench_t *bench, thread_state_t *thread, int seq) {
 
   ldb_batch_init(&batch);
   rng_init(&gen);
+  harness_pace_init(&pace, FLAGS_threads);
 
   if (bench->num != FLAGS_num) {
     char msg[100];
@@ -991,6 +1556,8 @@ bench_do_write(bench_t *bench, thread_state_t *thread, int seq) {
   }
 
   for (i = 0; i < bench->num; i += bench->entries_per_batch) {
+    double begin = harness_pace(&pace, bench->entries_per_batch);
+
     ldb_batch_reset(&batch);
 
     for (j = 0; j < bench->entries_per_batch; j++) {
@@ -1001,8 +1568,6 @@ bench_do_write(bench_t *bench, thread_state_t *thread, int seq) {
       ldb_batch_put(&batch, &key, &val);
 
       bytes += key.size + val.size;
-
-      stats_finished_single_op(&thread->stats);
     }
 
     rc = ldb_write(bench->db, &batch, &bench->write_options);
@@ -1011,6 +1576,9 @@ bench_do_write(bench_t *bench, thread_state_t *thread, int seq) {
       fprintf(stderr, "put error: %s\n", ldb_strerror(rc));
       exit(1);
     }
+
+    for (j = 0; j < bench->entries_per_batch; j++)
+      stats_finished_op(&thread->stats, begin);
   }
 
   stats_add_bytes(&thread->stats, bytes);
@@ -1078,9 +1646,13 @@ bench_read_random(bench_t *bench, thread_state_t *thread) {
   ldb_readopt_t options = *ldb_readopt_default;
   char buffer[1024], msg[100];
   int found = 0;
+  harness_pace_t pace;
   int i;
 
+  harness_pace_init(&pace, FLAGS_threads);
+
   for (i = 0; i < bench->reads; i++) {
+    const double begin = harness_pace(&pace, 1);
     const int k = ldb_rand_uniform(&thread->rnd, FLAGS_num);
     ldb_slice_t key = key_encode(k, buffer);
     ldb_slice_t val;
@@ -1090,20 +1662,150 @@ bench_read_random(bench_t *bench, thread_state_t *thread) {
       found++;
     }
 
+    stats_finished_op(&thread->stats, begin);
+  }
+
+  sprintf(msg, "(%d of %d found)", found, bench->num);
+  stats_add_message(&thread->stats, msg);
+}
+
+/* Point lookups which never leave the memtable: this is where the
+   skiplist's memory stalls show up. The memtable is filled before the
+   clock is restarted. */
+static void
+bench_read_memtable(bench_t *bench, thread_state_t *thread) {
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_comparator_t icmp;
+  ldb_memtable_t *mt;
+  ldb_mergectx_t merge;
+  ldb_buffer_t value;
+  char buffer[1024];
+  char msg[100];
+  int found = 0;
+  rng_t gen;
+  int i;
+
+  options.memtable_bloom_size = FLAGS_memtable_bloom_size;
+  options.memtable_rep = (enum ldb_memtable_rep)FLAGS_memtable_rep;
+  options.memtable_inline_prefix = FLAGS_memtable_inline_prefix;
+
+  ldb_ikc_init(&icmp, ldb_bytewise_comparator);
+
+  mt = ldb_memtable_create_ex(&icmp, &options, NULL, NULL);
+
+  ldb_memtable_ref(mt);
+
+  ldb_mergectx_init(&merge, NULL);
+  ldb_buffer_init(&value);
+  rng_init(&gen);
+
+  for (i = 0; i < bench->num; i++) {
+    int k = ldb_rand_uniform(&thread->rnd, FLAGS_num);
+    ldb_slice_t key = key_encode(k, buffer);
+    ldb_slice_t val = rng_generate(&gen, bench->value_size);
+
+    ldb_memtable_add(mt, i + 1, LDB_TYPE_VALUE, &key, &val);
+  }
+
+  stats_start(&thread->stats);
+
+  for (i = 0; i < bench->reads; i++) {
+    int k = ldb_rand_uniform(&thread->rnd, FLAGS_num);
+    ldb_slice_t key = key_encode(k, buffer);
+    int rc = LDB_OK;
+    ldb_lkey_t lkey;
+
+    ldb_lkey_init(&lkey, &key, LDB_MAX_SEQUENCE);
+    ldb_mergectx_reset(&merge);
+
+    if (ldb_memtable_get(mt, &lkey, &value, NULL, &rc, &merge) && rc == LDB_OK)
+      found++;
+
+    ldb_lkey_clear(&lkey);
+
     stats_finished_single_op(&thread->stats);
   }
 
   sprintf(msg, "(%d of %d found)", found, bench->num);
   stats_add_message(&thread->stats, msg);
+
+  ldb_memtable_unref(mt);
+  ldb_mergectx_clear(&merge);
+  ldb_buffer_clear(&value);
+  rng_clear(&gen);
+}
+
+static int
+int_compare(const void *x, const void *y) {
+  int a = *((const int *)x);
+  int b = *((const int *)y);
+  return LDB_CMP(a, b);
+}
+
+static void
+bench_multiread_random(bench_t *bench, thread_state_t *thread) {
+  ldb_readopt_t options = *ldb_readopt_default;
+  int batch = bench->entries_per_batch;
+  char *buffer = ldb_malloc(batch * 1024);
+  ldb_slice_t *keys = ldb_malloc(batch * sizeof(ldb_slice_t));
+  ldb_slice_t *vals = ldb_malloc(batch * sizeof(ldb_slice_t));
+  int *statuses = ldb_malloc(batch * sizeof(int));
+  int *nums = ldb_malloc(batch * sizeof(int));
+  int found = 0;
+  char msg[100];
+  harness_pace_t pace;
+  int i, j, n;
+
+  harness_pace_init(&pace, FLAGS_threads);
+
+  for (i = 0; i < bench->reads; i += n) {
+    double begin;
+
+    n = LDB_MIN(batch, bench->reads - i);
+    begin = harness_pace(&pace, n);
+
+    /* Sorted keys let the lookups share files and blocks. */
+    for (j = 0; j < n; j++)
+      nums[j] = ldb_rand_uniform(&thread->rnd, FLAGS_num);
+
+    qsort(nums, n, sizeof(int), int_compare);
+
+    for (j = 0; j < n; j++)
+      keys[j] = key_encode(nums[j], buffer + j * 1024);
+
+    ldb_multiget(bench->db, keys, vals, statuses, n, &options);
+
+    for (j = 0; j < n; j++) {
+      if (statuses[j] == LDB_OK) {
+        ldb_free(vals[j].data);
+        found++;
+      }
+
+      stats_finished_op(&thread->stats, begin);
+    }
+  }
+
+  ldb_free(nums);
+  ldb_free(statuses);
+  ldb_free(vals);
+  ldb_free(keys);
+  ldb_free(buffer);
+
+  sprintf(msg, "(%d of %d found)", found, bench->num);
+  stats_add_message(&thread->stats, msg);
 }
 
 static void
 bench_read_missing(bench_t *bench, thread_state_t *thread) {
   ldb_readopt_t options = *ldb_readopt_default;
   char buffer[1024];
+  harness_pace_t pace;
   int i;
 
+  harness_pace_init(&pace, FLAGS_threads);
+
   for (i = 0; i < bench->reads; i++) {
+    const double begin = harness_pace(&pace, 1);
     const int k = ldb_rand_uniform(&thread->rnd, FLAGS_num);
     ldb_slice_t key = key_encode(k, buffer);
     ldb_slice_t val;
@@ -1113,7 +1815,7 @@ bench_read_missing(bench_t *bench, thread_state_t *thread) {
     if (ldb_get(bench->db, &key, &val, &options) == LDB_OK)
       ldb_free(val.data);
 
-    stats_finished_single_op(&thread->stats);
+    stats_finished_op(&thread->stats, begin);
   }
 }
 
@@ -1122,9 +1824,13 @@ bench_read_hot(bench_t *bench, thread_state_t *thread) {
   ldb_readopt_t options = *ldb_readopt_default;
   const int range = (FLAGS_num + 99) / 100;
   char buffer[1024];
+  harness_pace_t pace;
   int i;
 
+  harness_pace_init(&pace, FLAGS_threads);
+
   for (i = 0; i < bench->reads; i++) {
+    const double begin = harness_pace(&pace, 1);
     const int k = ldb_rand_uniform(&thread->rnd, range);
     ldb_slice_t key = key_encode(k, buffer);
     ldb_slice_t val;
@@ -1132,7 +1838,7 @@ bench_read_hot(bench_t *bench, thread_state_t *thread) {
     if (ldb_get(bench->db, &key, &val, &options) == LDB_OK)
       ldb_free(val.data);
 
-    stats_finished_single_op(&thread->stats);
+    stats_finished_op(&thread->stats, begin);
   }
 }
 
@@ -1141,9 +1847,15 @@ bench_seek_random(bench_t *bench, thread_state_t *thread) {
   ldb_readopt_t options = *ldb_readopt_default;
   char buffer[1024], msg[100];
   int found = 0;
+  harness_pace_t pace;
   int i;
 
+  options.prefix_seek = FLAGS_prefix_seek;
+
+  harness_pace_init(&pace, FLAGS_threads);
+
   for (i = 0; i < bench->reads; i++) {
+    const double begin = harness_pace(&pace, 1);
     ldb_iter_t *iter = ldb_iterator(bench->db, &options);
     const int k = ldb_rand_uniform(&thread->rnd, FLAGS_num);
     ldb_slice_t key = key_encode(k, buffer);
@@ -1155,7 +1867,7 @@ bench_seek_random(bench_t *bench, thread_state_t *thread) {
 
     ldb_iter_destroy(iter);
 
-    stats_finished_single_op(&thread->stats);
+    stats_finished_op(&thread->stats, begin);
   }
 
   sprintf(msg, "(%d of %d found)", found, bench->num);
@@ -1165,12 +1877,16 @@ bench_seek_random(bench_t *bench, thread_state_t *thread) {
 static void
 bench_seek_ordered(bench_t *bench, thread_state_t *thread) {
   ldb_readopt_t options = *ldb_readopt_default;
-  ldb_iter_t *iter = ldb_iterator(bench->db, &options);
   char buffer[1024], msg[100];
   int found = 0;
   int last = 0;
+  ldb_iter_t *iter;
   int i;
 
+  options.prefix_seek = FLAGS_prefix_seek;
+
+  iter = ldb_iterator(bench->db, &options);
+
   for (i = 0; i < bench->reads; i++) {
     const int k = (last + ldb_rand_uniform(&thread->rnd, 100)) % FLAGS_num;
     ldb_slice_t key = key_encode(k, buffer);
@@ -1193,14 +1909,18 @@ bench_seek_ordered(bench_t *bench, thread_state_t *thread) {
 
 static void
 bench_do_delete(bench_t *bench, thread_state_t *thread, int seq) {
+  harness_pace_t pace;
   ldb_batch_t batch;
   char buffer[1024];
   int rc = LDB_OK;
   int i, j;
 
   ldb_batch_init(&batch);
+  harness_pace_init(&pace, FLAGS_threads);
 
   for (i = 0; i < bench->num; i += bench->entries_per_batch) {
+    double begin = harness_pace(&pace, bench->entries_per_batch);
+
     ldb_batch_reset(&batch);
 
     for (j = 0; j < bench->entries_per_batch; j++) {
@@ -1208,8 +1928,6 @@ bench_do_delete(bench_t *bench, thread_state_t *thread, int seq) {
       ldb_slice_t key = key_encode(k, buffer);
 
       ldb_batch_del(&batch, &key);
-
-      stats_finished_single_op(&thread->stats);
     }
 
     rc = ldb_write(bench->db, &batch, &bench->write_options);
@@ -1218,6 +1936,9 @@ bench_do_delete(bench_t *bench, thread_state_t *thread, int seq) {
       fprintf(stderr, "del error: %s\n", ldb_strerror(rc));
       exit(1);
     }
+
+    for (j = 0; j < bench->entries_per_batch; j++)
+      stats_finished_op(&thread->stats, begin);
   }
 
   ldb_batch_clear(&batch);
@@ -1280,6 +2001,240 @@ bench_read_while_writing(bench_t *bench, thread_state_t *thread) {
 }
 #endif /* _WIN32 || LDB_PTHREAD */
 
+/* State of a thread running the mixed benchmark. */
+typedef struct mixed_state_s {
+  bench_t *bench;
+  ldb_readopt_t options;
+  rng_t gen;
+} mixed_state_t;
+
+static void
+mixed_check(int rc) {
+  if (rc != LDB_OK) {
+    fprintf(stderr, "write error: %s\n", ldb_strerror(rc));
+    exit(1);
+  }
+}
+
+static int64_t
+mixed_get(void *db, int k) {
+  mixed_state_t *ms = db;
+  ldb_slice_t key, val;
+  char buffer[100];
+  int64_t n = -1;
+
+  key = key_encode(k, buffer);
+
+  if (ldb_get(ms->bench->db, &key, &val, &ms->options) == LDB_OK) {
+    n = val.size;
+    ldb_free(val.data);
+  }
+
+  return n;
+}
+
+static int64_t
+mixed_put(void *db, int k, size_t size) {
+  mixed_state_t *ms = db;
+  ldb_slice_t key, val;
+  char buffer[100];
+
+  key = key_encode(k, buffer);
+  val = rng_generate(&ms->gen, size);
+
+  mixed_check(ldb_put(ms->bench->db, &key, &val, &ms->bench->write_options));
+
+  return key.size + val.size;
+}
+
+static void
+mixed_del(void *db, int k) {
+  mixed_state_t *ms = db;
+  ldb_slice_t key;
+  char buffer[100];
+
+  key = key_encode(k, buffer);
+
+  mixed_check(ldb_del(ms->bench->db, &key, &ms->bench->write_options));
+}
+
+static int64_t
+mixed_scan(void *db, int k, int count) {
+  mixed_state_t *ms = db;
+  ldb_iter_t *iter = ldb_iterator(ms->bench->db, &ms->options);
+  ldb_slice_t key;
+  char buffer[100];
+  int64_t n = 0;
+  int j = 0;
+
+  key = key_encode(k, buffer);
+
+  for (ldb_iter_seek(iter, &key);
+       ldb_iter_valid(iter) && j < count;
+       ldb_iter_next(iter)) {
+    n += ldb_iter_key(iter).size + ldb_iter_value(iter).size;
+    j++;
+  }
+
+  ldb_iter_destroy(iter);
+
+  return j > 0 ? n : -1;
+}
+
+static void
+mixed_finished(void *stats, double begin) {
+  stats_finished_op(stats, begin);
+}
+
+static const harness_engine_t mixed_engine = {
+  mixed_get,
+  mixed_put,
+  mixed_del,
+  mixed_scan,
+  mixed_finished
+};
+
+static void
+bench_mixed(bench_t *bench, thread_state_t *thread) {
+  harness_mix_t mix;
+  mixed_state_t ms;
+
+  ms.bench = bench;
+  ms.options = *ldb_readopt_default;
+
+  rng_init(&ms.gen);
+
+  harness_mix_init(&mix);
+
+  harness_mixed(&mixed_engine, &ms, &thread->stats, &thread->rnd,
+                FLAGS_num, bench->reads, FLAGS_threads,
+                FLAGS_value_size, &mix);
+
+  rng_clear(&ms.gen);
+
+  stats_add_bytes(&thread->stats, mix.bytes);
+
+  /* The last thread to finish reports the totals. */
+  ldb_mutex_lock(&thread->shared->mu);
+
+  harness_mix_add(&bench->mixed, &mix);
+
+  if (++bench->mixed_done == thread->shared->total) {
+    char msg[200];
+
+    stats_add_message(&thread->stats, harness_mix_string(&bench->mixed, msg));
+  }
+
+  ldb_mutex_unlock(&thread->shared->mu);
+}
+
+static void
+bench_replay(bench_t *bench, thread_state_t *thread) {
+  ldb_readopt_t options = *ldb_readopt_default;
+  int64_t start = ldb_now_usec();
+  ldb_tracereader_t *reader;
+  ldb_iter_t *iter = NULL;
+  ldb_tracerec_t rec;
+  int64_t bytes = 0;
+  ldb_slice_t val;
+  char msg[100];
+  int found = 0;
+  int ops = 0;
+  rng_t gen;
+  int rc;
+
+  if (FLAGS_trace_file == NULL) {
+    fprintf(stderr, "replay requires --trace_file\n");
+    exit(1);
+  }
+
+  rc = ldb_tracereader_open(FLAGS_trace_file, &reader);
+
+  if (rc != LDB_OK) {
+    fprintf(stderr, "open error: %s\n", ldb_strerror(rc));
+    exit(1);
+  }
+
+  rng_init(&gen);
+
+  while (ldb_tracereader_next(reader, &rec)) {
+    if (FLAGS_trace_replay_speed > 0) {
+      int64_t due = start + (int64_t)(rec.micros / FLAGS_trace_replay_speed);
+      int64_t now = ldb_now_usec();
+
+      if (due > now)
+        ldb_sleep_usec(due - now);
+    }
+
+    switch (rec.op) {
+      case LDB_TRACE_GET: {
+        if (ldb_get(bench->db, &rec.key, &val, &options) == LDB_OK) {
+          bytes += val.size;
+          ldb_free(val.data);
+          found++;
+        }
+        break;
+      }
+
+      case LDB_TRACE_PUT:
+      case LDB_TRACE_MERGE: {
+        size_t size = LDB_MIN(rec.value_size, gen.data.size - 1);
+
+        val = rng_generate(&gen, size);
+
+        if (rec.op == LDB_TRACE_PUT)
+          rc = ldb_put(bench->db, &rec.key, &val, &bench->write_options);
+        else
+          rc = ldb_merge(bench->db, &rec.key, &val, &bench->write_options);
+
+        bytes += rec.key.size + val.size;
+
+        break;
+      }
+
+      case LDB_TRACE_DEL: {
+        rc = ldb_del(bench->db, &rec.key, &bench->write_options);
+        break;
+      }
+
+      case LDB_TRACE_SEEK: {
+        if (iter == NULL)
+          iter = ldb_iterator(bench->db, &options);
+
+        ldb_iter_seek(iter, &rec.key);
+
+        break;
+      }
+
+      case LDB_TRACE_NEXT: {
+        if (iter != NULL && ldb_iter_valid(iter))
+          ldb_iter_next(iter);
+        break;
+      }
+    }
+
+    if (rc != LDB_OK) {
+      fprintf(stderr, "write error: %s\n", ldb_strerror(rc));
+      exit(1);
+    }
+
+    stats_finished_single_op(&thread->stats);
+
+    ops++;
+  }
+
+  if (iter != NULL)
+    ldb_iter_destroy(iter);
+
+  ldb_tracereader_close(reader);
+  rng_clear(&gen);
+
+  sprintf(msg, "(%d ops, %d gets found)", ops, found);
+
+  stats_add_bytes(&thread->stats, bytes);
+  stats_add_message(&thread->stats, msg);
+}
+
 static void
 bench_compact(bench_t *bench, thread_state_t *thread) {
   (void)thread;
@@ -1298,6 +2253,100 @@ bench_print_stats(bench_t *bench, const char *key) {
   }
 }
 
+static void
+bench_drop_caches(void) {
+  static int warned = 0;
+  char path[LDB_PATH_MAX];
+  char **names;
+  int i, len;
+
+  len = ldb_get_children(FLAGS_db, &names);
+
+  for (i = 0; i < len; i++) {
+    if (!ldb_join(path, sizeof(path), FLAGS_db, names[i]))
+      continue;
+
+    if (ldb_evict_file(path) == LDB_NOSUPPORT && !warned) {
+      fprintf(stderr, "WARNING: --drop_caches is not supported here\n");
+      warned = 1;
+    }
+  }
+
+  if (len >= 0)
+    ldb_free_children(names, len);
+}
+
+/* Blocks read from disk per get since the counters were captured. */
+static void
+bench_report_reads(bench_t *bench, const char *name,
+                   uint64_t misses, uint64_t gets) {
+  ldb_statistics_t *stats = bench->statistics;
+
+  misses = ldb_statistics_get(stats, LDB_BLOCK_CACHE_MISS) - misses;
+  gets = ldb_statistics_get(stats, LDB_KEYS_READ) - gets;
+
+  if (gets == 0)
+    return;
+
+  fprintf(stdout, "%-12s : %11.3f blocks read/get; %.0f blocks read\n",
+                  name, (double)misses / (double)gets, (double)misses);
+  fflush(stdout);
+}
+
+/* Bytes written to disk per user byte since the counters were captured,
+   and bytes on disk per live byte. The live bytes are the tables' size
+   over the whole key range; the rest is logs, the manifest, and tables
+   awaiting deletion. */
+static void
+bench_report_writes(bench_t *bench, const char *name, const uint64_t *base) {
+  ldb_statistics_t *stats = bench->statistics;
+  uint64_t user, disk, live;
+  uint64_t total = 0;
+  char path[LDB_PATH_MAX];
+  ldb_range_t range;
+  char **names;
+  int i, len;
+
+  user = ldb_statistics_get(stats, LDB_BYTES_WRITTEN) - base[0];
+  disk = (ldb_statistics_get(stats, LDB_WAL_BYTES) - base[1])
+       + (ldb_statistics_get(stats, LDB_FLUSH_WRITE_BYTES) - base[2])
+       + (ldb_statistics_get(stats, LDB_COMPACT_WRITE_BYTES) - base[3]);
+
+  if (user == 0 || bench->db == NULL)
+    return;
+
+  range.start = ldb_string("");
+  range.limit = ldb_string("\xff");
+
+  ldb_approximate_sizes(bench->db, &range, 1, &live);
+
+  len = ldb_get_children(FLAGS_db, &names);
+
+  for (i = 0; i < len; i++) {
+    uint64_t size;
+
+    if (!ldb_join(path, sizeof(path), FLAGS_db, names[i]))
+      continue;
+
+    if (ldb_file_size(path, &size) == LDB_OK)
+      total += size;
+  }
+
+  if (len >= 0)
+    ldb_free_children(names, len);
+
+  fprintf(stdout, "%-12s : %11.3f write amp; %.1f MB written to disk\n",
+                  name, (double)disk / (double)user, disk / 1048576.0);
+
+  if (live > 0) {
+    fprintf(stdout, "%-12s : %11.3f space amp; %.1f MB on disk, %.1f MB live\n",
+                    name, (double)total / (double)live,
+                    total / 1048576.0, live / 1048576.0);
+  }
+
+  fflush(stdout);
+}
+
 static void
 bench_run(bench_t *bench) {
   const char *benchmarks = FLAGS_benchmarks;
@@ -1336,6 +2385,7 @@ bench_run(bench_t *bench) {
     bench->value_size = FLAGS_value_size;
     bench->entries_per_batch = 1;
     bench->write_options = *ldb_writeopt_default;
+    bench->write_options.disable_wal = FLAGS_disable_wal;
 
     method = NULL;
     fresh_db = 0;
@@ -1363,6 +2413,7 @@ bench_run(bench_t *bench) {
       fresh_db = 1;
       bench->num /= 1000;
       bench->write_options.sync = 1;
+      bench->write_options.disable_wal = 0;
       method = &bench_write_random;
     } else if (strcmp(name, "fill100K") == 0) {
       fresh_db = 1;
@@ -1375,6 +2426,9 @@ bench_run(bench_t *bench) {
       method = &bench_read_reverse;
     } else if (strcmp(name, "readrandom") == 0) {
       method = &bench_read_random;
+    } else if (strcmp(name, "multireadrandom") == 0) {
+      bench->entries_per_batch = 100;
+      method = &bench_multiread_random;
     } else if (strcmp(name, "readmissing") == 0) {
       method = &bench_read_missing;
     } else if (strcmp(name, "seekrandom") == 0) {
@@ -1383,6 +2437,8 @@ bench_run(bench_t *bench) {
       method = &bench_seek_ordered;
     } else if (strcmp(name, "readhot") == 0) {
       method = &bench_read_hot;
+    } else if (strcmp(name, "readmemtable") == 0) {
+      method = &bench_read_memtable;
     } else if (strcmp(name, "readrandomsmall") == 0) {
       bench->reads /= 1000;
       method = &bench_read_random;
@@ -1395,6 +2451,14 @@ bench_run(bench_t *bench) {
       num_threads++; /* Add extra thread for writing. */
       method = &bench_read_while_writing;
 #endif
+    } else if (strcmp(name, "replay") == 0) {
+      num_threads = 1;
+      method = &bench_replay;
+    } else if (strcmp(name, "mixed") == 0) {
+      harness_mix_init(&bench->mixed);
+      harness_reset(FLAGS_num);
+      bench->mixed_done = 0;
+      method = &bench_mixed;
     } else if (strcmp(name, "compact") == 0) {
       method = &bench_compact;
     } else if (strcmp(name, "crc32c") == 0) {
@@ -1407,6 +2471,8 @@ bench_run(bench_t *bench) {
       bench_print_stats(bench, "leveldb.stats");
     } else if (strcmp(name, "sstables") == 0) {
       bench_print_stats(bench, "leveldb.sstables");
+    } else if (strcmp(name, "cachestats") == 0) {
+      bench_print_stats(bench, "leveldb.block-cache-stats");
     } else {
       if (*name) /* No error message for empty name. */
         fprintf(stderr, "unknown benchmark '%s'\n", name);
@@ -1428,8 +2494,60 @@ bench_run(bench_t *bench) {
       }
     }
 
-    if (method != NULL)
+    if (method != NULL) {
+      ldb_statistics_t *stats = bench->statistics;
+      uint64_t written[4] = {0, 0, 0, 0};
+      uint64_t misses = 0;
+      uint64_t gets = 0;
+
+      if (FLAGS_drop_caches)
+        bench_drop_caches();
+
+      if (stats != NULL) {
+        misses = ldb_statistics_get(stats, LDB_BLOCK_CACHE_MISS);
+        gets = ldb_statistics_get(stats, LDB_KEYS_READ);
+        written[0] = ldb_statistics_get(stats, LDB_BYTES_WRITTEN);
+        written[1] = ldb_statistics_get(stats, LDB_WAL_BYTES);
+        written[2] = ldb_statistics_get(stats, LDB_FLUSH_WRITE_BYTES);
+        written[3] = ldb_statistics_get(stats, LDB_COMPACT_WRITE_BYTES);
+      }
+
       run_benchmark(bench, num_threads, name, method);
+
+      if (stats != NULL) {
+        bench_report_reads(bench, name, misses, gets);
+        bench_report_writes(bench, name, written);
+      }
+    }
+  }
+}
+
+static int
+parse_compression_levels(const char *xp) {
+  int n, len;
+
+  FLAGS_compression_levels = 0;
+
+  for (;;) {
+    if (sscanf(xp, "%d%n", &n, &len) != 1)
+      return 0;
+
+    if (n != 0 && n != 1 && n != 4 && n != 7)
+      return 0;
+
+    if (FLAGS_compression_levels == (int)lengthof(FLAGS_compression_per_level))
+      return 0;
+
+    FLAGS_compression_per_level[FLAGS_compression_levels++] =
+      (enum ldb_compression)n;
+
+    xp += len;
+
+    if (*xp == '\0')
+      return 1;
+
+    if (*xp++ != ',')
+      return 0;
   }
 }
 
@@ -1437,12 +2555,17 @@ int
 main(int argc, char **argv) {
   char db_path[LDB_PATH_MAX];
   bench_t bench;
+  int failed;
   int i;
 
   FLAGS_write_buffer_size = ldb_dbopt_default->write_buffer_size;
   FLAGS_max_file_size = ldb_dbopt_default->max_file_size;
   FLAGS_block_size = ldb_dbopt_default->block_size;
   FLAGS_open_files = ldb_dbopt_default->max_open_files;
+  FLAGS_max_background_compactions =
+    ldb_dbopt_default->max_background_compactions;
+  FLAGS_max_subcompactions = ldb_dbopt_default->max_subcompactions;
+  FLAGS_max_manual_compactions = ldb_dbopt_default->max_manual_compactions;
 
   for (i = 1; i < argc; i++) {
     char junk;
@@ -1465,12 +2588,158 @@ main(int argc, char **argv) {
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
-    } else if (sscanf(argv[i], "--compression=%d%c", &n, &junk) == 1 &&
+    } else if (sscanf(argv[i], "--pipelined_write=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
+      FLAGS_pipelined_write = n;
+    } else if (sscanf(argv[i], "--concurrent_memtable_write=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_concurrent_memtable_write = n;
+    } else if (sscanf(argv[i], "--max_insert_threads=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_max_insert_threads = n;
+    } else if (sscanf(argv[i], "--write_group_delay=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_write_group_delay = n;
+    } else if (sscanf(argv[i], "--max_write_group_size=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_max_write_group_size = n;
+    } else if (sscanf(argv[i], "--disable_wal=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_disable_wal = n;
+    } else if (sscanf(argv[i], "--compression=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1 || n == 4 || n == 7)) {
       FLAGS_compression = n;
+    } else if (sscanf(argv[i], "--wal_compression=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1 || n == 4 || n == 7)) {
+      FLAGS_wal_compression = n;
+    } else if (sscanf(argv[i], "--adaptive_compression=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_adaptive_compression = n;
+    } else if (sscanf(argv[i], "--allow_fallocate=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_allow_fallocate = n;
+    } else if (sscanf(argv[i], "--recycle_log_file_num=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_recycle_log_file_num = n;
+    } else if (sscanf(argv[i], "--manual_wal_flush=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_manual_wal_flush = n;
+    } else if (sscanf(argv[i], "--wal_sync_interval=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_wal_sync_interval = n;
+    } else if (sscanf(argv[i], "--max_mapped_tables=%d%c",
+                      &n, &junk) == 1 && n >= -1) {
+      FLAGS_max_mapped_tables = n;
+    } else if (sscanf(argv[i], "--advise_random_on_open=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_advise_random_on_open = n;
+    } else if (sscanf(argv[i], "--crc32c_size=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_crc32c_size = n;
+    } else if (sscanf(argv[i], "--snappy_min_mbps=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_snappy_min_mbps = n;
+    } else if (ldb_starts_with(argv[i], "--compression_per_level=")) {
+      if (!parse_compression_levels(argv[i] + 24)) {
+        fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+        exit(1);
+      }
+    } else if (sscanf(argv[i], "--zstd_max_dict_bytes=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_zstd_max_dict_bytes = n;
     } else if (sscanf(argv[i], "--use_mmap=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_use_mmap = n;
+    } else if (sscanf(argv[i], "--compaction_readahead_size=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_compaction_readahead_size = n;
+    } else if (sscanf(argv[i], "--compaction_warm_reads=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_compaction_warm_reads = n;
+    } else if (sscanf(argv[i], "--prepopulate_block_cache=%d%c",
+                      &n, &junk) == 1 && n >= 0 && n <= 2) {
+      FLAGS_prepopulate_block_cache = n;
+    } else if (sscanf(argv[i], "--block_cache_dump=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_block_cache_dump = n;
+    } else if (sscanf(argv[i], "--use_direct_reads=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_use_direct_reads = n;
+    } else if (sscanf(argv[i], "--use_direct_io_for_flush_and_compaction=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_use_direct_io_for_flush_and_compaction = n;
+    } else if (sscanf(argv[i], "--rate_limit=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_rate_limit = n;
+    } else if (sscanf(argv[i], "--rate_limit_auto=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_rate_limit_auto = n;
+    } else if (sscanf(argv[i], "--background_deletes=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_background_deletes = n;
+    } else if (sscanf(argv[i], "--delete_rate=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_delete_rate = n;
+    } else if (sscanf(argv[i], "--level0_file_num_compaction_trigger=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_level0_file_num_compaction_trigger = n;
+    } else if (sscanf(argv[i], "--level0_slowdown_writes_trigger=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_level0_slowdown_writes_trigger = n;
+    } else if (sscanf(argv[i], "--level0_stop_writes_trigger=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_level0_stop_writes_trigger = n;
+    } else if (sscanf(argv[i], "--delayed_write_rate=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_delayed_write_rate = n;
+    } else if (sscanf(argv[i], "--num_levels=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_num_levels = n;
+    } else if (sscanf(argv[i], "--max_bytes_for_level_base=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_max_bytes_for_level_base = n;
+    } else if (sscanf(argv[i], "--max_bytes_for_level_multiplier=%lf%c",
+                      &d, &junk) == 1 && d > 0) {
+      FLAGS_max_bytes_for_level_multiplier = d;
+    } else if (sscanf(argv[i], "--level_compaction_dynamic_level_bytes=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_level_compaction_dynamic_level_bytes = n;
+    } else if (sscanf(argv[i], "--max_file_size_multiplier=%lf%c",
+                      &d, &junk) == 1 && d >= 1) {
+      FLAGS_max_file_size_multiplier = d;
+    } else if (sscanf(argv[i], "--align_compaction_outputs=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_align_compaction_outputs = n;
+    } else if (sscanf(argv[i], "--compaction_pri=%d%c",
+                      &n, &junk) == 1 && n >= 0 && n <= 2) {
+      FLAGS_compaction_pri = n;
+    } else if (sscanf(argv[i], "--periodic_compaction_seconds=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_periodic_compaction_seconds = n;
+    } else if (sscanf(argv[i], "--deletion_compaction_ratio=%lf%c",
+                      &d, &junk) == 1 && d >= 0) {
+      FLAGS_deletion_compaction_ratio = d;
+    } else if (sscanf(argv[i], "--min_blob_size=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_min_blob_size = n;
+    } else if (sscanf(argv[i], "--blob_gc_age_cutoff=%lf%c",
+                      &d, &junk) == 1 && d >= 0 && d <= 1) {
+      FLAGS_blob_gc_age_cutoff = d;
+    } else if (sscanf(argv[i], "--compaction_style=%d%c",
+                      &n, &junk) == 1 && n >= 0 && n <= 2) {
+      FLAGS_compaction_style = n;
+    } else if (sscanf(argv[i], "--universal_size_ratio=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_universal_size_ratio = n;
+    } else if (sscanf(argv[i],
+                      "--universal_max_size_amplification_percent=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_universal_max_size_amplification_percent = n;
+    } else if (sscanf(argv[i], "--fifo_max_table_files_size=%d%c",
+                      &n, &junk) == 1 && n > 0) {
+      FLAGS_fifo_max_table_files_size = n;
+    } else if (sscanf(argv[i], "--ttl=%d%c", &n, &junk) == 1 && n >= 0) {
+      FLAGS_ttl = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
@@ -1489,10 +2758,85 @@ main(int argc, char **argv) {
       FLAGS_key_prefix = n < 0 ? 0 : LDB_MIN(n, 1000);
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--cache_shard_bits=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_shard_bits = n;
+    } else if (sscanf(argv[i], "--cache_midpoint=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_cache_midpoint = n;
+    } else if (sscanf(argv[i], "--compressed_cache_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compressed_cache_size = n;
+    } else if (sscanf(argv[i], "--full_filter=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_full_filter = n;
+    } else if (sscanf(argv[i], "--prefix_size=%d%c", &n, &junk) == 1) {
+      FLAGS_prefix_size = n;
+    } else if (sscanf(argv[i], "--prefix_seek=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_prefix_seek = n;
+    } else if (sscanf(argv[i], "--memtable_bloom_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_memtable_bloom_size = n;
+    } else if (sscanf(argv[i], "--memtable_huge_page_size=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_memtable_huge_page_size = n;
+    } else if (sscanf(argv[i], "--memtable_rep=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_memtable_rep = n;
+    } else if (sscanf(argv[i], "--memtable_inline_prefix=%d%c",
+                      &n, &junk) == 1 && n >= 0) {
+      FLAGS_memtable_inline_prefix = n;
+    } else if (sscanf(argv[i], "--data_block_hash_index=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_data_block_hash_index = n;
+    } else if (sscanf(argv[i], "--partition_index=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_partition_index = n;
+    } else if (sscanf(argv[i], "--partition_filters=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_partition_filters = n;
+    } else if (sscanf(argv[i], "--cache_index_and_filter_blocks=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_cache_index_and_filter_blocks = n;
+    } else if (sscanf(argv[i], "--pin_l0_filter_and_index_blocks=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_pin_l0_filter_and_index_blocks = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (sscanf(argv[i], "--bloom_blocked=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_bloom_blocked = n;
+    } else if (sscanf(argv[i], "--xor_filter=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_xor_filter = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--max_background_compactions=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_max_background_compactions = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
+    } else if (sscanf(argv[i], "--max_manual_compactions=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_max_manual_compactions = n;
+    } else if (ldb_starts_with(argv[i], "--trace_file=")) {
+      FLAGS_trace_file = argv[i] + 13;
+    } else if (sscanf(argv[i], "--trace_replay_speed=%lf%c",
+                      &d, &junk) == 1 && d >= 0) {
+      FLAGS_trace_replay_speed = d;
+    } else if (harness_parse_flag(argv[i])) {
+      /* See harness.h. */
+    } else if (sscanf(argv[i], "--drop_caches=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_drop_caches = n;
+    } else if (sscanf(argv[i], "--statistics=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_statistics = n;
+    } else if (sscanf(argv[i], "--stats_interval=%d%c", &n, &junk) == 1 &&
+               n >= 0) {
+      FLAGS_stats_interval = n;
+    } else if (ldb_starts_with(argv[i], "--stats_csv=")) {
+      FLAGS_stats_csv = argv[i] + 12;
     } else if (ldb_starts_with(argv[i], "--db=")) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -1501,6 +2845,11 @@ main(int argc, char **argv) {
     }
   }
 
+  if (harness_flags.value_size_min > harness_flags.value_size_max) {
+    fprintf(stderr, "--value_size_min exceeds --value_size_max\n");
+    return 1;
+  }
+
   /* Choose a location for the test database if none given with --db=<path>. */
   if (FLAGS_db == NULL) {
     if (!ldb_test_filename(db_path, sizeof(db_path), "dbbench"))
@@ -1511,7 +2860,12 @@ main(int argc, char **argv) {
 
   bench_init(&bench);
   bench_run(&bench);
+
+  failed = bench.failed;
+
   bench_clear(&bench);
 
-  return 0;
+  harness_close();
+
+  return failed ? 1 : 0;
 }
@@ -30,6 +30,7 @@
 #include "util/strutil.h"
 #include "util/testutil.h"
 
+#include "harness.h"
 #include "histogram.h"
 
 /* Comma-separated list of operations to run in the specified order
@@ -49,6 +50,8 @@
  *   readseq100K   -- read N/1000 100K values in sequential order in async mode
  *   readrand100K  -- read N/1000 100K values in sequential order in async mode
  *   readrandom    -- read N times in random order
+ *   mixed         -- N reads, writes, scans and deletes, in the proportions
+ *                    given by the --*_ratio flags (see harness.h)
  */
 static const char *FLAGS_benchmarks =
     "fillseqsync,"
@@ -280,11 +283,12 @@ stats_add_message(stats_t *st, const char *str) {
   append_with_space(&st->message, &msg);
 }
 
+/* Count an operation which began at `begin` (microseconds). */
 static void
-stats_finished_single_op(stats_t *st) {
-  if (FLAGS_histogram) {
+stats_finished_op(stats_t *st, double begin) {
+  if (FLAGS_histogram || harness_flags.json != NULL) {
     double now = ldb_now_usec();
-    double micros = now - st->last_op_finish;
+    double micros = now - (begin < 0 ? st->last_op_finish : begin);
 
     histogram_add(&st->hist, micros);
 
@@ -319,6 +323,11 @@ stats_finished_single_op(stats_t *st) {
   }
 }
 
+static void
+stats_finished_single_op(stats_t *st) {
+  stats_finished_op(st, -1);
+}
+
 static void
 stats_add_bytes(stats_t *st, int64_t n) {
   st->bytes += n;
@@ -366,6 +375,33 @@ stats_report(stats_t *st, const char *name) {
   fflush(stdout);
 }
 
+/* Write the results to --json. */
+static void
+stats_record(const stats_t *st, const char *name, int num) {
+  harness_result_t res;
+  ldb_buffer_t msg;
+
+  ldb_buffer_init(&msg);
+  ldb_buffer_copy(&msg, &st->message);
+  ldb_buffer_push(&msg, '\0');
+
+  res.engine = "bdb";
+  res.name = name;
+  res.threads = 1;
+  res.num = num;
+  res.value_size = FLAGS_value_size;
+  res.done = st->done;
+  res.seconds = st->seconds;
+  res.elapsed = (st->finish - st->start) * 1e-6;
+  res.bytes = st->bytes;
+  res.hist = &st->hist;
+  res.message = (char *)msg.data;
+
+  harness_report(&res);
+
+  ldb_buffer_clear(&msg);
+}
+
 /*
  * Benchmark
  */
@@ -768,6 +804,138 @@ bench_read_random(bench_t *bench) {
   stats_add_message(&bench->stats, msg);
 }
 
+static void
+mixed_key(DBT *mkey, int k, char *key) {
+  memset(mkey, 0, sizeof(*mkey));
+
+  mkey->data = key;
+  mkey->size = sprintf(key, "%016d", k);
+}
+
+static int64_t
+mixed_get(void *ptr, int k) {
+  bench_t *bench = ptr;
+  DB *db = bench->db;
+  DBT mkey, mval;
+  char key[100];
+  int64_t n = -1;
+
+  mixed_key(&mkey, k, key);
+
+  memset(&mval, 0, sizeof(mval));
+
+  mval.flags = DB_DBT_MALLOC;
+
+  if (db->get(db, NULL, &mkey, &mval, 0) == 0) {
+    n = mval.size;
+    free(mval.data);
+  }
+
+  return n;
+}
+
+static int64_t
+mixed_put(void *ptr, int k, size_t size) {
+  bench_t *bench = ptr;
+  DB *db = bench->db;
+  DBT mkey, mval;
+  char key[100];
+  int rc;
+
+  mixed_key(&mkey, k, key);
+
+  memset(&mval, 0, sizeof(mval));
+
+  mval.data = (void *)rng_generate(&bench->gen, size);
+  mval.size = size;
+
+  rc = db->put(db, NULL, &mkey, &mval, 0);
+
+  if (rc != 0)
+    fprintf(stderr, "set error: %s\n", db_strerror(rc));
+
+  return 16 + size;
+}
+
+static void
+mixed_del(void *ptr, int k) {
+  bench_t *bench = ptr;
+  DB *db = bench->db;
+  char key[100];
+  DBT mkey;
+  int rc;
+
+  mixed_key(&mkey, k, key);
+
+  rc = db->del(db, NULL, &mkey, 0);
+
+  if (rc != 0 && rc != DB_NOTFOUND)
+    fprintf(stderr, "del error: %s\n", db_strerror(rc));
+}
+
+static int64_t
+mixed_scan(void *ptr, int k, int count) {
+  bench_t *bench = ptr;
+  DB_ENV *env = bench->env;
+  DB *db = bench->db;
+  DBT mkey, mval;
+  int64_t n = 0;
+  char key[100];
+  DB_TXN *txn;
+  DBC *cursor;
+  int j = 0;
+  int rc;
+
+  mixed_key(&mkey, k, key);
+
+  memset(&mval, 0, sizeof(mval));
+
+  env->txn_begin(env, NULL, &txn, 0);
+  db->cursor(db, txn, &cursor, 0);
+
+  rc = cursor->get(cursor, &mkey, &mval, DB_SET_RANGE);
+
+  while (rc == 0 && j < count) {
+    n += mkey.size + mval.size;
+    j++;
+
+    rc = cursor->get(cursor, &mkey, &mval, DB_NEXT);
+  }
+
+  cursor->close(cursor);
+  txn->abort(txn);
+
+  return j > 0 ? n : -1;
+}
+
+static void
+mixed_finished(void *stats, double begin) {
+  stats_finished_op(stats, begin);
+}
+
+static const harness_engine_t mixed_engine = {
+  mixed_get,
+  mixed_put,
+  mixed_del,
+  mixed_scan,
+  mixed_finished
+};
+
+static void
+bench_mixed(bench_t *bench) {
+  harness_mix_t mix;
+  char msg[200];
+
+  harness_mix_init(&mix);
+  harness_reset(bench->num);
+
+  harness_mixed(&mixed_engine, bench, &bench->stats, &bench->rnd,
+                bench->num, bench->reads, 1, FLAGS_value_size, &mix);
+
+  stats_add_bytes(&bench->stats, mix.bytes);
+  stats_add_message(&bench->stats, harness_mix_string(&mix, msg));
+}
+
 static void
 bench_run(bench_t *bench) {
   const char *benchmarks = FLAGS_benchmarks;
@@ -865,6 +1033,8 @@ bench_run(bench_t *bench) {
       bench->reads /= 1000;
       bench_read_sequential(bench);
       bench->reads = n;
+    } else if (strcmp(name, "mixed") == 0) {
+      bench_mixed(bench);
     } else {
       if (*name) /* No error message for empty name. */
         fprintf(stderr, "unknown benchmark '%s'\n", name);
@@ -875,6 +1045,7 @@ bench_run(bench_t *bench) {
     if (known) {
       stats_stop(&bench->stats);
       stats_report(&bench->stats, name);
+      stats_record(&bench->stats, name, bench->num);
     }
   }
 }
@@ -890,7 +1061,9 @@ main(int argc, char **argv) {
     double d;
     int n;
 
-    if (ldb_starts_with(argv[i], "--benchmarks=")) {
+    if (harness_parse_flag(argv[i])) {
+      /* See harness.h. */
+    } else if (ldb_starts_with(argv[i], "--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + 13;
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
@@ -927,5 +1100,7 @@ main(int argc, char **argv) {
   bench_run(&bench);
   bench_clear(&bench);
 
+  harness_close();
+
   return 0;
 }
@@ -28,6 +28,7 @@
 #include "util/strutil.h"
 #include "util/testutil.h"
 
+#include "harness.h"
 #include "histogram.h"
 
 /* Comma-separated list of operations to run in the specified order
@@ -46,6 +47,9 @@
  *      readhot       -- read N times in random order from 1% section of DB
  *      seekrandom    -- N random seeks
  *      seekordered   -- N ordered seeks
+ *      mixed         -- N reads, writes, scans and deletes, in the
+ *                       proportions given by the --*_ratio flags
+ *                       (see harness.h)
  *      open          -- cost of opening a DB
  *   Meta operations:
  *      compact     -- Compact the entire DB
@@ -274,11 +278,12 @@ stats_add_message(stats_t *st, const char *str) {
   append_with_space(&st->message, &msg);
 }
 
+/* Count an operation which began at `begin` (microseconds). */
 static void
-stats_finished_single_op(stats_t *st) {
-  if (FLAGS_histogram) {
+stats_finished_op(stats_t *st, double begin) {
+  if (FLAGS_histogram || harness_flags.json != NULL) {
     double now = ldb_now_usec();
-    double micros = now - st->last_op_finish;
+    double micros = now - (begin < 0 ? st->last_op_finish : begin);
 
     histogram_add(&st->hist, micros);
 
@@ -313,6 +318,11 @@ stats_finished_single_op(stats_t *st) {
   }
 }
 
+static void
+stats_finished_single_op(stats_t *st) {
+  stats_finished_op(st, -1);
+}
+
 static void
 stats_add_bytes(stats_t *st, int64_t n) {
   st->bytes += n;
@@ -360,6 +370,33 @@ stats_report(stats_t *st, const char *name) {
   fflush(stdout);
 }
 
+/* Write the results to --json. */
+static void
+stats_record(const stats_t *st, const char *name, int num) {
+  harness_result_t res;
+  ldb_buffer_t msg;
+
+  ldb_buffer_init(&msg);
+  ldb_buffer_copy(&msg, &st->message);
+  ldb_buffer_push(&msg, '\0');
+
+  res.engine = "leveldb";
+  res.name = name;
+  res.threads = 1;
+  res.num = num;
+  res.value_size = FLAGS_value_size;
+  res.done = st->done;
+  res.seconds = st->seconds;
+  res.elapsed = (st->finish - st->start) * 1e-6;
+  res.bytes = st->bytes;
+  res.hist = &st->hist;
+  res.message = (char *)msg.data;
+
+  harness_report(&res);
+
+  ldb_buffer_clear(&msg);
+}
+
 /*
  * BenchState
  */
@@ -581,6 +618,7 @@ run_benchmark(bench_t *bench, const char *name,
 
   stats_stop(&state.stats);
   stats_report(&state.stats, name);
+  stats_record(&state.stats, name, bench->num);
 
   bench_state_clear(&state);
 }
@@ -898,6 +936,150 @@ bench_do_delete(bench_t *bench, bench_state_t *state, int seq) {
   }
 }
 
+/* State of the mixed benchmark. */
+typedef struct mixed_state_s {
+  bench_t *bench;
+  rng_t gen;
+} mixed_state_t;
+
+static void
+mixed_check(char *err, const char *type) {
+  if (err != NULL) {
+    fprintf(stderr, "%s error: %s\n", type, err);
+    exit(1);
+  }
+}
+
+static int64_t
+mixed_get(void *db, int k) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  const char *key;
+  char buffer[1024];
+  char *err = NULL;
+  int64_t n = -1;
+  size_t val_size;
+  char *val;
+
+  key = key_encode(k, buffer);
+
+  val = leveldb_get(bench->db,
+                    bench->read_options,
+                    key,
+                    bench->key_size,
+                    &val_size,
+                    &err);
+
+  if (val != NULL) {
+    n = val_size;
+    leveldb_free(val);
+  }
+
+  free(err);
+
+  return n;
+}
+
+static int64_t
+mixed_put(void *db, int k, size_t size) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  const char *key, *val;
+  char buffer[1024];
+  char *err = NULL;
+
+  key = key_encode(k, buffer);
+  val = rng_generate(&ms->gen, size);
+
+  leveldb_put(bench->db, bench->write_options,
+              key, bench->key_size, val, size, &err);
+
+  mixed_check(err, "put");
+
+  return bench->key_size + size;
+}
+
+static void
+mixed_del(void *db, int k) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  char buffer[1024];
+  char *err = NULL;
+  const char *key;
+
+  key = key_encode(k, buffer);
+
+  leveldb_delete(bench->db, bench->write_options,
+                 key, bench->key_size, &err);
+
+  mixed_check(err, "del");
+}
+
+static int64_t
+mixed_scan(void *db, int k, int count) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  leveldb_iterator_t *iter;
+  char buffer[1024];
+  const char *key;
+  int64_t n = 0;
+  int j = 0;
+
+  iter = leveldb_create_iterator(bench->db, bench->read_options);
+  key = key_encode(k, buffer);
+
+  for (leveldb_iter_seek(iter, key, bench->key_size);
+       leveldb_iter_valid(iter) && j < count;
+       leveldb_iter_next(iter)) {
+    size_t key_size, val_size;
+
+    leveldb_iter_key(iter, &key_size);
+    leveldb_iter_value(iter, &val_size);
+
+    n += key_size + val_size;
+    j++;
+  }
+
+  leveldb_iter_destroy(iter);
+
+  return j > 0 ? n : -1;
+}
+
+static void
+mixed_finished(void *stats, double begin) {
+  stats_finished_op(stats, begin);
+}
+
+static const harness_engine_t mixed_engine = {
+  mixed_get,
+  mixed_put,
+  mixed_del,
+  mixed_scan,
+  mixed_finished
+};
+
+static void
+bench_mixed(bench_t *bench, bench_state_t *state) {
+  harness_mix_t mix;
+  mixed_state_t ms;
+  char msg[200];
+
+  ms.bench = bench;
+
+  rng_init(&ms.gen);
+
+  harness_mix_init(&mix);
+  harness_reset(FLAGS_num);
+
+  harness_mixed(&mixed_engine, &ms, &state->stats, &state->rnd,
+                FLAGS_num, bench->reads, 1, bench->val_size, &mix);
+
+  rng_clear(&ms.gen);
+
+  stats_add_bytes(&state->stats, mix.bytes);
+  stats_add_message(&state->stats, harness_mix_string(&mix, msg));
+}
+
 static void
 bench_delete_sequential(bench_t *bench, bench_state_t *state) {
   bench_do_delete(bench, state, 1);
@@ -1010,6 +1192,8 @@ bench_run(bench_t *bench) {
       method = &bench_seek_ordered;
     } else if (strcmp(name, "readhot") == 0) {
       method = &bench_read_hot;
+    } else if (strcmp(name, "mixed") == 0) {
+      method = &bench_mixed;
     } else if (strcmp(name, "readrandomsmall") == 0) {
       bench->reads /= 1000;
       method = &bench_read_random;
@@ -1068,7 +1252,9 @@ main(int argc, char **argv) {
     double d;
     int n;
 
-    if (ldb_starts_with(argv[i], "--benchmarks=")) {
+    if (harness_parse_flag(argv[i])) {
+      /* See harness.h. */
+    } else if (ldb_starts_with(argv[i], "--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + 13;
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
@@ -1121,5 +1307,7 @@ main(int argc, char **argv) {
   bench_run(&bench);
   bench_clear(&bench);
 
+  harness_close();
+
   return 0;
 }
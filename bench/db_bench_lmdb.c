@@ -27,6 +27,7 @@
 #include "util/strutil.h"
 #include "util/testutil.h"
 
+#include "harness.h"
 #include "histogram.h"
 
 /* Comma-separated list of operations to run in the specified order
@@ -45,6 +46,9 @@
  *      readhot       -- read N times in random order from 1% section of DB
  *      seekrandom    -- N random seeks
  *      seekordered   -- N ordered seeks
+ *      mixed         -- N reads, writes, scans and deletes, in the
+ *                       proportions given by the --*_ratio flags
+ *                       (see harness.h)
  *      open          -- cost of opening a DB
  *   Meta operations:
  *      stat       -- Print env stat
@@ -293,11 +297,12 @@ stats_add_message(stats_t *st, const char *str) {
   append_with_space(&st->message, &msg);
 }
 
+/* Count an operation which began at `begin` (microseconds). */
 static void
-stats_finished_single_op(stats_t *st) {
-  if (FLAGS_histogram) {
+stats_finished_op(stats_t *st, double begin) {
+  if (FLAGS_histogram || harness_flags.json != NULL) {
     double now = ldb_now_usec();
-    double micros = now - st->last_op_finish;
+    double micros = now - (begin < 0 ? st->last_op_finish : begin);
 
     histogram_add(&st->hist, micros);
 
@@ -332,6 +337,11 @@ stats_finished_single_op(stats_t *st) {
   }
 }
 
+static void
+stats_finished_single_op(stats_t *st) {
+  stats_finished_op(st, -1);
+}
+
 static void
 stats_add_bytes(stats_t *st, int64_t n) {
   st->bytes += n;
@@ -379,6 +389,33 @@ stats_report(stats_t *st, const char *name) {
   fflush(stdout);
 }
 
+/* Write the results to --json. */
+static void
+stats_record(const stats_t *st, const char *name, int num) {
+  harness_result_t res;
+  ldb_buffer_t msg;
+
+  ldb_buffer_init(&msg);
+  ldb_buffer_copy(&msg, &st->message);
+  ldb_buffer_push(&msg, '\0');
+
+  res.engine = "lmdb";
+  res.name = name;
+  res.threads = 1;
+  res.num = num;
+  res.value_size = FLAGS_value_size;
+  res.done = st->done;
+  res.seconds = st->seconds;
+  res.elapsed = (st->finish - st->start) * 1e-6;
+  res.bytes = st->bytes;
+  res.hist = &st->hist;
+  res.message = (char *)msg.data;
+
+  harness_report(&res);
+
+  ldb_buffer_clear(&msg);
+}
+
 /*
  * BenchState
  */
@@ -597,6 +634,7 @@ run_benchmark(bench_t *bench, const char *name,
 
   stats_stop(&state.stats);
   stats_report(&state.stats, name);
+  stats_record(&state.stats, name, bench->num);
 
   bench_state_clear(&state);
 }
@@ -948,6 +986,160 @@ bench_do_delete(bench_t *bench, bench_state_t *state, int seq) {
   }
 }
 
+/* State of the mixed benchmark. */
+typedef struct mixed_state_s {
+  bench_t *bench;
+  rng_t gen;
+} mixed_state_t;
+
+static int64_t
+mixed_get(void *db, int k) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  int rc = MDB_SUCCESS;
+  char buffer[1024];
+  int64_t n = -1;
+  MDB_val key, val;
+  MDB_txn *txn;
+
+  rc = mdb_txn_begin(bench->env, NULL, MDB_RDONLY, &txn);
+  error_check(rc, "txn");
+
+  key = key_encode(k, buffer);
+
+  rc = mdb_get(txn, bench->db, &key, &val);
+
+  if (rc != MDB_NOTFOUND)
+    error_check(rc, "get");
+
+  if (rc == MDB_SUCCESS)
+    n = val.mv_size;
+
+  mdb_txn_abort(txn);
+
+  return n;
+}
+
+static int64_t
+mixed_put(void *db, int k, size_t size) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  int rc = MDB_SUCCESS;
+  char buffer[1024];
+  MDB_val key, val;
+  MDB_txn *txn;
+
+  rc = mdb_txn_begin(bench->env, NULL, 0, &txn);
+  error_check(rc, "txn");
+
+  key = key_encode(k, buffer);
+  val = rng_generate(&ms->gen, size);
+
+  rc = mdb_put(txn, bench->db, &key, &val, 0);
+  error_check(rc, "put");
+
+  rc = mdb_txn_commit(txn);
+  error_check(rc, "commit");
+
+  return key.mv_size + val.mv_size;
+}
+
+static void
+mixed_del(void *db, int k) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  int rc = MDB_SUCCESS;
+  char buffer[1024];
+  MDB_txn *txn;
+  MDB_val key;
+
+  rc = mdb_txn_begin(bench->env, NULL, 0, &txn);
+  error_check(rc, "txn");
+
+  key = key_encode(k, buffer);
+
+  rc = mdb_del(txn, bench->db, &key, NULL);
+
+  if (rc != MDB_NOTFOUND)
+    error_check(rc, "del");
+
+  rc = mdb_txn_commit(txn);
+  error_check(rc, "commit");
+}
+
+static int64_t
+mixed_scan(void *db, int k, int count) {
+  mixed_state_t *ms = db;
+  bench_t *bench = ms->bench;
+  MDB_cursor *cur = NULL;
+  int rc = MDB_SUCCESS;
+  char buffer[1024];
+  MDB_val key, val;
+  int64_t n = 0;
+  MDB_txn *txn;
+  int j = 0;
+
+  rc = mdb_txn_begin(bench->env, NULL, MDB_RDONLY, &txn);
+  error_check(rc, "txn");
+
+  rc = mdb_cursor_open(txn, bench->db, &cur);
+  error_check(rc, "cursor");
+
+  key = key_encode(k, buffer);
+
+  rc = mdb_cursor_get(cur, &key, &val, MDB_SET_RANGE);
+
+  while (rc == MDB_SUCCESS && j < count) {
+    n += key.mv_size + val.mv_size;
+    j++;
+
+    rc = mdb_cursor_get(cur, &key, &val, MDB_NEXT);
+  }
+
+  if (rc != MDB_SUCCESS && rc != MDB_NOTFOUND)
+    error_check(rc, "get");
+
+  mdb_cursor_close(cur);
+  mdb_txn_abort(txn);
+
+  return j > 0 ? n : -1;
+}
+
+static void
+mixed_finished(void *stats, double begin) {
+  stats_finished_op(stats, begin);
+}
+
+static const harness_engine_t mixed_engine = {
+  mixed_get,
+  mixed_put,
+  mixed_del,
+  mixed_scan,
+  mixed_finished
+};
+
+static void
+bench_mixed(bench_t *bench, bench_state_t *state) {
+  harness_mix_t mix;
+  mixed_state_t ms;
+  char msg[200];
+
+  ms.bench = bench;
+
+  rng_init(&ms.gen);
+
+  harness_mix_init(&mix);
+  harness_reset(FLAGS_num);
+
+  harness_mixed(&mixed_engine, &ms, &state->stats, &state->rnd,
+                FLAGS_num, bench->reads, 1, bench->val_size, &mix);
+
+  rng_clear(&ms.gen);
+
+  stats_add_bytes(&state->stats, mix.bytes);
+  stats_add_message(&state->stats, harness_mix_string(&mix, msg));
+}
+
 static void
 bench_delete_sequential(bench_t *bench, bench_state_t *state) {
   bench_do_delete(bench, state, 1);
@@ -1090,6 +1282,8 @@ bench_run(bench_t *bench) {
       method = &bench_seek_ordered;
     } else if (strcmp(name, "readhot") == 0) {
       method = &bench_read_hot;
+    } else if (strcmp(name, "mixed") == 0) {
+      method = &bench_mixed;
     } else if (strcmp(name, "readrandomsmall") == 0) {
       bench->reads /= 1000;
       method = &bench_read_random;
@@ -1142,7 +1336,9 @@ main(int argc, char **argv) {
     double d;
     int n;
 
-    if (ldb_starts_with(argv[i], "--benchmarks=")) {
+    if (harness_parse_flag(argv[i])) {
+      /* See harness.h. */
+    } else if (ldb_starts_with(argv[i], "--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + 13;
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
@@ -1203,5 +1399,7 @@ main(int argc, char **argv) {
   bench_run(&bench);
   bench_clear(&bench);
 
+  harness_close();
+
   return 0;
 }
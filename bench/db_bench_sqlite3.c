@@ -27,6 +27,7 @@
 #include "util/strutil.h"
 #include "util/testutil.h"
 
+#include "harness.h"
 #include "histogram.h"
 
 /* Comma-separated list of operations to run in the specified order
@@ -44,6 +45,8 @@
  *   readseq       -- read N times sequentially
  *   readrandom    -- read N times in random order
  *   readrand100K  -- read N/1000 100K values in sequential order in async mode
+ *   mixed         -- N reads, writes, scans and deletes, in the proportions
+ *                    given by the --*_ratio flags (see harness.h)
  */
 static const char *FLAGS_benchmarks =
     "fillseq,"
@@ -279,11 +282,12 @@ stats_add_message(stats_t *st, const char *str) {
   append_with_space(&st->message, &msg);
 }
 
+/* Count an operation which began at `begin` (microseconds). */
 static void
-stats_finished_single_op(stats_t *st) {
-  if (FLAGS_histogram) {
+stats_finished_op(stats_t *st, double begin) {
+  if (FLAGS_histogram || harness_flags.json != NULL) {
     double now = ldb_now_usec();
-    double micros = now - st->last_op_finish;
+    double micros = now - (begin < 0 ? st->last_op_finish : begin);
 
     histogram_add(&st->hist, micros);
 
@@ -318,6 +322,11 @@ stats_finished_single_op(stats_t *st) {
   }
 }
 
+static void
+stats_finished_single_op(stats_t *st) {
+  stats_finished_op(st, -1);
+}
+
 static void
 stats_add_bytes(stats_t *st, int64_t n) {
   st->bytes += n;
@@ -365,6 +374,33 @@ stats_report(stats_t *st, const char *name) {
   fflush(stdout);
 }
 
+/* Write the results to --json. */
+static void
+stats_record(const stats_t *st, const char *name, int num) {
+  harness_result_t res;
+  ldb_buffer_t msg;
+
+  ldb_buffer_init(&msg);
+  ldb_buffer_copy(&msg, &st->message);
+  ldb_buffer_push(&msg, '\0');
+
+  res.engine = "sqlite3";
+  res.name = name;
+  res.threads = 1;
+  res.num = num;
+  res.value_size = FLAGS_value_size;
+  res.done = st->done;
+  res.seconds = st->seconds;
+  res.elapsed = (st->finish - st->start) * 1e-6;
+  res.bytes = st->bytes;
+  res.hist = &st->hist;
+  res.message = (char *)msg.data;
+
+  harness_report(&res);
+
+  ldb_buffer_clear(&msg);
+}
+
 /*
  * Benchmark
  */
@@ -810,6 +846,175 @@ bench_read_sequential(bench_t *bench) {
   error_check(status);
 }
 
+/* State of the mixed benchmark. */
+typedef struct mixed_state_s {
+  bench_t *bench;
+  sqlite3_stmt *get_stmt;
+  sqlite3_stmt *put_stmt;
+  sqlite3_stmt *del_stmt;
+  sqlite3_stmt *scan_stmt;
+  rng_t gen;
+} mixed_state_t;
+
+static void
+mixed_prepare(sqlite3 *db, const char *str, sqlite3_stmt **stmt) {
+  int status = sqlite3_prepare_v2(db, str, -1, stmt, NULL);
+  error_check(status);
+}
+
+static void
+mixed_reset(sqlite3_stmt *stmt) {
+  int status = sqlite3_clear_bindings(stmt);
+  error_check(status);
+
+  status = sqlite3_reset(stmt);
+  error_check(status);
+}
+
+static void
+mixed_bind_key(sqlite3_stmt *stmt, int k, char *key) {
+  int status;
+
+  sprintf(key, "%016d", k);
+
+  status = sqlite3_bind_blob(stmt, 1, key, 16, SQLITE_STATIC);
+  error_check(status);
+}
+
+/* Step through the rows of a query, returning their size (or -1). */
+static int64_t
+mixed_rows(sqlite3_stmt *stmt) {
+  int64_t bytes = -1;
+  int status;
+
+  while ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (bytes < 0)
+      bytes = 0;
+
+    bytes += sqlite3_column_bytes(stmt, 0);
+    bytes += sqlite3_column_bytes(stmt, 1);
+  }
+
+  step_error_check(status);
+
+  mixed_reset(stmt);
+
+  return bytes;
+}
+
+static int64_t
+mixed_get(void *db, int k) {
+  mixed_state_t *ms = db;
+  char key[100];
+
+  mixed_bind_key(ms->get_stmt, k, key);
+
+  return mixed_rows(ms->get_stmt);
+}
+
+static int64_t
+mixed_put(void *db, int k, size_t size) {
+  mixed_state_t *ms = db;
+  const char *value = rng_generate(&ms->gen, size);
+  char key[100];
+  int status;
+
+  mixed_bind_key(ms->put_stmt, k, key);
+
+  status = sqlite3_bind_blob(ms->put_stmt, 2, value, size, SQLITE_STATIC);
+  error_check(status);
+
+  status = sqlite3_step(ms->put_stmt);
+  step_error_check(status);
+
+  mixed_reset(ms->put_stmt);
+
+  return 16 + size;
+}
+
+static void
+mixed_del(void *db, int k) {
+  mixed_state_t *ms = db;
+  char key[100];
+  int status;
+
+  mixed_bind_key(ms->del_stmt, k, key);
+
+  status = sqlite3_step(ms->del_stmt);
+  step_error_check(status);
+
+  mixed_reset(ms->del_stmt);
+}
+
+static int64_t
+mixed_scan(void *db, int k, int count) {
+  mixed_state_t *ms = db;
+  char key[100];
+  int status;
+
+  mixed_bind_key(ms->scan_stmt, k, key);
+
+  status = sqlite3_bind_int(ms->scan_stmt, 2, count);
+  error_check(status);
+
+  return mixed_rows(ms->scan_stmt);
+}
+
+static void
+mixed_finished(void *stats, double begin) {
+  stats_finished_op(stats, begin);
+}
+
+static const harness_engine_t mixed_engine = {
+  mixed_get,
+  mixed_put,
+  mixed_del,
+  mixed_scan,
+  mixed_finished
+};
+
+static void
+bench_mixed(bench_t *bench) {
+  sqlite3 *db = bench->db;
+  harness_mix_t mix;
+  mixed_state_t ms;
+  char msg[200];
+  int status;
+
+  ms.bench = bench;
+
+  status = sqlite3_exec(db, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+  error_check(status);
+
+  mixed_prepare(db, "SELECT key, value FROM test WHERE key = ?",
+                &ms.get_stmt);
+  mixed_prepare(db, "REPLACE INTO test (key, value) VALUES (?, ?)",
+                &ms.put_stmt);
+  mixed_prepare(db, "DELETE FROM test WHERE key = ?",
+                &ms.del_stmt);
+  mixed_prepare(db, "SELECT key, value FROM test WHERE key >= ?"
+                    " ORDER BY key LIMIT ?",
+                &ms.scan_stmt);
+
+  rng_init(&ms.gen);
+
+  harness_mix_init(&mix);
+  harness_reset(bench->num);
+
+  harness_mixed(&mixed_engine, &ms, &bench->stats, &bench->rnd,
+                bench->num, bench->reads, 1, FLAGS_value_size, &mix);
+
+  rng_clear(&ms.gen);
+
+  sqlite3_finalize(ms.get_stmt);
+  sqlite3_finalize(ms.put_stmt);
+  sqlite3_finalize(ms.del_stmt);
+  sqlite3_finalize(ms.scan_stmt);
+
+  stats_add_bytes(&bench->stats, mix.bytes);
+  stats_add_message(&bench->stats, harness_mix_string(&mix, msg));
+}
+
 static void
 bench_run(bench_t *bench) {
   const char *benchmarks = FLAGS_benchmarks;
@@ -897,6 +1102,9 @@ bench_run(bench_t *bench) {
       bench->reads /= 1000;
       bench_read(bench, RANDOM, 1);
       bench->reads = n;
+    } else if (strcmp(name, "mixed") == 0) {
+      bench_mixed(bench);
+      wal_checkpoint(bench->db);
     } else {
       if (*name) /* No error message for empty name. */
         fprintf(stderr, "unknown benchmark '%s'\n", name);
@@ -907,6 +1115,7 @@ bench_run(bench_t *bench) {
     if (known) {
       stats_stop(&bench->stats);
       stats_report(&bench->stats, name);
+      stats_record(&bench->stats, name, bench->num);
     }
   }
 }
@@ -922,7 +1131,9 @@ main(int argc, char **argv) {
     double d;
     int n;
 
-    if (ldb_starts_with(argv[i], "--benchmarks=")) {
+    if (harness_parse_flag(argv[i])) {
+      /* See harness.h. */
+    } else if (ldb_starts_with(argv[i], "--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + 13;
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
@@ -972,5 +1183,7 @@ main(int argc, char **argv) {
   bench_run(&bench);
   bench_clear(&bench);
 
+  harness_close();
+
   return 0;
 }
@@ -27,6 +27,7 @@
 #include "util/strutil.h"
 #include "util/testutil.h"
 
+#include "harness.h"
 #include "histogram.h"
 
 /* Comma-separated list of operations to run in the specified order
@@ -43,6 +44,8 @@
  *   readseq100K   -- read N/1000 100K values in sequential order in async mode
  *   readrand100K  -- read N/1000 100K values in sequential order in async mode
  *   readrandom    -- read N times in random order
+ *   mixed         -- N reads, writes, scans and deletes, in the proportions
+ *                    given by the --*_ratio flags (see harness.h)
  */
 static const char *FLAGS_benchmarks =
     "fillseq,"
@@ -244,11 +247,12 @@ stats_add_message(stats_t *st, const char *str) {
   append_with_space(&st->message, &msg);
 }
 
+/* Count an operation which began at `begin` (microseconds). */
 static void
-stats_finished_single_op(stats_t *st) {
-  if (FLAGS_histogram) {
+stats_finished_op(stats_t *st, double begin) {
+  if (FLAGS_histogram || harness_flags.json != NULL) {
     double now = ldb_now_usec();
-    double micros = now - st->last_op_finish;
+    double micros = now - (begin < 0 ? st->last_op_finish : begin);
 
     histogram_add(&st->hist, micros);
 
@@ -283,6 +287,11 @@ stats_finished_single_op(stats_t *st) {
   }
 }
 
+static void
+stats_finished_single_op(stats_t *st) {
+  stats_finished_op(st, -1);
+}
+
 static void
 stats_add_bytes(stats_t *st, int64_t n) {
   st->bytes += n;
@@ -330,6 +339,33 @@ stats_report(stats_t *st, const char *name) {
   fflush(stdout);
 }
 
+/* Write the results to --json. */
+static void
+stats_record(const stats_t *st, const char *name, int num) {
+  harness_result_t res;
+  ldb_buffer_t msg;
+
+  ldb_buffer_init(&msg);
+  ldb_buffer_copy(&msg, &st->message);
+  ldb_buffer_push(&msg, '\0');
+
+  res.engine = "kyotocabinet";
+  res.name = name;
+  res.threads = 1;
+  res.num = num;
+  res.value_size = FLAGS_value_size;
+  res.done = st->done;
+  res.seconds = st->seconds;
+  res.elapsed = (st->finish - st->start) * 1e-6;
+  res.bytes = st->bytes;
+  res.hist = &st->hist;
+  res.message = (char *)msg.data;
+
+  harness_report(&res);
+
+  ldb_buffer_clear(&msg);
+}
+
 /*
  * Benchmark
  */
@@ -636,6 +672,104 @@ bench_read_random(bench_t *bench) {
   stats_add_message(&bench->stats, msg);
 }
 
+static int64_t
+mixed_get(void *ptr, int k) {
+  bench_t *bench = ptr;
+  int64_t n = -1;
+  char key[100];
+  size_t vsize;
+  char *val;
+
+  sprintf(key, "%016d", k);
+
+  val = kcdbget(bench->db, key, 16, &vsize);
+
+  if (val != NULL) {
+    n = vsize;
+    kcfree(val);
+  }
+
+  return n;
+}
+
+static int64_t
+mixed_put(void *ptr, int k, size_t size) {
+  bench_t *bench = ptr;
+  const char *value = rng_generate(&bench->gen, size);
+  char key[100];
+
+  sprintf(key, "%016d", k);
+
+  if (!kcdbset(bench->db, key, 16, value, size))
+    fprintf(stderr, "set error: %s\n", kcdbemsg(bench->db));
+
+  return 16 + size;
+}
+
+static void
+mixed_del(void *ptr, int k) {
+  bench_t *bench = ptr;
+  char key[100];
+
+  sprintf(key, "%016d", k);
+
+  kcdbremove(bench->db, key, 16);
+}
+
+static int64_t
+mixed_scan(void *ptr, int k, int count) {
+  bench_t *bench = ptr;
+  KCCUR *cur = kcdbcursor(bench->db);
+  size_t ksize, vsize;
+  const char *val;
+  int64_t n = 0;
+  char key[100];
+  char *ckey;
+  int j = 0;
+
+  sprintf(key, "%016d", k);
+
+  if (kccurjumpkey(cur, key, 16)) {
+    while (j < count && (ckey = kccurget(cur, &ksize, &val, &vsize, 1))) {
+      n += ksize + vsize;
+      kcfree(ckey);
+      j++;
+    }
+  }
+
+  kccurdel(cur);
+
+  return j > 0 ? n : -1;
+}
+
+static void
+mixed_finished(void *stats, double begin) {
+  stats_finished_op(stats, begin);
+}
+
+static const harness_engine_t mixed_engine = {
+  mixed_get,
+  mixed_put,
+  mixed_del,
+  mixed_scan,
+  mixed_finished
+};
+
+static void
+bench_mixed(bench_t *bench) {
+  harness_mix_t mix;
+  char msg[200];
+
+  harness_mix_init(&mix);
+  harness_reset(bench->num);
+
+  harness_mixed(&mixed_engine, bench, &bench->stats, &bench->rnd,
+                bench->num, bench->reads, 1, FLAGS_value_size, &mix);
+
+  stats_add_bytes(&bench->stats, mix.bytes);
+  stats_add_message(&bench->stats, harness_mix_string(&mix, msg));
+}
+
 static void
 bench_run(bench_t *bench) {
   const char *benchmarks = FLAGS_benchmarks;
@@ -716,6 +850,9 @@ bench_run(bench_t *bench) {
       bench->reads /= 1000;
       bench_read_sequential(bench);
       bench->reads = n;
+    } else if (strcmp(name, "mixed") == 0) {
+      bench_mixed(bench);
+      db_synchronize(bench->db);
     } else {
       if (*name) /* No error message for empty name. */
         fprintf(stderr, "unknown benchmark '%s'\n", name);
@@ -726,6 +863,7 @@ bench_run(bench_t *bench) {
     if (known) {
       stats_stop(&bench->stats);
       stats_report(&bench->stats, name);
+      stats_record(&bench->stats, name, bench->num);
     }
   }
 }
@@ -741,7 +879,9 @@ main(int argc, char **argv) {
     double d;
     int n;
 
-    if (ldb_starts_with(argv[i], "--benchmarks=")) {
+    if (harness_parse_flag(argv[i])) {
+      /* See harness.h. */
+    } else if (ldb_starts_with(argv[i], "--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + 13;
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
@@ -783,5 +923,7 @@ main(int argc, char **argv) {
   bench_run(&bench);
   bench_clear(&bench);
 
+  harness_close();
+
   return 0;
 }
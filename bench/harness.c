@@ -0,0 +1,421 @@
+/*!
+ * harness.c - shared benchmark harness for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/atomic.h"
+#include "util/env.h"
+#include "util/internal.h"
+#include "util/random.h"
+#include "util/strutil.h"
+
+#include "harness.h"
+#include "histogram.h"
+
+/*
+ * Globals
+ */
+
+harness_flags_t harness_flags = {
+  /* .read_ratio = */ 50,
+  /* .write_ratio = */ 50,
+  /* .scan_ratio = */ 0,
+  /* .delete_ratio = */ 0,
+  /* .scan_length = */ 100,
+  /* .key_dist = */ KEY_UNIFORM,
+  /* .value_size_dist = */ VALUE_FIXED,
+  /* .value_size_min = */ 16,
+  /* .value_size_max = */ 1024,
+  /* .ops_per_sec = */ 0,
+  /* .json = */ NULL
+};
+
+/* Next key appended by "latest" writes. */
+static ldb_atomic(int) harness_latest = 0;
+
+static FILE *harness_json = NULL;
+
+/*
+ * Flags
+ */
+
+static int
+parse_int(const char *arg, const char *name, int *z, int min, int max) {
+  size_t len = strlen(name);
+  char junk;
+  int n;
+
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return 0;
+
+  if (sscanf(arg + len + 1, "%d%c", &n, &junk) != 1)
+    return 0;
+
+  if (n < min || n > max)
+    return 0;
+
+  *z = n;
+
+  return 1;
+}
+
+int
+harness_parse_flag(const char *arg) {
+  harness_flags_t *f = &harness_flags;
+
+  if (parse_int(arg, "--read_ratio", &f->read_ratio, 0, INT_MAX / 4))
+    return 1;
+
+  if (parse_int(arg, "--write_ratio", &f->write_ratio, 0, INT_MAX / 4))
+    return 1;
+
+  if (parse_int(arg, "--scan_ratio", &f->scan_ratio, 0, INT_MAX / 4))
+    return 1;
+
+  if (parse_int(arg, "--delete_ratio", &f->delete_ratio, 0, INT_MAX / 4))
+    return 1;
+
+  if (parse_int(arg, "--scan_length", &f->scan_length, 0, INT_MAX))
+    return 1;
+
+  if (parse_int(arg, "--value_size_min", &f->value_size_min, 0, 1048575))
+    return 1;
+
+  if (parse_int(arg, "--value_size_max", &f->value_size_max, 0, 1048575))
+    return 1;
+
+  if (parse_int(arg, "--ops_per_sec", &f->ops_per_sec, 0, INT_MAX))
+    return 1;
+
+  if (strcmp(arg, "--key_dist=uniform") == 0)
+    f->key_dist = KEY_UNIFORM;
+  else if (strcmp(arg, "--key_dist=zipfian") == 0)
+    f->key_dist = KEY_ZIPFIAN;
+  else if (strcmp(arg, "--key_dist=latest") == 0)
+    f->key_dist = KEY_LATEST;
+  else if (strcmp(arg, "--value_size_dist=fixed") == 0)
+    f->value_size_dist = VALUE_FIXED;
+  else if (strcmp(arg, "--value_size_dist=uniform") == 0)
+    f->value_size_dist = VALUE_UNIFORM;
+  else if (strcmp(arg, "--value_size_dist=skewed") == 0)
+    f->value_size_dist = VALUE_SKEWED;
+  else if (ldb_starts_with(arg, "--json="))
+    f->json = arg + 7;
+  else
+    return 0;
+
+  return 1;
+}
+
+/*
+ * Distributions
+ */
+
+/* A number below n, skewed towards zero: the order of magnitude is
+   chosen uniformly, giving a power law with an exponent of about 1. */
+static int
+skewed_below(ldb_rand_t *rnd, int n) {
+  int bits = 0;
+
+  while (bits < 30 && (1 << bits) < n)
+    bits++;
+
+  for (;;) {
+    int k = ldb_rand_skewed(rnd, bits);
+
+    if (k < n)
+      return k;
+  }
+}
+
+static int
+next_op(ldb_rand_t *rnd) {
+  const harness_flags_t *f = &harness_flags;
+  int total = f->read_ratio + f->write_ratio + f->scan_ratio + f->delete_ratio;
+  int r = ldb_rand_uniform(rnd, total);
+
+  if (r < f->read_ratio)
+    return HARNESS_READ;
+
+  r -= f->read_ratio;
+
+  if (r < f->write_ratio)
+    return HARNESS_WRITE;
+
+  r -= f->write_ratio;
+
+  if (r < f->scan_ratio)
+    return HARNESS_SCAN;
+
+  return HARNESS_DELETE;
+}
+
+static int
+next_key(ldb_rand_t *rnd, int num, int op) {
+  switch (harness_flags.key_dist) {
+    case KEY_ZIPFIAN: {
+      /* Scatter the hot keys so they do not share blocks. */
+      uint32_t rank = skewed_below(rnd, num);
+      return (int)((rank * UINT32_C(2654435761)) % (uint32_t)num);
+    }
+
+    case KEY_LATEST: {
+      int n;
+
+      if (op == HARNESS_WRITE)
+        return ldb_atomic_fetch_add(&harness_latest, 1, ldb_order_relaxed);
+
+      n = ldb_atomic_load(&harness_latest, ldb_order_relaxed);
+
+      if (n <= 0)
+        return 0;
+
+      return n - 1 - skewed_below(rnd, n);
+    }
+  }
+
+  return ldb_rand_uniform(rnd, num);
+}
+
+static size_t
+next_value_size(ldb_rand_t *rnd, int fixed) {
+  int lo = LDB_MIN(harness_flags.value_size_min, harness_flags.value_size_max);
+  int hi = LDB_MAX(harness_flags.value_size_min, harness_flags.value_size_max);
+
+  switch (harness_flags.value_size_dist) {
+    case VALUE_UNIFORM:
+      return lo + ldb_rand_uniform(rnd, hi - lo + 1);
+    case VALUE_SKEWED:
+      return lo + skewed_below(rnd, hi - lo + 1);
+  }
+
+  return fixed;
+}
+
+/*
+ * Pacing
+ */
+
+void
+harness_pace_init(harness_pace_t *pace, int threads) {
+  pace->interval = 0;
+  pace->due = 0;
+
+  if (harness_flags.ops_per_sec > 0) {
+    pace->interval = 1e6 * threads / harness_flags.ops_per_sec;
+    pace->due = ldb_now_usec();
+  }
+}
+
+double
+harness_pace(harness_pace_t *pace, int count) {
+  double begin, now;
+
+  if (pace->interval <= 0)
+    return -1;
+
+  now = ldb_now_usec();
+
+  if (pace->due > now)
+    ldb_sleep_usec((int64_t)(pace->due - now));
+
+  begin = pace->due;
+
+  pace->due += pace->interval * count;
+
+  return begin;
+}
+
+/*
+ * Mixed Workload
+ */
+
+void
+harness_reset(int num) {
+  /* Keys appended by earlier runs still exist. */
+  if (ldb_atomic_load(&harness_latest, ldb_order_relaxed) < num)
+    ldb_atomic_store(&harness_latest, num, ldb_order_relaxed);
+}
+
+void
+harness_mix_init(harness_mix_t *mix) {
+  memset(mix, 0, sizeof(*mix));
+}
+
+void
+harness_mix_add(harness_mix_t *z, const harness_mix_t *x) {
+  int i;
+
+  for (i = 0; i < 4; i++)
+    z->ops[i] += x->ops[i];
+
+  z->found += x->found;
+  z->bytes += x->bytes;
+}
+
+char *
+harness_mix_string(const harness_mix_t *mix, char *buf) {
+  sprintf(buf, "(%.0f reads, %.0f writes, %.0f scans, %.0f deletes;"
+               " %.0f found)",
+               (double)mix->ops[HARNESS_READ],
+               (double)mix->ops[HARNESS_WRITE],
+               (double)mix->ops[HARNESS_SCAN],
+               (double)mix->ops[HARNESS_DELETE],
+               (double)mix->found);
+  return buf;
+}
+
+void
+harness_mixed(const harness_engine_t *engine,
+              void *db,
+              void *stats,
+              ldb_rand_t *rnd,
+              int num,
+              int count,
+              int threads,
+              int value_size,
+              harness_mix_t *mix) {
+  const harness_flags_t *f = &harness_flags;
+  harness_pace_t pace;
+  int i;
+
+  if (f->read_ratio + f->write_ratio + f->scan_ratio + f->delete_ratio <= 0) {
+    fprintf(stderr, "mixed requires a positive --*_ratio\n");
+    exit(1);
+  }
+
+  harness_pace_init(&pace, threads);
+
+  for (i = 0; i < count; i++) {
+    int op = next_op(rnd);
+    int k = next_key(rnd, num, op);
+    double begin = harness_pace(&pace, 1);
+    int64_t n = 0;
+
+    switch (op) {
+      case HARNESS_READ: {
+        n = engine->get(db, k);
+        break;
+      }
+
+      case HARNESS_WRITE: {
+        n = engine->put(db, k, next_value_size(rnd, value_size));
+        break;
+      }
+
+      case HARNESS_SCAN: {
+        n = engine->scan(db, k, f->scan_length);
+        break;
+      }
+
+      case HARNESS_DELETE: {
+        engine->del(db, k);
+        break;
+      }
+    }
+
+    if (op == HARNESS_READ || op == HARNESS_SCAN)
+      mix->found += (n >= 0);
+
+    if (n > 0)
+      mix->bytes += n;
+
+    mix->ops[op]++;
+
+    engine->finished(stats, begin);
+  }
+}
+
+/*
+ * JSON Reports
+ */
+
+static void
+json_string(FILE *stream, const char *str) {
+  fputc('"', stream);
+
+  for (; *str; str++) {
+    int ch = *str & 0xff;
+
+    if (ch == '"' || ch == '\\')
+      fprintf(stream, "\\%c", ch);
+    else if (ch < 0x20)
+      fprintf(stream, "\\u%04x", ch);
+    else
+      fputc(ch, stream);
+  }
+
+  fputc('"', stream);
+}
+
+static void
+json_number(FILE *stream, const char *key, double value) {
+  fprintf(stream, ",\"%s\":%.3f", key, value);
+}
+
+void
+harness_report(const harness_result_t *res) {
+  int done = res->done > 0 ? res->done : 1;
+  FILE *stream;
+
+  if (harness_flags.json == NULL)
+    return;
+
+  if (harness_json == NULL) {
+    harness_json = fopen(harness_flags.json, "a");
+
+    if (harness_json == NULL) {
+      fprintf(stderr, "cannot open %s\n", harness_flags.json);
+      exit(1);
+    }
+  }
+
+  stream = harness_json;
+
+  fputs("{\"engine\":", stream);
+  json_string(stream, res->engine);
+  fputs(",\"benchmark\":", stream);
+  json_string(stream, res->name);
+
+  fprintf(stream, ",\"threads\":%d,\"num\":%d,\"value_size\":%d"
+                  ",\"ops\":%d",
+                  res->threads, res->num, res->value_size, res->done);
+
+  json_number(stream, "seconds", res->elapsed);
+  json_number(stream, "micros_per_op", res->seconds * 1e6 / done);
+  json_number(stream, "ops_per_sec",
+              res->elapsed > 0 ? res->done / res->elapsed : 0);
+  json_number(stream, "mb_per_sec",
+              res->elapsed > 0 ? (res->bytes / 1048576.0) / res->elapsed : 0);
+
+  if (res->hist != NULL && res->hist->num > 0) {
+    json_number(stream, "p50_micros", histogram_percentile(res->hist, 50.0));
+    json_number(stream, "p99_micros", histogram_percentile(res->hist, 99.0));
+    json_number(stream, "p999_micros", histogram_percentile(res->hist, 99.9));
+    json_number(stream, "max_micros", res->hist->max);
+  }
+
+  fputs(",\"message\":", stream);
+  json_string(stream, res->message != NULL ? res->message : "");
+  fputs("}\n", stream);
+
+  fflush(stream);
+}
+
+void
+harness_close(void) {
+  if (harness_json != NULL)
+    fclose(harness_json);
+
+  harness_json = NULL;
+}
@@ -0,0 +1,171 @@
+/*!
+ * harness.h - shared benchmark harness for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "util/random.h"
+#include "histogram.h"
+
+/*
+ * Constants
+ */
+
+enum harness_op {
+  HARNESS_READ,
+  HARNESS_WRITE,
+  HARNESS_SCAN,
+  HARNESS_DELETE
+};
+
+/* Zipfian keys are skewed towards a few hot keys scattered over the
+   key space; "latest" keys are skewed towards the most recent writes,
+   which append new keys. */
+enum harness_key_dist {
+  KEY_UNIFORM,
+  KEY_ZIPFIAN,
+  KEY_LATEST
+};
+
+/* Uniform and skewed sizes lie between value_size_min and
+   value_size_max, skewed sizes favoring the small end. */
+enum harness_value_dist {
+  VALUE_FIXED,
+  VALUE_UNIFORM,
+  VALUE_SKEWED
+};
+
+/*
+ * Types
+ */
+
+/* Workload flags understood by every engine's benchmark. */
+typedef struct harness_flags_s {
+  /* Relative weights of each operation in the mixed benchmark. */
+  int read_ratio;
+  int write_ratio;
+  int scan_ratio;
+  int delete_ratio;
+  /* Number of entries read by each scan. */
+  int scan_length;
+  int key_dist;
+  int value_size_dist;
+  int value_size_min;
+  int value_size_max;
+  /* Total operations per second aimed for across all threads (0
+     means as fast as possible). Operations are then issued on a
+     fixed schedule, whether or not earlier ones have finished, and
+     latencies are measured from when each operation was due. */
+  int ops_per_sec;
+  /* Append a JSON record of each benchmark's results to this file. */
+  const char *json;
+} harness_flags_t;
+
+/* An engine's operations, for the mixed benchmark. Keys are indexes,
+   to be encoded the way the engine's other benchmarks encode them. */
+typedef struct harness_engine_s {
+  /* Return the bytes read, or -1 if the key was not found. */
+  int64_t (*get)(void *db, int k);
+  /* Write a value of `size` bytes, and return the bytes written. */
+  int64_t (*put)(void *db, int k, size_t size);
+  void (*del)(void *db, int k);
+  /* Read up to `count` entries from `k` on, and return the bytes
+     read (or -1 if there were none). */
+  int64_t (*scan)(void *db, int k, int count);
+  /* Count an operation which began at `begin` (microseconds), or
+     after the last one (if `begin` is negative). */
+  void (*finished)(void *stats, double begin);
+} harness_engine_t;
+
+/* One thread's share of the --ops_per_sec schedule. */
+typedef struct harness_pace_s {
+  double interval; /* Microseconds between operations (0 if unpaced). */
+  double due;
+} harness_pace_t;
+
+typedef struct harness_mix_s {
+  int64_t ops[4]; /* By enum harness_op. */
+  int64_t found;
+  int64_t bytes;
+} harness_mix_t;
+
+typedef struct harness_result_s {
+  const char *engine;
+  const char *name;
+  int threads;
+  int num;
+  int value_size;
+  int done;
+  double seconds; /* Summed over threads. */
+  double elapsed;
+  int64_t bytes;
+  const histogram_t *hist; /* NULL if latencies were not gathered. */
+  const char *message;
+} harness_result_t;
+
+/*
+ * Globals
+ */
+
+extern harness_flags_t harness_flags;
+
+/*
+ * Harness
+ */
+
+/* Parse a workload flag. Returns zero if `arg` is not one. */
+int
+harness_parse_flag(const char *arg);
+
+/* Prepare for a mixed benchmark over `num` existing keys. */
+void
+harness_reset(int num);
+
+/* Start pacing one of `threads` threads at --ops_per_sec. */
+void
+harness_pace_init(harness_pace_t *pace, int threads);
+
+/* Wait until the next `count` operations are due, and return when
+   that was (or -1 if unpaced). A thread which falls behind does not
+   wait, and the operations it delays are charged for it. */
+double
+harness_pace(harness_pace_t *pace, int count);
+
+/* Run `count` mixed operations on one of `threads` threads, over
+   keys below `num`. Fixed-size values are `value_size` bytes. */
+void
+harness_mixed(const harness_engine_t *engine,
+              void *db,
+              void *stats,
+              ldb_rand_t *rnd,
+              int num,
+              int count,
+              int threads,
+              int value_size,
+              harness_mix_t *mix);
+
+void
+harness_mix_init(harness_mix_t *mix);
+
+void
+harness_mix_add(harness_mix_t *z, const harness_mix_t *x);
+
+/* Describe a mix (at most 200 bytes). */
+char *
+harness_mix_string(const harness_mix_t *mix, char *buf);
+
+/* Write a JSON record of a benchmark's results (if --json is set). */
+void
+harness_report(const harness_result_t *res);
+
+void
+harness_close(void);
+
+#endif /* HARNESS_H */
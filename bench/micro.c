@@ -0,0 +1,783 @@
+/*!
+ * micro.c - microbenchmarks for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/arena.h"
+#include "util/bloom.h"
+#include "util/buffer.h"
+#include "util/cache.h"
+#include "util/coding.h"
+#include "util/comparator.h"
+#include "util/env.h"
+#include "util/internal.h"
+#include "util/options.h"
+#include "util/port.h"
+#include "util/random.h"
+#include "util/slice.h"
+#include "util/status.h"
+#include "util/strutil.h"
+
+#include "table/block.h"
+#include "table/block_builder.h"
+#include "table/format.h"
+#include "table/iterator.h"
+#include "table/merger.h"
+
+#include "harness.h"
+#include "skiplist.h"
+#include "write_batch.h"
+
+/* Comma-separated list of operations to run in the specified order.
+ * Each reports the time taken by one call (or one step) of the
+ * function it is named after, in nanoseconds:
+ *
+ *   skiplist_insert -- insert N keys in random order into a skiplist
+ *   skiplist_seek   -- N random seeks in a skiplist of N keys
+ *   block_seek      -- N random seeks within a 4K data block
+ *   block_next      -- N steps through a 64K data block of values whose
+ *                      lengths take one or two bytes at random
+ *   bloom_match     -- N bloom filter probes (half of them misses)
+ *   merge_next      -- N steps of a merging iterator over 8 children
+ *   batch_iterate   -- iterate N records of 1000-record write batches
+ *   lru_lookup      -- N block cache lookups shared by --threads threads
+ *   varint32        -- decode N varint32s of random widths
+ *   varint64        -- decode N varint64s of random widths
+ */
+static const char *FLAGS_benchmarks =
+    "skiplist_insert,"
+    "skiplist_seek,"
+    "block_seek,"
+    "block_next,"
+    "bloom_match,"
+    "merge_next,"
+    "batch_iterate,"
+    "lru_lookup,"
+    "varint32,"
+    "varint64,";
+
+/* Number of operations timed by each benchmark. */
+static int FLAGS_num = 1000000;
+
+/* Times to run each benchmark. The fastest run is reported, which
+   keeps results stable enough to compare across commits. */
+static int FLAGS_repeat = 3;
+
+/* Number of threads contending for the cache in lru_lookup. */
+static int FLAGS_threads = 4;
+
+/*
+ * Helpers
+ */
+
+/* Keep results alive so the compiler cannot elide the work. */
+static uint64_t micro_sink = 0;
+
+/* Encode the i'th of a set of distinct 16 byte keys. Scrambled keys
+   arrive in random order as i increases. */
+static ldb_slice_t
+micro_key(uint32_t i, int scramble, char *buf) {
+  if (scramble)
+    i *= UINT32_C(2654435761);
+
+  sprintf(buf, "%016lu", (unsigned long)i);
+
+  return ldb_slice((uint8_t *)buf, 16);
+}
+
+static int64_t
+micro_elapsed(int64_t start) {
+  return ldb_now_nsec() - start;
+}
+
+/*
+ * Result
+ */
+
+typedef struct micro_result_s {
+  int64_t ops;
+  int64_t nanos; /* Summed over threads. */
+  int threads;
+} micro_result_t;
+
+static void
+micro_result_init(micro_result_t *res) {
+  res->ops = 0;
+  res->nanos = 0;
+  res->threads = 1;
+}
+
+static double
+micro_result_rate(const micro_result_t *res) {
+  return res->ops > 0 ? (double)res->nanos / res->ops : 0;
+}
+
+/*
+ * Benchmarks
+ */
+
+static void
+bench_skiplist(micro_result_t *res, int seek) {
+  uint8_t **keys = ldb_malloc(FLAGS_num * sizeof(uint8_t *));
+  ldb_skiplist_t list;
+  ldb_skipiter_t iter;
+  ldb_arena_t arena;
+  ldb_mutex_t mutex;
+  ldb_rand_t rnd;
+  int64_t start;
+  char buf[32];
+  int i;
+
+  ldb_arena_init(&arena);
+  ldb_mutex_init(&mutex);
+  ldb_rand_init(&rnd, 301);
+
+  /* Skiplist keys are length-prefixed. */
+  for (i = 0; i < FLAGS_num; i++) {
+    ldb_slice_t key = micro_key(i, 1, buf);
+    uint8_t *xp = ldb_arena_alloc(&arena, key.size + 1);
+
+    xp[0] = key.size;
+
+    memcpy(xp + 1, key.data, key.size);
+
+    keys[i] = xp;
+  }
+
+  ldb_skiplist_init(&list, ldb_bytewise_comparator, &arena, &mutex);
+
+  start = ldb_now_nsec();
+
+  for (i = 0; i < FLAGS_num; i++)
+    ldb_skiplist_insert(&list, keys[i]);
+
+  if (!seek) {
+    res->nanos = micro_elapsed(start);
+    res->ops = FLAGS_num;
+  } else {
+    ldb_skipiter_init(&iter, &list);
+
+    start = ldb_now_nsec();
+
+    for (i = 0; i < FLAGS_num; i++) {
+      ldb_skipiter_seek(&iter, keys[ldb_rand_uniform(&rnd, FLAGS_num)]);
+      micro_sink += ldb_skipiter_key(&iter)[1];
+    }
+
+    res->nanos = micro_elapsed(start);
+    res->ops = FLAGS_num;
+  }
+
+  ldb_mutex_destroy(&mutex);
+  ldb_arena_clear(&arena);
+  ldb_free(keys);
+}
+
+static void
+bench_skiplist_insert(micro_result_t *res) {
+  bench_skiplist(res, 0);
+}
+
+static void
+bench_skiplist_seek(micro_result_t *res) {
+  bench_skiplist(res, 1);
+}
+
+static void
+bench_block_seek(micro_result_t *res) {
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_slice_t value = ldb_string("0123456789abcdef0123456789abcdef");
+  ldb_contents_t contents;
+  ldb_blockgen_t bb;
+  ldb_block_t block;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  int64_t start;
+  char buf[32];
+  int i, n = 0;
+
+  options.comparator = ldb_bytewise_comparator;
+
+  ldb_blockgen_init(&bb, &options);
+  ldb_rand_init(&rnd, 301);
+
+  while (ldb_blockgen_size_estimate(&bb) < options.block_size) {
+    ldb_slice_t key = micro_key(n++, 0, buf);
+
+    ldb_blockgen_add(&bb, &key, &value);
+  }
+
+  contents.data = ldb_blockgen_finish(&bb);
+  contents.cachable = 0;
+  contents.heap_allocated = 0;
+  contents.verified = 0;
+
+  ldb_block_init(&block, &contents);
+
+  iter = ldb_blockiter_create(&block, ldb_bytewise_comparator);
+
+  start = ldb_now_nsec();
+
+  for (i = 0; i < FLAGS_num; i++) {
+    ldb_slice_t key = micro_key(ldb_rand_uniform(&rnd, n), 0, buf);
+
+    ldb_iter_seek(iter, &key);
+
+    micro_sink += ldb_iter_valid(iter);
+  }
+
+  res->nanos = micro_elapsed(start);
+  res->ops = FLAGS_num;
+
+  ldb_iter_destroy(iter);
+  ldb_block_clear(&block);
+  ldb_blockgen_clear(&bb);
+}
+
+static void
+bench_block_next(micro_result_t *res) {
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  uint8_t *space = ldb_malloc(256);
+  ldb_contents_t contents;
+  ldb_blockgen_t bb;
+  ldb_block_t block;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  int64_t start;
+  char buf[32];
+  int i, n = 0;
+
+  options.comparator = ldb_bytewise_comparator;
+  options.block_size = 64 << 10;
+
+  ldb_blockgen_init(&bb, &options);
+  ldb_rand_init(&rnd, 301);
+
+  memset(space, 'v', 256);
+
+  while (ldb_blockgen_size_estimate(&bb) < options.block_size) {
+    ldb_slice_t key = micro_key(n++, 0, buf);
+    ldb_slice_t value = ldb_slice(space, ldb_rand_uniform(&rnd, 256));
+
+    ldb_blockgen_add(&bb, &key, &value);
+  }
+
+  contents.data = ldb_blockgen_finish(&bb);
+  contents.cachable = 0;
+  contents.heap_allocated = 0;
+  contents.verified = 0;
+
+  ldb_block_init(&block, &contents);
+
+  iter = ldb_blockiter_create(&block, ldb_bytewise_comparator);
+
+  ldb_iter_first(iter);
+
+  start = ldb_now_nsec();
+
+  for (i = 0; i < FLAGS_num; i++) {
+    ldb_iter_next(iter);
+
+    if (!ldb_iter_valid(iter))
+      ldb_iter_first(iter);
+
+    micro_sink += ldb_iter_value(iter).size;
+  }
+
+  res->nanos = micro_elapsed(start);
+  res->ops = FLAGS_num;
+
+  ldb_iter_destroy(iter);
+  ldb_block_clear(&block);
+  ldb_blockgen_clear(&bb);
+  ldb_free(space);
+}
+
+static void
+bench_bloom_match(micro_result_t *res) {
+  const ldb_bloom_t *bloom = ldb_bloom_default;
+  int count = LDB_MIN(FLAGS_num, 100000);
+  ldb_slice_t *keys = ldb_malloc(count * sizeof(ldb_slice_t));
+  char *space = ldb_malloc(count * 16);
+  ldb_buffer_t filter;
+  ldb_rand_t rnd;
+  int64_t start;
+  char buf[32];
+  int i;
+
+  ldb_buffer_init(&filter);
+  ldb_rand_init(&rnd, 301);
+
+  for (i = 0; i < count; i++) {
+    ldb_slice_t key = micro_key(i * 2, 0, buf);
+
+    memcpy(space + i * 16, key.data, 16);
+
+    keys[i] = ldb_slice((uint8_t *)space + i * 16, 16);
+  }
+
+  bloom->build(bloom, &filter, keys, count);
+
+  start = ldb_now_nsec();
+
+  /* Even keys were added; odd keys were not. */
+  for (i = 0; i < FLAGS_num; i++) {
+    ldb_slice_t key = micro_key(ldb_rand_uniform(&rnd, count * 2), 0, buf);
+
+    micro_sink += bloom->match(bloom, &filter, &key);
+  }
+
+  res->nanos = micro_elapsed(start);
+  res->ops = FLAGS_num;
+
+  ldb_buffer_clear(&filter);
+  ldb_free(space);
+  ldb_free(keys);
+}
+
+#define MICRO_CHILDREN 8
+
+static void
+bench_merge_next(micro_result_t *res) {
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_slice_t value = ldb_string("0123456789abcdef");
+  ldb_iter_t *children[MICRO_CHILDREN];
+  ldb_blockgen_t bb[MICRO_CHILDREN];
+  ldb_block_t block[MICRO_CHILDREN];
+  ldb_iter_t *iter;
+  int64_t start;
+  int64_t ops = 0;
+  char buf[32];
+  int i;
+
+  options.comparator = ldb_bytewise_comparator;
+
+  for (i = 0; i < MICRO_CHILDREN; i++)
+    ldb_blockgen_init(&bb[i], &options);
+
+  /* Interleave the keys so that each step changes child. */
+  for (i = 0; i < FLAGS_num; i++) {
+    ldb_slice_t key = micro_key(i, 0, buf);
+
+    ldb_blockgen_add(&bb[i % MICRO_CHILDREN], &key, &value);
+  }
+
+  for (i = 0; i < MICRO_CHILDREN; i++) {
+    ldb_contents_t contents;
+
+    contents.data = ldb_blockgen_finish(&bb[i]);
+    contents.cachable = 0;
+    contents.heap_allocated = 0;
+    contents.verified = 0;
+
+    ldb_block_init(&block[i], &contents);
+
+    children[i] = ldb_blockiter_create(&block[i], ldb_bytewise_comparator);
+  }
+
+  iter = ldb_mergeiter_create(ldb_bytewise_comparator,
+                              children,
+                              MICRO_CHILDREN);
+
+  ldb_iter_first(iter);
+
+  start = ldb_now_nsec();
+
+  while (ldb_iter_valid(iter)) {
+    ldb_iter_next(iter);
+    ops++;
+  }
+
+  res->nanos = micro_elapsed(start);
+  res->ops = ops;
+
+  ldb_iter_destroy(iter);
+
+  for (i = 0; i < MICRO_CHILDREN; i++) {
+    ldb_block_clear(&block[i]);
+    ldb_blockgen_clear(&bb[i]);
+  }
+}
+
+static void
+handle_put(ldb_handler_t *handler,
+           const ldb_slice_t *key,
+           const ldb_slice_t *value) {
+  handler->number += key->size + value->size;
+}
+
+static void
+handle_del(ldb_handler_t *handler, const ldb_slice_t *key) {
+  handler->number += key->size;
+}
+
+static void
+bench_batch_iterate(micro_result_t *res) {
+  ldb_slice_t value = ldb_string("0123456789abcdef0123456789abcdef"
+                                 "0123456789abcdef0123456789abcdef");
+  ldb_handler_t handler;
+  ldb_batch_t batch;
+  int64_t start;
+  int64_t ops = 0;
+  char buf[32];
+  int i;
+
+  ldb_batch_init(&batch);
+
+  for (i = 0; i < 1000; i++) {
+    ldb_slice_t key = micro_key(i, 1, buf);
+
+    if (i % 10 == 9)
+      ldb_batch_del(&batch, &key);
+    else
+      ldb_batch_put(&batch, &key, &value);
+  }
+
+  handler.state = NULL;
+  handler.number = 0;
+  handler.put = handle_put;
+  handler.del = handle_del;
+  handler.merge = NULL;
+  handler.del_range = NULL;
+
+  start = ldb_now_nsec();
+
+  while (ops < FLAGS_num) {
+    if (ldb_batch_iterate(&batch, &handler) != LDB_OK)
+      abort(); /* LCOV_EXCL_LINE */
+
+    ops += 1000;
+  }
+
+  res->nanos = micro_elapsed(start);
+  res->ops = ops;
+
+  micro_sink += handler.number;
+
+  ldb_batch_clear(&batch);
+}
+
+/* Entries in the cache of lru_lookup. */
+#define MICRO_ENTRIES 10000
+
+typedef struct lru_arg_s {
+  ldb_lru_t *lru;
+  int seed;
+  int count;
+  int64_t nanos;
+  uint64_t sink;
+} lru_arg_t;
+
+static void
+lru_deleter(const ldb_slice_t *key, void *value) {
+  (void)key;
+  (void)value;
+}
+
+static void
+lru_body(void *ptr) {
+  lru_arg_t *arg = ptr;
+  ldb_rand_t rnd;
+  int64_t start;
+  char buf[32];
+  int i;
+
+  ldb_rand_init(&rnd, arg->seed);
+
+  start = ldb_now_nsec();
+
+  for (i = 0; i < arg->count; i++) {
+    uint32_t k = ldb_rand_uniform(&rnd, MICRO_ENTRIES);
+    ldb_slice_t key = micro_key(k, 0, buf);
+    ldb_entry_t *h = ldb_lru_lookup(arg->lru, &key);
+
+    if (h != NULL) {
+      arg->sink += (uintptr_t)ldb_lru_value(h);
+      ldb_lru_release(arg->lru, h);
+    }
+  }
+
+  arg->nanos = micro_elapsed(start);
+}
+
+static void
+bench_lru_lookup(micro_result_t *res) {
+  ldb_lru_t *lru = ldb_lru_create(MICRO_ENTRIES * 2);
+  int threads = FLAGS_threads;
+  lru_arg_t *args;
+  char buf[32];
+  int i;
+
+#if !defined(_WIN32) && !defined(LDB_PTHREAD)
+  threads = 1;
+#endif
+
+  for (i = 0; i < MICRO_ENTRIES; i++) {
+    ldb_slice_t key = micro_key(i, 0, buf);
+    ldb_entry_t *h = ldb_lru_insert(lru, &key, (void *)(uintptr_t)(i + 1),
+                                    1, lru_deleter);
+
+    ldb_lru_release(lru, h);
+  }
+
+  args = ldb_malloc(threads * sizeof(lru_arg_t));
+
+  for (i = 0; i < threads; i++) {
+    args[i].lru = lru;
+    args[i].seed = 301 + i;
+    args[i].count = FLAGS_num / threads;
+    args[i].nanos = 0;
+    args[i].sink = 0;
+  }
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+  {
+    ldb_thread_t *tids = ldb_malloc(threads * sizeof(ldb_thread_t));
+
+    for (i = 0; i < threads; i++)
+      ldb_thread_create(&tids[i], lru_body, &args[i]);
+
+    for (i = 0; i < threads; i++)
+      ldb_thread_join(&tids[i]);
+
+    ldb_free(tids);
+  }
+#else
+  lru_body(&args[0]);
+#endif
+
+  for (i = 0; i < threads; i++) {
+    res->nanos += args[i].nanos;
+    res->ops += args[i].count;
+    micro_sink += args[i].sink;
+  }
+
+  res->threads = threads;
+
+  ldb_free(args);
+  ldb_lru_destroy(lru);
+}
+
+static void
+bench_varint(micro_result_t *res, int wide) {
+  uint8_t *data = ldb_malloc((size_t)FLAGS_num * 10);
+  const uint8_t *xp;
+  uint8_t *zp = data;
+  ldb_rand_t rnd;
+  int64_t start;
+  size_t xn;
+  int i;
+
+  ldb_rand_init(&rnd, 301);
+
+  /* Widths are skewed towards small numbers, as lengths are. */
+  for (i = 0; i < FLAGS_num; i++) {
+    if (wide) {
+      uint64_t x = ((uint64_t)ldb_rand_next(&rnd) << 32)
+                 | ldb_rand_next(&rnd);
+
+      zp = ldb_varint64_write(zp, x >> ldb_rand_uniform(&rnd, 64));
+    } else {
+      zp = ldb_varint32_write(zp, ldb_rand_next(&rnd)
+                                  >> ldb_rand_uniform(&rnd, 32));
+    }
+  }
+
+  xp = data;
+  xn = zp - data;
+
+  start = ldb_now_nsec();
+
+  for (i = 0; i < FLAGS_num; i++) {
+    if (wide) {
+      uint64_t x;
+
+      if (!ldb_varint64_read(&x, &xp, &xn))
+        abort(); /* LCOV_EXCL_LINE */
+
+      micro_sink += x;
+    } else {
+      uint32_t x;
+
+      if (!ldb_varint32_read(&x, &xp, &xn))
+        abort(); /* LCOV_EXCL_LINE */
+
+      micro_sink += x;
+    }
+  }
+
+  res->nanos = micro_elapsed(start);
+  res->ops = FLAGS_num;
+
+  ldb_free(data);
+}
+
+static void
+bench_varint32(micro_result_t *res) {
+  bench_varint(res, 0);
+}
+
+static void
+bench_varint64(micro_result_t *res) {
+  bench_varint(res, 1);
+}
+
+/*
+ * Runner
+ */
+
+static void
+micro_run(const char *name, void (*method)(micro_result_t *)) {
+  micro_result_t best;
+  harness_result_t rec;
+  char msg[100];
+  int i;
+
+  micro_result_init(&best);
+
+  for (i = 0; i < FLAGS_repeat; i++) {
+    micro_result_t res;
+
+    micro_result_init(&res);
+
+    method(&res);
+
+    if (i == 0 || micro_result_rate(&res) < micro_result_rate(&best))
+      best = res;
+  }
+
+  if (best.threads > 1)
+    sprintf(msg, "(%d threads)", best.threads);
+  else
+    msg[0] = '\0';
+
+  fprintf(stdout, "%-16s : %10.2f ns/op%s%s\n", name,
+                  micro_result_rate(&best),
+                  msg[0] ? "; " : "",
+                  msg);
+
+  fflush(stdout);
+
+  rec.engine = "lcdb";
+  rec.name = name;
+  rec.threads = best.threads;
+  rec.num = FLAGS_num;
+  rec.value_size = 0;
+  rec.done = (int)best.ops;
+  rec.seconds = best.nanos * 1e-9;
+  rec.elapsed = best.nanos * 1e-9 / best.threads;
+  rec.bytes = 0;
+  rec.hist = NULL;
+  rec.message = msg;
+
+  harness_report(&rec);
+}
+
+static void
+micro_run_all(void) {
+  const char *benchmarks = FLAGS_benchmarks;
+  char name[128];
+
+  while (benchmarks != NULL) {
+    const char *sep = strchr(benchmarks, ',');
+    void (*method)(micro_result_t *) = NULL;
+
+    if (sep == NULL) {
+      if (strlen(benchmarks) + 1 > sizeof(name))
+        break;
+
+      strcpy(name, benchmarks);
+      benchmarks = NULL;
+    } else {
+      size_t len = sep - benchmarks;
+
+      if (len + 1 > sizeof(name))
+        break;
+
+      memcpy(name, benchmarks, len);
+
+      name[len] = '\0';
+
+      benchmarks = sep + 1;
+    }
+
+    if (strcmp(name, "skiplist_insert") == 0) {
+      method = &bench_skiplist_insert;
+    } else if (strcmp(name, "skiplist_seek") == 0) {
+      method = &bench_skiplist_seek;
+    } else if (strcmp(name, "block_seek") == 0) {
+      method = &bench_block_seek;
+    } else if (strcmp(name, "block_next") == 0) {
+      method = &bench_block_next;
+    } else if (strcmp(name, "bloom_match") == 0) {
+      method = &bench_bloom_match;
+    } else if (strcmp(name, "merge_next") == 0) {
+      method = &bench_merge_next;
+    } else if (strcmp(name, "batch_iterate") == 0) {
+      method = &bench_batch_iterate;
+    } else if (strcmp(name, "lru_lookup") == 0) {
+      method = &bench_lru_lookup;
+    } else if (strcmp(name, "varint32") == 0) {
+      method = &bench_varint32;
+    } else if (strcmp(name, "varint64") == 0) {
+      method = &bench_varint64;
+    } else if (*name) { /* No error message for empty name. */
+      fprintf(stderr, "unknown benchmark '%s'\n", name);
+    }
+
+    if (method != NULL)
+      micro_run(name, method);
+  }
+
+  /* Print so results are not dead. */
+  fprintf(stderr, "... sink=%lu\n", (unsigned long)micro_sink);
+}
+
+int
+main(int argc, char **argv) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    char junk;
+    int n;
+
+    if (ldb_starts_with(argv[i], "--benchmarks=")) {
+      FLAGS_benchmarks = argv[i] + 13;
+    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_num = n;
+    } else if (sscanf(argv[i], "--repeat=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_repeat = n;
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+      FLAGS_threads = n;
+    } else if (ldb_starts_with(argv[i], "--json=")) {
+      harness_flags.json = argv[i] + 7;
+    } else {
+      fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
+      exit(1);
+    }
+  }
+
+#if defined(__GNUC__) && !defined(__OPTIMIZE__)
+  fprintf(stdout,
+    "WARNING: Optimization is disabled: benchmarks unnecessarily slow\n");
+#endif
+#ifndef NDEBUG
+  fprintf(stdout,
+    "WARNING: Assertions are enabled; benchmarks unnecessarily slow\n");
+#endif
+
+  micro_run_all();
+
+  harness_close();
+
+  return 0;
+}
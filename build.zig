@@ -98,39 +98,60 @@ pub fn build(b: *std.build.Builder) void {
     "src/util/env.c",
     "src/util/hash.c",
     "src/util/internal.c",
+    "src/util/latency.c",
     "src/util/logger.c",
+    "src/util/mergeop.c",
     "src/util/options.c",
+    "src/util/pcache.c",
+    "src/util/perf.c",
+    "src/util/pinned.c",
     "src/util/port.c",
+    "src/util/prefix.c",
     "src/util/random.c",
+    "src/util/ratelimit.c",
     "src/util/rbt.c",
     "src/util/slice.c",
     "src/util/snappy.c",
+    "src/util/statistics.c",
     "src/util/status.c",
     "src/util/strutil.c",
     "src/util/thread_pool.c",
+    "src/util/trace.c",
     "src/util/vector.c",
+    "src/util/wbm.c",
     "src/table/block.c",
     "src/table/block_builder.c",
+    "src/table/cuckoo_builder.c",
+    "src/table/cuckoo_table.c",
     "src/table/filter_block.c",
     "src/table/format.c",
     "src/table/iterator.c",
     "src/table/merger.c",
+    "src/table/plain_table.c",
     "src/table/table.c",
     "src/table/table_builder.c",
     "src/table/two_level_iterator.c",
+    "src/backup.c",
+    "src/blob.c",
     "src/builder.c",
     "src/c.c",
+    "src/cachesim.c",
     "src/db_impl.c",
     "src/db_iter.c",
     "src/dbformat.c",
     "src/dumpfile.c",
+    "src/family.c",
     "src/filename.c",
+    "src/indexed_batch.c",
     "src/log_reader.c",
     "src/log_writer.c",
     "src/memtable.c",
+    "src/rangedel.c",
     "src/repair.c",
     "src/skiplist.c",
+    "src/sst_writer.c",
     "src/table_cache.c",
+    "src/verify.c",
     "src/version_edit.c",
     "src/version_set.c",
     "src/write_batch.c"
@@ -244,6 +265,7 @@ pub fn build(b: *std.build.Builder) void {
 
   bench.addCSourceFiles(&.{
     "bench/db_bench.c",
+    "bench/harness.c",
     "bench/histogram.c",
     "src/util/testutil.c"
   }, flags.items);
@@ -262,6 +284,34 @@ pub fn build(b: *std.build.Builder) void {
 
   bench_step.dependOn(&bench.run().step);
 
+  const micro = b.addExecutable("micro", null);
+
+  micro.setTarget(target);
+  micro.setBuildMode(mode);
+  micro.linkLibC();
+  micro.linkLibrary(lcdb);
+  micro.addIncludeDir("./include");
+  micro.addIncludeDir("./src");
+
+  micro.addCSourceFiles(&.{
+    "bench/micro.c",
+    "bench/harness.c",
+    "bench/histogram.c",
+    "src/util/testutil.c"
+  }, flags.items);
+
+  for (defines.items) |def| {
+    micro.defineCMacroRaw(def);
+  }
+
+  for (libs.items) |lib| {
+    micro.linkSystemLibrary(lib);
+  }
+
+  if (enable_bench) {
+    inst_step.dependOn(&micro.step);
+  }
+
   //
   // Tests
   //
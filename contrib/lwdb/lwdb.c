@@ -58,7 +58,44 @@
 
 enum ldb_compression {
   LDB_NO_COMPRESSION = 0,
-  LDB_SNAPPY_COMPRESSION = 1
+  LDB_SNAPPY_COMPRESSION = 1,
+  LDB_LZ4_COMPRESSION = 4,
+  LDB_ZSTD_COMPRESSION = 7
+};
+
+enum ldb_cfilter_decision {
+  LDB_CFILTER_KEEP = 0,
+  LDB_CFILTER_REMOVE = 1,
+  LDB_CFILTER_CHANGE = 2
+};
+
+enum ldb_compaction_style {
+  LDB_COMPACTION_LEVEL = 0,
+  LDB_COMPACTION_UNIVERSAL = 1,
+  LDB_COMPACTION_FIFO = 2
+};
+
+enum ldb_compaction_pri {
+  LDB_PRI_ROUND_ROBIN = 0,
+  LDB_PRI_MIN_OVERLAPPING_RATIO = 1,
+  LDB_PRI_OLDEST_FIRST = 2
+};
+
+enum ldb_memtable_rep {
+  LDB_MEMTABLE_SKIPLIST = 0,
+  LDB_MEMTABLE_VECTOR = 1,
+  LDB_MEMTABLE_HASH_SKIPLIST = 2
+};
+
+enum ldb_lru_policy {
+  LDB_LRU_DEFAULT = 0,
+  LDB_LRU_MIDPOINT = 1
+};
+
+enum ldb_size_flags {
+  LDB_SIZE_TABLES = 1 << 0,
+  LDB_SIZE_FILES_ONLY = 1 << 1,
+  LDB_SIZE_MEMTABLES = 1 << 2
 };
 
 /*
@@ -68,16 +105,27 @@ enum ldb_compression {
 typedef struct ldb_s ldb_t;
 typedef struct ldb_batch_s ldb_batch_t;
 typedef struct ldb_bloom_s ldb_bloom_t;
+typedef struct ldb_cfilter_s ldb_cfilter_t;
 typedef struct ldb_comparator_s ldb_comparator_t;
 typedef struct ldb_dbopt_s ldb_dbopt_t;
+typedef struct ldb_dbpath_s ldb_dbpath_t;
 typedef struct ldb_handler_s ldb_handler_t;
 typedef struct ldb_iter_s ldb_iter_t;
+typedef struct ldb_listener_s ldb_listener_t;
 typedef struct ldb_logger_s ldb_logger_t;
 typedef leveldb_cache_t ldb_lru_t;
+typedef struct ldb_mergeop_s ldb_mergeop_t;
+typedef struct ldb_pcache_s ldb_pcache_t;
+typedef struct ldb_pool_s ldb_pool_t;
+typedef struct ldb_prefix_s ldb_prefix_t;
 typedef struct ldb_range_s ldb_range_t;
+typedef struct ldb_ratelimit_s ldb_ratelimit_t;
 typedef struct ldb_readopt_s ldb_readopt_t;
 typedef struct ldb_slice_s ldb_slice_t;
 typedef leveldb_snapshot_t ldb_snapshot_t;
+typedef struct ldb_statistics_s ldb_statistics_t;
+typedef struct ldb_tracer_s ldb_tracer_t;
+typedef struct ldb_wbm_s ldb_wbm_t;
 typedef struct ldb_writeopt_s ldb_writeopt_t;
 
 struct ldb_slice_s {
@@ -107,6 +155,38 @@ struct ldb_comparator_s {
   void *dummy4;
 };
 
+struct ldb_prefix_s {
+  const char *name;
+  int (*extract)(const ldb_prefix_t *, ldb_slice_t *, const ldb_slice_t *);
+  void *state;
+};
+
+struct ldb_cfilter_s {
+  const char *name;
+  int (*filter)(const ldb_cfilter_t *,
+                int,
+                const ldb_slice_t *,
+                const ldb_slice_t *,
+                ldb_slice_t *);
+  void *state;
+};
+
+struct ldb_mergeop_s {
+  const char *name;
+  int (*merge)(const ldb_mergeop_t *,
+               const ldb_slice_t *,
+               const ldb_slice_t *,
+               const ldb_slice_t *,
+               size_t,
+               ldb_slice_t *);
+  void *state;
+};
+
+struct ldb_dbpath_s {
+  const char *path;
+  uint64_t target_size;
+};
+
 struct ldb_dbopt_s {
   ldb_comparator_t *comparator;
   int create_if_missing;
@@ -123,6 +203,96 @@ struct ldb_dbopt_s {
   int reuse_logs;
   ldb_bloom_t *filter_policy;
   int use_mmap;
+  int max_background_compactions;
+  int max_subcompactions;
+  int max_manual_compactions;
+  int pipelined_write;
+  int concurrent_memtable_write;
+  int max_insert_threads;
+  int write_group_delay;
+  size_t max_write_group_size;
+  ldb_lru_t *block_cache_compressed;
+  int partition_index;
+  int partition_filters;
+  int index_block_restart_interval;
+  int index_user_keys;
+  int cache_index_and_filter_blocks;
+  int pin_l0_filter_and_index_blocks;
+  int full_filter;
+  const ldb_prefix_t *prefix_extractor;
+  size_t memtable_bloom_size;
+  size_t memtable_huge_page_size;
+  enum ldb_memtable_rep memtable_rep;
+  size_t memtable_hash_buckets;
+  int memtable_inline_prefix;
+  int data_block_hash_index;
+  int restart_key_prefixes;
+  int separate_block_values;
+  size_t plain_key_size;
+  int cuckoo_table;
+  const enum ldb_compression *compression_per_level;
+  int compression_levels;
+  const size_t *block_size_per_level;
+  int block_size_levels;
+  const int *restart_interval_per_level;
+  int restart_interval_levels;
+  size_t zstd_max_dict_bytes;
+  size_t compaction_readahead_size;
+  int compaction_warm_reads;
+  int prepopulate_block_cache;
+  int block_cache_dump;
+  int use_direct_reads;
+  int use_direct_io_for_flush_and_compaction;
+  ldb_ratelimit_t *rate_limiter;
+  int background_deletes;
+  size_t delete_rate;
+  int level0_file_num_compaction_trigger;
+  int level0_slowdown_writes_trigger;
+  int level0_stop_writes_trigger;
+  size_t delayed_write_rate;
+  int num_levels;
+  size_t max_bytes_for_level_base;
+  double max_bytes_for_level_multiplier;
+  int level_compaction_dynamic_level_bytes;
+  double max_file_size_multiplier;
+  int align_compaction_outputs;
+  enum ldb_compaction_pri compaction_pri;
+  int periodic_compaction_seconds;
+  double deletion_compaction_ratio;
+  size_t min_blob_size;
+  double blob_gc_age_cutoff;
+  enum ldb_compaction_style compaction_style;
+  int universal_size_ratio;
+  int universal_max_size_amplification_percent;
+  size_t fifo_max_table_files_size;
+  int ttl;
+  const ldb_cfilter_t *compaction_filter;
+  const ldb_mergeop_t *merge_operator;
+  ldb_wbm_t *write_buffer_manager;
+  ldb_pool_t *thread_pool;
+  int iter_deletion_trigger;
+  int tombstone_sample_weight;
+  int max_file_opening_threads;
+  int lazy_table_open;
+  size_t max_manifest_file_size;
+  int track_latency;
+  ldb_statistics_t *statistics;
+  const ldb_listener_t *listener;
+  ldb_tracer_t *block_tracer;
+  enum ldb_compression wal_compression;
+  int allow_fallocate;
+  int recycle_log_file_num;
+  int manual_wal_flush;
+  int wal_sync_interval;
+  int max_mapped_tables;
+  int in_memory;
+  int advise_random_on_open;
+  ldb_pcache_t *persistent_cache;
+  const ldb_dbpath_t *db_paths;
+  int num_db_paths;
+  int wal_block_size;
+  int compression_threads;
+  int adaptive_compression;
 };
 
 struct ldb_handler_s {
@@ -135,12 +305,25 @@ struct ldb_handler_s {
 
   void (*del)(ldb_handler_t *handler,
               const ldb_slice_t *key);
+
+  void (*merge)(ldb_handler_t *handler,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value);
+
+  void (*del_range)(ldb_handler_t *handler,
+                    const ldb_slice_t *start,
+                    const ldb_slice_t *end);
 };
 
 struct ldb_iter_s {
   leveldb_iterator_t *rep;
   leveldb_readoptions_t *options;
   const ldb_comparator_t *ucmp;
+  /* Copies of iterate_lower_bound and iterate_upper_bound, which
+     leveldb lacks. Both are null if unset. */
+  ldb_slice_t *lower;
+  ldb_slice_t *upper;
+  ldb_slice_t bounds[2];
 };
 
 struct ldb_logger_s {
@@ -156,10 +339,20 @@ struct ldb_readopt_s {
   int verify_checksums;
   int fill_cache;
   const ldb_snapshot_t *snapshot;
+  int prefix_seek;
+  size_t readahead_size;
+  int rate_limited;
+  const ldb_slice_t *iterate_lower_bound;
+  const ldb_slice_t *iterate_upper_bound;
+  int pin_data;
+  int low_priority;
+  int tailing;
+  int keys_only;
 };
 
 struct ldb_writeopt_s {
   int sync;
+  int disable_wal;
 };
 
 struct ldb_s {
@@ -238,6 +431,12 @@ ldb_batch_append(ldb_batch_t *dst, const ldb_batch_t *src);
 LDB_EXTERN ldb_bloom_t *
 ldb_bloom_create(int bits_per_key);
 
+LDB_EXTERN ldb_bloom_t *
+ldb_bloom_create_blocked(int bits_per_key);
+
+LDB_EXTERN ldb_bloom_t *
+ldb_bloom_create_xor(void);
+
 LDB_EXTERN void
 ldb_bloom_destroy(ldb_bloom_t *bloom);
 
@@ -245,6 +444,14 @@ ldb_bloom_destroy(ldb_bloom_t *bloom);
 LDB_EXTERN ldb_lru_t *
 ldb_lru_create(size_t capacity);
 
+LDB_EXTERN ldb_lru_t *
+ldb_lru_create_sharded(size_t capacity, int shard_bits);
+
+LDB_EXTERN ldb_lru_t *
+ldb_lru_create_policy(size_t capacity,
+                      int shard_bits,
+                      enum ldb_lru_policy policy);
+
 LDB_EXTERN void
 ldb_lru_destroy(ldb_lru_t *lru);
 
@@ -260,6 +467,20 @@ ldb_get(ldb_t *db, const ldb_slice_t *key,
                    ldb_slice_t *value,
                    const ldb_readopt_t *options);
 
+LDB_EXTERN int
+ldb_multiget(ldb_t *db, const ldb_slice_t *keys,
+                        ldb_slice_t *values,
+                        int *statuses,
+                        size_t count,
+                        const ldb_readopt_t *options);
+
+LDB_EXTERN int
+ldb_get_packed(ldb_t *db, const void *keys,
+                          size_t size,
+                          void **result,
+                          size_t *length,
+                          const ldb_readopt_t *options);
+
 LDB_EXTERN int
 ldb_has(ldb_t *db, const ldb_slice_t *key, const ldb_readopt_t *options);
 
@@ -268,6 +489,11 @@ ldb_put(ldb_t *db, const ldb_slice_t *key,
                    const ldb_slice_t *value,
                    const ldb_writeopt_t *options);
 
+LDB_EXTERN int
+ldb_put_packed(ldb_t *db, const void *data,
+                          size_t size,
+                          const ldb_writeopt_t *options);
+
 LDB_EXTERN int
 ldb_del(ldb_t *db, const ldb_slice_t *key, const ldb_writeopt_t *options);
 
@@ -288,6 +514,23 @@ ldb_approximate_sizes(ldb_t *db, const ldb_range_t *range,
                                  size_t length,
                                  uint64_t *sizes);
 
+LDB_EXTERN void
+ldb_approximate_sizes_ex(ldb_t *db, const ldb_range_t *range,
+                                    size_t length,
+                                    int flags,
+                                    uint64_t *sizes);
+
+LDB_EXTERN int
+ldb_split_keys(ldb_t *db, size_t n, ldb_slice_t **keys, size_t *length);
+
+LDB_EXTERN int
+ldb_parallel_scan(ldb_t *db, const ldb_readopt_t *options,
+                             int threads,
+                             int (*func)(void *arg,
+                                         const ldb_slice_t *key,
+                                         const ldb_slice_t *value),
+                             void *arg);
+
 LDB_EXTERN void
 ldb_compact(ldb_t *db, const ldb_slice_t *begin, const ldb_slice_t *end);
 
@@ -318,9 +561,17 @@ ldb_test_filename(char *result, size_t size, const char *name);
 LDB_EXTERN void
 ldb_assert_fail(const char *file, int line, const char *expr);
 
+LDB_EXTERN void *
+ldb_malloc(size_t size);
+
 LDB_EXTERN void
 ldb_free(void *ptr);
 
+LDB_EXTERN void
+ldb_set_allocator(void *(*alloc)(size_t size),
+                  void *(*resize)(void *ptr, size_t size),
+                  void (*release)(void *ptr));
+
 /* Iterator */
 LDB_EXTERN ldb_iter_t *
 ldb_iterator(ldb_t *db, const ldb_readopt_t *options);
@@ -370,6 +621,16 @@ ldb_iter_seek_le(ldb_iter_t *iter, const ldb_slice_t *target);
 LDB_EXTERN void
 ldb_iter_seek_lt(ldb_iter_t *iter, const ldb_slice_t *target);
 
+LDB_EXTERN size_t
+ldb_iter_fill(ldb_iter_t *iter, void *buf, size_t size, size_t max);
+
+LDB_EXTERN size_t
+ldb_iter_next_batch(ldb_iter_t *iter, ldb_slice_t *keys,
+                                      ldb_slice_t *values,
+                                      size_t max,
+                                      void *buf,
+                                      size_t size);
+
 /* Logging */
 LDB_EXTERN ldb_logger_t *
 ldb_logger_create(void (*logv)(void *, const char *, va_list), void *state);
@@ -377,6 +638,13 @@ ldb_logger_create(void (*logv)(void *, const char *, va_list), void *state);
 LDB_EXTERN void
 ldb_logger_destroy(ldb_logger_t *logger);
 
+/* Prefix */
+LDB_EXTERN ldb_prefix_t *
+ldb_prefix_create_fixed(size_t length);
+
+LDB_EXTERN void
+ldb_prefix_destroy(ldb_prefix_t *prefix);
+
 /* Slice */
 LDB_EXTERN ldb_slice_t
 ldb_slice(const void *xp, size_t xn);
@@ -408,6 +676,71 @@ safe_free(void *ptr) {
     free(ptr);
 }
 
+static ldb_slice_t *
+slice_copy(ldb_slice_t *z, const ldb_slice_t *x) {
+  z->data = safe_malloc(x->size + 1);
+  z->size = x->size;
+  z->dummy = 0;
+
+  if (x->size > 0)
+    memcpy(z->data, x->data, x->size);
+
+  return z;
+}
+
+static size_t
+varint32_size(uint32_t x) {
+  size_t n = 1;
+
+  while (x >= 0x80) {
+    x >>= 7;
+    n++;
+  }
+
+  return n;
+}
+
+static unsigned char *
+varint32_write(unsigned char *zp, uint32_t x) {
+  while (x >= 0x80) {
+    *zp++ = (x & 0x7f) | 0x80;
+    x >>= 7;
+  }
+
+  *zp++ = x;
+
+  return zp;
+}
+
+static int
+slice_read(ldb_slice_t *z, ldb_slice_t *x) {
+  const unsigned char *xp = x->data;
+  uint32_t zn = 0;
+  size_t i;
+
+  for (i = 0; i < 5; i++) {
+    if (i >= x->size)
+      return 0;
+
+    zn |= (uint32_t)(xp[i] & 0x7f) << (7 * i);
+
+    if (!(xp[i] & 0x80))
+      break;
+  }
+
+  if (i == 5 || x->size - (i + 1) < zn)
+    return 0;
+
+  z->data = (void *)(xp + i + 1);
+  z->size = zn;
+  z->dummy = 0;
+
+  x->data = (void *)(xp + i + 1 + zn);
+  x->size -= i + 1 + zn;
+
+  return 1;
+}
+
 static int
 convert_error(char *err) {
   /* https://github.com/google/leveldb/blob/f57513a/include/leveldb/status.h */
@@ -700,6 +1033,18 @@ ldb_bloom_create(int bits_per_key) {
   return bloom;
 }
 
+ldb_bloom_t *
+ldb_bloom_create_blocked(int bits_per_key) {
+  /* Not supported by leveldb. */
+  return ldb_bloom_create(bits_per_key);
+}
+
+ldb_bloom_t *
+ldb_bloom_create_xor(void) {
+  /* Not supported by leveldb. */
+  return ldb_bloom_create(10);
+}
+
 void
 ldb_bloom_destroy(ldb_bloom_t *bloom) {
   leveldb_filterpolicy_destroy(bloom->rep);
@@ -715,6 +1060,21 @@ ldb_lru_create(size_t capacity) {
   return leveldb_cache_create_lru(capacity);
 }
 
+ldb_lru_t *
+ldb_lru_create_sharded(size_t capacity, int shard_bits) {
+  (void)shard_bits;
+  return leveldb_cache_create_lru(capacity);
+}
+
+ldb_lru_t *
+ldb_lru_create_policy(size_t capacity,
+                      int shard_bits,
+                      enum ldb_lru_policy policy) {
+  (void)shard_bits;
+  (void)policy;
+  return leveldb_cache_create_lru(capacity);
+}
+
 void
 ldb_lru_destroy(ldb_lru_t *lru) {
   leveldb_cache_destroy(lru);
@@ -844,6 +1204,108 @@ ldb_has(ldb_t *db, const ldb_slice_t *key, const ldb_readopt_t *options) {
   return rc;
 }
 
+int
+ldb_multiget(ldb_t *db, const ldb_slice_t *keys,
+                        ldb_slice_t *values,
+                        int *statuses,
+                        size_t count,
+                        const ldb_readopt_t *options) {
+  /* Emulated with one lookup per key. */
+  int rc = LDB_OK;
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    ldb_slice_t val;
+
+    statuses[i] = ldb_get(db, &keys[i], &val, options);
+
+    if (values != NULL) {
+      if (statuses[i] == LDB_OK) {
+        values[i] = val;
+      } else {
+        values[i].data = NULL;
+        values[i].size = 0;
+        values[i].dummy = 0;
+      }
+    } else if (statuses[i] == LDB_OK) {
+      leveldb_free(val.data);
+    }
+
+    if (rc == LDB_OK && statuses[i] != LDB_OK && statuses[i] != LDB_NOTFOUND)
+      rc = statuses[i];
+  }
+
+  return rc;
+}
+
+int
+ldb_get_packed(ldb_t *db, const void *keys,
+                          size_t size,
+                          void **result,
+                          size_t *length,
+                          const ldb_readopt_t *options) {
+  ldb_slice_t data, key, val;
+  size_t total = 0;
+  size_t alloc = 64;
+  unsigned char *zp;
+  int rc;
+
+  *result = NULL;
+  *length = 0;
+
+  data.data = (void *)keys;
+  data.size = size;
+  data.dummy = 0;
+
+  zp = safe_malloc(alloc);
+
+  while (data.size > 0) {
+    size_t need;
+
+    if (!slice_read(&key, &data)) {
+      safe_free(zp);
+      return LDB_INVALID;
+    }
+
+    rc = ldb_get(db, &key, &val, options);
+
+    if (rc != LDB_OK && rc != LDB_NOTFOUND) {
+      safe_free(zp);
+      return rc;
+    }
+
+    need = rc == LDB_OK ? varint32_size(val.size + 1) + val.size : 1;
+
+    if (total + need > alloc) {
+      while (total + need > alloc)
+        alloc *= 2;
+
+      zp = realloc(zp, alloc);
+
+      if (zp == NULL)
+        abort(); /* LCOV_EXCL_LINE */
+    }
+
+    if (rc == LDB_OK) {
+      unsigned char *xp = varint32_write(zp + total, val.size + 1);
+
+      if (val.size > 0)
+        memcpy(xp, val.data, val.size);
+
+      leveldb_free(val.data);
+    } else {
+      zp[total] = 0;
+    }
+
+    total += need;
+  }
+
+  *result = zp;
+  *length = total;
+
+  return LDB_OK;
+}
+
 int
 ldb_put(ldb_t *db, const ldb_slice_t *key,
                    const ldb_slice_t *value,
@@ -868,6 +1330,36 @@ ldb_put(ldb_t *db, const ldb_slice_t *key,
   return handle_error(err);
 }
 
+int
+ldb_put_packed(ldb_t *db, const void *data,
+                          size_t size,
+                          const ldb_writeopt_t *options) {
+  ldb_slice_t input, key, value;
+  ldb_batch_t batch;
+  int rc;
+
+  input.data = (void *)data;
+  input.size = size;
+  input.dummy = 0;
+
+  ldb_batch_init(&batch);
+
+  while (input.size > 0) {
+    if (!slice_read(&key, &input) || !slice_read(&value, &input)) {
+      ldb_batch_clear(&batch);
+      return LDB_INVALID;
+    }
+
+    ldb_batch_put(&batch, &key, &value);
+  }
+
+  rc = ldb_write(db, &batch, options);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
 int
 ldb_del(ldb_t *db, const ldb_slice_t *key, const ldb_writeopt_t *options) {
   leveldb_writeoptions_t *opt = db->write_options;
@@ -915,6 +1407,9 @@ ldb_release(ldb_t *db, const ldb_snapshot_t *snapshot) {
 
 int
 ldb_property(ldb_t *db, const char *property, char **value) {
+  /* Properties leveldb does not know about (for example
+     leveldb.estimate-pending-compaction-bytes) are reported as
+     unavailable rather than guessed at. */
   *value = leveldb_property_value(db->level, property);
   return *value != NULL;
 }
@@ -947,6 +1442,48 @@ ldb_approximate_sizes(ldb_t *db, const ldb_range_t *range,
   safe_free(limit_lens);
 }
 
+void
+ldb_approximate_sizes_ex(ldb_t *db, const ldb_range_t *range,
+                                    size_t length,
+                                    int flags,
+                                    uint64_t *sizes) {
+  /* leveldb cannot size memtables, so only tables are counted. */
+  if (flags & LDB_SIZE_TABLES) {
+    ldb_approximate_sizes(db, range, length, sizes);
+  } else {
+    size_t i;
+
+    for (i = 0; i < length; i++)
+      sizes[i] = 0;
+  }
+}
+
+int
+ldb_split_keys(ldb_t *db, size_t n, ldb_slice_t **keys, size_t *length) {
+  (void)db;
+  (void)n;
+
+  *keys = NULL;
+  *length = 0;
+
+  return LDB_NOSUPPORT;
+}
+
+int
+ldb_parallel_scan(ldb_t *db, const ldb_readopt_t *options,
+                             int threads,
+                             int (*func)(void *arg,
+                                         const ldb_slice_t *key,
+                                         const ldb_slice_t *value),
+                             void *arg) {
+  (void)db;
+  (void)options;
+  (void)threads;
+  (void)func;
+  (void)arg;
+  return LDB_NOSUPPORT;
+}
+
 void
 ldb_compact(ldb_t *db, const ldb_slice_t *begin, const ldb_slice_t *end) {
   static const ldb_slice_t empty = {NULL, 0, 0};
@@ -1231,11 +1768,26 @@ ldb_assert_fail(const char *file, int line, const char *expr) {
   /* LCOV_EXCL_STOP */
 }
 
+void *
+ldb_malloc(size_t size) {
+  return safe_malloc(size);
+}
+
 void
 ldb_free(void *ptr) {
   leveldb_free(ptr);
 }
 
+void
+ldb_set_allocator(void *(*alloc)(size_t size),
+                  void *(*resize)(void *ptr, size_t size),
+                  void (*release)(void *ptr)) {
+  /* leveldb always allocates with libc. */
+  (void)alloc;
+  (void)resize;
+  (void)release;
+}
+
 /*
  * Iterator
  */
@@ -1245,9 +1797,18 @@ ldb_iterator(ldb_t *db, const ldb_readopt_t *options) {
   ldb_iter_t *iter = safe_malloc(sizeof(ldb_iter_t));
   leveldb_readoptions_t *opt = db->iter_options;
 
+  iter->lower = NULL;
+  iter->upper = NULL;
+
   if (options != NULL) {
     opt = convert_readopt(options);
     iter->options = opt;
+
+    if (options->iterate_lower_bound != NULL)
+      iter->lower = slice_copy(&iter->bounds[0], options->iterate_lower_bound);
+
+    if (options->iterate_upper_bound != NULL)
+      iter->upper = slice_copy(&iter->bounds[1], options->iterate_upper_bound);
   } else {
     iter->options = NULL;
   }
@@ -1265,26 +1826,58 @@ ldb_iter_destroy(ldb_iter_t *iter) {
   if (iter->options != NULL)
     leveldb_readoptions_destroy(iter->options);
 
+  if (iter->lower != NULL)
+    safe_free(iter->lower->data);
+
+  if (iter->upper != NULL)
+    safe_free(iter->upper->data);
+
   safe_free(iter);
 }
 
 int
 ldb_iter_valid(const ldb_iter_t *iter) {
-  return leveldb_iter_valid(iter->rep);
+  if (!leveldb_iter_valid(iter->rep))
+    return 0;
+
+  if (iter->upper != NULL && ldb_iter_compare(iter, iter->upper) >= 0)
+    return 0;
+
+  if (iter->lower != NULL && ldb_iter_compare(iter, iter->lower) < 0)
+    return 0;
+
+  return 1;
 }
 
 void
 ldb_iter_first(ldb_iter_t *iter) {
-  leveldb_iter_seek_to_first(iter->rep);
+  if (iter->lower != NULL)
+    leveldb_iter_seek(iter->rep, iter->lower->data, iter->lower->size);
+  else
+    leveldb_iter_seek_to_first(iter->rep);
 }
 
 void
 ldb_iter_last(ldb_iter_t *iter) {
-  leveldb_iter_seek_to_last(iter->rep);
+  if (iter->upper != NULL) {
+    leveldb_iter_seek(iter->rep, iter->upper->data, iter->upper->size);
+
+    if (leveldb_iter_valid(iter->rep))
+      leveldb_iter_prev(iter->rep);
+    else
+      leveldb_iter_seek_to_last(iter->rep);
+  } else {
+    leveldb_iter_seek_to_last(iter->rep);
+  }
 }
 
 void
 ldb_iter_seek(ldb_iter_t *iter, const ldb_slice_t *target) {
+  const ldb_comparator_t *cmp = iter->ucmp;
+
+  if (iter->lower != NULL && cmp->compare(cmp, target, iter->lower) < 0)
+    target = iter->lower;
+
   leveldb_iter_seek(iter->rep, target->data, target->size);
 }
 
@@ -1367,6 +1960,78 @@ ldb_iter_seek_lt(ldb_iter_t *iter, const ldb_slice_t *target) {
     ldb_iter_last(iter);
 }
 
+size_t
+ldb_iter_fill(ldb_iter_t *iter, void *buf, size_t size, size_t max) {
+  unsigned char *zp = buf;
+  size_t len = 0;
+
+  while (max > 0 && ldb_iter_valid(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+    size_t need = varint32_size(key.size) + key.size
+                + varint32_size(val.size) + val.size;
+
+    if (need > size - len)
+      break;
+
+    zp = varint32_write(zp, key.size);
+
+    if (key.size > 0)
+      memcpy(zp, key.data, key.size);
+
+    zp = varint32_write(zp + key.size, val.size);
+
+    if (val.size > 0)
+      memcpy(zp, val.data, val.size);
+
+    zp += val.size;
+    len += need;
+    max -= 1;
+
+    ldb_iter_next(iter);
+  }
+
+  return len;
+}
+
+size_t
+ldb_iter_next_batch(ldb_iter_t *iter, ldb_slice_t *keys,
+                                      ldb_slice_t *values,
+                                      size_t max,
+                                      void *buf,
+                                      size_t size) {
+  unsigned char *zp = buf;
+  size_t count = 0;
+
+  while (count < max && ldb_iter_valid(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+
+    if (key.size + val.size > size)
+      break;
+
+    keys[count] = ldb_slice(zp, key.size);
+
+    if (key.size > 0)
+      memcpy(zp, key.data, key.size);
+
+    zp += key.size;
+
+    values[count] = ldb_slice(zp, val.size);
+
+    if (val.size > 0)
+      memcpy(zp, val.data, val.size);
+
+    zp += val.size;
+    size -= key.size + val.size;
+    count += 1;
+
+    ldb_iter_next(iter);
+  }
+
+  return count;
+}
+
 /*
  * Logging
  */
@@ -1389,6 +2054,45 @@ ldb_logger_destroy(ldb_logger_t *logger) {
   safe_free(logger);
 }
 
+/*
+ * Prefix
+ */
+
+static int
+fixed_extract(const ldb_prefix_t *prefix,
+              ldb_slice_t *result,
+              const ldb_slice_t *key) {
+  const size_t *length = prefix->state;
+
+  if (key->size < *length)
+    return 0;
+
+  *result = ldb_slice(key->data, *length);
+
+  return 1;
+}
+
+ldb_prefix_t *
+ldb_prefix_create_fixed(size_t length) {
+  /* Not supported by leveldb (the extractor is never consulted). */
+  ldb_prefix_t *prefix = safe_malloc(sizeof(ldb_prefix_t));
+  size_t *state = safe_malloc(sizeof(size_t));
+
+  *state = length;
+
+  prefix->name = "lcdb.FixedPrefix";
+  prefix->extract = fixed_extract;
+  prefix->state = state;
+
+  return prefix;
+}
+
+void
+ldb_prefix_destroy(ldb_prefix_t *prefix) {
+  safe_free(prefix->state);
+  safe_free(prefix);
+}
+
 /*
  * Options
  */
@@ -1408,23 +2112,132 @@ static const ldb_dbopt_t db_options = {
   /* .compression = */ LDB_SNAPPY_COMPRESSION,
   /* .reuse_logs = */ 0,
   /* .filter_policy = */ NULL,
-  /* .use_mmap = */ 1
+  /* .use_mmap = */ 1,
+  /* .max_background_compactions = */ 1,
+  /* .max_subcompactions = */ 1,
+  /* .max_manual_compactions = */ 1,
+  /* .pipelined_write = */ 0,
+  /* .concurrent_memtable_write = */ 0,
+  /* .max_insert_threads = */ 1,
+  /* .write_group_delay = */ 0,
+  /* .max_write_group_size = */ 1 << 20,
+  /* .block_cache_compressed = */ NULL,
+  /* .partition_index = */ 0,
+  /* .partition_filters = */ 0,
+  /* .index_block_restart_interval = */ 1,
+  /* .index_user_keys = */ 0,
+  /* .cache_index_and_filter_blocks = */ 0,
+  /* .pin_l0_filter_and_index_blocks = */ 0,
+  /* .full_filter = */ 0,
+  /* .prefix_extractor = */ NULL,
+  /* .memtable_bloom_size = */ 0,
+  /* .memtable_huge_page_size = */ 0,
+  /* .memtable_rep = */ LDB_MEMTABLE_SKIPLIST,
+  /* .memtable_hash_buckets = */ 16384,
+  /* .memtable_inline_prefix = */ 0,
+  /* .data_block_hash_index = */ 0,
+  /* .restart_key_prefixes = */ 0,
+  /* .separate_block_values = */ 0,
+  /* .plain_key_size = */ 0,
+  /* .cuckoo_table = */ 0,
+  /* .compression_per_level = */ NULL,
+  /* .compression_levels = */ 0,
+  /* .block_size_per_level = */ NULL,
+  /* .block_size_levels = */ 0,
+  /* .restart_interval_per_level = */ NULL,
+  /* .restart_interval_levels = */ 0,
+  /* .zstd_max_dict_bytes = */ 0,
+  /* .compaction_readahead_size = */ 2 * 1024 * 1024,
+  /* .compaction_warm_reads = */ 0,
+  /* .prepopulate_block_cache = */ 0,
+  /* .block_cache_dump = */ 0,
+  /* .use_direct_reads = */ 0,
+  /* .use_direct_io_for_flush_and_compaction = */ 0,
+  /* .rate_limiter = */ NULL,
+  /* .background_deletes = */ 0,
+  /* .delete_rate = */ 0,
+  /* .level0_file_num_compaction_trigger = */ 4,
+  /* .level0_slowdown_writes_trigger = */ 8,
+  /* .level0_stop_writes_trigger = */ 12,
+  /* .delayed_write_rate = */ 0,
+  /* .num_levels = */ 7,
+  /* .max_bytes_for_level_base = */ 10 * 1048576,
+  /* .max_bytes_for_level_multiplier = */ 10,
+  /* .level_compaction_dynamic_level_bytes = */ 0,
+  /* .max_file_size_multiplier = */ 1,
+  /* .align_compaction_outputs = */ 0,
+  /* .compaction_pri = */ LDB_PRI_ROUND_ROBIN,
+  /* .periodic_compaction_seconds = */ 0,
+  /* .deletion_compaction_ratio = */ 0,
+  /* .min_blob_size = */ 0,
+  /* .blob_gc_age_cutoff = */ 0.25,
+  /* .compaction_style = */ LDB_COMPACTION_LEVEL,
+  /* .universal_size_ratio = */ 1,
+  /* .universal_max_size_amplification_percent = */ 200,
+  /* .fifo_max_table_files_size = */ 1 << 30,
+  /* .ttl = */ 0,
+  /* .compaction_filter = */ NULL,
+  /* .merge_operator = */ NULL,
+  /* .write_buffer_manager = */ NULL,
+  /* .thread_pool = */ NULL,
+  /* .iter_deletion_trigger = */ 0,
+  /* .tombstone_sample_weight = */ 1,
+  /* .max_file_opening_threads = */ 0,
+  /* .lazy_table_open = */ 0,
+  /* .max_manifest_file_size = */ 0,
+  /* .track_latency = */ 0,
+  /* .statistics = */ NULL,
+  /* .listener = */ NULL,
+  /* .block_tracer = */ NULL,
+  /* .wal_compression = */ LDB_NO_COMPRESSION,
+  /* .allow_fallocate = */ 1,
+  /* .recycle_log_file_num = */ 0,
+  /* .manual_wal_flush = */ 0,
+  /* .wal_sync_interval = */ 0,
+  /* .max_mapped_tables = */ 0,
+  /* .in_memory = */ 0,
+  /* .advise_random_on_open = */ 1,
+  /* .persistent_cache = */ NULL,
+  /* .db_paths = */ NULL,
+  /* .num_db_paths = */ 0,
+  /* .wal_block_size = */ 32768,
+  /* .compression_threads = */ 1,
+  /* .adaptive_compression = */ 0
 };
 
 static const ldb_readopt_t read_options = {
   /* .verify_checksums = */ 0,
   /* .fill_cache = */ 1,
-  /* .snapshot = */ NULL
+  /* .snapshot = */ NULL,
+  /* .prefix_seek = */ 0,
+  /* .readahead_size = */ 0,
+  /* .rate_limited = */ 0,
+  /* .iterate_lower_bound = */ NULL,
+  /* .iterate_upper_bound = */ NULL,
+  /* .pin_data = */ 0,
+  /* .low_priority = */ 0,
+  /* .tailing = */ 0,
+  /* .keys_only = */ 0
 };
 
 static const ldb_writeopt_t write_options = {
-  /* .sync = */ 0
+  /* .sync = */ 0,
+  /* .disable_wal = */ 0
 };
 
 static const ldb_readopt_t iter_options = {
   /* .verify_checksums = */ 0,
   /* .fill_cache = */ 0,
-  /* .snapshot = */ NULL
+  /* .snapshot = */ NULL,
+  /* .prefix_seek = */ 0,
+  /* .readahead_size = */ 0,
+  /* .rate_limited = */ 0,
+  /* .iterate_lower_bound = */ NULL,
+  /* .iterate_upper_bound = */ NULL,
+  /* .pin_data = */ 0,
+  /* .low_priority = */ 0,
+  /* .tailing = */ 0,
+  /* .keys_only = */ 0
 };
 
 #ifdef _WIN32
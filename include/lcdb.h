@@ -50,10 +50,83 @@ typedef unsigned long long ldb_uint64_t;
 #define LDB_NOSUPPORT  30003
 #define LDB_INVALID    30004
 #define LDB_IOERR      30005
+#define LDB_CONFLICT   30006
 
 enum ldb_compression {
   LDB_NO_COMPRESSION = 0,
-  LDB_SNAPPY_COMPRESSION = 1
+  LDB_SNAPPY_COMPRESSION = 1,
+  LDB_LZ4_COMPRESSION = 4,
+  LDB_ZSTD_COMPRESSION = 7
+};
+
+enum ldb_cfilter_decision {
+  LDB_CFILTER_KEEP = 0,
+  LDB_CFILTER_REMOVE = 1,
+  LDB_CFILTER_CHANGE = 2
+};
+
+enum ldb_stall_cause {
+  LDB_STALL_DELAY = 1,
+  LDB_STALL_MEMTABLE = 2,
+  LDB_STALL_LEVEL0 = 3
+};
+
+enum ldb_compaction_style {
+  LDB_COMPACTION_LEVEL = 0,
+  LDB_COMPACTION_UNIVERSAL = 1,
+  LDB_COMPACTION_FIFO = 2
+};
+
+enum ldb_compaction_pri {
+  LDB_PRI_ROUND_ROBIN = 0,
+  LDB_PRI_MIN_OVERLAPPING_RATIO = 1,
+  LDB_PRI_OLDEST_FIRST = 2
+};
+
+enum ldb_memtable_rep {
+  LDB_MEMTABLE_SKIPLIST = 0,
+  LDB_MEMTABLE_VECTOR = 1,
+  LDB_MEMTABLE_HASH_SKIPLIST = 2
+};
+
+enum ldb_lru_policy {
+  LDB_LRU_DEFAULT = 0,
+  LDB_LRU_MIDPOINT = 1
+};
+
+enum ldb_size_flags {
+  LDB_SIZE_TABLES = 1 << 0,
+  LDB_SIZE_FILES_ONLY = 1 << 1,
+  LDB_SIZE_MEMTABLES = 1 << 2
+};
+
+enum ldb_ticker {
+  LDB_BLOCK_CACHE_MISS,
+  LDB_BLOCK_CACHE_HIT,
+  LDB_BLOCK_CACHE_DATA_MISS,
+  LDB_BLOCK_CACHE_DATA_HIT,
+  LDB_BLOCK_CACHE_INDEX_MISS,
+  LDB_BLOCK_CACHE_INDEX_HIT,
+  LDB_BLOCK_CACHE_FILTER_MISS,
+  LDB_BLOCK_CACHE_FILTER_HIT,
+  LDB_BLOOM_FILTER_USEFUL,
+  LDB_BLOOM_FILTER_POSITIVE,
+  LDB_MEMTABLE_HIT,
+  LDB_MEMTABLE_MISS,
+  LDB_GET_HIT_L0,
+  LDB_GET_HIT_L1,
+  LDB_GET_HIT_L2_AND_UP,
+  LDB_KEYS_READ,
+  LDB_BYTES_READ,
+  LDB_KEYS_WRITTEN,
+  LDB_BYTES_WRITTEN,
+  LDB_WAL_BYTES,
+  LDB_WAL_SYNCS,
+  LDB_FLUSH_WRITE_BYTES,
+  LDB_COMPACT_READ_BYTES,
+  LDB_COMPACT_WRITE_BYTES,
+  LDB_STALL_MICROS,
+  LDB_TICKER_MAX
 };
 
 /*
@@ -61,18 +134,40 @@ enum ldb_compression {
  */
 
 typedef struct ldb_s ldb_t;
+typedef struct ldb_backups_s ldb_backups_t;
 typedef struct ldb_batch_s ldb_batch_t;
 typedef struct ldb_bloom_s ldb_bloom_t;
+typedef struct ldb_cfilter_s ldb_cfilter_t;
 typedef struct ldb_comparator_s ldb_comparator_t;
+typedef struct ldb_compactinfo_s ldb_compactinfo_t;
 typedef struct ldb_dbopt_s ldb_dbopt_t;
+typedef struct ldb_dbpath_s ldb_dbpath_t;
+typedef struct ldb_flushinfo_s ldb_flushinfo_t;
 typedef struct ldb_handler_s ldb_handler_t;
+typedef struct ldb_ibatch_s ldb_ibatch_t;
 typedef struct ldb_iter_s ldb_iter_t;
+typedef struct ldb_listener_s ldb_listener_t;
+typedef struct ldb_loader_s ldb_loader_t;
 typedef struct ldb_logger_s ldb_logger_t;
 typedef struct ldb_lru_s ldb_lru_t;
+typedef struct ldb_memusage_s ldb_memusage_t;
+typedef struct ldb_mergeop_s ldb_mergeop_t;
+typedef struct ldb_pcache_s ldb_pcache_t;
+typedef struct ldb_perfctx_s ldb_perfctx_t;
+typedef struct ldb_pinned_s ldb_pinned_t;
+typedef struct ldb_pool_s ldb_pool_t;
+typedef struct ldb_prefix_s ldb_prefix_t;
 typedef struct ldb_range_s ldb_range_t;
+typedef struct ldb_ratelimit_s ldb_ratelimit_t;
 typedef struct ldb_readopt_s ldb_readopt_t;
 typedef struct ldb_slice_s ldb_slice_t;
 typedef struct ldb_snapshot_s ldb_snapshot_t;
+typedef struct ldb_sstwriter_s ldb_sstwriter_t;
+typedef struct ldb_stallinfo_s ldb_stallinfo_t;
+typedef struct ldb_statistics_s ldb_statistics_t;
+typedef struct ldb_tracer_s ldb_tracer_t;
+typedef struct ldb_txn_s ldb_txn_t;
+typedef struct ldb_wbm_s ldb_wbm_t;
 typedef struct ldb_writeopt_s ldb_writeopt_t;
 
 struct ldb_slice_s {
@@ -98,6 +193,74 @@ struct ldb_comparator_s {
   void *state;
 };
 
+struct ldb_prefix_s {
+  const char *name;
+  int (*extract)(const ldb_prefix_t *, ldb_slice_t *, const ldb_slice_t *);
+  void *state;
+};
+
+struct ldb_cfilter_s {
+  const char *name;
+  int (*filter)(const ldb_cfilter_t *,
+                int,
+                const ldb_slice_t *,
+                const ldb_slice_t *,
+                ldb_slice_t *);
+  void *state;
+};
+
+struct ldb_mergeop_s {
+  const char *name;
+  int (*merge)(const ldb_mergeop_t *,
+               const ldb_slice_t *,
+               const ldb_slice_t *,
+               const ldb_slice_t *,
+               size_t,
+               ldb_slice_t *);
+  void *state;
+};
+
+struct ldb_flushinfo_s {
+  ldb_uint64_t memtable_bytes;
+  ldb_uint64_t file_number;
+  ldb_uint64_t file_size;
+  int level;
+  ldb_uint64_t micros;
+  int status;
+};
+
+struct ldb_compactinfo_s {
+  int level;
+  int output_level;
+  int input_files;
+  ldb_uint64_t input_bytes;
+  int output_files;
+  ldb_uint64_t output_bytes;
+  ldb_uint64_t micros;
+  int status;
+};
+
+struct ldb_stallinfo_s {
+  int cause;
+  int level0_files;
+  ldb_uint64_t micros;
+};
+
+struct ldb_listener_s {
+  void (*flush_begin)(const ldb_listener_t *, const ldb_flushinfo_t *);
+  void (*flush_end)(const ldb_listener_t *, const ldb_flushinfo_t *);
+  void (*compaction_begin)(const ldb_listener_t *, const ldb_compactinfo_t *);
+  void (*compaction_end)(const ldb_listener_t *, const ldb_compactinfo_t *);
+  void (*stall_begin)(const ldb_listener_t *, const ldb_stallinfo_t *);
+  void (*stall_end)(const ldb_listener_t *, const ldb_stallinfo_t *);
+  void *state;
+};
+
+struct ldb_dbpath_s {
+  const char *path;
+  ldb_uint64_t target_size;
+};
+
 struct ldb_dbopt_s {
   const ldb_comparator_t *comparator;
   int create_if_missing;
@@ -114,6 +277,96 @@ struct ldb_dbopt_s {
   int reuse_logs;
   const ldb_bloom_t *filter_policy;
   int use_mmap;
+  int max_background_compactions;
+  int max_subcompactions;
+  int max_manual_compactions;
+  int pipelined_write;
+  int concurrent_memtable_write;
+  int max_insert_threads;
+  int write_group_delay;
+  size_t max_write_group_size;
+  ldb_lru_t *block_cache_compressed;
+  int partition_index;
+  int partition_filters;
+  int index_block_restart_interval;
+  int index_user_keys;
+  int cache_index_and_filter_blocks;
+  int pin_l0_filter_and_index_blocks;
+  int full_filter;
+  const ldb_prefix_t *prefix_extractor;
+  size_t memtable_bloom_size;
+  size_t memtable_huge_page_size;
+  enum ldb_memtable_rep memtable_rep;
+  size_t memtable_hash_buckets;
+  int memtable_inline_prefix;
+  int data_block_hash_index;
+  int restart_key_prefixes;
+  int separate_block_values;
+  size_t plain_key_size;
+  int cuckoo_table;
+  const enum ldb_compression *compression_per_level;
+  int compression_levels;
+  const size_t *block_size_per_level;
+  int block_size_levels;
+  const int *restart_interval_per_level;
+  int restart_interval_levels;
+  size_t zstd_max_dict_bytes;
+  size_t compaction_readahead_size;
+  int compaction_warm_reads;
+  int prepopulate_block_cache;
+  int block_cache_dump;
+  int use_direct_reads;
+  int use_direct_io_for_flush_and_compaction;
+  ldb_ratelimit_t *rate_limiter;
+  int background_deletes;
+  size_t delete_rate;
+  int level0_file_num_compaction_trigger;
+  int level0_slowdown_writes_trigger;
+  int level0_stop_writes_trigger;
+  size_t delayed_write_rate;
+  int num_levels;
+  size_t max_bytes_for_level_base;
+  double max_bytes_for_level_multiplier;
+  int level_compaction_dynamic_level_bytes;
+  double max_file_size_multiplier;
+  int align_compaction_outputs;
+  enum ldb_compaction_pri compaction_pri;
+  int periodic_compaction_seconds;
+  double deletion_compaction_ratio;
+  size_t min_blob_size;
+  double blob_gc_age_cutoff;
+  enum ldb_compaction_style compaction_style;
+  int universal_size_ratio;
+  int universal_max_size_amplification_percent;
+  size_t fifo_max_table_files_size;
+  int ttl;
+  const ldb_cfilter_t *compaction_filter;
+  const ldb_mergeop_t *merge_operator;
+  ldb_wbm_t *write_buffer_manager;
+  ldb_pool_t *thread_pool;
+  int iter_deletion_trigger;
+  int tombstone_sample_weight;
+  int max_file_opening_threads;
+  int lazy_table_open;
+  size_t max_manifest_file_size;
+  int track_latency;
+  ldb_statistics_t *statistics;
+  const ldb_listener_t *listener;
+  ldb_tracer_t *block_tracer;
+  enum ldb_compression wal_compression;
+  int allow_fallocate;
+  int recycle_log_file_num;
+  int manual_wal_flush;
+  int wal_sync_interval;
+  int max_mapped_tables;
+  int in_memory;
+  int advise_random_on_open;
+  ldb_pcache_t *persistent_cache;
+  const ldb_dbpath_t *db_paths;
+  int num_db_paths;
+  int wal_block_size;
+  int compression_threads;
+  int adaptive_compression;
 };
 
 struct ldb_handler_s {
@@ -126,6 +379,14 @@ struct ldb_handler_s {
 
   void (*del)(ldb_handler_t *handler,
               const ldb_slice_t *key);
+
+  void (*merge)(ldb_handler_t *handler,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value);
+
+  void (*del_range)(ldb_handler_t *handler,
+                    const ldb_slice_t *start,
+                    const ldb_slice_t *end);
 };
 
 struct ldb_range_s {
@@ -137,10 +398,47 @@ struct ldb_readopt_s {
   int verify_checksums;
   int fill_cache;
   const ldb_snapshot_t *snapshot;
+  int prefix_seek;
+  size_t readahead_size;
+  int rate_limited;
+  const ldb_slice_t *iterate_lower_bound;
+  const ldb_slice_t *iterate_upper_bound;
+  int pin_data;
+  int low_priority;
+  int tailing;
+  int keys_only;
 };
 
 struct ldb_writeopt_s {
   int sync;
+  int disable_wal;
+};
+
+struct ldb_perfctx_s {
+  ldb_uint64_t get_nanos;
+  ldb_uint64_t memtable_count;
+  ldb_uint64_t memtable_nanos;
+  ldb_uint64_t files_nanos;
+  ldb_uint64_t table_count;
+  ldb_uint64_t filter_count;
+  ldb_uint64_t filter_negatives;
+  ldb_uint64_t filter_nanos;
+  ldb_uint64_t index_nanos;
+  ldb_uint64_t block_cache_hits;
+  ldb_uint64_t block_cache_misses;
+  ldb_uint64_t block_read_count;
+  ldb_uint64_t block_read_bytes;
+  ldb_uint64_t block_read_nanos;
+  ldb_uint64_t decompress_nanos;
+};
+
+struct ldb_memusage_s {
+  size_t memtables;
+  size_t block_cache;
+  size_t pinned_blocks;
+  size_t table_readers;
+  size_t write_batches;
+  size_t total;
 };
 
 /*
@@ -188,6 +486,9 @@ ldb_batch_clear(ldb_batch_t *batch);
 void
 ldb_batch_reset(ldb_batch_t *batch);
 
+void
+ldb_batch_reserve(ldb_batch_t *batch, size_t size);
+
 void
 ldb_batch_put(ldb_batch_t *batch,
               const ldb_slice_t *key,
@@ -196,12 +497,56 @@ ldb_batch_put(ldb_batch_t *batch,
 void
 ldb_batch_del(ldb_batch_t *batch, const ldb_slice_t *key);
 
+void
+ldb_batch_merge(ldb_batch_t *batch,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value);
+
+void
+ldb_batch_del_range(ldb_batch_t *batch,
+                    const ldb_slice_t *start,
+                    const ldb_slice_t *end);
+
 int
 ldb_batch_iterate(const ldb_batch_t *batch, ldb_handler_t *handler);
 
 void
 ldb_batch_append(ldb_batch_t *dst, const ldb_batch_t *src);
 
+/*
+ * Indexed Batch
+ */
+
+ldb_ibatch_t *
+ldb_ibatch_create(const ldb_comparator_t *comparator);
+
+void
+ldb_ibatch_destroy(ldb_ibatch_t *ib);
+
+void
+ldb_ibatch_reset(ldb_ibatch_t *ib);
+
+void
+ldb_ibatch_put(ldb_ibatch_t *ib,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value);
+
+void
+ldb_ibatch_del(ldb_ibatch_t *ib, const ldb_slice_t *key);
+
+ldb_batch_t *
+ldb_ibatch_batch(ldb_ibatch_t *ib);
+
+int
+ldb_ibatch_get(const ldb_ibatch_t *ib,
+               ldb_t *db,
+               const ldb_slice_t *key,
+               ldb_slice_t *value,
+               const ldb_readopt_t *options);
+
+ldb_iter_t *
+ldb_ibatch_iterator(const ldb_ibatch_t *ib, ldb_iter_t *base);
+
 /*
  * Bloom
  */
@@ -209,6 +554,12 @@ ldb_batch_append(ldb_batch_t *dst, const ldb_batch_t *src);
 ldb_bloom_t *
 ldb_bloom_create(int bits_per_key);
 
+ldb_bloom_t *
+ldb_bloom_create_blocked(int bits_per_key);
+
+ldb_bloom_t *
+ldb_bloom_create_xor(void);
+
 void
 ldb_bloom_destroy(ldb_bloom_t *bloom);
 
@@ -219,9 +570,134 @@ ldb_bloom_destroy(ldb_bloom_t *bloom);
 ldb_lru_t *
 ldb_lru_create(size_t capacity);
 
+ldb_lru_t *
+ldb_lru_create_sharded(size_t capacity, int shard_bits);
+
+ldb_lru_t *
+ldb_lru_create_policy(size_t capacity,
+                      int shard_bits,
+                      enum ldb_lru_policy policy);
+
 void
 ldb_lru_destroy(ldb_lru_t *lru);
 
+void
+ldb_lru_set_capacity(ldb_lru_t *lru, size_t capacity);
+
+/*
+ * Persistent Cache
+ */
+
+int
+ldb_pcache_open(const char *path,
+                ldb_uint64_t capacity,
+                ldb_pcache_t **result);
+
+void
+ldb_pcache_close(ldb_pcache_t *pc);
+
+ldb_uint64_t
+ldb_pcache_usage(ldb_pcache_t *pc);
+
+ldb_uint64_t
+ldb_pcache_hits(ldb_pcache_t *pc);
+
+/*
+ * Rate Limiter
+ */
+
+ldb_ratelimit_t *
+ldb_ratelimit_create(size_t bytes_per_sec);
+
+ldb_ratelimit_t *
+ldb_ratelimit_create_auto(size_t max_bytes_per_sec);
+
+void
+ldb_ratelimit_destroy(ldb_ratelimit_t *lim);
+
+void
+ldb_ratelimit_set_rate(ldb_ratelimit_t *lim, size_t bytes_per_sec);
+
+size_t
+ldb_ratelimit_rate(ldb_ratelimit_t *lim);
+
+/*
+ * Write Buffer Manager
+ */
+
+ldb_wbm_t *
+ldb_wbm_create(size_t buffer_size);
+
+void
+ldb_wbm_destroy(ldb_wbm_t *wbm);
+
+size_t
+ldb_wbm_usage(ldb_wbm_t *wbm);
+
+void
+ldb_wbm_set_limit(ldb_wbm_t *wbm, size_t limit, ldb_lru_t *cache);
+
+/*
+ * Thread Pool
+ */
+
+ldb_pool_t *
+ldb_pool_create(int threads);
+
+void
+ldb_pool_destroy(ldb_pool_t *pool);
+
+void
+ldb_pool_set_limit(ldb_pool_t *pool, int limit);
+
+/*
+ * Statistics
+ */
+
+ldb_statistics_t *
+ldb_statistics_create(void);
+
+void
+ldb_statistics_destroy(ldb_statistics_t *stats);
+
+ldb_uint64_t
+ldb_statistics_get(ldb_statistics_t *stats, enum ldb_ticker ticker);
+
+void
+ldb_statistics_reset(ldb_statistics_t *stats);
+
+char *
+ldb_statistics_string(ldb_statistics_t *stats, int json);
+
+/*
+ * Tracer
+ */
+
+ldb_tracer_t *
+ldb_tracer_create(void);
+
+void
+ldb_tracer_destroy(ldb_tracer_t *tr);
+
+int
+ldb_tracer_start(ldb_tracer_t *tr, const char *filename);
+
+int
+ldb_tracer_stop(ldb_tracer_t *tr);
+
+/*
+ * Perf Context
+ */
+
+void
+ldb_perf_enable(int enable);
+
+ldb_perfctx_t *
+ldb_perf_context(void);
+
+void
+ldb_perf_reset(void);
+
 /*
  * Comparator
  */
@@ -263,11 +739,38 @@ ldb_open(const char *dbname, const ldb_dbopt_t *options, ldb_t **dbptr);
 void
 ldb_close(ldb_t *db);
 
+int
+ldb_open_readonly(const char *dbname,
+                  const ldb_dbopt_t *options,
+                  ldb_t **dbptr);
+
+int
+ldb_catch_up(ldb_t *db);
+
 int
 ldb_get(ldb_t *db, const ldb_slice_t *key,
                    ldb_slice_t *value,
                    const ldb_readopt_t *options);
 
+int
+ldb_get_pinned(ldb_t *db, const ldb_slice_t *key,
+                          ldb_pinned_t **value,
+                          const ldb_readopt_t *options);
+
+int
+ldb_multiget(ldb_t *db, const ldb_slice_t *keys,
+                        ldb_slice_t *values,
+                        int *statuses,
+                        size_t count,
+                        const ldb_readopt_t *options);
+
+int
+ldb_get_packed(ldb_t *db, const void *keys,
+                          size_t size,
+                          void **result,
+                          size_t *length,
+                          const ldb_readopt_t *options);
+
 int
 ldb_has(ldb_t *db, const ldb_slice_t *key, const ldb_readopt_t *options);
 
@@ -276,12 +779,33 @@ ldb_put(ldb_t *db, const ldb_slice_t *key,
                    const ldb_slice_t *value,
                    const ldb_writeopt_t *options);
 
+int
+ldb_put_packed(ldb_t *db, const void *data,
+                          size_t size,
+                          const ldb_writeopt_t *options);
+
 int
 ldb_del(ldb_t *db, const ldb_slice_t *key, const ldb_writeopt_t *options);
 
+int
+ldb_merge(ldb_t *db, const ldb_slice_t *key,
+                     const ldb_slice_t *value,
+                     const ldb_writeopt_t *options);
+
+int
+ldb_del_range(ldb_t *db, const ldb_slice_t *start,
+                         const ldb_slice_t *end,
+                         const ldb_writeopt_t *options);
+
 int
 ldb_write(ldb_t *db, ldb_batch_t *updates, const ldb_writeopt_t *options);
 
+int
+ldb_flush_wal(ldb_t *db, int sync);
+
+int
+ldb_flush(ldb_t *db, int wait, int allow_stall);
+
 const ldb_snapshot_t *
 ldb_snapshot(ldb_t *db);
 
@@ -291,20 +815,187 @@ ldb_release(ldb_t *db, const ldb_snapshot_t *snapshot);
 int
 ldb_property(ldb_t *db, const char *property, char **value);
 
+int
+ldb_start_trace(ldb_t *db, const char *filename);
+
+int
+ldb_end_trace(ldb_t *db);
+
+void
+ldb_reset_stats(ldb_t *db);
+
+void
+ldb_set_options(ldb_t *db, const ldb_dbopt_t *options);
+
 void
 ldb_approximate_sizes(ldb_t *db, const ldb_range_t *range,
                                  size_t length,
                                  ldb_uint64_t *sizes);
 
+void
+ldb_approximate_sizes_ex(ldb_t *db, const ldb_range_t *range,
+                                    size_t length,
+                                    int flags,
+                                    ldb_uint64_t *sizes);
+
+void
+ldb_memory_usage(ldb_t *db, ldb_memusage_t *usage);
+
+int
+ldb_split_keys(ldb_t *db, size_t n, ldb_slice_t **keys, size_t *length);
+
+int
+ldb_parallel_scan(ldb_t *db, const ldb_readopt_t *options,
+                             int threads,
+                             int (*func)(void *arg,
+                                         const ldb_slice_t *key,
+                                         const ldb_slice_t *value),
+                             void *arg);
+
 void
 ldb_compact(ldb_t *db, const ldb_slice_t *begin, const ldb_slice_t *end);
 
+int
+ldb_delete_files_in_range(ldb_t *db, const ldb_slice_t *begin,
+                                     const ldb_slice_t *end);
+
+int
+ldb_ingest(ldb_t *db, const char *fname);
+
+ldb_loader_t *
+ldb_loader_create(ldb_t *db);
+
+int
+ldb_loader_put(ldb_loader_t *ld, const ldb_slice_t *key,
+                                  const ldb_slice_t *value);
+
+int
+ldb_loader_finish(ldb_loader_t *ld);
+
+void
+ldb_loader_destroy(ldb_loader_t *ld);
+
+ldb_txn_t *
+ldb_txn_create(ldb_t *db);
+
+void
+ldb_txn_destroy(ldb_txn_t *txn);
+
+int
+ldb_txn_get(ldb_txn_t *txn, const ldb_slice_t *key,
+                            ldb_slice_t *value,
+                            const ldb_readopt_t *options);
+
+int
+ldb_txn_commit(ldb_txn_t *txn, ldb_batch_t *updates,
+                               const ldb_writeopt_t *options);
+
 int
 ldb_backup(ldb_t *db, const char *name);
 
+int
+ldb_checkpoint(ldb_t *db, const char *name);
+
 int
 ldb_compare(const ldb_t *db, const ldb_slice_t *x, const ldb_slice_t *y);
 
+/*
+ * Column Families
+ */
+
+#define LDB_MAX_FAMILIES 256
+
+ldb_comparator_t *
+ldb_family_comparator(const ldb_comparator_t *const *comparators, int length);
+
+void
+ldb_family_comparator_destroy(ldb_comparator_t *cmp);
+
+int
+ldb_family_get(ldb_t *db, int family,
+                          const ldb_slice_t *key,
+                          ldb_slice_t *value,
+                          const ldb_readopt_t *options);
+
+int
+ldb_family_put(ldb_t *db, int family,
+                          const ldb_slice_t *key,
+                          const ldb_slice_t *value,
+                          const ldb_writeopt_t *options);
+
+int
+ldb_family_del(ldb_t *db, int family,
+                          const ldb_slice_t *key,
+                          const ldb_writeopt_t *options);
+
+ldb_iter_t *
+ldb_family_iterator(ldb_t *db, int family, const ldb_readopt_t *options);
+
+void
+ldb_batch_family_put(ldb_batch_t *batch, int family,
+                                         const ldb_slice_t *key,
+                                         const ldb_slice_t *value);
+
+void
+ldb_batch_family_del(ldb_batch_t *batch, int family, const ldb_slice_t *key);
+
+/*
+ * Backups
+ */
+
+int
+ldb_backups_open(const char *dir, int threads, ldb_backups_t **result);
+
+void
+ldb_backups_close(ldb_backups_t *bk);
+
+int
+ldb_backups_create(ldb_backups_t *bk, ldb_t *db, int *id);
+
+int
+ldb_backups_restore(ldb_backups_t *bk, int id, const char *dbname);
+
+int
+ldb_backups_delete(ldb_backups_t *bk, int id);
+
+int
+ldb_backups_purge(ldb_backups_t *bk, int keep);
+
+int
+ldb_backups_length(const ldb_backups_t *bk);
+
+int
+ldb_backups_id(const ldb_backups_t *bk, int index);
+
+/*
+ * SST Writer
+ */
+
+int
+ldb_sstwriter_open(const char *fname,
+                   const ldb_dbopt_t *options,
+                   ldb_sstwriter_t **writer);
+
+int
+ldb_sstwriter_put(ldb_sstwriter_t *sst,
+                  const ldb_slice_t *key,
+                  const ldb_slice_t *value);
+
+int
+ldb_sstwriter_del(ldb_sstwriter_t *sst, const ldb_slice_t *key);
+
+int
+ldb_sstwriter_finish(ldb_sstwriter_t *sst);
+
+ldb_uint64_t
+ldb_sstwriter_entries(const ldb_sstwriter_t *sst);
+
+ldb_uint64_t
+ldb_sstwriter_size(const ldb_sstwriter_t *sst);
+
+void
+ldb_sstwriter_close(ldb_sstwriter_t *sst);
+
 /*
  * Static
  */
@@ -332,9 +1023,27 @@ ldb_test_filename(char *result, size_t size, const char *name);
  * Internal
  */
 
+void *
+ldb_malloc(size_t size);
+
 void
 ldb_free(void *ptr);
 
+void
+ldb_set_allocator(void *(*alloc)(size_t size),
+                  void *(*resize)(void *ptr, size_t size),
+                  void (*release)(void *ptr));
+
+/*
+ * Pinned Value
+ */
+
+ldb_slice_t
+ldb_pinned_value(const ldb_pinned_t *pin);
+
+void
+ldb_pinned_destroy(ldb_pinned_t *pin);
+
 /*
  * Iterator
  */
@@ -342,6 +1051,9 @@ ldb_free(void *ptr);
 ldb_iter_t *
 ldb_iterator(ldb_t *db, const ldb_readopt_t *options);
 
+int
+ldb_iter_refresh(ldb_iter_t *iter);
+
 void
 ldb_iter_destroy(ldb_iter_t *iter);
 
@@ -387,6 +1099,16 @@ ldb_iter_seek_le(ldb_iter_t *iter, const ldb_slice_t *target);
 void
 ldb_iter_seek_lt(ldb_iter_t *iter, const ldb_slice_t *target);
 
+size_t
+ldb_iter_fill(ldb_iter_t *iter, void *buf, size_t size, size_t max);
+
+size_t
+ldb_iter_next_batch(ldb_iter_t *iter, ldb_slice_t *keys,
+                                      ldb_slice_t *values,
+                                      size_t max,
+                                      void *buf,
+                                      size_t size);
+
 /**
  * Alias for `ldb_iter_value`.
  */
@@ -478,6 +1200,26 @@ ldb_logger_create(void (*logv)(void *, const char *, va_list), void *state);
 void
 ldb_logger_destroy(ldb_logger_t *logger);
 
+/*
+ * Prefix
+ */
+
+ldb_prefix_t *
+ldb_prefix_create_fixed(size_t length);
+
+void
+ldb_prefix_destroy(ldb_prefix_t *prefix);
+
+/*
+ * Merge Operator
+ */
+
+ldb_mergeop_t *
+ldb_mergeop_create_add(void);
+
+void
+ldb_mergeop_destroy(ldb_mergeop_t *op);
+
 /*
  * Slice
  */
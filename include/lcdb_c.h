@@ -69,6 +69,7 @@ typedef struct ldb_writeopt_s leveldb_writeoptions_t;
 typedef struct ldb_dbopt_s leveldb_options_t;
 typedef struct ldb_lru_s leveldb_cache_t;
 typedef struct ldb_logger_s leveldb_logger_t;
+typedef struct ldb_pinned_s leveldb_pinnableslice_t;
 typedef struct leveldb_comparator_s leveldb_comparator_t;
 typedef struct leveldb_filterpolicy_s leveldb_filterpolicy_t;
 typedef struct leveldb_env_s leveldb_env_t;
@@ -83,6 +84,9 @@ typedef struct leveldb_env_s leveldb_env_t;
 #define leveldb_delete ldb_c_delete
 #define leveldb_write ldb_c_write
 #define leveldb_get ldb_c_get
+#define leveldb_get_pinned ldb_c_get_pinned
+#define leveldb_get_into_buffer ldb_c_get_into_buffer
+#define leveldb_multi_get ldb_c_multi_get
 #define leveldb_create_iterator ldb_c_create_iterator
 #define leveldb_create_snapshot ldb_c_create_snapshot
 #define leveldb_release_snapshot ldb_c_release_snapshot
@@ -146,6 +150,8 @@ typedef struct leveldb_env_s leveldb_env_t;
 #define leveldb_create_default_env ldb_c_create_default_env
 #define leveldb_env_destroy ldb_c_env_destroy
 #define leveldb_env_get_test_directory ldb_c_env_get_test_directory
+#define leveldb_pinnableslice_value ldb_c_pinnableslice_value
+#define leveldb_pinnableslice_destroy ldb_c_pinnableslice_destroy
 #define leveldb_free ldb_c_free
 #define leveldb_major_version ldb_c_major_version
 #define leveldb_minor_version ldb_c_minor_version
@@ -182,6 +188,26 @@ leveldb_get(leveldb_t *db, const leveldb_readoptions_t *options,
                            const char *key, size_t keylen,
                            size_t *vallen, char **errptr);
 
+LDB_EXTERN leveldb_pinnableslice_t *
+leveldb_get_pinned(leveldb_t *db, const leveldb_readoptions_t *options,
+                                  const char *key, size_t keylen,
+                                  char **errptr);
+
+LDB_EXTERN unsigned char
+leveldb_get_into_buffer(leveldb_t *db, const leveldb_readoptions_t *options,
+                                       const char *key, size_t keylen,
+                                       char *buf, size_t bufsize,
+                                       size_t *vallen, char **errptr);
+
+LDB_EXTERN void
+leveldb_multi_get(leveldb_t *db, const leveldb_readoptions_t *options,
+                                 size_t num_keys,
+                                 const char *const *keys_list,
+                                 const size_t *keys_list_sizes,
+                                 char **values_list,
+                                 size_t *values_list_sizes,
+                                 char **errs);
+
 LDB_EXTERN leveldb_iterator_t *
 leveldb_create_iterator(leveldb_t *db, const leveldb_readoptions_t *options);
 
@@ -396,6 +422,12 @@ leveldb_env_destroy(leveldb_env_t *env);
 LDB_EXTERN char *
 leveldb_env_get_test_directory(leveldb_env_t *env);
 
+LDB_EXTERN const char *
+leveldb_pinnableslice_value(const leveldb_pinnableslice_t *v, size_t *vlen);
+
+LDB_EXTERN void
+leveldb_pinnableslice_destroy(leveldb_pinnableslice_t *v);
+
 LDB_EXTERN void
 leveldb_free(void *ptr);
 
@@ -0,0 +1,919 @@
+/*!
+ * backup.c - incremental backups for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/crc32c.h"
+#include "util/env.h"
+#include "util/internal.h"
+#include "util/slice.h"
+#include "util/status.h"
+#include "util/strutil.h"
+#include "util/thread_pool.h"
+#include "util/vector.h"
+
+#include "backup.h"
+#include "db_impl.h"
+#include "filename.h"
+
+/*
+ * Constants
+ */
+
+#define BACKUP_NAME_SIZE 64
+
+/*
+ * Types
+ */
+
+typedef struct backup_file_s {
+  char name[BACKUP_NAME_SIZE]; /* Name in the database. */
+  char path[BACKUP_NAME_SIZE]; /* Path within the backup directory. */
+  uint64_t size;
+  uint32_t crc;
+} backup_file_t;
+
+typedef struct backup_s {
+  int id;
+  ldb_vector_t files; /* backup_file_t */
+} backup_t;
+
+struct ldb_backups_s {
+  char dir[LDB_PATH_MAX];
+  int threads;
+  ldb_filelock_t *lock;
+  ldb_vector_t backups; /* backup_t, oldest first */
+};
+
+typedef struct backup_job_s {
+  char from[LDB_PATH_MAX];
+  char to[LDB_PATH_MAX];
+  backup_file_t *file;
+  int verify;
+  int status;
+} backup_job_t;
+
+/*
+ * Helpers
+ */
+
+static int
+backup_path(char *buf, size_t size, const ldb_backups_t *bk,
+                                    const char *path) {
+  return ldb_join(buf, size, bk->dir, path);
+}
+
+static void
+backup_dirname(char *buf, const char *prefix, int id) {
+  size_t len = strlen(prefix);
+
+  memcpy(buf, prefix, len);
+
+  ldb_encode_int(buf + len, id, 0);
+}
+
+static backup_t *
+backup_create(int id) {
+  backup_t *b = ldb_malloc(sizeof(backup_t));
+
+  b->id = id;
+
+  ldb_vector_init(&b->files);
+
+  return b;
+}
+
+static void
+backup_destroy(backup_t *b) {
+  size_t i;
+
+  for (i = 0; i < b->files.length; i++)
+    ldb_free(b->files.items[i]);
+
+  ldb_vector_clear(&b->files);
+  ldb_free(b);
+}
+
+static backup_file_t *
+backup_add(backup_t *b, const char *name, const char *path) {
+  backup_file_t *file = ldb_malloc(sizeof(backup_file_t));
+
+  if (strlen(name) + 1 > sizeof(file->name) ||
+      strlen(path) + 1 > sizeof(file->path)) {
+    ldb_free(file);
+    return NULL;
+  }
+
+  strcpy(file->name, name);
+  strcpy(file->path, path);
+
+  file->size = 0;
+  file->crc = 0;
+
+  ldb_vector_push(&b->files, file);
+
+  return file;
+}
+
+/* Find a shared file already held by some backup. */
+static const backup_file_t *
+backup_find_shared(const ldb_backups_t *bk, const char *path) {
+  size_t i, j;
+
+  for (i = 0; i < bk->backups.length; i++) {
+    const backup_t *b = bk->backups.items[i];
+
+    for (j = 0; j < b->files.length; j++) {
+      const backup_file_t *file = b->files.items[j];
+
+      if (strcmp(file->path, path) == 0)
+        return file;
+    }
+  }
+
+  return NULL;
+}
+
+static int
+backup_index(const ldb_backups_t *bk, int id) {
+  size_t i;
+
+  for (i = 0; i < bk->backups.length; i++) {
+    const backup_t *b = bk->backups.items[i];
+
+    if (b->id == id)
+      return i;
+  }
+
+  return -1;
+}
+
+/* Remove a directory along with the files in it. */
+static void
+backup_remove_dir(const char *dir) {
+  char path[LDB_PATH_MAX];
+  char **names;
+  int i, len;
+
+  len = ldb_get_children(dir, &names);
+
+  for (i = 0; i < len; i++) {
+    if (ldb_join(path, sizeof(path), dir, names[i]))
+      ldb_remove_file(path);
+  }
+
+  if (len >= 0)
+    ldb_free_children(names, len);
+
+  ldb_remove_dir(dir);
+}
+
+/*
+ * Copying
+ */
+
+/* Copy "from" to "to" (through a temporary file), computing the size
+   and crc32c of the data. With "to" NULL, the file is only read. */
+static int
+backup_copy(const char *from, const char *to, uint64_t *size,
+                                              uint32_t *crc) {
+  static const size_t buflen = (1 << 20);
+  char tmpname[LDB_PATH_MAX];
+  ldb_wfile_t *wfile = NULL;
+  ldb_rfile_t *rfile;
+  ldb_slice_t chunk;
+  uint8_t *buf;
+  int rc;
+
+  *size = 0;
+  *crc = 0;
+
+  rc = ldb_seqfile_create(from, &rfile);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  if (to != NULL) {
+    if (strlen(to) + 5 > sizeof(tmpname)) {
+      ldb_rfile_destroy(rfile);
+      return LDB_INVALID;
+    }
+
+    strcpy(tmpname, to);
+    strcat(tmpname, ".tmp");
+
+    rc = ldb_truncfile_create(tmpname, &wfile);
+
+    if (rc != LDB_OK) {
+      ldb_rfile_destroy(rfile);
+      return rc;
+    }
+  }
+
+  buf = ldb_malloc(buflen);
+
+  for (;;) {
+    rc = ldb_rfile_read(rfile, &chunk, buf, buflen);
+
+    if (rc != LDB_OK || chunk.size == 0)
+      break;
+
+    *crc = ldb_crc32c_extend(*crc, chunk.data, chunk.size);
+    *size += chunk.size;
+
+    if (wfile != NULL) {
+      rc = ldb_wfile_append(wfile, &chunk);
+
+      if (rc != LDB_OK)
+        break;
+    }
+  }
+
+  ldb_free(buf);
+  ldb_rfile_destroy(rfile);
+
+  if (wfile != NULL) {
+    if (rc == LDB_OK)
+      rc = ldb_wfile_sync(wfile);
+
+    if (rc == LDB_OK)
+      rc = ldb_wfile_close(wfile);
+
+    ldb_wfile_destroy(wfile);
+
+    if (rc == LDB_OK)
+      rc = ldb_rename_file(tmpname, to);
+
+    if (rc != LDB_OK)
+      ldb_remove_file(tmpname);
+  }
+
+  return rc;
+}
+
+static void
+backup_job_call(void *arg) {
+  backup_job_t *job = arg;
+  backup_file_t *file = job->file;
+  uint64_t size;
+  uint32_t crc;
+
+  job->status = backup_copy(job->from, job->to, &size, &crc);
+
+  if (job->status != LDB_OK)
+    return;
+
+  if (job->verify) {
+    if (size != file->size || crc != file->crc)
+      job->status = LDB_CORRUPTION;
+  } else {
+    file->size = size;
+    file->crc = crc;
+  }
+}
+
+/* Run the jobs on up to bk->threads threads. */
+static int
+backup_run(const ldb_backups_t *bk, backup_job_t *jobs, size_t length) {
+  int threads = bk->threads;
+  int rc = LDB_OK;
+  ldb_pool_t *pool;
+  size_t i;
+
+  if (length == 0)
+    return LDB_OK;
+
+  if ((size_t)threads > length)
+    threads = length;
+
+  if (threads <= 1) {
+    for (i = 0; i < length && rc == LDB_OK; i++) {
+      backup_job_call(&jobs[i]);
+      rc = jobs[i].status;
+    }
+
+    return rc;
+  }
+
+  pool = ldb_pool_create(threads);
+
+  for (i = 0; i < length; i++)
+    ldb_pool_schedule(pool, &backup_job_call, &jobs[i]);
+
+  ldb_pool_wait(pool);
+  ldb_pool_destroy(pool);
+
+  for (i = 0; i < length && rc == LDB_OK; i++)
+    rc = jobs[i].status;
+
+  return rc;
+}
+
+/*
+ * Metadata
+ */
+
+/* Each file of a backup is listed on a line of meta/<id>:
+ *
+ *    <name> <path> <size> <crc>
+ */
+static int
+backup_write_meta(const ldb_backups_t *bk, const backup_t *b) {
+  char fname[LDB_PATH_MAX];
+  char tmpname[LDB_PATH_MAX];
+  char name[32];
+  ldb_buffer_t data;
+  size_t i;
+  int rc;
+
+  backup_dirname(name, "meta/", b->id);
+
+  if (!backup_path(fname, sizeof(fname), bk, name))
+    return LDB_INVALID;
+
+  strcat(name, ".tmp");
+
+  if (!backup_path(tmpname, sizeof(tmpname), bk, name))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&data);
+
+  for (i = 0; i < b->files.length; i++) {
+    const backup_file_t *file = b->files.items[i];
+
+    ldb_buffer_string(&data, file->name);
+    ldb_buffer_push(&data, ' ');
+    ldb_buffer_string(&data, file->path);
+    ldb_buffer_push(&data, ' ');
+    ldb_buffer_number(&data, file->size);
+    ldb_buffer_push(&data, ' ');
+    ldb_buffer_number(&data, file->crc);
+    ldb_buffer_push(&data, '\n');
+  }
+
+  rc = ldb_write_file(tmpname, &data, 1);
+
+  if (rc == LDB_OK)
+    rc = ldb_rename_file(tmpname, fname);
+
+  if (rc != LDB_OK)
+    ldb_remove_file(tmpname);
+
+  ldb_buffer_clear(&data);
+
+  return rc;
+}
+
+static int
+backup_read_word(char *zp, size_t zn, const char **xp) {
+  const char *sp = *xp;
+  size_t len = 0;
+
+  while (sp[len] != '\0' && sp[len] != ' ' && sp[len] != '\n')
+    len++;
+
+  if (len == 0 || len + 1 > zn || sp[len] != ' ')
+    return 0;
+
+  memcpy(zp, sp, len);
+
+  zp[len] = '\0';
+
+  *xp = sp + len + 1;
+
+  return 1;
+}
+
+static int
+backup_read_meta(const ldb_backups_t *bk, backup_t *b) {
+  char fname[LDB_PATH_MAX];
+  char name[BACKUP_NAME_SIZE];
+  char path[BACKUP_NAME_SIZE];
+  ldb_buffer_t data;
+  const char *sp;
+  int rc;
+
+  backup_dirname(name, "meta/", b->id);
+
+  if (!backup_path(fname, sizeof(fname), bk, name))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&data);
+
+  rc = ldb_read_file(fname, &data);
+
+  if (rc != LDB_OK)
+    goto done;
+
+  ldb_buffer_push(&data, '\0');
+
+  sp = (const char *)data.data;
+
+  while (*sp != '\0') {
+    backup_file_t *file;
+    uint64_t size, crc;
+
+    if (!backup_read_word(name, sizeof(name), &sp) ||
+        !backup_read_word(path, sizeof(path), &sp) ||
+        !ldb_decode_int(&size, &sp) || *sp++ != ' ' ||
+        !ldb_decode_int(&crc, &sp) || *sp++ != '\n' ||
+        crc > UINT32_MAX) {
+      rc = LDB_CORRUPTION;
+      break;
+    }
+
+    file = backup_add(b, name, path);
+
+    if (file == NULL) {
+      rc = LDB_CORRUPTION;
+      break;
+    }
+
+    file->size = size;
+    file->crc = (uint32_t)crc;
+  }
+
+done:
+  ldb_buffer_clear(&data);
+  return rc;
+}
+
+static int
+backup_compare(void *x, void *y) {
+  const backup_t *a = x;
+  const backup_t *b = y;
+  return (a->id > b->id) - (a->id < b->id);
+}
+
+/* Remove shared files which no backup refers to. */
+static void
+backup_collect(ldb_backups_t *bk) {
+  char dir[LDB_PATH_MAX];
+  char path[LDB_PATH_MAX];
+  char rel[BACKUP_NAME_SIZE];
+  char **names;
+  int i, len;
+
+  if (!backup_path(dir, sizeof(dir), bk, "shared"))
+    return;
+
+  len = ldb_get_children(dir, &names);
+
+  for (i = 0; i < len; i++) {
+    if (strlen(names[i]) + 8 > sizeof(rel))
+      continue;
+
+    strcpy(rel, "shared/");
+    strcat(rel, names[i]);
+
+    if (backup_find_shared(bk, rel) != NULL)
+      continue;
+
+    if (ldb_join(path, sizeof(path), dir, names[i]))
+      ldb_remove_file(path);
+  }
+
+  if (len >= 0)
+    ldb_free_children(names, len);
+}
+
+/*
+ * Backups
+ */
+
+int
+ldb_backups_open(const char *dir, int threads, ldb_backups_t **result) {
+  static const char *subdirs[] = { "meta", "private", "shared" };
+  char path[LDB_PATH_MAX];
+  ldb_backups_t *bk;
+  char **names;
+  int rc, i, len;
+
+  *result = NULL;
+
+  if (strlen(dir) + 1 > LDB_PATH_MAX - 64)
+    return LDB_INVALID;
+
+  bk = ldb_malloc(sizeof(ldb_backups_t));
+
+  strcpy(bk->dir, dir);
+
+  bk->threads = threads;
+  bk->lock = NULL;
+
+  ldb_vector_init(&bk->backups);
+
+  ldb_create_dir(dir);
+
+  for (i = 0; i < 3; i++) {
+    if (backup_path(path, sizeof(path), bk, subdirs[i]))
+      ldb_create_dir(path);
+  }
+
+  if (!ldb_lock_filename(path, sizeof(path), dir)) {
+    rc = LDB_INVALID;
+    goto fail;
+  }
+
+  rc = ldb_lock_file(path, &bk->lock);
+
+  if (rc != LDB_OK)
+    goto fail;
+
+  if (!backup_path(path, sizeof(path), bk, "meta")) {
+    rc = LDB_INVALID;
+    goto fail;
+  }
+
+  len = ldb_get_children(path, &names);
+
+  if (len < 0) {
+    rc = ldb_system_error();
+    goto fail;
+  }
+
+  for (i = 0; i < len && rc == LDB_OK; i++) {
+    const char *sp = names[i];
+    uint64_t id;
+
+    /* Leftovers of an interrupted backup are ignored. */
+    if (!ldb_decode_int(&id, &sp) || *sp != '\0' || id > INT32_MAX)
+      continue;
+
+    ldb_vector_push(&bk->backups, backup_create((int)id));
+
+    rc = backup_read_meta(bk, ldb_vector_top(&bk->backups));
+  }
+
+  ldb_free_children(names, len);
+
+  if (rc != LDB_OK)
+    goto fail;
+
+  ldb_vector_sort(&bk->backups, backup_compare);
+
+  *result = bk;
+
+  return LDB_OK;
+fail:
+  ldb_backups_close(bk);
+  return rc;
+}
+
+void
+ldb_backups_close(ldb_backups_t *bk) {
+  size_t i;
+
+  for (i = 0; i < bk->backups.length; i++)
+    backup_destroy(bk->backups.items[i]);
+
+  if (bk->lock != NULL)
+    ldb_unlock_file(bk->lock);
+
+  ldb_vector_clear(&bk->backups);
+  ldb_free(bk);
+}
+
+int
+ldb_backups_create(ldb_backups_t *bk, ldb_t *db, int *id) {
+  char private_dir[LDB_PATH_MAX];
+  char name[BACKUP_NAME_SIZE];
+  char path[BACKUP_NAME_SIZE];
+  char desc[LDB_PATH_MAX];
+  char src[LDB_PATH_MAX];
+  uint64_t manifest_number;
+  uint64_t number, size;
+  backup_job_t *jobs;
+  backup_file_t *file;
+  ldb_filetype_t type;
+  ldb_buffer_t record;
+  ldb_vector_t files;
+  size_t i, njobs = 0;
+  backup_t *b;
+  int rc;
+
+  b = backup_create(1);
+
+  if (bk->backups.length > 0) {
+    const backup_t *last = ldb_vector_top(&bk->backups);
+    b->id = last->id + 1;
+  }
+
+  backup_dirname(name, "private/", b->id);
+
+  if (!backup_path(private_dir, sizeof(private_dir), bk, name)) {
+    backup_destroy(b);
+    return LDB_INVALID;
+  }
+
+  /* Clear out what an interrupted attempt may have left. */
+  backup_remove_dir(private_dir);
+
+  rc = ldb_create_dir(private_dir);
+
+  if (rc != LDB_OK) {
+    backup_destroy(b);
+    return rc;
+  }
+
+  ldb_vector_init(&files);
+  ldb_buffer_init(&record);
+
+  rc = ldb_hold_files(db, &files, &record, &manifest_number);
+
+  if (rc != LDB_OK)
+    goto done;
+
+  jobs = ldb_malloc(LDB_MAX(1, files.length) * sizeof(backup_job_t));
+
+  for (i = 0; i < files.length && rc == LDB_OK; i++) {
+    const char *from = files.items[i];
+    const char *filename = ldb_basename(from);
+    backup_job_t *job = &jobs[njobs];
+    const backup_file_t *have;
+
+    if (!ldb_parse_filename(&type, &number, filename)) {
+      rc = LDB_INVALID;
+      break;
+    }
+
+    if (type == LDB_FILE_LOG) {
+      backup_dirname(path, "private/", b->id);
+
+      if (strlen(path) + strlen(filename) + 2 > sizeof(path)) {
+        rc = LDB_INVALID;
+        break;
+      }
+
+      strcat(path, "/");
+      strcat(path, filename);
+    } else {
+      const char *ext = strrchr(filename, '.');
+
+      rc = ldb_file_size(from, &size);
+
+      if (rc != LDB_OK)
+        break;
+
+      /* Tables and blob files are immutable: one with the same
+         number and size has been stored already. */
+      strcpy(path, "shared/");
+
+      ldb_encode_int(path + 7, number, 6);
+
+      strcat(path, "_");
+
+      ldb_encode_int(path + strlen(path), size, 0);
+
+      strcat(path, ext != NULL ? ext : "");
+    }
+
+    file = backup_add(b, filename, path);
+
+    if (file == NULL) {
+      rc = LDB_INVALID;
+      break;
+    }
+
+    have = backup_find_shared(bk, path);
+
+    if (have != NULL) {
+      file->size = have->size;
+      file->crc = have->crc;
+      continue;
+    }
+
+    strcpy(job->from, from);
+
+    if (!backup_path(job->to, sizeof(job->to), bk, path)) {
+      rc = LDB_INVALID;
+      break;
+    }
+
+    job->file = file;
+    job->verify = 0;
+    job->status = LDB_OK;
+
+    njobs++;
+  }
+
+  if (rc == LDB_OK)
+    rc = backup_run(bk, jobs, njobs);
+
+  /* The logs have been copied; the database may move on. */
+  ldb_release_files(db);
+
+  ldb_free(jobs);
+
+  if (rc == LDB_OK)
+    rc = ldb_write_snapshot(private_dir, manifest_number, &record);
+
+  /* Checksum the MANIFEST and CURRENT written for the backup. */
+  if (rc == LDB_OK) {
+    if (!ldb_desc_filename(desc, sizeof(desc), private_dir, manifest_number))
+      rc = LDB_INVALID;
+
+    for (i = 0; i < 2 && rc == LDB_OK; i++) {
+      const char *filename = i == 0 ? ldb_basename(desc) : "CURRENT";
+
+      backup_dirname(path, "private/", b->id);
+
+      strcat(path, "/");
+      strcat(path, filename);
+
+      file = backup_add(b, filename, path);
+
+      if (file == NULL || !backup_path(src, sizeof(src), bk, path)) {
+        rc = LDB_INVALID;
+        break;
+      }
+
+      rc = backup_copy(src, NULL, &file->size, &file->crc);
+    }
+  }
+
+  if (rc == LDB_OK)
+    rc = backup_write_meta(bk, b);
+
+done:
+  for (i = 0; i < files.length; i++)
+    ldb_free(files.items[i]);
+
+  ldb_vector_clear(&files);
+  ldb_buffer_clear(&record);
+
+  if (rc == LDB_OK) {
+    if (id != NULL)
+      *id = b->id;
+
+    ldb_vector_push(&bk->backups, b);
+  } else {
+    backup_remove_dir(private_dir);
+    backup_destroy(b);
+    backup_collect(bk);
+  }
+
+  return rc;
+}
+
+int
+ldb_backups_restore(ldb_backups_t *bk, int id, const char *dbname) {
+  const backup_file_t *current = NULL;
+  char path[LDB_PATH_MAX];
+  backup_job_t *jobs;
+  size_t i, njobs = 0;
+  const backup_t *b;
+  int index, rc;
+
+  index = backup_index(bk, id);
+
+  if (index < 0)
+    return LDB_NOTFOUND;
+
+  if (strlen(dbname) + 1 > LDB_PATH_MAX - 35)
+    return LDB_INVALID;
+
+  if (!ldb_current_filename(path, sizeof(path), dbname))
+    return LDB_INVALID;
+
+  if (ldb_file_exists(path))
+    return LDB_INVALID; /* "database exists" */
+
+  rc = ldb_create_dir(dbname);
+
+  if (rc != LDB_OK && !ldb_file_exists(dbname))
+    return rc;
+
+  b = bk->backups.items[index];
+
+  jobs = ldb_malloc(LDB_MAX(1, b->files.length) * sizeof(backup_job_t));
+
+  rc = LDB_OK;
+
+  for (i = 0; i < b->files.length; i++) {
+    backup_file_t *file = b->files.items[i];
+    backup_job_t *job = &jobs[njobs];
+
+    if (!backup_path(job->from, sizeof(job->from), bk, file->path) ||
+        !ldb_join(job->to, sizeof(job->to), dbname, file->name)) {
+      rc = LDB_INVALID;
+      break;
+    }
+
+    job->file = file;
+    job->verify = 1;
+    job->status = LDB_OK;
+
+    /* CURRENT goes last, once everything it refers to is in place. */
+    if (strcmp(file->name, "CURRENT") == 0)
+      current = file;
+    else
+      njobs++;
+  }
+
+  if (rc == LDB_OK && current == NULL)
+    rc = LDB_CORRUPTION;
+
+  if (rc == LDB_OK)
+    rc = backup_run(bk, jobs, njobs);
+
+  if (rc == LDB_OK) {
+    backup_job_t *job = &jobs[0];
+
+    if (!backup_path(job->from, sizeof(job->from), bk, current->path) ||
+        !ldb_join(job->to, sizeof(job->to), dbname, current->name)) {
+      rc = LDB_INVALID;
+    } else {
+      job->file = (backup_file_t *)current;
+      job->verify = 1;
+
+      backup_job_call(job);
+
+      rc = job->status;
+    }
+  }
+
+  ldb_free(jobs);
+
+  if (rc == LDB_OK)
+    rc = ldb_sync_dir(dbname);
+
+  if (rc != LDB_OK)
+    ldb_destroy(dbname, NULL);
+
+  return rc;
+}
+
+int
+ldb_backups_delete(ldb_backups_t *bk, int id) {
+  char path[LDB_PATH_MAX];
+  char name[32];
+  backup_t *b;
+  int index, rc;
+  size_t i;
+
+  index = backup_index(bk, id);
+
+  if (index < 0)
+    return LDB_NOTFOUND;
+
+  b = bk->backups.items[index];
+
+  backup_dirname(name, "meta/", id);
+
+  if (!backup_path(path, sizeof(path), bk, name))
+    return LDB_INVALID;
+
+  rc = ldb_remove_file(path);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  for (i = index + 1; i < bk->backups.length; i++)
+    bk->backups.items[i - 1] = bk->backups.items[i];
+
+  bk->backups.length--;
+
+  backup_destroy(b);
+
+  backup_dirname(name, "private/", id);
+
+  if (backup_path(path, sizeof(path), bk, name))
+    backup_remove_dir(path);
+
+  backup_collect(bk);
+
+  return LDB_OK;
+}
+
+int
+ldb_backups_purge(ldb_backups_t *bk, int keep) {
+  int rc = LDB_OK;
+
+  while (rc == LDB_OK && (int)bk->backups.length > LDB_MAX(keep, 0)) {
+    const backup_t *b = bk->backups.items[0];
+
+    rc = ldb_backups_delete(bk, b->id);
+  }
+
+  return rc;
+}
+
+int
+ldb_backups_length(const ldb_backups_t *bk) {
+  return bk->backups.length;
+}
+
+int
+ldb_backups_id(const ldb_backups_t *bk, int index) {
+  const backup_t *b = bk->backups.items[index];
+  return b->id;
+}
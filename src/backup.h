@@ -0,0 +1,72 @@
+/*!
+ * backup.h - incremental backups for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_BACKUP_H
+#define LDB_BACKUP_H
+
+#include "util/extern.h"
+
+/*
+ * Types
+ */
+
+struct ldb_s;
+
+/* A directory holding any number of backups of a database:
+ *
+ *    meta/<id>          list of the files of backup <id>
+ *    private/<id>/      its MANIFEST, CURRENT and logs
+ *    shared/            tables and blob files
+ *
+ * Tables and blob files never change once written, so each is stored
+ * once in shared/ under its number and size, and later backups copy
+ * only the files added since. Every file is listed with its crc32c,
+ * which is verified on restore. A directory must not be opened by
+ * more than one handle at a time.
+ */
+typedef struct ldb_backups_s ldb_backups_t;
+
+/*
+ * Backups
+ */
+
+/* Open (or create) the backup directory "dir". Files are copied with
+   up to "threads" threads. */
+LDB_EXTERN int
+ldb_backups_open(const char *dir, int threads, ldb_backups_t **result);
+
+LDB_EXTERN void
+ldb_backups_close(ldb_backups_t *bk);
+
+/* Back up the current state of "db", storing the new backup's id in
+   *id (if not NULL). Background work on the database continues while
+   the files are copied. */
+LDB_EXTERN int
+ldb_backups_create(ldb_backups_t *bk, struct ldb_s *db, int *id);
+
+/* Restore backup "id" into "dbname", which must not hold a database. */
+LDB_EXTERN int
+ldb_backups_restore(ldb_backups_t *bk, int id, const char *dbname);
+
+/* Delete backup "id", along with the shared files only it needed. */
+LDB_EXTERN int
+ldb_backups_delete(ldb_backups_t *bk, int id);
+
+/* Delete all but the newest "keep" backups. */
+LDB_EXTERN int
+ldb_backups_purge(ldb_backups_t *bk, int keep);
+
+/* Number of backups held. */
+LDB_EXTERN int
+ldb_backups_length(const ldb_backups_t *bk);
+
+/* Id of the backup at "index" (oldest first). */
+LDB_EXTERN int
+ldb_backups_id(const ldb_backups_t *bk, int index);
+
+#endif /* LDB_BACKUP_H */
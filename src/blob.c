@@ -0,0 +1,415 @@
+/*!
+ * blob.c - blob files for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/buffer.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/env.h"
+#include "util/internal.h"
+#include "util/port.h"
+#include "util/slice.h"
+#include "util/status.h"
+
+#include "blob.h"
+#include "dbformat.h"
+#include "filename.h"
+
+/*
+ * Blob References
+ */
+
+int
+ldb_blob_wanted(const ldb_dbopt_t *options,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value) {
+  if (options->min_blob_size == 0 || value->size < options->min_blob_size)
+    return 0;
+
+  if (key->size < 8)
+    return 0;
+
+  return (ldb_valtype_t)key->data[key->size - 8] == LDB_TYPE_VALUE;
+}
+
+void
+ldb_blob_key(ldb_buffer_t *z, const ldb_slice_t *key) {
+  assert(key->size >= 8);
+
+  ldb_buffer_set(z, key->data, key->size);
+
+  /* The type is the low byte of the little-endian trailer. */
+  z->data[z->size - 8] = LDB_TYPE_BLOB;
+}
+
+static int
+blobref_import(uint64_t *number,
+               uint64_t *offset,
+               uint64_t *size,
+               const ldb_slice_t *ref) {
+  ldb_slice_t x = *ref;
+
+  if (!ldb_varint64_slurp(number, &x))
+    return 0;
+
+  if (!ldb_varint64_slurp(offset, &x))
+    return 0;
+
+  if (!ldb_varint64_slurp(size, &x))
+    return 0;
+
+  return x.size == 0 && *number != 0;
+}
+
+uint64_t
+ldb_blobref_number(const ldb_slice_t *ref) {
+  uint64_t number, offset, size;
+
+  if (!blobref_import(&number, &offset, &size, ref))
+    return 0;
+
+  return number;
+}
+
+/*
+ * BlobBuilder
+ */
+
+struct ldb_blobgen_s {
+  ldb_wfile_t *file;
+  uint64_t number;
+  uint64_t offset;
+};
+
+int
+ldb_blobgen_create(ldb_blobgen_t **gen,
+                   const char *dbname,
+                   uint64_t number,
+                   struct ldb_ratelimit_s *limiter,
+                   int priority) {
+  char fname[LDB_PATH_MAX];
+  ldb_wfile_t *file;
+  int rc;
+
+  *gen = NULL;
+
+  if (!ldb_blob_filename(fname, sizeof(fname), dbname, number))
+    return LDB_INVALID;
+
+  rc = ldb_truncfile_create(fname, &file);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  if (limiter != NULL)
+    ldb_wfile_ratelimit(file, limiter, priority);
+
+  *gen = ldb_malloc(sizeof(ldb_blobgen_t));
+
+  (*gen)->file = file;
+  (*gen)->number = number;
+  (*gen)->offset = 0;
+
+  return LDB_OK;
+}
+
+void
+ldb_blobgen_destroy(ldb_blobgen_t *gen) {
+  if (gen->file != NULL)
+    ldb_wfile_destroy(gen->file);
+
+  ldb_free(gen);
+}
+
+uint64_t
+ldb_blobgen_number(const ldb_blobgen_t *gen) {
+  return gen->number;
+}
+
+uint64_t
+ldb_blobgen_size(const ldb_blobgen_t *gen) {
+  return gen->offset;
+}
+
+int
+ldb_blobgen_add(ldb_blobgen_t *gen,
+                const ldb_slice_t *value,
+                ldb_buffer_t *ref) {
+  uint32_t crc = ldb_crc32c_value(value->data, value->size);
+  uint8_t trailer[4];
+  ldb_slice_t tmp;
+  int rc;
+
+  assert(gen->file != NULL);
+
+  ldb_fixed32_write(trailer, ldb_crc32c_mask(crc));
+  ldb_slice_set(&tmp, trailer, 4);
+
+  rc = ldb_wfile_append(gen->file, value);
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_append(gen->file, &tmp);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  ldb_buffer_reset(ref);
+  ldb_buffer_varint64(ref, gen->number);
+  ldb_buffer_varint64(ref, gen->offset);
+  ldb_buffer_varint64(ref, value->size);
+
+  gen->offset += value->size + 4;
+
+  return LDB_OK;
+}
+
+int
+ldb_blobgen_finish(ldb_blobgen_t *gen) {
+  int rc = ldb_wfile_sync(gen->file);
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_close(gen->file);
+
+  ldb_wfile_destroy(gen->file);
+
+  gen->file = NULL;
+
+  return rc;
+}
+
+/*
+ * BlobCache
+ */
+
+typedef struct blob_entry_s {
+  uint64_t number;
+  ldb_rfile_t *file;
+  int refs; /* References, including cache reference. */
+  struct blob_entry_s *next;
+} blob_entry_t;
+
+struct ldb_blobs_s {
+  const char *dbname;
+  int capacity;
+  ldb_mutex_t mutex;
+  blob_entry_t *head; /* Most recently used first. */
+  int length;
+};
+
+ldb_blobs_t *
+ldb_blobs_create(const char *dbname, int entries) {
+  ldb_blobs_t *cache = ldb_malloc(sizeof(ldb_blobs_t));
+
+  cache->dbname = dbname;
+  cache->capacity = LDB_MAX(1, entries);
+  cache->head = NULL;
+  cache->length = 0;
+
+  ldb_mutex_init(&cache->mutex);
+
+  return cache;
+}
+
+static void
+blob_unref(blob_entry_t *entry) {
+  assert(entry->refs > 0);
+
+  if (--entry->refs == 0) {
+    ldb_rfile_destroy(entry->file);
+    ldb_free(entry);
+  }
+}
+
+void
+ldb_blobs_destroy(ldb_blobs_t *cache) {
+  blob_entry_t *entry, *next;
+
+  for (entry = cache->head; entry != NULL; entry = next) {
+    next = entry->next;
+    blob_unref(entry);
+  }
+
+  ldb_mutex_destroy(&cache->mutex);
+  ldb_free(cache);
+}
+
+/* Unlink the entry for "number" (if any). Returns the entry, still
+   holding the cache reference. */
+static blob_entry_t *
+blob_remove(ldb_blobs_t *cache, uint64_t number) {
+  blob_entry_t **link = &cache->head;
+
+  while (*link != NULL) {
+    blob_entry_t *entry = *link;
+
+    if (entry->number == number) {
+      *link = entry->next;
+      cache->length--;
+      return entry;
+    }
+
+    link = &entry->next;
+  }
+
+  return NULL;
+}
+
+/* Put an entry at the front, dropping the least recently used
+   entries past capacity. */
+static void
+blob_insert(ldb_blobs_t *cache, blob_entry_t *entry) {
+  blob_entry_t **link;
+  int i = 0;
+
+  entry->next = cache->head;
+
+  cache->head = entry;
+  cache->length++;
+
+  if (cache->length <= cache->capacity)
+    return;
+
+  for (link = &cache->head; *link != NULL; i++) {
+    blob_entry_t *x = *link;
+
+    if (i >= cache->capacity) {
+      *link = x->next;
+      cache->length--;
+      blob_unref(x);
+    } else {
+      link = &x->next;
+    }
+  }
+}
+
+static int
+blob_lookup(ldb_blobs_t *cache, uint64_t number, blob_entry_t **result) {
+  char fname[LDB_PATH_MAX];
+  blob_entry_t *entry;
+  ldb_rfile_t *file;
+  int rc;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  entry = blob_remove(cache, number);
+
+  if (entry != NULL) {
+    blob_insert(cache, entry);
+    entry->refs++;
+  }
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  if (entry != NULL) {
+    *result = entry;
+    return LDB_OK;
+  }
+
+  /* Open the file without holding the mutex. */
+  if (!ldb_blob_filename(fname, sizeof(fname), cache->dbname, number))
+    return LDB_INVALID;
+
+  rc = ldb_randfile_create(fname, &file, 0);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  entry = ldb_malloc(sizeof(blob_entry_t));
+  entry->number = number;
+  entry->file = file;
+  entry->refs = 2;
+  entry->next = NULL;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  /* Another reader may have opened it in the meantime. */
+  {
+    blob_entry_t *old = blob_remove(cache, number);
+
+    if (old != NULL)
+      blob_unref(old);
+  }
+
+  blob_insert(cache, entry);
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  *result = entry;
+
+  return LDB_OK;
+}
+
+int
+ldb_blobs_read(ldb_blobs_t *cache,
+               const ldb_slice_t *ref,
+               ldb_buffer_t *value) {
+  uint64_t number, offset, size;
+  blob_entry_t *entry;
+  ldb_slice_t result;
+  uint32_t crc;
+  int rc;
+
+  if (!blobref_import(&number, &offset, &size, ref))
+    return LDB_CORRUPTION; /* "bad blob reference" */
+
+  if (size > (uint64_t)((size_t)-1) - 4)
+    return LDB_CORRUPTION;
+
+  rc = blob_lookup(cache, number, &entry);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  ldb_buffer_grow(value, size + 4);
+
+  rc = ldb_rfile_pread(entry->file, &result, value->data, size + 4, offset);
+
+  if (rc == LDB_OK && result.size != size + 4)
+    rc = LDB_CORRUPTION; /* "truncated blob read" */
+
+  if (rc == LDB_OK) {
+    crc = ldb_crc32c_unmask(ldb_fixed32_decode(result.data + size));
+
+    if (ldb_crc32c_value(result.data, size) != crc)
+      rc = LDB_CORRUPTION; /* "blob checksum mismatch" */
+  }
+
+  if (rc == LDB_OK) {
+    /* The file may be memory-mapped. */
+    if (result.data != value->data)
+      memcpy(value->data, result.data, size);
+
+    value->size = size;
+  }
+
+  ldb_mutex_lock(&cache->mutex);
+
+  blob_unref(entry);
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  return rc;
+}
+
+void
+ldb_blobs_evict(ldb_blobs_t *cache, uint64_t number) {
+  blob_entry_t *entry;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  entry = blob_remove(cache, number);
+
+  if (entry != NULL)
+    blob_unref(entry);
+
+  ldb_mutex_unlock(&cache->mutex);
+}
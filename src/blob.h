@@ -0,0 +1,115 @@
+/*!
+ * blob.h - blob files for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_BLOB_H
+#define LDB_BLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/options.h"
+#include "util/types.h"
+
+/*
+ * Types
+ */
+
+struct ldb_ratelimit_s;
+struct ldb_wfile_s;
+
+typedef struct ldb_blobgen_s ldb_blobgen_t;
+typedef struct ldb_blobs_s ldb_blobs_t;
+
+/*
+ * Blob Files
+ */
+
+/* Values of at least options->min_blob_size bytes are written to blob
+ * files when tables are built, and the tables store a reference to
+ * them under LDB_TYPE_BLOB. A blob file is an unframed sequence of
+ * records:
+ *
+ *    value: uint8[n]
+ *    crc: fixed32 (masked crc32c of value)
+ *
+ * and a reference is the varint64 file number, the varint64 offset of
+ * the record and its varint64 value size. Blob files are never changed
+ * once written: compaction moves the values of the oldest ones to new
+ * files, after which they are deleted.
+ */
+
+/* Whether the entry under internal key "key" is a value which belongs
+   in a blob file. */
+int
+ldb_blob_wanted(const ldb_dbopt_t *options,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value);
+
+/* Copy internal key "key", retyped as a blob reference, into *z. */
+void
+ldb_blob_key(ldb_buffer_t *z, const ldb_slice_t *key);
+
+/* Return the number of the blob file referenced by "ref" (zero if the
+   reference is malformed). */
+uint64_t
+ldb_blobref_number(const ldb_slice_t *ref);
+
+/*
+ * BlobBuilder
+ */
+
+/* Create a blob file named according to "number". */
+int
+ldb_blobgen_create(ldb_blobgen_t **gen,
+                   const char *dbname,
+                   uint64_t number,
+                   struct ldb_ratelimit_s *limiter,
+                   int priority);
+
+void
+ldb_blobgen_destroy(ldb_blobgen_t *gen);
+
+uint64_t
+ldb_blobgen_number(const ldb_blobgen_t *gen);
+
+/* Bytes written so far. */
+uint64_t
+ldb_blobgen_size(const ldb_blobgen_t *gen);
+
+/* Append "value" to the file, storing its reference in *ref. */
+int
+ldb_blobgen_add(ldb_blobgen_t *gen,
+                const ldb_slice_t *value,
+                ldb_buffer_t *ref);
+
+/* Sync and close the file. */
+int
+ldb_blobgen_finish(ldb_blobgen_t *gen);
+
+/*
+ * BlobCache
+ */
+
+/* Keep up to "entries" blob files open for reading. */
+ldb_blobs_t *
+ldb_blobs_create(const char *dbname, int entries);
+
+void
+ldb_blobs_destroy(ldb_blobs_t *cache);
+
+/* Read the value referenced by "ref" into *value. */
+int
+ldb_blobs_read(ldb_blobs_t *cache,
+               const ldb_slice_t *ref,
+               ldb_buffer_t *value);
+
+/* Close the blob file with the specified number (if open). */
+void
+ldb_blobs_evict(ldb_blobs_t *cache, uint64_t number);
+
+#endif /* LDB_BLOB_H */
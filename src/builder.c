@@ -13,17 +13,23 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "table/format.h"
 #include "table/iterator.h"
 #include "table/table_builder.h"
 
+#include "util/buffer.h"
+#include "util/coding.h"
 #include "util/env.h"
 #include "util/internal.h"
 #include "util/options.h"
+#include "util/ratelimit.h"
 #include "util/status.h"
 
+#include "blob.h"
 #include "builder.h"
 #include "dbformat.h"
 #include "filename.h"
+#include "rangedel.h"
 #include "table_cache.h"
 #include "version_edit.h"
 
@@ -36,45 +42,148 @@ ldb_build_table(const char *dbname,
                 const ldb_dbopt_t *options,
                 ldb_tables_t *table_cache,
                 ldb_iter_t *iter,
+                ldb_iter_t *range_iter,
                 ldb_filemeta_t *meta) {
   char fname[LDB_PATH_MAX];
   int rc = LDB_OK;
+  int has_range;
 
   meta->file_size = 0;
+  meta->tombstones = 0;
+  meta->entries = 0;
+  meta->deletions = 0;
+  meta->oldest_blob = 0;
 
   ldb_iter_first(iter);
 
-  if (!ldb_table_filename(fname, sizeof(fname), dbname, meta->number))
+  if (range_iter != NULL)
+    ldb_iter_first(range_iter);
+
+  has_range = range_iter != NULL && ldb_iter_valid(range_iter);
+
+  if (!ldb_table_filename(fname, sizeof(fname),
+                          ldb_table_dir(dbname, options, meta->path_id),
+                          meta->number)) {
     return LDB_INVALID;
+  }
 
-  if (ldb_iter_valid(iter)) {
+  if (ldb_iter_valid(iter) || has_range) {
+    ldb_blobgen_t *blobs = NULL;
+    ldb_buffer_t blob_key;
+    ldb_buffer_t blob_ref;
+    ldb_tableprops_t *props;
     ldb_tablegen_t *builder;
     ldb_slice_t key, val;
     ldb_wfile_t *file;
     ldb_iter_t *it;
 
-    rc = ldb_truncfile_create(fname, &file);
+    if (options->use_direct_io_for_flush_and_compaction)
+      rc = ldb_directfile_create(fname, &file);
+    else
+      rc = ldb_truncfile_create(fname, &file);
 
     if (rc != LDB_OK)
       return rc;
 
+    if (options->rate_limiter != NULL)
+      ldb_wfile_ratelimit(file, options->rate_limiter, LDB_IO_HIGH);
+
+    if (options->allow_fallocate)
+      ldb_wfile_preallocate(file, options->max_file_size);
+
     builder = ldb_tablegen_create(options, file);
+    props = ldb_tablegen_properties(builder);
+    props->creation_time = ldb_now_usec() / 1000000;
 
-    key = ldb_iter_key(iter);
+    if (options->prepopulate_block_cache > 0) {
+      uint64_t cache_id = ldb_tables_reserve(table_cache, meta->number);
 
-    ldb_ikey_copy(&meta->smallest, &key);
+      ldb_tablegen_warm_cache(builder, cache_id, 0);
+    }
+
+    ldb_buffer_init(&blob_key);
+    ldb_buffer_init(&blob_ref);
 
-    for (; ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    if (ldb_iter_valid(iter)) {
       key = ldb_iter_key(iter);
-      val = ldb_iter_value(iter);
 
-      ldb_tablegen_add(builder, &key, &val);
+      ldb_ikey_copy(&meta->smallest, &key);
+
+      for (; ldb_iter_valid(iter); ldb_iter_next(iter)) {
+        key = ldb_iter_key(iter);
+        val = ldb_iter_value(iter);
+
+        ldb_tableprops_update(props, &key);
+
+        if (ldb_blob_wanted(options, &key, &val)) {
+          /* The blob file shares the table's number. */
+          if (blobs == NULL) {
+            rc = ldb_blobgen_create(&blobs, dbname, meta->number,
+                                    options->rate_limiter, LDB_IO_HIGH);
+
+            if (rc != LDB_OK)
+              break;
+
+            meta->oldest_blob = meta->number;
+          }
+
+          rc = ldb_blobgen_add(blobs, &val, &blob_ref);
+
+          if (rc != LDB_OK)
+            break;
+
+          ldb_blob_key(&blob_key, &key);
+
+          ldb_tablegen_add(builder, &blob_key, &blob_ref);
+        } else {
+          ldb_tablegen_add(builder, &key, &val);
+        }
+      }
+
+      ldb_ikey_copy(&meta->largest, &key);
     }
 
-    ldb_ikey_copy(&meta->largest, &key);
+    ldb_buffer_clear(&blob_key);
+    ldb_buffer_clear(&blob_ref);
+
+    /* Values must be durable before the table referencing them. */
+    if (blobs != NULL) {
+      if (rc == LDB_OK)
+        rc = ldb_blobgen_finish(blobs);
+
+      ldb_blobgen_destroy(blobs);
+    }
+
+    for (; has_range && ldb_iter_valid(range_iter); ldb_iter_next(range_iter)) {
+      ldb_tombstone_t tomb;
+      ldb_pkey_t pkey;
+
+      key = ldb_iter_key(range_iter);
+      val = ldb_iter_value(range_iter);
+
+      if (!ldb_pkey_import(&pkey, &key)) {
+        rc = LDB_CORRUPTION;
+        break;
+      }
+
+      tomb.start = pkey.user_key;
+      tomb.end = val;
+      tomb.sequence = pkey.sequence;
+
+      ldb_tablegen_add_range(builder, &key, &val);
+      ldb_tombstone_bounds(&tomb, options->comparator,
+                           &meta->smallest, &meta->largest);
+    }
+
+    meta->tombstones = ldb_tablegen_tombstones(builder);
+    meta->entries = ldb_tablegen_entries(builder);
+    meta->deletions = props->deletions;
 
     /* Finish and check for builder errors. */
-    rc = ldb_tablegen_finish(builder);
+    if (rc == LDB_OK)
+      rc = ldb_tablegen_finish(builder);
+    else
+      ldb_tablegen_abandon(builder);
 
     if (rc == LDB_OK) {
       meta->file_size = ldb_tablegen_size(builder);
@@ -100,6 +209,9 @@ ldb_build_table(const char *dbname,
                               ldb_readopt_default,
                               meta->number,
                               meta->file_size,
+                              meta->path_id,
+                              0,
+                              0,
                               NULL);
 
       rc = ldb_iter_status(it);
@@ -112,10 +224,34 @@ ldb_build_table(const char *dbname,
   if (ldb_iter_status(iter) != LDB_OK)
     rc = ldb_iter_status(iter);
 
-  if (rc == LDB_OK && meta->file_size > 0)
+  if (rc == LDB_OK && meta->file_size > 0) {
     ; /* Keep it. */
-  else
+  } else {
+    ldb_tables_evict(table_cache, meta->number);
     ldb_remove_file(fname);
 
+    if (meta->oldest_blob != 0) {
+      if (ldb_blob_filename(fname, sizeof(fname), dbname, meta->number))
+        ldb_remove_file(fname);
+
+      meta->oldest_blob = 0;
+    }
+  }
+
   return rc;
 }
+
+void
+ldb_tableprops_update(ldb_tableprops_t *props, const ldb_slice_t *key) {
+  uint64_t tag = ldb_fixed64_decode(key->data + key->size - 8);
+  ldb_seqnum_t sequence = tag >> 8;
+
+  if ((ldb_valtype_t)(tag & 0xff) == LDB_TYPE_DELETION)
+    props->deletions++;
+
+  if (sequence < props->smallest_sequence)
+    props->smallest_sequence = sequence;
+
+  if (sequence > props->largest_sequence)
+    props->largest_sequence = sequence;
+}
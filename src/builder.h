@@ -13,6 +13,8 @@
 #ifndef LDB_BUILDER_H
 #define LDB_BUILDER_H
 
+#include "util/types.h"
+
 /*
  * Types
  */
@@ -20,22 +22,31 @@
 struct ldb_dbopt_s;
 struct ldb_filemeta_s;
 struct ldb_iter_s;
+struct ldb_tableprops_s;
 struct ldb_tables_s;
 
 /*
  * BuildTable
  */
 
-/* Build a Table file from the contents of *iter. The generated file
-   will be named according to meta->number. On success, the rest of
-   *meta will be filled with metadata about the generated table.
-   If no data is present in *iter, meta->file_size will be set to
-   zero, and no Table file will be produced. */
+/* Build a Table file from the contents of *iter, along with the range
+   tombstones of *range_iter (if non-null). The generated file will be
+   named according to meta->number, in the directory for meta->path_id
+   (see ldb_table_dir()). On success, the rest of *meta will be filled
+   with metadata about the generated table. If no data is present in
+   either iterator, meta->file_size will be set to zero, and no Table
+   file will be produced. */
 int
 ldb_build_table(const char *dbname,
                 const struct ldb_dbopt_s *options,
                 struct ldb_tables_s *table_cache,
                 struct ldb_iter_s *iter,
+                struct ldb_iter_s *range_iter,
                 struct ldb_filemeta_s *meta);
 
+/* Account for internal key "key" in the deletion count and sequence
+   range of a table's properties. */
+void
+ldb_tableprops_update(struct ldb_tableprops_s *props, const ldb_slice_t *key);
+
 #endif /* LDB_BUILDER_H */
@@ -25,6 +25,7 @@
 #include "util/extern.h"
 #include "util/internal.h"
 #include "util/options.h"
+#include "util/pinned.h"
 #include "util/slice.h"
 #include "util/status.h"
 
@@ -174,6 +175,104 @@ leveldb_get(leveldb_t *db, const leveldb_readoptions_t *options,
   return result;
 }
 
+leveldb_pinnableslice_t *
+leveldb_get_pinned(leveldb_t *db, const leveldb_readoptions_t *options,
+                                  const char *key, size_t keylen,
+                                  char **errptr) {
+  ldb_slice_t k = ldb_slice((const uint8_t *)key, keylen);
+  ldb_pinned_t *pin;
+  int rc;
+
+  rc = ldb_get_pinned(db, &k, &pin, options);
+
+  if (rc != LDB_OK) {
+    if (rc != LDB_NOTFOUND)
+      save_error(errptr, rc);
+
+    return NULL;
+  }
+
+  return pin;
+}
+
+unsigned char
+leveldb_get_into_buffer(leveldb_t *db, const leveldb_readoptions_t *options,
+                                       const char *key, size_t keylen,
+                                       char *buf, size_t bufsize,
+                                       size_t *vallen, char **errptr) {
+  ldb_slice_t k = ldb_slice((const uint8_t *)key, keylen);
+  ldb_pinned_t *pin;
+  ldb_slice_t v;
+  int rc;
+
+  *vallen = 0;
+
+  rc = ldb_get_pinned(db, &k, &pin, options);
+
+  if (rc != LDB_OK) {
+    if (rc != LDB_NOTFOUND)
+      save_error(errptr, rc);
+
+    return 0;
+  }
+
+  /* The full size is returned even if the value was truncated. */
+  v = ldb_pinned_value(pin);
+
+  if (v.size > 0 && bufsize > 0)
+    memcpy(buf, v.data, LDB_MIN(v.size, bufsize));
+
+  *vallen = v.size;
+
+  ldb_pinned_destroy(pin);
+
+  return 1;
+}
+
+void
+leveldb_multi_get(leveldb_t *db, const leveldb_readoptions_t *options,
+                                 size_t num_keys,
+                                 const char *const *keys_list,
+                                 const size_t *keys_list_sizes,
+                                 char **values_list,
+                                 size_t *values_list_sizes,
+                                 char **errs) {
+  ldb_slice_t *keys, *values;
+  int *statuses;
+  size_t i;
+
+  if (num_keys == 0)
+    return;
+
+  keys = ldb_malloc(num_keys * sizeof(ldb_slice_t));
+  values = ldb_malloc(num_keys * sizeof(ldb_slice_t));
+  statuses = ldb_malloc(num_keys * sizeof(int));
+
+  for (i = 0; i < num_keys; i++) {
+    keys[i] = ldb_slice((const uint8_t *)keys_list[i], keys_list_sizes[i]);
+    errs[i] = NULL;
+  }
+
+  ldb_multiget(db, keys, values, statuses, num_keys, options);
+
+  for (i = 0; i < num_keys; i++) {
+    if (statuses[i] == LDB_OK) {
+      values_list[i] = (char *)values[i].data;
+      values_list_sizes[i] = values[i].size;
+    } else {
+      values_list[i] = NULL;
+      values_list_sizes[i] = 0;
+
+      if (statuses[i] != LDB_NOTFOUND)
+        save_error(&errs[i], statuses[i]);
+    }
+  }
+
+  ldb_free(statuses);
+  ldb_free(values);
+  ldb_free(keys);
+}
+
 leveldb_iterator_t *
 leveldb_create_iterator(leveldb_t *db, const leveldb_readoptions_t *options) {
   return ldb_iterator(db, options);
@@ -365,6 +464,8 @@ leveldb_writebatch_iterate(const leveldb_writebatch_t *b, void *state,
   handler.state = &opt;
   handler.put = handle_put;
   handler.del = handle_del;
+  handler.merge = NULL;
+  handler.del_range = NULL;
 
   if (ldb_batch_iterate(b, &handler) != LDB_OK)
     abort(); /* LCOV_EXCL_LINE */
@@ -674,6 +775,28 @@ leveldb_env_get_test_directory(leveldb_env_t *env) {
   return result;
 }
 
+const char *
+leveldb_pinnableslice_value(const leveldb_pinnableslice_t *v, size_t *vlen) {
+  ldb_slice_t value;
+
+  if (v == NULL) {
+    *vlen = 0;
+    return NULL;
+  }
+
+  value = ldb_pinned_value(v);
+
+  *vlen = value.size;
+
+  return (const char *)value.data;
+}
+
+void
+leveldb_pinnableslice_destroy(leveldb_pinnableslice_t *v) {
+  if (v != NULL)
+    ldb_pinned_destroy(v);
+}
+
 void
 leveldb_free(void *ptr) {
   ldb_free(ptr);
@@ -0,0 +1,145 @@
+/*!
+ * cachesim.c - block cache simulator for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "util/cache.h"
+#include "util/internal.h"
+#include "util/slice.h"
+#include "util/status.h"
+#include "util/trace.h"
+
+#include "cachesim.h"
+
+/*
+ * Helpers
+ */
+
+typedef struct simstats_s {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t data_lookups;
+  uint64_t data_hits;
+} simstats_t;
+
+static void
+simstats_init(simstats_t *st) {
+  st->lookups = 0;
+  st->hits = 0;
+  st->data_lookups = 0;
+  st->data_hits = 0;
+}
+
+static void
+simstats_update(simstats_t *st, const ldb_tracerec_t *rec, int hit) {
+  st->lookups++;
+  st->hits += hit;
+
+  if (rec->block_type == LDB_BLOCK_DATA) {
+    st->data_lookups++;
+    st->data_hits += hit;
+  }
+}
+
+static double
+percent(uint64_t x, uint64_t y) {
+  return y > 0 ? (double)x * 100.0 / (double)y : 0.0;
+}
+
+static void
+simstats_print(const simstats_t *st, const char *name, FILE *dst) {
+  fprintf(dst, "%-12s hit: %6.2f%%  data hit: %6.2f%%  misses: %.0f\n",
+               name,
+               percent(st->hits, st->lookups),
+               percent(st->data_hits, st->data_lookups),
+               (double)(st->lookups - st->hits));
+}
+
+static void
+noop_deleter(const ldb_slice_t *key, void *value) {
+  (void)key;
+  (void)value;
+}
+
+/*
+ * Simulator
+ */
+
+int
+ldb_simulate_cache(const char *fname,
+                   const size_t *capacities,
+                   int count,
+                   enum ldb_lru_policy policy,
+                   FILE *dst) {
+  ldb_tracereader_t *rd;
+  ldb_lru_t **caches;
+  simstats_t *stats;
+  simstats_t observed;
+  ldb_tracerec_t rec;
+  char name[32];
+  int i, rc;
+
+  rc = ldb_tracereader_open(fname, &rd);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  caches = ldb_malloc((count + 1) * sizeof(ldb_lru_t *));
+  stats = ldb_malloc((count + 1) * sizeof(simstats_t));
+
+  simstats_init(&observed);
+
+  for (i = 0; i < count; i++) {
+    caches[i] = ldb_lru_create_policy(capacities[i], 4, policy);
+    simstats_init(&stats[i]);
+  }
+
+  while (ldb_tracereader_next(rd, &rec)) {
+    if (rec.op != LDB_TRACE_BLOCK)
+      continue;
+
+    simstats_update(&observed, &rec, rec.hit);
+
+    for (i = 0; i < count; i++) {
+      ldb_entry_t *h = ldb_lru_lookup(caches[i], &rec.key);
+
+      simstats_update(&stats[i], &rec, h != NULL);
+
+      if (h == NULL && rec.fill) {
+        h = ldb_lru_insert(caches[i], &rec.key, NULL,
+                           rec.value_size, noop_deleter);
+      }
+
+      if (h != NULL)
+        ldb_lru_release(caches[i], h);
+    }
+  }
+
+  ldb_tracereader_close(rd);
+
+  fprintf(dst, "lookups: %.0f (%.0f data)\n",
+               (double)observed.lookups,
+               (double)observed.data_lookups);
+
+  simstats_print(&observed, "observed", dst);
+
+  for (i = 0; i < count; i++) {
+    sprintf(name, "%.2fMB", (double)capacities[i] / 1048576.0);
+
+    simstats_print(&stats[i], name, dst);
+
+    ldb_lru_destroy(caches[i]);
+  }
+
+  ldb_free(stats);
+  ldb_free(caches);
+
+  return LDB_OK;
+}
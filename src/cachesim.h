@@ -0,0 +1,34 @@
+/*!
+ * cachesim.h - block cache simulator for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_CACHESIM_H
+#define LDB_CACHESIM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "util/cache.h"
+#include "util/extern.h"
+
+/* Replay the block cache lookups recorded in the trace file named by
+ * fname (see options.block_tracer) against a simulated cache of each
+ * of the given capacities, and write the resulting hit ratios to *dst
+ * in text format, one line per capacity.
+ *
+ * Blocks are charged their size on disk, and a miss only inserts the
+ * block if the traced lookup did.
+ *
+ * Returns a non-OK result if fname cannot be read as a trace.
+ */
+LDB_EXTERN int
+ldb_simulate_cache(const char *fname,
+                   const size_t *capacities,
+                   int count,
+                   enum ldb_lru_policy policy,
+                   FILE *dst);
+
+#endif /* LDB_CACHESIM_H */
@@ -14,31 +14,46 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "table/format.h"
 #include "table/iterator.h"
 #include "table/merger.h"
 #include "table/table.h"
 #include "table/table_builder.h"
 
+#include "util/arena.h"
 #include "util/array.h"
 #include "util/atomic.h"
 #include "util/bloom.h"
 #include "util/buffer.h"
 #include "util/cache.h"
+#include "util/cfilter.h"
 #include "util/coding.h"
 #include "util/comparator.h"
 #include "util/crc32c.h"
 #include "util/env.h"
 #include "util/internal.h"
+#include "util/latency.h"
+#include "util/listener.h"
+#include "util/mergeop.h"
 #include "util/options.h"
+#include "util/perf.h"
+#include "util/pinned.h"
 #include "util/port.h"
+#include "util/prefix.h"
+#include "util/ratelimit.h"
 #include "util/rbt.h"
 #include "util/slice.h"
+#include "util/statistics.h"
 #include "util/status.h"
 #include "util/strutil.h"
 #include "util/thread_pool.h"
+#include "util/trace.h"
 #include "util/vector.h"
+#include "util/wbm.h"
 
+#include "blob.h"
 #include "builder.h"
 #include "db_impl.h"
 #include "db_iter.h"
@@ -48,6 +63,7 @@
 #include "log_reader.h"
 #include "log_writer.h"
 #include "memtable.h"
+#include "rangedel.h"
 #include "snapshot.h"
 #include "table_cache.h"
 #include "version_edit.h"
@@ -58,28 +74,182 @@
  * DBImpl::ManualCompaction
  */
 
-/* Information for a manual compaction. */
-typedef struct ldb_manual_s {
-  int level;
-  int done;
+/* A part of the key range of a manual compaction. */
+typedef struct ldb_mpart_s {
   const ldb_ikey_t *begin; /* null means beginning of key range. */
   const ldb_ikey_t *end;   /* null means end of key range. */
+  ldb_ikey_t begin_storage;
+  ldb_ikey_t end_storage;
   ldb_ikey_t tmp_storage;  /* Used to keep track of compaction progress. */
+  int claimed; /* Compacted in the current round. */
+  int done;
+} ldb_mpart_t;
+
+/* Information for a manual compaction. Its key range is split into
+   disjoint parts, which may be compacted at the same time. Each round
+   (while the compaction is installed as db->manual_compaction) runs
+   one compaction on every part which is not done. */
+typedef struct ldb_manual_s {
+  int level;
+  int done;
+  ldb_mpart_t *parts;
+  int length;
+  int running; /* Parts being compacted. */
 } ldb_manual_t;
 
 static void
-ldb_manual_init(ldb_manual_t *m, int level) {
+ldb_mpart_init(ldb_mpart_t *part, const ldb_slice_t *begin,
+                                  const ldb_slice_t *end) {
+  ldb_ikey_init(&part->begin_storage);
+  ldb_ikey_init(&part->end_storage);
+  ldb_ikey_init(&part->tmp_storage);
+
+  part->begin = NULL;
+  part->end = NULL;
+  part->claimed = 0;
+  part->done = 0;
+
+  if (begin != NULL) {
+    ldb_ikey_set(&part->begin_storage, begin, LDB_MAX_SEQUENCE,
+                                              LDB_VALTYPE_SEEK);
+    part->begin = &part->begin_storage;
+  }
+
+  if (end != NULL) {
+    ldb_ikey_set(&part->end_storage, end, 0, (ldb_valtype_t)0);
+    part->end = &part->end_storage;
+  }
+}
+
+static void
+ldb_mpart_clear(ldb_mpart_t *part) {
+  ldb_ikey_clear(&part->begin_storage);
+  ldb_ikey_clear(&part->end_storage);
+  ldb_ikey_clear(&part->tmp_storage);
+}
+
+/* Split [begin,end] at "level" into up to max_parts parts of about
+   equal size, on the boundaries of the level's files. */
+static void
+ldb_manual_init(ldb_manual_t *m, ldb_version_t *current,
+                                 int level,
+                                 int max_parts,
+                                 const ldb_slice_t *begin,
+                                 const ldb_slice_t *end) {
+  ldb_vector_t files; /* ldb_filemeta_t */
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  size_t i, first;
+
   m->level = level;
   m->done = 0;
-  m->begin = NULL;
-  m->end = NULL;
+  m->running = 0;
+  m->length = 0;
+
+  ldb_vector_init(&files);
+
+  /* Level-0 files may overlap each other. */
+  if (level > 0 && max_parts > 1) {
+    ldb_mpart_t whole;
+
+    ldb_mpart_init(&whole, begin, end);
+
+    ldb_version_get_overlapping_inputs(current, level, whole.begin,
+                                                       whole.end,
+                                                       &files);
+
+    ldb_mpart_clear(&whole);
+  }
+
+  if ((size_t)max_parts > files.length)
+    max_parts = LDB_MAX(1, (int)files.length);
+
+  m->parts = ldb_malloc(max_parts * sizeof(ldb_mpart_t));
+
+  for (i = 0; i < files.length; i++) {
+    const ldb_filemeta_t *f = files.items[i];
+
+    total += f->file_size;
+  }
+
+  /* The last file always ends the last part. */
+  for (i = 0, first = 0; i + 1 < files.length; i++) {
+    const ldb_filemeta_t *f = files.items[i];
 
-  ldb_ikey_init(&m->tmp_storage);
+    sum += f->file_size;
+
+    if (m->length < max_parts - 1 &&
+        sum * max_parts >= total * (m->length + 1)) {
+      const ldb_filemeta_t *lo = files.items[first];
+      ldb_slice_t smallest = ldb_ikey_user_key(&lo->smallest);
+      ldb_slice_t largest = ldb_ikey_user_key(&f->largest);
+
+      ldb_mpart_init(&m->parts[m->length++], first > 0 ? &smallest : begin,
+                                             &largest);
+
+      first = i + 1;
+    }
+  }
+
+  if (first > 0) {
+    const ldb_filemeta_t *lo = files.items[first];
+    ldb_slice_t smallest = ldb_ikey_user_key(&lo->smallest);
+
+    ldb_mpart_init(&m->parts[m->length++], &smallest, end);
+  } else {
+    ldb_mpart_init(&m->parts[m->length++], begin, end);
+  }
+
+  ldb_vector_clear(&files);
 }
 
 static void
 ldb_manual_clear(ldb_manual_t *m) {
-  ldb_ikey_clear(&m->tmp_storage);
+  int i;
+
+  for (i = 0; i < m->length; i++)
+    ldb_mpart_clear(&m->parts[i]);
+
+  ldb_free(m->parts);
+}
+
+/* Begin a round of compactions. */
+static void
+ldb_manual_start(ldb_manual_t *m) {
+  int i;
+
+  for (i = 0; i < m->length; i++)
+    m->parts[i].claimed = 0;
+}
+
+/* A part with no compaction in this round (or NULL). */
+static ldb_mpart_t *
+ldb_manual_next(ldb_manual_t *m) {
+  int i;
+
+  for (i = 0; i < m->length; i++) {
+    ldb_mpart_t *part = &m->parts[i];
+
+    if (!part->done && !part->claimed)
+      return part;
+  }
+
+  return NULL;
+}
+
+/* Number of threads the current round can keep busy. */
+static int
+ldb_manual_slots(const ldb_manual_t *m) {
+  int slots = m->running;
+  int i;
+
+  for (i = 0; i < m->length; i++) {
+    const ldb_mpart_t *part = &m->parts[i];
+
+    slots += (!part->done && !part->claimed);
+  }
+
+  return slots;
 }
 
 /*
@@ -116,9 +286,15 @@ ldb_stats_add(ldb_stats_t *z, const ldb_stats_t *x) {
 typedef struct ldb_waiter_s {
   int status;
   ldb_batch_t *batch;
+  const struct ldb_txn_s *txn; /* Validated before the batch is written. */
   int sync;
+  int disable_wal;
   int done;
   ldb_cond_t cv;
+  /* Set by the group leader for a concurrent memtable insert. */
+  ldb_memtable_t *mem;
+  struct ldb_waiter_s *leader;
+  int pending;
   struct ldb_waiter_s *next;
 } ldb_waiter_t;
 
@@ -126,8 +302,13 @@ static void
 ldb_waiter_init(ldb_waiter_t *w) {
   w->status = LDB_OK;
   w->batch = NULL;
+  w->txn = NULL;
   w->sync = 0;
+  w->disable_wal = 0;
   w->done = 0;
+  w->mem = NULL;
+  w->leader = NULL;
+  w->pending = 0;
   w->next = NULL;
 
   ldb_cond_init(&w->cv);
@@ -194,15 +375,25 @@ ldb_queue_shift(ldb_queue_t *queue) {
 typedef struct ldb_output_s {
   uint64_t number;
   uint64_t file_size;
+  uint64_t tombstones;
+  uint64_t entries;
+  uint64_t deletions;
+  uint64_t oldest_blob; /* Oldest blob file referenced (zero if none). */
+  int path_id;
   ldb_ikey_t smallest, largest;
 } ldb_output_t;
 
 static ldb_output_t *
-ldb_output_create(uint64_t number) {
+ldb_output_create(uint64_t number, int path_id) {
   ldb_output_t *out = ldb_malloc(sizeof(ldb_output_t));
 
   out->number = number;
+  out->path_id = path_id;
   out->file_size = 0;
+  out->tombstones = 0;
+  out->entries = 0;
+  out->deletions = 0;
+  out->oldest_blob = 0;
 
   ldb_ikey_init(&out->smallest);
   ldb_ikey_init(&out->largest);
@@ -217,6 +408,25 @@ ldb_output_destroy(ldb_output_t *out) {
   ldb_free(out);
 }
 
+/*
+ * CompactionProgress
+ */
+
+/* A running compaction, for the "leveldb.compaction-progress"
+   property. Guarded by the database mutex. */
+typedef struct ldb_progress_s {
+  ldb_compaction_t *compaction;
+  int64_t start_micros;
+  int input_files;
+  uint64_t input_bytes;
+  uint64_t processed_bytes; /* Input bytes before the current keys. */
+  int output_files;
+  uint64_t output_bytes;
+} ldb_progress_t;
+
+/* Entry bytes read between updates of the processed bytes. */
+#define LDB_PROGRESS_INTERVAL (1 << 20)
+
 /*
  * CompactionState
  */
@@ -230,13 +440,62 @@ typedef struct ldb_cstate_s {
      we can drop all entries for the same key with sequence numbers < S. */
   ldb_seqnum_t smallest_snapshot;
 
+  /* Entries newer than largest_snapshot are not visible to any
+     snapshot and may be passed to the compaction filter. */
+  ldb_seqnum_t largest_snapshot;
+
+  /* Whether any snapshot existed. Without one, every entry may be
+     filtered, including those whose sequence numbers were zeroed. */
+  int has_snapshots;
+
+  /* Sequence numbers of the live snapshots in ascending order, ending
+     with the last sequence at the start of the compaction. An entry
+     followed by a newer one for its key is only kept if one of these
+     falls between the two: no reader could see it otherwise. */
+  ldb_array_t snapshots;
+
+  /* User key range (start, end] covered by this state. Subcompactions
+     each cover a part of the compaction's key range. */
+  ldb_slice_t start, end;
+  int has_start, has_end;
+
   ldb_vector_t outputs; /* ldb_output_t */
 
+  /* File number reserved for the first output (zero if none). */
+  uint64_t number;
+
   /* State kept for output being generated. */
   ldb_wfile_t *outfile;
   ldb_tablegen_t *builder;
 
+  /* Blob file of the current output (opened once a value needs it),
+     and scratch space for the entries referencing it. */
+  ldb_blobgen_t *blobs;
+  ldb_buffer_t blob_key;
+  ldb_buffer_t blob_ref;
+
+  /* Values in blob files numbered below this are moved to new ones. */
+  uint64_t blob_cutoff;
+
+  /* Compression dictionary shared by all outputs (may be NULL). */
+  const ldb_slice_t *dict;
+
+  /* Range tombstones of the input files (may be NULL). A tombstone is
+     written out once the input reaches its start key, and the output
+     is not switched until the input has passed its end key. */
+  const ldb_rangedel_t *tombstones;
+  size_t next_tombstone;
+  ldb_buffer_t tombstone_end;
+  int has_tombstone_end;
+
   uint64_t total_bytes;
+
+  /* Progress shared by the subcompactions (may be NULL). Each state
+     adds the input bytes between its first key and its current key. */
+  ldb_progress_t *progress;
+  uint64_t last_offset;
+  int has_offset;
+  size_t unreported; /* Entry bytes read since the last update. */
 } ldb_cstate_t;
 
 static ldb_cstate_t *
@@ -245,11 +504,30 @@ ldb_cstate_create(ldb_compaction_t *c) {
 
   state->compaction = c;
   state->smallest_snapshot = 0;
+  state->largest_snapshot = 0;
+  state->has_snapshots = 0;
+  state->has_start = 0;
+  state->has_end = 0;
+  state->number = 0;
   state->outfile = NULL;
   state->builder = NULL;
+  state->blobs = NULL;
+  state->blob_cutoff = 0;
+  state->dict = NULL;
+  state->tombstones = NULL;
+  state->next_tombstone = 0;
+  state->has_tombstone_end = 0;
   state->total_bytes = 0;
+  state->progress = NULL;
+  state->last_offset = 0;
+  state->has_offset = 0;
+  state->unreported = 0;
 
   ldb_vector_init(&state->outputs);
+  ldb_array_init(&state->snapshots);
+  ldb_buffer_init(&state->blob_key);
+  ldb_buffer_init(&state->blob_ref);
+  ldb_buffer_init(&state->tombstone_end);
 
   return state;
 }
@@ -261,15 +539,163 @@ ldb_cstate_destroy(ldb_cstate_t *state) {
   for (i = 0; i < state->outputs.length; i++)
     ldb_output_destroy(state->outputs.items[i]);
 
+  if (state->blobs != NULL)
+    ldb_blobgen_destroy(state->blobs);
+
   ldb_vector_clear(&state->outputs);
+  ldb_array_clear(&state->snapshots);
+  ldb_buffer_clear(&state->blob_key);
+  ldb_buffer_clear(&state->blob_ref);
+  ldb_buffer_clear(&state->tombstone_end);
   ldb_free(state);
 }
 
+/* Whether a snapshot sees sequence numbers in [lo, hi). */
+static int
+ldb_snapshot_between(const ldb_cstate_t *state,
+                     ldb_seqnum_t lo,
+                     ldb_seqnum_t hi) {
+  const ldb_array_t *snaps = &state->snapshots;
+  size_t left = 0;
+  size_t right = snaps->length;
+
+  /* Find the oldest snapshot at or above lo. */
+  while (left < right) {
+    size_t mid = left + (right - left) / 2;
+
+    if (snaps->items[mid] < lo)
+      left = mid + 1;
+    else
+      right = mid;
+  }
+
+  return left < snaps->length && snaps->items[left] < hi;
+}
+
 static ldb_output_t *
 ldb_cstate_top(ldb_cstate_t *state) {
   return ldb_vector_top(&state->outputs);
 }
 
+/* Move the outputs of a finished subcompaction into *z and destroy x. */
+static void
+ldb_cstate_merge(ldb_cstate_t *z, ldb_cstate_t *x) {
+  size_t i;
+
+  if (x->builder != NULL) {
+    /* May happen if the subcompaction failed. */
+    ldb_tablegen_abandon(x->builder);
+    ldb_tablegen_destroy(x->builder);
+  }
+
+  if (x->outfile != NULL)
+    ldb_wfile_destroy(x->outfile);
+
+  if (x->blobs != NULL) {
+    ldb_blobgen_destroy(x->blobs);
+    x->blobs = NULL;
+  }
+
+  for (i = 0; i < x->outputs.length; i++)
+    ldb_vector_push(&z->outputs, x->outputs.items[i]);
+
+  z->total_bytes += x->total_bytes;
+
+  x->outputs.length = 0;
+
+  ldb_cstate_destroy(x);
+}
+
+/*
+ * SuperVersion
+ */
+
+#if defined(LDB_TLS) && defined(LDB_HAVE_ATOMIC_PTR_CAS)
+#  define LDB_SUPER_CACHE
+#endif
+
+/* Number of cached superversions per database. Threads sharing a
+   slot fall back to the mutex when it is taken, and may put back a
+   superversion which has since been invalidated: each is stamped
+   with the generation it was built in, and a stale one is dropped
+   rather than read from. */
+#define LDB_SUPER_SLOTS 64
+
+/* The memtables and version a read needs, referenced as one. A copy
+   is cached per reader thread so that reads can skip the mutex. */
+typedef struct ldb_super_s {
+  ldb_memtable_t *mem;
+  ldb_memtable_t *imm; /* May be null. */
+  ldb_version_t *current;
+  int number; /* Generation (see ldb_super_invalidate()). */
+  int refs;   /* Guarded by the DB mutex. */
+} ldb_super_t;
+
+#ifdef LDB_SUPER_CACHE
+/* Sits in a thread's slot while the thread reads. */
+static ldb_super_t ldb_super_inuse;
+
+/* Threads seen so far, for handing out slots. */
+static ldb_atomic(int) ldb_super_threads;
+
+/* This thread's slot (-1 if not yet assigned). */
+static LDB_TLS int ldb_super_slot = -1;
+#endif
+
+/* REQUIRES: DB mutex held. */
+static ldb_super_t *
+ldb_super_create(ldb_memtable_t *mem,
+                 ldb_memtable_t *imm,
+                 ldb_version_t *current,
+                 int number) {
+  ldb_super_t *sv = ldb_malloc(sizeof(ldb_super_t));
+
+  sv->mem = mem;
+  sv->imm = imm;
+  sv->current = current;
+  sv->number = number;
+  sv->refs = 1;
+
+  ldb_memtable_ref(mem);
+
+  if (imm != NULL)
+    ldb_memtable_ref(imm);
+
+  ldb_version_ref(current);
+
+  return sv;
+}
+
+/* REQUIRES: DB mutex held. */
+static void
+ldb_super_unref(ldb_super_t *sv) {
+  assert(sv->refs >= 1);
+
+  if (--sv->refs > 0)
+    return;
+
+  ldb_memtable_unref(sv->mem);
+
+  if (sv->imm != NULL)
+    ldb_memtable_unref(sv->imm);
+
+  ldb_version_unref(sv->current);
+
+  ldb_free(sv);
+}
+
+#ifdef LDB_SUPER_CACHE
+static ldb_super_t *
+ldb_super_swap(ldb_atomic_ptr(ldb_super_t) *slot, ldb_super_t *sv) {
+  ldb_super_t *old = ldb_atomic_load_ptr(slot, ldb_order_acquire);
+
+  while (!ldb_atomic_compare_exchange_ptr(slot, &old, sv))
+    ;
+
+  return old;
+}
+#endif
+
 /*
  * IterState
  */
@@ -280,19 +706,29 @@ typedef struct ldb_istate_s {
   ldb_version_t *version;
   ldb_memtable_t *mem;
   ldb_memtable_t *imm;
+  /* The children of the merging iterator which a refresh may keep
+     (see ldb_iter_refresh()), and the options they were made with. */
+  ldb_readopt_t options;
+  ldb_iter_t *mem_iter;
+  ldb_iter_t *imm_iter;     /* May be null. */
+  ldb_array_t numbers;      /* Level-0 files iterated over. */
+  ldb_vector_t tables;      /* Their iterators (ldb_iter_t). */
 } ldb_istate_t;
 
 static ldb_istate_t *
-ldb_istate_create(ldb_mutex_t *mutex,
-                  ldb_memtable_t *mem,
-                  ldb_memtable_t *imm,
-                  ldb_version_t *version) {
+ldb_istate_create(ldb_mutex_t *mutex, const ldb_readopt_t *options) {
   ldb_istate_t *state = ldb_malloc(sizeof(ldb_istate_t));
 
   state->mu = mutex;
-  state->version = version;
-  state->mem = mem;
-  state->imm = imm;
+  state->version = NULL;
+  state->mem = NULL;
+  state->imm = NULL;
+  state->options = *options;
+  state->mem_iter = NULL;
+  state->imm_iter = NULL;
+
+  ldb_array_init(&state->numbers);
+  ldb_vector_init(&state->tables);
 
   return state;
 }
@@ -310,6 +746,8 @@ ldb_istate_destroy(ldb_istate_t *state) {
 
   ldb_mutex_unlock(state->mu);
 
+  ldb_array_clear(&state->numbers);
+  ldb_vector_clear(&state->tables);
   ldb_free(state);
 }
 
@@ -325,21 +763,131 @@ static const int non_table_cache_files = 10;
   if ((val) < (min)) (val) = (min);       \
 } while (0)
 
+/* Clip the options which ldb_set_options() may change. */
+static void
+sanitize_mutable(ldb_dbopt_t *result) {
+  clip_to_range(result->write_buffer_size, 64 << 10, 1 << 30);
+
+  if (result->memtable_huge_page_size > 0) {
+    size_t size = result->memtable_huge_page_size;
+
+    clip_to_range(size, 2 << 20, 1 << 30);
+
+    result->memtable_huge_page_size = ((size + (2 << 20) - 1) >> 21) << 21;
+
+    /* A region is charged in full as soon as it is mapped. */
+    if (result->memtable_huge_page_size > result->write_buffer_size / 4)
+      result->memtable_huge_page_size = 0;
+  }
+
+  clip_to_range(result->max_file_size, 1 << 20, 1 << 30);
+  clip_to_range(result->block_size, 1 << 10, 4 << 20);
+  clip_to_range(result->level0_file_num_compaction_trigger, 1, 1000);
+  clip_to_range(result->level0_slowdown_writes_trigger, 1, 1000);
+  clip_to_range(result->level0_stop_writes_trigger,
+                result->level0_slowdown_writes_trigger + 1, 1001);
+
+  if (result->max_bytes_for_level_base < (64 << 10))
+    result->max_bytes_for_level_base = 64 << 10;
+
+  if (!(result->max_bytes_for_level_multiplier >= 1.0))
+    result->max_bytes_for_level_multiplier = 1.0;
+
+  if (!(result->max_file_size_multiplier >= 1.0))
+    result->max_file_size_multiplier = 1.0;
+
+  if (result->memtable_bloom_size > result->write_buffer_size)
+    result->memtable_bloom_size = result->write_buffer_size;
+}
+
 ldb_dbopt_t
 ldb_sanitize_options(const char *dbname,
                      const ldb_comparator_t *icmp,
                      const ldb_bloom_t *ipolicy,
+                     const ldb_prefix_t *iprefix,
                      const ldb_dbopt_t *src) {
   ldb_dbopt_t result = *src;
   int rc = LDB_OK;
 
   result.comparator = icmp;
   result.filter_policy = (src->filter_policy != NULL) ? ipolicy : NULL;
+  result.prefix_extractor = (src->prefix_extractor != NULL) ? iprefix : NULL;
+
+  if (result.max_open_files != -1)
+    clip_to_range(result.max_open_files, 64 + non_table_cache_files, 50000);
+
+  sanitize_mutable(&result);
+
+  clip_to_range(result.index_block_restart_interval, 1, 1024);
+  clip_to_range(result.max_background_compactions, 1, 64);
+  clip_to_range(result.max_subcompactions, 1, 64);
+  clip_to_range(result.max_insert_threads, 1, 64);
+  clip_to_range(result.max_manual_compactions, 1, 64);
+  clip_to_range(result.max_file_opening_threads, 0, 64);
+  clip_to_range(result.write_group_delay, 0, 1000000);
+  clip_to_range(result.max_write_group_size, 64 << 10, 64 << 20);
+  clip_to_range(result.num_levels, 2, LDB_MAX_LEVELS);
+  clip_to_range(result.iter_deletion_trigger, 0, 1 << 30);
+  clip_to_range(result.tombstone_sample_weight, 1, 1000);
+  clip_to_range(result.recycle_log_file_num, 0, 1000);
+  clip_to_range(result.wal_sync_interval, 0, 3600000);
+
+  if (result.max_mapped_tables < 0)
+    result.max_mapped_tables = -1;
+
+  /* Nothing outlives an in-memory database, and its tables are
+     mapped and read in place rather than cached. */
+  if (result.in_memory) {
+    result.create_if_missing = 1;
+    result.error_if_exists = 0;
+    result.reuse_logs = 0;
+    result.recycle_log_file_num = 0;
+    result.wal_sync_interval = 0;
+    result.compression = LDB_NO_COMPRESSION;
+    result.compression_per_level = NULL;
+    result.compression_levels = 0;
+    result.use_mmap = 1;
+    result.use_direct_reads = 0;
+    result.max_mapped_tables = -1;
+  }
+
+  /* Appending to a recycled log would leave stale records in between. */
+  if (result.recycle_log_file_num > 0)
+    result.reuse_logs = 0;
+
+  if (!(result.blob_gc_age_cutoff >= 0.0))
+    result.blob_gc_age_cutoff = 0.0;
+
+  if (result.blob_gc_age_cutoff > 1.0)
+    result.blob_gc_age_cutoff = 1.0;
+
+  /* Keep the bucket array within a quarter of the write buffer. */
+  clip_to_range(result.memtable_hash_buckets, 1,
+                result.write_buffer_size / (4 * sizeof(void *)));
+
+  if (result.compression_per_level == NULL || result.compression_levels <= 0) {
+    result.compression_per_level = NULL;
+    result.compression_levels = 0;
+  }
+
+  if (result.block_size_per_level == NULL || result.block_size_levels <= 0) {
+    result.block_size_per_level = NULL;
+    result.block_size_levels = 0;
+  }
+
+  if (result.restart_interval_per_level == NULL
+      || result.restart_interval_levels <= 0) {
+    result.restart_interval_per_level = NULL;
+    result.restart_interval_levels = 0;
+  }
+
+  if (result.db_paths == NULL || result.num_db_paths <= 0) {
+    result.db_paths = NULL;
+    result.num_db_paths = 0;
+  }
 
-  clip_to_range(result.max_open_files, 64 + non_table_cache_files, 50000);
-  clip_to_range(result.write_buffer_size, 64 << 10, 1 << 30);
-  clip_to_range(result.max_file_size, 1 << 20, 1 << 30);
-  clip_to_range(result.block_size, 1 << 10, 4 << 20);
+  clip_to_range(result.wal_block_size, 4 << 10, 4 << 20);
+  clip_to_range(result.compression_threads, 1, 64);
 
   if (result.info_log == NULL) {
     char info[LDB_PATH_MAX];
@@ -373,6 +921,10 @@ ldb_sanitize_options(const char *dbname,
 
 static int
 table_cache_size(const ldb_dbopt_t *sanitized_options) {
+  /* Keep every table open. */
+  if (sanitized_options->max_open_files == -1)
+    return -1;
+
   /* Reserve ten files or so for other uses and give the rest to TableCache. */
   return sanitized_options->max_open_files - non_table_cache_files;
 }
@@ -387,6 +939,8 @@ struct ldb_s {
   ldb_bloom_t user_filter_policy;
   ldb_comparator_t internal_comparator;
   ldb_bloom_t internal_filter_policy;
+  ldb_prefix_t user_prefix;
+  ldb_prefix_t internal_prefix;
   ldb_dbopt_t options; /* options.comparator == &internal_comparator */
   int owns_info_log;
   int owns_cache;
@@ -395,6 +949,12 @@ struct ldb_s {
   /* table_cache provides its own synchronization. */
   ldb_tables_t *table_cache;
 
+  /* Operation latencies (may be NULL). Synchronized internally. */
+  ldb_latency_t *latency;
+
+  /* Operation trace (see ldb_start_trace()). Synchronized internally. */
+  ldb_tracer_t *tracer;
+
   /* Lock over the persistent DB state. Non-null iff successfully acquired. */
   ldb_filelock_t *db_lock;
 
@@ -404,7 +964,16 @@ struct ldb_s {
   ldb_cond_t background_work_finished_signal;
   ldb_memtable_t *mem;
   ldb_memtable_t *imm; /* Memtable being compacted. */
-  ldb_atomic(int) has_imm; /* So bg thread can detect non-null imm. */
+  ldb_super_t *super; /* Built lazily from mem, imm and current. */
+#ifdef LDB_SUPER_CACHE
+  ldb_atomic_ptr(ldb_super_t) super_slots[LDB_SUPER_SLOTS];
+  ldb_atomic(int64_t) visible_sequence; /* last_sequence for the slots. */
+#endif
+  ldb_atomic(int) super_number; /* Bumped by ldb_super_invalidate(). */
+  int mem_unlogged; /* Memtable holds writes missing from the log. */
+  int imm_unlogged;
+  ldb_arenapool_t arena_pool; /* Memory of flushed memtables. */
+  ldb_wbmclient_t wbm_client; /* Share of options.write_buffer_manager. */
   ldb_wfile_t *logfile;
   uint64_t logfile_number;
   ldb_writer_t *log;
@@ -412,7 +981,13 @@ struct ldb_s {
 
   /* Queue of writers. */
   ldb_queue_t writers;
-  ldb_batch_t *tmp_batch;
+
+  /* Memtable stage of pipelined writes. At most one write group is
+     inserting into the memtable at a time; mem_stage_sequence is the
+     last sequence number handed out to that group. */
+  int mem_stage_busy;
+  ldb_seqnum_t mem_stage_sequence;
+  ldb_cond_t mem_stage_cv;
 
   ldb_snaplist_t snapshots;
 
@@ -420,25 +995,227 @@ struct ldb_s {
      part of ongoing compactions. */
   rb_set64_t pending_outputs;
 
-  /* Thread pool. */
+  /* Number of checkpoints in progress. No files are deleted meanwhile. */
+  int checkpoints;
+
+  /* Removes obsolete files if options.background_deletes is set (NULL
+     otherwise). One batch is queued at a time: "deleting" is set while
+     it is, and "delete_again" if more files became obsolete meanwhile. */
+  ldb_pool_t *delete_pool;
+  int deleting;
+  int delete_again;
+
+  /* Reads the blocks listed in the BLOCKCACHE file back into the block
+     cache if options.block_cache_dump is set (NULL otherwise), one job
+     per table. "warming" counts the jobs left, which hold a reference
+     to "warm_base" until the last one is done. */
+  ldb_pool_t *warm_pool;
+  struct ldb_warmjob_s *warm_jobs;
+  int warming;
+  ldb_version_t *warm_base;
+
+  /* Opened by ldb_open_readonly(): nothing is written. */
+  int read_only;
+
+  /* Obsolete logs kept to be reused (oldest first), and the number of
+     the first log created by this instance. Older logs may not be in
+     the recyclable format, and are never reused. */
+  ldb_array_t recycled_logs;
+  uint64_t first_log_number;
+
+  /* Thread pool (options.thread_pool if set). */
   ldb_pool_t *pool;
 
-  /* Has a background compaction been scheduled or is running? */
+  /* Dedicated thread for memtable flushes (or options.thread_pool). */
+  ldb_pool_t *flush_pool;
+
+  /* Extra threads for subcompactions (may be NULL). */
+  ldb_pool_t *sub_pool;
+
+  /* Extra threads inserting large batches (may be NULL). */
+  ldb_pool_t *insert_pool;
+
+  /* Thread syncing the log every options.wal_sync_interval ms. */
+  ldb_thread_t wal_thread;
+  int wal_thread_running;
+
+  /* Number of background compactions scheduled or running. */
   int background_compaction_scheduled;
 
+  /* Has a memtable flush been scheduled or is running? */
+  int flush_scheduled;
+
   ldb_manual_t *manual_compaction;
 
+  /* Number of automatic compactions in progress. */
+  int automatic_compactions;
+
+  /* Running compactions. */
+  ldb_vector_t compactions; /* ldb_progress_t */
+
+  /* Is an ingestion picking the level of its table? */
+  int ingesting;
+
   ldb_versions_t *versions;
 
   /* Have we encountered a background error in paranoid mode? */
   int bg_error;
 
-  ldb_stats_t stats[LDB_NUM_LEVELS];
+  ldb_stats_t stats[LDB_MAX_LEVELS];
+
+  /* Bytes written by memtable flushes (for write amplification). */
+  int64_t flush_bytes;
+
+  /* Write delay controller (see ldb_delay_write()). */
+  double compaction_rate; /* Average compaction output, bytes/sec. */
+  double pending_debt; /* ldb_versions_pending_debt() after last change. */
+  int64_t delay_until; /* Time until which earlier writes are paced. */
 };
 
+/*
+ * SuperVersion (DB)
+ */
+
+/* Make the last sequence visible to reads taking a cached superversion. */
+/* REQUIRES: db->mutex held. */
+static void
+ldb_publish_sequence(ldb_t *db) {
+#ifdef LDB_SUPER_CACHE
+  ldb_atomic_store(&db->visible_sequence, db->versions->last_sequence,
+                   ldb_order_release);
+#else
+  (void)db;
+#endif
+}
+
+/* Drop the superversion and every cached copy of it. Must be
+   called whenever mem, imm or the current version change. */
+/* REQUIRES: db->mutex held. */
+static void
+ldb_super_invalidate(ldb_t *db) {
+#ifdef LDB_SUPER_CACHE
+  int i;
+#endif
+
+  /* Superversions built before now must not be cached again. */
+  ldb_atomic_fetch_add(&db->super_number, 1, ldb_order_release);
+
+#ifdef LDB_SUPER_CACHE
+  for (i = 0; i < LDB_SUPER_SLOTS; i++) {
+    ldb_super_t *sv = ldb_super_swap(&db->super_slots[i], NULL);
+
+    /* A thread still reading finds its slot emptied on release. */
+    if (sv != NULL && sv != &ldb_super_inuse)
+      ldb_super_unref(sv);
+  }
+#endif
+
+  if (db->super != NULL) {
+    ldb_super_unref(db->super);
+    db->super = NULL;
+  }
+
+  ldb_publish_sequence(db);
+}
+
+/* REQUIRES: db->mutex held. */
+static ldb_super_t *
+ldb_super_get(ldb_t *db) {
+  if (db->super == NULL) {
+    db->super = ldb_super_create(db->mem, db->imm,
+                                 db->versions->current,
+                                 ldb_atomic_load(&db->super_number,
+                                                 ldb_order_relaxed));
+
+    ldb_publish_sequence(db);
+  }
+
+  db->super->refs++;
+
+  return db->super;
+}
+
+/* Reference the state a read needs and the sequence it reads at,
+   without the mutex if this thread's cached copy is still current.
+   The sequence is loaded after the state: any write it covers which
+   is missing from the state went to a newer memtable, and everything
+   there is newer than what the state holds. Pass *slot back to
+   ldb_super_release(). */
+static ldb_super_t *
+ldb_super_acquire(ldb_t *db, ldb_seqnum_t *sequence, int *slot) {
+  ldb_super_t *stale = NULL;
+  ldb_super_t *sv;
+
+  *slot = -1;
+
+#ifdef LDB_SUPER_CACHE
+  if (sizeof(db->visible_sequence) >= sizeof(ldb_seqnum_t)) {
+    int i = ldb_super_slot;
+
+    if (i < 0) {
+      i = ldb_atomic_fetch_add(&ldb_super_threads, 1, ldb_order_relaxed);
+      i = (int)((unsigned int)i % LDB_SUPER_SLOTS);
+
+      ldb_super_slot = i;
+    }
+
+    sv = ldb_super_swap(&db->super_slots[i], &ldb_super_inuse);
+
+    if (sv != &ldb_super_inuse) {
+      *slot = i;
+
+      if (sv != NULL && sv->number == ldb_atomic_load(&db->super_number,
+                                                      ldb_order_acquire)) {
+        *sequence = ldb_atomic_load(&db->visible_sequence,
+                                    ldb_order_acquire);
+        return sv;
+      }
+
+      /* Put back by a thread sharing the slot after it was invalidated. */
+      stale = sv;
+    }
+  }
+#endif
+
+  ldb_mutex_lock(&db->mutex);
+
+  if (stale != NULL)
+    ldb_super_unref(stale);
+
+  sv = ldb_super_get(db);
+
+  *sequence = db->versions->last_sequence;
+
+  ldb_mutex_unlock(&db->mutex);
+
+  return sv;
+}
+
+/* Release a superversion, caching it in the thread's slot if it is
+   still current and the slot has not been emptied in the meantime. */
+static void
+ldb_super_release(ldb_t *db, ldb_super_t *sv, int slot) {
+#ifdef LDB_SUPER_CACHE
+  if (slot >= 0 && sv->number == ldb_atomic_load(&db->super_number,
+                                                 ldb_order_acquire)) {
+    ldb_super_t *expect = &ldb_super_inuse;
+
+    if (ldb_atomic_compare_exchange_ptr(&db->super_slots[slot], &expect, sv))
+      return;
+  }
+#else
+  (void)slot;
+#endif
+
+  ldb_mutex_lock(&db->mutex);
+  ldb_super_unref(sv);
+  ldb_mutex_unlock(&db->mutex);
+}
+
 static ldb_t *
-ldb_create(const char *dbname, const ldb_dbopt_t *options) {
+ldb_create(const char *dbname, const ldb_dbopt_t *options, int read_only) {
   ldb_t *db = ldb_malloc(sizeof(ldb_t));
+  ldb_dbopt_t opt = *options;
   size_t len = strlen(dbname);
   int i;
 
@@ -460,10 +1237,20 @@ ldb_create(const char *dbname, const ldb_dbopt_t *options) {
     ldb_ifp_init(&db->internal_filter_policy, ldb_bloom_default);
   }
 
+  if (options->prefix_extractor != NULL) {
+    db->user_prefix = *options->prefix_extractor;
+    ldb_ipe_init(&db->internal_prefix, &db->user_prefix);
+  }
+
+  /* The LOG file belongs to the instance writing the database. */
+  if (read_only && opt.info_log == NULL)
+    opt.info_log = ldb_logger_create(NULL, NULL);
+
   db->options = ldb_sanitize_options(db->dbname,
                                      &db->internal_comparator,
                                      &db->internal_filter_policy,
-                                     options);
+                                     &db->internal_prefix,
+                                     &opt);
 
   db->owns_info_log = (db->options.info_log != options->info_log);
   db->owns_cache = (db->options.block_cache != options->block_cache);
@@ -474,6 +1261,13 @@ ldb_create(const char *dbname, const ldb_dbopt_t *options) {
                                       &db->options,
                                       table_cache_size(&db->options));
 
+  db->latency = NULL;
+
+  if (db->options.track_latency)
+    db->latency = ldb_latency_create();
+
+  db->tracer = ldb_tracer_create();
+
   db->db_lock = NULL;
 
   ldb_mutex_init(&db->mutex);
@@ -484,8 +1278,28 @@ ldb_create(const char *dbname, const ldb_dbopt_t *options) {
 
   db->mem = NULL;
   db->imm = NULL;
+  db->super = NULL;
+
+#ifdef LDB_SUPER_CACHE
+  for (i = 0; i < LDB_SUPER_SLOTS; i++)
+    ldb_atomic_init_ptr(&db->super_slots[i], NULL);
+
+  ldb_atomic_init(&db->visible_sequence, 0);
+#endif
+
+  ldb_atomic_init(&db->super_number, 0);
 
-  ldb_atomic_init(&db->has_imm, 0);
+  db->mem_unlogged = 0;
+  db->imm_unlogged = 0;
+
+  if (db->options.write_buffer_manager != NULL)
+    ldb_wbm_register(db->options.write_buffer_manager, &db->wbm_client);
+
+  /* Enough for the next memtable to reuse all of the last one. */
+  ldb_arenapool_init(&db->arena_pool,
+                     db->options.memtable_huge_page_size,
+                     db->options.write_buffer_size
+                       + db->options.memtable_huge_page_size);
 
   db->logfile = NULL;
   db->logfile_number = 0;
@@ -494,14 +1308,64 @@ ldb_create(const char *dbname, const ldb_dbopt_t *options) {
 
   ldb_queue_init(&db->writers);
 
-  db->tmp_batch = ldb_batch_create();
+  db->mem_stage_busy = 0;
+  db->mem_stage_sequence = 0;
+
+  ldb_cond_init(&db->mem_stage_cv);
 
   ldb_snaplist_init(&db->snapshots);
   rb_set64_init(&db->pending_outputs);
+  ldb_vector_init(&db->compactions);
+
+  db->checkpoints = 0;
+  db->read_only = read_only;
+
+  ldb_array_init(&db->recycled_logs);
+
+  db->first_log_number = ~UINT64_C(0);
+
+  if (db->options.thread_pool != NULL) {
+    db->pool = db->options.thread_pool;
+    db->flush_pool = db->options.thread_pool;
+  } else {
+    db->pool = ldb_pool_create(db->options.max_background_compactions);
+    db->flush_pool = ldb_pool_create(1);
+  }
+
+  db->sub_pool = NULL;
+
+  if (db->options.max_subcompactions > 1)
+    db->sub_pool = ldb_pool_create(db->options.max_subcompactions - 1);
+
+  db->insert_pool = NULL;
+
+  if (db->options.concurrent_memtable_write &&
+      db->options.max_insert_threads > 1) {
+    db->insert_pool = ldb_pool_create(db->options.max_insert_threads - 1);
+  }
+
+  db->delete_pool = NULL;
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+  if (db->options.background_deletes && !read_only)
+    db->delete_pool = ldb_pool_create(1);
+#endif
+
+  db->deleting = 0;
+  db->delete_again = 0;
+
+  db->warm_pool = NULL;
+  db->warm_jobs = NULL;
+  db->warming = 0;
+  db->warm_base = NULL;
+
+  db->wal_thread_running = 0;
 
-  db->pool = ldb_pool_create(1);
   db->background_compaction_scheduled = 0;
+  db->flush_scheduled = 0;
   db->manual_compaction = NULL;
+  db->automatic_compactions = 0;
+  db->ingesting = 0;
 
   db->versions = ldb_versions_create(db->dbname,
                                      &db->options,
@@ -510,9 +1374,14 @@ ldb_create(const char *dbname, const ldb_dbopt_t *options) {
 
   db->bg_error = LDB_OK;
 
-  for (i = 0; i < LDB_NUM_LEVELS; i++)
+  for (i = 0; i < LDB_MAX_LEVELS; i++)
     ldb_stats_init(&db->stats[i]);
 
+  db->flush_bytes = 0;
+  db->compaction_rate = 0;
+  db->pending_debt = 0;
+  db->delay_until = 0;
+
   return db;
 }
 
@@ -523,12 +1392,39 @@ ldb_destroy_internal(ldb_t *db) {
 
   ldb_atomic_store(&db->shutting_down, 1, ldb_order_release);
 
-  while (db->background_compaction_scheduled)
+  while (db->background_compaction_scheduled || db->flush_scheduled ||
+         db->deleting || db->warming) {
     ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+  }
+
+  ldb_super_invalidate(db);
 
   ldb_mutex_unlock(&db->mutex);
 
-  ldb_pool_destroy(db->pool);
+  if (db->wal_thread_running)
+    ldb_thread_join(&db->wal_thread);
+
+  if (db->options.thread_pool == NULL) {
+    ldb_pool_destroy(db->pool);
+    ldb_pool_destroy(db->flush_pool);
+  }
+
+  if (db->options.write_buffer_manager != NULL)
+    ldb_wbm_unregister(db->options.write_buffer_manager, &db->wbm_client);
+
+  if (db->sub_pool != NULL)
+    ldb_pool_destroy(db->sub_pool);
+
+  if (db->insert_pool != NULL)
+    ldb_pool_destroy(db->insert_pool);
+
+  if (db->delete_pool != NULL)
+    ldb_pool_destroy(db->delete_pool);
+
+  if (db->warm_pool != NULL) {
+    ldb_pool_destroy(db->warm_pool);
+    ldb_free(db->warm_jobs);
+  }
 
   if (db->db_lock != NULL)
     ldb_unlock_file(db->db_lock);
@@ -541,16 +1437,24 @@ ldb_destroy_internal(ldb_t *db) {
   if (db->imm != NULL)
     ldb_memtable_unref(db->imm);
 
-  ldb_batch_destroy(db->tmp_batch);
+  ldb_arenapool_clear(&db->arena_pool);
 
-  if (db->log != NULL)
+  if (db->log != NULL) {
+    /* Write out records left buffered by options.manual_wal_flush. */
+    ldb_writer_flush(db->log);
     ldb_writer_destroy(db->log);
+  }
 
   if (db->logfile != NULL)
     ldb_wfile_destroy(db->logfile);
 
   ldb_tables_destroy(db->table_cache);
 
+  if (db->latency != NULL)
+    ldb_latency_destroy(db->latency);
+
+  ldb_tracer_destroy(db->tracer);
+
   if (db->owns_info_log)
     ldb_logger_destroy(db->options.info_log);
 
@@ -561,9 +1465,12 @@ ldb_destroy_internal(ldb_t *db) {
   assert(ldb_snaplist_empty(&db->snapshots));
 
   rb_set64_clear(&db->pending_outputs);
+  ldb_vector_clear(&db->compactions);
+  ldb_array_clear(&db->recycled_logs);
 
   ldb_mutex_destroy(&db->mutex);
   ldb_cond_destroy(&db->background_work_finished_signal);
+  ldb_cond_destroy(&db->mem_stage_cv);
 
   ldb_free(db);
 }
@@ -573,6 +1480,68 @@ ldb_user_comparator(const ldb_t *db) {
   return db->internal_comparator.user_comparator;
 }
 
+static ldb_memtable_t *
+ldb_new_memtable(ldb_t *db) {
+  const ldb_prefix_t *prefix = NULL;
+
+  if (db->options.prefix_extractor != NULL)
+    prefix = &db->user_prefix;
+
+  return ldb_memtable_create_ex(&db->internal_comparator,
+                                &db->options,
+                                prefix,
+                                &db->arena_pool);
+}
+
+/* Charge the memtables to the write buffer manager (if any). Returns
+   whether the current memtable should be flushed to free memory. */
+/* REQUIRES: db->mutex is held. */
+static int
+ldb_charge_memtables(ldb_t *db) {
+  ldb_wbm_t *wbm = db->options.write_buffer_manager;
+  size_t mem, imm = 0;
+
+  if (wbm == NULL)
+    return 0;
+
+  mem = ldb_memtable_usage(db->mem);
+
+  if (db->imm != NULL)
+    imm = ldb_memtable_usage(db->imm);
+
+  return ldb_wbm_charge(wbm, &db->wbm_client, mem, imm);
+}
+
+/* Options for building a table that will be placed at the given level. */
+static ldb_dbopt_t
+ldb_level_options(const ldb_t *db, int level) {
+  ldb_dbopt_t options = db->options;
+
+  if (options.compression_per_level != NULL) {
+    int i = LDB_MIN(level, options.compression_levels - 1);
+
+    options.compression = options.compression_per_level[i];
+  }
+
+  if (options.block_size_per_level != NULL) {
+    int i = LDB_MIN(level, options.block_size_levels - 1);
+
+    options.block_size = options.block_size_per_level[i];
+
+    clip_to_range(options.block_size, 1 << 10, 4 << 20);
+  }
+
+  if (options.restart_interval_per_level != NULL) {
+    int i = LDB_MIN(level, options.restart_interval_levels - 1);
+
+    options.block_restart_interval = options.restart_interval_per_level[i];
+
+    clip_to_range(options.block_restart_interval, 1, 1024);
+  }
+
+  return options;
+}
+
 static int
 ldb_new_db(ldb_t *db) {
   char manifest[LDB_PATH_MAX];
@@ -594,6 +1563,9 @@ ldb_new_db(ldb_t *db) {
   ldb_edit_set_next_file(&new_db, 2);
   ldb_edit_set_last_sequence(&new_db, 0);
 
+  if (db->options.wal_block_size != LDB_BLOCK_SIZE)
+    ldb_edit_set_log_block_size(&new_db, db->options.wal_block_size);
+
   {
     ldb_writer_t log;
     ldb_buffer_t record;
@@ -640,12 +1612,222 @@ ldb_maybe_ignore_error(const ldb_t *db, int *status) {
 }
 
 /* Delete any unneeded files and stale in-memory entries. */
+/* Create the file of log "number", reusing the oldest of the logs
+   kept for recycling if there is one. */
+static int
+ldb_create_logfile(ldb_t *db, uint64_t number, ldb_wfile_t **file) {
+  char fname[LDB_PATH_MAX];
+  int rc = LDB_NOTFOUND;
+
+  if (!ldb_log_filename(fname, sizeof(fname), db->dbname, number))
+    abort(); /* LCOV_EXCL_LINE */
+
+  if (db->recycled_logs.length > 0) {
+    uint64_t old_number = db->recycled_logs.items[0];
+    char oldname[LDB_PATH_MAX];
+    size_t i;
+
+    for (i = 1; i < db->recycled_logs.length; i++)
+      db->recycled_logs.items[i - 1] = db->recycled_logs.items[i];
+
+    db->recycled_logs.length--;
+
+    if (!ldb_log_filename(oldname, sizeof(oldname), db->dbname, old_number))
+      abort(); /* LCOV_EXCL_LINE */
+
+    rc = ldb_reusefile_create(oldname, fname, file);
+
+    if (rc == LDB_OK) {
+      ldb_log(db->options.info_log, "Recycling log #%lu as #%lu",
+                                    (unsigned long)old_number,
+                                    (unsigned long)number);
+    }
+  }
+
+  if (rc != LDB_OK)
+    rc = ldb_truncfile_create(fname, file);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  if (db->first_log_number > number)
+    db->first_log_number = number;
+
+  /* A log holds about one write buffer. */
+  if (db->options.allow_fallocate) {
+    size_t size = db->options.write_buffer_size;
+
+    ldb_wfile_preallocate(*file, size + size / 10);
+  }
+
+  return LDB_OK;
+}
+
+static ldb_writer_t *
+ldb_create_writer(ldb_t *db,
+                  ldb_wfile_t *file,
+                  uint64_t number,
+                  uint64_t length) {
+  ldb_writer_t *log = ldb_writer_create(file, length);
+
+  ldb_writer_block_size(log, db->options.wal_block_size);
+  ldb_writer_compress(log, db->options.wal_compression);
+
+  if (db->options.manual_wal_flush)
+    ldb_writer_manual_flush(log);
+
+  if (db->options.recycle_log_file_num > 0)
+    ldb_writer_recyclable(log, number);
+
+  return log;
+}
+
+/* Whether obsolete log "number" is (or is now) kept for reuse. */
+static int
+ldb_recycle_log(ldb_t *db, uint64_t number) {
+  size_t i;
+
+  if (number < db->first_log_number)
+    return 0;
+
+  for (i = 0; i < db->recycled_logs.length; i++) {
+    if (db->recycled_logs.items[i] == number)
+      return 1;
+  }
+
+  if (db->recycled_logs.length >= (size_t)db->options.recycle_log_file_num)
+    return 0;
+
+  ldb_array_push(&db->recycled_logs, number);
+
+  return 1;
+}
+
+/* Return the name of the table with the specified number in the
+   directory for "path_id". */
+static int
+ldb_table_name(char *buf, size_t size, ldb_t *db, int path_id, uint64_t num) {
+  const char *dir = ldb_table_dir(db->dbname, &db->options, path_id);
+
+  return ldb_table_filename(buf, size, dir, num);
+}
+
+/* Push the full path of each table file kept outside of the database
+   directory (see db_paths) whose number is in "set" (or is not, if
+   "wanted" is zero) onto "paths". */
+static void
+ldb_list_tables(ldb_t *db, const rb_set64_t *set,
+                           int wanted,
+                           ldb_vector_t *paths) {
+  char path[LDB_PATH_MAX];
+  ldb_filetype_t type;
+  uint64_t number;
+  int i, j;
+
+  for (i = 0; i < db->options.num_db_paths; i++) {
+    const char *dir = db->options.db_paths[i].path;
+    char **filenames = NULL;
+    int len;
+
+    if (!ldb_table_dir_extra(db->dbname, &db->options, i))
+      continue;
+
+    len = ldb_get_children(dir, &filenames); /* Ignoring errors. */
+
+    for (j = 0; j < len; j++) {
+      const char *filename = filenames[j];
+
+      if (!ldb_parse_filename(&type, &number, filename))
+        continue;
+
+      if (type != LDB_FILE_TABLE)
+        continue;
+
+      if (rb_set64_has(set, number) != !!wanted)
+        continue;
+
+      if (ldb_join(path, sizeof(path), dir, filename)) {
+        size_t size = strlen(path) + 1;
+        char *name = ldb_malloc(size);
+
+        memcpy(name, path, size);
+
+        ldb_vector_push(paths, name);
+      }
+    }
+
+    if (filenames != NULL)
+      ldb_free_children(filenames, len);
+  }
+}
+
+static void
+ldb_remove_obsolete_files(ldb_t *db);
+
+/* A batch of obsolete files for the background deleter. */
+typedef struct ldb_deletejob_s {
+  ldb_t *db;
+  ldb_vector_t paths; /* char *[] */
+} ldb_deletejob_t;
+
+static void
+ldb_deletejob_call(void *arg) {
+  ldb_deletejob_t *job = arg;
+  ldb_t *db = job->db;
+  double rate = db->options.delete_rate;
+  int64_t start = ldb_now_usec();
+  uint64_t bytes = 0;
+  size_t i;
+
+  for (i = 0; i < job->paths.length; i++) {
+    char *path = job->paths.items[i];
+    uint64_t size = 0;
+
+    if (rate > 0)
+      ldb_file_size(path, &size);
+
+    ldb_remove_file(path);
+    ldb_free(path);
+
+    bytes += size;
+
+    /* Space the removals out to the rate (unless we are closing). */
+    while (rate > 0 && !ldb_atomic_load(&db->shutting_down,
+                                        ldb_order_acquire)) {
+      int64_t delay = start + (int64_t)(bytes * 1e6 / rate) - ldb_now_usec();
+
+      if (delay <= 0)
+        break;
+
+      ldb_sleep_usec(LDB_MIN(delay, 100000));
+    }
+  }
+
+  ldb_vector_clear(&job->paths);
+  ldb_free(job);
+
+  ldb_mutex_lock(&db->mutex);
+
+  db->deleting = 0;
+
+  if (db->delete_again) {
+    db->delete_again = 0;
+    ldb_remove_obsolete_files(db);
+  }
+
+  ldb_cond_broadcast(&db->background_work_finished_signal);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
 static void
 ldb_remove_obsolete_files(ldb_t *db) {
   char path[LDB_PATH_MAX];
   char **filenames = NULL;
   ldb_vector_t to_delete;
+  ldb_vector_t tables;
   ldb_filetype_t type;
+  uint64_t oldest_blob;
   rb_set64_t live;
   uint64_t number;
   int i, len;
@@ -658,14 +1840,34 @@ ldb_remove_obsolete_files(ldb_t *db) {
     return;
   }
 
+  if (db->checkpoints > 0) {
+    /* A checkpoint is linking files outside of the lock. They are
+       collected once it is done. */
+    return;
+  }
+
+  if (db->read_only) {
+    /* The files belong to another instance. */
+    return;
+  }
+
+  if (db->deleting) {
+    /* Collected once the files being deleted are gone. */
+    db->delete_again = 1;
+    return;
+  }
+
   rb_set64_init(&live);
   ldb_vector_init(&to_delete);
+  ldb_vector_init(&tables);
 
   /* Make a set of all of the live files. */
   rb_set64_copy(&live, &db->pending_outputs);
 
   ldb_versions_add_files(db->versions, &live);
 
+  oldest_blob = ldb_versions_oldest_blob(db->versions);
+
   len = ldb_get_children(db->dbname, &filenames); /* Ignoring errors. */
 
   for (i = 0; i < len; i++) {
@@ -677,7 +1879,8 @@ ldb_remove_obsolete_files(ldb_t *db) {
       switch (type) {
         case LDB_FILE_LOG:
           keep = ((number >= db->versions->log_number) ||
-                  (number == db->versions->prev_log_number));
+                  (number == db->versions->prev_log_number) ||
+                  ldb_recycle_log(db, number));
           break;
         case LDB_FILE_DESC:
           /* Keep my manifest file, and any newer incarnations'
@@ -692,9 +1895,16 @@ ldb_remove_obsolete_files(ldb_t *db) {
              be recorded in pending_outputs, which is inserted into "live". */
           keep = rb_set64_has(&live, number);
           break;
+        case LDB_FILE_BLOB:
+          /* A blob file shares its number with the output it was written
+             for. Tables may refer to any blob file from their oldest on. */
+          keep = (oldest_blob != 0 && number >= oldest_blob) ||
+                 rb_set64_has(&live, number);
+          break;
         case LDB_FILE_CURRENT:
         case LDB_FILE_LOCK:
         case LDB_FILE_INFO:
+        case LDB_FILE_CACHE:
           keep = 1;
           break;
       }
@@ -705,6 +1915,9 @@ ldb_remove_obsolete_files(ldb_t *db) {
         if (type == LDB_FILE_TABLE)
           ldb_tables_evict(db->table_cache, number);
 
+        if (type == LDB_FILE_BLOB)
+          ldb_tables_evict_blob(db->table_cache, number);
+
         ldb_log(db->options.info_log, "Delete type=%d #%lu",
                                       (signed int)type,
                                       (unsigned long)number);
@@ -712,6 +1925,56 @@ ldb_remove_obsolete_files(ldb_t *db) {
     }
   }
 
+  /* Tables in the other directories are never kept once dead. */
+  ldb_list_tables(db, &live, 0, &tables);
+
+  for (i = 0; i < (int)tables.length; i++) {
+    const char *filename = ldb_basename(tables.items[i]);
+
+    if (ldb_parse_filename(&type, &number, filename)) {
+      ldb_tables_evict(db->table_cache, number);
+
+      ldb_log(db->options.info_log, "Delete type=%d #%lu",
+                                    (signed int)type,
+                                    (unsigned long)number);
+    }
+  }
+
+  /* Hand the files to the background deleter, if any. */
+  if (db->delete_pool != NULL && to_delete.length + tables.length > 0) {
+    ldb_deletejob_t *job = ldb_malloc(sizeof(ldb_deletejob_t));
+
+    job->db = db;
+
+    ldb_vector_init(&job->paths);
+
+    for (i = 0; i < (int)to_delete.length; i++) {
+      const char *filename = to_delete.items[i];
+      size_t size;
+      char *name;
+
+      if (!ldb_join(path, sizeof(path), db->dbname, filename))
+        continue;
+
+      size = strlen(path) + 1;
+      name = ldb_malloc(size);
+
+      memcpy(name, path, size);
+
+      ldb_vector_push(&job->paths, name);
+    }
+
+    for (i = 0; i < (int)tables.length; i++)
+      ldb_vector_push(&job->paths, tables.items[i]);
+
+    ldb_vector_reset(&to_delete);
+    ldb_vector_reset(&tables);
+
+    db->deleting = 1;
+
+    ldb_pool_schedule(db->delete_pool, &ldb_deletejob_call, job);
+  }
+
   /* While deleting all files unblock other threads. All files being deleted
      have unique names which will not collide with newly created files and
      are therefore safe to delete while allowing other threads to proceed. */
@@ -726,8 +1989,14 @@ ldb_remove_obsolete_files(ldb_t *db) {
     ldb_remove_file(path);
   }
 
+  for (i = 0; i < (int)tables.length; i++) {
+    ldb_remove_file(tables.items[i]);
+    ldb_free(tables.items[i]);
+  }
+
   rb_set64_clear(&live);
   ldb_vector_clear(&to_delete);
+  ldb_vector_clear(&tables);
 
   if (filenames != NULL)
     ldb_free_children(filenames, len);
@@ -739,9 +2008,12 @@ static int
 ldb_write_level0_table(ldb_t *db, ldb_memtable_t *mem,
                                   ldb_edit_t *edit,
                                   ldb_version_t *base) {
+  /* The output level is only picked once the table is built. */
+  ldb_dbopt_t options = ldb_level_options(db, 0);
   int64_t start_micros;
   ldb_filemeta_t meta;
   ldb_stats_t stats;
+  ldb_iter_t *range_iter;
   ldb_iter_t *iter;
   int rc = LDB_OK;
   int level = 0;
@@ -754,23 +2026,32 @@ ldb_write_level0_table(ldb_t *db, ldb_memtable_t *mem,
   start_micros = ldb_now_usec();
 
   meta.number = ldb_versions_new_file_number(db->versions);
+  meta.path_id = ldb_level_path_id(&db->options, 0);
 
   rb_set64_put(&db->pending_outputs, meta.number);
 
   iter = ldb_memiter_create(mem);
+  range_iter = ldb_rangeiter_create(mem);
 
   ldb_log(db->options.info_log, "Level-0 table #%lu: started",
                                 (unsigned long)meta.number);
 
   {
+    int caller;
+
     ldb_mutex_unlock(&db->mutex);
 
+    LDB_TRACE_CALLER(caller, LDB_CALLER_BACKGROUND);
+
     rc = ldb_build_table(db->dbname,
-                         &db->options,
+                         &options,
                          db->table_cache,
                          iter,
+                         range_iter,
                          &meta);
 
+    LDB_TRACE_RESTORE(caller);
+
     ldb_mutex_lock(&db->mutex);
   }
 
@@ -779,13 +2060,20 @@ ldb_write_level0_table(ldb_t *db, ldb_memtable_t *mem,
                                 (unsigned long)meta.file_size,
                                 ldb_strerror(rc));
 
+  ldb_iter_destroy(range_iter);
   ldb_iter_destroy(iter);
 
-  rb_set64_del(&db->pending_outputs, meta.number);
+  /* When flushing in the background, the caller removes the table from
+     pending_outputs once the edit is applied. Other background threads
+     may garbage collect files while the MANIFEST is being written. */
+  if (rc != LDB_OK || meta.file_size == 0 || base == NULL)
+    rb_set64_del(&db->pending_outputs, meta.number);
 
   /* Note that if file_size is zero, the file has been deleted and
      should not be added to the manifest. */
   if (rc == LDB_OK && meta.file_size > 0) {
+    ldb_filemeta_t *f;
+
     if (base != NULL) {
       ldb_slice_t min_user_key = ldb_ikey_user_key(&meta.smallest);
       ldb_slice_t max_user_key = ldb_ikey_user_key(&meta.largest);
@@ -795,11 +2083,18 @@ ldb_write_level0_table(ldb_t *db, ldb_memtable_t *mem,
                                                          &max_user_key);
     }
 
-    ldb_edit_add_file(edit, level,
-                      meta.number,
-                      meta.file_size,
-                      &meta.smallest,
-                      &meta.largest);
+    f = ldb_edit_add_file(edit, level,
+                          meta.number,
+                          meta.file_size,
+                          &meta.smallest,
+                          &meta.largest);
+
+    f->creation_time = ldb_now_usec() / 1000000;
+    f->tombstones = meta.tombstones;
+    f->entries = meta.entries;
+    f->deletions = meta.deletions;
+    f->oldest_blob = meta.oldest_blob;
+    f->path_id = meta.path_id;
   }
 
   stats.micros = ldb_now_usec() - start_micros;
@@ -807,6 +2102,14 @@ ldb_write_level0_table(ldb_t *db, ldb_memtable_t *mem,
 
   ldb_stats_add(&db->stats[level], &stats);
 
+  db->flush_bytes += meta.file_size;
+
+  if (db->latency != NULL)
+    ldb_latency_add(db->latency, LDB_LATENCY_FLUSH, stats.micros);
+
+  ldb_statistics_add(db->options.statistics, LDB_FLUSH_WRITE_BYTES,
+                                             meta.file_size);
+
   ldb_filemeta_clear(&meta);
 
   return rc;
@@ -822,90 +2125,266 @@ report_corruption(ldb_reporter_t *report, size_t bytes, int status) {
     *report->status = status;
 }
 
-static int
-ldb_recover_log_file(ldb_t *db, uint64_t log_number,
-                                int last_log,
-                                int *save_manifest,
-                                ldb_edit_t *edit,
-                                ldb_seqnum_t *max_sequence) {
-  char fname[LDB_PATH_MAX];
-  ldb_reporter_t reporter;
-  ldb_rfile_t *file;
-  int rc = LDB_OK;
-  ldb_buffer_t buf;
-  ldb_slice_t record;
+/* Log replay. The log is read (and checksummed) on the calling thread
+   while its batches are inserted on the compaction pool, which sits
+   idle until the database is open. Full memtables are written to
+   level-0 on the flush pool as the next one fills. */
+typedef struct ldb_replay_s {
+  ldb_t *db;
+  ldb_edit_t *edit;
+  int concurrent; /* Whether batches may be inserted out of order. */
+  int inserts; /* Batches waiting to be inserted. */
+  ldb_memtable_t *imm; /* Memtable being written to level-0. */
+  int status;
+  ldb_cond_t cv;
+} ldb_replay_t;
+
+typedef struct ldb_replayjob_s {
+  ldb_replay_t *replay;
+  ldb_memtable_t *mem;
   ldb_batch_t batch;
-  int compactions = 0;
-  ldb_memtable_t *mem = NULL;
-  ldb_reader_t reader;
+} ldb_replayjob_t;
 
-  ldb_mutex_assert_held(&db->mutex);
+static void
+ldb_replay_init(ldb_replay_t *replay, ldb_t *db, ldb_edit_t *edit) {
+  replay->db = db;
+  replay->edit = edit;
+  replay->concurrent = db->options.max_background_compactions > 1;
+  replay->inserts = 0;
+  replay->imm = NULL;
+  replay->status = LDB_OK;
+
+  ldb_cond_init(&replay->cv);
+}
 
-  /* Open the log file. */
-  if (!ldb_log_filename(fname, sizeof(fname), db->dbname, log_number))
-    return LDB_INVALID;
+/* Wait for the queued batches to drop to max_inserts and, if idle is
+   set, for the memtable being written (if any) to reach level-0. */
+/* REQUIRES: db->mutex is held. */
+static int
+ldb_replay_wait(ldb_replay_t *replay, int max_inserts, int idle) {
+  ldb_t *db = replay->db;
 
-  rc = ldb_seqfile_create(fname, &file);
+  while (replay->inserts > max_inserts || (idle && replay->imm != NULL))
+    ldb_cond_wait(&replay->cv, &db->mutex);
 
-  if (rc != LDB_OK) {
-    ldb_maybe_ignore_error(db, &rc);
-    return rc;
-  }
+  return replay->status;
+}
 
-  /* Create the log reader. */
-  reporter.fname = fname;
-  reporter.status = (db->options.paranoid_checks ? &rc : NULL);
-  reporter.info_log = db->options.info_log;
-  reporter.corruption = report_corruption;
+/* REQUIRES: db->mutex is held. */
+static void
+ldb_replay_clear(ldb_replay_t *replay) {
+  ldb_replay_wait(replay, 0, 1);
+  ldb_cond_destroy(&replay->cv);
+}
 
-  /* We intentionally make the log reader do checksumming even if
-     paranoid_checks==0 so that corruptions cause entire commits
-     to be skipped instead of propagating bad information (like
-     overly large sequence numbers). */
-  ldb_reader_init(&reader, file, &reporter, 1, 0);
-  ldb_batch_init(&batch);
-  ldb_buffer_init(&buf);
+static void
+ldb_replay_insert(void *arg) {
+  ldb_replayjob_t *job = (ldb_replayjob_t *)arg;
+  ldb_replay_t *replay = job->replay;
+  ldb_t *db = replay->db;
+  int rc;
 
-  ldb_log(db->options.info_log, "Recovering log #%lu",
-                                (unsigned long)log_number);
+  if (replay->concurrent)
+    rc = ldb_batch_insert_concurrently(&job->batch, job->mem);
+  else
+    rc = ldb_batch_insert_into(&job->batch, job->mem);
 
-  /* Read all the records and add to a memtable. */
-  while (ldb_reader_read_record(&reader, &record, &buf) && rc == LDB_OK) {
-    ldb_seqnum_t last_seq;
+  ldb_batch_clear(&job->batch);
 
-    if (record.size < 12) {
-      /* "log record too small" */
-      reporter.corruption(&reporter, record.size, LDB_CORRUPTION);
-      continue;
-    }
+  ldb_mutex_lock(&db->mutex);
 
-    ldb_batch_set_contents(&batch, &record);
+  ldb_maybe_ignore_error(db, &rc);
 
-    if (mem == NULL) {
-      mem = ldb_memtable_create(&db->internal_comparator);
-      ldb_memtable_ref(mem);
-    }
+  if (replay->status == LDB_OK)
+    replay->status = rc;
 
-    rc = ldb_batch_insert_into(&batch, mem);
+  ldb_memtable_unref(job->mem);
 
+  replay->inserts--;
+
+  ldb_cond_signal(&replay->cv);
+  ldb_mutex_unlock(&db->mutex);
+
+  ldb_free(job);
+}
+
+static void
+ldb_replay_flush(void *arg) {
+  ldb_replay_t *replay = (ldb_replay_t *)arg;
+  ldb_t *db = replay->db;
+  int rc;
+
+  ldb_mutex_lock(&db->mutex);
+
+  rc = ldb_write_level0_table(db, replay->imm, replay->edit, NULL);
+
+  if (replay->status == LDB_OK)
+    replay->status = rc;
+
+  ldb_memtable_unref(replay->imm);
+
+  replay->imm = NULL;
+
+  ldb_cond_signal(&replay->cv);
+  ldb_mutex_unlock(&db->mutex);
+}
+
+/* Queue a batch for insertion into mem, returning the last sequence
+   number it contains. */
+/* REQUIRES: db->mutex is not held. */
+static int
+ldb_replay_add(ldb_replay_t *replay, ldb_memtable_t *mem,
+                                     const ldb_slice_t *record,
+                                     ldb_seqnum_t *last_seq) {
+  ldb_t *db = replay->db;
+  ldb_replayjob_t *job;
+  int rc;
+
+  ldb_mutex_lock(&db->mutex);
+
+  /* Keep a bounded number of records in memory. */
+  rc = ldb_replay_wait(replay, 2 * db->options.max_background_compactions,
+                               0);
+
+  if (rc == LDB_OK) {
+    ldb_memtable_ref(mem);
+    replay->inserts++;
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  job = ldb_malloc(sizeof(ldb_replayjob_t));
+  job->replay = replay;
+  job->mem = mem;
+
+  ldb_batch_init(&job->batch);
+  ldb_batch_set_contents(&job->batch, record);
+
+  *last_seq = ldb_batch_sequence(&job->batch)
+            + ldb_batch_count(&job->batch) - 1;
+
+  ldb_pool_schedule(db->pool, &ldb_replay_insert, job);
+
+  return LDB_OK;
+}
+
+/* Write mem to level-0 once its batches are in, waiting for the
+   previous memtable to be written first. Consumes a reference. */
+/* REQUIRES: db->mutex is not held. */
+static int
+ldb_replay_flush_memtable(ldb_replay_t *replay, ldb_memtable_t *mem) {
+  ldb_t *db = replay->db;
+  int rc;
+
+  ldb_mutex_lock(&db->mutex);
+
+  rc = ldb_replay_wait(replay, 0, 1);
+
+  if (rc == LDB_OK) {
+    replay->imm = mem;
+    ldb_pool_schedule_ex(db->flush_pool, &ldb_replay_flush, replay,
+                         LDB_POOL_HIGH);
+  } else {
+    ldb_memtable_unref(mem);
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  return rc;
+}
+
+static int
+ldb_recover_log_file(ldb_t *db, uint64_t log_number,
+                                int last_log,
+                                int *save_manifest,
+                                ldb_edit_t *edit,
+                                ldb_seqnum_t *max_sequence) {
+  char fname[LDB_PATH_MAX];
+  ldb_reporter_t reporter;
+  ldb_replay_t replay;
+  ldb_rfile_t *file;
+  int rc = LDB_OK;
+  ldb_buffer_t buf;
+  ldb_slice_t record;
+  int compactions = 0;
+  ldb_memtable_t *mem = NULL;
+  size_t mem_records = 0;
+  ldb_reader_t reader;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  /* Open the log file. */
+  if (!ldb_log_filename(fname, sizeof(fname), db->dbname, log_number))
+    return LDB_INVALID;
+
+  rc = ldb_seqfile_create(fname, &file);
+
+  if (rc != LDB_OK) {
     ldb_maybe_ignore_error(db, &rc);
+    return rc;
+  }
+
+  /* Create the log reader. */
+  reporter.fname = fname;
+  reporter.status = (db->options.paranoid_checks ? &rc : NULL);
+  reporter.info_log = db->options.info_log;
+  reporter.corruption = report_corruption;
+
+  /* We intentionally make the log reader do checksumming even if
+     paranoid_checks==0 so that corruptions cause entire commits
+     to be skipped instead of propagating bad information (like
+     overly large sequence numbers). */
+  ldb_reader_init(&reader, file, &reporter, 1, 0);
+  ldb_reader_block_size(&reader, db->options.wal_block_size);
+  ldb_reader_recyclable(&reader, log_number);
+  ldb_replay_init(&replay, db, edit);
+  ldb_buffer_init(&buf);
+
+  ldb_log(db->options.info_log, "Recovering log #%lu",
+                                (unsigned long)log_number);
+
+  /* Nothing else touches the database until it is open. */
+  ldb_mutex_unlock(&db->mutex);
+
+  /* Read all the records and add to a memtable. */
+  while (ldb_reader_read_record(&reader, &record, &buf) && rc == LDB_OK) {
+    ldb_seqnum_t last_seq;
+
+    if (record.size < 12) {
+      /* "log record too small" */
+      reporter.corruption(&reporter, record.size, LDB_CORRUPTION);
+      continue;
+    }
+
+    if (mem == NULL) {
+      mem = ldb_new_memtable(db);
+      ldb_memtable_ref(mem);
+    }
+
+    rc = ldb_replay_add(&replay, mem, &record, &last_seq);
 
     if (rc != LDB_OK)
       break;
 
-    last_seq = ldb_batch_sequence(&batch) + ldb_batch_count(&batch) - 1;
-
     if (last_seq > *max_sequence)
       *max_sequence = last_seq;
 
-    if (ldb_memtable_usage(mem) > db->options.write_buffer_size) {
+    /* The memtable may not have caught up with the queued batches
+       yet; their size stands in for its usage until it does. */
+    mem_records += record.size;
+
+    if (ldb_memtable_usage(mem) > db->options.write_buffer_size ||
+        mem_records > db->options.write_buffer_size) {
       compactions++;
       *save_manifest = 1;
 
-      rc = ldb_write_level0_table(db, mem, edit, NULL);
+      rc = ldb_replay_flush_memtable(&replay, mem);
 
-      ldb_memtable_unref(mem);
       mem = NULL;
+      mem_records = 0;
 
       if (rc != LDB_OK) {
         /* Reflect errors immediately so that conditions like full
@@ -915,8 +2394,13 @@ ldb_recover_log_file(ldb_t *db, uint64_t log_number,
     }
   }
 
+  ldb_mutex_lock(&db->mutex);
+
+  if (rc == LDB_OK)
+    rc = ldb_replay_wait(&replay, 0, 1);
+
+  ldb_replay_clear(&replay);
   ldb_buffer_clear(&buf);
-  ldb_batch_clear(&batch);
   ldb_reader_clear(&reader);
   ldb_rfile_destroy(file);
 
@@ -932,7 +2416,13 @@ ldb_recover_log_file(ldb_t *db, uint64_t log_number,
         ldb_appendfile_create(fname, &db->logfile) == LDB_OK) {
       ldb_log(db->options.info_log, "Reusing old log %s", fname);
 
-      db->log = ldb_writer_create(db->logfile, lfile_size);
+      if (db->options.allow_fallocate) {
+        size_t size = db->options.write_buffer_size;
+
+        ldb_wfile_preallocate(db->logfile, size + size / 10);
+      }
+
+      db->log = ldb_create_writer(db, db->logfile, log_number, lfile_size);
       db->logfile_number = log_number;
 
       if (mem != NULL) {
@@ -940,7 +2430,7 @@ ldb_recover_log_file(ldb_t *db, uint64_t log_number,
         mem = NULL;
       } else {
         /* mem can be NULL if lognum exists but was empty. */
-        db->mem = ldb_memtable_create(&db->internal_comparator);
+        db->mem = ldb_new_memtable(db);
         ldb_memtable_ref(db->mem);
       }
     }
@@ -986,6 +2476,9 @@ ldb_recover(ldb_t *db, ldb_edit_t *edit, int *save_manifest) {
      may already exist from a previous failed creation attempt. */
   ldb_create_dir(db->dbname);
 
+  for (i = 0; i < db->options.num_db_paths; i++)
+    ldb_create_dir(db->options.db_paths[i].path);
+
   assert(db->db_lock == NULL);
 
   if (!ldb_lock_filename(path, sizeof(path), db->dbname))
@@ -1022,6 +2515,10 @@ ldb_recover(ldb_t *db, ldb_edit_t *edit, int *save_manifest) {
   if (rc != LDB_OK)
     return rc;
 
+  /* The block size the database was created with wins. */
+  if (db->versions->log_block_size != 0)
+    db->options.wal_block_size = db->versions->log_block_size;
+
   /* Recover from all newer log files than the ones named in the
    * descriptor (new log files may have been added by the previous
    * incarnation without registering them in the descriptor).
@@ -1054,6 +2551,29 @@ ldb_recover(ldb_t *db, ldb_edit_t *edit, int *save_manifest) {
 
   ldb_free_children(filenames, len);
 
+  /* Tables may also be in any of the other directories. */
+  for (i = 0; i < db->options.num_db_paths; i++) {
+    const char *dir = db->options.db_paths[i].path;
+    int j;
+
+    if (!ldb_table_dir_extra(db->dbname, &db->options, i))
+      continue;
+
+    len = ldb_get_children(dir, &filenames);
+
+    if (len < 0)
+      continue; /* Reported as missing files below. */
+
+    for (j = 0; j < len; j++) {
+      if (ldb_parse_filename(&type, &number, filenames[j])) {
+        if (type == LDB_FILE_TABLE)
+          rb_set64_del(&expected, number);
+      }
+    }
+
+    ldb_free_children(filenames, len);
+  }
+
   if (expected.size != 0) {
     rc = LDB_CORRUPTION; /* "[expected.size] missing files" */
     goto fail;
@@ -1088,1454 +2608,6554 @@ fail:
   return rc;
 }
 
+/* Tables opened by one preloading thread: every stride'th file. */
+typedef struct ldb_preload_s {
+  ldb_t *db;
+  const ldb_vector_t *files; /* ldb_filemeta_t[] */
+  const ldb_array_t *levels;
+  size_t start;
+  size_t stride;
+} ldb_preload_t;
+
 static void
-ldb_record_background_error(ldb_t *db, int status) {
-  ldb_mutex_assert_held(&db->mutex);
+ldb_preload_call(void *arg) {
+  ldb_preload_t *job = (ldb_preload_t *)arg;
+  size_t i;
 
-  if (db->bg_error == LDB_OK) {
-    db->bg_error = status;
+  for (i = job->start; i < job->files->length; i += job->stride) {
+    ldb_filemeta_t *f = job->files->items[i];
 
-    ldb_cond_broadcast(&db->background_work_finished_signal);
+    /* Errors are reported by whatever reads the table next. */
+    ldb_tables_load(job->db->table_cache, f, job->levels->items[i]);
   }
 }
 
-/* Compact the in-memory write buffer to disk. Switches to a new
-   log-file/memtable and writes a new descriptor iff successful.
-   Errors are recorded in bg_error. */
+/* Open the tables of the current version ahead of time, in parallel.
+   REQUIRES: db->mutex is held. */
 static void
-ldb_compact_memtable(ldb_t *db) {
-  ldb_version_t *base;
-  ldb_edit_t edit;
-  int rc = LDB_OK;
-
-  ldb_edit_init(&edit);
+ldb_preload_tables(ldb_t *db) {
+  size_t capacity = table_cache_size(&db->options);
+  int threads = db->options.max_file_opening_threads;
+  ldb_version_t *base = db->versions->current;
+  ldb_preload_t jobs[64];
+  ldb_array_t levels;
+  ldb_vector_t files;
+  ldb_pool_t *pool;
+  int level, i;
+  size_t j;
 
-  ldb_mutex_assert_held(&db->mutex);
+  if (threads == 0)
+    return;
 
-  assert(db->imm != NULL);
+  ldb_vector_init(&files);
+  ldb_array_init(&levels);
 
-  /* Save the contents of the memtable as a new Table. */
-  base = db->versions->current;
+  for (level = 0; level < db->options.num_levels; level++) {
+    const ldb_vector_t *list = &base->files[level];
 
-  ldb_version_ref(base);
+    for (j = 0; j < list->length && files.length < capacity; j++) {
+      ldb_vector_push(&files, list->items[j]);
+      ldb_array_push(&levels, level);
+    }
+  }
 
-  rc = ldb_write_level0_table(db, db->imm, &edit, base);
+  if ((size_t)threads > files.length)
+    threads = files.length;
 
-  ldb_version_unref(base);
+  ldb_version_ref(base);
+  ldb_mutex_unlock(&db->mutex);
 
-  if (rc == LDB_OK && ldb_atomic_load(&db->shutting_down, ldb_order_acquire))
-    rc = LDB_IOERR; /* "Deleting DB during memtable compaction" */
+  if (threads > 0) {
+    pool = ldb_pool_create(threads);
 
-  /* Replace immutable memtable with the generated Table. */
-  if (rc == LDB_OK) {
-    ldb_edit_set_prev_log_number(&edit, 0);
-    ldb_edit_set_log_number(&edit, db->logfile_number); /* Earlier logs no
-                                                           longer needed. */
+    for (i = 0; i < threads; i++) {
+      jobs[i].db = db;
+      jobs[i].files = &files;
+      jobs[i].levels = &levels;
+      jobs[i].start = i;
+      jobs[i].stride = threads;
 
-    rc = ldb_versions_apply(db->versions, &edit, &db->mutex);
-  }
+      ldb_pool_schedule(pool, &ldb_preload_call, &jobs[i]);
+    }
 
-  if (rc == LDB_OK) {
-    /* Commit to the new state. */
-    ldb_memtable_unref(db->imm);
-    db->imm = NULL;
-    ldb_atomic_store(&db->has_imm, 0, ldb_order_release);
-    ldb_remove_obsolete_files(db);
-  } else {
-    ldb_record_background_error(db, rc);
+    ldb_pool_wait(pool);
+    ldb_pool_destroy(pool);
   }
 
-  ldb_edit_clear(&edit);
-}
+  ldb_mutex_lock(&db->mutex);
+  ldb_version_unref(base);
 
-static int
-ldb_open_compaction_output_file(ldb_t *db, ldb_cstate_t *state) {
-  char fname[LDB_PATH_MAX];
-  uint64_t file_number;
-  int rc = LDB_OK;
+  ldb_log(db->options.info_log, "Preloaded %lu tables",
+                                (unsigned long)files.length);
 
-  assert(state != NULL);
-  assert(state->builder == NULL);
+  ldb_vector_clear(&files);
+  ldb_array_clear(&levels);
+}
 
-  {
-    ldb_mutex_lock(&db->mutex);
+/*
+ * Block Cache Dump
+ */
 
-    file_number = ldb_versions_new_file_number(db->versions);
+/* The BLOCKCACHE file lists the blocks of the database which were in
+ * the block cache when it was last closed, most recently used first:
+ *
+ *    number: varint64 (of the table)
+ *    offset: varint64 (of the block)
+ *    charge: varint64 (against the cache capacity)
+ *
+ * followed by the masked crc32c of the records (fixed32).
+ */
 
-    rb_set64_put(&db->pending_outputs, file_number);
+/* Threads reading the blocks back. */
+#define LDB_WARM_THREADS 4
 
-    ldb_vector_push(&state->outputs, ldb_output_create(file_number));
+/* The blocks of one table to read back. */
+typedef struct ldb_warmjob_s {
+  ldb_t *db;
+  ldb_filemeta_t *file;
+  int level;
+  ldb_array_t offsets;
+} ldb_warmjob_t;
 
-    ldb_mutex_unlock(&db->mutex);
-  }
+typedef struct ldb_cachedump_s {
+  const rb_tree_t *ids; /* block cache id -> file number */
+  ldb_array_t records;  /* rank, number, offset, charge */
+} ldb_cachedump_t;
 
-  /* Make the output file. */
-  if (!ldb_table_filename(fname, sizeof(fname), db->dbname, file_number))
-    return LDB_INVALID;
+static void
+ldb_cachedump_entry(void *arg,
+                    const ldb_slice_t *key,
+                    size_t charge,
+                    size_t rank) {
+  ldb_cachedump_t *dump = arg;
+  rb_node_t *node;
+
+  /* Keys of table blocks are the table's id and the block's offset. */
+  if (key->size != 16)
+    return;
 
-  rc = ldb_truncfile_create(fname, &state->outfile);
+  node = rb_tree_get(dump->ids, rb_ui(ldb_fixed64_decode(key->data)));
 
-  if (rc == LDB_OK)
-    state->builder = ldb_tablegen_create(&db->options, state->outfile);
+  if (node == NULL)
+    return;
 
-  return rc;
+  ldb_array_push(&dump->records, rank);
+  ldb_array_push(&dump->records, node->val.ui);
+  ldb_array_push(&dump->records, ldb_fixed64_decode(key->data + 8));
+  ldb_array_push(&dump->records, charge);
 }
 
 static int
-ldb_finish_compaction_output_file(ldb_t *db, ldb_cstate_t *state,
-                                             ldb_iter_t *input) {
-  uint64_t output_number, current_entries, current_bytes;
-  int rc = LDB_OK;
+compare_rank(void *x, void *y) {
+  return LDB_CMP(*(uint64_t *)x, *(uint64_t *)y);
+}
 
-  assert(state != NULL);
-  assert(state->outfile != NULL);
-  assert(state->builder != NULL);
+/* Write the BLOCKCACHE file. Entries of different shards of the block
+   cache are interleaved by their rank within their shard. */
+static void
+ldb_dump_block_cache(ldb_t *db) {
+  char fname[LDB_PATH_MAX];
+  ldb_cachedump_t dump;
+  ldb_vector_t order;
+  ldb_buffer_t data;
+  rb_tree_t ids;
+  size_t i;
+  int rc;
 
-  output_number = ldb_cstate_top(state)->number;
+  if (!ldb_cache_filename(fname, sizeof(fname), db->dbname))
+    return;
 
-  assert(output_number != 0);
+  rb_tree_init(&ids, rb_set64_compare, NULL);
+  ldb_array_init(&dump.records);
+  ldb_vector_init(&order);
+  ldb_buffer_init(&data);
 
-  /* Check for iterator errors. */
-  rc = ldb_iter_status(input);
+  ldb_tables_cache_ids(db->table_cache, &ids);
 
-  current_entries = ldb_tablegen_entries(state->builder);
+  dump.ids = &ids;
 
-  if (rc == LDB_OK)
-    rc = ldb_tablegen_finish(state->builder);
-  else
-    ldb_tablegen_abandon(state->builder);
+  ldb_lru_walk(db->options.block_cache, &ldb_cachedump_entry, &dump);
 
-  current_bytes = ldb_tablegen_size(state->builder);
+  for (i = 0; i < dump.records.length; i += 4)
+    ldb_vector_push(&order, &dump.records.items[i]);
 
-  ldb_cstate_top(state)->file_size = current_bytes;
+  ldb_vector_sort(&order, compare_rank);
 
-  state->total_bytes += current_bytes;
+  for (i = 0; i < order.length; i++) {
+    const uint64_t *record = order.items[i];
 
-  ldb_tablegen_destroy(state->builder);
-  state->builder = NULL;
+    ldb_buffer_varint64(&data, record[1]);
+    ldb_buffer_varint64(&data, record[2]);
+    ldb_buffer_varint64(&data, record[3]);
+  }
 
-  /* Finish and check for file errors. */
-  if (rc == LDB_OK)
-    rc = ldb_wfile_sync(state->outfile);
+  ldb_buffer_fixed32(&data, ldb_crc32c_mask(ldb_crc32c_value(data.data,
+                                                             data.size)));
 
-  if (rc == LDB_OK)
-    rc = ldb_wfile_close(state->outfile);
+  rc = ldb_write_file(fname, &data, 0);
 
-  ldb_wfile_destroy(state->outfile);
-  state->outfile = NULL;
+  ldb_log(db->options.info_log, "Saved %lu cached blocks: %s",
+                                (unsigned long)order.length,
+                                ldb_strerror(rc));
 
-  if (rc == LDB_OK && current_entries > 0) {
-    /* Verify that the table is usable. */
-    ldb_iter_t *iter = ldb_tables_iterate(db->table_cache,
-                                          ldb_readopt_default,
-                                          output_number,
-                                          current_bytes,
-                                          NULL);
+  ldb_buffer_clear(&data);
+  ldb_vector_clear(&order);
+  ldb_array_clear(&dump.records);
+  rb_tree_clear(&ids, NULL);
+}
 
-    rc = ldb_iter_status(iter);
+static void
+ldb_warmjob_call(void *arg) {
+  ldb_warmjob_t *job = arg;
+  ldb_t *db = job->db;
 
-    ldb_iter_destroy(iter);
+  if (!ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    ldb_array_sort(&job->offsets, compare_ascending);
 
-    if (rc == LDB_OK) {
-      ldb_log(db->options.info_log,
-              "Generated table #%lu@%d: %lu keys, %lu bytes",
-              (unsigned long)output_number,
-              state->compaction->level,
-              (unsigned long)current_entries,
-              (unsigned long)current_bytes);
-    }
+    /* Errors are reported by whatever reads the table next. */
+    ldb_tables_warm(db->table_cache, job->file, job->level,
+                    job->offsets.items, job->offsets.length);
   }
 
-  return rc;
-}
-
-static int
-ldb_install_compaction_results(ldb_t *db, ldb_cstate_t *state) {
-  ldb_edit_t *edit = &state->compaction->edit;
-  int level;
-  size_t i;
-
-  ldb_mutex_assert_held(&db->mutex);
-
-  ldb_log(db->options.info_log, "Compacted %d@%d + %d@%d files => %ld bytes",
-          (int)state->compaction->inputs[0].length,
-          state->compaction->level + 0,
-          (int)state->compaction->inputs[1].length,
-          state->compaction->level + 1,
-          (long)state->total_bytes);
+  ldb_array_clear(&job->offsets);
 
-  /* Add compaction outputs. */
-  ldb_compaction_add_input_deletions(state->compaction, edit);
+  ldb_mutex_lock(&db->mutex);
 
-  level = state->compaction->level;
+  if (--db->warming == 0) {
+    ldb_version_unref(db->warm_base);
 
-  for (i = 0; i < state->outputs.length; i++) {
-    const ldb_output_t *out = state->outputs.items[i];
+    db->warm_base = NULL;
 
-    ldb_edit_add_file(edit, level + 1,
-                      out->number,
-                      out->file_size,
-                      &out->smallest,
-                      &out->largest);
+    ldb_cond_broadcast(&db->background_work_finished_signal);
   }
 
-  return ldb_versions_apply(db->versions, edit, &db->mutex);
+  ldb_mutex_unlock(&db->mutex);
 }
 
-static int
-ldb_do_compaction_work(ldb_t *db, ldb_cstate_t *state) {
-  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
-  ldb_seqnum_t last_sequence_for_key = LDB_MAX_SEQUENCE;
-  int64_t start_micros = ldb_now_usec();
-  int64_t imm_micros = 0; /* Micros spent doing db->imm compactions. */
-  ldb_buffer_t user_key;
-  int has_user_key = 0;
-  ldb_stats_t stats;
-  ldb_iter_t *input;
-  int rc = LDB_OK;
-  int which, level;
-  ldb_pkey_t ikey;
-  char tmp[100];
-  size_t i;
+/* Read the blocks listed in the BLOCKCACHE file back into the block
+   cache in the background, as many as fit in it. Tables are read in
+   the order their first block appears in the file, on a few threads.
+   REQUIRES: db->mutex is held. */
+static void
+ldb_warm_block_cache(ldb_t *db) {
+  ldb_version_t *base = db->versions->current;
+  ldb_lru_t *block_cache = db->options.block_cache;
+  size_t capacity = ldb_lru_capacity(block_cache);
+  size_t usage = ldb_lru_usage(block_cache);
+  size_t budget = capacity > usage ? capacity - usage : 0;
+  char fname[LDB_PATH_MAX];
+  ldb_warmjob_t *jobs;
+  ldb_slice_t input;
+  ldb_buffer_t data;
+  ldb_array_t order;
+  size_t count = 0;
+  size_t blocks = 0;
+  rb_tree_t files;
+  size_t i, j;
+  int level;
 
-  ldb_log(db->options.info_log, "Compacting %d@%d + %d@%d files",
-          (int)state->compaction->inputs[0].length,
-          state->compaction->level + 0,
-          (int)state->compaction->inputs[1].length,
-          state->compaction->level + 1);
+  if (!ldb_cache_filename(fname, sizeof(fname), db->dbname))
+    return;
 
-  ldb_buffer_init(&user_key);
-  ldb_stats_init(&stats);
+  ldb_buffer_init(&data);
 
-  assert(ldb_versions_files(db->versions, state->compaction->level) > 0);
+  if (ldb_read_file(fname, &data) != LDB_OK) {
+    ldb_buffer_clear(&data);
+    return;
+  }
 
-  assert(state->builder == NULL);
-  assert(state->outfile == NULL);
+  /* The list is only good for the next open. */
+  ldb_remove_file(fname);
 
-  if (ldb_snaplist_empty(&db->snapshots)) {
-    state->smallest_snapshot = db->versions->last_sequence;
-  } else {
-    state->smallest_snapshot =
-      ldb_snaplist_oldest(&db->snapshots)->sequence;
-  }
+  if (data.size >= 4) {
+    uint32_t crc = ldb_fixed32_decode(data.data + data.size - 4);
 
-  input = ldb_inputiter_create(db->versions, state->compaction);
+    data.size -= 4;
 
-  /* Release mutex while we're actually doing the compaction work. */
-  ldb_mutex_unlock(&db->mutex);
+    if (ldb_crc32c_unmask(crc) != ldb_crc32c_value(data.data, data.size))
+      data.size = 0;
+  }
 
-  ldb_iter_first(input);
+  if (data.size == 0) {
+    ldb_buffer_clear(&data);
+    return;
+  }
 
-  while (ldb_iter_valid(input) && !ldb_atomic_load(&db->shutting_down,
-                                                   ldb_order_acquire)) {
-    ldb_slice_t key, value;
-    int drop = 0;
+  for (level = 0; level < db->options.num_levels; level++)
+    count += base->files[level].length;
 
-    /* Prioritize immutable compaction work. */
-    if (ldb_atomic_load(&db->has_imm, ldb_order_relaxed)) {
-      int64_t imm_start = ldb_now_usec();
+  jobs = ldb_malloc(LDB_MAX(count, 1) * sizeof(ldb_warmjob_t));
 
-      ldb_mutex_lock(&db->mutex);
+  rb_tree_init(&files, rb_set64_compare, NULL);
+  ldb_array_init(&order);
 
-      if (db->imm != NULL) {
-        ldb_compact_memtable(db);
+  for (level = 0, i = 0; level < db->options.num_levels; level++) {
+    const ldb_vector_t *list = &base->files[level];
 
-        /* Wake up make_room_for_write() if necessary. */
-        ldb_cond_broadcast(&db->background_work_finished_signal);
-      }
+    for (j = 0; j < list->length; j++, i++) {
+      ldb_warmjob_t *job = &jobs[i];
+      rb_node_t *node;
 
-      ldb_mutex_unlock(&db->mutex);
+      job->db = db;
+      job->file = list->items[j];
+      job->level = level;
 
-      imm_micros += (ldb_now_usec() - imm_start);
+      ldb_array_init(&job->offsets);
+
+      if (rb_tree_put(&files, rb_ui(job->file->number), &node))
+        node->val.ptr = job;
     }
+  }
 
-    key = ldb_iter_key(input);
+  ldb_slice_set(&input, data.data, data.size);
 
-    if (ldb_compaction_should_stop_before(state->compaction, &key) &&
-        state->builder != NULL) {
-      rc = ldb_finish_compaction_output_file(db, state, input);
+  while (input.size > 0) {
+    uint64_t number, offset, charge;
+    ldb_warmjob_t *job;
+    rb_node_t *node;
 
-      if (rc != LDB_OK)
-        break;
+    if (!ldb_varint64_slurp(&number, &input) ||
+        !ldb_varint64_slurp(&offset, &input) ||
+        !ldb_varint64_slurp(&charge, &input)) {
+      break;
     }
 
-    /* Handle key/value, add to state, etc. */
-    if (!ldb_pkey_import(&ikey, &key)) {
-      /* Do not hide error keys. */
-      ldb_buffer_reset(&user_key);
-      has_user_key = 0;
-      last_sequence_for_key = LDB_MAX_SEQUENCE;
-    } else {
-      if (!has_user_key || ldb_compare(ucmp, &ikey.user_key, &user_key) != 0) {
-        /* First occurrence of this user key. */
-        ldb_buffer_set(&user_key, ikey.user_key.data, ikey.user_key.size);
-        has_user_key = 1;
-        last_sequence_for_key = LDB_MAX_SEQUENCE;
-      }
+    /* Tables may have been compacted away since. */
+    node = rb_tree_get(&files, rb_ui(number));
 
-      if (last_sequence_for_key <= state->smallest_snapshot) {
-        /* Hidden by an newer entry for same user key. */
-        drop = 1; /* (A) */
-      } else if (ikey.type == LDB_TYPE_DELETION &&
-                 ikey.sequence <= state->smallest_snapshot &&
-                 ldb_compaction_is_base_level_for_key(state->compaction,
-                                                      &ikey.user_key)) {
-        /* For this user key:
-         *
-         * (1) there is no data in higher levels
-         * (2) data in lower levels will have larger sequence numbers
-         * (3) data in layers that are being compacted here and have
-         *     smaller sequence numbers will be dropped in the next
-         *     few iterations of this loop (by rule (A) above).
-         *
-         * Therefore this deletion marker is obsolete and can be dropped.
-         */
-        drop = 1;
-      }
+    if (node == NULL)
+      continue;
 
-      last_sequence_for_key = ikey.sequence;
-    }
+    if (charge > budget)
+      break;
 
-    if (!drop) {
-      /* Open output file if necessary. */
-      if (state->builder == NULL) {
-        rc = ldb_open_compaction_output_file(db, state);
+    budget -= charge;
 
-        if (rc != LDB_OK)
-          break;
-      }
+    job = node->val.ptr;
 
-      if (ldb_tablegen_entries(state->builder) == 0)
-        ldb_ikey_copy(&ldb_cstate_top(state)->smallest, &key);
+    if (job->offsets.length == 0)
+      ldb_array_push(&order, job - jobs);
 
-      ldb_ikey_copy(&ldb_cstate_top(state)->largest, &key);
+    ldb_array_push(&job->offsets, offset);
 
-      value = ldb_iter_value(input);
+    blocks++;
+  }
 
-      ldb_tablegen_add(state->builder, &key, &value);
+  ldb_log(db->options.info_log, "Warming block cache: %lu blocks of %lu tables",
+                                (unsigned long)blocks,
+                                (unsigned long)order.length);
 
-      /* Close output file if it is big enough. */
-      if (ldb_tablegen_size(state->builder) >=
-          state->compaction->max_output_file_size) {
-        rc = ldb_finish_compaction_output_file(db, state, input);
+  if (order.length > 0) {
+    db->warm_pool = ldb_pool_create(LDB_MIN(LDB_WARM_THREADS,
+                                            (int)order.length));
+    db->warm_jobs = jobs;
+    db->warming = order.length;
+    db->warm_base = base;
 
-        if (rc != LDB_OK)
-          break;
-      }
-    }
+    ldb_version_ref(base);
 
-    ldb_iter_next(input);
+    for (i = 0; i < order.length; i++)
+      ldb_pool_schedule(db->warm_pool, &ldb_warmjob_call,
+                        &jobs[order.items[i]]);
+  } else {
+    ldb_free(jobs);
   }
 
-  if (rc == LDB_OK && ldb_atomic_load(&db->shutting_down, ldb_order_acquire))
-    rc = LDB_IOERR; /* "Deleting DB during compaction" */
+  rb_tree_clear(&files, NULL);
+  ldb_array_clear(&order);
+  ldb_buffer_clear(&data);
+}
 
-  if (rc == LDB_OK && state->builder != NULL)
-    rc = ldb_finish_compaction_output_file(db, state, input);
+static void
+ldb_record_background_error(ldb_t *db, int status) {
+  ldb_mutex_assert_held(&db->mutex);
 
-  if (rc == LDB_OK)
-    rc = ldb_iter_status(input);
+  if (db->bg_error == LDB_OK) {
+    db->bg_error = status;
 
-  ldb_iter_destroy(input);
-  input = NULL;
+    ldb_cond_broadcast(&db->background_work_finished_signal);
+  }
+}
 
-  stats.micros = ldb_now_usec() - start_micros - imm_micros;
+/* Compact the in-memory write buffer to disk. Switches to a new
+   log-file/memtable and writes a new descriptor iff successful.
+   Errors are recorded in bg_error. */
+static void
+ldb_compact_memtable(ldb_t *db) {
+  const ldb_listener_t *lis = db->options.listener;
+  int64_t start_micros = ldb_now_usec();
+  ldb_flushinfo_t info;
+  ldb_version_t *base;
+  ldb_edit_t edit;
+  int rc = LDB_OK;
+  size_t i;
 
-  for (which = 0; which < 2; which++) {
-    size_t len = state->compaction->inputs[which].length;
+  ldb_edit_init(&edit);
 
-    for (i = 0; i < len; i++) {
-      ldb_filemeta_t *f = state->compaction->inputs[which].items[i];
+  ldb_mutex_assert_held(&db->mutex);
 
-      stats.bytes_read += f->file_size;
-    }
-  }
+  assert(db->imm != NULL);
 
-  for (i = 0; i < state->outputs.length; i++) {
-    ldb_output_t *out = state->outputs.items[i];
+  if (lis != NULL) {
+    memset(&info, 0, sizeof(info));
 
-    stats.bytes_written += out->file_size;
-  }
+    info.memtable_bytes = ldb_memtable_usage(db->imm);
 
-  ldb_mutex_lock(&db->mutex);
+    ldb_mutex_unlock(&db->mutex);
+    ldb_listener_notify(lis, flush_begin, &info);
+    ldb_mutex_lock(&db->mutex);
+  }
 
-  level = state->compaction->level;
+  /* Save the contents of the memtable as a new Table. */
+  base = db->versions->current;
 
-  ldb_stats_add(&db->stats[level + 1], &stats);
+  ldb_version_ref(base);
 
-  if (rc == LDB_OK)
-    rc = ldb_install_compaction_results(db, state);
+  rc = ldb_write_level0_table(db, db->imm, &edit, base);
 
-  if (rc != LDB_OK)
-    ldb_record_background_error(db, rc);
+  ldb_version_unref(base);
 
-  ldb_buffer_clear(&user_key);
+  if (rc == LDB_OK && ldb_atomic_load(&db->shutting_down, ldb_order_acquire))
+    rc = LDB_IOERR; /* "Deleting DB during memtable compaction" */
 
-  ldb_log(db->options.info_log, "compacted to: %s",
-          ldb_versions_summary(db->versions, tmp));
+  /* Replace immutable memtable with the generated Table. */
+  if (rc == LDB_OK) {
+    ldb_edit_set_prev_log_number(&edit, 0);
+    ldb_edit_set_log_number(&edit, db->logfile_number); /* Earlier logs no
+                                                           longer needed. */
 
-  return rc;
-}
+    rc = ldb_versions_apply(db->versions, &edit, &db->mutex);
+  }
 
-static void
-ldb_cleanup_compaction(ldb_t *db, ldb_cstate_t *state) {
-  size_t i;
+  for (i = 0; i < edit.new_files.length; i++) {
+    const meta_entry_t *entry = edit.new_files.items[i];
 
-  ldb_mutex_assert_held(&db->mutex);
+    rb_set64_del(&db->pending_outputs, entry->meta.number);
+  }
 
-  if (state->builder != NULL) {
-    /* May happen if we get a shutdown call in the middle of compaction. */
-    ldb_tablegen_abandon(state->builder);
-    ldb_tablegen_destroy(state->builder);
+  if (rc == LDB_OK) {
+    /* Commit to the new state. */
+    ldb_memtable_unref(db->imm);
+    db->imm = NULL;
+    db->imm_unlogged = 0;
+    ldb_super_invalidate(db);
+    ldb_charge_memtables(db);
+    ldb_remove_obsolete_files(db);
   } else {
-    assert(state->outfile == NULL);
+    ldb_record_background_error(db, rc);
   }
 
-  if (state->outfile != NULL)
-    ldb_wfile_destroy(state->outfile);
+  if (lis != NULL) {
+    if (edit.new_files.length > 0) {
+      const meta_entry_t *entry = edit.new_files.items[0];
 
-  for (i = 0; i < state->outputs.length; i++) {
-    const ldb_output_t *out = state->outputs.items[i];
+      info.file_number = entry->meta.number;
+      info.file_size = entry->meta.file_size;
+      info.level = entry->level;
+    }
 
-    rb_set64_del(&db->pending_outputs, out->number);
+    info.micros = ldb_now_usec() - start_micros;
+    info.status = rc;
+
+    ldb_mutex_unlock(&db->mutex);
+    ldb_listener_notify(lis, flush_end, &info);
+    ldb_mutex_lock(&db->mutex);
   }
 
-  ldb_cstate_destroy(state);
+  ldb_edit_clear(&edit);
 }
 
-static void
-ldb_background_compaction(ldb_t *db) {
-  int is_manual = (db->manual_compaction != NULL);
-  ldb_compaction_t *c;
+static int
+ldb_open_compaction_output_file(ldb_t *db, ldb_cstate_t *state) {
+  int level = state->compaction->output_level;
+  int path_id = ldb_level_path_id(&db->options, level);
+  char fname[LDB_PATH_MAX];
+  uint64_t file_number;
   int rc = LDB_OK;
 
-  ldb_mutex_assert_held(&db->mutex);
+  assert(state != NULL);
+  assert(state->builder == NULL);
 
-  if (db->imm != NULL) {
-    ldb_compact_memtable(db);
-    return;
-  }
+  {
+    ldb_mutex_lock(&db->mutex);
 
-  if (is_manual) {
-    ldb_manual_t *m = db->manual_compaction;
+    file_number = state->number;
 
-    c = ldb_versions_compact_range(db->versions, m->level, m->begin, m->end);
+    if (file_number == 0)
+      file_number = ldb_versions_new_file_number(db->versions);
 
-    m->done = (c == NULL);
+    state->number = 0;
 
-    if (c != NULL) {
-      ldb_filemeta_t *f = ldb_vector_top(&c->inputs[0]);
+    rb_set64_put(&db->pending_outputs, file_number);
 
-      /* Store for later. */
-      ldb_ikey_copy(&m->tmp_storage, &f->largest);
-    }
+    ldb_vector_push(&state->outputs, ldb_output_create(file_number,
+                                                       path_id));
 
-    ldb_log(db->options.info_log, "Manual compaction at level-%d", m->level);
-  } else {
-    c = ldb_versions_pick_compaction(db->versions);
+    ldb_mutex_unlock(&db->mutex);
   }
 
-  if (c == NULL) {
-    /* Nothing to do. */
-  } else if (!is_manual && ldb_compaction_is_trivial_move(c)) {
-    /* Move file to next level. */
-    ldb_filemeta_t *f;
-    char tmp[100];
+  /* Make the output file in the directory for its level. */
+  if (!ldb_table_name(fname, sizeof(fname), db, path_id, file_number))
+    return LDB_INVALID;
 
-    assert(c->inputs[0].length == 1);
+  if (db->options.use_direct_io_for_flush_and_compaction)
+    rc = ldb_directfile_create(fname, &state->outfile);
+  else
+    rc = ldb_truncfile_create(fname, &state->outfile);
 
-    f = c->inputs[0].items[0];
+  if (rc == LDB_OK && db->options.rate_limiter != NULL)
+    ldb_wfile_ratelimit(state->outfile, db->options.rate_limiter, LDB_IO_LOW);
 
-    ldb_edit_remove_file(&c->edit, c->level, f->number);
+  if (rc == LDB_OK && db->options.allow_fallocate)
+    ldb_wfile_preallocate(state->outfile,
+                          state->compaction->max_output_file_size);
 
-    ldb_edit_add_file(&c->edit, c->level + 1,
-                                f->number,
-                                f->file_size,
-                                &f->smallest,
-                                &f->largest);
+  if (rc == LDB_OK) {
+    ldb_dbopt_t options = ldb_level_options(db, level);
 
-    rc = ldb_versions_apply(db->versions, &c->edit, &db->mutex);
+    state->builder = ldb_tablegen_create(&options, state->outfile);
 
-    if (rc != LDB_OK)
-      ldb_record_background_error(db, rc);
+    if (state->dict != NULL)
+      ldb_tablegen_set_dict(state->builder, state->dict);
 
-    ldb_log(db->options.info_log, "Moved #%lu to level-%d %lu bytes %s: %s",
-                                  (unsigned long)f->number,
-                                  c->level + 1,
-                                  (unsigned long)f->file_size,
-                                  ldb_strerror(rc),
-                                  ldb_versions_summary(db->versions, tmp));
-  } else {
-    ldb_cstate_t *state = ldb_cstate_create(c);
+    /* Outputs at the top of the tree are read soon after. */
+    if (db->options.prepopulate_block_cache > 1 && level <= 1) {
+      uint64_t cache_id = ldb_tables_reserve(db->table_cache, file_number);
 
-    rc = ldb_do_compaction_work(db, state);
+      ldb_tablegen_warm_cache(state->builder, cache_id, level);
+    }
+  }
 
-    if (rc != LDB_OK)
-      ldb_record_background_error(db, rc);
+  return rc;
+}
 
-    ldb_cleanup_compaction(db, state);
+static int
+ldb_finish_compaction_output_file(ldb_t *db, ldb_cstate_t *state,
+                                             ldb_iter_t *input) {
+  uint64_t output_number, current_entries, current_bytes;
+  ldb_tableprops_t *props;
+  int rc = LDB_OK;
 
-    ldb_compaction_release_inputs(c);
+  assert(state != NULL);
+  assert(state->outfile != NULL);
+  assert(state->builder != NULL);
 
-    ldb_remove_obsolete_files(db);
+  props = ldb_tablegen_properties(state->builder);
+
+  output_number = ldb_cstate_top(state)->number;
+
+  assert(output_number != 0);
+
+  /* Check for iterator errors. */
+  rc = ldb_iter_status(input);
+
+  /* Values must be durable before the table referencing them. */
+  if (state->blobs != NULL) {
+    if (rc == LDB_OK)
+      rc = ldb_blobgen_finish(state->blobs);
+
+    ldb_blobgen_destroy(state->blobs);
+    state->blobs = NULL;
   }
 
-  if (c != NULL)
-    ldb_compaction_destroy(c);
+  current_entries = ldb_tablegen_entries(state->builder);
 
-  if (rc == LDB_OK) {
-    /* Done. */
-  } else if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
-    /* Ignore compaction errors found during shutting down. */
-  } else {
-    ldb_log(db->options.info_log, "Compaction error: %s", ldb_strerror(rc));
+  ldb_cstate_top(state)->entries = current_entries;
+  ldb_cstate_top(state)->deletions = props->deletions;
+
+  props->creation_time = ldb_compaction_creation_time(state->compaction);
+
+  if (rc == LDB_OK)
+    rc = ldb_tablegen_finish(state->builder);
+  else
+    ldb_tablegen_abandon(state->builder);
+
+  current_bytes = ldb_tablegen_size(state->builder);
+
+  ldb_cstate_top(state)->file_size = current_bytes;
+  ldb_cstate_top(state)->tombstones = ldb_tablegen_tombstones(state->builder);
+
+  current_entries += ldb_cstate_top(state)->tombstones;
+
+  state->has_tombstone_end = 0;
+
+  state->total_bytes += current_bytes;
+
+  ldb_tablegen_destroy(state->builder);
+  state->builder = NULL;
+
+  /* Finish and check for file errors. */
+  if (rc == LDB_OK)
+    rc = ldb_wfile_sync(state->outfile);
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_close(state->outfile);
+
+  ldb_wfile_destroy(state->outfile);
+  state->outfile = NULL;
+
+  if (rc == LDB_OK && state->progress != NULL) {
+    ldb_mutex_lock(&db->mutex);
+
+    state->progress->output_files++;
+    state->progress->output_bytes += current_bytes;
+
+    ldb_mutex_unlock(&db->mutex);
   }
 
-  if (is_manual) {
-    ldb_manual_t *m = db->manual_compaction;
+  if (rc == LDB_OK && current_entries > 0) {
+    /* Verify that the table is usable. */
+    ldb_iter_t *iter = ldb_tables_iterate(db->table_cache,
+                                          ldb_readopt_default,
+                                          output_number,
+                                          current_bytes,
+                                          ldb_cstate_top(state)->path_id,
+                                          state->compaction->output_level,
+                                          0,
+                                          NULL);
 
-    if (rc != LDB_OK)
-      m->done = 1;
+    rc = ldb_iter_status(iter);
 
-    if (!m->done) {
-      /* We only compacted part of the requested range. Update *m
-         to the range that is left to be compacted. */
-      m->begin = &m->tmp_storage;
-    }
+    ldb_iter_destroy(iter);
 
-    db->manual_compaction = NULL;
+    if (rc == LDB_OK) {
+      ldb_log(db->options.info_log,
+              "Generated table #%lu@%d: %lu keys, %lu bytes",
+              (unsigned long)output_number,
+              state->compaction->level,
+              (unsigned long)current_entries,
+              (unsigned long)current_bytes);
+    }
   }
+
+  return rc;
 }
 
-static void
-ldb_background_call(void *ptr);
+/* Whether an output of a compaction overlaps the user keys of "f". */
+static int
+ldb_output_overlaps(ldb_t *db,
+                    const ldb_output_t *out,
+                    const ldb_filemeta_t *f) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_slice_t out_smallest = ldb_ikey_user_key(&out->smallest);
+  ldb_slice_t out_largest = ldb_ikey_user_key(&out->largest);
+  ldb_slice_t smallest = ldb_ikey_user_key(&f->smallest);
+  ldb_slice_t largest = ldb_ikey_user_key(&f->largest);
 
-static void
-ldb_maybe_schedule_compaction(ldb_t *db) {
-  ldb_mutex_assert_held(&db->mutex);
+  return ldb_compare(ucmp, &largest, &out_smallest) >= 0
+      && ldb_compare(ucmp, &smallest, &out_largest) <= 0;
+}
 
-  if (db->background_compaction_scheduled) {
-    /* Already scheduled. */
-  } else if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
-    /* DB is being deleted; no more background compactions. */
-  } else if (db->bg_error != LDB_OK) {
-    /* Already got an error; no more changes. */
-  } else if (db->imm == NULL && db->manual_compaction == NULL &&
-             !ldb_versions_needs_compaction(db->versions)) {
-    /* No work to be done. */
-  } else {
-    db->background_compaction_scheduled = 1;
-    ldb_pool_schedule(db->pool, &ldb_background_call, db);
+/* An output inherits half the reads of the most read input it
+   overlaps, so that a hot range stays warm through a chain of
+   compactions, but cools off once it is no longer read. */
+static int
+ldb_output_reads(ldb_t *db, ldb_compaction_t *c, const ldb_output_t *out) {
+  int which, reads = 0;
+  size_t i;
+
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      ldb_filemeta_t *f = c->inputs[which].items[i];
+      int n = ldb_atomic_load(&f->reads, ldb_order_relaxed);
+
+      if (n > reads && ldb_output_overlaps(db, out, f))
+        reads = n;
+    }
   }
+
+  return reads / 2;
 }
 
-static void
-ldb_background_call(void *ptr) {
-  ldb_t *db = ptr;
+static int
+ldb_install_compaction_results(ldb_t *db, ldb_cstate_t *state) {
+  ldb_edit_t *edit = &state->compaction->edit;
+  uint64_t creation_time = ldb_compaction_creation_time(state->compaction);
+  int level, rc;
+  size_t i;
 
-  ldb_mutex_lock(&db->mutex);
+  ldb_mutex_assert_held(&db->mutex);
 
-  assert(db->background_compaction_scheduled);
+  ldb_log(db->options.info_log, "Compacted %d@%d + %d@%d files => %ld bytes",
+          (int)state->compaction->inputs[0].length,
+          state->compaction->level + 0,
+          (int)state->compaction->inputs[1].length,
+          state->compaction->output_level,
+          (long)state->total_bytes);
 
-  if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
-    /* No more background work when shutting down. */
-  } else if (db->bg_error != LDB_OK) {
-    /* No more background work after a background error. */
-  } else {
-    ldb_background_compaction(db);
-  }
+  /* Add compaction outputs. */
+  ldb_compaction_add_input_deletions(state->compaction, edit);
 
-  db->background_compaction_scheduled = 0;
+  level = state->compaction->output_level;
 
-  /* Previous compaction may have produced too many files in a level,
-     so reschedule another compaction if needed. */
-  ldb_maybe_schedule_compaction(db);
+  for (i = 0; i < state->outputs.length; i++) {
+    const ldb_output_t *out = state->outputs.items[i];
+    ldb_filemeta_t *f = ldb_edit_add_file(edit, level,
+                                          out->number,
+                                          out->file_size,
+                                          &out->smallest,
+                                          &out->largest);
+
+    f->creation_time = creation_time;
+    f->tombstones = out->tombstones;
+    f->entries = out->entries;
+    f->deletions = out->deletions;
+    f->oldest_blob = out->oldest_blob;
+    f->path_id = out->path_id;
+
+    if (db->options.compaction_warm_reads > 0) {
+      int reads = ldb_output_reads(db, state->compaction, out);
+
+      ldb_atomic_store(&f->reads, reads, ldb_order_relaxed);
+    }
+  }
 
-  ldb_cond_broadcast(&db->background_work_finished_signal);
+  rc = ldb_versions_apply(db->versions, edit, &db->mutex);
 
-  ldb_mutex_unlock(&db->mutex);
-}
+  ldb_super_invalidate(db);
 
-static void
-cleanup_iter_state(void *arg1, void *arg2) {
-  ldb_istate_destroy((ldb_istate_t *)arg1);
-  (void)arg2;
+  return rc;
 }
 
-static ldb_iter_t *
-ldb_internal_iterator(ldb_t *db, const ldb_readopt_t *options,
-                                 ldb_seqnum_t *latest_snapshot,
-                                 uint32_t *seed) {
-  ldb_iter_t *internal_iter;
+/* Read the entries of the outputs of an installed compaction which
+   cover hot input tables (see compaction_warm_reads), filling the
+   block cache with their blocks. Stops once half of the cache was
+   read. The lock is released while reading. */
+static void
+ldb_warm_compaction_outputs(ldb_t *db, ldb_cstate_t *state) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  size_t budget = ldb_lru_capacity(db->options.block_cache) / 2;
+  ldb_compaction_t *c = state->compaction;
+  ldb_vector_t hot; /* ldb_filemeta_t */
   ldb_version_t *current;
-  ldb_istate_t *cleanup;
-  ldb_vector_t list;
+  uint64_t bytes = 0;
+  ldb_ikey_t start;
+  int which, done;
+  size_t i, j;
 
-  ldb_vector_init(&list);
+  ldb_mutex_assert_held(&db->mutex);
 
-  ldb_mutex_lock(&db->mutex);
+  ldb_vector_init(&hot);
 
-  *latest_snapshot = db->versions->last_sequence;
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      ldb_filemeta_t *f = c->inputs[which].items[i];
 
-  /* Collect together all needed child iterators. */
-  ldb_vector_push(&list, ldb_memiter_create(db->mem));
-  ldb_memtable_ref(db->mem);
+      if (ldb_atomic_load(&f->reads, ldb_order_relaxed)
+          >= db->options.compaction_warm_reads) {
+        ldb_vector_push(&hot, f);
+      }
+    }
+  }
 
-  if (db->imm != NULL) {
-    ldb_vector_push(&list, ldb_memiter_create(db->imm));
-    ldb_memtable_ref(db->imm);
+  if (hot.length == 0) {
+    ldb_vector_clear(&hot);
+    return;
   }
 
+  /* The inputs live as long as the compaction. The outputs must
+     outlive any compaction installed while we are unlocked. */
   current = db->versions->current;
 
-  ldb_version_add_iterators(current, options, &list);
+  ldb_version_ref(current);
 
-  internal_iter = ldb_mergeiter_create(&db->internal_comparator,
-                                       (ldb_iter_t **)list.items,
-                                       list.length);
+  ldb_mutex_unlock(&db->mutex);
 
-  ldb_version_ref(current);
+  ldb_ikey_init(&start);
 
-  cleanup = ldb_istate_create(&db->mutex, db->mem, db->imm,
-                              db->versions->current);
+  done = (budget == 0);
 
-  ldb_iter_register_cleanup(internal_iter, cleanup_iter_state, cleanup, NULL);
+  for (i = 0; i < state->outputs.length && !done; i++) {
+    const ldb_output_t *out = state->outputs.items[i];
+    ldb_iter_t *iter = NULL;
 
-  *seed = ++db->seed;
+    for (j = 0; j < hot.length && !done; j++) {
+      const ldb_filemeta_t *f = hot.items[j];
+      ldb_slice_t smallest = ldb_ikey_user_key(&f->smallest);
+      ldb_slice_t largest = ldb_ikey_user_key(&f->largest);
 
-  ldb_mutex_unlock(&db->mutex);
+      if (!ldb_output_overlaps(db, out, f))
+        continue;
 
-  ldb_vector_clear(&list);
+      if (iter == NULL) {
+        iter = ldb_tables_iterate(db->table_cache,
+                                  ldb_readopt_default,
+                                  out->number,
+                                  out->file_size,
+                                  out->path_id,
+                                  c->output_level,
+                                  0,
+                                  NULL);
+      }
 
-  return internal_iter;
-}
+      ldb_ikey_set(&start, &smallest, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
 
-/* REQUIRES: Writer list must be non-empty. */
-/* REQUIRES: First writer must have a non-null batch. */
-static ldb_batch_t *
-ldb_build_batch_group(ldb_t *db, ldb_waiter_t **last_writer) {
-  ldb_waiter_t *first = db->writers.head;
-  ldb_batch_t *result = first->batch;
-  size_t size, max_size;
-  ldb_waiter_t *w;
+      ldb_iter_seek(iter, &start);
 
-  ldb_mutex_assert_held(&db->mutex);
+      while (ldb_iter_valid(iter) && !done) {
+        ldb_slice_t key = ldb_iter_key(iter);
+        ldb_slice_t user_key = ldb_extract_user_key(&key);
 
-  assert(first != NULL);
+        if (ldb_compare(ucmp, &user_key, &largest) > 0)
+          break;
 
-  result = first->batch;
+        bytes += key.size + ldb_iter_value(iter).size;
 
-  assert(result != NULL);
+        done = bytes >= budget
+            || ldb_atomic_load(&db->shutting_down, ldb_order_acquire);
 
-  size = ldb_batch_size(first->batch);
+        ldb_iter_next(iter);
+      }
+    }
 
-  /* Allow the group to grow up to a maximum size, but if the
-     original write is small, limit the growth so we do not slow
-     down the small write too much. */
-  max_size = 1 << 20;
+    if (iter != NULL)
+      ldb_iter_destroy(iter);
+  }
 
-  if (size <= (128 << 10))
-    max_size = size + (128 << 10);
+  ldb_ikey_clear(&start);
 
-  *last_writer = first;
+  ldb_log(db->options.info_log, "Warmed %lu bytes of %d@%d files",
+          (unsigned long)bytes,
+          (int)state->outputs.length,
+          c->output_level);
 
-  /* Advance past "first". */
-  for (w = first->next; w != NULL; w = w->next) {
-    if (w->sync && !first->sync) {
-      /* Do not include a sync write into a
-         batch handled by a non-sync write. */
-      break;
-    }
+  ldb_mutex_lock(&db->mutex);
 
-    if (w->batch != NULL) {
-      size += ldb_batch_size(w->batch);
+  ldb_version_unref(current);
 
-      if (size > max_size) {
-        /* Do not make batch too big. */
-        break;
-      }
+  ldb_vector_clear(&hot);
+}
 
-      /* Append to *result. */
-      if (result == first->batch) {
-        /* Switch to temporary batch instead of disturbing caller's batch. */
-        result = db->tmp_batch;
+/* Pass a live value to the compaction filter. A removed value is
+   turned into a deletion marker (stored in *tombstone), as older
+   versions of the key may still exist in this compaction or below. */
+static void
+ldb_filter_entry(ldb_t *db, ldb_cstate_t *state,
+                            ldb_pkey_t *ikey,
+                            ldb_slice_t *key,
+                            ldb_slice_t *value,
+                            ldb_ikey_t *tombstone,
+                            ldb_buffer_t *changed) {
+  const ldb_cfilter_t *filter = db->options.compaction_filter;
+  ldb_slice_t new_value;
+  int decision;
 
-        assert(ldb_batch_count(result) == 0);
+  ldb_slice_init(&new_value);
 
-        ldb_batch_append(result, first->batch);
-      }
+  decision = ldb_cfilter_filter(filter, state->compaction->level,
+                                        &ikey->user_key,
+                                        value,
+                                        &new_value);
 
-      ldb_batch_append(result, w->batch);
+  switch (decision) {
+    case LDB_CFILTER_REMOVE: {
+      ldb_ikey_set(tombstone, &ikey->user_key, ikey->sequence,
+                                               LDB_TYPE_DELETION);
+
+      ikey->type = LDB_TYPE_DELETION;
+
+      *key = *tombstone;
+
+      ldb_slice_reset(value);
+
+      break;
     }
 
-    *last_writer = w;
+    case LDB_CFILTER_CHANGE: {
+      ldb_buffer_set(changed, new_value.data, new_value.size);
+      ldb_free(new_value.data);
+
+      *value = *changed;
+
+      break;
+    }
   }
+}
 
-  return result;
+/* Whether a tombstone in the current output covers keys past "key",
+   in which case the output must not be switched yet. */
+static int
+ldb_tombstone_active(ldb_t *db, ldb_cstate_t *state, const ldb_slice_t *key) {
+  ldb_slice_t user_key;
+
+  if (!state->has_tombstone_end || key->size < 8)
+    return 0;
+
+  user_key = ldb_extract_user_key(key);
+
+  return ldb_compare(ldb_user_comparator(db), &state->tombstone_end,
+                                              &user_key) > 0;
 }
 
-/* REQUIRES: db->mutex is held. */
-/* REQUIRES: this thread is currently at the front of the writer queue. */
+/* Add an entry to the current output file, opening a new one if
+   necessary and closing it once it is big enough. */
 static int
-ldb_make_room_for_write(ldb_t *db, int force) {
-  size_t write_buffer_size = db->options.write_buffer_size;
-  char fname[LDB_PATH_MAX];
-  int allow_delay = !force;
+ldb_emit_entry(ldb_t *db, ldb_cstate_t *state,
+                          ldb_iter_t *input,
+                          const ldb_slice_t *key,
+                          const ldb_slice_t *value) {
+  const ldb_comparator_t *icmp = &db->internal_comparator;
+  ldb_output_t *out;
   int rc = LDB_OK;
 
-  ldb_mutex_assert_held(&db->mutex);
+  if (state->builder == NULL) {
+    rc = ldb_open_compaction_output_file(db, state);
 
-  assert(db->writers.length > 0);
+    if (rc != LDB_OK)
+      return rc;
+  }
 
-  for (;;) {
-#define L0_FILES ldb_versions_files(db->versions, 0)
-    if (db->bg_error != LDB_OK) {
-      /* Yield previous error. */
-      rc = db->bg_error;
-      break;
-    } else if (allow_delay && L0_FILES >= LDB_L0_SLOWDOWN_WRITES_TRIGGER) {
-      /* We are getting close to hitting a hard limit on the number of
-         L0 files. Rather than delaying a single write by several
-         seconds when we hit the hard limit, start delaying each
-         individual write by 1ms to reduce latency variance. Also,
-         this delay hands over some CPU to the compaction thread in
-         case it is sharing the same core as the writer. */
-      ldb_mutex_unlock(&db->mutex);
-      ldb_sleep_usec(1000);
-      allow_delay = 0; /* Do not delay a single write more than once. */
-      ldb_mutex_lock(&db->mutex);
-    } else if (!force && ldb_memtable_usage(db->mem) <= write_buffer_size) {
-      /* There is room in current memtable. */
+  out = ldb_cstate_top(state);
+
+  if (ldb_blob_wanted(&db->options, key, value)) {
+    /* The blob file shares the output's number. */
+    if (state->blobs == NULL) {
+      rc = ldb_blobgen_create(&state->blobs, db->dbname, out->number,
+                              db->options.rate_limiter, LDB_IO_LOW);
+
+      if (rc != LDB_OK)
+        return rc;
+    }
+
+    rc = ldb_blobgen_add(state->blobs, value, &state->blob_ref);
+
+    if (rc != LDB_OK)
+      return rc;
+
+    ldb_blob_key(&state->blob_key, key);
+
+    key = &state->blob_key;
+    value = &state->blob_ref;
+  }
+
+  if (key->size >= 8 && key->data[key->size - 8] == LDB_TYPE_BLOB) {
+    uint64_t number = ldb_blobref_number(value);
+
+    if (number != 0 && (out->oldest_blob == 0 || number < out->oldest_blob))
+      out->oldest_blob = number;
+  }
+
+  /* Tombstones may extend the range on either side. */
+  if (out->smallest.size == 0 || ldb_compare(icmp, key, &out->smallest) < 0)
+    ldb_ikey_copy(&out->smallest, key);
+
+  if (out->largest.size == 0 || ldb_compare(icmp, key, &out->largest) > 0)
+    ldb_ikey_copy(&out->largest, key);
+
+  ldb_tableprops_update(ldb_tablegen_properties(state->builder), key);
+  ldb_tablegen_add(state->builder, key, value);
+
+  if (ldb_tablegen_size(state->builder) >=
+      state->compaction->max_output_file_size &&
+      !ldb_tombstone_active(db, state, key)) {
+    rc = ldb_finish_compaction_output_file(db, state, input);
+  }
+
+  return rc;
+}
+
+/* Write out the input tombstones starting at or before "user_key" (or
+   all remaining tombstones if it is null). A tombstone is dropped once
+   no snapshot predates it and no older data can exist below it. */
+static int
+ldb_emit_tombstones(ldb_t *db, ldb_cstate_t *state,
+                               const ldb_slice_t *user_key) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  const ldb_rangedel_t *rd = state->tombstones;
+  ldb_ikey_t key;
+  int rc = LDB_OK;
+
+  if (rd == NULL)
+    return LDB_OK;
+
+  ldb_ikey_init(&key);
+
+  while (state->next_tombstone < rd->tombstones.length) {
+    const ldb_tombstone_t *tomb = rd->tombstones.items[state->next_tombstone];
+
+    if (user_key != NULL && ldb_compare(ucmp, &tomb->start, user_key) > 0)
       break;
-    } else if (db->imm != NULL) {
-      /* We have filled up the current memtable, but the previous
-         one is still being compacted, so we wait. */
-      ldb_log(db->options.info_log, "Current memtable full; waiting...");
-      ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
-    } else if (L0_FILES >= LDB_L0_STOP_WRITES_TRIGGER) {
-      /* There are too many level-0 files. */
-      ldb_log(db->options.info_log, "Too many L0 files; waiting...");
-      ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+
+    state->next_tombstone++;
+
+    if (tomb->sequence <= state->smallest_snapshot &&
+        ldb_compaction_is_base_level_for_range(state->compaction,
+                                               &tomb->start,
+                                               &tomb->end)) {
+      continue;
+    }
+
+    if (state->builder == NULL) {
+      rc = ldb_open_compaction_output_file(db, state);
+
+      if (rc != LDB_OK)
+        break;
+    }
+
+    ldb_ikey_set(&key, &tomb->start, tomb->sequence, LDB_TYPE_RANGE_DELETION);
+    ldb_tablegen_add_range(state->builder, &key, &tomb->end);
+
+    ldb_tombstone_bounds(tomb, &db->internal_comparator,
+                         &ldb_cstate_top(state)->smallest,
+                         &ldb_cstate_top(state)->largest);
+
+    if (!state->has_tombstone_end ||
+        ldb_compare(ucmp, &tomb->end, &state->tombstone_end) > 0) {
+      ldb_buffer_set(&state->tombstone_end, tomb->end.data, tomb->end.size);
+      state->has_tombstone_end = 1;
+    }
+  }
+
+  ldb_ikey_clear(&key);
+
+  return rc;
+}
+
+/* Combine the merge operand at the current position with the older
+   entries of its key. The operands are replaced by a single value of
+   the newest operand's sequence if the value they apply to has been
+   found, or if no older entries can exist. Otherwise they are written
+   out unchanged. Leaves the input past the consumed entries. */
+static int
+ldb_compact_merge(ldb_t *db, ldb_cstate_t *state,
+                             ldb_iter_t *input,
+                             const ldb_pkey_t *first,
+                             ldb_mergectx_t *merge,
+                             ldb_seqnum_t *last_sequence_for_key) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_buffer_t user_key, result, existing;
+  const ldb_slice_t *base = NULL;
+  ldb_pkey_t ikey = *first;
+  ldb_seqnum_t tomb = 0;
+  ldb_array_t sequences;
+  ldb_slice_t key, value;
+  int has_base = 0;
+  int rc = LDB_OK;
+  ldb_ikey_t okey;
+  size_t i;
+
+  ldb_buffer_init(&user_key);
+  ldb_buffer_init(&result);
+  ldb_buffer_init(&existing);
+  ldb_array_init(&sequences);
+  ldb_ikey_init(&okey);
+
+  ldb_mergectx_reset(merge);
+
+  ldb_buffer_copy(&user_key, &first->user_key);
+
+  if (state->tombstones != NULL) {
+    tomb = ldb_rangedel_covering(state->tombstones, &user_key,
+                                 state->smallest_snapshot);
+  }
+
+  for (;;) {
+    value = ldb_iter_value(input);
+
+    ldb_mergectx_push(merge, &value);
+    ldb_array_push(&sequences, ikey.sequence);
+
+    ldb_iter_next(input);
+
+    if (!ldb_iter_valid(input))
+      break;
+
+    key = ldb_iter_key(input);
+
+    if (!ldb_pkey_import(&ikey, &key))
+      break;
+
+    if (ldb_compare(ucmp, &ikey.user_key, &user_key) != 0)
+      break;
+
+    /* Older entries are range deleted (and will be dropped). */
+    if (ikey.sequence < tomb) {
+      has_base = 1;
+      break;
+    }
+
+    if (ikey.type == LDB_TYPE_MERGE)
+      continue;
+
+    /* Found the value (or deletion) the operands apply to. */
+    if (ikey.type == LDB_TYPE_VALUE) {
+      value = ldb_iter_value(input);
+      ldb_buffer_copy(&existing, &value);
+      base = &existing;
+    } else if (ikey.type == LDB_TYPE_BLOB) {
+      value = ldb_iter_value(input);
+      rc = ldb_tables_blob(db->table_cache, &value, &existing);
+      base = &existing;
+    }
+
+    has_base = 1;
+
+    ldb_iter_next(input);
+
+    break;
+  }
+
+  if (rc != LDB_OK) {
+    ldb_mergectx_reset(merge);
+  } else if (has_base || ldb_compaction_is_base_level_for_key(
+                           state->compaction, &user_key)) {
+    ldb_seqnum_t sequence = sequences.items[0];
+
+    rc = ldb_mergectx_finish(merge, &user_key, base, &result);
+
+    if (rc == LDB_OK) {
+      ldb_ikey_set(&okey, &user_key, sequence, LDB_TYPE_VALUE);
+
+      rc = ldb_emit_entry(db, state, input, &okey, &result);
+
+      /* Entries of the key below the base are now hidden. */
+      *last_sequence_for_key = sequence;
+    }
+  } else {
+    const uint8_t *xp = merge->data.data;
+
+    for (i = 0; i < sequences.length && rc == LDB_OK; i++) {
+      ldb_slice_set(&value, xp, merge->sizes.items[i]);
+      ldb_ikey_set(&okey, &user_key, sequences.items[i], LDB_TYPE_MERGE);
+
+      rc = ldb_emit_entry(db, state, input, &okey, &value);
+
+      xp += value.size;
+    }
+
+    ldb_mergectx_reset(merge);
+  }
+
+  ldb_ikey_clear(&okey);
+  ldb_array_clear(&sequences);
+  ldb_buffer_clear(&existing);
+  ldb_buffer_clear(&result);
+  ldb_buffer_clear(&user_key);
+
+  return rc;
+}
+
+/* Count the input bytes before "key" as processed. */
+static void
+ldb_update_progress(ldb_t *db, ldb_cstate_t *state, const ldb_slice_t *key) {
+  ldb_progress_t *progress = state->progress;
+  uint64_t offset = ldb_compaction_input_offset(progress->compaction, key);
+
+  state->unreported = 0;
+
+  if (!state->has_offset) {
+    state->last_offset = offset;
+    state->has_offset = 1;
+    return;
+  }
+
+  if (offset <= state->last_offset)
+    return;
+
+  ldb_mutex_lock(&db->mutex);
+
+  progress->processed_bytes += offset - state->last_offset;
+
+  ldb_mutex_unlock(&db->mutex);
+
+  state->last_offset = offset;
+}
+
+/* Compact the part of the input which falls in the state's key range. */
+static int
+ldb_run_compaction(ldb_t *db, ldb_cstate_t *state, ldb_iter_t *input) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_seqnum_t last_sequence_for_key = LDB_MAX_SEQUENCE;
+  ldb_buffer_t user_key, changed, inlined;
+  ldb_mergectx_t merge;
+  ldb_ikey_t tombstone;
+  ldb_ikey_t resolved;
+  ldb_ikey_t zeroed;
+  int has_user_key = 0;
+  int rc = LDB_OK;
+  ldb_pkey_t ikey;
+  int caller;
+
+  LDB_TRACE_CALLER(caller, LDB_CALLER_BACKGROUND);
+
+  ldb_buffer_init(&user_key);
+  ldb_buffer_init(&changed);
+  ldb_buffer_init(&inlined);
+  ldb_ikey_init(&tombstone);
+  ldb_ikey_init(&resolved);
+  ldb_ikey_init(&zeroed);
+  ldb_mergectx_init(&merge, db->options.merge_operator);
+
+  if (state->has_start) {
+    ldb_ikey_t start;
+
+    ldb_ikey_init(&start);
+    ldb_ikey_set(&start, &state->start, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+
+    ldb_iter_seek(input, &start);
+
+    /* The start key belongs to the previous range. */
+    while (ldb_iter_valid(input)) {
+      ldb_slice_t key = ldb_iter_key(input);
+
+      if (ldb_pkey_import(&ikey, &key) &&
+          ldb_compare(ucmp, &ikey.user_key, &state->start) > 0) {
+        break;
+      }
+
+      ldb_iter_next(input);
+    }
+
+    ldb_ikey_clear(&start);
+  } else {
+    ldb_iter_first(input);
+  }
+
+  while (ldb_iter_valid(input) && !ldb_atomic_load(&db->shutting_down,
+                                                   ldb_order_acquire)) {
+    ldb_slice_t key, value;
+    ldb_slice_t blob_key, blob_ref;
+    uint64_t output_size;
+    int relocate = 0;
+    int covered = 0;
+    int hidden = 0;
+    int filter = 0;
+    int drop = 0;
+    int zero = 0;
+
+    key = ldb_iter_key(input);
+    value = ldb_iter_value(input);
+
+    ldb_slice_init(&blob_key);
+    ldb_slice_init(&blob_ref);
+
+    if (state->progress != NULL) {
+      if (!state->has_offset || state->unreported >= LDB_PROGRESS_INTERVAL)
+        ldb_update_progress(db, state, &key);
+
+      state->unreported += key.size + value.size;
+    }
+
+    output_size = 0;
+
+    if (state->builder != NULL)
+      output_size = ldb_tablegen_size(state->builder);
+
+    if (ldb_compaction_should_stop_before(state->compaction, &key,
+                                          output_size) &&
+        state->builder != NULL && !ldb_tombstone_active(db, state, &key)) {
+      rc = ldb_finish_compaction_output_file(db, state, input);
+
+      if (rc != LDB_OK)
+        break;
+    }
+
+    /* Handle key/value, add to state, etc. */
+    if (!ldb_pkey_import(&ikey, &key)) {
+      /* Do not hide error keys. */
+      ldb_buffer_reset(&user_key);
+      has_user_key = 0;
+      last_sequence_for_key = LDB_MAX_SEQUENCE;
     } else {
-      ldb_wfile_t *lfile = NULL;
-      uint64_t new_log_number;
+      if (state->has_end && ldb_compare(ucmp, &ikey.user_key,
+                                              &state->end) > 0) {
+        /* Past the end of our range. */
+        break;
+      }
 
-      /* Attempt to switch to a new memtable and trigger compaction of old. */
-      assert(db->versions->prev_log_number == 0);
+      if (!has_user_key || ldb_compare(ucmp, &ikey.user_key, &user_key) != 0) {
+        /* First occurrence of this user key. */
+        ldb_buffer_set(&user_key, ikey.user_key.data, ikey.user_key.size);
+        has_user_key = 1;
+        last_sequence_for_key = LDB_MAX_SEQUENCE;
+
+        rc = ldb_emit_tombstones(db, state, &ikey.user_key);
+
+        if (rc != LDB_OK)
+          break;
+      }
+
+      if (state->tombstones != NULL) {
+        covered = ldb_rangedel_covering(state->tombstones,
+                                        &ikey.user_key,
+                                        state->smallest_snapshot)
+                > ikey.sequence;
+      }
+
+      /* Every reader which would see this entry sees a newer entry
+         for the same key instead: no snapshot was taken in between.
+         (In particular, this holds if the newer entry is visible to
+         the oldest snapshot.) */
+      hidden = last_sequence_for_key != LDB_MAX_SEQUENCE &&
+               !ldb_snapshot_between(state, ikey.sequence,
+                                            last_sequence_for_key);
+
+      filter = db->options.compaction_filter != NULL && !covered &&
+               (!state->has_snapshots ||
+                ikey.sequence > state->largest_snapshot) && !hidden;
+
+      relocate = ikey.type == LDB_TYPE_BLOB && !covered && !hidden &&
+                 ldb_blobref_number(&value) < state->blob_cutoff;
+
+      if (ikey.type == LDB_TYPE_BLOB && (filter || relocate)) {
+        /* Read the value back to move it out of an old blob file (it
+           is written to a new one if still large enough), or to pass
+           it to the compaction filter. */
+        rc = ldb_tables_blob(db->table_cache, &value, &inlined);
+
+        if (rc != LDB_OK)
+          break;
+
+        ldb_ikey_set(&resolved, &ikey.user_key, ikey.sequence,
+                                                LDB_TYPE_VALUE);
+
+        blob_key = key;
+        blob_ref = value;
+
+        key = resolved;
+        value = inlined;
+        ikey.type = LDB_TYPE_VALUE;
+      }
+
+      if (filter && ikey.type == LDB_TYPE_VALUE) {
+        /* Not visible to any snapshot, and not about to be dropped. */
+        ldb_filter_entry(db, state, &ikey, &key, &value, &tombstone,
+                                                         &changed);
+
+        /* Values left unchanged keep their blob reference. */
+        if (value.data == inlined.data && ikey.type == LDB_TYPE_VALUE &&
+            blob_key.size > 0 && !relocate) {
+          key = blob_key;
+          value = blob_ref;
+          ikey.type = LDB_TYPE_BLOB;
+        }
+      }
+
+      if (hidden) {
+        /* Hidden by an newer entry for same user key. */
+        drop = 1; /* (A) */
+      } else if (covered) {
+        /* Deleted by a range tombstone which every snapshot sees. */
+        drop = 1;
+      } else if (ikey.type == LDB_TYPE_DELETION &&
+                 ikey.sequence <= state->smallest_snapshot &&
+                 ldb_compaction_is_base_level_for_key(state->compaction,
+                                                      &ikey.user_key)) {
+        /* For this user key:
+         *
+         * (1) there is no data in higher levels
+         * (2) data in lower levels will have larger sequence numbers
+         * (3) data in layers that are being compacted here and have
+         *     smaller sequence numbers will be dropped in the next
+         *     few iterations of this loop (by rule (A) above).
+         *
+         * Therefore this deletion marker is obsolete and can be dropped.
+         */
+        drop = 1;
+      } else if (ikey.type == LDB_TYPE_MERGE &&
+                 ikey.sequence <= state->smallest_snapshot &&
+                 db->options.merge_operator != NULL) {
+        /* Every snapshot sees this operand and the entries below it
+           the same way, so they can be combined now. */
+        rc = ldb_compact_merge(db, state, input, &ikey, &merge,
+                               &last_sequence_for_key);
+
+        if (rc != LDB_OK)
+          break;
+
+        continue;
+      }
+
+      /* Merge operands do not hide older entries. */
+      if (ikey.type != LDB_TYPE_MERGE)
+        last_sequence_for_key = ikey.sequence;
+
+      /* Every snapshot sees this value, and nothing older is left for
+         it to hide: its sequence number no longer matters. Zeroes in
+         the trailer compress better. Range tombstones still compare
+         sequence numbers, so they keep theirs. */
+      if (!drop && (ikey.type == LDB_TYPE_VALUE ||
+                    ikey.type == LDB_TYPE_BLOB) &&
+          ikey.sequence > 0 &&
+          ikey.sequence <= state->smallest_snapshot &&
+          state->tombstones == NULL &&
+          ldb_compaction_is_base_level_for_key(state->compaction,
+                                               &ikey.user_key)) {
+        zero = 1;
+      }
+    }
+
+    if (zero) {
+      ldb_ikey_set(&zeroed, &ikey.user_key, 0, ikey.type);
+
+      rc = ldb_emit_entry(db, state, input, &zeroed, &value);
+
+      if (rc != LDB_OK)
+        break;
+    } else if (!drop) {
+      rc = ldb_emit_entry(db, state, input, &key, &value);
+
+      if (rc != LDB_OK)
+        break;
+    }
+
+    ldb_iter_next(input);
+  }
+
+  if (rc == LDB_OK && ldb_atomic_load(&db->shutting_down, ldb_order_acquire))
+    rc = LDB_IOERR; /* "Deleting DB during compaction" */
+
+  if (rc == LDB_OK)
+    rc = ldb_emit_tombstones(db, state, NULL);
+
+  if (rc == LDB_OK && state->builder != NULL)
+    rc = ldb_finish_compaction_output_file(db, state, input);
+
+  if (rc == LDB_OK)
+    rc = ldb_iter_status(input);
+
+  ldb_buffer_clear(&user_key);
+  ldb_buffer_clear(&changed);
+  ldb_buffer_clear(&inlined);
+  ldb_ikey_clear(&tombstone);
+  ldb_ikey_clear(&resolved);
+  ldb_ikey_clear(&zeroed);
+  ldb_mergectx_clear(&merge);
+
+  LDB_TRACE_RESTORE(caller);
+
+  return rc;
+}
+
+/* A key range of a compaction, run on the subcompaction pool. */
+typedef struct ldb_subjob_s {
+  ldb_t *db;
+  ldb_cstate_t *state;
+  ldb_iter_t *input;
+  int *remaining;
+  int status;
+} ldb_subjob_t;
+
+static void
+ldb_subcompaction_call(void *ptr) {
+  ldb_subjob_t *job = ptr;
+  ldb_t *db = job->db;
+
+  job->status = ldb_run_compaction(db, job->state, job->input);
+
+  ldb_mutex_lock(&db->mutex);
+
+  *job->remaining -= 1;
+
+  ldb_cond_broadcast(&db->background_work_finished_signal);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
+/* Train a compression dictionary for the outputs of a compaction. The
+   sample is spread over the input files: each contributes an equal
+   share of entries, read from its smallest key onward. */
+static int
+ldb_train_dict(ldb_t *db, ldb_compaction_t *c, ldb_buffer_t *dict) {
+  size_t max_size = db->options.zstd_max_dict_bytes;
+  size_t budget = max_size * 100;
+  size_t files = c->inputs[0].length + c->inputs[1].length;
+  size_t share = budget / files + 1;
+  ldb_buffer_t samples;
+  ldb_array_t sizes;
+  ldb_iter_t *iter;
+  int which, ok;
+  size_t i;
+
+  ldb_buffer_init(&samples);
+  ldb_array_init(&sizes);
+
+  iter = ldb_inputiter_create(db->versions, c);
+
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      ldb_filemeta_t *f = c->inputs[which].items[i];
+      size_t start = samples.size;
+
+      ldb_iter_seek(iter, &f->smallest);
+
+      while (ldb_iter_valid(iter) && samples.size - start < share) {
+        ldb_slice_t key = ldb_iter_key(iter);
+        ldb_slice_t value = ldb_iter_value(iter);
+
+        ldb_buffer_concat(&samples, &key);
+        ldb_buffer_concat(&samples, &value);
+        ldb_array_push(&sizes, key.size + value.size);
+
+        ldb_iter_next(iter);
+      }
+    }
+  }
+
+  ok = ldb_iter_status(iter) == LDB_OK
+    && ldb_dict_train(dict, max_size, &samples, &sizes);
+
+  ldb_iter_destroy(iter);
+  ldb_array_clear(&sizes);
+  ldb_buffer_clear(&samples);
+
+  return ok;
+}
+
+/* Whether any input file of a compaction holds range tombstones. */
+static int
+ldb_compaction_has_tombstones(ldb_compaction_t *c) {
+  int which;
+  size_t i;
+
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      const ldb_filemeta_t *f = c->inputs[which].items[i];
+
+      if (f->tombstones > 0)
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Read the range tombstones of a compaction's input files. */
+static int
+ldb_read_tombstones(ldb_t *db, ldb_compaction_t *c, ldb_rangedel_t *rd) {
+  int rc = LDB_OK;
+  int which;
+  size_t i;
+
+  for (which = 0; which < 2 && rc == LDB_OK; which++) {
+    int level = (which == 0 ? c->level : c->output_level);
+
+    for (i = 0; i < c->inputs[which].length && rc == LDB_OK; i++) {
+      const ldb_filemeta_t *f = c->inputs[which].items[i];
+
+      if (f->tombstones > 0) {
+        rc = ldb_tables_tombstones(db->table_cache, f->number,
+                                                    f->file_size,
+                                                    f->path_id,
+                                                    level,
+                                                    rd);
+      }
+    }
+  }
+
+  ldb_rangedel_build(rd);
+
+  return rc;
+}
+
+/* Blob files numbered below the returned number have their values moved
+   to new files by compactions: the oldest blob_gc_age_cutoff of those
+   which may be in use, by file number. Once separation is disabled all
+   blob values are moved back into the tables. */
+static uint64_t
+ldb_blob_cutoff(ldb_t *db) {
+  uint64_t oldest = ldb_versions_oldest_blob(db->versions);
+  uint64_t next = db->versions->next_file_number;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  if (oldest == 0)
+    return 0;
+
+  if (db->options.min_blob_size == 0)
+    return next;
+
+  return oldest + (uint64_t)((next - oldest) * db->options.blob_gc_age_cutoff);
+}
+
+/* Collect the sequence numbers of the live snapshots, in ascending
+   order, followed by the last sequence (which readers without a
+   snapshot may be using). */
+static void
+ldb_compaction_snapshots(ldb_t *db, ldb_array_t *z) {
+  const ldb_snapshot_t *head = &db->snapshots.head;
+  const ldb_snapshot_t *snap;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  ldb_array_reset(z);
+
+  for (snap = head->next; snap != head; snap = snap->next) {
+    if (z->length == 0 || ldb_array_top(z) != snap->sequence)
+      ldb_array_push(z, snap->sequence);
+  }
+
+  if (z->length == 0 || ldb_array_top(z) != db->versions->last_sequence)
+    ldb_array_push(z, db->versions->last_sequence);
+}
+
+static int
+ldb_do_compaction_work(ldb_t *db, ldb_cstate_t *state) {
+  const ldb_listener_t *lis = db->options.listener;
+  int64_t start_micros = ldb_now_usec();
+  ldb_compaction_t *c = state->compaction;
+  ldb_progress_t progress;
+  ldb_compactinfo_t info;
+  ldb_vector_t splits; /* ldb_filemeta_t */
+  ldb_rangedel_t tombstones;
+  int has_tombstones;
+  ldb_subjob_t *jobs;
+  ldb_buffer_t dict;
+  ldb_stats_t stats;
+  int rc = LDB_OK;
+  int which, level;
+  int remaining;
+  size_t i, n;
+  char tmp[LDB_SUMMARY_SIZE];
+
+  ldb_log(db->options.info_log, "Compacting %d@%d + %d@%d files",
+          (int)c->inputs[0].length,
+          c->level + 0,
+          (int)c->inputs[1].length,
+          c->output_level);
+
+  ldb_stats_init(&stats);
+
+  assert(ldb_versions_files(db->versions, c->level) > 0);
+
+  assert(state->builder == NULL);
+  assert(state->outfile == NULL);
+
+  if (ldb_snaplist_empty(&db->snapshots)) {
+    state->smallest_snapshot = db->versions->last_sequence;
+    state->largest_snapshot = 0;
+  } else {
+    state->smallest_snapshot =
+      ldb_snaplist_oldest(&db->snapshots)->sequence;
+    state->largest_snapshot =
+      ldb_snaplist_newest(&db->snapshots)->sequence;
+    state->has_snapshots = 1;
+  }
+
+  ldb_compaction_snapshots(db, &state->snapshots);
+
+  state->blob_cutoff = ldb_blob_cutoff(db);
+
+  memset(&progress, 0, sizeof(progress));
+
+  progress.compaction = c;
+  progress.start_micros = start_micros;
+
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      const ldb_filemeta_t *f = c->inputs[which].items[i];
+
+      progress.input_files++;
+      progress.input_bytes += f->file_size;
+    }
+  }
+
+  state->progress = &progress;
+
+  ldb_vector_push(&db->compactions, &progress);
+
+  /* Split the key range on input file boundaries. Each range gets
+     its own input iterator and outputs, and is compacted in parallel
+     with the others. Range tombstones may span the split points, so
+     inputs holding them are compacted as a whole. */
+  ldb_vector_init(&splits);
+
+  has_tombstones = ldb_compaction_has_tombstones(c);
+
+  /* A level-0 output has to be a single file (see
+     ldb_background_compaction()). */
+  if (!has_tombstones && c->output_level > 0)
+    ldb_compaction_split_points(c, db->options.max_subcompactions, &splits);
+
+  n = splits.length + 1;
+  jobs = ldb_malloc(n * sizeof(ldb_subjob_t));
+
+  for (i = 0; i < n; i++) {
+    ldb_subjob_t *job = &jobs[i];
+
+    job->db = db;
+    job->state = state;
+    job->input = ldb_inputiter_create(db->versions, c);
+    job->remaining = &remaining;
+    job->status = LDB_OK;
+
+    if (i > 0) {
+      const ldb_filemeta_t *f = splits.items[i - 1];
+
+      job->state = ldb_cstate_create(ldb_compaction_fork(c));
+      job->state->smallest_snapshot = state->smallest_snapshot;
+      job->state->largest_snapshot = state->largest_snapshot;
+      job->state->has_snapshots = state->has_snapshots;
+      ldb_array_copy(&job->state->snapshots, &state->snapshots);
+      job->state->blob_cutoff = state->blob_cutoff;
+      job->state->progress = &progress;
+      job->state->start = ldb_ikey_user_key(&f->largest);
+      job->state->has_start = 1;
+    }
+
+    if (i < n - 1) {
+      const ldb_filemeta_t *f = splits.items[i];
+
+      job->state->end = ldb_ikey_user_key(&f->largest);
+      job->state->has_end = 1;
+    }
+  }
+
+  if (n > 1) {
+    ldb_log(db->options.info_log, "Compacting in %d subcompactions",
+                                  (int)n);
+  }
+
+  remaining = n - 1;
+
+  /* Release mutex while we're actually doing the compaction work. */
+  ldb_mutex_unlock(&db->mutex);
+
+  if (lis != NULL) {
+    memset(&info, 0, sizeof(info));
+
+    info.level = c->level;
+    info.output_level = c->output_level;
+    info.input_files = progress.input_files;
+    info.input_bytes = progress.input_bytes;
+
+    ldb_listener_notify(lis, compaction_begin, &info);
+  }
+
+  ldb_buffer_init(&dict);
+  ldb_rangedel_init(&tombstones, ldb_user_comparator(db));
+
+  if (has_tombstones) {
+    rc = ldb_read_tombstones(db, c, &tombstones);
+    state->tombstones = &tombstones;
+  }
+
+  if (db->options.zstd_max_dict_bytes > 0) {
+    ldb_dbopt_t options = ldb_level_options(db, c->output_level);
+
+    if (options.compression == LDB_ZSTD_COMPRESSION &&
+        ldb_train_dict(db, c, &dict)) {
+      for (i = 0; i < n; i++)
+        jobs[i].state->dict = &dict;
+    }
+  }
+
+  for (i = 1; i < n; i++)
+    ldb_pool_schedule(db->sub_pool, &ldb_subcompaction_call, &jobs[i]);
+
+  if (rc == LDB_OK)
+    jobs[0].status = ldb_run_compaction(db, state, jobs[0].input);
+
+  ldb_mutex_lock(&db->mutex);
+
+  while (remaining > 0)
+    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+
+  for (i = 0; i < n; i++) {
+    ldb_subjob_t *job = &jobs[i];
+
+    if (rc == LDB_OK)
+      rc = job->status;
+
+    ldb_iter_destroy(job->input);
+
+    if (i > 0) {
+      ldb_compaction_t *sub = job->state->compaction;
+
+      ldb_cstate_merge(state, job->state);
+      ldb_compaction_destroy(sub);
+    }
+  }
+
+  ldb_free(jobs);
+  ldb_vector_clear(&splits);
+  ldb_buffer_clear(&dict);
+
+  state->tombstones = NULL;
+  state->progress = NULL;
+
+  for (i = 0; i < db->compactions.length; i++) {
+    if (db->compactions.items[i] == &progress) {
+      db->compactions.items[i] = ldb_vector_pop(&db->compactions);
+      break;
+    }
+  }
+
+  ldb_rangedel_clear(&tombstones);
+
+  stats.micros = ldb_now_usec() - start_micros;
+
+  for (which = 0; which < 2; which++) {
+    size_t len = c->inputs[which].length;
+
+    for (i = 0; i < len; i++) {
+      ldb_filemeta_t *f = c->inputs[which].items[i];
+
+      stats.bytes_read += f->file_size;
+    }
+  }
+
+  for (i = 0; i < state->outputs.length; i++) {
+    ldb_output_t *out = state->outputs.items[i];
+
+    stats.bytes_written += out->file_size;
+  }
+
+  level = c->output_level;
+
+  ldb_stats_add(&db->stats[level], &stats);
+
+  if (db->latency != NULL)
+    ldb_latency_add(db->latency, LDB_LATENCY_COMPACTION, stats.micros);
+
+  ldb_statistics_add(db->options.statistics, LDB_COMPACT_READ_BYTES,
+                                             stats.bytes_read);
+
+  ldb_statistics_add(db->options.statistics, LDB_COMPACT_WRITE_BYTES,
+                                             stats.bytes_written);
+
+  if (stats.micros > 0 && stats.bytes_written > 0) {
+    double rate = stats.bytes_written * 1e6 / stats.micros;
+
+    if (db->compaction_rate > 0)
+      db->compaction_rate = 0.75 * db->compaction_rate + 0.25 * rate;
+    else
+      db->compaction_rate = rate;
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_install_compaction_results(db, state);
+
+  if (rc == LDB_OK && db->options.compaction_warm_reads > 0)
+    ldb_warm_compaction_outputs(db, state);
+
+  if (rc != LDB_OK)
+    ldb_record_background_error(db, rc);
+
+  ldb_log(db->options.info_log, "compacted to: %s",
+          ldb_versions_summary(db->versions, tmp));
+
+  if (lis != NULL) {
+    info.output_files = state->outputs.length;
+    info.output_bytes = stats.bytes_written;
+    info.micros = stats.micros;
+    info.status = rc;
+
+    ldb_mutex_unlock(&db->mutex);
+    ldb_listener_notify(lis, compaction_end, &info);
+    ldb_mutex_lock(&db->mutex);
+  }
+
+  return rc;
+}
+
+static void
+ldb_cleanup_compaction(ldb_t *db, ldb_cstate_t *state) {
+  size_t i;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  if (state->builder != NULL) {
+    /* May happen if we get a shutdown call in the middle of compaction. */
+    ldb_tablegen_abandon(state->builder);
+    ldb_tablegen_destroy(state->builder);
+  } else {
+    assert(state->outfile == NULL);
+  }
+
+  if (state->outfile != NULL)
+    ldb_wfile_destroy(state->outfile);
+
+  for (i = 0; i < state->outputs.length; i++) {
+    const ldb_output_t *out = state->outputs.items[i];
+
+    rb_set64_del(&db->pending_outputs, out->number);
+  }
+
+  ldb_cstate_destroy(state);
+}
+
+static void
+ldb_maybe_schedule_compaction(ldb_t *db);
+
+/* Returns true if any work was done. */
+static int
+ldb_background_compaction(ldb_t *db) {
+  ldb_manual_t *m = db->manual_compaction;
+  int is_manual = (m != NULL);
+  ldb_mpart_t *part = NULL;
+  ldb_compaction_t *c;
+  int rc = LDB_OK;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  if (is_manual && db->automatic_compactions > 0) {
+    /* Manual compactions do not run alongside automatic ones.
+       Leave it to whichever thread finishes last. */
+    return 0;
+  }
+
+  if (is_manual) {
+    int busy;
+
+    part = ldb_manual_next(m);
+
+    if (part == NULL) {
+      /* Every part is taken for this round. */
+      return 0;
+    }
+
+    c = ldb_versions_compact_range(db->versions, m->level, part->begin,
+                                                           part->end,
+                                                           &busy);
+
+    if (busy) {
+      /* Inputs are shared with a running part. Its thread
+         reschedules this one when it is done. */
+      return 0;
+    }
+
+    part->claimed = 1;
+    part->done = (c == NULL);
+
+    if (c != NULL) {
+      ldb_filemeta_t *f = ldb_vector_top(&c->inputs[0]);
+
+      /* Store for later. */
+      ldb_ikey_copy(&part->tmp_storage, &f->largest);
+
+      m->running++;
+
+      /* Another thread may be able to compact another part. */
+      ldb_maybe_schedule_compaction(db);
+    }
+
+    ldb_log(db->options.info_log, "Manual compaction at level-%d", m->level);
+  } else {
+    c = ldb_versions_pick_compaction(db->versions, db->imm != NULL);
+
+    /* Our inputs are now reserved. Another thread may be able
+       to find a disjoint compaction to run alongside this one. */
+    if (c != NULL) {
+      db->automatic_compactions++;
+      ldb_maybe_schedule_compaction(db);
+    }
+  }
+
+  if (c == NULL) {
+    /* Nothing to do. */
+  } else if (c->deletion) {
+    /* Drop the files outright. */
+    int count = c->inputs[0].length;
+    char tmp[LDB_SUMMARY_SIZE];
+
+    ldb_compaction_add_input_deletions(c, &c->edit);
+
+    rc = ldb_versions_apply(db->versions, &c->edit, &db->mutex);
+
+    ldb_super_invalidate(db);
+
+    if (rc != LDB_OK)
+      ldb_record_background_error(db, rc);
+
+    ldb_log(db->options.info_log, "Deleted %d files: %s: %s",
+                                  count,
+                                  ldb_strerror(rc),
+                                  ldb_versions_summary(db->versions, tmp));
+
+    ldb_compaction_release_inputs(c);
+
+    ldb_remove_obsolete_files(db);
+  } else if (!is_manual && ldb_compaction_is_trivial_move(c)) {
+    /* Move files to next level. */
+    ldb_filemeta_t *f, *meta;
+    char tmp[LDB_SUMMARY_SIZE];
+    uint64_t bytes = 0;
+    size_t i;
+
+    for (i = 0; i < c->inputs[0].length; i++) {
+      f = c->inputs[0].items[i];
+
+      ldb_edit_remove_file(&c->edit, c->level, f->number);
+
+      meta = ldb_edit_add_file(&c->edit, c->output_level,
+                                         f->number,
+                                         f->file_size,
+                                         &f->smallest,
+                                         &f->largest);
+
+      meta->creation_time = f->creation_time;
+      meta->tombstones = f->tombstones;
+      meta->global_sequence = f->global_sequence;
+      meta->entries = f->entries;
+      meta->deletions = f->deletions;
+      meta->oldest_blob = f->oldest_blob;
+      meta->path_id = f->path_id;
+
+      bytes += f->file_size;
+    }
+
+    f = c->inputs[0].items[0];
+
+    rc = ldb_versions_apply(db->versions, &c->edit, &db->mutex);
+
+    ldb_super_invalidate(db);
+
+    if (rc != LDB_OK)
+      ldb_record_background_error(db, rc);
+
+    ldb_log(db->options.info_log, "Moved #%lu (%d files) to level-%d "
+                                  "%lu bytes %s: %s",
+                                  (unsigned long)f->number,
+                                  (int)c->inputs[0].length,
+                                  c->output_level,
+                                  (unsigned long)bytes,
+                                  ldb_strerror(rc),
+                                  ldb_versions_summary(db->versions, tmp));
+  } else {
+    ldb_cstate_t *state = ldb_cstate_create(c);
+
+    /* Level-0 files are searched in order of their numbers. Merged
+       back into level-0, the output has to be numbered after its
+       inputs but before the output of any flush still to come. */
+    if (c->output_level == 0)
+      state->number = ldb_versions_new_file_number(db->versions);
+
+    rc = ldb_do_compaction_work(db, state);
+
+    if (rc != LDB_OK)
+      ldb_record_background_error(db, rc);
+
+    ldb_cleanup_compaction(db, state);
+
+    ldb_compaction_release_inputs(c);
+
+    ldb_remove_obsolete_files(db);
+  }
+
+  if (c != NULL && !is_manual)
+    db->automatic_compactions--;
+
+  if (c != NULL)
+    ldb_compaction_destroy(c);
+  else if (!is_manual)
+    return 0;
+
+  if (rc == LDB_OK) {
+    /* Done. */
+  } else if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    /* Ignore compaction errors found during shutting down. */
+  } else {
+    ldb_log(db->options.info_log, "Compaction error: %s", ldb_strerror(rc));
+  }
+
+  if (is_manual) {
+    int i;
+
+    if (c != NULL)
+      m->running--;
+
+    if (rc != LDB_OK) {
+      for (i = 0; i < m->length; i++)
+        m->parts[i].done = 1;
+    }
+
+    if (!part->done) {
+      /* We only compacted part of the requested range. Update *part
+         to the range that is left to be compacted. */
+      part->begin = &part->tmp_storage;
+    }
+
+    if (m->running == 0 && ldb_manual_next(m) == NULL) {
+      /* End of the round. Let other compactions in before the
+         next one. */
+      m->done = 1;
+
+      for (i = 0; i < m->length; i++)
+        m->done &= m->parts[i].done;
+
+      if (db->manual_compaction == m)
+        db->manual_compaction = NULL;
+    }
+  }
+
+  return 1;
+}
+
+static void
+ldb_flush_call(void *ptr);
+
+static void
+ldb_background_call(void *ptr);
+
+static void
+ldb_maybe_schedule_flush(ldb_t *db) {
+  ldb_mutex_assert_held(&db->mutex);
+
+  if (db->flush_scheduled) {
+    /* Already scheduled. */
+  } else if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    /* DB is being deleted; no more background flushes. */
+  } else if (db->bg_error != LDB_OK) {
+    /* Already got an error; no more changes. */
+  } else if (db->imm == NULL) {
+    /* No work to be done. */
+  } else {
+    db->flush_scheduled = 1;
+    ldb_pool_schedule_ex(db->flush_pool, &ldb_flush_call, db, LDB_POOL_HIGH);
+  }
+}
+
+/* Recompute our compaction debt after a flush or compaction, for the
+   write controller and an auto-tuned rate limiter. */
+static void
+ldb_update_debt(ldb_t *db) {
+  ldb_ratelimit_t *lim = db->options.rate_limiter;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  db->pending_debt = ldb_versions_pending_debt(db->versions);
+
+  if (lim != NULL && ldb_ratelimit_tuned(lim))
+    ldb_ratelimit_tune(lim, ldb_versions_compaction_debt(db->versions));
+}
+
+static void
+ldb_maybe_schedule_compaction(ldb_t *db) {
+  ldb_mutex_assert_held(&db->mutex);
+
+  /* Memtable flushes have their own thread so that they are
+     never stuck behind a long running compaction. */
+  ldb_maybe_schedule_flush(db);
+
+  if (db->background_compaction_scheduled >=
+      db->options.max_background_compactions) {
+    /* Already scheduled. */
+  } else if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    /* DB is being deleted; no more background compactions. */
+  } else if (db->bg_error != LDB_OK) {
+    /* Already got an error; no more changes. */
+  } else if (db->read_only) {
+    /* No changes at all. */
+  } else if (db->ingesting) {
+    /* The ingested table must not race with compaction outputs. */
+  } else if (db->manual_compaction != NULL &&
+             (db->automatic_compactions > 0 ||
+              db->background_compaction_scheduled >=
+                ldb_manual_slots(db->manual_compaction))) {
+    /* Manual compactions run apart from automatic ones, with at
+       most a thread per part; wait for the others. */
+  } else if (db->manual_compaction == NULL &&
+             !ldb_versions_needs_compaction(db->versions)) {
+    /* No work to be done. */
+  } else {
+    db->background_compaction_scheduled++;
+    ldb_pool_schedule(db->pool, &ldb_background_call, db);
+  }
+}
+
+static void
+ldb_flush_call(void *ptr) {
+  ldb_t *db = ptr;
+
+  ldb_mutex_lock(&db->mutex);
+
+  assert(db->flush_scheduled);
+
+  if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    /* No more background work when shutting down. */
+  } else if (db->bg_error != LDB_OK) {
+    /* No more background work after a background error. */
+  } else if (db->imm != NULL) {
+    ldb_compact_memtable(db);
+  }
+
+  db->flush_scheduled = 0;
+
+  ldb_update_debt(db);
+
+  /* The new level-0 file may have triggered a compaction. */
+  ldb_maybe_schedule_compaction(db);
+
+  /* Wake up make_room_for_write() if necessary. */
+  ldb_cond_broadcast(&db->background_work_finished_signal);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
+static void
+ldb_background_call(void *ptr) {
+  ldb_t *db = ptr;
+  int did_work = 0;
+
+  ldb_mutex_lock(&db->mutex);
+
+  assert(db->background_compaction_scheduled > 0);
+
+  if (ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    /* No more background work when shutting down. */
+  } else if (db->bg_error != LDB_OK) {
+    /* No more background work after a background error. */
+  } else {
+    did_work = ldb_background_compaction(db);
+  }
+
+  db->background_compaction_scheduled--;
+
+  if (did_work)
+    ldb_update_debt(db);
+
+  /* Previous compaction may have produced too many files in a level,
+     so reschedule another compaction if needed. A thread which found
+     nothing to do leaves this to the remaining threads (if any) in
+     order to avoid spinning on work that is already claimed. */
+  if (did_work || db->background_compaction_scheduled == 0)
+    ldb_maybe_schedule_compaction(db);
+
+  ldb_cond_broadcast(&db->background_work_finished_signal);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
+static void
+cleanup_iter_state(void *arg1, void *arg2) {
+  ldb_istate_destroy((ldb_istate_t *)arg1);
+  (void)arg2;
+}
+
+/* Gather the range tombstones of the memtables and of the tables of
+   a version. The result is null if there are none. */
+static int
+ldb_read_visible_tombstones(ldb_t *db, ldb_memtable_t *mem,
+                                       ldb_memtable_t *imm,
+                                       ldb_version_t *current,
+                                       ldb_rangedel_t **result) {
+  ldb_rangedel_t *rd = ldb_rangedel_create(ldb_user_comparator(db));
+  int rc = LDB_OK;
+  ldb_iter_t *it;
+  int level;
+  size_t i;
+
+  it = ldb_rangeiter_create(mem);
+  rc = ldb_rangedel_add_iter(rd, it);
+  ldb_iter_destroy(it);
+
+  if (rc == LDB_OK && imm != NULL) {
+    it = ldb_rangeiter_create(imm);
+    rc = ldb_rangedel_add_iter(rd, it);
+    ldb_iter_destroy(it);
+  }
+
+  for (level = 0; level < db->options.num_levels && rc == LDB_OK; level++) {
+    const ldb_vector_t *files = &current->files[level];
+
+    for (i = 0; i < files->length && rc == LDB_OK; i++) {
+      const ldb_filemeta_t *f = files->items[i];
+
+      if (f->tombstones > 0) {
+        rc = ldb_tables_tombstones(db->table_cache, f->number,
+                                                    f->file_size,
+                                                    f->path_id,
+                                                    level,
+                                                    rd);
+      }
+    }
+  }
+
+  if (rc != LDB_OK || ldb_rangedel_empty(rd)) {
+    ldb_rangedel_destroy(rd);
+    rd = NULL;
+  } else {
+    ldb_rangedel_build(rd);
+  }
+
+  *result = rd;
+
+  return rc;
+}
+
+/* Collect the children of an internal iterator over the current
+   memtables and version into *list, referencing them from "state".
+   Iterators recorded in "state" by an earlier call are reused where
+   their memtable or level-0 file is still live. Must be called with
+   the mutex held; the previous memtables and version (if any) are
+   returned in "old" to be released by the caller. */
+static void
+ldb_istate_collect(ldb_t *db, ldb_istate_t *state,
+                              ldb_istate_t *old,
+                              ldb_vector_t *list) {
+  ldb_iter_t *mem_iter = NULL;
+  ldb_iter_t *imm_iter = NULL;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  /* A memtable may have become the immutable one since. Iterators
+     over a sorted copy of a memtable miss the writes made after it. */
+  if (state->mem != NULL && ldb_memiter_sees_writes(state->mem)) {
+    if (db->mem == state->mem)
+      mem_iter = state->mem_iter;
+    else if (db->imm == state->mem)
+      imm_iter = state->mem_iter;
+  }
+
+  if (db->imm != NULL && db->imm == state->imm)
+    imm_iter = state->imm_iter;
+
+  if (mem_iter == NULL)
+    mem_iter = ldb_memiter_create(db->mem);
+
+  if (db->imm != NULL && imm_iter == NULL)
+    imm_iter = ldb_memiter_create(db->imm);
+
+  old->mem = state->mem;
+  old->imm = state->imm;
+  old->version = state->version;
+
+  state->mem = db->mem;
+  state->imm = db->imm;
+  state->version = db->versions->current;
+  state->mem_iter = mem_iter;
+  state->imm_iter = imm_iter;
+
+  ldb_memtable_ref(state->mem);
+
+  if (state->imm != NULL)
+    ldb_memtable_ref(state->imm);
+
+  ldb_version_ref(state->version);
+
+  /* Collect together all needed child iterators. */
+  ldb_vector_push(list, mem_iter);
+
+  if (imm_iter != NULL)
+    ldb_vector_push(list, imm_iter);
+
+  ldb_version_readd_iterators(state->version, &state->options, list,
+                              &state->numbers, &state->tables);
+}
+
+static ldb_iter_t *
+ldb_internal_iterator(ldb_t *db, const ldb_readopt_t *options,
+                                 ldb_seqnum_t *latest_snapshot,
+                                 uint32_t *seed,
+                                 ldb_rangedel_t **tombstones) {
+  ldb_memtable_t *mem, *imm;
+  ldb_iter_t *internal_iter;
+  ldb_version_t *current;
+  ldb_istate_t *cleanup;
+  ldb_istate_t old;
+  ldb_vector_t list;
+
+  ldb_vector_init(&list);
+
+  cleanup = ldb_istate_create(&db->mutex, options);
+
+  ldb_mutex_lock(&db->mutex);
+
+  *latest_snapshot = db->versions->last_sequence;
+
+  ldb_istate_collect(db, cleanup, &old, &list);
+
+  internal_iter = ldb_mergeiter_create_resettable(&db->internal_comparator,
+                                                  (ldb_iter_t **)list.items,
+                                                  list.length);
+
+  ldb_iter_register_cleanup(internal_iter, cleanup_iter_state, cleanup, NULL);
+
+  *seed = ++db->seed;
+
+  mem = cleanup->mem;
+  imm = cleanup->imm;
+  current = cleanup->version;
+
+  ldb_mutex_unlock(&db->mutex);
+
+  ldb_vector_clear(&list);
+
+  /* The iterator holds references to the memtables and the version. */
+  if (tombstones != NULL) {
+    int rc = ldb_read_visible_tombstones(db, mem, imm, current, tombstones);
+
+    if (rc != LDB_OK) {
+      ldb_iter_destroy(internal_iter);
+      return ldb_emptyiter_create(rc);
+    }
+  }
+
+  return internal_iter;
+}
+
+/* REQUIRES: Writer list must be non-empty. */
+/* REQUIRES: First writer must have a non-null batch. */
+/* Pick the writers of the next group and number their batches from
+   "sequence". The batches are logged and inserted as they are, rather
+   than copied into one. Returns the number of batches. */
+static size_t
+ldb_build_batch_group(ldb_t *db, ldb_waiter_t **last_writer,
+                                 ldb_seqnum_t sequence) {
+  ldb_waiter_t *first = db->writers.head;
+  size_t size, max_size;
+  size_t length = 1;
+  ldb_waiter_t *w;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  assert(first != NULL);
+  assert(first->batch != NULL);
+
+  size = ldb_batch_size(first->batch);
+
+  /* Allow the group to grow up to a maximum size, but if the
+     original write is small, limit the growth so we do not slow
+     down the small write too much. */
+  max_size = db->options.max_write_group_size;
+
+  if (size <= max_size / 8)
+    max_size = size + max_size / 8;
+
+  ldb_batch_set_sequence(first->batch, sequence);
+
+  sequence += ldb_batch_count(first->batch);
+
+  *last_writer = first;
+
+  /* Advance past "first". */
+  for (w = first->next; w != NULL; w = w->next) {
+    if (w->sync && !first->sync) {
+      /* Do not include a sync write into a
+         batch handled by a non-sync write. */
+      break;
+    }
+
+    if (w->disable_wal != first->disable_wal) {
+      /* Logged and unlogged writes are not grouped together. */
+      break;
+    }
+
+    if (w->batch == NULL) {
+      /* A NULL batch must run at the front of the queue
+         (see ldb_flush() and ldb_ingest()). */
+      break;
+    }
+
+    if (w->txn != NULL) {
+      /* A transaction must be validated against the writes
+         ahead of it (see ldb_txn_commit()). */
+      break;
+    }
+
+    size += ldb_batch_size(w->batch);
+
+    if (size > max_size) {
+      /* Do not make batch too big. */
+      break;
+    }
+
+    ldb_batch_set_sequence(w->batch, sequence);
+
+    sequence += ldb_batch_count(w->batch);
+
+    *last_writer = w;
+
+    length++;
+  }
+
+  return length;
+}
+
+/* Write the batches of a group to the log, each as its own record,
+   with a single write. Recovery replays them like separate writes;
+   each carries its own sequence number. */
+/* REQUIRES: db->mutex is not held. */
+static int
+ldb_log_group(ldb_t *db, ldb_waiter_t *first,
+                         ldb_waiter_t *last_writer,
+                         size_t length) {
+  ldb_slice_t tmp[16];
+  ldb_slice_t *slices = tmp;
+  ldb_waiter_t *w = first;
+  size_t i;
+  int rc;
+
+  if (length > lengthof(tmp))
+    slices = ldb_malloc(length * sizeof(ldb_slice_t));
+
+  for (i = 0; i < length; i++) {
+    slices[i] = ldb_batch_contents(w->batch);
+
+    if (w == last_writer)
+      break;
+
+    w = w->next;
+  }
+
+  assert(i + 1 == length);
+
+  rc = ldb_writer_add_records(db->log, slices, length);
+
+  if (slices != tmp)
+    ldb_free(slices);
+
+  return rc;
+}
+
+/* REQUIRES: db->mutex is held. */
+/* Pace a write of `bytes` while level-0 is between the slowdown and
+   stop triggers. The target rate starts at the compaction throughput
+   (or delayed_write_rate) and shrinks linearly with the room left
+   before the stop trigger, and further while compactions are larger
+   than they are meant to be. Writes are spaced out by their size at
+   that rate. Returns the time to sleep in microseconds. */
+static int64_t
+ldb_delay_write(ldb_t *db, size_t bytes) {
+  int slowdown = db->options.level0_slowdown_writes_trigger;
+  int stop = db->options.level0_stop_writes_trigger;
+  int files = ldb_versions_files(db->versions, 0);
+  double rate = db->options.delayed_write_rate;
+  int64_t now = ldb_now_usec();
+  int64_t delay;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  if (rate <= 0)
+    rate = db->compaction_rate;
+
+  if (rate <= 0)
+    rate = LDB_DELAYED_WRITE_RATE;
+
+  rate *= (double)(stop - files) / (stop - slowdown);
+
+  if (db->pending_debt > 1)
+    rate /= db->pending_debt;
+
+  rate = LDB_MAX(rate, LDB_MIN_WRITE_RATE);
+
+  if (db->delay_until < now)
+    db->delay_until = now;
+
+  delay = db->delay_until - now;
+
+  db->delay_until += (int64_t)(bytes * 1e6 / rate);
+
+  /* Give up on the rate rather than delay writes indefinitely. */
+  if (db->delay_until > now + LDB_MAX_WRITE_DELAY)
+    db->delay_until = now + LDB_MAX_WRITE_DELAY;
+
+  return delay;
+}
+
+/* Wait for background work to make room for a write. */
+/* REQUIRES: db->mutex is held. */
+static void
+ldb_stall_write(ldb_t *db) {
+  ldb_statistics_t *stats = db->options.statistics;
+  int64_t start;
+
+  if (stats == NULL) {
+    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+    return;
+  }
+
+  start = ldb_now_usec();
+
+  ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+
+  ldb_statistics_add(stats, LDB_STALL_MICROS, ldb_now_usec() - start);
+}
+
+/* Report the start of a write stall to the listener, unless this
+   write has already stalled. Returns true if the mutex was released,
+   in which case the caller must recheck its wait condition. */
+/* REQUIRES: db->mutex is held. */
+static int
+ldb_stall_begin(ldb_t *db, ldb_stallinfo_t *stall, int cause) {
+  const ldb_listener_t *lis = db->options.listener;
+
+  if (lis == NULL || stall->cause != 0)
+    return 0;
+
+  stall->cause = cause;
+  stall->level0_files = ldb_versions_files(db->versions, 0);
+  stall->micros = 0;
+
+  ldb_mutex_unlock(&db->mutex);
+  ldb_listener_notify(lis, stall_begin, stall);
+  ldb_mutex_lock(&db->mutex);
+
+  return 1;
+}
+
+/* REQUIRES: db->mutex is held. */
+/* REQUIRES: this thread is currently at the front of the writer queue. */
+static int
+ldb_make_room_for_write(ldb_t *db, int force, size_t bytes) {
+  size_t write_buffer_size = db->options.write_buffer_size;
+  int slowdown = db->options.level0_slowdown_writes_trigger;
+  int stop = db->options.level0_stop_writes_trigger;
+  const ldb_listener_t *lis = db->options.listener;
+  int allow_delay = !force;
+  int64_t stall_start = 0;
+  ldb_stallinfo_t stall;
+  int rc = LDB_OK;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  assert(db->writers.length > 0);
+
+  stall.cause = 0;
+
+  /* FIFO compaction keeps every table in level-0 and only ever
+     deletes; the level-0 triggers would stall writes for good. */
+  if (db->options.compaction_style == LDB_COMPACTION_FIFO) {
+    slowdown = 1 << 30;
+    stop = 1 << 30;
+  }
+
+  for (;;) {
+#define L0_FILES ldb_versions_files(db->versions, 0)
+    if (db->bg_error != LDB_OK) {
+      /* Yield previous error. */
+      rc = db->bg_error;
+      break;
+    } else if (allow_delay && L0_FILES >= slowdown && L0_FILES < stop) {
+      /* We are getting close to hitting a hard limit on the number of
+         L0 files. Rather than delaying a single write by several
+         seconds when we hit the hard limit, pace the writes to what
+         compactions can absorb, which also reduces latency variance.
+         The delay hands over some CPU to the compaction thread in
+         case it is sharing the same core as the writer. */
+      int64_t delay = ldb_delay_write(db, bytes);
+
+      allow_delay = 0; /* Do not delay a single write more than once. */
+
+      if (delay > 0) {
+        ldb_stallinfo_t info;
+
+        info.cause = LDB_STALL_DELAY;
+        info.level0_files = L0_FILES;
+        info.micros = delay;
+
+        ldb_mutex_unlock(&db->mutex);
+        ldb_listener_notify(lis, stall_begin, &info);
+        ldb_sleep_usec(delay);
+        ldb_listener_notify(lis, stall_end, &info);
+        ldb_mutex_lock(&db->mutex);
+
+        ldb_statistics_add(db->options.statistics, LDB_STALL_MICROS, delay);
+      }
+    } else if (!force && ldb_memtable_usage(db->mem) <= write_buffer_size
+                      && !ldb_charge_memtables(db)) {
+      /* There is room in current memtable (and within the budget
+         of the write buffer manager). */
+      break;
+    } else if (db->imm != NULL) {
+      /* We have filled up the current memtable, but the previous
+         one is still being compacted, so we wait. */
+      ldb_log(db->options.info_log, "Current memtable full; waiting...");
+
+      if (ldb_stall_begin(db, &stall, LDB_STALL_MEMTABLE))
+        stall_start = ldb_now_usec();
+      else
+        ldb_stall_write(db);
+    } else if (L0_FILES >= stop) {
+      /* There are too many level-0 files. */
+      ldb_log(db->options.info_log, "Too many L0 files; waiting...");
+
+      if (ldb_stall_begin(db, &stall, LDB_STALL_LEVEL0))
+        stall_start = ldb_now_usec();
+      else
+        ldb_stall_write(db);
+    } else if (db->mem_stage_busy) {
+      /* A pipelined write is still inserting into the memtable. */
+      ldb_cond_wait(&db->mem_stage_cv, &db->mutex);
+    } else {
+      ldb_wfile_t *lfile = NULL;
+      uint64_t new_log_number;
+
+      /* Attempt to switch to a new memtable and trigger compaction of old. */
+      assert(db->versions->prev_log_number == 0);
+
+      new_log_number = ldb_versions_new_file_number(db->versions);
+
+      rc = ldb_create_logfile(db, new_log_number, &lfile);
+
+      if (rc != LDB_OK) {
+        /* Avoid chewing through file number space in a tight loop. */
+        ldb_versions_reuse_file_number(db->versions, new_log_number);
+        break;
+      }
+
+      if (db->log != NULL)
+        ldb_writer_destroy(db->log);
+
+      if (db->logfile != NULL) {
+        rc = ldb_wfile_close(db->logfile);
+
+        if (rc != LDB_OK) {
+          /* We may have lost some data written to the previous log file.
+           * Switch to the new log file anyway, but record as a background
+           * error so we do not attempt any more writes.
+           *
+           * We could perhaps attempt to save the memtable corresponding
+           * to log file and suppress the error if that works, but that
+           * would add more complexity in a critical code path.
+           */
+          ldb_record_background_error(db, rc);
+        }
+
+        ldb_wfile_destroy(db->logfile);
+      }
+
+      db->logfile = lfile;
+      db->logfile_number = new_log_number;
+      db->log = ldb_create_writer(db, lfile, new_log_number, 0);
+      db->imm = db->mem;
+      db->imm_unlogged = db->mem_unlogged;
+
+      db->mem = ldb_new_memtable(db);
+      db->mem_unlogged = 0;
+
+      ldb_memtable_ref(db->mem);
+      ldb_super_invalidate(db);
+
+      if (db->options.write_buffer_manager != NULL) {
+        ldb_wbm_switched(db->options.write_buffer_manager,
+                         &db->wbm_client,
+                         ldb_memtable_usage(db->mem),
+                         ldb_memtable_usage(db->imm));
+      }
+
+      force = 0; /* Do not force another compaction if have room. */
+      ldb_maybe_schedule_compaction(db);
+    }
+#undef L0_FILES
+  }
+
+  if (stall.cause != 0) {
+    stall.micros = ldb_now_usec() - stall_start;
+
+    ldb_mutex_unlock(&db->mutex);
+    ldb_listener_notify(lis, stall_end, &stall);
+    ldb_mutex_lock(&db->mutex);
+  }
+
+  return rc;
+}
+
+/*
+ * File Operations
+ */
+
+enum ldb_fileop_type {
+  LDB_FILEOP_COPY,
+  LDB_FILEOP_LINK,
+  LDB_FILEOP_REMOVE
+};
+
+/* A file to copy or link from "dir" into "to", or to remove. */
+typedef struct ldb_fileop_s {
+  int type;
+  const char *dir;
+  const char *name;
+  const char *to;
+  int status;
+} ldb_fileop_t;
+
+/* A batch of file operations, run together. The names point into
+   the directory listings held by the batch. */
+typedef struct ldb_fileops_s {
+  ldb_fileop_t *items;
+  size_t length;
+  size_t alloc;
+  ldb_vector_t lists; /* char **[] */
+  ldb_array_t lengths;
+} ldb_fileops_t;
+
+static void
+ldb_fileops_init(ldb_fileops_t *ops) {
+  ops->items = NULL;
+  ops->length = 0;
+  ops->alloc = 0;
+
+  ldb_vector_init(&ops->lists);
+  ldb_array_init(&ops->lengths);
+}
+
+static void
+ldb_fileops_clear(ldb_fileops_t *ops) {
+  size_t i;
+
+  for (i = 0; i < ops->lists.length; i++)
+    ldb_free_children(ops->lists.items[i], ops->lengths.items[i]);
+
+  if (ops->items != NULL)
+    ldb_free(ops->items);
+
+  ldb_vector_clear(&ops->lists);
+  ldb_array_clear(&ops->lengths);
+}
+
+/* List the files of "dir", keeping the names until the batch is
+   cleared. Returns the number of files, or -1 on error. */
+static int
+ldb_fileops_list(ldb_fileops_t *ops, const char *dir, char ***filenames) {
+  int len = ldb_get_children(dir, filenames);
+
+  if (len >= 0) {
+    ldb_vector_push(&ops->lists, *filenames);
+    ldb_array_push(&ops->lengths, len);
+  }
+
+  return len;
+}
+
+static void
+ldb_fileops_push(ldb_fileops_t *ops, int type,
+                                     const char *dir,
+                                     const char *name,
+                                     const char *to) {
+  ldb_fileop_t *op;
+
+  if (ops->length == ops->alloc) {
+    ops->alloc = ops->alloc == 0 ? 64 : ops->alloc * 2;
+    ops->items = ldb_realloc(ops->items, ops->alloc * sizeof(ldb_fileop_t));
+  }
+
+  op = &ops->items[ops->length++];
+  op->type = type;
+  op->dir = dir;
+  op->name = name;
+  op->to = to;
+  op->status = LDB_OK;
+}
+
+static void
+ldb_fileop_call(void *arg) {
+  ldb_fileop_t *op = arg;
+  char src[LDB_PATH_MAX];
+  char dst[LDB_PATH_MAX];
+
+  if (!ldb_join(src, sizeof(src), op->dir, op->name)) {
+    op->status = LDB_INVALID;
+    return;
+  }
+
+  if (op->type == LDB_FILEOP_REMOVE) {
+    op->status = ldb_remove_file(src);
+    return;
+  }
+
+  if (!ldb_join(dst, sizeof(dst), op->to, op->name)) {
+    op->status = LDB_INVALID;
+    return;
+  }
+
+  if (op->type == LDB_FILEOP_LINK)
+    op->status = ldb_link_file(src, dst);
+  else
+    op->status = ldb_copy_file(src, dst);
+}
+
+/* Run every operation, on max_file_opening_threads threads if more
+   than one. Returns the first error. */
+static int
+ldb_fileops_run(ldb_fileops_t *ops, const ldb_dbopt_t *options) {
+  int threads = options != NULL ? options->max_file_opening_threads : 0;
+  int rc = LDB_OK;
+  ldb_pool_t *pool;
+  size_t i;
+
+  clip_to_range(threads, 0, 64);
+
+  if ((size_t)threads > ops->length)
+    threads = ops->length;
+
+  if (threads <= 1) {
+    for (i = 0; i < ops->length; i++)
+      ldb_fileop_call(&ops->items[i]);
+  } else {
+    pool = ldb_pool_create(threads);
+
+    for (i = 0; i < ops->length; i++)
+      ldb_pool_schedule(pool, &ldb_fileop_call, &ops->items[i]);
+
+    ldb_pool_wait(pool);
+    ldb_pool_destroy(pool);
+  }
+
+  for (i = 0; i < ops->length && rc == LDB_OK; i++)
+    rc = ops->items[i].status;
+
+  return rc;
+}
+
+static int
+ldb_backup_inner(const char *dbname,
+                 const char *bakname,
+                 const ldb_dbopt_t *options,
+                 rb_set64_t *live) {
+  ldb_filelock_t *lock = NULL;
+  char lockname[LDB_PATH_MAX];
+  char **filenames = NULL;
+  char dst[LDB_PATH_MAX];
+  ldb_filetype_t type;
+  ldb_fileops_t ops;
+  uint64_t number;
+  int rc = LDB_OK;
+  int len = -1;
+  int i, j;
+
+  if (!ldb_lock_filename(lockname, sizeof(lockname), bakname))
+    return LDB_INVALID;
+
+  rc = ldb_create_dir(bakname);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  rc = ldb_lock_file(lockname, &lock);
+
+  ldb_fileops_init(&ops);
+
+  if (rc == LDB_OK) {
+    len = ldb_fileops_list(&ops, dbname, &filenames);
+
+    if (len < 0)
+      rc = ldb_system_error();
+  }
+
+  for (i = 0; i < len; i++) {
+    const char *filename = filenames[i];
+    int op = -1;
+
+    if (!ldb_parse_filename(&type, &number, filename))
+      continue;
+
+    switch (type) {
+      case LDB_FILE_LOG:
+      case LDB_FILE_DESC:
+      case LDB_FILE_CURRENT:
+        op = LDB_FILEOP_COPY;
+        break;
+      case LDB_FILE_TABLE:
+        if (live == NULL || rb_set64_has(live, number))
+          op = LDB_FILEOP_LINK;
+        break;
+      case LDB_FILE_BLOB:
+        op = LDB_FILEOP_LINK;
+        break;
+      case LDB_FILE_TEMP:
+      case LDB_FILE_LOCK:
+      case LDB_FILE_CACHE:
+        break;
+      case LDB_FILE_INFO:
+        if (live == NULL)
+          op = LDB_FILEOP_COPY;
+        break;
+    }
+
+    if (op >= 0)
+      ldb_fileops_push(&ops, op, dbname, filename, bakname);
+  }
+
+  /* Tables kept in the other directories go in with the rest. */
+  for (j = 0; options != NULL && j < options->num_db_paths; j++) {
+    const char *dir = options->db_paths[j].path;
+
+    if (rc != LDB_OK)
+      break;
+
+    if (!ldb_table_dir_extra(dbname, options, j))
+      continue;
+
+    len = ldb_fileops_list(&ops, dir, &filenames);
+
+    if (len < 0) {
+      rc = ldb_system_error();
+      break;
+    }
+
+    for (i = 0; i < len; i++) {
+      const char *filename = filenames[i];
+
+      if (!ldb_parse_filename(&type, &number, filename))
+        continue;
+
+      if (type != LDB_FILE_TABLE)
+        continue;
+
+      if (live != NULL && !rb_set64_has(live, number))
+        continue;
+
+      ldb_fileops_push(&ops, LDB_FILEOP_LINK, dir, filename, bakname);
+    }
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_fileops_run(&ops, options);
+
+  ldb_fileops_clear(&ops);
+
+  if (rc != LDB_OK) {
+    len = ldb_get_children(bakname, &filenames);
+
+    for (i = 0; i < len; i++) {
+      const char *filename = filenames[i];
+
+      if (!ldb_parse_filename(&type, &number, filename))
+        continue;
+
+      if (type == LDB_FILE_LOCK)
+        continue; /* Lock file will be deleted at end. */
+
+      if (!ldb_join(dst, sizeof(dst), bakname, filename))
+        continue;
+
+      ldb_remove_file(dst);
+    }
+
+    if (len >= 0)
+      ldb_free_children(filenames, len);
+  }
+
+  if (lock != NULL) {
+    ldb_unlock_file(lock);
+    ldb_remove_file(lockname);
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_sync_dir(bakname);
+  else
+    ldb_remove_dir(bakname);
+
+  return rc;
+}
+
+/*
+ * API
+ */
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+static void
+ldb_wal_sync_thread(void *arg) {
+  ldb_t *db = arg;
+  int64_t interval = (int64_t)db->options.wal_sync_interval * 1000;
+  int64_t next = ldb_now_usec() + interval;
+  ldb_seqnum_t synced = 0;
+  ldb_seqnum_t last;
+
+  /* Sleep in short steps to notice shutdowns. */
+  while (!ldb_atomic_load(&db->shutting_down, ldb_order_acquire)) {
+    int64_t now = ldb_now_usec();
+
+    if (now < next) {
+      ldb_sleep_usec(LDB_MIN(next - now, 10000));
+      continue;
+    }
+
+    next = now + interval;
+
+    ldb_mutex_lock(&db->mutex);
+
+    last = db->versions->last_sequence;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    /* Nothing to do if there were no writes since the last sync. */
+    if (last != synced && ldb_flush_wal(db, 1) == LDB_OK)
+      synced = last;
+  }
+}
+#endif
+
+int
+ldb_open(const char *dbname, const ldb_dbopt_t *options, ldb_t **dbptr) {
+  char path[LDB_PATH_MAX];
+  int save_manifest = 0;
+  ldb_edit_t edit;
+  int rc = LDB_OK;
+  ldb_t *db;
+
+  ldb_crc32c_init();
+
+  *dbptr = NULL;
+
+  if (options == NULL)
+    return LDB_INVALID;
+
+  if (options->filter_policy != NULL) {
+    if (strlen(options->filter_policy->name) > 64)
+      return LDB_INVALID;
+  }
+
+  if (!ldb_path_absolute(path, sizeof(path) - 35, dbname))
+    return LDB_INVALID;
+
+  if (options->in_memory) {
+    rc = ldb_destroy(path, options);
+
+    if (rc != LDB_OK)
+      return rc;
+  }
+
+  db = ldb_create(path, options, 0);
+
+  ldb_edit_init(&edit);
+  ldb_mutex_lock(&db->mutex);
+
+  /* Recover handles create_if_missing, error_if_exists. */
+  rc = ldb_recover(db, &edit, &save_manifest);
+
+  if (rc == LDB_OK && db->mem == NULL) {
+    /* Create new log and a corresponding memtable. */
+    uint64_t new_log_number = ldb_versions_new_file_number(db->versions);
+    ldb_wfile_t *lfile;
+
+    rc = ldb_create_logfile(db, new_log_number, &lfile);
+
+    if (rc == LDB_OK) {
+      ldb_edit_set_log_number(&edit, new_log_number);
+
+      db->logfile = lfile;
+      db->logfile_number = new_log_number;
+      db->log = ldb_create_writer(db, lfile, new_log_number, 0);
+      db->mem = ldb_new_memtable(db);
+
+      ldb_memtable_ref(db->mem);
+    }
+  }
+
+  if (rc == LDB_OK && save_manifest) {
+    ldb_edit_set_prev_log_number(&edit, 0); /* No older logs needed
+                                               after recovery. */
+    ldb_edit_set_log_number(&edit, db->logfile_number);
+
+    rc = ldb_versions_apply(db->versions, &edit, &db->mutex);
+  }
+
+  if (rc == LDB_OK) {
+    ldb_super_invalidate(db);
+    ldb_preload_tables(db);
+
+    if (db->options.block_cache_dump)
+      ldb_warm_block_cache(db);
+
+    ldb_remove_obsolete_files(db);
+    ldb_maybe_schedule_compaction(db);
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+  if (rc == LDB_OK && db->options.wal_sync_interval > 0) {
+    ldb_thread_create(&db->wal_thread, ldb_wal_sync_thread, db);
+    db->wal_thread_running = 1;
+  }
+#endif
+
+  if (rc == LDB_OK) {
+    assert(db->mem != NULL);
+    *dbptr = db;
+  } else {
+    ldb_destroy_internal(db);
+  }
+
+  ldb_edit_clear(&edit);
+
+  return rc;
+}
+
+void
+ldb_close(ldb_t *db) {
+  char dbname[LDB_PATH_MAX];
+  ldb_dbopt_t options;
+  int unlogged;
+
+  if (db->options.in_memory) {
+    /* Only the paths are used from here on. */
+    strcpy(dbname, db->dbname);
+    options = db->options;
+
+    ldb_destroy_internal(db);
+    ldb_destroy(dbname, &options);
+
+    return;
+  }
+
+  ldb_mutex_lock(&db->mutex);
+
+  unlogged = db->mem_unlogged || db->imm_unlogged;
+
+  ldb_mutex_unlock(&db->mutex);
+
+  /* Writes which skipped the log would not survive a reopen. */
+  if (unlogged)
+    ldb_flush(db, 1, 1);
+
+  if (db->options.block_cache_dump && !db->read_only)
+    ldb_dump_block_cache(db);
+
+  ldb_destroy_internal(db);
+}
+
+/* Read the logs of the current version into a new memtable, without
+   flushing it (read-only instances). */
+static int
+ldb_read_logs(ldb_t *db, ldb_memtable_t **result, ldb_seqnum_t *max_sequence) {
+  uint64_t min_log, prev_log, number;
+  char fname[LDB_PATH_MAX];
+  char **filenames = NULL;
+  ldb_reporter_t reporter;
+  ldb_memtable_t *mem;
+  ldb_filetype_t type;
+  ldb_slice_t record;
+  ldb_reader_t reader;
+  ldb_batch_t batch;
+  ldb_array_t logs;
+  ldb_buffer_t buf;
+  ldb_rfile_t *file;
+  int rc = LDB_OK;
+  int i, len;
+
+  ldb_mutex_assert_held(&db->mutex);
+
+  min_log = db->versions->log_number;
+  prev_log = db->versions->prev_log_number;
+
+  len = ldb_get_children(db->dbname, &filenames);
+
+  if (len < 0)
+    return ldb_system_error();
+
+  ldb_array_init(&logs);
+
+  for (i = 0; i < len; i++) {
+    if (ldb_parse_filename(&type, &number, filenames[i])) {
+      if (type == LDB_FILE_LOG && ((number >= min_log) || (number == prev_log)))
+        ldb_array_push(&logs, number);
+    }
+  }
+
+  ldb_free_children(filenames, len);
+
+  ldb_array_sort(&logs, compare_ascending);
+
+  mem = ldb_new_memtable(db);
+
+  ldb_memtable_ref(mem);
+
+  /* The last record may still be in the middle of being written. */
+  reporter.fname = fname;
+  reporter.status = NULL;
+  reporter.info_log = db->options.info_log;
+  reporter.corruption = report_corruption;
+
+  ldb_batch_init(&batch);
+  ldb_buffer_init(&buf);
+
+  for (i = 0; i < (int)logs.length && rc == LDB_OK; i++) {
+    if (!ldb_log_filename(fname, sizeof(fname), db->dbname, logs.items[i])) {
+      rc = LDB_INVALID;
+      break;
+    }
+
+    rc = ldb_seqfile_create(fname, &file);
+
+    if (rc == LDB_ENOENT) {
+      /* Flushed and deleted since the descriptor was read. */
+      rc = LDB_OK;
+      continue;
+    }
+
+    if (rc != LDB_OK)
+      break;
+
+    ldb_reader_init(&reader, file, &reporter, 1, 0);
+    ldb_reader_block_size(&reader, db->options.wal_block_size);
+    ldb_reader_recyclable(&reader, logs.items[i]);
+
+    while (ldb_reader_read_record(&reader, &record, &buf)) {
+      ldb_seqnum_t last_seq;
+
+      if (record.size < 12)
+        continue;
+
+      ldb_batch_set_contents(&batch, &record);
+
+      rc = ldb_batch_insert_into(&batch, mem);
+
+      if (rc != LDB_OK)
+        break;
+
+      last_seq = ldb_batch_sequence(&batch) + ldb_batch_count(&batch) - 1;
+
+      if (last_seq > *max_sequence)
+        *max_sequence = last_seq;
+    }
+
+    ldb_reader_clear(&reader);
+    ldb_rfile_destroy(file);
+  }
+
+  ldb_batch_clear(&batch);
+  ldb_buffer_clear(&buf);
+  ldb_array_clear(&logs);
+
+  if (rc != LDB_OK) {
+    ldb_memtable_unref(mem);
+    return rc;
+  }
+
+  *result = mem;
+
+  return LDB_OK;
+}
+
+int
+ldb_catch_up(ldb_t *db) {
+  ldb_seqnum_t max_sequence = 0;
+  ldb_memtable_t *mem = NULL;
+  int rc;
+
+  if (!db->read_only)
+    return LDB_NOSUPPORT;
+
+  ldb_mutex_lock(&db->mutex);
+
+  rc = ldb_versions_reload(db->versions);
+
+  if (rc == LDB_OK)
+    rc = ldb_read_logs(db, &mem, &max_sequence);
+
+  if (rc == LDB_OK) {
+    if (db->mem != NULL)
+      ldb_memtable_unref(db->mem);
+
+    db->mem = mem;
+
+    if (db->versions->last_sequence < max_sequence)
+      db->versions->last_sequence = max_sequence;
+
+    /* Open the new tables before their owner can delete them. */
+    ldb_preload_tables(db);
+  }
+
+  ldb_super_invalidate(db);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  return rc;
+}
+
+int
+ldb_open_readonly(const char *dbname,
+                  const ldb_dbopt_t *options,
+                  ldb_t **dbptr) {
+  char current[LDB_PATH_MAX];
+  char path[LDB_PATH_MAX];
+  ldb_t *db;
+  int rc;
+
+  ldb_crc32c_init();
+
+  *dbptr = NULL;
+
+  if (options == NULL)
+    return LDB_INVALID;
+
+  if (options->filter_policy != NULL) {
+    if (strlen(options->filter_policy->name) > 64)
+      return LDB_INVALID;
+  }
+
+  if (!ldb_path_absolute(path, sizeof(path) - 35, dbname))
+    return LDB_INVALID;
+
+  if (!ldb_current_filename(current, sizeof(current), path))
+    return LDB_INVALID;
+
+  if (!ldb_file_exists(current))
+    return LDB_INVALID; /* "does not exist" */
+
+  db = ldb_create(path, options, 1);
+
+  rc = ldb_catch_up(db);
+
+  if (rc == LDB_OK)
+    *dbptr = db;
+  else
+    ldb_destroy_internal(db);
+
+  return rc;
+}
+
+static void
+unref_memtable(void *arg1, void *arg2) {
+  ldb_t *db = (ldb_t *)arg1;
+  ldb_memtable_t *mem = (ldb_memtable_t *)arg2;
+
+  ldb_mutex_lock(&db->mutex);
+  ldb_memtable_unref(mem);
+  ldb_mutex_unlock(&db->mutex);
+}
+
+/* Look up a key, copying the value into *value unless *pin (if
+   non-null) can be pointed at it instead, or the read is key-only. */
+static int
+ldb_get_value(ldb_t *db, const ldb_slice_t *key,
+                         ldb_slice_t *value,
+                         ldb_pinned_t *pin,
+                         const ldb_readopt_t *options) {
+  ldb_buffer_t *out = value;
+  ldb_memtable_t *pinned_mem = NULL;
+  ldb_memtable_t *mem, *imm;
+  ldb_version_t *current;
+  ldb_seqnum_t snapshot;
+  ldb_super_t *sv;
+  int slot;
+  int have_stat_update = 0;
+  ldb_getstats_t stats;
+  int64_t perf_start;
+  int64_t start = 0;
+  int rc = LDB_OK;
+
+  LDB_PERF_START(perf_start);
+
+  if (db->latency != NULL)
+    start = ldb_now_usec();
+
+  if (value != NULL)
+    ldb_buffer_init(value);
+
+  if (options == NULL)
+    options = ldb_readopt_default;
+
+  /* Key-only lookups leave the value empty. */
+  if (options->keys_only) {
+    out = NULL;
+    pin = NULL;
+  }
+
+  /* Usually taken without the mutex. */
+  sv = ldb_super_acquire(db, &snapshot, &slot);
+
+  if (options->snapshot != NULL)
+    snapshot = options->snapshot->sequence;
+
+  mem = sv->mem;
+  imm = sv->imm;
+  current = sv->current;
+
+  {
+    ldb_mergectx_t merge;
+    ldb_lkey_t lkey;
+    int64_t mem_start;
+
+    /* First look in the memtable, then in the immutable memtable (if any). */
+    ldb_lkey_init(&lkey, key, snapshot);
+    ldb_mergectx_init(&merge, db->options.merge_operator);
+
+    LDB_PERF_START(mem_start);
+
+    if (ldb_memtable_get(mem, &lkey, out, pin, &rc, &merge)) {
+      pinned_mem = mem;
+    } else if (imm != NULL && ldb_memtable_get(imm, &lkey, out, pin,
+                                               &rc, &merge)) {
+      pinned_mem = imm;
+    }
+
+    LDB_PERF_STOP(memtable_nanos, mem_start);
+    LDB_PERF_ADD(memtable_count, (imm != NULL && pinned_mem != mem) + 1);
+
+    ldb_statistics_add(db->options.statistics,
+                       pinned_mem != NULL ? LDB_MEMTABLE_HIT
+                                          : LDB_MEMTABLE_MISS, 1);
+
+    if (pinned_mem == NULL) {
+      int caller;
+
+      LDB_TRACE_CALLER(caller, LDB_CALLER_GET);
+
+      rc = ldb_version_get(current, options, &lkey, out, pin,
+                           &stats, &merge);
+
+      LDB_TRACE_RESTORE(caller);
+
+      have_stat_update = 1;
+    }
+
+    ldb_mergectx_clear(&merge);
+    ldb_lkey_clear(&lkey);
+  }
+
+  /* Seeks are charged without the mutex. Only a file running out of
+     them, or a value pinning a memtable, needs it. */
+  if (have_stat_update && !ldb_version_charge_seek(&stats))
+    have_stat_update = 0;
+
+  if (have_stat_update || (pinned_mem != NULL && pin != NULL && pin->pending)) {
+    ldb_mutex_lock(&db->mutex);
+
+    if (have_stat_update && ldb_version_update_stats(current, &stats))
+      ldb_maybe_schedule_compaction(db);
+
+    /* A value pointing into a memtable keeps the memtable alive. */
+    if (pinned_mem != NULL && pin != NULL && pin->pending) {
+      ldb_memtable_ref(pinned_mem);
+      ldb_pinned_register(pin, &unref_memtable, db, pinned_mem);
+      pin->pending = 0;
+    }
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  ldb_super_release(db, sv, slot);
+
+  if (value != NULL) {
+    if (rc == LDB_OK)
+      ldb_buffer_grow(value, 1);
+    else
+      ldb_buffer_clear(value);
+  }
+
+  if (db->latency != NULL)
+    ldb_latency_add(db->latency, LDB_LATENCY_GET, ldb_now_usec() - start);
+
+  if (ldb_tracer_active(db->tracer)) {
+    size_t size = 0;
+
+    if (rc == LDB_OK && value != NULL) {
+      if (pin != NULL && value->size == 0)
+        size = pin->value.size;
+      else
+        size = value->size;
+    }
+
+    ldb_tracer_record(db->tracer, LDB_TRACE_GET, key, size);
+  }
+
+  if (db->options.statistics != NULL) {
+    ldb_statistics_add(db->options.statistics, LDB_KEYS_READ, 1);
+
+    if (rc == LDB_OK && value != NULL)
+      ldb_statistics_add(db->options.statistics, LDB_BYTES_READ, value->size);
+  }
+
+  LDB_PERF_STOP(get_nanos, perf_start);
+
+  return rc;
+}
+
+int
+ldb_get(ldb_t *db, const ldb_slice_t *key,
+                   ldb_slice_t *value,
+                   const ldb_readopt_t *options) {
+  return ldb_get_value(db, key, value, NULL, options);
+}
+
+int
+ldb_get_pinned(ldb_t *db, const ldb_slice_t *key,
+                          ldb_pinned_t **value,
+                          const ldb_readopt_t *options) {
+  ldb_pinned_t *pin = ldb_pinned_create();
+  int rc;
+
+  rc = ldb_get_value(db, key, &pin->buf, pin, options);
+
+  if (rc != LDB_OK) {
+    ldb_pinned_destroy(pin);
+    *value = NULL;
+    return rc;
+  }
+
+  /* Merged values (and copies) live in the pin's own buffer. */
+  if (pin->length == 0)
+    ldb_slice_set(&pin->value, pin->buf.data, pin->buf.size);
+
+  *value = pin;
+
+  return LDB_OK;
+}
+
+int
+ldb_multiget(ldb_t *db, const ldb_slice_t *keys,
+                        ldb_slice_t *values,
+                        int *statuses,
+                        size_t count,
+                        const ldb_readopt_t *options) {
+  ldb_memtable_t *mem, *imm;
+  ldb_version_t *current;
+  ldb_seqnum_t snapshot;
+  const ldb_lkey_t **pkeys;
+  ldb_buffer_t **pvalues;
+  ldb_getstats_t *stats;
+  ldb_mergectx_t merge;
+  ldb_lkey_t *lkeys;
+  int *pstatuses;
+  size_t i, pending;
+  ldb_super_t *sv;
+  int rc = LDB_OK;
+  int slot, seeks;
+
+  if (count == 0)
+    return LDB_OK;
+
+  if (options == NULL)
+    options = ldb_readopt_default;
+
+  lkeys = ldb_malloc(count * sizeof(ldb_lkey_t));
+  pkeys = ldb_malloc(count * sizeof(ldb_lkey_t *));
+  pvalues = ldb_malloc(count * sizeof(ldb_buffer_t *));
+  pstatuses = ldb_malloc(count * sizeof(int));
+  stats = ldb_malloc(count * sizeof(ldb_getstats_t));
+
+  if (values != NULL) {
+    for (i = 0; i < count; i++)
+      ldb_buffer_init(&values[i]);
+  }
+
+  /* Usually taken without the mutex. */
+  sv = ldb_super_acquire(db, &snapshot, &slot);
+
+  if (options->snapshot != NULL)
+    snapshot = options->snapshot->sequence;
+
+  mem = sv->mem;
+  imm = sv->imm;
+  current = sv->current;
+
+  ldb_mergectx_init(&merge, db->options.merge_operator);
+
+  pending = 0;
+
+  for (i = 0; i < count; i++) {
+    ldb_buffer_t *value = NULL;
+    ldb_lkey_t *lkey = &lkeys[i];
+
+    if (values != NULL && !options->keys_only)
+      value = &values[i];
+
+    ldb_lkey_init(lkey, &keys[i], snapshot);
+    ldb_mergectx_reset(&merge);
+
+    statuses[i] = LDB_OK;
+
+    /* First look in the memtable, then in the immutable memtable (if any). */
+    if (ldb_memtable_get(mem, lkey, value, NULL, &statuses[i], &merge)) {
+      /* Done. */
+    } else if (imm != NULL && ldb_memtable_get(imm, lkey, value, NULL,
+                                               &statuses[i], &merge)) {
+      /* Done. */
+    } else if (ldb_mergectx_pending(&merge)) {
+      /* Merge operands need their base value looked up separately.
+         Seek statistics are not charged for these. */
+      ldb_getstats_t unused;
+
+      statuses[i] = ldb_version_get(current, options, lkey, value, NULL,
+                                    &unused, &merge);
+    } else {
+      /* Defer the remaining keys to a single pass over the tables. */
+      pkeys[pending] = lkey;
+      pvalues[pending] = value;
+      pending++;
+    }
+  }
+
+  ldb_mergectx_clear(&merge);
+
+  if (pending > 0)
+    ldb_version_multiget(current, options, pkeys, pvalues,
+                         pstatuses, stats, pending);
+
+  for (i = 0; i < count; i++)
+    ldb_lkey_clear(&lkeys[i]);
+
+  seeks = 0;
+
+  for (i = 0; i < pending; i++)
+    seeks |= ldb_version_charge_seek(&stats[i]);
+
+  /* Only files running out of seeks need the mutex. */
+  if (seeks) {
+    ldb_mutex_lock(&db->mutex);
+
+    for (i = 0; i < pending; i++) {
+      if (ldb_version_update_stats(current, &stats[i]))
+        ldb_maybe_schedule_compaction(db);
+    }
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  ldb_super_release(db, sv, slot);
+
+  /* Scatter the table results back in key order. */
+  for (i = 0; i < pending; i++)
+    statuses[pkeys[i] - lkeys] = pstatuses[i];
+
+  for (i = 0; i < count; i++) {
+    if (values != NULL) {
+      if (statuses[i] == LDB_OK)
+        ldb_buffer_grow(&values[i], 1);
+      else
+        ldb_buffer_clear(&values[i]);
+    }
+
+    if (rc == LDB_OK && statuses[i] != LDB_OK && statuses[i] != LDB_NOTFOUND)
+      rc = statuses[i];
+  }
+
+  ldb_free(stats);
+  ldb_free(pstatuses);
+  ldb_free(pvalues);
+  ldb_free(pkeys);
+  ldb_free(lkeys);
+
+  return rc;
+}
+
+int
+ldb_get_packed(ldb_t *db, const void *keys,
+                          size_t size,
+                          void **result,
+                          size_t *length,
+                          const ldb_readopt_t *options) {
+  ldb_slice_t data, *slices, *values;
+  size_t i, count, total;
+  ldb_slice_t key;
+  int *statuses;
+  uint8_t *zp;
+  int rc;
+
+  *result = NULL;
+  *length = 0;
+
+  ldb_slice_set(&data, keys, size);
+
+  for (count = 0; data.size > 0; count++) {
+    if (!ldb_slice_slurp(&key, &data))
+      return LDB_INVALID;
+  }
+
+  slices = ldb_malloc((count + 1) * sizeof(ldb_slice_t));
+  values = ldb_malloc((count + 1) * sizeof(ldb_slice_t));
+  statuses = ldb_malloc((count + 1) * sizeof(int));
+
+  ldb_slice_set(&data, keys, size);
+
+  for (i = 0; i < count; i++)
+    ldb_slice_slurp(&slices[i], &data);
+
+  rc = ldb_multiget(db, slices, values, statuses, count, options);
+
+  if (rc == LDB_OK) {
+    total = 0;
+
+    for (i = 0; i < count; i++) {
+      if (statuses[i] == LDB_OK)
+        total += ldb_varint32_size(values[i].size + 1) + values[i].size;
+      else
+        total += 1;
+    }
+
+    /* Each value is prefixed with its size plus one, or zero if
+       the key was not found. */
+    zp = ldb_malloc(total + 1);
+
+    *result = zp;
+    *length = total;
+
+    for (i = 0; i < count; i++) {
+      if (statuses[i] == LDB_OK) {
+        zp = ldb_varint32_write(zp, values[i].size + 1);
+        zp = ldb_raw_write(zp, values[i].data, values[i].size);
+      } else {
+        *zp++ = 0;
+      }
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    if (statuses[i] == LDB_OK)
+      ldb_buffer_clear(&values[i]);
+  }
+
+  ldb_free(statuses);
+  ldb_free(values);
+  ldb_free(slices);
+
+  return rc;
+}
+
+int
+ldb_has(ldb_t *db, const ldb_slice_t *key, const ldb_readopt_t *options) {
+  return ldb_get(db, key, NULL, options);
+}
+
+int
+ldb_put(ldb_t *db, const ldb_slice_t *key,
+                   const ldb_slice_t *value,
+                   const ldb_writeopt_t *options) {
+  ldb_batch_t batch;
+  int rc;
+
+  ldb_batch_init(&batch);
+  ldb_batch_put(&batch, key, value);
+
+  rc = ldb_write(db, &batch, options);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
+int
+ldb_put_packed(ldb_t *db, const void *data,
+                          size_t size,
+                          const ldb_writeopt_t *options) {
+  ldb_slice_t input, key, value;
+  ldb_batch_t batch;
+  int rc;
+
+  ldb_slice_set(&input, data, size);
+  ldb_batch_init(&batch);
+
+  while (input.size > 0) {
+    if (!ldb_slice_slurp(&key, &input) ||
+        !ldb_slice_slurp(&value, &input)) {
+      ldb_batch_clear(&batch);
+      return LDB_INVALID;
+    }
+
+    ldb_batch_put(&batch, &key, &value);
+  }
+
+  rc = ldb_write(db, &batch, options);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
+int
+ldb_del(ldb_t *db, const ldb_slice_t *key, const ldb_writeopt_t *options) {
+  ldb_batch_t batch;
+  int rc;
+
+  ldb_batch_init(&batch);
+  ldb_batch_del(&batch, key);
+
+  rc = ldb_write(db, &batch, options);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
+int
+ldb_merge(ldb_t *db, const ldb_slice_t *key,
+                     const ldb_slice_t *value,
+                     const ldb_writeopt_t *options) {
+  ldb_batch_t batch;
+  int rc;
+
+  if (db->options.merge_operator == NULL)
+    return LDB_NOSUPPORT; /* "no merge operator" */
+
+  ldb_batch_init(&batch);
+  ldb_batch_merge(&batch, key, value);
+
+  rc = ldb_write(db, &batch, options);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
+int
+ldb_del_range(ldb_t *db, const ldb_slice_t *start,
+                         const ldb_slice_t *end,
+                         const ldb_writeopt_t *options) {
+  ldb_batch_t batch;
+  int rc;
+
+  if (ldb_compare(ldb_user_comparator(db), start, end) > 0)
+    return LDB_INVALID; /* "start key sorts after end key" */
+
+  ldb_batch_init(&batch);
+  ldb_batch_del_range(&batch, start, end);
+
+  rc = ldb_write(db, &batch, options);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
+/* REQUIRES: db->mutex is not held. */
+static int
+ldb_sync_log(ldb_t *db) {
+  int64_t start;
+  int rc;
+
+  ldb_statistics_add(db->options.statistics, LDB_WAL_SYNCS, 1);
+
+  if (db->latency == NULL)
+    return ldb_wfile_sync(db->logfile);
+
+  start = ldb_now_usec();
+
+  rc = ldb_wfile_sync(db->logfile);
+
+  ldb_latency_add(db->latency, LDB_LATENCY_WAL_SYNC, ldb_now_usec() - start);
+
+  return rc;
+}
+
+/* Smallest run of a batch handed to an insert thread. */
+#define LDB_MIN_INSERT_RUN (1 << 20)
+
+typedef struct ldb_insertjob_s {
+  ldb_batchpart_t part;
+  ldb_memtable_t *mem;
+  int status;
+} ldb_insertjob_t;
+
+static void
+ldb_insertjob_call(void *arg) {
+  ldb_insertjob_t *job = arg;
+  job->status = ldb_batchpart_insert_concurrently(&job->part, job->mem);
+}
+
+/* Insert a batch, splitting it among the insert threads if it is
+   large. Sequence numbers follow from the position of each update,
+   so the runs may go in in any order. */
+/* REQUIRES: db->mutex is not held. */
+static int
+ldb_insert_batch(ldb_t *db, const ldb_batch_t *batch,
+                            ldb_memtable_t *mem,
+                            int concurrent) {
+  size_t size = ldb_batch_size(batch);
+  ldb_insertjob_t jobs[64];
+  ldb_batchpart_t parts[64];
+  int threads = db->options.max_insert_threads;
+  int i, n, rc;
+
+  if (db->insert_pool == NULL || size < 2 * LDB_MIN_INSERT_RUN) {
+    if (concurrent)
+      return ldb_batch_insert_concurrently(batch, mem);
+
+    return ldb_batch_insert_into(batch, mem);
+  }
+
+  if ((size_t)threads > size / LDB_MIN_INSERT_RUN)
+    threads = size / LDB_MIN_INSERT_RUN;
+
+  rc = ldb_batch_split(batch, parts, threads, &n);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  for (i = 0; i < n; i++) {
+    jobs[i].part = parts[i];
+    jobs[i].mem = mem;
+    jobs[i].status = LDB_OK;
+
+    if (i > 0)
+      ldb_pool_schedule(db->insert_pool, &ldb_insertjob_call, &jobs[i]);
+  }
+
+  if (n > 0)
+    ldb_insertjob_call(&jobs[0]);
+
+  ldb_pool_wait(db->insert_pool);
+
+  for (i = 0; i < n && rc == LDB_OK; i++)
+    rc = jobs[i].status;
+
+  return rc;
+}
+
+/* Insert a write group into the memtable. With concurrent memtable
+   writes, every writer in the group inserts its own batch while the
+   leader inserts the first one; otherwise the leader inserts them
+   all in turn. */
+/* REQUIRES: db->mutex is not held. */
+/* REQUIRES: first is the leader of the group ending at last_writer. */
+static int
+ldb_insert_group(ldb_t *db, ldb_waiter_t *first,
+                            ldb_waiter_t *last_writer,
+                            ldb_memtable_t *mem) {
+  ldb_waiter_t *w;
+  int rc;
+
+  if (!db->options.concurrent_memtable_write || first == last_writer) {
+    rc = LDB_OK;
+
+    for (w = first; w != NULL && rc == LDB_OK; w = w->next) {
+      rc = ldb_insert_batch(db, w->batch, mem, 0);
+
+      if (w == last_writer)
+        break;
+    }
+
+    return rc;
+  }
+
+  ldb_mutex_lock(&db->mutex);
+
+  for (w = first->next; w != NULL; w = w->next) {
+    w->mem = mem;
+    w->leader = first;
+    first->pending++;
+    ldb_cond_signal(&w->cv);
+
+    if (w == last_writer)
+      break;
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  rc = ldb_insert_batch(db, first->batch, mem, 1);
+
+  ldb_mutex_lock(&db->mutex);
+
+  while (first->pending > 0)
+    ldb_cond_wait(&first->cv, &db->mutex);
+
+  for (w = first->next; w != NULL && rc == LDB_OK; w = w->next) {
+    rc = w->status;
+
+    if (w == last_writer)
+      break;
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  return rc;
+}
+
+/* Insert our own batch on behalf of the group leader. */
+/* REQUIRES: db->mutex is held. */
+static void
+ldb_insert_member(ldb_t *db, ldb_waiter_t *w) {
+  ldb_memtable_t *mem = w->mem;
+  ldb_waiter_t *leader = w->leader;
+  int rc;
+
+  w->mem = NULL;
+  w->leader = NULL;
+
+  ldb_mutex_unlock(&db->mutex);
+
+  rc = ldb_batch_insert_concurrently(w->batch, mem);
+
+  ldb_mutex_lock(&db->mutex);
+
+  w->status = rc;
+
+  if (--leader->pending == 0)
+    ldb_cond_signal(&leader->cv);
+}
+
+/* Write a group to the log, then hand the writer queue to the next
+   group before inserting into the memtable. */
+/* REQUIRES: db->mutex is held. */
+/* REQUIRES: w is at the front of the writer queue. */
+static int
+ldb_pipelined_write(ldb_t *db, ldb_waiter_t *w,
+                               ldb_waiter_t *last_writer,
+                               size_t length,
+                               uint64_t last_sequence) {
+  ldb_memtable_t *mem;
+  ldb_queue_t group;
+  int rc;
+
+  ldb_mutex_unlock(&db->mutex);
+
+  if (!w->disable_wal)
+    rc = ldb_log_group(db, w, last_writer, length);
+  else
+    rc = LDB_OK;
+
+  if (rc == LDB_OK && w->sync) {
+    rc = ldb_sync_log(db);
+
+    ldb_mutex_lock(&db->mutex);
+
+    if (rc != LDB_OK) {
+      /* See ldb_write(). */
+      ldb_record_background_error(db, rc);
+    }
+  } else {
+    ldb_mutex_lock(&db->mutex);
+  }
+
+  /* Wait for the previous group to finish inserting. Groups enter
+     the memtable stage in the order they were logged. */
+  while (db->mem_stage_busy)
+    ldb_cond_wait(&db->mem_stage_cv, &db->mutex);
+
+  db->mem_stage_busy = 1;
+  db->mem_stage_sequence = last_sequence;
+
+  /* make_room_for_write() does not switch memtables while we are busy. */
+  mem = db->mem;
+
+  /* Detach our group and let the next one start logging. */
+  ldb_queue_init(&group);
+
+  for (;;) {
+    ldb_waiter_t *ready = ldb_queue_shift(&db->writers);
+
+    ldb_queue_push(&group, ready);
+
+    if (ready == last_writer)
+      break;
+  }
+
+  if (db->writers.length > 0)
+    ldb_cond_signal(&db->writers.head->cv);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  if (rc == LDB_OK)
+    rc = ldb_insert_group(db, w, last_writer, mem);
+
+  ldb_mutex_lock(&db->mutex);
+
+  assert(last_sequence >= db->versions->last_sequence);
+
+  db->versions->last_sequence = last_sequence;
+  db->mem_stage_busy = 0;
+
+  ldb_publish_sequence(db);
+
+  ldb_cond_broadcast(&db->mem_stage_cv);
+
+  while (group.length > 0) {
+    ldb_waiter_t *ready = ldb_queue_shift(&group);
+
+    if (ready != w) {
+      ready->status = rc;
+      ready->done = 1;
+      ldb_cond_signal(&ready->cv);
+    }
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+  ldb_waiter_clear(w);
+
+  return rc;
+}
+
+/* Optimistic transaction (see ldb_txn_create()). */
+struct ldb_txn_s {
+  ldb_t *db;
+  const ldb_snapshot_t *snapshot; /* Sequence the reads were made at. */
+  ldb_buffer_t reads;             /* Length-prefixed keys read. */
+};
+
+/* Fail with LDB_CONFLICT if any key read by "txn" has been written
+   since its snapshot. REQUIRES: db->mutex is held and the caller is at
+   the head of the write queue, so no other write can slip in between
+   validation and the caller's own write. */
+static int
+ldb_validate_txn(ldb_t *db, const ldb_txn_t *txn) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_seqnum_t snapshot = txn->snapshot->sequence;
+  ldb_readopt_t options = *ldb_readopt_default;
+  ldb_rangedel_t *tombstones = NULL;
+  ldb_seqnum_t ignored;
+  ldb_slice_t reads, key;
+  uint32_t ignored_seed;
+  ldb_iter_t *iter;
+  int rc = LDB_OK;
+
+  /* Pipelined groups ahead of us may still be inserting. */
+  while (db->mem_stage_busy)
+    ldb_cond_wait(&db->mem_stage_cv, &db->mutex);
+
+  if (db->versions->last_sequence == snapshot || txn->reads.size == 0)
+    return LDB_OK; /* Nothing can conflict. */
+
+  ldb_mutex_unlock(&db->mutex);
+
+  options.fill_cache = 0;
+
+  /* The newest entry for a key is the first one at or after
+     (key, LDB_MAX_SEQUENCE). The transaction's snapshot keeps
+     compactions from hiding sequence numbers newer than it. */
+  iter = ldb_internal_iterator(db, &options, &ignored,
+                                             &ignored_seed,
+                                             &tombstones);
+
+  reads = ldb_slice(txn->reads.data, txn->reads.size);
+
+  while (rc == LDB_OK && ldb_slice_slurp(&key, &reads)) {
+    ldb_lkey_t lkey;
+    ldb_slice_t ikey;
+
+    ldb_lkey_init(&lkey, &key, LDB_MAX_SEQUENCE);
+
+    ikey = ldb_lkey_internal_key(&lkey);
+
+    ldb_iter_seek(iter, &ikey);
+
+    if (ldb_iter_valid(iter)) {
+      ldb_slice_t k = ldb_iter_key(iter);
+      ldb_pkey_t pkey;
+
+      if (!ldb_pkey_import(&pkey, &k))
+        rc = LDB_CORRUPTION;
+      else if (pkey.sequence > snapshot
+               && ldb_compare(ucmp, &pkey.user_key, &key) == 0)
+        rc = LDB_CONFLICT;
+    } else {
+      rc = ldb_iter_status(iter);
+    }
+
+    if (rc == LDB_OK && tombstones != NULL) {
+      if (ldb_rangedel_covering(tombstones, &key, LDB_MAX_SEQUENCE) > snapshot)
+        rc = LDB_CONFLICT;
+    }
+
+    ldb_lkey_clear(&lkey);
+  }
+
+  ldb_iter_destroy(iter);
+
+  if (tombstones != NULL)
+    ldb_rangedel_destroy(tombstones);
+
+  ldb_mutex_lock(&db->mutex);
+
+  return rc;
+}
+
+static int
+ldb_write_internal(ldb_t *db, ldb_batch_t *updates,
+                              const ldb_txn_t *txn,
+                              const ldb_writeopt_t *options) {
+  ldb_waiter_t *last_writer;
+  uint64_t last_sequence;
+  ldb_waiter_t w;
+  int rc;
+
+  if (options == NULL)
+    options = ldb_writeopt_default;
+
+  if (options->sync && options->disable_wal)
+    return LDB_INVALID; /* "sync writes cannot skip the log" */
+
+  if (db->read_only)
+    return LDB_NOSUPPORT;
+
+  ldb_waiter_init(&w);
+
+  w.batch = updates;
+  w.txn = txn;
+  w.sync = options->sync && !db->options.in_memory;
+  w.disable_wal = options->disable_wal || db->options.in_memory;
+  w.done = 0;
+
+  ldb_mutex_lock(&db->mutex);
+
+  ldb_queue_push(&db->writers, &w);
+
+  while (!w.done && &w != db->writers.head) {
+    if (w.mem != NULL)
+      ldb_insert_member(db, &w);
+    else
+      ldb_cond_wait(&w.cv, &db->mutex);
+  }
+
+  if (w.done) {
+    ldb_mutex_unlock(&db->mutex);
+    ldb_waiter_clear(&w);
+    return w.status;
+  }
+
+  /* Give other sync writes a chance to join our group. */
+  if (w.sync && db->options.write_group_delay > 0) {
+    ldb_mutex_unlock(&db->mutex);
+    ldb_sleep_usec(db->options.write_group_delay);
+    ldb_mutex_lock(&db->mutex);
+  }
+
+  rc = LDB_OK;
+
+  if (txn != NULL)
+    rc = ldb_validate_txn(db, txn);
+
+  /* May temporarily unlock and wait. */
+  if (rc == LDB_OK) {
+    rc = ldb_make_room_for_write(db, updates == NULL,
+                                 updates != NULL ? ldb_batch_size(updates)
+                                                 : 0);
+  }
+  last_sequence = db->versions->last_sequence;
+  last_writer = &w;
+
+  if (db->mem_stage_busy)
+    last_sequence = db->mem_stage_sequence;
+
+  if (rc == LDB_OK && updates != NULL) { /* NULL batch is for compactions. */
+    size_t length = ldb_build_batch_group(db, &last_writer,
+                                                last_sequence + 1);
+    uint64_t count = 0;
+    size_t size = 0;
+    ldb_waiter_t *x;
+
+    for (x = &w; x != NULL; x = x->next) {
+      count += ldb_batch_count(x->batch);
+      size += ldb_batch_size(x->batch);
+
+      if (x == last_writer)
+        break;
+    }
+
+    last_sequence += count;
+
+    if (w.disable_wal)
+      db->mem_unlogged = 1;
+
+    if (db->options.statistics != NULL) {
+      ldb_statistics_t *stats = db->options.statistics;
+
+      ldb_statistics_add(stats, LDB_KEYS_WRITTEN, count);
+      ldb_statistics_add(stats, LDB_BYTES_WRITTEN, size);
+
+      if (!w.disable_wal)
+        ldb_statistics_add(stats, LDB_WAL_BYTES, size);
+    }
+
+    /* Add to log and apply to memtable. We can release the lock
+       during this phase since &w is currently responsible for logging
+       and protects against concurrent loggers and concurrent writes
+       into db->mem. */
+    if (db->options.pipelined_write) {
+      return ldb_pipelined_write(db, &w, last_writer,
+                                    length,
+                                    last_sequence);
+    }
+
+    {
+      int sync_error = 0;
+
+      ldb_mutex_unlock(&db->mutex);
+
+      if (!w.disable_wal)
+        rc = ldb_log_group(db, &w, last_writer, length);
+
+      if (rc == LDB_OK && w.sync) {
+        rc = ldb_sync_log(db);
+
+        if (rc != LDB_OK)
+          sync_error = 1;
+      }
+
+      if (rc == LDB_OK)
+        rc = ldb_insert_group(db, &w, last_writer, db->mem);
+
+      ldb_mutex_lock(&db->mutex);
+
+      if (sync_error) {
+        /* The state of the log file is indeterminate: the log record we
+           just added may or may not show up when the DB is re-opened.
+           So we force the DB into a mode where all future writes fail. */
+        ldb_record_background_error(db, rc);
+      }
+    }
+
+    assert(last_sequence >= db->versions->last_sequence);
+
+    db->versions->last_sequence = last_sequence;
+
+    ldb_publish_sequence(db);
+  }
+
+  for (;;) {
+    ldb_waiter_t *ready = ldb_queue_shift(&db->writers);
+
+    if (ready != &w) {
+      ready->status = rc;
+      ready->done = 1;
+      ldb_cond_signal(&ready->cv);
+    }
+
+    if (ready == last_writer)
+      break;
+  }
+
+  /* Notify new head of write queue. */
+  if (db->writers.length > 0)
+    ldb_cond_signal(&db->writers.head->cv);
+
+  ldb_mutex_unlock(&db->mutex);
+  ldb_waiter_clear(&w);
+
+  return rc;
+}
+
+static void
+trace_put(ldb_handler_t *h, const ldb_slice_t *key, const ldb_slice_t *value) {
+  ldb_tracer_record(h->state, LDB_TRACE_PUT, key, value->size);
+}
+
+static void
+trace_del(ldb_handler_t *h, const ldb_slice_t *key) {
+  ldb_tracer_record(h->state, LDB_TRACE_DEL, key, 0);
+}
+
+static void
+trace_merge(ldb_handler_t *h, const ldb_slice_t *key,
+                              const ldb_slice_t *value) {
+  ldb_tracer_record(h->state, LDB_TRACE_MERGE, key, value->size);
+}
+
+/* Record each operation in a batch. */
+static void
+ldb_trace_batch(ldb_t *db, const ldb_batch_t *updates) {
+  ldb_handler_t handler;
+
+  handler.state = db->tracer;
+  handler.number = 0;
+  handler.put = trace_put;
+  handler.del = trace_del;
+  handler.merge = trace_merge;
+  handler.del_range = NULL;
+
+  ldb_batch_iterate(updates, &handler);
+}
+
+static void
+plain_check(ldb_handler_t *h, const ldb_slice_t *key) {
+  const ldb_t *db = h->state;
+
+  if (key->size != db->options.plain_key_size)
+    h->number++;
+}
+
+static void
+plain_put(ldb_handler_t *h, const ldb_slice_t *key, const ldb_slice_t *value) {
+  (void)value;
+  plain_check(h, key);
+}
+
+static void
+plain_range(ldb_handler_t *h, const ldb_slice_t *start,
+                              const ldb_slice_t *end) {
+  /* Range tombstones are kept apart from the entries. */
+  (void)h;
+  (void)start;
+  (void)end;
+}
+
+/* Check that every key in a batch fits plain tables. */
+static int
+ldb_plain_batch(ldb_t *db, const ldb_batch_t *updates) {
+  ldb_handler_t handler;
+  int rc;
+
+  handler.state = db;
+  handler.number = 0;
+  handler.put = plain_put;
+  handler.del = plain_check;
+  handler.merge = plain_put;
+  handler.del_range = plain_range;
+
+  rc = ldb_batch_iterate(updates, &handler);
+
+  if (rc == LDB_OK && handler.number > 0)
+    rc = LDB_INVALID; /* "key size does not match plain_key_size" */
+
+  return rc;
+}
+
+static int
+ldb_write_batch(ldb_t *db, ldb_batch_t *updates,
+                           const ldb_txn_t *txn,
+                           const ldb_writeopt_t *options) {
+  int64_t start;
+  int rc;
+
+  if (updates != NULL && db->options.plain_key_size > 0
+                      && !db->options.cuckoo_table) {
+    rc = ldb_plain_batch(db, updates);
+
+    if (rc != LDB_OK)
+      return rc;
+  }
+
+  if (updates != NULL && ldb_tracer_active(db->tracer))
+    ldb_trace_batch(db, updates);
+
+  if (db->latency == NULL)
+    return ldb_write_internal(db, updates, txn, options);
+
+  start = ldb_now_usec();
+
+  rc = ldb_write_internal(db, updates, txn, options);
+
+  ldb_latency_add(db->latency, LDB_LATENCY_WRITE, ldb_now_usec() - start);
+
+  return rc;
+}
+
+int
+ldb_write(ldb_t *db, ldb_batch_t *updates, const ldb_writeopt_t *options) {
+  return ldb_write_batch(db, updates, NULL, options);
+}
+
+int
+ldb_flush_wal(ldb_t *db, int sync) {
+  ldb_waiter_t w;
+  int rc;
+
+  if (db->read_only)
+    return LDB_NOSUPPORT;
+
+  ldb_waiter_init(&w);
+
+  ldb_mutex_lock(&db->mutex);
+
+  /* The head of the write queue owns the log. */
+  ldb_queue_push(&db->writers, &w);
+
+  while (&w != db->writers.head)
+    ldb_cond_wait(&w.cv, &db->mutex);
+
+  rc = db->bg_error;
+
+  if (rc == LDB_OK) {
+    ldb_mutex_unlock(&db->mutex);
+
+    rc = ldb_writer_flush(db->log);
+
+    if (rc == LDB_OK && sync)
+      rc = ldb_sync_log(db);
+
+    ldb_mutex_lock(&db->mutex);
+
+    if (rc != LDB_OK) {
+      /* See ldb_write(). */
+      ldb_record_background_error(db, rc);
+    }
+  }
+
+  ldb_queue_shift(&db->writers);
+
+  if (db->writers.length > 0)
+    ldb_cond_signal(&db->writers.head->cv);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  ldb_waiter_clear(&w);
+
+  return rc;
+}
+
+int
+ldb_flush(ldb_t *db, int wait, int allow_stall) {
+  int stop = db->options.level0_stop_writes_trigger;
+  int rc = LDB_OK;
+
+  if (db->read_only)
+    return LDB_NOSUPPORT;
+
+  if (db->options.compaction_style == LDB_COMPACTION_FIFO)
+    stop = 1 << 30;
+
+  if (!allow_stall) {
+    /* Switching memtables while the previous one is still being
+       flushed (or while level-0 is full) would hold up the writes
+       queued behind us until it is done. Wait outside of the write
+       queue instead. */
+    ldb_mutex_lock(&db->mutex);
+
+    while (db->bg_error == LDB_OK && (db->imm != NULL ||
+           ldb_versions_files(db->versions, 0) >= stop)) {
+      ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+    }
+
+    rc = db->bg_error;
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  /* NULL batch means just wait for earlier writes to be done. */
+  if (rc == LDB_OK)
+    rc = ldb_write_internal(db, NULL, NULL, ldb_writeopt_default);
+
+  if (rc == LDB_OK && wait) {
+    /* Wait until the compaction completes. */
+    ldb_mutex_lock(&db->mutex);
+
+    while (db->imm != NULL && db->bg_error == LDB_OK)
+      ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+
+    if (db->imm != NULL)
+      rc = db->bg_error;
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  return rc;
+}
+
+const ldb_snapshot_t *
+ldb_snapshot(ldb_t *db) {
+  ldb_snapshot_t *snap;
+  ldb_seqnum_t seq;
+
+  snap = ldb_malloc(sizeof(ldb_snapshot_t));
+
+  /* Only the link itself is done under the mutex: the sequence
+     number must be read in step with writers and compactions. */
+  ldb_mutex_lock(&db->mutex);
+
+  seq = db->versions->last_sequence;
+
+  ldb_snaplist_insert(&db->snapshots, snap, seq);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  return snap;
+}
+
+void
+ldb_release(ldb_t *db, const ldb_snapshot_t *snapshot) {
+  ldb_mutex_lock(&db->mutex);
+
+  ldb_snaplist_remove(&db->snapshots, snapshot);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  ldb_free((void *)snapshot);
+}
+
+ldb_iter_t *
+ldb_iterator(ldb_t *db, const ldb_readopt_t *options) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  const ldb_prefix_t *prefix = NULL;
+  ldb_rangedel_t *tombstones = NULL;
+  ldb_seqnum_t latest_snapshot;
+  ldb_iter_t *iter;
+  uint32_t seed;
+
+  if (options == NULL)
+    options = ldb_iteropt_default;
+
+  if (options->prefix_seek && db->options.prefix_extractor != NULL)
+    prefix = &db->user_prefix;
+
+  iter = ldb_internal_iterator(db, options, &latest_snapshot, &seed,
+                                           &tombstones);
+
+  return ldb_dbiter_create(db, ucmp, iter, tombstones, prefix, options,
+                           db->options.merge_operator,
+                           db->options.iter_deletion_trigger,
+                           db->options.tombstone_sample_weight,
+                           (options->snapshot != NULL
+                              ? options->snapshot->sequence
+                              : latest_snapshot),
+                           seed);
+}
+
+int
+ldb_refresh_internal(ldb_t *db, ldb_iter_t *internal,
+                                int force,
+                                ldb_seqnum_t *sequence,
+                                ldb_rangedel_t **tombstones,
+                                int *updated) {
+  ldb_istate_t *state;
+  ldb_istate_t old;
+  ldb_vector_t list;
+  int rc;
+
+  *updated = 0;
+
+  /* Not an internal iterator of ours, or one which failed to open. */
+  if (internal->cleanup_head.func != cleanup_iter_state)
+    return LDB_INVALID;
+
+  state = internal->cleanup_head.arg1;
+
+  /* Iterators reading a snapshot stay with it. */
+  if (state->options.snapshot != NULL)
+    return LDB_INVALID;
+
+  ldb_vector_init(&list);
+
+  ldb_mutex_lock(&db->mutex);
+
+  if (!force && db->versions->last_sequence == *sequence) {
+    ldb_mutex_unlock(&db->mutex);
+    return LDB_OK;
+  }
+
+  *sequence = db->versions->last_sequence;
+
+  /* Skiplist memtables are read as they are written to: only
+     a new memtable or version needs new children. */
+  if (force || db->mem != state->mem
+            || db->imm != state->imm
+            || db->versions->current != state->version
+            || !ldb_memiter_sees_writes(db->mem)) {
+    ldb_istate_collect(db, state, &old, &list);
+  } else {
+    old.mem = NULL;
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  if (old.mem != NULL) {
+    /* Children which were not kept go away before the old version. */
+    ldb_mergeiter_reset(internal, (ldb_iter_t **)list.items, list.length);
+
+    ldb_mutex_lock(&db->mutex);
+
+    ldb_memtable_unref(old.mem);
+
+    if (old.imm != NULL)
+      ldb_memtable_unref(old.imm);
+
+    ldb_version_unref(old.version);
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  ldb_vector_clear(&list);
+
+  *tombstones = NULL;
+  *updated = 1;
+
+  rc = ldb_read_visible_tombstones(db, state->mem, state->imm,
+                                       state->version, tombstones);
+
+  if (rc != LDB_OK) {
+    ldb_iter_t *empty = ldb_emptyiter_create(rc);
+
+    ldb_mergeiter_reset(internal, &empty, 1);
+
+    state->mem_iter = NULL;
+    state->imm_iter = NULL;
+
+    ldb_array_reset(&state->numbers);
+    ldb_vector_reset(&state->tables);
+  }
+
+  return rc;
+}
+
+int
+ldb_iter_refresh(ldb_iter_t *iter) {
+  ldb_rangedel_t *tombstones;
+  ldb_seqnum_t sequence = 0;
+  ldb_iter_t *internal;
+  int updated, rc;
+  ldb_t *db;
+
+  internal = ldb_dbiter_internal(iter, &db);
+
+  if (internal == NULL)
+    return LDB_INVALID;
+
+  rc = ldb_refresh_internal(db, internal, 1, &sequence, &tombstones,
+                                                         &updated);
+
+  if (updated)
+    ldb_dbiter_rebind(iter, tombstones, sequence);
+
+  return rc;
+}
+
+int
+ldb_property(ldb_t *db, const char *property, char **value) {
+  const char *in = property;
+
+  *value = NULL;
+
+  if (!ldb_starts_with(in, "leveldb."))
+    return 0;
+
+  in += 8;
+
+  ldb_mutex_lock(&db->mutex);
+
+  if (ldb_starts_with(in, "num-files-at-level")) {
+    uint64_t level;
+    int ok;
+
+    in += 18;
+
+    ok = ldb_decode_int(&level, &in) && *in == 0;
+
+    if (!ok || level >= (uint64_t)db->options.num_levels) {
+      ldb_mutex_unlock(&db->mutex);
+      return 0;
+    }
+
+    *value = ldb_malloc(21);
+
+    ldb_encode_int(*value, ldb_versions_files(db->versions, level), 0);
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "estimate-pending-compaction-bytes") == 0) {
+    *value = ldb_malloc(21);
+
+    ldb_encode_int(*value, ldb_versions_pending_bytes(db->versions), 0);
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "stats") == 0) {
+    ldb_buffer_t val;
+    char buf[200];
+    int level;
+
+    ldb_buffer_init(&val);
+
+    sprintf(buf, "                               Compactions\n"
+                 "Level  Files Size(MB) Time(sec) Read(MB) Write(MB)\n"
+                 "--------------------------------------------------\n");
+
+    ldb_buffer_string(&val, buf);
+
+    for (level = 0; level < db->options.num_levels; level++) {
+      int files = ldb_versions_files(db->versions, level);
+      ldb_stats_t *stats = &db->stats[level];
+
+      if (stats->micros > 0 || files > 0) {
+        int64_t bytes = ldb_versions_bytes(db->versions, level);
+
+        sprintf(buf, "%3d %8d %8.0f %9.0f %8.0f %9.0f\n",
+                     level, files, bytes / 1048576.0,
+                     stats->micros / 1e6,
+                     stats->bytes_read / 1048576.0,
+                     stats->bytes_written / 1048576.0);
+
+        ldb_buffer_string(&val, buf);
+      }
+    }
+
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "compaction-progress") == 0) {
+    int64_t now = ldb_now_usec();
+    ldb_buffer_t val;
+    char buf[200];
+    size_t i;
+
+    ldb_buffer_init(&val);
+
+    sprintf(buf, "Level  Files Input(MB) Done(MB) Outputs Output(MB)"
+                 " Time(sec) Left(sec)\n"
+                 "-----------------------------------------------"
+                 "---------------------\n");
+
+    ldb_buffer_string(&val, buf);
+
+    for (i = 0; i < db->compactions.length; i++) {
+      const ldb_progress_t *p = db->compactions.items[i];
+      double elapsed = (now - p->start_micros) / 1e6;
+      uint64_t done = LDB_MIN(p->processed_bytes, p->input_bytes);
+      double left = -1;
+
+      /* Assume the rest goes at the same rate. */
+      if (done > 0)
+        left = elapsed * (p->input_bytes - done) / done;
+
+      sprintf(buf, "%2d->%-2d %5d %9.1f %8.1f %7d %10.1f %9.1f ",
+                   p->compaction->level,
+                   p->compaction->output_level,
+                   p->input_files,
+                   p->input_bytes / 1048576.0,
+                   done / 1048576.0,
+                   p->output_files,
+                   p->output_bytes / 1048576.0,
+                   elapsed);
+
+      ldb_buffer_string(&val, buf);
+
+      if (left >= 0)
+        sprintf(buf, "%9.1f\n", left);
+      else
+        sprintf(buf, "%9s\n", "-");
+
+      ldb_buffer_string(&val, buf);
+    }
+
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "stats-json") == 0) {
+    ldb_lru_t *lru = db->options.block_cache;
+    int64_t written = 0;
+    ldb_lrustats_t stats;
+    size_t usage = 0;
+    size_t capacity = 0;
+    ldb_buffer_t val;
+    char buf[300];
+    int level, i;
+
+    ldb_buffer_init(&val);
+    ldb_buffer_string(&val, "{\"levels\":[");
+
+    for (level = 0; level < db->options.num_levels; level++) {
+      ldb_stats_t *st = &db->stats[level];
+
+      sprintf(buf, "%s{\"level\":%d,\"files\":%d,\"bytes\":%.0f,"
+                   "\"compaction_micros\":%.0f,"
+                   "\"read_bytes\":%.0f,\"write_bytes\":%.0f}",
+                   level > 0 ? "," : "",
+                   level,
+                   ldb_versions_files(db->versions, level),
+                   (double)ldb_versions_bytes(db->versions, level),
+                   (double)st->micros,
+                   (double)st->bytes_read,
+                   (double)st->bytes_written);
+
+      ldb_buffer_string(&val, buf);
+
+      written += st->bytes_written;
+    }
+
+    for (i = 0; i < ldb_lru_shards(lru); i++) {
+      ldb_lru_stats(lru, i, &stats);
+
+      usage += stats.usage;
+      capacity += stats.capacity;
+    }
+
+    sprintf(buf, "],\"flush_bytes\":%.0f,"
+                 "\"write_amplification\":%.2f,"
+                 "\"pending_compaction_bytes\":%.0f,"
+                 "\"memtable_bytes\":%.0f,"
+                 "\"immutable_memtable_bytes\":%.0f,"
+                 "\"block_cache_usage\":%.0f,"
+                 "\"block_cache_capacity\":%.0f}",
+                 (double)db->flush_bytes,
+                 db->flush_bytes > 0 ? (double)written / db->flush_bytes : 0.0,
+                 (double)ldb_versions_pending_bytes(db->versions),
+                 db->mem != NULL ? (double)ldb_memtable_usage(db->mem) : 0.0,
+                 db->imm != NULL ? (double)ldb_memtable_usage(db->imm) : 0.0,
+                 (double)usage,
+                 (double)capacity);
+
+    ldb_buffer_string(&val, buf);
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "sstables") == 0) {
+    ldb_buffer_t val;
+
+    ldb_buffer_init(&val);
+    ldb_version_debug(&val, db->versions->current);
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "table-properties") == 0) {
+    ldb_version_t *current = db->versions->current;
+    ldb_tableprops_t props;
+    ldb_buffer_t val;
+    char buf[400];
+    int level;
+    size_t i;
+
+    ldb_version_ref(current);
+    ldb_mutex_unlock(&db->mutex);
+
+    ldb_buffer_init(&val);
+
+    for (level = 0; level < db->options.num_levels; level++) {
+      const ldb_vector_t *files = &current->files[level];
+
+      sprintf(buf, "--- level %d ---\n", level);
+
+      ldb_buffer_string(&val, buf);
+
+      for (i = 0; i < files->length; i++) {
+        ldb_filemeta_t *f = files->items[i];
+
+        if (ldb_tables_properties(db->table_cache, f, level, &props)) {
+          sprintf(buf, " %lu: none\n", (unsigned long)f->number);
+          ldb_buffer_string(&val, buf);
+          continue;
+        }
+
+        sprintf(buf, " %lu: entries=%.0f deletions=%.0f tombstones=%.0f"
+                     " raw_key_size=%.0f raw_value_size=%.0f"
+                     " data_blocks=%.0f compression=%d"
+                     " sequences=%.0f..%.0f created=%.0f\n",
+                     (unsigned long)f->number,
+                     (double)props.entries,
+                     (double)props.deletions,
+                     (double)props.tombstones,
+                     (double)props.raw_key_size,
+                     (double)props.raw_value_size,
+                     (double)props.data_blocks,
+                     (int)props.compression,
+                     (double)props.smallest_sequence,
+                     (double)props.largest_sequence,
+                     (double)props.creation_time);
+
+        ldb_buffer_string(&val, buf);
+      }
+    }
+
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_lock(&db->mutex);
+    ldb_version_unref(current);
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "block-cache-stats") == 0) {
+    ldb_lru_t *lru = db->options.block_cache;
+    ldb_lrustats_t total, stats;
+    ldb_buffer_t val;
+    char buf[200];
+    int i;
+
+    memset(&total, 0, sizeof(total));
+
+    ldb_buffer_init(&val);
+
+    sprintf(buf, "Shard Usage(KB)     Hits   Misses  Inserts  Evicted\n"
+                 "---------------------------------------------------\n");
+
+    ldb_buffer_string(&val, buf);
+
+    for (i = 0; i < ldb_lru_shards(lru); i++) {
+      ldb_lru_stats(lru, i, &stats);
+
+      sprintf(buf, "%5d %9.0f %8.0f %8.0f %8.0f %8.0f\n",
+                   i, stats.usage / 1024.0,
+                   (double)stats.hits,
+                   (double)stats.misses,
+                   (double)stats.inserts,
+                   (double)stats.evictions);
+
+      ldb_buffer_string(&val, buf);
+
+      total.usage += stats.usage;
+      total.hits += stats.hits;
+      total.misses += stats.misses;
+      total.inserts += stats.inserts;
+      total.evictions += stats.evictions;
+    }
+
+    sprintf(buf, "Total %9.0f %8.0f %8.0f %8.0f %8.0f\n",
+                 total.usage / 1024.0,
+                 (double)total.hits,
+                 (double)total.misses,
+                 (double)total.inserts,
+                 (double)total.evictions);
+
+    ldb_buffer_string(&val, buf);
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "manifest-stats") == 0) {
+    ldb_versions_t *vset = db->versions;
+    ldb_buffer_t val;
+    char buf[200];
+
+    ldb_buffer_init(&val);
+
+    sprintf(buf, "MANIFEST-%06lu\n"
+                 "Size(KB): %.0f\n"
+                 "Replayed: %lu records in %.3f sec\n",
+                 (unsigned long)vset->manifest_file_number,
+                 vset->manifest_size / 1024.0,
+                 (unsigned long)vset->recover_records,
+                 vset->recover_micros / 1e6);
+
+    ldb_buffer_string(&val, buf);
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "table-readers") == 0) {
+    int mapped, total;
+    ldb_buffer_t val;
+    char buf[100];
+
+    ldb_tables_readers(db->table_cache, &mapped, &total);
+
+    ldb_buffer_init(&val);
+
+    sprintf(buf, "Mapped: %d\n"
+                 "Pread: %d\n", mapped, total - mapped);
+
+    ldb_buffer_string(&val, buf);
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "statistics") == 0 && db->options.statistics != NULL) {
+    *value = ldb_statistics_string(db->options.statistics, 0);
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "latency-stats") == 0 && db->latency != NULL) {
+    ldb_buffer_t val;
+
+    ldb_buffer_init(&val);
+    ldb_latency_export(&val, db->latency);
+    ldb_buffer_push(&val, 0);
+
+    *value = (char *)val.data;
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  if (strcmp(in, "approximate-memory-usage") == 0) {
+    size_t total_usage = ldb_lru_usage(db->options.block_cache);
+
+    if (db->mem != NULL)
+      total_usage += ldb_memtable_usage(db->mem);
+
+    if (db->imm != NULL)
+      total_usage += ldb_memtable_usage(db->imm);
+
+    *value = ldb_malloc(21);
+
+    ldb_encode_int(*value, total_usage, 0);
+
+    ldb_mutex_unlock(&db->mutex);
+
+    return 1;
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  return 0;
+}
+
+int
+ldb_start_trace(ldb_t *db, const char *filename) {
+  return ldb_tracer_start(db->tracer, filename);
+}
+
+int
+ldb_end_trace(ldb_t *db) {
+  return ldb_tracer_stop(db->tracer);
+}
+
+void
+ldb_reset_stats(ldb_t *db) {
+  if (db->latency != NULL)
+    ldb_latency_reset(db->latency);
+}
+
+void
+ldb_set_options(ldb_t *db, const ldb_dbopt_t *options) {
+  ldb_dbopt_t *result = &db->options;
+
+  ldb_mutex_lock(&db->mutex);
+
+  result->write_buffer_size = options->write_buffer_size;
+  result->block_size = options->block_size;
+  result->block_restart_interval = options->block_restart_interval;
+  result->max_file_size = options->max_file_size;
+  result->compression = options->compression;
+  result->level0_file_num_compaction_trigger =
+    options->level0_file_num_compaction_trigger;
+  result->level0_slowdown_writes_trigger =
+    options->level0_slowdown_writes_trigger;
+  result->level0_stop_writes_trigger = options->level0_stop_writes_trigger;
+  result->delayed_write_rate = options->delayed_write_rate;
+  result->max_bytes_for_level_base = options->max_bytes_for_level_base;
+  result->max_bytes_for_level_multiplier =
+    options->max_bytes_for_level_multiplier;
+  result->max_file_size_multiplier = options->max_file_size_multiplier;
+  result->periodic_compaction_seconds = options->periodic_compaction_seconds;
+  result->deletion_compaction_ratio = options->deletion_compaction_ratio;
+
+  sanitize_mutable(result);
+
+  /* The new triggers and level sizes may call for a compaction, or
+     release writers stalled on the old ones. */
+  ldb_versions_refresh(db->versions);
+  ldb_maybe_schedule_compaction(db);
+  ldb_cond_broadcast(&db->background_work_finished_signal);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
+void
+ldb_approximate_sizes(ldb_t *db, const ldb_range_t *range,
+                                 size_t length,
+                                 uint64_t *sizes) {
+  ldb_approximate_sizes_ex(db, range, length, LDB_SIZE_TABLES, sizes);
+}
+
+void
+ldb_approximate_sizes_ex(ldb_t *db, const ldb_range_t *range,
+                                    size_t length,
+                                    int flags,
+                                    uint64_t *sizes) {
+  ldb_memtable_t *mem, *imm;
+  uint64_t start, limit;
+  ldb_ikey_t k1, k2;
+  ldb_version_t *v;
+  size_t i;
+
+  ldb_mutex_lock(&db->mutex);
+
+  v = db->versions->current;
+  mem = db->mem;
+  imm = db->imm;
+
+  ldb_version_ref(v);
+  ldb_memtable_ref(mem);
+
+  if (imm != NULL)
+    ldb_memtable_ref(imm);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  /* The version and memtables are pinned by our references, and
+     tables are opened through the (thread-safe) table cache, so the
+     mutex need not be held while computing sizes. */
+  ldb_ikey_init(&k1);
+  ldb_ikey_init(&k2);
+
+  for (i = 0; i < length; i++) {
+    sizes[i] = 0;
+
+    /* Convert user_key into a corresponding internal key. */
+    ldb_ikey_set(&k1, &range[i].start, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+    ldb_ikey_set(&k2, &range[i].limit, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+
+    if (flags & LDB_SIZE_FILES_ONLY) {
+      sizes[i] += ldb_versions_approximate_size(db->versions, v, &k1, &k2);
+    } else if (flags & LDB_SIZE_TABLES) {
+      start = ldb_versions_approximate_offset(db->versions, v, &k1);
+      limit = ldb_versions_approximate_offset(db->versions, v, &k2);
+
+      sizes[i] += (limit >= start ? limit - start : 0);
+    }
+
+    if (flags & LDB_SIZE_MEMTABLES) {
+      sizes[i] += ldb_memtable_approximate_size(mem, &range[i].start,
+                                                     &range[i].limit);
+
+      if (imm != NULL) {
+        sizes[i] += ldb_memtable_approximate_size(imm, &range[i].start,
+                                                       &range[i].limit);
+      }
+    }
+  }
+
+  ldb_ikey_clear(&k1);
+  ldb_ikey_clear(&k2);
+
+  ldb_mutex_lock(&db->mutex);
+
+  ldb_memtable_unref(mem);
+
+  if (imm != NULL)
+    ldb_memtable_unref(imm);
+
+  ldb_version_unref(v);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
+void
+ldb_memory_usage(ldb_t *db, ldb_memusage_t *usage) {
+  ldb_lru_t *lru = db->options.block_cache;
+  ldb_waiter_t *w;
+
+  ldb_mutex_lock(&db->mutex);
+
+  usage->memtables = 0;
+
+  if (db->mem != NULL)
+    usage->memtables += ldb_memtable_usage(db->mem);
+
+  if (db->imm != NULL)
+    usage->memtables += ldb_memtable_usage(db->imm);
+
+  /* Queued batches are not changed until their writers are done. The
+     group batch of the leader only copies them. */
+  usage->write_batches = 0;
+
+  for (w = db->writers.head; w != NULL; w = w->next) {
+    if (w->batch != NULL)
+      usage->write_batches += ldb_batch_approximate_size(w->batch);
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  usage->block_cache = ldb_lru_usage(lru);
+  usage->pinned_blocks = ldb_lru_pinned_usage(lru);
+  usage->table_readers = ldb_tables_memory(db->table_cache);
+
+  /* Pinned blocks are part of the block cache. */
+  usage->total = usage->memtables
+               + usage->block_cache
+               + usage->table_readers
+               + usage->write_batches;
+}
+
+int
+ldb_split_keys(ldb_t *db, size_t n, ldb_slice_t **keys, size_t *length) {
+  ldb_slice_t *out;
+  ldb_vector_t result;
+  ldb_version_t *v;
+  size_t i, size;
+  uint8_t *zp;
+  int rc;
+
+  *keys = NULL;
+  *length = 0;
+
+  if (n == 0)
+    return LDB_INVALID;
+
+  ldb_vector_init(&result);
+
+  ldb_mutex_lock(&db->mutex);
+
+  v = db->versions->current;
+
+  ldb_version_ref(v);
+
+  ldb_mutex_unlock(&db->mutex);
+
+  rc = ldb_versions_split_keys(db->versions, v, n, &result);
+
+  ldb_mutex_lock(&db->mutex);
+  ldb_version_unref(v);
+  ldb_mutex_unlock(&db->mutex);
+
+  if (rc == LDB_OK && result.length > 0) {
+    /* Hand the keys back in one allocation. */
+    size = result.length * sizeof(ldb_slice_t);
+
+    for (i = 0; i < result.length; i++) {
+      const ldb_buffer_t *key = result.items[i];
+
+      size += key->size;
+    }
+
+    out = ldb_malloc(size);
+    zp = (uint8_t *)(out + result.length);
+
+    for (i = 0; i < result.length; i++) {
+      const ldb_buffer_t *key = result.items[i];
+
+      if (key->size > 0)
+        memcpy(zp, key->data, key->size);
+
+      out[i] = ldb_slice(zp, key->size);
+
+      zp += key->size;
+    }
+
+    *keys = out;
+    *length = result.length;
+  }
+
+  for (i = 0; i < result.length; i++) {
+    ldb_buffer_clear(result.items[i]);
+    ldb_free(result.items[i]);
+  }
+
+  ldb_vector_clear(&result);
+
+  return rc;
+}
+
+/* The scan of one range by ldb_parallel_scan(). */
+typedef struct ldb_scanjob_s {
+  ldb_t *db;
+  ldb_readopt_t options;
+  ldb_scan_f *func;
+  void *arg;
+  ldb_atomic(int) *stop;
+  int status;
+} ldb_scanjob_t;
+
+static void
+ldb_scanjob_call(void *arg) {
+  ldb_scanjob_t *job = (ldb_scanjob_t *)arg;
+  ldb_iter_t *iter;
+  int rc = LDB_OK;
+
+  if (ldb_atomic_load(job->stop, ldb_order_relaxed))
+    return;
+
+  iter = ldb_iterator(job->db, &job->options);
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t value = ldb_iter_value(iter);
+
+    rc = job->func(job->arg, &key, &value);
+
+    if (rc != LDB_OK)
+      break;
+
+    if (ldb_atomic_load(job->stop, ldb_order_relaxed))
+      break;
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_iter_status(iter);
+
+  ldb_iter_destroy(iter);
+
+  if (rc != LDB_OK)
+    ldb_atomic_store(job->stop, 1, ldb_order_relaxed);
+
+  job->status = rc;
+}
+
+int
+ldb_parallel_scan(ldb_t *db, const ldb_readopt_t *options,
+                             int threads,
+                             ldb_scan_f *func,
+                             void *arg) {
+  const ldb_snapshot_t *snapshot = NULL;
+  ldb_atomic(int) stop;
+  ldb_scanjob_t *jobs;
+  ldb_readopt_t opt;
+  ldb_slice_t *keys;
+  size_t i, length;
+  ldb_pool_t *pool;
+  int rc;
+
+  if (options == NULL) {
+    opt = *ldb_readopt_default;
+    opt.fill_cache = 0;
+  } else {
+    opt = *options;
+  }
+
+  if (threads < 1)
+    threads = 1;
+
+  /* Cut a few ranges per thread, so that those which finish early
+     have more to take on. */
+  rc = ldb_split_keys(db, threads > 1 ? threads * 4 : 1, &keys, &length);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  if (opt.snapshot == NULL) {
+    snapshot = ldb_snapshot(db);
+    opt.snapshot = snapshot;
+  }
+
+  ldb_atomic_init(&stop, 0);
+
+  jobs = ldb_malloc((length + 1) * sizeof(ldb_scanjob_t));
+
+  for (i = 0; i <= length; i++) {
+    jobs[i].db = db;
+    jobs[i].options = opt;
+    jobs[i].options.iterate_lower_bound = i > 0 ? &keys[i - 1] : NULL;
+    jobs[i].options.iterate_upper_bound = i < length ? &keys[i] : NULL;
+    jobs[i].func = func;
+    jobs[i].arg = arg;
+    jobs[i].stop = &stop;
+    jobs[i].status = LDB_OK;
+  }
+
+  if ((size_t)threads > length + 1)
+    threads = length + 1;
+
+  if (threads <= 1) {
+    ldb_scanjob_call(&jobs[0]);
+  } else {
+    pool = ldb_pool_create(threads);
+
+    for (i = 0; i <= length; i++)
+      ldb_pool_schedule(pool, &ldb_scanjob_call, &jobs[i]);
+
+    ldb_pool_wait(pool);
+    ldb_pool_destroy(pool);
+  }
+
+  for (i = 0; i <= length && rc == LDB_OK; i++)
+    rc = jobs[i].status;
+
+  if (snapshot != NULL)
+    ldb_release(db, snapshot);
+
+  ldb_free(jobs);
+
+  if (keys != NULL)
+    ldb_free(keys);
+
+  return rc;
+}
+
+void
+ldb_compact(ldb_t *db, const ldb_slice_t *begin, const ldb_slice_t *end) {
+  int max_level_with_files = 1;
+  int level;
+
+  {
+    ldb_version_t *base;
+
+    ldb_mutex_lock(&db->mutex);
+
+    base = db->versions->current;
+
+    for (level = 1; level < db->options.num_levels; level++) {
+      if (ldb_version_overlap_in_level(base, level, begin, end))
+        max_level_with_files = level;
+    }
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  ldb_flush(db, 1, 1);
+
+  for (level = 0; level < max_level_with_files; level++)
+    ldb_test_compact_range(db, level, begin, end);
+}
+
+int
+ldb_delete_files_in_range(ldb_t *db, const ldb_slice_t *begin,
+                                     const ldb_slice_t *end) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_vector_t files; /* ldb_filemeta_t */
+  char tmp[LDB_SUMMARY_SIZE];
+  ldb_version_t *base;
+  ldb_edit_t edit;
+  int rc = LDB_OK;
+  int level;
+  size_t i;
+
+  ldb_vector_init(&files);
+  ldb_edit_init(&edit);
+
+  ldb_mutex_lock(&db->mutex);
+
+  base = db->versions->current;
+  rc = db->read_only ? LDB_NOSUPPORT : db->bg_error;
+
+  for (level = 0; rc == LDB_OK && level < db->options.num_levels; level++) {
+    const ldb_vector_t *level_files = &base->files[level];
+
+    for (i = 0; i < level_files->length; i++) {
+      ldb_filemeta_t *f = level_files->items[i];
+      ldb_slice_t smallest = ldb_ikey_user_key(&f->smallest);
+      ldb_slice_t largest = ldb_ikey_user_key(&f->largest);
+
+      if (f->being_compacted)
+        continue;
+
+      if (begin != NULL && ldb_compare(ucmp, &smallest, begin) < 0)
+        continue;
+
+      if (end != NULL && ldb_compare(ucmp, &largest, end) > 0)
+        continue;
+
+      ldb_edit_remove_file(&edit, level, f->number);
+      ldb_vector_push(&files, f);
+    }
+  }
+
+  if (files.length > 0) {
+    /* Keep compactions away from the files while the edit is
+       written (the mutex may be released in the meantime). */
+    for (i = 0; i < files.length; i++)
+      ((ldb_filemeta_t *)files.items[i])->being_compacted = 1;
+
+    /* The files are freed along with the last version holding them. */
+    ldb_version_ref(base);
+
+    rc = ldb_versions_apply(db->versions, &edit, &db->mutex);
+
+    ldb_super_invalidate(db);
+
+    for (i = 0; i < files.length; i++)
+      ((ldb_filemeta_t *)files.items[i])->being_compacted = 0;
+
+    ldb_version_unref(base);
+
+    if (rc != LDB_OK)
+      ldb_record_background_error(db, rc);
+
+    ldb_log(db->options.info_log, "Deleted %d files in range: %s: %s",
+                                  (int)files.length,
+                                  ldb_strerror(rc),
+                                  ldb_versions_summary(db->versions, tmp));
+
+    ldb_remove_obsolete_files(db);
+    ldb_maybe_schedule_compaction(db);
+  }
+
+  ldb_mutex_unlock(&db->mutex);
+
+  ldb_edit_clear(&edit);
+  ldb_vector_clear(&files);
+
+  return rc;
+}
+
+/* Whether the memtable holds an entry or a range tombstone which
+   overlaps the user key range [smallest,largest]. */
+static int
+ldb_memtable_overlaps(ldb_t *db, ldb_memtable_t *mem,
+                                 const ldb_slice_t *smallest,
+                                 const ldb_slice_t *largest) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_iter_t *iter = ldb_memiter_create(mem);
+  int result = 0;
+  ldb_ikey_t key;
+
+  ldb_ikey_init(&key);
+  ldb_ikey_set(&key, smallest, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+
+  ldb_iter_seek(iter, &key);
+
+  if (ldb_iter_valid(iter)) {
+    ldb_slice_t k = ldb_iter_key(iter);
+    ldb_slice_t ukey = ldb_extract_user_key(&k);
 
-      new_log_number = ldb_versions_new_file_number(db->versions);
+    result = ldb_compare(ucmp, &ukey, largest) <= 0;
+  }
 
-      if (!ldb_log_filename(fname, sizeof(fname), db->dbname, new_log_number))
-        abort(); /* LCOV_EXCL_LINE */
+  ldb_iter_destroy(iter);
+  ldb_ikey_clear(&key);
 
-      rc = ldb_truncfile_create(fname, &lfile);
+  iter = ldb_rangeiter_create(mem);
 
-      if (rc != LDB_OK) {
-        /* Avoid chewing through file number space in a tight loop. */
-        ldb_versions_reuse_file_number(db->versions, new_log_number);
-        break;
-      }
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t k = ldb_iter_key(iter);
+    ldb_slice_t start = ldb_extract_user_key(&k);
+    ldb_slice_t end = ldb_iter_value(iter);
 
-      if (db->log != NULL)
-        ldb_writer_destroy(db->log);
+    if (result)
+      break;
 
-      if (db->logfile != NULL) {
-        rc = ldb_wfile_close(db->logfile);
+    result = ldb_compare(ucmp, &start, largest) <= 0
+          && ldb_compare(ucmp, &end, smallest) > 0;
+  }
 
-        if (rc != LDB_OK) {
-          /* We may have lost some data written to the previous log file.
-           * Switch to the new log file anyway, but record as a background
-           * error so we do not attempt any more writes.
-           *
-           * We could perhaps attempt to save the memtable corresponding
-           * to log file and suppress the error if that works, but that
-           * would add more complexity in a critical code path.
-           */
-          ldb_record_background_error(db, rc);
-        }
+  ldb_iter_destroy(iter);
 
-        ldb_wfile_destroy(db->logfile);
-      }
+  return result;
+}
 
-      db->logfile = lfile;
-      db->logfile_number = new_log_number;
-      db->log = ldb_writer_create(lfile, 0);
-      db->imm = db->mem;
+/* Check the next key of an external table, extending *largest. */
+static int
+ldb_ingest_check(ldb_t *db, const ldb_slice_t *key, ldb_ikey_t *largest) {
+  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
+  ldb_pkey_t pkey;
 
-      ldb_atomic_store(&db->has_imm, 1, ldb_order_release);
+  if (!ldb_pkey_import(&pkey, key))
+    return LDB_CORRUPTION;
 
-      db->mem = ldb_memtable_create(&db->internal_comparator);
+  if (pkey.sequence != 0)
+    return LDB_INVALID; /* "table was not built by an sstwriter" */
 
-      ldb_memtable_ref(db->mem);
+  if (pkey.type != LDB_TYPE_VALUE && pkey.type != LDB_TYPE_DELETION)
+    return LDB_INVALID;
 
-      force = 0; /* Do not force another compaction if have room. */
-      ldb_maybe_schedule_compaction(db);
-    }
-#undef L0_FILES
+  if (largest->size > 0) {
+    ldb_slice_t last = ldb_ikey_user_key(largest);
+
+    if (ldb_compare(ucmp, &pkey.user_key, &last) <= 0)
+      return LDB_CORRUPTION; /* "keys out of order" */
   }
 
-  return rc;
+  ldb_ikey_copy(largest, key);
+
+  return LDB_OK;
 }
 
+/* Open an external table and find its key range. Every key is
+   checked with paranoid_checks; otherwise just the first and last. */
 static int
-ldb_backup_inner(const char *dbname, const char *bakname, rb_set64_t *live) {
-  ldb_filelock_t *lock = NULL;
-  char lockname[LDB_PATH_MAX];
-  char **filenames = NULL;
-  char src[LDB_PATH_MAX];
-  char dst[LDB_PATH_MAX];
-  ldb_filetype_t type;
-  uint64_t number;
-  int rc = LDB_OK;
-  int len = -1;
-  int i;
+ldb_ingest_scan(ldb_t *db, const char *fname, uint64_t *file_size,
+                                              ldb_ikey_t *smallest,
+                                              ldb_ikey_t *largest) {
+  ldb_readopt_t options = *ldb_readopt_default;
+  ldb_table_t *table = NULL;
+  ldb_rfile_t *file = NULL;
+  ldb_iter_t *iter;
+  int rc;
 
-  if (!ldb_lock_filename(lockname, sizeof(lockname), bakname))
-    return LDB_INVALID;
+  rc = ldb_file_size(fname, file_size);
 
-  rc = ldb_create_dir(bakname);
+  if (rc == LDB_OK)
+    rc = ldb_randfile_create(fname, &file, 0);
 
-  if (rc != LDB_OK)
-    return rc;
+  if (rc == LDB_OK)
+    rc = ldb_table_open(&db->options, file, *file_size, &table);
 
-  rc = ldb_lock_file(lockname, &lock);
+  if (rc != LDB_OK) {
+    if (file != NULL)
+      ldb_rfile_destroy(file);
 
-  if (rc == LDB_OK) {
-    len = ldb_get_children(dbname, &filenames);
+    return rc;
+  }
 
-    if (len < 0)
-      rc = ldb_system_error();
+  iter = ldb_table_range_iterator(table);
+
+  if (iter != NULL) {
+    ldb_iter_destroy(iter);
+    rc = LDB_INVALID; /* "range tombstones cannot be ingested" */
   }
 
-  for (i = 0; i < len && rc == LDB_OK; i++) {
-    const char *filename = filenames[i];
+  options.verify_checksums = 1;
+  options.fill_cache = 0;
 
-    if (!ldb_parse_filename(&type, &number, filename))
-      continue;
+  iter = ldb_tableiter_create(table, &options);
 
-    if (!ldb_join(src, sizeof(src), dbname, filename)) {
-      rc = LDB_INVALID;
-      break;
-    }
+  ldb_iter_first(iter);
 
-    if (!ldb_join(dst, sizeof(dst), bakname, filename)) {
-      rc = LDB_INVALID;
-      break;
-    }
+  if (rc == LDB_OK && !ldb_iter_valid(iter)) {
+    rc = ldb_iter_status(iter);
 
-    switch (type) {
-      case LDB_FILE_LOG:
-      case LDB_FILE_DESC:
-      case LDB_FILE_CURRENT:
-        rc = ldb_copy_file(src, dst);
-        break;
-      case LDB_FILE_TABLE:
-        if (live == NULL || rb_set64_has(live, number))
-          rc = ldb_link_file(src, dst);
-        break;
-      case LDB_FILE_TEMP:
-      case LDB_FILE_LOCK:
-        break;
-      case LDB_FILE_INFO:
-        if (live == NULL)
-          rc = ldb_copy_file(src, dst);
-        break;
-    }
+    if (rc == LDB_OK)
+      rc = LDB_INVALID; /* "table is empty" */
   }
 
-  if (len >= 0)
-    ldb_free_children(filenames, len);
+  if (rc == LDB_OK) {
+    ldb_slice_t key = ldb_iter_key(iter);
 
-  if (rc != LDB_OK) {
-    len = ldb_get_children(bakname, &filenames);
+    rc = ldb_ingest_check(db, &key, largest);
 
-    for (i = 0; i < len; i++) {
-      const char *filename = filenames[i];
+    ldb_ikey_copy(smallest, &key);
+  }
 
-      if (!ldb_parse_filename(&type, &number, filename))
-        continue;
+  if (db->options.paranoid_checks) {
+    while (rc == LDB_OK) {
+      ldb_slice_t key;
 
-      if (type == LDB_FILE_LOCK)
-        continue; /* Lock file will be deleted at end. */
+      ldb_iter_next(iter);
 
-      if (!ldb_join(dst, sizeof(dst), bakname, filename))
-        continue;
+      if (!ldb_iter_valid(iter))
+        break;
 
-      ldb_remove_file(dst);
+      key = ldb_iter_key(iter);
+      rc = ldb_ingest_check(db, &key, largest);
     }
+  } else if (rc == LDB_OK) {
+    ldb_iter_last(iter);
 
-    if (len >= 0)
-      ldb_free_children(filenames, len);
-  }
+    if (ldb_iter_valid(iter)) {
+      ldb_slice_t key = ldb_iter_key(iter);
 
-  if (lock != NULL) {
-    ldb_unlock_file(lock);
-    ldb_remove_file(lockname);
+      if (ldb_compare(&db->internal_comparator, &key, largest) != 0)
+        rc = ldb_ingest_check(db, &key, largest);
+    }
   }
 
   if (rc == LDB_OK)
-    rc = ldb_sync_dir(bakname);
-  else
-    ldb_remove_dir(bakname);
+    rc = ldb_iter_status(iter);
+
+  ldb_iter_destroy(iter);
+  ldb_table_destroy(table);
+  ldb_rfile_destroy(file);
 
   return rc;
 }
 
-/*
- * API
- */
+/* Give a bound of an ingested table the global sequence number. */
+static void
+ldb_ingest_bound(ldb_ikey_t *key, ldb_seqnum_t sequence) {
+  ldb_pkey_t pkey;
+  ldb_ikey_t tmp;
 
-int
-ldb_open(const char *dbname, const ldb_dbopt_t *options, ldb_t **dbptr) {
-  char path[LDB_PATH_MAX];
-  int save_manifest = 0;
-  ldb_edit_t edit;
+  ldb_ikey_init(&tmp);
+
+  if (ldb_pkey_import(&pkey, key)) {
+    ldb_ikey_set(&tmp, &pkey.user_key, sequence, pkey.type);
+    ldb_ikey_copy(key, &tmp);
+  }
+
+  ldb_ikey_clear(&tmp);
+}
+
+/* Place tables which were written to the database as pending outputs
+   (in key order, without overlapping each other), renaming them to
+   newer numbers.
+   REQUIRES: db->mutex is held.
+   REQUIRES: this thread is currently at the front of the writer queue. */
+static int
+ldb_ingest_tables(ldb_t *db, ldb_vector_t *files) {
+  ldb_filemeta_t *first = files->items[0];
+  ldb_filemeta_t *last = files->items[files->length - 1];
+  ldb_slice_t small_key = ldb_ikey_user_key(&first->smallest);
+  ldb_slice_t large_key = ldb_ikey_user_key(&last->largest);
+  int num_levels = db->options.num_levels;
+  char src[LDB_PATH_MAX];
+  char dst[LDB_PATH_MAX];
+  char tmp[LDB_SUMMARY_SIZE];
+  ldb_seqnum_t sequence = 0;
+  ldb_version_t *base;
+  ldb_filemeta_t *f;
   int rc = LDB_OK;
-  ldb_t *db;
+  ldb_edit_t edit;
+  int level;
+  size_t i;
 
-  ldb_crc32c_init();
+  /* Wait for a pipelined write to leave the memtable. */
+  while (db->mem_stage_busy)
+    ldb_cond_wait(&db->mem_stage_cv, &db->mutex);
 
-  *dbptr = NULL;
+  /* Overlapping writes are flushed first so that the tables can go
+     on top of them. */
+  if (ldb_memtable_overlaps(db, db->mem, &small_key, &large_key))
+    rc = ldb_make_room_for_write(db, 1, 0);
 
-  if (options == NULL)
-    return LDB_INVALID;
+  if (rc == LDB_OK && db->imm != NULL) {
+    if (ldb_memtable_overlaps(db, db->imm, &small_key, &large_key)) {
+      while (db->imm != NULL && db->bg_error == LDB_OK)
+        ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
 
-  if (options->filter_policy != NULL) {
-    if (strlen(options->filter_policy->name) > 64)
-      return LDB_INVALID;
+      if (db->imm != NULL)
+        rc = db->bg_error;
+    }
   }
 
-  if (!ldb_path_absolute(path, sizeof(path) - 35, dbname))
-    return LDB_INVALID;
+  if (rc != LDB_OK)
+    return rc;
 
-  db = ldb_create(path, options);
+  /* No compaction may write to the level we pick. */
+  db->ingesting = 1;
 
-  ldb_edit_init(&edit);
-  ldb_mutex_lock(&db->mutex);
+  while (db->background_compaction_scheduled > 0 || db->flush_scheduled)
+    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
 
-  /* Recover handles create_if_missing, error_if_exists. */
-  rc = ldb_recover(db, &edit, &save_manifest);
+  rc = db->bg_error;
 
-  if (rc == LDB_OK && db->mem == NULL) {
-    /* Create new log and a corresponding memtable. */
-    uint64_t new_log_number = ldb_versions_new_file_number(db->versions);
-    ldb_wfile_t *lfile;
+  /* Level-0 tables are ordered by number, and the flushes above
+     (if any) were given newer numbers than ours. */
+  for (i = 0; i < files->length && rc == LDB_OK; i++) {
+    uint64_t number = ldb_versions_new_file_number(db->versions);
 
-    if (!ldb_log_filename(path, sizeof(path), db->dbname, new_log_number))
+    f = files->items[i];
+
+    if (!ldb_table_name(src, sizeof(src), db, f->path_id, f->number))
       abort(); /* LCOV_EXCL_LINE */
 
-    rc = ldb_truncfile_create(path, &lfile);
+    if (!ldb_table_name(dst, sizeof(dst), db, f->path_id, number))
+      abort(); /* LCOV_EXCL_LINE */
 
-    if (rc == LDB_OK) {
-      ldb_edit_set_log_number(&edit, new_log_number);
+    rb_set64_put(&db->pending_outputs, number);
 
-      db->logfile = lfile;
-      db->logfile_number = new_log_number;
-      db->log = ldb_writer_create(lfile, 0);
-      db->mem = ldb_memtable_create(&db->internal_comparator);
+    rc = ldb_rename_file(src, dst);
 
-      ldb_memtable_ref(db->mem);
+    if (rc == LDB_OK) {
+      rb_set64_del(&db->pending_outputs, f->number);
+      f->number = number;
+    } else {
+      rb_set64_del(&db->pending_outputs, number);
     }
   }
 
-  if (rc == LDB_OK && save_manifest) {
-    ldb_edit_set_prev_log_number(&edit, 0); /* No older logs needed
-                                               after recovery. */
-    ldb_edit_set_log_number(&edit, db->logfile_number);
+  if (rc == LDB_OK) {
+    base = db->versions->current;
+
+    for (level = 0; level < num_levels; level++) {
+      if (ldb_version_overlap_in_level(base, level, &small_key, &large_key))
+        break;
+    }
+
+    /* The keys must be newer than the ones they overlap, and must
+       not be seen by existing snapshots. */
+    if (level < num_levels || !ldb_snaplist_empty(&db->snapshots)) {
+      sequence = db->versions->last_sequence + 1;
+
+      db->versions->last_sequence = sequence;
+
+      ldb_publish_sequence(db);
+    }
+
+    /* Place the tables right above the newest data they overlap, or
+       in the bottommost level. Other compaction styles (and dynamic
+       level sizes) keep new data in level-0. */
+    if (db->options.compaction_style != LDB_COMPACTION_LEVEL)
+      level = 0;
+    else if (level == num_levels)
+      level = num_levels - 1;
+    else if (level == 0 || db->options.level_compaction_dynamic_level_bytes)
+      level = 0;
+    else
+      level -= 1;
+
+    ldb_edit_init(&edit);
+
+    for (i = 0; i < files->length; i++) {
+      ldb_filemeta_t *meta;
+
+      f = files->items[i];
+
+      if (sequence != 0) {
+        ldb_ingest_bound(&f->smallest, sequence);
+        ldb_ingest_bound(&f->largest, sequence);
+      }
+
+      meta = ldb_edit_add_file(&edit, level, f->number,
+                                             f->file_size,
+                                             &f->smallest,
+                                             &f->largest);
+
+      meta->creation_time = ldb_now_usec() / 1000000;
+      meta->global_sequence = sequence;
+      meta->path_id = f->path_id;
+    }
 
     rc = ldb_versions_apply(db->versions, &edit, &db->mutex);
-  }
 
-  if (rc == LDB_OK) {
-    ldb_remove_obsolete_files(db);
-    ldb_maybe_schedule_compaction(db);
-  }
+    ldb_super_invalidate(db);
 
-  ldb_mutex_unlock(&db->mutex);
+    if (rc != LDB_OK)
+      ldb_record_background_error(db, rc);
 
-  if (rc == LDB_OK) {
-    assert(db->mem != NULL);
-    *dbptr = db;
-  } else {
-    ldb_destroy_internal(db);
+    ldb_log(db->options.info_log,
+            "Ingested %d tables to level-%d at sequence %lu: %s: %s",
+            (int)files->length, level, (unsigned long)sequence,
+            ldb_strerror(rc), ldb_versions_summary(db->versions, tmp));
+
+    ldb_edit_clear(&edit);
   }
 
-  ldb_edit_clear(&edit);
+  db->ingesting = 0;
 
   return rc;
 }
 
-void
-ldb_close(ldb_t *db) {
-  ldb_destroy_internal(db);
-}
+/* Install the tables (see above) ahead of any later writes. The
+   tables are no longer pending outputs afterwards, and are removed
+   if they could not be installed. */
+static int
+ldb_ingest_install(ldb_t *db, ldb_vector_t *files) {
+  char fname[LDB_PATH_MAX];
+  ldb_waiter_t w;
+  size_t i;
+  int rc;
 
-int
-ldb_get(ldb_t *db, const ldb_slice_t *key,
-                   ldb_slice_t *value,
-                   const ldb_readopt_t *options) {
-  ldb_memtable_t *mem, *imm;
-  ldb_version_t *current;
-  ldb_seqnum_t snapshot;
-  int have_stat_update = 0;
-  ldb_getstats_t stats;
-  int rc = LDB_OK;
+  ldb_waiter_init(&w);
 
-  if (value != NULL)
-    ldb_buffer_init(value);
+  ldb_mutex_lock(&db->mutex);
 
-  if (options == NULL)
-    options = ldb_readopt_default;
+  ldb_queue_push(&db->writers, &w);
 
-  ldb_mutex_lock(&db->mutex);
+  while (&w != db->writers.head)
+    ldb_cond_wait(&w.cv, &db->mutex);
 
-  if (options->snapshot != NULL)
-    snapshot = options->snapshot->sequence;
-  else
-    snapshot = db->versions->last_sequence;
+  rc = ldb_ingest_tables(db, files);
 
-  mem = db->mem;
-  imm = db->imm;
-  current = db->versions->current;
+  ldb_queue_shift(&db->writers);
+
+  if (db->writers.length > 0)
+    ldb_cond_signal(&db->writers.head->cv);
 
-  ldb_memtable_ref(mem);
+  for (i = 0; i < files->length; i++) {
+    ldb_filemeta_t *f = files->items[i];
 
-  if (imm != NULL)
-    ldb_memtable_ref(imm);
+    rb_set64_del(&db->pending_outputs, f->number);
 
-  ldb_version_ref(current);
+    if (rc != LDB_OK) {
+      if (!ldb_table_name(fname, sizeof(fname), db, f->path_id, f->number))
+        abort(); /* LCOV_EXCL_LINE */
 
-  /* Unlock while reading from files and memtables. */
-  {
-    ldb_lkey_t lkey;
+      ldb_remove_file(fname);
+    }
+  }
 
-    ldb_mutex_unlock(&db->mutex);
+  ldb_maybe_schedule_compaction(db);
 
-    /* First look in the memtable, then in the immutable memtable (if any). */
-    ldb_lkey_init(&lkey, key, snapshot);
+  ldb_mutex_unlock(&db->mutex);
 
-    if (ldb_memtable_get(mem, &lkey, value, &rc)) {
-      /* Done. */
-    } else if (imm != NULL && ldb_memtable_get(imm, &lkey, value, &rc)) {
-      /* Done. */
-    } else {
-      rc = ldb_version_get(current, options, &lkey, value, &stats);
-      have_stat_update = 1;
-    }
+  ldb_waiter_clear(&w);
 
-    ldb_lkey_clear(&lkey);
+  return rc;
+}
 
-    ldb_mutex_lock(&db->mutex);
+int
+ldb_ingest(ldb_t *db, const char *fname) {
+  ldb_filemeta_t *f = ldb_filemeta_create();
+  char dst[LDB_PATH_MAX];
+  ldb_vector_t files;
+  int rc;
+
+  if (db->read_only) {
+    ldb_filemeta_destroy(f);
+    return LDB_NOSUPPORT;
   }
 
-  if (have_stat_update && ldb_version_update_stats(current, &stats))
-    ldb_maybe_schedule_compaction(db);
+  rc = ldb_ingest_scan(db, fname, &f->file_size, &f->smallest,
+                                                 &f->largest);
 
-  ldb_memtable_unref(mem);
+  if (rc != LDB_OK) {
+    ldb_filemeta_destroy(f);
+    return rc;
+  }
 
-  if (imm != NULL)
-    ldb_memtable_unref(imm);
+  ldb_mutex_lock(&db->mutex);
 
-  ldb_version_unref(current);
+  f->number = ldb_versions_new_file_number(db->versions);
+
+  rb_set64_put(&db->pending_outputs, f->number);
 
   ldb_mutex_unlock(&db->mutex);
 
-  if (value != NULL) {
-    if (rc == LDB_OK)
-      ldb_buffer_grow(value, 1);
-    else
-      ldb_buffer_clear(value);
-  }
+  /* Link the table into the database, or copy it if we cannot. */
+  if (!ldb_table_name(dst, sizeof(dst), db, f->path_id, f->number))
+    abort(); /* LCOV_EXCL_LINE */
 
-  return rc;
-}
+  rc = ldb_link_file(fname, dst);
 
-int
-ldb_has(ldb_t *db, const ldb_slice_t *key, const ldb_readopt_t *options) {
-  return ldb_get(db, key, NULL, options);
-}
+  if (rc != LDB_OK)
+    rc = ldb_copy_file(fname, dst);
 
-int
-ldb_put(ldb_t *db, const ldb_slice_t *key,
-                   const ldb_slice_t *value,
-                   const ldb_writeopt_t *options) {
-  ldb_batch_t batch;
-  int rc;
+  ldb_vector_init(&files);
+  ldb_vector_push(&files, f);
 
-  ldb_batch_init(&batch);
-  ldb_batch_put(&batch, key, value);
+  if (rc == LDB_OK) {
+    rc = ldb_ingest_install(db, &files);
+  } else {
+    ldb_remove_file(dst);
 
-  rc = ldb_write(db, &batch, options);
+    ldb_mutex_lock(&db->mutex);
+    rb_set64_del(&db->pending_outputs, f->number);
+    ldb_mutex_unlock(&db->mutex);
+  }
 
-  ldb_batch_clear(&batch);
+  ldb_vector_clear(&files);
+  ldb_filemeta_destroy(f);
 
   return rc;
 }
 
-int
-ldb_del(ldb_t *db, const ldb_slice_t *key, const ldb_writeopt_t *options) {
-  ldb_batch_t batch;
-  int rc;
+/*
+ * Loader
+ */
 
-  ldb_batch_init(&batch);
-  ldb_batch_del(&batch, key);
+struct ldb_loader_s {
+  ldb_t *db;
+  ldb_dbopt_t options;      /* Options of the bottommost level. */
+  ldb_vector_t files;       /* ldb_filemeta_t (finished tables) */
+  ldb_filemeta_t *meta;     /* Table being built. */
+  ldb_wfile_t *outfile;
+  ldb_tablegen_t *builder;
+  ldb_ikey_t key;           /* Last key added. */
+  int status;
+  int finished;
+};
 
-  rc = ldb_write(db, &batch, options);
+ldb_loader_t *
+ldb_loader_create(ldb_t *db) {
+  ldb_loader_t *ld = ldb_malloc(sizeof(ldb_loader_t));
 
-  ldb_batch_clear(&batch);
+  ld->db = db;
+  ld->options = ldb_level_options(db, db->options.num_levels - 1);
+  ld->meta = NULL;
+  ld->outfile = NULL;
+  ld->builder = NULL;
+  ld->status = db->read_only ? LDB_NOSUPPORT : LDB_OK;
+  ld->finished = 0;
 
-  return rc;
+  ldb_vector_init(&ld->files);
+  ldb_ikey_init(&ld->key);
+
+  return ld;
 }
 
-int
-ldb_write(ldb_t *db, ldb_batch_t *updates, const ldb_writeopt_t *options) {
-  ldb_waiter_t *last_writer;
-  uint64_t last_sequence;
-  ldb_waiter_t w;
+static int
+ldb_loader_open_output(ldb_loader_t *ld) {
+  ldb_t *db = ld->db;
+  char fname[LDB_PATH_MAX];
+  ldb_tableprops_t *props;
+  ldb_filemeta_t *meta;
   int rc;
 
-  if (options == NULL)
-    options = ldb_writeopt_default;
-
-  ldb_waiter_init(&w);
+  assert(ld->builder == NULL);
 
-  w.batch = updates;
-  w.sync = options->sync;
-  w.done = 0;
+  meta = ldb_filemeta_create();
 
   ldb_mutex_lock(&db->mutex);
 
-  ldb_queue_push(&db->writers, &w);
-
-  while (!w.done && &w != db->writers.head)
-    ldb_cond_wait(&w.cv, &db->mutex);
+  meta->number = ldb_versions_new_file_number(db->versions);
 
-  if (w.done) {
-    ldb_mutex_unlock(&db->mutex);
-    ldb_waiter_clear(&w);
-    return w.status;
-  }
+  rb_set64_put(&db->pending_outputs, meta->number);
 
-  /* May temporarily unlock and wait. */
-  rc = ldb_make_room_for_write(db, updates == NULL);
-  last_sequence = db->versions->last_sequence;
-  last_writer = &w;
+  ldb_mutex_unlock(&db->mutex);
 
-  if (rc == LDB_OK && updates != NULL) { /* NULL batch is for compactions. */
-    ldb_batch_t *write_batch = ldb_build_batch_group(db, &last_writer);
+  /* Removed along with the others if anything fails. */
+  ldb_vector_push(&ld->files, meta);
 
-    ldb_batch_set_sequence(write_batch, last_sequence + 1);
+  if (!ldb_table_name(fname, sizeof(fname), db, meta->path_id, meta->number))
+    return LDB_INVALID;
 
-    last_sequence += ldb_batch_count(write_batch);
+  if (db->options.use_direct_io_for_flush_and_compaction)
+    rc = ldb_directfile_create(fname, &ld->outfile);
+  else
+    rc = ldb_truncfile_create(fname, &ld->outfile);
 
-    /* Add to log and apply to memtable. We can release the lock
-       during this phase since &w is currently responsible for logging
-       and protects against concurrent loggers and concurrent writes
-       into db->mem. */
-    {
-      ldb_slice_t contents;
-      int sync_error = 0;
+  if (rc != LDB_OK)
+    return rc;
 
-      ldb_mutex_unlock(&db->mutex);
+  if (db->options.rate_limiter != NULL)
+    ldb_wfile_ratelimit(ld->outfile, db->options.rate_limiter, LDB_IO_HIGH);
 
-      contents = ldb_batch_contents(write_batch);
+  if (db->options.allow_fallocate)
+    ldb_wfile_preallocate(ld->outfile, db->options.max_file_size);
 
-      rc = ldb_writer_add_record(db->log, &contents);
+  ld->meta = meta;
+  ld->builder = ldb_tablegen_create(&ld->options, ld->outfile);
 
-      if (rc == LDB_OK && options->sync) {
-        rc = ldb_wfile_sync(db->logfile);
+  props = ldb_tablegen_properties(ld->builder);
+  props->creation_time = ldb_now_usec() / 1000000;
 
-        if (rc != LDB_OK)
-          sync_error = 1;
-      }
+  return LDB_OK;
+}
 
-      if (rc == LDB_OK)
-        rc = ldb_batch_insert_into(write_batch, db->mem);
+static int
+ldb_loader_finish_output(ldb_loader_t *ld) {
+  ldb_filemeta_t *meta = ld->meta;
+  int rc;
 
-      ldb_mutex_lock(&db->mutex);
+  assert(ld->builder != NULL);
 
-      if (sync_error) {
-        /* The state of the log file is indeterminate: the log record we
-           just added may or may not show up when the DB is re-opened.
-           So we force the DB into a mode where all future writes fail. */
-        ldb_record_background_error(db, rc);
-      }
-    }
+  rc = ldb_tablegen_finish(ld->builder);
 
-    if (write_batch == db->tmp_batch)
-      ldb_batch_reset(db->tmp_batch);
+  meta->file_size = ldb_tablegen_size(ld->builder);
 
-    assert(last_sequence >= db->versions->last_sequence);
+  ldb_ikey_copy(&meta->largest, &ld->key);
 
-    db->versions->last_sequence = last_sequence;
-  }
+  ldb_tablegen_destroy(ld->builder);
 
-  for (;;) {
-    ldb_waiter_t *ready = ldb_queue_shift(&db->writers);
+  ld->builder = NULL;
 
-    if (ready != &w) {
-      ready->status = rc;
-      ready->done = 1;
-      ldb_cond_signal(&ready->cv);
-    }
+  if (rc == LDB_OK)
+    rc = ldb_wfile_sync(ld->outfile);
 
-    if (ready == last_writer)
-      break;
-  }
+  if (rc == LDB_OK)
+    rc = ldb_wfile_close(ld->outfile);
 
-  /* Notify new head of write queue. */
-  if (db->writers.length > 0)
-    ldb_cond_signal(&db->writers.head->cv);
+  ldb_wfile_destroy(ld->outfile);
 
-  ldb_mutex_unlock(&db->mutex);
-  ldb_waiter_clear(&w);
+  ld->outfile = NULL;
+  ld->meta = NULL;
 
   return rc;
 }
 
-const ldb_snapshot_t *
-ldb_snapshot(ldb_t *db) {
-  ldb_snapshot_t *snap;
-  ldb_seqnum_t seq;
+int
+ldb_loader_put(ldb_loader_t *ld, const ldb_slice_t *key,
+                                  const ldb_slice_t *value) {
+  if (ld->status != LDB_OK)
+    return ld->status;
 
-  ldb_mutex_lock(&db->mutex);
+  if (ld->finished)
+    return LDB_INVALID;
 
-  seq = db->versions->last_sequence;
-  snap = ldb_snaplist_new(&db->snapshots, seq);
+  if (ld->key.size > 0) {
+    const ldb_comparator_t *ucmp = ldb_user_comparator(ld->db);
+    ldb_slice_t last = ldb_ikey_user_key(&ld->key);
 
-  ldb_mutex_unlock(&db->mutex);
+    if (ldb_compare(ucmp, key, &last) <= 0)
+      return LDB_INVALID; /* "keys must be added in strict ascending order" */
+  }
 
-  return snap;
-}
+  if (ld->builder == NULL) {
+    ld->status = ldb_loader_open_output(ld);
 
-void
-ldb_release(ldb_t *db, const ldb_snapshot_t *snapshot) {
-  ldb_mutex_lock(&db->mutex);
+    if (ld->status != LDB_OK)
+      return ld->status;
+  }
 
-  ldb_snaplist_delete(&db->snapshots, snapshot);
+  ldb_ikey_set(&ld->key, key, 0, LDB_TYPE_VALUE);
 
-  ldb_mutex_unlock(&db->mutex);
-}
+  if (ld->meta->smallest.size == 0)
+    ldb_ikey_copy(&ld->meta->smallest, &ld->key);
 
-ldb_iter_t *
-ldb_iterator(ldb_t *db, const ldb_readopt_t *options) {
-  const ldb_comparator_t *ucmp = ldb_user_comparator(db);
-  ldb_seqnum_t latest_snapshot;
-  ldb_iter_t *iter;
-  uint32_t seed;
+  ldb_tablegen_add(ld->builder, &ld->key, value);
 
-  if (options == NULL)
-    options = ldb_iteropt_default;
+  ld->status = ldb_tablegen_status(ld->builder);
 
-  iter = ldb_internal_iterator(db, options, &latest_snapshot, &seed);
+  if (ld->status == LDB_OK) {
+    if (ldb_tablegen_size(ld->builder) >= ld->options.max_file_size)
+      ld->status = ldb_loader_finish_output(ld);
+  }
 
-  return ldb_dbiter_create(db, ucmp, iter,
-                           (options->snapshot != NULL
-                              ? options->snapshot->sequence
-                              : latest_snapshot),
-                           seed);
+  return ld->status;
 }
 
-int
-ldb_property(ldb_t *db, const char *property, char **value) {
-  const char *in = property;
-
-  *value = NULL;
+static void
+ldb_loader_abandon(ldb_loader_t *ld) {
+  ldb_t *db = ld->db;
+  char fname[LDB_PATH_MAX];
+  size_t i;
 
-  if (!ldb_starts_with(in, "leveldb."))
-    return 0;
+  if (ld->builder != NULL) {
+    ldb_tablegen_abandon(ld->builder);
+    ldb_tablegen_destroy(ld->builder);
+    ld->builder = NULL;
+  }
 
-  in += 8;
+  if (ld->outfile != NULL) {
+    ldb_wfile_close(ld->outfile);
+    ldb_wfile_destroy(ld->outfile);
+    ld->outfile = NULL;
+  }
 
   ldb_mutex_lock(&db->mutex);
 
-  if (ldb_starts_with(in, "num-files-at-level")) {
-    uint64_t level;
-    int ok;
+  for (i = 0; i < ld->files.length; i++) {
+    ldb_filemeta_t *f = ld->files.items[i];
 
-    in += 18;
+    if (ldb_table_name(fname, sizeof(fname), db, f->path_id, f->number))
+      ldb_remove_file(fname);
 
-    ok = ldb_decode_int(&level, &in) && *in == 0;
+    rb_set64_del(&db->pending_outputs, f->number);
+  }
 
-    if (!ok || level >= LDB_NUM_LEVELS) {
-      ldb_mutex_unlock(&db->mutex);
-      return 0;
-    }
+  ldb_mutex_unlock(&db->mutex);
+}
 
-    *value = ldb_malloc(21);
+static void
+ldb_loader_reset(ldb_loader_t *ld) {
+  size_t i;
 
-    ldb_encode_int(*value, ldb_versions_files(db->versions, level), 0);
+  for (i = 0; i < ld->files.length; i++)
+    ldb_filemeta_destroy(ld->files.items[i]);
 
-    ldb_mutex_unlock(&db->mutex);
+  ldb_vector_reset(&ld->files);
 
-    return 1;
-  }
+  ld->meta = NULL;
+}
 
-  if (strcmp(in, "stats") == 0) {
-    ldb_buffer_t val;
-    char buf[200];
-    int level;
+int
+ldb_loader_finish(ldb_loader_t *ld) {
+  int rc = ld->status;
 
-    ldb_buffer_init(&val);
+  if (ld->finished)
+    return LDB_INVALID;
 
-    sprintf(buf, "                               Compactions\n"
-                 "Level  Files Size(MB) Time(sec) Read(MB) Write(MB)\n"
-                 "--------------------------------------------------\n");
+  if (rc == LDB_OK && ld->builder != NULL)
+    rc = ldb_loader_finish_output(ld);
 
-    ldb_buffer_string(&val, buf);
+  if (rc == LDB_OK && ld->files.length > 0)
+    rc = ldb_ingest_install(ld->db, &ld->files);
+  else if (rc != LDB_OK)
+    ldb_loader_abandon(ld);
 
-    for (level = 0; level < LDB_NUM_LEVELS; level++) {
-      int files = ldb_versions_files(db->versions, level);
-      ldb_stats_t *stats = &db->stats[level];
+  ldb_loader_reset(ld);
 
-      if (stats->micros > 0 || files > 0) {
-        int64_t bytes = ldb_versions_bytes(db->versions, level);
+  ld->status = rc;
+  ld->finished = 1;
 
-        sprintf(buf, "%3d %8d %8.0f %9.0f %8.0f %9.0f\n",
-                     level, files, bytes / 1048576.0,
-                     stats->micros / 1e6,
-                     stats->bytes_read / 1048576.0,
-                     stats->bytes_written / 1048576.0);
+  return rc;
+}
 
-        ldb_buffer_string(&val, buf);
-      }
-    }
+void
+ldb_loader_destroy(ldb_loader_t *ld) {
+  if (!ld->finished)
+    ldb_loader_abandon(ld);
 
-    ldb_buffer_push(&val, 0);
+  ldb_loader_reset(ld);
 
-    *value = (char *)val.data;
+  ldb_vector_clear(&ld->files);
+  ldb_ikey_clear(&ld->key);
+  ldb_free(ld);
+}
+
+int
+ldb_backup(ldb_t *db, const char *name) {
+  rb_set64_t live;
+  int rc;
+
+  if (strlen(name) + 1 > LDB_PATH_MAX - 35)
+    return LDB_INVALID;
 
-    ldb_mutex_unlock(&db->mutex);
+  ldb_mutex_lock(&db->mutex);
 
-    return 1;
+  /* A background delete could remove logs from under the copy. */
+  while (db->background_compaction_scheduled || db->flush_scheduled ||
+         db->deleting) {
+    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
   }
 
-  if (strcmp(in, "sstables") == 0) {
-    ldb_buffer_t val;
+  rc = db->bg_error;
 
-    ldb_buffer_init(&val);
-    ldb_version_debug(&val, db->versions->current);
-    ldb_buffer_push(&val, 0);
+  if (rc == LDB_OK) {
+    rb_set64_init(&live);
 
-    *value = (char *)val.data;
+    ldb_versions_add_files(db->versions, &live);
 
-    ldb_mutex_unlock(&db->mutex);
+    rc = ldb_backup_inner(db->dbname, name, &db->options, &live);
 
-    return 1;
+    rb_set64_clear(&live);
   }
 
-  if (strcmp(in, "approximate-memory-usage") == 0) {
-    size_t total_usage = ldb_lru_usage(db->options.block_cache);
+  ldb_mutex_unlock(&db->mutex);
 
-    if (db->mem != NULL)
-      total_usage += ldb_memtable_usage(db->mem);
+  return rc;
+}
 
-    if (db->imm != NULL)
-      total_usage += ldb_memtable_usage(db->imm);
+int
+ldb_hold_files(ldb_t *db, ldb_vector_t *files,
+                          ldb_buffer_t *record,
+                          uint64_t *manifest_number) {
+  uint64_t log_number, prev_log_number;
+  uint64_t oldest_blob, number;
+  char path[LDB_PATH_MAX];
+  char **filenames = NULL;
+  ldb_filetype_t type;
+  rb_set64_t pending;
+  rb_set64_t live;
+  int rc, i, len;
 
-    *value = ldb_malloc(21);
+  rb_set64_init(&pending);
+  rb_set64_init(&live);
 
-    ldb_encode_int(*value, total_usage, 0);
+  ldb_mutex_lock(&db->mutex);
 
-    ldb_mutex_unlock(&db->mutex);
+  rc = db->bg_error;
 
-    return 1;
+  if (rc == LDB_OK) {
+    rb_set64_copy(&pending, &db->pending_outputs);
+
+    ldb_versions_add_files(db->versions, &live);
+    ldb_versions_snapshot(db->versions, record);
+
+    oldest_blob = ldb_versions_oldest_blob(db->versions);
+    log_number = db->versions->log_number;
+    prev_log_number = db->versions->prev_log_number;
+
+    *manifest_number = db->versions->manifest_file_number;
+
+    db->checkpoints++;
   }
 
   ldb_mutex_unlock(&db->mutex);
 
-  return 0;
-}
+  if (rc != LDB_OK)
+    goto done;
 
-void
-ldb_approximate_sizes(ldb_t *db, const ldb_range_t *range,
-                                 size_t length,
-                                 uint64_t *sizes) {
-  uint64_t start, limit;
-  ldb_ikey_t k1, k2;
-  ldb_version_t *v;
-  size_t i;
+  len = ldb_get_children(db->dbname, &filenames);
 
-  ldb_mutex_lock(&db->mutex);
+  if (len < 0) {
+    rc = ldb_system_error();
+    ldb_release_files(db);
+    goto done;
+  }
 
-  v = db->versions->current;
+  for (i = 0; i < len; i++) {
+    const char *filename = filenames[i];
+    int wanted = 0;
 
-  ldb_version_ref(v);
+    if (!ldb_parse_filename(&type, &number, filename))
+      continue;
 
-  ldb_ikey_init(&k1);
-  ldb_ikey_init(&k2);
+    switch (type) {
+      case LDB_FILE_LOG:
+        wanted = (number >= log_number || number == prev_log_number);
+        break;
+      case LDB_FILE_TABLE:
+        wanted = rb_set64_has(&live, number);
+        break;
+      case LDB_FILE_BLOB:
+        /* Blob files of ongoing compactions are not referenced yet. */
+        wanted = (oldest_blob != 0 && number >= oldest_blob &&
+                  !rb_set64_has(&pending, number)) ||
+                 rb_set64_has(&live, number);
+        break;
+      default:
+        break;
+    }
 
-  for (i = 0; i < length; i++) {
-    /* Convert user_key into a corresponding internal key. */
-    ldb_ikey_set(&k1, &range[i].start, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
-    ldb_ikey_set(&k2, &range[i].limit, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+    if (wanted && ldb_join(path, sizeof(path), db->dbname, filename)) {
+      size_t size = strlen(path) + 1;
+      char *name = ldb_malloc(size);
 
-    start = ldb_versions_approximate_offset(db->versions, v, &k1);
-    limit = ldb_versions_approximate_offset(db->versions, v, &k2);
+      memcpy(name, path, size);
 
-    sizes[i] = (limit >= start ? limit - start : 0);
+      ldb_vector_push(files, name);
+    }
   }
 
-  ldb_ikey_clear(&k1);
-  ldb_ikey_clear(&k2);
+  ldb_free_children(filenames, len);
 
-  ldb_version_unref(v);
+  ldb_list_tables(db, &live, 1, files);
 
-  ldb_mutex_unlock(&db->mutex);
+done:
+  rb_set64_clear(&pending);
+  rb_set64_clear(&live);
+
+  return rc;
 }
 
 void
-ldb_compact(ldb_t *db, const ldb_slice_t *begin, const ldb_slice_t *end) {
-  int max_level_with_files = 1;
-  int level;
+ldb_release_files(ldb_t *db) {
+  ldb_mutex_lock(&db->mutex);
 
-  {
-    ldb_version_t *base;
+  assert(db->checkpoints > 0);
 
-    ldb_mutex_lock(&db->mutex);
+  if (--db->checkpoints == 0)
+    ldb_remove_obsolete_files(db);
 
-    base = db->versions->current;
+  ldb_mutex_unlock(&db->mutex);
+}
 
-    for (level = 1; level < LDB_NUM_LEVELS; level++) {
-      if (ldb_version_overlap_in_level(base, level, begin, end))
-        max_level_with_files = level;
-    }
+int
+ldb_write_snapshot(const char *dbname,
+                   uint64_t number,
+                   const ldb_slice_t *record) {
+  char fname[LDB_PATH_MAX];
+  ldb_writer_t *log;
+  ldb_wfile_t *file;
+  int rc;
 
-    ldb_mutex_unlock(&db->mutex);
-  }
+  if (!ldb_desc_filename(fname, sizeof(fname), dbname, number))
+    return LDB_INVALID;
 
-  ldb_test_compact_memtable(db);
+  rc = ldb_truncfile_create(fname, &file);
 
-  for (level = 0; level < max_level_with_files; level++)
-    ldb_test_compact_range(db, level, begin, end);
+  if (rc != LDB_OK)
+    return rc;
+
+  log = ldb_writer_create(file, 0);
+
+  rc = ldb_writer_add_record(log, record);
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_sync(file);
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_close(file);
+
+  ldb_writer_destroy(log);
+  ldb_wfile_destroy(file);
+
+  if (rc == LDB_OK)
+    rc = ldb_set_current_file(dbname, number);
+
+  return rc;
 }
 
 int
-ldb_backup(ldb_t *db, const char *name) {
-  rb_set64_t live;
+ldb_checkpoint(ldb_t *db, const char *name) {
+  char dst[LDB_PATH_MAX];
+  uint64_t number, manifest_number;
+  ldb_filetype_t type;
+  ldb_buffer_t record;
+  ldb_vector_t files;
+  size_t i;
   int rc;
 
   if (strlen(name) + 1 > LDB_PATH_MAX - 35)
     return LDB_INVALID;
 
-  ldb_mutex_lock(&db->mutex);
+  rc = ldb_create_dir(name);
 
-  while (db->background_compaction_scheduled)
-    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+  if (rc != LDB_OK)
+    return rc;
 
-  rc = db->bg_error;
+  ldb_vector_init(&files);
+  ldb_buffer_init(&record);
 
-  if (rc == LDB_OK) {
-    rb_set64_init(&live);
+  /* Unlike a backup, background work is not waited for. The current
+     version is written out as a fresh MANIFEST, and its files are kept
+     from deletion until they have been linked. */
+  rc = ldb_hold_files(db, &files, &record, &manifest_number);
 
-    ldb_versions_add_files(db->versions, &live);
+  if (rc != LDB_OK)
+    goto done;
 
-    rc = ldb_backup_inner(db->dbname, name, &live);
+  for (i = 0; i < files.length && rc == LDB_OK; i++) {
+    const char *src = files.items[i];
+    const char *filename = ldb_basename(src);
 
-    rb_set64_clear(&live);
+    if (!ldb_join(dst, sizeof(dst), name, filename)) {
+      rc = LDB_INVALID;
+      break;
+    }
+
+    ldb_parse_filename(&type, &number, filename);
+
+    /* Logs are still being written to. */
+    if (type == LDB_FILE_LOG)
+      rc = ldb_copy_file(src, dst);
+    else
+      rc = ldb_link_file(src, dst);
   }
 
-  ldb_mutex_unlock(&db->mutex);
+  if (rc == LDB_OK)
+    rc = ldb_write_snapshot(name, manifest_number, &record);
+
+  ldb_release_files(db);
+
+done:
+  for (i = 0; i < files.length; i++)
+    ldb_free(files.items[i]);
+
+  ldb_vector_clear(&files);
+  ldb_buffer_clear(&record);
 
   return rc;
 }
@@ -2550,6 +9170,52 @@ ldb_compare(const ldb_t *db, const ldb_slice_t *x, const ldb_slice_t *y) {
 
 #define ldb_compare ldb_compare_internal
 
+/*
+ * Transaction
+ */
+
+ldb_txn_t *
+ldb_txn_create(ldb_t *db) {
+  ldb_txn_t *txn = ldb_malloc(sizeof(ldb_txn_t));
+
+  txn->db = db;
+  txn->snapshot = ldb_snapshot(db);
+
+  ldb_buffer_init(&txn->reads);
+
+  return txn;
+}
+
+void
+ldb_txn_destroy(ldb_txn_t *txn) {
+  ldb_release(txn->db, txn->snapshot);
+  ldb_buffer_clear(&txn->reads);
+  ldb_free(txn);
+}
+
+int
+ldb_txn_get(ldb_txn_t *txn, const ldb_slice_t *key,
+                            ldb_slice_t *value,
+                            const ldb_readopt_t *options) {
+  ldb_readopt_t ro = options != NULL ? *options : *ldb_readopt_default;
+
+  ro.snapshot = txn->snapshot;
+
+  /* A missing key is recorded too: creating it is a conflict. */
+  ldb_slice_export(&txn->reads, key);
+
+  return ldb_get(txn->db, key, value, &ro);
+}
+
+int
+ldb_txn_commit(ldb_txn_t *txn, ldb_batch_t *updates,
+                               const ldb_writeopt_t *options) {
+  if (updates == NULL)
+    return LDB_INVALID;
+
+  return ldb_write_batch(txn->db, updates, txn, options);
+}
+
 /*
  * Static
  */
@@ -2560,8 +9226,6 @@ ldb_copy(const char *from, const char *to, const ldb_dbopt_t *options) {
   ldb_filelock_t *lock;
   int rc;
 
-  (void)options;
-
   if (strlen(from) + 1 > LDB_PATH_MAX - 35)
     return LDB_INVALID;
 
@@ -2580,7 +9244,7 @@ ldb_copy(const char *from, const char *to, const ldb_dbopt_t *options) {
   rc = ldb_lock_file(path, &lock);
 
   if (rc == LDB_OK) {
-    rc = ldb_backup_inner(from, to, NULL);
+    rc = ldb_backup_inner(from, to, options, NULL);
 
     ldb_unlock_file(lock);
   }
@@ -2595,11 +9259,10 @@ ldb_destroy(const char *dbname, const ldb_dbopt_t *options) {
   char path[LDB_PATH_MAX];
   ldb_filelock_t *lock;
   char **files = NULL;
+  ldb_fileops_t ops;
   int rc = LDB_OK;
   int len;
 
-  (void)options;
-
   if (strlen(dbname) + 1 > LDB_PATH_MAX - 35)
     return LDB_INVALID;
 
@@ -2626,7 +9289,10 @@ ldb_destroy(const char *dbname, const ldb_dbopt_t *options) {
   if (rc == LDB_OK) {
     ldb_filetype_t type;
     uint64_t number;
-    int i, status;
+    int lost = 0;
+    int i, j;
+
+    ldb_fileops_init(&ops);
 
     for (i = 0; i < len; i++) {
       const char *name = files[i];
@@ -2637,21 +9303,37 @@ ldb_destroy(const char *dbname, const ldb_dbopt_t *options) {
       if (type == LDB_FILE_LOCK)
         continue; /* Lock file will be deleted at end. */
 
-      if (!ldb_join(path, sizeof(path), dbname, name)) {
-        rc = LDB_INVALID;
+      ldb_fileops_push(&ops, LDB_FILEOP_REMOVE, dbname, name, NULL);
+    }
+
+    /* Remove the tables kept in the other directories. */
+    for (j = 0; options != NULL && j < options->num_db_paths; j++) {
+      const char *dir = options->db_paths[j].path;
+      char **subfiles = NULL;
+      int sublen;
+
+      if (!ldb_table_dir_extra(dbname, options, j))
         continue;
-      }
 
-      status = ldb_remove_file(path);
+      sublen = ldb_fileops_list(&ops, dir, &subfiles);
+
+      for (i = 0; i < sublen; i++) {
+        const char *name = subfiles[i];
+
+        if (!ldb_parse_filename(&type, &number, name))
+          continue;
+
+        if (type != LDB_FILE_TABLE)
+          continue;
 
-      if (rc == LDB_OK && status != LDB_OK)
-        rc = status;
+        ldb_fileops_push(&ops, LDB_FILEOP_REMOVE, dir, name, NULL);
+      }
     }
 
     if (ldb_current_filename(path, sizeof(path), subdir) &&
         !ldb_file_exists(path)) {
       char **subfiles = NULL;
-      int sublen = ldb_get_children(subdir, &subfiles);
+      int sublen = ldb_fileops_list(&ops, subdir, &subfiles);
 
       for (i = 0; i < sublen; i++) {
         const char *name = subfiles[i];
@@ -2659,23 +9341,25 @@ ldb_destroy(const char *dbname, const ldb_dbopt_t *options) {
         if (!ldb_parse_filename(&type, &number, name))
           continue;
 
-        if (!ldb_join(path, sizeof(path), subdir, name)) {
-          rc = LDB_INVALID;
-          continue;
-        }
+        ldb_fileops_push(&ops, LDB_FILEOP_REMOVE, subdir, name, NULL);
+      }
+
+      lost = (sublen >= 0);
+    }
 
-        status = ldb_remove_file(path);
+    rc = ldb_fileops_run(&ops, options);
 
-        if (rc == LDB_OK && status != LDB_OK)
-          rc = status;
-      }
+    ldb_fileops_clear(&ops);
 
-      if (sublen >= 0) {
-        ldb_free_children(subfiles, sublen);
-        ldb_remove_dir(subdir);
-      }
+    /* Ignore errors in case the directories have other files. */
+    for (j = 0; options != NULL && j < options->num_db_paths; j++) {
+      if (ldb_table_dir_extra(dbname, options, j))
+        ldb_remove_dir(options->db_paths[j].path);
     }
 
+    if (lost)
+      ldb_remove_dir(subdir);
+
     ldb_unlock_file(lock); /* Ignore error since state is already gone. */
     ldb_remove_file(lockname);
     ldb_remove_dir(dbname); /* Ignore error in case dir contains other files. */
@@ -2692,60 +9376,37 @@ ldb_destroy(const char *dbname, const ldb_dbopt_t *options) {
 
 int
 ldb_test_compact_memtable(ldb_t *db) {
-  /* NULL batch means just wait for earlier writes to be done. */
-  int rc = ldb_write(db, NULL, ldb_writeopt_default);
-
-  if (rc == LDB_OK) {
-    /* Wait until the compaction completes. */
-    ldb_mutex_lock(&db->mutex);
-
-    while (db->imm != NULL && db->bg_error == LDB_OK)
-      ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
-
-    if (db->imm != NULL)
-      rc = db->bg_error;
-
-    ldb_mutex_unlock(&db->mutex);
-  }
-
-  return rc;
+  return ldb_flush(db, 1, 1);
 }
 
 void
 ldb_test_compact_range(ldb_t *db, int level,
                                   const ldb_slice_t *begin,
                                   const ldb_slice_t *end) {
-  ldb_ikey_t begin_storage, end_storage;
   ldb_manual_t manual;
 
   assert(level >= 0);
-  assert(level + 1 < LDB_NUM_LEVELS);
+  assert(level + 1 < db->options.num_levels);
 
-  ldb_manual_init(&manual, level);
+  ldb_mutex_lock(&db->mutex);
 
-  if (begin == NULL) {
-    manual.begin = NULL;
-  } else {
-    ldb_ikey_init(&begin_storage);
-    ldb_ikey_set(&begin_storage, begin, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
-    manual.begin = &begin_storage;
-  }
+  ldb_manual_init(&manual, db->versions->current,
+                           level,
+                           db->options.max_manual_compactions,
+                           begin,
+                           end);
 
-  if (end == NULL) {
-    manual.end = NULL;
-  } else {
-    ldb_ikey_init(&end_storage);
-    ldb_ikey_set(&end_storage, end, 0, (ldb_valtype_t)0);
-    manual.end = &end_storage;
+  if (manual.length > 1) {
+    ldb_log(db->options.info_log, "Manual compaction at level-%d in %d parts",
+                                  level, manual.length);
   }
 
-  ldb_mutex_lock(&db->mutex);
-
   while (!manual.done &&
          !ldb_atomic_load(&db->shutting_down, ldb_order_acquire) &&
-         db->bg_error == LDB_OK) {
+         db->bg_error == LDB_OK && !db->read_only) {
     if (db->manual_compaction == NULL) { /* Idle. */
       db->manual_compaction = &manual;
+      ldb_manual_start(&manual);
       ldb_maybe_schedule_compaction(db);
     } else { /* Running either my compaction or another compaction. */
       ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
@@ -2757,13 +9418,11 @@ ldb_test_compact_range(ldb_t *db, int level,
     db->manual_compaction = NULL;
   }
 
-  ldb_mutex_unlock(&db->mutex);
-
-  if (begin != NULL)
-    ldb_ikey_clear(&begin_storage);
+  /* Parts may still be compacting. */
+  while (manual.running > 0)
+    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
 
-  if (end != NULL)
-    ldb_ikey_clear(&end_storage);
+  ldb_mutex_unlock(&db->mutex);
 
   ldb_manual_clear(&manual);
 }
@@ -2775,7 +9434,8 @@ ldb_test_internal_iterator(ldb_t *db) {
 
   return ldb_internal_iterator(db, ldb_readopt_default,
                                    &ignored,
-                                   &ignored_seed);
+                                   &ignored_seed,
+                                   NULL);
 }
 
 int64_t
@@ -2787,20 +9447,66 @@ ldb_test_max_next_level_overlapping_bytes(ldb_t *db) {
   return result;
 }
 
+void
+ldb_test_wait_for_warmup(ldb_t *db) {
+  ldb_mutex_lock(&db->mutex);
+
+  while (db->warming > 0)
+    ldb_cond_wait(&db->background_work_finished_signal, &db->mutex);
+
+  ldb_mutex_unlock(&db->mutex);
+}
+
 /*
  * Internal
  */
 
 void
-ldb_record_read_sample(ldb_t *db, const ldb_slice_t *key) {
+ldb_record_deletions(ldb_t *db, const ldb_slice_t *key) {
   ldb_version_t *current;
 
   ldb_mutex_lock(&db->mutex);
 
   current = db->versions->current;
 
-  if (ldb_version_record_read_sample(current, key))
+  if (ldb_version_record_deletions(current, key))
     ldb_maybe_schedule_compaction(db);
 
   ldb_mutex_unlock(&db->mutex);
 }
+
+int
+ldb_read_blob(ldb_t *db, const ldb_slice_t *ref, ldb_buffer_t *value) {
+  return ldb_tables_blob(db->table_cache, ref, value);
+}
+
+ldb_latency_t *
+ldb_latency_stats(ldb_t *db) {
+  return db->latency;
+}
+
+ldb_tracer_t *
+ldb_tracer(ldb_t *db) {
+  return db->tracer;
+}
+
+void
+ldb_record_read_sample(ldb_t *db, const ldb_slice_t *key) {
+  ldb_seqnum_t sequence;
+  ldb_getstats_t stats;
+  ldb_super_t *sv;
+  int slot;
+
+  sv = ldb_super_acquire(db, &sequence, &slot);
+
+  if (ldb_version_record_read_sample(sv->current, key, &stats)) {
+    ldb_mutex_lock(&db->mutex);
+
+    if (ldb_version_update_stats(sv->current, &stats))
+      ldb_maybe_schedule_compaction(db);
+
+    ldb_mutex_unlock(&db->mutex);
+  }
+
+  ldb_super_release(db, sv, slot);
+}
@@ -25,12 +25,44 @@
  */
 
 struct ldb_bloom_s;
+struct ldb_prefix_s;
 struct ldb_batch_s;
 struct ldb_comparator_s;
 struct ldb_iter_s;
+struct ldb_latency_s;
+struct ldb_pinned_s;
+struct ldb_rangedel_s;
 struct ldb_snapshot_s;
 
 typedef struct ldb_s ldb_t;
+typedef struct ldb_loader_s ldb_loader_t;
+typedef struct ldb_txn_s ldb_txn_t;
+
+/* Memory used by a database, by category (see ldb_memory_usage()). */
+typedef struct ldb_memusage_s {
+  size_t memtables; /* Active and immutable memtables. */
+  size_t block_cache; /* Charged to the block cache. */
+  size_t pinned_blocks; /* Block cache entries in use (part of the above). */
+  size_t table_readers; /* Index and filter blocks held by open tables. */
+  size_t write_batches; /* Batches waiting to be written. */
+  size_t total; /* All of the above, counting pinned blocks once. */
+} ldb_memusage_t;
+
+/* Called by ldb_parallel_scan() for each entry. */
+typedef int ldb_scan_f(void *arg,
+                       const ldb_slice_t *key,
+                       const ldb_slice_t *value);
+
+/*
+ * Constants
+ */
+
+/* What ldb_approximate_sizes_ex() counts. */
+enum ldb_size_flags {
+  LDB_SIZE_TABLES = 1 << 0,
+  LDB_SIZE_FILES_ONLY = 1 << 1,
+  LDB_SIZE_MEMTABLES = 1 << 2
+};
 
 /*
  * Helpers
@@ -42,6 +74,7 @@ ldb_dbopt_t
 ldb_sanitize_options(const char *dbname,
                      const struct ldb_comparator_s *icmp,
                      const struct ldb_bloom_s *ipolicy,
+                     const struct ldb_prefix_s *iprefix,
                      const ldb_dbopt_t *src);
 
 /*
@@ -54,11 +87,52 @@ ldb_open(const char *dbname, const ldb_dbopt_t *options, ldb_t **dbptr);
 LDB_EXTERN void
 ldb_close(ldb_t *db);
 
+/* Open a database for reading only. No lock is taken and nothing is
+   written, so the database may be open in another process at the same
+   time. Writes, ingestion and compaction fail with LDB_NOSUPPORT. The
+   instance sees the state of the database as of the last call to
+   ldb_catch_up() (made once here), which re-reads the MANIFEST and the
+   logs; tables deleted by the writer since then can no longer be read
+   unless they were kept open (see max_file_opening_threads). */
+LDB_EXTERN int
+ldb_open_readonly(const char *dbname,
+                  const ldb_dbopt_t *options,
+                  ldb_t **dbptr);
+
+/* Catch up with the writer of a read-only instance's database. */
+LDB_EXTERN int
+ldb_catch_up(ldb_t *db);
+
 LDB_EXTERN int
 ldb_get(ldb_t *db, const ldb_slice_t *key,
                    ldb_slice_t *value,
                    const ldb_readopt_t *options);
 
+LDB_EXTERN int
+ldb_get_pinned(ldb_t *db, const ldb_slice_t *key,
+                          struct ldb_pinned_s **value,
+                          const ldb_readopt_t *options);
+
+LDB_EXTERN int
+ldb_multiget(ldb_t *db, const ldb_slice_t *keys,
+                        ldb_slice_t *values,
+                        int *statuses,
+                        size_t count,
+                        const ldb_readopt_t *options);
+
+/* Look up many keys in one call. `keys` holds length-prefixed keys
+   back to back. On success, `result` is set to a buffer (to be freed
+   with ldb_free) holding, for each key in order, the value's size plus
+   one as a varint followed by the value, or a zero byte if the key was
+   not found. Meant for callers for whom each call is expensive, such
+   as JavaScript calling into wasm. */
+LDB_EXTERN int
+ldb_get_packed(ldb_t *db, const void *keys,
+                          size_t size,
+                          void **result,
+                          size_t *length,
+                          const ldb_readopt_t *options);
+
 LDB_EXTERN int
 ldb_has(ldb_t *db, const ldb_slice_t *key, const ldb_readopt_t *options);
 
@@ -67,13 +141,47 @@ ldb_put(ldb_t *db, const ldb_slice_t *key,
                    const ldb_slice_t *value,
                    const ldb_writeopt_t *options);
 
+/* Write length-prefixed key/value pairs (as produced by ldb_iter_fill)
+   as a single atomic batch. */
+LDB_EXTERN int
+ldb_put_packed(ldb_t *db, const void *data,
+                          size_t size,
+                          const ldb_writeopt_t *options);
+
 LDB_EXTERN int
 ldb_del(ldb_t *db, const ldb_slice_t *key, const ldb_writeopt_t *options);
 
+/* Merge "value" into the existing value of "key" using the merge
+   operator. Returns LDB_NOSUPPORT if none was configured. */
+LDB_EXTERN int
+ldb_merge(ldb_t *db, const ldb_slice_t *key,
+                     const ldb_slice_t *value,
+                     const ldb_writeopt_t *options);
+
+/* Erase every key in the range ["start", "end"). Returns LDB_INVALID
+   if "start" sorts after "end". */
+LDB_EXTERN int
+ldb_del_range(ldb_t *db, const ldb_slice_t *start,
+                         const ldb_slice_t *end,
+                         const ldb_writeopt_t *options);
+
 LDB_EXTERN int
 ldb_write(ldb_t *db, struct ldb_batch_s *updates,
                      const ldb_writeopt_t *options);
 
+/* Write out the log records buffered so far (see
+   options.manual_wal_flush), syncing the log if "sync" is true. */
+LDB_EXTERN int
+ldb_flush_wal(ldb_t *db, int sync);
+
+/* Switch to a new memtable and flush the current one to a level-0
+   table, so that a reopen does not have to replay its log. Returns
+   once the table is written if "wait" is true. If "allow_stall" is
+   false, an earlier flush (or a full level-0) is waited out before
+   taking the write queue, rather than stalling writes meanwhile. */
+LDB_EXTERN int
+ldb_flush(ldb_t *db, int wait, int allow_stall);
+
 LDB_EXTERN const struct ldb_snapshot_s *
 ldb_snapshot(ldb_t *db);
 
@@ -83,20 +191,167 @@ ldb_release(ldb_t *db, const struct ldb_snapshot_s *snapshot);
 LDB_EXTERN struct ldb_iter_s *
 ldb_iterator(ldb_t *db, const ldb_readopt_t *options);
 
+/* Move an iterator from ldb_iterator() up to the latest sequence and
+   version, so that it sees writes made since it was created. Children
+   over memtables and level-0 tables which are still live are kept
+   rather than reopened. The iterator is left unpositioned, and slices
+   previously returned by it are invalidated. Returns LDB_INVALID for
+   iterators reading a snapshot. */
+LDB_EXTERN int
+ldb_iter_refresh(struct ldb_iter_s *iter);
+
 LDB_EXTERN int
 ldb_property(ldb_t *db, const char *property, char **value);
 
+/* Record gets, writes and iterator seeks and steps to `filename` (see
+   util/trace.h for the format) until ldb_end_trace() is called. */
+LDB_EXTERN int
+ldb_start_trace(ldb_t *db, const char *filename);
+
+LDB_EXTERN int
+ldb_end_trace(ldb_t *db);
+
+/* Clear the counters behind the "leveldb.latency-stats" property. */
+LDB_EXTERN void
+ldb_reset_stats(ldb_t *db);
+
+/* Change the options of an open database. Only the following are
+   taken from `options`; the rest are fixed when it is opened:
+
+     write_buffer_size, block_size, block_restart_interval,
+     max_file_size, compression, level0_file_num_compaction_trigger,
+     level0_slowdown_writes_trigger, level0_stop_writes_trigger,
+     delayed_write_rate, max_bytes_for_level_base,
+     max_bytes_for_level_multiplier, max_file_size_multiplier,
+     periodic_compaction_seconds, deletion_compaction_ratio
+
+   They apply from the next memtable switch, table build or
+   compaction. The block cache is resized with ldb_lru_set_capacity(). */
+LDB_EXTERN void
+ldb_set_options(ldb_t *db, const ldb_dbopt_t *options);
+
 LDB_EXTERN void
 ldb_approximate_sizes(ldb_t *db, const ldb_range_t *range,
                                  size_t length,
                                  uint64_t *sizes);
 
+/* Like ldb_approximate_sizes(), but "flags" picks the data that is
+   counted: LDB_SIZE_TABLES for the table files (reading their index
+   blocks), LDB_SIZE_FILES_ONLY for the table files as judged from
+   their key boundaries alone (cheap, but coarse), and LDB_SIZE_MEMTABLES
+   for the memtables. */
+LDB_EXTERN void
+ldb_approximate_sizes_ex(ldb_t *db, const ldb_range_t *range,
+                                    size_t length,
+                                    int flags,
+                                    uint64_t *sizes);
+
+/* Report the memory used by the database. The block cache may be
+   shared with other databases, in which case its figures are for all
+   of them. */
+LDB_EXTERN void
+ldb_memory_usage(ldb_t *db, ldb_memusage_t *usage);
+
+/* Find up to n - 1 user keys which split the table data of the
+   database into n ranges of about equal size, for scanning the ranges
+   in parallel: [-inf, keys[0]), [keys[0], keys[1]), ..., [keys[m-1],
+   +inf). The keys are judged from the index blocks of the tables of the
+   current version, so data in the memtables is not weighed. Fewer keys
+   are returned if there are too few blocks. *keys must be freed with
+   ldb_free(). */
+LDB_EXTERN int
+ldb_split_keys(ldb_t *db, size_t n, ldb_slice_t **keys, size_t *length);
+
+/* Call func(arg, key, value) for every entry of the database, on
+   "threads" threads at once. The data is cut into ranges at keys from
+   ldb_split_keys(), and each range is read by its own iterator, against
+   one snapshot (options->snapshot, if set). Entries are passed in order
+   within a range, but ranges are scanned concurrently, so func must be
+   thread-safe. If options is NULL, the defaults are used, except that
+   blocks are not added to the block cache. If func returns non-zero,
+   the scan stops and that value is returned. */
+LDB_EXTERN int
+ldb_parallel_scan(ldb_t *db, const ldb_readopt_t *options,
+                             int threads,
+                             ldb_scan_f *func,
+                             void *arg);
+
 LDB_EXTERN void
 ldb_compact(ldb_t *db, const ldb_slice_t *begin, const ldb_slice_t *end);
 
+/* Drop every table whose keys all fall in the user key range
+   [begin,end] (a null key is unbounded), freeing its space right
+   away. Tables being compacted are left alone. Keys in tables which
+   only partly overlap the range are kept, and older versions of the
+   dropped keys may become visible again; follow up with ldb_del_range
+   to erase the range for good. */
+LDB_EXTERN int
+ldb_delete_files_in_range(ldb_t *db, const ldb_slice_t *begin,
+                                     const ldb_slice_t *end);
+
+/* Bulk load a table built by ldb_sstwriter (see src/sst_writer.h).
+   The file is hard linked into the database where possible (copied
+   otherwise) and stays in place. Overlapping writes in the memtable
+   are flushed first. If the table overlaps existing data (or if there
+   are snapshots), its keys are all given one new sequence number;
+   it is placed in the lowest level it fits in without going below
+   data it overlaps. */
+LDB_EXTERN int
+ldb_ingest(ldb_t *db, const char *fname);
+
+/* Bulk load pre-sorted keys without going through the log or the
+   memtable. Tables are cut at options.max_file_size and installed
+   together (as with ldb_ingest()) by ldb_loader_finish(); nothing is
+   visible before then. Keys must be strictly increasing; LDB_INVALID
+   is returned otherwise. Destroying an unfinished loader discards
+   everything written to it. */
+LDB_EXTERN ldb_loader_t *
+ldb_loader_create(ldb_t *db);
+
+LDB_EXTERN int
+ldb_loader_put(ldb_loader_t *ld, const ldb_slice_t *key,
+                                  const ldb_slice_t *value);
+
+LDB_EXTERN int
+ldb_loader_finish(ldb_loader_t *ld);
+
+LDB_EXTERN void
+ldb_loader_destroy(ldb_loader_t *ld);
+
+/* Optimistic transactions. Reads made with ldb_txn_get() see a
+   snapshot taken by ldb_txn_create(), and the keys read are recorded.
+   ldb_txn_commit() writes "updates" only if none of those keys has
+   been written (or range deleted) since the snapshot, and returns
+   LDB_CONFLICT otherwise; the caller may then retry with a new
+   transaction. Validation happens at the head of the write queue, so
+   transactions which do not conflict never wait on each other, but
+   each one is written in its own write group. Reads do not see the
+   transaction's own updates. */
+LDB_EXTERN ldb_txn_t *
+ldb_txn_create(ldb_t *db);
+
+LDB_EXTERN void
+ldb_txn_destroy(ldb_txn_t *txn);
+
+LDB_EXTERN int
+ldb_txn_get(ldb_txn_t *txn, const ldb_slice_t *key,
+                            ldb_slice_t *value,
+                            const ldb_readopt_t *options);
+
+LDB_EXTERN int
+ldb_txn_commit(ldb_txn_t *txn, struct ldb_batch_s *updates,
+                               const ldb_writeopt_t *options);
+
 LDB_EXTERN int
 ldb_backup(ldb_t *db, const char *name);
 
+/* Create an openable copy of the database in directory "name" without
+   waiting for background work: live tables and blob files are hard
+   linked (copied if that fails), logs are copied, and a new MANIFEST
+   describing the current version is written. */
+LDB_EXTERN int
+ldb_checkpoint(ldb_t *db, const char *name);
+
 #undef ldb_compare
 
 LDB_EXTERN int
@@ -144,6 +399,11 @@ ldb_test_internal_iterator(ldb_t *db);
 int64_t
 ldb_test_max_next_level_overlapping_bytes(ldb_t *db);
 
+/* Wait until the blocks listed in the BLOCKCACHE file have been read
+   back into the block cache (see options.block_cache_dump). */
+void
+ldb_test_wait_for_warmup(ldb_t *db);
+
 /*
  * Internal
  */
@@ -154,4 +414,57 @@ ldb_test_max_next_level_overlapping_bytes(ldb_t *db);
 void
 ldb_record_read_sample(ldb_t *db, const ldb_slice_t *key);
 
+/* Record a run of deleted entries skipped by an iterator, ending at
+   the specified internal key (see options.iter_deletion_trigger). */
+void
+ldb_record_deletions(ldb_t *db, const ldb_slice_t *key);
+
+/* Keep the files of the database from being deleted and push the paths
+   of those holding its current state to *files (allocated). Logs among
+   them are still appended to. The
+   state itself is exported to *record, to be written as the MANIFEST
+   numbered *manifest_number with ldb_write_snapshot(). A successful
+   call must be paired with ldb_release_files(). */
+int
+ldb_hold_files(ldb_t *db, ldb_vector_t *files,
+                          ldb_buffer_t *record,
+                          uint64_t *manifest_number);
+
+void
+ldb_release_files(ldb_t *db);
+
+/* Write a MANIFEST holding only "record" to "dbname" and make it
+   current. */
+int
+ldb_write_snapshot(const char *dbname,
+                   uint64_t number,
+                   const ldb_slice_t *record);
+
+/* Read the value stored in a blob file under reference "ref". */
+int
+ldb_read_blob(ldb_t *db, const ldb_slice_t *ref, ldb_buffer_t *value);
+
+/* The latency histograms of the database (NULL unless
+   options.track_latency is set). */
+struct ldb_latency_s *
+ldb_latency_stats(ldb_t *db);
+
+/* The operation tracer of the database. */
+struct ldb_tracer_s *
+ldb_tracer(ldb_t *db);
+
+/* Bring the internal iterator of a DB iterator up to the latest
+   sequence and version, keeping the children which are still live.
+   Unless "force" is set, nothing is done if nothing was written since
+   *sequence. If *updated is set, the iterator must read at *sequence
+   with the range tombstones in *tombstones (may be null) from now on.
+   Returns LDB_INVALID if the iterator reads a snapshot. */
+int
+ldb_refresh_internal(ldb_t *db,
+                     struct ldb_iter_s *internal,
+                     int force,
+                     uint64_t *sequence,
+                     struct ldb_rangedel_s **tombstones,
+                     int *updated);
+
 #endif /* LDB_DB_IMPL_H */
@@ -18,14 +18,21 @@
 
 #include "util/buffer.h"
 #include "util/comparator.h"
+#include "util/env.h"
 #include "util/internal.h"
+#include "util/latency.h"
+#include "util/mergeop.h"
+#include "util/options.h"
+#include "util/prefix.h"
 #include "util/random.h"
 #include "util/slice.h"
 #include "util/status.h"
+#include "util/trace.h"
 
 #include "db_impl.h"
 #include "db_iter.h"
 #include "dbformat.h"
+#include "rangedel.h"
 
 /*
  * Constants
@@ -54,14 +61,33 @@ typedef struct ldb_dbiter_s {
   ldb_t *db;
   const ldb_comparator_t *ucmp;
   ldb_iter_t *iter;
+  ldb_rangedel_t *tombstones; /* May be null. */
   ldb_seqnum_t sequence;
   int status;
   ldb_buffer_t saved_key;   /* == current key when direction==REVERSE */
   ldb_buffer_t saved_value; /* == current value when direction==REVERSE */
+  ldb_slice_t pinned_value; /* Used instead of saved_value if pinned. */
+  int value_pinned;
   enum ldb_direction direction;
   int valid;
+  int merged;               /* Current entry is in saved_key/saved_value
+                               although direction==FORWARD. */
+  ldb_mergectx_t merge;
   ldb_rand_t rnd;
   size_t bytes_until_read_sampling;
+  const ldb_prefix_t *prefix; /* Non-null in prefix mode. */
+  ldb_buffer_t seek_prefix;   /* Prefix of the last seek target. */
+  int bounded;                /* Whether seek_prefix is set. */
+  const ldb_slice_t *lower;   /* Inclusive lower bound (may be null). */
+  const ldb_slice_t *upper;   /* Exclusive upper bound (may be null). */
+  int deletion_trigger;       /* Zero if runs of deletions are ignored. */
+  int tombstone_weight;       /* Sampling weight of deletion markers. */
+  int pin_data;               /* Whether the blocks we visit stay live. */
+  ldb_latency_t *latency;     /* May be null. */
+  ldb_tracer_t *tracer;
+  int tailing;                /* Whether seeks catch up with writes. */
+  ldb_buffer_t target;        /* Copy of the seek target if tailing. */
+  int keys_only;              /* Whether values are left alone. */
 } ldb_dbiter_t;
 
 /*
@@ -81,6 +107,14 @@ parse_key(ldb_dbiter_t *iter, ldb_pkey_t *ikey) {
   ldb_slice_t v = ldb_iter_value(iter->iter);
   size_t bytes_read = k.size + v.size;
 
+  if (!ldb_pkey_import(ikey, &k)) {
+    iter->status = LDB_CORRUPTION; /* "corrupted internal key in DBIter" */
+    return 0;
+  }
+
+  if (ikey->type == LDB_TYPE_DELETION)
+    bytes_read *= iter->tombstone_weight;
+
   while (iter->bytes_until_read_sampling < bytes_read) {
     iter->bytes_until_read_sampling += random_compaction_period(iter);
     ldb_record_read_sample(iter->db, &k);
@@ -90,32 +124,166 @@ parse_key(ldb_dbiter_t *iter, ldb_pkey_t *ikey) {
 
   iter->bytes_until_read_sampling -= bytes_read;
 
-  if (!ldb_pkey_import(ikey, &k)) {
-    iter->status = LDB_CORRUPTION; /* "corrupted internal key in DBIter" */
+  return 1;
+}
+
+/* Whether the entry is deleted by a visible range tombstone. */
+static LDB_INLINE int
+range_deleted(const ldb_dbiter_t *iter, const ldb_pkey_t *ikey) {
+  if (iter->tombstones == NULL)
     return 0;
-  }
 
-  return 1;
+  return ldb_rangedel_covering(iter->tombstones, &ikey->user_key,
+                                                 iter->sequence)
+       > ikey->sequence;
 }
 
 static LDB_INLINE void
 clear_saved_value(ldb_dbiter_t *iter) {
+  iter->value_pinned = 0;
+
   if (iter->saved_value.alloc > 1048576)
     ldb_buffer_reinit(&iter->saved_value, 1);
   else
     ldb_buffer_reset(&iter->saved_value);
 }
 
+static LDB_INLINE int
+below_lower(const ldb_dbiter_t *iter, const ldb_slice_t *user_key) {
+  if (iter->lower == NULL)
+    return 0;
+
+  return ldb_compare(iter->ucmp, user_key, iter->lower) < 0;
+}
+
+static LDB_INLINE int
+past_upper(const ldb_dbiter_t *iter, const ldb_slice_t *user_key) {
+  if (iter->upper == NULL)
+    return 0;
+
+  return ldb_compare(iter->ucmp, user_key, iter->upper) >= 0;
+}
+
+static int
+out_of_prefix(const ldb_dbiter_t *iter, const ldb_slice_t *user_key) {
+  ldb_slice_t prefix;
+
+  if (!iter->bounded)
+    return 0;
+
+  if (!ldb_prefix_extract(iter->prefix, &prefix, user_key))
+    return 1;
+
+  return !ldb_slice_equal(&prefix, &iter->seek_prefix);
+}
+
+/* Read the value referenced by the blob entry at the current position
+   into saved_value. Leaves iter->iter at the entry. */
+static void
+load_blob(ldb_dbiter_t *iter, const ldb_pkey_t *ikey) {
+  ldb_slice_t ref = ldb_iter_value(iter->iter);
+  int rc;
+
+  ldb_buffer_copy(&iter->saved_key, &ikey->user_key);
+
+  iter->value_pinned = 0;
+
+  rc = ldb_read_blob(iter->db, &ref, &iter->saved_value);
+
+  if (rc != LDB_OK && iter->status == LDB_OK)
+    iter->status = rc;
+
+  iter->valid = (iter->status == LDB_OK);
+  iter->merged = iter->valid;
+}
+
+/* Apply the merge operand at the current position to the older
+   entries of its key. Leaves iter->iter at the entry the operands were
+   applied to, or just past the entries of the key. */
+static void
+merge_forward(ldb_dbiter_t *iter, const ldb_pkey_t *first) {
+  const ldb_slice_t *existing = NULL;
+  ldb_slice_t value = ldb_iter_value(iter->iter);
+  int rc = LDB_OK;
+  ldb_buffer_t base;
+  ldb_pkey_t ikey;
+
+  ldb_buffer_init(&base);
+  ldb_buffer_copy(&iter->saved_key, &first->user_key);
+  ldb_mergectx_reset(&iter->merge);
+  ldb_mergectx_push(&iter->merge, &value);
+
+  for (;;) {
+    ldb_iter_next(iter->iter);
+
+    if (!ldb_iter_valid(iter->iter))
+      break;
+
+    if (!parse_key(iter, &ikey))
+      break;
+
+    if (ldb_compare(iter->ucmp, &ikey.user_key, &iter->saved_key) != 0)
+      break;
+
+    /* Older entries are range deleted. */
+    if (range_deleted(iter, &ikey))
+      break;
+
+    value = ldb_iter_value(iter->iter);
+
+    if (ikey.type == LDB_TYPE_MERGE) {
+      ldb_mergectx_push(&iter->merge, &value);
+      continue;
+    }
+
+    if (ikey.type == LDB_TYPE_VALUE) {
+      existing = &value;
+    } else if (ikey.type == LDB_TYPE_BLOB) {
+      rc = ldb_read_blob(iter->db, &value, &base);
+      existing = &base;
+    }
+
+    break;
+  }
+
+  iter->value_pinned = 0;
+
+  if (rc == LDB_OK) {
+    rc = ldb_mergectx_finish(&iter->merge, &iter->saved_key,
+                                           existing,
+                                           &iter->saved_value);
+  }
+
+  ldb_buffer_clear(&base);
+
+  if (rc != LDB_OK && iter->status == LDB_OK)
+    iter->status = rc;
+
+  iter->valid = (iter->status == LDB_OK);
+  iter->merged = iter->valid;
+}
+
 static void
 find_next_user_entry(ldb_dbiter_t *iter, int skipping, ldb_buffer_t *skip) {
+  int skipped = 0;
+
   /* Loop until we hit an acceptable entry to yield. */
   assert(ldb_iter_valid(iter->iter));
   assert(iter->direction == LDB_FORWARD);
 
+  iter->merged = 0;
+
   do {
     ldb_pkey_t ikey;
 
-    if (parse_key(iter, &ikey) && ikey.sequence <= iter->sequence) {
+    if (!parse_key(iter, &ikey)) {
+      /* Skip corrupted entry. */
+    } else if (past_upper(iter, &ikey.user_key)) {
+      /* Nothing left below the upper bound. */
+      iter->valid = 0;
+      ldb_buffer_reset(&iter->saved_key);
+      return;
+    } else if (ikey.sequence <= iter->sequence) {
       switch (ikey.type) {
         case LDB_TYPE_DELETION:
           /* Arrange to skip all upcoming entries for this key since
@@ -124,17 +292,47 @@ find_next_user_entry(ldb_dbiter_t *iter, int skipping, ldb_buffer_t *skip) {
           skipping = 1;
           break;
         case LDB_TYPE_VALUE:
+        case LDB_TYPE_MERGE:
+        case LDB_TYPE_BLOB:
           if (skipping && ldb_compare(iter->ucmp, &ikey.user_key, skip) <= 0) {
             /* Entry hidden. */
+          } else if (range_deleted(iter, &ikey)) {
+            /* Hidden as if by a deletion. */
+            ldb_buffer_copy(skip, &ikey.user_key);
+            skipping = 1;
+          } else if (out_of_prefix(iter, &ikey.user_key)) {
+            /* Past the keys sharing the seek target's prefix. */
+            iter->valid = 0;
+            ldb_buffer_reset(&iter->saved_key);
+            return;
+          } else if (iter->keys_only) {
+            /* Any visible entry makes the key live. */
+            iter->valid = 1;
+            ldb_buffer_reset(&iter->saved_key);
+            return;
+          } else if (ikey.type == LDB_TYPE_MERGE) {
+            merge_forward(iter, &ikey);
+            return;
+          } else if (ikey.type == LDB_TYPE_BLOB) {
+            load_blob(iter, &ikey);
+            return;
           } else {
             iter->valid = 1;
             ldb_buffer_reset(&iter->saved_key);
             return;
           }
           break;
+        default:
+          break;
       }
     }
 
+    /* Have the run of skipped entries compacted away. */
+    if (++skipped == iter->deletion_trigger) {
+      ldb_slice_t key = ldb_iter_key(iter->iter);
+      ldb_record_deletions(iter->db, &key);
+    }
+
     ldb_iter_next(iter->iter);
   } while (ldb_iter_valid(iter->iter));
 
@@ -146,9 +344,15 @@ find_next_user_entry(ldb_dbiter_t *iter, int skipping, ldb_buffer_t *skip) {
 static void
 find_prev_user_entry(ldb_dbiter_t *iter) {
   ldb_valtype_t value_type = LDB_TYPE_DELETION;
+  int has_base = 0;
 
   assert(iter->direction == LDB_REVERSE);
 
+  iter->merged = 0;
+  iter->merge.reverse = 1;
+
+  ldb_mergectx_reset(&iter->merge);
+
   ldb_buffer_grow(&iter->saved_key, 1);
   ldb_buffer_grow(&iter->saved_value, 1);
 
@@ -156,28 +360,85 @@ find_prev_user_entry(ldb_dbiter_t *iter) {
     do {
       ldb_pkey_t ikey;
 
-      if (parse_key(iter, &ikey) && ikey.sequence <= iter->sequence) {
+      if (!parse_key(iter, &ikey)) {
+        /* Skip corrupted entry. */
+      } else if (below_lower(iter, &ikey.user_key)) {
+        /* Nothing left at or above the lower bound. */
+        break;
+      } else if (ikey.sequence <= iter->sequence) {
+        if (ikey.type != LDB_TYPE_DELETION && range_deleted(iter, &ikey))
+          ikey.type = LDB_TYPE_DELETION;
+
         if ((value_type != LDB_TYPE_DELETION) &&
             ldb_compare(iter->ucmp, &ikey.user_key, &iter->saved_key) < 0) {
           /* We encountered a non-deleted value in entries for previous keys. */
           break;
         }
 
+        if (ikey.type == LDB_TYPE_MERGE) {
+          /* Entries are visited oldest first: the operands apply to
+             whatever value (if any) was saved before them. */
+          ldb_slice_t value = ldb_iter_value(iter->iter);
+
+          if (value_type == LDB_TYPE_DELETION) {
+            ldb_mergectx_reset(&iter->merge);
+            has_base = 0;
+          }
+
+          ldb_buffer_copy(&iter->saved_key, &ikey.user_key);
+
+          if (!iter->keys_only)
+            ldb_mergectx_push(&iter->merge, &value);
+
+          value_type = ikey.type;
+
+          ldb_iter_prev(iter->iter);
+
+          continue;
+        }
+
         value_type = ikey.type;
 
+        ldb_mergectx_reset(&iter->merge);
+
         if (value_type == LDB_TYPE_DELETION) {
           ldb_buffer_reset(&iter->saved_key);
           clear_saved_value(iter);
+          has_base = 0;
         } else {
           ldb_slice_t key = ldb_iter_key(iter->iter);
           ldb_slice_t ukey = ldb_extract_user_key(&key);
           ldb_slice_t value = ldb_iter_value(iter->iter);
 
-          if (iter->saved_value.alloc > value.size + 1048576)
-            ldb_buffer_reinit(&iter->saved_value, LDB_MAX(value.size, 1));
-
           ldb_buffer_copy(&iter->saved_key, &ukey);
-          ldb_buffer_copy(&iter->saved_value, &value);
+
+          if (iter->keys_only) {
+            /* The value is not needed. */
+          } else if (value_type == LDB_TYPE_BLOB) {
+            int rc = ldb_read_blob(iter->db, &value, &iter->saved_value);
+
+            iter->value_pinned = 0;
+
+            if (rc != LDB_OK) {
+              if (iter->status == LDB_OK)
+                iter->status = rc;
+
+              value_type = LDB_TYPE_DELETION;
+
+              break;
+            }
+          } else if (iter->pin_data) {
+            /* The value stays put; no need to copy it. */
+            iter->pinned_value = value;
+            iter->value_pinned = 1;
+          } else {
+            if (iter->saved_value.alloc > value.size + 1048576)
+              ldb_buffer_reinit(&iter->saved_value, LDB_MAX(value.size, 1));
+
+            ldb_buffer_copy(&iter->saved_value, &value);
+          }
+
+          has_base = 1;
         }
       }
 
@@ -185,6 +446,28 @@ find_prev_user_entry(ldb_dbiter_t *iter) {
     } while (ldb_iter_valid(iter->iter));
   }
 
+  if (value_type == LDB_TYPE_MERGE && !iter->keys_only) {
+    const ldb_slice_t *base = NULL;
+    int rc;
+
+    if (has_base)
+      base = iter->value_pinned ? &iter->pinned_value : &iter->saved_value;
+
+    iter->value_pinned = 0;
+
+    rc = ldb_mergectx_finish(&iter->merge, &iter->saved_key,
+                             base, &iter->saved_value);
+
+    if (rc != LDB_OK) {
+      if (iter->status == LDB_OK)
+        iter->status = rc;
+
+      value_type = LDB_TYPE_DELETION;
+    }
+  }
+
+  iter->merge.reverse = 0;
+
   if (value_type == LDB_TYPE_DELETION) {
     /* End. */
     iter->valid = 0;
@@ -205,11 +488,18 @@ ldb_dbiter_init(ldb_dbiter_t *iter,
                 ldb_t *db,
                 const ldb_comparator_t *ucmp,
                 ldb_iter_t *internal_iter,
+                ldb_rangedel_t *tombstones,
+                const ldb_prefix_t *prefix,
+                const ldb_readopt_t *options,
+                const ldb_mergeop_t *merge,
+                int deletion_trigger,
+                int tombstone_weight,
                 ldb_seqnum_t sequence,
                 uint32_t seed) {
   iter->db = db;
   iter->ucmp = ucmp;
   iter->iter = internal_iter;
+  iter->tombstones = tombstones;
   iter->sequence = sequence;
   iter->status = LDB_OK;
 
@@ -218,17 +508,45 @@ ldb_dbiter_init(ldb_dbiter_t *iter,
 
   iter->direction = LDB_FORWARD;
   iter->valid = 0;
+  iter->merged = 0;
+
+  ldb_mergectx_init(&iter->merge, merge);
 
   ldb_rand_init(&iter->rnd, seed);
 
   iter->bytes_until_read_sampling = random_compaction_period(iter);
+
+  iter->prefix = prefix;
+
+  ldb_buffer_init(&iter->seek_prefix);
+
+  iter->bounded = 0;
+  iter->lower = options->iterate_lower_bound;
+  iter->upper = options->iterate_upper_bound;
+  iter->deletion_trigger = deletion_trigger;
+  iter->tombstone_weight = tombstone_weight;
+  iter->pin_data = options->pin_data;
+  iter->latency = ldb_latency_stats(db);
+  iter->tracer = ldb_tracer(db);
+  iter->value_pinned = 0;
+  iter->tailing = options->tailing && options->snapshot == NULL;
+  iter->keys_only = options->keys_only;
+
+  ldb_buffer_init(&iter->target);
 }
 
 static void
 ldb_dbiter_clear(ldb_dbiter_t *iter) {
   ldb_iter_destroy(iter->iter);
+
+  if (iter->tombstones != NULL)
+    ldb_rangedel_destroy(iter->tombstones);
+
   ldb_buffer_clear(&iter->saved_key);
   ldb_buffer_clear(&iter->saved_value);
+  ldb_buffer_clear(&iter->seek_prefix);
+  ldb_buffer_clear(&iter->target);
+  ldb_mergectx_clear(&iter->merge);
 }
 
 static int
@@ -240,7 +558,7 @@ static ldb_slice_t
 ldb_dbiter_key(const ldb_dbiter_t *iter) {
   assert(iter->valid);
 
-  if (iter->direction == LDB_FORWARD) {
+  if (iter->direction == LDB_FORWARD && !iter->merged) {
     ldb_slice_t key = ldb_iter_key(iter->iter);
     return ldb_extract_user_key(&key);
   }
@@ -252,9 +570,19 @@ static ldb_slice_t
 ldb_dbiter_value(const ldb_dbiter_t *iter) {
   assert(iter->valid);
 
-  if (iter->direction == LDB_FORWARD)
+  if (iter->keys_only) {
+    ldb_slice_t empty;
+
+    ldb_slice_init(&empty);
+    return empty;
+  }
+
+  if (iter->direction == LDB_FORWARD && !iter->merged)
     return ldb_iter_value(iter->iter);
 
+  if (iter->value_pinned)
+    return iter->pinned_value;
+
   return iter->saved_value;
 }
 
@@ -267,7 +595,7 @@ ldb_dbiter_status(const ldb_dbiter_t *iter) {
 }
 
 static void
-ldb_dbiter_next(ldb_dbiter_t *iter) {
+ldb_dbiter_step(ldb_dbiter_t *iter) {
   assert(iter->valid);
 
   if (iter->direction == LDB_REVERSE) { /* Switch directions? */
@@ -288,6 +616,15 @@ ldb_dbiter_next(ldb_dbiter_t *iter) {
     }
 
     /* iter->saved_key already contains the key to skip past. */
+  } else if (iter->merged) {
+    /* iter->saved_key already contains the key to skip past, and
+       iter->iter is positioned at or past its remaining entries. */
+    if (!ldb_iter_valid(iter->iter)) {
+      iter->valid = 0;
+      iter->merged = 0;
+      ldb_buffer_reset(&iter->saved_key);
+      return;
+    }
   } else {
     /* Store in iter->saved_key the current key so we skip it below. */
     ldb_slice_t key = ldb_iter_key(iter->iter);
@@ -309,6 +646,24 @@ ldb_dbiter_next(ldb_dbiter_t *iter) {
   find_next_user_entry(iter, 1, &iter->saved_key);
 }
 
+static void
+ldb_dbiter_next(ldb_dbiter_t *iter) {
+  int64_t start;
+
+  ldb_tracer_record(iter->tracer, LDB_TRACE_NEXT, NULL, 0);
+
+  if (iter->latency == NULL) {
+    ldb_dbiter_step(iter);
+    return;
+  }
+
+  start = ldb_now_usec();
+
+  ldb_dbiter_step(iter);
+
+  ldb_latency_add(iter->latency, LDB_LATENCY_NEXT, ldb_now_usec() - start);
+}
+
 static void
 ldb_dbiter_prev(ldb_dbiter_t *iter) {
   assert(iter->valid);
@@ -316,13 +671,24 @@ ldb_dbiter_prev(ldb_dbiter_t *iter) {
   if (iter->direction == LDB_FORWARD) { /* Switch directions? */
     /* iter->iter is pointing at the current entry. Scan backwards until
        the key changes so we can use the normal reverse scanning code. */
-    ldb_slice_t key = ldb_iter_key(iter->iter);
-    ldb_slice_t ukey = ldb_extract_user_key(&key);
+    ldb_slice_t key, ukey;
 
-    assert(ldb_iter_valid(iter->iter)); /* Otherwise iter->valid
-                                           would have been false. */
+    if (iter->merged) {
+      /* iter->saved_key holds the current key, but iter->iter may
+         already be past its entries. */
+      if (!ldb_iter_valid(iter->iter))
+        ldb_iter_last(iter->iter);
 
-    ldb_buffer_copy(&iter->saved_key, &ukey);
+      iter->merged = 0;
+    } else {
+      assert(ldb_iter_valid(iter->iter)); /* Otherwise iter->valid
+                                             would have been false. */
+
+      key = ldb_iter_key(iter->iter);
+      ukey = ldb_extract_user_key(&key);
+
+      ldb_buffer_copy(&iter->saved_key, &ukey);
+    }
 
     for (;;) {
       ldb_iter_prev(iter->iter);
@@ -347,16 +713,58 @@ ldb_dbiter_prev(ldb_dbiter_t *iter) {
   find_prev_user_entry(iter);
 }
 
+/* Read at the latest sequence from here on (tailing iterators). */
+static void
+ldb_dbiter_catch_up(ldb_dbiter_t *iter) {
+  ldb_rangedel_t *tombstones;
+  int updated;
+
+  ldb_refresh_internal(iter->db, iter->iter, 0, &iter->sequence,
+                                                &tombstones,
+                                                &updated);
+
+  if (updated) {
+    if (iter->tombstones != NULL)
+      ldb_rangedel_destroy(iter->tombstones);
+
+    iter->tombstones = tombstones;
+  }
+}
+
 static void
 ldb_dbiter_seek(ldb_dbiter_t *iter, const ldb_slice_t *target) {
+  int64_t start = iter->latency != NULL ? ldb_now_usec() : 0;
   ldb_pkey_t pkey;
 
+  ldb_tracer_record(iter->tracer, LDB_TRACE_SEEK, target, 0);
+
+  if (iter->tailing) {
+    /* The target may point into the children we are about to drop. */
+    ldb_buffer_copy(&iter->target, target);
+
+    target = &iter->target;
+
+    ldb_dbiter_catch_up(iter);
+  }
+
   iter->direction = LDB_FORWARD;
 
   clear_saved_value(iter);
 
   ldb_buffer_reset(&iter->saved_key);
 
+  if (below_lower(iter, target))
+    target = iter->lower;
+
+  if (iter->prefix != NULL) {
+    ldb_slice_t prefix;
+
+    iter->bounded = ldb_prefix_extract(iter->prefix, &prefix, target);
+
+    if (iter->bounded)
+      ldb_buffer_copy(&iter->seek_prefix, &prefix);
+  }
+
   ldb_pkey_init(&pkey, target, iter->sequence, LDB_VALTYPE_SEEK);
   ldb_pkey_export(&iter->saved_key, &pkey);
 
@@ -366,15 +774,33 @@ ldb_dbiter_seek(ldb_dbiter_t *iter, const ldb_slice_t *target) {
     find_next_user_entry(iter, 0, &iter->saved_key);
   else
     iter->valid = 0;
+
+  if (iter->latency != NULL)
+    ldb_latency_add(iter->latency, LDB_LATENCY_SEEK, ldb_now_usec() - start);
 }
 
 static void
 ldb_dbiter_first(ldb_dbiter_t *iter) {
+  if (iter->tailing)
+    ldb_dbiter_catch_up(iter);
+
   iter->direction = LDB_FORWARD;
+  iter->bounded = 0;
 
   clear_saved_value(iter);
 
-  ldb_iter_first(iter->iter);
+  if (iter->lower != NULL) {
+    ldb_pkey_t pkey;
+
+    ldb_pkey_init(&pkey, iter->lower, iter->sequence, LDB_VALTYPE_SEEK);
+    ldb_pkey_export(&iter->saved_key, &pkey);
+
+    ldb_iter_seek(iter->iter, &iter->saved_key);
+
+    ldb_buffer_reset(&iter->saved_key);
+  } else {
+    ldb_iter_first(iter->iter);
+  }
 
   if (ldb_iter_valid(iter->iter))
     find_next_user_entry(iter, 0, &iter->saved_key);
@@ -384,11 +810,32 @@ ldb_dbiter_first(ldb_dbiter_t *iter) {
 
 static void
 ldb_dbiter_last(ldb_dbiter_t *iter) {
+  if (iter->tailing)
+    ldb_dbiter_catch_up(iter);
+
   iter->direction = LDB_REVERSE;
+  iter->bounded = 0;
 
   clear_saved_value(iter);
 
-  ldb_iter_last(iter->iter);
+  if (iter->upper != NULL) {
+    ldb_pkey_t pkey;
+
+    /* Position at the last entry before the upper bound. */
+    ldb_pkey_init(&pkey, iter->upper, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+    ldb_pkey_export(&iter->saved_key, &pkey);
+
+    ldb_iter_seek(iter->iter, &iter->saved_key);
+
+    ldb_buffer_reset(&iter->saved_key);
+
+    if (ldb_iter_valid(iter->iter))
+      ldb_iter_prev(iter->iter);
+    else
+      ldb_iter_last(iter->iter);
+  } else {
+    ldb_iter_last(iter->iter);
+  }
 
   find_prev_user_entry(iter);
 }
@@ -399,9 +846,56 @@ ldb_iter_t *
 ldb_dbiter_create(ldb_t *db,
                   const ldb_comparator_t *user_comparator,
                   ldb_iter_t *internal_iter,
+                  ldb_rangedel_t *tombstones,
+                  const ldb_prefix_t *prefix,
+                  const ldb_readopt_t *options,
+                  const ldb_mergeop_t *merge,
+                  int deletion_trigger,
+                  int tombstone_weight,
                   ldb_seqnum_t sequence,
                   uint32_t seed) {
-  ldb_dbiter_t *iter = ldb_malloc(sizeof(ldb_dbiter_t));
-  ldb_dbiter_init(iter, db, user_comparator, internal_iter, sequence, seed);
-  return ldb_iter_create(iter, &ldb_dbiter_table, user_comparator);
+  ldb_dbiter_t *iter = ldb_small_alloc(sizeof(ldb_dbiter_t));
+
+  ldb_dbiter_init(iter, db, user_comparator, internal_iter,
+                  tombstones, prefix, options, merge,
+                  deletion_trigger, tombstone_weight, sequence, seed);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_dbiter_t),
+                               &ldb_dbiter_table, user_comparator);
+}
+
+ldb_iter_t *
+ldb_dbiter_internal(const ldb_iter_t *iter, ldb_t **db) {
+  const ldb_dbiter_t *it = iter->ptr;
+
+  if (iter->table != &ldb_dbiter_table)
+    return NULL;
+
+  *db = it->db;
+
+  return it->iter;
+}
+
+void
+ldb_dbiter_rebind(ldb_iter_t *iter,
+                  ldb_rangedel_t *tombstones,
+                  ldb_seqnum_t sequence) {
+  ldb_dbiter_t *it = iter->ptr;
+
+  assert(iter->table == &ldb_dbiter_table);
+
+  if (it->tombstones != NULL)
+    ldb_rangedel_destroy(it->tombstones);
+
+  it->tombstones = tombstones;
+  it->sequence = sequence;
+  it->status = LDB_OK;
+  it->direction = LDB_FORWARD;
+  it->valid = 0;
+  it->merged = 0;
+  it->value_pinned = 0;
+  it->bounded = 0;
+
+  ldb_buffer_reset(&it->saved_key);
+  ldb_buffer_reset(&it->saved_value);
 }
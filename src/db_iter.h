@@ -19,12 +19,37 @@
 struct ldb_s;
 struct ldb_comparator_s;
 struct ldb_iter_s;
+struct ldb_mergeop_s;
+struct ldb_prefix_s;
+struct ldb_rangedel_s;
+struct ldb_readopt_s;
 
+/* Takes ownership of the internal iterator and of the (built) range
+   tombstone set, which may be null. */
 struct ldb_iter_s *
 ldb_dbiter_create(struct ldb_s *db,
                   const struct ldb_comparator_s *user_comparator,
                   struct ldb_iter_s *internal_iter,
+                  struct ldb_rangedel_s *tombstones,
+                  const struct ldb_prefix_s *prefix,
+                  const struct ldb_readopt_s *options,
+                  const struct ldb_mergeop_s *merge,
+                  int deletion_trigger,
+                  int tombstone_weight,
                   uint64_t sequence,
                   uint32_t seed);
 
+/* Return the internal iterator of a DB iterator, and its database
+   in *db. Returns NULL if "iter" is not a DB iterator. */
+struct ldb_iter_s *
+ldb_dbiter_internal(const struct ldb_iter_s *iter, struct ldb_s **db);
+
+/* Read at "sequence" from now on, after the internal iterator was
+   rebuilt in place. Takes ownership of "tombstones" (may be null).
+   The iterator is left unpositioned. */
+void
+ldb_dbiter_rebind(struct ldb_iter_s *iter,
+                  struct ldb_rangedel_s *tombstones,
+                  uint64_t sequence);
+
 #endif /* LDB_DB_ITER_H */
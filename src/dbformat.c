@@ -19,6 +19,7 @@
 #include "util/coding.h"
 #include "util/comparator.h"
 #include "util/internal.h"
+#include "util/prefix.h"
 #include "util/slice.h"
 
 #include "dbformat.h"
@@ -30,7 +31,7 @@
 static uint64_t
 pack_seqtype(uint64_t sequence, ldb_valtype_t type) {
   assert(sequence <= LDB_MAX_SEQUENCE);
-  assert(type <= LDB_VALTYPE_SEEK);
+  assert(type <= LDB_VALTYPE_SEEK || type == LDB_TYPE_RANGE_DELETION);
   return (sequence << 8) | type;
 }
 
@@ -95,7 +96,7 @@ ldb_pkey_import(ldb_pkey_t *z, const ldb_slice_t *x) {
   num = ldb_fixed64_decode(xp + xn - 8);
   type = num & 0xff;
 
-  if (type > LDB_TYPE_VALUE)
+  if (type > LDB_TYPE_BLOB && type != LDB_TYPE_RANGE_DELETION)
     return 0;
 
   ldb_slice_set(&z->user_key, xp, xn - 8);
@@ -293,6 +294,10 @@ ldb_ikc_init(ldb_comparator_t *ikc, const ldb_comparator_t *user_comparator) {
   ikc->user_comparator = user_comparator;
   ikc->state = NULL;
 
+  /* The database keeps its own copy of the user comparator. */
+  if (user_comparator->compare == ldb_bytewise_comparator->compare)
+    ikc->compare = ldb_ikc_bytewise;
+
   if (user_comparator->shortest_separator != NULL)
     ikc->shortest_separator = ldb_ikc_shortest_separator;
 
@@ -312,16 +317,22 @@ ldb_ifp_build(const ldb_bloom_t *ifp,
   /* We rely on the fact that the code in
      table.c doesn't mind us adjusting keys. */
   ldb_slice_t *ukeys = (ldb_slice_t *)keys;
-  size_t i;
+  size_t i, j;
 
-  for (i = 0; i < length; i++) {
+  for (i = 0, j = 0; i < length; i++) {
     /* Inline extract_user_key. */
-    assert(ukeys[i].size >= 8);
+    assert(keys[i].size >= 8);
+
+    ukeys[j] = keys[i];
+    ukeys[j].size -= 8;
 
-    ukeys[i].size -= 8;
+    /* Multiple versions of a key are adjacent (as are repeats of a
+       prefix, see below). Only the first one is worth hashing. */
+    if (j == 0 || !ldb_slice_equal(&ukeys[j], &ukeys[j - 1]))
+      j++;
   }
 
-  ldb_bloom_build(ifp->user_policy, dst, ukeys, length);
+  ldb_bloom_build(ifp->user_policy, dst, ukeys, j);
 }
 
 static int
@@ -343,3 +354,34 @@ ldb_ifp_init(ldb_bloom_t *ifp, const ldb_bloom_t *user_policy) {
   ifp->user_policy = user_policy;
   ifp->state = NULL;
 }
+
+/*
+ * InternalPrefixExtractor
+ */
+
+static int
+ldb_ipe_extract(const ldb_prefix_t *ipe,
+                ldb_slice_t *result,
+                const ldb_slice_t *key) {
+  const ldb_prefix_t *user_prefix = ipe->state;
+  ldb_slice_t k = ldb_extract_user_key(key);
+  ldb_slice_t prefix;
+
+  if (!ldb_prefix_extract(user_prefix, &prefix, &k))
+    return 0;
+
+  assert(prefix.data == k.data && prefix.size <= k.size);
+
+  /* Keep 8 bytes past the user prefix so the result looks like an
+     internal key to the internal filter policy, which strips them. */
+  ldb_slice_set(result, key->data, prefix.size + 8);
+
+  return 1;
+}
+
+void
+ldb_ipe_init(ldb_prefix_t *ipe, const ldb_prefix_t *user_prefix) {
+  ipe->name = user_prefix->name;
+  ipe->extract = ldb_ipe_extract;
+  ipe->state = (void *)user_prefix;
+}
@@ -27,6 +27,11 @@
    parameters set via options. */
 #define LDB_NUM_LEVELS 7 /* kNumLevels */
 
+/* Upper bound on ldb_dbopt_t::num_levels (LDB_NUM_LEVELS is the default). */
+#define LDB_MAX_LEVELS 12
+
+/* Defaults of the level0_* triggers in ldb_dbopt_t. */
+
 /* Level-0 compaction is started when we hit this many files. */
 #define LDB_L0_COMPACTION_TRIGGER 4 /* kL0_CompactionTrigger */
 
@@ -36,6 +41,14 @@
 /* Maximum number of level-0 files. We stop writes at this point. */
 #define LDB_L0_STOP_WRITES_TRIGGER 12 /* kL0_StopWritesTrigger */
 
+/* Write rates used by the delayed write controller (bytes per second)
+   when nothing better is known, and as the lowest it will go. */
+#define LDB_DELAYED_WRITE_RATE (16 << 20)
+#define LDB_MIN_WRITE_RATE (16 << 10)
+
+/* Longest a single write is delayed by the controller (usec). */
+#define LDB_MAX_WRITE_DELAY 1000000
+
 /* Maximum level to which a new compacted memtable is pushed if it
    does not create overlap. We try to push to level 2 to avoid the
    relatively expensive level 0=>1 compactions and to avoid some
@@ -52,7 +65,12 @@
    data structures. */
 enum ldb_valtype {
   LDB_TYPE_DELETION = 0x0, /* kTypeDeletion */
-  LDB_TYPE_VALUE = 0x1 /* kTypeValue */
+  LDB_TYPE_VALUE = 0x1, /* kTypeValue */
+  LDB_TYPE_MERGE = 0x2, /* kTypeMerge */
+  LDB_TYPE_BLOB = 0x3, /* kTypeBlobIndex (a reference, see src/blob.h) */
+  /* Range tombstones are kept apart from the point entries above (see
+     src/rangedel.h) and so take no part in LDB_VALTYPE_SEEK. */
+  LDB_TYPE_RANGE_DELETION = 0xf /* kTypeRangeDeletion */
 };
 
 /* LDB_VALTYPE_SEEK defines the ldb_valtype that should be passed when
@@ -62,7 +80,7 @@ enum ldb_valtype {
  * number in internal keys, we need to use the highest-numbered
  * ldb_valtype, not the lowest).
  */
-#define LDB_VALTYPE_SEEK LDB_TYPE_VALUE /* kValueTypeForSeek */
+#define LDB_VALTYPE_SEEK LDB_TYPE_BLOB /* kValueTypeForSeek */
 
 /* We leave eight bits empty at the bottom so a type and sequence#
    can be packed together into 64-bits. */
@@ -74,6 +92,7 @@ enum ldb_valtype {
 
 struct ldb_bloom_s;
 struct ldb_comparator_s;
+struct ldb_prefix_s;
 
 typedef enum ldb_valtype ldb_valtype_t;
 
@@ -112,6 +131,7 @@ typedef struct ldb_lkey_s {
  */
 
 #define ldb_extract_user_key(x) ldb_slice((x)->data, (x)->size - 8)
+#define ldb_extract_type(x) ((ldb_valtype_t)(x)->data[(x)->size - 8])
 
 /*
  * ParsedInternalKey
@@ -202,4 +222,11 @@ ldb_ikc_init(struct ldb_comparator_s *ikc,
 void
 ldb_ifp_init(struct ldb_bloom_s *ifp, const struct ldb_bloom_s *user_policy);
 
+/*
+ * InternalPrefixExtractor
+ */
+
+void
+ldb_ipe_init(struct ldb_prefix_s *ipe, const struct ldb_prefix_s *user_prefix);
+
 #endif /* LDB_DBFORMAT_H */
@@ -15,11 +15,14 @@
 #include <string.h>
 
 #include "util/bloom.h"
+#include "util/internal.h"
 #include "util/options.h"
 #include "util/status.h"
 
+#include "cachesim.h"
 #include "db_impl.h"
 #include "dumpfile.h"
+#include "verify.h"
 
 /*
  * Commands
@@ -65,7 +68,7 @@ handle_repair_command(char **argv, int argc) {
       else
         rc = LDB_INVALID;
     } else if (sscanf(argv[i], "--compression=%d%c", &n, &junk) == 1) {
-      if (n >= 0 && n <= 1)
+      if (n == 0 || n == 1 || n == 4 || n == 7)
         options.compression = (enum ldb_compression)n;
       else
         rc = LDB_INVALID;
@@ -76,6 +79,11 @@ handle_repair_command(char **argv, int argc) {
       } else {
         rc = LDB_INVALID;
       }
+    } else if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
+      if (n >= 0)
+        options.max_file_opening_threads = n;
+      else
+        rc = LDB_INVALID;
     } else if (dbname == NULL) {
       dbname = argv[i];
     } else {
@@ -125,6 +133,86 @@ handle_destroy_command(char **argv, int argc) {
   return ok;
 }
 
+static int
+handle_simcache_command(char **argv, int argc) {
+  enum ldb_lru_policy policy = LDB_LRU_DEFAULT;
+  size_t *capacities = ldb_malloc((argc + 1) * sizeof(size_t));
+  const char *fname = NULL;
+  int rc = LDB_OK;
+  int count = 0;
+  int i;
+
+  for (i = 0; i < argc; i++) {
+    char junk;
+    double d;
+    int n;
+
+    if (sscanf(argv[i], "--policy=%d%c", &n, &junk) == 1) {
+      if (n == 0 || n == 1)
+        policy = (enum ldb_lru_policy)n;
+      else
+        rc = LDB_INVALID;
+    } else if (fname == NULL) {
+      fname = argv[i];
+    } else if (sscanf(argv[i], "%lf%c", &d, &junk) == 1 && d > 0) {
+      capacities[count++] = (size_t)(d * 1048576.0);
+    } else {
+      rc = LDB_INVALID;
+    }
+  }
+
+  if (fname == NULL || count == 0)
+    rc = LDB_INVALID;
+
+  if (rc == LDB_OK)
+    rc = ldb_simulate_cache(fname, capacities, count, policy, stdout);
+
+  if (rc != LDB_OK)
+    fprintf(stderr, "%s\n", ldb_strerror(rc));
+
+  ldb_free(capacities);
+
+  return rc == LDB_OK;
+}
+
+static int
+handle_verify_command(char **argv, int argc) {
+  const char *dbname = NULL;
+  int rc = LDB_OK;
+  int checksum = 1;
+  int threads = 1;
+  int i;
+
+  for (i = 0; i < argc; i++) {
+    char junk;
+    int n;
+
+    if (sscanf(argv[i], "--threads=%d%c", &n, &junk) == 1) {
+      if (n >= 1)
+        threads = n;
+      else
+        rc = LDB_INVALID;
+    } else if (strcmp(argv[i], "--scan") == 0) {
+      checksum = 0;
+    } else if (dbname == NULL) {
+      dbname = argv[i];
+    } else {
+      rc = LDB_INVALID;
+    }
+  }
+
+  if (dbname == NULL)
+    rc = LDB_INVALID;
+
+  if (rc == LDB_OK)
+    rc = ldb_verify_db(dbname, NULL, threads, checksum, stdout);
+
+  if (rc != LDB_OK)
+    fprintf(stderr, "%s\n", ldb_strerror(rc));
+
+  return rc == LDB_OK;
+}
+
 /*
  * Usage
  */
@@ -136,7 +224,11 @@ print_usage(void) {
     "   dump files...         -- dump contents of specified files\n"
     "   repair name [options] -- repair database\n"
     "   copy source dest      -- copy database\n"
-    "   destroy names...      -- destroy database\n");
+    "   destroy names...      -- destroy database\n"
+    "   verify name [--threads=n] [--scan]\n"
+    "                         -- verify checksums of live files\n"
+    "   simcache trace [--policy=0|1] megabytes...\n"
+    "                         -- simulate block cache sizes\n");
 }
 
 /*
@@ -162,6 +254,10 @@ main(int argc, char **argv) {
       ok = handle_copy_command(argv + 2, argc - 2);
     } else if (strcmp(command, "destroy") == 0) {
       ok = handle_destroy_command(argv + 2, argc - 2);
+    } else if (strcmp(command, "simcache") == 0) {
+      ok = handle_simcache_command(argv + 2, argc - 2);
+    } else if (strcmp(command, "verify") == 0) {
+      ok = handle_verify_command(argv + 2, argc - 2);
     } else {
       print_usage();
       ok = 0;
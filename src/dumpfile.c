@@ -80,10 +80,12 @@ print_log_contents(const char *fname,
                    void (*func)(uint64_t, const ldb_slice_t *, FILE *),
                    FILE *dst) {
   ldb_reporter_t reporter;
+  ldb_filetype_t type;
   ldb_reader_t reader;
   ldb_buffer_t scratch;
   ldb_slice_t record;
   ldb_rfile_t *file;
+  uint64_t number;
   int rc;
 
   rc = ldb_seqfile_create(fname, &file);
@@ -95,6 +97,9 @@ print_log_contents(const char *fname,
   reporter.corruption = report_corruption;
 
   ldb_reader_init(&reader, file, &reporter, 1, 0);
+
+  if (ldb_parse_filename(&type, &number, ldb_basename(fname)))
+    ldb_reader_recyclable(&reader, number);
   ldb_buffer_init(&scratch);
 
   while (ldb_reader_read_record(&reader, &record, &scratch))
@@ -138,6 +143,42 @@ handle_del(ldb_handler_t *h, const ldb_slice_t *key) {
   ldb_buffer_clear(&r);
 }
 
+static void
+handle_merge(ldb_handler_t *h,
+             const ldb_slice_t *key,
+             const ldb_slice_t *value) {
+  FILE *dst = h->state;
+  ldb_buffer_t r;
+
+  ldb_buffer_init(&r);
+  ldb_buffer_string(&r, "  merge '");
+  ldb_buffer_escape(&r, key);
+  ldb_buffer_string(&r, "' '");
+  ldb_buffer_escape(&r, value);
+  ldb_buffer_string(&r, "'\n");
+
+  stream_append(dst, &r);
+  ldb_buffer_clear(&r);
+}
+
+static void
+handle_del_range(ldb_handler_t *h,
+                 const ldb_slice_t *start,
+                 const ldb_slice_t *end) {
+  FILE *dst = h->state;
+  ldb_buffer_t r;
+
+  ldb_buffer_init(&r);
+  ldb_buffer_string(&r, "  del_range '");
+  ldb_buffer_escape(&r, start);
+  ldb_buffer_string(&r, "' '");
+  ldb_buffer_escape(&r, end);
+  ldb_buffer_string(&r, "'\n");
+
+  stream_append(dst, &r);
+  ldb_buffer_clear(&r);
+}
+
 /* Called on every log record (each one of which is a WriteBatch)
    found in a LDB_FILE_LOG. */
 static void
@@ -173,6 +214,8 @@ write_batch_printer(uint64_t pos, const ldb_slice_t *record, FILE *dst) {
   printer.state = dst;
   printer.put = handle_put;
   printer.del = handle_del;
+  printer.merge = handle_merge;
+  printer.del_range = handle_del_range;
 
   rc = ldb_batch_iterate(&batch, &printer);
 
@@ -225,6 +268,64 @@ dump_descriptor(const char *fname, FILE *dst) {
   return print_log_contents(fname, edit_printer, dst);
 }
 
+static void
+dump_entries(ldb_iter_t *iter, ldb_buffer_t *r, FILE *dst) {
+  int rc;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+    ldb_pkey_t pkey;
+
+    ldb_buffer_reset(r);
+
+    if (!ldb_pkey_import(&pkey, &key)) {
+      ldb_buffer_string(r, "badkey '");
+      ldb_buffer_escape(r, &key);
+      ldb_buffer_string(r, "' => '");
+      ldb_buffer_escape(r, &val);
+      ldb_buffer_string(r, "'\n");
+      stream_append(dst, r);
+    } else {
+      ldb_buffer_push(r, '\'');
+      ldb_buffer_escape(r, &pkey.user_key);
+      ldb_buffer_string(r, "' @ ");
+      ldb_buffer_number(r, pkey.sequence);
+      ldb_buffer_string(r, " : ");
+
+      if (pkey.type == LDB_TYPE_DELETION)
+        ldb_buffer_string(r, "del");
+      else if (pkey.type == LDB_TYPE_VALUE)
+        ldb_buffer_string(r, "val");
+      else if (pkey.type == LDB_TYPE_MERGE)
+        ldb_buffer_string(r, "merge");
+      else if (pkey.type == LDB_TYPE_BLOB)
+        ldb_buffer_string(r, "blob");
+      else if (pkey.type == LDB_TYPE_RANGE_DELETION)
+        ldb_buffer_string(r, "del_range");
+      else
+        ldb_buffer_number(r, pkey.type);
+
+      ldb_buffer_string(r, " => '");
+      ldb_buffer_escape(r, &val);
+      ldb_buffer_string(r, "'\n");
+
+      stream_append(dst, r);
+    }
+  }
+
+  rc = ldb_iter_status(iter);
+
+  if (rc != LDB_OK) {
+    ldb_buffer_reset(r);
+    ldb_buffer_string(r, "iterator error: ");
+    ldb_buffer_string(r, ldb_strerror(rc));
+    ldb_buffer_push(r, '\n');
+
+    stream_append(dst, r);
+  }
+}
+
 static int
 dump_table(const char *fname, FILE *dst) {
   ldb_readopt_t ro = *ldb_readopt_default;
@@ -268,56 +369,20 @@ dump_table(const char *fname, FILE *dst) {
 
   ldb_buffer_init(&r);
 
-  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
-    ldb_slice_t key = ldb_iter_key(iter);
-    ldb_slice_t val = ldb_iter_value(iter);
-    ldb_pkey_t pkey;
-
-    ldb_buffer_reset(&r);
-
-    if (!ldb_pkey_import(&pkey, &key)) {
-      ldb_buffer_string(&r, "badkey '");
-      ldb_buffer_escape(&r, &key);
-      ldb_buffer_string(&r, "' => '");
-      ldb_buffer_escape(&r, &val);
-      ldb_buffer_string(&r, "'\n");
-      stream_append(dst, &r);
-    } else {
-      ldb_buffer_push(&r, '\'');
-      ldb_buffer_escape(&r, &pkey.user_key);
-      ldb_buffer_string(&r, "' @ ");
-      ldb_buffer_number(&r, pkey.sequence);
-      ldb_buffer_string(&r, " : ");
-
-      if (pkey.type == LDB_TYPE_DELETION)
-        ldb_buffer_string(&r, "del");
-      else if (pkey.type == LDB_TYPE_VALUE)
-        ldb_buffer_string(&r, "val");
-      else
-        ldb_buffer_number(&r, pkey.type);
-
-      ldb_buffer_string(&r, " => '");
-      ldb_buffer_escape(&r, &val);
-      ldb_buffer_string(&r, "'\n");
-
-      stream_append(dst, &r);
-    }
-  }
+  dump_entries(iter, &r, dst);
 
-  rc = ldb_iter_status(iter);
+  ldb_iter_destroy(iter);
 
-  if (rc != LDB_OK) {
-    ldb_buffer_reset(&r);
-    ldb_buffer_string(&r, "iterator error: ");
-    ldb_buffer_string(&r, ldb_strerror(rc));
-    ldb_buffer_push(&r, '\n');
+  /* Range tombstones are kept apart from the other entries. */
+  iter = ldb_table_range_iterator(table);
 
-    stream_append(dst, &r);
+  if (iter != NULL) {
+    dump_entries(iter, &r, dst);
+    ldb_iter_destroy(iter);
   }
 
   ldb_buffer_clear(&r);
 
-  ldb_iter_destroy(iter);
   ldb_table_destroy(table);
   ldb_rfile_destroy(file);
 
@@ -0,0 +1,399 @@
+/*!
+ * family.c - column families for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table/iterator.h"
+
+#include "util/buffer.h"
+#include "util/comparator.h"
+#include "util/internal.h"
+#include "util/options.h"
+#include "util/slice.h"
+#include "util/status.h"
+
+#include "db_impl.h"
+#include "family.h"
+#include "write_batch.h"
+
+/*
+ * Family Comparator
+ */
+
+typedef struct ldb_families_s {
+  ldb_comparator_t cmp;
+  const ldb_comparator_t *comparators[LDB_MAX_FAMILIES];
+} ldb_families_t;
+
+static const ldb_comparator_t *
+family_lookup(const ldb_comparator_t *cmp, int family) {
+  const ldb_families_t *fam = cmp->state;
+  return fam->comparators[family];
+}
+
+static ldb_slice_t
+family_rest(const ldb_slice_t *key) {
+  ldb_slice_t z;
+  ldb_slice_set(&z, key->data + 1, key->size - 1);
+  return z;
+}
+
+static int
+family_compare(const ldb_comparator_t *cmp,
+               const ldb_slice_t *x,
+               const ldb_slice_t *y) {
+  ldb_slice_t xr, yr;
+
+  if (x->size == 0 || y->size == 0)
+    return (x->size != 0) - (y->size != 0);
+
+  if (x->data[0] != y->data[0])
+    return (int)x->data[0] - (int)y->data[0];
+
+  /* A family's empty key sorts first, bounding its family. */
+  if (x->size == 1 || y->size == 1)
+    return (x->size != 1) - (y->size != 1);
+
+  xr = family_rest(x);
+  yr = family_rest(y);
+
+  return ldb_compare(family_lookup(cmp, x->data[0]), &xr, &yr);
+}
+
+static void
+family_shortest_separator(const ldb_comparator_t *cmp,
+                          ldb_buffer_t *start,
+                          const ldb_slice_t *limit) {
+  const ldb_comparator_t *ucmp;
+  ldb_buffer_t key;
+  ldb_slice_t rest;
+
+  /* Keys of different families are left alone. */
+  if (start->size <= 1 || limit->size <= 1)
+    return;
+
+  if (start->data[0] != limit->data[0])
+    return;
+
+  ucmp = family_lookup(cmp, start->data[0]);
+
+  if (ucmp->shortest_separator == NULL)
+    return;
+
+  rest = family_rest(limit);
+
+  ldb_buffer_init(&key);
+  ldb_buffer_set(&key, start->data + 1, start->size - 1);
+
+  ldb_shortest_separator(ucmp, &key, &rest);
+
+  ldb_buffer_resize(start, 1);
+  ldb_buffer_append(start, key.data, key.size);
+  ldb_buffer_clear(&key);
+}
+
+static void
+family_short_successor(const ldb_comparator_t *cmp, ldb_buffer_t *key) {
+  const ldb_comparator_t *ucmp;
+  ldb_buffer_t rest;
+
+  if (key->size <= 1)
+    return;
+
+  ucmp = family_lookup(cmp, key->data[0]);
+
+  if (ucmp->short_successor == NULL)
+    return;
+
+  ldb_buffer_init(&rest);
+  ldb_buffer_set(&rest, key->data + 1, key->size - 1);
+
+  ldb_short_successor(ucmp, &rest);
+
+  ldb_buffer_resize(key, 1);
+  ldb_buffer_append(key, rest.data, rest.size);
+  ldb_buffer_clear(&rest);
+}
+
+ldb_comparator_t *
+ldb_family_comparator(const ldb_comparator_t *const *comparators,
+                      int length) {
+  ldb_families_t *fam = ldb_malloc(sizeof(ldb_families_t));
+  int i;
+
+  assert(length >= 0 && length <= LDB_MAX_FAMILIES);
+
+  for (i = 0; i < LDB_MAX_FAMILIES; i++) {
+    if (i < length && comparators[i] != NULL)
+      fam->comparators[i] = comparators[i];
+    else
+      fam->comparators[i] = ldb_bytewise_comparator;
+  }
+
+  fam->cmp.name = "lcdb.FamilyComparator";
+  fam->cmp.compare = family_compare;
+  fam->cmp.shortest_separator = family_shortest_separator;
+  fam->cmp.short_successor = family_short_successor;
+  fam->cmp.user_comparator = NULL;
+  fam->cmp.state = fam;
+
+  return &fam->cmp;
+}
+
+void
+ldb_family_comparator_destroy(ldb_comparator_t *cmp) {
+  ldb_free(cmp->state);
+}
+
+/*
+ * Family Keys
+ */
+
+static void
+family_key(ldb_buffer_t *z, int family, const ldb_slice_t *key) {
+  ldb_buffer_reset(z);
+  ldb_buffer_push(z, family);
+  ldb_buffer_append(z, key->data, key->size);
+}
+
+#define family_check(family) \
+  ((family) >= 0 && (family) < LDB_MAX_FAMILIES)
+
+/*
+ * Family Iterator
+ */
+
+typedef struct ldb_famiter_s {
+  ldb_iter_t *iter;
+  int family;
+  ldb_buffer_t target;
+  ldb_buffer_t lower;
+  ldb_buffer_t upper;
+} ldb_famiter_t;
+
+static void
+ldb_famiter_clear(ldb_famiter_t *iter) {
+  ldb_iter_destroy(iter->iter);
+  ldb_buffer_clear(&iter->target);
+  ldb_buffer_clear(&iter->lower);
+  ldb_buffer_clear(&iter->upper);
+}
+
+static int
+ldb_famiter_valid(const ldb_famiter_t *iter) {
+  ldb_slice_t key;
+
+  if (!ldb_iter_valid(iter->iter))
+    return 0;
+
+  /* The last family has no upper bound. */
+  key = ldb_iter_key(iter->iter);
+
+  return key.size > 0 && key.data[0] == iter->family;
+}
+
+static void
+ldb_famiter_first(ldb_famiter_t *iter) {
+  ldb_iter_first(iter->iter);
+}
+
+static void
+ldb_famiter_last(ldb_famiter_t *iter) {
+  ldb_iter_last(iter->iter);
+}
+
+static void
+ldb_famiter_seek(ldb_famiter_t *iter, const ldb_slice_t *target) {
+  family_key(&iter->target, iter->family, target);
+  ldb_iter_seek(iter->iter, &iter->target);
+}
+
+static void
+ldb_famiter_next(ldb_famiter_t *iter) {
+  ldb_iter_next(iter->iter);
+}
+
+static void
+ldb_famiter_prev(ldb_famiter_t *iter) {
+  ldb_iter_prev(iter->iter);
+}
+
+static ldb_slice_t
+ldb_famiter_key(const ldb_famiter_t *iter) {
+  ldb_slice_t key = ldb_iter_key(iter->iter);
+  return family_rest(&key);
+}
+
+static ldb_slice_t
+ldb_famiter_value(const ldb_famiter_t *iter) {
+  return ldb_iter_value(iter->iter);
+}
+
+static int
+ldb_famiter_status(const ldb_famiter_t *iter) {
+  return ldb_iter_status(iter->iter);
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_famiter);
+
+ldb_iter_t *
+ldb_family_iterator(ldb_t *db, int family, const ldb_readopt_t *options) {
+  ldb_readopt_t opt = *options;
+  const ldb_comparator_t *ucmp;
+  ldb_famiter_t *iter;
+  ldb_slice_t empty;
+
+  if (!family_check(family))
+    return ldb_emptyiter_create(LDB_INVALID);
+
+  iter = ldb_malloc(sizeof(ldb_famiter_t));
+
+  iter->family = family;
+
+  ldb_buffer_init(&iter->target);
+  ldb_buffer_init(&iter->lower);
+  ldb_buffer_init(&iter->upper);
+
+  ldb_slice_set(&empty, NULL, 0);
+
+  /* Keep the database iterator within the family. */
+  family_key(&iter->lower, family, options->iterate_lower_bound != NULL
+                                 ? options->iterate_lower_bound
+                                 : &empty);
+
+  opt.iterate_lower_bound = &iter->lower;
+  opt.iterate_upper_bound = NULL;
+
+  if (options->iterate_upper_bound != NULL) {
+    family_key(&iter->upper, family, options->iterate_upper_bound);
+  } else if (family < LDB_MAX_FAMILIES - 1) {
+    family_key(&iter->upper, family + 1, &empty);
+  }
+
+  if (iter->upper.size > 0)
+    opt.iterate_upper_bound = &iter->upper;
+
+  iter->iter = ldb_iterator(db, &opt);
+
+  /* Compare keys with the family's own comparator. */
+  ucmp = iter->iter->cmp;
+
+  if (ucmp != NULL && ucmp->compare == family_compare)
+    ucmp = family_lookup(ucmp, family);
+
+  return ldb_iter_create(iter, &ldb_famiter_table, ucmp);
+}
+
+/*
+ * Family Operations
+ */
+
+int
+ldb_family_get(ldb_t *db,
+               int family,
+               const ldb_slice_t *key,
+               ldb_slice_t *value,
+               const ldb_readopt_t *options) {
+  ldb_buffer_t k;
+  int rc;
+
+  if (!family_check(family))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&k);
+
+  family_key(&k, family, key);
+
+  rc = ldb_get(db, &k, value, options);
+
+  ldb_buffer_clear(&k);
+
+  return rc;
+}
+
+int
+ldb_family_put(ldb_t *db,
+               int family,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value,
+               const ldb_writeopt_t *options) {
+  ldb_buffer_t k;
+  int rc;
+
+  if (!family_check(family))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&k);
+
+  family_key(&k, family, key);
+
+  rc = ldb_put(db, &k, value, options);
+
+  ldb_buffer_clear(&k);
+
+  return rc;
+}
+
+int
+ldb_family_del(ldb_t *db,
+               int family,
+               const ldb_slice_t *key,
+               const ldb_writeopt_t *options) {
+  ldb_buffer_t k;
+  int rc;
+
+  if (!family_check(family))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&k);
+
+  family_key(&k, family, key);
+
+  rc = ldb_del(db, &k, options);
+
+  ldb_buffer_clear(&k);
+
+  return rc;
+}
+
+void
+ldb_batch_family_put(ldb_batch_t *batch,
+                     int family,
+                     const ldb_slice_t *key,
+                     const ldb_slice_t *value) {
+  ldb_buffer_t k;
+
+  assert(family_check(family));
+
+  ldb_buffer_init(&k);
+
+  family_key(&k, family, key);
+
+  ldb_batch_put(batch, &k, value);
+
+  ldb_buffer_clear(&k);
+}
+
+void
+ldb_batch_family_del(ldb_batch_t *batch,
+                     int family,
+                     const ldb_slice_t *key) {
+  ldb_buffer_t k;
+
+  assert(family_check(family));
+
+  ldb_buffer_init(&k);
+
+  family_key(&k, family, key);
+
+  ldb_batch_del(batch, &k);
+
+  ldb_buffer_clear(&k);
+}
@@ -0,0 +1,96 @@
+/*!
+ * family.h - column families for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_FAMILY_H
+#define LDB_FAMILY_H
+
+#include "util/extern.h"
+#include "util/options.h"
+#include "util/types.h"
+
+/*
+ * Types
+ */
+
+struct ldb_batch_s;
+struct ldb_comparator_s;
+struct ldb_iter_s;
+struct ldb_s;
+
+/*
+ * Constants
+ */
+
+/* Family numbers fit in the byte which begins their keys. */
+#define LDB_MAX_FAMILIES 256
+
+/*
+ * Column Families
+ */
+
+/* Column families are separate keyspaces within one database. They
+ * share its write-ahead log, memtables, background work and caches,
+ * so a batch spanning several families is applied atomically.
+ *
+ * Each key is stored with its family number as a leading byte. The
+ * database must be opened with the comparator returned here, which
+ * orders keys by family, then with comparators[family] (or bytewise,
+ * for families past "length" or with a NULL entry). The empty key of
+ * a family sorts before its others, and is never passed to them.
+ * Per-family comparators must not change once the database holds
+ * their keys.
+ *
+ * Plain calls (ldb_put(), ldb_iterator(), ...) see the keys with their
+ * family byte, while the calls below add and strip it.
+ */
+LDB_EXTERN struct ldb_comparator_s *
+ldb_family_comparator(const struct ldb_comparator_s *const *comparators,
+                      int length);
+
+LDB_EXTERN void
+ldb_family_comparator_destroy(struct ldb_comparator_s *cmp);
+
+LDB_EXTERN int
+ldb_family_get(struct ldb_s *db,
+               int family,
+               const ldb_slice_t *key,
+               ldb_slice_t *value,
+               const ldb_readopt_t *options);
+
+LDB_EXTERN int
+ldb_family_put(struct ldb_s *db,
+               int family,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value,
+               const ldb_writeopt_t *options);
+
+LDB_EXTERN int
+ldb_family_del(struct ldb_s *db,
+               int family,
+               const ldb_slice_t *key,
+               const ldb_writeopt_t *options);
+
+/* Iterate over the keys of one family (without their family byte).
+   Bounds in "options" are taken as keys of the family. */
+LDB_EXTERN struct ldb_iter_s *
+ldb_family_iterator(struct ldb_s *db,
+                    int family,
+                    const ldb_readopt_t *options);
+
+LDB_EXTERN void
+ldb_batch_family_put(struct ldb_batch_s *batch,
+                     int family,
+                     const ldb_slice_t *key,
+                     const ldb_slice_t *value);
+
+LDB_EXTERN void
+ldb_batch_family_del(struct ldb_batch_s *batch,
+                     int family,
+                     const ldb_slice_t *key);
+
+#endif /* LDB_FAMILY_H */
@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include "util/env.h"
+#include "util/options.h"
 #include "util/slice.h"
 #include "util/status.h"
 #include "util/strutil.h"
@@ -65,6 +66,12 @@ ldb_sstable_filename(char *buf, size_t size, const char *dbname, uint64_t num) {
   return make_filename(buf, size, dbname, num, "sst");
 }
 
+int
+ldb_blob_filename(char *buf, size_t size, const char *dbname, uint64_t num) {
+  assert(num > 0);
+  return make_filename(buf, size, dbname, num, "blob");
+}
+
 int
 ldb_desc_filename(char *buf, size_t size, const char *dbname, uint64_t num) {
   char tmp[128];
@@ -105,13 +112,19 @@ ldb_oldinfo_filename(char *buf, size_t size, const char *dbname) {
   return ldb_join(buf, size, dbname, "LOG.old");
 }
 
+int
+ldb_cache_filename(char *buf, size_t size, const char *dbname) {
+  return ldb_join(buf, size, dbname, "BLOCKCACHE");
+}
+
 /* Owned filenames have the form:
  *    dbname/CURRENT
  *    dbname/LOCK
  *    dbname/LOG
  *    dbname/LOG.old
+ *    dbname/BLOCKCACHE
  *    dbname/MANIFEST-[0-9]+
- *    dbname/[0-9]+.(log|sst|ldb)
+ *    dbname/[0-9]+.(log|sst|ldb|blob)
  */
 int
 ldb_parse_filename(ldb_filetype_t *type, uint64_t *num, const char *name) {
@@ -126,6 +139,9 @@ ldb_parse_filename(ldb_filetype_t *type, uint64_t *num, const char *name) {
   } else if (strcmp(name, "LOG") == 0 || strcmp(name, "LOG.old") == 0) {
     *type = LDB_FILE_INFO;
     *num = 0;
+  } else if (strcmp(name, "BLOCKCACHE") == 0) {
+    *type = LDB_FILE_CACHE;
+    *num = 0;
   } else if (ldb_starts_with(name, "MANIFEST-")) {
     name += 9;
 
@@ -144,6 +160,8 @@ ldb_parse_filename(ldb_filetype_t *type, uint64_t *num, const char *name) {
       *type = LDB_FILE_TABLE;
     else if (strcmp(name, ".dbtmp") == 0)
       *type = LDB_FILE_TEMP;
+    else if (strcmp(name, ".blob") == 0)
+      *type = LDB_FILE_BLOB;
     else
       return 0;
 
@@ -188,3 +206,31 @@ ldb_set_current_file(const char *dbname, uint64_t desc_number) {
 
   return rc;
 }
+
+const char *
+ldb_table_dir(const char *dbname,
+              const ldb_dbopt_t *options,
+              int path_id) {
+  if (options == NULL || path_id < 0 || path_id >= options->num_db_paths)
+    return dbname;
+
+  return options->db_paths[path_id].path;
+}
+
+int
+ldb_table_dir_extra(const char *dbname,
+                    const ldb_dbopt_t *options,
+                    int index) {
+  const char *path = options->db_paths[index].path;
+  int i;
+
+  if (strcmp(path, dbname) == 0)
+    return 0;
+
+  for (i = 0; i < index; i++) {
+    if (strcmp(options->db_paths[i].path, path) == 0)
+      return 0;
+  }
+
+  return 1;
+}
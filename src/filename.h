@@ -16,6 +16,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * Types
+ */
+
+struct ldb_dbopt_s;
+
 /*
  * Constants
  */
@@ -27,7 +33,9 @@ typedef enum ldb_filetype {
   LDB_FILE_DESC,
   LDB_FILE_CURRENT,
   LDB_FILE_TEMP,
-  LDB_FILE_INFO /* Either the current one, or an old one */
+  LDB_FILE_INFO, /* Either the current one, or an old one */
+  LDB_FILE_BLOB,
+  LDB_FILE_CACHE
 } ldb_filetype_t;
 
 /*
@@ -52,6 +60,12 @@ ldb_table_filename(char *buf, size_t size, const char *dbname, uint64_t num);
 int
 ldb_sstable_filename(char *buf, size_t size, const char *dbname, uint64_t num);
 
+/* Return the name of the blob file with the specified number
+   in the db named by "dbname". The result will be prefixed with
+   "dbname". */
+int
+ldb_blob_filename(char *buf, size_t size, const char *dbname, uint64_t num);
+
 /* Return the name of the descriptor file for the db named by
    "dbname" and the specified incarnation number. The result will be
    prefixed with "dbname". */
@@ -82,12 +96,34 @@ ldb_info_filename(char *buf, size_t size, const char *dbname);
 int
 ldb_oldinfo_filename(char *buf, size_t size, const char *dbname);
 
+/* Return the name of the file listing the blocks of "dbname" held in
+   the block cache when it was last closed. */
+int
+ldb_cache_filename(char *buf, size_t size, const char *dbname);
+
 /* If filename is a database file, store the type of the file in *type.
    The number encoded in the filename is stored in *num. If the
    filename was successfully parsed, returns true. Else return false. */
 int
 ldb_parse_filename(ldb_filetype_t *type, uint64_t *num, const char *name);
 
+/* Return the directory holding table files with the specified
+   path id (see db_paths). If no paths are configured, this is always
+   "dbname". */
+const char *
+ldb_table_dir(const char *dbname,
+              const struct ldb_dbopt_s *options,
+              int path_id);
+
+/* Return true if db_paths[index] is a directory other than "dbname"
+   which does not appear earlier in db_paths. Each directory a database
+   keeps tables in other than its own is visited once by iterating over
+   db_paths with this. */
+int
+ldb_table_dir_extra(const char *dbname,
+                    const struct ldb_dbopt_s *options,
+                    int index);
+
 /* Make the CURRENT file point to the descriptor file with the
    specified number. */
 int
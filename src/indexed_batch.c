@@ -0,0 +1,534 @@
+/*!
+ * indexed_batch.c - indexed write batch for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "table/iterator.h"
+
+#include "util/buffer.h"
+#include "util/comparator.h"
+#include "util/internal.h"
+#include "util/options.h"
+#include "util/rbt.h"
+#include "util/slice.h"
+#include "util/status.h"
+
+#include "db_impl.h"
+#include "dbformat.h"
+#include "indexed_batch.h"
+#include "write_batch.h"
+
+/*
+ * Types
+ */
+
+/* Index entry. Stored entries refer to the latest record for their
+   key by its offset in the batch's representation, which stays valid
+   as the representation grows. Lookups compare against "probe". */
+typedef struct ldb_ientry_s {
+  size_t offset;
+  const ldb_slice_t *probe;
+} ldb_ientry_t;
+
+struct ldb_ibatch_s {
+  const ldb_comparator_t *ucmp;
+  ldb_batch_t batch;
+  rb_tree_t index; /* ldb_ientry_t */
+};
+
+/*
+ * Helpers
+ */
+
+/* Decode the record at "offset". Returns the record's tag. */
+static int
+ldb_ibatch_record(const ldb_ibatch_t *ib,
+                  size_t offset,
+                  ldb_slice_t *key,
+                  ldb_slice_t *value) {
+  const ldb_buffer_t *rep = &ib->batch.rep;
+  ldb_slice_t input;
+  int tag;
+
+  assert(offset < rep->size);
+
+  input = ldb_slice(rep->data + offset + 1, rep->size - offset - 1);
+  tag = rep->data[offset];
+
+  if (!ldb_slice_slurp(key, &input))
+    abort(); /* LCOV_EXCL_LINE */
+
+  if (tag == LDB_TYPE_VALUE) {
+    if (!ldb_slice_slurp(value, &input))
+      abort(); /* LCOV_EXCL_LINE */
+  } else {
+    ldb_slice_set(value, NULL, 0);
+  }
+
+  return tag;
+}
+
+static ldb_slice_t
+ldb_ientry_key(const ldb_ibatch_t *ib, const ldb_ientry_t *entry) {
+  ldb_slice_t key, value;
+
+  if (entry->probe != NULL)
+    return *entry->probe;
+
+  ldb_ibatch_record(ib, entry->offset, &key, &value);
+
+  return key;
+}
+
+static int
+ldb_ientry_compare(rb_val_t x, rb_val_t y, void *arg) {
+  const ldb_ibatch_t *ib = arg;
+  ldb_slice_t xk = ldb_ientry_key(ib, x.ptr);
+  ldb_slice_t yk = ldb_ientry_key(ib, y.ptr);
+
+  return ldb_compare(ib->ucmp, &xk, &yk);
+}
+
+static void
+ldb_ientry_destruct(rb_node_t *node) {
+  ldb_free(node->key.ptr);
+}
+
+/* Point the key's index entry at the record starting at "offset". */
+static void
+ldb_ibatch_index(ldb_ibatch_t *ib, const ldb_slice_t *key, size_t offset) {
+  ldb_ientry_t probe, *entry;
+  rb_node_t *node;
+
+  probe.offset = 0;
+  probe.probe = key;
+
+  node = rb_tree_get(&ib->index, rb_ptr(&probe));
+
+  if (node != NULL) {
+    entry = node->key.ptr;
+    entry->offset = offset;
+    return;
+  }
+
+  entry = ldb_malloc(sizeof(ldb_ientry_t));
+  entry->offset = offset;
+  entry->probe = NULL;
+
+  rb_tree_put(&ib->index, rb_ptr(entry), NULL);
+}
+
+/*
+ * IndexedBatch
+ */
+
+ldb_ibatch_t *
+ldb_ibatch_create(const ldb_comparator_t *comparator) {
+  ldb_ibatch_t *ib = ldb_malloc(sizeof(ldb_ibatch_t));
+
+  if (comparator == NULL)
+    comparator = ldb_bytewise_comparator;
+
+  ib->ucmp = comparator;
+
+  ldb_batch_init(&ib->batch);
+
+  rb_tree_init(&ib->index, ldb_ientry_compare, ib);
+
+  return ib;
+}
+
+void
+ldb_ibatch_destroy(ldb_ibatch_t *ib) {
+  rb_tree_clear(&ib->index, ldb_ientry_destruct);
+  ldb_batch_clear(&ib->batch);
+  ldb_free(ib);
+}
+
+void
+ldb_ibatch_reset(ldb_ibatch_t *ib) {
+  rb_tree_clear(&ib->index, ldb_ientry_destruct);
+  rb_tree_init(&ib->index, ldb_ientry_compare, ib);
+  ldb_batch_reset(&ib->batch);
+}
+
+void
+ldb_ibatch_put(ldb_ibatch_t *ib,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value) {
+  size_t offset = ib->batch.rep.size;
+
+  ldb_batch_put(&ib->batch, key, value);
+  ldb_ibatch_index(ib, key, offset);
+}
+
+void
+ldb_ibatch_del(ldb_ibatch_t *ib, const ldb_slice_t *key) {
+  size_t offset = ib->batch.rep.size;
+
+  ldb_batch_del(&ib->batch, key);
+  ldb_ibatch_index(ib, key, offset);
+}
+
+ldb_batch_t *
+ldb_ibatch_batch(ldb_ibatch_t *ib) {
+  return &ib->batch;
+}
+
+int
+ldb_ibatch_get(const ldb_ibatch_t *ib,
+               ldb_t *db,
+               const ldb_slice_t *key,
+               ldb_slice_t *value,
+               const ldb_readopt_t *options) {
+  ldb_ientry_t probe;
+  rb_node_t *node;
+
+  probe.offset = 0;
+  probe.probe = key;
+
+  node = rb_tree_get(&ib->index, rb_ptr(&probe));
+
+  if (node != NULL) {
+    const ldb_ientry_t *entry = node->key.ptr;
+    ldb_slice_t k, v;
+
+    if (ldb_ibatch_record(ib, entry->offset, &k, &v) != LDB_TYPE_VALUE)
+      return LDB_NOTFOUND;
+
+    if (value != NULL) {
+      ldb_buffer_init(value);
+      ldb_buffer_grow(value, 1);
+      ldb_buffer_set(value, v.data, v.size);
+    }
+
+    return LDB_OK;
+  }
+
+  if (db == NULL)
+    return LDB_NOTFOUND;
+
+  return ldb_get(db, key, value, options);
+}
+
+/*
+ * Constants
+ */
+
+enum ldb_direction {
+  LDB_FORWARD,
+  LDB_REVERSE
+};
+
+/*
+ * Indexed Batch Iterator
+ */
+
+/* Iterates over the batch ("delta") and a base iterator at once. When
+   both are positioned at the same key, the batch's entry wins and
+   "equal" is set so that both are moved past it together. */
+typedef struct ldb_ibiter_s {
+  const ldb_ibatch_t *ib;
+  ldb_iter_t *base;
+  rb_iter_t delta;
+  ldb_buffer_t saved; /* Current key across a change of direction. */
+  enum ldb_direction direction;
+  int at_base;
+  int equal;
+} ldb_ibiter_t;
+
+static int
+ldb_ibiter_base_valid(const ldb_ibiter_t *iter) {
+  return iter->base != NULL && ldb_iter_valid(iter->base);
+}
+
+static int
+ldb_ibiter_delta_type(const ldb_ibiter_t *iter,
+                      ldb_slice_t *key,
+                      ldb_slice_t *value) {
+  const ldb_ientry_t *entry = rb_key_ptr(iter->delta);
+
+  return ldb_ibatch_record(iter->ib, entry->offset, key, value);
+}
+
+static ldb_slice_t
+ldb_ibiter_delta_key(const ldb_ibiter_t *iter) {
+  ldb_slice_t key, value;
+
+  ldb_ibiter_delta_type(iter, &key, &value);
+
+  return key;
+}
+
+static void
+ldb_ibiter_step_delta(ldb_ibiter_t *iter) {
+  if (iter->direction == LDB_FORWARD)
+    rb_iter_next(&iter->delta);
+  else
+    rb_iter_prev(&iter->delta);
+}
+
+static void
+ldb_ibiter_step_base(ldb_ibiter_t *iter) {
+  if (iter->direction == LDB_FORWARD)
+    ldb_iter_next(iter->base);
+  else
+    ldb_iter_prev(iter->base);
+}
+
+/* Settle on the next visible entry in the current direction,
+   skipping deletions in the batch and the base keys they hide. */
+static void
+ldb_ibiter_update(ldb_ibiter_t *iter) {
+  iter->equal = 0;
+
+  for (;;) {
+    ldb_slice_t dkey, bkey, value;
+    int type, cmp;
+
+    if (!rb_iter_valid(&iter->delta)) {
+      iter->at_base = 1;
+      return;
+    }
+
+    type = ldb_ibiter_delta_type(iter, &dkey, &value);
+
+    if (!ldb_ibiter_base_valid(iter)) {
+      if (type == LDB_TYPE_DELETION) {
+        ldb_ibiter_step_delta(iter);
+        continue;
+      }
+
+      iter->at_base = 0;
+      return;
+    }
+
+    bkey = ldb_iter_key(iter->base);
+    cmp = ldb_compare(iter->ib->ucmp, &dkey, &bkey);
+
+    if (iter->direction == LDB_REVERSE)
+      cmp = -cmp;
+
+    if (cmp > 0) {
+      iter->at_base = 1;
+      return;
+    }
+
+    if (type == LDB_TYPE_DELETION) {
+      if (cmp == 0)
+        ldb_ibiter_step_base(iter);
+
+      ldb_ibiter_step_delta(iter);
+      continue;
+    }
+
+    iter->at_base = 0;
+    iter->equal = (cmp == 0);
+
+    return;
+  }
+}
+
+static void
+ldb_ibiter_clear(ldb_ibiter_t *iter) {
+  if (iter->base != NULL)
+    ldb_iter_destroy(iter->base);
+
+  ldb_buffer_clear(&iter->saved);
+}
+
+static int
+ldb_ibiter_valid(const ldb_ibiter_t *iter) {
+  if (iter->at_base)
+    return ldb_ibiter_base_valid(iter);
+
+  return rb_iter_valid(&iter->delta);
+}
+
+static ldb_slice_t
+ldb_ibiter_key(const ldb_ibiter_t *iter) {
+  assert(ldb_ibiter_valid(iter));
+
+  if (iter->at_base)
+    return ldb_iter_key(iter->base);
+
+  return ldb_ibiter_delta_key(iter);
+}
+
+static ldb_slice_t
+ldb_ibiter_value(const ldb_ibiter_t *iter) {
+  ldb_slice_t key, value;
+
+  assert(ldb_ibiter_valid(iter));
+
+  if (iter->at_base)
+    return ldb_iter_value(iter->base);
+
+  ldb_ibiter_delta_type(iter, &key, &value);
+
+  return value;
+}
+
+static int
+ldb_ibiter_status(const ldb_ibiter_t *iter) {
+  if (iter->base != NULL)
+    return ldb_iter_status(iter->base);
+
+  return LDB_OK;
+}
+
+static void
+ldb_ibiter_first(ldb_ibiter_t *iter) {
+  rb_iter_init(&iter->delta, &iter->ib->index);
+  rb_iter_first(&iter->delta);
+
+  if (iter->base != NULL)
+    ldb_iter_first(iter->base);
+
+  iter->direction = LDB_FORWARD;
+
+  ldb_ibiter_update(iter);
+}
+
+static void
+ldb_ibiter_last(ldb_ibiter_t *iter) {
+  rb_iter_init(&iter->delta, &iter->ib->index);
+  rb_iter_last(&iter->delta);
+
+  if (iter->base != NULL)
+    ldb_iter_last(iter->base);
+
+  iter->direction = LDB_REVERSE;
+
+  ldb_ibiter_update(iter);
+}
+
+static void
+ldb_ibiter_seek(ldb_ibiter_t *iter, const ldb_slice_t *target) {
+  ldb_ientry_t probe;
+
+  probe.offset = 0;
+  probe.probe = target;
+
+  rb_iter_init(&iter->delta, &iter->ib->index);
+  rb_iter_seek(&iter->delta, rb_ptr(&probe));
+
+  if (iter->base != NULL)
+    ldb_iter_seek(iter->base, target);
+
+  iter->direction = LDB_FORWARD;
+
+  ldb_ibiter_update(iter);
+}
+
+/* Position both sides just past (or just before) the current key
+   when the direction changes. */
+static void
+ldb_ibiter_turn(ldb_ibiter_t *iter, enum ldb_direction direction) {
+  const ldb_comparator_t *ucmp = iter->ib->ucmp;
+  ldb_slice_t key = ldb_ibiter_key(iter);
+  ldb_ientry_t probe;
+
+  ldb_buffer_set(&iter->saved, key.data, key.size);
+
+  probe.offset = 0;
+  probe.probe = &iter->saved;
+
+  rb_iter_seek(&iter->delta, rb_ptr(&probe));
+
+  if (iter->base != NULL)
+    ldb_iter_seek(iter->base, &iter->saved);
+
+  if (direction == LDB_FORWARD) {
+    if (rb_iter_valid(&iter->delta)) {
+      key = ldb_ibiter_delta_key(iter);
+
+      if (ldb_compare(ucmp, &key, &iter->saved) == 0)
+        rb_iter_next(&iter->delta);
+    }
+
+    if (ldb_ibiter_base_valid(iter)) {
+      key = ldb_iter_key(iter->base);
+
+      if (ldb_compare(ucmp, &key, &iter->saved) == 0)
+        ldb_iter_next(iter->base);
+    }
+  } else {
+    if (rb_iter_valid(&iter->delta))
+      rb_iter_prev(&iter->delta);
+    else
+      rb_iter_last(&iter->delta);
+
+    if (iter->base != NULL) {
+      if (ldb_iter_valid(iter->base))
+        ldb_iter_prev(iter->base);
+      else
+        ldb_iter_last(iter->base);
+    }
+  }
+
+  iter->direction = direction;
+}
+
+static void
+ldb_ibiter_next(ldb_ibiter_t *iter) {
+  assert(ldb_ibiter_valid(iter));
+
+  if (iter->direction != LDB_FORWARD) {
+    ldb_ibiter_turn(iter, LDB_FORWARD);
+  } else if (iter->at_base) {
+    ldb_iter_next(iter->base);
+  } else {
+    rb_iter_next(&iter->delta);
+
+    if (iter->equal)
+      ldb_iter_next(iter->base);
+  }
+
+  ldb_ibiter_update(iter);
+}
+
+static void
+ldb_ibiter_prev(ldb_ibiter_t *iter) {
+  assert(ldb_ibiter_valid(iter));
+
+  if (iter->direction != LDB_REVERSE) {
+    ldb_ibiter_turn(iter, LDB_REVERSE);
+  } else if (iter->at_base) {
+    ldb_iter_prev(iter->base);
+  } else {
+    rb_iter_prev(&iter->delta);
+
+    if (iter->equal)
+      ldb_iter_prev(iter->base);
+  }
+
+  ldb_ibiter_update(iter);
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_ibiter);
+
+ldb_iter_t *
+ldb_ibatch_iterator(const ldb_ibatch_t *ib, ldb_iter_t *base) {
+  ldb_ibiter_t *iter = ldb_malloc(sizeof(ldb_ibiter_t));
+
+  iter->ib = ib;
+  iter->base = base;
+  iter->direction = LDB_FORWARD;
+  iter->at_base = 1;
+  iter->equal = 0;
+
+  rb_iter_init(&iter->delta, &ib->index);
+
+  ldb_buffer_init(&iter->saved);
+
+  return ldb_iter_create(iter, &ldb_ibiter_table, ib->ucmp);
+}
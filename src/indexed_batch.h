@@ -0,0 +1,78 @@
+/*!
+ * indexed_batch.h - indexed write batch for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_INDEXED_BATCH_H
+#define LDB_INDEXED_BATCH_H
+
+#include "util/extern.h"
+#include "util/options.h"
+#include "util/types.h"
+
+/*
+ * Types
+ */
+
+struct ldb_batch_s;
+struct ldb_comparator_s;
+struct ldb_iter_s;
+struct ldb_s;
+
+/* A write batch which also keeps its keys in a search tree, so that
+   pending updates can be read back before the batch is written (for
+   example by a transaction, see ldb_txn_create()). Only puts and
+   deletions may be added. The batch must not be modified while an
+   iterator over it is live. */
+typedef struct ldb_ibatch_s ldb_ibatch_t;
+
+/*
+ * IndexedBatch
+ */
+
+/* Keys are ordered by "comparator", which must be the comparator
+   of the database the batch is read against (bytewise if NULL). */
+LDB_EXTERN ldb_ibatch_t *
+ldb_ibatch_create(const struct ldb_comparator_s *comparator);
+
+LDB_EXTERN void
+ldb_ibatch_destroy(ldb_ibatch_t *ib);
+
+/* Clear all updates buffered in this batch. */
+LDB_EXTERN void
+ldb_ibatch_reset(ldb_ibatch_t *ib);
+
+LDB_EXTERN void
+ldb_ibatch_put(ldb_ibatch_t *ib,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value);
+
+LDB_EXTERN void
+ldb_ibatch_del(ldb_ibatch_t *ib, const ldb_slice_t *key);
+
+/* The underlying batch, to be passed to ldb_write() or
+   ldb_txn_commit(). */
+LDB_EXTERN struct ldb_batch_s *
+ldb_ibatch_batch(ldb_ibatch_t *ib);
+
+/* Look "key" up in the batch, falling back to the database if the
+   batch does not update it. "db" may be NULL to read the batch alone.
+   The value is returned as with ldb_get(). */
+LDB_EXTERN int
+ldb_ibatch_get(const ldb_ibatch_t *ib,
+               struct ldb_s *db,
+               const ldb_slice_t *key,
+               ldb_slice_t *value,
+               const ldb_readopt_t *options);
+
+/* Return an iterator over the batch layered on top of "base" (usually
+   from ldb_iterator(); may be NULL). Keys put by the batch shadow those
+   of "base" and keys it deletes are skipped. The iterator takes
+   ownership of "base". */
+LDB_EXTERN struct ldb_iter_s *
+ldb_ibatch_iterator(const ldb_ibatch_t *ib, struct ldb_iter_s *base);
+
+#endif /* LDB_INDEXED_BATCH_H */
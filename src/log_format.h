@@ -20,14 +20,27 @@ typedef enum ldb_rectype {
   /* For fragments. */
   LDB_TYPE_FIRST = 2,
   LDB_TYPE_MIDDLE = 3,
-  LDB_TYPE_LAST = 4
+  LDB_TYPE_LAST = 4,
+  /* Like FULL and FIRST, for a record which is compressed: its first
+     byte is the compression type, followed by the compressed data
+     (encoded as a table block would be). */
+  LDB_TYPE_ZFULL = 5,
+  LDB_TYPE_ZFIRST = 6
 } ldb_rectype_t;
 
-#define LDB_MAX_RECTYPE LDB_TYPE_LAST
+#define LDB_MAX_RECTYPE LDB_TYPE_ZFIRST
 
 #define LDB_BLOCK_SIZE 32768
 
 /* Header is checksum (4 bytes), length (2 bytes), type (1 byte). */
 #define LDB_HEADER_SIZE (4 + 2 + 1)
 
+/* Logs which may be recycled (see recycle_log_file_num) set this bit
+   in the type of every record, and follow the type with the low 32
+   bits of the log number (covered by the checksum). Records left over
+   from the file's previous use are recognized by their number. */
+#define LDB_TYPE_RECYCLABLE 0x80
+
+#define LDB_RECYCLABLE_HEADER_SIZE (LDB_HEADER_SIZE + 4)
+
 #endif /* LDB_LOG_FORMAT_H */
@@ -23,6 +23,8 @@
 #include "util/slice.h"
 #include "util/status.h"
 
+#include "table/format.h"
+
 #include "log_format.h"
 #include "log_reader.h"
 
@@ -61,8 +63,13 @@ ldb_reader_init(ldb_reader_t *lr,
   lr->reporter = reporter;
   lr->checksum = checksum;
   lr->backing_store = ldb_malloc(LDB_BLOCK_SIZE);
+  lr->block_size = LDB_BLOCK_SIZE;
+  lr->inflated = NULL;
   ldb_slice_init(&lr->buffer);
   lr->eof = 0;
+  lr->log_number = 0;
+  lr->recycled = 0;
+  lr->header_size = LDB_HEADER_SIZE;
   lr->last_offset = 0;
   lr->end_offset = 0;
   lr->initial_offset = initial_offset;
@@ -72,6 +79,20 @@ ldb_reader_init(ldb_reader_t *lr,
 void
 ldb_reader_clear(ldb_reader_t *lr) {
   ldb_free(lr->backing_store);
+
+  if (lr->inflated != NULL)
+    ldb_free(lr->inflated);
+}
+
+void
+ldb_reader_block_size(ldb_reader_t *lr, size_t size) {
+  lr->backing_store = ldb_realloc(lr->backing_store, size);
+  lr->block_size = size;
+}
+
+void
+ldb_reader_recyclable(ldb_reader_t *lr, uint64_t number) {
+  lr->log_number = (uint32_t)number;
 }
 
 /* Reports dropped bytes to the reporter. */
@@ -95,9 +116,12 @@ static unsigned int
 read_physical_record(ldb_reader_t *lr, ldb_slice_t *result) {
   const uint8_t *header;
   uint32_t a, b, length;
+  size_t header_size;
   unsigned int type;
   int rc;
 
+  lr->header_size = LDB_HEADER_SIZE;
+
   for (;;) {
     if (lr->buffer.size < LDB_HEADER_SIZE) {
       if (!lr->eof) {
@@ -107,7 +131,7 @@ read_physical_record(ldb_reader_t *lr, ldb_slice_t *result) {
         if (lr->error != LDB_OK) {
           rc = lr->error;
         } else if (lr->src != NULL) {
-          size_t nread = LDB_MIN(LDB_BLOCK_SIZE, lr->src->size);
+          size_t nread = LDB_MIN(lr->block_size, lr->src->size);
 
           lr->buffer.data = lr->src->data;
           lr->buffer.size = nread;
@@ -122,19 +146,19 @@ read_physical_record(ldb_reader_t *lr, ldb_slice_t *result) {
           rc = ldb_rfile_read(lr->file,
                               &lr->buffer,
                               lr->backing_store,
-                              LDB_BLOCK_SIZE);
+                              lr->block_size);
         }
 
         lr->end_offset += lr->buffer.size;
 
         if (rc != LDB_OK) {
           ldb_slice_reset(&lr->buffer);
-          report_drop(lr, LDB_BLOCK_SIZE, rc);
+          report_drop(lr, lr->block_size, rc);
           lr->eof = 1;
           return LDB_EOF;
         }
 
-        if (lr->buffer.size < LDB_BLOCK_SIZE)
+        if (lr->buffer.size < lr->block_size)
           lr->eof = 1;
 
         continue;
@@ -155,12 +179,20 @@ read_physical_record(ldb_reader_t *lr, ldb_slice_t *result) {
     b = (uint32_t)header[5] & 0xff;
     type = header[6];
     length = a | (b << 8);
+    header_size = LDB_HEADER_SIZE;
 
-    if (LDB_HEADER_SIZE + length > lr->buffer.size) {
+    if (type & LDB_TYPE_RECYCLABLE)
+      header_size = LDB_RECYCLABLE_HEADER_SIZE;
+
+    if (header_size + length > lr->buffer.size) {
       size_t drop_size = lr->buffer.size;
 
       ldb_slice_reset(&lr->buffer);
 
+      /* Stale data past the end of a recycled log. */
+      if (lr->recycled)
+        return LDB_EOF;
+
       if (!lr->eof) {
         report_corruption(lr, drop_size, "bad record length");
         return LDB_BAD_RECORD;
@@ -184,7 +216,8 @@ read_physical_record(ldb_reader_t *lr, ldb_slice_t *result) {
     /* Check crc. */
     if (lr->checksum) {
       uint32_t expect = ldb_crc32c_unmask(ldb_fixed32_decode(header));
-      uint32_t actual = ldb_crc32c_value(header + 6, 1 + length);
+      uint32_t actual = ldb_crc32c_value(header + 6,
+                                         header_size - 6 + length);
 
       if (actual != expect) {
         /* Drop the rest of the buffer since "length" itself may have
@@ -195,39 +228,96 @@ read_physical_record(ldb_reader_t *lr, ldb_slice_t *result) {
 
         ldb_slice_reset(&lr->buffer);
 
+        if (lr->recycled)
+          return LDB_EOF;
+
         report_corruption(lr, drop_size, "checksum mismatch");
 
         return LDB_BAD_RECORD;
       }
     }
 
-    ldb_slice_eat(&lr->buffer, LDB_HEADER_SIZE + length);
+    if (type & LDB_TYPE_RECYCLABLE) {
+      uint32_t number = ldb_fixed32_decode(header + 7);
+
+      if (lr->log_number != 0 && number != lr->log_number) {
+        /* Left over from the file's previous use. */
+        ldb_slice_reset(&lr->buffer);
+        return LDB_EOF;
+      }
+
+      lr->recycled = 1;
+
+      type &= ~LDB_TYPE_RECYCLABLE;
+    } else if (lr->recycled) {
+      ldb_slice_reset(&lr->buffer);
+      return LDB_EOF;
+    }
+
+    ldb_slice_eat(&lr->buffer, header_size + length);
+
+    lr->header_size = header_size;
 
     /* Skip physical record that started before initial_offset. */
-    if (lr->end_offset - lr->buffer.size - LDB_HEADER_SIZE - length <
+    if (lr->end_offset - lr->buffer.size - header_size - length <
         lr->initial_offset) {
       ldb_slice_reset(result);
       return LDB_BAD_RECORD;
     }
 
-    ldb_slice_set(result, header + LDB_HEADER_SIZE, length);
+    ldb_slice_set(result, header + header_size, length);
 
     return type;
   }
 }
 
+/* Decompress a record written as ZFULL/ZFIRST in place of *record.
+ *
+ * Returns true on success. Handles reporting.
+ */
+static int
+inflate_record(ldb_reader_t *lr, ldb_slice_t *record) {
+  ldb_contents_t raw, result;
+  int rc = LDB_CORRUPTION;
+
+  if (record->size > 0) {
+    ldb_contents_init(&raw);
+    ldb_slice_set(&raw.data, record->data + 1, record->size - 1);
+
+    rc = ldb_decode_block(&result, &raw, record->data[0], NULL);
+  }
+
+  if (rc != LDB_OK) {
+    report_drop(lr, record->size, rc);
+    ldb_slice_reset(record);
+    return 0;
+  }
+
+  if (lr->inflated != NULL)
+    ldb_free(lr->inflated);
+
+  lr->inflated = NULL;
+
+  if (result.heap_allocated)
+    lr->inflated = (uint8_t *)result.data.data;
+
+  *record = result.data;
+
+  return 1;
+}
+
 /* Skips all blocks that are completely before "initial_offset".
  *
  * Returns true on success. Handles reporting.
  */
 static int
 skip_to_initial_block(ldb_reader_t *lr) {
-  size_t offset_in_block = lr->initial_offset % LDB_BLOCK_SIZE;
+  size_t offset_in_block = lr->initial_offset % lr->block_size;
   uint64_t block_start = lr->initial_offset - offset_in_block;
 
   /* Don't search a block if we'd be in the trailer. */
-  if (offset_in_block > LDB_BLOCK_SIZE - 6)
-    block_start += LDB_BLOCK_SIZE;
+  if (offset_in_block > lr->block_size - 6)
+    block_start += lr->block_size;
 
   lr->end_offset = block_start;
 
@@ -263,6 +353,7 @@ ldb_reader_read_record(ldb_reader_t *lr,
      0 is a dummy value to make compilers happy. */
   uint64_t prospective_offset = 0;
   int in_fragmented_record = 0;
+  int compressed = 0;
   ldb_slice_t fragment;
 
   if (lr->last_offset < lr->initial_offset) {
@@ -281,7 +372,7 @@ ldb_reader_read_record(ldb_reader_t *lr,
        that it has returned, properly accounting for its header size. */
     uint64_t physical_offset = (lr->end_offset -
                                 lr->buffer.size -
-                                LDB_HEADER_SIZE -
+                                lr->header_size -
                                 fragment.size);
 
     if (lr->resyncing) {
@@ -297,7 +388,8 @@ ldb_reader_read_record(ldb_reader_t *lr,
     }
 
     switch (record_type) {
-      case LDB_TYPE_FULL: {
+      case LDB_TYPE_FULL:
+      case LDB_TYPE_ZFULL: {
         if (in_fragmented_record) {
           /* Handle bug in earlier versions of LogWriter where it could
              emit an empty LDB_TYPE_FIRST record at the tail end of a
@@ -313,14 +405,20 @@ ldb_reader_read_record(ldb_reader_t *lr,
 
         ldb_buffer_reset(scratch);
 
+        in_fragmented_record = 0;
+
         *record = fragment;
 
         lr->last_offset = prospective_offset;
 
+        if (record_type == LDB_TYPE_ZFULL && !inflate_record(lr, record))
+          break;
+
         return 1;
       }
 
-      case LDB_TYPE_FIRST: {
+      case LDB_TYPE_FIRST:
+      case LDB_TYPE_ZFIRST: {
         if (in_fragmented_record) {
           /* Handle bug in earlier versions of LogWriter where
              it could emit an empty LDB_TYPE_FIRST record at the tail end
@@ -337,6 +435,7 @@ ldb_reader_read_record(ldb_reader_t *lr,
         ldb_buffer_set(scratch, fragment.data, fragment.size);
 
         in_fragmented_record = 1;
+        compressed = (record_type == LDB_TYPE_ZFIRST);
 
         break;
       }
@@ -363,6 +462,12 @@ ldb_reader_read_record(ldb_reader_t *lr,
 
           lr->last_offset = prospective_offset;
 
+          if (compressed && !inflate_record(lr, record)) {
+            in_fragmented_record = 0;
+            ldb_buffer_reset(scratch);
+            break;
+          }
+
           return 1;
         }
 
@@ -46,8 +46,18 @@ typedef struct ldb_reader_s {
   ldb_reporter_t *reporter;
   int checksum;
   uint8_t *backing_store;
+  size_t block_size;
+  uint8_t *inflated; /* Last decompressed record. */
   ldb_slice_t buffer;
-  int eof; /* Last read() indicated EOF by returning < LDB_BLOCK_SIZE. */
+  int eof; /* Last read() indicated EOF by returning < block_size. */
+
+  /* Number carried by the records of a recycled log (zero if unknown),
+     and whether any such record has been read. */
+  uint32_t log_number;
+  int recycled;
+
+  /* Header size of the last physical record. */
+  size_t header_size;
 
   /* Offset of the last record returned by read_record. */
   uint64_t last_offset;
@@ -90,6 +100,21 @@ ldb_reader_init(ldb_reader_t *lr,
 void
 ldb_reader_clear(ldb_reader_t *lr);
 
+/* Read a log written in blocks of "size" bytes (see
+ * ldb_writer_block_size()). Must be called before the first read.
+ */
+void
+ldb_reader_block_size(ldb_reader_t *lr, size_t size);
+
+/* Expect recyclable records (see log_format.h) to carry "number". The
+ * log ends at the first record which does not: in a recycled file, it
+ * was left over from the file's previous use. A bad checksum or length
+ * past the recyclable records also ends the log rather than being
+ * reported, since the file holds stale data past its end.
+ */
+void
+ldb_reader_recyclable(ldb_reader_t *lr, uint64_t number);
+
 /* Read the next record into *record. Returns true if read
  * successfully, false if we hit end of the input. May use
  * "*scratch" as temporary storage. The contents filled in *record
@@ -19,9 +19,12 @@
 #include "util/crc32c.h"
 #include "util/env.h"
 #include "util/internal.h"
+#include "util/options.h"
 #include "util/slice.h"
 #include "util/status.h"
 
+#include "table/format.h"
+
 #include "log_format.h"
 #include "log_writer.h"
 
@@ -46,6 +49,7 @@ ldb_writer_create(ldb_wfile_t *file, uint64_t length) {
 
 void
 ldb_writer_destroy(ldb_writer_t *lw) {
+  ldb_buffer_clear(&lw->compressed);
   ldb_free(lw);
 }
 
@@ -53,22 +57,91 @@ void
 ldb_writer_init(ldb_writer_t *lw, ldb_wfile_t *file, uint64_t length) {
   lw->file = file;
   lw->dst = NULL; /* For testing. */
+  lw->length = length;
+  lw->block_size = LDB_BLOCK_SIZE;
   lw->block_offset = length % LDB_BLOCK_SIZE;
+  lw->compression = LDB_NO_COMPRESSION;
+  lw->recyclable = 0;
+  lw->iovcnt = 0;
+  lw->log_number = 0;
+  lw->manual_flush = 0;
+  ldb_buffer_init(&lw->compressed);
   init_type_crc(lw->type_crc);
 }
 
+void
+ldb_writer_compress(ldb_writer_t *lw, int type) {
+  lw->compression = type;
+}
+
+void
+ldb_writer_block_size(ldb_writer_t *lw, int size) {
+  assert(size >= LDB_RECYCLABLE_HEADER_SIZE);
+
+  lw->block_size = size;
+  lw->block_offset = lw->length % size;
+}
+
+void
+ldb_writer_recyclable(ldb_writer_t *lw, uint64_t number) {
+  lw->recyclable = 1;
+  lw->log_number = (uint32_t)number;
+}
+
+void
+ldb_writer_manual_flush(ldb_writer_t *lw) {
+  lw->manual_flush = 1;
+}
+
+int
+ldb_writer_flush(ldb_writer_t *lw) {
+  if (lw->dst != NULL)
+    return LDB_OK;
+
+  return ldb_wfile_flush(lw->file);
+}
+
+static int
+writer_spill(ldb_writer_t *lw) {
+  int rc = LDB_OK;
+
+  if (lw->iovcnt > 0)
+    rc = ldb_wfile_appendv(lw->file, lw->iov, lw->iovcnt);
+
+  lw->iovcnt = 0;
+
+  return rc;
+}
+
+static int
+writer_gather(ldb_writer_t *lw, const uint8_t *ptr, size_t length) {
+  int rc = LDB_OK;
+
+  if (lw->iovcnt == LDB_WRITER_IOV)
+    rc = writer_spill(lw);
+
+  ldb_slice_set(&lw->iov[lw->iovcnt++], ptr, length);
+
+  return rc;
+}
+
 static int
 emit_physical_record(ldb_writer_t *lw,
                      ldb_rectype_t type,
                      const uint8_t *ptr,
                      size_t length) {
-  uint8_t buf[LDB_HEADER_SIZE];
-  ldb_slice_t data;
+  size_t header_size = LDB_HEADER_SIZE;
+  uint8_t *buf;
   int rc = LDB_OK;
   uint32_t crc;
 
   assert(length <= 0xffff); /* Must fit in two bytes. */
-  assert(lw->block_offset + LDB_HEADER_SIZE + length <= LDB_BLOCK_SIZE);
+
+  /* The header and the payload go out together. */
+  if (lw->dst == NULL && lw->iovcnt + 2 > LDB_WRITER_IOV)
+    rc = writer_spill(lw);
+
+  buf = lw->headers[lw->iovcnt];
 
   /* Format the header. */
   buf[4] = (uint8_t)(length & 0xff);
@@ -76,92 +149,153 @@ emit_physical_record(ldb_writer_t *lw,
   buf[6] = (uint8_t)(type);
 
   /* Compute the crc of the record type and the payload. */
-  crc = ldb_crc32c_extend(lw->type_crc[type], ptr, length);
-  crc = ldb_crc32c_mask(crc); /* Adjust for storage. */
+  if (lw->recyclable) {
+    header_size = LDB_RECYCLABLE_HEADER_SIZE;
 
-  ldb_fixed32_write(buf, crc);
+    buf[6] |= LDB_TYPE_RECYCLABLE;
 
-  if (lw->dst != NULL) {
-    ldb_buffer_append(lw->dst, buf, LDB_HEADER_SIZE);
-    ldb_buffer_append(lw->dst, ptr, length);
+    ldb_fixed32_write(buf + 7, lw->log_number);
+
+    crc = ldb_crc32c_value(buf + 6, header_size - 6);
   } else {
-    /* Write the header and the payload. */
-    ldb_slice_set(&data, buf, LDB_HEADER_SIZE);
+    crc = lw->type_crc[type];
+  }
 
-    rc = ldb_wfile_append(lw->file, &data);
+  assert(lw->block_offset + header_size + length <= (size_t)lw->block_size);
 
-    if (rc == LDB_OK) {
-      ldb_slice_set(&data, ptr, length);
+  crc = ldb_crc32c_extend(crc, ptr, length);
+  crc = ldb_crc32c_mask(crc); /* Adjust for storage. */
 
-      rc = ldb_wfile_append(lw->file, &data);
+  ldb_fixed32_write(buf, crc);
 
-      if (rc == LDB_OK)
-        rc = ldb_wfile_flush(lw->file);
-    }
+  if (lw->dst != NULL) {
+    ldb_buffer_append(lw->dst, buf, header_size);
+    ldb_buffer_append(lw->dst, ptr, length);
+  } else {
+    ldb_slice_set(&lw->iov[lw->iovcnt++], buf, header_size);
+    ldb_slice_set(&lw->iov[lw->iovcnt++], ptr, length);
   }
 
-  lw->block_offset += LDB_HEADER_SIZE + length;
+  lw->block_offset += header_size + length;
 
   return rc;
 }
 
-int
-ldb_writer_add_record(ldb_writer_t *lw, const ldb_slice_t *slice) {
-  static const uint8_t zeroes[LDB_HEADER_SIZE] = {0};
+static int
+writer_emit(ldb_writer_t *lw, const ldb_slice_t *slice) {
+  static const uint8_t zeroes[LDB_RECYCLABLE_HEADER_SIZE] = {0};
+  int header_size = lw->recyclable ? LDB_RECYCLABLE_HEADER_SIZE
+                                   : LDB_HEADER_SIZE;
   const uint8_t *ptr = slice->data;
   size_t left = slice->size;
+  int compressed = 0;
   int rc = LDB_OK;
   int begin = 1;
 
+  if (lw->compression != LDB_NO_COMPRESSION && left > 0) {
+    ldb_buffer_t *z = &lw->compressed;
+
+    ldb_buffer_reset(z);
+    ldb_buffer_push(z, lw->compression);
+
+    if (ldb_encode_block(z, lw->compression, slice)
+        && z->size < left - (left / 8)) {
+      ptr = z->data;
+      left = z->size;
+      compressed = 1;
+    }
+  }
+
   /* Fragment the record if necessary and emit it. Note that if slice
      is empty, we still want to iterate once to emit a single
      zero-length record. */
   do {
-    int leftover = LDB_BLOCK_SIZE - lw->block_offset;
+    int leftover = lw->block_size - lw->block_offset;
     size_t avail, fragment_length;
     ldb_rectype_t type;
     int end;
 
     assert(leftover >= 0);
 
-    if (leftover < LDB_HEADER_SIZE) {
+    if (leftover < header_size) {
       /* Switch to a new block. */
       if (leftover > 0) {
         /* Fill the trailer. */
-        ldb_slice_t padding;
-
-        ldb_slice_set(&padding, zeroes, leftover);
-
         if (lw->dst != NULL)
-          ldb_buffer_concat(lw->dst, &padding);
+          ldb_buffer_append(lw->dst, zeroes, leftover);
         else
-          ldb_wfile_append(lw->file, &padding);
+          rc = writer_gather(lw, zeroes, leftover);
       }
 
       lw->block_offset = 0;
     }
 
-    /* Invariant: we never leave < LDB_HEADER_SIZE bytes in a block. */
-    assert(LDB_BLOCK_SIZE - lw->block_offset - LDB_HEADER_SIZE >= 0);
+    /* Invariant: we never leave < header_size bytes in a block. */
+    assert(lw->block_size - lw->block_offset - header_size >= 0);
+
+    avail = lw->block_size - lw->block_offset - header_size;
+
+    /* Blocks larger than 64kb hold several fragments. */
+    if (avail > 0xffff)
+      avail = 0xffff;
 
-    avail = LDB_BLOCK_SIZE - lw->block_offset - LDB_HEADER_SIZE;
     fragment_length = (left < avail) ? left : avail;
     end = (left == fragment_length);
 
     if (begin && end)
-      type = LDB_TYPE_FULL;
+      type = compressed ? LDB_TYPE_ZFULL : LDB_TYPE_FULL;
     else if (begin)
-      type = LDB_TYPE_FIRST;
+      type = compressed ? LDB_TYPE_ZFIRST : LDB_TYPE_FIRST;
     else if (end)
       type = LDB_TYPE_LAST;
     else
       type = LDB_TYPE_MIDDLE;
 
-    rc = emit_physical_record(lw, type, ptr, fragment_length);
+    if (rc == LDB_OK)
+      rc = emit_physical_record(lw, type, ptr, fragment_length);
+
     ptr += fragment_length;
     left -= fragment_length;
     begin = 0;
   } while (rc == LDB_OK && left > 0);
 
+  /* The compression buffer is reused by the next record. */
+  if (compressed && lw->dst == NULL && rc == LDB_OK)
+    rc = writer_spill(lw);
+
+  return rc;
+}
+
+static int
+writer_finish(ldb_writer_t *lw, int rc) {
+  /* Write every fragment at once. */
+  if (lw->dst == NULL) {
+    if (rc == LDB_OK)
+      rc = writer_spill(lw);
+
+    lw->iovcnt = 0;
+
+    if (rc == LDB_OK && !lw->manual_flush)
+      rc = ldb_wfile_flush(lw->file);
+  }
+
   return rc;
 }
+
+int
+ldb_writer_add_record(ldb_writer_t *lw, const ldb_slice_t *slice) {
+  return writer_finish(lw, writer_emit(lw, slice));
+}
+
+int
+ldb_writer_add_records(ldb_writer_t *lw,
+                       const ldb_slice_t *slices,
+                       size_t count) {
+  int rc = LDB_OK;
+  size_t i;
+
+  for (i = 0; i < count && rc == LDB_OK; i++)
+    rc = writer_emit(lw, &slices[i]);
+
+  return writer_finish(lw, rc);
+}
@@ -18,6 +18,13 @@
 #include "util/types.h"
 #include "log_format.h"
 
+/*
+ * Constants
+ */
+
+/* Slices gathered into a single vectored append. */
+#define LDB_WRITER_IOV 64
+
 /*
  * Types
  */
@@ -27,7 +34,20 @@ struct ldb_wfile_s;
 typedef struct ldb_writer_s {
   struct ldb_wfile_s *file;
   ldb_buffer_t *dst; /* For testing. */
+  uint64_t length; /* Initial length of the file. */
+  int block_size; /* LDB_BLOCK_SIZE unless set otherwise. */
   int block_offset; /* Current offset in block. */
+  int compression; /* Compression type of records. */
+  int recyclable; /* Write recyclable records. */
+  uint32_t log_number;
+  int manual_flush; /* Leave records buffered until flushed. */
+  ldb_buffer_t compressed;
+
+  /* Headers, payloads and padding of the record being added. They
+     reach the file in one append once the record is complete. */
+  ldb_slice_t iov[LDB_WRITER_IOV];
+  uint8_t headers[LDB_WRITER_IOV][LDB_RECYCLABLE_HEADER_SIZE];
+  int iovcnt;
 
   /* crc32c values for all supported record types. These are
      pre-computed to reduce the overhead of computing the crc of the
@@ -54,7 +74,36 @@ ldb_writer_init(ldb_writer_t *lw,
                 struct ldb_wfile_s *file,
                 uint64_t length);
 
+/* Compress records with the specified type from now on. Records which
+   do not shrink by at least 12.5% are written as they are. */
+void
+ldb_writer_compress(ldb_writer_t *lw, int type);
+
+/* Lay records out in blocks of "size" bytes rather than LDB_BLOCK_SIZE.
+   Must be called before the first record is added. */
+void
+ldb_writer_block_size(ldb_writer_t *lw, int size);
+
+/* Write records in the recyclable format, tagged with "number". */
+void
+ldb_writer_recyclable(ldb_writer_t *lw, uint64_t number);
+
+/* Stop flushing the file after every record. Buffered records reach
+   the file when the buffer fills, or on ldb_writer_flush(). */
+void
+ldb_writer_manual_flush(ldb_writer_t *lw);
+
+int
+ldb_writer_flush(ldb_writer_t *lw);
+
 int
 ldb_writer_add_record(ldb_writer_t *lw, const ldb_slice_t *slice);
 
+/* Add each slice as its own record, with a single write (and flush)
+   for all of them. */
+int
+ldb_writer_add_records(ldb_writer_t *lw,
+                       const ldb_slice_t *slices,
+                       size_t count);
+
 #endif /* LDB_LOG_WRITER_H */
@@ -11,8 +11,10 @@
  */
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "table/iterator.h"
 
@@ -21,15 +23,46 @@
 #include "util/buffer.h"
 #include "util/coding.h"
 #include "util/comparator.h"
+#include "util/hash.h"
 #include "util/internal.h"
+#include "util/mergeop.h"
+#include "util/options.h"
+#include "util/pinned.h"
 #include "util/port.h"
+#include "util/prefix.h"
 #include "util/slice.h"
 #include "util/status.h"
+#include "util/vector.h"
 
 #include "dbformat.h"
 #include "memtable.h"
 #include "skiplist.h"
 
+/*
+ * Constants
+ */
+
+/* Probes per key. All probes for a key fall into a single
+   64 byte line (16 words) to keep it to one cache miss. */
+#define LDB_MEMBLOOM_PROBES 6
+#define LDB_MEMBLOOM_LINE 16
+
+/* Point lookups in a vector memtable scan up to this many unsorted
+   entries before sorting them in. */
+#define LDB_MEMVEC_SCAN 256
+
+/*
+ * Types
+ */
+
+/* A sorted array of entries. Shared by the iterators created while
+   it was current, and freed once the last of them is gone. */
+typedef struct ldb_memvec_s {
+  int refs;
+  size_t length;
+  void *items[1];
+} ldb_memvec_t;
+
 /*
  * MemTable
  */
@@ -38,44 +71,150 @@ struct ldb_memtable_s {
   ldb_comparator_t comparator;
   int refs;
   ldb_arena_t arena;
-#ifndef LDB_HAVE_ATOMICS
   ldb_mutex_t mutex;
-#endif
+  enum ldb_memtable_rep rep;
+  int prefixed; /* Skiplists keep key prefixes in their nodes. */
   ldb_skiplist_t table;
+  ldb_skiplist_t range_dels; /* Range tombstones (see src/rangedel.h). */
+  ldb_atomic(uint32_t) *bloom; /* Bloom filter over user keys (optional). */
+  uint32_t bloom_lines;
+  /* LDB_MEMTABLE_HASH_SKIPLIST: one skiplist per hash of the prefix. */
+  const ldb_prefix_t *prefix;
+  ldb_atomic_ptr(struct ldb_skiplist_s) *buckets;
+  uint32_t bucket_count;
+  /* Vector and hash memtables: every entry, in the order added. */
+  ldb_mutex_t vec_mutex; /* Guards the fields below. */
+  ldb_vector_t pending; /* Entries which are not yet in "sorted". */
+  ldb_memvec_t *sorted;
+  ldb_atomic(size_t) vec_usage;
+  /* Point entries added, and their encoded size. */
+  ldb_atomic(size_t) entries;
+  ldb_atomic(size_t) data_size;
 };
 
 static void
-ldb_memtable_init(ldb_memtable_t *mt, const ldb_comparator_t *comparator) {
+ldb_memtable_init(ldb_memtable_t *mt,
+                  const ldb_comparator_t *comparator,
+                  const ldb_dbopt_t *options,
+                  const ldb_prefix_t *prefix,
+                  ldb_arenapool_t *pool) {
+  size_t bloom_size = options->memtable_bloom_size;
+
   assert(comparator->user_comparator != NULL);
 
   mt->comparator = *comparator;
   mt->refs = 0;
 
-  ldb_arena_init(&mt->arena);
-
-#ifdef LDB_HAVE_ATOMICS
-  ldb_skiplist_init(&mt->table, &mt->comparator, &mt->arena, NULL);
-#else
+  if (pool != NULL)
+    ldb_arena_init_pool(&mt->arena, pool);
+  else
+    ldb_arena_init(&mt->arena);
   ldb_mutex_init(&mt->mutex);
+
+  switch (options->memtable_rep) {
+    case LDB_MEMTABLE_VECTOR:
+    case LDB_MEMTABLE_HASH_SKIPLIST:
+      mt->rep = options->memtable_rep;
+      break;
+    default:
+      mt->rep = LDB_MEMTABLE_SKIPLIST;
+      break;
+  }
+
+  /* Prefixes order keys as memcmp does. */
+  mt->prefixed = options->memtable_inline_prefix
+              && strcmp(comparator->user_comparator->name,
+                        ldb_bytewise_comparator->name) == 0;
+
   ldb_skiplist_init(&mt->table, &mt->comparator, &mt->arena, &mt->mutex);
-#endif
+  ldb_skiplist_init(&mt->range_dels, &mt->comparator,
+                    &mt->arena, &mt->mutex);
+
+  if (mt->prefixed)
+    ldb_skiplist_use_prefix(&mt->table);
+
+  mt->bloom = NULL;
+  mt->bloom_lines = 0;
+  mt->prefix = prefix;
+  mt->buckets = NULL;
+  mt->bucket_count = 0;
+
+  ldb_mutex_init(&mt->vec_mutex);
+  ldb_vector_init(&mt->pending);
+
+  mt->sorted = NULL;
+
+  ldb_atomic_init(&mt->vec_usage, 0);
+  ldb_atomic_init(&mt->entries, 0);
+  ldb_atomic_init(&mt->data_size, 0);
+
+  if (mt->rep == LDB_MEMTABLE_HASH_SKIPLIST) {
+    size_t count = options->memtable_hash_buckets;
+    size_t i;
+
+    if (count < 1)
+      count = 1;
+
+    if (count > UINT32_MAX)
+      count = UINT32_MAX;
+
+    mt->buckets = ldb_arena_alloc_aligned(&mt->arena,
+                                          count * sizeof(*mt->buckets));
+    mt->bucket_count = count;
+
+    for (i = 0; i < count; i++)
+      ldb_atomic_init_ptr(&mt->buckets[i], NULL);
+  }
+
+  if (bloom_size > 0) {
+    /* Atomic words may be wider than 32 bits on some platforms; size
+       by the actual footprint so that bloom_size is honored in memory. */
+    size_t line_size = LDB_MEMBLOOM_LINE * sizeof(*mt->bloom);
+    size_t lines = (bloom_size + line_size - 1) / line_size;
+    size_t i, words;
+
+    if (lines > UINT32_MAX)
+      lines = UINT32_MAX;
+
+    words = lines * LDB_MEMBLOOM_LINE;
+
+    mt->bloom = ldb_arena_alloc_aligned(&mt->arena,
+                                        words * sizeof(*mt->bloom));
+    mt->bloom_lines = lines;
+
+    for (i = 0; i < words; i++)
+      ldb_atomic_init(&mt->bloom[i], 0);
+  }
 }
 
 static void
 ldb_memtable_clear(ldb_memtable_t *mt) {
   assert(mt->refs == 0);
 
-#ifndef LDB_HAVE_ATOMICS
+  if (mt->sorted != NULL) {
+    assert(mt->sorted->refs == 1);
+    ldb_free(mt->sorted);
+  }
+
+  ldb_vector_clear(&mt->pending);
+  ldb_mutex_destroy(&mt->vec_mutex);
   ldb_mutex_destroy(&mt->mutex);
-#endif
 
   ldb_arena_clear(&mt->arena);
 }
 
 ldb_memtable_t *
 ldb_memtable_create(const ldb_comparator_t *comparator) {
+  return ldb_memtable_create_ex(comparator, ldb_dbopt_default, NULL, NULL);
+}
+
+ldb_memtable_t *
+ldb_memtable_create_ex(const ldb_comparator_t *comparator,
+                       const ldb_dbopt_t *options,
+                       const ldb_prefix_t *prefix,
+                       ldb_arenapool_t *pool) {
   ldb_memtable_t *mt = ldb_malloc(sizeof(ldb_memtable_t));
-  ldb_memtable_init(mt, comparator);
+  ldb_memtable_init(mt, comparator, options, prefix, pool);
   return mt;
 }
 
@@ -102,15 +241,276 @@ ldb_memtable_unref(ldb_memtable_t *mt) {
 
 size_t
 ldb_memtable_usage(const ldb_memtable_t *mt) {
-  return ldb_arena_usage(&mt->arena);
+  return ldb_arena_usage(&mt->arena)
+       + ldb_atomic_load(&mt->vec_usage, ldb_order_relaxed);
 }
 
-void
-ldb_memtable_add(ldb_memtable_t *mt,
-                 ldb_seqnum_t sequence,
-                 ldb_valtype_t type,
-                 const ldb_slice_t *key,
-                 const ldb_slice_t *value) {
+/*
+ * Sorted Entries
+ */
+
+static int
+ldb_memtable_compare(const ldb_memtable_t *mt,
+                     const void *xp,
+                     const void *yp) {
+  /* Internal keys are encoded as length-prefixed strings. */
+  ldb_slice_t x = ldb_slice_decode(xp);
+  ldb_slice_t y = ldb_slice_decode(yp);
+
+  return ldb_compare_fast(&mt->comparator, &x, &y);
+}
+
+static void
+ldb_memvec_sort(const ldb_memtable_t *mt, void **items,
+                                          void **tmp,
+                                          size_t len) {
+  size_t mid = len / 2;
+  size_t i = 0;
+  size_t j = mid;
+  size_t k = 0;
+
+  if (len < 2)
+    return;
+
+  ldb_memvec_sort(mt, items, tmp, mid);
+  ldb_memvec_sort(mt, items + mid, tmp, len - mid);
+
+  if (ldb_memtable_compare(mt, items[mid - 1], items[mid]) < 0)
+    return; /* Already in order (the common case for bulk loads). */
+
+  while (i < mid && j < len) {
+    if (ldb_memtable_compare(mt, items[j], items[i]) < 0)
+      tmp[k++] = items[j++];
+    else
+      tmp[k++] = items[i++];
+  }
+
+  while (i < mid)
+    tmp[k++] = items[i++];
+
+  while (j < len)
+    tmp[k++] = items[j++];
+
+  memcpy(items, tmp, len * sizeof(void *));
+}
+
+static ldb_memvec_t *
+ldb_memvec_create(size_t length) {
+  ldb_memvec_t *vec = ldb_malloc(sizeof(ldb_memvec_t)
+                               + length * sizeof(void *));
+
+  vec->refs = 1;
+  vec->length = length;
+
+  return vec;
+}
+
+/* REQUIRES: mt->vec_mutex is held. */
+static void
+ldb_memvec_unref(ldb_memvec_t *vec) {
+  if (--vec->refs == 0)
+    ldb_free(vec);
+}
+
+/* Sort the pending entries into a new sorted array.
+   REQUIRES: mt->vec_mutex is held. */
+static void
+ldb_memtable_sort(ldb_memtable_t *mt) {
+  ldb_memvec_t *old = mt->sorted;
+  size_t len = mt->pending.length;
+  void **items = mt->pending.items;
+  size_t olen = old != NULL ? old->length : 0;
+  size_t i = 0, j = 0, k = 0;
+  ldb_memvec_t *vec;
+
+  if (old != NULL && len == 0)
+    return;
+
+  vec = ldb_memvec_create(olen + len);
+
+  /* Sort the new entries in the space at the end, then merge. */
+  if (len > 0) {
+    void **tmp = vec->items;
+
+    ldb_memvec_sort(mt, items, tmp, len);
+  }
+
+  while (i < olen && j < len) {
+    if (ldb_memtable_compare(mt, items[j], old->items[i]) < 0)
+      vec->items[k++] = items[j++];
+    else
+      vec->items[k++] = old->items[i++];
+  }
+
+  while (i < olen)
+    vec->items[k++] = old->items[i++];
+
+  while (j < len)
+    vec->items[k++] = items[j++];
+
+  if (old != NULL)
+    ldb_memvec_unref(old);
+
+  mt->sorted = vec;
+
+  ldb_vector_reset(&mt->pending);
+
+  ldb_atomic_store(&mt->vec_usage,
+                   (vec->length + mt->pending.alloc) * sizeof(void *),
+                   ldb_order_relaxed);
+}
+
+/* Return a reference to the entries sorted so far. All of them are
+   sorted in, unless "ukey" is given and none of the pending entries
+   are for it (and few enough of them are pending to have checked). */
+static ldb_memvec_t *
+ldb_memtable_sorted(ldb_memtable_t *mt, const ldb_slice_t *ukey) {
+  const ldb_comparator_t *cmp = mt->comparator.user_comparator;
+  ldb_memvec_t *vec;
+  int sort = 1;
+  size_t i;
+
+  ldb_mutex_lock(&mt->vec_mutex);
+
+  if (ukey != NULL && mt->sorted != NULL
+                   && mt->pending.length <= LDB_MEMVEC_SCAN) {
+    sort = 0;
+
+    for (i = 0; i < mt->pending.length; i++) {
+      ldb_slice_t key = ldb_slice_decode(mt->pending.items[i]);
+
+      key.size -= 8;
+
+      if (ldb_compare(cmp, &key, ukey) == 0) {
+        sort = 1;
+        break;
+      }
+    }
+  }
+
+  if (sort)
+    ldb_memtable_sort(mt);
+
+  vec = mt->sorted;
+  vec->refs++;
+
+  ldb_mutex_unlock(&mt->vec_mutex);
+
+  return vec;
+}
+
+static void
+ldb_memtable_release(ldb_memtable_t *mt, ldb_memvec_t *vec) {
+  ldb_mutex_lock(&mt->vec_mutex);
+  ldb_memvec_unref(vec);
+  ldb_mutex_unlock(&mt->vec_mutex);
+}
+
+/* Return the index of the first entry >= target (an encoded
+   internal key). */
+static size_t
+ldb_memvec_search(const ldb_memtable_t *mt,
+                  const ldb_memvec_t *vec,
+                  const uint8_t *target) {
+  size_t lo = 0;
+  size_t hi = vec->length;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (ldb_memtable_compare(mt, vec->items[mid], target) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void
+ldb_memtable_push(ldb_memtable_t *mt, const uint8_t *entry) {
+  ldb_mutex_lock(&mt->vec_mutex);
+
+  ldb_vector_push(&mt->pending, entry);
+
+  ldb_atomic_store(&mt->vec_usage,
+                   ((mt->sorted != NULL ? mt->sorted->length : 0)
+                     + mt->pending.alloc) * sizeof(void *),
+                   ldb_order_relaxed);
+
+  ldb_mutex_unlock(&mt->vec_mutex);
+}
+
+/*
+ * Hash Buckets
+ */
+
+/* Return the skiplist holding "ukey", creating it if "create" is
+   true. Returns NULL if it does not exist. */
+static ldb_skiplist_t *
+ldb_memtable_bucket(ldb_memtable_t *mt, const ldb_slice_t *ukey, int create) {
+  ldb_slice_t prefix = *ukey;
+  ldb_skiplist_t *list;
+  uint32_t hash, index;
+
+  if (mt->prefix != NULL) {
+    if (!ldb_prefix_extract(mt->prefix, &prefix, ukey))
+      prefix = *ukey;
+  }
+
+  hash = ldb_hash(prefix.data, prefix.size, 0);
+  index = ((uint64_t)hash * mt->bucket_count) >> 32;
+
+#ifdef LDB_HAVE_ATOMICS
+  list = ldb_atomic_load_ptr(&mt->buckets[index], ldb_order_acquire);
+#else
+  ldb_mutex_lock(&mt->mutex);
+  list = ldb_atomic_load_ptr(&mt->buckets[index], ldb_order_relaxed);
+  ldb_mutex_unlock(&mt->mutex);
+#endif
+
+  if (list != NULL || !create)
+    return list;
+
+  /* Buckets are created under the mutex so that concurrent writers
+     agree on them (the arena is theirs to share, too). */
+  ldb_mutex_lock(&mt->mutex);
+
+  list = ldb_atomic_load_ptr(&mt->buckets[index], ldb_order_relaxed);
+
+  if (list == NULL) {
+    list = ldb_arena_alloc_aligned(&mt->arena, sizeof(ldb_skiplist_t));
+
+    ldb_skiplist_init(list, &mt->comparator, &mt->arena, &mt->mutex);
+
+    if (mt->prefixed)
+      ldb_skiplist_use_prefix(list);
+
+    ldb_atomic_store_ptr(&mt->buckets[index], list, ldb_order_release);
+  }
+
+  ldb_mutex_unlock(&mt->mutex);
+
+  return list;
+}
+
+static size_t
+ldb_entry_size(const ldb_slice_t *key, const ldb_slice_t *value) {
+  size_t ikey_size = key->size + 8;
+  size_t zn = 0;
+
+  zn += ldb_varint32_size(ikey_size) + ikey_size;
+  zn += ldb_varint32_size(value->size) + value->size;
+
+  return zn;
+}
+
+static uint8_t *
+ldb_entry_write(uint8_t *zp,
+                ldb_seqnum_t sequence,
+                ldb_valtype_t type,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value) {
   /* Format of an entry is concatenation of:
    *
    *  key_size     : varint32 of internal_key.size
@@ -119,41 +519,297 @@ ldb_memtable_add(ldb_memtable_t *mt,
    *  value_size   : varint32 of value.size
    *  value bytes  : char[value.size]
    */
-  size_t val_size = value->size;
-  size_t ikey_size = key->size + 8;
+  zp = ldb_varint32_write(zp, key->size + 8);
+  zp = ldb_raw_write(zp, key->data, key->size);
+  zp = ldb_fixed64_write(zp, (sequence << 8) | type);
+
+  zp = ldb_varint32_write(zp, value->size);
+  zp = ldb_raw_write(zp, value->data, value->size);
+
+  return zp;
+}
+
+/* Writers are serialized (see add_concurrently), so bits are set with
+   a plain load and store. Readers only need to see the bits of keys
+   which were added before their sequence number was published. */
+static void
+ldb_memtable_bloom_add(ldb_memtable_t *mt, const ldb_slice_t *key) {
+  uint32_t hash = ldb_hash(key->data, key->size, 0x9e3779b9);
+  uint32_t line = ((uint64_t)hash * mt->bloom_lines) >> 32;
+  ldb_atomic(uint32_t) *words = mt->bloom + line * LDB_MEMBLOOM_LINE;
+  uint32_t h = hash * 0x5bd1e995;
+  uint32_t delta = (h >> 17) | (h << 15);
+  int i;
+
+  for (i = 0; i < LDB_MEMBLOOM_PROBES; i++) {
+    uint32_t bit = h & (LDB_MEMBLOOM_LINE * 32 - 1);
+    uint32_t word = ldb_atomic_load(&words[bit >> 5], ldb_order_relaxed);
+
+    word |= UINT32_C(1) << (bit & 31);
+
+    ldb_atomic_store(&words[bit >> 5], word, ldb_order_relaxed);
+
+    h += delta;
+  }
+}
+
+static int
+ldb_memtable_bloom_match(const ldb_memtable_t *mt, const ldb_slice_t *key) {
+  uint32_t hash = ldb_hash(key->data, key->size, 0x9e3779b9);
+  uint32_t line = ((uint64_t)hash * mt->bloom_lines) >> 32;
+  ldb_atomic(uint32_t) *words = mt->bloom + line * LDB_MEMBLOOM_LINE;
+  uint32_t h = hash * 0x5bd1e995;
+  uint32_t delta = (h >> 17) | (h << 15);
+  int i;
+
+  for (i = 0; i < LDB_MEMBLOOM_PROBES; i++) {
+    uint32_t bit = h & (LDB_MEMBLOOM_LINE * 32 - 1);
+    uint32_t word = ldb_atomic_load(&words[bit >> 5], ldb_order_relaxed);
+
+    if ((word & (UINT32_C(1) << (bit & 31))) == 0)
+      return 0;
+
+    h += delta;
+  }
+
+  return 1;
+}
+
+void
+ldb_memtable_add(ldb_memtable_t *mt,
+                 ldb_seqnum_t sequence,
+                 ldb_valtype_t type,
+                 const ldb_slice_t *key,
+                 const ldb_slice_t *value) {
+  size_t zn = ldb_entry_size(key, value);
+  uint8_t *tp = ldb_arena_alloc(&mt->arena, zn);
+  uint8_t *zp = ldb_entry_write(tp, sequence, type, key, value);
+
+  assert(zp == tp + zn);
+
+  (void)zp;
+
+  if (type == LDB_TYPE_RANGE_DELETION) {
+    ldb_skiplist_insert(&mt->range_dels, tp);
+    return;
+  }
+
+  if (mt->bloom != NULL)
+    ldb_memtable_bloom_add(mt, key);
+
+  ldb_atomic_fetch_add(&mt->entries, 1, ldb_order_relaxed);
+  ldb_atomic_fetch_add(&mt->data_size, zn, ldb_order_relaxed);
+
+  switch (mt->rep) {
+    case LDB_MEMTABLE_VECTOR:
+      ldb_memtable_push(mt, tp);
+      break;
+    case LDB_MEMTABLE_HASH_SKIPLIST:
+      ldb_skiplist_insert(ldb_memtable_bucket(mt, key, 1), tp);
+      ldb_memtable_push(mt, tp);
+      break;
+    default:
+      ldb_skiplist_insert(&mt->table, tp);
+      break;
+  }
+}
+
+void
+ldb_memtable_add_concurrently(ldb_memtable_t *mt,
+                              ldb_seqnum_t sequence,
+                              ldb_valtype_t type,
+                              const ldb_slice_t *key,
+                              const ldb_slice_t *value) {
+  size_t zn = ldb_entry_size(key, value);
   uint8_t *tp, *zp;
-  size_t zn = 0;
 
-  zn += ldb_varint32_size(ikey_size) + ikey_size;
-  zn += ldb_varint32_size(val_size) + val_size;
+  /* The arena is shared by all writers. */
+  ldb_mutex_lock(&mt->mutex);
 
   tp = ldb_arena_alloc(&mt->arena, zn);
-  zp = tp;
 
-  zp = ldb_varint32_write(zp, ikey_size);
-  zp = ldb_raw_write(zp, key->data, key->size);
-  zp = ldb_fixed64_write(zp, (sequence << 8) | type);
+  if (mt->bloom != NULL && type != LDB_TYPE_RANGE_DELETION)
+    ldb_memtable_bloom_add(mt, key);
 
-  zp = ldb_varint32_write(zp, val_size);
-  zp = ldb_raw_write(zp, value->data, value->size);
+  ldb_mutex_unlock(&mt->mutex);
+
+  zp = ldb_entry_write(tp, sequence, type, key, value);
 
   assert(zp == tp + zn);
 
-  ldb_skiplist_insert(&mt->table, tp);
+  (void)zp;
+
+  if (type == LDB_TYPE_RANGE_DELETION) {
+    ldb_skiplist_insert_concurrently(&mt->range_dels, tp);
+    return;
+  }
+
+  ldb_atomic_fetch_add(&mt->entries, 1, ldb_order_relaxed);
+  ldb_atomic_fetch_add(&mt->data_size, zn, ldb_order_relaxed);
+
+  switch (mt->rep) {
+    case LDB_MEMTABLE_VECTOR:
+      ldb_memtable_push(mt, tp);
+      break;
+    case LDB_MEMTABLE_HASH_SKIPLIST:
+      ldb_skiplist_insert_concurrently(ldb_memtable_bucket(mt, key, 1), tp);
+      ldb_memtable_push(mt, tp);
+      break;
+    default:
+      ldb_skiplist_insert_concurrently(&mt->table, tp);
+      break;
+  }
 }
 
-int
-ldb_memtable_get(ldb_memtable_t *mt,
-                 const ldb_lkey_t *key,
-                 ldb_buffer_t *value,
-                 int *status) {
-  ldb_slice_t mkey = ldb_lkey_memtable_key(key);
+/*
+ * Entry Cursor
+ */
+
+/* Walks either a skiplist or a sorted array of entries. */
+typedef struct ldb_memiter_s {
+  ldb_memtable_t *mt;
+  ldb_skipiter_t iter;
+  ldb_memvec_t *vec; /* Sorted entries (if non-NULL). */
+  size_t index;
+  ldb_buffer_t tmp;
+} ldb_memiter_t;
+
+static void
+ldb_memiter_init(ldb_memiter_t *iter,
+                 ldb_memtable_t *mt,
+                 const ldb_skiplist_t *table) {
+  iter->mt = mt;
+
+  ldb_skipiter_init(&iter->iter, table);
+
+  iter->vec = NULL;
+  iter->index = 0;
+
+  ldb_buffer_init(&iter->tmp);
+}
+
+/* Walk the entries sorted so far (see ldb_memtable_sorted). */
+static void
+ldb_memiter_init_sorted(ldb_memiter_t *iter,
+                        ldb_memtable_t *mt,
+                        const ldb_slice_t *ukey) {
+  ldb_memiter_init(iter, mt, &mt->table);
+
+  iter->vec = ldb_memtable_sorted(mt, ukey);
+  iter->index = iter->vec->length;
+}
+
+static void
+ldb_memiter_clear(ldb_memiter_t *iter) {
+  if (iter->vec != NULL)
+    ldb_memtable_release(iter->mt, iter->vec);
+
+  ldb_buffer_clear(&iter->tmp);
+}
+
+static int
+ldb_memiter_valid(const ldb_memiter_t *iter) {
+  if (iter->vec != NULL)
+    return iter->index < iter->vec->length;
+
+  return ldb_skipiter_valid(&iter->iter);
+}
+
+static const uint8_t *
+ldb_memiter_entry(const ldb_memiter_t *iter) {
+  if (iter->vec != NULL)
+    return iter->vec->items[iter->index];
+
+  return ldb_skipiter_key(&iter->iter);
+}
+
+/* Advance to the first entry >= target (an encoded internal key). */
+static void
+ldb_memiter_seek_raw(ldb_memiter_t *iter, const uint8_t *target) {
+  if (iter->vec != NULL) {
+    iter->index = ldb_memvec_search(iter->mt, iter->vec, target);
+  } else {
+    ldb_skipiter_seek(&iter->iter, target);
+  }
+}
+
+static void
+ldb_memiter_next(ldb_memiter_t *iter) {
+  if (iter->vec != NULL)
+    iter->index++;
+  else
+    ldb_skipiter_next(&iter->iter);
+}
+
+/*
+ * MemTable Lookups
+ */
+
+/* Return the sequence number of the newest range tombstone covering
+   "ukey" which is visible at "snapshot", or zero. Tombstones are sorted
+   by their start key, so only those starting before the key are read. */
+static ldb_seqnum_t
+ldb_memtable_covering(const ldb_memtable_t *mt,
+                      const ldb_slice_t *ukey,
+                      ldb_seqnum_t snapshot) {
+  const ldb_comparator_t *cmp = mt->comparator.user_comparator;
+  ldb_seqnum_t result = 0;
   ldb_skipiter_t iter;
 
-  ldb_skipiter_init(&iter, &mt->table);
-  ldb_skipiter_seek(&iter, mkey.data);
+  ldb_skipiter_init(&iter, &mt->range_dels);
+
+  for (ldb_skipiter_first(&iter);
+       ldb_skipiter_valid(&iter);
+       ldb_skipiter_next(&iter)) {
+    ldb_slice_t start = ldb_slice_decode(ldb_skipiter_key(&iter));
+    ldb_seqnum_t sequence;
+    ldb_slice_t end;
+
+    start.size -= 8;
+
+    if (ldb_compare(cmp, &start, ukey) > 0)
+      break;
+
+    sequence = ldb_fixed64_decode(start.data + start.size) >> 8;
+    end = ldb_slice_decode(start.data + start.size + 8);
+
+    if (sequence <= snapshot && sequence > result) {
+      if (ldb_compare(cmp, ukey, &end) < 0)
+        result = sequence;
+    }
+  }
+
+  return result;
+}
+
+static int
+ldb_memtable_deleted(const ldb_slice_t *ukey,
+                     ldb_buffer_t *value,
+                     int *status,
+                     ldb_mergectx_t *merge) {
+  if (ldb_mergectx_pending(merge))
+    *status = ldb_mergectx_finish(merge, ukey, NULL, value);
+  else
+    *status = LDB_NOTFOUND;
 
-  if (ldb_skipiter_valid(&iter)) {
+  return 1;
+}
+
+static int
+ldb_memtable_search(ldb_memtable_t *mt,
+                    ldb_memiter_t *iter,
+                    const ldb_slice_t *mkey,
+                    const ldb_slice_t *ukey,
+                    ldb_seqnum_t tomb,
+                    ldb_buffer_t *value,
+                    ldb_pinned_t *pin,
+                    int *status,
+                    ldb_mergectx_t *merge) {
+  const ldb_comparator_t *cmp = mt->comparator.user_comparator;
+
+  ldb_memiter_seek_raw(iter, mkey->data);
+
+  while (ldb_memiter_valid(iter)) {
     /* Entry format is:
      *
      *    klength  varint32
@@ -166,63 +822,176 @@ ldb_memtable_get(ldb_memtable_t *mt,
      * sequence number since the seek() call above should have skipped
      * all entries with overly large sequence numbers.
      */
-    const ldb_comparator_t *cmp = mt->comparator.user_comparator;
-    ldb_slice_t okey = ldb_slice_decode(ldb_skipiter_key(&iter));
-    ldb_slice_t ukey = ldb_lkey_user_key(key);
+    ldb_slice_t okey = ldb_slice_decode(ldb_memiter_entry(iter));
+    ldb_slice_t val;
+    uint64_t tag;
 
     assert(okey.size >= 8);
 
     okey.size -= 8;
 
-    if (ldb_compare(cmp, &okey, &ukey) == 0) {
-      /* Correct user key. */
-      uint64_t tag = ldb_fixed64_decode(okey.data + okey.size);
+    if (ldb_compare(cmp, &okey, ukey) != 0)
+      break;
 
-      switch ((ldb_valtype_t)(tag & 0xff)) {
-        case LDB_TYPE_VALUE: {
-          if (value != NULL) {
-            ldb_slice_t val = ldb_slice_decode(okey.data + okey.size + 8);
-            ldb_buffer_copy(value, &val);
-          }
-          return 1;
-        }
+    /* Correct user key. */
+    tag = ldb_fixed64_decode(okey.data + okey.size);
+    val = ldb_slice_decode(okey.data + okey.size + 8);
+
+    /* Entries older than a range tombstone are deleted. */
+    if ((tag >> 8) < tomb)
+      break;
+
+    switch ((ldb_valtype_t)(tag & 0xff)) {
+      case LDB_TYPE_VALUE: {
+        if (ldb_mergectx_pending(merge))
+          *status = ldb_mergectx_finish(merge, ukey, &val, value);
+        else if (pin != NULL)
+          ldb_pinned_set(pin, &val); /* Lives as long as the memtable. */
+        else if (value != NULL)
+          ldb_buffer_copy(value, &val);
+        return 1;
+      }
 
-        case LDB_TYPE_DELETION: {
+      case LDB_TYPE_DELETION: {
+        if (ldb_mergectx_pending(merge))
+          *status = ldb_mergectx_finish(merge, ukey, NULL, value);
+        else
           *status = LDB_NOTFOUND;
+        return 1;
+      }
+
+      case LDB_TYPE_MERGE: {
+        /* Without a value to produce, the operand settles the lookup. */
+        if (value == NULL && pin == NULL && merge->op != NULL) {
+          ldb_mergectx_reset(merge);
+          *status = LDB_OK;
           return 1;
         }
+
+        /* Keep looking for the value the operand applies to. */
+        ldb_mergectx_push(merge, &val);
+        break;
+      }
+
+      default: {
+        break;
       }
     }
+
+    ldb_memiter_next(iter);
   }
 
+  if (tomb > 0)
+    return ldb_memtable_deleted(ukey, value, status, merge);
+
   return 0;
 }
 
-/*
- * MemTable Iterator
- */
+int
+ldb_memtable_get(ldb_memtable_t *mt,
+                 const ldb_lkey_t *key,
+                 ldb_buffer_t *value,
+                 ldb_pinned_t *pin,
+                 int *status,
+                 ldb_mergectx_t *merge) {
+  ldb_slice_t mkey = ldb_lkey_memtable_key(key);
+  ldb_slice_t ukey = ldb_lkey_user_key(key);
+  ldb_slice_t ikey = ldb_lkey_internal_key(key);
+  ldb_seqnum_t snapshot = ldb_fixed64_decode(ikey.data + ikey.size - 8) >> 8;
+  ldb_seqnum_t tomb = ldb_memtable_covering(mt, &ukey, snapshot);
+  ldb_skiplist_t *table = &mt->table;
+  ldb_memiter_t iter;
+  int result;
 
-typedef struct ldb_memiter_s {
-  ldb_skipiter_t iter;
-  ldb_buffer_t tmp;
-} ldb_memiter_t;
+  if (mt->bloom != NULL) {
+    if (!ldb_memtable_bloom_match(mt, &ukey)) {
+      if (tomb > 0)
+        return ldb_memtable_deleted(&ukey, value, status, merge);
 
-static void
-ldb_memiter_init(ldb_memiter_t *iter, const ldb_skiplist_t *table) {
-  ldb_skipiter_init(&iter->iter, table);
-  ldb_buffer_init(&iter->tmp);
-}
+      return 0;
+    }
+  }
 
-static void
-ldb_memiter_clear(ldb_memiter_t *iter) {
-  ldb_buffer_clear(&iter->tmp);
+  if (mt->rep == LDB_MEMTABLE_HASH_SKIPLIST) {
+    table = ldb_memtable_bucket(mt, &ukey, 0);
+
+    if (table == NULL) {
+      if (tomb > 0)
+        return ldb_memtable_deleted(&ukey, value, status, merge);
+
+      return 0;
+    }
+  }
+
+  if (mt->rep == LDB_MEMTABLE_VECTOR)
+    ldb_memiter_init_sorted(&iter, mt, &ukey);
+  else
+    ldb_memiter_init(&iter, mt, table);
+
+  result = ldb_memtable_search(mt, &iter, &mkey, &ukey, tomb,
+                               value, pin, status, merge);
+
+  ldb_memiter_clear(&iter);
+
+  return result;
 }
 
-static int
-ldb_memiter_valid(const ldb_memiter_t *iter) {
-  return ldb_skipiter_valid(&iter->iter);
+uint64_t
+ldb_memtable_approximate_size(ldb_memtable_t *mt,
+                              const ldb_slice_t *start,
+                              const ldb_slice_t *limit) {
+  size_t entries = ldb_atomic_load(&mt->entries, ldb_order_relaxed);
+  size_t data_size = ldb_atomic_load(&mt->data_size, ldb_order_relaxed);
+  uint64_t lo, hi;
+  ldb_lkey_t k1, k2;
+
+  if (entries == 0)
+    return 0;
+
+  ldb_lkey_init(&k1, start, LDB_MAX_SEQUENCE);
+  ldb_lkey_init(&k2, limit, LDB_MAX_SEQUENCE);
+
+  if (mt->rep == LDB_MEMTABLE_SKIPLIST) {
+    uint64_t total = ldb_skiplist_estimate(&mt->table, NULL);
+
+    lo = ldb_skiplist_estimate(&mt->table, k1.start);
+    hi = ldb_skiplist_estimate(&mt->table, k2.start);
+
+    /* Scale the estimates to the known number of entries. */
+    if (total > 0) {
+      lo = (uint64_t)((double)lo * ((double)entries / total));
+      hi = (uint64_t)((double)hi * ((double)entries / total));
+    }
+  } else {
+    /* Hash buckets are unordered with respect to each other, so
+       count over the sorted entries instead. */
+    ldb_memvec_t *vec = ldb_memtable_sorted(mt, NULL);
+
+    lo = ldb_memvec_search(mt, vec, k1.start);
+    hi = ldb_memvec_search(mt, vec, k2.start);
+
+    ldb_memtable_release(mt, vec);
+  }
+
+  ldb_lkey_clear(&k1);
+  ldb_lkey_clear(&k2);
+
+  if (hi <= lo)
+    return 0;
+
+  hi -= lo;
+
+  if (hi > entries)
+    hi = entries;
+
+  /* Assume the entries in range are of average size. */
+  return (uint64_t)((double)data_size * ((double)hi / entries));
 }
 
+/*
+ * MemTable Iterator
+ */
+
 static void
 ldb_memiter_seek(ldb_memiter_t *iter, const ldb_slice_t *key) {
   ldb_buffer_t *tmp = &iter->tmp;
@@ -230,32 +999,42 @@ ldb_memiter_seek(ldb_memiter_t *iter, const ldb_slice_t *key) {
   ldb_buffer_reset(tmp);
   ldb_slice_export(tmp, key);
 
-  ldb_skipiter_seek(&iter->iter, tmp->data);
+  ldb_memiter_seek_raw(iter, tmp->data);
 }
 
 static void
 ldb_memiter_first(ldb_memiter_t *iter) {
-  ldb_skipiter_first(&iter->iter);
+  if (iter->vec != NULL)
+    iter->index = 0;
+  else
+    ldb_skipiter_first(&iter->iter);
 }
 
 static void
 ldb_memiter_last(ldb_memiter_t *iter) {
-  ldb_skipiter_last(&iter->iter);
-}
-
-static void
-ldb_memiter_next(ldb_memiter_t *iter) {
-  ldb_skipiter_next(&iter->iter);
+  if (iter->vec != NULL) {
+    if (iter->vec->length > 0)
+      iter->index = iter->vec->length - 1;
+  } else {
+    ldb_skipiter_last(&iter->iter);
+  }
 }
 
 static void
 ldb_memiter_prev(ldb_memiter_t *iter) {
-  ldb_skipiter_prev(&iter->iter);
+  if (iter->vec != NULL) {
+    if (iter->index == 0)
+      iter->index = iter->vec->length;
+    else
+      iter->index--;
+  } else {
+    ldb_skipiter_prev(&iter->iter);
+  }
 }
 
 static ldb_slice_t
 ldb_memiter_key(const ldb_memiter_t *iter) {
-  return ldb_slice_decode(ldb_skipiter_key(&iter->iter));
+  return ldb_slice_decode(ldb_memiter_entry(iter));
 }
 
 static ldb_slice_t
@@ -273,10 +1052,29 @@ ldb_memiter_status(const ldb_memiter_t *iter) {
 LDB_ITERATOR_FUNCTIONS(ldb_memiter);
 
 ldb_iter_t *
-ldb_memiter_create(const ldb_memtable_t *mt) {
-  ldb_memiter_t *iter = ldb_malloc(sizeof(ldb_memiter_t));
+ldb_memiter_create(ldb_memtable_t *mt) {
+  ldb_memiter_t *iter = ldb_small_alloc(sizeof(ldb_memiter_t));
+
+  if (mt->rep != LDB_MEMTABLE_SKIPLIST)
+    ldb_memiter_init_sorted(iter, mt, NULL);
+  else
+    ldb_memiter_init(iter, mt, &mt->table);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_memiter_t),
+                               &ldb_memiter_table, &mt->comparator);
+}
+
+int
+ldb_memiter_sees_writes(const ldb_memtable_t *mt) {
+  return mt->rep == LDB_MEMTABLE_SKIPLIST;
+}
+
+ldb_iter_t *
+ldb_rangeiter_create(ldb_memtable_t *mt) {
+  ldb_memiter_t *iter = ldb_small_alloc(sizeof(ldb_memiter_t));
 
-  ldb_memiter_init(iter, &mt->table);
+  ldb_memiter_init(iter, mt, &mt->range_dels);
 
-  return ldb_iter_create(iter, &ldb_memiter_table, &mt->comparator);
+  return ldb_iter_create_small(iter, sizeof(ldb_memiter_t),
+                               &ldb_memiter_table, &mt->comparator);
 }
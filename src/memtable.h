@@ -13,15 +13,21 @@
 #ifndef LDB_MEMTABLE_H
 #define LDB_MEMTABLE_H
 
+#include <stddef.h>
 #include "util/types.h"
 
 /*
  * Types
  */
 
+struct ldb_arenapool_s;
 struct ldb_comparator_s;
+struct ldb_dbopt_s;
 struct ldb_iter_s;
 struct ldb_lkey_s;
+struct ldb_mergectx_s;
+struct ldb_pinned_s;
+struct ldb_prefix_s;
 
 typedef struct ldb_memtable_s ldb_memtable_t;
 
@@ -34,6 +40,18 @@ typedef struct ldb_memtable_s ldb_memtable_t;
 ldb_memtable_t *
 ldb_memtable_create(const struct ldb_comparator_s *comparator);
 
+/* Like create(), but index the entries as options->memtable_rep says
+   (hashing user keys by "prefix" if non-NULL), also maintain a bloom
+   filter of options->memtable_bloom_size bytes over the user keys,
+   and take memory from "pool" (if non-NULL, see src/util/arena.h).
+   The memory is given back to the pool once the memtable is
+   destroyed. */
+ldb_memtable_t *
+ldb_memtable_create_ex(const struct ldb_comparator_s *comparator,
+                       const struct ldb_dbopt_s *options,
+                       const struct ldb_prefix_s *prefix,
+                       struct ldb_arenapool_s *pool);
+
 void
 ldb_memtable_destroy(ldb_memtable_t *mt);
 
@@ -52,7 +70,9 @@ ldb_memtable_usage(const ldb_memtable_t *mt);
 
 /* Add an entry into memtable that maps key to value at the
    specified sequence number and with the specified type.
-   Typically value will be empty if type==LDB_TYPE_DELETION. */
+   Typically value will be empty if type==LDB_TYPE_DELETION. Range
+   tombstones (type==LDB_TYPE_RANGE_DELETION) map the start key to
+   the end key, and are kept apart from the other entries. */
 void
 ldb_memtable_add(ldb_memtable_t *mt,
                  ldb_seqnum_t sequence,
@@ -60,15 +80,43 @@ ldb_memtable_add(ldb_memtable_t *mt,
                  const ldb_slice_t *key,
                  const ldb_slice_t *value);
 
-/* If memtable contains a value for key, store it in *value and return true.
+/* Like add(), but may be called by several threads at once. Calls to
+   add() must not run at the same time. */
+void
+ldb_memtable_add_concurrently(ldb_memtable_t *mt,
+                              ldb_seqnum_t sequence,
+                              ldb_valtype_t type,
+                              const ldb_slice_t *key,
+                              const ldb_slice_t *value);
+
+/* If memtable contains a value for key, store it in *value (or point
+   *pin at it, if non-null) and return true.
    If memtable contains a deletion for key, store a NOTFOUND error
    in *status and return true.
-   Else, return false. */
+   Else, return false.
+
+   Merge operands found on the way are added to *merge and applied
+   to the value (or deletion) beneath them. If there is none, false is
+   returned with the operands left in *merge.
+
+   A key covered by a range tombstone is treated as deleted at the
+   tombstone's sequence number. */
 int
 ldb_memtable_get(ldb_memtable_t *mt,
                  const struct ldb_lkey_s *key,
                  ldb_buffer_t *value,
-                 int *status);
+                 struct ldb_pinned_s *pin,
+                 int *status,
+                 struct ldb_mergectx_s *merge);
+
+/* Return the approximate number of bytes of point entries whose user
+   keys are in ["start", "limit"). Skiplist memtables are estimated
+   from the shape of the list without walking it. It is safe to call
+   when memtable is being modified. */
+uint64_t
+ldb_memtable_approximate_size(ldb_memtable_t *mt,
+                              const ldb_slice_t *start,
+                              const ldb_slice_t *limit);
 
 /*
  * MemTable Iterator
@@ -80,8 +128,21 @@ ldb_memtable_get(ldb_memtable_t *mt,
  * while the returned iterator is live. The keys returned by this
  * iterator are internal keys encoded by ldb_pkey_export in the
  * src/dbformat.{h,c} module.
+ *
+ * Vector and hash memtables are iterated over a sorted copy of the
+ * entries present at creation; later writes are not seen.
  */
 struct ldb_iter_s *
-ldb_memiter_create(const ldb_memtable_t *mt);
+ldb_memiter_create(ldb_memtable_t *mt);
+
+/* Whether iterators over the memtable see writes made after they
+   were created (true unless they iterate over a sorted copy). */
+int
+ldb_memiter_sees_writes(const ldb_memtable_t *mt);
+
+/* Return an iterator that yields the range tombstones of the memtable,
+   as (start, sequence, LDB_TYPE_RANGE_DELETION) => end. */
+struct ldb_iter_s *
+ldb_rangeiter_create(ldb_memtable_t *mt);
 
 #endif /* LDB_MEMTABLE_H */
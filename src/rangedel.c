@@ -0,0 +1,357 @@
+/*!
+ * rangedel.c - range tombstones for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "table/iterator.h"
+
+#include "util/buffer.h"
+#include "util/comparator.h"
+#include "util/internal.h"
+#include "util/slice.h"
+#include "util/status.h"
+#include "util/vector.h"
+
+#include "dbformat.h"
+#include "rangedel.h"
+
+/*
+ * Types
+ */
+
+/* A maximal key range covered by the same set of tombstones. */
+typedef struct rd_fragment_s {
+  ldb_slice_t start;
+  ldb_slice_t end;
+  size_t length;
+  ldb_seqnum_t seqs[1]; /* Newest first. */
+} rd_fragment_t;
+
+typedef int rd_compare_f(const ldb_comparator_t *, const void *, const void *);
+
+/*
+ * Helpers
+ */
+
+static int
+tombstone_compare(const ldb_comparator_t *ucmp, const void *x, const void *y) {
+  const ldb_tombstone_t *a = x;
+  const ldb_tombstone_t *b = y;
+  int r = ldb_compare(ucmp, &a->start, &b->start);
+
+  if (r != 0)
+    return r;
+
+  if (a->sequence != b->sequence)
+    return a->sequence > b->sequence ? -1 : 1;
+
+  return 0;
+}
+
+static int
+slice_compare(const ldb_comparator_t *ucmp, const void *x, const void *y) {
+  return ldb_compare(ucmp, (const ldb_slice_t *)x, (const ldb_slice_t *)y);
+}
+
+/* Stable merge sort. The vector sort takes no comparator state. */
+static void
+rd_sort(void **items,
+        void **tmp,
+        size_t len,
+        const ldb_comparator_t *ucmp,
+        rd_compare_f *cmp) {
+  size_t mid = len / 2;
+  size_t i = 0;
+  size_t j = mid;
+  size_t k = 0;
+
+  if (len < 2)
+    return;
+
+  rd_sort(items, tmp, mid, ucmp, cmp);
+  rd_sort(items + mid, tmp, len - mid, ucmp, cmp);
+
+  while (i < mid && j < len) {
+    if (cmp(ucmp, items[j], items[i]) < 0)
+      tmp[k++] = items[j++];
+    else
+      tmp[k++] = items[i++];
+  }
+
+  while (i < mid)
+    tmp[k++] = items[i++];
+
+  while (j < len)
+    tmp[k++] = items[j++];
+
+  memcpy(items, tmp, len * sizeof(void *));
+}
+
+static void
+rd_reset_fragments(ldb_rangedel_t *rd) {
+  size_t i;
+
+  for (i = 0; i < rd->fragments.length; i++)
+    ldb_free(rd->fragments.items[i]);
+
+  ldb_vector_reset(&rd->fragments);
+}
+
+/*
+ * Tombstone
+ */
+
+void
+ldb_tombstone_bounds(const ldb_tombstone_t *tomb,
+                     const ldb_comparator_t *icmp,
+                     ldb_ikey_t *smallest,
+                     ldb_ikey_t *largest) {
+  ldb_ikey_t key;
+
+  ldb_ikey_init(&key);
+
+  ldb_ikey_set(&key, &tomb->start, tomb->sequence, LDB_TYPE_RANGE_DELETION);
+
+  if (smallest->size == 0 || ldb_compare(icmp, &key, smallest) < 0)
+    ldb_ikey_copy(smallest, &key);
+
+  ldb_ikey_set(&key, &tomb->end, LDB_MAX_SEQUENCE, LDB_TYPE_RANGE_DELETION);
+
+  if (largest->size == 0 || ldb_compare(icmp, &key, largest) > 0)
+    ldb_ikey_copy(largest, &key);
+
+  ldb_ikey_clear(&key);
+}
+
+/*
+ * RangeDel
+ */
+
+void
+ldb_rangedel_init(ldb_rangedel_t *rd, const ldb_comparator_t *ucmp) {
+  rd->ucmp = ucmp;
+  rd->built = 1;
+
+  ldb_vector_init(&rd->tombstones);
+  ldb_vector_init(&rd->fragments);
+}
+
+void
+ldb_rangedel_clear(ldb_rangedel_t *rd) {
+  ldb_rangedel_reset(rd);
+
+  ldb_vector_clear(&rd->tombstones);
+  ldb_vector_clear(&rd->fragments);
+}
+
+void
+ldb_rangedel_reset(ldb_rangedel_t *rd) {
+  size_t i;
+
+  for (i = 0; i < rd->tombstones.length; i++)
+    ldb_free(rd->tombstones.items[i]);
+
+  ldb_vector_reset(&rd->tombstones);
+
+  rd_reset_fragments(rd);
+
+  rd->built = 1;
+}
+
+ldb_rangedel_t *
+ldb_rangedel_create(const ldb_comparator_t *ucmp) {
+  ldb_rangedel_t *rd = ldb_malloc(sizeof(ldb_rangedel_t));
+  ldb_rangedel_init(rd, ucmp);
+  return rd;
+}
+
+void
+ldb_rangedel_destroy(ldb_rangedel_t *rd) {
+  ldb_rangedel_clear(rd);
+  ldb_free(rd);
+}
+
+void
+ldb_rangedel_add(ldb_rangedel_t *rd,
+                 const ldb_slice_t *start,
+                 const ldb_slice_t *end,
+                 ldb_seqnum_t sequence) {
+  ldb_tombstone_t *tomb;
+  uint8_t *zp;
+
+  if (ldb_compare(rd->ucmp, start, end) >= 0)
+    return;
+
+  tomb = ldb_malloc(sizeof(ldb_tombstone_t) + start->size + end->size);
+  zp = (uint8_t *)(tomb + 1);
+
+  if (start->size > 0)
+    memcpy(zp, start->data, start->size);
+
+  if (end->size > 0)
+    memcpy(zp + start->size, end->data, end->size);
+
+  ldb_slice_set(&tomb->start, zp, start->size);
+  ldb_slice_set(&tomb->end, zp + start->size, end->size);
+
+  tomb->sequence = sequence;
+
+  ldb_vector_push(&rd->tombstones, tomb);
+
+  rd->built = 0;
+}
+
+int
+ldb_rangedel_add_iter(ldb_rangedel_t *rd, ldb_iter_t *iter) {
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t end = ldb_iter_value(iter);
+    ldb_pkey_t pkey;
+
+    if (!ldb_pkey_import(&pkey, &key))
+      return LDB_CORRUPTION;
+
+    if (pkey.type != LDB_TYPE_RANGE_DELETION)
+      return LDB_CORRUPTION;
+
+    ldb_rangedel_add(rd, &pkey.user_key, &end, pkey.sequence);
+  }
+
+  return ldb_iter_status(iter);
+}
+
+void
+ldb_rangedel_build(ldb_rangedel_t *rd) {
+  ldb_tombstone_t **items = (ldb_tombstone_t **)rd->tombstones.items;
+  size_t count = rd->tombstones.length;
+  ldb_vector_t bounds, active, tmp;
+  size_t i, j, next;
+
+  if (rd->built)
+    return;
+
+  rd_reset_fragments(rd);
+
+  ldb_vector_init(&bounds);
+  ldb_vector_init(&active);
+  ldb_vector_init(&tmp);
+
+  ldb_vector_resize(&tmp, count * 2);
+
+  rd_sort(rd->tombstones.items, tmp.items, count,
+          rd->ucmp, tombstone_compare);
+
+  /* Every start and end key bounds a fragment. */
+  for (i = 0; i < count; i++) {
+    ldb_vector_push(&bounds, &items[i]->start);
+    ldb_vector_push(&bounds, &items[i]->end);
+  }
+
+  rd_sort(bounds.items, tmp.items, bounds.length, rd->ucmp, slice_compare);
+
+  for (i = 0, j = 0; i < bounds.length; i++) {
+    if (j > 0 && slice_compare(rd->ucmp, bounds.items[j - 1],
+                                         bounds.items[i]) == 0) {
+      continue;
+    }
+
+    bounds.items[j++] = bounds.items[i];
+  }
+
+  bounds.length = j;
+
+  /* Sweep over the fragments, tracking the tombstones covering each. */
+  for (i = 0, next = 0; i + 1 < bounds.length; i++) {
+    const ldb_slice_t *lo = bounds.items[i];
+    const ldb_slice_t *hi = bounds.items[i + 1];
+    rd_fragment_t *frag;
+    size_t k;
+
+    for (j = 0; j < active.length; /* nothing */) {
+      const ldb_tombstone_t *tomb = active.items[j];
+
+      if (ldb_compare(rd->ucmp, &tomb->end, lo) <= 0)
+        active.items[j] = active.items[--active.length];
+      else
+        j++;
+    }
+
+    while (next < count && ldb_compare(rd->ucmp, &items[next]->start, lo) <= 0)
+      ldb_vector_push(&active, items[next++]);
+
+    if (active.length == 0)
+      continue;
+
+    frag = ldb_malloc(sizeof(rd_fragment_t)
+                    + (active.length - 1) * sizeof(ldb_seqnum_t));
+
+    frag->start = *lo;
+    frag->end = *hi;
+    frag->length = active.length;
+
+    /* Insertion sort, newest first. */
+    for (j = 0; j < active.length; j++) {
+      const ldb_tombstone_t *tomb = active.items[j];
+
+      for (k = j; k > 0 && frag->seqs[k - 1] < tomb->sequence; k--)
+        frag->seqs[k] = frag->seqs[k - 1];
+
+      frag->seqs[k] = tomb->sequence;
+    }
+
+    ldb_vector_push(&rd->fragments, frag);
+  }
+
+  ldb_vector_clear(&bounds);
+  ldb_vector_clear(&active);
+  ldb_vector_clear(&tmp);
+
+  rd->built = 1;
+}
+
+ldb_seqnum_t
+ldb_rangedel_covering(const ldb_rangedel_t *rd,
+                      const ldb_slice_t *key,
+                      ldb_seqnum_t snapshot) {
+  const rd_fragment_t *frag;
+  size_t lo = 0;
+  size_t hi = rd->fragments.length;
+  size_t i;
+
+  assert(rd->built);
+
+  /* Find the last fragment starting at or before the key. */
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    frag = rd->fragments.items[mid];
+
+    if (ldb_compare(rd->ucmp, &frag->start, key) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == 0)
+    return 0;
+
+  frag = rd->fragments.items[lo - 1];
+
+  if (ldb_compare(rd->ucmp, key, &frag->end) >= 0)
+    return 0;
+
+  for (i = 0; i < frag->length; i++) {
+    if (frag->seqs[i] <= snapshot)
+      return frag->seqs[i];
+  }
+
+  return 0;
+}
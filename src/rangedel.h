@@ -0,0 +1,109 @@
+/*!
+ * rangedel.h - range tombstones for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_RANGEDEL_H
+#define LDB_RANGEDEL_H
+
+#include <stddef.h>
+
+#include "util/types.h"
+
+#include "dbformat.h"
+
+/*
+ * Types
+ */
+
+struct ldb_comparator_s;
+struct ldb_iter_s;
+
+/* A range tombstone deletes every key in [start, end) which was
+ * written before it (i.e. with a lower sequence number).
+ *
+ * Tombstones are stored apart from the point entries: memtables keep
+ * them in a second skiplist, and tables in a "rangedel" meta block,
+ * both keyed by the internal key (start, sequence, range deletion)
+ * with the end key as the value. A table's key range is widened to
+ * cover its tombstones, with "end" recorded as (end, max sequence) so
+ * that the (exclusive) end key itself stays outside of the range.
+ */
+typedef struct ldb_tombstone_s {
+  ldb_slice_t start;
+  ldb_slice_t end;
+  ldb_seqnum_t sequence;
+} ldb_tombstone_t;
+
+/* A set of range tombstones, split into non-overlapping fragments
+   so that the tombstones covering a key can be found with a binary
+   search. The set must be built before it is queried, after which it
+   may be shared between threads. */
+typedef struct ldb_rangedel_s {
+  const struct ldb_comparator_s *ucmp;
+  ldb_vector_t tombstones; /* ldb_tombstone_t */
+  ldb_vector_t fragments;  /* rd_fragment_t */
+  int built;
+} ldb_rangedel_t;
+
+/*
+ * Tombstone
+ */
+
+/* Widen [*smallest, *largest] (empty if smallest is empty) to cover
+   the tombstone. "icmp" is the internal key comparator. */
+void
+ldb_tombstone_bounds(const ldb_tombstone_t *tomb,
+                     const struct ldb_comparator_s *icmp,
+                     ldb_ikey_t *smallest,
+                     ldb_ikey_t *largest);
+
+/*
+ * RangeDel
+ */
+
+void
+ldb_rangedel_init(ldb_rangedel_t *rd, const struct ldb_comparator_s *ucmp);
+
+void
+ldb_rangedel_clear(ldb_rangedel_t *rd);
+
+void
+ldb_rangedel_reset(ldb_rangedel_t *rd);
+
+ldb_rangedel_t *
+ldb_rangedel_create(const struct ldb_comparator_s *ucmp);
+
+void
+ldb_rangedel_destroy(ldb_rangedel_t *rd);
+
+/* Add a tombstone. Empty ranges are ignored. */
+void
+ldb_rangedel_add(ldb_rangedel_t *rd,
+                 const ldb_slice_t *start,
+                 const ldb_slice_t *end,
+                 ldb_seqnum_t sequence);
+
+/* Add the tombstones yielded by an iterator over a tombstone skiplist
+   or meta block (see above). */
+int
+ldb_rangedel_add_iter(ldb_rangedel_t *rd, struct ldb_iter_s *iter);
+
+/* Sort the tombstones by start key (newest first for equal keys) and
+   compute the fragments. Must be called after adding tombstones. */
+void
+ldb_rangedel_build(ldb_rangedel_t *rd);
+
+#define ldb_rangedel_empty(rd) ((rd)->tombstones.length == 0)
+
+/* Return the sequence number of the newest tombstone covering "key"
+   which is visible at "snapshot", or zero if there is none. */
+ldb_seqnum_t
+ldb_rangedel_covering(const ldb_rangedel_t *rd,
+                      const ldb_slice_t *key,
+                      ldb_seqnum_t snapshot);
+
+#endif /* LDB_RANGEDEL_H */
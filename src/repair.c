@@ -28,11 +28,15 @@
 #include "util/env.h"
 #include "util/internal.h"
 #include "util/options.h"
+#include "util/port.h"
+#include "util/prefix.h"
 #include "util/slice.h"
 #include "util/status.h"
 #include "util/strutil.h"
+#include "util/thread_pool.h"
 #include "util/vector.h"
 
+#include "blob.h"
 #include "builder.h"
 #include "db_impl.h"
 #include "dbformat.h"
@@ -41,8 +45,10 @@
 #include "log_reader.h"
 #include "log_writer.h"
 #include "memtable.h"
+#include "rangedel.h"
 #include "table_cache.h"
 #include "version_edit.h"
+#include "version_set.h"
 #include "write_batch.h"
 
 /* We recover the contents of the descriptor from the other files we find.
@@ -70,6 +76,9 @@
  * Possible optimization 2:
  *   Store per-table metadata (smallest, largest, largest-seq#, ...)
  *   in the table's meta section to speed up scan_table.
+ *
+ * Steps (1) and (2) run on max_file_opening_threads threads, one log
+ * or table at a time. Results are collected in file order.
  */
 
 /*
@@ -106,6 +115,7 @@ typedef struct ldb_repair_s {
   const char *dbname;
   ldb_comparator_t icmp;
   ldb_bloom_t ipolicy;
+  ldb_prefix_t iprefix;
   ldb_dbopt_t options;
   int owns_info_log;
   int owns_cache;
@@ -113,8 +123,10 @@ typedef struct ldb_repair_s {
   ldb_edit_t edit;
   ldb_array_t manifests;
   ldb_array_t table_numbers;
+  ldb_array_t table_paths; /* Path id of each of table_numbers. */
   ldb_array_t logs;
   ldb_vector_t tables; /* ldb_tabinfo_t */
+  ldb_mutex_t mutex; /* Protects next_file_number. */
   uint64_t next_file_number;
 } ldb_repair_t;
 
@@ -132,9 +144,13 @@ repair_init(ldb_repair_t *rep, const char *dbname, const ldb_dbopt_t *options) {
   else
     ldb_ifp_init(&rep->ipolicy, ldb_bloom_default);
 
+  if (options->prefix_extractor != NULL)
+    ldb_ipe_init(&rep->iprefix, options->prefix_extractor);
+
   rep->options = ldb_sanitize_options(dbname,
                                       &rep->icmp,
                                       &rep->ipolicy,
+                                      &rep->iprefix,
                                       options);
 
   rep->owns_info_log = rep->options.info_log != options->info_log;
@@ -146,8 +162,10 @@ repair_init(ldb_repair_t *rep, const char *dbname, const ldb_dbopt_t *options) {
   ldb_edit_init(&rep->edit);
   ldb_array_init(&rep->manifests);
   ldb_array_init(&rep->table_numbers);
+  ldb_array_init(&rep->table_paths);
   ldb_array_init(&rep->logs);
   ldb_vector_init(&rep->tables);
+  ldb_mutex_init(&rep->mutex);
 
   rep->next_file_number = 1;
 }
@@ -170,12 +188,74 @@ repair_clear(ldb_repair_t *rep) {
   ldb_edit_clear(&rep->edit);
   ldb_array_clear(&rep->manifests);
   ldb_array_clear(&rep->table_numbers);
+  ldb_array_clear(&rep->table_paths);
   ldb_array_clear(&rep->logs);
   ldb_vector_clear(&rep->tables);
+  ldb_mutex_destroy(&rep->mutex);
+}
+
+static uint64_t
+new_file_number(ldb_repair_t *rep) {
+  uint64_t number;
+
+  ldb_mutex_lock(&rep->mutex);
+
+  number = rep->next_file_number++;
+
+  ldb_mutex_unlock(&rep->mutex);
+
+  return number;
+}
+
+/* The path id under which tables in the database directory are found
+   (see ldb_table_dir()). */
+static int
+home_path_id(ldb_repair_t *rep) {
+  int i;
+
+  for (i = 0; i < rep->options.num_db_paths; i++) {
+    if (strcmp(rep->options.db_paths[i].path, rep->dbname) == 0)
+      break;
+  }
+
+  return i;
+}
+
+static void
+find_tables(ldb_repair_t *rep) {
+  ldb_filetype_t type;
+  uint64_t number;
+  char **filenames;
+  int i, j, len;
+
+  for (i = 0; i < rep->options.num_db_paths; i++) {
+    if (!ldb_table_dir_extra(rep->dbname, &rep->options, i))
+      continue;
+
+    len = ldb_get_children(rep->options.db_paths[i].path, &filenames);
+
+    for (j = 0; j < len; j++) {
+      if (!ldb_parse_filename(&type, &number, filenames[j]))
+        continue;
+
+      if (type != LDB_FILE_TABLE)
+        continue;
+
+      if (number + 1 > rep->next_file_number)
+        rep->next_file_number = number + 1;
+
+      ldb_array_push(&rep->table_numbers, number);
+      ldb_array_push(&rep->table_paths, i);
+    }
+
+    if (len >= 0)
+      ldb_free_children(filenames, len);
+  }
 }
 
 static int
 find_files(ldb_repair_t *rep) {
+  int home = home_path_id(rep);
   ldb_filetype_t type;
   uint64_t number;
   char **filenames;
@@ -203,15 +283,20 @@ find_files(ldb_repair_t *rep) {
       if (number + 1 > rep->next_file_number)
         rep->next_file_number = number + 1;
 
-      if (type == LDB_FILE_LOG)
+      if (type == LDB_FILE_LOG) {
         ldb_array_push(&rep->logs, number);
-      else if (type == LDB_FILE_TABLE)
+      } else if (type == LDB_FILE_TABLE) {
         ldb_array_push(&rep->table_numbers, number);
+        ldb_array_push(&rep->table_paths, home);
+      }
     }
   }
 
   ldb_free_children(filenames, len);
 
+  /* Tables may also be in any of the other directories. */
+  find_tables(rep);
+
   return LDB_OK;
 }
 
@@ -255,8 +340,54 @@ report_corruption(ldb_reporter_t *reporter, size_t bytes, int status) {
                               ldb_strerror(status));
 }
 
+/*
+ * Jobs
+ */
+
+/* A log to convert or a table to scan. */
+typedef struct repair_job_s {
+  ldb_repair_t *rep;
+  uint64_t number;
+  int path_id;
+  uint64_t output; /* Table written by a log conversion (0 if none). */
+  ldb_tabinfo_t *table; /* Scanned (or repaired) table, if usable. */
+} repair_job_t;
+
+/* Run "func" on every job, on up to max_file_opening_threads threads. */
+static void
+repair_run_jobs(ldb_repair_t *rep,
+                repair_job_t *jobs,
+                size_t length,
+                ldb_work_f *func) {
+  int threads = rep->options.max_file_opening_threads;
+  ldb_pool_t *pool;
+  size_t i;
+
+  if ((size_t)threads > length)
+    threads = length;
+
+  if (threads <= 1) {
+    for (i = 0; i < length; i++)
+      func(&jobs[i]);
+
+    return;
+  }
+
+  pool = ldb_pool_create(threads);
+
+  for (i = 0; i < length; i++)
+    ldb_pool_schedule(pool, func, &jobs[i]);
+
+  ldb_pool_wait(pool);
+  ldb_pool_destroy(pool);
+}
+
+/*
+ * Logs
+ */
+
 static int
-convert_log_to_table(ldb_repair_t *rep, uint64_t log) {
+convert_log_to_table(ldb_repair_t *rep, uint64_t log, uint64_t *output) {
   /* Open the log file. */
   char logname[LDB_PATH_MAX];
   ldb_reporter_t reporter;
@@ -267,6 +398,7 @@ convert_log_to_table(ldb_repair_t *rep, uint64_t log) {
   ldb_batch_t batch;
   ldb_memtable_t *mem;
   ldb_filemeta_t meta;
+  ldb_iter_t *range_iter;
   ldb_iter_t *iter;
   int rc, counter;
 
@@ -288,6 +420,8 @@ convert_log_to_table(ldb_repair_t *rep, uint64_t log) {
      propagating bad information (like overly large sequence
      numbers). */
   ldb_reader_init(&reader, lfile, &reporter, 0, 0);
+  ldb_reader_block_size(&reader, rep->options.wal_block_size);
+  ldb_reader_recyclable(&reader, log);
   ldb_buffer_init(&scratch);
   ldb_slice_init(&record);
   ldb_batch_init(&batch);
@@ -328,25 +462,27 @@ convert_log_to_table(ldb_repair_t *rep, uint64_t log) {
      since extract_meta_data() will also generate edits. */
   ldb_filemeta_init(&meta);
 
-  meta.number = rep->next_file_number++;
+  meta.number = new_file_number(rep);
+  meta.path_id = ldb_level_path_id(&rep->options, 0);
 
   iter = ldb_memiter_create(mem);
+  range_iter = ldb_rangeiter_create(mem);
 
   rc = ldb_build_table(rep->dbname,
                        &rep->options,
                        rep->table_cache,
                        iter,
+                       range_iter,
                        &meta);
 
+  ldb_iter_destroy(range_iter);
   ldb_iter_destroy(iter);
 
   ldb_memtable_unref(mem);
   mem = NULL;
 
-  if (rc == LDB_OK) {
-    if (meta.file_size > 0)
-      ldb_array_push(&rep->table_numbers, meta.number);
-  }
+  if (rc == LDB_OK && meta.file_size > 0)
+    *output = meta.number;
 
   ldb_filemeta_clear(&meta);
 
@@ -359,29 +495,62 @@ convert_log_to_table(ldb_repair_t *rep, uint64_t log) {
 }
 
 static void
-convert_logs_to_tables(ldb_repair_t *rep) {
+convert_log_call(void *arg) {
+  repair_job_t *job = arg;
+  ldb_repair_t *rep = job->rep;
   char fname[LDB_PATH_MAX];
-  size_t i;
   int rc;
 
-  for (i = 0; i < rep->logs.length; i++) {
-    uint64_t log = rep->logs.items[i];
+  if (!ldb_log_filename(fname, sizeof(fname), rep->dbname, job->number))
+    abort(); /* LCOV_EXCL_LINE */
 
-    if (!ldb_log_filename(fname, sizeof(fname), rep->dbname, log))
-      abort(); /* LCOV_EXCL_LINE */
+  rc = convert_log_to_table(rep, job->number, &job->output);
 
-    rc = convert_log_to_table(rep, log);
+  if (rc != LDB_OK) {
+    ldb_log(rep->options.info_log, "Log #%lu: ignoring conversion error: %s",
+                                   (unsigned long)job->number,
+                                   ldb_strerror(rc));
+  }
 
-    if (rc != LDB_OK) {
-      ldb_log(rep->options.info_log, "Log #%lu: ignoring conversion error: %s",
-                                     (unsigned long)rep->logs.items[i],
-                                     ldb_strerror(rc));
-    }
+  archive_file(rep, fname);
+}
 
-    archive_file(rep, fname);
+static void
+convert_logs_to_tables(ldb_repair_t *rep) {
+  size_t length = rep->logs.length;
+  repair_job_t *jobs;
+  size_t i;
+
+  if (length == 0)
+    return;
+
+  jobs = ldb_malloc(length * sizeof(repair_job_t));
+
+  for (i = 0; i < length; i++) {
+    jobs[i].rep = rep;
+    jobs[i].number = rep->logs.items[i];
+    jobs[i].path_id = 0;
+    jobs[i].output = 0;
+    jobs[i].table = NULL;
   }
+
+  repair_run_jobs(rep, jobs, length, &convert_log_call);
+
+  /* The new tables are scanned along with the others. */
+  for (i = 0; i < length; i++) {
+    if (jobs[i].output != 0) {
+      ldb_array_push(&rep->table_numbers, jobs[i].output);
+      ldb_array_push(&rep->table_paths, ldb_level_path_id(&rep->options, 0));
+    }
+  }
+
+  ldb_free(jobs);
 }
 
+/*
+ * Tables
+ */
+
 static ldb_iter_t *
 tableiter_create(ldb_repair_t *rep, const ldb_filemeta_t *meta) {
   /* Same as compaction iterators: if paranoid_checks
@@ -394,13 +563,18 @@ tableiter_create(ldb_repair_t *rep, const ldb_filemeta_t *meta) {
                             &options,
                             meta->number,
                             meta->file_size,
+                            meta->path_id,
+                            -1,
+                            0,
                             NULL);
 }
 
-static void
+static ldb_tabinfo_t *
 repair_table(ldb_repair_t *rep, const char *src, ldb_tabinfo_t *t) {
   /* We will copy src contents to a new table and then rename the
      new table over the source. */
+  const char *dir = ldb_table_dir(rep->dbname, &rep->options,
+                                  t->meta.path_id);
   ldb_tablegen_t *builder;
   char copy[LDB_PATH_MAX];
   char orig[LDB_PATH_MAX];
@@ -410,16 +584,14 @@ repair_table(ldb_repair_t *rep, const char *src, ldb_tabinfo_t *t) {
   int rc;
 
   /* Create builder. */
-  if (!ldb_table_filename(copy, sizeof(copy), rep->dbname,
-                          rep->next_file_number++)) {
+  if (!ldb_table_filename(copy, sizeof(copy), dir, new_file_number(rep)))
     abort(); /* LCOV_EXCL_LINE */
-  }
 
   rc = ldb_truncfile_create(copy, &file);
 
   if (rc != LDB_OK) {
     tabinfo_destroy(t);
-    return;
+    return NULL;
   }
 
   builder = ldb_tablegen_create(&rep->options, file);
@@ -462,7 +634,7 @@ repair_table(ldb_repair_t *rep, const char *src, ldb_tabinfo_t *t) {
   file = NULL;
 
   if (counter > 0 && rc == LDB_OK) {
-    if (!ldb_table_filename(orig, sizeof(orig), rep->dbname, t->meta.number))
+    if (!ldb_table_filename(orig, sizeof(orig), dir, t->meta.number))
       abort(); /* LCOV_EXCL_LINE */
 
     rc = ldb_rename_file(copy, orig);
@@ -472,20 +644,53 @@ repair_table(ldb_repair_t *rep, const char *src, ldb_tabinfo_t *t) {
                                      (unsigned long)t->meta.number,
                                      counter);
 
-      ldb_vector_push(&rep->tables, t);
-      t = NULL;
+      return t;
     }
   }
 
   if (rc != LDB_OK || counter == 0)
     ldb_remove_file(copy);
 
-  if (t != NULL)
-    tabinfo_destroy(t);
+  tabinfo_destroy(t);
+
+  return NULL;
 }
 
-static void
-scan_table(ldb_repair_t *rep, uint64_t number) {
+static int
+scan_tombstones(ldb_repair_t *rep, ldb_tabinfo_t *t) {
+  ldb_rangedel_t rd;
+  size_t i;
+  int rc;
+
+  ldb_rangedel_init(&rd, rep->icmp.user_comparator);
+
+  rc = ldb_tables_tombstones(rep->table_cache,
+                             t->meta.number,
+                             t->meta.file_size,
+                             t->meta.path_id,
+                             0,
+                             &rd);
+
+  for (i = 0; rc == LDB_OK && i < rd.tombstones.length; i++) {
+    const ldb_tombstone_t *tomb = rd.tombstones.items[i];
+
+    ldb_tombstone_bounds(tomb, &rep->icmp, &t->meta.smallest,
+                                           &t->meta.largest);
+
+    if (tomb->sequence > t->max_sequence)
+      t->max_sequence = tomb->sequence;
+
+    t->meta.tombstones++;
+  }
+
+  ldb_rangedel_clear(&rd);
+
+  return rc;
+}
+
+static ldb_tabinfo_t *
+scan_table(ldb_repair_t *rep, uint64_t number, int path_id) {
+  const char *dir = ldb_table_dir(rep->dbname, &rep->options, path_id);
   char fname[LDB_PATH_MAX];
   uint64_t file_size = 0;
   int counter, empty;
@@ -494,14 +699,14 @@ scan_table(ldb_repair_t *rep, uint64_t number) {
   ldb_tabinfo_t *t;
   int rc, status;
 
-  if (!ldb_table_filename(fname, sizeof(fname), rep->dbname, number))
+  if (!ldb_table_filename(fname, sizeof(fname), dir, number))
     abort(); /* LCOV_EXCL_LINE */
 
   rc = ldb_file_size(fname, &file_size);
 
   if (rc != LDB_OK) {
     /* Try alternate file name. */
-    if (!ldb_sstable_filename(fname, sizeof(fname), rep->dbname, number))
+    if (!ldb_sstable_filename(fname, sizeof(fname), dir, number))
       abort(); /* LCOV_EXCL_LINE */
 
     status = ldb_file_size(fname, &file_size);
@@ -511,22 +716,23 @@ scan_table(ldb_repair_t *rep, uint64_t number) {
   }
 
   if (rc != LDB_OK) {
-    ldb_table_filename(fname, sizeof(fname), rep->dbname, number);
+    ldb_table_filename(fname, sizeof(fname), dir, number);
     archive_file(rep, fname);
 
-    ldb_sstable_filename(fname, sizeof(fname), rep->dbname, number);
+    ldb_sstable_filename(fname, sizeof(fname), dir, number);
     archive_file(rep, fname);
 
     ldb_log(rep->options.info_log, "Table #%lu: dropped: %s",
                                    (unsigned long)number,
                                    ldb_strerror(rc));
 
-    return;
+    return NULL;
   }
 
   t = tabinfo_create();
   t->meta.file_size = file_size;
   t->meta.number = number;
+  t->meta.path_id = path_id;
 
   /* Extract metadata by scanning through table. */
   iter = tableiter_create(rep, &t->meta);
@@ -555,6 +761,16 @@ scan_table(ldb_repair_t *rep, uint64_t number) {
 
     if (parsed.sequence > t->max_sequence)
       t->max_sequence = parsed.sequence;
+
+    if (parsed.type == LDB_TYPE_BLOB) {
+      ldb_slice_t ref = ldb_iter_value(iter);
+      uint64_t blob = ldb_blobref_number(&ref);
+
+      if (blob != 0 && (t->meta.oldest_blob == 0 ||
+                        blob < t->meta.oldest_blob)) {
+        t->meta.oldest_blob = blob;
+      }
+    }
   }
 
   if (ldb_iter_status(iter) != LDB_OK)
@@ -562,22 +778,58 @@ scan_table(ldb_repair_t *rep, uint64_t number) {
 
   ldb_iter_destroy(iter);
 
+  /* Range tombstones are only kept for intact tables; repair_table()
+     copies the point entries alone. */
+  if (rc == LDB_OK)
+    rc = scan_tombstones(rep, t);
+
+  if (rc != LDB_OK)
+    t->meta.tombstones = 0;
+
   ldb_log(rep->options.info_log, "Table #%lu: %d entries %s",
                                  (unsigned long)t->meta.number,
                                  counter, ldb_strerror(rc));
 
-  if (rc == LDB_OK)
-    ldb_vector_push(&rep->tables, t);
-  else
-    repair_table(rep, fname, t); /* repair_table archives input file. */
+  if (rc != LDB_OK)
+    t = repair_table(rep, fname, t); /* repair_table archives input file. */
+
+  return t;
+}
+
+static void
+scan_table_call(void *arg) {
+  repair_job_t *job = arg;
+
+  job->table = scan_table(job->rep, job->number, job->path_id);
 }
 
 static void
 extract_meta_data(ldb_repair_t *rep) {
+  size_t length = rep->table_numbers.length;
+  repair_job_t *jobs;
   size_t i;
 
-  for (i = 0; i < rep->table_numbers.length; i++)
-    scan_table(rep, rep->table_numbers.items[i]);
+  if (length == 0)
+    return;
+
+  jobs = ldb_malloc(length * sizeof(repair_job_t));
+
+  for (i = 0; i < length; i++) {
+    jobs[i].rep = rep;
+    jobs[i].number = rep->table_numbers.items[i];
+    jobs[i].path_id = (int)rep->table_paths.items[i];
+    jobs[i].output = 0;
+    jobs[i].table = NULL;
+  }
+
+  repair_run_jobs(rep, jobs, length, &scan_table_call);
+
+  for (i = 0; i < length; i++) {
+    if (jobs[i].table != NULL)
+      ldb_vector_push(&rep->tables, jobs[i].table);
+  }
+
+  ldb_free(jobs);
 }
 
 static int
@@ -609,13 +861,21 @@ write_descriptor(ldb_repair_t *rep) {
   ldb_edit_set_next_file(&rep->edit, rep->next_file_number);
   ldb_edit_set_last_sequence(&rep->edit, max_sequence);
 
+  if (rep->options.wal_block_size != LDB_BLOCK_SIZE)
+    ldb_edit_set_log_block_size(&rep->edit, rep->options.wal_block_size);
+
   for (i = 0; i < rep->tables.length; i++) {
     const ldb_tabinfo_t *t = rep->tables.items[i];
+    ldb_filemeta_t *f;
+
+    f = ldb_edit_add_file(&rep->edit, 0, t->meta.number,
+                                         t->meta.file_size,
+                                         &t->meta.smallest,
+                                         &t->meta.largest);
 
-    ldb_edit_add_file(&rep->edit, 0, t->meta.number,
-                                     t->meta.file_size,
-                                     &t->meta.smallest,
-                                     &t->meta.largest);
+    f->tombstones = t->meta.tombstones;
+    f->oldest_blob = t->meta.oldest_blob;
+    f->path_id = t->meta.path_id;
   }
 
   {
@@ -29,6 +29,8 @@
  * -------------
  *
  * Writes require external synchronization, most likely a mutex.
+ * The exception is insert_concurrently(), which links nodes in with
+ * compare-and-swap and may be called by several writers at once.
  * Reads require a guarantee that the SkipList will not be destroyed
  * while the read is in progress. Apart from that, reads progress
  * without any internal locking or synchronization.
@@ -60,12 +62,16 @@
  * Constants
  */
 
-#define LDB_MAX_HEIGHT 12
+#define LDB_BRANCHING 4
 
 /*
  * SkipList::Node
  */
 
+/* In a prefixed list, each node is preceded by the big-endian value
+   of the first 8 bytes of its user key (zero-padded). Comparing two
+   such values orders the keys just as memcmp would, unless they are
+   equal. The head node has no prefix; it is never compared. */
 struct ldb_skipnode_s {
   const uint8_t *key;
   /* Array of length equal to the node height.
@@ -127,6 +133,31 @@ ldb_skipnode_set_nb(ldb_skipnode_t *node, int n, ldb_skipnode_t *x) {
 #endif
 }
 
+static uint64_t
+ldb_skipnode_prefix(const ldb_skipnode_t *node) {
+  uint64_t prefix;
+  memcpy(&prefix, (const uint8_t *)node - 8, 8);
+  return prefix;
+}
+
+static uint64_t
+ldb_skiplist_prefix(const uint8_t *key) {
+  ldb_slice_t x = ldb_slice_decode(key);
+  size_t len = x.size - 8; /* User key. */
+  uint64_t prefix = 0;
+  size_t i;
+
+  assert(x.size >= 8);
+
+  if (len > 8)
+    len = 8;
+
+  for (i = 0; i < len; i++)
+    prefix |= (uint64_t)x.data[i] << (56 - i * 8);
+
+  return prefix;
+}
+
 static ldb_skipnode_t *
 ldb_skipnode_create(ldb_skiplist_t *list, const uint8_t *key, int height) {
 #ifdef LDB_HAVE_ATOMICS
@@ -136,8 +167,18 @@ ldb_skipnode_create(ldb_skiplist_t *list, const uint8_t *key, int height) {
   size_t size = (sizeof(ldb_skipnode_t) +
                  sizeof(ldb_skipnode_t *) * (height - 1));
 #endif
+  ldb_skipnode_t *node;
+
+  if (list->prefixed && key != NULL) {
+    uint8_t *zp = ldb_arena_alloc_aligned(list->arena, 8 + size);
+    uint64_t prefix = ldb_skiplist_prefix(key);
+
+    memcpy(zp, &prefix, 8);
 
-  ldb_skipnode_t *node = ldb_arena_alloc_aligned(list->arena, size);
+    node = (void *)(zp + 8);
+  } else {
+    node = ldb_arena_alloc_aligned(list->arena, size);
+  }
 
   ldb_skipnode_init(node, key);
 
@@ -157,20 +198,31 @@ ldb_skiplist_init(ldb_skiplist_t *list,
 
   list->comparator = cmp;
   list->arena = arena;
+  list->prefixed = 0;
   list->head = ldb_skipnode_create(list, NULL, LDB_MAX_HEIGHT);
 
 #ifdef LDB_HAVE_ATOMICS
   ldb_atomic_init(&list->max_height, 1);
-  (void)mutex;
 #else
   list->max_height = 1;
-  list->mutex = mutex;
 #endif
 
+  list->mutex = mutex;
+
   ldb_rand_init(&list->rnd, 0xdeadbeef);
 
-  for (i = 0; i < LDB_MAX_HEIGHT; i++)
+  for (i = 0; i < LDB_MAX_HEIGHT; i++) {
     ldb_skipnode_set(list->head, i, NULL);
+    list->splice[i] = list->head;
+  }
+
+  list->splice_height = LDB_MAX_HEIGHT;
+}
+
+void
+ldb_skiplist_use_prefix(ldb_skiplist_t *list) {
+  assert(ldb_skipnode_next(list->head, 0) == NULL);
+  list->prefixed = 1;
 }
 
 static int
@@ -191,7 +243,28 @@ ldb_skiplist_compare(const ldb_skiplist_t *list,
   ldb_slice_t x = ldb_slice_decode(xp);
   ldb_slice_t y = ldb_slice_decode(yp);
 
-  return ldb_compare(list->comparator, &x, &y);
+  return ldb_compare_fast(list->comparator, &x, &y);
+}
+
+/* Compare a node to a key whose prefix is "prefix" (if prefixed). */
+static int
+ldb_skiplist_compare_node(const ldb_skiplist_t *list,
+                          const ldb_skipnode_t *node,
+                          const uint8_t *key,
+                          uint64_t prefix) {
+  if (list->prefixed) {
+    uint64_t node_prefix = ldb_skipnode_prefix(node);
+
+    if (node_prefix != prefix)
+      return node_prefix < prefix ? -1 : 1;
+  }
+
+  return ldb_skiplist_compare(list, node->key, key);
+}
+
+static uint64_t
+ldb_skiplist_key_prefix(const ldb_skiplist_t *list, const uint8_t *key) {
+  return list->prefixed ? ldb_skiplist_prefix(key) : 0;
 }
 
 static int
@@ -206,7 +279,8 @@ ldb_skiplist_randheight(ldb_skiplist_t *list) {
   /* Increase height with probability 1 in 4. */
   int height = 1;
 
-  while (height < LDB_MAX_HEIGHT && ldb_rand_one_in(&list->rnd, 4))
+  while (height < LDB_MAX_HEIGHT
+         && ldb_rand_one_in(&list->rnd, LDB_BRANCHING))
     height++;
 
   assert(height > 0);
@@ -219,9 +293,19 @@ ldb_skiplist_randheight(ldb_skiplist_t *list) {
 static int
 ldb_skiplist_key_after_node(const ldb_skiplist_t *list,
                             const uint8_t *key,
+                            uint64_t prefix,
                             ldb_skipnode_t *node) {
   /* A null node is considered infinite. */
-  return (node != NULL) && (ldb_skiplist_compare(list, node->key, key) < 0);
+  return (node != NULL)
+      && (ldb_skiplist_compare_node(list, node, key, prefix) < 0);
+}
+
+/* Start loading the node after "node" at "level" (the next one a
+   search would visit if it moves forward) while "node" is compared. */
+static void
+ldb_skiplist_prefetch(ldb_skipnode_t *node, int level) {
+  if (node != NULL)
+    LDB_PREFETCH(ldb_skipnode_next_nb(node, level));
 }
 
 /* Return the earliest node that comes at or after key.
@@ -234,13 +318,16 @@ static ldb_skipnode_t *
 ldb_skiplist_find_ge(const ldb_skiplist_t *list,
                      const uint8_t *key,
                      ldb_skipnode_t **prev) {
+  uint64_t prefix = ldb_skiplist_key_prefix(list, key);
   int level = ldb_skiplist_maxheight(list) - 1;
   ldb_skipnode_t *x = list->head;
 
   for (;;) {
     ldb_skipnode_t *next = ldb_skipnode_next(x, level);
 
-    if (ldb_skiplist_key_after_node(list, key, next)) {
+    ldb_skiplist_prefetch(next, level);
+
+    if (ldb_skiplist_key_after_node(list, key, prefix, next)) {
       /* Keep searching in this list. */
       x = next;
     } else {
@@ -260,6 +347,7 @@ ldb_skiplist_find_ge(const ldb_skiplist_t *list,
 /* Return head if there is no such node. */
 static ldb_skipnode_t *
 ldb_skiplist_find_lt(const ldb_skiplist_t *list, const uint8_t *key) {
+  uint64_t prefix = ldb_skiplist_key_prefix(list, key);
   int level = ldb_skiplist_maxheight(list) - 1;
   ldb_skipnode_t *x = list->head;
   ldb_skipnode_t *next;
@@ -269,7 +357,10 @@ ldb_skiplist_find_lt(const ldb_skiplist_t *list, const uint8_t *key) {
 
     next = ldb_skipnode_next(x, level);
 
-    if (next == NULL || ldb_skiplist_compare(list, next->key, key) >= 0) {
+    ldb_skiplist_prefetch(next, level);
+
+    if (next == NULL
+        || ldb_skiplist_compare_node(list, next, key, prefix) >= 0) {
       if (level == 0)
         return x;
 
@@ -303,15 +394,42 @@ ldb_skiplist_find_last(const ldb_skiplist_t *list) {
   }
 }
 
-void
-ldb_skiplist_insert(ldb_skiplist_t *list, const uint8_t *key) {
-  ldb_skipnode_t *prev[LDB_MAX_HEIGHT];
+/* Whether key goes right after the last node linked by insert(). */
+static int
+ldb_skiplist_splice_fits(const ldb_skiplist_t *list, const uint8_t *key) {
+  ldb_skipnode_t *last = list->splice[0];
+  uint64_t prefix;
+
+  if (list->splice_height == 0)
+    return 0;
+
+  prefix = ldb_skiplist_key_prefix(list, key);
+
+  if (last != list->head && !ldb_skiplist_key_after_node(list, key,
+                                                          prefix, last)) {
+    return 0;
+  }
+
+  return !ldb_skiplist_key_after_node(list, key, prefix,
+                                      ldb_skipnode_next_nb(last, 0));
+}
+
+static void
+ldb_skiplist_link(ldb_skiplist_t *list, const uint8_t *key) {
+  ldb_skipnode_t **prev = list->splice;
   ldb_skipnode_t *x;
   int i, height;
 
-  SKIP_LOCK(list->mutex);
+  if (ldb_skiplist_splice_fits(list, key)) {
+    /* Sequential insert: the last node precedes key on every level
+       it reaches, and its predecessors precede key on the rest. */
+    for (i = 1; i < list->splice_height; i++)
+      prev[i] = prev[0];
 
-  x = ldb_skiplist_find_ge(list, key, prev);
+    x = ldb_skipnode_next_nb(prev[0], 0);
+  } else {
+    x = ldb_skiplist_find_ge(list, key, prev);
+  }
 
   /* Our data structure does not allow duplicate insertion. */
   assert(x == NULL || !ldb_skiplist_equal(list, key, x->key));
@@ -345,9 +463,96 @@ ldb_skiplist_insert(ldb_skiplist_t *list, const uint8_t *key) {
     ldb_skipnode_set(prev[i], i, x);
   }
 
+  prev[0] = x;
+
+  list->splice_height = height;
+}
+
+void
+ldb_skiplist_insert(ldb_skiplist_t *list, const uint8_t *key) {
+  SKIP_LOCK(list->mutex);
+  ldb_skiplist_link(list, key);
   SKIP_UNLOCK(list->mutex);
 }
 
+#ifdef LDB_HAVE_ATOMIC_PTR_CAS
+void
+ldb_skiplist_insert_concurrently(ldb_skiplist_t *list, const uint8_t *key) {
+  ldb_skipnode_t *prev[LDB_MAX_HEIGHT];
+  ldb_skipnode_t *x, *next;
+  int i, height, max_height;
+  uint64_t prefix;
+
+  /* The arena and the random state are not thread-safe. Hold
+     the lock only long enough to allocate the node. */
+  ldb_mutex_lock(list->mutex);
+
+  height = ldb_skiplist_randheight(list);
+
+  x = ldb_skipnode_create(list, key, height);
+
+  /* Nodes linked here may fall between the splice and its
+     predecessors, so the next insert() must search. */
+  list->splice_height = 0;
+
+  ldb_mutex_unlock(list->mutex);
+
+  /* Raise max_height. Readers tolerate a stale value for the
+     same reasons described in link(). */
+  max_height = ldb_skiplist_maxheight(list);
+
+  while (height > max_height) {
+    int old = ldb_atomic_compare_exchange(&list->max_height,
+                                          max_height,
+                                          height);
+
+    if (old == max_height)
+      break;
+
+    max_height = old;
+  }
+
+  prefix = ldb_skiplist_key_prefix(list, key);
+
+  /* Levels above the height we search at start from head. */
+  for (i = 0; i < LDB_MAX_HEIGHT; i++)
+    prev[i] = list->head;
+
+  ldb_skiplist_find_ge(list, key, prev);
+
+  /* Splice in bottom-up. Once a node is reachable at level 0 it is
+     visible to readers; the upper levels only speed up searches. If
+     another writer wins the race for prev[i], walk forward from it:
+     nodes are never removed, so prev[i] is still before key. */
+  for (i = 0; i < height; i++) {
+    for (;;) {
+      next = ldb_skipnode_next(prev[i], i);
+
+      if (ldb_skiplist_key_after_node(list, key, prefix, next)) {
+        prev[i] = next;
+        continue;
+      }
+
+      /* Our data structure does not allow duplicate insertion. */
+      assert(next == NULL || !ldb_skiplist_equal(list, key, next->key));
+
+      ldb_skipnode_set_nb(x, i, next);
+
+      /* The CAS is a full barrier, publishing "x" to readers. */
+      if (ldb_atomic_compare_exchange_ptr(&prev[i]->next[i], &next, x))
+        break;
+    }
+  }
+}
+#else /* !LDB_HAVE_ATOMIC_PTR_CAS */
+void
+ldb_skiplist_insert_concurrently(ldb_skiplist_t *list, const uint8_t *key) {
+  ldb_mutex_lock(list->mutex);
+  ldb_skiplist_link(list, key);
+  ldb_mutex_unlock(list->mutex);
+}
+#endif /* !LDB_HAVE_ATOMIC_PTR_CAS */
+
 int
 ldb_skiplist_contains(const ldb_skiplist_t *list, const uint8_t *key) {
   ldb_skipnode_t *x;
@@ -364,6 +569,41 @@ ldb_skiplist_contains(const ldb_skiplist_t *list, const uint8_t *key) {
   return 0;
 }
 
+uint64_t
+ldb_skiplist_estimate(const ldb_skiplist_t *list, const uint8_t *key) {
+  uint64_t prefix = key != NULL ? ldb_skiplist_key_prefix(list, key) : 0;
+  /* Start from a level which holds about sqrt(n) nodes. The few
+     nodes on the levels above would each stand for too many entries
+     for their counts to mean much. */
+  int level = ldb_skiplist_maxheight(list) / 2;
+  ldb_skipnode_t *x = list->head;
+  uint64_t count = 0;
+
+  SKIP_LOCK(list->mutex);
+
+  for (;;) {
+    ldb_skipnode_t *next = ldb_skipnode_next(x, level);
+
+    if (key == NULL ? next != NULL
+                    : ldb_skiplist_key_after_node(list, key, prefix, next)) {
+      x = next;
+      count++;
+    } else {
+      if (level == 0)
+        break;
+
+      /* Each node on this level stands for about
+         LDB_BRANCHING nodes on the level below. */
+      count *= LDB_BRANCHING;
+      level--;
+    }
+  }
+
+  SKIP_UNLOCK(list->mutex);
+
+  return count;
+}
+
 /*
  * SkipList::Iterator
  */
@@ -18,6 +18,12 @@
 #include "util/atomic.h"
 #include "util/random.h"
 
+/*
+ * Constants
+ */
+
+#define LDB_MAX_HEIGHT 12
+
 /*
  * Types
  */
@@ -33,6 +39,7 @@ typedef struct ldb_skiplist_s {
   const struct ldb_comparator_s *comparator;
   struct ldb_arena_s *arena;
   ldb_skipnode_t *head;
+  int prefixed; /* Nodes carry a key prefix (see use_prefix()). */
 
 #ifdef LDB_HAVE_ATOMICS
   /* Modified only by insert(). Read racily by readers, but stale
@@ -40,11 +47,20 @@ typedef struct ldb_skiplist_s {
   ldb_atomic(int) max_height; /* Height of the entire list. */
 #else
   int max_height; /* Height of the entire list. */
-  struct ldb_mutex_s *mutex;
 #endif
 
+  /* Guards readers when atomics are unavailable, and node
+     allocation during insert_concurrently(). */
+  struct ldb_mutex_s *mutex;
+
   /* Read/written only by insert(). */
   ldb_rand_t rnd;
+
+  /* The node last linked by insert() (splice[0]) and, on each level
+     it does not reach, its predecessor. A key falling right after it
+     links in without a search. Cleared by insert_concurrently(). */
+  ldb_skipnode_t *splice[LDB_MAX_HEIGHT];
+  int splice_height; /* Height of splice[0], or zero if unset. */
 } ldb_skiplist_t;
 
 typedef struct ldb_skipiter_s {
@@ -67,15 +83,42 @@ ldb_skiplist_init(ldb_skiplist_t *list,
                   struct ldb_arena_s *arena,
                   struct ldb_mutex_s *mutex);
 
-/* Insert key into the list. */
+/* Store the first 8 bytes of each user key alongside its node, so
+ * that most comparisons during a search do not have to touch the key.
+ */
+/* REQUIRES: the list is empty. */
+/* REQUIRES: keys are internal keys ordered bytewise by user key. */
+void
+ldb_skiplist_use_prefix(ldb_skiplist_t *list);
+
+/* Insert key into the list. Keys inserted in increasing order are
+ * linked in constant time.
+ */
 /* REQUIRES: nothing that compares equal to key is currently in the list. */
 void
 ldb_skiplist_insert(ldb_skiplist_t *list, const uint8_t *key);
 
+/* Like insert(), but may be called by several threads at once. Inserts
+ * through insert() must not run at the same time. Falls back to
+ * serializing on the list mutex when pointer CAS is unavailable.
+ */
+/* REQUIRES: nothing that compares equal to key is currently in the list. */
+void
+ldb_skiplist_insert_concurrently(ldb_skiplist_t *list, const uint8_t *key);
+
 /* Returns true iff an entry that compares equal to key is in the list. */
 int
 ldb_skiplist_contains(const ldb_skiplist_t *list, const uint8_t *key);
 
+/* Returns an estimate of the number of entries less than key (or of
+ * all entries, if key is NULL). Rather than walking the list, this
+ * walks one of its middle levels (about sqrt(n) nodes) and descends
+ * from there. The estimates are in proportion to one another more so
+ * than to the true counts; scale them by the estimate for NULL.
+ */
+uint64_t
+ldb_skiplist_estimate(const ldb_skiplist_t *list, const uint8_t *key);
+
 /*
  * SkipList::Iterator
  */
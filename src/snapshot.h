@@ -76,16 +76,16 @@ ldb_snaplist_newest(const ldb_snaplist_t *list) {
   return list->head.prev;
 }
 
-/* Creates a snapshot and appends it to the end of the list. */
-LDB_UNUSED static ldb_snapshot_t *
-ldb_snaplist_new(ldb_snaplist_t *list, ldb_seqnum_t sequence) {
-  ldb_snapshot_t *snap;
-
+/* Appends a snapshot to the end of the list. The snapshot is
+   allocated by the caller, so that the DB's mutex need not be held
+   while allocating it. */
+LDB_UNUSED static void
+ldb_snaplist_insert(ldb_snaplist_t *list,
+                    ldb_snapshot_t *snap,
+                    ldb_seqnum_t sequence) {
   assert(ldb_snaplist_empty(list) ||
          ldb_snaplist_newest(list)->sequence <= sequence);
 
-  snap = ldb_malloc(sizeof(ldb_snapshot_t));
-
   snap->sequence = sequence;
   snap->next = &list->head;
   snap->prev = list->head.prev;
@@ -95,20 +95,18 @@ ldb_snaplist_new(ldb_snaplist_t *list, ldb_seqnum_t sequence) {
 #ifndef NDEBUG
   snap->list = list;
 #endif
-
-  return snap;
 }
 
-/* Removes a snapshot from this list.
+/* Removes a snapshot from this list. The caller frees it.
  *
- * The snapshot must have been created by calling new() on this list.
+ * The snapshot must have been inserted into this list.
  *
  * The snapshot pointer should not be const, because its memory is
  * deallocated. However, that would force us to change ldb_release(),
  * which is in the API, and currently takes a const snapshot.
  */
 LDB_UNUSED static void
-ldb_snaplist_delete(ldb_snaplist_t *list, const ldb_snapshot_t *snap) {
+ldb_snaplist_remove(ldb_snaplist_t *list, const ldb_snapshot_t *snap) {
 #ifndef NDEBUG
   assert(snap->list == list);
 #else
@@ -117,8 +115,6 @@ ldb_snaplist_delete(ldb_snaplist_t *list, const ldb_snapshot_t *snap) {
 
   snap->prev->next = snap->next;
   snap->next->prev = snap->prev;
-
-  ldb_free((void *)snap);
 }
 
 #endif /* LDB_SNAPSHOT_H */
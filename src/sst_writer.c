@@ -0,0 +1,208 @@
+/*!
+ * sst_writer.c - external sstable writer for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "table/table_builder.h"
+
+#include "util/bloom.h"
+#include "util/buffer.h"
+#include "util/comparator.h"
+#include "util/env.h"
+#include "util/internal.h"
+#include "util/options.h"
+#include "util/prefix.h"
+#include "util/slice.h"
+#include "util/status.h"
+
+#include "dbformat.h"
+#include "sst_writer.h"
+
+/*
+ * Types
+ */
+
+struct ldb_sstwriter_s {
+  char fname[LDB_PATH_MAX];
+  ldb_comparator_t user_comparator;
+  ldb_comparator_t internal_comparator;
+  ldb_bloom_t user_filter_policy;
+  ldb_bloom_t internal_filter_policy;
+  ldb_prefix_t user_prefix;
+  ldb_prefix_t internal_prefix;
+  ldb_dbopt_t options; /* options.comparator == &internal_comparator */
+  ldb_wfile_t *file;
+  ldb_tablegen_t *builder;
+  ldb_buffer_t last_key; /* User key. */
+  ldb_ikey_t key;
+  int finished;
+};
+
+/*
+ * SstWriter
+ */
+
+int
+ldb_sstwriter_open(const char *fname,
+                   const ldb_dbopt_t *options,
+                   ldb_sstwriter_t **writer) {
+  size_t len = strlen(fname);
+  ldb_sstwriter_t *sst;
+  ldb_wfile_t *file;
+  int rc;
+
+  *writer = NULL;
+
+  if (options == NULL || len + 1 > LDB_PATH_MAX)
+    return LDB_INVALID;
+
+  rc = ldb_truncfile_create(fname, &file);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  sst = ldb_malloc(sizeof(ldb_sstwriter_t));
+
+  memcpy(sst->fname, fname, len + 1);
+
+  if (options->comparator != NULL)
+    sst->user_comparator = *options->comparator;
+  else
+    sst->user_comparator = *ldb_bytewise_comparator;
+
+  ldb_ikc_init(&sst->internal_comparator, &sst->user_comparator);
+
+  sst->options = *options;
+  sst->options.comparator = &sst->internal_comparator;
+
+  if (options->filter_policy != NULL) {
+    sst->user_filter_policy = *options->filter_policy;
+
+    ldb_ifp_init(&sst->internal_filter_policy, &sst->user_filter_policy);
+
+    sst->options.filter_policy = &sst->internal_filter_policy;
+  }
+
+  if (options->prefix_extractor != NULL) {
+    sst->user_prefix = *options->prefix_extractor;
+
+    ldb_ipe_init(&sst->internal_prefix, &sst->user_prefix);
+
+    sst->options.prefix_extractor = &sst->internal_prefix;
+  }
+
+  sst->file = file;
+  sst->builder = ldb_tablegen_create(&sst->options, file);
+  sst->finished = 0;
+
+  ldb_buffer_init(&sst->last_key);
+  ldb_ikey_init(&sst->key);
+
+  *writer = sst;
+
+  return LDB_OK;
+}
+
+static int
+ldb_sstwriter_add(ldb_sstwriter_t *sst,
+                  const ldb_slice_t *key,
+                  const ldb_slice_t *value,
+                  ldb_valtype_t type) {
+  int rc = ldb_tablegen_status(sst->builder);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  if (sst->finished)
+    return LDB_INVALID;
+
+  if (ldb_tablegen_entries(sst->builder) > 0) {
+    if (ldb_compare(&sst->user_comparator, key, &sst->last_key) <= 0)
+      return LDB_INVALID; /* "keys must be added in strict ascending order" */
+  }
+
+  ldb_buffer_set(&sst->last_key, key->data, key->size);
+  ldb_ikey_set(&sst->key, key, 0, type);
+
+  ldb_tablegen_add(sst->builder, &sst->key, value);
+
+  return ldb_tablegen_status(sst->builder);
+}
+
+int
+ldb_sstwriter_put(ldb_sstwriter_t *sst,
+                  const ldb_slice_t *key,
+                  const ldb_slice_t *value) {
+  return ldb_sstwriter_add(sst, key, value, LDB_TYPE_VALUE);
+}
+
+int
+ldb_sstwriter_del(ldb_sstwriter_t *sst, const ldb_slice_t *key) {
+  ldb_slice_t empty = ldb_string("");
+  return ldb_sstwriter_add(sst, key, &empty, LDB_TYPE_DELETION);
+}
+
+int
+ldb_sstwriter_finish(ldb_sstwriter_t *sst) {
+  int rc;
+
+  if (sst->finished)
+    return LDB_INVALID;
+
+  if (ldb_tablegen_entries(sst->builder) == 0)
+    return LDB_INVALID; /* "cannot create a table with no entries" */
+
+  rc = ldb_tablegen_finish(sst->builder);
+
+  sst->finished = 1;
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_sync(sst->file);
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_close(sst->file);
+
+  ldb_wfile_destroy(sst->file);
+
+  sst->file = NULL;
+
+  if (rc != LDB_OK)
+    ldb_remove_file(sst->fname);
+
+  return rc;
+}
+
+uint64_t
+ldb_sstwriter_entries(const ldb_sstwriter_t *sst) {
+  return ldb_tablegen_entries(sst->builder);
+}
+
+uint64_t
+ldb_sstwriter_size(const ldb_sstwriter_t *sst) {
+  return ldb_tablegen_size(sst->builder);
+}
+
+void
+ldb_sstwriter_close(ldb_sstwriter_t *sst) {
+  if (!sst->finished)
+    ldb_tablegen_abandon(sst->builder);
+
+  ldb_tablegen_destroy(sst->builder);
+
+  if (sst->file != NULL) {
+    ldb_wfile_close(sst->file);
+    ldb_wfile_destroy(sst->file);
+    ldb_remove_file(sst->fname);
+  }
+
+  ldb_buffer_clear(&sst->last_key);
+  ldb_ikey_clear(&sst->key);
+  ldb_free(sst);
+}
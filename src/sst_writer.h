@@ -0,0 +1,70 @@
+/*!
+ * sst_writer.h - external sstable writer for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_SST_WRITER_H
+#define LDB_SST_WRITER_H
+
+#include <stdint.h>
+
+#include "util/extern.h"
+#include "util/options.h"
+#include "util/types.h"
+
+/*
+ * Types
+ */
+
+/* Builds a table outside of any database, to be bulk loaded into one
+   with ldb_ingest(). Every key is written with a sequence number of
+   zero; the database assigns the file a sequence number of its own
+   when it is ingested. */
+typedef struct ldb_sstwriter_s ldb_sstwriter_t;
+
+/*
+ * SstWriter
+ */
+
+/* Create the table file "fname". The comparator, filter policy and
+   prefix extractor in "options" must match those of the database the
+   table is ingested into. The table is compressed with
+   options->compression. */
+LDB_EXTERN int
+ldb_sstwriter_open(const char *fname,
+                   const ldb_dbopt_t *options,
+                   ldb_sstwriter_t **writer);
+
+/* Add key,value to the table. Keys must be added in strictly
+   increasing order; LDB_INVALID is returned otherwise. */
+LDB_EXTERN int
+ldb_sstwriter_put(ldb_sstwriter_t *sst,
+                  const ldb_slice_t *key,
+                  const ldb_slice_t *value);
+
+/* Add a deletion of key to the table (see ldb_sstwriter_put()). */
+LDB_EXTERN int
+ldb_sstwriter_del(ldb_sstwriter_t *sst, const ldb_slice_t *key);
+
+/* Finish the table and sync it to disk. A table without any entries
+   is not written, and LDB_INVALID is returned. */
+LDB_EXTERN int
+ldb_sstwriter_finish(ldb_sstwriter_t *sst);
+
+/* Number of entries added so far. */
+LDB_EXTERN uint64_t
+ldb_sstwriter_entries(const ldb_sstwriter_t *sst);
+
+/* Size of the file generated so far (the final size after
+   ldb_sstwriter_finish()). */
+LDB_EXTERN uint64_t
+ldb_sstwriter_size(const ldb_sstwriter_t *sst);
+
+/* Destroy the writer. The file is removed unless it was finished. */
+LDB_EXTERN void
+ldb_sstwriter_close(ldb_sstwriter_t *sst);
+
+#endif /* LDB_SST_WRITER_H */
@@ -17,6 +17,7 @@
 #include "../util/buffer.h"
 #include "../util/coding.h"
 #include "../util/comparator.h"
+#include "../util/hash.h"
 #include "../util/internal.h"
 #include "../util/slice.h"
 #include "../util/status.h"
@@ -53,18 +54,73 @@ ldb_block_init(ldb_block_t *block, const ldb_contents_t *contents) {
   block->data = contents->data.data;
   block->size = contents->data.size;
   block->restart_offset = 0;
+  block->num_restarts = 0;
+  block->buckets = NULL;
+  block->num_buckets = 0;
+  block->prefixes = NULL;
+  block->value_restarts = NULL;
   block->owned = contents->heap_allocated;
+  block->verified = contents->verified;
 
   if (block->size < 4) {
     block->size = 0; /* Error marker. */
   } else {
-    size_t max_restarts_allowed = (block->size - 4) / 4;
+    uint32_t mask = LDB_HASH_FLAG | LDB_PREFIX_FLAG | LDB_SPLIT_FLAG;
+    uint32_t num_restarts = ldb_block_restarts(block);
+    uint32_t flags = num_restarts & mask;
+    size_t trailer = 4;
+    size_t width = 4;
 
-    if (ldb_block_restarts(block) > max_restarts_allowed) {
+    num_restarts &= ~mask;
+
+    if (flags & LDB_SPLIT_FLAG)
+      width += 4;
+
+    if (flags & LDB_PREFIX_FLAG)
+      width += 8;
+
+    if (flags & LDB_HASH_FLAG) {
+      if (block->size < 8) {
+        block->size = 0;
+        return;
+      }
+
+      block->num_buckets = ldb_fixed32_decode(block->data + block->size - 8);
+
+      if (block->num_buckets == 0 || block->num_buckets > block->size - 8) {
+        block->size = 0;
+        return;
+      }
+
+      trailer += 4 + block->num_buckets;
+    }
+
+    if (num_restarts > (block->size - trailer) / width) {
       /* The size is too small for ldb_block_restarts(). */
       block->size = 0;
     } else {
-      block->restart_offset = block->size - (1 + ldb_block_restarts(block)) * 4;
+      block->restart_offset = block->size - trailer - num_restarts * width;
+      block->num_restarts = num_restarts;
+
+      if (block->num_buckets > 0)
+        block->buckets = block->data + block->size - trailer;
+
+      if (flags & LDB_SPLIT_FLAG) {
+        block->value_restarts = block->data + block->restart_offset
+                                            + num_restarts * 4;
+
+        /* The values must start after the entries and within the block. */
+        if (num_restarts == 0 || ldb_fixed32_decode(block->value_restarts)
+                                   > block->restart_offset) {
+          block->size = 0;
+          return;
+        }
+      }
+
+      if (flags & LDB_PREFIX_FLAG) {
+        block->prefixes = block->data + block->restart_offset
+                                      + num_restarts * (width - 8);
+      }
     }
   }
 }
@@ -75,10 +131,49 @@ ldb_block_clear(ldb_block_t *block) {
     ldb_free((void *)block->data);
 }
 
+uint32_t
+ldb_block_hash(const ldb_comparator_t *comparator, const ldb_slice_t *key) {
+  size_t size = key->size;
+
+  /* Internal keys are hashed without their sequence number
+     so that every version of a user key shares a bucket. */
+  if (comparator->user_comparator != NULL) {
+    assert(size >= 8);
+    size -= 8;
+  }
+
+  return ldb_hash(key->data, size, 0x3a5c7e19);
+}
+
+int
+ldb_block_can_prefix(const ldb_comparator_t *comparator) {
+  return comparator == ldb_bytewise_comparator
+      || comparator->compare == ldb_ikc_bytewise;
+}
+
+uint64_t
+ldb_block_prefix(const ldb_comparator_t *comparator, const ldb_slice_t *key) {
+  size_t size = key->size;
+  uint64_t prefix = 0;
+  size_t i;
+
+  if (comparator->user_comparator != NULL) {
+    assert(size >= 8);
+    size -= 8;
+  }
+
+  for (i = 0; i < 8; i++)
+    prefix = (prefix << 8) | (i < size ? key->data[i] : 0);
+
+  return prefix;
+}
+
 /* Helper routine: decode the next block entry starting at "xp",
  * storing the number of shared key bytes, non_shared key bytes,
  * and the length of the value in "*shared", "*non_shared", and
  * "*value_length", respectively. Will not dereference past "limit".
+ * The value is expected to follow the key delta unless "split" is
+ * set (see separate_block_values).
  *
  * If any errors are detected, returns NULL. Otherwise, returns a
  * pointer to the key delta (just past the three decoded values).
@@ -88,7 +183,9 @@ decode_entry(uint32_t *shared,
              uint32_t *non_shared,
              uint32_t *value_length,
              const uint8_t *xp,
-             const uint8_t *limit) {
+             const uint8_t *limit,
+             int split) {
+  uint32_t wide, mask;
   size_t xn;
 
   if (limit < xp)
@@ -99,14 +196,20 @@ decode_entry(uint32_t *shared,
   if (xn < 3)
     return NULL;
 
-  *shared = xp[0];
-  *non_shared = xp[1];
-  *value_length = xp[2];
+  wide = xp[2] >> 7;
+  mask = -wide;
 
-  if ((*shared | *non_shared | *value_length) < 128) {
-    /* Fast path: all three values are encoded in one byte each. */
-    xp += 3;
-    xn -= 3;
+  if (xn >= 4 && (xp[0] | xp[1] | (xp[3] & mask)) < 128) {
+    /* Fast path: the key lengths are encoded in one byte each and
+       the value length in one or two (values under 16K). Its width
+       tends to vary from one entry to the next, so it is decoded
+       without branching on it. */
+    *shared = xp[0];
+    *non_shared = xp[1];
+    *value_length = (xp[2] & 127) | (((uint32_t)xp[3] << 7) & mask);
+
+    xp += 3 + wide;
+    xn -= 3 + wide;
   } else {
     if (!ldb_varint32_read(shared, &xp, &xn))
       return NULL;
@@ -118,7 +221,7 @@ decode_entry(uint32_t *shared,
       return NULL;
   }
 
-  if (xn < ((uint64_t)*non_shared + *value_length))
+  if (xn < ((uint64_t)*non_shared + (split ? 0 : *value_length)))
     return NULL;
 
   return xp;
@@ -133,10 +236,17 @@ typedef struct ldb_blockiter_s {
   const uint8_t *data;    /* Underlying block contents. */
   uint32_t restarts;      /* Offset of restart array (list of fixed32). */
   uint32_t num_restarts;  /* Number of uint32_t entries in restart array. */
+  const uint8_t *buckets; /* Hash index (may be NULL). */
+  uint32_t num_buckets;   /* Number of hash index buckets. */
+  const uint8_t *prefixes; /* Restart key prefixes (may be NULL). */
+  const uint8_t *value_restarts; /* Value offsets (may be NULL). */
+  uint32_t limit;         /* End of the entries. */
 
   /* current is offset in data of current entry. >= restarts if !valid. */
   uint32_t current;
   uint32_t restart_index; /* Index of restart block in which current falls. */
+  uint32_t next;          /* Offset of the entry after current. */
+  uint32_t next_value;    /* Offset of its value, if values are apart. */
   ldb_buffer_t key;
   ldb_slice_t value;
   int status;
@@ -146,22 +256,30 @@ static int
 do_compare(const ldb_blockiter_t *iter,
            const ldb_slice_t *x,
            const ldb_slice_t *y) {
-  return ldb_compare(iter->comparator, x, y);
+  return ldb_compare_fast(iter->comparator, x, y);
 }
 
-/* Return the offset in iter->data just past the end of the current entry. */
 static uint32_t
-next_entry_offset(const ldb_blockiter_t *iter) {
-  return (iter->value.data + iter->value.size) - iter->data;
+get_restart_point(const ldb_blockiter_t *iter, uint32_t index) {
+  uint32_t offset;
+
+  assert(index < iter->num_restarts);
+
+  offset = ldb_fixed32_decode(iter->data + iter->restarts + index * 4);
+
+  if (UNLIKELY(offset > iter->limit))
+    offset = iter->limit;
+
+  return offset;
 }
 
 static uint32_t
-get_restart_point(const ldb_blockiter_t *iter, uint32_t index) {
+get_value_restart(const ldb_blockiter_t *iter, uint32_t index) {
   uint32_t offset;
 
   assert(index < iter->num_restarts);
 
-  offset = ldb_fixed32_decode(iter->data + iter->restarts + index * 4);
+  offset = ldb_fixed32_decode(iter->value_restarts + index * 4);
 
   if (UNLIKELY(offset > iter->restarts))
     offset = iter->restarts;
@@ -169,6 +287,27 @@ get_restart_point(const ldb_blockiter_t *iter, uint32_t index) {
   return offset;
 }
 
+/* Number of restart points whose key prefix is below "prefix"
+   (or at most "prefix" if "upper" is set). */
+static uint32_t
+restart_prefix_bound(const ldb_blockiter_t *iter, uint64_t prefix, int upper) {
+  const uint8_t *prefixes = iter->prefixes;
+  uint32_t lo = 0;
+  uint32_t hi = iter->num_restarts;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    uint64_t x = ldb_fixed64_decode(prefixes + mid * 8);
+
+    if (x < prefix || (upper && x == prefix))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
 static void
 seek_to_restart_point(ldb_blockiter_t *iter, uint32_t index) {
   uint32_t offset;
@@ -178,28 +317,42 @@ seek_to_restart_point(ldb_blockiter_t *iter, uint32_t index) {
   iter->restart_index = index;
 
   /* iter->current will be fixed by parse_next_key() */
-
-  /* parse_next_key() starts at the end of iter->value,
-     so set iter->value accordingly */
   offset = get_restart_point(iter, index);
 
-  ldb_slice_set(&iter->value, iter->data + offset, 0);
+  iter->next = offset;
+
+  if (iter->value_restarts != NULL)
+    iter->next_value = get_value_restart(iter, index);
 }
 
 static void
 ldb_blockiter_init(ldb_blockiter_t *iter,
                    const ldb_comparator_t *comparator,
-                   const uint8_t *data,
-                   uint32_t restarts,
-                   uint32_t num_restarts) {
-  assert(num_restarts > 0);
+                   const ldb_block_t *block) {
+  assert(block->num_restarts > 0);
 
   iter->comparator = comparator;
-  iter->data = data;
-  iter->restarts = restarts;
-  iter->num_restarts = num_restarts;
+  iter->data = block->data;
+  iter->restarts = block->restart_offset;
+  iter->num_restarts = block->num_restarts;
+  iter->buckets = block->buckets;
+  iter->num_buckets = block->num_buckets;
+  iter->prefixes = NULL;
+  iter->value_restarts = block->value_restarts;
+  iter->limit = block->restart_offset;
+
+  if (block->prefixes != NULL && ldb_block_can_prefix(comparator))
+    iter->prefixes = block->prefixes;
+
+  /* Restart points point into the entries, which end where the values
+     begin. */
+  if (block->value_restarts != NULL)
+    iter->limit = ldb_fixed32_decode(block->value_restarts);
+
   iter->current = iter->restarts;
   iter->restart_index = iter->num_restarts;
+  iter->next = iter->limit;
+  iter->next_value = iter->restarts;
 
   ldb_buffer_init(&iter->key);
   ldb_slice_init(&iter->value);
@@ -250,10 +403,10 @@ parse_next_key(ldb_blockiter_t *iter) {
   uint32_t shared, non_shared, value_length;
   const uint8_t *p, *limit;
 
-  iter->current = next_entry_offset(iter);
+  iter->current = iter->next;
 
   p = iter->data + iter->current;
-  limit = iter->data + iter->restarts; /* Restarts come right after data. */
+  limit = iter->data + iter->limit;
 
   if (p >= limit) {
     /* No more entries to return. Mark as invalid. */
@@ -263,7 +416,8 @@ parse_next_key(ldb_blockiter_t *iter) {
   }
 
   /* Decode next entry. */
-  p = decode_entry(&shared, &non_shared, &value_length, p, limit);
+  p = decode_entry(&shared, &non_shared, &value_length, p, limit,
+                   iter->value_restarts != NULL);
 
   if (p == NULL || iter->key.size < shared) {
     ldb_blockiter_corruption(iter);
@@ -275,11 +429,25 @@ parse_next_key(ldb_blockiter_t *iter) {
     return 0;
   }
 
+  if (iter->value_restarts != NULL) {
+    if (value_length > iter->restarts - iter->next_value) {
+      ldb_blockiter_corruption(iter);
+      return 0;
+    }
+
+    ldb_slice_set(&iter->value, iter->data + iter->next_value, value_length);
+
+    iter->next = (p + non_shared) - iter->data;
+    iter->next_value += value_length;
+  } else {
+    ldb_slice_set(&iter->value, p + non_shared, value_length);
+
+    iter->next = (p + non_shared + value_length) - iter->data;
+  }
+
   ldb_buffer_resize(&iter->key, shared);
   ldb_buffer_append(&iter->key, p, non_shared);
 
-  ldb_slice_set(&iter->value, p + non_shared, value_length);
-
   while (iter->restart_index + 1 < iter->num_restarts &&
          get_restart_point(iter, iter->restart_index + 1) < iter->current) {
     ++iter->restart_index;
@@ -317,7 +485,7 @@ ldb_blockiter_prev(ldb_blockiter_t *iter) {
 
   do {
     /* Loop until end of current entry hits the start of original entry. */
-  } while (parse_next_key(iter) && next_entry_offset(iter) < original);
+  } while (parse_next_key(iter) && iter->next < original);
 }
 
 static void
@@ -354,17 +522,46 @@ ldb_blockiter_seek(ldb_blockiter_t *iter, const ldb_slice_t *target) {
     }
   }
 
+  if (iter->prefixes != NULL && left < right) {
+    uint64_t prefix = ldb_block_prefix(iter->comparator, target);
+    uint32_t lo, hi;
+
+    /* Restart keys with a smaller prefix are below the target and those
+       with a larger one above it. Only ties need their keys decoded. */
+    lo = restart_prefix_bound(iter, prefix, 0);
+    hi = restart_prefix_bound(iter, prefix, 1);
+
+    if (lo > 0 && lo - 1 > left)
+      left = lo - 1;
+
+    if (hi == 0)
+      right = left;
+    else if (hi - 1 < right)
+      right = LDB_MAX(hi - 1, left);
+  }
+
   while (left < right) {
     uint32_t mid = (left + right + 1) / 2;
     uint32_t region_offset = get_restart_point(iter, mid);
     uint32_t shared, non_shared, value_length;
-    const uint8_t *key_ptr = decode_entry(&shared,
-                                          &non_shared,
-                                          &value_length,
-                                          iter->data + region_offset,
-                                          iter->data + iter->restarts);
+    const uint8_t *key_ptr;
     ldb_slice_t mid_key;
 
+    /* Start loading both keys the next step could probe while this
+       one is decoded and compared. */
+    if (mid - left > 1)
+      LDB_PREFETCH(iter->data + get_restart_point(iter, (left + mid) / 2));
+
+    if (right - mid > 0)
+      LDB_PREFETCH(iter->data + get_restart_point(iter, (mid + right + 1) / 2));
+
+    key_ptr = decode_entry(&shared,
+                           &non_shared,
+                           &value_length,
+                           iter->data + region_offset,
+                           iter->data + iter->limit,
+                           iter->value_restarts != NULL);
+
     if (key_ptr == NULL || (shared != 0)) {
       ldb_blockiter_corruption(iter);
       return;
@@ -418,7 +615,7 @@ static void
 ldb_blockiter_last(ldb_blockiter_t *iter) {
   seek_to_restart_point(iter, iter->num_restarts - 1);
 
-  while (parse_next_key(iter) && next_entry_offset(iter) < iter->restarts) {
+  while (parse_next_key(iter) && iter->next < iter->limit) {
     /* Keep skipping. */
   }
 }
@@ -429,23 +626,71 @@ ldb_iter_t *
 ldb_blockiter_create(const ldb_block_t *block,
                      const ldb_comparator_t *comparator) {
   ldb_blockiter_t *iter;
-  uint32_t num_restarts;
 
   if (block->size < 4)
     return ldb_emptyiter_create(LDB_CORRUPTION); /* "bad block contents" */
 
-  num_restarts = ldb_block_restarts(block);
-
-  if (num_restarts == 0)
+  if (block->num_restarts == 0)
     return ldb_emptyiter_create(LDB_OK);
 
-  iter = ldb_malloc(sizeof(ldb_blockiter_t));
+  iter = ldb_small_alloc(sizeof(ldb_blockiter_t));
+
+  ldb_blockiter_init(iter, comparator, block);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_blockiter_t),
+                               &ldb_blockiter_table, comparator);
+}
+
+void
+ldb_blockiter_seek_get(ldb_iter_t *it, const ldb_slice_t *target) {
+  ldb_blockiter_t *iter = it->ptr;
+  uint32_t index;
+
+  if (it->table != &ldb_blockiter_table || iter->buckets == NULL) {
+    ldb_iter_seek(it, target);
+    return;
+  }
+
+  if (iter->comparator->user_comparator != NULL && target->size < 8) {
+    ldb_blockiter_corruption(iter);
+    return;
+  }
+
+  index = ldb_block_hash(iter->comparator, target) % iter->num_buckets;
+  index = iter->buckets[index];
 
-  ldb_blockiter_init(iter,
-                     comparator,
-                     block->data,
-                     block->restart_offset,
-                     num_restarts);
+  if (index == LDB_HASH_EMPTY) {
+    /* No entry shares the user key. */
+    iter->current = iter->restarts;
+    iter->restart_index = iter->num_restarts;
+    return;
+  }
+
+  if (index == LDB_HASH_COLLISION) {
+    ldb_blockiter_seek(iter, target);
+    return;
+  }
+
+  if (index >= iter->num_restarts) {
+    ldb_blockiter_corruption(iter);
+    return;
+  }
+
+  /* Every version of the user key lives in this restart run,
+     so there is no need to look past the end of it. */
+  seek_to_restart_point(iter, index);
 
-  return ldb_iter_create(iter, &ldb_blockiter_table, comparator);
+  for (;;) {
+    if (!parse_next_key(iter))
+      return;
+
+    if (iter->restart_index != index) {
+      iter->current = iter->restarts;
+      iter->restart_index = iter->num_restarts;
+      return;
+    }
+
+    if (do_compare(iter, &iter->key, target) >= 0)
+      return;
+  }
 }
@@ -16,6 +16,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "../util/types.h"
+
 /*
  * Types
  */
@@ -28,7 +30,14 @@ typedef struct ldb_block_s {
   const uint8_t *data;
   size_t size;
   uint32_t restart_offset;  /* Offset in data of restart array. */
+  uint32_t num_restarts;    /* Number of entries in restart array. */
+  const uint8_t *buckets;   /* Hash index (may be NULL). */
+  uint32_t num_buckets;     /* Number of hash index buckets. */
+  const uint8_t *prefixes;  /* Restart key prefixes (may be NULL). */
+  const uint8_t *value_restarts; /* Value offsets of restart points
+                                    (NULL unless values are apart). */
   int owned;                /* Block owns data[]. */
+  int verified;             /* Checksum was checked when read. */
 } ldb_block_t;
 
 /*
@@ -47,6 +56,21 @@ ldb_block_init(ldb_block_t *block, const struct ldb_contents_s *contents);
 void
 ldb_block_clear(ldb_block_t *block);
 
+/* Hash of the user portion of key, as stored in a block's hash index. */
+uint32_t
+ldb_block_hash(const struct ldb_comparator_s *comparator,
+               const ldb_slice_t *key);
+
+/* Whether restart key prefixes order keys as the comparator does. */
+int
+ldb_block_can_prefix(const struct ldb_comparator_s *comparator);
+
+/* The first 8 bytes of the user portion of key as a big-endian integer
+   (zero padded), as stored for each restart point. */
+uint64_t
+ldb_block_prefix(const struct ldb_comparator_s *comparator,
+                 const ldb_slice_t *key);
+
 /*
  * Block Iterator
  */
@@ -55,4 +79,11 @@ struct ldb_iter_s *
 ldb_blockiter_create(const ldb_block_t *block,
                      const struct ldb_comparator_s *comparator);
 
+/* Position a block iterator for a point lookup of target. Uses the
+   block's hash index where possible and otherwise behaves like seek().
+   The iterator may be left invalid if the hash index shows that no
+   entry in the block shares target's user key. */
+void
+ldb_blockiter_seek_get(struct ldb_iter_s *iter, const ldb_slice_t *target);
+
 #endif /* LDB_BLOCK_H */
@@ -13,16 +13,20 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "../util/array.h"
 #include "../util/buffer.h"
+#include "../util/coding.h"
 #include "../util/comparator.h"
 #include "../util/internal.h"
 #include "../util/options.h"
 #include "../util/slice.h"
 #include "../util/vector.h"
 
+#include "block.h"
 #include "block_builder.h"
+#include "format.h"
 
 /* BlockBuilder generates blocks where keys are prefix-compressed:
  *
@@ -47,12 +51,49 @@
  *     restarts: uint32[num_restarts]
  *     num_restarts: uint32
  * restarts[i] contains the offset within the block of the ith restart point.
+ *
+ * With data_block_hash_index, the trailer instead has the form:
+ *     restarts: uint32[num_restarts]
+ *     buckets: uint8[num_buckets]
+ *     num_buckets: uint32
+ *     num_restarts: uint32 (with the high bit set)
+ * Each user key is hashed to a bucket holding the index of the restart
+ * point whose run contains the key. Buckets are LDB_HASH_EMPTY if no key
+ * maps to them and LDB_HASH_COLLISION if the keys mapping to them live
+ * in different runs.
+ *
+ * With restart_key_prefixes, the restart array is followed by:
+ *     prefixes: uint64[num_restarts]
+ * and num_restarts has LDB_PREFIX_FLAG set. prefixes[i] holds the first
+ * 8 bytes of the user key at the ith restart point (see
+ * ldb_block_prefix()).
+ *
+ * With separate_block_values, the entries leave out their values,
+ * which follow all of the entries, in the same order:
+ *     entries: entry[n] (without values)
+ *     values: char[]
+ * and the restart array is followed (before any prefixes) by:
+ *     value_restarts: uint32[num_restarts]
+ * with LDB_SPLIT_FLAG set in num_restarts. value_restarts[i] holds the
+ * offset within the block of the value of the ith restart point, so
+ * value_restarts[0] is also where the entries end.
  */
 
 /*
  * BlockBuilder
  */
 
+static int
+use_prefixes(const ldb_blockgen_t *bb) {
+  return bb->options->restart_key_prefixes
+      && ldb_block_can_prefix(bb->options->comparator);
+}
+
+static int
+use_split(const ldb_blockgen_t *bb) {
+  return bb->options->separate_block_values;
+}
+
 void
 ldb_blockgen_init(ldb_blockgen_t *bb, const ldb_dbopt_t *options) {
   assert(options->block_restart_interval >= 1);
@@ -63,15 +104,24 @@ ldb_blockgen_init(ldb_blockgen_t *bb, const ldb_dbopt_t *options) {
 
   ldb_buffer_init(&bb->buffer);
   ldb_array_init(&bb->restarts);
+  ldb_array_init(&bb->hashes);
+  ldb_array_init(&bb->prefixes);
+  ldb_buffer_init(&bb->values);
+  ldb_array_init(&bb->value_restarts);
   ldb_buffer_init(&bb->last_key);
 
   ldb_array_push(&bb->restarts, 0); /* First restart point is at offset 0. */
+  ldb_array_push(&bb->value_restarts, 0);
 }
 
 void
 ldb_blockgen_clear(ldb_blockgen_t *bb) {
   ldb_buffer_clear(&bb->buffer);
   ldb_array_clear(&bb->restarts);
+  ldb_array_clear(&bb->hashes);
+  ldb_array_clear(&bb->prefixes);
+  ldb_buffer_clear(&bb->values);
+  ldb_array_clear(&bb->value_restarts);
   ldb_buffer_clear(&bb->last_key);
 }
 
@@ -79,8 +129,13 @@ void
 ldb_blockgen_reset(ldb_blockgen_t *bb) {
   ldb_buffer_reset(&bb->buffer);
   ldb_array_reset(&bb->restarts);
+  ldb_array_reset(&bb->hashes);
+  ldb_array_reset(&bb->prefixes);
+  ldb_buffer_reset(&bb->values);
+  ldb_array_reset(&bb->value_restarts);
 
   ldb_array_push(&bb->restarts, 0); /* First restart point is at offset 0. */
+  ldb_array_push(&bb->value_restarts, 0);
 
   bb->counter = 0;
   bb->finished = 0;
@@ -104,16 +159,20 @@ ldb_blockgen_add(ldb_blockgen_t *bb,
 
   if (bb->counter < bb->options->block_restart_interval) {
     /* See how much sharing to do with previous string. */
-    size_t min_length = LDB_MIN(last->size, key->size);
-
-    while (shared < min_length && last->data[shared] == key->data[shared])
-      shared++;
+    shared = ldb_slice_shared(last, key);
   } else {
     /* Restart compression. */
     ldb_array_push(&bb->restarts, bb->buffer.size);
+    ldb_array_push(&bb->value_restarts, bb->values.size);
     bb->counter = 0;
   }
 
+  if (bb->counter == 0 && use_prefixes(bb)) {
+    uint64_t prefix = ldb_block_prefix(bb->options->comparator, key);
+
+    ldb_array_push(&bb->prefixes, prefix);
+  }
+
   if (shared > 0)
     key_offset += shared;
 
@@ -126,7 +185,18 @@ ldb_blockgen_add(ldb_blockgen_t *bb,
 
   /* Add string delta to buffer followed by value. */
   ldb_buffer_append(&bb->buffer, key_offset, non_shared);
-  ldb_buffer_append(&bb->buffer, value->data, value->size);
+
+  if (use_split(bb))
+    ldb_buffer_append(&bb->values, value->data, value->size);
+  else
+    ldb_buffer_append(&bb->buffer, value->data, value->size);
+
+  if (bb->options->data_block_hash_index) {
+    uint64_t hash = ldb_block_hash(bb->options->comparator, key);
+    uint64_t index = bb->restarts.length - 1;
+
+    ldb_array_push(&bb->hashes, (hash << 32) | index);
+  }
 
   /* Update state. */
   ldb_buffer_resize(&bb->last_key, shared);
@@ -135,15 +205,76 @@ ldb_blockgen_add(ldb_blockgen_t *bb,
   bb->counter++;
 }
 
+static int
+use_hash_index(const ldb_blockgen_t *bb) {
+  return bb->hashes.length > 0
+      && bb->restarts.length <= LDB_HASH_MAX_RESTARTS;
+}
+
+static uint32_t
+hash_buckets(const ldb_blockgen_t *bb) {
+  /* Aim for a load factor of 0.75. */
+  return (bb->hashes.length * 4) / 3 + 1;
+}
+
 ldb_slice_t
 ldb_blockgen_finish(ldb_blockgen_t *bb) {
-  /* Append restart array. */
+  uint32_t flags = 0;
   size_t i;
 
-  for (i = 0; i < bb->restarts.length; i++)
-    ldb_buffer_fixed32(&bb->buffer, bb->restarts.items[i]);
+  if (use_split(bb)) {
+    size_t offset = bb->buffer.size;
+
+    /* Append values. */
+    ldb_buffer_append(&bb->buffer, bb->values.data, bb->values.size);
 
-  ldb_buffer_fixed32(&bb->buffer, bb->restarts.length);
+    /* Append restart array. */
+    for (i = 0; i < bb->restarts.length; i++)
+      ldb_buffer_fixed32(&bb->buffer, bb->restarts.items[i]);
+
+    /* Append value restart array. */
+    for (i = 0; i < bb->value_restarts.length; i++)
+      ldb_buffer_fixed32(&bb->buffer, offset + bb->value_restarts.items[i]);
+
+    flags |= LDB_SPLIT_FLAG;
+  } else {
+    /* Append restart array. */
+    for (i = 0; i < bb->restarts.length; i++)
+      ldb_buffer_fixed32(&bb->buffer, bb->restarts.items[i]);
+  }
+
+  if (bb->prefixes.length > 0) {
+    assert(bb->prefixes.length == bb->restarts.length);
+
+    for (i = 0; i < bb->prefixes.length; i++)
+      ldb_buffer_fixed64(&bb->buffer, bb->prefixes.items[i]);
+
+    flags |= LDB_PREFIX_FLAG;
+  }
+
+  if (use_hash_index(bb)) {
+    uint32_t num_buckets = hash_buckets(bb);
+    uint8_t *buckets = ldb_buffer_pad(&bb->buffer, num_buckets);
+
+    memset(buckets, LDB_HASH_EMPTY, num_buckets);
+
+    for (i = 0; i < bb->hashes.length; i++) {
+      uint64_t item = bb->hashes.items[i];
+      uint8_t *bucket = &buckets[(item >> 32) % num_buckets];
+      uint8_t index = item & 0xff;
+
+      if (*bucket == LDB_HASH_EMPTY)
+        *bucket = index;
+      else if (*bucket != index)
+        *bucket = LDB_HASH_COLLISION;
+    }
+
+    ldb_buffer_fixed32(&bb->buffer, num_buckets);
+    ldb_buffer_fixed32(&bb->buffer, bb->restarts.length | flags
+                                                        | LDB_HASH_FLAG);
+  } else {
+    ldb_buffer_fixed32(&bb->buffer, bb->restarts.length | flags);
+  }
 
   bb->finished = 1;
 
@@ -152,7 +283,19 @@ ldb_blockgen_finish(ldb_blockgen_t *bb) {
 
 size_t
 ldb_blockgen_size_estimate(const ldb_blockgen_t *bb) {
-  return (bb->buffer.size +                        /* Raw data buffer */
-          bb->restarts.length * sizeof(uint32_t) + /* Restart array */
-          sizeof(uint32_t));                       /* Restart array length */
+  size_t size = bb->buffer.size                     /* Raw data buffer */
+              + bb->restarts.length * sizeof(uint32_t) /* Restart array */
+              + sizeof(uint32_t);                      /* Restart array length */
+
+  if (use_hash_index(bb))
+    size += hash_buckets(bb) + sizeof(uint32_t);       /* Hash index */
+
+  size += bb->prefixes.length * sizeof(uint64_t);      /* Key prefixes */
+
+  if (use_split(bb)) {
+    size += bb->values.size;                           /* Values */
+    size += bb->restarts.length * sizeof(uint32_t);    /* Value restarts */
+  }
+
+  return size;
 }
@@ -28,6 +28,10 @@ typedef struct ldb_blockgen_s {
   const ldb_dbopt_t *options;
   ldb_buffer_t buffer;          /* Destination buffer. */
   ldb_array_t restarts;         /* Restart points (uint32_t). */
+  ldb_array_t hashes;           /* Key hash and restart index (uint64_t). */
+  ldb_array_t prefixes;         /* Restart key prefixes (uint64_t). */
+  ldb_buffer_t values;          /* Values (separate_block_values). */
+  ldb_array_t value_restarts;   /* Offsets in values of restart points. */
   int counter;                  /* Number of entries emitted since restart. */
   int finished;                 /* Has finish() been called? */
   ldb_buffer_t last_key;
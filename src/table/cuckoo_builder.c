@@ -0,0 +1,205 @@
+/*!
+ * cuckoo_builder.c - cuckoo hash table builder for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../util/buffer.h"
+#include "../util/comparator.h"
+#include "../util/internal.h"
+#include "../util/slice.h"
+#include "../util/status.h"
+
+#include "cuckoo_table.h"
+#include "cuckoo_builder.h"
+
+/*
+ * Constants
+ */
+
+/* Displacements tried before the table is grown. */
+#define LDB_CUCKOO_MAX_KICKS 500
+
+/* Largest number of buckets (with 32 bit run offsets,
+   tables never hold this many runs anyway). */
+#define LDB_CUCKOO_MAX_BUCKETS (UINT32_C(1) << 30)
+
+/*
+ * Types
+ */
+
+typedef struct cuckoo_run_s {
+  uint32_t hashes[3];
+  uint32_t offset;
+  uint32_t size;
+} cuckoo_run_t;
+
+struct ldb_cuckoogen_s {
+  const ldb_comparator_t *comparator;
+  cuckoo_run_t *runs;
+  size_t length;
+  size_t alloc;
+  ldb_buffer_t last_key; /* User key of the last run. */
+};
+
+/*
+ * CuckooTableBuilder
+ */
+
+ldb_cuckoogen_t *
+ldb_cuckoogen_create(const ldb_comparator_t *comparator) {
+  ldb_cuckoogen_t *cb = ldb_malloc(sizeof(ldb_cuckoogen_t));
+
+  cb->comparator = comparator;
+  cb->runs = NULL;
+  cb->length = 0;
+  cb->alloc = 0;
+
+  ldb_buffer_init(&cb->last_key);
+
+  return cb;
+}
+
+void
+ldb_cuckoogen_destroy(ldb_cuckoogen_t *cb) {
+  if (cb->runs != NULL)
+    ldb_free(cb->runs);
+
+  ldb_buffer_clear(&cb->last_key);
+  ldb_free(cb);
+}
+
+void
+ldb_cuckoogen_add(ldb_cuckoogen_t *cb,
+                  const ldb_slice_t *key,
+                  uint32_t offset,
+                  uint32_t size) {
+  ldb_slice_t user_key = *key;
+  cuckoo_run_t *run;
+
+  if (cb->comparator->user_comparator != NULL)
+    user_key.size -= 8;
+
+  /* Further versions of a user key extend its run. */
+  if (cb->length > 0 && ldb_slice_equal(&user_key, &cb->last_key)) {
+    run = &cb->runs[cb->length - 1];
+    run->size = offset + size - run->offset;
+    return;
+  }
+
+  if (cb->length == cb->alloc) {
+    cb->alloc = cb->alloc == 0 ? 64 : cb->alloc * 2;
+    cb->runs = ldb_realloc(cb->runs, cb->alloc * sizeof(cuckoo_run_t));
+  }
+
+  run = &cb->runs[cb->length++];
+
+  ldb_cuckoo_hash(cb->comparator, key, run->hashes);
+
+  run->offset = offset;
+  run->size = size;
+
+  ldb_buffer_set(&cb->last_key, user_key.data, user_key.size);
+}
+
+/* Place every run into "slots" (one plus the index of a run, or zero
+   if empty), moving runs to their other bucket to make room. */
+static int
+cuckoo_place(const ldb_cuckoogen_t *cb, uint32_t *slots, uint32_t mask) {
+  size_t i;
+  int k;
+
+  for (i = 0; i < cb->length; i++) {
+    uint32_t slot = i + 1;
+    uint32_t b = cb->runs[i].hashes[0] & mask;
+
+    for (k = 0; k < LDB_CUCKOO_MAX_KICKS; k++) {
+      const cuckoo_run_t *run = &cb->runs[slot - 1];
+      uint32_t b0 = run->hashes[0] & mask;
+      uint32_t b1 = run->hashes[1] & mask;
+      uint32_t victim;
+
+      if (slots[b0] == 0) {
+        slots[b0] = slot;
+        break;
+      }
+
+      if (slots[b1] == 0) {
+        slots[b1] = slot;
+        break;
+      }
+
+      /* Evict whichever bucket we did not just come from. */
+      b = (b == b0) ? b1 : b0;
+
+      victim = slots[b];
+      slots[b] = slot;
+      slot = victim;
+    }
+
+    if (k == LDB_CUCKOO_MAX_KICKS)
+      return 0;
+  }
+
+  return 1;
+}
+
+int
+ldb_cuckoogen_finish(ldb_cuckoogen_t *cb, ldb_buffer_t *index) {
+  uint32_t num_buckets = 0;
+  uint32_t *slots = NULL;
+  uint32_t i;
+
+  if (cb->length > 0) {
+    num_buckets = 1;
+
+    while (num_buckets < cb->length * 2)
+      num_buckets <<= 1;
+
+    for (;;) {
+      if (num_buckets > LDB_CUCKOO_MAX_BUCKETS) {
+        if (slots != NULL)
+          ldb_free(slots);
+
+        return LDB_INVALID; /* "could not place runs" */
+      }
+
+      slots = ldb_realloc(slots, num_buckets * sizeof(uint32_t));
+
+      memset(slots, 0, num_buckets * sizeof(uint32_t));
+
+      if (cuckoo_place(cb, slots, num_buckets - 1))
+        break;
+
+      num_buckets <<= 1;
+    }
+  }
+
+  for (i = 0; i < num_buckets; i++) {
+    if (slots[i] == 0) {
+      ldb_buffer_fixed32(index, 0);
+      ldb_buffer_fixed32(index, 0);
+      ldb_buffer_fixed32(index, 0);
+    } else {
+      const cuckoo_run_t *run = &cb->runs[slots[i] - 1];
+
+      ldb_buffer_fixed32(index, run->hashes[2]);
+      ldb_buffer_fixed32(index, run->offset);
+      ldb_buffer_fixed32(index, run->size);
+    }
+  }
+
+  ldb_buffer_fixed32(index, cb->length);
+  ldb_buffer_fixed32(index, num_buckets);
+
+  if (slots != NULL)
+    ldb_free(slots);
+
+  return LDB_OK;
+}
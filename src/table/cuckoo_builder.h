@@ -0,0 +1,53 @@
+/*!
+ * cuckoo_builder.h - cuckoo hash table builder for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_CUCKOO_BUILDER_H
+#define LDB_CUCKOO_BUILDER_H
+
+#include <stdint.h>
+
+#include "../util/types.h"
+
+/*
+ * Types
+ */
+
+struct ldb_comparator_s;
+
+/* Builds the "cuckoo.index" meta block of a cuckoo table (see
+ * cuckoo_table.c) from the entries written by the table builder.
+ *
+ * The sequence of calls must match the regexp:
+ *     add* finish
+ */
+typedef struct ldb_cuckoogen_s ldb_cuckoogen_t;
+
+/*
+ * CuckooTableBuilder
+ */
+
+ldb_cuckoogen_t *
+ldb_cuckoogen_create(const struct ldb_comparator_s *comparator);
+
+void
+ldb_cuckoogen_destroy(ldb_cuckoogen_t *cb);
+
+/* Record an entry of "size" bytes written at "offset". Entries are
+   added in order, and must follow each other. */
+void
+ldb_cuckoogen_add(ldb_cuckoogen_t *cb,
+                  const ldb_slice_t *key,
+                  uint32_t offset,
+                  uint32_t size);
+
+/* Place every run in the hash table and append the contents of the
+   meta block to "index". Fails if the runs can not be placed. */
+int
+ldb_cuckoogen_finish(ldb_cuckoogen_t *cb, ldb_buffer_t *index);
+
+#endif /* LDB_CUCKOO_BUILDER_H */
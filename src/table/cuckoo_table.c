@@ -0,0 +1,477 @@
+/*!
+ * cuckoo_table.c - cuckoo hash table format for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../util/array.h"
+#include "../util/coding.h"
+#include "../util/comparator.h"
+#include "../util/env.h"
+#include "../util/hash.h"
+#include "../util/internal.h"
+#include "../util/options.h"
+#include "../util/pinned.h"
+#include "../util/slice.h"
+#include "../util/status.h"
+
+#include "cuckoo_table.h"
+#include "format.h"
+#include "iterator.h"
+
+/*
+ * Cuckoo Table
+ */
+
+/* The entries of a cuckoo table are stored one after another from the
+ * start of the file, uncompressed and without block trailers:
+ *
+ *    key_length: varint32
+ *    key: char[key_length]
+ *    value_length: varint32
+ *    value: char[value_length]
+ *
+ * The versions of a user key are adjacent, and form a run. The
+ * "cuckoo.index" meta block holds a cuckoo hash table of the runs:
+ *
+ *    buckets: bucket[num_buckets]
+ *    num_runs: uint32
+ *    num_buckets: uint32
+ *
+ * where each bucket is
+ *
+ *    tag: uint32
+ *    offset: uint32
+ *    size: uint32
+ *
+ * num_buckets is zero or a power of two. A run lives in one of the
+ * two buckets picked by the hashes of its user key (see
+ * ldb_cuckoo_hash()), and is tagged with a third hash so that a
+ * lookup rarely reads a run it does not want. Empty buckets have a
+ * size of zero.
+ *
+ * The regular index block of the table maps runs of about block_size
+ * bytes of entries, for approximate offsets and compaction splits.
+ */
+struct ldb_cuckoo_s {
+  const ldb_comparator_t *comparator;
+  ldb_rfile_t *file;
+  uint64_t size;         /* Size of the entries. */
+  ldb_contents_t index;  /* The "cuckoo.index" meta block. */
+  const uint8_t *buckets;
+  uint32_t num_runs;
+  uint32_t num_buckets;
+};
+
+void
+ldb_cuckoo_hash(const ldb_comparator_t *comparator,
+                const ldb_slice_t *key,
+                uint32_t *hashes) {
+  size_t size = key->size;
+
+  /* Every version of a user key shares a run. */
+  if (comparator->user_comparator != NULL) {
+    assert(size >= 8);
+    size -= 8;
+  }
+
+  hashes[0] = ldb_hash(key->data, size, 0x4d2f95a1);
+  hashes[1] = ldb_hash(key->data, size, 0xa3e8c05b);
+  hashes[2] = ldb_hash(key->data, size, 0x1f6b3d27);
+}
+
+int
+ldb_cuckoo_open(ldb_cuckoo_t **cuckoo,
+                const ldb_comparator_t *comparator,
+                ldb_rfile_t *file,
+                const ldb_readopt_t *options,
+                const ldb_handle_t *handle) {
+  ldb_contents_t contents;
+  const uint8_t *tail;
+  ldb_cuckoo_t *ct;
+  uint64_t size;
+  uint32_t i;
+  int rc;
+
+  *cuckoo = NULL;
+
+  rc = ldb_read_block(&contents, file, options, handle);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  ct = ldb_malloc(sizeof(ldb_cuckoo_t));
+  ct->comparator = comparator;
+  ct->file = file;
+  ct->size = handle->offset;
+  ct->index = contents;
+
+  if (contents.data.size < 8)
+    goto corrupt;
+
+  tail = contents.data.data + contents.data.size - 8;
+
+  ct->num_runs = ldb_fixed32_decode(tail + 0);
+  ct->num_buckets = ldb_fixed32_decode(tail + 4);
+  ct->buckets = contents.data.data;
+
+  if (ct->num_buckets & (ct->num_buckets - 1))
+    goto corrupt;
+
+  size = (uint64_t)ct->num_buckets * LDB_CUCKOO_BUCKET_SIZE + 8;
+
+  if (contents.data.size != size)
+    goto corrupt;
+
+  /* Every run must lie within the entries. */
+  for (i = 0; i < ct->num_buckets; i++) {
+    const uint8_t *bucket = ct->buckets + i * LDB_CUCKOO_BUCKET_SIZE;
+    uint64_t offset = ldb_fixed32_decode(bucket + 4);
+    uint64_t length = ldb_fixed32_decode(bucket + 8);
+
+    if (offset + length > ct->size)
+      goto corrupt;
+  }
+
+  *cuckoo = ct;
+
+  return LDB_OK;
+corrupt:
+  ldb_cuckoo_destroy(ct);
+  return LDB_CORRUPTION;
+}
+
+void
+ldb_cuckoo_destroy(ldb_cuckoo_t *cuckoo) {
+  if (cuckoo->index.heap_allocated)
+    ldb_free((void *)cuckoo->index.data.data);
+
+  ldb_free(cuckoo);
+}
+
+size_t
+ldb_cuckoo_memory(const ldb_cuckoo_t *cuckoo) {
+  size_t size = sizeof(ldb_cuckoo_t);
+
+  if (cuckoo->index.heap_allocated)
+    size += cuckoo->index.data.size;
+
+  return size;
+}
+
+/* Decode the entry at the front of "input". */
+static int
+cuckoo_entry(ldb_slice_t *key, ldb_slice_t *value, ldb_slice_t *input) {
+  if (!ldb_slice_slurp(key, input))
+    return 0;
+
+  if (!ldb_slice_slurp(value, input))
+    return 0;
+
+  return 1;
+}
+
+static int
+cuckoo_same_user(const ldb_comparator_t *comparator,
+                 const ldb_slice_t *x,
+                 const ldb_slice_t *y) {
+  size_t xn = x->size;
+  size_t yn = y->size;
+
+  if (comparator->user_comparator != NULL) {
+    if (xn < 8 || yn < 8)
+      return 0;
+
+    xn -= 8;
+    yn -= 8;
+  }
+
+  return xn == yn && memcmp(x->data, y->data, xn) == 0;
+}
+
+static void
+free_run(void *arg, void *ignored) {
+  (void)ignored;
+  ldb_free(arg);
+}
+
+int
+ldb_cuckoo_get(const ldb_cuckoo_t *cuckoo,
+               const ldb_slice_t *k,
+               void *arg,
+               ldb_cuckoofunc_f handle_result,
+               ldb_pinned_t *pin) {
+  uint32_t mask = cuckoo->num_buckets - 1;
+  uint32_t hashes[3];
+  int i;
+
+  if (cuckoo->num_buckets == 0)
+    return LDB_OK;
+
+  ldb_cuckoo_hash(cuckoo->comparator, k, hashes);
+
+  for (i = 0; i < 2; i++) {
+    uint32_t b = hashes[i] & mask;
+    const uint8_t *bucket = cuckoo->buckets + b * LDB_CUCKOO_BUCKET_SIZE;
+    uint32_t offset = ldb_fixed32_decode(bucket + 4);
+    uint32_t size = ldb_fixed32_decode(bucket + 8);
+    ldb_slice_t run, key, value;
+    uint8_t *buf = NULL;
+    int found = 0;
+    int mine = 0;
+    int rc;
+
+    if (i == 1 && b == (hashes[0] & mask))
+      break;
+
+    if (size == 0 || ldb_fixed32_decode(bucket) != hashes[2])
+      continue;
+
+    if (!ldb_rfile_mapped(cuckoo->file))
+      buf = ldb_malloc(size);
+
+    rc = ldb_rfile_pread(cuckoo->file, &run, buf, size, offset);
+
+    if (rc == LDB_OK && run.size != size)
+      rc = LDB_CORRUPTION;
+
+    /* Skip to the first version at or after k. */
+    while (rc == LDB_OK && run.size > 0) {
+      if (!cuckoo_entry(&key, &value, &run)) {
+        rc = LDB_CORRUPTION; /* "bad entry in cuckoo table" */
+        break;
+      }
+
+      if (!cuckoo_same_user(cuckoo->comparator, &key, k))
+        break;
+
+      mine = 1;
+
+      if (ldb_compare(cuckoo->comparator, &key, k) >= 0) {
+        found = 1;
+        break;
+      }
+    }
+
+    if (found)
+      (*handle_result)(arg, &key, &value);
+
+    if (buf != NULL) {
+      if (found && pin != NULL && pin->pending)
+        ldb_pinned_register(pin, &free_run, buf, NULL);
+      else
+        ldb_free(buf);
+    }
+
+    /* A tag collision moves on to the other bucket. */
+    if (rc != LDB_OK || mine)
+      return rc;
+  }
+
+  return LDB_OK;
+}
+
+/*
+ * Cuckoo Table Iterator
+ */
+
+typedef struct ldb_cuckooiter_s {
+  const ldb_cuckoo_t *cuckoo;
+  const uint8_t *data;  /* Entries, once read. */
+  uint8_t *heap;        /* data, if read into memory. */
+  ldb_array_t offsets;  /* Offset of each entry. */
+  size_t index;         /* offsets.length if invalid. */
+  ldb_slice_t key;
+  ldb_slice_t value;
+  int loaded;
+  int status;
+} ldb_cuckooiter_t;
+
+/* Read the entries and find where each one starts. */
+static int
+ldb_cuckooiter_load(ldb_cuckooiter_t *iter) {
+  const ldb_cuckoo_t *cuckoo = iter->cuckoo;
+  ldb_slice_t input, key, value;
+  int rc;
+
+  if (iter->loaded)
+    return iter->status == LDB_OK;
+
+  iter->loaded = 1;
+
+  if (cuckoo->size > SIZE_MAX) {
+    iter->status = LDB_CORRUPTION;
+    return 0;
+  }
+
+  if (!ldb_rfile_mapped(cuckoo->file))
+    iter->heap = ldb_malloc(cuckoo->size + 1);
+
+  rc = ldb_rfile_pread(cuckoo->file, &input, iter->heap, cuckoo->size, 0);
+
+  if (rc == LDB_OK && input.size != cuckoo->size)
+    rc = LDB_CORRUPTION;
+
+  iter->data = input.data;
+
+  while (rc == LDB_OK && input.size > 0) {
+    ldb_array_push(&iter->offsets, input.data - iter->data);
+
+    if (!cuckoo_entry(&key, &value, &input))
+      rc = LDB_CORRUPTION; /* "bad entry in cuckoo table" */
+  }
+
+  if (rc != LDB_OK)
+    ldb_array_reset(&iter->offsets);
+
+  iter->index = iter->offsets.length;
+  iter->status = rc;
+
+  return rc == LDB_OK;
+}
+
+static void
+ldb_cuckooiter_update(ldb_cuckooiter_t *iter) {
+  uint64_t offset;
+  ldb_slice_t input;
+
+  if (iter->index >= iter->offsets.length)
+    return;
+
+  offset = iter->offsets.items[iter->index];
+  input = ldb_slice(iter->data + offset, iter->cuckoo->size - offset);
+
+  cuckoo_entry(&iter->key, &iter->value, &input);
+}
+
+static void
+ldb_cuckooiter_clear(ldb_cuckooiter_t *iter) {
+  if (iter->heap != NULL)
+    ldb_free(iter->heap);
+
+  ldb_array_clear(&iter->offsets);
+}
+
+static int
+ldb_cuckooiter_valid(const ldb_cuckooiter_t *iter) {
+  return iter->index < iter->offsets.length;
+}
+
+/* Index of the first entry at or after target. */
+static size_t
+ldb_cuckooiter_lower_bound(ldb_cuckooiter_t *iter, const ldb_slice_t *target) {
+  size_t lo = 0;
+  size_t hi = iter->offsets.length;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    iter->index = mid;
+
+    ldb_cuckooiter_update(iter);
+
+    if (ldb_compare(iter->cuckoo->comparator, &iter->key, target) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void
+ldb_cuckooiter_seek(ldb_cuckooiter_t *iter, const ldb_slice_t *target) {
+  if (!ldb_cuckooiter_load(iter))
+    return;
+
+  iter->index = ldb_cuckooiter_lower_bound(iter, target);
+
+  ldb_cuckooiter_update(iter);
+}
+
+static void
+ldb_cuckooiter_first(ldb_cuckooiter_t *iter) {
+  if (!ldb_cuckooiter_load(iter))
+    return;
+
+  iter->index = 0;
+
+  ldb_cuckooiter_update(iter);
+}
+
+static void
+ldb_cuckooiter_last(ldb_cuckooiter_t *iter) {
+  if (!ldb_cuckooiter_load(iter))
+    return;
+
+  iter->index = iter->offsets.length;
+
+  if (iter->index > 0)
+    iter->index--;
+
+  ldb_cuckooiter_update(iter);
+}
+
+static void
+ldb_cuckooiter_next(ldb_cuckooiter_t *iter) {
+  assert(ldb_cuckooiter_valid(iter));
+  iter->index++;
+  ldb_cuckooiter_update(iter);
+}
+
+static void
+ldb_cuckooiter_prev(ldb_cuckooiter_t *iter) {
+  assert(ldb_cuckooiter_valid(iter));
+
+  if (iter->index == 0)
+    iter->index = iter->offsets.length;
+  else
+    iter->index--;
+
+  ldb_cuckooiter_update(iter);
+}
+
+static ldb_slice_t
+ldb_cuckooiter_key(const ldb_cuckooiter_t *iter) {
+  assert(ldb_cuckooiter_valid(iter));
+  return iter->key;
+}
+
+static ldb_slice_t
+ldb_cuckooiter_value(const ldb_cuckooiter_t *iter) {
+  assert(ldb_cuckooiter_valid(iter));
+  return iter->value;
+}
+
+static int
+ldb_cuckooiter_status(const ldb_cuckooiter_t *iter) {
+  return iter->status;
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_cuckooiter);
+
+ldb_iter_t *
+ldb_cuckooiter_create(const ldb_cuckoo_t *cuckoo) {
+  ldb_cuckooiter_t *iter = ldb_small_alloc(sizeof(ldb_cuckooiter_t));
+
+  iter->cuckoo = cuckoo;
+  iter->data = NULL;
+  iter->heap = NULL;
+  iter->index = 0;
+  iter->loaded = 0;
+  iter->status = LDB_OK;
+
+  ldb_array_init(&iter->offsets);
+  ldb_slice_init(&iter->key);
+  ldb_slice_init(&iter->value);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_cuckooiter_t),
+                               &ldb_cuckooiter_table, cuckoo->comparator);
+}
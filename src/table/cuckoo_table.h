@@ -0,0 +1,85 @@
+/*!
+ * cuckoo_table.h - cuckoo hash table format for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_CUCKOO_TABLE_H
+#define LDB_CUCKOO_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../util/types.h"
+
+/*
+ * Constants
+ */
+
+/* Size of a bucket of the "cuckoo.index" meta block. */
+#define LDB_CUCKOO_BUCKET_SIZE 12
+
+/*
+ * Types
+ */
+
+struct ldb_comparator_s;
+struct ldb_handle_s;
+struct ldb_iter_s;
+struct ldb_pinned_s;
+struct ldb_readopt_s;
+struct ldb_rfile_s;
+
+/* The hash index of a cuckoo table (see cuckoo_table.c), kept in memory
+   so that a lookup reads nothing but the versions of its key. */
+typedef struct ldb_cuckoo_s ldb_cuckoo_t;
+
+typedef void (*ldb_cuckoofunc_f)(void *,
+                                 const ldb_slice_t *,
+                                 const ldb_slice_t *);
+
+/*
+ * Cuckoo Table
+ */
+
+/* The bucket hashes (hashes[0] and hashes[1]) and tag (hashes[2])
+   of the user key of "key". */
+void
+ldb_cuckoo_hash(const struct ldb_comparator_s *comparator,
+                const ldb_slice_t *key,
+                uint32_t *hashes);
+
+/* Read the index of a cuckoo table from the "cuckoo.index" meta block
+   at "handle". The entries, which precede it, are read on demand. */
+int
+ldb_cuckoo_open(ldb_cuckoo_t **cuckoo,
+                const struct ldb_comparator_s *comparator,
+                struct ldb_rfile_s *file,
+                const struct ldb_readopt_s *options,
+                const struct ldb_handle_s *handle);
+
+void
+ldb_cuckoo_destroy(ldb_cuckoo_t *cuckoo);
+
+/* Memory held by the reader (the index). */
+size_t
+ldb_cuckoo_memory(const ldb_cuckoo_t *cuckoo);
+
+/* Calls (*handle_result)(arg, ...) with the first version of k's user
+   key at or after k, if any. Reads the versions with a single read,
+   which is kept alive by "pin" if it asks for it. */
+int
+ldb_cuckoo_get(const ldb_cuckoo_t *cuckoo,
+               const ldb_slice_t *k,
+               void *arg,
+               ldb_cuckoofunc_f handle_result,
+               struct ldb_pinned_s *pin);
+
+/* Returns a new iterator over the entries. The entries are read in
+   full when it is first positioned. */
+struct ldb_iter_s *
+ldb_cuckooiter_create(const ldb_cuckoo_t *cuckoo);
+
+#endif /* LDB_CUCKOO_TABLE_H */
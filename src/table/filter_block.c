@@ -13,11 +13,14 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "../util/array.h"
 #include "../util/bloom.h"
 #include "../util/buffer.h"
 #include "../util/coding.h"
+#include "../util/perf.h"
+#include "../util/prefix.h"
 #include "../util/slice.h"
 #include "../util/vector.h"
 
@@ -58,6 +61,11 @@ ldb_filtergen_init(ldb_filtergen_t *fb, const ldb_bloom_t *policy) {
   ldb_array_init(&fb->start);
   ldb_buffer_init(&fb->result);
   ldb_array_init(&fb->filter_offsets);
+
+  fb->prefix = NULL;
+
+  ldb_buffer_init(&fb->prefixes);
+  ldb_array_init(&fb->prefix_start);
 }
 
 void
@@ -69,6 +77,18 @@ ldb_filtergen_clear(ldb_filtergen_t *fb) {
   ldb_array_clear(&fb->start);
   ldb_buffer_clear(&fb->result);
   ldb_array_clear(&fb->filter_offsets);
+  ldb_buffer_clear(&fb->prefixes);
+  ldb_array_clear(&fb->prefix_start);
+}
+
+void
+ldb_filtergen_reset(ldb_filtergen_t *fb) {
+  ldb_buffer_reset(&fb->keys);
+  ldb_array_reset(&fb->start);
+  ldb_buffer_reset(&fb->result);
+  ldb_array_reset(&fb->filter_offsets);
+  ldb_buffer_reset(&fb->prefixes);
+  ldb_array_reset(&fb->prefix_start);
 }
 
 static ldb_slice_t *
@@ -82,6 +102,7 @@ ldb_filtergen_alloc(ldb_filtergen_t *fb, size_t num_keys) {
 
 static void
 ldb_filtergen_generate(ldb_filtergen_t *fb) {
+  size_t num_prefixes = fb->prefix_start.length;
   size_t num_keys = fb->start.length;
   ldb_slice_t *tmp_keys;
   size_t i;
@@ -94,8 +115,9 @@ ldb_filtergen_generate(ldb_filtergen_t *fb) {
 
   /* Make list of keys from flattened key structure. */
   ldb_array_push(&fb->start, fb->keys.size); /* Simplify length computation. */
+  ldb_array_push(&fb->prefix_start, fb->prefixes.size);
 
-  tmp_keys = ldb_filtergen_alloc(fb, num_keys);
+  tmp_keys = ldb_filtergen_alloc(fb, num_keys + num_prefixes);
 
   for (i = 0; i < num_keys; i++) {
     const uint8_t *base = fb->keys.data + fb->start.items[i];
@@ -104,12 +126,30 @@ ldb_filtergen_generate(ldb_filtergen_t *fb) {
     ldb_slice_set(&tmp_keys[i], base, length);
   }
 
+  /* Prefixes go after the keys (both are in sorted order). */
+  for (i = 0; i < num_prefixes; i++) {
+    const uint8_t *base = fb->prefixes.data + fb->prefix_start.items[i];
+    size_t length = fb->prefix_start.items[i + 1] - fb->prefix_start.items[i];
+
+    ldb_slice_set(&tmp_keys[num_keys + i], base, length);
+  }
+
+  num_keys += num_prefixes;
+
   /* Generate filter for current set of keys and append to result. */
   ldb_array_push(&fb->filter_offsets, fb->result.size);
   ldb_bloom_build(fb->policy, &fb->result, tmp_keys, num_keys);
 
   ldb_buffer_reset(&fb->keys);
   ldb_array_reset(&fb->start);
+  ldb_buffer_reset(&fb->prefixes);
+  ldb_array_reset(&fb->prefix_start);
+}
+
+void
+ldb_filtergen_set_prefix(ldb_filtergen_t *fb, const ldb_prefix_t *prefix) {
+  assert(fb->start.length == 0);
+  fb->prefix = prefix;
 }
 
 void
@@ -122,10 +162,35 @@ ldb_filtergen_start_block(ldb_filtergen_t *fb, uint64_t block_offset) {
     ldb_filtergen_generate(fb);
 }
 
+static void
+ldb_filtergen_add_prefix(ldb_filtergen_t *fb, const ldb_slice_t *key) {
+  ldb_slice_t prefix;
+
+  if (!ldb_prefix_extract(fb->prefix, &prefix, key))
+    return;
+
+  /* Skip the prefix if it is the same as the previous one. */
+  if (fb->prefix_start.length > 0) {
+    size_t last = fb->prefix_start.items[fb->prefix_start.length - 1];
+    size_t length = fb->prefixes.size - last;
+
+    if (length == prefix.size &&
+        memcmp(fb->prefixes.data + last, prefix.data, length) == 0) {
+      return;
+    }
+  }
+
+  ldb_array_push(&fb->prefix_start, fb->prefixes.size);
+  ldb_buffer_append(&fb->prefixes, prefix.data, prefix.size);
+}
+
 void
 ldb_filtergen_add_key(ldb_filtergen_t *fb, const ldb_slice_t *key) {
   ldb_array_push(&fb->start, fb->keys.size);
   ldb_buffer_append(&fb->keys, key->data, key->size);
+
+  if (fb->prefix != NULL)
+    ldb_filtergen_add_prefix(fb, key);
 }
 
 ldb_slice_t
@@ -201,6 +266,10 @@ ldb_filter_matches(const ldb_filter_t *fr,
                    uint64_t block_offset,
                    const ldb_slice_t *key) {
   uint64_t index = block_offset >> fr->base_lg;
+  int result = 1; /* Errors are treated as potential matches. */
+  int64_t timer;
+
+  LDB_PERF_START(timer);
 
   if (index < fr->num) {
     uint32_t start = ldb_fixed32_decode(fr->offset + index * 4);
@@ -211,14 +280,16 @@ ldb_filter_matches(const ldb_filter_t *fr,
 
       ldb_slice_set(&filter, fr->data + start, limit - start);
 
-      return ldb_bloom_match(fr->policy, &filter, key);
-    }
-
-    if (start == limit) {
+      result = ldb_bloom_match(fr->policy, &filter, key);
+    } else if (start == limit) {
       /* Empty filters do not match any keys. */
-      return 0;
+      result = 0;
     }
   }
 
-  return 1; /* Errors are treated as potential matches. */
+  LDB_PERF_STOP(filter_nanos, timer);
+  LDB_PERF_ADD(filter_count, 1);
+  LDB_PERF_ADD(filter_negatives, !result);
+
+  return result;
 }
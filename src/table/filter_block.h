@@ -23,6 +23,7 @@
  */
 
 struct ldb_bloom_s;
+struct ldb_prefix_s;
 
 /* A filter block builder is used to construct all of the filters for a
  * particular Table. It generates a single string which is stored as
@@ -39,6 +40,9 @@ typedef struct ldb_filtergen_s {
   ldb_array_t start;          /* Starting index in keys of each key (size_t). */
   ldb_buffer_t result;        /* Filter data computed so far. */
   ldb_array_t filter_offsets; /* Filter offsets (uint32_t). */
+  const struct ldb_prefix_s *prefix; /* Prefix extractor (optional). */
+  ldb_buffer_t prefixes;      /* Flattened prefix contents. */
+  ldb_array_t prefix_start;   /* Starting index in prefixes of each prefix. */
 } ldb_filtergen_t;
 
 typedef struct ldb_filter_s {
@@ -66,6 +70,17 @@ ldb_filtergen_init(ldb_filtergen_t *fb,
 void
 ldb_filtergen_clear(ldb_filtergen_t *fb);
 
+/* Discard all filters built so far, allowing the builder
+   to be reused for another (partitioned) filter block. */
+void
+ldb_filtergen_reset(ldb_filtergen_t *fb);
+
+/* Also add the prefix of every key (as defined by "prefix")
+   to the filters. Must be called before any keys are added. */
+void
+ldb_filtergen_set_prefix(ldb_filtergen_t *fb,
+                         const struct ldb_prefix_s *prefix);
+
 void
 ldb_filtergen_start_block(ldb_filtergen_t *fb, uint64_t block_offset);
 
@@ -11,10 +11,20 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#ifdef LDB_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef LDB_HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
 #include "../util/buffer.h"
 #include "../util/coding.h"
 #include "../util/crc32c.h"
@@ -87,20 +97,27 @@ void
 ldb_footer_init(ldb_footer_t *x) {
   ldb_handle_init(&x->metaindex_handle);
   ldb_handle_init(&x->index_handle);
+  x->format = LDB_FORMAT_BLOCK;
 }
 
 uint8_t *
 ldb_footer_write(uint8_t *zp, const ldb_footer_t *x) {
+  uint64_t magic = LDB_TABLE_MAGIC;
   uint8_t *tp = zp;
   size_t pad;
 
+  if (x->format == LDB_FORMAT_PLAIN)
+    magic = LDB_PLAIN_MAGIC;
+  else if (x->format == LDB_FORMAT_CUCKOO)
+    magic = LDB_CUCKOO_MAGIC;
+
   zp = ldb_handle_write(zp, &x->metaindex_handle);
   zp = ldb_handle_write(zp, &x->index_handle);
 
   pad = (2 * LDB_HANDLE_SIZE) - (zp - tp);
 
   zp = ldb_padding_write(zp, pad);
-  zp = ldb_fixed64_write(zp, LDB_TABLE_MAGIC);
+  zp = ldb_fixed64_write(zp, magic);
 
   return zp;
 }
@@ -117,11 +134,20 @@ int
 ldb_footer_read(ldb_footer_t *z, const uint8_t **xp, size_t *xn) {
   const uint8_t *tp = *xp;
   size_t tn = *xn;
+  uint64_t magic;
 
   if (*xn < LDB_FOOTER_SIZE)
     return 0;
 
-  if (ldb_fixed64_decode(*xp + LDB_FOOTER_SIZE - 8) != LDB_TABLE_MAGIC)
+  magic = ldb_fixed64_decode(*xp + LDB_FOOTER_SIZE - 8);
+
+  if (magic == LDB_TABLE_MAGIC)
+    z->format = LDB_FORMAT_BLOCK;
+  else if (magic == LDB_PLAIN_MAGIC)
+    z->format = LDB_FORMAT_PLAIN;
+  else if (magic == LDB_CUCKOO_MAGIC)
+    z->format = LDB_FORMAT_CUCKOO;
+  else
     return 0;
 
   if (!ldb_handle_read(&z->metaindex_handle, xp, xn))
@@ -152,19 +178,98 @@ ldb_contents_init(ldb_contents_t *x) {
 
   x->cachable = 0;
   x->heap_allocated = 0;
+  x->verified = 0;
+}
+
+/*
+ * TableProperties
+ */
+
+void
+ldb_tableprops_init(ldb_tableprops_t *x) {
+  x->entries = 0;
+  x->deletions = 0;
+  x->tombstones = 0;
+  x->raw_key_size = 0;
+  x->raw_value_size = 0;
+  x->data_blocks = 0;
+  x->compression = 0;
+  x->smallest_sequence = UINT64_MAX;
+  x->largest_sequence = 0;
+  x->creation_time = 0;
 }
 
 /*
  * ReadBlock
  */
 
+/* Verify a block read along with its trailer. Takes ownership of buf. */
+static int
+finish_raw_block(ldb_contents_t *result,
+                 int *type,
+                 const ldb_readopt_t *options,
+                 const ldb_slice_t *contents,
+                 uint8_t *buf,
+                 size_t n) {
+  const uint8_t *data;
+
+  if (contents->size != n + LDB_TRAILER_SIZE) {
+    ldb_free(buf);
+    return LDB_IOERR; /* "truncated block read" */
+  }
+
+  /* Check the crc of the type and the block contents. */
+  data = contents->data; /* Pointer to where Read put the data. */
+
+  if (options->verify_checksums) {
+    uint32_t crc = ldb_crc32c_unmask(ldb_fixed32_decode(data + n + 1));
+    uint32_t actual = ldb_crc32c_value(data, n + 1);
+
+    if (crc != actual) {
+      ldb_free(buf);
+      return LDB_CORRUPTION; /* "block checksum mismatch" */
+    }
+  }
+
+  *type = data[n];
+
+  result->verified = options->verify_checksums;
+
+  if (data != buf) {
+    /* File implementation gave us pointer to some other data.
+       Use it directly under the assumption that it will be live
+       while the file is open. */
+    ldb_free(buf);
+    ldb_slice_set(&result->data, data, n);
+    result->heap_allocated = 0;
+    result->cachable = 0; /* Do not double-cache. */
+  } else {
+    ldb_slice_set(&result->data, buf, n);
+    result->heap_allocated = 1;
+    result->cachable = 1;
+  }
+
+  return LDB_OK;
+}
+
 int
-ldb_read_block(ldb_contents_t *result,
-               ldb_rfile_t *file,
-               const ldb_readopt_t *options,
-               const ldb_handle_t *handle) {
+ldb_read_raw_block(ldb_contents_t *result,
+                   int *type,
+                   ldb_rfile_t *file,
+                   const ldb_readopt_t *options,
+                   const ldb_handle_t *handle) {
+  return ldb_read_raw_scratch(result, type, file, options, handle, NULL, 0);
+}
+
+int
+ldb_read_raw_scratch(ldb_contents_t *result,
+                     int *type,
+                     ldb_rfile_t *file,
+                     const ldb_readopt_t *options,
+                     const ldb_handle_t *handle,
+                     uint8_t *scratch,
+                     size_t size) {
   ldb_slice_t contents;
-  const uint8_t *data;
   uint8_t *buf = NULL;
   size_t n, len;
   int rc;
@@ -181,51 +286,340 @@ ldb_read_block(ldb_contents_t *result,
   len = n + LDB_TRAILER_SIZE;
 
   if (!ldb_rfile_mapped(file)) {
-    if ((buf = malloc(len)) == NULL)
+    if (len <= size)
+      buf = scratch;
+    else if ((buf = malloc(len)) == NULL)
       return LDB_ENOMEM;
   }
 
   rc = ldb_rfile_pread(file, &contents, buf, len, handle->offset);
 
+  if (buf == scratch)
+    buf = NULL; /* Not ours to free. */
+
   if (rc != LDB_OK) {
     ldb_free(buf);
     return rc;
   }
 
-  if (contents.size != len) {
-    ldb_free(buf);
-    return LDB_IOERR; /* "truncated block read" */
+  return finish_raw_block(result, type, options, &contents, buf, n);
+}
+
+void
+ldb_read_raw_blocks(ldb_contents_t *results,
+                    int *types,
+                    int *statuses,
+                    ldb_rfile_t *file,
+                    const ldb_readopt_t *options,
+                    const ldb_handle_t *handles,
+                    size_t count) {
+  int mapped = ldb_rfile_mapped(file);
+  ldb_readreq_t *reqs;
+  size_t i;
+
+  reqs = ldb_malloc(count * sizeof(ldb_readreq_t));
+
+  for (i = 0; i < count; i++) {
+    ldb_readreq_t *req = &reqs[i];
+
+    ldb_contents_init(&results[i]);
+
+    req->offset = handles[i].offset;
+    req->count = 0;
+    req->buf = NULL;
+    req->status = LDB_OK;
+
+    ldb_slice_set(&req->result, NULL, 0);
+
+    /* Check for overflow. */
+    if (handles[i].size > SIZE_MAX - LDB_TRAILER_SIZE) {
+      statuses[i] = LDB_CORRUPTION;
+      continue;
+    }
+
+    req->count = handles[i].size + LDB_TRAILER_SIZE;
+
+    if (!mapped && (req->buf = malloc(req->count)) == NULL) {
+      statuses[i] = LDB_ENOMEM;
+      req->count = 0;
+      continue;
+    }
+
+    statuses[i] = LDB_OK;
   }
 
-  /* Check the crc of the type and the block contents. */
-  data = contents.data; /* Pointer to where Read put the data. */
+  ldb_rfile_multiread(file, reqs, count);
 
-  if (options->verify_checksums) {
-    uint32_t crc = ldb_crc32c_unmask(ldb_fixed32_decode(data + n + 1));
-    uint32_t actual = ldb_crc32c_value(data, n + 1);
+  for (i = 0; i < count; i++) {
+    ldb_readreq_t *req = &reqs[i];
 
-    if (crc != actual) {
-      ldb_free(buf);
-      return LDB_CORRUPTION; /* "block checksum mismatch" */
+    if (statuses[i] != LDB_OK)
+      continue;
+
+    if (req->status != LDB_OK) {
+      ldb_free(req->buf);
+      statuses[i] = req->status;
+      continue;
     }
+
+    statuses[i] = finish_raw_block(&results[i], &types[i], options,
+                                   &req->result, req->buf,
+                                   handles[i].size);
   }
 
-  switch (data[n]) {
-    case LDB_NO_COMPRESSION: {
-      if (data != buf) {
-        /* File implementation gave us pointer to some other data.
-           Use it directly under the assumption that it will be live
-           while the file is open. */
-        ldb_free(buf);
-        ldb_slice_set(&result->data, data, n);
-        result->heap_allocated = 0;
-        result->cachable = 0; /* Do not double-cache. */
-      } else {
-        ldb_slice_set(&result->data, buf, n);
-        result->heap_allocated = 1;
-        result->cachable = 1;
+  ldb_free(reqs);
+}
+
+/*
+ * Dictionary
+ */
+
+#ifdef LDB_HAVE_ZSTD
+struct ldb_dict_s {
+  ZSTD_DDict *ddict;
+};
+#endif
+
+ldb_dict_t *
+ldb_dict_create(const ldb_slice_t *data) {
+#ifdef LDB_HAVE_ZSTD
+  ZSTD_DDict *ddict = ZSTD_createDDict(data->data, data->size);
+  ldb_dict_t *dict;
+
+  if (ddict == NULL)
+    return NULL;
+
+  dict = ldb_malloc(sizeof(ldb_dict_t));
+  dict->ddict = ddict;
+
+  return dict;
+#else
+  (void)data;
+  return NULL;
+#endif
+}
+
+void
+ldb_dict_destroy(ldb_dict_t *dict) {
+#ifdef LDB_HAVE_ZSTD
+  ZSTD_freeDDict(dict->ddict);
+  ldb_free(dict);
+#else
+  (void)dict;
+#endif
+}
+
+int
+ldb_dict_train(ldb_buffer_t *dict,
+               size_t max_size,
+               const ldb_slice_t *data,
+               const ldb_array_t *sizes) {
+#ifdef LDB_HAVE_ZSTD
+  size_t *lengths;
+  size_t i, len;
+
+  if (sizes->length == 0 || sizes->length > UINT_MAX)
+    return 0;
+
+  lengths = ldb_malloc(sizes->length * sizeof(size_t));
+
+  for (i = 0; i < sizes->length; i++)
+    lengths[i] = sizes->items[i];
+
+  ldb_buffer_grow(dict, max_size);
+
+  len = ZDICT_trainFromBuffer(dict->data, max_size,
+                              data->data, lengths,
+                              (unsigned)sizes->length);
+
+  ldb_free(lengths);
+
+  if (ZDICT_isError(len))
+    return 0;
+
+  dict->size = len;
+
+  return 1;
+#else
+  (void)dict;
+  (void)max_size;
+  (void)data;
+  (void)sizes;
+  return 0;
+#endif
+}
+
+int
+ldb_encode_block(ldb_buffer_t *z, int type, const ldb_slice_t *x) {
+  switch (type) {
+    case LDB_SNAPPY_COMPRESSION: {
+      size_t max;
+
+      if (!snappy_encode_size(&max, x->size))
+        return 0;
+
+      ldb_buffer_grow(z, z->size + max);
+
+      z->size += snappy_encode(z->data + z->size, x->data, x->size);
+
+      return 1;
+    }
+
+    /* LZ4 and Zstd blocks are prefixed with their uncompressed length. */
+#ifdef LDB_HAVE_LZ4
+    case LDB_LZ4_COMPRESSION: {
+      int max, len;
+
+      if (x->size > LZ4_MAX_INPUT_SIZE)
+        return 0;
+
+      max = LZ4_compressBound((int)x->size);
+
+      ldb_buffer_varint32(z, x->size);
+      ldb_buffer_grow(z, z->size + max);
+
+      len = LZ4_compress_default((const char *)x->data,
+                                 (char *)z->data + z->size,
+                                 (int)x->size,
+                                 max);
+
+      if (len <= 0)
+        return 0;
+
+      z->size += len;
+
+      return 1;
+    }
+#endif
+
+#ifdef LDB_HAVE_ZSTD
+    case LDB_ZSTD_COMPRESSION: {
+      size_t max = ZSTD_compressBound(x->size);
+      size_t len;
+
+      ldb_buffer_varint32(z, x->size);
+      ldb_buffer_grow(z, z->size + max);
+
+      len = ZSTD_compress(z->data + z->size, max,
+                          x->data, x->size,
+                          ZSTD_CLEVEL_DEFAULT);
+
+      if (ZSTD_isError(len))
+        return 0;
+
+      z->size += len;
+
+      return 1;
+    }
+#endif
+
+    default: {
+      (void)z;
+      (void)x;
+      return 0;
+    }
+  }
+}
+
+/* LZ4 and Zstd blocks are prefixed with their uncompressed length. */
+static int
+decode_prefixed(ldb_slice_t *z,
+                int type,
+                const uint8_t *xp,
+                size_t xn,
+                const ldb_dict_t *dict) {
+  uint8_t *zp = NULL;
+  uint32_t zn;
+  int ok = 0;
+
+  if (!ldb_varint32_read(&zn, &xp, &xn))
+    return LDB_CORRUPTION; /* "corrupted compressed block contents" */
+
+  switch (type) {
+#ifdef LDB_HAVE_LZ4
+    case LDB_LZ4_COMPRESSION: {
+      if (xn > INT_MAX || zn > LZ4_MAX_INPUT_SIZE)
+        return LDB_CORRUPTION;
+
+      if ((zp = malloc(zn + 1)) == NULL)
+        return LDB_ENOMEM;
+
+      ok = LZ4_decompress_safe((const char *)xp,
+                               (char *)zp,
+                               (int)xn,
+                               (int)zn) == (int)zn;
+
+      break;
+    }
+#endif
+
+#ifdef LDB_HAVE_ZSTD
+    case LDB_ZSTD_COMPRESSION: {
+      if ((zp = malloc(zn + 1)) == NULL)
+        return LDB_ENOMEM;
+
+      ok = ZSTD_decompress(zp, zn, xp, xn) == zn;
+
+      break;
+    }
+
+    case LDB_ZSTD_DICT_TYPE: {
+      ZSTD_DCtx *ctx;
+
+      if (dict == NULL)
+        return LDB_CORRUPTION; /* "missing compression dictionary" */
+
+      if ((zp = malloc(zn + 1)) == NULL)
+        return LDB_ENOMEM;
+
+      if ((ctx = ZSTD_createDCtx()) == NULL) {
+        ldb_free(zp);
+        return LDB_ENOMEM;
       }
 
+      ok = ZSTD_decompress_usingDDict(ctx, zp, zn, xp, xn,
+                                      dict->ddict) == zn;
+
+      ZSTD_freeDCtx(ctx);
+
+      break;
+    }
+#endif
+
+    default: {
+      (void)dict;
+      return LDB_NOSUPPORT; /* "compression type not supported" */
+    }
+  }
+
+  if (!ok) {
+    ldb_free(zp);
+    return LDB_CORRUPTION; /* "corrupted compressed block contents" */
+  }
+
+  ldb_slice_set(z, zp, zn);
+
+  return LDB_OK;
+}
+
+int
+ldb_decode_block(ldb_contents_t *result,
+                 ldb_contents_t *raw,
+                 int type,
+                 const ldb_dict_t *dict) {
+  const uint8_t *data = raw->data.data;
+  size_t n = raw->data.size;
+  uint8_t *buf = NULL;
+
+  if (raw->heap_allocated)
+    buf = (uint8_t *)data;
+
+  ldb_contents_init(result);
+
+  switch (type) {
+    case LDB_NO_COMPRESSION: {
+      *result = *raw;
+
       /* Ok. */
       break;
     }
@@ -256,6 +650,24 @@ ldb_read_block(ldb_contents_t *result,
 
       result->heap_allocated = 1;
       result->cachable = 1;
+      result->verified = raw->verified;
+
+      break;
+    }
+
+    case LDB_LZ4_COMPRESSION:
+    case LDB_ZSTD_COMPRESSION:
+    case LDB_ZSTD_DICT_TYPE: {
+      int rc = decode_prefixed(&result->data, type, data, n, dict);
+
+      ldb_free(buf);
+
+      if (rc != LDB_OK)
+        return rc;
+
+      result->heap_allocated = 1;
+      result->cachable = 1;
+      result->verified = raw->verified;
 
       break;
     }
@@ -268,3 +680,22 @@ ldb_read_block(ldb_contents_t *result,
 
   return LDB_OK;
 }
+
+int
+ldb_read_block(ldb_contents_t *result,
+               ldb_rfile_t *file,
+               const ldb_readopt_t *options,
+               const ldb_handle_t *handle) {
+  ldb_contents_t raw;
+  int type = 0;
+  int rc;
+
+  rc = ldb_read_raw_block(&raw, &type, file, options, handle);
+
+  if (rc != LDB_OK) {
+    ldb_contents_init(result);
+    return rc;
+  }
+
+  return ldb_decode_block(result, &raw, type, NULL);
+}
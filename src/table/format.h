@@ -38,6 +38,28 @@
    and taking the leading 64 bits. */
 #define LDB_TABLE_MAGIC UINT64_C(0xdb4775248b80fb57) /* kTableMagicNumber */
 
+/* Magic numbers of plain and cuckoo tables (see plain_table.c
+   and cuckoo_table.c). */
+#define LDB_PLAIN_MAGIC UINT64_C(0x8242229663bf9564)
+#define LDB_CUCKOO_MAGIC UINT64_C(0x926789d0c5f17873)
+
+/* Set in the restart count of blocks which carry a hash index. */
+#define LDB_HASH_FLAG UINT32_C(0x80000000)
+
+/* Set in the restart count of blocks which carry key prefixes. */
+#define LDB_PREFIX_FLAG UINT32_C(0x40000000)
+
+/* Set in the restart count of blocks which keep values apart from keys. */
+#define LDB_SPLIT_FLAG UINT32_C(0x20000000)
+
+/* Special hash index buckets. Restart indices must be below these. */
+#define LDB_HASH_COLLISION 254
+#define LDB_HASH_EMPTY 255
+#define LDB_HASH_MAX_RESTARTS 253
+
+/* Block type of Zstd data blocks compressed with the table's dictionary. */
+#define LDB_ZSTD_DICT_TYPE 0x8
+
 /*
  * Types
  */
@@ -45,6 +67,16 @@
 struct ldb_rfile_s;
 struct ldb_readopt_s;
 
+/* Layouts of the entries of a table, told apart by the footer magic. */
+enum ldb_table_format {
+  LDB_FORMAT_BLOCK,  /* Blocks, found through the index (LDB_TABLE_MAGIC). */
+  LDB_FORMAT_PLAIN,  /* Fixed-size keys (LDB_PLAIN_MAGIC). */
+  LDB_FORMAT_CUCKOO  /* Cuckoo hashed user keys (LDB_CUCKOO_MAGIC). */
+};
+
+/* A decompression dictionary shared by the data blocks of a table. */
+typedef struct ldb_dict_s ldb_dict_t;
+
 /* BlockHandle is a pointer to the extent of a file that stores a data
    block or a meta block. */
 typedef struct ldb_handle_s {
@@ -57,14 +89,32 @@ typedef struct ldb_handle_s {
 typedef struct ldb_footer_s {
   ldb_handle_t metaindex_handle;
   ldb_handle_t index_handle;
+  int format; /* enum ldb_table_format */
 } ldb_footer_t;
 
 typedef struct ldb_contents_s {
   ldb_slice_t data;    /* Actual contents of data. */
   int cachable;        /* True iff data can be cached. */
   int heap_allocated;  /* True iff caller should free() data.data. */
+  int verified;        /* True iff the checksum was checked. */
 } ldb_contents_t;
 
+/* Statistics of a table, stored in its "properties" meta block. The
+   table builder fills in the counts and sizes; the database fills in
+   the fields which depend on the key format. */
+typedef struct ldb_tableprops_s {
+  uint64_t entries;           /* Point entries. */
+  uint64_t deletions;         /* Deletion markers among them. */
+  uint64_t tombstones;        /* Range tombstones. */
+  uint64_t raw_key_size;      /* Key bytes before any encoding. */
+  uint64_t raw_value_size;    /* Value bytes before any encoding. */
+  uint64_t data_blocks;
+  uint64_t compression;       /* Configured compression type. */
+  uint64_t smallest_sequence;
+  uint64_t largest_sequence;
+  uint64_t creation_time;     /* Seconds since the epoch (zero if unknown). */
+} ldb_tableprops_t;
+
 /*
  * BlockHandle
  */
@@ -113,6 +163,13 @@ ldb_footer_import(ldb_footer_t *z, const ldb_slice_t *x);
 void
 ldb_contents_init(ldb_contents_t *x);
 
+/*
+ * TableProperties
+ */
+
+void
+ldb_tableprops_init(ldb_tableprops_t *x);
+
 /*
  * ReadBlock
  */
@@ -123,4 +180,73 @@ ldb_read_block(ldb_contents_t *result,
                const struct ldb_readopt_s *options,
                const ldb_handle_t *handle);
 
+/* Like read_block(), but return the block exactly as stored (possibly
+   compressed), without the trailer. The compression type is stored
+   in *type. */
+int
+ldb_read_raw_block(ldb_contents_t *result,
+                   int *type,
+                   struct ldb_rfile_s *file,
+                   const struct ldb_readopt_s *options,
+                   const ldb_handle_t *handle);
+
+/* Like read_raw_block(), but read into "scratch" if the block and its
+   trailer fit in "size" bytes and the file is not mapped. The result
+   then points into scratch and is not heap allocated; it must be
+   decoded or copied before scratch is reused. */
+int
+ldb_read_raw_scratch(ldb_contents_t *result,
+                     int *type,
+                     struct ldb_rfile_s *file,
+                     const struct ldb_readopt_s *options,
+                     const ldb_handle_t *handle,
+                     uint8_t *scratch,
+                     size_t size);
+
+/* Batched form of read_raw_block() for blocks of the same file. The
+   reads are submitted together so that they can proceed in parallel.
+   Fills results[i], types[i] and statuses[i] for each handle. */
+void
+ldb_read_raw_blocks(ldb_contents_t *results,
+                    int *types,
+                    int *statuses,
+                    struct ldb_rfile_s *file,
+                    const struct ldb_readopt_s *options,
+                    const ldb_handle_t *handles,
+                    size_t count);
+
+/* Append "x" compressed with "type" (snappy, LZ4 or Zstd) to *z.
+   Returns zero if the type is not supported or not compiled in. */
+int
+ldb_encode_block(ldb_buffer_t *z, int type, const ldb_slice_t *x);
+
+/* Uncompress a block returned by read_raw_block(). Takes ownership
+   of raw's data if it is heap allocated. The dictionary (which may
+   be NULL) is only needed for LDB_ZSTD_DICT_TYPE blocks. */
+int
+ldb_decode_block(ldb_contents_t *result,
+                 ldb_contents_t *raw,
+                 int type,
+                 const ldb_dict_t *dict);
+
+/*
+ * Dictionary
+ */
+
+/* Returns NULL if Zstd support is not compiled in. */
+ldb_dict_t *
+ldb_dict_create(const ldb_slice_t *data);
+
+void
+ldb_dict_destroy(ldb_dict_t *dict);
+
+/* Train a Zstd dictionary of at most max_size bytes on the samples
+   concatenated in data. Returns 0 if it could not be trained (or if
+   Zstd support is not compiled in). */
+int
+ldb_dict_train(ldb_buffer_t *dict,
+               size_t max_size,
+               const ldb_slice_t *data,
+               const ldb_array_t *sizes);
+
 #endif /* LDB_TABLE_FORMAT_H */
@@ -15,8 +15,10 @@
 #include <assert.h>
 #include <stddef.h>
 
+#include "../util/coding.h"
 #include "../util/comparator.h"
 #include "../util/internal.h"
+#include "../util/slice.h"
 #include "../util/types.h"
 
 #include "iterator.h"
@@ -31,6 +33,7 @@ ldb_iter_init(ldb_iter_t *iter,
               const ldb_itertbl_t *table,
               const ldb_comparator_t *cmp) {
   iter->ptr = ptr;
+  iter->ptr_size = 0;
   iter->cleanup_head.func = NULL;
   iter->cleanup_head.next = NULL;
   iter->table = table;
@@ -47,28 +50,41 @@ ldb_iter_clear(ldb_iter_t *iter) {
     for (node = iter->cleanup_head.next; node != NULL; node = next) {
       next = node->next;
       ldb_cleanup_run(node);
-      ldb_free(node);
+      ldb_small_free(node, sizeof(ldb_cleanup_t));
     }
   }
 
   iter->table->clear(iter->ptr);
 
-  ldb_free(iter->ptr);
+  if (iter->ptr_size > 0)
+    ldb_small_free(iter->ptr, iter->ptr_size);
+  else
+    ldb_free(iter->ptr);
 }
 
 ldb_iter_t *
 ldb_iter_create(void *ptr,
                 const ldb_itertbl_t *table,
                 const ldb_comparator_t *cmp) {
-  ldb_iter_t *iter = ldb_malloc(sizeof(ldb_iter_t));
+  ldb_iter_t *iter = ldb_small_alloc(sizeof(ldb_iter_t));
   ldb_iter_init(iter, ptr, table, cmp);
   return iter;
 }
 
+ldb_iter_t *
+ldb_iter_create_small(void *ptr,
+                      size_t size,
+                      const ldb_itertbl_t *table,
+                      const ldb_comparator_t *cmp) {
+  ldb_iter_t *iter = ldb_iter_create(ptr, table, cmp);
+  iter->ptr_size = size;
+  return iter;
+}
+
 void
 ldb_iter_destroy(ldb_iter_t *iter) {
   ldb_iter_clear(iter);
-  ldb_free(iter);
+  ldb_small_free(iter, sizeof(ldb_iter_t));
 }
 
 void
@@ -81,7 +97,7 @@ ldb_iter_register_cleanup(ldb_iter_t *iter,
   if (ldb_cleanup_empty(&iter->cleanup_head)) {
     node = &iter->cleanup_head;
   } else {
-    node = ldb_malloc(sizeof(ldb_cleanup_t));
+    node = ldb_small_alloc(sizeof(ldb_cleanup_t));
     node->next = iter->cleanup_head.next;
     iter->cleanup_head.next = node;
   }
@@ -179,6 +195,67 @@ ldb_iter_seek_lt(ldb_iter_t *iter, const ldb_slice_t *target) {
     iter->table->last(iter->ptr);
 }
 
+size_t
+ldb_iter_fill(ldb_iter_t *iter, void *buf, size_t size, size_t max) {
+  uint8_t *zp = buf;
+  size_t len = 0;
+
+  while (max > 0 && iter->table->valid(iter->ptr)) {
+    ldb_slice_t key = iter->table->key(iter->ptr);
+    ldb_slice_t val = iter->table->value(iter->ptr);
+    size_t need = ldb_varint32_size(key.size) + key.size
+                + ldb_varint32_size(val.size) + val.size;
+
+    if (need > size - len)
+      break;
+
+    zp = ldb_varint32_write(zp, key.size);
+    zp = ldb_raw_write(zp, key.data, key.size);
+    zp = ldb_varint32_write(zp, val.size);
+    zp = ldb_raw_write(zp, val.data, val.size);
+
+    len += need;
+    max -= 1;
+
+    iter->table->next(iter->ptr);
+  }
+
+  return len;
+}
+
+size_t
+ldb_iter_next_batch(ldb_iter_t *iter, ldb_slice_t *keys,
+                                      ldb_slice_t *values,
+                                      size_t max,
+                                      void *buf,
+                                      size_t size) {
+  const ldb_itertbl_t *table = iter->table;
+  uint8_t *zp = buf;
+  void *ptr = iter->ptr;
+  size_t count = 0;
+
+  while (count < max && table->valid(ptr)) {
+    ldb_slice_t key = table->key(ptr);
+    ldb_slice_t val = table->value(ptr);
+
+    if (key.size + val.size > size)
+      break;
+
+    ldb_slice_set(&keys[count], zp, key.size);
+    zp = ldb_raw_write(zp, key.data, key.size);
+
+    ldb_slice_set(&values[count], zp, val.size);
+    zp = ldb_raw_write(zp, val.data, val.size);
+
+    size -= key.size + val.size;
+    count += 1;
+
+    table->next(ptr);
+  }
+
+  return count;
+}
+
 /*
  * Empty Comparator
  */
@@ -273,9 +350,10 @@ LDB_ITERATOR_FUNCTIONS(ldb_emptyiter);
 
 ldb_iter_t *
 ldb_emptyiter_create(int status) {
-  ldb_emptyiter_t *iter = ldb_malloc(sizeof(ldb_emptyiter_t));
+  ldb_emptyiter_t *iter = ldb_small_alloc(sizeof(ldb_emptyiter_t));
 
   iter->status = status;
 
-  return ldb_iter_create(iter, &ldb_emptyiter_table, &empty_comparator);
+  return ldb_iter_create_small(iter, sizeof(ldb_emptyiter_t),
+                               &ldb_emptyiter_table, &empty_comparator);
 }
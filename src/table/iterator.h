@@ -48,6 +48,9 @@ typedef struct ldb_iter_s {
   /* The underlying iterator. */
   void *ptr;
 
+  /* Size of ptr if it came from ldb_small_alloc(), otherwise zero. */
+  size_t ptr_size;
+
   /* Cleanup functions are stored in a single-linked list.
      The list's head node is inlined in the iterator. */
   ldb_cleanup_t cleanup_head;
@@ -222,6 +225,14 @@ ldb_iter_create(void *ptr,
                 const ldb_itertbl_t *table,
                 const struct ldb_comparator_s *cmp);
 
+/* Like ldb_iter_create(), for a ptr of `size` bytes allocated with
+   ldb_small_alloc(). */
+ldb_iter_t *
+ldb_iter_create_small(void *ptr,
+                      size_t size,
+                      const ldb_itertbl_t *table,
+                      const struct ldb_comparator_s *cmp);
+
 LDB_EXTERN void
 ldb_iter_destroy(ldb_iter_t *iter);
 
@@ -289,6 +300,28 @@ ldb_iter_seek_le(ldb_iter_t *iter, const ldb_slice_t *target);
 LDB_EXTERN void
 ldb_iter_seek_lt(ldb_iter_t *iter, const ldb_slice_t *target);
 
+/* Copy up to `max` entries, starting at the current one, into `buf`
+   and step past them. Each entry is a length-prefixed key followed by
+   a length-prefixed value. Stops early when the next entry does not
+   fit. Returns the number of bytes written; zero with the iterator
+   still valid means `buf` is too small for a single entry. This lets
+   a caller across an FFI boundary (e.g. JavaScript and wasm) read many
+   entries per call. */
+LDB_EXTERN size_t
+ldb_iter_fill(ldb_iter_t *iter, void *buf, size_t size, size_t max);
+
+/* Copy up to `max` entries, starting at the current one, into `buf`
+   and step past them. keys[i] and values[i] point into `buf` and stay
+   valid after the iterator moves on. Stops early when the next entry
+   does not fit. Returns the number of entries; zero with the iterator
+   still valid means `buf` is too small for a single entry. */
+LDB_EXTERN size_t
+ldb_iter_next_batch(ldb_iter_t *iter, ldb_slice_t *keys,
+                                      ldb_slice_t *values,
+                                      size_t max,
+                                      void *buf,
+                                      size_t size);
+
 /*
  * Empty Iterator
  */
@@ -36,12 +36,14 @@ enum ldb_direction {
  */
 
 typedef struct ldb_mergeiter_s {
-  /* We might want to use a heap in case there are lots of children.
-     For now we use a simple array since we expect a very small number
-     of children in the current implementation. */
+  /* The valid children are kept in a binary heap ordered by key
+     (smallest first when moving forward, largest first in reverse),
+     so that advancing costs O(log n) comparisons rather than O(n). */
   const ldb_comparator_t *comparator;
   ldb_wrapiter_t *children;
   int n;
+  ldb_wrapiter_t **heap;
+  int length;
   ldb_wrapiter_t *current;
   enum ldb_direction direction;
 } ldb_mergeiter_t;
@@ -54,8 +56,10 @@ ldb_mergeiter_init(ldb_mergeiter_t *mi,
   int i;
 
   mi->comparator = comparator;
-  mi->children = ldb_malloc(n * sizeof(ldb_wrapiter_t));
+  mi->children = ldb_small_alloc(n * sizeof(ldb_wrapiter_t));
   mi->n = n;
+  mi->heap = ldb_small_alloc(n * sizeof(ldb_wrapiter_t *));
+  mi->length = 0;
   mi->current = NULL;
   mi->direction = LDB_FORWARD;
 
@@ -70,7 +74,8 @@ ldb_mergeiter_clear(ldb_mergeiter_t *mi) {
   for (i = 0; i < mi->n; i++)
     ldb_wrapiter_clear(&mi->children[i]);
 
-  ldb_free(mi->children);
+  ldb_small_free(mi->children, mi->n * sizeof(ldb_wrapiter_t));
+  ldb_small_free(mi->heap, mi->n * sizeof(ldb_wrapiter_t *));
 }
 
 static int
@@ -103,52 +108,85 @@ ldb_mergeiter_status(const ldb_mergeiter_t *mi) {
   return rc;
 }
 
+/* Whether child x belongs above child y in the heap. Equal keys are
+   ordered by position: the first child wins moving forward, and the
+   last one in reverse. */
+static LDB_INLINE int
+ldb_mergeiter_before(const ldb_mergeiter_t *mi,
+                     const ldb_wrapiter_t *x,
+                     const ldb_wrapiter_t *y) {
+  ldb_slice_t xk = ldb_wrapiter_key(x);
+  ldb_slice_t yk = ldb_wrapiter_key(y);
+  int cmp = ldb_compare_fast(mi->comparator, &xk, &yk);
+
+  if (mi->direction == LDB_REVERSE)
+    return cmp > 0 || (cmp == 0 && x > y);
+
+  return cmp < 0 || (cmp == 0 && x < y);
+}
+
 static void
-ldb_mergeiter_find_smallest(ldb_mergeiter_t *mi) {
-  ldb_wrapiter_t *smallest = NULL;
-  int i;
+ldb_mergeiter_sift_down(ldb_mergeiter_t *mi, int i) {
+  ldb_wrapiter_t **heap = mi->heap;
+  ldb_wrapiter_t *item = heap[i];
+  int len = mi->length;
 
-  for (i = 0; i < mi->n; i++) {
-    ldb_wrapiter_t *child = &mi->children[i];
+  for (;;) {
+    int child = 2 * i + 1;
 
-    if (ldb_wrapiter_valid(child)) {
-      if (smallest == NULL) {
-        smallest = child;
-      } else {
-        ldb_slice_t child_key = ldb_wrapiter_key(child);
-        ldb_slice_t smallest_key = ldb_wrapiter_key(smallest);
+    if (child >= len)
+      break;
 
-        if (ldb_compare(mi->comparator, &child_key, &smallest_key) < 0)
-          smallest = child;
-      }
+    if (child + 1 < len && ldb_mergeiter_before(mi, heap[child + 1],
+                                                    heap[child])) {
+      child++;
     }
+
+    if (!ldb_mergeiter_before(mi, heap[child], item))
+      break;
+
+    heap[i] = heap[child];
+    i = child;
   }
 
-  mi->current = smallest;
+  heap[i] = item;
 }
 
+/* Rebuild the heap from every valid child (mi->direction must be set). */
 static void
-ldb_mergeiter_find_largest(ldb_mergeiter_t *mi) {
-  ldb_wrapiter_t *largest = NULL;
+ldb_mergeiter_build(ldb_mergeiter_t *mi) {
   int i;
 
-  for (i = mi->n - 1; i >= 0; i--) {
-    ldb_wrapiter_t *child = &mi->children[i];
+  mi->length = 0;
 
-    if (ldb_wrapiter_valid(child)) {
-      if (largest == NULL) {
-        largest = child;
-      } else {
-        ldb_slice_t child_key = ldb_wrapiter_key(child);
-        ldb_slice_t largest_key = ldb_wrapiter_key(largest);
+  for (i = 0; i < mi->n; i++) {
+    if (ldb_wrapiter_valid(&mi->children[i]))
+      mi->heap[mi->length++] = &mi->children[i];
+  }
 
-        if (ldb_compare(mi->comparator, &child_key, &largest_key) > 0)
-          largest = child;
-      }
+  for (i = mi->length / 2 - 1; i >= 0; i--)
+    ldb_mergeiter_sift_down(mi, i);
+
+  mi->current = mi->length > 0 ? mi->heap[0] : NULL;
+}
+
+/* Restore the heap after the current child has moved. */
+static void
+ldb_mergeiter_update(ldb_mergeiter_t *mi) {
+  assert(mi->length > 0 && mi->heap[0] == mi->current);
+
+  if (!ldb_wrapiter_valid(mi->current)) {
+    mi->heap[0] = mi->heap[--mi->length];
+
+    if (mi->length == 0) {
+      mi->current = NULL;
+      return;
     }
   }
 
-  mi->current = largest;
+  ldb_mergeiter_sift_down(mi, 0);
+
+  mi->current = mi->heap[0];
 }
 
 static void
@@ -158,9 +196,9 @@ ldb_mergeiter_first(ldb_mergeiter_t *mi) {
   for (i = 0; i < mi->n; i++)
     ldb_wrapiter_first(&mi->children[i]);
 
-  ldb_mergeiter_find_smallest(mi);
-
   mi->direction = LDB_FORWARD;
+
+  ldb_mergeiter_build(mi);
 }
 
 static void
@@ -170,9 +208,9 @@ ldb_mergeiter_last(ldb_mergeiter_t *mi) {
   for (i = 0; i < mi->n; i++)
     ldb_wrapiter_last(&mi->children[i]);
 
-  ldb_mergeiter_find_largest(mi);
-
   mi->direction = LDB_REVERSE;
+
+  ldb_mergeiter_build(mi);
 }
 
 static void
@@ -182,9 +220,9 @@ ldb_mergeiter_seek(ldb_mergeiter_t *mi, const ldb_slice_t *target) {
   for (i = 0; i < mi->n; i++)
     ldb_wrapiter_seek(&mi->children[i], target);
 
-  ldb_mergeiter_find_smallest(mi);
-
   mi->direction = LDB_FORWARD;
+
+  ldb_mergeiter_build(mi);
 }
 
 static void
@@ -217,10 +255,15 @@ ldb_mergeiter_next(ldb_mergeiter_t *mi) {
     }
 
     mi->direction = LDB_FORWARD;
+
+    ldb_wrapiter_next(mi->current);
+    ldb_mergeiter_build(mi);
+
+    return;
   }
 
   ldb_wrapiter_next(mi->current);
-  ldb_mergeiter_find_smallest(mi);
+  ldb_mergeiter_update(mi);
 }
 
 static void
@@ -254,10 +297,15 @@ ldb_mergeiter_prev(ldb_mergeiter_t *mi) {
     }
 
     mi->direction = LDB_REVERSE;
+
+    ldb_wrapiter_prev(mi->current);
+    ldb_mergeiter_build(mi);
+
+    return;
   }
 
   ldb_wrapiter_prev(mi->current);
-  ldb_mergeiter_find_largest(mi);
+  ldb_mergeiter_update(mi);
 }
 
 LDB_ITERATOR_FUNCTIONS(ldb_mergeiter);
@@ -276,9 +324,50 @@ ldb_mergeiter_create(const ldb_comparator_t *comparator,
   if (n == 1)
     return children[0];
 
-  iter = ldb_malloc(sizeof(ldb_mergeiter_t));
+  iter = ldb_small_alloc(sizeof(ldb_mergeiter_t));
+
+  ldb_mergeiter_init(iter, comparator, children, n);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_mergeiter_t),
+                               &ldb_mergeiter_table, comparator);
+}
+
+ldb_iter_t *
+ldb_mergeiter_create_resettable(const ldb_comparator_t *comparator,
+                                ldb_iter_t **children,
+                                int n) {
+  ldb_mergeiter_t *iter = ldb_small_alloc(sizeof(ldb_mergeiter_t));
+
+  assert(n >= 1);
 
   ldb_mergeiter_init(iter, comparator, children, n);
 
-  return ldb_iter_create(iter, &ldb_mergeiter_table, comparator);
+  return ldb_iter_create_small(iter, sizeof(ldb_mergeiter_t),
+                               &ldb_mergeiter_table, comparator);
+}
+
+void
+ldb_mergeiter_reset(ldb_iter_t *iter, ldb_iter_t **children, int n) {
+  ldb_mergeiter_t *mi = iter->ptr;
+  int i, j;
+
+  assert(iter->table == &ldb_mergeiter_table);
+  assert(n >= 1);
+
+  for (i = 0; i < mi->n; i++) {
+    ldb_iter_t *child = mi->children[i].iter;
+
+    for (j = 0; j < n; j++) {
+      if (children[j] == child)
+        break;
+    }
+
+    if (j == n)
+      ldb_wrapiter_clear(&mi->children[i]);
+  }
+
+  ldb_small_free(mi->children, mi->n * sizeof(ldb_wrapiter_t));
+  ldb_small_free(mi->heap, mi->n * sizeof(ldb_wrapiter_t *));
+
+  ldb_mergeiter_init(mi, mi->comparator, children, n);
 }
@@ -30,4 +30,26 @@ ldb_mergeiter_create(const struct ldb_comparator_s *comparator,
                      struct ldb_iter_s **children,
                      int n);
 
+/* Like ldb_mergeiter_create(), but always returns a merging
+ * iterator, whose children may later be replaced with
+ * ldb_mergeiter_reset().
+ *
+ * REQUIRES: n >= 1
+ */
+struct ldb_iter_s *
+ldb_mergeiter_create_resettable(const struct ldb_comparator_s *comparator,
+                                struct ldb_iter_s **children,
+                                int n);
+
+/* Replace the children of a resettable merging iterator. Old
+ * children which are not among the new ones are deleted; the
+ * rest are kept. The iterator is left unpositioned.
+ *
+ * REQUIRES: n >= 1
+ */
+void
+ldb_mergeiter_reset(struct ldb_iter_s *iter,
+                    struct ldb_iter_s **children,
+                    int n);
+
 #endif /* LDB_MERGER_H */
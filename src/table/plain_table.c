@@ -0,0 +1,418 @@
+/*!
+ * plain_table.c - plain table format for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../util/coding.h"
+#include "../util/comparator.h"
+#include "../util/env.h"
+#include "../util/internal.h"
+#include "../util/options.h"
+#include "../util/slice.h"
+#include "../util/status.h"
+
+#include "block.h"
+#include "format.h"
+#include "iterator.h"
+#include "plain_table.h"
+
+/*
+ * Plain Table
+ */
+
+/* The entries of a plain table are stored one after another from the
+ * start of the file, uncompressed and without block trailers:
+ *
+ *    key: char[key_width]
+ *    value_length: varint32
+ *    value: char[value_length]
+ *
+ * The "plain.index" meta block finds them:
+ *
+ *    offsets: uint32[num_entries]
+ *    buckets: uint32[num_buckets]
+ *    key_width: uint32
+ *    num_entries: uint32
+ *    num_buckets: uint32
+ *
+ * offsets[i] is the file offset of the ith entry. The buckets form
+ * an open addressed hash table (num_buckets is zero or a power of
+ * two) over the user keys of the entries (see ldb_block_hash()):
+ * each holds one plus the index of the first entry of a user key,
+ * or zero if empty. Tables whose comparator does not order keys
+ * bytewise have no buckets and are always binary searched.
+ *
+ * The regular index block of the table maps runs of about block_size
+ * bytes of entries, for approximate offsets and compaction splits.
+ */
+struct ldb_plain_s {
+  const ldb_comparator_t *comparator;
+  const uint8_t *data;    /* Entries (start of the file). */
+  size_t size;            /* Size of the entries. */
+  uint8_t *heap;          /* data, if read into memory. */
+  ldb_contents_t index;   /* The "plain.index" meta block. */
+  const uint8_t *offsets;
+  const uint8_t *buckets;
+  uint32_t key_width;
+  uint32_t num_entries;
+  uint32_t num_buckets;
+};
+
+int
+ldb_plain_open(ldb_plain_t **plain,
+               const ldb_comparator_t *comparator,
+               ldb_rfile_t *file,
+               const ldb_readopt_t *options,
+               const ldb_handle_t *handle) {
+  const uint8_t *tail;
+  ldb_contents_t contents;
+  uint64_t min_size, prev;
+  ldb_plain_t *pt;
+  ldb_slice_t data;
+  uint32_t i;
+  int rc;
+
+  *plain = NULL;
+
+  if (handle->offset > SIZE_MAX)
+    return LDB_CORRUPTION;
+
+  rc = ldb_read_block(&contents, file, options, handle);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  pt = ldb_malloc(sizeof(ldb_plain_t));
+  pt->comparator = comparator;
+  pt->data = NULL;
+  pt->size = handle->offset;
+  pt->heap = NULL;
+  pt->index = contents;
+
+  if (contents.data.size < 12)
+    goto corrupt;
+
+  tail = contents.data.data + contents.data.size - 12;
+
+  pt->key_width = ldb_fixed32_decode(tail + 0);
+  pt->num_entries = ldb_fixed32_decode(tail + 4);
+  pt->num_buckets = ldb_fixed32_decode(tail + 8);
+
+  if (pt->num_buckets & (pt->num_buckets - 1))
+    goto corrupt;
+
+  if (pt->key_width < 8 && comparator->user_comparator != NULL)
+    goto corrupt;
+
+  min_size = ((uint64_t)pt->num_entries + pt->num_buckets) * 4 + 12;
+
+  if (contents.data.size != min_size)
+    goto corrupt;
+
+  pt->offsets = contents.data.data;
+  pt->buckets = pt->offsets + (size_t)pt->num_entries * 4;
+
+  if (!ldb_rfile_mapped(file))
+    pt->heap = ldb_malloc(pt->size + 1);
+
+  rc = ldb_rfile_pread(file, &data, pt->heap, pt->size, 0);
+
+  if (rc != LDB_OK)
+    goto fail;
+
+  if (data.size != pt->size)
+    goto corrupt;
+
+  pt->data = data.data;
+
+  /* Every key must lie within the entries, in order. */
+  for (i = 0, prev = 0; i < pt->num_entries; i++) {
+    uint64_t offset = ldb_fixed32_decode(pt->offsets + i * 4);
+
+    if (offset < prev || offset + pt->key_width + 1 > pt->size)
+      goto corrupt;
+
+    prev = offset + pt->key_width + 1;
+  }
+
+  /* Probes must end at an empty bucket. */
+  for (i = 0, prev = 0; i < pt->num_buckets; i++) {
+    uint32_t slot = ldb_fixed32_decode(pt->buckets + i * 4);
+
+    if (slot > pt->num_entries)
+      goto corrupt;
+
+    prev += (slot == 0);
+  }
+
+  if (pt->num_buckets > 0 && prev == 0)
+    goto corrupt;
+
+  *plain = pt;
+
+  return LDB_OK;
+corrupt:
+  rc = LDB_CORRUPTION;
+fail:
+  ldb_plain_destroy(pt);
+  return rc;
+}
+
+void
+ldb_plain_destroy(ldb_plain_t *plain) {
+  if (plain->index.heap_allocated)
+    ldb_free((void *)plain->index.data.data);
+
+  if (plain->heap != NULL)
+    ldb_free(plain->heap);
+
+  ldb_free(plain);
+}
+
+size_t
+ldb_plain_memory(const ldb_plain_t *plain) {
+  size_t size = sizeof(ldb_plain_t);
+
+  if (plain->heap != NULL)
+    size += plain->size;
+
+  if (plain->index.heap_allocated)
+    size += plain->index.data.size;
+
+  return size;
+}
+
+static LDB_INLINE ldb_slice_t
+plain_key(const ldb_plain_t *plain, uint32_t index) {
+  uint32_t offset = ldb_fixed32_decode(plain->offsets + index * 4);
+  ldb_slice_t key;
+
+  ldb_slice_set(&key, plain->data + offset, plain->key_width);
+
+  return key;
+}
+
+/* Decode the value of the entry at "index". Returns zero if it
+   runs past the entries. */
+static int
+plain_value(const ldb_plain_t *plain, uint32_t index, ldb_slice_t *value) {
+  uint32_t offset = ldb_fixed32_decode(plain->offsets + index * 4);
+  const uint8_t *xp = plain->data + offset + plain->key_width;
+  size_t xn = plain->size - offset - plain->key_width;
+  uint32_t length;
+
+  if (!ldb_varint32_read(&length, &xp, &xn))
+    return 0;
+
+  if (length > xn)
+    return 0;
+
+  ldb_slice_set(value, xp, length);
+
+  return 1;
+}
+
+/* Index of the first entry at or after target. */
+static uint32_t
+plain_lower_bound(const ldb_plain_t *plain, const ldb_slice_t *target) {
+  uint32_t lo = 0;
+  uint32_t hi = plain->num_entries;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    ldb_slice_t key = plain_key(plain, mid);
+
+    if (ldb_compare(plain->comparator, &key, target) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* Index of the first entry sharing k's user key, or num_entries if
+   the hash index shows there is none. */
+static uint32_t
+plain_find(const ldb_plain_t *plain, const ldb_slice_t *k) {
+  uint32_t mask = plain->num_buckets - 1;
+  size_t user_size = k->size;
+  uint32_t b, i;
+
+  if (k->size != plain->key_width)
+    return plain->num_entries;
+
+  if (plain->comparator->user_comparator != NULL)
+    user_size -= 8;
+
+  b = ldb_block_hash(plain->comparator, k) & mask;
+
+  for (;;) {
+    uint32_t slot = ldb_fixed32_decode(plain->buckets + b * 4);
+    ldb_slice_t key;
+
+    if (slot == 0)
+      return plain->num_entries;
+
+    i = slot - 1;
+    key = plain_key(plain, i);
+
+    if (memcmp(key.data, k->data, user_size) == 0)
+      return i;
+
+    b = (b + 1) & mask;
+  }
+}
+
+int
+ldb_plain_get(const ldb_plain_t *plain,
+              const ldb_slice_t *k,
+              void *arg,
+              ldb_plainfunc_f handle_result) {
+  ldb_slice_t key, value;
+  uint32_t i;
+
+  if (plain->num_buckets > 0) {
+    i = plain_find(plain, k);
+
+    /* Versions of a user key are adjacent, newest first. */
+    while (i < plain->num_entries) {
+      key = plain_key(plain, i);
+
+      if (ldb_compare(plain->comparator, &key, k) >= 0)
+        break;
+
+      i++;
+    }
+  } else {
+    i = plain_lower_bound(plain, k);
+  }
+
+  if (i >= plain->num_entries)
+    return LDB_OK;
+
+  key = plain_key(plain, i);
+
+  if (!plain_value(plain, i, &value))
+    return LDB_CORRUPTION;
+
+  (*handle_result)(arg, &key, &value);
+
+  return LDB_OK;
+}
+
+/*
+ * Plain Table Iterator
+ */
+
+typedef struct ldb_plainiter_s {
+  const ldb_plain_t *plain;
+  uint32_t index; /* num_entries if invalid. */
+  ldb_slice_t value;
+  int status;
+} ldb_plainiter_t;
+
+static void
+ldb_plainiter_update(ldb_plainiter_t *iter) {
+  const ldb_plain_t *plain = iter->plain;
+
+  if (iter->index >= plain->num_entries)
+    return;
+
+  if (!plain_value(plain, iter->index, &iter->value)) {
+    iter->status = LDB_CORRUPTION; /* "bad entry in plain table" */
+    iter->index = plain->num_entries;
+  }
+}
+
+static void
+ldb_plainiter_clear(ldb_plainiter_t *iter) {
+  (void)iter;
+}
+
+static int
+ldb_plainiter_valid(const ldb_plainiter_t *iter) {
+  return iter->index < iter->plain->num_entries;
+}
+
+static void
+ldb_plainiter_seek(ldb_plainiter_t *iter, const ldb_slice_t *target) {
+  iter->index = plain_lower_bound(iter->plain, target);
+  ldb_plainiter_update(iter);
+}
+
+static void
+ldb_plainiter_first(ldb_plainiter_t *iter) {
+  iter->index = 0;
+  ldb_plainiter_update(iter);
+}
+
+static void
+ldb_plainiter_last(ldb_plainiter_t *iter) {
+  iter->index = iter->plain->num_entries;
+
+  if (iter->index > 0)
+    iter->index--;
+
+  ldb_plainiter_update(iter);
+}
+
+static void
+ldb_plainiter_next(ldb_plainiter_t *iter) {
+  assert(ldb_plainiter_valid(iter));
+  iter->index++;
+  ldb_plainiter_update(iter);
+}
+
+static void
+ldb_plainiter_prev(ldb_plainiter_t *iter) {
+  assert(ldb_plainiter_valid(iter));
+
+  if (iter->index == 0)
+    iter->index = iter->plain->num_entries;
+  else
+    iter->index--;
+
+  ldb_plainiter_update(iter);
+}
+
+static ldb_slice_t
+ldb_plainiter_key(const ldb_plainiter_t *iter) {
+  assert(ldb_plainiter_valid(iter));
+  return plain_key(iter->plain, iter->index);
+}
+
+static ldb_slice_t
+ldb_plainiter_value(const ldb_plainiter_t *iter) {
+  assert(ldb_plainiter_valid(iter));
+  return iter->value;
+}
+
+static int
+ldb_plainiter_status(const ldb_plainiter_t *iter) {
+  return iter->status;
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_plainiter);
+
+ldb_iter_t *
+ldb_plainiter_create(const ldb_plain_t *plain) {
+  ldb_plainiter_t *iter = ldb_small_alloc(sizeof(ldb_plainiter_t));
+
+  iter->plain = plain;
+  iter->index = plain->num_entries;
+  iter->status = LDB_OK;
+
+  ldb_slice_init(&iter->value);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_plainiter_t),
+                               &ldb_plainiter_table, plain->comparator);
+}
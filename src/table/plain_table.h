@@ -0,0 +1,68 @@
+/*!
+ * plain_table.h - plain table format for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_PLAIN_TABLE_H
+#define LDB_PLAIN_TABLE_H
+
+#include <stddef.h>
+
+#include "../util/types.h"
+
+/*
+ * Types
+ */
+
+struct ldb_comparator_s;
+struct ldb_handle_s;
+struct ldb_iter_s;
+struct ldb_readopt_s;
+struct ldb_rfile_s;
+
+/* The entries of a plain table (see plain_key_size), read in place
+   from the mapped file, along with the index used to find them. */
+typedef struct ldb_plain_s ldb_plain_t;
+
+typedef void (*ldb_plainfunc_f)(void *,
+                                const ldb_slice_t *,
+                                const ldb_slice_t *);
+
+/*
+ * Plain Table
+ */
+
+/* Read the index of a plain table from the "plain.index" meta block
+   at "handle", along with the entries which precede it. If the file
+   is not mapped, the entries are read into memory. */
+int
+ldb_plain_open(ldb_plain_t **plain,
+               const struct ldb_comparator_s *comparator,
+               struct ldb_rfile_s *file,
+               const struct ldb_readopt_s *options,
+               const struct ldb_handle_s *handle);
+
+void
+ldb_plain_destroy(ldb_plain_t *plain);
+
+/* Memory held by the reader (entries read into memory, and the index). */
+size_t
+ldb_plain_memory(const ldb_plain_t *plain);
+
+/* Calls (*handle_result)(arg, ...) with the entry found after a
+   seek to k, unless the hash index shows that no entry shares k's
+   user key. */
+int
+ldb_plain_get(const ldb_plain_t *plain,
+              const ldb_slice_t *k,
+              void *arg,
+              ldb_plainfunc_f handle_result);
+
+/* Returns a new iterator over the entries. */
+struct ldb_iter_s *
+ldb_plainiter_create(const ldb_plain_t *plain);
+
+#endif /* LDB_PLAIN_TABLE_H */
@@ -13,24 +13,52 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "../util/bloom.h"
+#include "../util/buffer.h"
 #include "../util/cache.h"
 #include "../util/coding.h"
 #include "../util/comparator.h"
 #include "../util/env.h"
 #include "../util/internal.h"
 #include "../util/options.h"
+#include "../util/pcache.h"
+#include "../util/perf.h"
+#include "../util/pinned.h"
+#include "../util/prefix.h"
+#include "../util/ratelimit.h"
 #include "../util/slice.h"
+#include "../util/statistics.h"
 #include "../util/status.h"
+#include "../util/trace.h"
 
 #include "block.h"
+#include "cuckoo_table.h"
 #include "filter_block.h"
 #include "format.h"
 #include "iterator.h"
+#include "plain_table.h"
 #include "table.h"
 #include "two_level_iterator.h"
 
+/*
+ * Constants
+ */
+
+/* Automatic readahead starts once this many blocks were read back to
+   back, with a window that doubles on each refill up to the maximum. */
+#define LDB_READAHEAD_TRIGGER 2
+#define LDB_READAHEAD_MIN (8 << 10)
+#define LDB_READAHEAD_MAX (256 << 10)
+
+/* Compressed blocks up to this size are read onto the stack, as they
+   are copied out when decoded. */
+#define LDB_SCRATCH_SIZE (16 << 10)
+
+/* Blocks read at once by ldb_table_warm(). */
+#define LDB_WARM_BATCH 64
+
 /*
  * Table
  */
@@ -40,13 +68,253 @@ struct ldb_table_s {
   int status;
   ldb_rfile_t *file;
   uint64_t cache_id;
+  uint64_t compressed_id;
+  uint64_t pcache_id;
   ldb_filter_t *filter;
   const uint8_t *filter_data;
+  size_t filter_size; /* Size of filter_data. */
   ldb_handle_t metaindex_handle; /* Handle to metaindex_block:
                                     saved from footer. */
   ldb_block_t *index_block;
+  int partitioned; /* index_block is a top-level partition index. */
+  int user_keys; /* index_block is keyed by user keys alone. */
+  ldb_block_t *filter_index; /* Top-level index of filter partitions. */
+  int full_filter; /* The filter block covers the whole table. */
+  int prefix_filter; /* The (whole-table) filter also holds key prefixes. */
+  ldb_dict_t *dict; /* Decompression dictionary for data blocks. */
+  ldb_block_t *range_block; /* Range tombstones (or NULL). */
+  ldb_plain_t *plain; /* Entries of a plain table (or NULL). */
+  ldb_cuckoo_t *cuckoo; /* Index of a cuckoo table (or NULL). */
+  ldb_tableprops_t props;
+  int has_props;
+  int in_place; /* Blocks are read in place from the mapped file. */
+  int high_priority; /* Data blocks are cached at high priority. */
+
+  /* With cache_index_and_filter_blocks, the blocks above live in the
+     block cache instead, and are found through these handles. Pinned
+     blocks are resident again, but still charged to the cache. */
+  int cache_meta;
+  int lazy; /* Not read until first needed (see lazy_table_open). */
+  ldb_handle_t index_handle;
+  ldb_handle_t filter_handle;
+  ldb_handle_t filter_index_handle;
+  int filter_cached;
+  int filter_index_cached;
+  ldb_entry_t *index_pin;
+  ldb_entry_t *filter_pin;
+  ldb_entry_t *filter_index_pin;
+};
+
+/* Kinds of blocks, which decide their block cache priority. */
+enum block_kind {
+  BLOCK_DATA,
+  BLOCK_INDEX, /* Index blocks and index partitions. */
+  BLOCK_FILTER /* Filter blocks and filter partitions. */
 };
 
+/* A filter (or filter partition), as stored in the block cache. */
+typedef struct filter_part_s {
+  ldb_filter_t filter;
+  const uint8_t *data; /* Heap allocated filter data (or NULL). */
+} filter_part_t;
+
+static filter_part_t *
+filter_part_create(const ldb_bloom_t *policy, const ldb_contents_t *contents) {
+  filter_part_t *part = ldb_malloc(sizeof(filter_part_t));
+
+  part->data = contents->heap_allocated ? contents->data.data : NULL;
+
+  ldb_filter_init(&part->filter, policy, &contents->data);
+
+  return part;
+}
+
+static void
+filter_part_destroy(filter_part_t *part) {
+  if (part->data != NULL)
+    ldb_free((void *)part->data);
+
+  ldb_free(part);
+}
+
+static void
+delete_cached_filter(const ldb_slice_t *key, void *value) {
+  (void)key;
+  filter_part_destroy((filter_part_t *)value);
+}
+
+static void
+delete_cached_block(const ldb_slice_t *key, void *value) {
+  ldb_block_t *block = (ldb_block_t *)value;
+  (void)key;
+  ldb_block_destroy(block);
+}
+
+ldb_slice_t
+ldb_table_cache_key(uint8_t *buf, uint64_t id, const ldb_handle_t *handle) {
+  ldb_slice_t key;
+
+  ldb_fixed64_write(buf + 0, id);
+  ldb_fixed64_write(buf + 8, handle->offset);
+
+  ldb_slice_set(&key, buf, 16);
+
+  return key;
+}
+
+/* Count (and trace) a block cache lookup of the block at `handle`.
+   `miss` is one of the LDB_BLOCK_CACHE_*_MISS tickers, each of which
+   is followed by its _HIT counterpart. `fill` is whether a miss would
+   insert the block. */
+static void
+ldb_table_record_lookup(const ldb_table_t *table,
+                        enum ldb_ticker miss,
+                        int hit,
+                        const ldb_slice_t *key,
+                        const ldb_handle_t *handle,
+                        int fill) {
+  ldb_statistics_t *stats = table->options.statistics;
+  ldb_tracer_t *tracer = table->options.block_tracer;
+
+  if (stats != NULL) {
+    ldb_statistics_add(stats, hit ? LDB_BLOCK_CACHE_HIT
+                                  : LDB_BLOCK_CACHE_MISS, 1);
+    ldb_statistics_add(stats, (enum ldb_ticker)(miss + (hit != 0)), 1);
+  }
+
+  if (tracer != NULL && ldb_tracer_active(tracer)) {
+    enum ldb_block_type type = LDB_BLOCK_DATA;
+
+    if (miss == LDB_BLOCK_CACHE_INDEX_MISS)
+      type = LDB_BLOCK_INDEX;
+    else if (miss == LDB_BLOCK_CACHE_FILTER_MISS)
+      type = LDB_BLOCK_FILTER;
+
+    ldb_tracer_record_block(tracer, key, type, handle->size, hit, fill);
+  }
+}
+
+/* Count a filter probe. */
+static int
+ldb_table_record_filter(const ldb_table_t *table, int result) {
+  ldb_statistics_add(table->options.statistics,
+                     result ? LDB_BLOOM_FILTER_POSITIVE
+                            : LDB_BLOOM_FILTER_USEFUL, 1);
+  return result;
+}
+
+/* Index and filter blocks are needed by every read of the table, and
+   are evicted last, as are the data blocks of level-0 tables (which
+   every read probes). Data blocks of low priority reads go first. */
+static enum ldb_lru_priority
+ldb_table_priority(const ldb_table_t *table,
+                   const ldb_readopt_t *options,
+                   enum block_kind kind) {
+  if (kind != BLOCK_DATA)
+    return LDB_LRU_HIGH;
+
+  if (options->low_priority)
+    return LDB_LRU_LOW;
+
+  if (table->high_priority)
+    return LDB_LRU_HIGH;
+
+  return LDB_LRU_NORMAL;
+}
+
+/* Hand a freshly read index or filter block over to the block cache. */
+static void
+ldb_table_cache_meta(ldb_table_t *table,
+                     const ldb_handle_t *handle,
+                     void *value,
+                     size_t charge,
+                     void (*deleter)(const ldb_slice_t *, void *)) {
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_entry_t *entry;
+  uint8_t buf[16];
+  ldb_slice_t key;
+
+  key = ldb_table_cache_key(buf, table->cache_id, handle);
+  entry = ldb_lru_insert_priority(block_cache, &key, value, charge,
+                                  deleter, LDB_LRU_HIGH);
+
+  ldb_lru_release(block_cache, entry);
+}
+
+/* Look up an index or filter block in the block cache, reading it
+   back in if it has been evicted. On success, the caller must release
+   *entry (or, if *entry is NULL, destroy the result itself). */
+static void *
+ldb_table_lookup_meta(const ldb_table_t *table,
+                      const ldb_handle_t *handle,
+                      int is_filter,
+                      ldb_entry_t **entry) {
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_contents_t contents;
+  uint8_t buf[16];
+  ldb_slice_t key;
+  size_t charge;
+  void *value;
+
+  key = ldb_table_cache_key(buf, table->cache_id, handle);
+
+  *entry = ldb_lru_lookup(block_cache, &key);
+
+  ldb_table_record_lookup(table, is_filter ? LDB_BLOCK_CACHE_FILTER_MISS
+                                           : LDB_BLOCK_CACHE_INDEX_MISS,
+                                 *entry != NULL, &key, handle, 1);
+
+  if (*entry != NULL)
+    return ldb_lru_value(*entry);
+
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
+  if (ldb_read_block(&contents, table->file, &opt, handle) != LDB_OK)
+    return NULL;
+
+  if (is_filter) {
+    value = filter_part_create(table->options.filter_policy, &contents);
+    charge = contents.data.size;
+  } else {
+    ldb_block_t *block = ldb_block_create(&contents);
+
+    value = block;
+    charge = block->size;
+  }
+
+  if (contents.cachable) {
+    *entry = ldb_lru_insert_priority(block_cache, &key, value, charge,
+                                     is_filter ? &delete_cached_filter
+                                               : &delete_cached_block,
+                                     LDB_LRU_HIGH);
+  }
+
+  return value;
+}
+
+static void
+ldb_table_read_dict(ldb_table_t *table, const ldb_slice_t *handle_value) {
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_contents_t block;
+  ldb_handle_t handle;
+
+  if (!ldb_handle_import(&handle, handle_value))
+    return;
+
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
+  if (ldb_read_block(&block, table->file, &opt, &handle) != LDB_OK)
+    return;
+
+  table->dict = ldb_dict_create(&block.data);
+
+  if (block.heap_allocated)
+    ldb_free((void *)block.data.data);
+}
+
 static void
 ldb_table_read_filter(ldb_table_t *table,
                       const ldb_slice_t *filter_handle_value) {
@@ -58,6 +326,12 @@ ldb_table_read_filter(ldb_table_t *table,
   if (!ldb_handle_import(&filter_handle, filter_handle_value))
     return;
 
+  if (table->lazy) {
+    table->filter_handle = filter_handle;
+    table->filter_cached = 1;
+    return;
+  }
+
   /* We might want to unify with read_block() if we start
      requiring checksum verification in table_open(). */
   if (table->options.paranoid_checks)
@@ -71,31 +345,214 @@ ldb_table_read_filter(ldb_table_t *table,
   if (rc != LDB_OK)
     return;
 
-  if (block.heap_allocated)
+  if (table->cache_meta && block.cachable) {
+    filter_part_t *part = filter_part_create(table->options.filter_policy,
+                                             &block);
+
+    ldb_table_cache_meta(table, &filter_handle, part,
+                         block.data.size, &delete_cached_filter);
+
+    table->filter_handle = filter_handle;
+    table->filter_cached = 1;
+
+    return;
+  }
+
+  if (block.heap_allocated) {
     table->filter_data = block.data.data; /* Will need to delete later. */
+    table->filter_size = block.data.size;
+  }
 
   table->filter = ldb_filter_create(table->options.filter_policy, &block.data);
 }
 
 static void
-ldb_table_read_meta(ldb_table_t *table, const ldb_footer_t *footer) {
+ldb_table_read_filter_index(ldb_table_t *table,
+                            const ldb_slice_t *filter_handle_value) {
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_handle_t filter_handle;
+  ldb_contents_t block;
+  int rc;
+
+  if (!ldb_handle_import(&filter_handle, filter_handle_value))
+    return;
+
+  if (table->lazy) {
+    table->filter_index_handle = filter_handle;
+    table->filter_index_cached = 1;
+    return;
+  }
+
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
+  rc = ldb_read_block(&block,
+                      table->file,
+                      &opt,
+                      &filter_handle);
+
+  if (rc != LDB_OK)
+    return;
+
+  if (table->cache_meta && block.cachable) {
+    ldb_block_t *filter_index = ldb_block_create(&block);
+
+    ldb_table_cache_meta(table, &filter_handle, filter_index,
+                         filter_index->size, &delete_cached_block);
+
+    table->filter_index_handle = filter_handle;
+    table->filter_index_cached = 1;
+
+    return;
+  }
+
+  table->filter_index = ldb_block_create(&block);
+}
+
+static void
+ldb_table_read_range(ldb_table_t *table, const ldb_slice_t *handle_value) {
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_contents_t block;
+  ldb_handle_t handle;
+  int rc;
+
+  /* Unlike the other meta blocks, tombstones are needed for
+     correct reads. Failing to load them poisons the table. */
+  if (!ldb_handle_import(&handle, handle_value)) {
+    table->status = LDB_CORRUPTION;
+    return;
+  }
+
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
+  rc = ldb_read_block(&block, table->file, &opt, &handle);
+
+  if (rc != LDB_OK) {
+    table->status = rc;
+    return;
+  }
+
+  table->range_block = ldb_block_create(&block);
+}
+
+static int
+ldb_meta_find(ldb_iter_t *iter, const char *name, ldb_slice_t *value) {
+  ldb_slice_t key;
+
+  ldb_slice_set_str(&key, name);
+  ldb_iter_seek(iter, &key);
+
+  if (ldb_iter_valid(iter)) {
+    ldb_slice_t iter_key = ldb_iter_key(iter);
+
+    if (ldb_slice_equal(&iter_key, &key)) {
+      *value = ldb_iter_value(iter);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void
+ldb_props_find(ldb_iter_t *iter, const char *name, uint64_t *field) {
+  ldb_slice_t value;
+
+  if (ldb_meta_find(iter, name, &value))
+    ldb_varint64_slurp(field, &value);
+}
+
+static void
+ldb_table_read_props(ldb_table_t *table, const ldb_slice_t *handle_value) {
   ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_tableprops_t *props = &table->props;
   ldb_contents_t contents;
-  ldb_block_t *meta;
+  ldb_handle_t handle;
+  ldb_block_t *block;
   ldb_iter_t *iter;
-  ldb_slice_t key;
-  char name[72];
-  int rc;
 
-  if (table->options.filter_policy == NULL)
-    return; /* Do not need any metadata. */
+  /* Properties are informational only; errors are not propagated. */
+  if (!ldb_handle_import(&handle, handle_value))
+    return;
+
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
+  if (ldb_read_block(&contents, table->file, &opt, &handle) != LDB_OK)
+    return;
+
+  block = ldb_block_create(&contents);
+  iter = ldb_blockiter_create(block, ldb_bytewise_comparator);
+
+  ldb_tableprops_init(props);
+
+  ldb_props_find(iter, "compression", &props->compression);
+  ldb_props_find(iter, "creation.time", &props->creation_time);
+  ldb_props_find(iter, "data.blocks", &props->data_blocks);
+  ldb_props_find(iter, "deletions", &props->deletions);
+  ldb_props_find(iter, "entries", &props->entries);
+  ldb_props_find(iter, "raw.key.size", &props->raw_key_size);
+  ldb_props_find(iter, "raw.value.size", &props->raw_value_size);
+  ldb_props_find(iter, "sequence.largest", &props->largest_sequence);
+  ldb_props_find(iter, "sequence.smallest", &props->smallest_sequence);
+  ldb_props_find(iter, "tombstones", &props->tombstones);
+
+  table->has_props = (ldb_iter_status(iter) == LDB_OK);
+
+  ldb_iter_destroy(iter);
+  ldb_block_destroy(block);
+}
+
+static void
+ldb_table_read_plain(ldb_table_t *table, const ldb_slice_t *handle_value) {
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_handle_t handle;
+
+  if (!ldb_handle_import(&handle, handle_value))
+    return;
 
   if (table->options.paranoid_checks)
     opt.verify_checksums = 1;
 
-  if (!ldb_bloom_name(name, sizeof(name), table->options.filter_policy))
+  ldb_plain_open(&table->plain,
+                 table->options.comparator,
+                 table->file,
+                 &opt,
+                 &handle);
+}
+
+static void
+ldb_table_read_cuckoo(ldb_table_t *table, const ldb_slice_t *handle_value) {
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_handle_t handle;
+
+  if (!ldb_handle_import(&handle, handle_value))
     return;
 
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
+  ldb_cuckoo_open(&table->cuckoo,
+                  table->options.comparator,
+                  table->file,
+                  &opt,
+                  &handle);
+}
+
+static void
+ldb_table_read_meta(ldb_table_t *table, const ldb_footer_t *footer) {
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_contents_t contents;
+  ldb_slice_t value;
+  ldb_block_t *meta;
+  ldb_iter_t *iter;
+  char name[90];
+  int rc;
+
+  if (table->options.paranoid_checks)
+    opt.verify_checksums = 1;
+
   rc = ldb_read_block(&contents,
                       table->file,
                       &opt,
@@ -109,15 +566,57 @@ ldb_table_read_meta(ldb_table_t *table, const ldb_footer_t *footer) {
   meta = ldb_block_create(&contents);
   iter = ldb_blockiter_create(meta, ldb_bytewise_comparator);
 
-  ldb_slice_set_str(&key, name);
-  ldb_iter_seek(iter, &key);
+  if (ldb_meta_find(iter, "partition.index", &value))
+    table->partitioned = 1;
 
-  if (ldb_iter_valid(iter)) {
-    ldb_slice_t iter_key = ldb_iter_key(iter);
+  if (ldb_meta_find(iter, "index.user_keys", &value)) {
+    if (table->options.comparator->user_comparator != NULL)
+      table->user_keys = 1;
+  }
 
-    if (ldb_slice_equal(&iter_key, &key)) {
-      ldb_slice_t iter_value = ldb_iter_value(iter);
-      ldb_table_read_filter(table, &iter_value);
+  if (ldb_meta_find(iter, "compression.dict", &value))
+    ldb_table_read_dict(table, &value);
+
+  if (ldb_meta_find(iter, "properties", &value))
+    ldb_table_read_props(table, &value);
+
+  if (footer->format == LDB_FORMAT_PLAIN) {
+    if (ldb_meta_find(iter, "plain.index", &value))
+      ldb_table_read_plain(table, &value);
+  }
+
+  if (footer->format == LDB_FORMAT_CUCKOO) {
+    if (ldb_meta_find(iter, "cuckoo.index", &value))
+      ldb_table_read_cuckoo(table, &value);
+  }
+
+  if (ldb_meta_find(iter, "rangedel", &value))
+    ldb_table_read_range(table, &value);
+
+  strcpy(name, "partition.");
+
+  if (table->options.filter_policy != NULL &&
+      ldb_bloom_name(name + 10, 72, table->options.filter_policy)) {
+    if (ldb_meta_find(iter, name + 10, &value)) {
+      ldb_table_read_filter(table, &value);
+    } else if (ldb_meta_find(iter, name, &value)) {
+      ldb_table_read_filter_index(table, &value);
+    } else {
+      memcpy(name + 6, "full", 4); /* "fullfilter.Name" */
+
+      if (ldb_meta_find(iter, name + 6, &value)) {
+        ldb_table_read_filter(table, &value);
+        table->full_filter = 1;
+      }
+    }
+  }
+
+  if (table->full_filter && table->options.prefix_extractor != NULL) {
+    /* Only trust prefixes added by an extractor of the same name. */
+    if (ldb_meta_find(iter, "prefix", &value)) {
+      ldb_slice_t expect = ldb_string(table->options.prefix_extractor->name);
+
+      table->prefix_filter = ldb_slice_equal(&value, &expect);
     }
   }
 
@@ -125,20 +624,55 @@ ldb_table_read_meta(ldb_table_t *table, const ldb_footer_t *footer) {
   ldb_block_destroy(meta);
 }
 
+/* Ask for the pages of the metadata blocks read after opening (those
+   which are lazily loaded, or go through the block cache) to be kept
+   resident, so that they are not faulted in one page at a time. */
+static void
+ldb_table_advise_meta(ldb_table_t *table) {
+  const ldb_handle_t *handles[3];
+  int i;
+
+  handles[0] = &table->index_handle;
+  handles[1] = &table->filter_handle;
+  handles[2] = &table->filter_index_handle;
+
+  for (i = 0; i < 3; i++) {
+    const ldb_handle_t *h = handles[i];
+
+    if (h->offset == ~UINT64_C(0))
+      continue;
+
+    ldb_rfile_readahead(table->file, h->offset, h->size + LDB_TRAILER_SIZE);
+  }
+}
+
 int
 ldb_table_open(const ldb_dbopt_t *options,
                ldb_rfile_t *file,
                uint64_t size,
                ldb_table_t **table) {
+  return ldb_table_open_id(options, file, size, 0, table);
+}
+
+int
+ldb_table_open_id(const ldb_dbopt_t *options,
+                  ldb_rfile_t *file,
+                  uint64_t size,
+                  uint64_t cache_id,
+                  ldb_table_t **table) {
   ldb_readopt_t opt = *ldb_readopt_default;
   uint8_t buf[LDB_FOOTER_SIZE];
   ldb_contents_t contents;
   ldb_footer_t footer;
   ldb_slice_t input;
+  int lazy = 0;
   int rc;
 
   *table = NULL;
 
+  if (options->block_cache != NULL && options->cache_index_and_filter_blocks)
+    lazy = options->lazy_table_open;
+
   if (size < LDB_FOOTER_SIZE)
     return LDB_CORRUPTION; /* "file is too short to be an sstable" */
 
@@ -154,35 +688,102 @@ ldb_table_open(const ldb_dbopt_t *options,
   if (!ldb_footer_import(&footer, &input))
     return LDB_CORRUPTION;
 
+  /* Plain and cuckoo tables are only usable once their index is read. */
+  if (footer.format != LDB_FORMAT_BLOCK)
+    lazy = 0;
+
   /* Read the index block. */
   if (options->paranoid_checks)
     opt.verify_checksums = 1;
 
-  rc = ldb_read_block(&contents,
-                      file,
-                      &opt,
-                      &footer.index_handle);
+  if (!lazy) {
+    rc = ldb_read_block(&contents,
+                        file,
+                        &opt,
+                        &footer.index_handle);
+  }
 
   if (rc == LDB_OK) {
-    /* We've successfully read the footer and the
-       index block: we're ready to serve requests. */
-    ldb_block_t *index_block = ldb_block_create(&contents);
+    /* We've successfully read the footer and the index
+       block (unless lazy): we're ready to serve requests. */
+    ldb_block_t *index_block = NULL;
     ldb_table_t *tbl = ldb_malloc(sizeof(ldb_table_t));
 
+    if (!lazy)
+      index_block = ldb_block_create(&contents);
+
     tbl->options = *options;
     tbl->status = LDB_OK;
     tbl->file = file;
     tbl->cache_id = 0;
+    tbl->compressed_id = 0;
+    tbl->pcache_id = 0;
     tbl->filter = NULL;
     tbl->filter_data = NULL;
+    tbl->filter_size = 0;
     tbl->metaindex_handle = footer.metaindex_handle;
     tbl->index_block = index_block;
+    tbl->partitioned = 0;
+    tbl->user_keys = 0;
+    tbl->filter_index = NULL;
+    tbl->full_filter = 0;
+    tbl->prefix_filter = 0;
+    tbl->dict = NULL;
+    tbl->range_block = NULL;
+    tbl->plain = NULL;
+    tbl->cuckoo = NULL;
+    tbl->has_props = 0;
+    tbl->in_place = 0;
+    tbl->high_priority = 0;
+    tbl->cache_meta = 0;
+    tbl->lazy = lazy;
+    tbl->index_handle = footer.index_handle;
+    tbl->filter_cached = 0;
+    tbl->filter_index_cached = 0;
+    tbl->index_pin = NULL;
+    tbl->filter_pin = NULL;
+    tbl->filter_index_pin = NULL;
+
+    ldb_handle_init(&tbl->filter_handle);
+    ldb_handle_init(&tbl->filter_index_handle);
+
+    if (options->block_cache != NULL) {
+      if (cache_id == 0)
+        cache_id = ldb_lru_id(options->block_cache);
+
+      tbl->cache_id = cache_id;
+      tbl->cache_meta = options->cache_index_and_filter_blocks;
+    }
+
+    if (options->block_cache_compressed != NULL)
+      tbl->compressed_id = ldb_lru_id(options->block_cache_compressed);
+
+    if (options->persistent_cache != NULL)
+      tbl->pcache_id = ldb_pcache_id(options->persistent_cache);
+
+    if (tbl->cache_meta && !lazy && contents.cachable) {
+      ldb_table_cache_meta(tbl, &footer.index_handle, index_block,
+                           index_block->size, &delete_cached_block);
 
-    if (options->block_cache != NULL)
-      tbl->cache_id = ldb_lru_id(options->block_cache);
+      tbl->index_block = NULL;
+    }
 
     ldb_table_read_meta(tbl, &footer);
 
+    if ((footer.format == LDB_FORMAT_PLAIN && tbl->plain == NULL) ||
+        (footer.format == LDB_FORMAT_CUCKOO && tbl->cuckoo == NULL)) {
+      ldb_table_destroy(tbl);
+      return LDB_CORRUPTION; /* "bad table index" */
+    }
+
+    if ((tbl->lazy || tbl->cache_meta) && ldb_rfile_mapped(file))
+      ldb_table_advise_meta(tbl);
+
+    /* Uncompressed blocks of a mapped file are used where they lie
+       and never cached, so there is no point in looking them up. */
+    if (ldb_rfile_mapped(file) && tbl->has_props)
+      tbl->in_place = (tbl->props.compression == LDB_NO_COMPRESSION);
+
     *table = tbl;
   }
 
@@ -191,17 +792,141 @@ ldb_table_open(const ldb_dbopt_t *options,
 
 void
 ldb_table_destroy(ldb_table_t *table) {
-  if (table->filter != NULL)
+  ldb_lru_t *block_cache = table->options.block_cache;
+
+  if (table->filter_pin != NULL)
+    ldb_lru_release(block_cache, table->filter_pin);
+  else if (table->filter != NULL)
     ldb_filter_destroy(table->filter);
 
   if (table->filter_data != NULL)
     ldb_free((void *)table->filter_data);
 
-  ldb_block_destroy(table->index_block);
+  if (table->filter_index_pin != NULL)
+    ldb_lru_release(block_cache, table->filter_index_pin);
+  else if (table->filter_index != NULL)
+    ldb_block_destroy(table->filter_index);
+
+  if (table->index_pin != NULL)
+    ldb_lru_release(block_cache, table->index_pin);
+  else if (table->index_block != NULL)
+    ldb_block_destroy(table->index_block);
+
+  if (table->dict != NULL)
+    ldb_dict_destroy(table->dict);
+
+  if (table->range_block != NULL)
+    ldb_block_destroy(table->range_block);
+
+  if (table->plain != NULL)
+    ldb_plain_destroy(table->plain);
+
+  if (table->cuckoo != NULL)
+    ldb_cuckoo_destroy(table->cuckoo);
 
   ldb_free(table);
 }
 
+uint64_t
+ldb_table_cache_id(const ldb_table_t *table) {
+  return table->cache_id;
+}
+
+void
+ldb_table_prioritize(ldb_table_t *table) {
+  table->high_priority = 1;
+}
+
+void
+ldb_table_pin(ldb_table_t *table) {
+  ldb_entry_t *entry;
+  void *value;
+
+  if (table->index_block == NULL) {
+    value = ldb_table_lookup_meta(table, &table->index_handle, 0, &entry);
+
+    if (value != NULL) {
+      table->index_block = value;
+      table->index_pin = entry;
+    }
+  }
+
+  if (table->filter_cached) {
+    value = ldb_table_lookup_meta(table, &table->filter_handle, 1, &entry);
+
+    if (value != NULL && entry != NULL) {
+      table->filter = &((filter_part_t *)value)->filter;
+      table->filter_pin = entry;
+      table->filter_cached = 0;
+    } else if (value != NULL) {
+      filter_part_destroy(value);
+    }
+  }
+
+  if (table->filter_index_cached) {
+    value = ldb_table_lookup_meta(table, &table->filter_index_handle,
+                                  0, &entry);
+
+    if (value != NULL) {
+      table->filter_index = value;
+      table->filter_index_pin = entry;
+      table->filter_index_cached = 0;
+    }
+  }
+}
+
+static size_t
+block_memory(const ldb_block_t *block) {
+  if (block == NULL)
+    return 0;
+
+  return sizeof(ldb_block_t) + (block->owned ? block->size : 0);
+}
+
+size_t
+ldb_table_memory(const ldb_table_t *table) {
+  size_t size = sizeof(ldb_table_t) + block_memory(table->range_block);
+
+  /* Pinned blocks are already charged to the block cache. */
+  if (table->index_pin == NULL)
+    size += block_memory(table->index_block);
+
+  if (table->filter_index_pin == NULL)
+    size += block_memory(table->filter_index);
+
+  if (table->filter_pin == NULL)
+    size += table->filter_size;
+
+  if (table->plain != NULL)
+    size += ldb_plain_memory(table->plain);
+
+  if (table->cuckoo != NULL)
+    size += ldb_cuckoo_memory(table->cuckoo);
+
+  return size;
+}
+
+int
+ldb_table_properties(const ldb_table_t *table, ldb_tableprops_t *props) {
+  if (!table->has_props)
+    return 0;
+
+  *props = table->props;
+
+  return 1;
+}
+
+ldb_iter_t *
+ldb_table_range_iterator(const ldb_table_t *table) {
+  if (table->status != LDB_OK)
+    return ldb_emptyiter_create(table->status);
+
+  if (table->range_block == NULL)
+    return NULL;
+
+  return ldb_blockiter_create(table->range_block, table->options.comparator);
+}
+
 static void
 delete_block(void *arg, void *ignored) {
   ldb_block_t *block = (ldb_block_t *)arg;
@@ -209,11 +934,18 @@ delete_block(void *arg, void *ignored) {
   ldb_block_destroy(block);
 }
 
+/* A block as stored on disk, kept in the compressed block cache. */
+typedef struct raw_block_s {
+  size_t size;
+  int type;
+  int verified;
+  uint8_t data[1];
+} raw_block_t;
+
 static void
-delete_cached_block(const ldb_slice_t *key, void *value) {
-  ldb_block_t *block = (ldb_block_t *)value;
+delete_raw_block(const ldb_slice_t *key, void *value) {
   (void)key;
-  ldb_block_destroy(block);
+  ldb_free(value);
 }
 
 static void
@@ -224,143 +956,1228 @@ release_block(void *arg, void *h) {
   ldb_lru_release(cache, handle);
 }
 
-/* Convert an index iterator value (i.e., an encoded BlockHandle)
-   into an iterator over the contents of the corresponding block. */
+static void
+destroy_iter(void *arg, void *ignored) {
+  (void)ignored;
+  ldb_iter_destroy((ldb_iter_t *)arg);
+}
+
+/* Keep one window ahead of a sequential scan. Each time a block read
+   reaches a new window, the following window is requested from the
+   file (and the first block requests the first window). */
+static void
+ldb_table_readahead(ldb_table_t *table,
+                    const ldb_readopt_t *options,
+                    const ldb_handle_t *handle) {
+  uint64_t window = options->readahead_size;
+  uint64_t start, end;
+
+  if (window == 0)
+    return;
+
+  start = handle->offset / window;
+  end = (handle->offset + handle->size + LDB_TRAILER_SIZE) / window;
+
+  if (handle->offset == 0)
+    ldb_rfile_readahead(table->file, 0, window);
+
+  if (start != end || handle->offset % window == 0)
+    ldb_rfile_readahead(table->file, (end + 1) * window, window);
+}
+
+/* Charge a block read against the rate limiter (compaction inputs). */
+static void
+ldb_table_ratelimit(ldb_table_t *table,
+                    const ldb_readopt_t *options,
+                    const ldb_handle_t *handle) {
+  ldb_ratelimit_t *lim = table->options.rate_limiter;
+
+  if (options->rate_limited && lim != NULL)
+    ldb_ratelimit_request(lim, handle->size + LDB_TRAILER_SIZE, LDB_IO_LOW);
+}
+
+/* Read the raw contents of a block from the file, into scratch if
+   it fits (see ldb_read_raw_scratch()). */
+static int
+ldb_table_read_raw(ldb_table_t *table,
+                   const ldb_readopt_t *options,
+                   const ldb_handle_t *handle,
+                   ldb_contents_t *contents,
+                   int *type,
+                   uint8_t *scratch,
+                   size_t size) {
+  ldb_pcache_t *pcache = table->options.persistent_cache;
+  int verified = 0;
+  int64_t start;
+  int rc;
+
+  /* Mapped tables are read from memory; nothing to gain. */
+  if (pcache != NULL && ldb_rfile_mapped(table->file))
+    pcache = NULL;
+
+  if (pcache != NULL && ldb_pcache_lookup(pcache, table->pcache_id,
+                                          handle->offset, &contents->data,
+                                          type, &verified)) {
+    /* A block cached by a read which skipped the checksum is read
+       again (and replaced) the first time one is requested. */
+    if (!options->verify_checksums || verified) {
+      contents->cachable = 1;
+      contents->heap_allocated = 1;
+      contents->verified = verified;
+      return LDB_OK;
+    }
+
+    ldb_free((void *)contents->data.data);
+  }
+
+  ldb_table_ratelimit(table, options, handle);
+
+  LDB_PERF_START(start);
+
+  rc = ldb_read_raw_scratch(contents, type, table->file,
+                            options, handle, scratch, size);
+
+  LDB_PERF_STOP(block_read_nanos, start);
+  LDB_PERF_ADD(block_read_count, 1);
+  LDB_PERF_ADD(block_read_bytes, handle->size + LDB_TRAILER_SIZE);
+
+  if (rc == LDB_OK && pcache != NULL && options->fill_cache) {
+    ldb_pcache_insert(pcache, table->pcache_id, handle->offset,
+                      &contents->data, *type, contents->verified);
+  }
+
+  return rc;
+}
+
+static int
+ldb_table_decode(ldb_table_t *table,
+                 ldb_contents_t *result,
+                 ldb_contents_t *raw,
+                 int type) {
+  int64_t start;
+  int rc;
+
+  LDB_PERF_START(start);
+
+  rc = ldb_decode_block(result, raw, type, table->dict);
+
+  LDB_PERF_STOP(decompress_nanos, start);
+
+  return rc;
+}
+
+/* Decode a block which may have been read into scratch. An
+   uncompressed block is still in scratch and must be copied. */
+static int
+ldb_table_decode_scratch(ldb_table_t *table,
+                         ldb_contents_t *result,
+                         ldb_contents_t *raw,
+                         int type,
+                         const uint8_t *scratch) {
+  int rc = ldb_table_decode(table, result, raw, type);
+  uint8_t *buf;
+
+  if (rc == LDB_OK && result->data.data == scratch) {
+    buf = ldb_malloc(result->data.size + 1);
+
+    memcpy(buf, scratch, result->data.size);
+
+    result->data.data = buf;
+    result->heap_allocated = 1;
+    result->cachable = 1;
+  }
+
+  return rc;
+}
+
+/* Read a block, going through the compressed block cache if we have one. */
+static int
+ldb_table_read_block(ldb_table_t *table,
+                     const ldb_readopt_t *options,
+                     const ldb_handle_t *handle,
+                     enum block_kind kind,
+                     ldb_contents_t *result) {
+  enum ldb_lru_priority priority = ldb_table_priority(table, options, kind);
+  ldb_lru_t *cache = table->options.block_cache_compressed;
+  uint8_t cache_key_buffer[16];
+  uint8_t scratch[LDB_SCRATCH_SIZE];
+  ldb_entry_t *cache_handle;
+  ldb_contents_t contents;
+  raw_block_t *raw;
+  ldb_slice_t key;
+  size_t size = 0;
+  int stale = 0;
+  int type = 0;
+  int rc;
+
+  ldb_table_readahead(table, options, handle);
+
+  /* Decompression copies the block out, so there is no
+     need to read it into a buffer of its own. */
+  if (table->has_props && table->props.compression != LDB_NO_COMPRESSION)
+    size = sizeof(scratch);
+
+  if (cache == NULL) {
+    rc = ldb_table_read_raw(table, options, handle,
+                            &contents, &type, scratch, size);
+
+    if (rc != LDB_OK)
+      return rc;
+
+    return ldb_table_decode_scratch(table, result, &contents, type, scratch);
+  }
+
+  ldb_fixed64_write(cache_key_buffer + 0, table->compressed_id);
+  ldb_fixed64_write(cache_key_buffer + 8, handle->offset);
+
+  ldb_slice_set(&key, cache_key_buffer, sizeof(cache_key_buffer));
+
+  cache_handle = ldb_lru_lookup(cache, &key);
+
+  if (cache_handle != NULL) {
+    raw = (raw_block_t *)ldb_lru_value(cache_handle);
+
+    /* A block cached by a read which skipped the checksum is read
+       again (and replaced) the first time one is requested. */
+    if (options->verify_checksums && !raw->verified) {
+      ldb_lru_release(cache, cache_handle);
+      cache_handle = NULL;
+      stale = 1;
+    }
+  }
+
+  if (cache_handle != NULL) {
+    /* Only compressed blocks are cached, so decoding copies out. */
+    ldb_contents_init(&contents);
+    ldb_slice_set(&contents.data, raw->data, raw->size);
+
+    contents.verified = raw->verified;
+
+    rc = ldb_table_decode(table, result, &contents, raw->type);
+
+    ldb_lru_release(cache, cache_handle);
+
+    return rc;
+  }
+
+  rc = ldb_table_read_raw(table, options, handle,
+                          &contents, &type, scratch, size);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  if (type != LDB_NO_COMPRESSION && (options->fill_cache || stale)) {
+    raw = ldb_malloc(sizeof(raw_block_t) - 1 + contents.data.size);
+
+    raw->size = contents.data.size;
+    raw->type = type;
+    raw->verified = contents.verified;
+
+    memcpy(raw->data, contents.data.data, contents.data.size);
+
+    cache_handle = ldb_lru_insert_priority(cache, &key, raw, raw->size,
+                                           &delete_raw_block, priority);
+
+    ldb_lru_release(cache, cache_handle);
+  }
+
+  return ldb_table_decode_scratch(table, result, &contents, type, scratch);
+}
+
+/* Wrap a block in an iterator which releases it when destroyed. */
 static ldb_iter_t *
-ldb_table_blockreader(void *arg,
-                      const ldb_readopt_t *options,
-                      const ldb_slice_t *index_value) {
-  ldb_table_t *table = (ldb_table_t *)arg;
+ldb_table_wrap_block(ldb_table_t *table,
+                     ldb_block_t *block,
+                     ldb_entry_t *cache_handle) {
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_iter_t *iter = ldb_blockiter_create(block, table->options.comparator);
+
+  if (cache_handle == NULL) {
+    ldb_iter_register_cleanup(iter, &delete_block, block, NULL);
+  } else {
+    ldb_iter_register_cleanup(iter, &release_block, block_cache,
+                                                    cache_handle);
+  }
+
+  return iter;
+}
+
+/* Return an iterator over the contents of the block at "handle". */
+static ldb_iter_t *
+ldb_table_handlereader(ldb_table_t *table,
+                       const ldb_readopt_t *options,
+                       const ldb_handle_t *handle,
+                       enum block_kind kind) {
+  enum ldb_lru_priority priority = ldb_table_priority(table, options, kind);
   ldb_lru_t *block_cache = table->options.block_cache;
   ldb_entry_t *cache_handle = NULL;
   ldb_block_t *block = NULL;
-  ldb_handle_t handle;
-  ldb_iter_t *iter;
+  ldb_contents_t contents;
   int rc = LDB_OK;
+  int stale = 0;
 
-  /* We intentionally allow extra stuff in index_value so that we
-     can add more features in the future. */
+  if (block_cache != NULL && !table->in_place) {
+    uint8_t cache_key_buffer[16];
+    ldb_slice_t key = ldb_table_cache_key(cache_key_buffer,
+                                          table->cache_id, handle);
 
-  if (!ldb_handle_import(&handle, index_value))
-    rc = LDB_CORRUPTION;
+    cache_handle = ldb_lru_lookup(block_cache, &key);
 
-  if (rc == LDB_OK) {
-    ldb_contents_t contents;
+    if (cache_handle != NULL) {
+      block = (ldb_block_t *)ldb_lru_value(cache_handle);
 
-    if (block_cache != NULL) {
-      uint8_t cache_key_buffer[16];
-      ldb_slice_t key;
+      /* Blocks verified once are trusted from then on; others are read
+         again (and replaced) the first time a checksum is requested. */
+      if (options->verify_checksums && !block->verified) {
+        ldb_lru_release(block_cache, cache_handle);
+        cache_handle = NULL;
+        block = NULL;
+        stale = 1;
+      }
+    }
 
-      ldb_fixed64_write(cache_key_buffer + 0, table->cache_id);
-      ldb_fixed64_write(cache_key_buffer + 8, handle.offset);
+    ldb_table_record_lookup(table, LDB_BLOCK_CACHE_DATA_MISS,
+                                   cache_handle != NULL, &key, handle,
+                                   options->fill_cache || stale);
 
-      ldb_slice_set(&key, cache_key_buffer, sizeof(cache_key_buffer));
+    if (cache_handle == NULL) {
+      LDB_PERF_ADD(block_cache_misses, 1);
 
-      cache_handle = ldb_lru_lookup(block_cache, &key);
+      rc = ldb_table_read_block(table, options, handle, kind, &contents);
 
-      if (cache_handle != NULL) {
-        block = (ldb_block_t *)ldb_lru_value(cache_handle);
-      } else {
-        rc = ldb_read_block(&contents, table->file, options, &handle);
-
-        if (rc == LDB_OK) {
-          block = ldb_block_create(&contents);
-
-          if (contents.cachable && options->fill_cache) {
-            cache_handle = ldb_lru_insert(block_cache,
-                                          &key,
-                                          block,
-                                          block->size,
-                                          &delete_cached_block);
-          }
+      if (rc == LDB_OK) {
+        block = ldb_block_create(&contents);
+
+        if (contents.cachable && (options->fill_cache || stale)) {
+          cache_handle = ldb_lru_insert_priority(block_cache,
+                                                 &key,
+                                                 block,
+                                                 block->size,
+                                                 &delete_cached_block,
+                                                 priority);
         }
       }
     } else {
-      rc = ldb_read_block(&contents, table->file, options, &handle);
-
-      if (rc == LDB_OK)
-        block = ldb_block_create(&contents);
+      LDB_PERF_ADD(block_cache_hits, 1);
     }
+  } else {
+    rc = ldb_table_read_block(table, options, handle, kind, &contents);
+
+    if (rc == LDB_OK)
+      block = ldb_block_create(&contents);
   }
 
-  if (block != NULL) {
-    iter = ldb_blockiter_create(block, table->options.comparator);
+  if (block == NULL)
+    return ldb_emptyiter_create(rc);
 
-    if (cache_handle == NULL) {
-      ldb_iter_register_cleanup(iter, &delete_block, block, NULL);
-    } else {
-      ldb_iter_register_cleanup(iter, &release_block, block_cache,
-                                                      cache_handle);
-    }
-  } else {
-    iter = ldb_emptyiter_create(rc);
-  }
+  return ldb_table_wrap_block(table, block, cache_handle);
+}
 
-  return iter;
+/* Convert an index iterator value (i.e., an encoded BlockHandle)
+   into an iterator over the contents of the corresponding block. */
+static ldb_iter_t *
+ldb_table_blockreader(void *arg,
+                      const ldb_readopt_t *options,
+                      const ldb_slice_t *index_value) {
+  ldb_table_t *table = (ldb_table_t *)arg;
+  ldb_handle_t handle;
+
+  /* We intentionally allow extra stuff in index_value so that we
+     can add more features in the future. */
+
+  if (!ldb_handle_import(&handle, index_value))
+    return ldb_emptyiter_create(LDB_CORRUPTION);
+
+  return ldb_table_handlereader(table, options, &handle, BLOCK_DATA);
 }
 
-ldb_iter_t *
-ldb_tableiter_create(const ldb_table_t *table, const ldb_readopt_t *options) {
-  ldb_iter_t *iter = ldb_blockiter_create(table->index_block,
-                                          table->options.comparator);
+/* Like ldb_table_blockreader, for the partitions of an index. */
+static ldb_iter_t *
+ldb_table_partreader(void *arg,
+                     const ldb_readopt_t *options,
+                     const ldb_slice_t *index_value) {
+  ldb_table_t *table = (ldb_table_t *)arg;
+  ldb_handle_t handle;
+
+  if (!ldb_handle_import(&handle, index_value))
+    return ldb_emptyiter_create(LDB_CORRUPTION);
 
-  return ldb_twoiter_create(iter,
-                            &ldb_table_blockreader,
-                            (void *)table,
-                            options);
+  return ldb_table_handlereader(table, options, &handle, BLOCK_INDEX);
 }
 
-int
-ldb_table_internal_get(ldb_table_t *table,
-                       const ldb_readopt_t *options,
-                       const ldb_slice_t *k,
-                       void *arg,
-                       void (*handle_result)(void *,
-                                             const ldb_slice_t *,
-                                             const ldb_slice_t *)) {
-  ldb_iter_t *index_iter;
-  int rc = LDB_OK;
+/* Per-iterator state for automatic readahead. */
+typedef struct autoread_s {
+  ldb_table_t *table;
+  uint64_t next_offset; /* Where a sequential read would continue. */
+  uint64_t limit;       /* End of the last window read ahead. */
+  size_t window;
+  int reads;            /* Back to back block reads so far. */
+} autoread_t;
 
-  index_iter = ldb_blockiter_create(table->index_block,
-                                    table->options.comparator);
+static void
+delete_autoread(void *arg, void *ignored) {
+  (void)ignored;
+  ldb_free(arg);
+}
 
-  ldb_iter_seek(index_iter, k);
+/* Like ldb_table_blockreader, but watches for an iterator walking the
+   data blocks in order and reads ahead of it, in windows growing from
+   LDB_READAHEAD_MIN up to LDB_READAHEAD_MAX. */
+static ldb_iter_t *
+ldb_table_autoreader(void *arg,
+                     const ldb_readopt_t *options,
+                     const ldb_slice_t *index_value) {
+  autoread_t *ra = (autoread_t *)arg;
+  ldb_handle_t handle;
+  uint64_t end;
 
-  if (ldb_iter_valid(index_iter)) {
-    ldb_slice_t iter_value = ldb_iter_value(index_iter);
-    ldb_filter_t *filter = table->filter;
-    ldb_handle_t handle;
+  if (!ldb_handle_import(&handle, index_value))
+    return ldb_emptyiter_create(LDB_CORRUPTION);
 
-    if (filter != NULL &&
-        ldb_handle_import(&handle, &iter_value) &&
-        !ldb_filter_matches(filter, handle.offset, k)) {
-      /* Not found. */
-    } else {
-      ldb_iter_t *block_iter = ldb_table_blockreader(table,
-                                                     options,
-                                                     &iter_value);
+  end = handle.offset + handle.size + LDB_TRAILER_SIZE;
 
-      ldb_iter_seek(block_iter, k);
+  if (handle.offset == ra->next_offset) {
+    ra->reads++;
+  } else {
+    ra->limit = 0;
+    ra->window = 0;
+    ra->reads = 0;
+  }
 
-      if (ldb_iter_valid(block_iter)) {
-        ldb_slice_t block_iter_key = ldb_iter_key(block_iter);
-        ldb_slice_t block_iter_value = ldb_iter_value(block_iter);
+  ra->next_offset = end;
 
-        (*handle_result)(arg, &block_iter_key, &block_iter_value);
-      }
+  if (ra->reads >= LDB_READAHEAD_TRIGGER && end > ra->limit) {
+    if (ra->window == 0)
+      ra->window = LDB_READAHEAD_MIN;
+    else if (ra->window < LDB_READAHEAD_MAX)
+      ra->window *= 2;
 
-      rc = ldb_iter_status(block_iter);
+    ldb_rfile_readahead(ra->table->file, end, ra->window);
 
-      ldb_iter_destroy(block_iter);
-    }
+    ra->limit = end + ra->window;
   }
 
-  if (rc == LDB_OK)
-    rc = ldb_iter_status(index_iter);
+  return ldb_table_handlereader(ra->table, options, &handle, BLOCK_DATA);
+}
 
-  ldb_iter_destroy(index_iter);
+/* Wraps an index keyed by user keys so that it can be sought and read
+   with internal keys. An index entry for user key "k" stands for the
+   internal key (k, 0, 0), which sorts after every other version of "k"
+   (the table ensures no version of "k" lives in a later block). */
+typedef struct ldb_ukeyiter_s {
+  ldb_iter_t *iter;
+  ldb_buffer_t key;
+} ldb_ukeyiter_t;
 
-  return rc;
+static void
+ldb_ukeyiter_update(ldb_ukeyiter_t *iter) {
+  if (ldb_iter_valid(iter->iter)) {
+    ldb_slice_t key = ldb_iter_key(iter->iter);
+
+    ldb_buffer_copy(&iter->key, &key);
+    ldb_buffer_fixed64(&iter->key, 0);
+  }
+}
+
+static void
+ldb_ukeyiter_clear(ldb_ukeyiter_t *iter) {
+  ldb_iter_destroy(iter->iter);
+  ldb_buffer_clear(&iter->key);
+}
+
+static int
+ldb_ukeyiter_valid(const ldb_ukeyiter_t *iter) {
+  return ldb_iter_valid(iter->iter);
+}
+
+static void
+ldb_ukeyiter_first(ldb_ukeyiter_t *iter) {
+  ldb_iter_first(iter->iter);
+  ldb_ukeyiter_update(iter);
+}
+
+static void
+ldb_ukeyiter_last(ldb_ukeyiter_t *iter) {
+  ldb_iter_last(iter->iter);
+  ldb_ukeyiter_update(iter);
+}
+
+static void
+ldb_ukeyiter_seek(ldb_ukeyiter_t *iter, const ldb_slice_t *target) {
+  ldb_slice_t key;
+
+  if (target->size < 8) {
+    ldb_iter_seek(iter->iter, target);
+  } else {
+    key = ldb_slice(target->data, target->size - 8);
+    ldb_iter_seek(iter->iter, &key);
+  }
+
+  ldb_ukeyiter_update(iter);
+}
+
+static void
+ldb_ukeyiter_next(ldb_ukeyiter_t *iter) {
+  ldb_iter_next(iter->iter);
+  ldb_ukeyiter_update(iter);
+}
+
+static void
+ldb_ukeyiter_prev(ldb_ukeyiter_t *iter) {
+  ldb_iter_prev(iter->iter);
+  ldb_ukeyiter_update(iter);
+}
+
+static ldb_slice_t
+ldb_ukeyiter_key(const ldb_ukeyiter_t *iter) {
+  return iter->key;
+}
+
+static ldb_slice_t
+ldb_ukeyiter_value(const ldb_ukeyiter_t *iter) {
+  return ldb_iter_value(iter->iter);
+}
+
+static int
+ldb_ukeyiter_status(const ldb_ukeyiter_t *iter) {
+  return ldb_iter_status(iter->iter);
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_ukeyiter);
+
+/* Create an iterator over the index entries of every data block. For a
+   partitioned index this walks the partitions through the block cache. */
+static ldb_iter_t *
+ldb_table_indexiter(const ldb_table_t *table, const ldb_readopt_t *options) {
+  const ldb_comparator_t *cmp = table->options.comparator;
+  ldb_block_t *block = table->index_block;
+  ldb_entry_t *entry = NULL;
+  ldb_iter_t *iter;
+
+  if (block == NULL) {
+    block = ldb_table_lookup_meta(table, &table->index_handle, 0, &entry);
+
+    if (block == NULL)
+      return ldb_emptyiter_create(LDB_CORRUPTION);
+  }
+
+  if (table->user_keys)
+    cmp = cmp->user_comparator;
+
+  iter = ldb_blockiter_create(block, cmp);
+
+  if (block != table->index_block) {
+    if (entry == NULL) {
+      ldb_iter_register_cleanup(iter, &delete_block, block, NULL);
+    } else {
+      ldb_iter_register_cleanup(iter, &release_block,
+                                table->options.block_cache, entry);
+    }
+  }
+
+  if (table->partitioned) {
+    iter = ldb_twoiter_create(iter,
+                              &ldb_table_partreader,
+                              (void *)table,
+                              options);
+  }
+
+  if (table->user_keys) {
+    ldb_ukeyiter_t *uiter = ldb_malloc(sizeof(ldb_ukeyiter_t));
+
+    uiter->iter = iter;
+
+    ldb_buffer_init(&uiter->key);
+
+    iter = ldb_iter_create(uiter, &ldb_ukeyiter_table,
+                           table->options.comparator);
+  }
+
+  return iter;
+}
+
+/* Check the filter partition covering the data block at "block_offset". */
+static int
+ldb_table_partition_matches(ldb_table_t *table,
+                            const ldb_readopt_t *options,
+                            uint64_t block_offset,
+                            const ldb_slice_t *k) {
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_block_t *filter_index = table->filter_index;
+  ldb_entry_t *cache_handle = NULL;
+  ldb_entry_t *index_entry = NULL;
+  uint8_t cache_key_buffer[16];
+  filter_part_t *part = NULL;
+  ldb_contents_t contents;
+  ldb_slice_t input, key;
+  ldb_handle_t handle;
+  ldb_iter_t *iter;
+  uint64_t base;
+  int result = 1;
+
+  if (filter_index == NULL) {
+    filter_index = ldb_table_lookup_meta(table, &table->filter_index_handle,
+                                         0, &index_entry);
+
+    if (filter_index == NULL)
+      return 1;
+  }
+
+  iter = ldb_blockiter_create(filter_index, table->options.comparator);
+
+  ldb_iter_seek(iter, k);
+
+  if (!ldb_iter_valid(iter))
+    goto done;
+
+  input = ldb_iter_value(iter);
+
+  if (!ldb_handle_read(&handle, (const uint8_t **)&input.data, &input.size))
+    goto done;
+
+  if (!ldb_varint64_slurp(&base, &input) || base > block_offset)
+    goto done;
+
+  ldb_fixed64_write(cache_key_buffer + 0, table->cache_id);
+  ldb_fixed64_write(cache_key_buffer + 8, handle.offset);
+
+  ldb_slice_set(&key, cache_key_buffer, sizeof(cache_key_buffer));
+
+  if (block_cache != NULL) {
+    cache_handle = ldb_lru_lookup(block_cache, &key);
+
+    ldb_table_record_lookup(table, LDB_BLOCK_CACHE_FILTER_MISS,
+                                   cache_handle != NULL, &key, &handle,
+                                   options->fill_cache);
+
+    if (cache_handle != NULL)
+      part = (filter_part_t *)ldb_lru_value(cache_handle);
+  }
+
+  if (part == NULL) {
+    if (ldb_table_read_block(table, options, &handle,
+                             BLOCK_FILTER, &contents) != LDB_OK) {
+      goto done;
+    }
+
+    part = filter_part_create(table->options.filter_policy, &contents);
+
+    if (block_cache != NULL && contents.cachable && options->fill_cache) {
+      cache_handle = ldb_lru_insert_priority(block_cache,
+                                             &key,
+                                             part,
+                                             contents.data.size,
+                                             &delete_cached_filter,
+                                             LDB_LRU_HIGH);
+    }
+  }
+
+  result = ldb_filter_matches(&part->filter, block_offset - base, k);
+
+  ldb_table_record_filter(table, result);
+
+  if (cache_handle != NULL)
+    ldb_lru_release(block_cache, cache_handle);
+  else
+    filter_part_destroy(part);
+
+done:
+  ldb_iter_destroy(iter);
+
+  if (index_entry != NULL)
+    ldb_lru_release(block_cache, index_entry);
+  else if (filter_index != table->filter_index)
+    ldb_block_destroy(filter_index);
+
+  return result;
+}
+
+/* Check the (unpartitioned) filter block. */
+static int
+ldb_table_filter_matches(ldb_table_t *table,
+                         uint64_t block_offset,
+                         const ldb_slice_t *k) {
+  if (table->filter != NULL) {
+    int result = ldb_filter_matches(table->filter, block_offset, k);
+    return ldb_table_record_filter(table, result);
+  }
+
+  if (table->filter_cached) {
+    ldb_entry_t *entry;
+    filter_part_t *part;
+    int result;
+
+    part = ldb_table_lookup_meta(table, &table->filter_handle, 1, &entry);
+
+    if (part == NULL)
+      return 1;
+
+    result = ldb_filter_matches(&part->filter, block_offset, k);
+
+    if (entry != NULL)
+      ldb_lru_release(table->options.block_cache, entry);
+    else
+      filter_part_destroy(part);
+
+    return ldb_table_record_filter(table, result);
+  }
+
+  return 1;
+}
+
+static int
+ldb_table_may_match(ldb_table_t *table,
+                    const ldb_readopt_t *options,
+                    const ldb_slice_t *index_value,
+                    const ldb_slice_t *k) {
+  ldb_handle_t handle;
+
+  if (table->full_filter)
+    return 1; /* Already checked. */
+
+  if (!ldb_handle_import(&handle, index_value))
+    return 1;
+
+  if (table->filter != NULL || table->filter_cached)
+    return ldb_table_filter_matches(table, handle.offset, k);
+
+  if (table->filter_index != NULL || table->filter_index_cached)
+    return ldb_table_partition_matches(table, options, handle.offset, k);
+
+  return 1;
+}
+
+/* Wraps a table iterator for prefix seeks. A seek to a target whose
+   prefix is rejected by the table's filter leaves the iterator invalid
+   without touching the index or any data blocks. */
+typedef struct ldb_prefixiter_s {
+  ldb_table_t *table;
+  ldb_iter_t *iter;
+  int rejected;
+} ldb_prefixiter_t;
+
+static void
+ldb_prefixiter_clear(ldb_prefixiter_t *iter) {
+  ldb_iter_destroy(iter->iter);
+}
+
+static int
+ldb_prefixiter_valid(const ldb_prefixiter_t *iter) {
+  return !iter->rejected && ldb_iter_valid(iter->iter);
+}
+
+static void
+ldb_prefixiter_first(ldb_prefixiter_t *iter) {
+  iter->rejected = 0;
+  ldb_iter_first(iter->iter);
+}
+
+static void
+ldb_prefixiter_last(ldb_prefixiter_t *iter) {
+  iter->rejected = 0;
+  ldb_iter_last(iter->iter);
+}
+
+static void
+ldb_prefixiter_seek(ldb_prefixiter_t *iter, const ldb_slice_t *target) {
+  const ldb_prefix_t *extractor = iter->table->options.prefix_extractor;
+  ldb_slice_t prefix;
+
+  if (ldb_prefix_extract(extractor, &prefix, target) &&
+      !ldb_table_filter_matches(iter->table, 0, &prefix)) {
+    iter->rejected = 1;
+    return;
+  }
+
+  iter->rejected = 0;
+
+  ldb_iter_seek(iter->iter, target);
+}
+
+static void
+ldb_prefixiter_next(ldb_prefixiter_t *iter) {
+  assert(!iter->rejected);
+  ldb_iter_next(iter->iter);
+}
+
+static void
+ldb_prefixiter_prev(ldb_prefixiter_t *iter) {
+  assert(!iter->rejected);
+  ldb_iter_prev(iter->iter);
+}
+
+static ldb_slice_t
+ldb_prefixiter_key(const ldb_prefixiter_t *iter) {
+  return ldb_iter_key(iter->iter);
+}
+
+static ldb_slice_t
+ldb_prefixiter_value(const ldb_prefixiter_t *iter) {
+  return ldb_iter_value(iter->iter);
+}
+
+static int
+ldb_prefixiter_status(const ldb_prefixiter_t *iter) {
+  return ldb_iter_status(iter->iter);
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_prefixiter);
+
+ldb_iter_t *
+ldb_tableiter_create(const ldb_table_t *table, const ldb_readopt_t *options) {
+  ldb_iter_t *iter;
+
+  if (table->plain != NULL)
+    return ldb_plainiter_create(table->plain);
+
+  if (table->cuckoo != NULL)
+    return ldb_cuckooiter_create(table->cuckoo);
+
+  iter = ldb_table_indexiter(table, options);
+
+  if (options->readahead_size == 0) {
+    autoread_t *ra = ldb_malloc(sizeof(autoread_t));
+
+    ra->table = (ldb_table_t *)table;
+    ra->next_offset = 0;
+    ra->limit = 0;
+    ra->window = 0;
+    ra->reads = 0;
+
+    iter = ldb_twoiter_create(iter, &ldb_table_autoreader, ra, options);
+
+    ldb_iter_register_cleanup(iter, &delete_autoread, ra, NULL);
+  } else {
+    iter = ldb_twoiter_create(iter,
+                              &ldb_table_blockreader,
+                              (void *)table,
+                              options);
+  }
+
+  if (options->prefix_seek && table->prefix_filter) {
+    ldb_prefixiter_t *piter = ldb_malloc(sizeof(ldb_prefixiter_t));
+
+    piter->table = (ldb_table_t *)table;
+    piter->iter = iter;
+    piter->rejected = 0;
+
+    iter = ldb_iter_create(piter, &ldb_prefixiter_table, iter->cmp);
+  }
+
+  return iter;
+}
+
+int
+ldb_table_internal_get(ldb_table_t *table,
+                       const ldb_readopt_t *options,
+                       const ldb_slice_t *k,
+                       void *arg,
+                       void (*handle_result)(void *,
+                                             const ldb_slice_t *,
+                                             const ldb_slice_t *),
+                       ldb_pinned_t *pin) {
+  ldb_iter_t *index_iter;
+  int rc = LDB_OK;
+  int64_t start;
+
+  if (table->plain != NULL)
+    return ldb_plain_get(table->plain, k, arg, handle_result);
+
+  if (table->cuckoo != NULL)
+    return ldb_cuckoo_get(table->cuckoo, k, arg, handle_result, pin);
+
+  /* A whole-table filter lets us skip the index entirely. */
+  if (table->full_filter && !ldb_table_filter_matches(table, 0, k))
+    return LDB_OK;
+
+  LDB_PERF_START(start);
+
+  index_iter = ldb_table_indexiter(table, options);
+
+  ldb_iter_seek(index_iter, k);
+
+  LDB_PERF_STOP(index_nanos, start);
+
+  if (ldb_iter_valid(index_iter)) {
+    ldb_slice_t iter_value = ldb_iter_value(index_iter);
+
+    if (!ldb_table_may_match(table, options, &iter_value, k)) {
+      /* Not found. */
+    } else {
+      ldb_iter_t *block_iter = ldb_table_blockreader(table,
+                                                     options,
+                                                     &iter_value);
+
+      ldb_blockiter_seek_get(block_iter, k);
+
+      if (ldb_iter_valid(block_iter)) {
+        ldb_slice_t block_iter_key = ldb_iter_key(block_iter);
+        ldb_slice_t block_iter_value = ldb_iter_value(block_iter);
+
+        (*handle_result)(arg, &block_iter_key, &block_iter_value);
+      }
+
+      rc = ldb_iter_status(block_iter);
+
+      if (pin != NULL && pin->pending)
+        ldb_pinned_register(pin, &destroy_iter, block_iter, NULL);
+      else
+        ldb_iter_destroy(block_iter);
+    }
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_iter_status(index_iter);
+
+  ldb_iter_destroy(index_iter);
+
+  return rc;
+}
+
+/* A data block read ahead of time by a batched lookup. */
+typedef struct prefetch_s {
+  ldb_block_t *block;
+  ldb_entry_t *cache_handle;
+} prefetch_t;
+
+/* Read every uncached block in "handles" with one batched read. */
+static void
+ldb_table_prefetch(ldb_table_t *table,
+                   const ldb_readopt_t *options,
+                   const ldb_handle_t *handles,
+                   size_t count,
+                   prefetch_t *blocks) {
+  enum ldb_lru_priority priority = ldb_table_priority(table, options,
+                                                      BLOCK_DATA);
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_contents_t *raws = ldb_malloc(count * sizeof(ldb_contents_t));
+  int *types = ldb_malloc(count * sizeof(int));
+  int *statuses = ldb_malloc(count * sizeof(int));
+  size_t i;
+
+  ldb_read_raw_blocks(raws, types, statuses, table->file,
+                      options, handles, count);
+
+  for (i = 0; i < count; i++) {
+    prefetch_t *pf = &blocks[i];
+    ldb_contents_t contents;
+
+    pf->block = NULL;
+    pf->cache_handle = NULL;
+
+    if (statuses[i] != LDB_OK)
+      continue; /* The normal path will report the error. */
+
+    if (ldb_decode_block(&contents, &raws[i], types[i],
+                         table->dict) != LDB_OK) {
+      continue;
+    }
+
+    pf->block = ldb_block_create(&contents);
+
+    if (block_cache != NULL && contents.cachable && options->fill_cache) {
+      uint8_t cache_key_buffer[16];
+      ldb_slice_t key = ldb_table_cache_key(cache_key_buffer,
+                                            table->cache_id, &handles[i]);
+
+      pf->cache_handle = ldb_lru_insert_priority(block_cache,
+                                                 &key,
+                                                 pf->block,
+                                                 pf->block->size,
+                                                 &delete_cached_block,
+                                                 priority);
+    }
+  }
+
+  ldb_free(statuses);
+  ldb_free(types);
+  ldb_free(raws);
+}
+
+static void
+ldb_table_prefetch_release(ldb_table_t *table, prefetch_t *pf) {
+  if (pf->cache_handle != NULL)
+    ldb_lru_release(table->options.block_cache, pf->cache_handle);
+  else if (pf->block != NULL)
+    ldb_block_destroy(pf->block);
+
+  pf->block = NULL;
+  pf->cache_handle = NULL;
+}
+
+int
+ldb_table_multiget(ldb_table_t *table,
+                   const ldb_readopt_t *options,
+                   const ldb_slice_t *keys,
+                   size_t count,
+                   void **args,
+                   void (*handle_result)(void *,
+                                         const ldb_slice_t *,
+                                         const ldb_slice_t *)) {
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_handle_t *handles;
+  ldb_handle_t *missing;
+  int *matched;
+  ldb_iter_t *index_iter = NULL;
+  ldb_iter_t *block_iter = NULL;
+  uint64_t block_offset = 0;
+  prefetch_t *blocks = NULL;
+  size_t i, j, pos, nmissing = 0;
+  int rc = LDB_OK;
+
+  /* Plain and cuckoo tables have no blocks to batch. */
+  if (table->plain != NULL) {
+    for (i = 0; i < count && rc == LDB_OK; i++)
+      rc = ldb_plain_get(table->plain, &keys[i], args[i], handle_result);
+
+    return rc;
+  }
+
+  if (table->cuckoo != NULL) {
+    for (i = 0; i < count && rc == LDB_OK; i++) {
+      rc = ldb_cuckoo_get(table->cuckoo, &keys[i], args[i],
+                          handle_result, NULL);
+    }
+
+    return rc;
+  }
+
+  handles = ldb_malloc(count * sizeof(ldb_handle_t));
+  missing = ldb_malloc(count * sizeof(ldb_handle_t));
+  matched = ldb_malloc(count * sizeof(int));
+
+  /* Resolve every key to its data block first. */
+  for (i = 0; i < count && rc == LDB_OK; i++) {
+    const ldb_slice_t *k = &keys[i];
+    ldb_slice_t iter_value;
+
+    matched[i] = 0;
+
+    if (table->full_filter && !ldb_table_filter_matches(table, 0, k))
+      continue;
+
+    if (index_iter == NULL)
+      index_iter = ldb_table_indexiter(table, options);
+
+    ldb_iter_seek(index_iter, k);
+
+    if (!ldb_iter_valid(index_iter)) {
+      rc = ldb_iter_status(index_iter);
+      continue;
+    }
+
+    iter_value = ldb_iter_value(index_iter);
+
+    if (!ldb_table_may_match(table, options, &iter_value, k))
+      continue;
+
+    if (!ldb_handle_import(&handles[i], &iter_value)) {
+      rc = LDB_CORRUPTION;
+      continue;
+    }
+
+    matched[i] = 1;
+
+    /* Note the first appearance of each block not yet cached. */
+    if (nmissing > 0 && missing[nmissing - 1].offset == handles[i].offset)
+      continue;
+
+    if (block_cache != NULL && !table->in_place) {
+      uint8_t cache_key_buffer[16];
+      ldb_slice_t key = ldb_table_cache_key(cache_key_buffer,
+                                            table->cache_id, &handles[i]);
+      ldb_entry_t *cache_handle = ldb_lru_lookup(block_cache, &key);
+
+      if (cache_handle != NULL) {
+        ldb_block_t *block = (ldb_block_t *)ldb_lru_value(cache_handle);
+        int usable = !options->verify_checksums || block->verified;
+
+        ldb_lru_release(block_cache, cache_handle);
+
+        if (usable)
+          continue;
+      }
+    }
+
+    missing[nmissing++] = handles[i];
+  }
+
+  if (index_iter != NULL) {
+    if (rc == LDB_OK)
+      rc = ldb_iter_status(index_iter);
+
+    ldb_iter_destroy(index_iter);
+  }
+
+  /* Read the missing blocks together. The compressed and persistent
+     block caches have their own read path, so leave those tables
+     alone. */
+  if (rc == LDB_OK && nmissing > 1 &&
+      table->options.block_cache_compressed == NULL &&
+      table->options.persistent_cache == NULL) {
+    blocks = ldb_malloc(nmissing * sizeof(prefetch_t));
+    ldb_table_prefetch(table, options, missing, nmissing, blocks);
+  } else {
+    nmissing = 0;
+  }
+
+  pos = 0;
+
+  for (i = 0; i < count && rc == LDB_OK; i++) {
+    const ldb_slice_t *k = &keys[i];
+
+    if (!matched[i])
+      continue;
+
+    /* Neighbouring keys usually share a data block: keep it open. */
+    if (block_iter != NULL && handles[i].offset != block_offset) {
+      ldb_iter_destroy(block_iter);
+      block_iter = NULL;
+    }
+
+    if (block_iter == NULL) {
+      for (j = pos; j < nmissing; j++) {
+        if (missing[j].offset == handles[i].offset)
+          break;
+      }
+
+      if (j < nmissing && blocks[j].block != NULL) {
+        prefetch_t *pf = &blocks[j];
+
+        pos = j + 1;
+
+        block_iter = ldb_table_wrap_block(table, pf->block,
+                                          pf->cache_handle);
+
+        pf->block = NULL;
+        pf->cache_handle = NULL;
+      } else {
+        block_iter = ldb_table_handlereader(table, options,
+                                            &handles[i], BLOCK_DATA);
+      }
+
+      block_offset = handles[i].offset;
+    }
+
+    ldb_blockiter_seek_get(block_iter, k);
+
+    if (ldb_iter_valid(block_iter)) {
+      ldb_slice_t block_iter_key = ldb_iter_key(block_iter);
+      ldb_slice_t block_iter_value = ldb_iter_value(block_iter);
+
+      (*handle_result)(args[i], &block_iter_key, &block_iter_value);
+    }
+
+    rc = ldb_iter_status(block_iter);
+  }
+
+  if (block_iter != NULL)
+    ldb_iter_destroy(block_iter);
+
+  for (i = 0; i < nmissing; i++)
+    ldb_table_prefetch_release(table, &blocks[i]);
+
+  ldb_free(blocks);
+  ldb_free(matched);
+  ldb_free(missing);
+  ldb_free(handles);
+
+  return rc;
+}
+
+/* Read the batch of blocks at "handles" into the block cache. */
+static void
+ldb_table_warm_batch(ldb_table_t *table,
+                     const ldb_readopt_t *options,
+                     const ldb_handle_t *handles,
+                     size_t count) {
+  prefetch_t blocks[LDB_WARM_BATCH];
+  size_t i;
+
+  assert(count <= LDB_WARM_BATCH);
+
+  ldb_table_prefetch(table, options, handles, count, blocks);
+
+  for (i = 0; i < count; i++)
+    ldb_table_prefetch_release(table, &blocks[i]);
+}
+
+int
+ldb_table_warm(ldb_table_t *table,
+               const ldb_readopt_t *options,
+               const uint64_t *offsets,
+               size_t count) {
+  ldb_lru_t *block_cache = table->options.block_cache;
+  ldb_handle_t handles[LDB_WARM_BATCH];
+  ldb_readopt_t opt = *options;
+  ldb_iter_t *index_iter;
+  size_t i = 0, n = 0;
+  int rc = LDB_OK;
+
+  if (block_cache == NULL || table->in_place)
+    return LDB_OK;
+
+  /* Plain and cuckoo tables have no blocks to cache. */
+  if (table->plain != NULL || table->cuckoo != NULL)
+    return LDB_OK;
+
+  opt.fill_cache = 1;
+
+  index_iter = ldb_table_indexiter(table, &opt);
+
+  /* The index lists the blocks in file order. */
+  ldb_iter_first(index_iter);
+
+  while (ldb_iter_valid(index_iter) && i < count) {
+    ldb_slice_t iter_value = ldb_iter_value(index_iter);
+    uint8_t cache_key_buffer[16];
+    ldb_entry_t *cache_handle;
+    ldb_handle_t handle;
+    ldb_slice_t key;
+
+    if (!ldb_handle_import(&handle, &iter_value)) {
+      rc = LDB_CORRUPTION;
+      break;
+    }
+
+    ldb_iter_next(index_iter);
+
+    while (i < count && offsets[i] < handle.offset)
+      i++;
+
+    if (i == count || offsets[i] != handle.offset)
+      continue;
+
+    key = ldb_table_cache_key(cache_key_buffer, table->cache_id, &handle);
+    cache_handle = ldb_lru_lookup(block_cache, &key);
+
+    if (cache_handle != NULL) {
+      ldb_lru_release(block_cache, cache_handle);
+      continue;
+    }
+
+    handles[n++] = handle;
+
+    if (n == LDB_WARM_BATCH) {
+      ldb_table_warm_batch(table, &opt, handles, n);
+      n = 0;
+    }
+  }
+
+  if (n > 0)
+    ldb_table_warm_batch(table, &opt, handles, n);
+
+  if (rc == LDB_OK)
+    rc = ldb_iter_status(index_iter);
+
+  ldb_iter_destroy(index_iter);
+
+  return rc;
+}
+
+ldb_iter_t *
+ldb_table_index_iterator(const ldb_table_t *table) {
+  return ldb_table_indexiter(table, ldb_readopt_default);
 }
 
 uint64_t
@@ -369,8 +2186,7 @@ ldb_table_approximate_offset(const ldb_table_t *table,
   ldb_iter_t *index_iter;
   uint64_t result;
 
-  index_iter = ldb_blockiter_create(table->index_block,
-                                    table->options.comparator);
+  index_iter = ldb_table_indexiter(table, ldb_readopt_default);
 
   ldb_iter_seek(index_iter, key);
 
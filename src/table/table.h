@@ -22,9 +22,12 @@
  */
 
 struct ldb_dbopt_s;
+struct ldb_handle_s;
 struct ldb_iter_s;
+struct ldb_pinned_s;
 struct ldb_readopt_s;
 struct ldb_rfile_s;
+struct ldb_tableprops_s;
 
 /* A table is a sorted map from strings to strings. Tables are
    immutable and persistent. A table may be safely accessed from
@@ -54,9 +57,56 @@ ldb_table_open(const struct ldb_dbopt_s *options,
                uint64_t size,
                ldb_table_t **table);
 
+/* Like ldb_table_open(), but keys the blocks of the table in the
+   block cache by "cache_id" (see ldb_lru_id()), under which they may
+   already have been inserted by the table builder. */
+int
+ldb_table_open_id(const struct ldb_dbopt_s *options,
+                  struct ldb_rfile_s *file,
+                  uint64_t size,
+                  uint64_t cache_id,
+                  ldb_table_t **table);
+
+/* Write the block cache key of the block at "handle" of the table
+   with "cache_id" to buf[0..15]. */
+ldb_slice_t
+ldb_table_cache_key(uint8_t *buf, uint64_t cache_id,
+                    const struct ldb_handle_s *handle);
+
 void
 ldb_table_destroy(ldb_table_t *table);
 
+/* Pin the index and filter blocks of a table which keeps them in the
+   block cache (see cache_index_and_filter_blocks), so they stay resident
+   until the table is destroyed. Must be called before the table is
+   shared with other threads. */
+void
+ldb_table_pin(ldb_table_t *table);
+
+/* The id the blocks of the table are keyed by in the block cache
+   (zero if there is none). */
+uint64_t
+ldb_table_cache_id(const ldb_table_t *table);
+
+/* Cache the data blocks of the table at high priority, as for the
+   index and filter blocks (used for level-0 tables). Must be called
+   before the table is shared with other threads. */
+void
+ldb_table_prioritize(ldb_table_t *table);
+
+/* Stores the table's properties (see format.h) in *props. Returns
+   zero if the table has no readable "properties" meta block. */
+int
+ldb_table_properties(const ldb_table_t *table,
+                     struct ldb_tableprops_s *props);
+
+/* Returns a new iterator over the range tombstones stored in the
+ * table's "rangedel" meta block (see src/rangedel.h), or NULL if the
+ * table has none. An iterator is also returned if the block could not
+ * be read, carrying the error status.
+ */
+struct ldb_iter_s *
+ldb_table_range_iterator(const ldb_table_t *table);
 
 /* Returns a new iterator over the table contents.
  * The result of create() is initially invalid (caller must
@@ -69,6 +119,9 @@ ldb_tableiter_create(const ldb_table_t *table,
 /* Calls (*handle_result)(arg, ...) with the entry found after a call
  * to seek(key). May not make such a call if filter policy says
  * that key is not present.
+ *
+ * If the handler leaves "pin" pending (see pinned.h), the block the
+ * value was read from is kept alive by the pin.
  */
 int
 ldb_table_internal_get(ldb_table_t *table,
@@ -77,7 +130,40 @@ ldb_table_internal_get(ldb_table_t *table,
                        void *arg,
                        void (*handle_result)(void *,
                                              const ldb_slice_t *,
-                                             const ldb_slice_t *));
+                                             const ldb_slice_t *),
+                       struct ldb_pinned_s *pin);
+
+/* Like ldb_table_internal_get, but for a batch of keys, calling
+ * (*handle_result)(args[i], ...) for each key found. Keys should be
+ * sorted so that those sharing a data block read it only once.
+ */
+int
+ldb_table_multiget(ldb_table_t *table,
+                   const struct ldb_readopt_s *options,
+                   const ldb_slice_t *keys,
+                   size_t count,
+                   void **args,
+                   void (*handle_result)(void *,
+                                         const ldb_slice_t *,
+                                         const ldb_slice_t *));
+
+/* Read the data blocks which start at offsets[0..count-1] (in
+ * ascending order) into the block cache, unless they are already
+ * cached. Offsets which are not the start of a data block are
+ * ignored. Does nothing for tables without a block cache.
+ */
+int
+ldb_table_warm(ldb_table_t *table,
+               const struct ldb_readopt_s *options,
+               const uint64_t *offsets,
+               size_t count);
+
+/* Returns a new iterator over the index of the table. Each key is at
+ * or after every key of a data block, and before the keys of the next
+ * one; the value is the handle of that block (see format.h).
+ */
+struct ldb_iter_s *
+ldb_table_index_iterator(const ldb_table_t *table);
 
 /* Given a key, return an approximate byte offset in the file where
  * the data for that key begins (or would begin if the key were
@@ -90,4 +176,11 @@ uint64_t
 ldb_table_approximate_offset(const ldb_table_t *table,
                              const ldb_slice_t *key);
 
+/* Returns the memory held by the table reader itself: its index,
+ * filter and tombstone blocks, unless those are charged to the block
+ * cache instead.
+ */
+size_t
+ldb_table_memory(const ldb_table_t *table);
+
 #endif /* LDB_TABLE_H */
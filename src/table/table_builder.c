@@ -13,24 +13,66 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef LDB_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "../util/array.h"
 #include "../util/bloom.h"
 #include "../util/buffer.h"
+#include "../util/cache.h"
 #include "../util/coding.h"
 #include "../util/comparator.h"
 #include "../util/crc32c.h"
 #include "../util/env.h"
 #include "../util/internal.h"
 #include "../util/options.h"
+#include "../util/port.h"
+#include "../util/prefix.h"
 #include "../util/slice.h"
-#include "../util/snappy.h"
 #include "../util/status.h"
+#include "../util/thread_pool.h"
 
+#include "block.h"
 #include "block_builder.h"
+#include "cuckoo_builder.h"
 #include "filter_block.h"
 #include "format.h"
+#include "table.h"
 #include "table_builder.h"
 
+/*
+ * Constants
+ */
+
+/* With adaptive_compression, data blocks are stored uncompressed once
+   this many in a row have failed to compress, for as many blocks as
+   are skipped between two further tries. */
+#define LDB_COMPRESS_FAILURES 4
+#define LDB_COMPRESS_SKIP 16
+
+/*
+ * Compression Job
+ */
+
+/* A finished data block waiting to be compressed by a worker and
+   written out in order. */
+typedef struct ldb_cjob_s {
+  struct ldb_tablegen_s *tb;
+  ldb_buffer_t raw;
+  ldb_buffer_t compressed;
+  int type; /* Requested type, then the type the block is stored with. */
+  int tried; /* Whether compression was attempted. */
+  int done;
+  ldb_buffer_t index_key; /* Separator after the block. */
+  ldb_buffer_t keys; /* Keys for a per-block filter, length-prefixed. */
+#ifdef LDB_HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+#endif
+} ldb_cjob_t;
+
 /*
  * TableBuilder
  */
@@ -38,6 +80,7 @@
 struct ldb_tablegen_s {
   ldb_dbopt_t options;
   ldb_dbopt_t index_block_options;
+  ldb_dbopt_t meta_block_options;
   ldb_wfile_t *file;
   uint64_t offset;
   int status;
@@ -47,6 +90,27 @@ struct ldb_tablegen_s {
   int64_t num_entries;
   int closed; /* Either finish() or abandon() has been called. */
   ldb_filtergen_t *filter_block;
+  int full_filter; /* filter_block covers the whole table. */
+  ldb_blockgen_t range_block; /* Range tombstones. */
+  uint64_t num_tombstones;
+  ldb_tableprops_t props;
+
+  /* When partitioning, index_block (and filter_block) hold the current
+     partition, and the top-level blocks map the last key of each
+     partition to its location. Filter partitions are built relative to
+     filter_base, the offset of the first data block they cover. */
+  int partition_index;
+  int partition_filters;
+  ldb_blockgen_t top_index_block;
+  ldb_blockgen_t top_filter_block;
+  uint64_t filter_base;
+
+  /* With index_user_keys, uindex_block mirrors index_block with the
+     user keys alone, for as long as no user key has spanned two data
+     blocks (user_keys is cleared otherwise). */
+  int user_keys;
+  ldb_dbopt_t uindex_block_options;
+  ldb_blockgen_t uindex_block;
 
   /* We do not emit the index entry for a block until we have seen the
      first key for the next data block. This allows us to use shorter
@@ -59,6 +123,50 @@ struct ldb_tablegen_s {
   int pending_index_entry;
   ldb_handle_t pending_handle; /* Handle to add to index block. */
   ldb_buffer_t compressed_output;
+
+  /* Data blocks in a row which failed to compress, and the number of
+     blocks left to store without trying (see adaptive_compression). */
+  int compress_failures;
+  int compress_skip;
+
+  /* Zstd dictionary for data blocks (empty if none). */
+  ldb_buffer_t dict;
+
+  /* If non-zero, data blocks are inserted into the block cache under
+     this id as they are written (see ldb_tablegen_warm_cache). */
+  uint64_t cache_id;
+  enum ldb_lru_priority cache_priority;
+#ifdef LDB_HAVE_ZSTD
+  ZSTD_CDict *cdict;
+  ZSTD_CCtx *cctx;
+#endif
+
+  /* With compression_threads > 1, data blocks are compressed on the
+     pool and written in order from a ring of jobs. Their index entries
+     and filter keys are added once they are written, since only then
+     are their offsets known. */
+  ldb_pool_t *pool;
+  ldb_mutex_t mutex;
+  ldb_cond_t cond;
+  ldb_cjob_t *jobs;
+  int max_jobs;
+  int job_head;
+  int num_jobs;
+  uint64_t job_bytes; /* Uncompressed size of the queued blocks. */
+  ldb_buffer_t block_keys;
+
+  /* With plain_key_size (or cuckoo_table), entries are appended as
+     they are (see plain_table.c and cuckoo_table.c), in runs of about
+     block_size bytes which are indexed like data blocks. The hash
+     index of a plain table is built from the hash and index of the
+     first entry of each user key. */
+  int plain;
+  int plain_hash;
+  ldb_cuckoogen_t *cuckoo; /* Builds the index of a cuckoo table. */
+  uint32_t key_width;
+  ldb_buffer_t plain_data; /* Entries of the current run. */
+  ldb_array_t plain_offsets;
+  ldb_array_t plain_heads; /* hash << 32 | index */
 };
 
 static void
@@ -70,6 +178,35 @@ ldb_tablegen_init(ldb_tablegen_t *tb,
   tb->file = file;
   tb->offset = 0;
   tb->status = LDB_OK;
+  tb->plain = (options->plain_key_size > 0);
+  tb->plain_hash = tb->plain && ldb_block_can_prefix(options->comparator);
+  tb->key_width = options->plain_key_size;
+  tb->cuckoo = NULL;
+
+  /* Cuckoo tables hash user keys, which must then compare equal
+     only if their bytes are equal. */
+  if (options->cuckoo_table && ldb_block_can_prefix(options->comparator)) {
+    tb->cuckoo = ldb_cuckoogen_create(options->comparator);
+    tb->plain = 1;
+    tb->plain_hash = 0;
+  }
+
+  if (options->comparator->user_comparator != NULL)
+    tb->key_width += 8;
+
+  ldb_buffer_init(&tb->plain_data);
+  ldb_array_init(&tb->plain_offsets);
+  ldb_array_init(&tb->plain_heads);
+
+  /* Plain tables hold neither compressed blocks nor filters, and are
+     always indexed by a single level. */
+  if (tb->plain) {
+    tb->options.compression = LDB_NO_COMPRESSION;
+    tb->options.filter_policy = NULL;
+    tb->options.partition_index = 0;
+    tb->options.index_user_keys = 0;
+    options = &tb->options;
+  }
 
   ldb_blockgen_init(&tb->data_block, &tb->options);
   ldb_blockgen_init(&tb->index_block, &tb->index_block_options);
@@ -79,15 +216,100 @@ ldb_tablegen_init(ldb_tablegen_t *tb,
   tb->num_entries = 0;
   tb->closed = 0;
   tb->filter_block = NULL;
+  tb->full_filter = 0;
+  tb->partition_index = options->partition_index;
+  tb->partition_filters = 0;
+  tb->filter_base = 0;
   tb->pending_index_entry = 0;
 
   ldb_handle_init(&tb->pending_handle);
   ldb_buffer_init(&tb->compressed_output);
+  ldb_buffer_init(&tb->dict);
+
+  tb->compress_failures = 0;
+  tb->compress_skip = 0;
+  tb->cache_id = 0;
+  tb->cache_priority = LDB_LRU_NORMAL;
+
+#ifdef LDB_HAVE_ZSTD
+  tb->cdict = NULL;
+  tb->cctx = NULL;
+#endif
+
+  tb->pool = NULL;
+  tb->jobs = NULL;
+  tb->max_jobs = 0;
+  tb->job_head = 0;
+  tb->num_jobs = 0;
+  tb->job_bytes = 0;
+
+  ldb_buffer_init(&tb->block_keys);
+
+  if (options->compression_threads > 1
+      && options->compression != LDB_NO_COMPRESSION) {
+    int i;
+
+    tb->pool = ldb_pool_create(options->compression_threads);
+    tb->max_jobs = 2 * options->compression_threads;
+    tb->jobs = ldb_malloc(tb->max_jobs * sizeof(ldb_cjob_t));
+
+    for (i = 0; i < tb->max_jobs; i++) {
+      ldb_cjob_t *job = &tb->jobs[i];
+
+      job->tb = tb;
+
+      ldb_buffer_init(&job->raw);
+      ldb_buffer_init(&job->compressed);
+      ldb_buffer_init(&job->index_key);
+      ldb_buffer_init(&job->keys);
+
+#ifdef LDB_HAVE_ZSTD
+      job->cctx = NULL;
+#endif
+    }
+
+    ldb_mutex_init(&tb->mutex);
+    ldb_cond_init(&tb->cond);
+  }
 
-  tb->index_block_options.block_restart_interval = 1;
+  tb->index_block_options.block_restart_interval =
+    LDB_MAX(options->index_block_restart_interval, 1);
+  tb->index_block_options.data_block_hash_index = 0;
+  tb->index_block_options.separate_block_values = 0;
+
+  tb->meta_block_options = tb->index_block_options;
+  tb->meta_block_options.block_restart_interval = 1;
+
+  ldb_blockgen_init(&tb->top_index_block, &tb->index_block_options);
+  ldb_blockgen_init(&tb->top_filter_block, &tb->meta_block_options);
+  ldb_blockgen_init(&tb->range_block, &tb->meta_block_options);
+
+  /* Only internal keys have a user key to index by. */
+  tb->user_keys = options->index_user_keys
+               && !options->partition_index
+               && options->comparator->user_comparator != NULL;
+
+  tb->uindex_block_options = tb->index_block_options;
+
+  if (tb->user_keys)
+    tb->uindex_block_options.comparator = options->comparator->user_comparator;
+
+  ldb_blockgen_init(&tb->uindex_block, &tb->uindex_block_options);
+
+  tb->num_tombstones = 0;
+
+  ldb_tableprops_init(&tb->props);
 
   if (options->filter_policy != NULL) {
     tb->filter_block = ldb_filtergen_create(options->filter_policy);
+    tb->full_filter = options->full_filter;
+    tb->partition_filters = options->partition_index
+                         && options->partition_filters
+                         && !options->full_filter;
+
+    /* Prefixes are only checked against whole-table filters. */
+    if (options->full_filter && options->prefix_extractor != NULL)
+      ldb_filtergen_set_prefix(tb->filter_block, options->prefix_extractor);
 
     ldb_filtergen_start_block(tb->filter_block, 0);
   }
@@ -99,12 +321,60 @@ ldb_tablegen_clear(ldb_tablegen_t *tb) {
 
   ldb_blockgen_clear(&tb->data_block);
   ldb_blockgen_clear(&tb->index_block);
+  ldb_blockgen_clear(&tb->uindex_block);
+  ldb_blockgen_clear(&tb->top_index_block);
+  ldb_blockgen_clear(&tb->top_filter_block);
+  ldb_blockgen_clear(&tb->range_block);
 
   ldb_buffer_clear(&tb->last_key);
   ldb_buffer_clear(&tb->compressed_output);
+  ldb_buffer_clear(&tb->dict);
+
+#ifdef LDB_HAVE_ZSTD
+  if (tb->cdict != NULL)
+    ZSTD_freeCDict(tb->cdict);
+
+  if (tb->cctx != NULL)
+    ZSTD_freeCCtx(tb->cctx);
+#endif
 
   if (tb->filter_block != NULL)
     ldb_filtergen_destroy(tb->filter_block);
+
+  if (tb->jobs != NULL) {
+    int i;
+
+    assert(tb->num_jobs == 0);
+
+    ldb_pool_destroy(tb->pool);
+
+    for (i = 0; i < tb->max_jobs; i++) {
+      ldb_cjob_t *job = &tb->jobs[i];
+
+      ldb_buffer_clear(&job->raw);
+      ldb_buffer_clear(&job->compressed);
+      ldb_buffer_clear(&job->index_key);
+      ldb_buffer_clear(&job->keys);
+
+#ifdef LDB_HAVE_ZSTD
+      if (job->cctx != NULL)
+        ZSTD_freeCCtx(job->cctx);
+#endif
+    }
+
+    ldb_free(tb->jobs);
+
+    ldb_mutex_destroy(&tb->mutex);
+    ldb_cond_destroy(&tb->cond);
+  }
+
+  ldb_buffer_clear(&tb->block_keys);
+  ldb_buffer_clear(&tb->plain_data);
+  ldb_array_clear(&tb->plain_offsets);
+  ldb_array_clear(&tb->plain_heads);
+
+  if (tb->cuckoo != NULL)
+    ldb_cuckoogen_destroy(tb->cuckoo);
 }
 
 ldb_tablegen_t *
@@ -120,10 +390,83 @@ ldb_tablegen_destroy(ldb_tablegen_t *tb) {
   ldb_free(tb);
 }
 
+void
+ldb_tablegen_set_dict(ldb_tablegen_t *tb, const ldb_slice_t *dict) {
+  assert(tb->num_entries == 0);
+  assert(tb->dict.size == 0);
+
+  if (tb->options.compression != LDB_ZSTD_COMPRESSION || dict->size == 0)
+    return;
+
+#ifdef LDB_HAVE_ZSTD
+  tb->cdict = ZSTD_createCDict(dict->data, dict->size, ZSTD_CLEVEL_DEFAULT);
+  tb->cctx = ZSTD_createCCtx();
+
+  if (tb->cdict != NULL && tb->cctx != NULL)
+    ldb_buffer_copy(&tb->dict, dict);
+#endif
+}
+
+void
+ldb_tablegen_warm_cache(ldb_tablegen_t *tb, uint64_t cache_id, int level) {
+  assert(tb->num_entries == 0);
+
+  /* Plain tables have no data blocks. */
+  if (tb->options.block_cache == NULL || tb->plain)
+    return;
+
+  tb->cache_id = cache_id;
+  tb->cache_priority = (level == 0) ? LDB_LRU_HIGH : LDB_LRU_NORMAL;
+}
+
+static void
+delete_cached_block(const ldb_slice_t *key, void *value) {
+  ldb_block_t *block = (ldb_block_t *)value;
+  (void)key;
+  ldb_block_destroy(block);
+}
+
+/* Insert a copy of the data block just written at "handle" into the
+   block cache, as the table will read it back. We computed its
+   checksum ourselves, so it counts as verified. */
+static void
+ldb_tablegen_cache_block(ldb_tablegen_t *tb,
+                         const ldb_slice_t *raw,
+                         const ldb_handle_t *handle) {
+  ldb_lru_t *block_cache = tb->options.block_cache;
+  ldb_contents_t contents;
+  ldb_entry_t *entry;
+  ldb_block_t *block;
+  uint8_t buf[16];
+  ldb_slice_t key;
+  uint8_t *data;
+
+  if (tb->cache_id == 0 || tb->status != LDB_OK)
+    return;
+
+  data = ldb_malloc(raw->size);
+
+  memcpy(data, raw->data, raw->size);
+
+  ldb_slice_set(&contents.data, data, raw->size);
+
+  contents.cachable = 1;
+  contents.heap_allocated = 1;
+  contents.verified = 1;
+
+  block = ldb_block_create(&contents);
+  key = ldb_table_cache_key(buf, tb->cache_id, handle);
+
+  entry = ldb_lru_insert_priority(block_cache, &key, block, block->size,
+                                  &delete_cached_block, tb->cache_priority);
+
+  ldb_lru_release(block_cache, entry);
+}
+
 static void
 ldb_tablegen_write_raw_block(ldb_tablegen_t *tb,
                              const ldb_slice_t *block_contents,
-                             enum ldb_compression type,
+                             int type,
                              ldb_handle_t *handle) {
   handle->offset = tb->offset;
   handle->size = block_contents->size;
@@ -151,6 +494,79 @@ ldb_tablegen_write_raw_block(ldb_tablegen_t *tb,
   }
 }
 
+/* Compress "x" into "z", returning the type the block should be
+   stored with. "cctx" is the zstd context to use with the dictionary. */
+static int
+ldb_tablegen_compress(const ldb_tablegen_t *tb,
+                      void *cctx,
+                      ldb_buffer_t *z,
+                      int type,
+                      const ldb_slice_t *x) {
+  int ok;
+
+#ifdef LDB_HAVE_ZSTD
+  if (type == LDB_ZSTD_DICT_TYPE) {
+    size_t max = ZSTD_compressBound(x->size);
+    size_t len;
+
+    ldb_buffer_varint32(z, x->size);
+    ldb_buffer_grow(z, z->size + max);
+
+    if (cctx != NULL) {
+      len = ZSTD_compress_usingCDict((ZSTD_CCtx *)cctx,
+                                     z->data + z->size, max,
+                                     x->data, x->size, tb->cdict);
+    } else {
+      len = (size_t)-1;
+    }
+
+    ok = cctx != NULL && !ZSTD_isError(len);
+
+    if (ok)
+      z->size += len;
+  } else {
+    ok = ldb_encode_block(z, type, x);
+  }
+#else
+  (void)tb;
+  (void)cctx;
+
+  ok = ldb_encode_block(z, type, x);
+#endif
+
+  /* Not compiled in, or compressed less than 12.5%. */
+  if (!ok || z->size >= x->size - (x->size / 8))
+    return LDB_NO_COMPRESSION;
+
+  return type;
+}
+
+/* Whether the next data block is worth trying to compress. */
+static int
+ldb_tablegen_should_compress(ldb_tablegen_t *tb) {
+  if (tb->compress_skip == 0)
+    return 1;
+
+  tb->compress_skip--;
+
+  return 0;
+}
+
+/* Record whether a data block we tried to compress did compress. */
+static void
+ldb_tablegen_note_compression(ldb_tablegen_t *tb, int compressed) {
+  if (!tb->options.adaptive_compression)
+    return;
+
+  if (compressed) {
+    tb->compress_failures = 0;
+    return;
+  }
+
+  if (++tb->compress_failures >= LDB_COMPRESS_FAILURES)
+    tb->compress_skip = LDB_COMPRESS_SKIP;
+}
+
 static void
 ldb_tablegen_write_block(ldb_tablegen_t *tb,
                          ldb_blockgen_t *block,
@@ -162,39 +578,49 @@ ldb_tablegen_write_block(ldb_tablegen_t *tb,
    *    crc: uint32
    */
   ldb_slice_t raw, *block_contents;
-  enum ldb_compression type;
+  int type;
 
   assert(tb->status == LDB_OK);
 
   raw = ldb_blockgen_finish(block);
   type = tb->options.compression;
 
+  /* Only data blocks use the dictionary. Meta blocks must
+     be readable before the dictionary is loaded. */
+  if (block == &tb->data_block && tb->dict.size > 0)
+    type = LDB_ZSTD_DICT_TYPE;
+
+  if (block == &tb->data_block && type != LDB_NO_COMPRESSION) {
+    if (!ldb_tablegen_should_compress(tb))
+      type = LDB_NO_COMPRESSION;
+  }
+
   switch (type) {
     case LDB_NO_COMPRESSION: {
       block_contents = &raw;
       break;
     }
 
-    case LDB_SNAPPY_COMPRESSION: {
-      ldb_buffer_t *compressed = &tb->compressed_output;
-      size_t max;
+    case LDB_SNAPPY_COMPRESSION:
+    case LDB_LZ4_COMPRESSION:
+    case LDB_ZSTD_COMPRESSION:
+    case LDB_ZSTD_DICT_TYPE: {
+      void *cctx = NULL;
 
-      if (!snappy_encode_size(&max, raw.size))
-        abort(); /* LCOV_EXCL_LINE */
+#ifdef LDB_HAVE_ZSTD
+      cctx = tb->cctx;
+#endif
 
-      ldb_buffer_grow(compressed, max);
+      type = ldb_tablegen_compress(tb, cctx, &tb->compressed_output,
+                                   type, &raw);
 
-      compressed->size = snappy_encode(compressed->data,
-                                       raw.data, raw.size);
+      if (block == &tb->data_block)
+        ldb_tablegen_note_compression(tb, type != LDB_NO_COMPRESSION);
 
-      if (compressed->size < raw.size - (raw.size / 8)) {
-        block_contents = compressed;
-      } else {
-        /* Snappy not supported, or compressed less than
-           12.5%, so just store uncompressed form. */
+      if (type != LDB_NO_COMPRESSION)
+        block_contents = &tb->compressed_output;
+      else
         block_contents = &raw;
-        type = LDB_NO_COMPRESSION;
-      }
 
       break;
     }
@@ -207,11 +633,406 @@ ldb_tablegen_write_block(ldb_tablegen_t *tb,
 
   ldb_tablegen_write_raw_block(tb, block_contents, type, handle);
 
+  if (block == &tb->data_block)
+    ldb_tablegen_cache_block(tb, &raw, handle);
+
   ldb_buffer_reset(&tb->compressed_output);
 
   ldb_blockgen_reset(block);
 }
 
+/* Write out the current index (and filter) partition. The
+   partition is referenced by "key" in the top-level blocks. */
+static void
+ldb_tablegen_write_partition(ldb_tablegen_t *tb, const ldb_slice_t *key) {
+  uint8_t tmp[LDB_HANDLE_SIZE + 10];
+  ldb_buffer_t handle_encoding;
+  ldb_handle_t handle;
+
+  if (tb->partition_filters) {
+    ldb_slice_t contents = ldb_filtergen_finish(tb->filter_block);
+
+    ldb_tablegen_write_raw_block(tb, &contents,
+                                     LDB_NO_COMPRESSION,
+                                     &handle);
+
+    if (tb->status != LDB_OK)
+      return;
+
+    ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+    ldb_handle_export(&handle_encoding, &handle);
+    ldb_buffer_varint64(&handle_encoding, tb->filter_base);
+    ldb_blockgen_add(&tb->top_filter_block, key, &handle_encoding);
+  }
+
+  ldb_tablegen_write_block(tb, &tb->index_block, &handle);
+
+  if (tb->status != LDB_OK)
+    return;
+
+  ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+  ldb_handle_export(&handle_encoding, &handle);
+  ldb_blockgen_add(&tb->top_index_block, key, &handle_encoding);
+
+  if (tb->partition_filters) {
+    tb->filter_base = tb->offset;
+
+    ldb_filtergen_reset(tb->filter_block);
+    ldb_filtergen_start_block(tb->filter_block, 0);
+  }
+}
+
+/* Map "key" (>= every key in the block, < every key after it)
+   to the data block at "handle". */
+static void
+ldb_tablegen_add_index(ldb_tablegen_t *tb,
+                       const ldb_slice_t *key,
+                       const ldb_handle_t *handle) {
+  uint8_t tmp[LDB_HANDLE_SIZE];
+  ldb_buffer_t handle_encoding;
+
+  ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+  ldb_handle_export(&handle_encoding, handle);
+  ldb_blockgen_add(&tb->index_block, key, &handle_encoding);
+
+  if (tb->user_keys) {
+    ldb_slice_t ukey = ldb_slice(key->data, key->size - 8);
+
+    ldb_blockgen_add(&tb->uindex_block, &ukey, &handle_encoding);
+  }
+
+  if (tb->partition_index) {
+    size_t size = ldb_blockgen_size_estimate(&tb->index_block);
+
+    if (size >= tb->options.block_size)
+      ldb_tablegen_write_partition(tb, key);
+  }
+}
+
+static void
+ldb_cjob_execute(void *arg) {
+  ldb_cjob_t *job = arg;
+  ldb_tablegen_t *tb = job->tb;
+  void *cctx = NULL;
+
+#ifdef LDB_HAVE_ZSTD
+  if (job->type == LDB_ZSTD_DICT_TYPE) {
+    if (job->cctx == NULL)
+      job->cctx = ZSTD_createCCtx();
+
+    cctx = job->cctx;
+  }
+#endif
+
+  ldb_buffer_reset(&job->compressed);
+
+  job->type = ldb_tablegen_compress(tb, cctx, &job->compressed,
+                                    job->type, &job->raw);
+
+  ldb_mutex_lock(&tb->mutex);
+
+  job->done = 1;
+
+  ldb_cond_broadcast(&tb->cond);
+  ldb_mutex_unlock(&tb->mutex);
+}
+
+/* Wait for the oldest job and remove it from the ring. */
+static ldb_cjob_t *
+ldb_tablegen_pop_job(ldb_tablegen_t *tb) {
+  ldb_cjob_t *job = &tb->jobs[tb->job_head];
+
+  assert(tb->num_jobs > 0);
+
+  ldb_mutex_lock(&tb->mutex);
+
+  while (!job->done)
+    ldb_cond_wait(&tb->cond, &tb->mutex);
+
+  ldb_mutex_unlock(&tb->mutex);
+
+  tb->job_head = (tb->job_head + 1) % tb->max_jobs;
+  tb->num_jobs--;
+  tb->job_bytes -= job->raw.size;
+
+  return job;
+}
+
+/* Write the oldest block out. */
+static void
+ldb_tablegen_write_job(ldb_tablegen_t *tb) {
+  ldb_cjob_t *job = ldb_tablegen_pop_job(tb);
+  ldb_slice_t contents;
+  ldb_handle_t handle;
+
+  if (tb->status != LDB_OK)
+    return;
+
+  if (tb->filter_block != NULL && !tb->full_filter) {
+    ldb_slice_t keys = job->keys;
+    ldb_slice_t key;
+
+    while (ldb_slice_slurp(&key, &keys))
+      ldb_filtergen_add_key(tb->filter_block, &key);
+  }
+
+  if (job->tried)
+    ldb_tablegen_note_compression(tb, job->type != LDB_NO_COMPRESSION);
+
+  if (job->type != LDB_NO_COMPRESSION)
+    contents = job->compressed;
+  else
+    contents = job->raw;
+
+  ldb_tablegen_write_raw_block(tb, &contents, job->type, &handle);
+
+  ldb_tablegen_cache_block(tb, &job->raw, &handle);
+
+  if (tb->status == LDB_OK) {
+    tb->props.data_blocks++;
+    tb->status = ldb_wfile_flush(tb->file);
+  }
+
+  if (tb->filter_block != NULL && !tb->full_filter)
+    ldb_filtergen_start_block(tb->filter_block, tb->offset - tb->filter_base);
+
+  if (tb->status == LDB_OK)
+    ldb_tablegen_add_index(tb, &job->index_key, &handle);
+}
+
+/* Hand the current data block to the pool. */
+static void
+ldb_tablegen_submit(ldb_tablegen_t *tb) {
+  ldb_cjob_t *job;
+  ldb_slice_t raw;
+
+  if (tb->num_jobs == tb->max_jobs)
+    ldb_tablegen_write_job(tb);
+
+  if (tb->status != LDB_OK)
+    return;
+
+  job = &tb->jobs[(tb->job_head + tb->num_jobs) % tb->max_jobs];
+  raw = ldb_blockgen_finish(&tb->data_block);
+
+  ldb_buffer_copy(&job->raw, &raw);
+  ldb_buffer_copy(&job->index_key, &tb->last_key);
+  ldb_buffer_swap(&job->keys, &tb->block_keys);
+  ldb_buffer_reset(&tb->block_keys);
+
+  /* Only data blocks use the dictionary. */
+  if (tb->dict.size > 0)
+    job->type = LDB_ZSTD_DICT_TYPE;
+  else
+    job->type = tb->options.compression;
+
+  job->tried = ldb_tablegen_should_compress(tb);
+  job->done = !job->tried;
+
+  if (!job->tried)
+    job->type = LDB_NO_COMPRESSION;
+
+  tb->num_jobs++;
+  tb->job_bytes += raw.size;
+  tb->pending_index_entry = 1;
+
+  ldb_blockgen_reset(&tb->data_block);
+
+  if (job->tried)
+    ldb_pool_schedule(tb->pool, &ldb_cjob_execute, job);
+}
+
+/* The index entry of a block is >= its last key and < the first key of
+   the next block. Its user key alone is as good only if the user keys
+   of those two keys differ. */
+static void
+ldb_tablegen_check_boundary(ldb_tablegen_t *tb, const ldb_slice_t *key) {
+  const ldb_comparator_t *ucmp = tb->uindex_block_options.comparator;
+  ldb_slice_t x = ldb_slice(tb->last_key.data, tb->last_key.size - 8);
+  ldb_slice_t y = ldb_slice(key->data, key->size - 8);
+
+  if (ldb_compare(ucmp, &x, &y) == 0) {
+    ldb_blockgen_reset(&tb->uindex_block);
+    tb->user_keys = 0;
+  }
+}
+
+/* The newest job, whose separator is set by the next key added. */
+static ldb_cjob_t *
+ldb_tablegen_last_job(ldb_tablegen_t *tb) {
+  assert(tb->num_jobs > 0);
+  return &tb->jobs[(tb->job_head + tb->num_jobs - 1) % tb->max_jobs];
+}
+
+static void
+ldb_tablegen_add_cuckoo(ldb_tablegen_t *tb,
+                        const ldb_slice_t *key,
+                        const ldb_slice_t *value) {
+  uint64_t offset = tb->offset + tb->plain_data.size;
+  size_t size = ldb_slice_size(key) + ldb_slice_size(value);
+
+  if (offset + size > UINT32_MAX) {
+    tb->status = LDB_INVALID; /* "entry does not fit a cuckoo table" */
+    return;
+  }
+
+  ldb_slice_export(&tb->plain_data, key);
+  ldb_slice_export(&tb->plain_data, value);
+
+  ldb_cuckoogen_add(tb->cuckoo, key, offset, size);
+
+  ldb_buffer_copy(&tb->last_key, key);
+
+  tb->num_entries++;
+  tb->props.raw_key_size += key->size;
+  tb->props.raw_value_size += value->size;
+
+  if (tb->plain_data.size >= tb->options.block_size)
+    ldb_tablegen_flush(tb);
+}
+
+static void
+ldb_tablegen_add_plain(ldb_tablegen_t *tb,
+                       const ldb_slice_t *key,
+                       const ldb_slice_t *value) {
+  uint64_t offset = tb->offset + tb->plain_data.size;
+
+  if (tb->cuckoo != NULL) {
+    ldb_tablegen_add_cuckoo(tb, key, value);
+    return;
+  }
+
+  if (key->size != tb->key_width || offset > UINT32_MAX) {
+    tb->status = LDB_INVALID; /* "entry does not fit a plain table" */
+    return;
+  }
+
+  /* Only the first (newest) entry of a user key is hashed. */
+  if (tb->plain_hash) {
+    size_t user_size = key->size;
+    int head;
+
+    if (tb->options.comparator->user_comparator != NULL)
+      user_size -= 8;
+
+    head = tb->num_entries == 0
+        || tb->last_key.size != key->size
+        || memcmp(tb->last_key.data, key->data, user_size) != 0;
+
+    if (head) {
+      uint64_t hash = ldb_block_hash(tb->options.comparator, key);
+
+      ldb_array_push(&tb->plain_heads, (hash << 32) | tb->num_entries);
+    }
+  }
+
+  ldb_array_push(&tb->plain_offsets, offset);
+
+  ldb_buffer_concat(&tb->plain_data, key);
+  ldb_buffer_varint32(&tb->plain_data, value->size);
+  ldb_buffer_concat(&tb->plain_data, value);
+
+  ldb_buffer_copy(&tb->last_key, key);
+
+  tb->num_entries++;
+  tb->props.raw_key_size += key->size;
+  tb->props.raw_value_size += value->size;
+
+  if (tb->plain_data.size >= tb->options.block_size)
+    ldb_tablegen_flush(tb);
+}
+
+/* Write the run of plain entries, to be indexed as a data block. */
+static void
+ldb_tablegen_flush_plain(ldb_tablegen_t *tb) {
+  if (tb->plain_data.size == 0)
+    return;
+
+  assert(!tb->pending_index_entry);
+
+  tb->pending_handle.offset = tb->offset;
+  tb->pending_handle.size = tb->plain_data.size;
+
+  tb->status = ldb_wfile_append(tb->file, &tb->plain_data);
+
+  if (tb->status == LDB_OK) {
+    tb->offset += tb->plain_data.size;
+    tb->pending_index_entry = 1;
+    tb->props.data_blocks++;
+    tb->status = ldb_wfile_flush(tb->file);
+  }
+
+  ldb_buffer_reset(&tb->plain_data);
+}
+
+/* Write the "plain.index" meta block (see plain_table.c). */
+static void
+ldb_tablegen_write_plain_index(ldb_tablegen_t *tb, ldb_handle_t *handle) {
+  size_t count = tb->plain_heads.length;
+  uint32_t num_buckets = 0;
+  uint32_t *buckets = NULL;
+  ldb_buffer_t index;
+  size_t i;
+
+  if (count > 0) {
+    uint32_t mask;
+
+    num_buckets = 1;
+
+    while (num_buckets < count * 2)
+      num_buckets <<= 1;
+
+    mask = num_buckets - 1;
+    buckets = ldb_malloc(num_buckets * sizeof(uint32_t));
+
+    memset(buckets, 0, num_buckets * sizeof(uint32_t));
+
+    for (i = 0; i < count; i++) {
+      uint64_t item = tb->plain_heads.items[i];
+      uint32_t b = (uint32_t)(item >> 32) & mask;
+
+      while (buckets[b] != 0)
+        b = (b + 1) & mask;
+
+      buckets[b] = (uint32_t)(item & 0xffffffff) + 1;
+    }
+  }
+
+  ldb_buffer_init(&index);
+
+  for (i = 0; i < tb->plain_offsets.length; i++)
+    ldb_buffer_fixed32(&index, tb->plain_offsets.items[i]);
+
+  for (i = 0; i < num_buckets; i++)
+    ldb_buffer_fixed32(&index, buckets[i]);
+
+  ldb_buffer_fixed32(&index, tb->key_width);
+  ldb_buffer_fixed32(&index, tb->plain_offsets.length);
+  ldb_buffer_fixed32(&index, num_buckets);
+
+  ldb_tablegen_write_raw_block(tb, &index, LDB_NO_COMPRESSION, handle);
+
+  ldb_buffer_clear(&index);
+
+  if (buckets != NULL)
+    ldb_free(buckets);
+}
+
+/* Write the "cuckoo.index" meta block (see cuckoo_table.c). */
+static void
+ldb_tablegen_write_cuckoo_index(ldb_tablegen_t *tb, ldb_handle_t *handle) {
+  ldb_buffer_t index;
+
+  ldb_buffer_init(&index);
+
+  tb->status = ldb_cuckoogen_finish(tb->cuckoo, &index);
+
+  if (tb->status == LDB_OK)
+    ldb_tablegen_write_raw_block(tb, &index, LDB_NO_COMPRESSION, handle);
+
+  ldb_buffer_clear(&index);
+}
+
 void
 ldb_tablegen_add(ldb_tablegen_t *tb,
                  const ldb_slice_t *key,
@@ -227,24 +1048,45 @@ ldb_tablegen_add(ldb_tablegen_t *tb,
     assert(ldb_compare(tb->options.comparator, key, &tb->last_key) > 0);
 
   if (tb->pending_index_entry) {
-    uint8_t tmp[LDB_HANDLE_SIZE];
-    ldb_buffer_t handle_encoding;
-
     assert(ldb_blockgen_empty(&tb->data_block));
 
-    ldb_shortest_separator(tb->options.comparator, &tb->last_key, key);
-    ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
-    ldb_handle_export(&handle_encoding, &tb->pending_handle);
-    ldb_blockgen_add(&tb->index_block, &tb->last_key, &handle_encoding);
+    if (tb->user_keys)
+      ldb_tablegen_check_boundary(tb, key);
+
+    if (tb->jobs != NULL) {
+      /* The entry is added once the block is written. */
+      ldb_cjob_t *job = ldb_tablegen_last_job(tb);
+
+      ldb_shortest_separator(tb->options.comparator, &job->index_key, key);
+    } else {
+      ldb_shortest_separator(tb->options.comparator, &tb->last_key, key);
+      ldb_tablegen_add_index(tb, &tb->last_key, &tb->pending_handle);
+    }
+
     tb->pending_index_entry = 0;
+
+    if (tb->status != LDB_OK)
+      return;
   }
 
-  if (tb->filter_block != NULL)
-    ldb_filtergen_add_key(tb->filter_block, key);
+  if (tb->plain) {
+    ldb_tablegen_add_plain(tb, key, value);
+    return;
+  }
+
+  if (tb->filter_block != NULL) {
+    /* Per-block filters need the offset of the block. */
+    if (tb->jobs != NULL && !tb->full_filter)
+      ldb_slice_export(&tb->block_keys, key);
+    else
+      ldb_filtergen_add_key(tb->filter_block, key);
+  }
 
   ldb_buffer_copy(&tb->last_key, key);
 
   tb->num_entries++;
+  tb->props.raw_key_size += key->size;
+  tb->props.raw_value_size += value->size;
 
   ldb_blockgen_add(&tb->data_block, key, value);
 
@@ -254,6 +1096,20 @@ ldb_tablegen_add(ldb_tablegen_t *tb,
     ldb_tablegen_flush(tb);
 }
 
+void
+ldb_tablegen_add_range(ldb_tablegen_t *tb,
+                       const ldb_slice_t *key,
+                       const ldb_slice_t *end) {
+  assert(!tb->closed);
+
+  if (tb->status != LDB_OK)
+    return;
+
+  ldb_blockgen_add(&tb->range_block, key, end);
+
+  tb->num_tombstones++;
+}
+
 void
 ldb_tablegen_flush(ldb_tablegen_t *tb) {
   assert(!tb->closed);
@@ -261,20 +1117,81 @@ ldb_tablegen_flush(ldb_tablegen_t *tb) {
   if (tb->status != LDB_OK)
     return;
 
+  if (tb->plain) {
+    ldb_tablegen_flush_plain(tb);
+    return;
+  }
+
   if (ldb_blockgen_empty(&tb->data_block))
     return;
 
   assert(!tb->pending_index_entry);
 
+  if (tb->jobs != NULL) {
+    ldb_tablegen_submit(tb);
+    return;
+  }
+
   ldb_tablegen_write_block(tb, &tb->data_block, &tb->pending_handle);
 
   if (tb->status == LDB_OK) {
     tb->pending_index_entry = 1;
+    tb->props.data_blocks++;
     tb->status = ldb_wfile_flush(tb->file);
   }
 
-  if (tb->filter_block != NULL)
-    ldb_filtergen_start_block(tb->filter_block, tb->offset);
+  if (tb->filter_block != NULL && !tb->full_filter)
+    ldb_filtergen_start_block(tb->filter_block, tb->offset - tb->filter_base);
+}
+
+static void
+ldb_props_add(ldb_blockgen_t *block, const char *name, uint64_t value) {
+  uint8_t tmp[10];
+  ldb_buffer_t val;
+  ldb_slice_t key;
+
+  ldb_slice_set_str(&key, name);
+  ldb_buffer_rwset(&val, tmp, sizeof(tmp));
+  ldb_buffer_varint64(&val, value);
+  ldb_blockgen_add(block, &key, &val);
+}
+
+static void
+ldb_tablegen_write_props(ldb_tablegen_t *tb, ldb_handle_t *handle) {
+  ldb_dbopt_t props_options = tb->options;
+  ldb_tableprops_t *props = &tb->props;
+  ldb_blockgen_t block;
+
+  props->entries = tb->num_entries;
+  props->tombstones = tb->num_tombstones;
+  props->compression = tb->options.compression;
+
+  if (props->smallest_sequence > props->largest_sequence) {
+    props->smallest_sequence = 0;
+    props->largest_sequence = 0;
+  }
+
+  props_options.comparator = ldb_bytewise_comparator;
+  props_options.data_block_hash_index = 0;
+  props_options.separate_block_values = 0;
+
+  ldb_blockgen_init(&block, &props_options);
+
+  /* Names are sorted bytewise. */
+  ldb_props_add(&block, "compression", props->compression);
+  ldb_props_add(&block, "creation.time", props->creation_time);
+  ldb_props_add(&block, "data.blocks", props->data_blocks);
+  ldb_props_add(&block, "deletions", props->deletions);
+  ldb_props_add(&block, "entries", props->entries);
+  ldb_props_add(&block, "raw.key.size", props->raw_key_size);
+  ldb_props_add(&block, "raw.value.size", props->raw_value_size);
+  ldb_props_add(&block, "sequence.largest", props->largest_sequence);
+  ldb_props_add(&block, "sequence.smallest", props->smallest_sequence);
+  ldb_props_add(&block, "tombstones", props->tombstones);
+
+  ldb_tablegen_write_block(tb, &block, handle);
+
+  ldb_blockgen_clear(&block);
 }
 
 int
@@ -282,6 +1199,10 @@ ldb_tablegen_finish(ldb_tablegen_t *tb) {
   ldb_handle_t metaindex_handle = {0, 0};
   ldb_handle_t index_handle = {0, 0};
   ldb_handle_t filter_handle;
+  ldb_handle_t range_handle;
+  ldb_handle_t dict_handle;
+  ldb_handle_t props_handle;
+  ldb_handle_t plain_handle;
 
   ldb_tablegen_flush(tb);
 
@@ -289,29 +1210,129 @@ ldb_tablegen_finish(ldb_tablegen_t *tb) {
 
   tb->closed = 1;
 
+  /* Write out the blocks still being compressed. */
+  if (tb->jobs != NULL) {
+    if (tb->status == LDB_OK && tb->pending_index_entry) {
+      ldb_short_successor(tb->options.comparator, &tb->last_key);
+      ldb_buffer_copy(&ldb_tablegen_last_job(tb)->index_key, &tb->last_key);
+      tb->pending_index_entry = 0;
+    }
+
+    while (tb->num_jobs > 0)
+      ldb_tablegen_write_job(tb);
+  }
+
+  /* Add the index entry for the last data block. */
+  if (tb->status == LDB_OK && tb->pending_index_entry) {
+    uint8_t tmp[LDB_HANDLE_SIZE];
+    ldb_buffer_t handle_encoding;
+
+    ldb_short_successor(tb->options.comparator, &tb->last_key);
+    ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+    ldb_handle_export(&handle_encoding, &tb->pending_handle);
+    ldb_blockgen_add(&tb->index_block, &tb->last_key, &handle_encoding);
+
+    if (tb->user_keys) {
+      ldb_slice_t ukey = ldb_slice(tb->last_key.data, tb->last_key.size - 8);
+
+      ldb_blockgen_add(&tb->uindex_block, &ukey, &handle_encoding);
+    }
+
+    tb->pending_index_entry = 0;
+  }
+
+  /* Write the final index (and filter) partition. */
+  if (tb->status == LDB_OK && tb->partition_index) {
+    if (!ldb_blockgen_empty(&tb->index_block))
+      ldb_tablegen_write_partition(tb, &tb->last_key);
+  }
+
   /* Write filter block. */
   if (tb->status == LDB_OK && tb->filter_block != NULL) {
-    ldb_slice_t contents = ldb_filtergen_finish(tb->filter_block);
+    if (tb->partition_filters) {
+      ldb_tablegen_write_block(tb, &tb->top_filter_block, &filter_handle);
+    } else {
+      ldb_slice_t contents = ldb_filtergen_finish(tb->filter_block);
+
+      ldb_tablegen_write_raw_block(tb, &contents,
+                                       LDB_NO_COMPRESSION,
+                                       &filter_handle);
+    }
+  }
 
-    ldb_tablegen_write_raw_block(tb, &contents,
+  /* Write the plain (or cuckoo) index, right after the entries. */
+  if (tb->status == LDB_OK && tb->cuckoo != NULL)
+    ldb_tablegen_write_cuckoo_index(tb, &plain_handle);
+  else if (tb->status == LDB_OK && tb->plain)
+    ldb_tablegen_write_plain_index(tb, &plain_handle);
+
+  /* Write range tombstones. */
+  if (tb->status == LDB_OK && tb->num_tombstones > 0)
+    ldb_tablegen_write_block(tb, &tb->range_block, &range_handle);
+
+  /* Write compression dictionary. */
+  if (tb->status == LDB_OK && tb->dict.size > 0) {
+    ldb_tablegen_write_raw_block(tb, &tb->dict,
                                      LDB_NO_COMPRESSION,
-                                     &filter_handle);
+                                     &dict_handle);
   }
 
+  /* Write table properties. */
+  if (tb->status == LDB_OK)
+    ldb_tablegen_write_props(tb, &props_handle);
+
   /* Write metaindex block. */
   if (tb->status == LDB_OK) {
+    ldb_dbopt_t metaindex_options = tb->options;
     ldb_blockgen_t metaindex_block;
 
-    ldb_blockgen_init(&metaindex_block, &tb->options);
+    /* Meta block names are sorted bytewise. */
+    metaindex_options.comparator = ldb_bytewise_comparator;
+    metaindex_options.data_block_hash_index = 0;
+    metaindex_options.separate_block_values = 0;
+
+    ldb_blockgen_init(&metaindex_block, &metaindex_options);
+
+    if (tb->dict.size > 0) {
+      /* Add mapping from "compression.dict" to the dictionary. */
+      uint8_t tmp[LDB_HANDLE_SIZE];
+      ldb_slice_t key = ldb_string("compression.dict");
+      ldb_buffer_t handle_encoding;
+
+      ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+      ldb_handle_export(&handle_encoding, &dict_handle);
+      ldb_blockgen_add(&metaindex_block, &key, &handle_encoding);
+    }
+
+    if (tb->cuckoo != NULL) {
+      /* Add mapping from "cuckoo.index" to the cuckoo index. */
+      uint8_t tmp[LDB_HANDLE_SIZE];
+      ldb_slice_t key = ldb_string("cuckoo.index");
+      ldb_buffer_t handle_encoding;
+
+      ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+      ldb_handle_export(&handle_encoding, &plain_handle);
+      ldb_blockgen_add(&metaindex_block, &key, &handle_encoding);
+    }
 
     if (tb->filter_block != NULL) {
       /* Add mapping from "filter.Name" to location of filter data. */
+      /* Partitioned filters use "partition.filter.Name" instead, and
+         whole-table filters use "fullfilter.Name". */
       uint8_t tmp[LDB_HANDLE_SIZE];
       ldb_buffer_t handle_encoding;
       ldb_slice_t key;
-      char name[72];
+      char name[90];
+
+      if (tb->partition_filters)
+        strcpy(name, "partition.");
+      else if (tb->full_filter)
+        strcpy(name, "full");
+      else
+        name[0] = '\0';
 
-      if (!ldb_bloom_name(name, sizeof(name), tb->options.filter_policy)) {
+      if (!ldb_bloom_name(name + strlen(name), 72,
+                          tb->options.filter_policy)) {
         ldb_blockgen_clear(&metaindex_block);
         return LDB_INVALID;
       }
@@ -322,25 +1343,76 @@ ldb_tablegen_finish(ldb_tablegen_t *tb) {
       ldb_blockgen_add(&metaindex_block, &key, &handle_encoding);
     }
 
-    ldb_tablegen_write_block(tb, &metaindex_block, &metaindex_handle);
+    if (tb->user_keys) {
+      /* Mark the index block as holding user keys. */
+      ldb_slice_t key = ldb_string("index.user_keys");
+      ldb_slice_t val = ldb_string("");
 
-    ldb_blockgen_clear(&metaindex_block);
-  }
+      ldb_blockgen_add(&metaindex_block, &key, &val);
+    }
 
-  /* Write index block. */
-  if (tb->status == LDB_OK) {
-    if (tb->pending_index_entry) {
+    if (tb->partition_index) {
+      /* Mark the index block as a top-level partition index. */
+      ldb_slice_t key = ldb_string("partition.index");
+      ldb_slice_t val = ldb_string("");
+
+      ldb_blockgen_add(&metaindex_block, &key, &val);
+    }
+
+    if (tb->plain && tb->cuckoo == NULL) {
+      /* Add mapping from "plain.index" to the plain index. */
       uint8_t tmp[LDB_HANDLE_SIZE];
+      ldb_slice_t key = ldb_string("plain.index");
       ldb_buffer_t handle_encoding;
 
-      ldb_short_successor(tb->options.comparator, &tb->last_key);
       ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
-      ldb_handle_export(&handle_encoding, &tb->pending_handle);
-      ldb_blockgen_add(&tb->index_block, &tb->last_key, &handle_encoding);
-      tb->pending_index_entry = 0;
+      ldb_handle_export(&handle_encoding, &plain_handle);
+      ldb_blockgen_add(&metaindex_block, &key, &handle_encoding);
+    }
+
+    if (tb->filter_block != NULL && tb->filter_block->prefix != NULL) {
+      /* Record which prefix extractor the filter was built with. */
+      ldb_slice_t key = ldb_string("prefix");
+      ldb_slice_t val = ldb_string(tb->filter_block->prefix->name);
+
+      ldb_blockgen_add(&metaindex_block, &key, &val);
+    }
+
+    {
+      /* Add mapping from "properties" to the table properties. */
+      uint8_t tmp[LDB_HANDLE_SIZE];
+      ldb_slice_t key = ldb_string("properties");
+      ldb_buffer_t handle_encoding;
+
+      ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+      ldb_handle_export(&handle_encoding, &props_handle);
+      ldb_blockgen_add(&metaindex_block, &key, &handle_encoding);
     }
 
-    ldb_tablegen_write_block(tb, &tb->index_block, &index_handle);
+    if (tb->num_tombstones > 0) {
+      /* Add mapping from "rangedel" to the range tombstones. */
+      uint8_t tmp[LDB_HANDLE_SIZE];
+      ldb_slice_t key = ldb_string("rangedel");
+      ldb_buffer_t handle_encoding;
+
+      ldb_buffer_rwset(&handle_encoding, tmp, sizeof(tmp));
+      ldb_handle_export(&handle_encoding, &range_handle);
+      ldb_blockgen_add(&metaindex_block, &key, &handle_encoding);
+    }
+
+    ldb_tablegen_write_block(tb, &metaindex_block, &metaindex_handle);
+
+    ldb_blockgen_clear(&metaindex_block);
+  }
+
+  /* Write index block. */
+  if (tb->status == LDB_OK) {
+    if (tb->partition_index)
+      ldb_tablegen_write_block(tb, &tb->top_index_block, &index_handle);
+    else if (tb->user_keys)
+      ldb_tablegen_write_block(tb, &tb->uindex_block, &index_handle);
+    else
+      ldb_tablegen_write_block(tb, &tb->index_block, &index_handle);
   }
 
   /* Write footer. */
@@ -351,6 +1423,10 @@ ldb_tablegen_finish(ldb_tablegen_t *tb) {
 
     footer.metaindex_handle = metaindex_handle;
     footer.index_handle = index_handle;
+    if (tb->cuckoo != NULL)
+      footer.format = LDB_FORMAT_CUCKOO;
+    else if (tb->plain)
+      footer.format = LDB_FORMAT_PLAIN;
 
     ldb_buffer_rwset(&footer_encoding, tmp, sizeof(tmp));
     ldb_footer_export(&footer_encoding, &footer);
@@ -367,7 +1443,11 @@ ldb_tablegen_finish(ldb_tablegen_t *tb) {
 void
 ldb_tablegen_abandon(ldb_tablegen_t *tb) {
   assert(!tb->closed);
+
   tb->closed = 1;
+
+  while (tb->num_jobs > 0)
+    ldb_tablegen_pop_job(tb);
 }
 
 int
@@ -380,7 +1460,17 @@ ldb_tablegen_entries(const ldb_tablegen_t *tb) {
   return tb->num_entries;
 }
 
+uint64_t
+ldb_tablegen_tombstones(const ldb_tablegen_t *tb) {
+  return tb->num_tombstones;
+}
+
+ldb_tableprops_t *
+ldb_tablegen_properties(ldb_tablegen_t *tb) {
+  return &tb->props;
+}
+
 uint64_t
 ldb_tablegen_size(const ldb_tablegen_t *tb) {
-  return tb->offset;
+  return tb->offset + tb->job_bytes;
 }
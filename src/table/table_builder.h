@@ -22,6 +22,7 @@
  */
 
 struct ldb_dbopt_s;
+struct ldb_tableprops_s;
 struct ldb_wfile_s;
 
 typedef struct ldb_tablegen_s ldb_tablegen_t;
@@ -42,6 +43,22 @@ ldb_tablegen_create(const struct ldb_dbopt_s *options,
 void
 ldb_tablegen_destroy(ldb_tablegen_t *tb);
 
+/* Compress data blocks with a Zstd dictionary, which is stored in the
+ * table. Has no effect unless the table uses LDB_ZSTD_COMPRESSION.
+ * REQUIRES: add() has not been called
+ */
+void
+ldb_tablegen_set_dict(ldb_tablegen_t *tb, const ldb_slice_t *dict);
+
+/* Insert each data block into the block cache as it is written, keyed
+ * as the table opened with "cache_id" (see ldb_table_open_id()) will
+ * look for it. "level" is the level the table is written to: blocks
+ * of level-0 tables are inserted with high priority.
+ * REQUIRES: add() has not been called
+ */
+void
+ldb_tablegen_warm_cache(ldb_tablegen_t *tb, uint64_t cache_id, int level);
+
 /* Add key,value to the table being constructed. */
 /* REQUIRES: key is after any previously added key according to comparator. */
 /* REQUIRES: finish(), abandon() have not been called */
@@ -50,6 +67,17 @@ ldb_tablegen_add(ldb_tablegen_t *tb,
                  const ldb_slice_t *key,
                  const ldb_slice_t *value);
 
+/* Add a range tombstone to the table's "rangedel" meta block. The
+ * key is the internal key of the tombstone's start and the value is
+ * its end key (see src/rangedel.h).
+ * REQUIRES: key is after any previously added tombstone.
+ * REQUIRES: finish(), abandon() have not been called
+ */
+void
+ldb_tablegen_add_range(ldb_tablegen_t *tb,
+                       const ldb_slice_t *key,
+                       const ldb_slice_t *end);
+
 /* Advanced operation: flush any buffered key/value pairs to file.
  * Can be used to ensure that two adjacent entries never live in
  * the same data block. Most clients should not need to use this method.
@@ -82,6 +110,15 @@ ldb_tablegen_status(const ldb_tablegen_t *tb);
 uint64_t
 ldb_tablegen_entries(const ldb_tablegen_t *tb);
 
+/* Number of calls to add_range() so far. */
+uint64_t
+ldb_tablegen_tombstones(const ldb_tablegen_t *tb);
+
+/* Properties to be written by finish(). The caller may fill in the
+   deletion count, sequence range and creation time before then. */
+struct ldb_tableprops_s *
+ldb_tablegen_properties(ldb_tablegen_t *tb);
+
 /* Size of the file generated so far. If invoked after a successful
    finish() call, returns the size of the final generated file. */
 uint64_t
@@ -18,6 +18,7 @@
 #include "../util/options.h"
 #include "../util/slice.h"
 #include "../util/status.h"
+#include "../util/vector.h"
 
 #include "iterator.h"
 #include "iterator_wrapper.h"
@@ -37,6 +38,9 @@ typedef struct ldb_twoiter_s {
   /* If data_iter is non-null, then "data_block_handle" holds the
     "index_value" passed to block_function to create the data_iter. */
   ldb_buffer_t data_block_handle;
+  /* With options.pin_data, data iterators we are done with are kept
+     here (along with the blocks they hold) until we are destroyed. */
+  ldb_vector_t pinned;
 } ldb_twoiter_t;
 
 static int
@@ -91,20 +95,34 @@ ldb_twoiter_init(ldb_twoiter_t *iter,
   ldb_wrapiter_init(&iter->index_iter, index_iter);
   ldb_wrapiter_init(&iter->data_iter, NULL);
   ldb_buffer_init(&iter->data_block_handle);
+  ldb_vector_init(&iter->pinned);
 }
 
 static void
 ldb_twoiter_clear(ldb_twoiter_t *iter) {
+  size_t i;
+
   ldb_wrapiter_clear(&iter->index_iter);
   ldb_wrapiter_clear(&iter->data_iter);
   ldb_buffer_clear(&iter->data_block_handle);
+
+  for (i = 0; i < iter->pinned.length; i++)
+    ldb_iter_destroy(iter->pinned.items[i]);
+
+  ldb_vector_clear(&iter->pinned);
 }
 
 static void
 ldb_twoiter_set_data_iter(ldb_twoiter_t *iter, ldb_iter_t *data_iter) {
-  if (iter->data_iter.iter != NULL)
+  if (iter->data_iter.iter != NULL) {
     ldb_twoiter_saverr(iter, ldb_wrapiter_status(&iter->data_iter));
 
+    if (iter->options.pin_data) {
+      ldb_vector_push(&iter->pinned, iter->data_iter.iter);
+      iter->data_iter.iter = NULL;
+    }
+  }
+
   ldb_wrapiter_set(&iter->data_iter, data_iter);
 }
 
@@ -221,9 +239,10 @@ ldb_twoiter_create(ldb_iter_t *index_iter,
                    ldb_blockfunc_f block_function,
                    void *arg,
                    const ldb_readopt_t *options) {
-  ldb_twoiter_t *iter = ldb_malloc(sizeof(ldb_twoiter_t));
+  ldb_twoiter_t *iter = ldb_small_alloc(sizeof(ldb_twoiter_t));
 
   ldb_twoiter_init(iter, index_iter, block_function, arg, options);
 
-  return ldb_iter_create(iter, &ldb_twoiter_table, index_iter->cmp);
+  return ldb_iter_create_small(iter, sizeof(ldb_twoiter_t),
+                               &ldb_twoiter_table, index_iter->cmp);
 }
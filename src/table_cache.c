@@ -14,56 +14,740 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "table/format.h"
 #include "table/iterator.h"
 #include "table/table.h"
 
+#include "util/atomic.h"
 #include "util/cache.h"
 #include "util/coding.h"
+#include "util/comparator.h"
 #include "util/env.h"
 #include "util/internal.h"
 #include "util/options.h"
+#include "util/pinned.h"
+#include "util/port.h"
+#include "util/rbt.h"
 #include "util/slice.h"
 #include "util/status.h"
 
+#include "blob.h"
+#include "dbformat.h"
 #include "filename.h"
+#include "rangedel.h"
 #include "table_cache.h"
+#include "version_edit.h"
 
 /*
  * Types
  */
 
-struct ldb_tables_s {
-  const char *dbname;
-  const ldb_dbopt_t *options;
-  ldb_lru_t *lru;
-};
+/* An open table. Entries are never freed while the cache is alive:
+   once the last reference is dropped they go on a free list to be
+   reused. A lookup which races with an eviction may therefore still
+   touch an entry, though it will find it no longer holds the table
+   it is looking for (see table_lookup()). */
+#define table_entry_s ldb_tabref_s
 
 typedef struct table_entry_s {
+  uint64_t number;
   ldb_rfile_t *file;
   ldb_table_t *table;
+  ldb_rangedel_t *tombstones; /* NULL if the table has none. */
+  size_t memory;              /* Memory held by the table reader. */
+  ldb_atomic(int) refs;       /* References, including cache reference. */
+  ldb_atomic(int) tag;        /* Low bits of number, checked first. */
+  ldb_atomic(int) hit;        /* Looked up since last visited by evict(). */
+  struct table_entry_s *next; /* Free list. */
 } table_entry_t;
 
+/* Slots of the handle table. Lookups may still be probing an array
+   after it has been replaced by a larger one, so replaced arrays are
+   only freed along with the cache. */
+typedef struct table_array_s {
+  struct table_array_s *next; /* Replaced arrays. */
+  size_t mask;
+  ldb_atomic_ptr(table_entry_t) slots[1];
+} table_array_t;
+
+struct ldb_tables_s {
+  const char *dbname;
+  const ldb_dbopt_t *options;
+  size_t capacity;
+  int keep_all; /* Keep every table open (max_open_files=-1). */
+
+  /* Open-addressed by file number with linear probing. A slot holds
+     NULL (never used), &table_deleted, or an entry in the cache.
+     Lookups probe the slots without taking the mutex. */
+  ldb_atomic_ptr(table_array_t) array;
+
+  /* mutex protects the following state. */
+  ldb_mutex_t mutex;
+  size_t usage; /* Entries in the cache. */
+  size_t used;  /* Slots which are not NULL. */
+  size_t hand;  /* Clock hand for evict(). */
+  table_entry_t *free_list;
+  table_array_t *retired;
+  rb_tree_t reserved; /* file number -> block cache id */
+
+  /* Blob files open for reading. */
+  ldb_blobs_t *blobs;
+
+  /* Open table files, and how many of them are memory-mapped. */
+  ldb_atomic(int) files;
+  ldb_atomic(int) mapped;
+
+  /* Memory held by the cached table readers. */
+  ldb_atomic(size_t) memory;
+};
+
+/* One blob file is kept open for every four tables. */
+#define LDB_BLOBS_PER_TABLE 4
+
 /*
  * Helpers
  */
 
+static int
+read_tombstones(const ldb_tables_t *cache,
+                const ldb_table_t *table,
+                ldb_rangedel_t **result) {
+  const ldb_comparator_t *icmp = cache->options->comparator;
+  ldb_iter_t *iter = ldb_table_range_iterator(table);
+  ldb_rangedel_t *rd;
+  int rc;
+
+  *result = NULL;
+
+  if (iter == NULL)
+    return LDB_OK;
+
+  rd = ldb_rangedel_create(icmp->user_comparator);
+  rc = ldb_rangedel_add_iter(rd, iter);
+
+  ldb_iter_destroy(iter);
+
+  if (rc != LDB_OK) {
+    ldb_rangedel_destroy(rd);
+    return rc;
+  }
+
+  ldb_rangedel_build(rd);
+
+  *result = rd;
+
+  return LDB_OK;
+}
+
+/* Report the newest range tombstone covering the lookup key "k"
+   (if any) as a LDB_TYPE_RANGE_DELETION entry. This comes before
+   the table lookup, which may never call handle_result(). */
+static void
+report_tombstone(const ldb_rangedel_t *rd,
+                 const ldb_slice_t *k,
+                 void *arg,
+                 void (*handle_result)(void *,
+                                       const ldb_slice_t *,
+                                       const ldb_slice_t *)) {
+  ldb_slice_t ukey = ldb_extract_user_key(k);
+  ldb_seqnum_t snapshot = ldb_fixed64_decode(k->data + ukey.size) >> 8;
+  ldb_seqnum_t sequence = ldb_rangedel_covering(rd, &ukey, snapshot);
+
+  if (sequence > 0) {
+    ldb_slice_t empty = ldb_string("");
+    ldb_ikey_t key;
+
+    ldb_ikey_init(&key);
+    ldb_ikey_set(&key, &ukey, sequence, LDB_TYPE_RANGE_DELETION);
+
+    handle_result(arg, &key, &empty);
+
+    ldb_ikey_clear(&key);
+  }
+}
+
+/*
+ * Global Sequence
+ */
+
+/* The keys of an ingested table are all written with a sequence
+   number of zero, and are read as having the file's global sequence
+   number instead (see ldb_ingest()). The writer only allows one entry
+   per user key, so the rewritten keys keep their order. */
+static void
+set_sequence(ldb_ikey_t *z, const ldb_slice_t *x, ldb_seqnum_t sequence) {
+  ldb_pkey_t pkey;
+
+  if (ldb_pkey_import(&pkey, x))
+    ldb_ikey_set(z, &pkey.user_key, sequence, pkey.type);
+  else
+    ldb_ikey_copy(z, x); /* Reported as corrupted further up. */
+}
+
+typedef struct ldb_seqiter_s {
+  ldb_iter_t *iter;
+  const ldb_comparator_t *icmp;
+  ldb_seqnum_t sequence;
+  ldb_ikey_t key;
+} ldb_seqiter_t;
+
+static void
+ldb_seqiter_update(ldb_seqiter_t *iter) {
+  if (ldb_iter_valid(iter->iter)) {
+    ldb_slice_t key = ldb_iter_key(iter->iter);
+
+    set_sequence(&iter->key, &key, iter->sequence);
+  }
+}
+
+static void
+ldb_seqiter_clear(ldb_seqiter_t *iter) {
+  ldb_iter_destroy(iter->iter);
+  ldb_ikey_clear(&iter->key);
+}
+
+static int
+ldb_seqiter_valid(const ldb_seqiter_t *iter) {
+  return ldb_iter_valid(iter->iter);
+}
+
+static void
+ldb_seqiter_first(ldb_seqiter_t *iter) {
+  ldb_iter_first(iter->iter);
+  ldb_seqiter_update(iter);
+}
+
+static void
+ldb_seqiter_last(ldb_seqiter_t *iter) {
+  ldb_iter_last(iter->iter);
+  ldb_seqiter_update(iter);
+}
+
+static void
+ldb_seqiter_seek(ldb_seqiter_t *iter, const ldb_slice_t *target) {
+  ldb_iter_seek(iter->iter, target);
+  ldb_seqiter_update(iter);
+
+  /* The table holds (key, 0), which may be newer than the target
+     once it is read as (key, sequence). */
+  if (ldb_iter_valid(iter->iter)) {
+    if (ldb_compare(iter->icmp, &iter->key, target) < 0) {
+      ldb_iter_next(iter->iter);
+      ldb_seqiter_update(iter);
+    }
+  }
+}
+
+static void
+ldb_seqiter_next(ldb_seqiter_t *iter) {
+  ldb_iter_next(iter->iter);
+  ldb_seqiter_update(iter);
+}
+
+static void
+ldb_seqiter_prev(ldb_seqiter_t *iter) {
+  ldb_iter_prev(iter->iter);
+  ldb_seqiter_update(iter);
+}
+
+static ldb_slice_t
+ldb_seqiter_key(const ldb_seqiter_t *iter) {
+  return iter->key;
+}
+
+static ldb_slice_t
+ldb_seqiter_value(const ldb_seqiter_t *iter) {
+  return ldb_iter_value(iter->iter);
+}
+
+static int
+ldb_seqiter_status(const ldb_seqiter_t *iter) {
+  return ldb_iter_status(iter->iter);
+}
+
+LDB_ITERATOR_FUNCTIONS(ldb_seqiter);
+
+static ldb_iter_t *
+ldb_seqiter_create(ldb_iter_t *it,
+                   const ldb_comparator_t *icmp,
+                   ldb_seqnum_t sequence) {
+  ldb_seqiter_t *iter = ldb_small_alloc(sizeof(ldb_seqiter_t));
+
+  iter->iter = it;
+  iter->icmp = icmp;
+  iter->sequence = sequence;
+
+  ldb_ikey_init(&iter->key);
+
+  return ldb_iter_create_small(iter, sizeof(ldb_seqiter_t),
+                               &ldb_seqiter_table, icmp);
+}
+
+typedef struct seqarg_s {
+  ldb_seqnum_t sequence;
+  ldb_seqnum_t snapshot;
+  void *arg;
+  void (*handle_result)(void *, const ldb_slice_t *, const ldb_slice_t *);
+} seqarg_t;
+
+static void
+seqarg_init(seqarg_t *sa,
+            ldb_seqnum_t sequence,
+            const ldb_slice_t *k,
+            void *arg,
+            void (*handle_result)(void *,
+                                  const ldb_slice_t *,
+                                  const ldb_slice_t *)) {
+  ldb_slice_t ukey = ldb_extract_user_key(k);
+
+  sa->sequence = sequence;
+  sa->snapshot = ldb_fixed64_decode(k->data + ukey.size) >> 8;
+  sa->arg = arg;
+  sa->handle_result = handle_result;
+}
+
+static void
+save_sequenced(void *arg, const ldb_slice_t *k, const ldb_slice_t *v) {
+  seqarg_t *sa = (seqarg_t *)arg;
+  ldb_ikey_t key;
+
+  /* The entry was written after the lookup's snapshot. */
+  if (sa->sequence > sa->snapshot)
+    return;
+
+  ldb_ikey_init(&key);
+
+  set_sequence(&key, k, sa->sequence);
+
+  sa->handle_result(sa->arg, &key, v);
+
+  ldb_ikey_clear(&key);
+}
+
+/*
+ * Handle Table
+ */
+
+/* Marks a slot whose entry was removed. Lookups probe past it. */
+static table_entry_t table_deleted;
+
+static size_t
+table_hash(uint64_t number) {
+  /* Fibonacci hashing spreads out sequential file numbers. */
+  return (size_t)((number * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+static int
+table_tag(uint64_t number) {
+  return (int)(number & 0x7fffffff);
+}
+
+static table_array_t *
+table_array_create(size_t size) {
+  table_array_t *a = ldb_malloc(sizeof(table_array_t)
+                              + (size - 1) * sizeof(a->slots[0]));
+  size_t i;
+
+  a->next = NULL;
+  a->mask = size - 1;
+
+  for (i = 0; i < size; i++)
+    ldb_atomic_init_ptr(&a->slots[i], NULL);
+
+  return a;
+}
+
+static table_array_t *
+table_array(ldb_tables_t *cache) {
+  return ldb_atomic_load_ptr(&cache->array, ldb_order_acquire);
+}
+
+static table_entry_t *
+table_slot(table_array_t *a, size_t i) {
+  return ldb_atomic_load_ptr(&a->slots[i], ldb_order_acquire);
+}
+
+static void
+table_set_slot(table_array_t *a, size_t i, table_entry_t *e) {
+  ldb_atomic_store_ptr(&a->slots[i], e, ldb_order_release);
+}
+
+static int
+table_refs(table_entry_t *e) {
+  return ldb_atomic_load(&e->refs, ldb_order_acquire);
+}
+
+static void
+table_ref(table_entry_t *e) {
+  ldb_atomic_fetch_add(&e->refs, 1, ldb_order_relaxed);
+}
+
+/* Take a reference unless the entry is free (or about to be).
+   An entry's contents do not change while it is referenced. */
+static int
+table_try_ref(table_entry_t *e) {
+  int refs = table_refs(e);
+
+  while (refs > 0) {
+    int old = ldb_atomic_compare_exchange(&e->refs, refs, refs + 1);
+
+    if (old == refs)
+      return 1;
+
+    refs = old;
+  }
+
+  return 0;
+}
+
+static void
+table_touch(table_entry_t *e) {
+  if (!ldb_atomic_load(&e->hit, ldb_order_relaxed))
+    ldb_atomic_store(&e->hit, 1, ldb_order_relaxed);
+}
+
+/* Count a mapping against options->max_mapped_tables. */
+static int
+mapping_acquire(ldb_tables_t *cache) {
+  int limit = cache->options->max_mapped_tables;
+
+  if (ldb_atomic_fetch_add(&cache->mapped, 1, ldb_order_relaxed) < limit
+      || limit < 0) {
+    return 1;
+  }
+
+  ldb_atomic_fetch_sub(&cache->mapped, 1, ldb_order_relaxed);
+
+  return 0;
+}
+
+static void
+close_file(ldb_tables_t *cache, ldb_rfile_t *file) {
+  if (ldb_rfile_mapped(file))
+    ldb_atomic_fetch_sub(&cache->mapped, 1, ldb_order_relaxed);
+
+  ldb_atomic_fetch_sub(&cache->files, 1, ldb_order_relaxed);
+
+  ldb_rfile_destroy(file);
+}
+
+/* Close an entry's table and put it on the free list.
+   REQUIRES: cache->mutex is held. */
 static void
-delete_entry(const ldb_slice_t *key, void *value) {
-  table_entry_t *entry = (table_entry_t *)value;
+table_free(ldb_tables_t *cache, table_entry_t *e) {
+  if (e->tombstones != NULL)
+    ldb_rangedel_destroy(e->tombstones);
+
+  ldb_atomic_fetch_sub(&cache->memory, e->memory, ldb_order_relaxed);
+
+  ldb_table_destroy(e->table);
+  close_file(cache, e->file);
+
+  e->file = NULL;
+  e->table = NULL;
+  e->tombstones = NULL;
+  e->next = cache->free_list;
+
+  cache->free_list = e;
+}
 
-  (void)key;
+/* REQUIRES: cache->mutex is held. */
+static void
+table_unref_locked(ldb_tables_t *cache, table_entry_t *e) {
+  if (ldb_atomic_fetch_sub(&e->refs, 1, ldb_order_acq_rel) == 1)
+    table_free(cache, e);
+}
 
-  ldb_table_destroy(entry->table);
-  ldb_rfile_destroy(entry->file);
-  ldb_free(entry);
+/* Drop a reference. Does not require the mutex unless this was the
+   last one: the cache holds a reference to every entry in it, so only
+   an entry which has already left the cache can be freed here. */
+static void
+table_unref(ldb_tables_t *cache, table_entry_t *e) {
+  if (ldb_atomic_fetch_sub(&e->refs, 1, ldb_order_acq_rel) == 1) {
+    ldb_mutex_lock(&cache->mutex);
+    table_free(cache, e);
+    ldb_mutex_unlock(&cache->mutex);
+  }
 }
 
 static void
 unref_entry(void *arg1, void *arg2) {
-  ldb_lru_t *lru = (ldb_lru_t *)arg1;
-  ldb_entry_t *h = (ldb_entry_t *)arg2;
+  ldb_tables_t *cache = (ldb_tables_t *)arg1;
+  table_entry_t *e = (table_entry_t *)arg2;
+
+  table_unref(cache, e);
+}
+
+/* Look up "number" without taking the mutex. May return NULL if the
+   lookup races with a change to the table; callers then retry under
+   the mutex. On success, the caller holds a new reference. */
+static table_entry_t *
+table_lookup(ldb_tables_t *cache, uint64_t number) {
+  table_array_t *a = table_array(cache);
+  size_t i = table_hash(number) & a->mask;
+  int tag = table_tag(number);
+  size_t n;
+
+  for (n = 0; n <= a->mask; n++) {
+    table_entry_t *e = table_slot(a, i);
+
+    if (e == NULL)
+      break;
+
+    if (e != &table_deleted &&
+        ldb_atomic_load(&e->tag, ldb_order_relaxed) == tag &&
+        table_try_ref(e)) {
+      /* Now that the entry cannot be reused, check that
+         it is the one we want and still in the cache. */
+      if (e->number == number && table_slot(a, i) == e) {
+        table_touch(e);
+        return e;
+      }
+
+      table_unref(cache, e);
+    }
 
-  ldb_lru_release(lru, h);
+    i = (i + 1) & a->mask;
+  }
+
+  return NULL;
+}
+
+/* Find the slot index holding "number", or return -1.
+   REQUIRES: cache->mutex is held. */
+static long
+table_find_locked(ldb_tables_t *cache, uint64_t number) {
+  table_array_t *a = table_array(cache);
+  size_t i = table_hash(number) & a->mask;
+  size_t n;
+
+  for (n = 0; n <= a->mask; n++) {
+    table_entry_t *e = table_slot(a, i);
+
+    if (e == NULL)
+      break;
+
+    if (e != &table_deleted && e->number == number)
+      return (long)i;
+
+    i = (i + 1) & a->mask;
+  }
+
+  return -1;
+}
+
+/* Remove the entry in slot "i" from the cache.
+   REQUIRES: cache->mutex is held. */
+static void
+table_remove(ldb_tables_t *cache, size_t i) {
+  table_array_t *a = table_array(cache);
+  table_entry_t *e = table_slot(a, i);
+
+  table_set_slot(a, i, &table_deleted);
+
+  cache->usage--;
+
+  table_unref_locked(cache, e);
+}
+
+/* Place a live entry in the first free slot of its probe sequence.
+   REQUIRES: cache->mutex is held. */
+static void
+table_place(ldb_tables_t *cache, table_array_t *a, table_entry_t *e) {
+  size_t i = table_hash(e->number) & a->mask;
+
+  for (;;) {
+    table_entry_t *x = table_slot(a, i);
+
+    if (x == NULL) {
+      cache->used++;
+      break;
+    }
+
+    if (x == &table_deleted)
+      break;
+
+    i = (i + 1) & a->mask;
+  }
+
+  table_set_slot(a, i, e);
+}
+
+/* Make room for one more entry: drop the deleted markers once they
+   fill up the table, so that probes for missing tables stay short, or
+   move to an array twice the size if the live entries do. Concurrent
+   lookups may miss while this runs, in which case they retry under
+   the mutex.
+   REQUIRES: cache->mutex is held. */
+static void
+table_reserve(ldb_tables_t *cache) {
+  table_array_t *a = table_array(cache);
+  size_t size = a->mask + 1;
+  table_entry_t **live;
+  size_t count = 0;
+  size_t i;
+
+  if (4 * (cache->used + 1) <= 3 * size)
+    return;
+
+  live = ldb_malloc((cache->usage + 1) * sizeof(table_entry_t *));
+
+  for (i = 0; i < size; i++) {
+    table_entry_t *e = table_slot(a, i);
+
+    if (e != NULL && e != &table_deleted)
+      live[count++] = e;
+  }
+
+  assert(count == cache->usage);
+
+  if (4 * (count + 1) > 2 * size) {
+    table_array_t *old = a;
+
+    while (4 * (count + 1) > 2 * size)
+      size *= 2;
+
+    a = table_array_create(size);
+
+    cache->used = 0;
+
+    for (i = 0; i < count; i++)
+      table_place(cache, a, live[i]);
+
+    ldb_atomic_store_ptr(&cache->array, a, ldb_order_release);
+
+    /* Lookups still probing the old array will miss. */
+    for (i = 0; i <= old->mask; i++)
+      table_set_slot(old, i, NULL);
+
+    old->next = cache->retired;
+    cache->retired = old;
+    cache->hand = 0;
+  } else {
+    for (i = 0; i < size; i++)
+      table_set_slot(a, i, NULL);
+
+    cache->used = 0;
+
+    for (i = 0; i < count; i++)
+      table_place(cache, a, live[i]);
+  }
+
+  ldb_free(live);
+}
+
+/* Advance the clock hand until usage fits in capacity. Gives up after
+   two passes, in case everything is referenced.
+   REQUIRES: cache->mutex is held. */
+static void
+table_evict(ldb_tables_t *cache) {
+  table_array_t *a = table_array(cache);
+  size_t steps = 2 * (a->mask + 1);
+
+  while (cache->usage > cache->capacity && steps-- > 0) {
+    size_t i = cache->hand;
+    table_entry_t *e = table_slot(a, i);
+
+    cache->hand = (i + 1) & a->mask;
+
+    if (e == NULL || e == &table_deleted)
+      continue;
+
+    if (table_refs(e) > 1)
+      continue; /* Still in use. */
+
+    if (ldb_atomic_load(&e->hit, ldb_order_relaxed)) {
+      /* Another chance. */
+      ldb_atomic_store(&e->hit, 0, ldb_order_relaxed);
+      continue;
+    }
+
+    table_remove(cache, i);
+  }
+}
+
+/* Insert a freshly opened table, or return the entry another thread
+   inserted for it in the meantime (in which case the caller closes its
+   own copy). The returned entry holds a reference for the caller. */
+static table_entry_t *
+table_insert(ldb_tables_t *cache,
+             uint64_t number,
+             ldb_rfile_t *file,
+             ldb_table_t *table,
+             ldb_rangedel_t *tombstones,
+             int *inserted) {
+  table_entry_t *e;
+  long found;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  found = table_find_locked(cache, number);
+
+  if (found >= 0) {
+    e = table_slot(table_array(cache), found);
+
+    table_ref(e);
+    table_touch(e);
+
+    ldb_mutex_unlock(&cache->mutex);
+
+    *inserted = 0;
+
+    return e;
+  }
+
+  if (cache->free_list != NULL) {
+    e = cache->free_list;
+    cache->free_list = e->next;
+  } else {
+    e = ldb_malloc(sizeof(table_entry_t));
+  }
+
+  e->number = number;
+  e->file = file;
+  e->table = table;
+  e->tombstones = tombstones;
+  e->memory = ldb_table_memory(table);
+
+  e->next = NULL;
+
+  ldb_atomic_fetch_add(&cache->memory, e->memory, ldb_order_relaxed);
+
+  ldb_atomic_store(&e->tag, table_tag(number), ldb_order_relaxed);
+  ldb_atomic_store(&e->hit, 0, ldb_order_relaxed);
+  ldb_atomic_store(&e->refs, 1, ldb_order_release); /* For the caller. */
+
+  /* Don't cache (capacity==0 is supported and turns off caching). */
+  if (cache->capacity > 0) {
+    table_reserve(cache);
+
+    table_ref(e); /* For the cache's reference. */
+    table_place(cache, table_array(cache), e);
+
+    cache->usage++;
+
+    table_evict(cache);
+  }
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  *inserted = 1;
+
+  return e;
+}
+
+/* Keep a reference to the table in the file's metadata, so that later
+   lookups can skip the cache. */
+static void
+table_keep(ldb_tables_t *cache, ldb_filemeta_t *f, table_entry_t *e) {
+  ldb_mutex_lock(&cache->mutex);
+
+  if (ldb_atomic_load_ptr(&f->reader, ldb_order_relaxed) == NULL) {
+    table_ref(e);
+    ldb_atomic_store_ptr(&f->reader, e, ldb_order_release);
+  }
+
+  ldb_mutex_unlock(&cache->mutex);
 }
 
 /*
@@ -73,87 +757,281 @@ unref_entry(void *arg1, void *arg2) {
 ldb_tables_t *
 ldb_tables_create(const char *dbname, const ldb_dbopt_t *options, int entries) {
   ldb_tables_t *cache = ldb_malloc(sizeof(ldb_tables_t));
+  size_t size = 16;
 
   cache->dbname = dbname;
   cache->options = options;
-  cache->lru = ldb_lru_create(entries);
+  cache->capacity = entries;
+  cache->keep_all = 0;
+
+  if (entries < 0) {
+    cache->capacity = (size_t)-1;
+    cache->keep_all = 1;
+  } else {
+    while (size < 2 * (size_t)entries)
+      size *= 2;
+  }
+
+  ldb_atomic_init_ptr(&cache->array, table_array_create(size));
+
+  ldb_mutex_init(&cache->mutex);
+
+  cache->usage = 0;
+  cache->used = 0;
+  cache->hand = 0;
+  cache->free_list = NULL;
+  cache->retired = NULL;
+
+  rb_set64_init(&cache->reserved);
+
+  if (cache->keep_all)
+    cache->blobs = ldb_blobs_create(dbname, 1000);
+  else
+    cache->blobs = ldb_blobs_create(dbname, entries / LDB_BLOBS_PER_TABLE);
+
+  ldb_atomic_init(&cache->files, 0);
+  ldb_atomic_init(&cache->mapped, 0);
+  ldb_atomic_init(&cache->memory, 0);
 
   return cache;
 }
 
 void
 ldb_tables_destroy(ldb_tables_t *cache) {
-  ldb_lru_destroy(cache->lru);
+  table_array_t *a = table_array(cache);
+  size_t i;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  for (i = 0; i <= a->mask; i++) {
+    table_entry_t *e = table_slot(a, i);
+
+    if (e != NULL && e != &table_deleted) {
+      /* Error if caller has an unreleased handle. */
+      assert(table_refs(e) == 1);
+      table_remove(cache, i);
+    }
+  }
+
+  while (cache->free_list != NULL) {
+    table_entry_t *e = cache->free_list;
+
+    cache->free_list = e->next;
+
+    ldb_free(e);
+  }
+
+  while (cache->retired != NULL) {
+    table_array_t *old = cache->retired;
+
+    cache->retired = old->next;
+
+    ldb_free(old);
+  }
+
+  rb_tree_clear(&cache->reserved, NULL);
+
+  ldb_mutex_unlock(&cache->mutex);
+  ldb_mutex_destroy(&cache->mutex);
+
+  ldb_blobs_destroy(cache->blobs);
+
+  ldb_free(a);
   ldb_free(cache);
 }
 
+/* Take the block cache id reserved for a table, if any. */
+static uint64_t
+take_reserved(ldb_tables_t *cache, uint64_t file_number) {
+  uint64_t id = 0;
+  rb_node_t node;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  if (rb_tree_del(&cache->reserved, rb_ui(file_number), &node))
+    id = node.val.ui;
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  return id;
+}
+
 static int
-find_table(ldb_tables_t *cache,
+open_table(ldb_tables_t *cache,
            uint64_t file_number,
            uint64_t file_size,
-           ldb_entry_t **handle) {
-  ldb_slice_t key;
+           int path_id,
+           int level,
+           table_entry_t **handle) {
+  int flags = cache->options->use_mmap ? LDB_RFILE_MMAP : 0;
+  const char *dir = ldb_table_dir(cache->dbname, cache->options, path_id);
+  char fname[LDB_PATH_MAX];
+  ldb_rangedel_t *tombstones = NULL;
+  ldb_rfile_t *file = NULL;
+  ldb_table_t *table = NULL;
+  int acquired = 0;
   int rc = LDB_OK;
-  uint8_t buf[8];
 
-  ldb_fixed64_write(buf, file_number);
+  if (cache->options->use_direct_reads)
+    flags = LDB_RFILE_DIRECT;
+
+  if (cache->options->advise_random_on_open)
+    flags |= LDB_RFILE_RANDOM;
 
-  ldb_slice_set(&key, buf, sizeof(buf));
+  /* The database has its own mapping limit. */
+  if ((flags & LDB_RFILE_MMAP) && cache->options->max_mapped_tables != 0) {
+    acquired = mapping_acquire(cache);
+
+    if (acquired)
+      flags |= LDB_RFILE_NOLIMIT;
+    else
+      flags &= ~LDB_RFILE_MMAP;
+  }
 
-  *handle = ldb_lru_lookup(cache->lru, &key);
+  if (!ldb_table_filename(fname, sizeof(fname), dir, file_number))
+    return LDB_INVALID;
 
-  if (*handle == NULL) {
-    int use_mmap = cache->options->use_mmap;
-    char fname[LDB_PATH_MAX];
-    ldb_rfile_t *file = NULL;
-    ldb_table_t *table = NULL;
+  rc = ldb_randfile_create(fname, &file, flags);
 
-    if (!ldb_table_filename(fname, sizeof(fname), cache->dbname, file_number))
+  if (rc != LDB_OK) {
+    if (!ldb_sstable_filename(fname, sizeof(fname), dir, file_number))
       return LDB_INVALID;
 
-    rc = ldb_randfile_create(fname, &file, use_mmap);
+    if (ldb_randfile_create(fname, &file, flags) == LDB_OK)
+      rc = LDB_OK;
+  }
 
-    if (rc != LDB_OK) {
-      if (!ldb_sstable_filename(fname, sizeof(fname), cache->dbname,
-                                                      file_number)) {
-        return LDB_INVALID;
-      }
+  if (rc == LDB_OK) {
+    ldb_atomic_fetch_add(&cache->files, 1, ldb_order_relaxed);
 
-      if (ldb_randfile_create(fname, &file, use_mmap) == LDB_OK)
-        rc = LDB_OK;
-    }
+    if (ldb_rfile_mapped(file) && !acquired)
+      ldb_atomic_fetch_add(&cache->mapped, 1, ldb_order_relaxed);
+  }
+
+  /* Give back a mapping which was not used. */
+  if (acquired && (rc != LDB_OK || !ldb_rfile_mapped(file)))
+    ldb_atomic_fetch_sub(&cache->mapped, 1, ldb_order_relaxed);
+
+  if (rc == LDB_OK) {
+    uint64_t cache_id = take_reserved(cache, file_number);
+
+    rc = ldb_table_open_id(cache->options, file, file_size,
+                           cache_id, &table);
+  }
 
-    if (rc == LDB_OK)
-      rc = ldb_table_open(cache->options, file, file_size, &table);
+  if (rc == LDB_OK) {
+    rc = read_tombstones(cache, table, &tombstones);
 
     if (rc != LDB_OK) {
-      assert(table == NULL);
+      ldb_table_destroy(table);
+      table = NULL;
+    }
+  }
 
-      if (file != NULL)
-        ldb_rfile_destroy(file);
+  if (rc != LDB_OK) {
+    assert(table == NULL);
 
-      /* We do not cache error results so that if the error is transient,
-         or somebody repairs the file, we recover automatically. */
-    } else {
-      table_entry_t *entry = ldb_malloc(sizeof(table_entry_t));
+    if (file != NULL)
+      close_file(cache, file);
+
+    /* We do not cache error results so that if the error is transient,
+       or somebody repairs the file, we recover automatically. */
+  } else {
+    int inserted;
+
+    if (level == 0 && cache->options->pin_l0_filter_and_index_blocks)
+      ldb_table_pin(table);
 
-      entry->file = file;
-      entry->table = table;
+    if (level == 0)
+      ldb_table_prioritize(table);
 
-      *handle = ldb_lru_insert(cache->lru, &key, entry, 1, &delete_entry);
+    *handle = table_insert(cache, file_number, file, table,
+                           tombstones, &inserted);
+
+    if (!inserted) {
+      /* Another thread opened it first. */
+      if (tombstones != NULL)
+        ldb_rangedel_destroy(tombstones);
+
+      ldb_table_destroy(table);
+      close_file(cache, file);
     }
   }
 
   return rc;
 }
 
+static int
+find_table(ldb_tables_t *cache,
+           uint64_t file_number,
+           uint64_t file_size,
+           int path_id,
+           int level,
+           table_entry_t **handle) {
+  long i;
+
+  *handle = table_lookup(cache, file_number);
+
+  if (*handle != NULL)
+    return LDB_OK;
+
+  /* The lock-free lookup can miss an entry which is being moved. */
+  ldb_mutex_lock(&cache->mutex);
+
+  i = table_find_locked(cache, file_number);
+
+  if (i >= 0) {
+    *handle = table_slot(table_array(cache), i);
+
+    table_ref(*handle);
+    table_touch(*handle);
+  }
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  if (*handle != NULL)
+    return LDB_OK;
+
+  /* Open the table without holding the mutex, so that tables can be
+     opened in parallel and lookups of other tables are not held up. */
+  return open_table(cache, file_number, file_size, path_id, level, handle);
+}
+
+/* Like find_table(), but goes through the table kept open in the
+   file's metadata if there is one, and keeps one there if the file
+   is at level-0 or every table is kept open. */
+static int
+find_file(ldb_tables_t *cache,
+          ldb_filemeta_t *f,
+          int level,
+          table_entry_t **handle) {
+  table_entry_t *e = ldb_atomic_load_ptr(&f->reader, ldb_order_acquire);
+  int rc;
+
+  if (e != NULL) {
+    table_ref(e);
+    *handle = e;
+    return LDB_OK;
+  }
+
+  rc = find_table(cache, f->number, f->file_size, f->path_id, level, handle);
+
+  if (rc == LDB_OK && (level == 0 || cache->keep_all))
+    table_keep(cache, f, *handle);
+
+  return rc;
+}
+
 ldb_iter_t *
 ldb_tables_iterate(ldb_tables_t *cache,
                    const ldb_readopt_t *options,
                    uint64_t file_number,
                    uint64_t file_size,
+                   int path_id,
+                   int level,
+                   ldb_seqnum_t sequence,
                    ldb_table_t **tableptr) {
-  ldb_entry_t *handle = NULL;
+  table_entry_t *handle = NULL;
   ldb_table_t *table;
   ldb_iter_t *result;
   int rc;
@@ -161,15 +1039,18 @@ ldb_tables_iterate(ldb_tables_t *cache,
   if (tableptr != NULL)
     *tableptr = NULL;
 
-  rc = find_table(cache, file_number, file_size, &handle);
+  rc = find_table(cache, file_number, file_size, path_id, level, &handle);
 
   if (rc != LDB_OK)
     return ldb_emptyiter_create(rc);
 
-  table = ((table_entry_t *)ldb_lru_value(handle))->table;
+  table = handle->table;
   result = ldb_tableiter_create(table, options);
 
-  ldb_iter_register_cleanup(result, &unref_entry, cache->lru, handle);
+  ldb_iter_register_cleanup(result, &unref_entry, cache, handle);
+
+  if (sequence != 0)
+    result = ldb_seqiter_create(result, cache->options->comparator, sequence);
 
   if (tableptr != NULL)
     *tableptr = table;
@@ -180,36 +1061,278 @@ ldb_tables_iterate(ldb_tables_t *cache,
 int
 ldb_tables_get(ldb_tables_t *cache,
                const ldb_readopt_t *options,
-               uint64_t file_number,
-               uint64_t file_size,
+               ldb_filemeta_t *f,
+               int level,
                const ldb_slice_t *k,
                void *arg,
                void (*handle_result)(void *,
                                      const ldb_slice_t *,
-                                     const ldb_slice_t *)) {
-  ldb_entry_t *handle = NULL;
+                                     const ldb_slice_t *),
+               ldb_pinned_t *pin) {
+  ldb_seqnum_t sequence = f->global_sequence;
+  table_entry_t *handle = NULL;
+  int rc;
+
+  rc = find_file(cache, f, level, &handle);
+
+  if (rc == LDB_OK) {
+    table_entry_t *entry = handle;
+    seqarg_t sa;
+
+    if (entry->tombstones != NULL)
+      report_tombstone(entry->tombstones, k, arg, handle_result);
+
+    if (sequence != 0) {
+      seqarg_init(&sa, sequence, k, arg, handle_result);
+
+      arg = &sa;
+      handle_result = save_sequenced;
+    }
+
+    rc = ldb_table_internal_get(entry->table, options, k,
+                                arg, handle_result, pin);
+
+    if (pin != NULL && pin->pending) {
+      ldb_pinned_register(pin, &unref_entry, cache, handle);
+      pin->pending = 0;
+    } else {
+      table_unref(cache, handle);
+    }
+  }
+
+  return rc;
+}
+
+int
+ldb_tables_multiget(ldb_tables_t *cache,
+                    const ldb_readopt_t *options,
+                    ldb_filemeta_t *f,
+                    int level,
+                    const ldb_slice_t *keys,
+                    size_t count,
+                    void **args,
+                    void (*handle_result)(void *,
+                                          const ldb_slice_t *,
+                                          const ldb_slice_t *)) {
+  ldb_seqnum_t sequence = f->global_sequence;
+  table_entry_t *handle = NULL;
+  int rc;
+
+  rc = find_file(cache, f, level, &handle);
+
+  if (rc == LDB_OK) {
+    table_entry_t *entry = handle;
+    seqarg_t *sas = NULL;
+    void **sargs = NULL;
+    size_t i;
+
+    if (entry->tombstones != NULL) {
+      for (i = 0; i < count; i++)
+        report_tombstone(entry->tombstones, &keys[i], args[i], handle_result);
+    }
+
+    if (sequence != 0) {
+      sas = ldb_malloc(count * sizeof(seqarg_t));
+      sargs = ldb_malloc(count * sizeof(void *));
+
+      for (i = 0; i < count; i++) {
+        seqarg_init(&sas[i], sequence, &keys[i], args[i], handle_result);
+        sargs[i] = &sas[i];
+      }
+
+      args = sargs;
+      handle_result = save_sequenced;
+    }
+
+    rc = ldb_table_multiget(entry->table, options, keys, count,
+                            args, handle_result);
+
+    if (sas != NULL) {
+      ldb_free(sargs);
+      ldb_free(sas);
+    }
+
+    table_unref(cache, handle);
+  }
+
+  return rc;
+}
+
+int
+ldb_tables_tombstones(ldb_tables_t *cache,
+                      uint64_t file_number,
+                      uint64_t file_size,
+                      int path_id,
+                      int level,
+                      ldb_rangedel_t *result) {
+  table_entry_t *handle = NULL;
   int rc;
 
-  rc = find_table(cache, file_number, file_size, &handle);
+  rc = find_table(cache, file_number, file_size, path_id, level, &handle);
 
   if (rc == LDB_OK) {
-    ldb_table_t *table = ((table_entry_t *)ldb_lru_value(handle))->table;
+    table_entry_t *entry = handle;
+    const ldb_rangedel_t *rd = entry->tombstones;
+    size_t i;
+
+    for (i = 0; rd != NULL && i < rd->tombstones.length; i++) {
+      const ldb_tombstone_t *tomb = rd->tombstones.items[i];
 
-    rc = ldb_table_internal_get(table, options, k, arg, handle_result);
+      ldb_rangedel_add(result, &tomb->start, &tomb->end, tomb->sequence);
+    }
 
-    ldb_lru_release(cache->lru, handle);
+    table_unref(cache, handle);
   }
 
   return rc;
 }
 
+int
+ldb_tables_load(ldb_tables_t *cache, ldb_filemeta_t *f, int level) {
+  table_entry_t *handle = NULL;
+  int rc;
+
+  rc = find_file(cache, f, level, &handle);
+
+  if (rc == LDB_OK)
+    table_unref(cache, handle);
+
+  return rc;
+}
+
+int
+ldb_tables_properties(ldb_tables_t *cache,
+                      ldb_filemeta_t *f,
+                      int level,
+                      ldb_tableprops_t *props) {
+  table_entry_t *handle = NULL;
+  int rc;
+
+  rc = find_file(cache, f, level, &handle);
+
+  if (rc == LDB_OK) {
+    if (!ldb_table_properties(handle->table, props))
+      rc = LDB_NOTFOUND;
+
+    table_unref(cache, handle);
+  }
+
+  return rc;
+}
+
+int
+ldb_tables_warm(ldb_tables_t *cache,
+                ldb_filemeta_t *f,
+                int level,
+                const uint64_t *offsets,
+                size_t count) {
+  table_entry_t *handle = NULL;
+  int rc;
+
+  rc = find_file(cache, f, level, &handle);
+
+  if (rc == LDB_OK) {
+    rc = ldb_table_warm(handle->table, ldb_readopt_default, offsets, count);
+
+    table_unref(cache, handle);
+  }
+
+  return rc;
+}
+
+void
+ldb_tables_release(ldb_tables_t *cache, ldb_filemeta_t *f) {
+  table_entry_t *e = ldb_atomic_load_ptr(&f->reader, ldb_order_acquire);
+
+  if (e != NULL) {
+    ldb_atomic_store_ptr(&f->reader, NULL, ldb_order_relaxed);
+    table_unref(cache, e);
+  }
+}
+
+void
+ldb_tables_readers(ldb_tables_t *cache, int *mapped, int *total) {
+  *mapped = ldb_atomic_load(&cache->mapped, ldb_order_relaxed);
+  *total = ldb_atomic_load(&cache->files, ldb_order_relaxed);
+}
+
+size_t
+ldb_tables_memory(ldb_tables_t *cache) {
+  return ldb_atomic_load(&cache->memory, ldb_order_relaxed);
+}
+
 void
 ldb_tables_evict(ldb_tables_t *cache, uint64_t file_number) {
-  ldb_slice_t key;
-  uint8_t buf[8];
+  long i;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  i = table_find_locked(cache, file_number);
 
-  ldb_fixed64_write(buf, file_number);
-  ldb_slice_set(&key, buf, sizeof(buf));
+  if (i >= 0)
+    table_remove(cache, i);
 
-  ldb_lru_erase(cache->lru, &key);
+  rb_tree_del(&cache->reserved, rb_ui(file_number), NULL);
+
+  ldb_mutex_unlock(&cache->mutex);
+}
+
+void
+ldb_tables_cache_ids(ldb_tables_t *cache, rb_tree_t *ids) {
+  table_array_t *a;
+  size_t i;
+
+  ldb_mutex_lock(&cache->mutex);
+
+  a = table_array(cache);
+
+  for (i = 0; i <= a->mask; i++) {
+    table_entry_t *e = table_slot(a, i);
+    uint64_t id;
+    rb_node_t *node;
+
+    if (e == NULL || e == &table_deleted)
+      continue;
+
+    id = ldb_table_cache_id(e->table);
+
+    if (id != 0 && rb_tree_put(ids, rb_ui(id), &node))
+      node->val.ui = e->number;
+  }
+
+  ldb_mutex_unlock(&cache->mutex);
+}
+
+uint64_t
+ldb_tables_reserve(ldb_tables_t *cache, uint64_t file_number) {
+  ldb_lru_t *block_cache = cache->options->block_cache;
+  rb_node_t *node;
+  uint64_t id;
+
+  if (block_cache == NULL)
+    return 0;
+
+  id = ldb_lru_id(block_cache);
+
+  ldb_mutex_lock(&cache->mutex);
+
+  rb_tree_put(&cache->reserved, rb_ui(file_number), &node);
+
+  node->val.ui = id;
+
+  ldb_mutex_unlock(&cache->mutex);
+
+  return id;
+}
+
+int
+ldb_tables_blob(ldb_tables_t *cache,
+                const ldb_slice_t *ref,
+                ldb_buffer_t *value) {
+  return ldb_blobs_read(cache->blobs, ref, value);
+}
+
+void
+ldb_tables_evict_blob(ldb_tables_t *cache, uint64_t file_number) {
+  ldb_blobs_evict(cache->blobs, file_number);
 }
@@ -19,11 +19,18 @@
 #include "util/options.h"
 #include "util/types.h"
 
+#include "dbformat.h"
+
 /*
  * Types
  */
 
+struct ldb_filemeta_s;
 struct ldb_iter_s;
+struct ldb_pinned_s;
+struct ldb_rangedel_s;
+struct ldb_tableprops_s;
+struct rb_tree_s;
 
 typedef struct ldb_tables_s ldb_tables_t;
 
@@ -38,7 +45,12 @@ void
 ldb_tables_destroy(ldb_tables_t *cache);
 
 /* Return an iterator for the specified file number (the corresponding
- * file length must be exactly "file_size" bytes). If "tableptr" is
+ * file length must be exactly "file_size" bytes). "path_id" is the
+ * file's index into db_paths. "level" is the level the file lives at
+ * (or -1 if unknown), and decides whether the table's metadata is
+ * pinned when it is first opened. A non-zero "sequence" is
+ * the file's global sequence number, which replaces the sequence number
+ * of every key read from an ingested table. If "tableptr" is
  * non-null, also sets "*tableptr" to point to the Table object
  * underlying the returned iterator, or to NULL if no Table object
  * underlies the returned iterator. The returned "*tableptr" object is owned
@@ -50,23 +62,119 @@ ldb_tables_iterate(ldb_tables_t *cache,
                    const ldb_readopt_t *options,
                    uint64_t file_number,
                    uint64_t file_size,
+                   int path_id,
+                   int level,
+                   ldb_seqnum_t sequence,
                    ldb_table_t **tableptr);
 
-/* If a seek to internal key "k" in specified file finds an entry,
-   call (*handle_result)(arg, found_key, found_value). */
+/* If a seek to internal key "k" in file "f" finds an entry, call
+   (*handle_result)(arg, found_key, found_value). If a range tombstone
+   of the file covers the key, it is reported first, as an entry of
+   type LDB_TYPE_RANGE_DELETION with the tombstone's sequence number.
+   The file's global sequence number is applied as for
+   ldb_tables_iterate(); entries which it makes newer than the lookup
+   key are not reported.
+
+   Level-0 tables (or every table, if max_open_files is -1) are kept
+   open in f->reader once found, and later lookups skip the cache.
+
+   If the handler points "pin" at the value it was given, the table
+   and the block holding the value are kept until the pin is gone. */
 int
 ldb_tables_get(ldb_tables_t *cache,
                const ldb_readopt_t *options,
-               uint64_t file_number,
-               uint64_t file_size,
+               struct ldb_filemeta_s *f,
+               int level,
                const ldb_slice_t *k,
                void *arg,
                void (*handle_result)(void *,
                                      const ldb_slice_t *,
-                                     const ldb_slice_t *));
+                                     const ldb_slice_t *),
+               struct ldb_pinned_s *pin);
+
+/* Batched form of ldb_tables_get: looks up each internal key in
+   keys[0..count-1], calling (*handle_result)(args[i], ...) on a hit. */
+int
+ldb_tables_multiget(ldb_tables_t *cache,
+                    const ldb_readopt_t *options,
+                    struct ldb_filemeta_s *f,
+                    int level,
+                    const ldb_slice_t *keys,
+                    size_t count,
+                    void **args,
+                    void (*handle_result)(void *,
+                                          const ldb_slice_t *,
+                                          const ldb_slice_t *));
+
+/* Add the range tombstones of the specified file to *result. */
+int
+ldb_tables_tombstones(ldb_tables_t *cache,
+                      uint64_t file_number,
+                      uint64_t file_size,
+                      int path_id,
+                      int level,
+                      struct ldb_rangedel_s *result);
+
+/* Open file "f" (if it is not already) and keep it in the cache,
+   or in f->reader as for ldb_tables_get(). */
+int
+ldb_tables_load(ldb_tables_t *cache, struct ldb_filemeta_s *f, int level);
+
+/* Store the properties of file "f" in *props. Returns LDB_NOTFOUND
+   if the table was written without them. */
+int
+ldb_tables_properties(ldb_tables_t *cache,
+                      struct ldb_filemeta_s *f,
+                      int level,
+                      struct ldb_tableprops_s *props);
+
+/* Read the data blocks of file "f" which start at offsets[0..count-1]
+   (in ascending order) into the block cache (see ldb_table_warm()). */
+int
+ldb_tables_warm(ldb_tables_t *cache,
+                struct ldb_filemeta_s *f,
+                int level,
+                const uint64_t *offsets,
+                size_t count);
+
+/* Close the table kept open in f->reader, if any. Called once the
+   last version holding "f" is gone. */
+void
+ldb_tables_release(ldb_tables_t *cache, struct ldb_filemeta_s *f);
+
+/* Number of open table files, and how many of them are mapped. */
+void
+ldb_tables_readers(ldb_tables_t *cache, int *mapped, int *total);
+
+/* Memory held by the open table readers, not counting blocks charged
+   to the block cache. */
+size_t
+ldb_tables_memory(ldb_tables_t *cache);
 
 /* Evict any entry for the specified file number. */
 void
 ldb_tables_evict(ldb_tables_t *cache, uint64_t file_number);
 
+/* Map the block cache id of every open table to its file number
+   (rb_ui(id) -> node->val.ui) in "ids". */
+void
+ldb_tables_cache_ids(ldb_tables_t *cache, struct rb_tree_s *ids);
+
+/* Reserve the block cache id the table with the specified file number
+   is keyed by once opened, so that its blocks can be cached while it
+   is still being written (see ldb_tablegen_warm_cache()). Returns zero
+   if there is no block cache. */
+uint64_t
+ldb_tables_reserve(ldb_tables_t *cache, uint64_t file_number);
+
+/* Read the value stored in a blob file under reference "ref". */
+int
+ldb_tables_blob(ldb_tables_t *cache,
+                const ldb_slice_t *ref,
+                ldb_buffer_t *value);
+
+/* Close the blob file with the specified number, if open. */
+void
+ldb_tables_evict_blob(ldb_tables_t *cache, uint64_t file_number);
+
 #endif /* LDB_TABLE_CACHE_H */
@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include "arena.h"
 #include "atomic.h"
+#include "env.h"
 #include "internal.h"
 #include "vector.h"
 
@@ -24,6 +25,81 @@
 
 #define LDB_ARENA_BLOCK 4096
 
+/*
+ * Arena Pool
+ */
+
+void
+ldb_arenapool_init(ldb_arenapool_t *pool, size_t page_size,
+                                          size_t capacity) {
+  ldb_mutex_init(&pool->mutex);
+  ldb_vector_init(&pool->blocks);
+  ldb_vector_init(&pool->pages);
+
+  pool->page_size = page_size;
+  pool->capacity = capacity;
+  pool->size = 0;
+}
+
+void
+ldb_arenapool_clear(ldb_arenapool_t *pool) {
+  size_t i;
+
+  for (i = 0; i < pool->blocks.length; i++)
+    ldb_free(pool->blocks.items[i]);
+
+  for (i = 0; i < pool->pages.length; i++)
+    ldb_pages_free(pool->pages.items[i], pool->page_size);
+
+  ldb_vector_clear(&pool->blocks);
+  ldb_vector_clear(&pool->pages);
+  ldb_mutex_destroy(&pool->mutex);
+}
+
+size_t
+ldb_arenapool_size(ldb_arenapool_t *pool) {
+  size_t size;
+
+  ldb_mutex_lock(&pool->mutex);
+
+  size = pool->size;
+
+  ldb_mutex_unlock(&pool->mutex);
+
+  return size;
+}
+
+static void *
+ldb_arenapool_get(ldb_arenapool_t *pool, ldb_vector_t *list, size_t size) {
+  void *result = NULL;
+
+  ldb_mutex_lock(&pool->mutex);
+
+  if (list->length > 0) {
+    result = ldb_vector_pop(list);
+    pool->size -= size;
+  }
+
+  ldb_mutex_unlock(&pool->mutex);
+
+  return result;
+}
+
+/* Move as many of "items" into the pool as fit. */
+static void
+ldb_arenapool_put(ldb_arenapool_t *pool, ldb_vector_t *list,
+                                         ldb_vector_t *items,
+                                         size_t size) {
+  ldb_mutex_lock(&pool->mutex);
+
+  while (items->length > 0 && pool->size + size <= pool->capacity) {
+    ldb_vector_push(list, ldb_vector_pop(items));
+    pool->size += size;
+  }
+
+  ldb_mutex_unlock(&pool->mutex);
+}
+
 /*
  * Arena
  */
@@ -35,16 +111,43 @@ ldb_arena_init(ldb_arena_t *arena) {
 
   ldb_atomic_init(&arena->usage, 0);
   ldb_vector_init(&arena->blocks);
+  ldb_vector_init(&arena->large);
+  ldb_vector_init(&arena->pages);
+
+  arena->pool = NULL;
+  arena->use_pages = 0;
+}
+
+void
+ldb_arena_init_pool(ldb_arena_t *arena, ldb_arenapool_t *pool) {
+  ldb_arena_init(arena);
+
+  arena->pool = pool;
+  arena->use_pages = (pool->page_size > 0);
 }
 
 void
 ldb_arena_clear(ldb_arena_t *arena) {
+  ldb_arenapool_t *pool = arena->pool;
   size_t i;
 
+  if (pool != NULL) {
+    ldb_arenapool_put(pool, &pool->pages, &arena->pages, pool->page_size);
+    ldb_arenapool_put(pool, &pool->blocks, &arena->blocks, LDB_ARENA_BLOCK);
+  }
+
   for (i = 0; i < arena->blocks.length; i++)
     ldb_free(arena->blocks.items[i]);
 
+  for (i = 0; i < arena->large.length; i++)
+    ldb_free(arena->large.items[i]);
+
+  for (i = 0; i < arena->pages.length; i++)
+    ldb_pages_free(arena->pages.items[i], pool->page_size);
+
   ldb_vector_clear(&arena->blocks);
+  ldb_vector_clear(&arena->large);
+  ldb_vector_clear(&arena->pages);
 }
 
 size_t
@@ -53,10 +156,10 @@ ldb_arena_usage(const ldb_arena_t *arena) {
 }
 
 static void *
-ldb_arena_alloc_block(ldb_arena_t *arena, size_t size) {
+ldb_arena_alloc_large(ldb_arena_t *arena, size_t size) {
   void *result = ldb_malloc(size);
 
-  ldb_vector_push(&arena->blocks, result);
+  ldb_vector_push(&arena->large, result);
 
   ldb_atomic_fetch_add(&arena->usage,
                        size + sizeof(void *),
@@ -65,19 +168,76 @@ ldb_arena_alloc_block(ldb_arena_t *arena, size_t size) {
   return result;
 }
 
+static void *
+ldb_arena_alloc_block(ldb_arena_t *arena) {
+  void *result = NULL;
+
+  if (arena->pool != NULL)
+    result = ldb_arenapool_get(arena->pool, &arena->pool->blocks,
+                                            LDB_ARENA_BLOCK);
+
+  if (result == NULL)
+    result = ldb_malloc(LDB_ARENA_BLOCK);
+
+  ldb_vector_push(&arena->blocks, result);
+
+  ldb_atomic_fetch_add(&arena->usage,
+                       LDB_ARENA_BLOCK + sizeof(void *),
+                       ldb_order_relaxed);
+
+  return result;
+}
+
+static void *
+ldb_arena_alloc_pages(ldb_arena_t *arena) {
+  ldb_arenapool_t *pool = arena->pool;
+  void *result;
+
+  result = ldb_arenapool_get(pool, &pool->pages, pool->page_size);
+
+  if (result == NULL)
+    result = ldb_pages_alloc(pool->page_size);
+
+  if (result == NULL) {
+    /* Stick to malloc from now on. */
+    arena->use_pages = 0;
+    return NULL;
+  }
+
+  ldb_vector_push(&arena->pages, result);
+
+  ldb_atomic_fetch_add(&arena->usage,
+                       pool->page_size,
+                       ldb_order_relaxed);
+
+  return result;
+}
+
 static void *
 ldb_arena_alloc_fallback(ldb_arena_t *arena, size_t size) {
   void *result;
 
+  if (arena->use_pages && size <= arena->pool->page_size / 4) {
+    result = ldb_arena_alloc_pages(arena);
+
+    if (result != NULL) {
+      arena->data = result;
+      arena->left = arena->pool->page_size;
+      arena->data += size;
+      arena->left -= size;
+      return result;
+    }
+  }
+
   if (size > LDB_ARENA_BLOCK / 4) {
     /* Object is more than a quarter of our block size.
        Allocate it separately to avoid wasting too much
        space in leftover bytes. */
-    return ldb_arena_alloc_block(arena, size);
+    return ldb_arena_alloc_large(arena, size);
   }
 
   /* We waste the remaining space in the current block. */
-  arena->data = ldb_arena_alloc_block(arena, LDB_ARENA_BLOCK);
+  arena->data = ldb_arena_alloc_block(arena);
   arena->left = LDB_ARENA_BLOCK;
 
   result = arena->data;
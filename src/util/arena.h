@@ -17,12 +17,24 @@
 #include <stdint.h>
 #include "atomic.h"
 #include "internal.h"
+#include "port.h"
 #include "types.h"
 
 /*
  * Types
  */
 
+/* Memory released by cleared arenas, kept for the next ones. Many
+   arenas (e.g. the memtables of a database) may share a pool. */
+typedef struct ldb_arenapool_s {
+  ldb_mutex_t mutex;
+  ldb_vector_t blocks; /* Spare blocks. */
+  ldb_vector_t pages; /* Spare mapped regions. */
+  size_t page_size; /* Size of mapped regions (zero for none). */
+  size_t capacity; /* Maximum number of bytes kept. */
+  size_t size; /* Number of bytes kept. */
+} ldb_arenapool_t;
+
 typedef struct ldb_arena_s {
   /* Allocation state. */
   uint8_t *data;
@@ -31,8 +43,34 @@ typedef struct ldb_arena_s {
   ldb_atomic(size_t) usage;
   /* Array of allocated memory blocks. */
   ldb_vector_t blocks;
+  /* Array of objects allocated separately. */
+  ldb_vector_t large;
+  /* Array of mapped regions (see ldb_arenapool_init()). */
+  ldb_vector_t pages;
+  ldb_arenapool_t *pool;
+  int use_pages;
 } ldb_arena_t;
 
+/*
+ * Arena Pool
+ */
+
+/* Keep up to "capacity" bytes of released memory. If "page_size" is
+   non-zero, arenas using the pool carve small allocations out of
+   regions of that many bytes mapped with ldb_pages_alloc() rather
+   than out of small malloc'd blocks. */
+void
+ldb_arenapool_init(ldb_arenapool_t *pool, size_t page_size,
+                                          size_t capacity);
+
+/* REQUIRES: No arena is using the pool. */
+void
+ldb_arenapool_clear(ldb_arenapool_t *pool);
+
+/* Number of bytes currently kept by the pool. */
+size_t
+ldb_arenapool_size(ldb_arenapool_t *pool);
+
 /*
  * Arena
  */
@@ -40,6 +78,10 @@ typedef struct ldb_arena_s {
 void
 ldb_arena_init(ldb_arena_t *arena);
 
+/* Like init(), but take memory from (and return it to) a pool. */
+void
+ldb_arena_init_pool(ldb_arena_t *arena, ldb_arenapool_t *pool);
+
 void
 ldb_arena_clear(ldb_arena_t *arena);
 
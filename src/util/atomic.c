@@ -245,6 +245,29 @@ ldb_atomic__compare_exchange(volatile ldb_word_t *object,
 #endif
 }
 
+int
+ldb_atomic__compare_exchange_ptr(void *volatile *object,
+                                 void **expected,
+                                 void *desired) {
+  void *old = *expected;
+#if defined(USE_INTRIN) && defined(_WIN64)
+  *expected = _InterlockedCompareExchangePointer(object, desired, old);
+#elif defined(USE_INTRIN)
+  *expected = (void *)_InterlockedCompareExchange((volatile long *)object,
+                                                 (long)desired,
+                                                 (long)old);
+#elif defined(_WIN64)
+  /* Windows XP and above. */
+  *expected = InterlockedCompareExchangePointer(object, desired, old);
+#else
+  /* Windows 98 and above. */
+  *expected = (void *)InterlockedCompareExchange((volatile long *)object,
+                                                 (long)desired,
+                                                 (long)old);
+#endif
+  return *expected == old;
+}
+
 ldb_word_t
 ldb_atomic__fetch_add(volatile ldb_word_t *object, ldb_word_t operand) {
 #if defined(USE_INTRIN) && defined(_WIN64)
@@ -114,6 +114,13 @@
 #  define LDB_PTHREAD_ATOMICS
 #endif
 
+#if (defined(LDB_STD_ATOMICS)  \
+  || defined(LDB_GNUC_ATOMICS) \
+  || defined(LDB_SYNC_ATOMICS) \
+  || defined(LDB_MSVC_ATOMICS))
+#  define LDB_HAVE_ATOMIC_PTR_CAS
+#endif
+
 /*
  * Types
  */
@@ -225,6 +232,8 @@ ldb_atomic_compare_exchange(_Atomic(intptr_t) *object,
   return expected;
 }
 
+#define ldb_atomic_compare_exchange_ptr atomic_compare_exchange_strong
+
 #define ldb_atomic_fetch_add atomic_fetch_add_explicit
 #define ldb_atomic_fetch_sub atomic_fetch_sub_explicit
 
@@ -250,6 +259,9 @@ __extension__ ({                                                \
   _exp;                                                         \
 })
 
+#define ldb_atomic_compare_exchange_ptr(object, expected, desired) \
+  __atomic_compare_exchange_n(object, expected, desired, 0, 5, 5)
+
 #define ldb_atomic_fetch_add __atomic_fetch_add
 #define ldb_atomic_fetch_sub __atomic_fetch_sub
 
@@ -301,6 +313,13 @@ __extension__ ({                                                \
 
 #define ldb_atomic_compare_exchange __sync_val_compare_and_swap
 
+#define ldb_atomic_compare_exchange_ptr(object, expected, desired) \
+__extension__ ({                                                   \
+  __typeof__(**(object)) *_exp = *(expected);                      \
+  *(expected) = __sync_val_compare_and_swap(object, _exp, desired); \
+  *(expected) == _exp;                                             \
+})
+
 #define ldb_atomic_fetch_add(object, operand, order) \
   __sync_fetch_and_add(object, operand)
 
@@ -779,6 +798,11 @@ ldb_atomic__compare_exchange(volatile ldb_word_t *object,
                              ldb_word_t expected,
                              ldb_word_t desired);
 
+int
+ldb_atomic__compare_exchange_ptr(void *volatile *object,
+                                 void **expected,
+                                 void *desired);
+
 ldb_word_t
 ldb_atomic__fetch_add(volatile ldb_word_t *object, ldb_word_t operand);
 
@@ -797,6 +821,11 @@ ldb_atomic__fetch_add(volatile ldb_word_t *object, ldb_word_t operand);
 #define ldb_atomic_exchange ldb_atomic__exchange
 #define ldb_atomic_compare_exchange ldb_atomic__compare_exchange
 
+#define ldb_atomic_compare_exchange_ptr(object, expected, desired) \
+  ldb_atomic__compare_exchange_ptr((void *volatile *)(object),     \
+                                   (void **)(expected),            \
+                                   (void *)(desired))
+
 #define ldb_atomic_fetch_add(object, operand, order) \
   ldb_atomic__fetch_add(object, operand)
 
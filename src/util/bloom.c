@@ -14,12 +14,30 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "array.h"
 #include "bloom.h"
 #include "buffer.h"
+#include "coding.h"
 #include "hash.h"
 #include "internal.h"
 #include "slice.h"
 
+/*
+ * SIMD
+ */
+
+#undef HAVE_SSE2
+#undef HAVE_NEON
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) \
+ || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define HAVE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#  include <arm_neon.h>
+#  define HAVE_NEON
+#endif
+
 /*
  * Bloom
  */
@@ -36,6 +54,20 @@ ldb_bloom_destroy(ldb_bloom_t *bloom) {
   ldb_free(bloom);
 }
 
+ldb_bloom_t *
+ldb_bloom_create_blocked(int bits_per_key) {
+  ldb_bloom_t *bloom = ldb_malloc(sizeof(ldb_bloom_t));
+  ldb_bloom_init_blocked(bloom, bits_per_key);
+  return bloom;
+}
+
+ldb_bloom_t *
+ldb_bloom_create_xor(void) {
+  ldb_bloom_t *bloom = ldb_malloc(sizeof(ldb_bloom_t));
+  ldb_bloom_init_xor(bloom);
+  return bloom;
+}
+
 void
 ldb_bloom_init(ldb_bloom_t *bloom, int bits_per_key) {
   /* We intentionally round down to reduce probing cost a little bit. */
@@ -165,6 +197,439 @@ bloom_match(const ldb_bloom_t *bloom,
   return 1;
 }
 
+/*
+ * Blocked Bloom
+ */
+
+/* A blocked bloom filter confines all probes for a key to a single
+   64 byte line (512 bits), so a lookup touches one cache line no
+   matter how many probes are made. This costs slightly more space
+   for the same false positive rate. */
+#define LDB_BLOOM_LINE 64
+#define LDB_BLOOM_LINE_BITS (LDB_BLOOM_LINE * 8)
+
+static uint32_t
+blocked_mix(uint32_t h) {
+  /* Finalizer from MurmurHash3. Our line and in-line probe
+     positions are both derived from the same 32 bit hash. */
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+static size_t
+blocked_lines(const ldb_bloom_t *bloom, size_t n) {
+  size_t bits = n * bloom->bits_per_key;
+  size_t lines = (bits + LDB_BLOOM_LINE_BITS - 1) / LDB_BLOOM_LINE_BITS;
+
+  return lines == 0 ? 1 : lines;
+}
+
+static const uint8_t *
+blocked_line(const uint8_t *data, size_t lines, uint32_t hash) {
+  /* Map the hash onto [0, lines) without a division. */
+  size_t index = ((uint64_t)hash * lines) >> 32;
+
+  return data + index * LDB_BLOOM_LINE;
+}
+
+static void
+blocked_mask(uint8_t *mask, uint32_t hash, size_t k) {
+  uint32_t h = blocked_mix(hash);
+  uint32_t delta = (h >> 17) | (h << 15); /* Rotate right 17 bits. */
+  size_t i;
+
+  memset(mask, 0, LDB_BLOOM_LINE);
+
+  for (i = 0; i < k; i++) {
+    uint32_t pos = h >> 23; /* 9 bits. */
+
+    mask[pos / 8] |= (1 << (pos % 8));
+
+    h += delta;
+  }
+}
+
+static int
+blocked_test(const uint8_t *line, const uint8_t *mask) {
+  /* Check (line & mask) == mask for the whole line at once. */
+#if defined(HAVE_SSE2)
+  __m128i acc = _mm_set1_epi8(-1);
+  int i;
+
+  for (i = 0; i < LDB_BLOOM_LINE; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(const void *)(line + i));
+    __m128i m = _mm_loadu_si128((const __m128i *)(const void *)(mask + i));
+
+    acc = _mm_and_si128(acc, _mm_cmpeq_epi8(_mm_and_si128(x, m), m));
+  }
+
+  return _mm_movemask_epi8(acc) == 0xffff;
+#elif defined(HAVE_NEON)
+  uint8x16_t acc = vdupq_n_u8(0xff);
+  uint64x2_t r;
+  int i;
+
+  for (i = 0; i < LDB_BLOOM_LINE; i += 16) {
+    uint8x16_t x = vld1q_u8(line + i);
+    uint8x16_t m = vld1q_u8(mask + i);
+
+    acc = vandq_u8(acc, vceqq_u8(vandq_u8(x, m), m));
+  }
+
+  r = vreinterpretq_u64_u8(acc);
+
+  return (vgetq_lane_u64(r, 0) & vgetq_lane_u64(r, 1)) == UINT64_MAX;
+#else
+  int i;
+
+  for (i = 0; i < LDB_BLOOM_LINE; i++) {
+    if ((line[i] & mask[i]) != mask[i])
+      return 0;
+  }
+
+  return 1;
+#endif
+}
+
+static void
+blocked_build(const ldb_bloom_t *bloom,
+              ldb_buffer_t *dst,
+              const ldb_slice_t *keys,
+              size_t length) {
+  size_t lines = blocked_lines(bloom, length);
+  size_t bytes = lines * LDB_BLOOM_LINE;
+  uint8_t mask[LDB_BLOOM_LINE];
+  uint8_t *data;
+  size_t i, j;
+
+  data = ldb_buffer_pad(dst, bytes + 1);
+
+  for (i = 0; i < length; i++) {
+    uint32_t hash = bloom_hash(&keys[i]);
+    uint8_t *line = (uint8_t *)blocked_line(data, lines, hash);
+
+    blocked_mask(mask, hash, bloom->k);
+
+    for (j = 0; j < LDB_BLOOM_LINE; j++)
+      line[j] |= mask[j];
+  }
+
+  data[bytes] = bloom->k; /* Remember # of probes in filter. */
+}
+
+static int
+blocked_match(const ldb_bloom_t *bloom,
+              const ldb_slice_t *filter,
+              const ldb_slice_t *key) {
+  const uint8_t *data = filter->data;
+  size_t len = filter->size;
+  uint8_t mask[LDB_BLOOM_LINE];
+  uint32_t hash;
+  size_t k;
+
+  (void)bloom;
+
+  if (len < LDB_BLOOM_LINE + 1 || (len - 1) % LDB_BLOOM_LINE != 0)
+    return 1; /* Not a filter we wrote. Consider it a match. */
+
+  k = data[len - 1];
+
+  if (k > 30) {
+    /* Reserved for potentially new encodings. Consider it a match. */
+    return 1;
+  }
+
+  hash = bloom_hash(key);
+
+  blocked_mask(mask, hash, k);
+
+  return blocked_test(blocked_line(data, (len - 1) / LDB_BLOOM_LINE, hash),
+                      mask);
+}
+
+static const ldb_bloom_t bloom_blocked = {
+  /* .name = */ "lcdb.BlockedBloomFilter",
+  /* .build = */ blocked_build,
+  /* .match = */ blocked_match,
+  /* .bits_per_key = */ 10,
+  /* .k = */ 6,
+  /* .user_policy = */ NULL,
+  /* .state = */ NULL
+};
+
+void
+ldb_bloom_init_blocked(ldb_bloom_t *bloom, int bits_per_key) {
+  ldb_bloom_init(bloom, bits_per_key);
+
+  bloom->name = bloom_blocked.name;
+  bloom->build = bloom_blocked.build;
+  bloom->match = bloom_blocked.match;
+}
+
+/*
+ * Xor Filter
+ */
+
+/* An xor filter [Graf, Lemire 2019] with 8 bit fingerprints. Every key
+ * maps to three slots (one in each third of a table of roughly 1.23n
+ * fingerprints) whose xor equals the key's fingerprint. This gives a
+ * false positive rate of ~0.4% at ~9.9 bits per key, where a bloom
+ * filter needs ~11.5 bits per key for the same rate.
+ *
+ * Construction needs every key up front and has a fixed overhead per
+ * filter, so this is best paired with a whole-table filter (see the
+ * full_filter option).
+ *
+ * Layout:
+ *
+ *   fingerprints: uint8[3 * block_length]
+ *   seed: fixed32
+ *   block_length: fixed32
+ *   tag: uint8 (fingerprint bits, always 8)
+ */
+#define LDB_XOR_TRAILER 9
+#define LDB_XOR_TAG 8
+#define LDB_XOR_TRIES 100
+
+static uint64_t
+xor_mix(uint32_t hash, uint32_t seed) {
+  /* Finalizer from MurmurHash3 (64 bit). */
+  uint64_t h = ((uint64_t)seed << 32) | hash;
+
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+
+  return h;
+}
+
+static uint32_t
+xor_reduce(uint32_t hash, uint32_t n) {
+  return ((uint64_t)hash * n) >> 32;
+}
+
+static void
+xor_slots(uint32_t *slots, uint64_t h, uint32_t block_length) {
+  uint32_t r0 = (uint32_t)h;
+  uint32_t r1 = (uint32_t)((h << 21) | (h >> 43));
+  uint32_t r2 = (uint32_t)((h << 42) | (h >> 22));
+
+  slots[0] = xor_reduce(r0, block_length);
+  slots[1] = xor_reduce(r1, block_length) + block_length;
+  slots[2] = xor_reduce(r2, block_length) + 2 * block_length;
+}
+
+#define xor_fingerprint(h) ((uint8_t)((h) ^ ((h) >> 32)))
+
+static int
+xor_compare(uint64_t x, uint64_t y) {
+  return (x > y) - (x < y);
+}
+
+/* Try to build the filter with the given seed. Returns false if the
+   keys could not be peeled (rare), in which case another seed works. */
+static int
+xor_populate(uint8_t *fp,
+             const ldb_array_t *hashes,
+             uint32_t block_length,
+             uint32_t seed) {
+  uint32_t capacity = 3 * block_length;
+  size_t n = hashes->length;
+  size_t queue_size = capacity + 3 * n;
+  uint64_t *xormask = ldb_malloc(capacity * sizeof(uint64_t));
+  uint32_t *count = ldb_malloc(capacity * sizeof(uint32_t));
+  uint32_t *queue = ldb_malloc(queue_size * sizeof(uint32_t));
+  uint64_t *stack_hash = ldb_malloc((n + 1) * sizeof(uint64_t));
+  uint32_t *stack_slot = ldb_malloc((n + 1) * sizeof(uint32_t));
+  size_t qlen = 0;
+  size_t slen = 0;
+  uint32_t slots[3];
+  size_t i, j;
+  int ok;
+
+  memset(xormask, 0, capacity * sizeof(uint64_t));
+  memset(count, 0, capacity * sizeof(uint32_t));
+  memset(fp, 0, capacity);
+
+  for (i = 0; i < n; i++) {
+    uint64_t h = xor_mix(hashes->items[i], seed);
+
+    xor_slots(slots, h, block_length);
+
+    for (j = 0; j < 3; j++) {
+      xormask[slots[j]] ^= h;
+      count[slots[j]]++;
+    }
+  }
+
+  for (i = 0; i < capacity; i++) {
+    if (count[i] == 1)
+      queue[qlen++] = i;
+  }
+
+  /* Peel off slots which are referenced by exactly one key. */
+  while (qlen > 0) {
+    uint32_t slot = queue[--qlen];
+    uint64_t h;
+
+    if (count[slot] != 1)
+      continue;
+
+    h = xormask[slot];
+
+    stack_hash[slen] = h;
+    stack_slot[slen] = slot;
+    slen++;
+
+    xor_slots(slots, h, block_length);
+
+    for (j = 0; j < 3; j++) {
+      xormask[slots[j]] ^= h;
+
+      if (--count[slots[j]] == 1)
+        queue[qlen++] = slots[j];
+    }
+  }
+
+  ok = (slen == n);
+
+  if (ok) {
+    /* Assign fingerprints in reverse peeling order. Each key's own
+       slot is still zero at this point, so it does not disturb
+       the xor of the other two. */
+    while (slen > 0) {
+      uint64_t h = stack_hash[--slen];
+
+      xor_slots(slots, h, block_length);
+
+      fp[stack_slot[slen]] = xor_fingerprint(h)
+                           ^ fp[slots[0]]
+                           ^ fp[slots[1]]
+                           ^ fp[slots[2]];
+    }
+  }
+
+  ldb_free(xormask);
+  ldb_free(count);
+  ldb_free(queue);
+  ldb_free(stack_hash);
+  ldb_free(stack_slot);
+
+  return ok;
+}
+
+static void
+xor_build(const ldb_bloom_t *bloom,
+          ldb_buffer_t *dst,
+          const ldb_slice_t *keys,
+          size_t length) {
+  uint32_t block_length, seed;
+  ldb_array_t hashes;
+  uint8_t *data;
+  size_t i, j;
+
+  (void)bloom;
+
+  ldb_array_init(&hashes);
+  ldb_array_grow(&hashes, length);
+
+  for (i = 0; i < length; i++)
+    ldb_array_push(&hashes, bloom_hash(&keys[i]));
+
+  /* Peeling requires distinct keys. Keys which collide on the
+     32 bit hash are indistinguishable to the filter anyway. */
+  ldb_array_sort(&hashes, xor_compare);
+
+  for (i = 0, j = 0; i < hashes.length; i++) {
+    if (j == 0 || hashes.items[i] != hashes.items[j - 1])
+      hashes.items[j++] = hashes.items[i];
+  }
+
+  hashes.length = j;
+
+  if (hashes.length == 0) {
+    data = ldb_buffer_pad(dst, LDB_XOR_TRAILER);
+    data[LDB_XOR_TRAILER - 1] = LDB_XOR_TAG;
+    ldb_array_clear(&hashes);
+    return;
+  }
+
+  block_length = (32 + (123 * hashes.length + 99) / 100 + 2) / 3;
+
+  data = ldb_buffer_pad(dst, 3 * block_length + LDB_XOR_TRAILER);
+
+  for (seed = 0; seed < LDB_XOR_TRIES; seed++) {
+    if (xor_populate(data, &hashes, block_length, seed))
+      break;
+  }
+
+  data += 3 * block_length;
+
+  ldb_fixed32_write(data + 0, seed);
+  ldb_fixed32_write(data + 4, block_length);
+
+  /* An unknown tag is treated as "always match". */
+  data[8] = seed < LDB_XOR_TRIES ? LDB_XOR_TAG : 0xff;
+
+  ldb_array_clear(&hashes);
+}
+
+static int
+xor_match(const ldb_bloom_t *bloom,
+          const ldb_slice_t *filter,
+          const ldb_slice_t *key) {
+  const uint8_t *data = filter->data;
+  size_t len = filter->size;
+  uint32_t seed, block_length;
+  uint32_t slots[3];
+  uint64_t h;
+
+  (void)bloom;
+
+  if (len < LDB_XOR_TRAILER || data[len - 1] != LDB_XOR_TAG)
+    return 1; /* Reserved for new encodings. Consider it a match. */
+
+  seed = ldb_fixed32_decode(data + len - LDB_XOR_TRAILER);
+  block_length = ldb_fixed32_decode(data + len - LDB_XOR_TRAILER + 4);
+
+  if (block_length == 0)
+    return 0; /* No keys. */
+
+  if ((len - LDB_XOR_TRAILER) / 3 != block_length ||
+      (len - LDB_XOR_TRAILER) % 3 != 0) {
+    return 1;
+  }
+
+  h = xor_mix(bloom_hash(key), seed);
+
+  xor_slots(slots, h, block_length);
+
+  return xor_fingerprint(h) == (data[slots[0]]
+                              ^ data[slots[1]]
+                              ^ data[slots[2]]);
+}
+
+static const ldb_bloom_t bloom_xor = {
+  /* .name = */ "lcdb.XorFilter8",
+  /* .build = */ xor_build,
+  /* .match = */ xor_match,
+  /* .bits_per_key = */ 10,
+  /* .k = */ 3,
+  /* .user_policy = */ NULL,
+  /* .state = */ NULL
+};
+
+void
+ldb_bloom_init_xor(ldb_bloom_t *bloom) {
+  *bloom = bloom_xor;
+}
+
 /*
  * Default
  */
@@ -104,6 +104,30 @@ ldb_bloom_destroy(ldb_bloom_t *bloom);
 LDB_EXTERN void
 ldb_bloom_init(ldb_bloom_t *bloom, int bits_per_key);
 
+/* Return a new filter policy that uses a cache-blocked bloom filter:
+ * every probe for a key falls within the same 64 byte line, making
+ * lookups cheaper at the cost of a slightly higher false positive
+ * rate for a given bits_per_key. Filters built by this policy are
+ * not compatible with those of ldb_bloom_create().
+ */
+LDB_EXTERN ldb_bloom_t *
+ldb_bloom_create_blocked(int bits_per_key);
+
+LDB_EXTERN void
+ldb_bloom_init_blocked(ldb_bloom_t *bloom, int bits_per_key);
+
+/* Return a new filter policy that uses an xor filter with 8 bit
+ * fingerprints: a ~0.4% false positive rate at ~9.9 bits per key.
+ * An xor filter is built from all of its keys at once, so it should
+ * be used with the full_filter option (one filter per table) rather
+ * than the default of one filter per 2KB of data.
+ */
+LDB_EXTERN ldb_bloom_t *
+ldb_bloom_create_xor(void);
+
+LDB_EXTERN void
+ldb_bloom_init_xor(ldb_bloom_t *bloom);
+
 int
 ldb_bloom_name(char *buf, size_t size, const ldb_bloom_t *bloom);
 
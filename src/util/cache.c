@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "atomic.h"
 #include "cache.h"
 #include "hash.h"
 #include "internal.h"
@@ -28,20 +29,32 @@
  * entry being passed to its "deleter" are via erase(), via insert() when
  * an element with a duplicate key is inserted, or on destruction of the cache.
  *
- * The cache keeps two linked lists of items in the cache. All items in the
- * cache are in one list or the other, and never both. Items still referenced
- * by clients but erased from the cache are in neither list. The lists are:
+ * Every item in the cache is on exactly one list, whether or not clients
+ * hold references to it. Items still referenced by clients but erased from
+ * the cache are on no list.
  *
- * - in-use: contains the items currently referenced by clients, in no
- *   particular order. (This list is used for invariant checking. If we
- *   removed the check, elements that would otherwise be on this list could be
- *   left as disconnected singleton lists.)
+ * The reference count is atomic and lookup() does not touch the lists:
+ * it bumps the count and the entry's saturating "hit" counter under the
+ * shard mutex. release() takes no lock at all. List maintenance is deferred
+ * to eviction, which works like a multi-bit CLOCK: starting from the oldest
+ * item, an item that is still referenced is skipped, an item with a nonzero
+ * hit counter gets another chance (the counter is decremented and the item
+ * moves to the newest end), and anything else is evicted.
  *
- * - LRU: contains the items not currently referenced by clients, in LRU order
+ * With the midpoint policy there are two lists:
  *
- * Elements are moved between these lists by the ref() and unref() methods,
- * when they detect an element in the cache acquiring or losing its only
- * external reference.
+ * - hot: items which were looked up again after being inserted. Eviction
+ *   moves them here instead of giving them a second chance in place. Its
+ *   total charge is limited to a fraction of the capacity; the oldest
+ *   items are demoted to the cold list.
+ *
+ * - cold: everything else. New items always start here and are evicted
+ *   from here first, so a scan which touches each block once cannot push
+ *   the hot items out of the cache.
+ *
+ * Items may also be inserted with a priority: low priority items start
+ * at the oldest end of the cold list, and high priority items start
+ * with a full hit counter (on the hot list, with the midpoint policy).
  */
 
 /*
@@ -49,7 +62,9 @@
  */
 
 #define LDB_SHARD_BITS 4
-#define LDB_SHARDS (1 << LDB_SHARD_BITS)
+#define LDB_MAX_SHARD_BITS 16
+#define LDB_HOT_PERCENT 50
+#define LDB_MAX_HITS 3
 
 /*
  * LRUHandle
@@ -68,7 +83,9 @@ typedef struct lru_handle_s {
   size_t charge;
   size_t key_length;
   int in_cache;        /* Whether entry is in the cache. */
-  uint32_t refs;       /* References, including cache reference, if present. */
+  int in_hot;          /* Whether entry is on the hot list. */
+  int hit;             /* Lookups since last visited by eviction. */
+  ldb_atomic(int) refs; /* References, including cache reference. */
   uint32_t hash;       /* Hash of key(); used for fast sharding & comparisons */
   uint8_t key_data[1]; /* Beginning of key. */
 } lru_handle_t;
@@ -229,21 +246,30 @@ lru_table_remove(lru_table_t *tbl, const ldb_slice_t *key, uint32_t hash) {
 typedef struct lru_shard_s {
   /* Initialized before use. */
   size_t capacity;
+  size_t hot_capacity;
+  enum ldb_lru_policy policy;
 
   /* mutex protects the following state. */
   ldb_mutex_t mutex;
   size_t usage;
 
-  /* Dummy head of LRU list. */
+  /* Dummy head of cold list. */
   /* list.prev is newest entry, list.next is oldest entry. */
-  /* Entries have refs==1 and in_cache==1. */
+  /* Entries have in_cache==1 and in_hot==0. */
   lru_handle_t list;
 
-  /* Dummy head of in-use list. */
-  /* Entries are in use by clients, and have refs >= 2 and in_cache==1. */
-  lru_handle_t in_use;
+  /* Dummy head of hot list (midpoint policy only). */
+  /* Entries have in_cache==1 and in_hot==1. */
+  lru_handle_t hot;
+  size_t hot_usage;
 
   lru_table_t table;
+
+  /* Statistics, also protected by mutex. */
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t evictions;
 } lru_shard_t;
 
 static size_t
@@ -270,22 +296,22 @@ lru_shard_remove(lru_handle_t *e) {
   e->prev->next = e->next;
 }
 
-static void
-lru_shard_ref(lru_shard_t *lru, lru_handle_t *e) {
-  if (e->refs == 1 && e->in_cache) { /* If on lru->list, move to lru->in_use. */
-    lru_shard_remove(e);
-    lru_shard_append(&lru->in_use, e);
-  }
-  e->refs++;
+static int
+lru_handle_refs(lru_handle_t *e) {
+  return ldb_atomic_load(&e->refs, ldb_order_acquire);
 }
 
 static void
-lru_shard_unref(lru_shard_t *lru, lru_handle_t *e) {
-  assert(e->refs > 0);
-
-  e->refs--;
+lru_handle_ref(lru_handle_t *e) {
+  ldb_atomic_fetch_add(&e->refs, 1, ldb_order_relaxed);
+}
 
-  if (e->refs == 0) { /* Deallocate. */
+/* Drop a reference. Does not require the shard mutex: the cache holds
+   a reference to every entry in it, so only an entry which has already
+   left the cache can be deallocated here. */
+static void
+lru_handle_unref(lru_handle_t *e) {
+  if (ldb_atomic_fetch_sub(&e->refs, 1, ldb_order_acq_rel) == 1) {
     ldb_slice_t key = lru_handle_key(e);
 
     assert(!e->in_cache);
@@ -293,10 +319,37 @@ lru_shard_unref(lru_shard_t *lru, lru_handle_t *e) {
     e->deleter(&key, e->value);
 
     ldb_free(e);
-  } else if (e->in_cache && e->refs == 1) {
-    /* No longer in use; move to lru->list. */
-    lru_shard_remove(e);
-    lru_shard_append(&lru->list, e);
+  }
+}
+
+static void
+lru_shard_unhot(lru_shard_t *lru, lru_handle_t *e) {
+  if (e->in_hot) {
+    e->in_hot = 0;
+    lru->hot_usage -= e->charge;
+  }
+}
+
+/* Move an entry to the hot list, demoting the oldest hot entries
+   to the newest end of the cold list if it overflows. */
+static void
+lru_shard_promote(lru_shard_t *lru, lru_handle_t *e) {
+  e->in_hot = 1;
+  lru->hot_usage += e->charge;
+
+  lru_shard_append(&lru->hot, e);
+
+  while (lru->hot_usage > lru->hot_capacity) {
+    lru_handle_t *old = lru->hot.next;
+
+    assert(old != &lru->hot);
+
+    lru_shard_remove(old);
+    lru_shard_unhot(lru, old);
+
+    old->hit = 0;
+
+    lru_shard_append(&lru->list, old);
   }
 }
 
@@ -307,36 +360,47 @@ lru_shard_init(lru_shard_t *lru) {
   ldb_mutex_init(&lru->mutex);
 
   lru->capacity = 0;
+  lru->hot_capacity = 0;
+  lru->policy = LDB_LRU_DEFAULT;
   lru->usage = 0;
+  lru->hot_usage = 0;
+  lru->hits = 0;
+  lru->misses = 0;
+  lru->inserts = 0;
+  lru->evictions = 0;
 
   /* Make empty circular linked lists. */
   lru->list.next = &lru->list;
   lru->list.prev = &lru->list;
 
-  lru->in_use.next = &lru->in_use;
-  lru->in_use.prev = &lru->in_use;
+  lru->hot.next = &lru->hot;
+  lru->hot.prev = &lru->hot;
 
   lru_table_init(&lru->table);
 }
 
 static void
-lru_shard_clear(lru_shard_t *lru) {
+lru_shard_drain(lru_handle_t *list) {
   lru_handle_t *e, *next;
 
-  assert(lru->in_use.next == &lru->in_use); /* Error if caller has
-                                               an unreleased handle */
-
-  for (e = lru->list.next; e != &lru->list; e = next) {
+  for (e = list->next; e != list; e = next) {
     next = e->next;
 
     assert(e->in_cache);
 
     e->in_cache = 0;
 
-    assert(e->refs == 1); /* Invariant of lru->list. */
+    /* Error if caller has an unreleased handle. */
+    assert(lru_handle_refs(e) == 1);
 
-    lru_shard_unref(lru, e);
+    lru_handle_unref(e);
   }
+}
+
+static void
+lru_shard_clear(lru_shard_t *lru) {
+  lru_shard_drain(&lru->list);
+  lru_shard_drain(&lru->hot);
 
   lru_table_clear(&lru->table);
 
@@ -351,19 +415,20 @@ lru_shard_lookup(lru_shard_t *lru, const ldb_slice_t *key, uint32_t hash) {
 
   e = lru_table_lookup(&lru->table, key, hash);
 
-  if (e != NULL)
-    lru_shard_ref(lru, e);
+  if (e != NULL) {
+    lru_handle_ref(e);
 
-  ldb_mutex_unlock(&lru->mutex);
+    if (e->hit < LDB_MAX_HITS)
+      e->hit++;
 
-  return e;
-}
+    lru->hits++;
+  } else {
+    lru->misses++;
+  }
 
-static void
-lru_shard_release(lru_shard_t *lru, lru_handle_t *handle) {
-  ldb_mutex_lock(&lru->mutex);
-  lru_shard_unref(lru, handle);
   ldb_mutex_unlock(&lru->mutex);
+
+  return e;
 }
 
 /* If e != NULL, finish removing *e from the cache; it has already been
@@ -374,17 +439,27 @@ lru_shard_finish(lru_shard_t *lru, lru_handle_t *e) {
     assert(e->in_cache);
 
     lru_shard_remove(e);
+    lru_shard_unhot(lru, e);
 
     e->in_cache = 0;
 
     lru->usage -= e->charge;
 
-    lru_shard_unref(lru, e);
+    lru_handle_unref(e);
   }
 
   return e != NULL;
 }
 
+static void
+lru_shard_evict_one(lru_shard_t *lru, lru_handle_t *e) {
+  ldb_slice_t key = lru_handle_key(e);
+
+  assert(lru_handle_refs(e) == 1);
+
+  lru_shard_finish(lru, lru_table_remove(&lru->table, &key, e->hash));
+}
+
 static void
 lru_shard_erase(lru_shard_t *lru, const ldb_slice_t *key, uint32_t hash) {
   ldb_mutex_lock(&lru->mutex);
@@ -392,21 +467,72 @@ lru_shard_erase(lru_shard_t *lru, const ldb_slice_t *key, uint32_t hash) {
   ldb_mutex_unlock(&lru->mutex);
 }
 
+static void
+lru_shard_prune_list(lru_shard_t *lru, lru_handle_t *list) {
+  lru_handle_t *e, *next;
+
+  for (e = list->next; e != list; e = next) {
+    next = e->next;
+
+    if (lru_handle_refs(e) == 1)
+      lru_shard_evict_one(lru, e);
+  }
+}
+
 static void
 lru_shard_prune(lru_shard_t *lru) {
   ldb_mutex_lock(&lru->mutex);
 
-  while (lru->list.next != &lru->list) {
-    lru_handle_t *e = lru->list.next;
-    ldb_slice_t key = lru_handle_key(e);
+  lru_shard_prune_list(lru, &lru->list);
+  lru_shard_prune_list(lru, &lru->hot);
 
-    assert(e->refs == 1);
+  ldb_mutex_unlock(&lru->mutex);
+}
 
-    lru_shard_finish(lru,
-      lru_table_remove(&lru->table, &key, e->hash));
-  }
+/* Advance the clock hand until usage fits in capacity. Gives up once
+   every hit counter could have run down, in case everything is
+   referenced. */
+static void
+lru_shard_evict(lru_shard_t *lru) {
+  uint64_t steps = (uint64_t)(LDB_MAX_HITS + 1) * lru->table.elems;
 
-  ldb_mutex_unlock(&lru->mutex);
+  while (lru->usage > lru->capacity && steps-- > 0) {
+    lru_handle_t *list = &lru->list;
+    lru_handle_t *e;
+
+    if (list->next == list)
+      list = &lru->hot;
+
+    e = list->next;
+
+    if (e == list)
+      break;
+
+    if (lru_handle_refs(e) > 1) {
+      /* Still in use. */
+      lru_shard_remove(e);
+      lru_shard_append(list, e);
+      continue;
+    }
+
+    if (e->hit > 0) {
+      /* Another chance. */
+      lru_shard_remove(e);
+
+      e->hit--;
+
+      if (lru->policy == LDB_LRU_MIDPOINT && !e->in_hot)
+        lru_shard_promote(lru, e);
+      else
+        lru_shard_append(list, e);
+
+      continue;
+    }
+
+    lru_shard_evict_one(lru, e);
+
+    lru->evictions++;
+  }
 }
 
 static lru_handle_t *
@@ -415,12 +541,9 @@ lru_shard_insert(lru_shard_t *lru,
                  uint32_t hash,
                  void *value,
                  size_t charge,
-                 void (*deleter)(const ldb_slice_t *key, void *value)) {
-  lru_handle_t *e;
-
-  ldb_mutex_lock(&lru->mutex);
-
-  e = ldb_malloc(sizeof(lru_handle_t) - 1 + key->size);
+                 void (*deleter)(const ldb_slice_t *key, void *value),
+                 enum ldb_lru_priority priority) {
+  lru_handle_t *e = ldb_malloc(sizeof(lru_handle_t) - 1 + key->size);
 
   e->value = value;
   e->deleter = deleter;
@@ -428,14 +551,26 @@ lru_shard_insert(lru_shard_t *lru,
   e->key_length = key->size;
   e->hash = hash;
   e->in_cache = 0;
-  e->refs = 1; /* For the returned handle. */
+  e->in_hot = 0;
+  e->hit = (priority == LDB_LRU_HIGH) ? LDB_MAX_HITS : 0;
+
+  ldb_atomic_init(&e->refs, 1); /* For the returned handle. */
 
   memcpy(e->key_data, key->data, key->size);
 
+  ldb_mutex_lock(&lru->mutex);
+
+  lru->inserts++;
+
   if (lru->capacity > 0) {
-    e->refs++; /* For the cache's reference. */
+    lru_handle_ref(e); /* For the cache's reference. */
     e->in_cache = 1;
-    lru_shard_append(&lru->in_use, e);
+
+    if (priority == LDB_LRU_HIGH && lru->policy == LDB_LRU_MIDPOINT)
+      lru_shard_promote(lru, e);
+    else if (priority != LDB_LRU_LOW)
+      lru_shard_append(&lru->list, e);
+
     lru->usage += charge;
     lru_shard_finish(lru, lru_table_insert(&lru->table, e));
   } else { /* Don't cache (capacity==0 is supported and turns off caching). */
@@ -443,19 +578,117 @@ lru_shard_insert(lru_shard_t *lru,
     e->next = NULL;
   }
 
-  while (lru->usage > lru->capacity && lru->list.next != &lru->list) {
-    lru_handle_t *old = lru->list.next;
-    ldb_slice_t old_key = lru_handle_key(old);
+  lru_shard_evict(lru);
+
+  /* A low priority entry is linked in as the oldest only once room has
+     been made; until then the caller's reference would have the clock
+     pass over it. */
+  if (e->in_cache && priority == LDB_LRU_LOW)
+    lru_shard_append(lru->list.next, e);
+
+  ldb_mutex_unlock(&lru->mutex);
+
+  return e;
+}
+
+static size_t
+lru_shard_pinned_list(lru_handle_t *list) {
+  size_t usage = 0;
+  lru_handle_t *e;
+
+  for (e = list->next; e != list; e = e->next) {
+    if (lru_handle_refs(e) > 1)
+      usage += e->charge;
+  }
+
+  return usage;
+}
+
+static size_t
+lru_shard_pinned_usage(lru_shard_t *lru) {
+  size_t usage;
+
+  ldb_mutex_lock(&lru->mutex);
+
+  usage = lru_shard_pinned_list(&lru->list)
+        + lru_shard_pinned_list(&lru->hot);
 
-    assert(old->refs == 1);
+  ldb_mutex_unlock(&lru->mutex);
 
-    lru_shard_finish(lru,
-      lru_table_remove(&lru->table, &old_key, old->hash));
+  return usage;
+}
+
+static void
+lru_shard_set_capacity(lru_shard_t *lru, size_t capacity) {
+  ldb_mutex_lock(&lru->mutex);
+
+  lru->capacity = capacity;
+  lru->hot_capacity = (capacity / 100) * LDB_HOT_PERCENT
+                    + (capacity % 100) * LDB_HOT_PERCENT / 100;
+
+  /* Demote the oldest hot entries which no longer fit. */
+  while (lru->hot_usage > lru->hot_capacity) {
+    lru_handle_t *old = lru->hot.next;
+
+    lru_shard_remove(old);
+    lru_shard_unhot(lru, old);
+
+    old->hit = 0;
+
+    lru_shard_append(&lru->list, old);
   }
 
+  lru_shard_evict(lru);
+
   ldb_mutex_unlock(&lru->mutex);
+}
 
-  return e;
+static size_t
+lru_shard_walk_list(lru_handle_t *list,
+                    size_t rank,
+                    void (*func)(void *,
+                                 const ldb_slice_t *,
+                                 size_t,
+                                 size_t),
+                    void *arg) {
+  lru_handle_t *e;
+
+  for (e = list->prev; e != list; e = e->prev) {
+    ldb_slice_t key = lru_handle_key(e);
+
+    func(arg, &key, e->charge, rank++);
+  }
+
+  return rank;
+}
+
+static void
+lru_shard_walk(lru_shard_t *lru,
+               void (*func)(void *, const ldb_slice_t *, size_t, size_t),
+               void *arg) {
+  size_t rank;
+
+  ldb_mutex_lock(&lru->mutex);
+
+  rank = lru_shard_walk_list(&lru->hot, 0, func, arg);
+
+  lru_shard_walk_list(&lru->list, rank, func, arg);
+
+  ldb_mutex_unlock(&lru->mutex);
+}
+
+static void
+lru_shard_stats(lru_shard_t *lru, ldb_lrustats_t *stats) {
+  ldb_mutex_lock(&lru->mutex);
+
+  stats->capacity = lru->capacity;
+  stats->usage = lru->usage;
+  stats->hits = lru->hits;
+  stats->misses = lru->misses;
+  stats->inserts = lru->inserts;
+  stats->evictions = lru->evictions;
+
+  ldb_mutex_unlock(&lru->mutex);
 }
 
 /*
@@ -463,7 +696,10 @@ lru_shard_insert(lru_shard_t *lru,
  */
 
 struct ldb_lru_s {
-  lru_shard_t shard[LDB_SHARDS];
+  lru_shard_t *shard;
+  int shard_bits;
+  int shards;
+  ldb_atomic(size_t) capacity;
   ldb_mutex_t id_mutex;
   uint64_t last_id;
 };
@@ -473,25 +709,57 @@ ldb_lru_hash(const ldb_slice_t *s) {
   return ldb_hash(s->data, s->size, 0);
 }
 
-static uint32_t
-ldb_lru_shard(uint32_t hash) {
-  return hash >> (32 - LDB_SHARD_BITS);
+static lru_shard_t *
+ldb_lru_shard(ldb_lru_t *lru, uint32_t hash) {
+  if (lru->shard_bits == 0)
+    return &lru->shard[0];
+
+  return &lru->shard[hash >> (32 - lru->shard_bits)];
 }
 
 ldb_lru_t *
 ldb_lru_create(size_t capacity) {
-  size_t per_shard = (capacity + LDB_SHARDS - 1) / LDB_SHARDS;
+  return ldb_lru_create_sharded(capacity, LDB_SHARD_BITS);
+}
+
+ldb_lru_t *
+ldb_lru_create_sharded(size_t capacity, int shard_bits) {
+  return ldb_lru_create_policy(capacity, shard_bits, LDB_LRU_DEFAULT);
+}
+
+ldb_lru_t *
+ldb_lru_create_policy(size_t capacity,
+                      int shard_bits,
+                      enum ldb_lru_policy policy) {
   ldb_lru_t *lru = ldb_malloc(sizeof(ldb_lru_t));
+  size_t per_shard;
   int i;
 
+  if (shard_bits < 0)
+    shard_bits = 0;
+
+  if (shard_bits > LDB_MAX_SHARD_BITS)
+    shard_bits = LDB_MAX_SHARD_BITS;
+
+  lru->shard_bits = shard_bits;
+  lru->shards = 1 << shard_bits;
+  lru->shard = ldb_malloc(lru->shards * sizeof(lru_shard_t));
+
   ldb_mutex_init(&lru->id_mutex);
 
   lru->last_id = 0;
 
-  for (i = 0; i < LDB_SHARDS; i++) {
+  ldb_atomic_store(&lru->capacity, capacity, ldb_order_relaxed);
+
+  per_shard = (capacity + lru->shards - 1) / lru->shards;
+
+  for (i = 0; i < lru->shards; i++) {
     lru_shard_init(&lru->shard[i]);
 
     lru->shard[i].capacity = per_shard;
+    lru->shard[i].hot_capacity = (per_shard / 100) * LDB_HOT_PERCENT
+                               + (per_shard % 100) * LDB_HOT_PERCENT / 100;
+    lru->shard[i].policy = policy;
   }
 
   return lru;
@@ -501,11 +769,12 @@ void
 ldb_lru_destroy(ldb_lru_t *lru) {
   int i;
 
-  for (i = 0; i < LDB_SHARDS; i++)
+  for (i = 0; i < lru->shards; i++)
     lru_shard_clear(&lru->shard[i]);
 
   ldb_mutex_destroy(&lru->id_mutex);
 
+  ldb_free(lru->shard);
   ldb_free(lru);
 }
 
@@ -515,28 +784,39 @@ ldb_lru_insert(ldb_lru_t *lru,
                void *value,
                size_t charge,
                void (*deleter)(const ldb_slice_t *key, void *value)) {
+  return ldb_lru_insert_priority(lru, key, value, charge,
+                                 deleter, LDB_LRU_NORMAL);
+}
+
+lru_handle_t *
+ldb_lru_insert_priority(ldb_lru_t *lru,
+                        const ldb_slice_t *key,
+                        void *value,
+                        size_t charge,
+                        void (*deleter)(const ldb_slice_t *key, void *value),
+                        enum ldb_lru_priority priority) {
   uint32_t hash = ldb_lru_hash(key);
-  lru_shard_t *shard = &lru->shard[ldb_lru_shard(hash)];
-  return lru_shard_insert(shard, key, hash, value, charge, deleter);
+  lru_shard_t *shard = ldb_lru_shard(lru, hash);
+  return lru_shard_insert(shard, key, hash, value, charge, deleter, priority);
 }
 
 lru_handle_t *
 ldb_lru_lookup(ldb_lru_t *lru, const ldb_slice_t *key) {
   uint32_t hash = ldb_lru_hash(key);
-  lru_shard_t *shard = &lru->shard[ldb_lru_shard(hash)];
+  lru_shard_t *shard = ldb_lru_shard(lru, hash);
   return lru_shard_lookup(shard, key, hash);
 }
 
 void
 ldb_lru_release(ldb_lru_t *lru, lru_handle_t *handle) {
-  lru_shard_t *shard = &lru->shard[ldb_lru_shard(handle->hash)];
-  lru_shard_release(shard, handle);
+  (void)lru;
+  lru_handle_unref(handle);
 }
 
 void
 ldb_lru_erase(ldb_lru_t *lru, const ldb_slice_t *key) {
   uint32_t hash = ldb_lru_hash(key);
-  lru_shard_t *shard = &lru->shard[ldb_lru_shard(hash)];
+  lru_shard_t *shard = ldb_lru_shard(lru, hash);
   lru_shard_erase(shard, key, hash);
 }
 
@@ -558,7 +838,7 @@ void
 ldb_lru_prune(ldb_lru_t *lru) {
   int i;
 
-  for (i = 0; i < LDB_SHARDS; i++)
+  for (i = 0; i < lru->shards; i++)
     lru_shard_prune(&lru->shard[i]);
 }
 
@@ -567,8 +847,59 @@ ldb_lru_usage(ldb_lru_t *lru) {
   size_t total = 0;
   int i;
 
-  for (i = 0; i < LDB_SHARDS; i++)
+  for (i = 0; i < lru->shards; i++)
     total += lru_shard_usage(&lru->shard[i]);
 
   return total;
 }
+
+size_t
+ldb_lru_pinned_usage(ldb_lru_t *lru) {
+  size_t total = 0;
+  int i;
+
+  for (i = 0; i < lru->shards; i++)
+    total += lru_shard_pinned_usage(&lru->shard[i]);
+
+  return total;
+}
+
+size_t
+ldb_lru_capacity(ldb_lru_t *lru) {
+  return ldb_atomic_load(&lru->capacity, ldb_order_relaxed);
+}
+
+void
+ldb_lru_set_capacity(ldb_lru_t *lru, size_t capacity) {
+  size_t per_shard = (capacity + lru->shards - 1) / lru->shards;
+  int i;
+
+  ldb_atomic_store(&lru->capacity, capacity, ldb_order_relaxed);
+
+  for (i = 0; i < lru->shards; i++)
+    lru_shard_set_capacity(&lru->shard[i], per_shard);
+}
+
+int
+ldb_lru_shards(ldb_lru_t *lru) {
+  return lru->shards;
+}
+
+void
+ldb_lru_walk(ldb_lru_t *lru,
+             void (*func)(void *arg,
+                          const ldb_slice_t *key,
+                          size_t charge,
+                          size_t rank),
+             void *arg) {
+  int i;
+
+  for (i = 0; i < lru->shards; i++)
+    lru_shard_walk(&lru->shard[i], func, arg);
+}
+
+void
+ldb_lru_stats(ldb_lru_t *lru, int index, ldb_lrustats_t *stats) {
+  assert(index >= 0 && index < lru->shards);
+  lru_shard_stats(&lru->shard[index], stats);
+}
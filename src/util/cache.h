@@ -24,9 +24,41 @@
 
 typedef struct ldb_lru_s ldb_lru_t;
 
+/* Replacement policies. */
+enum ldb_lru_policy {
+  /* Plain least-recently-used eviction. */
+  LDB_LRU_DEFAULT = 0,
+  /* Midpoint insertion: entries which are looked up again are kept
+     in a protected segment, so scans do not evict the working set. */
+  LDB_LRU_MIDPOINT = 1
+};
+
+/* Insertion priorities. */
+enum ldb_lru_priority {
+  /* Inserted as the oldest entry, so it is the first to be evicted
+     unless it is looked up again. */
+  LDB_LRU_LOW = 0,
+  /* Inserted as the newest entry. */
+  LDB_LRU_NORMAL = 1,
+  /* Inserted as the newest entry, with the hit count of an entry which
+     was looked up repeatedly (straight to the hot list under the
+     midpoint policy). */
+  LDB_LRU_HIGH = 2
+};
+
 /* Opaque handle to an entry stored in the cache. */
 typedef struct ldb_entry_s ldb_entry_t;
 
+/* Counters for a single cache shard. */
+typedef struct ldb_lrustats_s {
+  size_t capacity;
+  size_t usage;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t evictions;
+} ldb_lrustats_t;
+
 /*
  * Cache
  */
@@ -36,6 +68,18 @@ typedef struct ldb_entry_s ldb_entry_t;
 LDB_EXTERN ldb_lru_t *
 ldb_lru_create(size_t capacity);
 
+/* Like create(), but split the cache into 2^shard_bits shards, each with
+   its own lock. The default is 4 bits (16 shards). Values are clipped to
+   the range 0..16. */
+LDB_EXTERN ldb_lru_t *
+ldb_lru_create_sharded(size_t capacity, int shard_bits);
+
+/* Like create_sharded(), but also select the replacement policy. */
+LDB_EXTERN ldb_lru_t *
+ldb_lru_create_policy(size_t capacity,
+                      int shard_bits,
+                      enum ldb_lru_policy policy);
+
 /* Destroys all existing entries by calling the "deleter"
    function that was passed to the constructor. */
 LDB_EXTERN void
@@ -58,6 +102,16 @@ ldb_lru_insert(ldb_lru_t *lru,
                size_t charge,
                void (*deleter)(const ldb_slice_t *key, void *value));
 
+/* Like insert(), but with one of the priorities above (insert()
+   uses LDB_LRU_NORMAL). */
+ldb_entry_t *
+ldb_lru_insert_priority(ldb_lru_t *lru,
+                        const ldb_slice_t *key,
+                        void *value,
+                        size_t charge,
+                        void (*deleter)(const ldb_slice_t *key, void *value),
+                        enum ldb_lru_priority priority);
+
 /* If the cache has no mapping for "key", returns NULL.
  *
  * Else return a handle that corresponds to the mapping. The caller
@@ -111,4 +165,42 @@ ldb_lru_prune(ldb_lru_t *lru);
 size_t
 ldb_lru_usage(ldb_lru_t *lru);
 
+/* Return the combined charges of the elements currently referenced by
+   clients (and which therefore cannot be evicted). */
+size_t
+ldb_lru_pinned_usage(ldb_lru_t *lru);
+
+/* Return the capacity of the cache. */
+size_t
+ldb_lru_capacity(ldb_lru_t *lru);
+
+/* Change the capacity of the cache, evicting entries not in use until
+   the cache fits. */
+LDB_EXTERN void
+ldb_lru_set_capacity(ldb_lru_t *lru, size_t capacity);
+
+/* Return the number of shards. */
+int
+ldb_lru_shards(ldb_lru_t *lru);
+
+/* Call (*func)(arg, key, charge, rank) for every entry in the cache,
+ * one shard at a time. Within a shard, entries are visited from the
+ * most recently used to the least ("rank" counts up from zero), hot
+ * entries first. Entries of different shards with the same rank were
+ * used at about the same time.
+ *
+ * The shard is locked during the calls: "func" must not use the cache.
+ */
+void
+ldb_lru_walk(ldb_lru_t *lru,
+             void (*func)(void *arg,
+                          const ldb_slice_t *key,
+                          size_t charge,
+                          size_t rank),
+             void *arg);
+
+/* Take a snapshot of the counters of shard "index". */
+void
+ldb_lru_stats(ldb_lru_t *lru, int index, ldb_lrustats_t *stats);
+
 #endif /* LDB_CACHE_H */
@@ -0,0 +1,71 @@
+/*!
+ * cfilter.h - compaction filter for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_CFILTER_H
+#define LDB_CFILTER_H
+
+#include "types.h"
+
+/*
+ * Constants
+ */
+
+/* Decisions returned by a compaction filter. */
+enum ldb_cfilter_decision {
+  /* Write the entry out unchanged. */
+  LDB_CFILTER_KEEP = 0,
+  /* Delete the entry (older versions of the key are deleted too). */
+  LDB_CFILTER_REMOVE = 1,
+  /* Replace the value of the entry with *new_value. */
+  LDB_CFILTER_CHANGE = 2
+};
+
+/*
+ * Types
+ */
+
+/* A compaction filter is consulted for each live value a compaction
+ * rewrites, and may drop it or replace its value. This allows expired
+ * or otherwise unwanted entries to be garbage collected as a side
+ * effect of compaction, without issuing deletions for them.
+ *
+ * Values which may still be visible through a snapshot are never
+ * passed to the filter, nor are deletion markers. Filtering happens in
+ * the background, so the effects may not be visible for a long time;
+ * reads see the old value until then.
+ *
+ * REQUIRES: the filter must be thread-safe, as it may be called from
+ * several compactions at once.
+ */
+typedef struct ldb_cfilter_s {
+  /* The name of the compaction filter. Used for logging. */
+  const char *name;
+
+  /* Decide the fate of the entry "key" => "value", which is being
+   * compacted out of "level". Return one of the decisions above. To
+   * change the value, store a buffer allocated with ldb_malloc() in
+   * *new_value; the database takes ownership of it.
+   */
+  int (*filter)(const struct ldb_cfilter_s *filt,
+                int level,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value,
+                ldb_slice_t *new_value);
+
+  /* Extra state. */
+  void *state;
+} ldb_cfilter_t;
+
+/*
+ * Macros
+ */
+
+#define ldb_cfilter_filter(cf, level, key, value, new_value) \
+  (cf)->filter(cf, level, key, value, new_value)
+
+#endif /* LDB_CFILTER_H */
@@ -47,15 +47,10 @@ shortest_separator(const ldb_comparator_t *comparator,
                    const ldb_slice_t *limit) {
   /* Find length of common prefix. */
   size_t min_length = LDB_MIN(start->size, limit->size);
-  size_t diff_index = 0;
+  size_t diff_index = ldb_slice_shared(start, limit);
 
   (void)comparator;
 
-  while (diff_index < min_length &&
-         start->data[diff_index] == limit->data[diff_index]) {
-    diff_index++;
-  }
-
   if (diff_index >= min_length) {
     /* Do not shorten if one string is a prefix of the other. */
   } else {
@@ -96,6 +91,18 @@ static const ldb_comparator_t bytewise_comparator = {
   /* .state = */ NULL
 };
 
+/*
+ * Bytewise Fast Path
+ */
+
+int
+ldb_ikc_bytewise(const ldb_comparator_t *ikc,
+                 const ldb_slice_t *x,
+                 const ldb_slice_t *y) {
+  (void)ikc;
+  return ldb_bytewise_icompare(x, y);
+}
+
 /*
  * Globals
  */
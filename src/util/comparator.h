@@ -14,7 +14,11 @@
 #define LDB_COMPARATOR_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "coding.h"
 #include "extern.h"
+#include "internal.h"
 #include "types.h"
 
 /*
@@ -78,6 +82,13 @@ typedef struct ldb_comparator_s {
 #define ldb_compare_internal(cmp, x, y) (cmp)->compare(cmp, x, y)
 #define ldb_compare ldb_compare_internal
 
+/* Compare internal keys, skipping the indirect calls when the
+   user comparator is bytewise (see ldb_ikc_bytewise). */
+#define ldb_compare_fast(cmp, x, y)           \
+  ((cmp)->compare == ldb_ikc_bytewise         \
+    ? ldb_bytewise_icompare(x, y)             \
+    : ldb_compare_internal(cmp, x, y))
+
 #define ldb_shortest_separator(cmp, start, limit) do { \
   if ((cmp)->shortest_separator != NULL)               \
     (cmp)->shortest_separator(cmp, start, limit);      \
@@ -88,6 +99,44 @@ typedef struct ldb_comparator_s {
     (cmp)->short_successor(cmp, key);      \
 } while (0)
 
+/*
+ * Bytewise Fast Path
+ */
+
+/* InternalKeyComparator::Compare() over the bytewise comparator:
+   increasing user key, then decreasing sequence number and type. */
+LDB_STATIC int
+ldb_bytewise_icompare(const ldb_slice_t *x, const ldb_slice_t *y) {
+  size_t xn = x->size - 8;
+  size_t yn = y->size - 8;
+  size_t n = LDB_MIN(xn, yn);
+  int r = n ? memcmp(x->data, y->data, n) : 0;
+
+  if (r == 0) {
+    if (xn != yn)
+      return xn < yn ? -1 : 1;
+
+    {
+      uint64_t xs = ldb_fixed64_decode(x->data + xn);
+      uint64_t ys = ldb_fixed64_decode(y->data + yn);
+
+      if (xs > ys)
+        r = -1;
+      else if (xs < ys)
+        r = +1;
+    }
+  }
+
+  return r;
+}
+
+/* The compare function ldb_ikc_init() installs for the bytewise
+   comparator. Compared against by ldb_compare_fast(). */
+int
+ldb_ikc_bytewise(const ldb_comparator_t *ikc,
+                 const ldb_slice_t *x,
+                 const ldb_slice_t *y);
+
 /*
  * Globals
  */
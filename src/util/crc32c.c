@@ -75,11 +75,14 @@
 #  define HAVE_X64_CRC
 #endif
 
+/* The data is usually about to be used again (a block is checksummed
+   right before it is compressed or parsed), and a non-temporal hint
+   also keeps the prefetched lines out of L2, so fetch into all levels. */
 #ifdef HAVE_PREFETCH
 #  ifdef HAVE_X64_INTRIN
-#    define request_prefetch(p) _mm_prefetch((const char *)(p), _MM_HINT_NTA)
+#    define request_prefetch(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
 #  else
-#    define request_prefetch(p) __builtin_prefetch(p, 0, 0)
+#    define request_prefetch(p) __builtin_prefetch(p, 0, 3)
 #  endif
 #endif
 
@@ -18,6 +18,8 @@
 #  include "env_unix_impl.h"
 #endif
 
+#include "ratelimit.h"
+
 /*
  * Globals
  */
@@ -60,6 +62,28 @@ ldb_rfile_pread(ldb_rfile_t *file,
   return ldb_rfile_pread0(file, result, buf, count, offset);
 }
 
+void
+ldb_rfile_multiread(ldb_rfile_t *file, ldb_readreq_t *reqs, size_t count) {
+#ifndef NDEBUG
+  struct ldb_env_state_s *state = &ldb_env_state;
+
+  if (state->enable_testing && state->count_random_reads) {
+    ldb_atomic_fetch_add(&state->random_read_counter, count,
+                         ldb_order_seq_cst);
+  }
+#endif
+
+  ldb_rfile_multiread0(file, reqs, count);
+}
+
+void
+ldb_wfile_ratelimit(ldb_wfile_t *file,
+                    struct ldb_ratelimit_s *lim,
+                    int priority) {
+  file->ratelimit = lim;
+  file->priority = priority;
+}
+
 int
 ldb_wfile_append(ldb_wfile_t *file, const ldb_slice_t *data) {
 #ifndef NDEBUG
@@ -76,9 +100,41 @@ ldb_wfile_append(ldb_wfile_t *file, const ldb_slice_t *data) {
   }
 #endif
 
+  if (file->ratelimit != NULL)
+    ldb_ratelimit_request(file->ratelimit, data->size, file->priority);
+
   return ldb_wfile_append0(file, data);
 }
 
+int
+ldb_wfile_appendv(ldb_wfile_t *file, const ldb_slice_t *iov, size_t count) {
+#ifndef NDEBUG
+  struct ldb_env_state_s *state = &ldb_env_state;
+
+  if (state->enable_testing) {
+    if (file->manifest) {
+      if (ldb_atomic_load(&state->manifest_write_error, ldb_order_acquire))
+        return LDB_IOERR; /* "simulated writer error" */
+    } else {
+      if (ldb_atomic_load(&state->no_space, ldb_order_acquire))
+        return LDB_OK; /* Drop writes on the floor. */
+    }
+  }
+#endif
+
+  if (file->ratelimit != NULL) {
+    size_t size = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+      size += iov[i].size;
+
+    ldb_ratelimit_request(file->ratelimit, size, file->priority);
+  }
+
+  return ldb_wfile_appendv0(file, iov, count);
+}
+
 int
 ldb_wfile_sync(ldb_wfile_t *file) {
 #ifndef NDEBUG
@@ -122,6 +178,53 @@ ldb_truncfile_create(const char *filename, ldb_wfile_t **file) {
   return ldb_truncfile_create0(filename, file);
 }
 
+int
+ldb_reusefile_create(const char *oldname,
+                     const char *filename,
+                     ldb_wfile_t **file) {
+  int rc;
+
+#ifndef NDEBUG
+  struct ldb_env_state_s *state = &ldb_env_state;
+
+  if (state->enable_testing) {
+    if (ldb_atomic_load(&state->non_writable, ldb_order_acquire))
+      return LDB_IOERR; /* "simulated write error" */
+
+    if (state->writable_file_error) {
+      ++state->num_writable_file_errors;
+      return LDB_IOERR; /* "fake error" */
+    }
+  }
+#endif
+
+  rc = ldb_rename_file(oldname, filename);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  return ldb_reusefile_create0(filename, file);
+}
+
+int
+ldb_directfile_create(const char *filename, ldb_wfile_t **file) {
+#ifndef NDEBUG
+  struct ldb_env_state_s *state = &ldb_env_state;
+
+  if (state->enable_testing) {
+    if (ldb_atomic_load(&state->non_writable, ldb_order_acquire))
+      return LDB_IOERR; /* "simulated write error" */
+
+    if (state->writable_file_error) {
+      ++state->num_writable_file_errors;
+      return LDB_IOERR; /* "fake error" */
+    }
+  }
+#endif
+
+  return ldb_directfile_create0(filename, file);
+}
+
 int
 ldb_appendfile_create(const char *filename, ldb_wfile_t **file) {
 #ifndef NDEBUG
@@ -39,6 +39,24 @@ typedef struct ldb_logger_s ldb_logger_t;
 typedef struct ldb_rfile_s ldb_rfile_t;
 typedef struct ldb_wfile_s ldb_wfile_t;
 
+struct ldb_ratelimit_s;
+
+/* Random access file flags. */
+#define LDB_RFILE_MMAP 1 /* Map the file into memory if possible. */
+#define LDB_RFILE_DIRECT 2 /* Bypass the page cache (O_DIRECT). */
+#define LDB_RFILE_NOLIMIT 4 /* Map without counting against the
+                               process-wide limit (LDB_RFILE_MMAP). */
+#define LDB_RFILE_RANDOM 8 /* Reads will be random; skip readahead. */
+
+/* One range of a batched random read. */
+typedef struct ldb_readreq_s {
+  uint64_t offset;
+  size_t count;
+  void *buf;
+  ldb_slice_t result;
+  int status;
+} ldb_readreq_t;
+
 /*
  * Globals
  */
@@ -109,6 +127,12 @@ ldb_sync_dir(const char *dirname);
 int
 ldb_file_size(const char *filename, uint64_t *size);
 
+/* Write back the file's dirty pages and drop its pages from the
+   operating system's cache, so that later reads go to the disk.
+   Returns LDB_NOSUPPORT where this is not possible. */
+int
+ldb_evict_file(const char *filename);
+
 int
 ldb_rename_file(const char *from, const char *to);
 
@@ -143,12 +167,18 @@ ldb_test_filename(char *result, size_t size, const char *name);
 int
 ldb_seqfile_create(const char *filename, ldb_rfile_t **file);
 
+/* `flags` is a combination of the LDB_RFILE_* flags above. */
 int
-ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap);
+ldb_randfile_create(const char *filename, ldb_rfile_t **file, int flags);
 
 int
 ldb_rfile_mapped(ldb_rfile_t *file);
 
+/* Hint that [offset, offset + count) will be read soon. The data is
+   fetched in the background, if the platform supports it. */
+void
+ldb_rfile_readahead(ldb_rfile_t *file, uint64_t offset, size_t count);
+
 int
 ldb_rfile_read(ldb_rfile_t *file,
                ldb_slice_t *result,
@@ -165,6 +195,12 @@ ldb_rfile_pread(ldb_rfile_t *file,
                 size_t count,
                 uint64_t offset);
 
+/* Read several ranges of a random access file. The reads may be in
+   flight concurrently (io_uring on linux). Each request receives its
+   own result and status. */
+void
+ldb_rfile_multiread(ldb_rfile_t *file, ldb_readreq_t *reqs, size_t count);
+
 void
 ldb_rfile_destroy(ldb_rfile_t *file);
 
@@ -178,9 +214,40 @@ ldb_truncfile_create(const char *filename, ldb_wfile_t **file);
 int
 ldb_appendfile_create(const char *filename, ldb_wfile_t **file);
 
+/* Rename "oldname" to "filename" and open it for writing from its
+   start, overwriting its blocks rather than allocating new ones. The
+   old contents past the bytes written are left in place. */
+int
+ldb_reusefile_create(const char *oldname,
+                     const char *filename,
+                     ldb_wfile_t **file);
+
+/* Like ldb_truncfile_create, but bypass the page cache where the
+   platform and file system allow it. Falls back to buffered I/O. */
+int
+ldb_directfile_create(const char *filename, ldb_wfile_t **file);
+
+/* Charge every append against `lim` at `priority` (see ratelimit.h). */
+void
+ldb_wfile_ratelimit(ldb_wfile_t *file,
+                    struct ldb_ratelimit_s *lim,
+                    int priority);
+
+/* Reserve disk space in chunks of `block_size` bytes ahead of the
+   appends, where the platform supports it (fallocate(2) on linux). The
+   space not written to is released when the file is closed. */
+void
+ldb_wfile_preallocate(ldb_wfile_t *file, uint64_t block_size);
+
 int
 ldb_wfile_append(ldb_wfile_t *file, const ldb_slice_t *data);
 
+/* Append `count` slices in order. Whatever does not fit the file's
+   buffer is written along with it in a single writev(2) call where the
+   platform supports it. */
+int
+ldb_wfile_appendv(ldb_wfile_t *file, const ldb_slice_t *iov, size_t count);
+
 int
 ldb_wfile_flush(ldb_wfile_t *file);
 
@@ -212,6 +279,18 @@ ldb_logger_fopen(FILE *stream);
 int
 ldb_logger_open(const char *filename, ldb_logger_t **result);
 
+/*
+ * Memory
+ */
+
+/* Map "size" bytes of page-aligned memory, backed by huge pages
+   where the system allows. Returns NULL on failure. */
+void *
+ldb_pages_alloc(size_t size);
+
+void
+ldb_pages_free(void *ptr, size_t size);
+
 /*
  * Time
  */
@@ -219,6 +298,10 @@ ldb_logger_open(const char *filename, ldb_logger_t **result);
 int64_t
 ldb_now_usec(void);
 
+/* Monotonic time (where available), for timing short intervals. */
+int64_t
+ldb_now_nsec(void);
+
 void
 ldb_sleep_usec(int64_t usec);
 
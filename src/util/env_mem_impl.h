@@ -41,7 +41,12 @@
  * Constants
  */
 
-#define BLOCK_SIZE (8 * 1024)
+/* Files are stored in chunks which double in size from CHUNK_MIN
+   up to CHUNK_MIN << CHUNK_SHIFT (64KB), so that small files stay
+   small and reads of large ones rarely straddle two chunks. */
+#define CHUNK_MIN (4 * 1024)
+#define CHUNK_SHIFT 4
+#define CHUNK_MAX (CHUNK_MIN << CHUNK_SHIFT)
 
 /*
  * Types
@@ -112,11 +117,39 @@ struct ldb_fstate_s {
   char *path;
   ldb_mutex_t refs_mutex;
   ldb_mutex_t blocks_mutex;
-  ldb_vector_t blocks;
+  ldb_vector_t blocks; /* Chunks (see CHUNK_MIN). */
+  ldb_vector_t retired; /* Chunks truncated away while shared. */
   uint64_t size;
   int refs;
 };
 
+static size_t
+ldb_chunk_size(size_t index) {
+  return CHUNK_MIN << (index < CHUNK_SHIFT ? index : CHUNK_SHIFT);
+}
+
+/* Find the chunk holding "offset", and the position within it. */
+static size_t
+ldb_chunk_index(uint64_t offset, size_t *pos) {
+  uint64_t q = offset / CHUNK_MIN + 1;
+  size_t index = 0;
+
+  if (q < ((uint64_t)1 << CHUNK_SHIFT)) {
+    while (q >>= 1)
+      index++;
+
+    *pos = offset - (uint64_t)CHUNK_MIN * ((1 << index) - 1);
+
+    return index;
+  }
+
+  offset -= (uint64_t)CHUNK_MIN * ((1 << CHUNK_SHIFT) - 1);
+
+  *pos = offset % CHUNK_MAX;
+
+  return CHUNK_SHIFT + (size_t)(offset / CHUNK_MAX);
+}
+
 static ldb_fstate_t *
 ldb_fstate_create(const char *path) {
   ldb_fstate_t *state = ldb_malloc(sizeof(ldb_fstate_t));
@@ -126,6 +159,7 @@ ldb_fstate_create(const char *path) {
   ldb_mutex_init(&state->refs_mutex);
   ldb_mutex_init(&state->blocks_mutex);
   ldb_vector_init(&state->blocks);
+  ldb_vector_init(&state->retired);
 
   state->size = 0;
   state->refs = 0;
@@ -137,24 +171,27 @@ static ldb_fstate_t *
 ldb_fstate_clone(const char *path, const ldb_fstate_t *x) {
   ldb_mutex_t *mutex = (ldb_mutex_t *)&x->blocks_mutex;
   ldb_fstate_t *z = ldb_fstate_create(path);
-  size_t i, remain;
+  uint64_t remain;
+  size_t i;
 
   ldb_mutex_lock(mutex);
 
-  remain = x->size % BLOCK_SIZE;
+  remain = x->size;
 
   ldb_vector_grow(&z->blocks, x->blocks.length);
 
   for (i = 0; i < x->blocks.length; i++) {
-    uint8_t *block = ldb_malloc(BLOCK_SIZE);
-    size_t size = BLOCK_SIZE;
+    size_t size = ldb_chunk_size(i);
+    uint8_t *block = ldb_malloc(size);
 
-    if (i == x->blocks.length - 1 && remain != 0)
+    if (size > remain)
       size = remain;
 
     memcpy(block, x->blocks.items[i], size);
 
     ldb_vector_push(&z->blocks, block);
+
+    remain -= size;
   }
 
   z->size = x->size;
@@ -173,12 +210,23 @@ ldb_fstate_rename(ldb_fstate_t *state, const char *path) {
 
 static void
 ldb_fstate_truncate(ldb_fstate_t *state) {
+  int shared;
   size_t i;
 
+  ldb_mutex_lock(&state->refs_mutex);
+  shared = (state->refs > 1);
+  ldb_mutex_unlock(&state->refs_mutex);
+
   ldb_mutex_lock(&state->blocks_mutex);
 
-  for (i = 0; i < state->blocks.length; i++)
-    ldb_free(state->blocks.items[i]);
+  /* Reads may have returned pointers into the chunks. Those are
+     kept until the file is gone if anyone else has it open. */
+  for (i = 0; i < state->blocks.length; i++) {
+    if (shared)
+      ldb_vector_push(&state->retired, state->blocks.items[i]);
+    else
+      ldb_free(state->blocks.items[i]);
+  }
 
   state->blocks.length = 0;
   state->size = 0;
@@ -188,10 +236,17 @@ ldb_fstate_truncate(ldb_fstate_t *state) {
 
 static void
 ldb_fstate_destroy(ldb_fstate_t *state) {
+  size_t i;
+
   ldb_fstate_truncate(state);
+
+  for (i = 0; i < state->retired.length; i++)
+    ldb_free(state->retired.items[i]);
+
   ldb_mutex_destroy(&state->refs_mutex);
   ldb_mutex_destroy(&state->blocks_mutex);
   ldb_vector_clear(&state->blocks);
+  ldb_vector_clear(&state->retired);
   ldb_free(state->path);
   ldb_free(state);
 }
@@ -237,6 +292,8 @@ ldb_fstate_size(const ldb_fstate_t *state) {
   return size;
 }
 
+/* Reads which fall within one chunk are not copied: the result
+   points into the chunk, which stays put while the file is open. */
 static int
 ldb_fstate_pread(const ldb_fstate_t *state,
                  ldb_slice_t *result,
@@ -266,15 +323,23 @@ ldb_fstate_pread(const ldb_fstate_t *state,
     return LDB_OK;
   }
 
-  assert(offset / BLOCK_SIZE <= (size_t)-1);
+  block = ldb_chunk_index(offset, &block_offset);
+
+  if (block_offset + count <= ldb_chunk_size(block)) {
+    uint8_t *data = (uint8_t *)state->blocks.items[block] + block_offset;
+
+    ldb_mutex_unlock(mutex);
+
+    *result = ldb_slice(data, count);
+
+    return LDB_OK;
+  }
 
-  block = (size_t)(offset / BLOCK_SIZE);
-  block_offset = offset % BLOCK_SIZE;
   bytes_to_copy = count;
   dst = buf;
 
   while (bytes_to_copy > 0) {
-    size_t avail = BLOCK_SIZE - block_offset;
+    size_t avail = ldb_chunk_size(block) - block_offset;
 
     if (avail > bytes_to_copy)
       avail = bytes_to_copy;
@@ -302,22 +367,19 @@ ldb_fstate_append(ldb_fstate_t *state, const ldb_slice_t *data) {
   ldb_mutex_lock(&state->blocks_mutex);
 
   while (src_len > 0) {
-    size_t offset = state->size % BLOCK_SIZE;
-    size_t avail;
+    size_t offset;
+    size_t index = ldb_chunk_index(state->size, &offset);
+    size_t avail = ldb_chunk_size(index) - offset;
 
-    if (offset != 0) {
-      /* There is some room in the last block. */
-      avail = BLOCK_SIZE - offset;
-    } else {
+    if (index == state->blocks.length) {
       /* No room in the last block; push new one. */
-      ldb_vector_push(&state->blocks, ldb_malloc(BLOCK_SIZE));
-      avail = BLOCK_SIZE;
+      ldb_vector_push(&state->blocks, ldb_malloc(ldb_chunk_size(index)));
     }
 
     if (avail > src_len)
       avail = src_len;
 
-    memcpy((char *)ldb_vector_top(&state->blocks) + offset, src, avail);
+    memcpy((char *)state->blocks.items[index] + offset, src, avail);
 
     src_len -= avail;
     src += avail;
@@ -473,6 +535,12 @@ ldb_sync_dir(const char *dirname) {
   return LDB_OK;
 }
 
+int
+ldb_evict_file(const char *filename) {
+  (void)filename;
+  return LDB_NOSUPPORT;
+}
+
 int
 ldb_file_size(const char *filename, uint64_t *size) {
   ldb_fstate_t *state;
@@ -632,6 +700,13 @@ ldb_rfile_mapped(ldb_rfile_t *file) {
   return 0;
 }
 
+void
+ldb_rfile_readahead(ldb_rfile_t *file, uint64_t offset, size_t count) {
+  (void)file;
+  (void)offset;
+  (void)count;
+}
+
 int
 ldb_rfile_read(ldb_rfile_t *file,
                ldb_slice_t *result,
@@ -672,6 +747,18 @@ ldb_rfile_pread0(ldb_rfile_t *file,
   return ldb_fstate_pread(file->state, result, buf, count, offset);
 }
 
+static void
+ldb_rfile_multiread0(ldb_rfile_t *file, ldb_readreq_t *reqs, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++) {
+    ldb_readreq_t *req = &reqs[i];
+
+    req->status = ldb_rfile_pread0(file, &req->result, req->buf,
+                                   req->count, req->offset);
+  }
+}
+
 void
 ldb_rfile_destroy(ldb_rfile_t *file) {
   ldb_fstate_unref(file->state);
@@ -692,8 +779,8 @@ ldb_seqfile_create(const char *filename, ldb_rfile_t **file) {
  */
 
 int
-ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap) {
-  (void)use_mmap;
+ldb_randfile_create(const char *filename, ldb_rfile_t **file, int flags) {
+  (void)flags;
   return ldb_rfile_create(filename, file);
 }
 
@@ -704,12 +791,16 @@ ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap) {
 struct ldb_wfile_s {
   ldb_fstate_t *state;
   int manifest;
+  struct ldb_ratelimit_s *ratelimit;
+  int priority;
 };
 
 static void
 ldb_wfile_init(ldb_wfile_t *file, const char *filename, ldb_fstate_t *state) {
   file->state = ldb_fstate_ref(state);
   file->manifest = ldb_is_manifest(filename);
+  file->ratelimit = NULL;
+  file->priority = 0;
 }
 
 static LDB_INLINE int
@@ -717,6 +808,19 @@ ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   return ldb_fstate_append(file->state, data);
 }
 
+static LDB_INLINE int
+ldb_wfile_appendv0(ldb_wfile_t *file, const ldb_slice_t *iov, size_t count) {
+  size_t i;
+  int rc;
+
+  for (i = 0; i < count; i++) {
+    if ((rc = ldb_fstate_append(file->state, &iov[i])))
+      return rc;
+  }
+
+  return LDB_OK;
+}
+
 int
 ldb_wfile_flush(ldb_wfile_t *file) {
   (void)file;
@@ -769,6 +873,31 @@ ldb_truncfile_create0(const char *filename, ldb_wfile_t **file) {
   return LDB_OK;
 }
 
+void
+ldb_wfile_preallocate(ldb_wfile_t *file, uint64_t block_size) {
+  (void)file;
+  (void)block_size;
+}
+
+/*
+ * ReusableFile
+ */
+
+static LDB_INLINE int
+ldb_reusefile_create0(const char *filename, ldb_wfile_t **file) {
+  /* Nothing to gain in memory. */
+  return ldb_truncfile_create0(filename, file);
+}
+
+/*
+ * DirectFile
+ */
+
+static LDB_INLINE int
+ldb_directfile_create0(const char *filename, ldb_wfile_t **file) {
+  return ldb_truncfile_create0(filename, file);
+}
+
 /*
  * AppendableFile
  */
@@ -806,6 +935,21 @@ ldb_logger_open(const char *filename, ldb_logger_t **result) {
   return LDB_OK;
 }
 
+/*
+ * Memory
+ */
+
+void *
+ldb_pages_alloc(size_t size) {
+  return ldb_malloc(size);
+}
+
+void
+ldb_pages_free(void *ptr, size_t size) {
+  (void)size;
+  ldb_free(ptr);
+}
+
 /*
  * Time
  */
@@ -833,6 +977,25 @@ ldb_now_usec(void) {
 #endif /* !_WIN32 */
 }
 
+int64_t
+ldb_now_nsec(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER freq, ticks;
+
+  if (QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&ticks)) {
+    return (ticks.QuadPart / freq.QuadPart) * 1000000000
+         + (ticks.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+  }
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+
+  return ldb_now_usec() * 1000;
+}
+
 void
 ldb_sleep_usec(int64_t usec) {
 #ifdef _WIN32
@@ -59,6 +59,8 @@
 #undef HAVE_FLOCK
 #undef HAVE_FDATASYNC
 #undef HAVE_PREAD
+#undef HAVE_IO_URING
+#undef HAVE_FALLOCATE
 
 #if !defined(__wasi__) && !defined(__EMSCRIPTEN__)
 #  define HAVE_FCNTL
@@ -90,6 +92,30 @@
 #  define HAVE_PREAD
 #endif
 
+#if defined(HAVE_PREAD) && (defined(O_DIRECT) || defined(F_NOCACHE))
+#  define HAVE_DIRECT
+#endif
+
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+#  define HAVE_FALLOCATE
+#endif
+
+#if !defined(__DJGPP__) && !defined(__wasi__) && !defined(__EMSCRIPTEN__)
+#  include <sys/uio.h>
+#  define HAVE_WRITEV
+#endif
+
+#if defined(LDB_HAVE_IO_URING) && defined(HAVE_PREAD) && defined(HAVE_MMAP)
+#  if defined(__linux__) && defined(__GNUC__)
+#    include <linux/io_uring.h>
+#    include <sys/syscall.h>
+#    include <sys/uio.h>
+#    if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#      define HAVE_IO_URING
+#    endif
+#  endif
+#endif
+
 /*
  * Fixes
  */
@@ -98,6 +124,10 @@
 #  define MAP_FAILED ((void *)-1)
 #endif
 
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
 #ifdef __wasi__
 /* lseek(3) is statement expression in wasi-libc. */
 #  pragma GCC diagnostic ignored "-Wgnu-statement-expression"
@@ -108,6 +138,8 @@
  */
 
 #define LDB_WRITE_BUFFER 65536
+#define LDB_DIRECT_ALIGN 4096
+#define LDB_IOV_MAX 64
 #define LDB_MMAP_LIMIT (sizeof(void *) >= 8 ? 1000 : 0)
 #define LDB_OFFSET_MAX (sizeof(off_t) >= 8 ? INT64_MAX : INT32_MAX)
 
@@ -382,6 +414,44 @@ ldb_read(int fd, void *dst, size_t len) {
   return cnt;
 }
 
+#ifdef HAVE_DIRECT
+static void *
+ldb_align_ptr(void *ptr) {
+  uintptr_t addr = (uintptr_t)ptr;
+
+  addr = (addr + LDB_DIRECT_ALIGN - 1) & ~((uintptr_t)LDB_DIRECT_ALIGN - 1);
+
+  return (void *)addr;
+}
+
+static int
+ldb_open_direct(const char *name, int flags, uint32_t mode, int *direct) {
+  int fd = -1;
+
+  *direct = 0;
+
+#if defined(O_DIRECT)
+  do {
+    fd = ldb_try_open(name, flags | O_DIRECT, mode);
+  } while (fd < 0 && errno == EINTR);
+
+  /* Not supported by this file system (e.g. tmpfs). */
+  if (fd < 0 && errno == EINVAL)
+    return ldb_open(name, flags, mode);
+
+  if (fd >= 0)
+    *direct = 1;
+#else
+  fd = ldb_open(name, flags, mode);
+
+  if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) == 0)
+    *direct = 1;
+#endif
+
+  return fd;
+}
+#endif
+
 #ifdef HAVE_PREAD
 static int64_t
 ldb_pread(int fd, void *dst, size_t len, uint64_t off) {
@@ -410,6 +480,72 @@ ldb_pread(int fd, void *dst, size_t len, uint64_t off) {
 
   return cnt;
 }
+
+#ifdef HAVE_DIRECT
+static int64_t
+ldb_pwrite(int fd, const void *src, size_t len, uint64_t off) {
+  const unsigned char *buf = src;
+  int64_t cnt = 0;
+
+  while (len > 0) {
+    size_t max = LDB_MIN(len, 1 << 30);
+    int nwrite;
+
+    do {
+      nwrite = pwrite(fd, buf, max, off);
+    } while (nwrite < 0 && errno == EINTR);
+
+    if (nwrite < 0)
+      return -1;
+
+    buf += nwrite;
+    len -= nwrite;
+    off += nwrite;
+    cnt += nwrite;
+  }
+
+  return cnt;
+}
+
+/* Read through an aligned bounce buffer. With direct I/O the offset,
+   length and memory must all be multiples of the block size. */
+static int64_t
+ldb_pread_direct(int fd, void *dst, size_t len, uint64_t off) {
+  uint64_t start = off & ~((uint64_t)LDB_DIRECT_ALIGN - 1);
+  size_t skip = off - start;
+  size_t size = (skip + len + LDB_DIRECT_ALIGN - 1)
+              & ~((size_t)LDB_DIRECT_ALIGN - 1);
+  unsigned char *raw = ldb_malloc(size + LDB_DIRECT_ALIGN);
+  unsigned char *buf = ldb_align_ptr(raw);
+  size_t pos = 0;
+  int64_t nread;
+
+  while (pos < size) {
+    do {
+      nread = pread(fd, buf + pos, size - pos, start + pos);
+    } while (nread < 0 && errno == EINTR);
+
+    if (nread < 0) {
+      ldb_free(raw);
+      return -1;
+    }
+
+    pos += nread;
+
+    /* Short read: end of file. */
+    if (nread == 0 || (pos & (LDB_DIRECT_ALIGN - 1)) != 0)
+      break;
+  }
+
+  nread = pos > skip ? LDB_MIN(pos - skip, len) : 0;
+
+  memcpy(dst, buf + skip, nread);
+
+  ldb_free(raw);
+
+  return nread;
+}
+#endif /* HAVE_DIRECT */
 #endif
 
 static int64_t
@@ -436,6 +572,39 @@ ldb_write(int fd, const void *src, size_t len) {
   return cnt;
 }
 
+#ifdef HAVE_WRITEV
+static int64_t
+ldb_writev(int fd, struct iovec *iov, int iovcnt) {
+  int64_t cnt = 0;
+  ssize_t nwrite;
+
+  while (iovcnt > 0) {
+    do {
+      nwrite = writev(fd, iov, iovcnt);
+    } while (nwrite < 0 && errno == EINTR);
+
+    if (nwrite < 0)
+      return -1;
+
+    cnt += nwrite;
+
+    /* Skip past whatever was written. */
+    while (iovcnt > 0 && (size_t)nwrite >= iov->iov_len) {
+      nwrite -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+
+    if (nwrite > 0) {
+      iov->iov_base = (char *)iov->iov_base + nwrite;
+      iov->iov_len -= nwrite;
+    }
+  }
+
+  return cnt;
+}
+#endif
+
 static int
 ldb_fsync(int fd) {
   int rc;
@@ -721,6 +890,34 @@ ldb_sync_dir(const char *dirname) {
   return rc;
 }
 
+int
+ldb_evict_file(const char *filename) {
+#ifdef POSIX_FADV_DONTNEED
+  int fd = ldb_open(filename, O_RDONLY, 0);
+  int rc = LDB_OK;
+
+  if (fd < 0)
+    return ldb_system_error();
+
+  if (ldb_fsync(fd) != 0)
+    rc = ldb_system_error();
+
+  if (rc == LDB_OK) {
+    rc = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    if (rc != 0)
+      rc = LDB_NOSUPPORT;
+  }
+
+  close(fd);
+
+  return rc;
+#else
+  (void)filename;
+  return LDB_NOSUPPORT;
+#endif
+}
+
 int
 ldb_file_size(const char *filename, uint64_t *size) {
   struct stat st;
@@ -980,6 +1177,7 @@ struct ldb_rfile_s {
   int fd;
   ldb_limiter_t *limiter;
   int mapped;
+  int direct;
   unsigned char *base;
   size_t length;
 #ifndef HAVE_PREAD
@@ -994,6 +1192,7 @@ ldb_seqfile_init(ldb_rfile_t *file, int fd) {
   file->fd = fd;
   file->limiter = NULL;
   file->mapped = 0;
+  file->direct = 0;
   file->base = NULL;
   file->length = 0;
 #ifndef HAVE_PREAD
@@ -1012,6 +1211,7 @@ ldb_randfile_init(ldb_rfile_t *file,
   file->fd = acquired ? fd : -1;
   file->limiter = acquired ? limiter : NULL;
   file->mapped = 0;
+  file->direct = 0;
   file->base = NULL;
   file->length = 0;
 
@@ -1034,6 +1234,7 @@ ldb_mapfile_init(ldb_rfile_t *file,
   file->fd = -1;
   file->limiter = limiter;
   file->mapped = 1;
+  file->direct = 0;
   file->base = base;
   file->length = length;
 #ifndef HAVE_PREAD
@@ -1047,6 +1248,39 @@ ldb_rfile_mapped(ldb_rfile_t *file) {
   return file->mapped;
 }
 
+void
+ldb_rfile_readahead(ldb_rfile_t *file, uint64_t offset, size_t count) {
+  if (file->mapped) {
+#if defined(HAVE_MMAP) && defined(MADV_WILLNEED)
+    static size_t page_size = 0;
+    uint64_t start;
+
+    if (offset >= file->length)
+      return;
+
+    count = LDB_MIN(count, file->length - offset);
+
+    if (page_size == 0)
+      page_size = sysconf(_SC_PAGESIZE);
+
+    /* madvise() wants a page-aligned address. */
+    start = offset - (offset % page_size);
+
+    madvise(file->base + start, count + (offset - start), MADV_WILLNEED);
+#endif
+    return;
+  }
+
+#ifdef POSIX_FADV_WILLNEED
+  /* Direct reads bypass the page cache; there is nothing to fill. */
+  if (file->fd != -1 && !file->direct)
+    posix_fadvise(file->fd, offset, count, POSIX_FADV_WILLNEED);
+#else
+  (void)offset;
+  (void)count;
+#endif
+}
+
 int
 ldb_rfile_read(ldb_rfile_t *file,
                ldb_slice_t *result,
@@ -1099,12 +1333,26 @@ ldb_rfile_pread0(ldb_rfile_t *file,
     return EINVAL;
 
   if (file->fd == -1) {
-    fd = ldb_open(file->filename, O_RDONLY, 0);
+#ifdef HAVE_DIRECT
+    if (file->direct) {
+      int direct;
+
+      fd = ldb_open_direct(file->filename, O_RDONLY, 0, &direct);
+    } else
+#endif
+    {
+      fd = ldb_open(file->filename, O_RDONLY, 0);
+    }
 
     if (fd < 0)
       return ldb_system_error();
   }
 
+#ifdef HAVE_DIRECT
+  if (file->direct)
+    nread = ldb_pread_direct(fd, buf, count, offset);
+  else
+#endif
 #ifdef HAVE_PREAD
   nread = ldb_pread(fd, buf, count, offset);
 #else
@@ -1129,128 +1377,590 @@ ldb_rfile_pread0(ldb_rfile_t *file,
   return rc;
 }
 
+/*
+ * Ring (io_uring)
+ */
+
+#ifdef HAVE_IO_URING
+
+#define LDB_URING_ENTRIES 32
+#define LDB_URING_RINGS 8
+
+typedef struct ldb_uring_s {
+  int fd;
+  int busy;
+  int broken;
+  unsigned features;
+  unsigned char *sq_ptr;
+  size_t sq_len;
+  unsigned char *cq_ptr;
+  size_t cq_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+} ldb_uring_t;
+
+/* Rings are set up lazily and reused, one per concurrent batch. */
+static ldb_uring_t ldb_rings[LDB_URING_RINGS];
+static int ldb_rings_disabled = 0;
+static ldb_mutex_t ldb_rings_mutex = LDB_MUTEX_INITIALIZER;
+
 static int
-ldb_rfile_close(ldb_rfile_t *file) {
-  int rc = LDB_OK;
+ldb_uring_setup(ldb_uring_t *ring) {
+  struct io_uring_params p;
+  void *ptr;
+  int fd;
 
-  if (file->filename != NULL)
-    ldb_free(file->filename);
+  memset(&p, 0, sizeof(p));
 
-  if (file->fd != -1) {
-    if (close(file->fd) != 0)
-      rc = ldb_system_error();
+  fd = syscall(__NR_io_uring_setup, LDB_URING_ENTRIES, &p);
+
+  if (fd < 0)
+    return 0;
+
+  ring->fd = fd;
+  ring->features = p.features;
+  ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_len > ring->sq_len)
+      ring->sq_len = ring->cq_len;
+
+    ring->cq_len = 0;
   }
 
-#ifdef HAVE_MMAP
-  if (file->mapped)
-    munmap((void *)file->base, file->length);
-#endif
+  ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, IORING_OFF_SQ_RING);
 
-  if (file->limiter != NULL)
-    ldb_limiter_release(file->limiter);
+  if (ptr == MAP_FAILED)
+    goto fail;
 
-  file->filename = NULL;
-  file->fd = -1;
-  file->limiter = NULL;
-  file->mapped = 0;
-  file->base = NULL;
-  file->length = 0;
+  ring->sq_ptr = ptr;
+  ring->cq_ptr = ptr;
 
-#ifndef HAVE_PREAD
-  if (file->has_mutex) {
-    ldb_mutex_destroy(&file->mutex);
-    file->has_mutex = 0;
+  if (ring->cq_len > 0) {
+    ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, IORING_OFF_CQ_RING);
+
+    if (ptr == MAP_FAILED) {
+      munmap(ring->sq_ptr, ring->sq_len);
+      goto fail;
+    }
+
+    ring->cq_ptr = ptr;
   }
-#endif
 
-  return rc;
-}
+  ptr = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, IORING_OFF_SQES);
 
-void
-ldb_rfile_destroy(ldb_rfile_t *file) {
-  ldb_rfile_close(file);
-  ldb_free(file);
+  if (ptr == MAP_FAILED) {
+    if (ring->cq_len > 0)
+      munmap(ring->cq_ptr, ring->cq_len);
+
+    munmap(ring->sq_ptr, ring->sq_len);
+
+    goto fail;
+  }
+
+  ring->sqes = ptr;
+  ring->sq_tail = (unsigned *)(void *)(ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(void *)(ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(void *)(ring->sq_ptr + p.sq_off.array);
+  ring->cq_head = (unsigned *)(void *)(ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(void *)(ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(void *)(ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(void *)(ring->cq_ptr + p.cq_off.cqes);
+
+  return 1;
+fail:
+  close(fd);
+  ring->fd = -1;
+  return 0;
 }
 
-/*
- * SequentialFile
- */
+static ldb_uring_t *
+ldb_uring_acquire(void) {
+  ldb_uring_t *ring = NULL;
+  int i;
 
-int
-ldb_seqfile_create(const char *filename, ldb_rfile_t **file) {
-  int fd = ldb_open(filename, O_RDONLY, 0);
+  ldb_mutex_lock(&ldb_rings_mutex);
 
-  if (fd < 0)
-    return ldb_system_error();
+  for (i = 0; i < LDB_URING_RINGS && !ldb_rings_disabled; i++) {
+    if (ldb_rings[i].busy)
+      continue;
 
-  *file = ldb_malloc(sizeof(ldb_rfile_t));
+    if (ldb_rings[i].sq_ptr == NULL && !ldb_uring_setup(&ldb_rings[i])) {
+      /* Not supported by the kernel (or not permitted). */
+      ldb_rings_disabled = 1;
+      break;
+    }
 
-  ldb_seqfile_init(*file, fd);
+    ring = &ldb_rings[i];
+    ring->busy = 1;
 
-  return LDB_OK;
+    break;
+  }
+
+  ldb_mutex_unlock(&ldb_rings_mutex);
+
+  return ring;
 }
 
-/*
- * RandomAccessFile
- */
+static void
+ldb_uring_release(ldb_uring_t *ring) {
+  ldb_mutex_lock(&ldb_rings_mutex);
 
-int
-ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap) {
-#ifdef HAVE_MMAP
-  void *base = NULL;
-  size_t size = 0;
-  int rc = LDB_OK;
-  struct stat st;
-#endif
-  int fd;
+  /* A broken ring stays checked out for good. */
+  if (!ring->broken)
+    ring->busy = 0;
 
-#ifndef HAVE_MMAP
-  (void)use_mmap;
-#endif
+  ldb_mutex_unlock(&ldb_rings_mutex);
+}
 
-  fd = ldb_open(filename, O_RDONLY, 0);
+static void
+ldb_uring_finish(int fd, ldb_readreq_t *req, int64_t nread) {
+  /* Complete short (or unsubmitted) reads synchronously. */
+  if ((size_t)nread < req->count) {
+    unsigned char *buf = (unsigned char *)req->buf + nread;
+    int64_t n = ldb_pread(fd, buf, req->count - nread, req->offset + nread);
+
+    if (n < 0) {
+      req->status = ldb_system_error();
+      n = 0;
+    }
 
-  if (fd < 0)
-    return ldb_system_error();
+    nread += n;
+  }
 
-#ifdef HAVE_MMAP
-  if (!use_mmap || !ldb_limiter_acquire(&ldb_mmap_limiter))
-#endif
-  {
-    *file = ldb_malloc(sizeof(ldb_rfile_t));
+  ldb_slice_set(&req->result, req->buf, nread);
+}
 
-    ldb_env_init();
-    ldb_randfile_init(*file, filename, fd, &ldb_fd_limiter);
+/* Submit up to LDB_URING_ENTRIES reads and wait for all of them. */
+static int
+ldb_uring_read(ldb_uring_t *ring, int fd, ldb_readreq_t *reqs, size_t count) {
+  struct iovec iov[LDB_URING_ENTRIES];
+  size_t i, submitted, done;
+  unsigned tail, head, mask;
+  long ret;
 
-    return LDB_OK;
-  }
+  assert(count <= LDB_URING_ENTRIES);
 
-#ifdef HAVE_MMAP
-  if (fstat(fd, &st) != 0)
-    rc = ldb_system_error();
+  tail = *ring->sq_tail;
+  mask = *ring->sq_mask;
 
-  if (rc == LDB_OK) {
-    size = st.st_size;
-    base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  for (i = 0; i < count; i++) {
+    unsigned index = (tail + i) & mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
 
-    if (base == MAP_FAILED)
-      rc = ldb_system_error();
-  }
+    iov[i].iov_base = reqs[i].buf;
+    iov[i].iov_len = reqs[i].count;
 
-  if (rc == LDB_OK) {
-    *file = ldb_malloc(sizeof(ldb_rfile_t));
+    memset(sqe, 0, sizeof(*sqe));
 
-    ldb_mapfile_init(*file, base, size, &ldb_mmap_limiter);
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&iov[i];
+    sqe->len = 1;
+    sqe->off = reqs[i].offset;
+    sqe->user_data = i;
+
+    ring->sq_array[index] = index;
   }
 
-  close(fd);
+  __atomic_store_n(ring->sq_tail, tail + count, __ATOMIC_RELEASE);
 
-  if (rc != LDB_OK)
-    ldb_limiter_release(&ldb_mmap_limiter);
+  submitted = 0;
 
-  return rc;
-#endif
-}
+  while (submitted < count) {
+    ret = syscall(__NR_io_uring_enter, ring->fd,
+                  (unsigned)(count - submitted), 0, 0, NULL, 0);
+
+    if (ret < 0 && errno == EINTR)
+      continue;
+
+    if (ret <= 0) {
+      /* Entries left in the queue would be submitted by the next
+         user of this ring, while their buffers are long gone. */
+      ring->broken = 1;
+      break;
+    }
+
+    submitted += ret;
+  }
+
+  if (submitted == 0)
+    return 0;
+
+  /* Everything in flight must complete before the buffers go away. */
+  done = 0;
+
+  while (done < submitted) {
+    head = *ring->cq_head;
+    mask = *ring->cq_mask;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & mask];
+      ldb_readreq_t *req = &reqs[cqe->user_data];
+
+      if (cqe->res < 0) {
+        req->status = -cqe->res;
+        ldb_slice_set(&req->result, req->buf, 0);
+      } else {
+        ldb_uring_finish(fd, req, cqe->res);
+      }
+
+      head++;
+      done++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (done < submitted) {
+      syscall(__NR_io_uring_enter, ring->fd, 0,
+              (unsigned)(submitted - done),
+              IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+  }
+
+  for (i = submitted; i < count; i++)
+    ldb_uring_finish(fd, &reqs[i], 0);
+
+  return 1;
+}
+
+/* Write out "data" followed by a linked fdatasync, submitted with a
+   single syscall. Returns zero if nothing could be queued. */
+static int
+ldb_uring_sync(ldb_uring_t *ring, int fd,
+               const unsigned char *data, size_t size, int *status) {
+  unsigned tail, head, mask;
+  unsigned n = 0, done = 0;
+  struct io_uring_sqe *sqe;
+  int64_t written = -1;
+  int have_sync = 0;
+  int synced = 0;
+  struct iovec iov;
+  long ret;
+
+  /* Writes at the current position need 5.6+. */
+  if (!(ring->features & IORING_FEAT_RW_CUR_POS))
+    return 0;
+
+  tail = *ring->sq_tail;
+  mask = *ring->sq_mask;
+
+  if (size > 0) {
+    iov.iov_base = (void *)data;
+    iov.iov_len = size;
+
+    sqe = &ring->sqes[(tail + n) & mask];
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = 0;
+
+    ring->sq_array[(tail + n) & mask] = (tail + n) & mask;
+
+    n++;
+  }
+
+  sqe = &ring->sqes[(tail + n) & mask];
+
+  memset(sqe, 0, sizeof(*sqe));
+
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data = 1;
+
+  ring->sq_array[(tail + n) & mask] = (tail + n) & mask;
+
+  n++;
+
+  __atomic_store_n(ring->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+  do {
+    ret = syscall(__NR_io_uring_enter, ring->fd, n, n,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < (long)n) {
+    /* Entries left in the queue must never be submitted later. */
+    ring->broken = 1;
+
+    if (ret <= 0)
+      return 0;
+  }
+
+  /* Reap the completions. */
+  while (done < (unsigned)ret) {
+    head = *ring->cq_head;
+    mask = *ring->cq_mask;
+
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & mask];
+
+      if (cqe->user_data == 0) {
+        written = cqe->res;
+      } else {
+        synced = cqe->res;
+        have_sync = 1;
+      }
+
+      head++;
+      done++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (done < (unsigned)ret) {
+      syscall(__NR_io_uring_enter, ring->fd, 0, (unsigned)ret - done,
+              IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+  }
+
+  *status = LDB_OK;
+
+  if (size > 0 && written < (int64_t)size) {
+    /* Failed, short or unsubmitted write: finish it by hand. The
+       linked sync was canceled along with it. */
+    if (written < 0)
+      written = 0;
+
+    if (ldb_write(fd, data + written, size - written) < 0) {
+      *status = ldb_system_error();
+      return 1;
+    }
+
+    have_sync = 0;
+  }
+
+  if (have_sync && synced < 0 && synced != -ECANCELED) {
+    *status = -synced;
+    return 1;
+  }
+
+  if (!have_sync || synced < 0) {
+    if (ldb_fsync(fd) != 0)
+      *status = ldb_system_error();
+  }
+
+  return 1;
+}
+
+#endif /* HAVE_IO_URING */
+
+static void
+ldb_rfile_multiread0(ldb_rfile_t *file, ldb_readreq_t *reqs, size_t count) {
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    reqs[i].status = LDB_OK;
+
+#ifdef HAVE_IO_URING
+  if (!file->mapped && !file->direct && file->fd != -1 && count > 1) {
+    ldb_uring_t *ring = ldb_uring_acquire();
+
+    if (ring != NULL) {
+      size_t n;
+
+      for (i = 0; i < count; i += n) {
+        n = LDB_MIN(count - i, LDB_URING_ENTRIES);
+
+        if (ring->broken || !ldb_uring_read(ring, file->fd, reqs + i, n))
+          break;
+      }
+
+      ldb_uring_release(ring);
+
+      if (i >= count)
+        return;
+
+      reqs += i;
+      count -= i;
+    }
+  }
+#endif
+
+#ifdef POSIX_FADV_WILLNEED
+  /* Let the kernel queue all of the reads before we block on any. */
+  if (!file->mapped && !file->direct && file->fd != -1 && count > 1) {
+    for (i = 0; i < count; i++)
+      posix_fadvise(file->fd, reqs[i].offset, reqs[i].count,
+                    POSIX_FADV_WILLNEED);
+  }
+#endif
+
+  for (i = 0; i < count; i++) {
+    ldb_readreq_t *req = &reqs[i];
+
+    req->status = ldb_rfile_pread0(file, &req->result, req->buf,
+                                   req->count, req->offset);
+  }
+}
+
+static int
+ldb_rfile_close(ldb_rfile_t *file) {
+  int rc = LDB_OK;
+
+  if (file->filename != NULL)
+    ldb_free(file->filename);
+
+  if (file->fd != -1) {
+    if (close(file->fd) != 0)
+      rc = ldb_system_error();
+  }
+
+#ifdef HAVE_MMAP
+  if (file->mapped)
+    munmap((void *)file->base, file->length);
+#endif
+
+  if (file->limiter != NULL)
+    ldb_limiter_release(file->limiter);
+
+  file->filename = NULL;
+  file->fd = -1;
+  file->limiter = NULL;
+  file->mapped = 0;
+  file->direct = 0;
+  file->base = NULL;
+  file->length = 0;
+
+#ifndef HAVE_PREAD
+  if (file->has_mutex) {
+    ldb_mutex_destroy(&file->mutex);
+    file->has_mutex = 0;
+  }
+#endif
+
+  return rc;
+}
+
+void
+ldb_rfile_destroy(ldb_rfile_t *file) {
+  ldb_rfile_close(file);
+  ldb_free(file);
+}
+
+/*
+ * SequentialFile
+ */
+
+int
+ldb_seqfile_create(const char *filename, ldb_rfile_t **file) {
+  int fd = ldb_open(filename, O_RDONLY, 0);
+
+  if (fd < 0)
+    return ldb_system_error();
+
+  *file = ldb_malloc(sizeof(ldb_rfile_t));
+
+  ldb_seqfile_init(*file, fd);
+
+  return LDB_OK;
+}
+
+/*
+ * RandomAccessFile
+ */
+
+int
+ldb_randfile_create(const char *filename, ldb_rfile_t **file, int flags) {
+  int use_mmap = (flags & LDB_RFILE_MMAP) && !(flags & LDB_RFILE_DIRECT);
+#ifdef HAVE_MMAP
+  ldb_limiter_t *limiter = NULL;
+  void *base = NULL;
+  size_t size = 0;
+  int rc = LDB_OK;
+  struct stat st;
+#endif
+  int direct = 0;
+  int fd;
+
+#ifndef HAVE_MMAP
+  (void)use_mmap;
+#endif
+
+#ifdef HAVE_DIRECT
+  if (flags & LDB_RFILE_DIRECT)
+    fd = ldb_open_direct(filename, O_RDONLY, 0, &direct);
+  else
+#endif
+  fd = ldb_open(filename, O_RDONLY, 0);
+
+  if (fd < 0)
+    return ldb_system_error();
+
+#ifdef HAVE_MMAP
+  if (use_mmap && !(flags & LDB_RFILE_NOLIMIT)) {
+    limiter = &ldb_mmap_limiter;
+    use_mmap = ldb_limiter_acquire(limiter);
+  }
+
+  if (!use_mmap)
+#endif
+  {
+    *file = ldb_malloc(sizeof(ldb_rfile_t));
+
+    ldb_env_init();
+    ldb_randfile_init(*file, filename, fd, &ldb_fd_limiter);
+
+    (*file)->direct = direct;
+
+#ifdef POSIX_FADV_RANDOM
+    if ((flags & LDB_RFILE_RANDOM) && (*file)->fd != -1 && !direct)
+      posix_fadvise((*file)->fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+
+    return LDB_OK;
+  }
+
+#ifdef HAVE_MMAP
+  if (fstat(fd, &st) != 0)
+    rc = ldb_system_error();
+
+  if (rc == LDB_OK) {
+    size = st.st_size;
+    base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (base == MAP_FAILED)
+      rc = ldb_system_error();
+  }
+
+#if defined(MADV_RANDOM)
+  if (rc == LDB_OK && (flags & LDB_RFILE_RANDOM))
+    madvise(base, size, MADV_RANDOM);
+#endif
+
+  if (rc == LDB_OK) {
+    *file = ldb_malloc(sizeof(ldb_rfile_t));
+
+    ldb_mapfile_init(*file, base, size, limiter);
+  }
+
+  close(fd);
+
+  if (rc != LDB_OK && limiter != NULL)
+    ldb_limiter_release(limiter);
+
+  return rc;
+#endif
+}
 
 /*
  * WritableFile (backend)
@@ -1261,6 +1971,21 @@ struct ldb_wfile_s {
   int fd, manifest;
   unsigned char buf[LDB_WRITE_BUFFER];
   size_t pos;
+  struct ldb_ratelimit_s *ratelimit;
+  int priority;
+#ifdef HAVE_FALLOCATE
+  /* Space is reserved in chunks of `prealloc` bytes, up to `alloc`. */
+  uint64_t size;
+  uint64_t prealloc;
+  uint64_t alloc;
+#endif
+#ifdef HAVE_DIRECT
+  /* Direct I/O: writes go through an aligned buffer at `offset`. */
+  int direct;
+  uint64_t offset;
+  unsigned char *raw;
+  unsigned char *data;
+#endif
 };
 
 static void
@@ -1269,6 +1994,19 @@ ldb_wfile_init(ldb_wfile_t *file, const char *filename, int fd) {
   file->fd = fd;
   file->manifest = ldb_is_manifest(filename);
   file->pos = 0;
+  file->ratelimit = NULL;
+  file->priority = 0;
+#ifdef HAVE_FALLOCATE
+  file->size = 0;
+  file->prealloc = 0;
+  file->alloc = 0;
+#endif
+#ifdef HAVE_DIRECT
+  file->direct = 0;
+  file->offset = 0;
+  file->raw = NULL;
+  file->data = NULL;
+#endif
 
   if (file->manifest) {
     size_t size = strlen(filename) + 2;
@@ -1294,11 +2032,42 @@ ldb_wfile_create(const char *filename, int flags, ldb_wfile_t **file) {
   return LDB_OK;
 }
 
+#ifdef HAVE_FALLOCATE
+/* Reserve the space for the next `size` bytes. The file size is left
+   as is, so readers never see the reserved space. */
+static void
+ldb_wfile_reserve(ldb_wfile_t *file, size_t size) {
+  uint64_t end = file->size + size;
+  uint64_t len;
+
+  if (file->prealloc == 0 || end <= file->alloc)
+    return;
+
+  len = end - file->alloc + file->prealloc - 1;
+  len -= len % file->prealloc;
+
+  if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE,
+                (off_t)file->alloc, (off_t)len) == 0) {
+    file->alloc += len;
+  } else {
+    file->prealloc = 0; /* Not supported by the file system. */
+  }
+}
+#endif
+
 static int
 ldb_wfile_write(ldb_wfile_t *file, const unsigned char *data, size_t size) {
+#ifdef HAVE_FALLOCATE
+  ldb_wfile_reserve(file, size);
+#endif
+
   if (ldb_write(file->fd, data, size) < 0)
     return ldb_system_error();
 
+#ifdef HAVE_FALLOCATE
+  file->size += size;
+#endif
+
   return LDB_OK;
 }
 
@@ -1310,6 +2079,88 @@ ldb_wfile_sync_dir(ldb_wfile_t *file) {
   return ldb_sync_dir(file->dirname);
 }
 
+#ifdef HAVE_DIRECT
+static int
+ldb_direct_write(ldb_wfile_t *file, size_t size) {
+  if (ldb_pwrite(file->fd, file->data, size, file->offset) < 0)
+    return ldb_system_error();
+
+  return LDB_OK;
+}
+
+static int
+ldb_direct_append(ldb_wfile_t *file, const unsigned char *data, size_t size) {
+  int rc;
+
+  while (size > 0) {
+    size_t copy_size = LDB_MIN(size, LDB_WRITE_BUFFER - file->pos);
+
+    memcpy(file->data + file->pos, data, copy_size);
+
+    data += copy_size;
+    size -= copy_size;
+    file->pos += copy_size;
+
+    if (file->pos == LDB_WRITE_BUFFER) {
+      if ((rc = ldb_direct_write(file, LDB_WRITE_BUFFER)))
+        return rc;
+
+      file->offset += LDB_WRITE_BUFFER;
+      file->pos = 0;
+    }
+  }
+
+  return LDB_OK;
+}
+
+/* Write out every complete block. The tail stays buffered. */
+static int
+ldb_direct_flush(ldb_wfile_t *file) {
+  size_t size = file->pos & ~((size_t)LDB_DIRECT_ALIGN - 1);
+  int rc;
+
+  if (size == 0)
+    return LDB_OK;
+
+  if ((rc = ldb_direct_write(file, size)))
+    return rc;
+
+  memmove(file->data, file->data + size, file->pos - size);
+
+  file->offset += size;
+  file->pos -= size;
+
+  return LDB_OK;
+}
+
+/* Write the tail as a zero-padded block and truncate the padding
+   off again. The tail remains buffered and is rewritten in place by
+   the next flush. */
+static int
+ldb_direct_finish(ldb_wfile_t *file) {
+  size_t size;
+  int rc;
+
+  if ((rc = ldb_direct_flush(file)))
+    return rc;
+
+  if (file->pos == 0)
+    return LDB_OK;
+
+  size = (file->pos + LDB_DIRECT_ALIGN - 1) & ~((size_t)LDB_DIRECT_ALIGN - 1);
+
+  memset(file->data + file->pos, 0, size - file->pos);
+
+  if ((rc = ldb_direct_write(file, size)))
+    return rc;
+
+  if (ftruncate(file->fd, file->offset + file->pos) != 0)
+    return ldb_system_error();
+
+  return LDB_OK;
+}
+#endif /* HAVE_DIRECT */
+
 static LDB_INLINE int
 ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   const unsigned char *write_data = data->data;
@@ -1317,6 +2168,11 @@ ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   size_t copy_size;
   int rc;
 
+#ifdef HAVE_DIRECT
+  if (file->direct)
+    return ldb_direct_append(file, write_data, write_size);
+#endif
+
   copy_size = LDB_MIN(write_size, LDB_WRITE_BUFFER - file->pos);
 
   if (copy_size > 0) {
@@ -1342,10 +2198,108 @@ ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   return ldb_wfile_write(file, write_data, write_size);
 }
 
+#ifdef HAVE_WRITEV
+/* Write the buffer followed by the slices, LDB_IOV_MAX at a time. */
+static int
+ldb_wfile_writev(ldb_wfile_t *file, const ldb_slice_t *iov, size_t count) {
+  struct iovec vec[LDB_IOV_MAX];
+  size_t size = file->pos;
+  size_t i;
+  int n = 0;
+
+  if (file->pos > 0) {
+    vec[n].iov_base = file->buf;
+    vec[n].iov_len = file->pos;
+    n++;
+  }
+
+  for (i = 0; i <= count; i++) {
+    if (n == LDB_IOV_MAX || (i == count && n > 0)) {
+#ifdef HAVE_FALLOCATE
+      ldb_wfile_reserve(file, size);
+#endif
+
+      if (ldb_writev(file->fd, vec, n) < 0)
+        return ldb_system_error();
+
+#ifdef HAVE_FALLOCATE
+      file->size += size;
+#endif
+
+      file->pos = 0;
+      size = 0;
+      n = 0;
+    }
+
+    if (i < count && iov[i].size > 0) {
+      vec[n].iov_base = iov[i].data;
+      vec[n].iov_len = iov[i].size;
+      size += iov[i].size;
+      n++;
+    }
+  }
+
+  return LDB_OK;
+}
+#endif
+
+static LDB_INLINE int
+ldb_wfile_appendv0(ldb_wfile_t *file, const ldb_slice_t *iov, size_t count) {
+  size_t size = 0;
+  size_t i;
+  int rc;
+
+#ifdef HAVE_DIRECT
+  if (file->direct) {
+    for (i = 0; i < count; i++) {
+      if ((rc = ldb_direct_append(file, iov[i].data, iov[i].size)))
+        return rc;
+    }
+
+    return LDB_OK;
+  }
+#endif
+
+  for (i = 0; i < count; i++)
+    size += iov[i].size;
+
+  /* Small appends only touch the buffer. */
+  if (size <= LDB_WRITE_BUFFER - file->pos) {
+    for (i = 0; i < count; i++) {
+      if (iov[i].size > 0) {
+        memcpy(file->buf + file->pos, iov[i].data, iov[i].size);
+        file->pos += iov[i].size;
+      }
+    }
+
+    return LDB_OK;
+  }
+
+#ifdef HAVE_WRITEV
+  (void)rc;
+  return ldb_wfile_writev(file, iov, count);
+#else
+  for (i = 0; i < count; i++) {
+    if ((rc = ldb_wfile_append0(file, &iov[i])))
+      return rc;
+  }
+
+  return LDB_OK;
+#endif
+}
+
 int
 ldb_wfile_flush(ldb_wfile_t *file) {
-  int rc = ldb_wfile_write(file, file->buf, file->pos);
+  int rc;
+
+#ifdef HAVE_DIRECT
+  if (file->direct)
+    return ldb_direct_flush(file);
+#endif
+
+  rc = ldb_wfile_write(file, file->buf, file->pos);
   file->pos = 0;
+
   return rc;
 }
 
@@ -1356,6 +2310,45 @@ ldb_wfile_sync0(ldb_wfile_t *file) {
   if ((rc = ldb_wfile_sync_dir(file)))
     return rc;
 
+#ifdef HAVE_DIRECT
+  if (file->direct) {
+    if ((rc = ldb_direct_finish(file)))
+      return rc;
+
+    if (ldb_fsync(file->fd) != 0)
+      return ldb_system_error();
+
+    return LDB_OK;
+  }
+#endif
+
+#if defined(HAVE_IO_URING) && defined(HAVE_FDATASYNC)
+  {
+    ldb_uring_t *ring = ldb_uring_acquire();
+
+    if (ring != NULL) {
+      int ok;
+
+#ifdef HAVE_FALLOCATE
+      ldb_wfile_reserve(file, file->pos);
+#endif
+
+      ok = ldb_uring_sync(ring, file->fd, file->buf, file->pos, &rc);
+
+      ldb_uring_release(ring);
+
+      if (ok) {
+#ifdef HAVE_FALLOCATE
+        if (rc == LDB_OK)
+          file->size += file->pos;
+#endif
+        file->pos = 0;
+        return rc;
+      }
+    }
+  }
+#endif
+
   if ((rc = ldb_wfile_flush(file)))
     return rc;
 
@@ -1367,7 +2360,22 @@ ldb_wfile_sync0(ldb_wfile_t *file) {
 
 int
 ldb_wfile_close(ldb_wfile_t *file) {
-  int rc = ldb_wfile_flush(file);
+  int rc;
+
+#ifdef HAVE_DIRECT
+  if (file->direct)
+    rc = ldb_direct_finish(file);
+  else
+#endif
+  rc = ldb_wfile_flush(file);
+
+#ifdef HAVE_FALLOCATE
+  /* Release the space reserved past the end. */
+  if (file->alloc > file->size && rc == LDB_OK) {
+    if (ftruncate(file->fd, (off_t)file->size) != 0)
+      rc = ldb_system_error();
+  }
+#endif
 
   if (close(file->fd) != 0 && rc == LDB_OK)
     rc = ldb_system_error();
@@ -1385,9 +2393,29 @@ ldb_wfile_destroy(ldb_wfile_t *file) {
   if (file->fd >= 0)
     close(file->fd);
 
+#ifdef HAVE_DIRECT
+  if (file->raw != NULL)
+    ldb_free(file->raw);
+#endif
+
   ldb_free(file);
 }
 
+void
+ldb_wfile_preallocate(ldb_wfile_t *file, uint64_t block_size) {
+#ifdef HAVE_FALLOCATE
+#ifdef HAVE_DIRECT
+  if (file->direct)
+    return;
+#endif
+  file->prealloc = block_size;
+  file->alloc = file->size;
+#else
+  (void)file;
+  (void)block_size;
+#endif
+}
+
 /*
  * WritableFile
  */
@@ -1398,6 +2426,46 @@ ldb_truncfile_create0(const char *filename, ldb_wfile_t **file) {
   return ldb_wfile_create(filename, flags, file);
 }
 
+/*
+ * ReusableFile
+ */
+
+static LDB_INLINE int
+ldb_reusefile_create0(const char *filename, ldb_wfile_t **file) {
+  int flags = O_WRONLY | O_CREAT;
+  return ldb_wfile_create(filename, flags, file);
+}
+
+/*
+ * DirectFile
+ */
+
+static LDB_INLINE int
+ldb_directfile_create0(const char *filename, ldb_wfile_t **file) {
+#ifdef HAVE_DIRECT
+  int flags = O_TRUNC | O_WRONLY | O_CREAT;
+  int direct;
+  int fd = ldb_open_direct(filename, flags, 0644, &direct);
+
+  if (fd < 0)
+    return ldb_system_error();
+
+  *file = ldb_malloc(sizeof(ldb_wfile_t));
+
+  ldb_wfile_init(*file, filename, fd);
+
+  if (direct) {
+    (*file)->direct = 1;
+    (*file)->raw = ldb_malloc(LDB_WRITE_BUFFER + LDB_DIRECT_ALIGN);
+    (*file)->data = ldb_align_ptr((*file)->raw);
+  }
+
+  return LDB_OK;
+#else
+  return ldb_truncfile_create0(filename, file);
+#endif
+}
+
 /*
  * AppendableFile
  */
@@ -1405,7 +2473,18 @@ ldb_truncfile_create0(const char *filename, ldb_wfile_t **file) {
 static LDB_INLINE int
 ldb_appendfile_create0(const char *filename, ldb_wfile_t **file) {
   int flags = O_APPEND | O_WRONLY | O_CREAT;
-  return ldb_wfile_create(filename, flags, file);
+  int rc = ldb_wfile_create(filename, flags, file);
+
+#ifdef HAVE_FALLOCATE
+  if (rc == LDB_OK) {
+    struct stat st;
+
+    if (fstat((*file)->fd, &st) == 0)
+      (*file)->size = st.st_size;
+  }
+#endif
+
+  return rc;
 }
 
 /*
@@ -1433,6 +2512,52 @@ ldb_logger_open(const char *filename, ldb_logger_t **result) {
   return LDB_OK;
 }
 
+/*
+ * Memory
+ */
+
+void *
+ldb_pages_alloc(size_t size) {
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *ptr = MAP_FAILED;
+
+#if defined(MAP_HUGETLB) && (defined(__x86_64__) || defined(__i386__))
+  /* Explicit huge pages (2mb here) must be reserved by the system
+     administrator, so this usually fails. */
+  if ((size & ((2 << 20) - 1)) == 0)
+    ptr = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+#endif
+
+  if (ptr == MAP_FAILED) {
+    ptr = mmap(NULL, size, prot, flags, -1, 0);
+
+    if (ptr == MAP_FAILED)
+      return NULL;
+
+#ifdef MADV_HUGEPAGE
+    /* Ask for transparent huge pages instead. */
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+  }
+
+  return ptr;
+#else
+  return ldb_malloc(size);
+#endif
+}
+
+void
+ldb_pages_free(void *ptr, size_t size) {
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+  munmap(ptr, size);
+#else
+  (void)size;
+  ldb_free(ptr);
+#endif
+}
+
 /*
  * Time
  */
@@ -1447,6 +2572,18 @@ ldb_now_usec(void) {
   return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
+int64_t
+ldb_now_nsec(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+
+  return ldb_now_usec() * 1000;
+}
+
 void
 ldb_sleep_usec(int64_t usec) {
   struct timeval tv;
@@ -44,6 +44,8 @@
 
 #define LDB_WRITE_BUFFER 65536
 #define LDB_MMAP_LIMIT (sizeof(void *) >= 8 ? 1000 : 0)
+#define LDB_DIRECT_ALIGN 4096
+#define LDB_READ_BATCH 64
 
 /*
  * Types
@@ -405,6 +407,46 @@ tls_buffer_get(size_t size) {
   return ptr;
 }
 
+static HANDLE
+tls_event_get(void) {
+  static ldb_atomic(int) state = 0;
+  static DWORD tls_index = 0;
+  HANDLE event;
+  int value;
+
+  while ((value = ldb_atomic_compare_exchange(&state, 0, 1)) == 1)
+    Sleep(0);
+
+  if (value == 0) {
+    tls_index = TlsAlloc();
+
+    if (tls_index == TLS_OUT_OF_INDEXES)
+      abort(); /* LCOV_EXCL_LINE */
+
+    if (ldb_atomic_exchange(&state, 2) != 1)
+      abort(); /* LCOV_EXCL_LINE */
+  } else {
+    assert(value == 2);
+  }
+
+  event = TlsGetValue(tls_index);
+
+  if (event == NULL) {
+    if (GetLastError() != ERROR_SUCCESS)
+      abort(); /* LCOV_EXCL_LINE */
+
+    event = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+    if (event == NULL)
+      abort(); /* LCOV_EXCL_LINE */
+
+    if (!TlsSetValue(tls_index, event))
+      abort(); /* LCOV_EXCL_LINE */
+  }
+
+  return event;
+}
+
 static int
 ldb_convert_error(DWORD code) {
   if (code == ERROR_SUCCESS || code > INT_MAX)
@@ -492,27 +534,81 @@ ldb_read(HANDLE handle, void *dst, size_t len) {
   return cnt;
 }
 
+static void *
+ldb_align_ptr(void *ptr) {
+  uintptr_t addr = (uintptr_t)ptr;
+
+  addr = (addr + LDB_DIRECT_ALIGN - 1) & ~((uintptr_t)LDB_DIRECT_ALIGN - 1);
+
+  return (void *)addr;
+}
+
+/* Start a read at `off`. Returns 1 if the caller must wait for it,
+   0 if it hit the end of the file and -1 on error. A read on a handle
+   opened with FILE_FLAG_OVERLAPPED needs its own event, since the
+   handle is signaled by whichever request finishes first. */
+static int
+ldb_read_start(HANDLE handle,
+               void *dst,
+               DWORD len,
+               uint64_t off,
+               OVERLAPPED *ol,
+               HANDLE event) {
+  ULARGE_INTEGER ul;
+  DWORD code;
+
+  memset(ol, 0, sizeof(*ol));
+
+  ul.QuadPart = off;
+  ol->OffsetHigh = ul.HighPart;
+  ol->Offset = ul.LowPart;
+  ol->hEvent = event;
+
+  if (ReadFile(handle, dst, len, NULL, ol))
+    return 1;
+
+  code = GetLastError();
+
+  if (code == ERROR_IO_PENDING)
+    return 1;
+
+  if (code == ERROR_HANDLE_EOF)
+    return 0;
+
+  return -1;
+}
+
+static int
+ldb_io_wait(HANDLE handle, OVERLAPPED *ol, DWORD *count) {
+  *count = 0;
+
+  if (!GetOverlappedResult(handle, ol, count, TRUE)) {
+    if (GetLastError() != ERROR_HANDLE_EOF)
+      return 0;
+
+    *count = 0;
+  }
+
+  return 1;
+}
+
 static int64_t
 ldb_pread(HANDLE handle, void *dst, size_t len, uint64_t off) {
+  HANDLE event = tls_event_get();
   unsigned char *buf = dst;
-  ULARGE_INTEGER ul;
   int64_t cnt = 0;
   OVERLAPPED ol;
 
   while (len > 0) {
     DWORD max = LDB_MIN(len, 1 << 30);
     DWORD nread = 0;
+    int ret = ldb_read_start(handle, buf, max, off, &ol, event);
 
-    memset(&ol, 0, sizeof(ol));
-
-    ul.QuadPart = off;
-    ol.OffsetHigh = ul.HighPart;
-    ol.Offset = ul.LowPart;
+    if (ret < 0)
+      return -1;
 
-    if (!ReadFile(handle, buf, max, &nread, &ol)) {
-      if (GetLastError() != ERROR_HANDLE_EOF)
-        return -1;
-    }
+    if (ret > 0 && !ldb_io_wait(handle, &ol, &nread))
+      return -1;
 
     if (nread == 0)
       break;
@@ -526,6 +622,48 @@ ldb_pread(HANDLE handle, void *dst, size_t len, uint64_t off) {
   return cnt;
 }
 
+/* Read through an aligned bounce buffer. With FILE_FLAG_NO_BUFFERING
+   the offset, length and memory must all be multiples of the sector
+   size. */
+static int64_t
+ldb_pread_direct(HANDLE handle, void *dst, size_t len, uint64_t off) {
+  uint64_t start = off & ~((uint64_t)LDB_DIRECT_ALIGN - 1);
+  size_t skip = off - start;
+  size_t size = (skip + len + LDB_DIRECT_ALIGN - 1)
+              & ~((size_t)LDB_DIRECT_ALIGN - 1);
+  unsigned char *raw = ldb_malloc(size + LDB_DIRECT_ALIGN);
+  unsigned char *buf = ldb_align_ptr(raw);
+  HANDLE event = tls_event_get();
+  size_t pos = 0;
+  int64_t nread;
+  OVERLAPPED ol;
+
+  while (pos < size) {
+    DWORD max = LDB_MIN(size - pos, 1 << 30);
+    DWORD count = 0;
+    int ret = ldb_read_start(handle, buf + pos, max, start + pos, &ol, event);
+
+    if (ret < 0 || (ret > 0 && !ldb_io_wait(handle, &ol, &count))) {
+      ldb_free(raw);
+      return -1;
+    }
+
+    pos += count;
+
+    /* Short read: end of file. */
+    if (count == 0 || (pos & (LDB_DIRECT_ALIGN - 1)) != 0)
+      break;
+  }
+
+  nread = pos > skip ? LDB_MIN(pos - skip, len) : 0;
+
+  memcpy(dst, buf + skip, nread);
+
+  ldb_free(raw);
+
+  return nread;
+}
+
 static int64_t
 ldb_write(HANDLE handle, const void *src, size_t len) {
   const unsigned char *buf = src;
@@ -945,6 +1083,12 @@ ldb_sync_dir(const char *dirname) {
   return LDB_OK;
 }
 
+int
+ldb_evict_file(const char *filename) {
+  (void)filename;
+  return LDB_NOSUPPORT;
+}
+
 int
 ldb_file_size(const char *filename, uint64_t *size) {
   LARGE_INTEGER result;
@@ -1189,6 +1333,7 @@ struct ldb_rfile_s {
   HANDLE handle;
   ldb_limiter_t *limiter;
   int mapped;
+  int direct;
   unsigned char *base;
   size_t length;
   CRITICAL_SECTION mutex;
@@ -1200,6 +1345,7 @@ ldb_seqfile_init(ldb_rfile_t *file, HANDLE handle) {
   file->handle = handle;
   file->limiter = NULL;
   file->mapped = 0;
+  file->direct = 0;
   file->base = NULL;
   file->length = 0;
   file->has_mutex = 0;
@@ -1210,6 +1356,7 @@ ldb_randfile_init(ldb_rfile_t *file, HANDLE handle) {
   file->handle = handle;
   file->limiter = NULL;
   file->mapped = 0;
+  file->direct = 0;
   file->base = NULL;
   file->length = 0;
   file->has_mutex = 0;
@@ -1228,6 +1375,7 @@ ldb_mapfile_init(ldb_rfile_t *file,
   file->handle = INVALID_HANDLE_VALUE;
   file->limiter = limiter;
   file->mapped = 1;
+  file->direct = 0;
   file->base = base;
   file->length = length;
   file->has_mutex = 0;
@@ -1238,6 +1386,13 @@ ldb_rfile_mapped(ldb_rfile_t *file) {
   return file->mapped;
 }
 
+void
+ldb_rfile_readahead(ldb_rfile_t *file, uint64_t offset, size_t count) {
+  (void)file;
+  (void)offset;
+  (void)count;
+}
+
 int
 ldb_rfile_read(ldb_rfile_t *file,
                ldb_slice_t *result,
@@ -1303,6 +1458,8 @@ ldb_rfile_pread0(ldb_rfile_t *file,
       nread = ldb_read(file->handle, buf, count);
 
     LeaveCriticalSection(&file->mutex);
+  } else if (file->direct) {
+    nread = ldb_pread_direct(file->handle, buf, count, offset);
   } else {
     /* Windows NT. */
     nread = ldb_pread(file->handle, buf, count, offset);
@@ -1316,6 +1473,86 @@ ldb_rfile_pread0(ldb_rfile_t *file,
   return LDB_OK;
 }
 
+/* Queue up to LDB_READ_BATCH reads on the overlapped handle before
+   waiting on any of them. Returns the number of requests handled. */
+static size_t
+ldb_rfile_overlapped(ldb_rfile_t *file, ldb_readreq_t *reqs, size_t count) {
+  OVERLAPPED ol[LDB_READ_BATCH];
+  HANDLE events[LDB_READ_BATCH];
+  int started[LDB_READ_BATCH];
+  size_t i, n = 0;
+
+  count = LDB_MIN(count, LDB_READ_BATCH);
+
+  for (n = 0; n < count; n++) {
+    ldb_readreq_t *req = &reqs[n];
+
+    if (req->count > (1 << 30))
+      break;
+
+    events[n] = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+    if (events[n] == NULL)
+      break;
+
+    started[n] = ldb_read_start(file->handle, req->buf, (DWORD)req->count,
+                                req->offset, &ol[n], events[n]);
+
+    if (started[n] < 0)
+      req->status = ldb_system_error();
+  }
+
+  for (i = 0; i < n; i++) {
+    ldb_readreq_t *req = &reqs[i];
+    DWORD nread = 0;
+
+    if (started[i] < 0) {
+      CloseHandle(events[i]);
+      continue;
+    }
+
+    if (started[i] > 0 && !ldb_io_wait(file->handle, &ol[i], &nread)) {
+      req->status = ldb_system_error();
+    } else if (nread > 0 && nread < req->count) {
+      /* Short read: let the synchronous path pick up the rest. */
+      req->status = ldb_rfile_pread0(file, &req->result, req->buf,
+                                     req->count, req->offset);
+    } else {
+      ldb_slice_set(&req->result, req->buf, nread);
+      req->status = LDB_OK;
+    }
+
+    CloseHandle(events[i]);
+  }
+
+  return n;
+}
+
+static void
+ldb_rfile_multiread0(ldb_rfile_t *file, ldb_readreq_t *reqs, size_t count) {
+  size_t i;
+
+  /* Overlapped I/O only exists on NT. */
+  if (!file->mapped && !file->direct && !file->has_mutex && count > 1) {
+    while (count > 0) {
+      size_t n = ldb_rfile_overlapped(file, reqs, count);
+
+      if (n == 0)
+        break;
+
+      reqs += n;
+      count -= n;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    ldb_readreq_t *req = &reqs[i];
+
+    req->status = ldb_rfile_pread0(file, &req->result, req->buf,
+                                   req->count, req->offset);
+  }
+}
+
 static int
 ldb_rfile_close(ldb_rfile_t *file) {
   int rc = LDB_OK;
@@ -1334,6 +1571,7 @@ ldb_rfile_close(ldb_rfile_t *file) {
   file->handle = INVALID_HANDLE_VALUE;
   file->limiter = NULL;
   file->mapped = 0;
+  file->direct = 0;
   file->base = NULL;
   file->length = 0;
 
@@ -1381,29 +1619,64 @@ ldb_seqfile_create(const char *filename, ldb_rfile_t **file) {
  */
 
 int
-ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap) {
+ldb_randfile_create(const char *filename, ldb_rfile_t **file, int flags) {
+  int use_mmap = (flags & LDB_RFILE_MMAP) && !(flags & LDB_RFILE_DIRECT);
+  DWORD attrs = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS;
+  ldb_limiter_t *limiter = NULL;
   HANDLE mapping = NULL;
   LARGE_INTEGER size;
   void *base = NULL;
   int rc = LDB_OK;
+  int direct = 0;
   HANDLE handle;
 
+  /* Reads on NT always pass an offset, which lets several of them be
+     in flight at once on the same handle. */
+  if (LDBIsWindowsNT()) {
+    attrs |= FILE_FLAG_OVERLAPPED;
+
+    if (flags & LDB_RFILE_DIRECT) {
+      attrs |= FILE_FLAG_NO_BUFFERING;
+      direct = 1;
+    }
+  }
+
   handle = LDBCreateFile(filename,
                          GENERIC_READ,
                          FILE_SHARE_READ | FILE_SHARE_WRITE,
                          NULL,
                          OPEN_EXISTING,
-                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+                         attrs,
                          NULL);
 
+  /* Not supported by this file system. */
+  if (handle == INVALID_HANDLE_VALUE && direct
+      && GetLastError() == ERROR_INVALID_PARAMETER) {
+    handle = LDBCreateFile(filename,
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           NULL,
+                           OPEN_EXISTING,
+                           attrs & ~FILE_FLAG_NO_BUFFERING,
+                           NULL);
+    direct = 0;
+  }
+
   if (handle == INVALID_HANDLE_VALUE)
     return ldb_system_error();
 
-  if (!use_mmap || !ldb_limiter_acquire(&ldb_mmap_limiter)) {
+  if (use_mmap && !(flags & LDB_RFILE_NOLIMIT)) {
+    limiter = &ldb_mmap_limiter;
+    use_mmap = ldb_limiter_acquire(limiter);
+  }
+
+  if (!use_mmap) {
     *file = ldb_malloc(sizeof(ldb_rfile_t));
 
     ldb_randfile_init(*file, handle);
 
+    (*file)->direct = direct;
+
     return LDB_OK;
   }
 
@@ -1432,7 +1705,7 @@ ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap) {
   if (rc == LDB_OK) {
     *file = ldb_malloc(sizeof(ldb_rfile_t));
 
-    ldb_mapfile_init(*file, base, size.QuadPart, &ldb_mmap_limiter);
+    ldb_mapfile_init(*file, base, size.QuadPart, limiter);
   }
 
   if (mapping != NULL)
@@ -1440,8 +1713,8 @@ ldb_randfile_create(const char *filename, ldb_rfile_t **file, int use_mmap) {
 
   CloseHandle(handle);
 
-  if (rc != LDB_OK)
-    ldb_limiter_release(&ldb_mmap_limiter);
+  if (rc != LDB_OK && limiter != NULL)
+    ldb_limiter_release(limiter);
 
   return rc;
 }
@@ -1455,6 +1728,18 @@ struct ldb_wfile_s {
   int manifest;
   unsigned char buf[LDB_WRITE_BUFFER];
   size_t pos;
+  struct ldb_ratelimit_s *ratelimit;
+  int priority;
+  /* Direct I/O: writes go through two aligned buffers at `offset`.
+     One is filled while the other is written out in the background. */
+  int direct;
+  uint64_t offset;
+  unsigned char *raw;
+  unsigned char *data;
+  unsigned char *back;
+  OVERLAPPED ol;
+  HANDLE event;
+  int pending;
 };
 
 static void
@@ -1462,6 +1747,15 @@ ldb_wfile_init(ldb_wfile_t *file, const char *filename, HANDLE handle) {
   file->handle = handle;
   file->manifest = ldb_is_manifest(filename);
   file->pos = 0;
+  file->ratelimit = NULL;
+  file->priority = 0;
+  file->direct = 0;
+  file->offset = 0;
+  file->raw = NULL;
+  file->data = NULL;
+  file->back = NULL;
+  file->event = NULL;
+  file->pending = 0;
 }
 
 static int
@@ -1472,6 +1766,137 @@ ldb_wfile_write(ldb_wfile_t *file, const unsigned char *data, size_t size) {
   return LDB_OK;
 }
 
+/* Wait for the write in flight, if any. */
+static int
+ldb_direct_wait(ldb_wfile_t *file) {
+  DWORD nwrite;
+
+  if (!file->pending)
+    return LDB_OK;
+
+  file->pending = 0;
+
+  if (!GetOverlappedResult(file->handle, &file->ol, &nwrite, TRUE))
+    return ldb_system_error();
+
+  return LDB_OK;
+}
+
+/* Start writing the first `size` bytes of the current buffer at
+   `offset`. Unless `wait` is set, the buffers are swapped and the
+   write completes in the background. */
+static int
+ldb_direct_write(ldb_wfile_t *file, size_t size, int wait) {
+  ULARGE_INTEGER ul;
+  unsigned char *tmp;
+  int rc;
+
+  if ((rc = ldb_direct_wait(file)))
+    return rc;
+
+  memset(&file->ol, 0, sizeof(file->ol));
+
+  ul.QuadPart = file->offset;
+  file->ol.OffsetHigh = ul.HighPart;
+  file->ol.Offset = ul.LowPart;
+  file->ol.hEvent = file->event;
+
+  if (!WriteFile(file->handle, file->data, (DWORD)size, NULL, &file->ol)) {
+    if (GetLastError() != ERROR_IO_PENDING)
+      return ldb_system_error();
+  }
+
+  file->pending = 1;
+
+  if (wait)
+    return ldb_direct_wait(file);
+
+  tmp = file->data;
+  file->data = file->back;
+  file->back = tmp;
+
+  return LDB_OK;
+}
+
+static int
+ldb_direct_append(ldb_wfile_t *file, const unsigned char *data, size_t size) {
+  int rc;
+
+  while (size > 0) {
+    size_t copy_size = LDB_MIN(size, LDB_WRITE_BUFFER - file->pos);
+
+    memcpy(file->data + file->pos, data, copy_size);
+
+    data += copy_size;
+    size -= copy_size;
+    file->pos += copy_size;
+
+    if (file->pos == LDB_WRITE_BUFFER) {
+      if ((rc = ldb_direct_write(file, LDB_WRITE_BUFFER, 0)))
+        return rc;
+
+      file->offset += LDB_WRITE_BUFFER;
+      file->pos = 0;
+    }
+  }
+
+  return LDB_OK;
+}
+
+/* Write out every complete block. The tail moves to the other
+   buffer and stays buffered. */
+static int
+ldb_direct_flush(ldb_wfile_t *file) {
+  size_t size = file->pos & ~((size_t)LDB_DIRECT_ALIGN - 1);
+  int rc;
+
+  if (size == 0)
+    return LDB_OK;
+
+  if ((rc = ldb_direct_write(file, size, 0)))
+    return rc;
+
+  memcpy(file->data, file->back + size, file->pos - size);
+
+  file->offset += size;
+  file->pos -= size;
+
+  return LDB_OK;
+}
+
+/* Write the tail as a zero-padded block and truncate the padding
+   off again. The tail remains buffered and is rewritten in place by
+   the next flush. */
+static int
+ldb_direct_finish(ldb_wfile_t *file) {
+  LARGE_INTEGER end;
+  size_t size;
+  int rc;
+
+  if ((rc = ldb_direct_flush(file)))
+    return rc;
+
+  if (file->pos == 0)
+    return ldb_direct_wait(file);
+
+  size = (file->pos + LDB_DIRECT_ALIGN - 1) & ~((size_t)LDB_DIRECT_ALIGN - 1);
+
+  memset(file->data + file->pos, 0, size - file->pos);
+
+  if ((rc = ldb_direct_write(file, size, 1)))
+    return rc;
+
+  end.QuadPart = file->offset + file->pos;
+
+  if (!LDBSetFilePointerEx(file->handle, end, NULL, FILE_BEGIN))
+    return ldb_system_error();
+
+  if (!SetEndOfFile(file->handle))
+    return ldb_system_error();
+
+  return LDB_OK;
+}
+
 static LDB_INLINE int
 ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   const unsigned char *write_data = data->data;
@@ -1479,6 +1904,9 @@ ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   size_t copy_size;
   int rc;
 
+  if (file->direct)
+    return ldb_direct_append(file, write_data, write_size);
+
   copy_size = LDB_MIN(write_size, LDB_WRITE_BUFFER - file->pos);
 
   if (copy_size > 0) {
@@ -1504,10 +1932,39 @@ ldb_wfile_append0(ldb_wfile_t *file, const ldb_slice_t *data) {
   return ldb_wfile_write(file, write_data, write_size);
 }
 
+static LDB_INLINE int
+ldb_wfile_appendv0(ldb_wfile_t *file, const ldb_slice_t *iov, size_t count) {
+  size_t i;
+  int rc;
+
+  /* WriteFileGather() only works on unbuffered, page-aligned I/O. */
+  if (file->direct) {
+    for (i = 0; i < count; i++) {
+      if ((rc = ldb_direct_append(file, iov[i].data, iov[i].size)))
+        return rc;
+    }
+
+    return LDB_OK;
+  }
+
+  for (i = 0; i < count; i++) {
+    if ((rc = ldb_wfile_append0(file, &iov[i])))
+      return rc;
+  }
+
+  return LDB_OK;
+}
+
 int
 ldb_wfile_flush(ldb_wfile_t *file) {
-  int rc = ldb_wfile_write(file, file->buf, file->pos);
+  int rc;
+
+  if (file->direct)
+    return ldb_direct_flush(file);
+
+  rc = ldb_wfile_write(file, file->buf, file->pos);
   file->pos = 0;
+
   return rc;
 }
 
@@ -1515,7 +1972,12 @@ static LDB_INLINE int
 ldb_wfile_sync0(ldb_wfile_t *file) {
   int rc;
 
-  if ((rc = ldb_wfile_flush(file)))
+  if (file->direct)
+    rc = ldb_direct_finish(file);
+  else
+    rc = ldb_wfile_flush(file);
+
+  if (rc != LDB_OK)
     return rc;
 
   if (!FlushFileBuffers(file->handle))
@@ -1526,7 +1988,12 @@ ldb_wfile_sync0(ldb_wfile_t *file) {
 
 int
 ldb_wfile_close(ldb_wfile_t *file) {
-  int rc = ldb_wfile_flush(file);
+  int rc;
+
+  if (file->direct)
+    rc = ldb_direct_finish(file);
+  else
+    rc = ldb_wfile_flush(file);
 
   if (!CloseHandle(file->handle) && rc == LDB_OK)
     rc = ldb_system_error();
@@ -1538,9 +2005,19 @@ ldb_wfile_close(ldb_wfile_t *file) {
 
 void
 ldb_wfile_destroy(ldb_wfile_t *file) {
+  /* The kernel may still be reading from our buffer. */
+  if (file->pending)
+    ldb_direct_wait(file);
+
   if (file->handle != INVALID_HANDLE_VALUE)
     CloseHandle(file->handle);
 
+  if (file->event != NULL)
+    CloseHandle(file->event);
+
+  if (file->raw != NULL)
+    ldb_free(file->raw);
+
   ldb_free(file);
 }
 
@@ -1568,6 +2045,86 @@ ldb_truncfile_create0(const char *filename, ldb_wfile_t **file) {
   return LDB_OK;
 }
 
+void
+ldb_wfile_preallocate(ldb_wfile_t *file, uint64_t block_size) {
+  (void)file;
+  (void)block_size;
+}
+
+/*
+ * ReusableFile
+ */
+
+static LDB_INLINE int
+ldb_reusefile_create0(const char *filename, ldb_wfile_t **file) {
+  HANDLE handle = LDBCreateFile(filename,
+                                GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                NULL,
+                                OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL,
+                                NULL);
+
+  if (handle == INVALID_HANDLE_VALUE)
+    return ldb_system_error();
+
+  *file = ldb_malloc(sizeof(ldb_wfile_t));
+
+  ldb_wfile_init(*file, filename, handle);
+
+  return LDB_OK;
+}
+
+/*
+ * DirectFile
+ */
+
+static LDB_INLINE int
+ldb_directfile_create0(const char *filename, ldb_wfile_t **file) {
+  HANDLE handle, event;
+
+  if (!LDBIsWindowsNT())
+    return ldb_truncfile_create0(filename, file);
+
+  handle = LDBCreateFile(filename,
+                         GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL,
+                         CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL |
+                         FILE_FLAG_NO_BUFFERING |
+                         FILE_FLAG_OVERLAPPED,
+                         NULL);
+
+  /* Not supported by this file system. */
+  if (handle == INVALID_HANDLE_VALUE) {
+    if (GetLastError() == ERROR_INVALID_PARAMETER)
+      return ldb_truncfile_create0(filename, file);
+
+    return ldb_system_error();
+  }
+
+  event = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+  if (event == NULL) {
+    int rc = ldb_system_error();
+    CloseHandle(handle);
+    return rc;
+  }
+
+  *file = ldb_malloc(sizeof(ldb_wfile_t));
+
+  ldb_wfile_init(*file, filename, handle);
+
+  (*file)->direct = 1;
+  (*file)->raw = ldb_malloc(2 * LDB_WRITE_BUFFER + LDB_DIRECT_ALIGN);
+  (*file)->data = ldb_align_ptr((*file)->raw);
+  (*file)->back = (*file)->data + LDB_WRITE_BUFFER;
+  (*file)->event = event;
+
+  return LDB_OK;
+}
+
 /*
  * AppendableFile
  */
@@ -1638,6 +2195,22 @@ ldb_logger_open(const char *filename, ldb_logger_t **result) {
   return LDB_OK;
 }
 
+/*
+ * Memory
+ */
+
+void *
+ldb_pages_alloc(size_t size) {
+  /* Large pages require SeLockMemoryPrivilege; use normal ones. */
+  return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void
+ldb_pages_free(void *ptr, size_t size) {
+  (void)size;
+  VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
 /*
  * Time
  */
@@ -1656,6 +2229,17 @@ ldb_now_usec(void) {
   return (ticks.QuadPart - epoch) / 10;
 }
 
+int64_t
+ldb_now_nsec(void) {
+  LARGE_INTEGER freq, ticks;
+
+  if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&ticks))
+    return ldb_now_usec() * 1000;
+
+  return (ticks.QuadPart / freq.QuadPart) * 1000000000
+       + (ticks.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
+
 void
 ldb_sleep_usec(int64_t usec) {
   if (usec < 0)
@@ -6,8 +6,47 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "atomic.h"
 #include "internal.h"
 
+/*
+ * Constants
+ */
+
+#define LDB_SMALL_ALIGN 16
+#define LDB_SMALL_CLASSES 24 /* Up to 384 bytes. */
+#define LDB_SMALL_SLOTS 64 /* Per class. */
+
+/*
+ * Allocator
+ */
+
+static void *(*ldb_alloc_func)(size_t) = malloc;
+static void *(*ldb_resize_func)(void *, size_t) = realloc;
+static void (*ldb_release_func)(void *) = free;
+
+/* Freed small objects. Each slot holds a single object, so a slot
+   which is emptied and refilled between a load and a CAS still holds
+   a free object of its class: there is no ABA problem. */
+#if defined(LDB_HAVE_ATOMIC_PTR_CAS)
+static ldb_atomic_ptr(void) ldb_small_slots[LDB_SMALL_CLASSES]
+                                           [LDB_SMALL_SLOTS];
+#endif
+
+/* Slot last filled by this thread. Each thread uses the slots of a
+   class as a stack, freeing upward from here and allocating downward,
+   so that it usually finds a slot at once, and threads keep to
+   different slots. Slots filled by other threads are found by going
+   on around. */
+#if defined(LDB_HAVE_ATOMIC_PTR_CAS) && defined(LDB_TLS)
+static LDB_TLS unsigned char ldb_small_hint[LDB_SMALL_CLASSES];
+#  define ldb_small_hint_get(i) ldb_small_hint[i]
+#  define ldb_small_hint_set(i, x) (ldb_small_hint[i] = (x))
+#else
+#  define ldb_small_hint_get(i) 0
+#  define ldb_small_hint_set(i, x) ((void)(x))
+#endif
+
 /*
  * Helpers
  */
@@ -23,7 +62,7 @@ ldb_assert_fail(const char *file, int line, const char *expr) {
 
 LDB_MALLOC void *
 ldb_malloc(size_t size) {
-  void *ptr = malloc(size);
+  void *ptr = ldb_alloc_func(size);
 
   if (ptr == NULL)
     abort(); /* LCOV_EXCL_LINE */
@@ -33,7 +72,7 @@ ldb_malloc(size_t size) {
 
 LDB_MALLOC void *
 ldb_realloc(void *ptr, size_t size) {
-  ptr = realloc(ptr, size);
+  ptr = ldb_resize_func(ptr, size);
 
   if (ptr == NULL)
     abort(); /* LCOV_EXCL_LINE */
@@ -44,5 +83,99 @@ ldb_realloc(void *ptr, size_t size) {
 void
 ldb_free(void *ptr) {
   if (ptr != NULL)
-    free(ptr);
+    ldb_release_func(ptr);
+}
+
+void
+ldb_set_allocator(void *(*alloc)(size_t size),
+                  void *(*resize)(void *ptr, size_t size),
+                  void (*release)(void *ptr)) {
+#if defined(LDB_HAVE_ATOMIC_PTR_CAS)
+  int i, j;
+
+  /* The pooled objects belong to the old allocator. */
+  for (i = 0; i < LDB_SMALL_CLASSES; i++) {
+    for (j = 0; j < LDB_SMALL_SLOTS; j++) {
+      void *ptr = ldb_atomic_load_ptr(&ldb_small_slots[i][j],
+                                      ldb_order_acquire);
+
+      if (ptr != NULL) {
+        ldb_atomic_store_ptr(&ldb_small_slots[i][j], NULL,
+                             ldb_order_relaxed);
+        ldb_free(ptr);
+      }
+    }
+  }
+#endif
+
+  ldb_alloc_func = alloc != NULL ? alloc : malloc;
+  ldb_resize_func = resize != NULL ? resize : realloc;
+  ldb_release_func = release != NULL ? release : free;
+}
+
+LDB_MALLOC void *
+ldb_small_alloc(size_t size) {
+  size_t index = (size - 1) / LDB_SMALL_ALIGN;
+
+  if (size == 0 || index >= LDB_SMALL_CLASSES)
+    return ldb_malloc(size);
+
+#if defined(LDB_HAVE_ATOMIC_PTR_CAS)
+  {
+    unsigned int hint = ldb_small_hint_get(index);
+    int i;
+
+    for (i = 0; i < LDB_SMALL_SLOTS; i++) {
+      unsigned int slot = (hint + LDB_SMALL_SLOTS - i) % LDB_SMALL_SLOTS;
+      ldb_atomic_ptr(void) *obj = &ldb_small_slots[index][slot];
+      void *ptr = ldb_atomic_load_ptr(obj, ldb_order_acquire);
+
+      if (ptr != NULL && ldb_atomic_compare_exchange_ptr(obj, &ptr, NULL)) {
+        /* The slot below is the next to take from. */
+        slot = (slot + LDB_SMALL_SLOTS - 1) % LDB_SMALL_SLOTS;
+        ldb_small_hint_set(index, slot);
+        return ptr;
+      }
+    }
+  }
+#endif
+
+  /* Any object of the class can be reused for any size in it. */
+  return ldb_malloc((index + 1) * LDB_SMALL_ALIGN);
+}
+
+void
+ldb_small_free(void *ptr, size_t size) {
+  size_t index = (size - 1) / LDB_SMALL_ALIGN;
+
+  if (ptr == NULL)
+    return;
+
+  if (size == 0 || index >= LDB_SMALL_CLASSES) {
+    ldb_free(ptr);
+    return;
+  }
+
+#if defined(LDB_HAVE_ATOMIC_PTR_CAS)
+  {
+    unsigned int hint = ldb_small_hint_get(index);
+    int i;
+
+    for (i = 0; i < LDB_SMALL_SLOTS; i++) {
+      unsigned int slot = (hint + 1 + i) % LDB_SMALL_SLOTS;
+      ldb_atomic_ptr(void) *obj = &ldb_small_slots[index][slot];
+      void *expect = ldb_atomic_load_ptr(obj, ldb_order_relaxed);
+
+      if (expect != NULL)
+        continue;
+
+      if (ldb_atomic_compare_exchange_ptr(obj, &expect, ptr)) {
+        ldb_small_hint_set(index, slot);
+        return;
+      }
+    }
+  }
+#endif
+
+  ldb_free(ptr);
 }
@@ -57,6 +57,13 @@
 #  define UNLIKELY(x) (x)
 #endif
 
+/* Hint that *p will soon be read. A no-op if unsupported. */
+#if LDB_GNUC_PREREQ(3, 1) || LDB_HAS_BUILTIN(__builtin_prefetch)
+#  define LDB_PREFETCH(p) __builtin_prefetch(p)
+#else
+#  define LDB_PREFETCH(p) ((void)0)
+#endif
+
 /*
  * Static Assertions
  */
@@ -118,6 +125,17 @@
 
 #define LDB_STATIC LDB_UNUSED static LDB_INLINE
 
+/* Thread-local storage class (left undefined if unavailable). */
+#if !defined(_WIN32) && !defined(LDB_PTHREAD)
+#  define LDB_TLS /* Single-threaded. */
+#elif LDB_STDC_VERSION >= 201112L && !defined(__STDC_NO_THREADS__)
+#  define LDB_TLS _Thread_local
+#elif LDB_GNUC_PREREQ(3, 3) || defined(__clang__)
+#  define LDB_TLS __thread
+#elif defined(_MSC_VER) && _MSC_VER >= 1300
+#  define LDB_TLS __declspec(thread)
+#endif
+
 /*
  * Macros
  */
@@ -134,7 +152,7 @@
 LDB_EXTERN LDB_NORETURN void
 ldb_assert_fail(const char *file, int line, const char *expr);
 
-LDB_MALLOC void *
+LDB_EXTERN LDB_MALLOC void *
 ldb_malloc(size_t size);
 
 LDB_MALLOC void *
@@ -143,4 +161,24 @@ ldb_realloc(void *ptr, size_t size);
 LDB_EXTERN void
 ldb_free(void *ptr);
 
+/* Route every allocation of the library through the given functions
+   (NULL for those of libc). Buffers which the database takes ownership
+   of, or which are freed with ldb_free(), must then come from
+   ldb_malloc(). Must be called before anything else is allocated, or
+   once everything allocated has been freed. */
+LDB_EXTERN void
+ldb_set_allocator(void *(*alloc)(size_t size),
+                  void *(*resize)(void *ptr, size_t size),
+                  void (*release)(void *ptr));
+
+/* Allocate a small object (such as an iterator) which is short-lived
+   and allocated often. Freed objects of up to 384 bytes are kept for
+   reuse, sorted by size class. */
+LDB_MALLOC void *
+ldb_small_alloc(size_t size);
+
+/* Free an object from ldb_small_alloc(), given the same size. */
+void
+ldb_small_free(void *ptr, size_t size);
+
 #endif /* LDB_INTERNAL_H */
@@ -0,0 +1,233 @@
+/*!
+ * latency.c - latency histograms for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "buffer.h"
+#include "internal.h"
+#include "latency.h"
+#include "port.h"
+
+/*
+ * Constants
+ */
+
+/* Each power of two is split into four buckets, up to 2^40 usec. */
+#define LDB_LATENCY_BUCKETS (4 + 4 * 38)
+
+#define LDB_LATENCY_STRIPES 16
+
+static const char *ldb_latency_names[LDB_LATENCY_TOTAL] = {
+  "get",
+  "write",
+  "seek",
+  "next",
+  "wal-sync",
+  "flush",
+  "compaction"
+};
+
+/*
+ * Histogram
+ */
+
+typedef struct ldb_hist_s {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[LDB_LATENCY_BUCKETS];
+} ldb_hist_t;
+
+static int
+ldb_hist_bucket(uint64_t x) {
+  int bits = 2;
+  int index;
+
+  if (x < 4)
+    return (int)x;
+
+  while (bits < 63 && (x >> (bits + 1)) != 0)
+    bits++;
+
+  index = (bits - 1) * 4 + (int)((x >> (bits - 2)) & 3);
+
+  return LDB_MIN(index, LDB_LATENCY_BUCKETS - 1);
+}
+
+static double
+ldb_hist_lower(int index) {
+  if (index < 4)
+    return index;
+
+  return (double)((uint64_t)(4 + (index & 3)) << (index / 4 - 1));
+}
+
+static void
+ldb_hist_merge(ldb_hist_t *z, const ldb_hist_t *x) {
+  int i;
+
+  z->count += x->count;
+  z->sum += x->sum;
+  z->max = LDB_MAX(z->max, x->max);
+
+  for (i = 0; i < LDB_LATENCY_BUCKETS; i++)
+    z->buckets[i] += x->buckets[i];
+}
+
+static double
+ldb_hist_percentile(const ldb_hist_t *h, double p) {
+  double threshold = h->count * (p / 100.0);
+  double sum = 0;
+  int i;
+
+  for (i = 0; i < LDB_LATENCY_BUCKETS; i++) {
+    double count = (double)h->buckets[i];
+
+    sum += count;
+
+    if (count > 0 && sum >= threshold) {
+      /* Scale linearly within this bucket. */
+      double left = ldb_hist_lower(i);
+      double right = ldb_hist_lower(i + 1);
+      double pos = (threshold - (sum - count)) / count;
+      double r = left + (right - left) * pos;
+
+      return LDB_MIN(r, (double)h->max);
+    }
+  }
+
+  return (double)h->max;
+}
+
+/*
+ * Latency
+ */
+
+typedef struct ldb_stripe_s {
+  ldb_mutex_t mutex;
+  ldb_hist_t hists[LDB_LATENCY_TOTAL];
+} ldb_stripe_t;
+
+struct ldb_latency_s {
+  ldb_stripe_t stripes[LDB_LATENCY_STRIPES];
+};
+
+ldb_latency_t *
+ldb_latency_create(void) {
+  ldb_latency_t *lat = ldb_malloc(sizeof(ldb_latency_t));
+  int i;
+
+  for (i = 0; i < LDB_LATENCY_STRIPES; i++) {
+    ldb_stripe_t *stripe = &lat->stripes[i];
+
+    ldb_mutex_init(&stripe->mutex);
+
+    memset(stripe->hists, 0, sizeof(stripe->hists));
+  }
+
+  return lat;
+}
+
+void
+ldb_latency_destroy(ldb_latency_t *lat) {
+  int i;
+
+  for (i = 0; i < LDB_LATENCY_STRIPES; i++)
+    ldb_mutex_destroy(&lat->stripes[i].mutex);
+
+  ldb_free(lat);
+}
+
+static ldb_stripe_t *
+ldb_latency_stripe(ldb_latency_t *lat) {
+  ldb_tid_t thread = ldb_thread_self();
+  unsigned long tid = 0;
+  uint32_t hash;
+
+  memcpy(&tid, &thread, LDB_MIN(sizeof(tid), sizeof(thread)));
+
+  /* Thread ids are often aligned pointers; mix in the high bits. */
+  hash = (uint32_t)(tid ^ (tid >> 16) ^ (tid >> 31 >> 1));
+  hash *= 0x9e3779b1;
+
+  return &lat->stripes[hash >> 28];
+}
+
+void
+ldb_latency_add(ldb_latency_t *lat, enum ldb_latency_op op, int64_t micros) {
+  ldb_stripe_t *stripe = ldb_latency_stripe(lat);
+  uint64_t x = micros > 0 ? (uint64_t)micros : 0;
+  ldb_hist_t *h = &stripe->hists[op];
+
+  ldb_mutex_lock(&stripe->mutex);
+
+  h->count++;
+  h->sum += x;
+
+  if (x > h->max)
+    h->max = x;
+
+  h->buckets[ldb_hist_bucket(x)]++;
+
+  ldb_mutex_unlock(&stripe->mutex);
+}
+
+void
+ldb_latency_reset(ldb_latency_t *lat) {
+  int i;
+
+  for (i = 0; i < LDB_LATENCY_STRIPES; i++) {
+    ldb_stripe_t *stripe = &lat->stripes[i];
+
+    ldb_mutex_lock(&stripe->mutex);
+
+    memset(stripe->hists, 0, sizeof(stripe->hists));
+
+    ldb_mutex_unlock(&stripe->mutex);
+  }
+}
+
+void
+ldb_latency_export(ldb_buffer_t *z, ldb_latency_t *lat) {
+  ldb_hist_t hists[LDB_LATENCY_TOTAL];
+  char buf[200];
+  int i, op;
+
+  memset(hists, 0, sizeof(hists));
+
+  for (i = 0; i < LDB_LATENCY_STRIPES; i++) {
+    ldb_stripe_t *stripe = &lat->stripes[i];
+
+    ldb_mutex_lock(&stripe->mutex);
+
+    for (op = 0; op < LDB_LATENCY_TOTAL; op++)
+      ldb_hist_merge(&hists[op], &stripe->hists[op]);
+
+    ldb_mutex_unlock(&stripe->mutex);
+  }
+
+  sprintf(buf, "Operation      Count  Avg(us)  P50(us)  P99(us) P999(us)  Max(us)\n"
+               "-----------------------------------------------------------------\n");
+
+  ldb_buffer_string(z, buf);
+
+  for (op = 0; op < LDB_LATENCY_TOTAL; op++) {
+    const ldb_hist_t *h = &hists[op];
+    double avg = h->count > 0 ? (double)h->sum / h->count : 0;
+
+    sprintf(buf, "%-10s %9.0f %8.1f %8.1f %8.1f %8.1f %8.0f\n",
+                 ldb_latency_names[op],
+                 (double)h->count, avg,
+                 ldb_hist_percentile(h, 50.0),
+                 ldb_hist_percentile(h, 99.0),
+                 ldb_hist_percentile(h, 99.9),
+                 (double)h->max);
+
+    ldb_buffer_string(z, buf);
+  }
+}
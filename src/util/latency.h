@@ -0,0 +1,59 @@
+/*!
+ * latency.h - latency histograms for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#ifndef LDB_LATENCY_H
+#define LDB_LATENCY_H
+
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Constants
+ */
+
+enum ldb_latency_op {
+  LDB_LATENCY_GET = 0,
+  LDB_LATENCY_WRITE = 1,
+  LDB_LATENCY_SEEK = 2,
+  LDB_LATENCY_NEXT = 3,
+  LDB_LATENCY_WAL_SYNC = 4,
+  LDB_LATENCY_FLUSH = 5,
+  LDB_LATENCY_COMPACTION = 6,
+  LDB_LATENCY_TOTAL = 7
+};
+
+/*
+ * Types
+ */
+
+/* Histograms of the time taken by each kind of operation. Threads
+   record into one of several stripes (picked by thread id), so
+   concurrent readers and writers rarely contend on a lock. */
+typedef struct ldb_latency_s ldb_latency_t;
+
+/*
+ * Latency
+ */
+
+ldb_latency_t *
+ldb_latency_create(void);
+
+void
+ldb_latency_destroy(ldb_latency_t *lat);
+
+/* Record an operation which took `micros` microseconds. */
+void
+ldb_latency_add(ldb_latency_t *lat, enum ldb_latency_op op, int64_t micros);
+
+void
+ldb_latency_reset(ldb_latency_t *lat);
+
+/* Append a table of count, average, percentiles
+   and maximum (in microseconds) per operation. */
+void
+ldb_latency_export(ldb_buffer_t *z, ldb_latency_t *lat);
+
+#endif /* LDB_LATENCY_H */
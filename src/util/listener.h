@@ -0,0 +1,103 @@
+/*!
+ * listener.h - event listener for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_LISTENER_H
+#define LDB_LISTENER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Constants
+ */
+
+/* Reasons a write may stall. */
+enum ldb_stall_cause {
+  /* Writes are being paced (too many level-0 files). */
+  LDB_STALL_DELAY = 1,
+  /* The memtable is full and the previous one is still flushing. */
+  LDB_STALL_MEMTABLE = 2,
+  /* Writes are stopped (far too many level-0 files). */
+  LDB_STALL_LEVEL0 = 3
+};
+
+/*
+ * Types
+ */
+
+typedef struct ldb_flushinfo_s {
+  uint64_t memtable_bytes; /* Memory used by the memtable. */
+  uint64_t file_number;    /* The table written (zero if none). */
+  uint64_t file_size;
+  int level;               /* The level the table was placed in. */
+  uint64_t micros;         /* Duration (end only). */
+  int status;              /* Outcome (end only). */
+} ldb_flushinfo_t;
+
+typedef struct ldb_compactinfo_s {
+  int level;               /* Input levels are level and level + 1. */
+  int output_level;
+  int input_files;
+  uint64_t input_bytes;
+  int output_files;        /* End only. */
+  uint64_t output_bytes;   /* End only. */
+  uint64_t micros;         /* End only. */
+  int status;              /* End only. */
+} ldb_compactinfo_t;
+
+typedef struct ldb_stallinfo_s {
+  int cause;               /* See enum ldb_stall_cause. */
+  int level0_files;        /* Level-0 files when the stall began. */
+  uint64_t micros;         /* Duration (planned duration for delays). */
+} ldb_stallinfo_t;
+
+/* An event listener is told when memtable flushes and compactions
+ * begin and end, and when writes stall, along with the sizes and
+ * timings involved. Any hook may be NULL.
+ *
+ * Hooks are called without the database's mutex held, but on the
+ * thread doing the work; a slow hook delays it. Trivial compactions
+ * (a file moved to the next level unchanged) are not reported.
+ *
+ * REQUIRES: the listener must be thread-safe, as flushes, compactions
+ * and writers may report events at the same time.
+ */
+typedef struct ldb_listener_s {
+  void (*flush_begin)(const struct ldb_listener_s *lis,
+                      const ldb_flushinfo_t *info);
+
+  void (*flush_end)(const struct ldb_listener_s *lis,
+                    const ldb_flushinfo_t *info);
+
+  void (*compaction_begin)(const struct ldb_listener_s *lis,
+                           const ldb_compactinfo_t *info);
+
+  void (*compaction_end)(const struct ldb_listener_s *lis,
+                         const ldb_compactinfo_t *info);
+
+  void (*stall_begin)(const struct ldb_listener_s *lis,
+                      const ldb_stallinfo_t *info);
+
+  void (*stall_end)(const struct ldb_listener_s *lis,
+                    const ldb_stallinfo_t *info);
+
+  /* Extra state. */
+  void *state;
+} ldb_listener_t;
+
+/*
+ * Macros
+ */
+
+/* Call a hook (if it exists). */
+#define ldb_listener_notify(lis, hook, info) do { \
+  if ((lis) != NULL && (lis)->hook != NULL)       \
+    (lis)->hook(lis, info);                       \
+} while (0)
+
+#endif /* LDB_LISTENER_H */
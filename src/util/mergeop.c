@@ -0,0 +1,152 @@
+/*!
+ * mergeop.c - merge operator for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "array.h"
+#include "buffer.h"
+#include "coding.h"
+#include "internal.h"
+#include "mergeop.h"
+#include "slice.h"
+#include "status.h"
+
+/*
+ * Add Operator
+ */
+
+static int
+add_merge(const ldb_mergeop_t *op,
+          const ldb_slice_t *key,
+          const ldb_slice_t *existing,
+          const ldb_slice_t *operands,
+          size_t count,
+          ldb_slice_t *result) {
+  uint64_t sum = 0;
+  size_t i;
+
+  (void)op;
+  (void)key;
+
+  if (existing != NULL) {
+    if (existing->size != 8)
+      return 0;
+
+    sum = ldb_fixed64_decode(existing->data);
+  }
+
+  for (i = 0; i < count; i++) {
+    if (operands[i].size != 8)
+      return 0;
+
+    sum += ldb_fixed64_decode(operands[i].data);
+  }
+
+  result->data = ldb_malloc(8);
+  result->size = 8;
+
+  ldb_fixed64_write(result->data, sum);
+
+  return 1;
+}
+
+ldb_mergeop_t *
+ldb_mergeop_create_add(void) {
+  ldb_mergeop_t *op = ldb_malloc(sizeof(ldb_mergeop_t));
+
+  op->name = "lcdb.UInt64AddOperator";
+  op->merge = add_merge;
+  op->state = NULL;
+
+  return op;
+}
+
+void
+ldb_mergeop_destroy(ldb_mergeop_t *op) {
+  ldb_free(op);
+}
+
+/*
+ * Merge Context
+ */
+
+void
+ldb_mergectx_init(ldb_mergectx_t *ctx, const ldb_mergeop_t *op) {
+  ctx->op = op;
+  ctx->reverse = 0;
+
+  ldb_buffer_init(&ctx->data);
+  ldb_array_init(&ctx->sizes);
+}
+
+void
+ldb_mergectx_clear(ldb_mergectx_t *ctx) {
+  ldb_buffer_clear(&ctx->data);
+  ldb_array_clear(&ctx->sizes);
+}
+
+void
+ldb_mergectx_reset(ldb_mergectx_t *ctx) {
+  ldb_buffer_reset(&ctx->data);
+  ldb_array_reset(&ctx->sizes);
+}
+
+void
+ldb_mergectx_push(ldb_mergectx_t *ctx, const ldb_slice_t *operand) {
+  ldb_buffer_concat(&ctx->data, operand);
+  ldb_array_push(&ctx->sizes, operand->size);
+}
+
+int
+ldb_mergectx_finish(ldb_mergectx_t *ctx,
+                    const ldb_slice_t *key,
+                    const ldb_slice_t *existing,
+                    ldb_buffer_t *value) {
+  size_t count = ctx->sizes.length;
+  const uint8_t *xp = ctx->data.data;
+  ldb_slice_t *operands;
+  ldb_slice_t result;
+  int rc = LDB_OK;
+  size_t i;
+
+  if (ctx->op == NULL) {
+    ldb_mergectx_reset(ctx);
+    return LDB_INVALID; /* "merge operand without merge operator" */
+  }
+
+  if (value == NULL) {
+    ldb_mergectx_reset(ctx);
+    return LDB_OK;
+  }
+
+  operands = ldb_malloc(count * sizeof(ldb_slice_t));
+
+  for (i = 0; i < count; i++) {
+    size_t j = ctx->reverse ? i : count - 1 - i;
+    size_t size = ctx->sizes.items[i];
+
+    ldb_slice_set(&operands[j], xp, size);
+
+    xp += size;
+  }
+
+  ldb_slice_init(&result);
+
+  if (ctx->op->merge(ctx->op, key, existing, operands, count, &result))
+    ldb_buffer_set(value, result.data, result.size);
+  else
+    rc = LDB_CORRUPTION; /* "merge operator failed" */
+
+  ldb_free(result.data);
+  ldb_free(operands);
+
+  ldb_mergectx_reset(ctx);
+
+  return rc;
+}
@@ -0,0 +1,99 @@
+/*!
+ * mergeop.h - merge operator for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_MERGEOP_H
+#define LDB_MERGEOP_H
+
+#include <stddef.h>
+#include "extern.h"
+#include "types.h"
+
+/*
+ * Types
+ */
+
+/* A merge operator combines the merge operands written for a key (see
+ * ldb_merge()) with the value they apply to. Operands are stored as
+ * blind writes and only combined once the key is read, or once a
+ * compaction finds the value beneath them. This turns read-modify-write
+ * sequences such as counter increments into single writes.
+ */
+typedef struct ldb_mergeop_s {
+  /* The name of the merge operator. Used for logging. */
+  const char *name;
+
+  /* Apply operands[0..count-1] (ordered from oldest to newest) to
+   * "existing", which is NULL if the key has no value. Store the
+   * result in *result as a buffer allocated with ldb_malloc(); the
+   * database takes ownership of it. Return false if the operands
+   * cannot be applied, in which case the read or compaction fails
+   * with LDB_CORRUPTION.
+   *
+   * REQUIRES: the operator must be thread-safe and deterministic.
+   */
+  int (*merge)(const struct ldb_mergeop_s *op,
+               const ldb_slice_t *key,
+               const ldb_slice_t *existing,
+               const ldb_slice_t *operands,
+               size_t count,
+               ldb_slice_t *result);
+
+  /* Extra state. */
+  void *state;
+} ldb_mergeop_t;
+
+/* Merge operands collected by a read, waiting for their base value. */
+typedef struct ldb_mergectx_s {
+  const ldb_mergeop_t *op;
+  ldb_buffer_t data;  /* Concatenated operands. */
+  ldb_array_t sizes;  /* Operand sizes. */
+  int reverse;        /* Operands are pushed oldest first. */
+} ldb_mergectx_t;
+
+/*
+ * Merge Operator
+ */
+
+/* Return a new merge operator which treats values and operands as
+   8 byte little-endian integers and adds them together. */
+LDB_EXTERN ldb_mergeop_t *
+ldb_mergeop_create_add(void);
+
+LDB_EXTERN void
+ldb_mergeop_destroy(ldb_mergeop_t *op);
+
+/*
+ * Merge Context
+ */
+
+void
+ldb_mergectx_init(ldb_mergectx_t *ctx, const ldb_mergeop_t *op);
+
+void
+ldb_mergectx_clear(ldb_mergectx_t *ctx);
+
+void
+ldb_mergectx_reset(ldb_mergectx_t *ctx);
+
+/* Add an operand. Operands are pushed newest first unless
+   ctx->reverse is set. */
+void
+ldb_mergectx_push(ldb_mergectx_t *ctx, const ldb_slice_t *operand);
+
+#define ldb_mergectx_pending(ctx) ((ctx)->sizes.length > 0)
+
+/* Apply the pending operands to "existing" (which may be NULL),
+   storing the result in *value (if non-null), and reset the context.
+   Returns LDB_INVALID if no merge operator is configured. */
+int
+ldb_mergectx_finish(ldb_mergectx_t *ctx,
+                    const ldb_slice_t *key,
+                    const ldb_slice_t *existing,
+                    ldb_buffer_t *value);
+
+#endif /* LDB_MERGEOP_H */
@@ -33,7 +33,97 @@ static const ldb_dbopt_t db_options = {
   /* .compression = */ LDB_SNAPPY_COMPRESSION,
   /* .reuse_logs = */ 0,
   /* .filter_policy = */ NULL,
-  /* .use_mmap = */ 1
+  /* .use_mmap = */ 1,
+  /* .max_background_compactions = */ 1,
+  /* .max_subcompactions = */ 1,
+  /* .max_manual_compactions = */ 1,
+  /* .pipelined_write = */ 0,
+  /* .concurrent_memtable_write = */ 0,
+  /* .max_insert_threads = */ 1,
+  /* .write_group_delay = */ 0,
+  /* .max_write_group_size = */ 1 << 20,
+  /* .block_cache_compressed = */ NULL,
+  /* .partition_index = */ 0,
+  /* .partition_filters = */ 0,
+  /* .index_block_restart_interval = */ 1,
+  /* .index_user_keys = */ 0,
+  /* .cache_index_and_filter_blocks = */ 0,
+  /* .pin_l0_filter_and_index_blocks = */ 0,
+  /* .full_filter = */ 0,
+  /* .prefix_extractor = */ NULL,
+  /* .memtable_bloom_size = */ 0,
+  /* .memtable_huge_page_size = */ 0,
+  /* .memtable_rep = */ LDB_MEMTABLE_SKIPLIST,
+  /* .memtable_hash_buckets = */ 16384,
+  /* .memtable_inline_prefix = */ 0,
+  /* .data_block_hash_index = */ 0,
+  /* .restart_key_prefixes = */ 0,
+  /* .separate_block_values = */ 0,
+  /* .plain_key_size = */ 0,
+  /* .cuckoo_table = */ 0,
+  /* .compression_per_level = */ NULL,
+  /* .compression_levels = */ 0,
+  /* .block_size_per_level = */ NULL,
+  /* .block_size_levels = */ 0,
+  /* .restart_interval_per_level = */ NULL,
+  /* .restart_interval_levels = */ 0,
+  /* .zstd_max_dict_bytes = */ 0,
+  /* .compaction_readahead_size = */ 2 * 1024 * 1024,
+  /* .compaction_warm_reads = */ 0,
+  /* .prepopulate_block_cache = */ 0,
+  /* .block_cache_dump = */ 0,
+  /* .use_direct_reads = */ 0,
+  /* .use_direct_io_for_flush_and_compaction = */ 0,
+  /* .rate_limiter = */ NULL,
+  /* .background_deletes = */ 0,
+  /* .delete_rate = */ 0,
+  /* .level0_file_num_compaction_trigger = */ 4,
+  /* .level0_slowdown_writes_trigger = */ 8,
+  /* .level0_stop_writes_trigger = */ 12,
+  /* .delayed_write_rate = */ 0,
+  /* .num_levels = */ 7,
+  /* .max_bytes_for_level_base = */ 10 * 1048576,
+  /* .max_bytes_for_level_multiplier = */ 10,
+  /* .level_compaction_dynamic_level_bytes = */ 0,
+  /* .max_file_size_multiplier = */ 1,
+  /* .align_compaction_outputs = */ 0,
+  /* .compaction_pri = */ LDB_PRI_ROUND_ROBIN,
+  /* .periodic_compaction_seconds = */ 0,
+  /* .deletion_compaction_ratio = */ 0,
+  /* .min_blob_size = */ 0,
+  /* .blob_gc_age_cutoff = */ 0.25,
+  /* .compaction_style = */ LDB_COMPACTION_LEVEL,
+  /* .universal_size_ratio = */ 1,
+  /* .universal_max_size_amplification_percent = */ 200,
+  /* .fifo_max_table_files_size = */ 1 << 30,
+  /* .ttl = */ 0,
+  /* .compaction_filter = */ NULL,
+  /* .merge_operator = */ NULL,
+  /* .write_buffer_manager = */ NULL,
+  /* .thread_pool = */ NULL,
+  /* .iter_deletion_trigger = */ 0,
+  /* .tombstone_sample_weight = */ 1,
+  /* .max_file_opening_threads = */ 0,
+  /* .lazy_table_open = */ 0,
+  /* .max_manifest_file_size = */ 0,
+  /* .track_latency = */ 0,
+  /* .statistics = */ NULL,
+  /* .listener = */ NULL,
+  /* .block_tracer = */ NULL,
+  /* .wal_compression = */ LDB_NO_COMPRESSION,
+  /* .allow_fallocate = */ 1,
+  /* .recycle_log_file_num = */ 0,
+  /* .manual_wal_flush = */ 0,
+  /* .wal_sync_interval = */ 0,
+  /* .max_mapped_tables = */ 0,
+  /* .in_memory = */ 0,
+  /* .advise_random_on_open = */ 1,
+  /* .persistent_cache = */ NULL,
+  /* .db_paths = */ NULL,
+  /* .num_db_paths = */ 0,
+  /* .wal_block_size = */ 32768,
+  /* .compression_threads = */ 1,
+  /* .adaptive_compression = */ 0
 };
 
 /*
@@ -43,7 +133,16 @@ static const ldb_dbopt_t db_options = {
 static const ldb_readopt_t read_options = {
   /* .verify_checksums = */ 0,
   /* .fill_cache = */ 1,
-  /* .snapshot = */ NULL
+  /* .snapshot = */ NULL,
+  /* .prefix_seek = */ 0,
+  /* .readahead_size = */ 0,
+  /* .rate_limited = */ 0,
+  /* .iterate_lower_bound = */ NULL,
+  /* .iterate_upper_bound = */ NULL,
+  /* .pin_data = */ 0,
+  /* .low_priority = */ 0,
+  /* .tailing = */ 0,
+  /* .keys_only = */ 0
 };
 
 /*
@@ -51,7 +150,8 @@ static const ldb_readopt_t read_options = {
  */
 
 static const ldb_writeopt_t write_options = {
-  /* .sync = */ 0
+  /* .sync = */ 0,
+  /* .disable_wal = */ 0
 };
 
 /*
@@ -61,7 +161,16 @@ static const ldb_writeopt_t write_options = {
 static const ldb_readopt_t iter_options = {
   /* .verify_checksums = */ 0,
   /* .fill_cache = */ 0,
-  /* .snapshot = */ NULL
+  /* .snapshot = */ NULL,
+  /* .prefix_seek = */ 0,
+  /* .readahead_size = */ 0,
+  /* .rate_limited = */ 0,
+  /* .iterate_lower_bound = */ NULL,
+  /* .iterate_upper_bound = */ NULL,
+  /* .pin_data = */ 0,
+  /* .low_priority = */ 0,
+  /* .tailing = */ 0,
+  /* .keys_only = */ 0
 };
 
 /*
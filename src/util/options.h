@@ -24,7 +24,12 @@ struct ldb_bloom_s;
 struct ldb_comparator_s;
 struct ldb_logger_s;
 struct ldb_lru_s;
+struct ldb_pcache_s;
+struct ldb_pool_s;
+struct ldb_ratelimit_s;
+struct ldb_slice_s;
 struct ldb_snapshot_s;
+struct ldb_wbm_s;
 
 /*
  * Constants
@@ -39,9 +44,58 @@ enum ldb_compression {
   /* NOTE: do not change the values of existing entries, as these are
      part of the persistent format on disk. */
   LDB_NO_COMPRESSION = 0x0,
-  LDB_SNAPPY_COMPRESSION = 0x1
+  LDB_SNAPPY_COMPRESSION = 0x1,
+  LDB_LZ4_COMPRESSION = 0x4,
+  LDB_ZSTD_COMPRESSION = 0x7
 };
 
+/* How compactions are picked. */
+enum ldb_compaction_style {
+  /* Keep each level within its target size (the default). */
+  LDB_COMPACTION_LEVEL = 0,
+  /* Tiered: level-0 files and non-empty levels form sorted runs,
+     and runs of similar size are merged. Writes much less at the
+     cost of more space and more runs to check on reads. */
+  LDB_COMPACTION_UNIVERSAL = 1,
+  /* Nothing is rewritten: all tables stay in level-0 and the oldest
+     ones are deleted once they exceed fifo_max_table_files_size or
+     ttl. For data which simply expires, such as time series. */
+  LDB_COMPACTION_FIFO = 2
+};
+
+/* Which file of a level a level compaction starts from. */
+enum ldb_compaction_pri {
+  /* Each file in turn, resuming after the last one compacted. */
+  LDB_PRI_ROUND_ROBIN = 0,
+  /* The file overlapping the fewest bytes of the next level per byte
+     of its own. Rewrites the least data; suits random writes. */
+  LDB_PRI_MIN_OVERLAPPING_RATIO = 1,
+  /* The file holding the oldest data (by creation time), which has
+     gone longest without being merged downwards. */
+  LDB_PRI_OLDEST_FIRST = 2
+};
+
+/* How memtable entries are indexed. */
+enum ldb_memtable_rep {
+  /* A skiplist (the default). Good for any mix of reads and writes. */
+  LDB_MEMTABLE_SKIPLIST = 0,
+  /* An unsorted array, sorted once it is iterated (normally by the
+     flush). The cheapest to fill, but reads of a memtable which is
+     still being written must sort its newest entries first. Meant
+     for bulk loads which are not read until they are done. */
+  LDB_MEMTABLE_VECTOR = 1,
+  /* A hash table of skiplists, one per key prefix (per key without a
+     prefix_extractor). Point lookups search only their own bucket,
+     but iterators sort a copy of the whole memtable. */
+  LDB_MEMTABLE_HASH_SKIPLIST = 2
+};
+
+/* A directory to place table files in (see db_paths). */
+typedef struct ldb_dbpath_s {
+  const char *path;
+  uint64_t target_size;
+} ldb_dbpath_t;
+
 /*
  * DB Options
  */
@@ -95,6 +149,9 @@ typedef struct ldb_dbopt_s {
   /* Number of open files that can be used by the DB. You may need to
    * increase this if your database has a large working set (budget
    * one open file per 2MB of working set).
+   *
+   * If -1, every table is kept open once it is first read, and point
+   * lookups no longer go through the table cache at all.
    */
   int max_open_files; /* 1000 */
 
@@ -143,6 +200,11 @@ typedef struct ldb_dbopt_s {
    * worth switching to LDB_NO_COMPRESSION. Even if the input data is
    * incompressible, the LDB_SNAPPY_COMPRESSION implementation will
    * efficiently detect that and will switch to uncompressed mode.
+   *
+   * LDB_LZ4_COMPRESSION decodes faster than snappy, while
+   * LDB_ZSTD_COMPRESSION trades speed for a much better ratio. Both
+   * require building against the respective library; otherwise blocks
+   * are stored uncompressed and tables using them can not be read.
    */
   enum ldb_compression compression; /* LDB_SNAPPY_COMPRESSION */
 
@@ -161,6 +223,668 @@ typedef struct ldb_dbopt_s {
 
   /* Whether to utilize mmap() for random access files. */
   int use_mmap; /* 1 */
+
+  /* Maximum number of background compactions which may run
+   * concurrently. Compactions are only run in parallel when they
+   * operate on disjoint sets of files (and therefore disjoint key
+   * ranges). Level-0 compactions are never run in parallel with
+   * each other.
+   */
+  int max_background_compactions; /* 1 */
+
+  /* Maximum number of threads which will work on a single compaction.
+   * Values greater than one split large compactions into disjoint key
+   * ranges (on input file boundaries) which are compacted in parallel.
+   */
+  int max_subcompactions; /* 1 */
+
+  /* Maximum number of parts of a manual compaction (ldb_compact())
+   * which may be compacted at the same time. Values greater than one
+   * split each level's key range (on file boundaries) into disjoint
+   * parts of about equal size. The parts run on the background
+   * compaction threads, so max_background_compactions also limits
+   * how many run at once. Level-0 is never split.
+   */
+  int max_manual_compactions; /* 1 */
+
+  /* If true, a group of writes may append to the log while the
+   * previous group is still being inserted into the memtable. This
+   * improves throughput with many concurrent writers.
+   */
+  int pipelined_write; /* 0 */
+
+  /* If true, each writer in a write group inserts its own batch into
+   * the memtable, in parallel with the other members, instead of the
+   * group leader inserting everything. This improves throughput with
+   * many concurrent writers.
+   */
+  int concurrent_memtable_write; /* 0 */
+
+  /* Number of threads which insert a large batch into the memtable,
+   * each taking a run of its updates, when concurrent_memtable_write
+   * is set. The writing thread is one of them. Bulk loads which write
+   * one huge batch at a time benefit the most.
+   */
+  int max_insert_threads; /* 1 */
+
+  /* Time (in microseconds) a sync write waits before forming its
+   * write group, so that more sync writes may join the group and
+   * share its log sync. This trades latency for durable throughput
+   * under concurrency. Zero disables the wait.
+   */
+  int write_group_delay; /* 0 */
+
+  /* Maximum size of the batches combined into one write group. A
+   * small leading write limits the group to its size plus 1/8th of
+   * this, so as not to slow it down too much.
+   */
+  size_t max_write_group_size; /* 1mb */
+
+  /* If non-null, use the specified cache for compressed blocks. Blocks
+   * which miss in block_cache are looked up here before reading the
+   * file, and only need to be decompressed on a hit. This lets a given
+   * amount of memory hold several times more data than block_cache.
+   */
+  struct ldb_lru_s *block_cache_compressed; /* NULL */
+
+  /* If true, split the index block of each table into partitions of
+   * roughly block_size bytes, with a small top-level index pointing at
+   * them. Partitions are loaded on demand through the block cache, so
+   * only the top-level index is kept in memory for an open table.
+   * Tables written with this option can not be read by versions
+   * which predate it.
+   */
+  int partition_index; /* 0 */
+
+  /* If true (and partition_index is also true), split the filter block
+   * along the same boundaries as the index partitions. Filter
+   * partitions are loaded on demand through the block cache.
+   */
+  int partition_filters; /* 0 */
+
+  /* Number of keys between restart points for delta encoding of the
+   * keys in index blocks. Larger values shrink the index (and its
+   * footprint in memory or the block cache) at the cost of a short
+   * linear scan on every lookup.
+   */
+  int index_block_restart_interval; /* 1 */
+
+  /* If true, store only the user keys in the index block of a table
+   * whenever no user key spans two of its data blocks (tables where
+   * one does fall back to internal keys). Saves 8 bytes per index
+   * entry. Ignored with partition_index. Tables written with this
+   * option can not be read by versions which predate it.
+   */
+  int index_user_keys; /* 0 */
+
+  /* If true, index and filter blocks are kept in block_cache (and
+   * charged against its capacity) rather than being held by every
+   * open table. This bounds the memory used by table metadata with a
+   * single knob, at the cost of occasionally re-reading it.
+   */
+  int cache_index_and_filter_blocks; /* 0 */
+
+  /* If true (and cache_index_and_filter_blocks is also true), the
+   * index and filter blocks of level-0 tables are pinned in
+   * block_cache for as long as the table is open. Level-0 tables are
+   * consulted by nearly every read, so evicting their metadata is
+   * rarely worthwhile.
+   */
+  int pin_l0_filter_and_index_blocks; /* 0 */
+
+  /* If true (and filter_policy is non-null), build a single filter over
+   * every key in a table rather than one filter per 2KB of data. The
+   * filter is checked before the index block, so a lookup for a missing
+   * key never touches the index. Takes precedence over
+   * partition_filters. Tables written with this option can not be read
+   * by versions which predate it.
+   */
+  int full_filter; /* 0 */
+
+  /* If non-null, use the specified prefix extractor to add the prefix
+   * of every key to each table's filter. Prefix seeks (see the
+   * prefix_seek read option) then skip tables whose filter rejects
+   * the prefix of the seek target.
+   *
+   * Requires a filter_policy and full_filter. Tables are otherwise
+   * built (and read) as if this were null.
+   */
+  const struct ldb_prefix_s * prefix_extractor; /* NULL */
+
+  /* If non-zero, keep a bloom filter of this many bytes for each
+   * memtable. Point lookups for keys that are not in a memtable can
+   * then skip searching it entirely. The filter is charged against
+   * write_buffer_size.
+   *
+   * About 10 bits per key keeps false positives near 1%, so a good
+   * value is (write_buffer_size / average entry size) * 10 / 8.
+   */
+  size_t memtable_bloom_size; /* 0 */
+
+  /* If non-zero, memtables allocate their memory in regions of this
+   * many bytes mapped directly from the system (explicit huge pages
+   * where the size allows, transparent huge pages otherwise) instead
+   * of in small malloc'd blocks. Fewer pages back the skiplist, which
+   * reduces TLB misses on large memtables. Rounded to a multiple of
+   * 2mb, and ignored unless write_buffer_size is at least 4 times
+   * larger (a region is charged in full once it is mapped).
+   */
+  size_t memtable_huge_page_size; /* 0 */
+
+  /* Index of the memtable entries (see enum ldb_memtable_rep). */
+  enum ldb_memtable_rep memtable_rep; /* LDB_MEMTABLE_SKIPLIST */
+
+  /* LDB_MEMTABLE_HASH_SKIPLIST: number of hash buckets. Each bucket
+     costs a pointer whether it is used or not, and is charged against
+     write_buffer_size. */
+  size_t memtable_hash_buckets; /* 16384 */
+
+  /* If true, memtable skiplists keep the first 8 bytes of each user
+   * key in the node itself. Most comparisons during a search are then
+   * decided without a cache miss on the key, which helps keys that do
+   * not share long prefixes. Costs 8 bytes per entry. Ignored unless
+   * the comparator is the bytewise comparator.
+   */
+  int memtable_inline_prefix; /* 0 */
+
+  /* If true, append a hash index to every data block which maps each
+   * user key to the restart point holding it. Point lookups in a block
+   * then skip the binary search over the restart array. Costs about
+   * one byte per key. Ignored for blocks with more than 253 restart
+   * points. Tables written with this option can not be read by versions
+   * which predate it.
+   */
+  int data_block_hash_index; /* 0 */
+
+  /* If true, store the first 8 bytes of the (user) key at each restart
+   * point of a block next to the restart array. Seeks binary search
+   * these before decoding any entry, and only compare full keys among
+   * restart points sharing the prefix of the target. Costs 8 bytes per
+   * restart point, and is only used with the bytewise comparator.
+   * Tables written with this option can not be read by versions which
+   * predate it.
+   */
+  int restart_key_prefixes; /* 0 */
+
+  /* Store the values of each data block after all of its keys, rather
+   * than each value after its key. Seeks, and scans which only look at
+   * keys, then read far fewer bytes of the block. Costs 4 bytes per
+   * restart point. Tables written with this option can not be read by
+   * versions which predate it.
+   */
+  int separate_block_values; /* 0 */
+
+  /* If non-zero, every user key is exactly this many bytes, and tables
+   * are written in the plain format: entries are stored uncompressed,
+   * one after another, with a hash index over the user keys (or a
+   * binary search index with a custom comparator). Reads then go
+   * straight to the entry without a block cache, in place if files are
+   * mapped (see use_mmap), and are best suited to data sets which fit
+   * in memory. Writes of keys of any other size fail. Tables of either
+   * format can always be read, but tables written with this option can
+   * not be read by versions which predate it.
+   */
+  size_t plain_key_size; /* 0 */
+
+  /* Write tables in the cuckoo format, for data sets which are only
+   * read by exact key. Entries are stored uncompressed, and each user
+   * key hashes to one of two buckets of a table kept in memory, which
+   * holds where its versions lie: a lookup then costs a single read,
+   * with no index or filter blocks to go through. Scans read the whole
+   * table at once. Takes precedence over plain_key_size, and is
+   * ignored with comparators which do not order keys bytewise. Tables
+   * of either format can always be read, but tables written with this
+   * option can not be read by versions which predate it.
+   */
+  int cuckoo_table; /* 0 */
+
+  /* If non-null, the compression type to use for each level, overriding
+   * compression. Levels past the end of the array use its last entry.
+   * Memtable flushes use the level 0 entry even if the table is placed
+   * at a deeper level.
+   *
+   * A common setup is no compression (or LZ4) for the first couple of
+   * levels, whose data is soon rewritten, and Zstd for the deepest
+   * levels, which hold most of the bytes.
+   */
+  const enum ldb_compression *compression_per_level; /* NULL */
+
+  /* Number of entries in compression_per_level. */
+  int compression_levels; /* 0 */
+
+  /* If non-null, the block size to use for each level, overriding
+   * block_size in the same way as compression_per_level does for
+   * compression.
+   *
+   * Small blocks suit the upper levels, where most point reads are
+   * served, as fewer bytes are read and cached per lookup. Large blocks
+   * suit the deepest levels, where they compress better and keep the
+   * index blocks small.
+   */
+  const size_t *block_size_per_level; /* NULL */
+
+  /* Number of entries in block_size_per_level. */
+  int block_size_levels; /* 0 */
+
+  /* If non-null, the restart interval to use for each level, overriding
+   * block_restart_interval in the same way.
+   */
+  const int *restart_interval_per_level; /* NULL */
+
+  /* Number of entries in restart_interval_per_level. */
+  int restart_interval_levels; /* 0 */
+
+  /* If non-zero, compactions writing LDB_ZSTD_COMPRESSION tables train
+   * a Zstd dictionary of up to this many bytes on a sample of their
+   * input, and compress every data block with it. The dictionary is
+   * stored in each output table. Good values are 16KB to 64KB; this
+   * mostly helps with small values that share a lot of structure.
+   *
+   * Tables written with this option can not be read by versions which
+   * predate it.
+   */
+  size_t zstd_max_dict_bytes; /* 0 */
+
+  /* Readahead window used when compactions read their input tables
+   * (see ldb_readopt_t.readahead_size). Zero disables it.
+   */
+  size_t compaction_readahead_size; /* 2 * 1024 * 1024 */
+
+  /* If non-zero, the outputs of a compaction are read into the block
+   * cache where they cover an input table which served at least this
+   * many reads (point lookups which found their key in it, plus one
+   * per megabyte or so scanned by iterators). Reads of a hot range
+   * then keep hitting the cache once the compaction replaces the
+   * tables they were reading. At most half of the block cache is
+   * filled this way per compaction.
+   */
+  int compaction_warm_reads; /* 0 */
+
+  /* If 1, the data blocks of the tables written by memtable flushes
+   * are inserted into the block cache as they are written, so that
+   * reads of recently written keys do not go to disk once they leave
+   * the memtable. If 2, the outputs of compactions into levels 0 and
+   * 1 are cached as well. Only useful for tables which are not read
+   * in place (see use_mmap).
+   */
+  int prepopulate_block_cache; /* 0 */
+
+  /* If true, the locations of the blocks of this database held in the
+   * block cache are written to the BLOCKCACHE file when it is closed,
+   * most recently used first. When it is next opened, as many of them
+   * as fit in the block cache are read back in the background, most
+   * recently used first, so that reads do not have to wait for the
+   * cache to fill up again after a restart.
+   */
+  int block_cache_dump; /* 0 */
+
+  /* If true, table files are read with direct I/O (O_DIRECT), which
+   * bypasses the operating system's page cache so that the block
+   * cache is the only cache. Disables use_mmap. Falls back to
+   * buffered reads where direct I/O is not supported.
+   */
+  int use_direct_reads; /* 0 */
+
+  /* If true, tables written by memtable flushes and compactions are
+   * written with direct I/O, so that background writes do not evict
+   * hot data from the page cache.
+   */
+  int use_direct_io_for_flush_and_compaction; /* 0 */
+
+  /* If non-null, background I/O is charged against this limiter:
+   * compaction reads and writes at low priority, memtable flushes at
+   * high priority. The rate may be changed at any time with
+   * ldb_ratelimit_set_rate(). The limiter may be shared between
+   * databases.
+   */
+  struct ldb_ratelimit_s *rate_limiter; /* NULL */
+
+  /* If true, obsolete files are removed by a background thread rather
+   * than by the flush or compaction which made them obsolete. Ignored
+   * without thread support.
+   */
+  int background_deletes; /* 0 */
+
+  /* If non-zero (and background_deletes is set), obsolete files are
+   * removed at no more than this many bytes per second, sparing the
+   * device bursts of discards after large compactions.
+   */
+  size_t delete_rate; /* 0 */
+
+  /* Level-0 compaction is started when we hit this many files. */
+  int level0_file_num_compaction_trigger; /* 4 */
+
+  /* Soft limit on the number of level-0 files. Writes are paced at
+   * this point (see delayed_write_rate), increasingly so as the
+   * count approaches level0_stop_writes_trigger.
+   */
+  int level0_slowdown_writes_trigger; /* 8 */
+
+  /* Maximum number of level-0 files. We stop writes at this point. */
+  int level0_stop_writes_trigger; /* 12 */
+
+  /* Write rate (bytes per second) allowed once the slowdown trigger
+   * is reached, before scaling down by the remaining room to the stop
+   * trigger. Zero uses the observed compaction throughput instead.
+   */
+  size_t delayed_write_rate; /* 0 */
+
+  /* Number of levels in the LSM tree, at most 12. Must not be lowered
+   * below the deepest level holding files in an existing database.
+   */
+  int num_levels; /* 7 */
+
+  /* Target size of level-1. */
+  size_t max_bytes_for_level_base; /* 10 * 1048576 */
+
+  /* Each level past level-1 targets this many times the size of the
+   * level above it.
+   */
+  double max_bytes_for_level_multiplier; /* 10 */
+
+  /* Derive the level targets from the size of the last level rather
+   * than from max_bytes_for_level_base: each level above it targets
+   * 1/max_bytes_for_level_multiplier of the one below, and levels
+   * which would end up smaller than max_bytes_for_level_base are
+   * skipped, level-0 compacting straight into the first level used.
+   * Keeps space amplification bounded regardless of database size.
+   */
+  int level_compaction_dynamic_level_bytes; /* 0 */
+
+  /* Files written to each level past level-1 target this many times
+   * the size of those of the level above it (max_file_size at level-1
+   * and level-0). Larger files in the deeper levels mean fewer files,
+   * a smaller manifest and fewer table cache entries.
+   */
+  double max_file_size_multiplier; /* 1 */
+
+  /* Once a compaction output reaches half of its target size, end it
+   * where a file of the level below the output level ends, so that
+   * each output overlaps as few of those files as possible when it is
+   * itself compacted.
+   */
+  int align_compaction_outputs; /* 0 */
+
+  /* Order in which the files of a level are picked for compaction
+   * (see enum ldb_compaction_pri). Level-0 files are always picked
+   * in turn.
+   */
+  enum ldb_compaction_pri compaction_pri; /* LDB_PRI_ROUND_ROBIN */
+
+  /* Tables holding data written more than this many seconds ago are
+   * compacted into the next level (or rewritten in place in the last
+   * level), so that deleted and overwritten entries in rarely written
+   * key ranges are eventually purged. Checked whenever compactions
+   * are considered (i.e. after each flush). Zero disables.
+   */
+  int periodic_compaction_seconds; /* 0 */
+
+  /* Tables above the last level in which deletion markers make up at
+   * least this fraction of the entries are compacted into the next
+   * level once no level is over its target, so that scans stop paying
+   * for the markers. Zero disables.
+   */
+  double deletion_compaction_ratio; /* 0 */
+
+  /* Values of at least this many bytes are moved to blob files when
+   * tables are built, the tables holding a reference to them instead.
+   * Compaction then moves references rather than values, reducing its
+   * write amplification at the cost of an extra read for such values.
+   * Zero keeps all values in the tables (existing blob values are moved
+   * back in as they are compacted).
+   */
+  size_t min_blob_size; /* 0 */
+
+  /* Fraction of the blob files, oldest first, whose live values are
+   * moved to new blob files when compacted, so that the space of the
+   * overwritten and deleted values in them is eventually reclaimed.
+   */
+  double blob_gc_age_cutoff; /* 0.25 */
+
+  /* Compaction picker to use (see enum ldb_compaction_style). The
+   * style may be changed on an existing database: the levels are a
+   * valid set of sorted runs for either.
+   */
+  enum ldb_compaction_style compaction_style; /* LDB_COMPACTION_LEVEL */
+
+  /* LDB_COMPACTION_UNIVERSAL: a run is merged with the runs before
+   * it while its size is within this percentage of their total.
+   */
+  int universal_size_ratio; /* 1 */
+
+  /* LDB_COMPACTION_UNIVERSAL: all runs are merged once the ones other
+   * than the oldest add up to more than this percentage of its size.
+   */
+  int universal_max_size_amplification_percent; /* 200 */
+
+  /* LDB_COMPACTION_FIFO: the oldest tables are deleted while their
+   * total size exceeds this.
+   */
+  size_t fifo_max_table_files_size; /* 1 << 30 */
+
+  /* LDB_COMPACTION_FIFO: tables created more than this many seconds
+   * ago are deleted (checked whenever compactions are considered,
+   * i.e. after each flush). Zero disables.
+   */
+  int ttl; /* 0 */
+
+  /* If non-null, use the specified compaction filter to drop or
+   * rewrite entries as they are compacted. See cfilter.h.
+   */
+  const struct ldb_cfilter_s * compaction_filter; /* NULL */
+
+  /* If non-null, use the specified merge operator to combine the
+   * operands written with ldb_merge() with the values they apply to.
+   * Required to read or compact keys with merge operands.
+   */
+  const struct ldb_mergeop_s * merge_operator; /* NULL */
+
+  /* If non-null, charge memtable memory to the specified write buffer
+   * manager, which caps the total across every database sharing it
+   * (see wbm.h).
+   */
+  struct ldb_wbm_s *write_buffer_manager; /* NULL */
+
+  /* If non-null, run background flushes and compactions on the
+   * specified thread pool (see ldb_pool_create()) rather than on
+   * threads of the database's own. A pool may be shared by several
+   * databases, in which case max_background_compactions bounds only
+   * the work each of them queues (ldb_pool_set_limit() bounds it for
+   * all of them). Flushes take priority over compactions. The pool
+   * must outlive the database.
+   */
+  struct ldb_pool_s *thread_pool; /* NULL */
+
+  /* If non-zero, an iterator which has to skip at least this many
+   * consecutive entries (deleted, or hidden by newer ones) in a forward
+   * scan schedules the table holding them for compaction, so that later
+   * scans of the same range do not pay for them again.
+   */
+  int iter_deletion_trigger; /* 0 */
+
+  /* Bytes of deletion markers are counted this many times when an
+   * iterator samples its reads for compaction (see
+   * LDB_READ_BYTES_PERIOD), making ranges dense with deletions
+   * compact sooner.
+   */
+  int tombstone_sample_weight; /* 1 */
+
+  /* If non-zero, ldb_open() opens the tables of the database (as many
+   * as fit in the table cache, lowest levels first) on this many
+   * threads before returning. Otherwise tables are opened one at a
+   * time, as reads and compactions first need them.
+   *
+   * ldb_repair() converts logs and scans tables on this many threads,
+   * and ldb_copy(), ldb_backup() and ldb_destroy() copy, link and
+   * remove files on this many threads.
+   */
+  int max_file_opening_threads; /* 0 */
+
+  /* If true (and cache_index_and_filter_blocks is also true), opening
+   * a table reads little more than its footer. The index and filter
+   * blocks are read into block_cache when they are first needed.
+   */
+  int lazy_table_open; /* 0 */
+
+  /* If non-zero, start a new MANIFEST (holding a single snapshot of
+   * the database's files) once the current one grows past this many
+   * bytes. This bounds the time spent replaying it in ldb_open().
+   */
+  size_t max_manifest_file_size; /* 0 */
+
+  /* If true, keep histograms of how long gets, writes, iterator seeks
+   * and steps, log syncs, memtable flushes and compactions take. They
+   * are reported by the "leveldb.latency-stats" property and cleared
+   * by ldb_reset_stats().
+   */
+  int track_latency; /* 0 */
+
+  /* If non-NULL, count events such as block cache hits, useful filter
+   * probes, bytes flushed and compacted, and time spent in write
+   * stalls here. May be shared by several databases, and is reported
+   * by the "leveldb.statistics" property.
+   */
+  struct ldb_statistics_s *statistics; /* NULL */
+
+  /* If non-NULL, report memtable flushes, compactions and write
+   * stalls (with their sizes and durations) as they happen. See
+   * listener.h.
+   */
+  const struct ldb_listener_s *listener; /* NULL */
+
+  /* If non-NULL, record every block cache lookup (the block, its type
+   * and size, and whether it hit) while the tracer is started. May be
+   * shared by several databases. See trace.h.
+   */
+  struct ldb_tracer_s *block_tracer; /* NULL */
+
+  /* Compress write-ahead log records using the specified compression
+   * algorithm. Each record (one write group) is compressed on its own,
+   * and stored as is if it shrinks by less than 12.5%. This mostly
+   * pays off for large, compressible values, and cuts the I/O both of
+   * writes and of log recovery.
+   *
+   * Logs written with this option can not be read by versions which
+   * predate it.
+   */
+  enum ldb_compression wal_compression; /* LDB_NO_COMPRESSION */
+
+  /* If true, log and table files reserve their disk space ahead of
+   * their writes (with fallocate(2), where supported), so that syncs
+   * rarely have to commit file system metadata. Space which ends up
+   * unused is released when the file is closed.
+   */
+  int allow_fallocate; /* 1 */
+
+  /* If non-zero, keep up to this many obsolete log files and reuse
+   * them for new logs instead of creating new files. Overwriting the
+   * blocks of an existing file spares syncs the cost of allocating
+   * them. Records of such logs carry their log number, so that those
+   * left over from a file's previous use are recognized. Disables
+   * reuse_logs.
+   *
+   * Logs written with this option can not be read by versions which
+   * predate it.
+   */
+  int recycle_log_file_num; /* 0 */
+
+  /* If true, log records are left in the log file's write buffer
+   * until it fills, a sync write is made or ldb_flush_wal() is called,
+   * rather than being written out one by one. Writes made since the
+   * last flush are lost if the process crashes.
+   */
+  int manual_wal_flush; /* 0 */
+
+  /* If non-zero, a background thread flushes and syncs the log every
+   * this many milliseconds, bounding the writes a machine crash can
+   * lose without making every write sync. Ignored without thread
+   * support.
+   */
+  int wal_sync_interval; /* 0 */
+
+  /* Number of tables which may be memory-mapped (with use_mmap) by
+   * this database. Zero shares a process-wide limit of 1000 tables
+   * (none on 32-bit platforms); -1 maps every table. Tables past the
+   * limit are read with pread(). Mapping many tables on a 32-bit
+   * platform can exhaust its address space.
+   */
+  int max_mapped_tables; /* 0 */
+
+  /* If true, the database is an ephemeral, in-memory store which is
+   * still organized as an LSM tree: ldb_open() removes whatever was
+   * at the path beforehand, writes skip the log (as with disable_wal,
+   * and sync writes are not synced), tables are written uncompressed
+   * and read in place (through mmap, or straight from the memory env
+   * of LDB_MEMENV builds) rather than copied into the block cache, and
+   * ldb_close() removes the files again. Memory use is bounded by the
+   * write buffer and by compaction, as usual. Best used with a tmpfs
+   * directory or an LDB_MEMENV build.
+   */
+  int in_memory; /* 0 */
+
+  /* If true, the OS is told that tables will be read at random, which
+   * turns off its readahead of them. Scans still read ahead with
+   * ldb_readopt_t.readahead_size.
+   */
+  int advise_random_on_open; /* 1 */
+
+  /* If non-null, blocks which have to be read from a table are also
+   * written to this persistent cache, and looked up there before the
+   * table is read again (see pcache.h). Meant for a database on slow
+   * or remote storage, with the cache on a fast local device. Tables
+   * which are memory-mapped bypass it.
+   */
+  struct ldb_pcache_s *persistent_cache; /* NULL */
+
+  /* If non-null, table files are placed in these directories rather
+   * than the database directory (which may be one of them). New tables
+   * go to the first path with room for their level: the levels are
+   * laid out from the first path on, by their target sizes (see
+   * max_bytes_for_level_base), moving to the next path once a path's
+   * target_size is used up. The last path takes the remaining levels.
+   * For example, { fast, 1gb }, { slow, 0 } keeps the first few levels
+   * on "fast" and the rest on "slow".
+   *
+   * Each table records the index of its path, so paths may only be
+   * appended once a database has been created. The first path takes
+   * the place of the database directory: an existing database should
+   * list its own directory first. Everything other than tables (blob
+   * files included) stays in the database directory. A path must not
+   * be shared between databases.
+   *
+   * Backups, checkpoints and copies gather every table into a single
+   * directory and are opened without db_paths.
+   */
+  const ldb_dbpath_t *db_paths; /* NULL */
+
+  /* Number of entries in db_paths. */
+  int num_db_paths; /* 0 */
+
+  /* Size of the blocks write-ahead log records are laid out in. Larger
+   * blocks split big batches into fewer fragments and pad less; matching
+   * the storage's write granularity avoids partial writes. Blocks larger
+   * than 64kb hold several fragments each.
+   *
+   * The size is recorded when the database is created and the recorded
+   * size wins when an existing database is opened. Repair reads logs
+   * with this size.
+   */
+  int wal_block_size; /* 32768 */
+
+  /* Number of threads data blocks are compressed on while a table is
+   * built. Values greater than one hand finished blocks to a pool of
+   * that many threads, so that compression overlaps with merging; the
+   * blocks are still written in order. Has no effect without
+   * compression.
+   */
+  int compression_threads; /* 1 */
+
+  /* If true, a table stops compressing its data blocks after several
+   * in a row fail to shrink by an eighth, storing them as they are and
+   * trying again every so often. Saves the work of compressing values
+   * which will not compress (random or encrypted data).
+   */
+  int adaptive_compression; /* 0 */
 } ldb_dbopt_t;
 
 /*
@@ -185,6 +909,91 @@ typedef struct ldb_readopt_s {
    * snapshot of the state at the beginning of this read operation.
    */
   const struct ldb_snapshot_s *snapshot; /* NULL */
+
+  /* If true, an iterator only yields keys which share a prefix (as
+   * defined by the prefix_extractor option) with the most recent
+   * seek target. This allows tables whose filter rejects the prefix
+   * to be skipped without reading any of their data blocks.
+   *
+   * Only forward iteration following a seek is supported; calling
+   * ldb_iter_prev() after a prefix seek yields undefined results.
+   * Has no effect if the database has no prefix_extractor.
+   */
+  int prefix_seek; /* 0 */
+
+  /* If non-zero, reads issued by this operation are treated as a
+   * sequential scan: as it crosses into each window of this many
+   * bytes of a table file, the next window is read ahead of time.
+   * Useful for bulk scans on storage with high per-read latency.
+   *
+   * If zero, iterators read ahead on their own once they have read a
+   * few blocks of a table in order, with a window growing from 8KB
+   * to 256KB.
+   */
+  size_t readahead_size; /* 0 */
+
+  /* If true, block reads issued by this operation are charged
+   * against ldb_dbopt_t.rate_limiter at low priority. Compactions
+   * set this for their input tables.
+   */
+  int rate_limited; /* 0 */
+
+  /* If non-null, an iterator only yields user keys at or after
+   * this bound: seeks before it (and ldb_iter_first()) land on it,
+   * and reverse iteration stops there. Level-0 tables and levels
+   * entirely below the bound are not opened.
+   *
+   * The slice (and its data) must outlive any iterator it is
+   * used for.
+   */
+  const struct ldb_slice_s *iterate_lower_bound; /* NULL */
+
+  /* If non-null, an iterator only yields user keys before this
+   * bound (exclusive): forward iteration stops at the first entry
+   * at or past it, rather than walking over whatever deletions lie
+   * beyond, and ldb_iter_last() positions before it. Tables and
+   * levels entirely at or past the bound are not opened.
+   *
+   * The slice (and its data) must outlive any iterator it is
+   * used for.
+   */
+  const struct ldb_slice_s *iterate_upper_bound; /* NULL */
+
+  /* If true, an iterator keeps every block it has visited referenced
+   * until it is destroyed, so that the slices returned by
+   * ldb_iter_value() stay valid for the iterator's lifetime instead of
+   * until its next move, and stepping backwards needs no copy of the
+   * value. Keys are still rebuilt per entry (block keys are prefix
+   * compressed), as are the results of merge operands.
+   *
+   * Memory use grows with the amount of data scanned.
+   */
+  int pin_data; /* 0 */
+
+  /* Insert the data blocks read by this operation into the block cache
+   * at low priority, making them the first to be evicted unless they
+   * are read again. Meant for scans which should still fill the cache
+   * for their own sake, but not displace the working set.
+   */
+  int low_priority; /* 0 */
+
+  /* If true, an iterator follows writes made after it was created:
+   * each seek (including ldb_iter_first() and ldb_iter_last()) reads
+   * at the latest sequence. Skiplist memtables are read as they are
+   * written to; the iterator's other children are only rebuilt after
+   * a memtable switch or a compaction, keeping those still live (see
+   * ldb_iter_refresh()). Ignored if a snapshot is given.
+   *
+   * With pin_data, values only stay valid until the next seek.
+   */
+  int tailing; /* 0 */
+
+  /* If true, only keys are read: iterators yield empty values, and
+   * point lookups leave the value empty and only report whether the
+   * key exists. Values are never copied, blob values are not read,
+   * and merge operands are not applied.
+   */
+  int keys_only; /* 0 */
 } ldb_readopt_t;
 
 /*
@@ -209,6 +1018,17 @@ typedef struct ldb_writeopt_s {
    * system call followed by "fsync()".
    */
   int sync; /* 0 */
+
+  /* If true, the write is not added to the log, and exists only in
+   * the memtable until the memtable is flushed to a table. Unlogged
+   * writes are lost if the process crashes before then (logged writes
+   * made after them survive). ldb_close() flushes the memtable if it
+   * holds unlogged writes, so a clean shutdown loses nothing.
+   *
+   * Useful for data that can be rebuilt. Cannot be combined with
+   * sync; LDB_INVALID is returned in that case.
+   */
+  int disable_wal; /* 0 */
 } ldb_writeopt_t;
 
 /*
@@ -0,0 +1,509 @@
+/*!
+ * pcache.c - persistent block cache for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "coding.h"
+#include "crc32c.h"
+#include "env.h"
+#include "internal.h"
+#include "pcache.h"
+#include "port.h"
+#include "rbt.h"
+#include "slice.h"
+#include "status.h"
+#include "strutil.h"
+
+/*
+ * Constants
+ */
+
+/* The capacity is split across this many segments, so that evicting
+   one drops roughly an eighth of the cache. */
+#define PCACHE_SEGMENTS 8
+
+/* Record header: masked crc32c (4), table id (8), block offset (8),
+   block size (4), compression type (1), verified flag (1). The crc
+   covers everything after it, block included. */
+#define PCACHE_HEADER 26
+
+/*
+ * Types
+ */
+
+struct pcache_entry_s;
+
+typedef struct pcache_seg_s {
+  uint64_t number;
+  uint64_t size; /* Bytes written. */
+  ldb_wfile_t *wfile; /* Non-null while the segment is being written. */
+  ldb_rfile_t *rfile;
+  int refs; /* One for the cache, plus one per reader. */
+  struct pcache_entry_s *entries; /* Blocks written to the segment. */
+  struct pcache_seg_s *next;
+} pcache_seg_t;
+
+typedef struct pcache_entry_s {
+  uint64_t id;
+  uint64_t offset;
+  pcache_seg_t *seg;
+  uint64_t pos; /* Position of the record in the segment. */
+  uint32_t size; /* Size of the block. */
+  int live; /* Still in the index (not replaced by a later copy). */
+  struct pcache_entry_s *next;
+} pcache_entry_t;
+
+struct ldb_pcache_s {
+  ldb_mutex_t mutex;
+  char path[LDB_PATH_MAX];
+  ldb_filelock_t *lock;
+  uint64_t capacity;
+  uint64_t segment_size;
+  uint64_t usage;
+  uint64_t last_id;
+  uint64_t last_number;
+  uint64_t hits;
+  rb_set_t index; /* pcache_entry_t by (id, offset). */
+  pcache_seg_t *head; /* Oldest segment. */
+  pcache_seg_t *tail; /* Newest segment, the one being written. */
+};
+
+/*
+ * Helpers
+ */
+
+static int
+pcache_compare(rb_val_t x, rb_val_t y, void *arg) {
+  const pcache_entry_t *a = x.ptr;
+  const pcache_entry_t *b = y.ptr;
+
+  (void)arg;
+
+  if (a->id != b->id)
+    return (a->id > b->id) - (a->id < b->id);
+
+  return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+static int
+pcache_filename(char *buf, size_t size, const char *path, uint64_t num) {
+  char tmp[128];
+  char id[32];
+
+  ldb_encode_int(id, num, 6);
+
+  sprintf(tmp, "%s.pcache", id);
+
+  return ldb_join(buf, size, path, tmp);
+}
+
+static int
+pcache_parse_filename(const char *name) {
+  uint64_t num;
+  return ldb_decode_int(&num, &name) && strcmp(name, ".pcache") == 0;
+}
+
+/*
+ * Segment
+ */
+
+static void
+pcache_seg_unref(ldb_pcache_t *pc, pcache_seg_t *seg) {
+  char fname[LDB_PATH_MAX];
+
+  if (--seg->refs > 0)
+    return;
+
+  if (seg->wfile != NULL)
+    ldb_wfile_destroy(seg->wfile);
+
+  ldb_rfile_destroy(seg->rfile);
+
+  if (pcache_filename(fname, sizeof(fname), pc->path, seg->number))
+    ldb_remove_file(fname);
+
+  ldb_free(seg);
+}
+
+/* Stop writing the newest segment. Its blocks stay readable. */
+static void
+pcache_seg_seal(pcache_seg_t *seg) {
+  if (seg->wfile != NULL) {
+    ldb_wfile_close(seg->wfile);
+    ldb_wfile_destroy(seg->wfile);
+    seg->wfile = NULL;
+  }
+}
+
+static pcache_seg_t *
+pcache_seg_create(ldb_pcache_t *pc) {
+  uint64_t number = ++pc->last_number;
+  char fname[LDB_PATH_MAX];
+  ldb_wfile_t *wfile;
+  ldb_rfile_t *rfile;
+  pcache_seg_t *seg;
+
+  if (!pcache_filename(fname, sizeof(fname), pc->path, number))
+    return NULL;
+
+  if (ldb_truncfile_create(fname, &wfile) != LDB_OK)
+    return NULL;
+
+  if (ldb_randfile_create(fname, &rfile, LDB_RFILE_RANDOM) != LDB_OK) {
+    ldb_wfile_destroy(wfile);
+    ldb_remove_file(fname);
+    return NULL;
+  }
+
+  seg = ldb_malloc(sizeof(pcache_seg_t));
+  seg->number = number;
+  seg->size = 0;
+  seg->wfile = wfile;
+  seg->rfile = rfile;
+  seg->refs = 1;
+  seg->entries = NULL;
+  seg->next = NULL;
+
+  return seg;
+}
+
+/* Drop the oldest segment along with the blocks it holds. */
+static void
+pcache_evict(ldb_pcache_t *pc) {
+  pcache_seg_t *seg = pc->head;
+  pcache_entry_t *entry, *next;
+
+  for (entry = seg->entries; entry != NULL; entry = next) {
+    next = entry->next;
+
+    if (entry->live)
+      rb_set_del(&pc->index, entry);
+
+    ldb_free(entry);
+  }
+
+  pc->head = seg->next;
+
+  if (pc->head == NULL)
+    pc->tail = NULL;
+
+  pc->usage -= seg->size;
+
+  pcache_seg_seal(seg);
+  pcache_seg_unref(pc, seg);
+}
+
+/* The segment to write to, starting a new one if the newest is full. */
+static pcache_seg_t *
+pcache_writable(ldb_pcache_t *pc) {
+  pcache_seg_t *seg = pc->tail;
+
+  if (seg != NULL && seg->wfile != NULL && seg->size < pc->segment_size)
+    return seg;
+
+  if (seg != NULL)
+    pcache_seg_seal(seg);
+
+  seg = pcache_seg_create(pc);
+
+  if (seg == NULL)
+    return NULL;
+
+  if (pc->tail == NULL)
+    pc->head = seg;
+  else
+    pc->tail->next = seg;
+
+  pc->tail = seg;
+
+  return seg;
+}
+
+/*
+ * Persistent Cache
+ */
+
+int
+ldb_pcache_open(const char *path, uint64_t capacity, ldb_pcache_t **result) {
+  char fname[LDB_PATH_MAX];
+  ldb_pcache_t *pc;
+  char **names;
+  int rc, i, len;
+
+  *result = NULL;
+
+  if (strlen(path) + 1 > LDB_PATH_MAX - 64)
+    return LDB_INVALID;
+
+  pc = ldb_malloc(sizeof(ldb_pcache_t));
+
+  ldb_mutex_init(&pc->mutex);
+
+  strcpy(pc->path, path);
+
+  pc->lock = NULL;
+  pc->capacity = capacity;
+  pc->segment_size = LDB_MAX(capacity / PCACHE_SEGMENTS, 1);
+  pc->usage = 0;
+  pc->last_id = 0;
+  pc->last_number = 0;
+  pc->hits = 0;
+  pc->head = NULL;
+  pc->tail = NULL;
+
+  rb_set_init(&pc->index, pcache_compare, NULL);
+
+  ldb_create_dir(path);
+
+  if (!ldb_join(fname, sizeof(fname), path, "LOCK")) {
+    rc = LDB_INVALID;
+    goto fail;
+  }
+
+  rc = ldb_lock_file(fname, &pc->lock);
+
+  if (rc != LDB_OK)
+    goto fail;
+
+  /* Segments of an earlier process can not be found without its
+     index, so they only take up space. */
+  len = ldb_get_children(path, &names);
+
+  if (len < 0) {
+    rc = ldb_system_error();
+    goto fail;
+  }
+
+  for (i = 0; i < len; i++) {
+    if (!pcache_parse_filename(names[i]))
+      continue;
+
+    if (ldb_join(fname, sizeof(fname), path, names[i]))
+      ldb_remove_file(fname);
+  }
+
+  ldb_free_children(names, len);
+
+  *result = pc;
+
+  return LDB_OK;
+fail:
+  ldb_pcache_close(pc);
+  return rc;
+}
+
+void
+ldb_pcache_close(ldb_pcache_t *pc) {
+  while (pc->head != NULL)
+    pcache_evict(pc);
+
+  if (pc->lock != NULL)
+    ldb_unlock_file(pc->lock);
+
+  rb_set_clear(&pc->index, NULL);
+
+  ldb_mutex_destroy(&pc->mutex);
+  ldb_free(pc);
+}
+
+uint64_t
+ldb_pcache_usage(ldb_pcache_t *pc) {
+  uint64_t usage;
+
+  ldb_mutex_lock(&pc->mutex);
+
+  usage = pc->usage;
+
+  ldb_mutex_unlock(&pc->mutex);
+
+  return usage;
+}
+
+uint64_t
+ldb_pcache_hits(ldb_pcache_t *pc) {
+  uint64_t hits;
+
+  ldb_mutex_lock(&pc->mutex);
+
+  hits = pc->hits;
+
+  ldb_mutex_unlock(&pc->mutex);
+
+  return hits;
+}
+
+uint64_t
+ldb_pcache_id(ldb_pcache_t *pc) {
+  uint64_t id;
+
+  ldb_mutex_lock(&pc->mutex);
+
+  id = ++pc->last_id;
+
+  ldb_mutex_unlock(&pc->mutex);
+
+  return id;
+}
+
+int
+ldb_pcache_lookup(ldb_pcache_t *pc,
+                  uint64_t id,
+                  uint64_t offset,
+                  ldb_slice_t *block,
+                  int *type,
+                  int *verified) {
+  const pcache_entry_t *entry;
+  const rb_node_t *node;
+  pcache_entry_t probe;
+  pcache_seg_t *seg;
+  const uint8_t *hp = NULL;
+  ldb_slice_t rec;
+  uint32_t size;
+  uint64_t pos;
+  uint8_t *buf;
+  int ok = 0;
+
+  probe.id = id;
+  probe.offset = offset;
+
+  ldb_mutex_lock(&pc->mutex);
+
+  node = rb_tree_get(&pc->index, rb_ptr(&probe));
+
+  if (node == NULL) {
+    ldb_mutex_unlock(&pc->mutex);
+    return 0;
+  }
+
+  entry = node->key.ptr;
+  seg = entry->seg;
+  pos = entry->pos;
+  size = entry->size;
+
+  seg->refs++;
+
+  ldb_mutex_unlock(&pc->mutex);
+
+  /* The segment is only deleted once we let go of it, even if it is
+     evicted in the meantime. */
+  buf = ldb_malloc(PCACHE_HEADER + (size_t)size);
+
+  if (ldb_rfile_pread(seg->rfile, &rec, buf,
+                      PCACHE_HEADER + (size_t)size, pos) == LDB_OK) {
+    hp = rec.data;
+
+    ok = rec.size == PCACHE_HEADER + (size_t)size
+      && ldb_fixed64_decode(hp + 4) == id
+      && ldb_fixed64_decode(hp + 12) == offset
+      && ldb_fixed32_decode(hp + 20) == size
+      && ldb_crc32c_unmask(ldb_fixed32_decode(hp))
+         == ldb_crc32c_value(hp + 4, rec.size - 4);
+  }
+
+  if (ok) {
+    *type = hp[24];
+    *verified = hp[25];
+
+    memmove(buf, hp + PCACHE_HEADER, size);
+
+    ldb_slice_set(block, buf, size);
+  } else {
+    ldb_free(buf);
+  }
+
+  ldb_mutex_lock(&pc->mutex);
+
+  pc->hits += ok;
+
+  pcache_seg_unref(pc, seg);
+
+  ldb_mutex_unlock(&pc->mutex);
+
+  return ok;
+}
+
+void
+ldb_pcache_insert(ldb_pcache_t *pc,
+                  uint64_t id,
+                  uint64_t offset,
+                  const ldb_slice_t *block,
+                  int type,
+                  int verified) {
+  uint8_t header[PCACHE_HEADER];
+  pcache_entry_t *entry;
+  ldb_slice_t chunk;
+  pcache_seg_t *seg;
+  rb_node_t *node;
+  uint32_t crc;
+
+  if (block->size > UINT32_MAX - PCACHE_HEADER)
+    return;
+
+  if (PCACHE_HEADER + block->size > pc->capacity)
+    return;
+
+  ldb_fixed64_write(header + 4, id);
+  ldb_fixed64_write(header + 12, offset);
+  ldb_fixed32_write(header + 20, block->size);
+
+  header[24] = type;
+  header[25] = (verified != 0);
+
+  crc = ldb_crc32c_value(header + 4, PCACHE_HEADER - 4);
+  crc = ldb_crc32c_extend(crc, block->data, block->size);
+
+  ldb_fixed32_write(header, ldb_crc32c_mask(crc));
+
+  ldb_mutex_lock(&pc->mutex);
+
+  seg = pcache_writable(pc);
+
+  if (seg == NULL)
+    goto done;
+
+  ldb_slice_set(&chunk, header, PCACHE_HEADER);
+
+  /* A partial record is never indexed, and will fail its checksum if
+     a later record is somehow written over it. */
+  if (ldb_wfile_append(seg->wfile, &chunk) != LDB_OK
+      || ldb_wfile_append(seg->wfile, block) != LDB_OK
+      || ldb_wfile_flush(seg->wfile) != LDB_OK) {
+    pcache_seg_seal(seg);
+    goto done;
+  }
+
+  entry = ldb_malloc(sizeof(pcache_entry_t));
+  entry->id = id;
+  entry->offset = offset;
+  entry->seg = seg;
+  entry->pos = seg->size;
+  entry->size = block->size;
+  entry->live = 1;
+  entry->next = seg->entries;
+
+  seg->entries = entry;
+  seg->size += PCACHE_HEADER + block->size;
+
+  pc->usage += PCACHE_HEADER + block->size;
+
+  if (!rb_tree_put(&pc->index, rb_ptr(entry), &node)) {
+    pcache_entry_t *old = node->key.ptr;
+
+    old->live = 0;
+
+    node->key = rb_ptr(entry);
+  }
+
+  while (pc->usage > pc->capacity && pc->head != seg)
+    pcache_evict(pc);
+
+done:
+  ldb_mutex_unlock(&pc->mutex);
+}
@@ -0,0 +1,87 @@
+/*!
+ * pcache.h - persistent block cache for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_PCACHE_H
+#define LDB_PCACHE_H
+
+#include <stdint.h>
+#include "extern.h"
+#include "types.h"
+
+/*
+ * Types
+ */
+
+/* A second tier of the block cache, kept in files on a (presumably
+ * fast, local) directory of its own:
+ *
+ *    <number>.pcache    a segment of the cache log
+ *
+ * Blocks read from tables are appended to the newest segment, exactly
+ * as stored in the table (compressed, without the trailer), and are
+ * found through an index held in memory. Once the segments outgrow
+ * the capacity, the oldest segment is deleted along with the blocks
+ * it holds. Each record carries its own crc32c, so a block which was
+ * damaged on the cache device is simply read from the table again.
+ *
+ * Like the keys of the block cache, the index only lives as long as
+ * the process; segments left over by an earlier process are deleted
+ * when the directory is opened. A directory must not be opened by
+ * more than one handle at a time.
+ */
+typedef struct ldb_pcache_s ldb_pcache_t;
+
+/*
+ * Persistent Cache
+ */
+
+/* Open (or create) the cache directory "path", holding at most
+   "capacity" bytes of blocks. */
+LDB_EXTERN int
+ldb_pcache_open(const char *path, uint64_t capacity, ldb_pcache_t **result);
+
+/* REQUIRES: No database is using the cache. Deletes the segments. */
+LDB_EXTERN void
+ldb_pcache_close(ldb_pcache_t *pc);
+
+/* Bytes of segments currently on disk. */
+LDB_EXTERN uint64_t
+ldb_pcache_usage(ldb_pcache_t *pc);
+
+/* Lookups which were served from the cache. */
+LDB_EXTERN uint64_t
+ldb_pcache_hits(ldb_pcache_t *pc);
+
+/* Return a new numeric id for a table, to key its blocks with. */
+uint64_t
+ldb_pcache_id(ldb_pcache_t *pc);
+
+/* Look up the block at "offset" in the table with the given id. On a
+   hit, returns 1 and stores the block in *block, in a buffer which the
+   caller must free(). Its compression type is stored in *type, and
+   whether its checksum was verified when it was read from the table
+   in *verified. */
+int
+ldb_pcache_lookup(ldb_pcache_t *pc,
+                  uint64_t id,
+                  uint64_t offset,
+                  ldb_slice_t *block,
+                  int *type,
+                  int *verified);
+
+/* Store a block read from a table. Failures to write the cache are
+   ignored; the block is just not cached. */
+void
+ldb_pcache_insert(ldb_pcache_t *pc,
+                  uint64_t id,
+                  uint64_t offset,
+                  const ldb_slice_t *block,
+                  int type,
+                  int verified);
+
+#endif /* LDB_PCACHE_H */
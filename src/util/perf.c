@@ -0,0 +1,54 @@
+/*!
+ * perf.c - per-thread performance context for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "internal.h"
+#include "perf.h"
+
+/*
+ * Perf Context
+ */
+
+#ifdef LDB_TLS
+
+LDB_TLS ldb_perfstate_t ldb_perf_state;
+
+void
+ldb_perf_enable(int enable) {
+  ldb_perf_state.enabled = (enable != 0);
+}
+
+ldb_perfctx_t *
+ldb_perf_context(void) {
+  return &ldb_perf_state.ctx;
+}
+
+void
+ldb_perf_reset(void) {
+  memset(&ldb_perf_state.ctx, 0, sizeof(ldb_perfctx_t));
+}
+
+#else /* !LDB_TLS */
+
+static ldb_perfctx_t ldb_perf_zero;
+
+void
+ldb_perf_enable(int enable) {
+  (void)enable;
+}
+
+ldb_perfctx_t *
+ldb_perf_context(void) {
+  return &ldb_perf_zero; /* Never updated. */
+}
+
+void
+ldb_perf_reset(void) {
+  return;
+}
+
+#endif /* !LDB_TLS */
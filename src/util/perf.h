@@ -0,0 +1,92 @@
+/*!
+ * perf.h - per-thread performance context for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#ifndef LDB_PERF_H
+#define LDB_PERF_H
+
+#include <stdint.h>
+#include "env.h"
+#include "extern.h"
+#include "internal.h"
+
+/*
+ * Types
+ */
+
+/* Counts and times (in nanoseconds) of the stages a read went
+   through on the calling thread. Only gathered while enabled with
+   ldb_perf_enable(), and only where the compiler supports
+   thread-local storage (all fields stay zero otherwise). */
+typedef struct ldb_perfctx_s {
+  uint64_t get_nanos;          /* Total time spent in ldb_get(). */
+  uint64_t memtable_count;     /* Memtables searched. */
+  uint64_t memtable_nanos;
+  uint64_t files_nanos;        /* Time spent searching tables. */
+  uint64_t table_count;        /* Tables searched. */
+  uint64_t filter_count;       /* Filter probes. */
+  uint64_t filter_negatives;   /* Probes which ruled out the key. */
+  uint64_t filter_nanos;
+  uint64_t index_nanos;        /* Time spent seeking index blocks. */
+  uint64_t block_cache_hits;
+  uint64_t block_cache_misses;
+  uint64_t block_read_count;   /* Blocks read from disk. */
+  uint64_t block_read_bytes;
+  uint64_t block_read_nanos;
+  uint64_t decompress_nanos;
+} ldb_perfctx_t;
+
+/*
+ * Perf Context
+ */
+
+/* Start (or stop) gathering counters on the calling thread. */
+LDB_EXTERN void
+ldb_perf_enable(int enable);
+
+/* The calling thread's counters. */
+LDB_EXTERN ldb_perfctx_t *
+ldb_perf_context(void);
+
+/* Zero the calling thread's counters. */
+LDB_EXTERN void
+ldb_perf_reset(void);
+
+/*
+ * Helpers
+ */
+
+#ifdef LDB_TLS
+
+typedef struct ldb_perfstate_s {
+  int enabled;
+  ldb_perfctx_t ctx;
+} ldb_perfstate_t;
+
+extern LDB_TLS ldb_perfstate_t ldb_perf_state;
+
+#define LDB_PERF_ADD(field, n) do {   \
+  if (ldb_perf_state.enabled)         \
+    ldb_perf_state.ctx.field += (n);  \
+} while (0)
+
+/* `t` is zero if the counters are disabled. */
+#define LDB_PERF_START(t) \
+  ((t) = ldb_perf_state.enabled ? ldb_now_nsec() : 0)
+
+#define LDB_PERF_STOP(field, t) do {                    \
+  if ((t) != 0)                                         \
+    ldb_perf_state.ctx.field += ldb_now_nsec() - (t);   \
+} while (0)
+
+#else /* !LDB_TLS */
+
+#define LDB_PERF_ADD(field, n) do { } while (0)
+#define LDB_PERF_START(t) ((t) = 0)
+#define LDB_PERF_STOP(field, t) do { (void)(t); } while (0)
+
+#endif /* !LDB_TLS */
+
+#endif /* LDB_PERF_H */
@@ -0,0 +1,67 @@
+/*!
+ * pinned.c - pinned values for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include "buffer.h"
+#include "internal.h"
+#include "pinned.h"
+#include "slice.h"
+
+/*
+ * Pinned Value
+ */
+
+ldb_pinned_t *
+ldb_pinned_create(void) {
+  ldb_pinned_t *pin = ldb_malloc(sizeof(ldb_pinned_t));
+
+  ldb_slice_init(&pin->value);
+  ldb_buffer_init(&pin->buf);
+
+  pin->pending = 0;
+  pin->length = 0;
+
+  return pin;
+}
+
+void
+ldb_pinned_destroy(ldb_pinned_t *pin) {
+  while (pin->length > 0) {
+    int i = --pin->length;
+
+    pin->cleanups[i].func(pin->cleanups[i].arg1, pin->cleanups[i].arg2);
+  }
+
+  ldb_buffer_clear(&pin->buf);
+  ldb_free(pin);
+}
+
+ldb_slice_t
+ldb_pinned_value(const ldb_pinned_t *pin) {
+  return pin->value;
+}
+
+void
+ldb_pinned_set(ldb_pinned_t *pin, const ldb_slice_t *value) {
+  pin->value = *value;
+  pin->pending = 1;
+}
+
+void
+ldb_pinned_register(ldb_pinned_t *pin,
+                    ldb_unpin_f func,
+                    void *arg1,
+                    void *arg2) {
+  assert(pin->length < LDB_PINNED_CLEANUPS);
+
+  pin->cleanups[pin->length].func = func;
+  pin->cleanups[pin->length].arg1 = arg1;
+  pin->cleanups[pin->length].arg2 = arg2;
+  pin->length++;
+}
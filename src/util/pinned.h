@@ -0,0 +1,66 @@
+/*!
+ * pinned.h - pinned values for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_PINNED_H
+#define LDB_PINNED_H
+
+#include "extern.h"
+#include "types.h"
+
+/*
+ * Constants
+ */
+
+#define LDB_PINNED_CLEANUPS 4
+
+/*
+ * Types
+ */
+
+typedef void (*ldb_unpin_f)(void *arg1, void *arg2);
+
+/* A value read without copying it out of the block (or memtable) it
+   lives in. Whatever holds the data is released along with it. */
+typedef struct ldb_pinned_s {
+  ldb_slice_t value; /* Points at pinned data, or at buf. */
+  ldb_buffer_t buf;  /* Holds the value if it had to be built. */
+  int pending;       /* Value points at data its owner must pin. */
+  struct {
+    ldb_unpin_f func;
+    void *arg1;
+    void *arg2;
+  } cleanups[LDB_PINNED_CLEANUPS];
+  int length;
+} ldb_pinned_t;
+
+/*
+ * Pinned Value
+ */
+
+ldb_pinned_t *
+ldb_pinned_create(void);
+
+LDB_EXTERN void
+ldb_pinned_destroy(ldb_pinned_t *pin);
+
+LDB_EXTERN ldb_slice_t
+ldb_pinned_value(const ldb_pinned_t *pin);
+
+/* Point the value at data owned by someone else. The owner (seeing
+   pin->pending) keeps the data alive with ldb_pinned_register(). */
+void
+ldb_pinned_set(ldb_pinned_t *pin, const ldb_slice_t *value);
+
+/* Run func(arg1, arg2) when the value is destroyed. */
+void
+ldb_pinned_register(ldb_pinned_t *pin,
+                    ldb_unpin_f func,
+                    void *arg1,
+                    void *arg2);
+
+#endif /* LDB_PINNED_H */
@@ -0,0 +1,61 @@
+/*!
+ * prefix.c - prefix extractor for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "internal.h"
+#include "prefix.h"
+#include "slice.h"
+
+/*
+ * Types
+ */
+
+typedef struct fixed_prefix_s {
+  ldb_prefix_t prefix;
+  size_t length;
+  char name[48];
+} fixed_prefix_t;
+
+/*
+ * Fixed Prefix
+ */
+
+static int
+fixed_extract(const ldb_prefix_t *prefix,
+              ldb_slice_t *result,
+              const ldb_slice_t *key) {
+  const fixed_prefix_t *fp = prefix->state;
+
+  if (key->size < fp->length)
+    return 0;
+
+  ldb_slice_set(result, key->data, fp->length);
+
+  return 1;
+}
+
+ldb_prefix_t *
+ldb_prefix_create_fixed(size_t length) {
+  fixed_prefix_t *fp = ldb_malloc(sizeof(fixed_prefix_t));
+
+  sprintf(fp->name, "lcdb.FixedPrefix.%lu", (unsigned long)length);
+
+  fp->length = length;
+  fp->prefix.name = fp->name;
+  fp->prefix.extract = fixed_extract;
+  fp->prefix.state = fp;
+
+  return &fp->prefix;
+}
+
+void
+ldb_prefix_destroy(ldb_prefix_t *prefix) {
+  ldb_free(prefix->state);
+}
@@ -0,0 +1,67 @@
+/*!
+ * prefix.h - prefix extractor for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_PREFIX_H
+#define LDB_PREFIX_H
+
+#include <stddef.h>
+#include "extern.h"
+#include "types.h"
+
+/*
+ * Types
+ */
+
+/* A prefix extractor maps a user key to its prefix (for example, the
+ * `tenant|entity|` portion of a `tenant|entity|timestamp` key). When
+ * configured alongside a whole-table filter, every distinct prefix is
+ * added to the table's filter so that prefix seeks can skip tables
+ * which do not contain a single key with the target's prefix.
+ *
+ * REQUIRES: keys sharing a prefix must be contiguous according to the
+ * comparator, and the prefix of a key must be a prefix of that key.
+ */
+typedef struct ldb_prefix_s {
+  /* The name of the prefix extractor. This is stored in each table
+   * alongside its filter, so the name must be changed whenever the
+   * extractor is changed in an incompatible way. Tables built with a
+   * differently named extractor will not be prefix-filtered.
+   */
+  const char *name;
+
+  /* Store the prefix of "key" in *prefix (which must point into key).
+     Return false if the key has no prefix, in which case it is left
+     out of prefix filters and seeks to it are never filtered. */
+  int (*extract)(const struct ldb_prefix_s *prefix,
+                 ldb_slice_t *result,
+                 const ldb_slice_t *key);
+
+  /* Extra state. */
+  void *state;
+} ldb_prefix_t;
+
+/*
+ * Macros
+ */
+
+#define ldb_prefix_extract(pe, result, key) (pe)->extract(pe, result, key)
+
+/*
+ * Prefix
+ */
+
+/* Return a new prefix extractor which uses the first "length" bytes
+   of each key as its prefix. Keys shorter than "length" have no
+   prefix. */
+LDB_EXTERN ldb_prefix_t *
+ldb_prefix_create_fixed(size_t length);
+
+LDB_EXTERN void
+ldb_prefix_destroy(ldb_prefix_t *prefix);
+
+#endif /* LDB_PREFIX_H */
@@ -0,0 +1,258 @@
+/*!
+ * ratelimit.c - i/o rate limiter for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "env.h"
+#include "internal.h"
+#include "port.h"
+#include "ratelimit.h"
+
+/*
+ * Constants
+ */
+
+/* Refill period; the bucket holds this much time worth of tokens. */
+#define LDB_RATELIMIT_PERIOD 100000
+
+/* How long a low priority request yields to waiting high ones. */
+#define LDB_RATELIMIT_YIELD 1000
+
+/* Ratio of the maximum to the minimum auto-tuned rate. */
+#define LDB_RATELIMIT_RANGE 20
+
+/*
+ * Rate Limiter
+ */
+
+struct ldb_ratelimit_s {
+  ldb_mutex_t mutex;
+  int64_t rate;
+  int64_t available;
+  int64_t last;
+  int auto_tune;
+  int64_t min_rate;
+  int64_t max_rate;
+  int stalled;
+  int waiting[LDB_IO_TOTAL];
+  uint64_t total[LDB_IO_TOTAL];
+};
+
+static int64_t
+ldb_ratelimit_burst(const ldb_ratelimit_t *lim) {
+  int64_t burst = lim->rate / (1000000 / LDB_RATELIMIT_PERIOD);
+  return LDB_MAX(burst, 1);
+}
+
+static void
+ldb_ratelimit_refill(ldb_ratelimit_t *lim, int64_t now) {
+  int64_t elapsed = now - lim->last;
+  int64_t burst = ldb_ratelimit_burst(lim);
+
+  if (elapsed <= 0)
+    return;
+
+  /* Anything past a second only matters for paying off debt larger
+     than the bucket; cap it so the product cannot overflow. */
+  if (elapsed > 1000000)
+    elapsed = 1000000;
+
+  lim->available += (elapsed * lim->rate) / 1000000;
+  lim->available = LDB_MIN(lim->available, burst);
+  lim->last = now;
+}
+
+ldb_ratelimit_t *
+ldb_ratelimit_create(size_t bytes_per_sec) {
+  ldb_ratelimit_t *lim = ldb_malloc(sizeof(ldb_ratelimit_t));
+  int i;
+
+  ldb_mutex_init(&lim->mutex);
+
+  lim->rate = bytes_per_sec;
+  lim->available = ldb_ratelimit_burst(lim);
+  lim->last = ldb_now_usec();
+  lim->auto_tune = 0;
+  lim->min_rate = 0;
+  lim->max_rate = 0;
+  lim->stalled = 0;
+
+  for (i = 0; i < LDB_IO_TOTAL; i++) {
+    lim->waiting[i] = 0;
+    lim->total[i] = 0;
+  }
+
+  return lim;
+}
+
+static void
+ldb_ratelimit_bounds(ldb_ratelimit_t *lim, int64_t max_rate) {
+  lim->max_rate = max_rate;
+  lim->min_rate = LDB_MAX(max_rate / LDB_RATELIMIT_RANGE, 1);
+}
+
+ldb_ratelimit_t *
+ldb_ratelimit_create_auto(size_t max_bytes_per_sec) {
+  ldb_ratelimit_t *lim = ldb_ratelimit_create(max_bytes_per_sec);
+
+  if (max_bytes_per_sec > 0) {
+    lim->auto_tune = 1;
+    ldb_ratelimit_bounds(lim, max_bytes_per_sec);
+  }
+
+  return lim;
+}
+
+void
+ldb_ratelimit_destroy(ldb_ratelimit_t *lim) {
+  ldb_mutex_destroy(&lim->mutex);
+  ldb_free(lim);
+}
+
+static void
+ldb_ratelimit_update(ldb_ratelimit_t *lim, int64_t rate) {
+  if (lim->rate > 0)
+    ldb_ratelimit_refill(lim, ldb_now_usec());
+  else
+    lim->last = ldb_now_usec();
+
+  lim->rate = rate;
+  lim->available = LDB_MIN(lim->available, ldb_ratelimit_burst(lim));
+}
+
+void
+ldb_ratelimit_set_rate(ldb_ratelimit_t *lim, size_t bytes_per_sec) {
+  int64_t rate = bytes_per_sec;
+
+  ldb_mutex_lock(&lim->mutex);
+
+  if (lim->auto_tune && rate > 0) {
+    ldb_ratelimit_bounds(lim, rate);
+
+    rate = LDB_MIN(lim->rate, lim->max_rate);
+    rate = LDB_MAX(rate, lim->min_rate);
+  } else {
+    lim->auto_tune = 0;
+  }
+
+  ldb_ratelimit_update(lim, rate);
+
+  ldb_mutex_unlock(&lim->mutex);
+}
+
+size_t
+ldb_ratelimit_rate(ldb_ratelimit_t *lim) {
+  size_t rate;
+
+  ldb_mutex_lock(&lim->mutex);
+
+  rate = lim->rate;
+
+  ldb_mutex_unlock(&lim->mutex);
+
+  return rate;
+}
+
+void
+ldb_ratelimit_request(ldb_ratelimit_t *lim, size_t bytes, int priority) {
+  int64_t wait;
+
+  ldb_mutex_lock(&lim->mutex);
+
+  lim->total[priority] += bytes;
+  lim->waiting[priority]++;
+
+  for (;;) {
+    if (lim->rate == 0)
+      break;
+
+    ldb_ratelimit_refill(lim, ldb_now_usec());
+
+    if (lim->available > 0) {
+      if (priority == LDB_IO_HIGH || lim->waiting[LDB_IO_HIGH] == 0)
+        break;
+
+      wait = LDB_RATELIMIT_YIELD;
+    } else {
+      /* Sleep until the debt is paid off, but wake up at least once
+         per period to notice rate changes. */
+      wait = ((1 - lim->available) * 1000000) / lim->rate;
+      wait = LDB_MIN(wait, LDB_RATELIMIT_PERIOD);
+
+      /* A flush had to wait: writers may be blocked behind it. */
+      if (priority == LDB_IO_HIGH)
+        lim->stalled = 1;
+    }
+
+    ldb_mutex_unlock(&lim->mutex);
+
+    ldb_sleep_usec(wait);
+
+    ldb_mutex_lock(&lim->mutex);
+  }
+
+  lim->waiting[priority]--;
+
+  if (lim->rate > 0)
+    lim->available -= bytes;
+
+  ldb_mutex_unlock(&lim->mutex);
+}
+
+void
+ldb_ratelimit_tune(ldb_ratelimit_t *lim, double debt) {
+  int64_t rate;
+
+  ldb_mutex_lock(&lim->mutex);
+
+  if (lim->auto_tune) {
+    /* Multiplicative steps: a few compactions take the rate from
+       one end of the range to the other. Flushes waiting on tokens
+       count as debt too, as they hold up the writers. */
+    if (debt >= 1.0 || lim->stalled)
+      rate = lim->rate + LDB_MAX(lim->rate / 4, 1);
+    else if (debt < 0.5)
+      rate = lim->rate - lim->rate / 5;
+    else
+      rate = lim->rate;
+
+    rate = LDB_MIN(rate, lim->max_rate);
+    rate = LDB_MAX(rate, lim->min_rate);
+
+    if (rate != lim->rate)
+      ldb_ratelimit_update(lim, rate);
+
+    lim->stalled = 0;
+  }
+
+  ldb_mutex_unlock(&lim->mutex);
+}
+
+int
+ldb_ratelimit_tuned(ldb_ratelimit_t *lim) {
+  int ret;
+
+  ldb_mutex_lock(&lim->mutex);
+
+  ret = lim->auto_tune;
+
+  ldb_mutex_unlock(&lim->mutex);
+
+  return ret;
+}
+
+uint64_t
+ldb_ratelimit_total(ldb_ratelimit_t *lim, int priority) {
+  uint64_t total;
+
+  ldb_mutex_lock(&lim->mutex);
+
+  total = lim->total[priority];
+
+  ldb_mutex_unlock(&lim->mutex);
+
+  return total;
+}
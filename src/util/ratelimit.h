@@ -0,0 +1,81 @@
+/*!
+ * ratelimit.h - i/o rate limiter for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#ifndef LDB_RATELIMIT_H
+#define LDB_RATELIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "extern.h"
+
+/*
+ * Types
+ */
+
+typedef struct ldb_ratelimit_s ldb_ratelimit_t;
+
+/* Request priorities. Low priority requests wait while any high
+   priority request is waiting. */
+enum ldb_io_priority {
+  /* Compaction reads and writes. */
+  LDB_IO_LOW = 0,
+  /* Memtable flushes. */
+  LDB_IO_HIGH = 1,
+  LDB_IO_TOTAL = 2
+};
+
+/*
+ * Rate Limiter
+ */
+
+/* Create a token bucket limiter allowing `bytes_per_sec` bytes of
+   background I/O per second. The bucket holds at most 100ms worth of
+   tokens. A rate of zero means unlimited. */
+LDB_EXTERN ldb_ratelimit_t *
+ldb_ratelimit_create(size_t bytes_per_sec);
+
+/* Create a limiter whose rate is tuned by the databases using it,
+   between max_bytes_per_sec / 20 and max_bytes_per_sec. The rate
+   rises while compactions fall behind and drops while they keep up.
+   It starts out at the maximum. */
+LDB_EXTERN ldb_ratelimit_t *
+ldb_ratelimit_create_auto(size_t max_bytes_per_sec);
+
+LDB_EXTERN void
+ldb_ratelimit_destroy(ldb_ratelimit_t *lim);
+
+/* Change the rate. Safe to call while the limiter is in use. For an
+   auto-tuned limiter this changes the maximum instead. */
+LDB_EXTERN void
+ldb_ratelimit_set_rate(ldb_ratelimit_t *lim, size_t bytes_per_sec);
+
+LDB_EXTERN size_t
+ldb_ratelimit_rate(ldb_ratelimit_t *lim);
+
+/* Block until `bytes` may be transferred. Requests larger than the
+   bucket are granted once tokens are available and leave a debt that
+   later requests have to wait out. */
+void
+ldb_ratelimit_request(ldb_ratelimit_t *lim, size_t bytes, int priority);
+
+/* Report the pending compaction debt of a database: values of one
+   and above mean compactions are falling behind, values below a half
+   mean they easily keep up. Flushes which had to wait for tokens since
+   the last call are treated as debt as well. No-op unless the limiter
+   is auto-tuned. */
+void
+ldb_ratelimit_tune(ldb_ratelimit_t *lim, double debt);
+
+/* Whether the limiter is auto-tuned (so callers can skip computing
+   their debt otherwise). */
+int
+ldb_ratelimit_tuned(ldb_ratelimit_t *lim);
+
+/* Total bytes requested at `priority`. */
+uint64_t
+ldb_ratelimit_total(ldb_ratelimit_t *lim, int priority);
+
+#endif /* LDB_RATELIMIT_H */
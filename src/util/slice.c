@@ -20,6 +20,22 @@
 #include "internal.h"
 #include "slice.h"
 
+/*
+ * SIMD
+ */
+
+#undef HAVE_SSE2
+#undef HAVE_NEON
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) \
+ || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define HAVE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#  include <arm_neon.h>
+#  define HAVE_NEON
+#endif
+
 /*
  * Slice
  */
@@ -63,6 +79,40 @@ ldb_slice_equal(const ldb_slice_t *x, const ldb_slice_t *y) {
   return memcmp(x->data, y->data, y->size) == 0;
 }
 
+size_t
+ldb_slice_shared(const ldb_slice_t *x, const ldb_slice_t *y) {
+  const uint8_t *xp = x->data;
+  const uint8_t *yp = y->data;
+  size_t n = LDB_MIN(x->size, y->size);
+  size_t i = 0;
+
+  /* Skip over equal 16 byte chunks; the byte loop finds the
+     mismatch within the last one. */
+#if defined(HAVE_SSE2)
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(const void *)(xp + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(yp + i));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+      break;
+  }
+#elif defined(HAVE_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t a = vld1q_u8(xp + i);
+    uint8x16_t b = vld1q_u8(yp + i);
+    uint64x2_t r = vreinterpretq_u64_u8(vceqq_u8(a, b));
+
+    if ((vgetq_lane_u64(r, 0) & vgetq_lane_u64(r, 1)) != UINT64_MAX)
+      break;
+  }
+#endif
+
+  while (i < n && xp[i] == yp[i])
+    i++;
+
+  return i;
+}
+
 size_t
 ldb_slice_size(const ldb_slice_t *x) {
   return ldb_varint32_size(x->size) + x->size;
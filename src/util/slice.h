@@ -74,6 +74,10 @@ ldb_slice_copy(ldb_slice_t *z, const ldb_slice_t *x);
 int
 ldb_slice_equal(const ldb_slice_t *x, const ldb_slice_t *y);
 
+/* Length of the common prefix of x and y. */
+size_t
+ldb_slice_shared(const ldb_slice_t *x, const ldb_slice_t *y);
+
 /* remove_prefix */
 LDB_STATIC void
 ldb_slice_eat(ldb_slice_t *z, size_t xn) {
@@ -198,6 +198,62 @@ finish:
  * Decoding
  */
 
+/* Output slack needed by the wide copies below. */
+#define OUTPUT_MARGIN 16
+
+static void
+copy8(uint8_t *zp, const uint8_t *xp) {
+  uint8_t tmp[8];
+
+  memcpy(tmp, xp, 8);
+  memcpy(zp, tmp, 8);
+}
+
+static void
+copy16(uint8_t *zp, const uint8_t *xp) {
+  uint8_t tmp[16];
+
+  memcpy(tmp, xp, 16);
+  memcpy(zp, tmp, 16);
+}
+
+/* Copy len bytes from zp - off to zp in wide stores. The copy may
+   write up to OUTPUT_MARGIN bytes past zp + len. */
+static void
+copy_pattern(uint8_t *zp, uint32_t off, uint32_t len) {
+  const uint8_t *xp = zp - off;
+  uint8_t *ep = zp + len;
+
+  if (off >= 16) {
+    while (zp < ep) {
+      copy16(zp, xp);
+      xp += 16;
+      zp += 16;
+    }
+  } else if (off >= 8) {
+    while (zp < ep) {
+      copy8(zp, xp);
+      xp += 8;
+      zp += 8;
+    }
+  } else {
+    /* A short offset repeats a pattern. Expand it to eight bytes
+       once and store that, stepping by a multiple of the period,
+       rather than re-reading bytes which were only just written. */
+    uint32_t step = 8 - (8 % off);
+    uint8_t pat[8];
+    uint32_t i;
+
+    for (i = 0; i < 8; i++)
+      pat[i] = xp[i % off];
+
+    while (zp < ep) {
+      memcpy(zp, pat, 8);
+      zp += step;
+    }
+  }
+}
+
 static int
 decode_blocks(uint8_t *zp, size_t zn, const uint8_t *xp, size_t xn) {
   uint8_t *sp = zp;
@@ -263,7 +319,11 @@ decode_blocks(uint8_t *zp, size_t zn, const uint8_t *xp, size_t xn) {
         if (len > zn || len > xn)
           return 0;
 
-        memcpy(zp, xp, len);
+        /* Over-copy short literals when there is room on both sides. */
+        if (len <= 16 && xn >= 16 && zn >= 16)
+          copy16(zp, xp);
+        else
+          memcpy(zp, xp, len);
 
         zp += len;
         zn -= len;
@@ -323,7 +383,9 @@ decode_blocks(uint8_t *zp, size_t zn, const uint8_t *xp, size_t xn) {
     if ((size_t)(zp - sp) < off || len > zn)
       return 0;
 
-    if (off >= len) {
+    if ((len <= 16 || off < len) && zn >= len + OUTPUT_MARGIN) {
+      copy_pattern(zp, off, len);
+    } else if (off >= len) {
       memcpy(zp, zp - off, len);
     } else {
       for (i = 0; i < len; i++)
@@ -0,0 +1,122 @@
+/*!
+ * statistics.c - database statistics for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "atomic.h"
+#include "buffer.h"
+#include "internal.h"
+#include "statistics.h"
+
+/*
+ * Constants
+ */
+
+static const char *ldb_ticker_names[LDB_TICKER_MAX] = {
+  "block.cache.miss",
+  "block.cache.hit",
+  "block.cache.data.miss",
+  "block.cache.data.hit",
+  "block.cache.index.miss",
+  "block.cache.index.hit",
+  "block.cache.filter.miss",
+  "block.cache.filter.hit",
+  "bloom.filter.useful",
+  "bloom.filter.positive",
+  "memtable.hit",
+  "memtable.miss",
+  "get.hit.l0",
+  "get.hit.l1",
+  "get.hit.l2andup",
+  "number.keys.read",
+  "bytes.read",
+  "number.keys.written",
+  "bytes.written",
+  "wal.bytes",
+  "wal.synced",
+  "flush.write.bytes",
+  "compact.read.bytes",
+  "compact.write.bytes",
+  "stall.micros"
+};
+
+/*
+ * Statistics
+ */
+
+struct ldb_statistics_s {
+  ldb_atomic(size_t) tickers[LDB_TICKER_MAX];
+};
+
+ldb_statistics_t *
+ldb_statistics_create(void) {
+  ldb_statistics_t *stats = ldb_malloc(sizeof(ldb_statistics_t));
+  int i;
+
+  for (i = 0; i < LDB_TICKER_MAX; i++)
+    ldb_atomic_init(&stats->tickers[i], 0);
+
+  return stats;
+}
+
+void
+ldb_statistics_destroy(ldb_statistics_t *stats) {
+  ldb_free(stats);
+}
+
+uint64_t
+ldb_statistics_get(ldb_statistics_t *stats, enum ldb_ticker ticker) {
+  return ldb_atomic_load(&stats->tickers[ticker], ldb_order_relaxed);
+}
+
+void
+ldb_statistics_reset(ldb_statistics_t *stats) {
+  int i;
+
+  for (i = 0; i < LDB_TICKER_MAX; i++)
+    ldb_atomic_store(&stats->tickers[i], 0, ldb_order_relaxed);
+}
+
+char *
+ldb_statistics_string(ldb_statistics_t *stats, int json) {
+  ldb_buffer_t z;
+  char buf[100];
+  int i;
+
+  ldb_buffer_init(&z);
+
+  if (json)
+    ldb_buffer_push(&z, '{');
+
+  for (i = 0; i < LDB_TICKER_MAX; i++) {
+    double value = (double)ldb_statistics_get(stats, (enum ldb_ticker)i);
+
+    if (json) {
+      sprintf(buf, "%s\"%s\":%.0f", i > 0 ? "," : "",
+                   ldb_ticker_names[i], value);
+    } else {
+      sprintf(buf, "%s: %.0f\n", ldb_ticker_names[i], value);
+    }
+
+    ldb_buffer_string(&z, buf);
+  }
+
+  if (json)
+    ldb_buffer_push(&z, '}');
+
+  ldb_buffer_push(&z, 0);
+
+  return (char *)z.data;
+}
+
+void
+ldb_statistics_add(ldb_statistics_t *stats,
+                   enum ldb_ticker ticker,
+                   uint64_t count) {
+  if (stats != NULL)
+    ldb_atomic_fetch_add(&stats->tickers[ticker], count, ldb_order_relaxed);
+}
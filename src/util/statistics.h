@@ -0,0 +1,89 @@
+/*!
+ * statistics.h - database statistics for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#ifndef LDB_STATISTICS_H
+#define LDB_STATISTICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "extern.h"
+
+/*
+ * Constants
+ */
+
+enum ldb_ticker {
+  /* Block cache lookups (all blocks, then by type). */
+  LDB_BLOCK_CACHE_MISS,
+  LDB_BLOCK_CACHE_HIT,
+  LDB_BLOCK_CACHE_DATA_MISS,
+  LDB_BLOCK_CACHE_DATA_HIT,
+  LDB_BLOCK_CACHE_INDEX_MISS,
+  LDB_BLOCK_CACHE_INDEX_HIT,
+  LDB_BLOCK_CACHE_FILTER_MISS,
+  LDB_BLOCK_CACHE_FILTER_HIT,
+  /* Filter probes which ruled a key out (saving a block read),
+     and those which did not. */
+  LDB_BLOOM_FILTER_USEFUL,
+  LDB_BLOOM_FILTER_POSITIVE,
+  /* Point lookups answered by the memtables, or by each level. */
+  LDB_MEMTABLE_HIT,
+  LDB_MEMTABLE_MISS,
+  LDB_GET_HIT_L0,
+  LDB_GET_HIT_L1,
+  LDB_GET_HIT_L2_AND_UP,
+  LDB_KEYS_READ,
+  LDB_BYTES_READ,
+  LDB_KEYS_WRITTEN,
+  LDB_BYTES_WRITTEN,
+  LDB_WAL_BYTES,
+  LDB_WAL_SYNCS,
+  LDB_FLUSH_WRITE_BYTES,
+  LDB_COMPACT_READ_BYTES,
+  LDB_COMPACT_WRITE_BYTES,
+  /* Time writers spent delayed or stopped. */
+  LDB_STALL_MICROS,
+  LDB_TICKER_MAX
+};
+
+/*
+ * Types
+ */
+
+/* Counters which may be shared by several databases (see
+   options.statistics). Updates are relaxed atomic additions; the
+   counters are word-sized, and wrap around on 32-bit systems. */
+typedef struct ldb_statistics_s ldb_statistics_t;
+
+/*
+ * Statistics
+ */
+
+LDB_EXTERN ldb_statistics_t *
+ldb_statistics_create(void);
+
+LDB_EXTERN void
+ldb_statistics_destroy(ldb_statistics_t *stats);
+
+LDB_EXTERN uint64_t
+ldb_statistics_get(ldb_statistics_t *stats, enum ldb_ticker ticker);
+
+LDB_EXTERN void
+ldb_statistics_reset(ldb_statistics_t *stats);
+
+/* Return every counter, one "name: value" line each, or (if `json`
+   is true) as a JSON object. The result must be freed with
+   ldb_free(). */
+LDB_EXTERN char *
+ldb_statistics_string(ldb_statistics_t *stats, int json);
+
+/* Add `count` to a counter. `stats` may be NULL. */
+void
+ldb_statistics_add(ldb_statistics_t *stats,
+                   enum ldb_ticker ticker,
+                   uint64_t count);
+
+#endif /* LDB_STATISTICS_H */
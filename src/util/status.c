@@ -24,7 +24,8 @@ static const char *ldb_errmsg[] = {
   /* .LDB_CORRUPTION = */ "Corruption",
   /* .LDB_NOSUPPORT = */ "Not implemented",
   /* .LDB_INVALID = */ "Invalid argument",
-  /* .LDB_IOERR = */ "IO error"
+  /* .LDB_IOERR = */ "IO error",
+  /* .LDB_CONFLICT = */ "Write conflict"
 };
 
 /*
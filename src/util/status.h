@@ -27,7 +27,8 @@
 #define LDB_NOSUPPORT  30003
 #define LDB_INVALID    30004
 #define LDB_IOERR      30005
-#define LDB_MAXERR     30005
+#define LDB_CONFLICT   30006
+#define LDB_MAXERR     30006
 
 #ifdef _WIN32
 #  define LDB_ENOENT  2 /* ERROR_FILE_NOT_FOUND */
@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "atomic.h"
 #include "internal.h"
 #include "port.h"
 #include "thread_pool.h"
@@ -17,19 +18,25 @@
 typedef struct ldb_work_s {
   ldb_work_f *func;
   void *arg;
+  int priority;
+  struct ldb_work_s *prev;
   struct ldb_work_s *next;
 } ldb_work_t;
 
+#if defined(_WIN32) || defined(LDB_PTHREAD)
 static ldb_work_t *
-ldb_work_create(ldb_work_f *func, void *arg) {
+ldb_work_create(ldb_work_f *func, void *arg, int priority) {
   ldb_work_t *work = ldb_malloc(sizeof(ldb_work_t));
 
   work->func = func;
   work->arg = arg;
+  work->priority = priority;
+  work->prev = NULL;
   work->next = NULL;
 
   return work;
 }
+#endif
 
 static ldb_work_t *
 ldb_work_destroy(ldb_work_t *work) {
@@ -38,16 +45,12 @@ ldb_work_destroy(ldb_work_t *work) {
   return next;
 }
 
-static ldb_work_t *
-ldb_work_execute(ldb_work_t *work) {
-  work->func(work->arg);
-  return ldb_work_destroy(work);
-}
-
 /*
  * Work Queue
  */
 
+/* The owning thread takes work from the head, in the order it was
+   scheduled. Other threads steal from the tail. */
 typedef struct ldb_queue_s {
   ldb_work_t *head;
   ldb_work_t *tail;
@@ -71,9 +74,11 @@ ldb_queue_clear(ldb_queue_t *queue) {
   ldb_queue_init(queue);
 }
 
+#if defined(_WIN32) || defined(LDB_PTHREAD)
 static void
-ldb_queue_push(ldb_queue_t *queue, ldb_work_f *func, void *arg) {
-  ldb_work_t *work = ldb_work_create(func, arg);
+ldb_queue_push(ldb_queue_t *queue, ldb_work_t *work) {
+  work->prev = queue->tail;
+  work->next = NULL;
 
   if (queue->head == NULL)
     queue->head = work;
@@ -84,18 +89,21 @@ ldb_queue_push(ldb_queue_t *queue, ldb_work_f *func, void *arg) {
   queue->tail = work;
   queue->length++;
 }
+#endif
 
 static ldb_work_t *
 ldb_queue_shift(ldb_queue_t *queue) {
   ldb_work_t *work = queue->head;
 
   if (work == NULL)
-    abort(); /* LCOV_EXCL_LINE */
+    return NULL;
 
   queue->head = work->next;
 
   if (queue->head == NULL)
     queue->tail = NULL;
+  else
+    queue->head->prev = NULL;
 
   queue->length--;
 
@@ -104,19 +112,102 @@ ldb_queue_shift(ldb_queue_t *queue) {
   return work;
 }
 
+static ldb_work_t *
+ldb_queue_pop(ldb_queue_t *queue) {
+  ldb_work_t *work = queue->tail;
+
+  if (work == NULL)
+    return NULL;
+
+  queue->tail = work->prev;
+
+  if (queue->tail == NULL)
+    queue->head = NULL;
+  else
+    queue->tail->next = NULL;
+
+  queue->length--;
+
+  work->prev = NULL;
+
+  return work;
+}
+
+/*
+ * Worker
+ */
+
+typedef struct ldb_worker_s {
+  struct ldb_pool_s *pool;
+  ldb_mutex_t mutex;
+  ldb_queue_t queues[LDB_POOL_PRIORITIES];
+} ldb_worker_t;
+
+#ifdef LDB_TLS
+/* The worker the calling thread is running as (if any). */
+static LDB_TLS ldb_worker_t *ldb_current_worker = NULL;
+#endif
+
+static void
+ldb_worker_init(ldb_worker_t *worker, struct ldb_pool_s *pool) {
+  int i;
+
+  worker->pool = pool;
+
+  ldb_mutex_init(&worker->mutex);
+
+  for (i = 0; i < LDB_POOL_PRIORITIES; i++)
+    ldb_queue_init(&worker->queues[i]);
+}
+
+static void
+ldb_worker_clear(ldb_worker_t *worker) {
+  int i;
+
+  for (i = 0; i < LDB_POOL_PRIORITIES; i++)
+    ldb_queue_clear(&worker->queues[i]);
+
+  ldb_mutex_destroy(&worker->mutex);
+}
+
+static ldb_work_t *
+ldb_worker_take(ldb_worker_t *worker, int priority, int steal) {
+  ldb_queue_t *queue = &worker->queues[priority];
+  ldb_work_t *work;
+
+  ldb_mutex_lock(&worker->mutex);
+
+  if (steal)
+    work = ldb_queue_pop(queue);
+  else
+    work = ldb_queue_shift(queue);
+
+  ldb_mutex_unlock(&worker->mutex);
+
+  return work;
+}
+
 /*
  * Workers
  */
 
 struct ldb_pool_s {
+  /* Guards starting, stopping and sleeping only: the
+     queues each have a lock of their own. */
   ldb_mutex_t mutex;
   ldb_cond_t master;
   ldb_cond_t worker;
-  ldb_queue_t queue;
+  ldb_worker_t *workers;
   int threads;
   int running;
-  int left;
   int stop;
+  ldb_atomic(int) started;
+  ldb_atomic(int) sleeping;
+  ldb_atomic(int) queued[LDB_POOL_PRIORITIES];
+  ldb_atomic(int) left; /* Scheduled but not finished. */
+  ldb_atomic(int) next; /* Queue for the next outside work. */
+  ldb_atomic(int) limit; /* Max. running below LDB_POOL_HIGH (0 = none). */
+  ldb_atomic(int) active; /* Running (or about to) below LDB_POOL_HIGH. */
 };
 
 static void
@@ -125,6 +216,7 @@ worker_thread(void *arg);
 ldb_pool_t *
 ldb_pool_create(int threads) {
   ldb_pool_t *pool = ldb_malloc(sizeof(ldb_pool_t));
+  int i;
 
   if (threads < 1)
     threads = 1;
@@ -132,68 +224,137 @@ ldb_pool_create(int threads) {
   ldb_mutex_init(&pool->mutex);
   ldb_cond_init(&pool->master);
   ldb_cond_init(&pool->worker);
-  ldb_queue_init(&pool->queue);
 
+  pool->workers = ldb_malloc(threads * sizeof(ldb_worker_t));
   pool->threads = threads;
   pool->running = 0;
-  pool->left = 0;
   pool->stop = 0;
 
+  for (i = 0; i < threads; i++)
+    ldb_worker_init(&pool->workers[i], pool);
+
+  ldb_atomic_init(&pool->started, 0);
+  ldb_atomic_init(&pool->sleeping, 0);
+
+  for (i = 0; i < LDB_POOL_PRIORITIES; i++)
+    ldb_atomic_init(&pool->queued[i], 0);
+
+  ldb_atomic_init(&pool->left, 0);
+  ldb_atomic_init(&pool->next, 0);
+  ldb_atomic_init(&pool->limit, 0);
+  ldb_atomic_init(&pool->active, 0);
+
   return pool;
 }
 
 void
 ldb_pool_destroy(ldb_pool_t *pool) {
-  ldb_mutex_lock(&pool->mutex);
+  int i;
 
-  ldb_queue_clear(&pool->queue);
+  ldb_mutex_lock(&pool->mutex);
 
   pool->stop = 1;
 
   ldb_cond_broadcast(&pool->worker);
-  ldb_mutex_unlock(&pool->mutex);
-
-  ldb_mutex_lock(&pool->mutex);
 
   while (pool->running > 0)
     ldb_cond_wait(&pool->master, &pool->mutex);
 
   ldb_mutex_unlock(&pool->mutex);
 
+  for (i = 0; i < pool->threads; i++)
+    ldb_worker_clear(&pool->workers[i]);
+
   ldb_mutex_destroy(&pool->mutex);
   ldb_cond_destroy(&pool->worker);
   ldb_cond_destroy(&pool->master);
 
+  ldb_free(pool->workers);
   ldb_free(pool);
 }
 
 void
-ldb_pool_schedule(ldb_pool_t *pool, ldb_work_f *func, void *arg) {
+ldb_pool_set_limit(ldb_pool_t *pool, int limit) {
+  ldb_atomic_store(&pool->limit, LDB_MAX(limit, 0), ldb_order_seq_cst);
+
+  /* A higher limit may let sleeping threads take work. */
+  ldb_mutex_lock(&pool->mutex);
+  ldb_cond_broadcast(&pool->worker);
+  ldb_mutex_unlock(&pool->mutex);
+}
+
 #if defined(_WIN32) || defined(LDB_PTHREAD)
+static void
+ldb_pool_start(ldb_pool_t *pool) {
   ldb_mutex_lock(&pool->mutex);
 
-  if (pool->running == 0) {
+  if (!ldb_atomic_load(&pool->started, ldb_order_acquire)) {
     ldb_thread_t thread;
     int i;
 
     pool->running = pool->threads;
 
     for (i = 0; i < pool->threads; i++) {
-      ldb_thread_create(&thread, worker_thread, pool);
+      ldb_thread_create(&thread, worker_thread, &pool->workers[i]);
       ldb_thread_detach(&thread);
     }
+
+    ldb_atomic_store(&pool->started, 1, ldb_order_release);
+  }
+
+  ldb_mutex_unlock(&pool->mutex);
+}
+#endif
+
+void
+ldb_pool_schedule(ldb_pool_t *pool, ldb_work_f *func, void *arg) {
+  ldb_pool_schedule_ex(pool, func, arg, LDB_POOL_NORMAL);
+}
+
+void
+ldb_pool_schedule_ex(ldb_pool_t *pool,
+                     ldb_work_f *func,
+                     void *arg,
+                     enum ldb_pool_priority priority) {
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+  ldb_worker_t *worker = NULL;
+  ldb_work_t *work;
+
+  if (!ldb_atomic_load(&pool->started, ldb_order_acquire))
+    ldb_pool_start(pool);
+
+  work = ldb_work_create(func, arg, priority);
+
+#ifdef LDB_TLS
+  if (ldb_current_worker != NULL && ldb_current_worker->pool == pool)
+    worker = ldb_current_worker;
+#endif
+
+  if (worker == NULL) {
+    unsigned int i = ldb_atomic_fetch_add(&pool->next, 1, ldb_order_relaxed);
+
+    worker = &pool->workers[i % (unsigned int)pool->threads];
   }
 
-  ldb_queue_push(&pool->queue, func, arg);
+  ldb_atomic_fetch_add(&pool->left, 1, ldb_order_relaxed);
 
-  pool->left++;
+  ldb_mutex_lock(&worker->mutex);
+  ldb_queue_push(&worker->queues[priority], work);
+  ldb_mutex_unlock(&worker->mutex);
 
-  ldb_cond_signal(&pool->worker);
-  ldb_mutex_unlock(&pool->mutex);
+  ldb_atomic_fetch_add(&pool->queued[priority], 1, ldb_order_seq_cst);
+
+  /* A sleeping thread either sees the work queued above, or is
+     seen here (both are sequentially consistent). */
+  if (ldb_atomic_load(&pool->sleeping, ldb_order_seq_cst) > 0) {
+    ldb_mutex_lock(&pool->mutex);
+    ldb_cond_signal(&pool->worker);
+    ldb_mutex_unlock(&pool->mutex);
+  }
 #else
-  (void)ldb_queue_push;
   (void)worker_thread;
   (void)pool;
+  (void)priority;
 
   func(arg);
 #endif
@@ -203,40 +364,138 @@ void
 ldb_pool_wait(ldb_pool_t *pool) {
   ldb_mutex_lock(&pool->mutex);
 
-  while (pool->left > 0)
+  while (ldb_atomic_load(&pool->left, ldb_order_acquire) > 0)
     ldb_cond_wait(&pool->master, &pool->mutex);
 
   ldb_mutex_unlock(&pool->mutex);
 }
 
+static int
+ldb_pool_limited(ldb_pool_t *pool) {
+  int limit = ldb_atomic_load(&pool->limit, ldb_order_seq_cst);
+
+  if (limit == 0)
+    return 0;
+
+  return ldb_atomic_load(&pool->active, ldb_order_seq_cst) >= limit;
+}
+
+/* Whether there is queued work a thread is allowed to start. */
+static int
+ldb_pool_pending(ldb_pool_t *pool) {
+  int i;
+
+  if (ldb_atomic_load(&pool->queued[LDB_POOL_HIGH], ldb_order_seq_cst) > 0)
+    return 1;
+
+  for (i = LDB_POOL_HIGH + 1; i < LDB_POOL_PRIORITIES; i++) {
+    if (ldb_atomic_load(&pool->queued[i], ldb_order_seq_cst) > 0)
+      return !ldb_pool_limited(pool);
+  }
+
+  return 0;
+}
+
+static int
+ldb_pool_acquire(ldb_pool_t *pool) {
+  int limit = ldb_atomic_load(&pool->limit, ldb_order_seq_cst);
+  int active = ldb_atomic_fetch_add(&pool->active, 1, ldb_order_seq_cst);
+
+  if (limit > 0 && active >= limit) {
+    ldb_atomic_fetch_sub(&pool->active, 1, ldb_order_seq_cst);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void
+ldb_pool_release(ldb_pool_t *pool) {
+  ldb_atomic_fetch_sub(&pool->active, 1, ldb_order_seq_cst);
+
+  /* Same as in ldb_pool_schedule_ex(): a thread which went to
+     sleep over the limit either sees the slot or is seen here. */
+  if (ldb_atomic_load(&pool->sleeping, ldb_order_seq_cst) > 0) {
+    ldb_mutex_lock(&pool->mutex);
+    ldb_cond_signal(&pool->worker);
+    ldb_mutex_unlock(&pool->mutex);
+  }
+}
+
+/* Take the most urgent work queued: our own first, then that of the
+   other threads, starting with our neighbour. */
+static ldb_work_t *
+ldb_pool_take(ldb_pool_t *pool, ldb_worker_t *self) {
+  int index = self - pool->workers;
+  int i, j;
+
+  for (i = 0; i < LDB_POOL_PRIORITIES; i++) {
+    if (ldb_atomic_load(&pool->queued[i], ldb_order_acquire) == 0)
+      continue;
+
+    if (i != LDB_POOL_HIGH && !ldb_pool_acquire(pool))
+      break;
+
+    for (j = 0; j < pool->threads; j++) {
+      ldb_worker_t *worker = &pool->workers[(index + j) % pool->threads];
+      ldb_work_t *work = ldb_worker_take(worker, i, j > 0);
+
+      if (work != NULL) {
+        ldb_atomic_fetch_sub(&pool->queued[i], 1, ldb_order_relaxed);
+        return work;
+      }
+    }
+
+    if (i != LDB_POOL_HIGH)
+      ldb_pool_release(pool);
+  }
+
+  return NULL;
+}
+
 static void
 worker_thread(void *arg) {
-  ldb_pool_t *pool = arg;
+  ldb_worker_t *self = arg;
+  ldb_pool_t *pool = self->pool;
   ldb_work_t *work;
-  int ran = 0;
+
+#ifdef LDB_TLS
+  ldb_current_worker = self;
+#endif
 
   for (;;) {
-    ldb_mutex_lock(&pool->mutex);
+    work = ldb_pool_take(pool, self);
+
+    if (work != NULL) {
+      work->func(work->arg);
 
-    if (ran) {
-      pool->left--;
+      if (work->priority != LDB_POOL_HIGH)
+        ldb_pool_release(pool);
 
-      if (!pool->stop && pool->left == 0)
-        ldb_cond_signal(&pool->master);
+      ldb_work_destroy(work);
+
+      if (ldb_atomic_fetch_sub(&pool->left, 1, ldb_order_acq_rel) == 1) {
+        ldb_mutex_lock(&pool->mutex);
+        ldb_cond_broadcast(&pool->master);
+        ldb_mutex_unlock(&pool->mutex);
+      }
+
+      continue;
     }
 
-    while (!pool->stop && pool->queue.length == 0)
+    ldb_mutex_lock(&pool->mutex);
+
+    ldb_atomic_fetch_add(&pool->sleeping, 1, ldb_order_seq_cst);
+
+    while (!pool->stop && !ldb_pool_pending(pool))
       ldb_cond_wait(&pool->worker, &pool->mutex);
 
+    ldb_atomic_fetch_sub(&pool->sleeping, 1, ldb_order_seq_cst);
+
     if (pool->stop)
       break;
 
-    work = ldb_queue_shift(&pool->queue);
-    ran = 1;
-
     ldb_mutex_unlock(&pool->mutex);
-
-    ldb_work_execute(work);
   }
 
   if (--pool->running == 0)
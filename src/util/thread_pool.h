@@ -7,6 +7,8 @@
 #ifndef LDB_THREAD_POOL_H
 #define LDB_THREAD_POOL_H
 
+#include "extern.h"
+
 /*
  * Types
  */
@@ -14,19 +16,48 @@
 typedef void ldb_work_f(void *arg);
 typedef struct ldb_pool_s ldb_pool_t;
 
+/* Queued work of a higher priority is always started first. */
+enum ldb_pool_priority {
+  LDB_POOL_HIGH,   /* Memtable flushes. */
+  LDB_POOL_NORMAL, /* Compactions, and anything else by default. */
+  LDB_POOL_LOW     /* Work which should yield to the above. */
+};
+
+#define LDB_POOL_PRIORITIES 3
+
 /*
  * Workers
  */
 
-ldb_pool_t *
+/* Each of the pool's threads has its own queues (one per priority),
+   which work scheduled from that thread goes to. Work scheduled from
+   elsewhere is spread over the queues in turn, and a thread which has
+   run out of work takes it from the others. A pool may be shared by
+   several databases (see ldb_dbopt_t.thread_pool). */
+LDB_EXTERN ldb_pool_t *
 ldb_pool_create(int threads);
 
-void
+/* Run at most "limit" pieces of work below LDB_POOL_HIGH at once (0
+   for no limit), leaving the remaining threads to flushes. With a pool
+   shared by many databases this bounds their compactions as a whole. */
+LDB_EXTERN void
+ldb_pool_set_limit(ldb_pool_t *pool, int limit);
+
+/* Stop the threads once their current work is done. Work which has
+   not been started is dropped. */
+LDB_EXTERN void
 ldb_pool_destroy(ldb_pool_t *pool);
 
 void
 ldb_pool_schedule(ldb_pool_t *pool, ldb_work_f *func, void *arg);
 
+void
+ldb_pool_schedule_ex(ldb_pool_t *pool,
+                     ldb_work_f *func,
+                     void *arg,
+                     enum ldb_pool_priority priority);
+
+/* Wait for all work scheduled so far to finish. */
 void
 ldb_pool_wait(ldb_pool_t *pool);
 
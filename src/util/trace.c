@@ -0,0 +1,402 @@
+/*!
+ * trace.c - operation tracing for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "atomic.h"
+#include "buffer.h"
+#include "coding.h"
+#include "env.h"
+#include "internal.h"
+#include "port.h"
+#include "slice.h"
+#include "status.h"
+#include "trace.h"
+
+/*
+ * Constants
+ */
+
+/* A trace file begins with:
+ *
+ *   magic: fixed32 ("LDTR")
+ *   version: fixed32
+ *   start: fixed64 (wall clock, microseconds)
+ *
+ * Followed by records of:
+ *
+ *   micros: varint64 (since start)
+ *   op: uint8
+ *   key: varint32 length, then bytes
+ *   value_size: varint32
+ *
+ * Block cache lookups are followed by one more byte:
+ *
+ *   block_type: 2 bits
+ *   caller: 2 bits
+ *   hit: 1 bit
+ *   fill: 1 bit
+ */
+#define LDB_TRACE_MAGIC 0x5254444c
+#define LDB_TRACE_VERSION 1
+#define LDB_TRACE_HEADER 16
+
+/* Buffered bytes before a write. */
+#define LDB_TRACE_CHUNK (64 << 10)
+
+/*
+ * Globals
+ */
+
+#ifdef LDB_TLS
+LDB_TLS int ldb_trace_caller = LDB_CALLER_ITERATOR;
+#endif
+
+/*
+ * Tracer
+ */
+
+struct ldb_tracer_s {
+  ldb_mutex_t mutex;
+  ldb_atomic(int) active;
+  ldb_wfile_t *file; /* NULL if stopped. */
+  ldb_buffer_t buf;
+  int64_t start; /* Monotonic, nanoseconds. */
+  int status; /* First write error. */
+};
+
+ldb_tracer_t *
+ldb_tracer_create(void) {
+  ldb_tracer_t *tr = ldb_malloc(sizeof(ldb_tracer_t));
+
+  ldb_mutex_init(&tr->mutex);
+  ldb_atomic_init(&tr->active, 0);
+  ldb_buffer_init(&tr->buf);
+
+  tr->file = NULL;
+  tr->start = 0;
+  tr->status = LDB_OK;
+
+  return tr;
+}
+
+void
+ldb_tracer_destroy(ldb_tracer_t *tr) {
+  if (tr->file != NULL)
+    ldb_tracer_stop(tr);
+
+  ldb_buffer_clear(&tr->buf);
+  ldb_mutex_destroy(&tr->mutex);
+  ldb_free(tr);
+}
+
+/* REQUIRES: tr->mutex is held. */
+static void
+ldb_tracer_flush(ldb_tracer_t *tr) {
+  ldb_slice_t data;
+
+  if (tr->buf.size == 0)
+    return;
+
+  ldb_slice_set(&data, tr->buf.data, tr->buf.size);
+
+  if (tr->status == LDB_OK)
+    tr->status = ldb_wfile_append(tr->file, &data);
+
+  ldb_buffer_reset(&tr->buf);
+}
+
+int
+ldb_tracer_start(ldb_tracer_t *tr, const char *filename) {
+  ldb_wfile_t *file;
+  int rc;
+
+  ldb_mutex_lock(&tr->mutex);
+
+  if (tr->file != NULL) {
+    ldb_mutex_unlock(&tr->mutex);
+    return LDB_INVALID;
+  }
+
+  rc = ldb_truncfile_create(filename, &file);
+
+  if (rc == LDB_OK) {
+    tr->file = file;
+    tr->start = ldb_now_nsec();
+    tr->status = LDB_OK;
+
+    ldb_buffer_reset(&tr->buf);
+    ldb_buffer_fixed32(&tr->buf, LDB_TRACE_MAGIC);
+    ldb_buffer_fixed32(&tr->buf, LDB_TRACE_VERSION);
+    ldb_buffer_fixed64(&tr->buf, ldb_now_usec());
+
+    ldb_atomic_store(&tr->active, 1, ldb_order_release);
+  }
+
+  ldb_mutex_unlock(&tr->mutex);
+
+  return rc;
+}
+
+int
+ldb_tracer_stop(ldb_tracer_t *tr) {
+  int rc;
+
+  ldb_mutex_lock(&tr->mutex);
+
+  if (tr->file == NULL) {
+    ldb_mutex_unlock(&tr->mutex);
+    return LDB_INVALID;
+  }
+
+  ldb_atomic_store(&tr->active, 0, ldb_order_release);
+
+  ldb_tracer_flush(tr);
+
+  rc = tr->status;
+
+  if (rc == LDB_OK)
+    rc = ldb_wfile_close(tr->file);
+
+  ldb_wfile_destroy(tr->file);
+
+  tr->file = NULL;
+
+  ldb_mutex_unlock(&tr->mutex);
+
+  return rc;
+}
+
+int
+ldb_tracer_active(ldb_tracer_t *tr) {
+  return ldb_atomic_load(&tr->active, ldb_order_acquire);
+}
+
+/* `info` is the extra byte of block cache lookups (or -1). */
+static void
+ldb_tracer_append(ldb_tracer_t *tr,
+                  enum ldb_trace_op op,
+                  const ldb_slice_t *key,
+                  size_t value_size,
+                  int info) {
+  int64_t now;
+
+  if (!ldb_atomic_load(&tr->active, ldb_order_relaxed))
+    return;
+
+  now = ldb_now_nsec();
+
+  ldb_mutex_lock(&tr->mutex);
+
+  if (tr->file != NULL) {
+    ldb_buffer_varint64(&tr->buf, now > tr->start ? (now - tr->start) / 1000
+                                                  : 0);
+    ldb_buffer_push(&tr->buf, op);
+
+    if (key != NULL) {
+      ldb_buffer_varint32(&tr->buf, key->size);
+      ldb_buffer_append(&tr->buf, key->data, key->size);
+    } else {
+      ldb_buffer_varint32(&tr->buf, 0);
+    }
+
+    ldb_buffer_varint32(&tr->buf, value_size);
+
+    if (info >= 0)
+      ldb_buffer_push(&tr->buf, info);
+
+    if (tr->buf.size >= LDB_TRACE_CHUNK)
+      ldb_tracer_flush(tr);
+  }
+
+  ldb_mutex_unlock(&tr->mutex);
+}
+
+void
+ldb_tracer_record(ldb_tracer_t *tr,
+                  enum ldb_trace_op op,
+                  const ldb_slice_t *key,
+                  size_t value_size) {
+  ldb_tracer_append(tr, op, key, value_size, -1);
+}
+
+void
+ldb_tracer_record_block(ldb_tracer_t *tr,
+                        const ldb_slice_t *key,
+                        enum ldb_block_type type,
+                        size_t size,
+                        int hit,
+                        int fill) {
+  int caller = LDB_CALLER_ITERATOR;
+
+#ifdef LDB_TLS
+  caller = ldb_trace_caller;
+#endif
+
+  ldb_tracer_append(tr, LDB_TRACE_BLOCK, key, size, (int)type
+                                                  | (caller << 2)
+                                                  | ((hit != 0) << 4)
+                                                  | ((fill != 0) << 5));
+}
+
+/*
+ * Trace Reader
+ */
+
+struct ldb_tracereader_s {
+  ldb_rfile_t *file;
+  ldb_buffer_t buf;
+  size_t pos; /* Offset of the next record in buf. */
+  int eof;
+  uint8_t chunk[LDB_TRACE_CHUNK];
+};
+
+/* Move the unread bytes to the front, and append a chunk. */
+static int
+ldb_tracereader_fill(ldb_tracereader_t *rd) {
+  size_t left = rd->buf.size - rd->pos;
+  ldb_slice_t result;
+
+  if (rd->eof)
+    return 0;
+
+  if (left > 0)
+    memmove(rd->buf.data, rd->buf.data + rd->pos, left);
+
+  rd->buf.size = left;
+  rd->pos = 0;
+
+  if (ldb_rfile_read(rd->file, &result, rd->chunk, LDB_TRACE_CHUNK) != LDB_OK
+      || result.size == 0) {
+    rd->eof = 1;
+    return 0;
+  }
+
+  ldb_buffer_append(&rd->buf, result.data, result.size);
+
+  return 1;
+}
+
+int
+ldb_tracereader_open(const char *filename, ldb_tracereader_t **reader) {
+  ldb_tracereader_t *rd;
+  const uint8_t *xp;
+  ldb_rfile_t *file;
+  size_t xn;
+  int rc;
+
+  *reader = NULL;
+
+  rc = ldb_seqfile_create(filename, &file);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  rd = ldb_malloc(sizeof(ldb_tracereader_t));
+  rd->file = file;
+  rd->pos = 0;
+  rd->eof = 0;
+
+  ldb_buffer_init(&rd->buf);
+
+  while (rd->buf.size < LDB_TRACE_HEADER && ldb_tracereader_fill(rd))
+    ;
+
+  xp = rd->buf.data;
+  xn = rd->buf.size;
+
+  if (xn < LDB_TRACE_HEADER
+      || ldb_fixed32_decode(xp + 0) != LDB_TRACE_MAGIC
+      || ldb_fixed32_decode(xp + 4) != LDB_TRACE_VERSION) {
+    ldb_tracereader_close(rd);
+    return LDB_CORRUPTION;
+  }
+
+  rd->pos = LDB_TRACE_HEADER;
+
+  *reader = rd;
+
+  return LDB_OK;
+}
+
+static int
+ldb_tracerec_read(ldb_tracerec_t *rec, const uint8_t **xp, size_t *xn) {
+  uint32_t key_size;
+
+  if (!ldb_varint64_read(&rec->micros, xp, xn))
+    return 0;
+
+  if (*xn < 1)
+    return 0;
+
+  rec->op = **xp;
+
+  *xp += 1;
+  *xn -= 1;
+
+  if (!ldb_varint32_read(&key_size, xp, xn))
+    return 0;
+
+  if (*xn < key_size)
+    return 0;
+
+  ldb_slice_set(&rec->key, *xp, key_size);
+
+  *xp += key_size;
+  *xn -= key_size;
+
+  if (!ldb_varint32_read(&rec->value_size, xp, xn))
+    return 0;
+
+  rec->block_type = 0;
+  rec->caller = 0;
+  rec->hit = 0;
+  rec->fill = 0;
+
+  if (rec->op == LDB_TRACE_BLOCK) {
+    int info;
+
+    if (*xn < 1)
+      return 0;
+
+    info = **xp;
+
+    *xp += 1;
+    *xn -= 1;
+
+    rec->block_type = info & 3;
+    rec->caller = (info >> 2) & 3;
+    rec->hit = (info >> 4) & 1;
+    rec->fill = (info >> 5) & 1;
+  }
+
+  return 1;
+}
+
+int
+ldb_tracereader_next(ldb_tracereader_t *rd, ldb_tracerec_t *rec) {
+  for (;;) {
+    const uint8_t *xp = rd->buf.data + rd->pos;
+    size_t xn = rd->buf.size - rd->pos;
+
+    if (ldb_tracerec_read(rec, &xp, &xn)) {
+      rd->pos = rd->buf.size - xn;
+      return 1;
+    }
+
+    /* Incomplete record; read more of the file. */
+    if (!ldb_tracereader_fill(rd))
+      return 0;
+  }
+}
+
+void
+ldb_tracereader_close(ldb_tracereader_t *rd) {
+  ldb_rfile_destroy(rd->file);
+  ldb_buffer_clear(&rd->buf);
+  ldb_free(rd);
+}
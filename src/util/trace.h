@@ -0,0 +1,147 @@
+/*!
+ * trace.h - operation tracing for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#ifndef LDB_TRACE_H
+#define LDB_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "extern.h"
+#include "internal.h"
+#include "types.h"
+
+/*
+ * Constants
+ */
+
+enum ldb_trace_op {
+  LDB_TRACE_GET = 1,
+  LDB_TRACE_PUT = 2,
+  LDB_TRACE_DEL = 3,
+  LDB_TRACE_MERGE = 4,
+  LDB_TRACE_SEEK = 5,
+  LDB_TRACE_NEXT = 6,
+  LDB_TRACE_BLOCK = 7 /* Block cache lookup. */
+};
+
+enum ldb_block_type {
+  LDB_BLOCK_DATA = 0,
+  LDB_BLOCK_INDEX = 1,
+  LDB_BLOCK_FILTER = 2
+};
+
+/* What a block was read for. */
+enum ldb_block_caller {
+  LDB_CALLER_ITERATOR = 0, /* Iterators (and anything else). */
+  LDB_CALLER_GET = 1,
+  LDB_CALLER_BACKGROUND = 2 /* Flushes and compactions. */
+};
+
+/*
+ * Types
+ */
+
+/* Records operations to a trace file while started. Records are
+   buffered and written out in large chunks; when no trace is running,
+   recording costs a single atomic load. Block cache lookups are
+   traced with a tracer of their own (see options.block_tracer). */
+typedef struct ldb_tracer_s ldb_tracer_t;
+
+typedef struct ldb_tracerec_s {
+  int op;              /* See enum ldb_trace_op. */
+  ldb_slice_t key;     /* Empty for iterator steps. */
+  uint32_t value_size; /* Value written or found (zero if none). */
+  uint64_t micros;     /* Time since the trace was started. */
+  /* Block cache lookups only (the key is the cache key, and the
+     value size is the size of the block on disk). */
+  int block_type;      /* See enum ldb_block_type. */
+  int caller;          /* See enum ldb_block_caller. */
+  int hit;
+  int fill;            /* Whether a miss inserts the block. */
+} ldb_tracerec_t;
+
+typedef struct ldb_tracereader_s ldb_tracereader_t;
+
+/*
+ * Tracer
+ */
+
+LDB_EXTERN ldb_tracer_t *
+ldb_tracer_create(void);
+
+LDB_EXTERN void
+ldb_tracer_destroy(ldb_tracer_t *tr);
+
+/* Start writing records to `filename`, replacing it. Returns
+   LDB_INVALID if a trace is already running. */
+LDB_EXTERN int
+ldb_tracer_start(ldb_tracer_t *tr, const char *filename);
+
+/* Stop tracing and close the file. Returns LDB_INVALID if no
+   trace is running. */
+LDB_EXTERN int
+ldb_tracer_stop(ldb_tracer_t *tr);
+
+/* Is a trace running? */
+int
+ldb_tracer_active(ldb_tracer_t *tr);
+
+void
+ldb_tracer_record(ldb_tracer_t *tr,
+                  enum ldb_trace_op op,
+                  const ldb_slice_t *key,
+                  size_t value_size);
+
+/* Record a block cache lookup on behalf of the calling thread's
+   current caller (see LDB_TRACE_CALLER). */
+void
+ldb_tracer_record_block(ldb_tracer_t *tr,
+                        const ldb_slice_t *key,
+                        enum ldb_block_type type,
+                        size_t size,
+                        int hit,
+                        int fill);
+
+/*
+ * Trace Reader
+ */
+
+/* Open a trace file. Returns LDB_CORRUPTION if it is not a trace. */
+LDB_EXTERN int
+ldb_tracereader_open(const char *filename, ldb_tracereader_t **reader);
+
+/* Read the next record. The key is valid until the next call. Returns
+   zero at the end of the trace, or if the rest of it is corrupt. */
+LDB_EXTERN int
+ldb_tracereader_next(ldb_tracereader_t *rd, ldb_tracerec_t *rec);
+
+LDB_EXTERN void
+ldb_tracereader_close(ldb_tracereader_t *rd);
+
+/*
+ * Helpers
+ */
+
+/* Set the calling thread's block caller, saving the previous one. */
+#ifdef LDB_TLS
+
+extern LDB_TLS int ldb_trace_caller;
+
+#define LDB_TRACE_CALLER(prev, caller) do { \
+  (prev) = ldb_trace_caller;                \
+  ldb_trace_caller = (caller);              \
+} while (0)
+
+#define LDB_TRACE_RESTORE(prev) (ldb_trace_caller = (prev))
+
+#else /* !LDB_TLS */
+
+#define LDB_TRACE_CALLER(prev, caller) ((prev) = (caller))
+#define LDB_TRACE_RESTORE(prev) ((void)(prev))
+
+#endif /* !LDB_TLS */
+
+#endif /* LDB_TRACE_H */
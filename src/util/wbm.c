@@ -0,0 +1,266 @@
+/*!
+ * wbm.c - write buffer manager for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include "cache.h"
+#include "internal.h"
+#include "port.h"
+#include "wbm.h"
+
+/*
+ * Write Buffer Manager
+ */
+
+struct ldb_wbm_s {
+  ldb_mutex_t mutex;
+  size_t buffer_size;
+  size_t usage; /* Total charged. */
+  size_t pending; /* Charged for memtables being (or about to be) freed. */
+  size_t limit; /* Hard limit on memtables and cache (or zero). */
+  ldb_lru_t *cache; /* Cache shrunk to fit the limit (or NULL). */
+  size_t cache_capacity; /* Capacity of the cache before the limit. */
+  size_t cache_target; /* Capacity last given to the cache. */
+  ldb_wbmclient_t *head;
+};
+
+ldb_wbm_t *
+ldb_wbm_create(size_t buffer_size) {
+  ldb_wbm_t *wbm = ldb_malloc(sizeof(ldb_wbm_t));
+
+  ldb_mutex_init(&wbm->mutex);
+
+  wbm->buffer_size = buffer_size;
+  wbm->usage = 0;
+  wbm->pending = 0;
+  wbm->limit = 0;
+  wbm->cache = NULL;
+  wbm->cache_capacity = 0;
+  wbm->cache_target = 0;
+  wbm->head = NULL;
+
+  return wbm;
+}
+
+void
+ldb_wbm_destroy(ldb_wbm_t *wbm) {
+  assert(wbm->head == NULL);
+
+  if (wbm->cache != NULL)
+    ldb_lru_set_capacity(wbm->cache, wbm->cache_capacity);
+
+  ldb_mutex_destroy(&wbm->mutex);
+  ldb_free(wbm);
+}
+
+size_t
+ldb_wbm_usage(ldb_wbm_t *wbm) {
+  size_t usage;
+
+  ldb_mutex_lock(&wbm->mutex);
+
+  usage = wbm->usage;
+
+  ldb_mutex_unlock(&wbm->mutex);
+
+  return usage;
+}
+
+/* Give the cache whatever the memtables leave of the limit.
+   REQUIRES: wbm->mutex is held. */
+static void
+ldb_wbm_resize(ldb_wbm_t *wbm) {
+  size_t granule, target;
+
+  if (wbm->cache == NULL)
+    return;
+
+  granule = wbm->limit / 64 + 1;
+
+  if (wbm->usage < wbm->limit - wbm->limit / 4)
+    target = wbm->limit - wbm->usage;
+  else
+    target = wbm->limit / 4;
+
+  if (target > wbm->cache_capacity)
+    target = wbm->cache_capacity;
+
+  /* Avoid resizing on every write. */
+  target -= target % granule;
+
+  if (target != wbm->cache_target) {
+    ldb_lru_set_capacity(wbm->cache, target);
+    wbm->cache_target = target;
+  }
+}
+
+void
+ldb_wbm_set_limit(ldb_wbm_t *wbm, size_t limit, ldb_lru_t *cache) {
+  ldb_mutex_lock(&wbm->mutex);
+
+  if (wbm->cache != NULL)
+    ldb_lru_set_capacity(wbm->cache, wbm->cache_capacity);
+
+  wbm->limit = limit;
+  wbm->cache = limit > 0 ? cache : NULL;
+  wbm->cache_capacity = 0;
+  wbm->cache_target = 0;
+
+  if (wbm->cache != NULL) {
+    wbm->cache_capacity = ldb_lru_capacity(cache);
+    wbm->cache_target = wbm->cache_capacity;
+  }
+
+  ldb_wbm_resize(wbm);
+
+  ldb_mutex_unlock(&wbm->mutex);
+}
+
+void
+ldb_wbm_register(ldb_wbm_t *wbm, ldb_wbmclient_t *client) {
+  client->mem = 0;
+  client->imm = 0;
+  client->flush = 0;
+  client->prev = NULL;
+
+  ldb_mutex_lock(&wbm->mutex);
+
+  client->next = wbm->head;
+
+  if (wbm->head != NULL)
+    wbm->head->prev = client;
+
+  wbm->head = client;
+
+  ldb_mutex_unlock(&wbm->mutex);
+}
+
+/* Drop the charges of a client. */
+/* REQUIRES: wbm->mutex is held. */
+static void
+ldb_wbm_release(ldb_wbm_t *wbm, ldb_wbmclient_t *client) {
+  wbm->usage -= client->mem + client->imm;
+  wbm->pending -= client->imm;
+
+  if (client->flush)
+    wbm->pending -= client->mem;
+
+  client->mem = 0;
+  client->imm = 0;
+}
+
+void
+ldb_wbm_unregister(ldb_wbm_t *wbm, ldb_wbmclient_t *client) {
+  ldb_mutex_lock(&wbm->mutex);
+
+  ldb_wbm_release(wbm, client);
+
+  if (client->prev != NULL)
+    client->prev->next = client->next;
+  else
+    wbm->head = client->next;
+
+  if (client->next != NULL)
+    client->next->prev = client->prev;
+
+  client->prev = NULL;
+  client->next = NULL;
+
+  ldb_wbm_resize(wbm);
+
+  ldb_mutex_unlock(&wbm->mutex);
+}
+
+/* REQUIRES: wbm->mutex is held. */
+static void
+ldb_wbm_set(ldb_wbm_t *wbm, ldb_wbmclient_t *client,
+                            size_t mem,
+                            size_t imm) {
+  ldb_wbm_release(wbm, client);
+
+  client->mem = mem;
+  client->imm = imm;
+
+  wbm->usage += mem + imm;
+  wbm->pending += imm;
+
+  if (client->flush)
+    wbm->pending += mem;
+}
+
+/* Ask the largest memtables not already being freed to be flushed
+   until the rest fits the budget. Databases which are asked but
+   become idle keep their memory until their next write.
+   REQUIRES: wbm->mutex is held. */
+static void
+ldb_wbm_balance(ldb_wbm_t *wbm) {
+  size_t budget = wbm->buffer_size;
+
+  if (wbm->limit > 0) {
+    size_t share = wbm->limit;
+
+    if (wbm->cache != NULL)
+      share -= wbm->limit / 4;
+
+    if (share < budget)
+      budget = share;
+  }
+
+  while (wbm->usage - wbm->pending > budget) {
+    ldb_wbmclient_t *largest = NULL;
+    ldb_wbmclient_t *c;
+
+    for (c = wbm->head; c != NULL; c = c->next) {
+      if (c->flush || c->mem == 0)
+        continue;
+
+      if (largest == NULL || c->mem > largest->mem)
+        largest = c;
+    }
+
+    if (largest == NULL)
+      break;
+
+    largest->flush = 1;
+
+    wbm->pending += largest->mem;
+  }
+}
+
+int
+ldb_wbm_charge(ldb_wbm_t *wbm, ldb_wbmclient_t *client,
+                               size_t mem,
+                               size_t imm) {
+  int flush;
+
+  ldb_mutex_lock(&wbm->mutex);
+
+  ldb_wbm_set(wbm, client, mem, imm);
+  ldb_wbm_balance(wbm);
+  ldb_wbm_resize(wbm);
+
+  flush = client->flush;
+
+  ldb_mutex_unlock(&wbm->mutex);
+
+  return flush;
+}
+
+void
+ldb_wbm_switched(ldb_wbm_t *wbm, ldb_wbmclient_t *client,
+                                 size_t mem,
+                                 size_t imm) {
+  ldb_mutex_lock(&wbm->mutex);
+
+  ldb_wbm_release(wbm, client);
+
+  client->flush = 0;
+
+  ldb_wbm_set(wbm, client, mem, imm);
+  ldb_wbm_resize(wbm);
+
+  ldb_mutex_unlock(&wbm->mutex);
+}
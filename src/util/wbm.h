@@ -0,0 +1,81 @@
+/*!
+ * wbm.h - write buffer manager for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ */
+
+#ifndef LDB_WBM_H
+#define LDB_WBM_H
+
+#include <stddef.h>
+#include "extern.h"
+
+/*
+ * Types
+ */
+
+struct ldb_lru_s;
+
+/* Caps the memtable memory of every database sharing it. */
+typedef struct ldb_wbm_s ldb_wbm_t;
+
+/* The share of a single database. */
+typedef struct ldb_wbmclient_s {
+  size_t mem; /* Charged for the current memtable. */
+  size_t imm; /* Charged for memtables being flushed. */
+  int flush; /* Whether the current memtable should be flushed. */
+  struct ldb_wbmclient_s *prev;
+  struct ldb_wbmclient_s *next;
+} ldb_wbmclient_t;
+
+/*
+ * Write Buffer Manager
+ */
+
+/* Create a manager limiting the memtables of the databases using it
+   to a total of roughly `buffer_size` bytes. Once the budget is used
+   up, the database with the largest memtable is asked to flush it;
+   it does so at its next write. Databases keep their own
+   write_buffer_size limits as well. */
+LDB_EXTERN ldb_wbm_t *
+ldb_wbm_create(size_t buffer_size);
+
+/* REQUIRES: No database is using the manager. */
+LDB_EXTERN void
+ldb_wbm_destroy(ldb_wbm_t *wbm);
+
+/* Total memory charged by all databases. */
+LDB_EXTERN size_t
+ldb_wbm_usage(ldb_wbm_t *wbm);
+
+/* Set a hard limit on the memtables and the block cache together
+   (zero for none). Memtables are flushed before they take more than
+   three quarters of the limit, and the cache gives up whatever the
+   memtables use beyond a quarter of it, growing back (up to its own
+   capacity) as they are flushed. The cache must outlive its use by
+   the manager. */
+LDB_EXTERN void
+ldb_wbm_set_limit(ldb_wbm_t *wbm, size_t limit, struct ldb_lru_s *cache);
+
+void
+ldb_wbm_register(ldb_wbm_t *wbm, ldb_wbmclient_t *client);
+
+/* Remove the client along with its charges. */
+void
+ldb_wbm_unregister(ldb_wbm_t *wbm, ldb_wbmclient_t *client);
+
+/* Update the charges of a client, asking the largest memtables to be
+   flushed if the budget is exceeded. Returns whether the client's
+   memtable should be flushed. */
+int
+ldb_wbm_charge(ldb_wbm_t *wbm, ldb_wbmclient_t *client,
+                               size_t mem,
+                               size_t imm);
+
+/* Like charge(), after the client switched to a new memtable. */
+void
+ldb_wbm_switched(ldb_wbm_t *wbm, ldb_wbmclient_t *client,
+                                 size_t mem,
+                                 size_t imm);
+
+#endif /* LDB_WBM_H */
@@ -0,0 +1,592 @@
+/*!
+ * verify.c - database verification for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "table/iterator.h"
+#include "table/table.h"
+
+#include "util/buffer.h"
+#include "util/comparator.h"
+#include "util/crc32c.h"
+#include "util/env.h"
+#include "util/internal.h"
+#include "util/options.h"
+#include "util/port.h"
+#include "util/rbt.h"
+#include "util/slice.h"
+#include "util/status.h"
+#include "util/strutil.h"
+#include "util/thread_pool.h"
+#include "util/vector.h"
+
+#include "filename.h"
+#include "log_format.h"
+#include "log_reader.h"
+#include "verify.h"
+#include "version_edit.h"
+
+/*
+ * Types
+ */
+
+struct verify_s;
+
+typedef struct verify_file_s {
+  struct verify_s *state;
+  ldb_filetype_t type;
+  uint64_t number;
+  int path_id;
+  char name[LDB_PATH_MAX];
+  uint64_t size;    /* Bytes read from the file. */
+  uint64_t entries; /* Log records or table entries. */
+  size_t dropped;   /* Log bytes dropped due to corruption. */
+  int status;
+} verify_file_t;
+
+typedef struct verify_s {
+  const char *dbname;
+  ldb_dbopt_t options; /* For opening tables. */
+  uint32_t log_block_size;
+  int checksum;
+  ldb_mutex_t mutex;
+  int done;
+  int total;
+  FILE *dst;
+} verify_t;
+
+/*
+ * Helpers
+ */
+
+static verify_file_t *
+verify_file_create(verify_t *v, ldb_filetype_t type, uint64_t number) {
+  verify_file_t *f = ldb_malloc(sizeof(verify_file_t));
+
+  f->state = v;
+  f->type = type;
+  f->number = number;
+  f->path_id = 0;
+  f->name[0] = '\0';
+  f->size = 0;
+  f->entries = 0;
+  f->dropped = 0;
+  f->status = LDB_OK;
+
+  return f;
+}
+
+static void
+live_destruct(rb_node_t *node) {
+  ldb_free(node->val.ptr);
+}
+
+/* Print a line for a finished file. */
+static void
+verify_report(verify_t *v, const verify_file_t *f) {
+  const char *name = ldb_basename(f->name);
+
+  ldb_mutex_lock(&v->mutex);
+
+  v->done++;
+
+  if (f->status == LDB_OK) {
+    fprintf(v->dst, "[%d/%d] %s: OK (%.0f entries, %.0f bytes)\n",
+                    v->done, v->total, name,
+                    (double)f->entries, (double)f->size);
+  } else if (f->dropped > 0) {
+    fprintf(v->dst, "[%d/%d] %s: %s (%.0f bytes dropped)\n",
+                    v->done, v->total, name,
+                    ldb_strerror(f->status),
+                    (double)f->dropped);
+  } else {
+    fprintf(v->dst, "[%d/%d] %s: %s\n",
+                    v->done, v->total, name,
+                    ldb_strerror(f->status));
+  }
+
+  fflush(v->dst);
+
+  ldb_mutex_unlock(&v->mutex);
+}
+
+/*
+ * Logs
+ */
+
+static void
+report_corruption(ldb_reporter_t *report, size_t bytes, int status) {
+  if (*report->status == LDB_OK)
+    *report->status = status;
+
+  report->dropped_bytes += bytes;
+}
+
+/* Read every record of a log file, calling (*func)() on each. */
+static void
+verify_log(verify_file_t *f,
+           size_t block_size,
+           void (*func)(void *, const ldb_slice_t *),
+           void *arg) {
+  ldb_reporter_t reporter;
+  ldb_reader_t reader;
+  ldb_buffer_t scratch;
+  ldb_slice_t record;
+  ldb_rfile_t *file;
+  int rc;
+
+  rc = ldb_file_size(f->name, &f->size);
+
+  if (rc == LDB_OK)
+    rc = ldb_seqfile_create(f->name, &file);
+
+  if (rc != LDB_OK) {
+    f->status = rc;
+    return;
+  }
+
+  reporter.status = &f->status;
+  reporter.dropped_bytes = 0;
+  reporter.corruption = report_corruption;
+
+  ldb_reader_init(&reader, file, &reporter, f->state->checksum, 0);
+  ldb_reader_block_size(&reader, block_size);
+
+  if (f->type == LDB_FILE_LOG)
+    ldb_reader_recyclable(&reader, f->number);
+
+  ldb_buffer_init(&scratch);
+
+  while (ldb_reader_read_record(&reader, &record, &scratch)) {
+    if (func != NULL)
+      func(arg, &record);
+
+    f->entries++;
+  }
+
+  f->dropped = reporter.dropped_bytes;
+
+  ldb_buffer_clear(&scratch);
+  ldb_reader_clear(&reader);
+  ldb_rfile_destroy(file);
+}
+
+static void
+verify_log_call(void *arg) {
+  verify_file_t *f = arg;
+  verify_t *v = f->state;
+
+  verify_log(f, v->log_block_size, NULL, NULL);
+  verify_report(v, f);
+}
+
+/*
+ * Descriptor
+ */
+
+typedef struct replay_s {
+  rb_tree_t live; /* number -> verify_file_t * */
+  uint64_t log_number;
+  uint64_t prev_log_number;
+  uint32_t log_block_size;
+  verify_t *state;
+  int status;
+} replay_t;
+
+/* Apply an edit to the set of live tables. */
+static void
+replay_edit(void *arg, const ldb_slice_t *record) {
+  replay_t *r = arg;
+  ldb_edit_t edit;
+  rb_iter_t it;
+  size_t i;
+
+  if (r->status != LDB_OK)
+    return;
+
+  ldb_edit_init(&edit);
+
+  if (!ldb_edit_import(&edit, record)) {
+    r->status = LDB_CORRUPTION;
+    ldb_edit_clear(&edit);
+    return;
+  }
+
+  if (edit.has_log_number)
+    r->log_number = edit.log_number;
+
+  if (edit.has_prev_log_number)
+    r->prev_log_number = edit.prev_log_number;
+
+  if (edit.has_log_block_size)
+    r->log_block_size = edit.log_block_size;
+
+  /* A file moved between levels is deleted and added by one edit. */
+  rb_set_each(&edit.deleted_files, it) {
+    const file_entry_t *entry = rb_key_ptr(it);
+    rb_node_t node;
+
+    if (rb_tree_del(&r->live, rb_ui(entry->number), &node))
+      ldb_free(node.val.ptr);
+  }
+
+  for (i = 0; i < edit.new_files.length; i++) {
+    const meta_entry_t *entry = edit.new_files.items[i];
+    const ldb_filemeta_t *meta = &entry->meta;
+    verify_file_t *f;
+    rb_node_t *node;
+
+    if (rb_tree_put(&r->live, rb_ui(meta->number), &node))
+      node->val.ptr = verify_file_create(r->state, LDB_FILE_TABLE, 0);
+
+    f = node->val.ptr;
+    f->number = meta->number;
+    f->path_id = meta->path_id;
+  }
+
+  ldb_edit_clear(&edit);
+}
+
+static int
+read_current_filename(char *path, size_t size, const char *dbname) {
+  ldb_buffer_t data;
+  int rc;
+
+  if (!ldb_current_filename(path, size, dbname))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&data);
+
+  rc = ldb_read_file(path, &data);
+
+  if (rc == LDB_OK) {
+    if (data.size == 0 || data.data[data.size - 1] != '\n') {
+      rc = LDB_CORRUPTION; /* "CURRENT file does not end with newline" */
+    } else {
+      data.data[data.size - 1] = '\0';
+
+      if (!ldb_join(path, size, dbname, (char *)data.data))
+        rc = LDB_INVALID;
+    }
+  }
+
+  ldb_buffer_clear(&data);
+
+  return rc;
+}
+
+/*
+ * Tables
+ */
+
+static int
+open_table(verify_file_t *f, ldb_rfile_t **file, ldb_table_t **table) {
+  verify_t *v = f->state;
+  const char *dir = ldb_table_dir(v->dbname, &v->options, f->path_id);
+  int rc;
+
+  if (!ldb_table_filename(f->name, sizeof(f->name), dir, f->number))
+    return LDB_INVALID;
+
+  rc = ldb_file_size(f->name, &f->size);
+
+  if (rc != LDB_OK) {
+    /* Try alternate file name. */
+    char alt[LDB_PATH_MAX];
+
+    if (!ldb_sstable_filename(alt, sizeof(alt), dir, f->number))
+      return LDB_INVALID;
+
+    if (ldb_file_size(alt, &f->size) == LDB_OK) {
+      strcpy(f->name, alt);
+      rc = LDB_OK;
+    }
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_randfile_create(f->name, file, LDB_RFILE_MMAP);
+
+  if (rc == LDB_OK) {
+    rc = ldb_table_open(&v->options, *file, f->size, table);
+
+    if (rc != LDB_OK)
+      ldb_rfile_destroy(*file);
+  }
+
+  return rc;
+}
+
+static int
+scan_entries(verify_file_t *f, ldb_iter_t *iter) {
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+    f->entries++;
+
+  return ldb_iter_status(iter);
+}
+
+static void
+verify_table_call(void *arg) {
+  verify_file_t *f = arg;
+  verify_t *v = f->state;
+  ldb_readopt_t ro = *ldb_readopt_default;
+  ldb_table_t *table;
+  ldb_rfile_t *file;
+  ldb_iter_t *iter;
+  int rc;
+
+  rc = open_table(f, &file, &table);
+
+  if (rc == LDB_OK) {
+    ro.verify_checksums = v->checksum;
+    ro.fill_cache = 0;
+
+    iter = ldb_tableiter_create(table, &ro);
+    rc = scan_entries(f, iter);
+    ldb_iter_destroy(iter);
+
+    /* Range tombstones are kept apart from the other entries. */
+    iter = ldb_table_range_iterator(table);
+
+    if (iter != NULL) {
+      int status = scan_entries(f, iter);
+
+      if (rc == LDB_OK)
+        rc = status;
+
+      ldb_iter_destroy(iter);
+    }
+
+    ldb_table_destroy(table);
+    ldb_rfile_destroy(file);
+  }
+
+  f->status = rc;
+
+  verify_report(v, f);
+}
+
+/*
+ * Verify
+ */
+
+static int
+verify_inner(verify_t *v, int threads) {
+  char fname[LDB_PATH_MAX];
+  char **filenames = NULL;
+  verify_file_t *desc;
+  ldb_vector_t files;
+  ldb_filetype_t type;
+  int64_t start, elapsed;
+  uint64_t number;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+  int failed = 0;
+  replay_t r;
+  rb_iter_t it;
+  size_t i;
+  int len;
+  int rc;
+
+  start = ldb_now_usec();
+
+  /* Read the descriptor first: it decides which files are live. */
+  rc = read_current_filename(fname, sizeof(fname), v->dbname);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  rb_tree_init(&r.live, rb_set64_compare, NULL);
+
+  r.log_number = 0;
+  r.prev_log_number = 0;
+  r.log_block_size = LDB_BLOCK_SIZE;
+  r.state = v;
+  r.status = LDB_OK;
+
+  desc = verify_file_create(v, LDB_FILE_DESC, 0);
+
+  strcpy(desc->name, fname);
+
+  v->total = 1;
+
+  verify_log(desc, LDB_BLOCK_SIZE, replay_edit, &r);
+
+  if (desc->status == LDB_OK)
+    desc->status = r.status;
+
+  if (desc->status != LDB_OK) {
+    verify_report(v, desc);
+    rc = desc->status;
+    ldb_free(desc);
+    rb_tree_clear(&r.live, live_destruct);
+    return rc;
+  }
+
+  /* Collect the live logs and tables. */
+  ldb_vector_init(&files);
+
+  len = ldb_get_children(v->dbname, &filenames);
+
+  for (i = 0; (int)i < len; i++) {
+    verify_file_t *f;
+
+    if (!ldb_parse_filename(&type, &number, filenames[i]))
+      continue;
+
+    if (type != LDB_FILE_LOG)
+      continue;
+
+    if (number < r.log_number && number != r.prev_log_number)
+      continue;
+
+    f = verify_file_create(v, type, number);
+
+    if (!ldb_join(f->name, sizeof(f->name), v->dbname, filenames[i])) {
+      ldb_free(f);
+      continue;
+    }
+
+    ldb_vector_push(&files, f);
+  }
+
+  if (len >= 0)
+    ldb_free_children(filenames, len);
+
+  rb_tree_each(&r.live, it)
+    ldb_vector_push(&files, rb_val_ptr(it));
+
+  rb_tree_clear(&r.live, NULL);
+
+  v->log_block_size = r.log_block_size;
+  v->total += files.length;
+
+  verify_report(v, desc);
+
+  entries += desc->entries;
+  bytes += desc->size;
+
+  ldb_free(desc);
+
+  /* Read everything else in parallel. */
+  if ((size_t)threads > files.length)
+    threads = files.length;
+
+  if (threads <= 1) {
+    for (i = 0; i < files.length; i++) {
+      verify_file_t *f = files.items[i];
+
+      if (f->type == LDB_FILE_LOG)
+        verify_log_call(f);
+      else
+        verify_table_call(f);
+    }
+  } else {
+    ldb_pool_t *pool = ldb_pool_create(threads);
+
+    for (i = 0; i < files.length; i++) {
+      verify_file_t *f = files.items[i];
+
+      if (f->type == LDB_FILE_LOG)
+        ldb_pool_schedule(pool, verify_log_call, f);
+      else
+        ldb_pool_schedule(pool, verify_table_call, f);
+    }
+
+    ldb_pool_wait(pool);
+    ldb_pool_destroy(pool);
+  }
+
+  for (i = 0; i < files.length; i++) {
+    verify_file_t *f = files.items[i];
+
+    if (f->status != LDB_OK)
+      failed++;
+
+    entries += f->entries;
+    bytes += f->size;
+
+    ldb_free(f);
+  }
+
+  ldb_vector_clear(&files);
+
+  elapsed = ldb_now_usec() - start;
+
+  if (elapsed <= 0)
+    elapsed = 1;
+
+  fprintf(v->dst, "%d files, %.0f entries, %.1f MB in %.2f s (%.1f MB/s)\n",
+                  v->total,
+                  (double)entries,
+                  (double)bytes / 1048576.0,
+                  (double)elapsed / 1000000.0,
+                  ((double)bytes / 1048576.0) / ((double)elapsed / 1000000.0));
+
+  if (failed > 0) {
+    fprintf(v->dst, "%d of %d files failed to verify\n", failed, v->total);
+    return LDB_CORRUPTION;
+  }
+
+  return LDB_OK;
+}
+
+int
+ldb_verify_db(const char *dbname,
+              const ldb_dbopt_t *options,
+              int threads,
+              int checksum,
+              FILE *dst) {
+  char lockname[LDB_PATH_MAX];
+  ldb_filelock_t *lock;
+  verify_t v;
+  int rc;
+
+  if (options == NULL)
+    options = ldb_dbopt_default;
+
+  if (strlen(dbname) + 1 > LDB_PATH_MAX - 35)
+    return LDB_INVALID;
+
+  if (!ldb_lock_filename(lockname, sizeof(lockname), dbname))
+    return LDB_INVALID;
+
+  ldb_crc32c_init();
+
+  rc = ldb_lock_file(lockname, &lock);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  v.dbname = dbname;
+  v.options = *options;
+  v.log_block_size = LDB_BLOCK_SIZE;
+  v.checksum = checksum;
+  v.done = 0;
+  v.total = 0;
+  v.dst = dst;
+
+  /* We use the bytewise comparator as ldb_dump_file() does: tables are
+     only iterated forward, which requires no comparisons. Blocks are
+     never cached, and the index and filter blocks are verified. */
+  v.options.comparator = ldb_bytewise_comparator;
+  v.options.block_cache = NULL;
+  v.options.paranoid_checks = checksum;
+
+  ldb_mutex_init(&v.mutex);
+
+  rc = verify_inner(&v, threads);
+
+  ldb_mutex_destroy(&v.mutex);
+
+  ldb_unlock_file(lock);
+
+  return rc;
+}
@@ -0,0 +1,39 @@
+/*!
+ * verify.h - database verification for lcdb
+ * Copyright (c) 2022, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/lcdb
+ *
+ * See LICENSE for more information.
+ */
+
+#ifndef LDB_VERIFY_H
+#define LDB_VERIFY_H
+
+#include <stdio.h>
+#include "util/extern.h"
+
+struct ldb_dbopt_s;
+
+/* Read every file the database "dbname" depends on: the descriptor
+ * named by CURRENT, the write-ahead logs which are still live, and
+ * every table of the current version (looked up in options->db_paths
+ * if the database was created with them). Every log record and table
+ * block is read through in full, using up to "threads" threads.
+ *
+ * A line is written to *dst as each file completes, followed by a
+ * summary of the entries and bytes read and the read throughput. If
+ * "checksum" is zero, block checksums are not verified, measuring raw
+ * scan throughput instead.
+ *
+ * The database must not be open. Returns LDB_CORRUPTION if any file
+ * failed to verify, or another non-OK result if the descriptor could
+ * not be read.
+ */
+LDB_EXTERN int
+ldb_verify_db(const char *dbname,
+              const struct ldb_dbopt_s *options,
+              int threads,
+              int checksum,
+              FILE *dst);
+
+#endif /* LDB_VERIFY_H */
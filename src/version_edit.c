@@ -10,6 +10,7 @@
  * See LICENSE for more information.
  */
 
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -38,7 +39,14 @@ enum {
   TAG_DELETED_FILE = 6,
   TAG_NEW_FILE = 7,
   /* 8 was used for large value refs. */
-  TAG_PREV_LOG_NUMBER = 9
+  TAG_PREV_LOG_NUMBER = 9,
+  TAG_NEW_FILE_TIME = 10, /* TAG_NEW_FILE with a creation time. */
+  TAG_NEW_FILE_RANGE = 11, /* TAG_NEW_FILE_TIME with a tombstone count. */
+  TAG_NEW_FILE_SEQ = 12, /* TAG_NEW_FILE_RANGE with a global sequence. */
+  TAG_NEW_FILE_STATS = 13, /* TAG_NEW_FILE_SEQ with entry counts. */
+  TAG_NEW_FILE_BLOB = 14, /* TAG_NEW_FILE_STATS with a blob file number. */
+  TAG_NEW_FILE_PATH = 15, /* TAG_NEW_FILE_BLOB with a path id. */
+  TAG_LOG_BLOCK_SIZE = 16
 };
 
 /*
@@ -173,9 +181,20 @@ ldb_filemeta_unref(ldb_filemeta_t *z) {
 void
 ldb_filemeta_init(ldb_filemeta_t *meta) {
   meta->refs = 0;
-  meta->allowed_seeks = (1 << 30);
+  ldb_atomic_init(&meta->allowed_seeks, 1 << 30);
+  ldb_atomic_init(&meta->reads, 0);
+  meta->being_compacted = 0;
   meta->number = 0;
   meta->file_size = 0;
+  meta->creation_time = 0;
+  meta->tombstones = 0;
+  meta->global_sequence = 0;
+  meta->entries = 0;
+  meta->deletions = 0;
+  meta->oldest_blob = 0;
+  meta->path_id = 0;
+
+  ldb_atomic_init_ptr(&meta->reader, NULL);
 
   ldb_ikey_init(&meta->smallest);
   ldb_ikey_init(&meta->largest);
@@ -190,9 +209,24 @@ ldb_filemeta_clear(ldb_filemeta_t *meta) {
 void
 ldb_filemeta_copy(ldb_filemeta_t *z, const ldb_filemeta_t *x) {
   z->refs = x->refs;
-  z->allowed_seeks = x->allowed_seeks;
+  ldb_atomic_store(&z->allowed_seeks,
+                   ldb_atomic_load(&x->allowed_seeks, ldb_order_relaxed),
+                   ldb_order_relaxed);
+  ldb_atomic_store(&z->reads,
+                   ldb_atomic_load(&x->reads, ldb_order_relaxed),
+                   ldb_order_relaxed);
+  z->being_compacted = x->being_compacted;
   z->number = x->number;
   z->file_size = x->file_size;
+  z->creation_time = x->creation_time;
+  z->tombstones = x->tombstones;
+  z->global_sequence = x->global_sequence;
+  z->entries = x->entries;
+  z->deletions = x->deletions;
+  z->oldest_blob = x->oldest_blob;
+  z->path_id = x->path_id;
+
+  ldb_atomic_init_ptr(&z->reader, NULL); /* Not shared. */
 
   ldb_ikey_copy(&z->smallest, &x->smallest);
   ldb_ikey_copy(&z->largest, &x->largest);
@@ -210,11 +244,13 @@ ldb_edit_init(ldb_edit_t *edit) {
   edit->prev_log_number = 0;
   edit->last_sequence = 0;
   edit->next_file_number = 0;
+  edit->log_block_size = 0;
   edit->has_comparator = 0;
   edit->has_log_number = 0;
   edit->has_prev_log_number = 0;
   edit->has_next_file_number = 0;
   edit->has_last_sequence = 0;
+  edit->has_log_block_size = 0;
 
   ldb_vector_init(&edit->compact_pointers);
   rb_set_init(&edit->deleted_files, file_entry_compare, NULL);
@@ -273,6 +309,12 @@ ldb_edit_set_last_sequence(ldb_edit_t *edit, ldb_seqnum_t seq) {
   edit->last_sequence = seq;
 }
 
+void
+ldb_edit_set_log_block_size(ldb_edit_t *edit, uint32_t size) {
+  edit->has_log_block_size = 1;
+  edit->log_block_size = size;
+}
+
 void
 ldb_edit_set_compact_pointer(ldb_edit_t *edit,
                              int level,
@@ -282,7 +324,7 @@ ldb_edit_set_compact_pointer(ldb_edit_t *edit,
   ldb_vector_push(&edit->compact_pointers, entry);
 }
 
-void
+ldb_filemeta_t *
 ldb_edit_add_file(ldb_edit_t *edit,
                   int level,
                   uint64_t number,
@@ -296,6 +338,8 @@ ldb_edit_add_file(ldb_edit_t *edit,
                                           largest);
 
   ldb_vector_push(&edit->new_files, entry);
+
+  return &entry->meta;
 }
 
 void
@@ -336,6 +380,11 @@ ldb_edit_export(ldb_buffer_t *dst, const ldb_edit_t *edit) {
     ldb_buffer_varint64(dst, edit->last_sequence);
   }
 
+  if (edit->has_log_block_size) {
+    ldb_buffer_varint32(dst, TAG_LOG_BLOCK_SIZE);
+    ldb_buffer_varint32(dst, edit->log_block_size);
+  }
+
   for (i = 0; i < edit->compact_pointers.length; i++) {
     const ikey_entry_t *entry = edit->compact_pointers.items[i];
     const ldb_ikey_t *key = &entry->key;
@@ -357,12 +406,59 @@ ldb_edit_export(ldb_buffer_t *dst, const ldb_edit_t *edit) {
     const meta_entry_t *entry = edit->new_files.items[i];
     const ldb_filemeta_t *meta = &entry->meta;
 
-    ldb_buffer_varint32(dst, TAG_NEW_FILE);
+    /* Files without a creation time stay readable by older versions. */
+    if (meta->path_id != 0)
+      ldb_buffer_varint32(dst, TAG_NEW_FILE_PATH);
+    else if (meta->oldest_blob != 0)
+      ldb_buffer_varint32(dst, TAG_NEW_FILE_BLOB);
+    else if (meta->entries != 0)
+      ldb_buffer_varint32(dst, TAG_NEW_FILE_STATS);
+    else if (meta->global_sequence != 0)
+      ldb_buffer_varint32(dst, TAG_NEW_FILE_SEQ);
+    else if (meta->tombstones != 0)
+      ldb_buffer_varint32(dst, TAG_NEW_FILE_RANGE);
+    else if (meta->creation_time != 0)
+      ldb_buffer_varint32(dst, TAG_NEW_FILE_TIME);
+    else
+      ldb_buffer_varint32(dst, TAG_NEW_FILE);
+
     ldb_buffer_varint32(dst, entry->level);
     ldb_buffer_varint64(dst, meta->number);
     ldb_buffer_varint64(dst, meta->file_size);
     ldb_ikey_export(dst, &meta->smallest);
     ldb_ikey_export(dst, &meta->largest);
+
+    if (meta->path_id != 0) {
+      ldb_buffer_varint64(dst, meta->creation_time);
+      ldb_buffer_varint64(dst, meta->tombstones);
+      ldb_buffer_varint64(dst, meta->global_sequence);
+      ldb_buffer_varint64(dst, meta->entries);
+      ldb_buffer_varint64(dst, meta->deletions);
+      ldb_buffer_varint64(dst, meta->oldest_blob);
+      ldb_buffer_varint32(dst, meta->path_id);
+    } else if (meta->oldest_blob != 0) {
+      ldb_buffer_varint64(dst, meta->creation_time);
+      ldb_buffer_varint64(dst, meta->tombstones);
+      ldb_buffer_varint64(dst, meta->global_sequence);
+      ldb_buffer_varint64(dst, meta->entries);
+      ldb_buffer_varint64(dst, meta->deletions);
+      ldb_buffer_varint64(dst, meta->oldest_blob);
+    } else if (meta->entries != 0) {
+      ldb_buffer_varint64(dst, meta->creation_time);
+      ldb_buffer_varint64(dst, meta->tombstones);
+      ldb_buffer_varint64(dst, meta->global_sequence);
+      ldb_buffer_varint64(dst, meta->entries);
+      ldb_buffer_varint64(dst, meta->deletions);
+    } else if (meta->global_sequence != 0) {
+      ldb_buffer_varint64(dst, meta->creation_time);
+      ldb_buffer_varint64(dst, meta->tombstones);
+      ldb_buffer_varint64(dst, meta->global_sequence);
+    } else if (meta->tombstones != 0) {
+      ldb_buffer_varint64(dst, meta->creation_time);
+      ldb_buffer_varint64(dst, meta->tombstones);
+    } else if (meta->creation_time != 0) {
+      ldb_buffer_varint64(dst, meta->creation_time);
+    }
   }
 }
 
@@ -373,7 +469,7 @@ ldb_level_slurp(int *level, ldb_slice_t *input) {
   if (!ldb_varint32_slurp(&val, input))
     return 0;
 
-  if (val >= LDB_NUM_LEVELS)
+  if (val >= LDB_MAX_LEVELS)
     return 0;
 
   *level = val;
@@ -383,8 +479,10 @@ ldb_level_slurp(int *level, ldb_slice_t *input) {
 
 int
 ldb_edit_import(ldb_edit_t *edit, const ldb_slice_t *src) {
+  uint64_t number, file_size, creation_time, tombstones, global_sequence;
+  uint64_t entries, deletions, oldest_blob;
+  uint32_t path_id;
   ldb_slice_t smallest, largest;
-  uint64_t number, file_size;
   ldb_slice_t input = *src;
   ldb_slice_t key;
   uint32_t tag;
@@ -442,6 +540,15 @@ ldb_edit_import(ldb_edit_t *edit, const ldb_slice_t *src) {
         break;
       }
 
+      case TAG_LOG_BLOCK_SIZE: {
+        if (!ldb_varint32_slurp(&edit->log_block_size, &input))
+          return 0;
+
+        edit->has_log_block_size = 1;
+
+        break;
+      }
+
       case TAG_COMPACT_POINTER: {
         if (!ldb_level_slurp(&level, &input))
           return 0;
@@ -469,7 +576,15 @@ ldb_edit_import(ldb_edit_t *edit, const ldb_slice_t *src) {
         break;
       }
 
-      case TAG_NEW_FILE: {
+      case TAG_NEW_FILE:
+      case TAG_NEW_FILE_TIME:
+      case TAG_NEW_FILE_RANGE:
+      case TAG_NEW_FILE_SEQ:
+      case TAG_NEW_FILE_STATS:
+      case TAG_NEW_FILE_BLOB:
+      case TAG_NEW_FILE_PATH: {
+        ldb_filemeta_t *meta;
+
         if (!ldb_level_slurp(&level, &input))
           return 0;
 
@@ -488,7 +603,60 @@ ldb_edit_import(ldb_edit_t *edit, const ldb_slice_t *src) {
         if (smallest.size < 8 || largest.size < 8)
           return 0;
 
-        ldb_edit_add_file(edit, level, number, file_size, &smallest, &largest);
+        creation_time = 0;
+        tombstones = 0;
+        global_sequence = 0;
+        entries = 0;
+        deletions = 0;
+        oldest_blob = 0;
+        path_id = 0;
+
+        if (tag != TAG_NEW_FILE) {
+          if (!ldb_varint64_slurp(&creation_time, &input))
+            return 0;
+        }
+
+        if (tag != TAG_NEW_FILE && tag != TAG_NEW_FILE_TIME) {
+          if (!ldb_varint64_slurp(&tombstones, &input))
+            return 0;
+        }
+
+        if (tag >= TAG_NEW_FILE_SEQ) {
+          if (!ldb_varint64_slurp(&global_sequence, &input))
+            return 0;
+        }
+
+        if (tag >= TAG_NEW_FILE_STATS) {
+          if (!ldb_varint64_slurp(&entries, &input))
+            return 0;
+
+          if (!ldb_varint64_slurp(&deletions, &input))
+            return 0;
+        }
+
+        if (tag >= TAG_NEW_FILE_BLOB) {
+          if (!ldb_varint64_slurp(&oldest_blob, &input))
+            return 0;
+        }
+
+        if (tag == TAG_NEW_FILE_PATH) {
+          if (!ldb_varint32_slurp(&path_id, &input))
+            return 0;
+
+          if (path_id > INT_MAX)
+            return 0;
+        }
+
+        meta = ldb_edit_add_file(edit, level, number, file_size,
+                                 &smallest, &largest);
+
+        meta->creation_time = creation_time;
+        meta->tombstones = tombstones;
+        meta->global_sequence = global_sequence;
+        meta->entries = entries;
+        meta->deletions = deletions;
+        meta->oldest_blob = oldest_blob;
+        meta->path_id = path_id;
 
         break;
       }
@@ -534,6 +702,11 @@ ldb_edit_debug(ldb_buffer_t *z, const ldb_edit_t *edit) {
     ldb_buffer_number(z, edit->last_sequence);
   }
 
+  if (edit->has_log_block_size) {
+    ldb_buffer_string(z, "\n  LogBlockSize: ");
+    ldb_buffer_number(z, edit->log_block_size);
+  }
+
   for (i = 0; i < edit->compact_pointers.length; i++) {
     const ikey_entry_t *entry = edit->compact_pointers.items[i];
 
@@ -16,6 +16,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "util/atomic.h"
 #include "util/rbt.h"
 #include "util/types.h"
 
@@ -25,13 +26,26 @@
  * Types
  */
 
+struct ldb_tabref_s;
+
 typedef struct ldb_filemeta_s {
   int refs;
-  int allowed_seeks;   /* Seeks allowed until compaction. */
+  ldb_atomic(int) allowed_seeks; /* Seeks allowed until compaction. */
+  ldb_atomic(int) reads; /* Reads served (see compaction_warm_reads). */
+  int being_compacted; /* Input to a running compaction. */
   uint64_t number;
   uint64_t file_size;  /* File size in bytes. */
   ldb_ikey_t smallest; /* Smallest internal key served by table. */
   ldb_ikey_t largest;  /* Largest internal key served by table. */
+  uint64_t creation_time; /* Seconds since the epoch (zero if unknown). */
+  uint64_t tombstones; /* Number of range tombstones in table. */
+  ldb_seqnum_t global_sequence; /* Sequence of every key (if non-zero). */
+  uint64_t entries;    /* Number of point entries (zero if unknown). */
+  uint64_t deletions;  /* Number of deletion markers among them. */
+  uint64_t oldest_blob; /* Oldest blob file referenced (zero if none). */
+  int path_id;         /* Index into db_paths (see ldb_table_dir()). */
+  /* Table kept open by the table cache (see ldb_tables_get()). */
+  ldb_atomic_ptr(struct ldb_tabref_s) reader;
 } ldb_filemeta_t;
 
 typedef struct ldb_edit_s {
@@ -40,11 +54,13 @@ typedef struct ldb_edit_s {
   uint64_t prev_log_number;
   uint64_t next_file_number;
   ldb_seqnum_t last_sequence;
+  uint32_t log_block_size;
   int has_comparator;
   int has_log_number;
   int has_prev_log_number;
   int has_next_file_number;
   int has_last_sequence;
+  int has_log_block_size;
   ldb_vector_t compact_pointers; /* ikey_entry_t */
   rb_set_t deleted_files;        /* file_entry_t */
   ldb_vector_t new_files;        /* meta_entry_t */
@@ -121,15 +137,21 @@ ldb_edit_set_next_file(ldb_edit_t *edit, uint64_t num);
 void
 ldb_edit_set_last_sequence(ldb_edit_t *edit, ldb_seqnum_t seq);
 
+/* Record the block size the database's write-ahead logs are
+   written in (see wal_block_size). */
+void
+ldb_edit_set_log_block_size(ldb_edit_t *edit, uint32_t size);
+
 void
 ldb_edit_set_compact_pointer(ldb_edit_t *edit,
                              int level,
                              const ldb_ikey_t *key);
 
-/* Add the specified file at the specified number. */
+/* Add the specified file at the specified number. Returns the new
+   file's metadata so that the remaining fields can be filled in. */
 /* REQUIRES: This version has not been saved (see vset_save_to). */
 /* REQUIRES: "smallest" and "largest" are smallest and largest keys in file. */
-void
+ldb_filemeta_t *
 ldb_edit_add_file(ldb_edit_t *edit,
                   int level,
                   uint64_t number,
@@ -14,21 +14,28 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "table/format.h"
 #include "table/iterator.h"
 #include "table/merger.h"
 #include "table/table.h"
 #include "table/two_level_iterator.h"
 
+#include "util/array.h"
 #include "util/buffer.h"
 #include "util/coding.h"
 #include "util/comparator.h"
 #include "util/env.h"
 #include "util/internal.h"
+#include "util/mergeop.h"
 #include "util/options.h"
+#include "util/perf.h"
+#include "util/pinned.h"
 #include "util/port.h"
 #include "util/rbt.h"
 #include "util/slice.h"
+#include "util/statistics.h"
 #include "util/status.h"
 #include "util/strutil.h"
 #include "util/vector.h"
@@ -70,24 +77,33 @@ static double
 max_bytes_for_level(const ldb_dbopt_t *options, int level) {
   /* Note: the result for level zero is not really used since we set
      the level-0 compaction threshold based on number of files. */
-  double result = 10. * 1048576.0;
-
-  (void)options;
+  double result = options->max_bytes_for_level_base;
 
   /* Result for both level-0 and level-1. */
   while (level > 1) {
-    result *= 10;
+    result *= options->max_bytes_for_level_multiplier;
     level--;
   }
 
   return result;
 }
 
+/* Target size of the files written to "level". */
 static uint64_t
 max_file_size_for_level(const ldb_dbopt_t *options, int level) {
-  /* We could vary per level to reduce number of files? */
-  (void)level;
-  return target_file_size(options);
+  double result = target_file_size(options);
+
+  /* Result for both level-0 and level-1. */
+  while (level > 1) {
+    result *= options->max_file_size_multiplier;
+    level--;
+  }
+
+  /* Keep clear of overflow with absurd multipliers. */
+  if (result > (double)(UINT64_C(1) << 62))
+    return UINT64_C(1) << 62;
+
+  return (uint64_t)result;
 }
 
 static int64_t
@@ -104,13 +120,13 @@ total_file_size(const ldb_vector_t *files) {
   return sum;
 }
 
-int
-find_file(const ldb_comparator_t *icmp,
-          const ldb_vector_t *files,
-          const ldb_slice_t *key) {
-  uint32_t left = 0;
-  uint32_t right = files->length;
-
+/* As find_file(), knowing the result to lie in [left, right]. */
+static uint32_t
+find_file_in(const ldb_comparator_t *icmp,
+             const ldb_vector_t *files,
+             const ldb_slice_t *key,
+             uint32_t left,
+             uint32_t right) {
   while (left < right) {
     uint32_t mid = (left + right) / 2;
     const ldb_filemeta_t *f = files->items[mid];
@@ -129,6 +145,13 @@ find_file(const ldb_comparator_t *icmp,
   return right;
 }
 
+int
+find_file(const ldb_comparator_t *icmp,
+          const ldb_vector_t *files,
+          const ldb_slice_t *key) {
+  return find_file_in(icmp, files, key, 0, files->length);
+}
+
 static int
 after_file(const ldb_comparator_t *ucmp,
            const ldb_slice_t *user_key,
@@ -211,20 +234,50 @@ some_file_overlaps_range(const ldb_comparator_t *icmp,
   return !before_file(ucmp, largest_user_key, files->items[index]);
 }
 
+int
+ldb_level_path_id(const ldb_dbopt_t *options, int level) {
+  double remaining, size;
+  int path = 0;
+  int cur = 0;
+
+  if (options->num_db_paths <= 1)
+    return 0;
+
+  /* Level-0 is assumed to be the size of level-1. */
+  remaining = (double)options->db_paths[0].target_size;
+  size = max_bytes_for_level(options, 0);
+
+  /* The last path takes whatever is left. */
+  while (path < options->num_db_paths - 1) {
+    if (size <= remaining) {
+      if (cur == level)
+        return path;
+
+      remaining -= size;
+      size = max_bytes_for_level(options, ++cur);
+    } else {
+      remaining = (double)options->db_paths[++path].target_size;
+    }
+  }
+
+  return path;
+}
+
 /*
  * Version::LevelFileNumIterator
  */
 
 /* An internal iterator. For a given version/level pair, yields
    information about the files in the level. For a given entry, key()
-   is the largest key that occurs in the file, and value() is an
-   16-byte value containing the file number and file size, both
-   encoded using ldb_fixed64_write. */
+   is the largest key that occurs in the file, and value() is a
+   28-byte value containing the file number, file size and global
+   sequence number, encoded using ldb_fixed64_write, followed by the
+   path id, encoded using ldb_fixed32_write. */
 typedef struct ldb_numiter_s {
   ldb_comparator_t icmp;
   const ldb_vector_t *flist; /* ldb_filemeta_t */
   uint32_t index;
-  uint8_t value[16];
+  uint8_t value[28];
 } ldb_numiter_t;
 
 static void
@@ -299,6 +352,8 @@ ldb_numiter_value(const ldb_numiter_t *iter) {
 
   ldb_fixed64_write(value + 0, file->number);
   ldb_fixed64_write(value + 8, file->file_size);
+  ldb_fixed64_write(value + 16, file->global_sequence);
+  ldb_fixed32_write(value + 24, file->path_id);
 
   return ldb_slice(value, sizeof(iter->value));
 }
@@ -313,11 +368,12 @@ LDB_ITERATOR_FUNCTIONS(ldb_numiter);
 
 static ldb_iter_t *
 ldb_numiter_create(const ldb_comparator_t *icmp, const ldb_vector_t *flist) {
-  ldb_numiter_t *iter = ldb_malloc(sizeof(ldb_numiter_t));
+  ldb_numiter_t *iter = ldb_small_alloc(sizeof(ldb_numiter_t));
 
   ldb_numiter_init(iter, icmp, flist);
 
-  return ldb_iter_create(iter, &ldb_numiter_table, &iter->icmp);
+  return ldb_iter_create_small(iter, sizeof(ldb_numiter_t),
+                               &ldb_numiter_table, &iter->icmp);
 }
 
 /*
@@ -330,7 +386,7 @@ get_file_iterator(void *arg,
                   const ldb_slice_t *file_value) {
   ldb_tables_t *cache = (ldb_tables_t *)arg;
 
-  if (file_value->size != 16) {
+  if (file_value->size != 28) {
     /* "FileReader invoked with unexpected value" */
     return ldb_emptyiter_create(LDB_CORRUPTION);
   }
@@ -338,6 +394,9 @@ get_file_iterator(void *arg,
   return ldb_tables_iterate(cache, options,
                             ldb_fixed64_decode(file_value->data + 0),
                             ldb_fixed64_decode(file_value->data + 8),
+                            ldb_fixed32_decode(file_value->data + 24),
+                            -1,
+                            ldb_fixed64_decode(file_value->data + 16),
                             NULL);
 }
 
@@ -362,13 +421,31 @@ typedef struct saver_s {
     S_NOTFOUND,
     S_FOUND,
     S_DELETED,
-    S_CORRUPT
+    S_CORRUPT,
+    S_MERGE
   } state;
   const ldb_comparator_t *ucmp;
   ldb_slice_t user_key;
   ldb_buffer_t *value;
+  ldb_pinned_t *pin;     /* Takes the value without a copy (or null). */
+  ldb_mergectx_t *merge;
+  ldb_tables_t *cache;   /* For values stored in blob files. */
+  int status;            /* Result of applying merge operands. */
+  ldb_seqnum_t sequence; /* Sequence of the last merge operand. */
+  ldb_seqnum_t tomb;     /* Newest range tombstone covering the key. */
+  ldb_ikey_t next;       /* Lookup key for entries below it. */
 } saver_t;
 
+static void
+save_deletion(saver_t *s) {
+  if (ldb_mergectx_pending(s->merge)) {
+    s->state = S_FOUND;
+    s->status = ldb_mergectx_finish(s->merge, &s->user_key, NULL, s->value);
+  } else {
+    s->state = S_DELETED;
+  }
+}
+
 static void
 save_value(void *arg, const ldb_slice_t *ikey, const ldb_slice_t *v) {
   saver_t *s = (saver_t *)arg;
@@ -380,10 +457,84 @@ save_value(void *arg, const ldb_slice_t *ikey, const ldb_slice_t *v) {
   }
 
   if (ldb_compare(s->ucmp, &pkey.user_key, &s->user_key) == 0) {
-    s->state = (pkey.type == LDB_TYPE_VALUE) ? S_FOUND : S_DELETED;
+    if (pkey.type == LDB_TYPE_RANGE_DELETION) {
+      /* Reported before the file's entry for the key (if any). */
+      if (pkey.sequence > s->tomb)
+        s->tomb = pkey.sequence;
+      return;
+    }
+
+    if (pkey.sequence < s->tomb) {
+      save_deletion(s);
+      return;
+    }
+
+    switch (pkey.type) {
+      case LDB_TYPE_VALUE: {
+        s->state = S_FOUND;
+
+        if (ldb_mergectx_pending(s->merge))
+          s->status = ldb_mergectx_finish(s->merge, &s->user_key, v,
+                                                    s->value);
+        else if (s->pin != NULL)
+          ldb_pinned_set(s->pin, v);
+        else if (s->value != NULL)
+          ldb_buffer_set(s->value, v->data, v->size);
+
+        break;
+      }
+
+      case LDB_TYPE_BLOB: {
+        s->state = S_FOUND;
+
+        if (s->value == NULL) {
+          /* The value is not wanted; neither is the blob. */
+          if (ldb_mergectx_pending(s->merge))
+            s->status = ldb_mergectx_finish(s->merge, &s->user_key, NULL, NULL);
+        } else if (ldb_mergectx_pending(s->merge)) {
+          ldb_buffer_t base;
+
+          ldb_buffer_init(&base);
+
+          s->status = ldb_tables_blob(s->cache, v, &base);
+
+          if (s->status == LDB_OK)
+            s->status = ldb_mergectx_finish(s->merge, &s->user_key, &base,
+                                                      s->value);
+
+          ldb_buffer_clear(&base);
+        } else {
+          s->status = ldb_tables_blob(s->cache, v, s->value);
+        }
+
+        break;
+      }
+
+      case LDB_TYPE_DELETION: {
+        save_deletion(s);
+        break;
+      }
+
+      case LDB_TYPE_MERGE: {
+        /* Without a value to produce, an operand settles the lookup. */
+        if (s->value == NULL && s->pin == NULL && s->merge->op != NULL) {
+          ldb_mergectx_reset(s->merge);
+          s->state = S_FOUND;
+          break;
+        }
+
+        ldb_mergectx_push(s->merge, v);
+
+        s->state = S_MERGE;
+        s->sequence = pkey.sequence;
 
-    if (s->state == S_FOUND && s->value != NULL)
-      ldb_buffer_set(s->value, v->data, v->size);
+        break;
+      }
+
+      default: {
+        break;
+      }
+    }
   }
 }
 
@@ -403,11 +554,8 @@ typedef struct getstate_s {
   int found;
 } getstate_t;
 
-static int
-getstate_match(void *arg, int level, ldb_filemeta_t *f) {
-  getstate_t *state = (getstate_t *)arg;
-  ldb_tables_t *cache = state->vset->table_cache;
-
+static void
+getstate_charge(getstate_t *state, int level, ldb_filemeta_t *f) {
   if (state->stats->seek_file == NULL &&
       state->last_file_read != NULL) {
     /* We have had more than one seek for this read. Charge the 1st file. */
@@ -417,15 +565,33 @@ getstate_match(void *arg, int level, ldb_filemeta_t *f) {
 
   state->last_file_read = f;
   state->last_file_read_level = level;
+}
 
-  state->status = ldb_tables_get(cache,
-                                 state->options,
-                                 f->number,
-                                 f->file_size,
-                                 &state->ikey,
-                                 &state->saver,
-                                 save_value);
+/* Count a key found in table "f" at "level". */
+static void
+getstate_record(getstate_t *state, int level, ldb_filemeta_t *f) {
+  const ldb_dbopt_t *options = state->vset->options;
+  ldb_statistics_t *stats = options->statistics;
+
+  if (state->saver.state != S_FOUND)
+    return;
+
+  if (options->compaction_warm_reads > 0)
+    ldb_atomic_fetch_add(&f->reads, 1, ldb_order_relaxed);
+
+  if (stats == NULL)
+    return;
+
+  if (level == 0)
+    ldb_statistics_add(stats, LDB_GET_HIT_L0, 1);
+  else if (level == 1)
+    ldb_statistics_add(stats, LDB_GET_HIT_L1, 1);
+  else
+    ldb_statistics_add(stats, LDB_GET_HIT_L2_AND_UP, 1);
+}
 
+static int
+getstate_finish(getstate_t *state) {
   if (state->status != LDB_OK) {
     state->found = 1;
     return 0;
@@ -433,8 +599,16 @@ getstate_match(void *arg, int level, ldb_filemeta_t *f) {
 
   switch (state->saver.state) {
     case S_NOTFOUND:
-      return 1; /* Keep searching in other files. */
+    case S_MERGE:
+      if (state->saver.tomb == 0)
+        return 1; /* Keep searching in other files. */
+
+      /* Older files only hold entries below the range tombstone. */
+      save_deletion(&state->saver);
+
+      return getstate_finish(state);
     case S_FOUND:
+      state->status = state->saver.status;
       state->found = 1;
       return 0;
     case S_DELETED:
@@ -450,6 +624,109 @@ getstate_match(void *arg, int level, ldb_filemeta_t *f) {
   return 0;
 }
 
+/* A table lookup only yields the first entry for the key, so after a
+   merge operand the rest of "f" is searched once more from the entry
+   below it. */
+static void
+getstate_continue(getstate_t *state, int level, ldb_filemeta_t *f) {
+  ldb_tables_t *cache = state->vset->table_cache;
+  saver_t *s = &state->saver;
+
+  while (state->status == LDB_OK && s->state == S_MERGE) {
+    s->state = S_NOTFOUND;
+
+    if (s->sequence == 0)
+      break;
+
+    ldb_ikey_set(&s->next, &s->user_key, s->sequence - 1, LDB_VALTYPE_SEEK);
+
+    state->status = ldb_tables_get(cache,
+                                   state->options,
+                                   f,
+                                   level,
+                                   &s->next,
+                                   s,
+                                   save_value,
+                                   s->pin);
+  }
+}
+
+static int
+getstate_match(void *arg, int level, ldb_filemeta_t *f) {
+  getstate_t *state = (getstate_t *)arg;
+  ldb_tables_t *cache = state->vset->table_cache;
+
+  getstate_charge(state, level, f);
+
+  LDB_PERF_ADD(table_count, 1);
+
+  state->status = ldb_tables_get(cache,
+                                 state->options,
+                                 f,
+                                 level,
+                                 &state->ikey,
+                                 &state->saver,
+                                 save_value,
+                                 state->saver.pin);
+
+  getstate_continue(state, level, f);
+  getstate_record(state, level, f);
+
+  return getstate_finish(state);
+}
+
+static void
+getstate_init(getstate_t *state,
+              ldb_version_t *ver,
+              const ldb_readopt_t *options,
+              const ldb_lkey_t *k,
+              ldb_buffer_t *value,
+              ldb_pinned_t *pin,
+              ldb_getstats_t *stats,
+              ldb_mergectx_t *merge) {
+  stats->seek_file = NULL;
+  stats->seek_file_level = -1;
+
+  state->status = LDB_OK;
+  state->found = 0;
+  state->stats = stats;
+  state->last_file_read = NULL;
+  state->last_file_read_level = -1;
+
+  state->options = options;
+  state->ikey = ldb_lkey_internal_key(k);
+  state->vset = ver->vset;
+
+  state->saver.state = S_NOTFOUND;
+  state->saver.ucmp = ver->vset->icmp.user_comparator;
+  state->saver.user_key = ldb_lkey_user_key(k);
+  state->saver.value = value;
+  state->saver.pin = pin;
+  state->saver.merge = merge;
+  state->saver.cache = ver->vset->table_cache;
+  state->saver.status = LDB_OK;
+  state->saver.sequence = 0;
+  state->saver.tomb = 0;
+
+  ldb_ikey_init(&state->saver.next);
+}
+
+static void
+getstate_clear(getstate_t *state) {
+  ldb_ikey_clear(&state->saver.next);
+}
+
+/* Apply merge operands left over once all files were searched. */
+static int
+getstate_result(getstate_t *state) {
+  saver_t *s = &state->saver;
+
+  if (!state->found && ldb_mergectx_pending(s->merge))
+    return ldb_mergectx_finish(s->merge, &s->user_key, NULL, s->value);
+
+  return state->found ? state->status : LDB_NOTFOUND;
+}
+
 /*
  * SampleState (for Version::RecordReadSample)
  */
@@ -476,1639 +753,3817 @@ samplestate_match(void *arg, int level, ldb_filemeta_t *f) {
 }
 
 /*
- * Version
+ * Level0Index
  */
 
-static void
-ldb_version_init(ldb_version_t *ver, ldb_versions_t *vset) {
-  int level;
+/* The distinct user keys bounding the level-0 files split the key
+   space into slots: slot 2*i holds bounds[i] itself and slot 2*i+1
+   the keys between bounds[i] and bounds[i+1]. Each slot lists the
+   files overlapping it, newest first, so that a point lookup takes
+   a binary search rather than a scan and sort of the whole level. */
+typedef struct ldb_l0index_s {
+  ldb_slice_t *bounds;
+  size_t length;
+  size_t *offsets; /* Files of slot i are files[offsets[i], offsets[i+1]). */
+  ldb_filemeta_t **files;
+} ldb_l0index_t;
+
+/* Maximum number of entries in an index. Level-0 is normally small;
+   a large and heavily overlapping one is searched without an index. */
+#define LDB_L0_INDEX_MAX (1 << 16)
 
-  ver->vset = vset;
-  ver->next = ver;
-  ver->prev = ver;
-  ver->refs = 0;
-  ver->file_to_compact = NULL;
-  ver->file_to_compact_level = -1;
-  ver->compaction_score = -1;
-  ver->compaction_level = -1;
+static int
+newest_first(void *x, void *y) {
+  const ldb_filemeta_t *a = x;
+  const ldb_filemeta_t *b = y;
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++)
-    ldb_vector_init(&ver->files[level]);
+  return LDB_CMP(b->number, a->number);
 }
 
 static void
-ldb_version_clear(ldb_version_t *ver) {
-  size_t i;
-  int level;
+sort_keys(const ldb_comparator_t *ucmp,
+          ldb_slice_t *keys,
+          ldb_slice_t *tmp,
+          size_t length) {
+  size_t mid = length / 2;
+  size_t i = 0;
+  size_t j = mid;
+  size_t k = 0;
+
+  if (length < 2)
+    return;
 
-  assert(ver->refs == 0);
+  sort_keys(ucmp, keys, tmp, mid);
+  sort_keys(ucmp, keys + mid, tmp, length - mid);
 
-  /* Remove from linked list. */
-  ver->prev->next = ver->next;
-  ver->next->prev = ver->prev;
+  while (i < mid && j < length) {
+    if (ldb_compare(ucmp, &keys[j], &keys[i]) < 0)
+      tmp[k++] = keys[j++];
+    else
+      tmp[k++] = keys[i++];
+  }
 
-  /* Drop references to files. */
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    for (i = 0; i < ver->files[level].length; i++) {
-      ldb_filemeta_t *f = ver->files[level].items[i];
-      ldb_filemeta_unref(f);
-    }
+  while (i < mid)
+    tmp[k++] = keys[i++];
 
-    ldb_vector_clear(&ver->files[level]);
-  }
+  /* The rest of the right half is in place. */
+  memcpy(keys, tmp, k * sizeof(ldb_slice_t));
 }
 
-ldb_version_t *
-ldb_version_create(ldb_versions_t *vset) {
-  ldb_version_t *ver = ldb_malloc(sizeof(ldb_version_t));
-  ldb_version_init(ver, vset);
-  return ver;
+/* Index of the first bound at or after "key". */
+static size_t
+l0index_search(const ldb_l0index_t *idx,
+               const ldb_comparator_t *ucmp,
+               const ldb_slice_t *key) {
+  size_t lo = 0;
+  size_t hi = idx->length;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (ldb_compare(ucmp, &idx->bounds[mid], key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
 }
 
-void
-ldb_version_destroy(ldb_version_t *ver) {
-  ldb_version_clear(ver);
-  ldb_free(ver);
+static void
+l0index_destroy(ldb_l0index_t *idx) {
+  ldb_free(idx->bounds);
+  ldb_free(idx->offsets);
+  ldb_free(idx->files);
+  ldb_free(idx);
 }
 
-void
-ldb_version_add_iterators(ldb_version_t *ver,
-                          const ldb_readopt_t *options,
-                          ldb_vector_t *iters) {
-  ldb_tables_t *table_cache = ver->vset->table_cache;
-  int level;
-  size_t i;
+static ldb_l0index_t *
+l0index_create(const ldb_comparator_t *ucmp, const ldb_vector_t *level0) {
+  size_t i, s, m, slots, total;
+  ldb_slice_t *keys, *tmp;
+  size_t *spans, *cursor;
+  ldb_l0index_t *idx;
+  ldb_vector_t files;
 
-  /* Merge all level zero files together since they may overlap. */
-  for (i = 0; i < ver->files[0].length; i++) {
-    ldb_filemeta_t *item = ver->files[0].items[i];
-    ldb_iter_t *iter = ldb_tables_iterate(table_cache,
-                                          options,
-                                          item->number,
-                                          item->file_size,
-                                          NULL);
+  if (level0->length == 0)
+    return NULL;
 
-    ldb_vector_push(iters, iter);
+  keys = ldb_malloc(2 * level0->length * sizeof(ldb_slice_t));
+  tmp = ldb_malloc(2 * level0->length * sizeof(ldb_slice_t));
+
+  for (i = 0; i < level0->length; i++) {
+    const ldb_filemeta_t *f = level0->items[i];
+
+    keys[2 * i + 0] = ldb_ikey_user_key(&f->smallest);
+    keys[2 * i + 1] = ldb_ikey_user_key(&f->largest);
   }
 
-  /* For levels > 0, we can use a concatenating iterator that sequentially
-     walks through the non-overlapping files in the level, opening them
-     lazily. */
-  for (level = 1; level < LDB_NUM_LEVELS; level++) {
-    if (ver->files[level].length > 0) {
-      ldb_iter_t *iter = ldb_concatiter_create(ver, options, level);
+  sort_keys(ucmp, keys, tmp, 2 * level0->length);
 
-      ldb_vector_push(iters, iter);
-    }
+  ldb_free(tmp);
+
+  for (i = 1, m = 1; i < 2 * level0->length; i++) {
+    if (ldb_compare(ucmp, &keys[i], &keys[m - 1]) != 0)
+      keys[m++] = keys[i];
   }
-}
 
-static int
-newest_first(void *x, void *y) {
-  const ldb_filemeta_t *a = x;
-  const ldb_filemeta_t *b = y;
+  idx = ldb_malloc(sizeof(ldb_l0index_t));
+  idx->bounds = keys;
+  idx->length = m;
+  idx->offsets = NULL;
+  idx->files = NULL;
 
-  return LDB_CMP(b->number, a->number);
-}
+  ldb_vector_init(&files);
+  ldb_vector_copy(&files, level0);
+  ldb_vector_sort(&files, newest_first);
 
-static void
-ldb_version_for_each_overlapping(ldb_version_t *ver,
-                                 const ldb_slice_t *user_key,
-                                 const ldb_slice_t *internal_key,
-                                 void *arg,
-                                 int (*func)(void *, int, ldb_filemeta_t *)) {
-  const ldb_comparator_t *ucmp = ver->vset->icmp.user_comparator;
-  ldb_vector_t tmp;
-  uint32_t i;
-  int level;
+  /* The slots spanned by each file. */
+  spans = ldb_malloc(2 * files.length * sizeof(size_t));
+  total = 0;
 
-  /* Search level-0 in order from newest to oldest. */
-  ldb_vector_init(&tmp);
-  ldb_vector_grow(&tmp, ver->files[0].length);
+  for (i = 0; i < files.length; i++) {
+    const ldb_filemeta_t *f = files.items[i];
+    ldb_slice_t smallest = ldb_ikey_user_key(&f->smallest);
+    ldb_slice_t largest = ldb_ikey_user_key(&f->largest);
 
-  for (i = 0; i < ver->files[0].length; i++) {
-    ldb_filemeta_t *f = ver->files[0].items[i];
-    ldb_slice_t small_key = ldb_ikey_user_key(&f->smallest);
-    ldb_slice_t large_key = ldb_ikey_user_key(&f->largest);
+    spans[2 * i + 0] = 2 * l0index_search(idx, ucmp, &smallest);
+    spans[2 * i + 1] = 2 * l0index_search(idx, ucmp, &largest);
 
-    if (ldb_compare(ucmp, user_key, &small_key) >= 0 &&
-        ldb_compare(ucmp, user_key, &large_key) <= 0) {
-      ldb_vector_push(&tmp, f);
-    }
+    total += spans[2 * i + 1] - spans[2 * i + 0] + 1;
   }
 
-  if (tmp.length > 0) {
-    ldb_vector_sort(&tmp, newest_first);
-
-    for (i = 0; i < tmp.length; i++) {
-      if (!func(arg, 0, tmp.items[i])) {
-        ldb_vector_clear(&tmp);
-        return;
-      }
-    }
+  if (total > LDB_L0_INDEX_MAX) {
+    ldb_vector_clear(&files);
+    ldb_free(spans);
+    l0index_destroy(idx);
+    return NULL;
   }
 
-  ldb_vector_clear(&tmp);
+  slots = 2 * m - 1;
 
-  /* Search other levels. */
-  for (level = 1; level < LDB_NUM_LEVELS; level++) {
-    size_t num_files = ver->files[level].length;
-    uint32_t index;
+  idx->offsets = ldb_malloc((slots + 1) * sizeof(size_t));
+  idx->files = ldb_malloc(total * sizeof(ldb_filemeta_t *));
 
-    if (num_files == 0)
-      continue;
+  memset(idx->offsets, 0, (slots + 1) * sizeof(size_t));
 
-    /* Binary search to find earliest index whose largest key >= internal_key */
-    index = find_file(&ver->vset->icmp, &ver->files[level], internal_key);
+  for (i = 0; i < files.length; i++) {
+    for (s = spans[2 * i + 0]; s <= spans[2 * i + 1]; s++)
+      idx->offsets[s + 1]++;
+  }
 
-    if (index < num_files) {
-      ldb_filemeta_t *f = ver->files[level].items[index];
-      ldb_slice_t small_key = ldb_ikey_user_key(&f->smallest);
+  for (s = 0; s < slots; s++)
+    idx->offsets[s + 1] += idx->offsets[s];
 
-      if (ldb_compare(ucmp, user_key, &small_key) < 0) {
-        /* All of "f" is past any data for user_key. */
-      } else {
-        if (!func(arg, level, f))
-          return;
-      }
-    }
+  /* The files are taken newest first, and so are the slots filled. */
+  cursor = ldb_malloc(slots * sizeof(size_t));
+
+  memcpy(cursor, idx->offsets, slots * sizeof(size_t));
+
+  for (i = 0; i < files.length; i++) {
+    for (s = spans[2 * i + 0]; s <= spans[2 * i + 1]; s++)
+      idx->files[cursor[s]++] = files.items[i];
   }
+
+  ldb_vector_clear(&files);
+  ldb_free(cursor);
+  ldb_free(spans);
+
+  return idx;
 }
 
-int
-ldb_version_get(ldb_version_t *ver,
-                const ldb_readopt_t *options,
-                const ldb_lkey_t *k,
-                ldb_buffer_t *value,
-                ldb_getstats_t *stats) {
-  getstate_t state;
-
-  stats->seek_file = NULL;
-  stats->seek_file_level = -1;
+/* The level-0 files which may hold "user_key", newest first. */
+static ldb_filemeta_t **
+l0index_find(const ldb_l0index_t *idx,
+             const ldb_comparator_t *ucmp,
+             const ldb_slice_t *user_key,
+             size_t *count) {
+  size_t b = l0index_search(idx, ucmp, user_key);
+  size_t slot;
 
-  state.status = LDB_OK;
-  state.found = 0;
-  state.stats = stats;
-  state.last_file_read = NULL;
-  state.last_file_read_level = -1;
+  *count = 0;
 
-  state.options = options;
-  state.ikey = ldb_lkey_internal_key(k);
-  state.vset = ver->vset;
+  if (b == idx->length)
+    return NULL;
 
-  state.saver.state = S_NOTFOUND;
-  state.saver.ucmp = ver->vset->icmp.user_comparator;
-  state.saver.user_key = ldb_lkey_user_key(k);
-  state.saver.value = value;
+  if (ldb_compare(ucmp, &idx->bounds[b], user_key) == 0)
+    slot = 2 * b;
+  else if (b > 0)
+    slot = 2 * b - 1;
+  else
+    return NULL;
 
-  ldb_version_for_each_overlapping(ver,
-                                   &state.saver.user_key,
-                                   &state.ikey,
-                                   &state,
-                                   &getstate_match);
+  *count = idx->offsets[slot + 1] - idx->offsets[slot];
 
-  return state.found ? state.status : LDB_NOTFOUND;
+  return idx->files + idx->offsets[slot];
 }
 
-int
-ldb_version_update_stats(ldb_version_t *ver, const ldb_getstats_t *stats) {
-  ldb_filemeta_t *f = stats->seek_file;
-
-  if (f != NULL) {
-    f->allowed_seeks--;
+/*
+ * Cascade
+ */
 
-    if (f->allowed_seeks <= 0 && ver->file_to_compact == NULL) {
-      ver->file_to_compact = f;
-      ver->file_to_compact_level = stats->seek_file_level;
-      return 1;
-    }
-  }
+/* For each file of "files", the index of the first file of "next"
+   whose largest key is at or after its own (next->length if none).
+   A lookup finding file i of "files" need then only search "next"
+   between the entries for files i-1 and i. Shared by versions in
+   which neither level has changed. */
+typedef struct ldb_cascade_s {
+  int refs;
+  uint32_t *index;
+} ldb_cascade_t;
+
+static ldb_cascade_t *
+cascade_create(const ldb_comparator_t *icmp,
+               const ldb_vector_t *files,
+               const ldb_vector_t *next) {
+  size_t size = sizeof(ldb_cascade_t) + files->length * sizeof(uint32_t);
+  ldb_cascade_t *cascade = ldb_malloc(size);
+  uint32_t j = 0;
+  size_t i;
 
-  return 0;
-}
+  cascade->refs = 1;
+  cascade->index = (uint32_t *)(cascade + 1);
 
-int
-ldb_version_record_read_sample(ldb_version_t *ver, const ldb_slice_t *ikey) {
-  samplestate_t state;
-  ldb_pkey_t pkey;
+  for (i = 0; i < files->length; i++) {
+    const ldb_filemeta_t *f = files->items[i];
 
-  if (!ldb_pkey_import(&pkey, ikey))
-    return 0;
+    while (j < next->length) {
+      const ldb_filemeta_t *g = next->items[j];
 
-  state.stats.seek_file = NULL;
-  state.stats.seek_file_level = 0;
-  state.matches = 0;
+      if (ldb_compare(icmp, &g->largest, &f->largest) >= 0)
+        break;
 
-  ldb_version_for_each_overlapping(ver,
-                                   &pkey.user_key,
-                                   ikey,
-                                   &state,
-                                   &samplestate_match);
+      j++;
+    }
 
-  /* Must have at least two matches since we want to merge across
-     files. But what if we have a single file that contains many
-     overwrites and deletions? Should we have another mechanism for
-     finding such files? */
-  if (state.matches >= 2) {
-    /* 1MB cost is about 1 seek (see comment in builder_apply). */
-    return ldb_version_update_stats(ver, &state.stats);
+    cascade->index[i] = j;
   }
 
-  return 0;
+  return cascade;
 }
 
-void
-ldb_version_ref(ldb_version_t *ver) {
-  ++ver->refs;
+static void
+cascade_unref(ldb_cascade_t *cascade) {
+  if (--cascade->refs == 0)
+    ldb_free(cascade);
 }
 
-void
-ldb_version_unref(ldb_version_t *ver) {
-  assert(ver != &ver->vset->dummy_versions);
-  assert(ver->refs >= 1);
+static int
+cascade_next(const ldb_version_t *ver, int level) {
+  int next;
 
-  --ver->refs;
+  for (next = level + 1; next < LDB_MAX_LEVELS; next++) {
+    if (ver->files[next].length > 0)
+      break;
+  }
 
-  if (ver->refs == 0)
-    ldb_version_destroy(ver);
+  return next;
 }
 
-int
-ldb_version_overlap_in_level(ldb_version_t *ver,
-                             int level,
-                             const ldb_slice_t *smallest_user_key,
-                             const ldb_slice_t *largest_user_key) {
-  return some_file_overlaps_range(&ver->vset->icmp,
-                                  (level > 0),
-                                  &ver->files[level],
-                                  smallest_user_key,
-                                  largest_user_key);
+static int
+cascade_same(const ldb_version_t *x, const ldb_version_t *y, int level) {
+  return x->files[level].items == y->files[level].items
+      && x->files[level].length == y->files[level].length;
 }
 
-int
-ldb_version_pick_level_for_memtable_output(ldb_version_t *ver,
-                                           const ldb_slice_t *small_key,
-                                           const ldb_slice_t *large_key) {
-  int level = 0;
-  int64_t sum;
+/* Build the hints of "ver", taking them from "base" for each level
+   which shares its files (and those of the next level) with it. */
+static void
+cascade_build(ldb_version_t *ver, ldb_version_t *base) {
+  int level, next;
 
-  if (!ldb_version_overlap_in_level(ver, 0, small_key, large_key)) {
-    /* Push to next level if there is no overlap in next level,
-       and the #bytes overlapping in the level after that are limited. */
-    ldb_vector_t overlaps; /* ldb_filemeta_t */
-    ldb_ikey_t start, limit;
+  if (base == ver)
+    base = NULL;
 
-    ldb_vector_init(&overlaps);
-    ldb_ikey_init(&start);
-    ldb_ikey_init(&limit);
+  for (level = 1; level < LDB_MAX_LEVELS - 1; level++) {
+    if (ver->cascade[level] != NULL || ver->files[level].length == 0)
+      continue;
 
-    ldb_ikey_set(&start, small_key, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
-    ldb_ikey_set(&limit, large_key, 0, (ldb_valtype_t)0);
+    next = cascade_next(ver, level);
 
-    while (level < LDB_MAX_MEM_COMPACT_LEVEL) {
-      if (ldb_version_overlap_in_level(ver, level + 1, small_key, large_key))
-        break;
+    if (next == LDB_MAX_LEVELS)
+      break;
 
-      if (level + 2 < LDB_NUM_LEVELS) {
-        /* Check that file does not overlap too many grandparent bytes. */
-        ldb_version_get_overlapping_inputs(ver, level + 2,
-                                           &start, &limit,
-                                           &overlaps);
+    if (base != NULL && base->cascade[level] != NULL
+                     && cascade_same(ver, base, level)
+                     && cascade_same(ver, base, next)
+                     && cascade_next(base, level) == next) {
+      ver->cascade[level] = base->cascade[level];
+      ver->cascade[level]->refs++;
+      continue;
+    }
 
-        sum = total_file_size(&overlaps);
+    ver->cascade[level] = cascade_create(&ver->vset->icmp,
+                                         &ver->files[level],
+                                         &ver->files[next]);
+  }
+}
 
-        if (sum > max_grandparent_overlap_bytes(ver->vset->options))
-          break;
-      }
+/*
+ * Version
+ */
 
-      level++;
-    }
+static void
+ldb_version_init(ldb_version_t *ver, ldb_versions_t *vset) {
+  int level;
 
-    ldb_vector_clear(&overlaps);
-    ldb_ikey_clear(&start);
-    ldb_ikey_clear(&limit);
-  }
+  ver->vset = vset;
+  ver->next = ver;
+  ver->prev = ver;
+  ver->refs = 0;
+  ver->file_to_compact = NULL;
+  ver->file_to_compact_level = -1;
+  ver->file_to_purge = NULL;
+  ver->file_to_purge_level = -1;
+  ver->compaction_score = -1;
+  ver->compaction_level = -1;
+  ver->base_level = 1;
+  ver->l0_index = NULL;
 
-  return level;
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    ldb_vector_init(&ver->files[level]);
+    ver->level_refs[level] = NULL;
+    ver->cascade[level] = NULL;
+    ver->level_max_bytes[level] = max_bytes_for_level(vset->options, level);
+  }
 }
 
-/* Store in "*inputs" all files in "level" that overlap [begin,end]. */
-void
-ldb_version_get_overlapping_inputs(ldb_version_t *ver,
-                                   int level,
-                                   const ldb_ikey_t *begin,
-                                   const ldb_ikey_t *end,
-                                   ldb_vector_t *inputs) {
-  const ldb_comparator_t *uc = ver->vset->icmp.user_comparator;
-  ldb_slice_t user_begin, user_end;
+static void
+ldb_version_clear(ldb_version_t *ver) {
   size_t i;
+  int level;
 
-  assert(level >= 0);
-  assert(level < LDB_NUM_LEVELS);
-
-  ldb_slice_init(&user_begin);
-  ldb_slice_init(&user_end);
+  assert(ver->refs == 0);
 
-  ldb_vector_reset(inputs);
+  /* Remove from linked list. */
+  ver->prev->next = ver->next;
+  ver->next->prev = ver->prev;
 
-  if (begin != NULL)
-    user_begin = ldb_ikey_user_key(begin);
+  if (ver->l0_index != NULL)
+    l0index_destroy(ver->l0_index);
 
-  if (end != NULL)
-    user_end = ldb_ikey_user_key(end);
+  /* Drop references to files. */
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    int *refs = ver->level_refs[level];
 
-  for (i = 0; i < ver->files[level].length;) {
-    ldb_filemeta_t *f = ver->files[level].items[i++];
-    ldb_slice_t file_start = ldb_ikey_user_key(&f->smallest);
-    ldb_slice_t file_limit = ldb_ikey_user_key(&f->largest);
+    if (ver->cascade[level] != NULL)
+      cascade_unref(ver->cascade[level]);
 
-    if (begin != NULL && ldb_compare(uc, &file_limit, &user_begin) < 0) {
-      /* "f" is completely before specified range; skip it. */
-    } else if (end != NULL && ldb_compare(uc, &file_start, &user_end) > 0) {
-      /* "f" is completely after specified range; skip it. */
-    } else {
-      ldb_vector_push(inputs, f);
+    /* A shared level is owned by the last version to drop it. */
+    if (refs != NULL) {
+      if (--*refs > 0)
+        continue;
 
-      if (level == 0) {
-        /* Level-0 files may overlap each other. So check if the newly
-           added file has expanded the range. If so, restart search. */
-        if (begin != NULL && ldb_compare(uc, &file_start, &user_begin) < 0) {
-          user_begin = file_start;
-          ldb_vector_reset(inputs);
-          i = 0;
-        } else if (end != NULL && ldb_compare(uc, &file_limit, &user_end) > 0) {
-          user_end = file_limit;
-          ldb_vector_reset(inputs);
-          i = 0;
-        }
-      }
+      ldb_free(refs);
     }
-  }
-}
-
-void
-ldb_version_debug(ldb_buffer_t *z, const ldb_version_t *x) {
-  int level;
-
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    const ldb_vector_t *files = &x->files[level];
-    size_t i;
 
-    /* E.g.,
-     *   --- level 1 ---
-     *   17:123['a' .. 'd']
-     *   20:43['e' .. 'g']
-     */
-    ldb_buffer_string(z, "--- level ");
-    ldb_buffer_number(z, level);
-    ldb_buffer_string(z, " ---\n");
+    for (i = 0; i < ver->files[level].length; i++) {
+      ldb_filemeta_t *f = ver->files[level].items[i];
 
-    for (i = 0; i < files->length; i++) {
-      const ldb_filemeta_t *file = files->items[i];
+      if (f->refs == 1)
+        ldb_tables_release(ver->vset->table_cache, f);
 
-      ldb_buffer_push(z, ' ');
-      ldb_buffer_number(z, file->number);
-      ldb_buffer_push(z, ':');
-      ldb_buffer_number(z, file->file_size);
-      ldb_buffer_push(z, '[');
-      ldb_ikey_debug(z, &file->smallest);
-      ldb_buffer_string(z, " .. ");
-      ldb_ikey_debug(z, &file->largest);
-      ldb_buffer_string(z, "]\n");
+      ldb_filemeta_unref(f);
     }
+
+    ldb_vector_clear(&ver->files[level]);
   }
 }
 
-/*
- * VersionSet::Builder
- */
-
-/* A helper class so we can efficiently apply a whole sequence
-   of edits to a particular state without creating intermediate
-   versions that contain full copies of the intermediate state. */
-typedef struct level_state_s {
-  rb_set64_t deleted_files;
-  rb_set_t added_files; /* ldb_filemeta_t * */
-} level_state_t;
+ldb_version_t *
+ldb_version_create(ldb_versions_t *vset) {
+  ldb_version_t *ver = ldb_malloc(sizeof(ldb_version_t));
+  ldb_version_init(ver, vset);
+  return ver;
+}
 
-typedef struct builder_s {
-  ldb_versions_t *vset;
-  ldb_version_t *base;
-  level_state_t levels[LDB_NUM_LEVELS];
-} builder_t;
+void
+ldb_version_destroy(ldb_version_t *ver) {
+  ldb_version_clear(ver);
+  ldb_free(ver);
+}
 
+/* Whether a file may hold user keys in [lower, upper). */
 static int
-by_smallest_key(const ldb_comparator_t *cmp,
-                const ldb_filemeta_t *f1,
-                const ldb_filemeta_t *f2) {
-  int r = ldb_compare(cmp, &f1->smallest, &f2->smallest);
+file_in_bounds(const ldb_comparator_t *ucmp,
+               const ldb_filemeta_t *f,
+               const ldb_slice_t *lower,
+               const ldb_slice_t *upper) {
+  if (after_file(ucmp, lower, f))
+    return 0;
 
-  if (r != 0)
-    return r;
+  if (upper != NULL) {
+    ldb_slice_t smallest = ldb_ikey_user_key(&f->smallest);
 
-  /* Break ties by file number. */
-  return LDB_CMP(f1->number, f2->number);
+    if (ldb_compare(ucmp, upper, &smallest) <= 0)
+      return 0;
+  }
+
+  return 1;
 }
 
-static int
-file_set_compare(rb_val_t x, rb_val_t y, void *arg) {
-  return by_smallest_key(arg, x.ptr, y.ptr);
-}
-
-static void
-file_set_destruct(rb_node_t *node) {
-  ldb_filemeta_unref(node->key.ptr);
+void
+ldb_version_add_iterators(ldb_version_t *ver,
+                          const ldb_readopt_t *options,
+                          ldb_vector_t *iters) {
+  ldb_version_readd_iterators(ver, options, iters, NULL, NULL);
 }
 
-/* Initialize a builder with the files from *base and other info from *vset. */
-static void
-builder_init(builder_t *b, ldb_versions_t *vset, ldb_version_t *base) {
+void
+ldb_version_readd_iterators(ldb_version_t *ver,
+                            const ldb_readopt_t *options,
+                            ldb_vector_t *iters,
+                            ldb_array_t *numbers,
+                            ldb_vector_t *tables) {
+  const ldb_comparator_t *ucmp = ver->vset->icmp.user_comparator;
+  const ldb_slice_t *lower = options->iterate_lower_bound;
+  const ldb_slice_t *upper = options->iterate_upper_bound;
+  ldb_tables_t *table_cache = ver->vset->table_cache;
+  ldb_array_t new_numbers;
+  ldb_vector_t new_tables;
   int level;
+  size_t i, j;
 
-  b->vset = vset;
-  b->base = base;
+  ldb_array_init(&new_numbers);
+  ldb_vector_init(&new_tables);
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    level_state_t *state = &b->levels[level];
+  /* Merge all level zero files together since they may overlap. */
+  for (i = 0; i < ver->files[0].length; i++) {
+    ldb_filemeta_t *item = ver->files[0].items[i];
+    ldb_iter_t *iter = NULL;
 
-    rb_set64_init(&state->deleted_files);
-    rb_set_init(&state->added_files, file_set_compare, &b->vset->icmp);
-  }
+    /* Files outside the iterator's bounds are never visited. */
+    if (!file_in_bounds(ucmp, item, lower, upper))
+      continue;
 
-  ldb_version_ref(b->base);
-}
+    if (numbers != NULL) {
+      for (j = 0; j < numbers->length; j++) {
+        if (numbers->items[j] == item->number) {
+          iter = tables->items[j];
+          break;
+        }
+      }
+    }
 
-static void
-builder_clear(builder_t *b) {
-  int level;
+    if (iter == NULL) {
+      iter = ldb_tables_iterate(table_cache,
+                                            options,
+                                            item->number,
+                                            item->file_size,
+                                            item->path_id,
+                                            0,
+                                            item->global_sequence,
+                                            NULL);
+    }
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    level_state_t *state = &b->levels[level];
+    ldb_vector_push(iters, iter);
 
-    rb_set64_clear(&state->deleted_files);
-    rb_set_clear(&state->added_files, file_set_destruct);
+    if (numbers != NULL) {
+      ldb_array_push(&new_numbers, item->number);
+      ldb_vector_push(&new_tables, iter);
+    }
   }
 
-  ldb_version_unref(b->base);
-}
-
-/* Apply all of the edits in *edit to the current state. */
-static void
-builder_apply(builder_t *b, const ldb_edit_t *edit) {
-  ldb_versions_t *v = b->vset;
-  rb_iter_t it;
-  size_t i;
+  if (numbers != NULL) {
+    ldb_array_swap(numbers, &new_numbers);
+    ldb_vector_swap(tables, &new_tables);
+  }
 
-  /* Update compaction pointers. */
-  for (i = 0; i < edit->compact_pointers.length; i++) {
-    const ikey_entry_t *entry = edit->compact_pointers.items[i];
+  ldb_array_clear(&new_numbers);
+  ldb_vector_clear(&new_tables);
 
-    ldb_buffer_copy(&v->compact_pointer[entry->level], &entry->key);
-  }
+  /* For levels > 0, we can use a concatenating iterator that sequentially
+     walks through the non-overlapping files in the level, opening them
+     lazily. */
+  for (level = 1; level < LDB_MAX_LEVELS; level++) {
+    if (ver->files[level].length == 0)
+      continue;
 
-  /* Delete files. */
-  rb_set_each(&edit->deleted_files, it) {
-    const file_entry_t *entry = rb_key_ptr(it);
-    level_state_t *state = &b->levels[entry->level];
+    /* The concatenating iterator only opens the files it reaches,
+       so a level just needs skipping if nothing in it is in range
+       (the upper bound is treated as inclusive here). */
+    if ((lower != NULL || upper != NULL) &&
+        !ldb_version_overlap_in_level(ver, level, lower, upper)) {
+      continue;
+    }
 
-    rb_set64_put(&state->deleted_files, entry->number);
+    ldb_vector_push(iters, ldb_concatiter_create(ver, options, level));
   }
+}
 
-  /* Add new files. */
-  for (i = 0; i < edit->new_files.length; i++) {
-    const meta_entry_t *entry = edit->new_files.items[i];
-    level_state_t *state = &b->levels[entry->level];
-    ldb_filemeta_t *f = ldb_filemeta_clone(&entry->meta);
+/* Calls func for each level-0 file which may hold "user_key", newest
+   first. Returns zero if func asked to stop. */
+static int
+ldb_version_for_each_level0(ldb_version_t *ver,
+                            const ldb_slice_t *user_key,
+                            void *arg,
+                            int (*func)(void *, int, ldb_filemeta_t *)) {
+  const ldb_comparator_t *ucmp = ver->vset->icmp.user_comparator;
+  ldb_vector_t tmp;
+  size_t i;
 
-    f->refs = 1;
+  if (ver->l0_index != NULL) {
+    ldb_filemeta_t **files;
+    size_t count;
 
-    /* We arrange to automatically compact this file after
-     * a certain number of seeks. Let's assume:
-     *
-     *   (1) One seek costs 10ms
-     *   (2) Writing or reading 1MB costs 10ms (100MB/s)
-     *   (3) A compaction of 1MB does 25MB of IO:
-     *         1MB read from this level
-     *         10-12MB read from next level (boundaries may be misaligned)
-     *         10-12MB written to next level
-     *
-     * This implies that 25 seeks cost the same as the compaction
-     * of 1MB of data. I.e., one seek costs approximately the
-     * same as the compaction of 40KB of data. We are a little
-     * conservative and allow approximately one seek for every 16KB
-     * of data before triggering a compaction.
-     */
-    f->allowed_seeks = (int)(f->file_size / 16384U);
+    files = l0index_find(ver->l0_index, ucmp, user_key, &count);
 
-    if (f->allowed_seeks < 100)
-      f->allowed_seeks = 100;
+    for (i = 0; i < count; i++) {
+      if (!func(arg, 0, files[i]))
+        return 0;
+    }
 
-    rb_set64_del(&state->deleted_files, f->number);
-    rb_set_put(&state->added_files, f);
+    return 1;
   }
-}
-
-static void
-builder_maybe_add_file(builder_t *b,
-                       ldb_version_t *v,
-                       int level,
-                       ldb_filemeta_t *f) {
-  level_state_t *state = &b->levels[level];
 
-  if (rb_set64_has(&state->deleted_files, f->number)) {
-    /* File is deleted: do nothing. */
-  } else {
-    ldb_vector_t *files = &v->files[level];
+  ldb_vector_init(&tmp);
+  ldb_vector_grow(&tmp, ver->files[0].length);
 
-#ifndef NDEBUG
-    if (level > 0 && files->length > 0) {
-      ldb_filemeta_t *item = files->items[files->length - 1];
+  for (i = 0; i < ver->files[0].length; i++) {
+    ldb_filemeta_t *f = ver->files[0].items[i];
+    ldb_slice_t small_key = ldb_ikey_user_key(&f->smallest);
+    ldb_slice_t large_key = ldb_ikey_user_key(&f->largest);
 
-      /* Must not overlap. */
-      assert(ldb_compare(&b->vset->icmp, &item->largest, &f->smallest) < 0);
+    if (ldb_compare(ucmp, user_key, &small_key) >= 0 &&
+        ldb_compare(ucmp, user_key, &large_key) <= 0) {
+      ldb_vector_push(&tmp, f);
     }
-#endif
+  }
 
-    ldb_filemeta_ref(f);
-    ldb_vector_push(files, f);
+  if (tmp.length > 0) {
+    ldb_vector_sort(&tmp, newest_first);
+
+    for (i = 0; i < tmp.length; i++) {
+      if (!func(arg, 0, tmp.items[i])) {
+        ldb_vector_clear(&tmp);
+        return 0;
+      }
+    }
   }
+
+  ldb_vector_clear(&tmp);
+
+  return 1;
 }
 
-/* Save the current state in *v. */
 static void
-builder_save_to(builder_t *b, ldb_version_t *v) {
+ldb_version_for_each_overlapping(ldb_version_t *ver,
+                                 const ldb_slice_t *user_key,
+                                 const ldb_slice_t *internal_key,
+                                 void *arg,
+                                 int (*func)(void *, int, ldb_filemeta_t *)) {
+  const ldb_comparator_t *ucmp = ver->vset->icmp.user_comparator;
+  uint32_t left = 0;
+  uint32_t right = UINT32_MAX;
   int level;
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    /* Merge the set of added files with the set of pre-existing files. */
-    /* Drop any deleted files. Store the result in *v. */
-    const ldb_vector_t *base_files = &b->base->files[level];
-    const rb_set_t *added_files = &b->levels[level].added_files;
-    size_t i = 0;
-    rb_iter_t it;
+  /* Search level-0 in order from newest to oldest. */
+  if (!ldb_version_for_each_level0(ver, user_key, arg, func))
+    return;
 
-    ldb_vector_grow(&v->files[level], base_files->length + added_files->size);
+  /* Search other levels. Each narrows the search of the next. */
+  for (level = 1; level < LDB_MAX_LEVELS; level++) {
+    uint32_t num_files = ver->files[level].length;
+    const ldb_cascade_t *cascade = ver->cascade[level];
+    uint32_t index;
 
-    rb_set_each(added_files, it) {
-      ldb_filemeta_t *added_file = rb_key_ptr(it);
+    if (num_files == 0)
+      continue;
 
-      /* Add all smaller files listed in b->base. */
-      /* This code assumes the base files are sorted. */
-      for (; i < base_files->length; i++) {
-        ldb_filemeta_t *base_file = base_files->items[i];
+    if (right > num_files)
+      right = num_files;
 
-        if (by_smallest_key(&b->vset->icmp, base_file, added_file) >= 0)
-          break;
+    /* Binary search to find earliest index whose largest key >= internal_key */
+    index = find_file_in(&ver->vset->icmp, &ver->files[level],
+                         internal_key, left, right);
+
+    /* The result at the next non-empty level lies between the ones
+       for the largest keys of the files on either side of ours. */
+    if (cascade != NULL) {
+      left = index > 0 ? cascade->index[index - 1] : 0;
+      right = index < num_files ? cascade->index[index] : UINT32_MAX;
+    } else {
+      left = 0;
+      right = UINT32_MAX;
+    }
 
-        builder_maybe_add_file(b, v, level, base_file);
-      }
+    if (index < num_files) {
+      ldb_filemeta_t *f = ver->files[level].items[index];
+      ldb_slice_t small_key = ldb_ikey_user_key(&f->smallest);
 
-      builder_maybe_add_file(b, v, level, added_file);
+      if (ldb_compare(ucmp, user_key, &small_key) < 0) {
+        /* All of "f" is past any data for user_key. */
+      } else {
+        if (!func(arg, level, f))
+          return;
+      }
     }
+  }
+}
 
-    /* Add remaining base files. */
-    for (; i < base_files->length; i++) {
-      ldb_filemeta_t *base_file = base_files->items[i];
+int
+ldb_version_get(ldb_version_t *ver,
+                const ldb_readopt_t *options,
+                const ldb_lkey_t *k,
+                ldb_buffer_t *value,
+                ldb_pinned_t *pin,
+                ldb_getstats_t *stats,
+                ldb_mergectx_t *merge) {
+  getstate_t state;
+  int64_t start;
+  int rc;
 
-      builder_maybe_add_file(b, v, level, base_file);
-    }
+  LDB_PERF_START(start);
 
-#ifndef NDEBUG
-    /* Make sure there is no overlap in levels > 0. */
-    if (level > 0) {
-      for (i = 1; i < v->files[level].length; i++) {
-        const ldb_filemeta_t *x = v->files[level].items[i - 1];
-        const ldb_filemeta_t *y = v->files[level].items[i];
+  getstate_init(&state, ver, options, k, value, pin, stats, merge);
 
-        if (ldb_compare(&b->vset->icmp, &x->largest, &y->smallest) >= 0) {
-          fprintf(stderr, "overlapping ranges in same level\n");
-          abort();
-        }
-      }
-    }
-#endif
-  }
+  ldb_version_for_each_overlapping(ver,
+                                   &state.saver.user_key,
+                                   &state.ikey,
+                                   &state,
+                                   &getstate_match);
+
+  rc = getstate_result(&state);
+
+  LDB_PERF_STOP(files_nanos, start);
+
+  getstate_clear(&state);
+
+  return rc;
 }
 
 /*
- * VersionSet
+ * MultiGet
  */
 
+typedef struct multiget_s {
+  ldb_version_t *ver;
+  const ldb_readopt_t *options;
+  getstate_t *states;
+  ldb_mergectx_t *merges;
+  int *done;
+  size_t *batch;
+  ldb_slice_t *keys;
+  void **args;
+  size_t length;
+} multiget_t;
+
 static void
-ldb_versions_append_version(ldb_versions_t *vset, ldb_version_t *v) {
-  /* Make "v" current. */
-  assert(v->refs == 0);
-  assert(v != vset->current);
+multiget_flush(multiget_t *mg, int level, ldb_filemeta_t *f) {
+  ldb_tables_t *cache = mg->ver->vset->table_cache;
+  size_t i;
+  int rc;
 
-  if (vset->current != NULL)
-    ldb_version_unref(vset->current);
+  if (mg->length == 0)
+    return;
 
-  vset->current = v;
+  for (i = 0; i < mg->length; i++) {
+    getstate_t *state = &mg->states[mg->batch[i]];
 
-  ldb_version_ref(v);
+    getstate_charge(state, level, f);
 
-  /* Append to linked list. */
-  v->prev = vset->dummy_versions.prev;
-  v->next = &vset->dummy_versions;
-  v->prev->next = v;
-  v->next->prev = v;
-}
+    mg->keys[i] = state->ikey;
+    mg->args[i] = &state->saver;
+  }
 
-static void
-ldb_versions_init(ldb_versions_t *vset,
-                  const char *dbname,
-                  const ldb_dbopt_t *options,
-                  ldb_tables_t *table_cache,
-                  const ldb_comparator_t *cmp) {
-  int level;
+  rc = ldb_tables_multiget(cache,
+                           mg->options,
+                           f,
+                           level,
+                           mg->keys,
+                           mg->length,
+                           mg->args,
+                           save_value);
 
-  vset->dbname = dbname;
-  vset->options = options;
-  vset->table_cache = table_cache;
-  vset->icmp = *cmp;
-  vset->next_file_number = 2;
-  vset->manifest_file_number = 0; /* Filled by recover(). */
-  vset->last_sequence = 0;
-  vset->log_number = 0;
-  vset->prev_log_number = 0;
-  vset->descriptor_file = NULL;
-  vset->descriptor_log = NULL;
-  vset->current = NULL;
+  for (i = 0; i < mg->length; i++) {
+    size_t j = mg->batch[i];
 
-  ldb_version_init(&vset->dummy_versions, vset);
+    mg->states[j].status = rc;
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++)
-    ldb_buffer_init(&vset->compact_pointer[level]);
+    getstate_continue(&mg->states[j], level, f);
+    getstate_record(&mg->states[j], level, f);
 
-  ldb_versions_append_version(vset, ldb_version_create(vset));
+    mg->done[j] = !getstate_finish(&mg->states[j]);
+  }
+
+  mg->length = 0;
 }
 
-static void
-ldb_versions_clear(ldb_versions_t *vset) {
+void
+ldb_version_multiget(ldb_version_t *ver,
+                     const ldb_readopt_t *options,
+                     const ldb_lkey_t **keys,
+                     ldb_buffer_t **values,
+                     int *statuses,
+                     ldb_getstats_t *stats,
+                     size_t count) {
+  const ldb_comparator_t *ucmp = ver->vset->icmp.user_comparator;
+  ldb_vector_t tmp;
+  multiget_t mg;
+  size_t i, j;
   int level;
 
-  ldb_version_unref(vset->current);
+  mg.ver = ver;
+  mg.options = options;
+  mg.states = ldb_malloc(count * sizeof(getstate_t));
+  mg.merges = ldb_malloc(count * sizeof(ldb_mergectx_t));
+  mg.done = ldb_malloc(count * sizeof(int));
+  mg.batch = ldb_malloc(count * sizeof(size_t));
+  mg.keys = ldb_malloc(count * sizeof(ldb_slice_t));
+  mg.args = ldb_malloc(count * sizeof(void *));
+  mg.length = 0;
 
-  /* List must be empty. */
-  assert(vset->dummy_versions.next == &vset->dummy_versions);
+  for (i = 0; i < count; i++) {
+    ldb_mergectx_init(&mg.merges[i], ver->vset->options->merge_operator);
 
-  if (vset->descriptor_log != NULL)
-    ldb_writer_destroy(vset->descriptor_log);
+    getstate_init(&mg.states[i], ver, options, keys[i], values[i], NULL,
+                  &stats[i], &mg.merges[i]);
 
-  if (vset->descriptor_file != NULL)
-    ldb_wfile_destroy(vset->descriptor_file);
+    mg.done[i] = 0;
+  }
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++)
-    ldb_buffer_clear(&vset->compact_pointer[level]);
+  /* Search level-0 in order from newest to oldest, visiting each
+     file once for every key it may contain. */
+  ldb_vector_init(&tmp);
+  ldb_vector_grow(&tmp, ver->files[0].length);
+
+  for (i = 0; i < ver->files[0].length; i++)
+    ldb_vector_push(&tmp, ver->files[0].items[i]);
+
+  ldb_vector_sort(&tmp, newest_first);
+
+  for (i = 0; i < tmp.length; i++) {
+    ldb_filemeta_t *f = tmp.items[i];
+    ldb_slice_t small_key = ldb_ikey_user_key(&f->smallest);
+    ldb_slice_t large_key = ldb_ikey_user_key(&f->largest);
+
+    for (j = 0; j < count; j++) {
+      const ldb_slice_t *user_key = &mg.states[j].saver.user_key;
+
+      if (mg.done[j])
+        continue;
+
+      if (ldb_compare(ucmp, user_key, &small_key) >= 0 &&
+          ldb_compare(ucmp, user_key, &large_key) <= 0) {
+        mg.batch[mg.length++] = j;
+      }
+    }
+
+    multiget_flush(&mg, 0, f);
+  }
+
+  ldb_vector_clear(&tmp);
+
+  /* Search other levels. Runs of keys landing in the same file are
+     looked up together. */
+  for (level = 1; level < LDB_MAX_LEVELS; level++) {
+    size_t num_files = ver->files[level].length;
+    ldb_filemeta_t *last = NULL;
+
+    if (num_files == 0)
+      continue;
+
+    for (j = 0; j < count; j++) {
+      getstate_t *state = &mg.states[j];
+      ldb_filemeta_t *f;
+      ldb_slice_t small_key;
+      uint32_t index;
+
+      if (mg.done[j])
+        continue;
+
+      index = find_file(&ver->vset->icmp, &ver->files[level], &state->ikey);
+
+      if (index >= num_files)
+        continue;
+
+      f = ver->files[level].items[index];
+      small_key = ldb_ikey_user_key(&f->smallest);
+
+      if (ldb_compare(ucmp, &state->saver.user_key, &small_key) < 0)
+        continue; /* All of "f" is past any data for user_key. */
+
+      if (f != last) {
+        if (last != NULL)
+          multiget_flush(&mg, level, last);
+
+        last = f;
+      }
+
+      mg.batch[mg.length++] = j;
+    }
+
+    if (last != NULL)
+      multiget_flush(&mg, level, last);
+  }
+
+  for (i = 0; i < count; i++) {
+    getstate_t *state = &mg.states[i];
+
+    statuses[i] = getstate_result(state);
+
+    getstate_clear(state);
+    ldb_mergectx_clear(&mg.merges[i]);
+  }
+
+  ldb_free(mg.args);
+  ldb_free(mg.keys);
+  ldb_free(mg.batch);
+  ldb_free(mg.done);
+  ldb_free(mg.merges);
+  ldb_free(mg.states);
 }
 
-ldb_versions_t *
-ldb_versions_create(const char *dbname,
-                    const ldb_dbopt_t *options,
-                    ldb_tables_t *table_cache,
-                    const ldb_comparator_t *cmp) {
-  ldb_versions_t *vset = ldb_malloc(sizeof(ldb_versions_t));
-  ldb_versions_init(vset, dbname, options, table_cache, cmp);
-  return vset;
+int
+ldb_version_charge_seek(const ldb_getstats_t *stats) {
+  ldb_filemeta_t *f = stats->seek_file;
+
+  if (f == NULL)
+    return 0;
+
+  return ldb_atomic_fetch_sub(&f->allowed_seeks, 1, ldb_order_relaxed) <= 1;
+}
+
+int
+ldb_version_update_stats(ldb_version_t *ver, const ldb_getstats_t *stats) {
+  ldb_filemeta_t *f = stats->seek_file;
+
+  if (f != NULL && ver->file_to_compact == NULL) {
+    if (ldb_atomic_load(&f->allowed_seeks, ldb_order_relaxed) <= 0) {
+      ver->file_to_compact = f;
+      ver->file_to_compact_level = stats->seek_file_level;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int
+ldb_version_record_read_sample(ldb_version_t *ver,
+                               const ldb_slice_t *ikey,
+                               ldb_getstats_t *stats) {
+  samplestate_t state;
+  ldb_pkey_t pkey;
+
+  stats->seek_file = NULL;
+  stats->seek_file_level = 0;
+
+  if (!ldb_pkey_import(&pkey, ikey))
+    return 0;
+
+  state.stats.seek_file = NULL;
+  state.stats.seek_file_level = 0;
+  state.matches = 0;
+
+  ldb_version_for_each_overlapping(ver,
+                                   &pkey.user_key,
+                                   ikey,
+                                   &state,
+                                   &samplestate_match);
+
+  /* The newest table holding the key served the read. */
+  if (state.stats.seek_file != NULL &&
+      ver->vset->options->compaction_warm_reads > 0) {
+    ldb_atomic_fetch_add(&state.stats.seek_file->reads, 1, ldb_order_relaxed);
+  }
+
+  /* Must have at least two matches since we want to merge across
+     files. But what if we have a single file that contains many
+     overwrites and deletions? Should we have another mechanism for
+     finding such files? */
+  if (state.matches >= 2) {
+    /* 1MB cost is about 1 seek (see comment in builder_apply). */
+    *stats = state.stats;
+    return ldb_version_charge_seek(stats);
+  }
+
+  return 0;
+}
+
+int
+ldb_version_record_deletions(ldb_version_t *ver, const ldb_slice_t *ikey) {
+  samplestate_t state;
+  ldb_pkey_t pkey;
+
+  if (ver->file_to_compact != NULL)
+    return 0;
+
+  if (!ldb_pkey_import(&pkey, ikey))
+    return 0;
+
+  state.stats.seek_file = NULL;
+  state.stats.seek_file_level = 0;
+  state.matches = 0;
+
+  ldb_version_for_each_overlapping(ver,
+                                   &pkey.user_key,
+                                   ikey,
+                                   &state,
+                                   &samplestate_match);
+
+  /* A table in the last level has nowhere to be compacted to (and
+     holds no deletions worth dropping, unless snapshots kept them). */
+  if (state.stats.seek_file == NULL)
+    return 0;
+
+  if (state.stats.seek_file_level >= ver->vset->options->num_levels - 1)
+    return 0;
+
+  ver->file_to_compact = state.stats.seek_file;
+  ver->file_to_compact_level = state.stats.seek_file_level;
+
+  return 1;
+}
+
+static int
+overlapping_match(void *arg, int level, ldb_filemeta_t *f) {
+  (void)level;
+  ldb_vector_push((ldb_vector_t *)arg, f);
+  return 1;
 }
 
 void
-ldb_versions_destroy(ldb_versions_t *vset) {
-  ldb_versions_clear(vset);
-  ldb_free(vset);
+ldb_version_overlapping(ldb_version_t *ver,
+                        const ldb_slice_t *ikey,
+                        ldb_vector_t *result) {
+  ldb_pkey_t pkey;
+
+  if (!ldb_pkey_import(&pkey, ikey))
+    return;
+
+  ldb_version_for_each_overlapping(ver,
+                                   &pkey.user_key,
+                                   ikey,
+                                   result,
+                                   &overlapping_match);
 }
 
-uint64_t
-ldb_versions_new_file_number(ldb_versions_t *vset) {
-  return vset->next_file_number++;
+void
+ldb_version_ref(ldb_version_t *ver) {
+  ++ver->refs;
 }
 
 void
-ldb_versions_reuse_file_number(ldb_versions_t *vset, uint64_t file_number) {
-  if (vset->next_file_number == file_number + 1)
-    vset->next_file_number = file_number;
+ldb_version_unref(ldb_version_t *ver) {
+  assert(ver != &ver->vset->dummy_versions);
+  assert(ver->refs >= 1);
+
+  --ver->refs;
+
+  if (ver->refs == 0)
+    ldb_version_destroy(ver);
+}
+
+int
+ldb_version_overlap_in_level(ldb_version_t *ver,
+                             int level,
+                             const ldb_slice_t *smallest_user_key,
+                             const ldb_slice_t *largest_user_key) {
+  return some_file_overlaps_range(&ver->vset->icmp,
+                                  (level > 0),
+                                  &ver->files[level],
+                                  smallest_user_key,
+                                  largest_user_key);
+}
+
+int
+ldb_version_pick_level_for_memtable_output(ldb_version_t *ver,
+                                           const ldb_slice_t *small_key,
+                                           const ldb_slice_t *large_key) {
+  int num_levels = ver->vset->options->num_levels;
+  int max_level = LDB_MIN(LDB_MAX_MEM_COMPACT_LEVEL, num_levels - 1);
+  int level = 0;
+  int64_t sum;
+
+  /* Levels above the base level are kept empty. Universal compaction
+     needs all newer data above the existing runs, and FIFO compaction
+     keeps everything in level-0. */
+  if (ver->vset->options->level_compaction_dynamic_level_bytes ||
+      ver->vset->options->compaction_style != LDB_COMPACTION_LEVEL) {
+    return 0;
+  }
+
+  if (!ldb_version_overlap_in_level(ver, 0, small_key, large_key)) {
+    /* Push to next level if there is no overlap in next level,
+       and the #bytes overlapping in the level after that are limited. */
+    ldb_vector_t overlaps; /* ldb_filemeta_t */
+    ldb_ikey_t start, limit;
+
+    ldb_vector_init(&overlaps);
+    ldb_ikey_init(&start);
+    ldb_ikey_init(&limit);
+
+    ldb_ikey_set(&start, small_key, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+    ldb_ikey_set(&limit, large_key, 0, (ldb_valtype_t)0);
+
+    while (level < max_level) {
+      if (ldb_version_overlap_in_level(ver, level + 1, small_key, large_key))
+        break;
+
+      if (level + 2 < num_levels) {
+        /* Check that file does not overlap too many grandparent bytes. */
+        ldb_version_get_overlapping_inputs(ver, level + 2,
+                                           &start, &limit,
+                                           &overlaps);
+
+        sum = total_file_size(&overlaps);
+
+        if (sum > max_grandparent_overlap_bytes(ver->vset->options))
+          break;
+      }
+
+      level++;
+    }
+
+    ldb_vector_clear(&overlaps);
+    ldb_ikey_clear(&start);
+    ldb_ikey_clear(&limit);
+  }
+
+  return level;
 }
 
-int
-ldb_versions_needs_compaction(const ldb_versions_t *vset) {
-  ldb_version_t *v = vset->current;
-  return (v->compaction_score >= 1) || (v->file_to_compact != NULL);
-}
+/* Store in "*inputs" all files in "level" that overlap [begin,end]. */
+void
+ldb_version_get_overlapping_inputs(ldb_version_t *ver,
+                                   int level,
+                                   const ldb_ikey_t *begin,
+                                   const ldb_ikey_t *end,
+                                   ldb_vector_t *inputs) {
+  const ldb_comparator_t *uc = ver->vset->icmp.user_comparator;
+  ldb_slice_t user_begin, user_end;
+  size_t i;
+
+  assert(level >= 0);
+  assert(level < LDB_MAX_LEVELS);
+
+  ldb_slice_init(&user_begin);
+  ldb_slice_init(&user_end);
+
+  ldb_vector_reset(inputs);
+
+  if (begin != NULL)
+    user_begin = ldb_ikey_user_key(begin);
+
+  if (end != NULL)
+    user_end = ldb_ikey_user_key(end);
+
+  for (i = 0; i < ver->files[level].length;) {
+    ldb_filemeta_t *f = ver->files[level].items[i++];
+    ldb_slice_t file_start = ldb_ikey_user_key(&f->smallest);
+    ldb_slice_t file_limit = ldb_ikey_user_key(&f->largest);
+
+    if (begin != NULL && ldb_compare(uc, &file_limit, &user_begin) < 0) {
+      /* "f" is completely before specified range; skip it. */
+    } else if (end != NULL && ldb_compare(uc, &file_start, &user_end) > 0) {
+      /* "f" is completely after specified range; skip it. */
+    } else {
+      ldb_vector_push(inputs, f);
+
+      if (level == 0) {
+        /* Level-0 files may overlap each other. So check if the newly
+           added file has expanded the range. If so, restart search. */
+        if (begin != NULL && ldb_compare(uc, &file_start, &user_begin) < 0) {
+          user_begin = file_start;
+          ldb_vector_reset(inputs);
+          i = 0;
+        } else if (end != NULL && ldb_compare(uc, &file_limit, &user_end) > 0) {
+          user_end = file_limit;
+          ldb_vector_reset(inputs);
+          i = 0;
+        }
+      }
+    }
+  }
+}
+
+void
+ldb_version_debug(ldb_buffer_t *z, const ldb_version_t *x) {
+  int level;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    const ldb_vector_t *files = &x->files[level];
+    size_t i;
+
+    /* E.g.,
+     *   --- level 1 ---
+     *   17:123['a' .. 'd']
+     *   20:43['e' .. 'g']
+     */
+    ldb_buffer_string(z, "--- level ");
+    ldb_buffer_number(z, level);
+    ldb_buffer_string(z, " ---\n");
+
+    for (i = 0; i < files->length; i++) {
+      const ldb_filemeta_t *file = files->items[i];
+
+      ldb_buffer_push(z, ' ');
+      ldb_buffer_number(z, file->number);
+      ldb_buffer_push(z, ':');
+      ldb_buffer_number(z, file->file_size);
+      ldb_buffer_push(z, '[');
+      ldb_ikey_debug(z, &file->smallest);
+      ldb_buffer_string(z, " .. ");
+      ldb_ikey_debug(z, &file->largest);
+      ldb_buffer_string(z, "]\n");
+    }
+  }
+}
+
+/*
+ * VersionSet::Builder
+ */
+
+/* A helper class so we can efficiently apply a whole sequence
+   of edits to a particular state without creating intermediate
+   versions that contain full copies of the intermediate state. */
+typedef struct level_state_s {
+  rb_set64_t deleted_files;
+  rb_set_t added_files; /* ldb_filemeta_t * */
+} level_state_t;
+
+typedef struct builder_s {
+  ldb_versions_t *vset;
+  ldb_version_t *base;
+  level_state_t levels[LDB_MAX_LEVELS];
+} builder_t;
+
+static int
+by_smallest_key(const ldb_comparator_t *cmp,
+                const ldb_filemeta_t *f1,
+                const ldb_filemeta_t *f2) {
+  int r = ldb_compare(cmp, &f1->smallest, &f2->smallest);
+
+  if (r != 0)
+    return r;
+
+  /* Break ties by file number. */
+  return LDB_CMP(f1->number, f2->number);
+}
+
+static int
+file_set_compare(rb_val_t x, rb_val_t y, void *arg) {
+  return by_smallest_key(arg, x.ptr, y.ptr);
+}
+
+static void
+file_set_destruct(rb_node_t *node) {
+  ldb_filemeta_unref(node->key.ptr);
+}
+
+/* Initialize a builder with the files from *base and other info from *vset. */
+static void
+builder_init(builder_t *b, ldb_versions_t *vset, ldb_version_t *base) {
+  int level;
+
+  b->vset = vset;
+  b->base = base;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    level_state_t *state = &b->levels[level];
+
+    rb_set64_init(&state->deleted_files);
+    rb_set_init(&state->added_files, file_set_compare, &b->vset->icmp);
+  }
+
+  ldb_version_ref(b->base);
+}
+
+static void
+builder_clear(builder_t *b) {
+  int level;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    level_state_t *state = &b->levels[level];
+
+    rb_set64_clear(&state->deleted_files);
+    rb_set_clear(&state->added_files, file_set_destruct);
+  }
+
+  ldb_version_unref(b->base);
+}
+
+/* Apply all of the edits in *edit to the current state. */
+static void
+builder_apply(builder_t *b, const ldb_edit_t *edit) {
+  ldb_versions_t *v = b->vset;
+  rb_iter_t it;
+  size_t i;
+
+  /* Update compaction pointers. */
+  for (i = 0; i < edit->compact_pointers.length; i++) {
+    const ikey_entry_t *entry = edit->compact_pointers.items[i];
+
+    ldb_buffer_copy(&v->compact_pointer[entry->level], &entry->key);
+  }
+
+  /* Delete files. */
+  rb_set_each(&edit->deleted_files, it) {
+    const file_entry_t *entry = rb_key_ptr(it);
+    level_state_t *state = &b->levels[entry->level];
+
+    rb_set64_put(&state->deleted_files, entry->number);
+  }
+
+  /* Add new files. */
+  for (i = 0; i < edit->new_files.length; i++) {
+    const meta_entry_t *entry = edit->new_files.items[i];
+    level_state_t *state = &b->levels[entry->level];
+    ldb_filemeta_t *f = ldb_filemeta_clone(&entry->meta);
+    int allowed_seeks;
+
+    f->refs = 1;
+
+    /* We arrange to automatically compact this file after
+     * a certain number of seeks. Let's assume:
+     *
+     *   (1) One seek costs 10ms
+     *   (2) Writing or reading 1MB costs 10ms (100MB/s)
+     *   (3) A compaction of 1MB does 25MB of IO:
+     *         1MB read from this level
+     *         10-12MB read from next level (boundaries may be misaligned)
+     *         10-12MB written to next level
+     *
+     * This implies that 25 seeks cost the same as the compaction
+     * of 1MB of data. I.e., one seek costs approximately the
+     * same as the compaction of 40KB of data. We are a little
+     * conservative and allow approximately one seek for every 16KB
+     * of data before triggering a compaction.
+     */
+    allowed_seeks = (int)(f->file_size / 16384U);
+
+    if (allowed_seeks < 100)
+      allowed_seeks = 100;
+
+    ldb_atomic_store(&f->allowed_seeks, allowed_seeks, ldb_order_relaxed);
+
+    rb_set64_del(&state->deleted_files, f->number);
+    rb_set_put(&state->added_files, f);
+  }
+}
+
+static void
+builder_maybe_add_file(builder_t *b,
+                       ldb_version_t *v,
+                       int level,
+                       ldb_filemeta_t *f) {
+  level_state_t *state = &b->levels[level];
+
+  if (rb_set64_has(&state->deleted_files, f->number)) {
+    /* File is deleted: do nothing. */
+  } else {
+    ldb_vector_t *files = &v->files[level];
+
+#ifndef NDEBUG
+    if (level > 0 && files->length > 0) {
+      ldb_filemeta_t *item = files->items[files->length - 1];
+
+      /* Must not overlap. */
+      assert(ldb_compare(&b->vset->icmp, &item->largest, &f->smallest) < 0);
+    }
+#endif
+
+    ldb_filemeta_ref(f);
+    ldb_vector_push(files, f);
+  }
+}
+
+/* Save the current state in *v. */
+static void
+builder_save_to(builder_t *b, ldb_version_t *v) {
+  int level;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    /* Merge the set of added files with the set of pre-existing files. */
+    /* Drop any deleted files. Store the result in *v. */
+    const ldb_vector_t *base_files = &b->base->files[level];
+    const rb_set_t *added_files = &b->levels[level].added_files;
+    const rb_set64_t *deleted_files = &b->levels[level].deleted_files;
+    size_t i = 0;
+    rb_iter_t it;
+
+    /* An untouched level is shared with the base version rather
+       than rebuilt. Neither version modifies it after this point. */
+    if (added_files->size == 0 && deleted_files->size == 0) {
+      ldb_version_t *base = b->base;
+
+      if (base->files[level].length == 0)
+        continue;
+
+      if (base->level_refs[level] == NULL) {
+        base->level_refs[level] = ldb_malloc(sizeof(int));
+        *base->level_refs[level] = 1;
+      }
+
+      assert(v->files[level].length == 0);
+
+      ldb_vector_clear(&v->files[level]);
+
+      v->files[level] = base->files[level];
+      v->level_refs[level] = base->level_refs[level];
+
+      *v->level_refs[level] += 1;
+
+      continue;
+    }
+
+    ldb_vector_grow(&v->files[level], base_files->length + added_files->size);
+
+    rb_set_each(added_files, it) {
+      ldb_filemeta_t *added_file = rb_key_ptr(it);
+
+      /* Add all smaller files listed in b->base. */
+      /* This code assumes the base files are sorted. */
+      for (; i < base_files->length; i++) {
+        ldb_filemeta_t *base_file = base_files->items[i];
+
+        if (by_smallest_key(&b->vset->icmp, base_file, added_file) >= 0)
+          break;
+
+        builder_maybe_add_file(b, v, level, base_file);
+      }
+
+      builder_maybe_add_file(b, v, level, added_file);
+    }
+
+    /* Add remaining base files. */
+    for (; i < base_files->length; i++) {
+      ldb_filemeta_t *base_file = base_files->items[i];
+
+      builder_maybe_add_file(b, v, level, base_file);
+    }
+
+#ifndef NDEBUG
+    /* Make sure there is no overlap in levels > 0. */
+    if (level > 0) {
+      for (i = 1; i < v->files[level].length; i++) {
+        const ldb_filemeta_t *x = v->files[level].items[i - 1];
+        const ldb_filemeta_t *y = v->files[level].items[i];
+
+        if (ldb_compare(&b->vset->icmp, &x->largest, &y->smallest) >= 0) {
+          fprintf(stderr, "overlapping ranges in same level\n");
+          abort();
+        }
+      }
+    }
+#endif
+  }
+}
+
+/*
+ * VersionSet
+ */
+
+static void
+ldb_versions_append_version(ldb_versions_t *vset, ldb_version_t *v) {
+  /* Make "v" current. */
+  assert(v->refs == 0);
+  assert(v != vset->current);
+
+  if (vset->current != NULL)
+    ldb_version_unref(vset->current);
+
+  vset->current = v;
+
+  ldb_version_ref(v);
+
+  /* Append to linked list. */
+  v->prev = vset->dummy_versions.prev;
+  v->next = &vset->dummy_versions;
+  v->prev->next = v;
+  v->next->prev = v;
+}
+
+static void
+ldb_versions_init(ldb_versions_t *vset,
+                  const char *dbname,
+                  const ldb_dbopt_t *options,
+                  ldb_tables_t *table_cache,
+                  const ldb_comparator_t *cmp) {
+  int level;
+
+  vset->dbname = dbname;
+  vset->options = options;
+  vset->table_cache = table_cache;
+  vset->icmp = *cmp;
+  vset->next_file_number = 2;
+  vset->manifest_file_number = 0; /* Filled by recover(). */
+  vset->last_sequence = 0;
+  vset->log_number = 0;
+  vset->prev_log_number = 0;
+  vset->descriptor_file = NULL;
+  vset->descriptor_log = NULL;
+  vset->manifest_size = 0;
+  vset->recover_records = 0;
+  vset->recover_micros = 0;
+  vset->log_block_size = 0;
+  vset->current = NULL;
+
+  ldb_version_init(&vset->dummy_versions, vset);
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++)
+    ldb_buffer_init(&vset->compact_pointer[level]);
+
+  ldb_vector_init(&vset->manifest_queue);
+
+  vset->manifest_busy = 0;
+
+  ldb_cond_init(&vset->manifest_cv);
+
+  ldb_versions_append_version(vset, ldb_version_create(vset));
+}
+
+static void
+ldb_versions_clear(ldb_versions_t *vset) {
+  int level;
+
+  ldb_version_unref(vset->current);
+
+  /* List must be empty. */
+  assert(vset->dummy_versions.next == &vset->dummy_versions);
+
+  if (vset->descriptor_log != NULL)
+    ldb_writer_destroy(vset->descriptor_log);
+
+  if (vset->descriptor_file != NULL)
+    ldb_wfile_destroy(vset->descriptor_file);
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++)
+    ldb_buffer_clear(&vset->compact_pointer[level]);
+
+  ldb_vector_clear(&vset->manifest_queue);
+  ldb_cond_destroy(&vset->manifest_cv);
+}
+
+ldb_versions_t *
+ldb_versions_create(const char *dbname,
+                    const ldb_dbopt_t *options,
+                    ldb_tables_t *table_cache,
+                    const ldb_comparator_t *cmp) {
+  ldb_versions_t *vset = ldb_malloc(sizeof(ldb_versions_t));
+  ldb_versions_init(vset, dbname, options, table_cache, cmp);
+  return vset;
+}
+
+void
+ldb_versions_destroy(ldb_versions_t *vset) {
+  ldb_versions_clear(vset);
+  ldb_free(vset);
+}
+
+uint64_t
+ldb_versions_new_file_number(ldb_versions_t *vset) {
+  return vset->next_file_number++;
+}
+
+void
+ldb_versions_reuse_file_number(ldb_versions_t *vset, uint64_t file_number) {
+  if (vset->next_file_number == file_number + 1)
+    vset->next_file_number = file_number;
+}
+
+/* Whether the oldest level-0 file has outlived options->ttl. */
+static int
+ldb_version_fifo_expired(const ldb_version_t *v) {
+  const ldb_dbopt_t *options = v->vset->options;
+  const ldb_vector_t *files = &v->files[0];
+  uint64_t now, oldest = 0;
+  size_t i;
+
+  if (options->ttl <= 0)
+    return 0;
+
+  for (i = 0; i < files->length; i++) {
+    const ldb_filemeta_t *f = files->items[i];
+
+    if (f->creation_time != 0 && (oldest == 0 || f->creation_time < oldest))
+      oldest = f->creation_time;
+  }
+
+  now = ldb_now_usec() / 1000000;
+
+  return oldest != 0 && oldest + options->ttl <= now;
+}
+
+/* The first file (by level) holding data written more than
+   options->periodic_compaction_seconds ago, if any. */
+static ldb_filemeta_t *
+ldb_version_periodic_file(const ldb_version_t *v, int *level) {
+  const ldb_dbopt_t *options = v->vset->options;
+  uint64_t now;
+  size_t i;
+  int j;
+
+  if (options->periodic_compaction_seconds <= 0)
+    return NULL;
+
+  now = ldb_now_usec() / 1000000;
+
+  for (j = 0; j < options->num_levels; j++) {
+    const ldb_vector_t *files = &v->files[j];
+
+    for (i = 0; i < files->length; i++) {
+      ldb_filemeta_t *f = files->items[i];
+
+      if (f->being_compacted || f->creation_time == 0)
+        continue;
+
+      if (f->creation_time + options->periodic_compaction_seconds <= now) {
+        *level = j;
+        return f;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int
+ldb_versions_needs_compaction(const ldb_versions_t *vset) {
+  ldb_version_t *v = vset->current;
+  int level;
+
+  /* Seek compactions would break up the sorted runs. */
+  if (vset->options->compaction_style == LDB_COMPACTION_UNIVERSAL)
+    return v->compaction_score >= 1;
+
+  if (vset->options->compaction_style == LDB_COMPACTION_FIFO)
+    return v->compaction_score >= 1 || ldb_version_fifo_expired(v);
+
+  if (v->compaction_score >= 1 || v->file_to_compact != NULL)
+    return 1;
+
+  if (v->file_to_purge != NULL)
+    return 1;
+
+  return ldb_version_periodic_file(v, &level) != NULL;
+}
+
+static double
+ldb_versions_score(const ldb_versions_t *vset,
+                   const ldb_version_t *v,
+                   int level) {
+  double score;
+
+  if (level == 0) {
+    /* We treat level-0 specially by bounding the number of files
+     * instead of number of bytes for two reasons:
+     *
+     * (1) With larger write-buffer sizes, it is nice not to do too
+     * many level-0 compactions.
+     *
+     * (2) The files in level-0 are merged on every read and
+     * therefore we wish to avoid too many files when the individual
+     * file size is small (perhaps because of a small write-buffer
+     * setting, or very high compression ratios, or lots of
+     * overwrites/deletions).
+     */
+    int trigger = vset->options->level0_file_num_compaction_trigger;
+
+    score = v->files[level].length / (double)trigger;
+  } else {
+    /* Compute the ratio of current size to size limit. */
+    int64_t level_bytes = total_file_size(&v->files[level]);
+
+    score = (double)level_bytes / v->level_max_bytes[level];
+  }
+
+  return score;
+}
+
+/* Derive the level targets from the size of the last level: each level
+   above it targets 1/multiplier of the level below, and levels whose
+   target would fall under max_bytes_for_level_base / multiplier are
+   left empty. Level-0 compacts into the first remaining (base) level. */
+static void
+ldb_versions_dynamic_targets(ldb_versions_t *vset, ldb_version_t *v) {
+  const ldb_dbopt_t *options = vset->options;
+  double multiplier = options->max_bytes_for_level_multiplier;
+  double base_max = options->max_bytes_for_level_base;
+  double base_min = base_max / multiplier;
+  int num_levels = options->num_levels;
+  int first_level = 0;
+  double max_size = 0;
+  double size;
+  int level;
+
+  for (level = 1; level < num_levels; level++) {
+    double bytes = total_file_size(&v->files[level]);
+
+    if (first_level == 0 && v->files[level].length > 0)
+      first_level = level;
+
+    max_size = LDB_MAX(max_size, bytes);
+  }
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++)
+    v->level_max_bytes[level] = base_max;
+
+  if (first_level == 0) {
+    /* Empty database: level-0 goes straight to the last level. */
+    v->base_level = num_levels - 1;
+    return;
+  }
+
+  size = max_size;
+
+  for (level = num_levels - 2; level >= first_level; level--)
+    size /= multiplier;
+
+  v->base_level = first_level;
+
+  /* Open up more levels while the base level would exceed its size. */
+  while (v->base_level > 1 && size > base_max) {
+    v->base_level--;
+    size /= multiplier;
+  }
+
+  /* Keep the base level from getting too small for level-0 to
+     compact into it efficiently. */
+  if (size <= base_min)
+    size = base_min;
+
+  for (level = v->base_level; level < num_levels; level++) {
+    if (level > v->base_level)
+      size *= multiplier;
+
+    v->level_max_bytes[level] = LDB_MAX(size, base_max);
+  }
+}
+
+/* Number of sorted runs in a version: each level-0 file plus each
+   non-empty level. */
+static int
+ldb_version_sorted_runs(const ldb_version_t *v) {
+  int runs = v->files[0].length;
+  int level;
+
+  for (level = 1; level < v->vset->options->num_levels; level++) {
+    if (v->files[level].length > 0)
+      runs++;
+  }
+
+  return runs;
+}
+
+/* Run count at which universal compaction kicks in. Merging a single
+   run would only rewrite it. */
+static int
+universal_trigger(const ldb_dbopt_t *options) {
+  return LDB_MAX(options->level0_file_num_compaction_trigger, 2);
+}
+
+/* Find the file with the highest fraction of deletion markers above
+   the last level. Deletions in the last level are only kept for the
+   sake of snapshots, so compacting them would not purge them. */
+static void
+ldb_versions_find_purge(ldb_versions_t *vset, ldb_version_t *v) {
+  double threshold = vset->options->deletion_compaction_ratio;
+  double best_ratio = 0;
+  int level;
+  size_t i;
+
+  if (threshold <= 0)
+    return;
+
+  for (level = 0; level < vset->options->num_levels - 1; level++) {
+    const ldb_vector_t *files = &v->files[level];
+
+    for (i = 0; i < files->length; i++) {
+      ldb_filemeta_t *f = files->items[i];
+      double ratio;
+
+      if (f->entries == 0)
+        continue;
+
+      ratio = (double)f->deletions / (double)f->entries;
+
+      if (ratio >= threshold && ratio > best_ratio) {
+        v->file_to_purge = f;
+        v->file_to_purge_level = level;
+        best_ratio = ratio;
+      }
+    }
+  }
+}
+
+static void
+ldb_versions_finalize(ldb_versions_t *vset, ldb_version_t *v) {
+  /* Precomputed best level for next compaction. */
+  int best_level = -1;
+  double best_score = -1;
+  int level;
+
+  if (v->l0_index == NULL)
+    v->l0_index = l0index_create(vset->icmp.user_comparator, &v->files[0]);
+
+  cascade_build(v, vset->current);
+
+  if (vset->options->compaction_style == LDB_COMPACTION_UNIVERSAL) {
+    v->compaction_level = 0;
+    v->compaction_score = ldb_version_sorted_runs(v)
+                        / (double)universal_trigger(vset->options);
+    return;
+  }
+
+  if (vset->options->compaction_style == LDB_COMPACTION_FIFO) {
+    v->compaction_level = 0;
+    v->compaction_score = total_file_size(&v->files[0])
+                        / (double)vset->options->fifo_max_table_files_size;
+    return;
+  }
+
+  if (vset->options->level_compaction_dynamic_level_bytes)
+    ldb_versions_dynamic_targets(vset, v);
+
+  for (level = 0; level < vset->options->num_levels - 1; level++) {
+    double score = ldb_versions_score(vset, v, level);
+
+    if (score > best_score) {
+      best_level = level;
+      best_score = score;
+    }
+  }
+
+  v->compaction_level = best_level;
+  v->compaction_score = best_score;
+
+  ldb_versions_find_purge(vset, v);
+}
+
+static void
+ldb_versions_snapshot_edit(ldb_versions_t *vset, ldb_edit_t *edit) {
+  int level;
+
+  /* Save metadata. */
+  ldb_edit_set_comparator_name(edit, vset->icmp.user_comparator->name);
+
+  if (vset->log_block_size != 0)
+    ldb_edit_set_log_block_size(edit, vset->log_block_size);
+
+  /* Save compaction pointers. */
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    if (vset->compact_pointer[level].size > 0) {
+      ldb_edit_set_compact_pointer(edit, level,
+                                   &vset->compact_pointer[level]);
+    }
+  }
+
+  /* Save files. */
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    const ldb_vector_t *files = &vset->current->files[level];
+    size_t i;
+
+    for (i = 0; i < files->length; i++) {
+      const ldb_filemeta_t *f = files->items[i];
+      ldb_filemeta_t *meta = ldb_edit_add_file(edit, level,
+                                               f->number,
+                                               f->file_size,
+                                               &f->smallest,
+                                               &f->largest);
+
+      meta->creation_time = f->creation_time;
+      meta->tombstones = f->tombstones;
+      meta->global_sequence = f->global_sequence;
+      meta->entries = f->entries;
+      meta->deletions = f->deletions;
+      meta->oldest_blob = f->oldest_blob;
+      meta->path_id = f->path_id;
+    }
+  }
+}
+
+static int
+ldb_versions_write_snapshot(ldb_versions_t *vset, ldb_writer_t *log) {
+  ldb_buffer_t record;
+  ldb_edit_t edit;
+  int rc;
+
+  ldb_edit_init(&edit);
+  ldb_versions_snapshot_edit(vset, &edit);
+
+  ldb_buffer_init(&record);
+  ldb_edit_export(&record, &edit);
+  ldb_edit_clear(&edit);
+
+  rc = ldb_writer_add_record(log, &record);
+
+  if (rc == LDB_OK)
+    vset->manifest_size += LDB_HEADER_SIZE + record.size;
+
+  ldb_buffer_clear(&record);
+
+  return rc;
+}
+
+/* A thread waiting to write an edit to the MANIFEST. */
+typedef struct ldb_mwaiter_s {
+  ldb_edit_t *edit;
+  int status;
+  int done;
+} ldb_mwaiter_t;
+
+static int
+manifest_leader(const ldb_versions_t *vset, const ldb_mwaiter_t *w) {
+  if (vset->manifest_busy || vset->manifest_queue.length == 0)
+    return 0;
+
+  return vset->manifest_queue.items[0] == w;
+}
+
+int
+ldb_versions_apply(ldb_versions_t *vset, ldb_edit_t *edit, ldb_mutex_t *mu) {
+  size_t max_size = vset->options->max_manifest_file_size;
+  struct ldb_wfile_s *old_file = NULL;
+  ldb_writer_t *old_log = NULL;
+  uint64_t old_number = 0;
+  uint64_t old_size = 0;
+  char fname[LDB_PATH_MAX];
+  size_t written = 0;
+  uint64_t log_number = vset->log_number;
+  uint64_t prev_log_number = vset->prev_log_number;
+  ldb_vector_t group;
+  ldb_mwaiter_t w;
+  ldb_version_t *v;
+  int rc = LDB_OK;
+  size_t i;
+
+  fname[0] = '\0';
+
+  w.edit = edit;
+  w.status = LDB_OK;
+  w.done = 0;
+
+  /* Queue up behind any in-progress MANIFEST write. Whichever thread
+     leads the next group writes our edit along with its own. */
+  ldb_vector_push(&vset->manifest_queue, &w);
+
+  while (!w.done && !manifest_leader(vset, &w))
+    ldb_cond_wait(&vset->manifest_cv, mu);
+
+  if (w.done)
+    return w.status;
+
+  /* Take every edit queued so far. Threads arriving while we write
+     queue up anew and form the next group. */
+  ldb_vector_init(&group);
+  ldb_vector_swap(&group, &vset->manifest_queue);
+
+  vset->manifest_busy = 1;
+
+  /* Roll over to a new descriptor once the current one has grown too
+     large to replay quickly. The old one stays open (and CURRENT keeps
+     pointing to it) until the new one has been installed. */
+  if (vset->descriptor_log != NULL && max_size > 0 &&
+      vset->manifest_size >= max_size) {
+    old_file = vset->descriptor_file;
+    old_log = vset->descriptor_log;
+    old_number = vset->manifest_file_number;
+    old_size = vset->manifest_size;
+
+    vset->descriptor_file = NULL;
+    vset->descriptor_log = NULL;
+    vset->manifest_file_number = ldb_versions_new_file_number(vset);
+  }
+
+  /* Each edit sees the log numbers left by the edits before it. */
+  for (i = 0; i < group.length; i++) {
+    ldb_edit_t *e = ((ldb_mwaiter_t *)group.items[i])->edit;
+
+    if (e->has_log_number) {
+      assert(e->log_number >= log_number);
+      assert(e->log_number < vset->next_file_number);
+    } else {
+      ldb_edit_set_log_number(e, log_number);
+    }
+
+    if (!e->has_prev_log_number)
+      ldb_edit_set_prev_log_number(e, prev_log_number);
+
+    ldb_edit_set_next_file(e, vset->next_file_number);
+    ldb_edit_set_last_sequence(e, vset->last_sequence);
+
+    log_number = e->log_number;
+    prev_log_number = e->prev_log_number;
+  }
+
+  v = ldb_version_create(vset);
+
+  {
+    builder_t b;
+
+    builder_init(&b, vset, vset->current);
+
+    for (i = 0; i < group.length; i++)
+      builder_apply(&b, ((ldb_mwaiter_t *)group.items[i])->edit);
+
+    builder_save_to(&b, v);
+    builder_clear(&b);
+  }
+
+  ldb_versions_finalize(vset, v);
+
+  /* Initialize new descriptor log file if necessary by creating
+     a temporary file that contains a snapshot of the current version. */
+  if (vset->descriptor_log == NULL) {
+    /* No reason to unlock *mu here since we only hit this path in the
+       first call to apply (when opening the database) or on rollover,
+       and the snapshot is not synced until below. */
+    assert(vset->descriptor_file == NULL);
+
+    if (ldb_desc_filename(fname, sizeof(fname), vset->dbname,
+                                                vset->manifest_file_number)) {
+      rc = ldb_truncfile_create(fname, &vset->descriptor_file);
+    } else {
+      rc = LDB_INVALID;
+    }
+
+    if (rc == LDB_OK) {
+      vset->descriptor_log = ldb_writer_create(vset->descriptor_file, 0);
+      vset->manifest_size = 0;
+
+      rc = ldb_versions_write_snapshot(vset, vset->descriptor_log);
+    }
+  }
+
+  /* Unlock during expensive MANIFEST log write. */
+  {
+    ldb_mutex_unlock(mu);
+
+    /* Write new records to MANIFEST log. The group is ours alone:
+       other threads queue up elsewhere while we are unlocked. */
+    if (rc == LDB_OK) {
+      ldb_buffer_t record;
+
+      ldb_buffer_init(&record);
+
+      for (i = 0; i < group.length && rc == LDB_OK; i++) {
+        ldb_buffer_reset(&record);
+        ldb_edit_export(&record, ((ldb_mwaiter_t *)group.items[i])->edit);
+
+        rc = ldb_writer_add_record(vset->descriptor_log, &record);
+
+        written += LDB_HEADER_SIZE + record.size;
+      }
+
+      if (rc == LDB_OK)
+        rc = ldb_wfile_sync(vset->descriptor_file);
+
+      if (rc != LDB_OK) {
+        ldb_log(vset->options->info_log, "MANIFEST write: %s",
+                                         ldb_strerror(rc));
+      }
+
+      ldb_buffer_clear(&record);
+    }
+
+    /* If we just created a new descriptor file, install it by writing a
+       new CURRENT file that points to it. */
+    if (rc == LDB_OK && fname[0])
+      rc = ldb_set_current_file(vset->dbname, vset->manifest_file_number);
+
+    ldb_mutex_lock(mu);
+  }
+
+  /* Install the new version. */
+  if (rc == LDB_OK) {
+    ldb_versions_append_version(vset, v);
+
+    vset->log_number = log_number;
+    vset->prev_log_number = prev_log_number;
+    vset->manifest_size += written;
+
+    if (old_log != NULL) {
+      ldb_log(vset->options->info_log, "Rolled over MANIFEST at %lu bytes",
+                                       (unsigned long)old_size);
+
+      ldb_writer_destroy(old_log);
+      ldb_wfile_destroy(old_file);
+    }
+  } else {
+    ldb_version_destroy(v);
+
+    if (fname[0]) {
+      if (vset->descriptor_log != NULL)
+        ldb_writer_destroy(vset->descriptor_log);
+
+      if (vset->descriptor_file != NULL)
+        ldb_wfile_destroy(vset->descriptor_file);
+
+      vset->descriptor_log = NULL;
+      vset->descriptor_file = NULL;
+
+      ldb_remove_file(fname);
+    }
+
+    /* Keep appending to the old descriptor. */
+    if (old_log != NULL) {
+      vset->descriptor_file = old_file;
+      vset->descriptor_log = old_log;
+      vset->manifest_file_number = old_number;
+      vset->manifest_size = old_size;
+    }
+  }
+
+  /* Report to the rest of the group and hand over to the next. */
+  for (i = 0; i < group.length; i++) {
+    ldb_mwaiter_t *ready = group.items[i];
+
+    ready->status = rc;
+    ready->done = 1;
+  }
+
+  ldb_vector_clear(&group);
+
+  vset->manifest_busy = 0;
+
+  ldb_cond_broadcast(&vset->manifest_cv);
+
+  return rc;
+}
+
+static int
+ldb_versions_reuse_manifest(ldb_versions_t *vset, const char *dscname) {
+  ldb_filetype_t manifest_type;
+  uint64_t manifest_number;
+  uint64_t manifest_size;
+  const char *dscbase;
+  int rc;
+
+  if (!vset->options->reuse_logs)
+    return 0;
+
+  dscbase = ldb_basename(dscname);
+
+  if (!ldb_parse_filename(&manifest_type, &manifest_number, dscbase) ||
+      manifest_type != LDB_FILE_DESC ||
+      ldb_file_size(dscname, &manifest_size) != LDB_OK ||
+      /* Make new compacted MANIFEST if old one is too big. */
+      manifest_size >= target_file_size(vset->options)) {
+    return 0;
+  }
+
+  assert(vset->descriptor_file == NULL);
+  assert(vset->descriptor_log == NULL);
+
+  rc = ldb_appendfile_create(dscname, &vset->descriptor_file);
+
+  if (rc != LDB_OK) {
+    ldb_log(vset->options->info_log, "Reuse MANIFEST: %s",
+                                     ldb_strerror(rc));
+
+    assert(vset->descriptor_file == NULL);
+
+    return 0;
+  }
+
+  ldb_log(vset->options->info_log, "Reusing MANIFEST %s", dscname);
+
+  vset->descriptor_log = ldb_writer_create(vset->descriptor_file,
+                                           manifest_size);
+
+  vset->manifest_file_number = manifest_number;
+  vset->manifest_size = manifest_size;
+
+  return 1;
+}
+
+static void
+report_corruption(ldb_reporter_t *reporter, size_t bytes, int status) {
+  (void)bytes;
+
+  if (*reporter->status == LDB_OK)
+    *reporter->status = status;
+}
+
+static int
+read_current_filename(char *path, size_t size, const char *dbname) {
+  ldb_buffer_t data;
+  size_t len;
+  char *name;
+  int rc;
+
+  if (!ldb_current_filename(path, size, dbname))
+    return LDB_INVALID;
+
+  ldb_buffer_init(&data);
+
+  rc = ldb_read_file(path, &data);
+
+  if (rc != LDB_OK)
+    goto fail;
+
+  name = (char *)data.data;
+  len = data.size;
+
+  if (len == 0 || name[len - 1] != '\n') {
+    rc = LDB_CORRUPTION; /* "CURRENT file does not end with newline" */
+    goto fail;
+  }
+
+  name[len - 1] = '\0';
+
+  if (!ldb_join(path, size, dbname, name)) {
+    rc = LDB_INVALID;
+    goto fail;
+  }
+
+fail:
+  ldb_buffer_clear(&data);
+  return rc;
+}
+
+/* Replay the descriptor "fname" on top of "base" and install the
+   resulting version. */
+static int
+ldb_versions_replay(ldb_versions_t *vset,
+                    const char *fname,
+                    ldb_version_t *base) {
+  const ldb_comparator_t *ucmp = vset->icmp.user_comparator;
+  int have_log_number = 0;
+  int have_prev_log_number = 0;
+  int have_next_file = 0;
+  int have_last_sequence = 0;
+  uint64_t next_file = 0;
+  uint64_t last_sequence = 0;
+  uint64_t log_number = 0;
+  uint64_t prev_log_number = 0;
+  uint32_t log_block_size = 0;
+  int64_t start_micros = ldb_now_usec();
+  int read_records = 0;
+  builder_t builder;
+  ldb_rfile_t *file;
+  int rc;
+
+  rc = ldb_seqfile_create(fname, &file);
+
+  if (rc != LDB_OK) {
+    if (rc == LDB_ENOENT)
+      return LDB_CORRUPTION; /* "CURRENT points to a non-existent file" */
+
+    return rc;
+  }
+
+  builder_init(&builder, vset, base);
+
+  {
+    ldb_slice_t name = ldb_string(ucmp->name);
+    ldb_reporter_t reporter;
+    ldb_reader_t reader;
+    ldb_slice_t record;
+    ldb_buffer_t buf;
+    ldb_edit_t edit;
+
+    reporter.status = &rc;
+    reporter.corruption = report_corruption;
+
+    ldb_reader_init(&reader, file, &reporter, 1, 0);
+    ldb_slice_init(&record);
+    ldb_buffer_init(&buf);
+    ldb_edit_init(&edit);
+
+    while (ldb_reader_read_record(&reader, &record, &buf) && rc == LDB_OK) {
+      ++read_records;
+
+      /* Calls ldb_edit_reset() internally. */
+      if (!ldb_edit_import(&edit, &record))
+        rc = LDB_CORRUPTION;
+
+      if (rc == LDB_OK) {
+        if (edit.has_comparator && !ldb_slice_equal(&edit.comparator, &name)) {
+          rc = LDB_INVALID; /* "[edit.comparator] does not match
+                                existing comparator [vset.user_comparator]" */
+        }
+      }
+
+      if (rc == LDB_OK)
+        builder_apply(&builder, &edit);
+
+      if (edit.has_log_number) {
+        log_number = edit.log_number;
+        have_log_number = 1;
+      }
+
+      if (edit.has_prev_log_number) {
+        prev_log_number = edit.prev_log_number;
+        have_prev_log_number = 1;
+      }
+
+      if (edit.has_next_file_number) {
+        next_file = edit.next_file_number;
+        have_next_file = 1;
+      }
+
+      if (edit.has_last_sequence) {
+        last_sequence = edit.last_sequence;
+        have_last_sequence = 1;
+      }
+
+      if (edit.has_log_block_size)
+        log_block_size = edit.log_block_size;
+    }
+
+    ldb_edit_clear(&edit);
+    ldb_buffer_clear(&buf);
+    ldb_reader_clear(&reader);
+  }
+
+  ldb_rfile_destroy(file);
+  file = NULL;
+
+  vset->recover_records = read_records;
+  vset->recover_micros = ldb_now_usec() - start_micros;
+
+  if (rc == LDB_OK) {
+    if (!have_next_file)
+      rc = LDB_CORRUPTION; /* "no meta-nextfile entry in descriptor" */
+    else if (!have_log_number)
+      rc = LDB_CORRUPTION; /* "no meta-lognumber entry in descriptor" */
+    else if (!have_last_sequence)
+      rc = LDB_CORRUPTION; /* "no last-sequence-number entry in descriptor" */
+
+    if (!have_prev_log_number)
+      prev_log_number = 0;
+
+    ldb_versions_mark_file_number(vset, prev_log_number);
+    ldb_versions_mark_file_number(vset, log_number);
+  }
+
+  if (rc == LDB_OK) {
+    ldb_version_t *v = ldb_version_create(vset);
+    int level;
+
+    builder_save_to(&builder, v);
+
+    /* Files beyond the configured levels would never be compacted. */
+    for (level = vset->options->num_levels; level < LDB_MAX_LEVELS; level++) {
+      if (v->files[level].length > 0) {
+        rc = LDB_INVALID; /* "num_levels is lower than the existing
+                              number of levels" */
+        break;
+      }
+    }
+
+    if (rc == LDB_OK) {
+      /* Install recovered version. */
+      ldb_versions_finalize(vset, v);
+      ldb_versions_append_version(vset, v);
+    } else {
+      ldb_version_destroy(v);
+    }
+  }
+
+  if (rc == LDB_OK) {
+    vset->manifest_file_number = next_file;
+    vset->next_file_number = next_file + 1;
+    vset->last_sequence = last_sequence;
+    vset->log_number = log_number;
+    vset->prev_log_number = prev_log_number;
+    vset->log_block_size = log_block_size;
+  } else {
+    ldb_log(vset->options->info_log,
+            "Error recovering version set with %d records: %s",
+            read_records, ldb_strerror(rc));
+  }
+
+  builder_clear(&builder);
+
+  return rc;
+}
+
+int
+ldb_versions_recover(ldb_versions_t *vset, int *save_manifest) {
+  char fname[LDB_PATH_MAX];
+  int rc;
+
+  /* Read "CURRENT" file, which contains a
+     pointer to the current manifest file. */
+  rc = read_current_filename(fname, sizeof(fname), vset->dbname);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  rc = ldb_versions_replay(vset, fname, vset->current);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  /* See if we can reuse the existing MANIFEST file. */
+  if (ldb_versions_reuse_manifest(vset, fname)) {
+    /* No need to save new manifest. */
+  } else {
+    *save_manifest = 1;
+  }
+
+  return LDB_OK;
+}
+
+int
+ldb_versions_reload(ldb_versions_t *vset) {
+  char fname[LDB_PATH_MAX];
+  ldb_version_t *base;
+  int rc;
+
+  rc = read_current_filename(fname, sizeof(fname), vset->dbname);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  /* The descriptor may have been rewritten since it was last read,
+     so the state is rebuilt from scratch. */
+  base = ldb_version_create(vset);
+
+  ldb_version_ref(base);
+
+  rc = ldb_versions_replay(vset, fname, base);
+
+  ldb_version_unref(base);
+
+  return rc;
+}
+
+void
+ldb_versions_mark_file_number(ldb_versions_t *vset, uint64_t number) {
+  if (vset->next_file_number <= number)
+    vset->next_file_number = number + 1;
+}
+
+int
+ldb_versions_files(const ldb_versions_t *vset, int level) {
+  assert(level >= 0);
+  assert(level < LDB_MAX_LEVELS);
+  return vset->current->files[level].length;
+}
+
+void
+ldb_versions_refresh(ldb_versions_t *vset) {
+  ldb_version_t *v = vset->current;
+  int level;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++)
+    v->level_max_bytes[level] = max_bytes_for_level(vset->options, level);
+
+  ldb_versions_finalize(vset, v);
+}
+
+const char *
+ldb_versions_summary(const ldb_versions_t *vset, char *scratch) {
+  const ldb_version_t *c = vset->current;
+  char *zp = scratch;
+  int level;
+
+  zp += sprintf(zp, "files[ ");
+
+  for (level = 0; level < vset->options->num_levels; level++)
+    zp += sprintf(zp, "%d ", (int)c->files[level].length);
+
+  sprintf(zp, "]");
+
+  return scratch;
+}
+
+uint64_t
+ldb_versions_approximate_offset(ldb_versions_t *vset,
+                                ldb_version_t *v,
+                                const ldb_ikey_t *ikey) {
+  uint64_t result = 0;
+  int level;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    const ldb_vector_t *files = &v->files[level];
+    size_t i;
+
+    for (i = 0; i < files->length; i++) {
+      const ldb_filemeta_t *file = files->items[i];
+
+      if (ldb_compare(&vset->icmp, &file->largest, ikey) <= 0) {
+        /* Entire file is before "ikey", so just add the file size. */
+        result += file->file_size;
+      } else if (ldb_compare(&vset->icmp, &file->smallest, ikey) > 0) {
+        /* Entire file is after "ikey", so ignore. */
+        if (level > 0) {
+          /* Files other than level 0 are sorted by meta->smallest, so
+             no further files in this level will contain data for
+             "ikey". */
+          break;
+        }
+      } else {
+        /* "ikey" falls in the range for this table. Add the
+           approximate offset of "ikey" within the table. */
+        ldb_table_t *tableptr;
+        ldb_iter_t *iter;
+
+        iter = ldb_tables_iterate(vset->table_cache,
+                                  ldb_readopt_default,
+                                  file->number,
+                                  file->file_size,
+                                  file->path_id,
+                                  level,
+                                  file->global_sequence,
+                                  &tableptr);
+
+        if (tableptr != NULL)
+          result += ldb_table_approximate_offset(tableptr, ikey);
+
+        ldb_iter_destroy(iter);
+      }
+    }
+  }
+
+  return result;
+}
+
+uint64_t
+ldb_versions_approximate_size(ldb_versions_t *vset,
+                              ldb_version_t *v,
+                              const ldb_ikey_t *start,
+                              const ldb_ikey_t *limit) {
+  uint64_t result = 0;
+  int level;
+
+  if (ldb_compare(&vset->icmp, start, limit) >= 0)
+    return 0;
+
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    const ldb_vector_t *files = &v->files[level];
+    size_t i;
+
+    for (i = 0; i < files->length; i++) {
+      const ldb_filemeta_t *file = files->items[i];
+
+      if (ldb_compare(&vset->icmp, &file->largest, start) < 0)
+        continue;
+
+      if (ldb_compare(&vset->icmp, &file->smallest, limit) >= 0) {
+        /* Files other than level 0 are sorted by meta->smallest. */
+        if (level > 0)
+          break;
+
+        continue;
+      }
+
+      if (ldb_compare(&vset->icmp, &file->smallest, start) >= 0 &&
+          ldb_compare(&vset->icmp, &file->largest, limit) < 0) {
+        /* Entire file is within the range. */
+        result += file->file_size;
+      } else {
+        /* The range cuts through the file. Without reading its
+           index, assume it holds half of the file's data. */
+        result += file->file_size / 2;
+      }
+    }
+  }
+
+  return result;
+}
+
+/* Size of the data block which an index entry points at. */
+static uint64_t
+index_block_size(const ldb_iter_t *iter) {
+  ldb_slice_t input = ldb_iter_value(iter);
+  ldb_handle_t handle;
+
+  if (!ldb_handle_import(&handle, &input))
+    return 0;
+
+  return handle.size + LDB_TRAILER_SIZE;
+}
+
+int
+ldb_versions_split_keys(ldb_versions_t *vset,
+                        ldb_version_t *v,
+                        size_t n,
+                        ldb_vector_t *result) {
+  const ldb_comparator_t *ucmp = vset->icmp.user_comparator;
+  ldb_vector_t tables, children;
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  ldb_buffer_t *last = NULL;
+  ldb_iter_t *iter;
+  int rc, level;
+  size_t i;
+
+  ldb_vector_init(&tables);
+  ldb_vector_init(&children);
+
+  /* Merge the indexes of every table. The table iterators keep
+     the tables open meanwhile. */
+  for (level = 0; level < LDB_MAX_LEVELS; level++) {
+    const ldb_vector_t *files = &v->files[level];
+
+    for (i = 0; i < files->length; i++) {
+      const ldb_filemeta_t *file = files->items[i];
+      ldb_table_t *tableptr;
+
+      iter = ldb_tables_iterate(vset->table_cache,
+                                ldb_readopt_default,
+                                file->number,
+                                file->file_size,
+                                file->path_id,
+                                level,
+                                file->global_sequence,
+                                &tableptr);
+
+      if (tableptr != NULL)
+        ldb_vector_push(&children, ldb_table_index_iterator(tableptr));
+
+      ldb_vector_push(&tables, iter);
+    }
+  }
+
+  iter = ldb_mergeiter_create(&vset->icmp,
+                              (ldb_iter_t **)children.items,
+                              children.length);
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+    total += index_block_size(iter);
+
+  /* Each split key closes the block at which the running sum
+     reaches the next n'th of the total. */
+  i = 1;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter) && i < n;
+                             ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t ukey;
+
+    sum += index_block_size(iter);
+
+    if ((double)sum < (double)total * ((double)i / n))
+      continue;
+
+    ukey = ldb_extract_user_key(&key);
+
+    if (last == NULL || ldb_compare(ucmp, &ukey, last) > 0) {
+      last = ldb_malloc(sizeof(ldb_buffer_t));
+
+      ldb_buffer_init(last);
+      ldb_buffer_set(last, ukey.data, ukey.size);
+      ldb_vector_push(result, last);
+    }
+
+    while (i < n && (double)sum >= (double)total * ((double)i / n))
+      i++;
+  }
+
+  rc = ldb_iter_status(iter);
+
+  ldb_iter_destroy(iter);
+
+  for (i = 0; i < tables.length; i++)
+    ldb_iter_destroy(tables.items[i]);
+
+  ldb_vector_clear(&children);
+  ldb_vector_clear(&tables);
+
+  return rc;
+}
+
+void
+ldb_versions_add_files(ldb_versions_t *vset, rb_set64_t *live) {
+  ldb_version_t *list = &vset->dummy_versions;
+  ldb_version_t *v;
+  int level;
+  size_t i;
+
+  for (v = list->next; v != list; v = v->next) {
+    for (level = 0; level < LDB_MAX_LEVELS; level++) {
+      const ldb_vector_t *files = &v->files[level];
+
+      for (i = 0; i < files->length; i++) {
+        const ldb_filemeta_t *file = files->items[i];
+
+        rb_set64_put(live, file->number);
+      }
+    }
+  }
+}
+
+uint64_t
+ldb_versions_oldest_blob(ldb_versions_t *vset) {
+  ldb_version_t *list = &vset->dummy_versions;
+  uint64_t oldest = 0;
+  ldb_version_t *v;
+  int level;
+  size_t i;
+
+  for (v = list->next; v != list; v = v->next) {
+    for (level = 0; level < LDB_MAX_LEVELS; level++) {
+      const ldb_vector_t *files = &v->files[level];
+
+      for (i = 0; i < files->length; i++) {
+        const ldb_filemeta_t *file = files->items[i];
+
+        if (file->oldest_blob == 0)
+          continue;
+
+        if (oldest == 0 || file->oldest_blob < oldest)
+          oldest = file->oldest_blob;
+      }
+    }
+  }
+
+  return oldest;
+}
+
+void
+ldb_versions_snapshot(ldb_versions_t *vset, ldb_buffer_t *record) {
+  ldb_edit_t edit;
+
+  ldb_edit_init(&edit);
+  ldb_versions_snapshot_edit(vset, &edit);
+
+  ldb_edit_set_log_number(&edit, vset->log_number);
+  ldb_edit_set_prev_log_number(&edit, vset->prev_log_number);
+  ldb_edit_set_next_file(&edit, vset->next_file_number);
+  ldb_edit_set_last_sequence(&edit, vset->last_sequence);
+
+  ldb_edit_export(record, &edit);
+  ldb_edit_clear(&edit);
+}
+
+int64_t
+ldb_versions_bytes(const ldb_versions_t *vset, int level) {
+  assert(level >= 0);
+  assert(level < LDB_MAX_LEVELS);
+  return total_file_size(&vset->current->files[level]);
+}
+
+int64_t
+ldb_versions_max_next_level_overlapping_bytes(ldb_versions_t *vset) {
+  ldb_vector_t overlaps;
+  int64_t result = 0;
+  int level;
+  size_t i;
+
+  ldb_vector_init(&overlaps);
+
+  for (level = 1; level < vset->options->num_levels - 1; level++) {
+    for (i = 0; i < vset->current->files[level].length; i++) {
+      const ldb_filemeta_t *f = vset->current->files[level].items[i];
+      int64_t sum;
+
+      ldb_version_get_overlapping_inputs(vset->current,
+                                         level + 1,
+                                         &f->smallest,
+                                         &f->largest,
+                                         &overlaps);
+
+      sum = total_file_size(&overlaps);
+
+      if (sum > result)
+        result = sum;
+    }
+  }
+
+  ldb_vector_clear(&overlaps);
+
+  return result;
+}
+
+double
+ldb_versions_pending_debt(ldb_versions_t *vset) {
+  int64_t limit = expanded_compaction_byte_size_limit(vset->options);
+  int64_t overlap = ldb_versions_max_next_level_overlapping_bytes(vset);
+
+  return (double)overlap / limit;
+}
+
+int64_t
+ldb_versions_pending_bytes(ldb_versions_t *vset) {
+  const ldb_dbopt_t *options = vset->options;
+  const ldb_version_t *v = vset->current;
+  double ratio = options->max_bytes_for_level_multiplier;
+  int64_t carry = 0; /* Bytes compacted down from the level above. */
+  int64_t result = 0;
+  int level;
+
+  if ((int)v->files[0].length >= options->level0_file_num_compaction_trigger) {
+    carry = total_file_size(&v->files[0]);
+    result += carry + total_file_size(&v->files[1]);
+  }
+
+  for (level = 1; level < options->num_levels - 1; level++) {
+    int64_t size = total_file_size(&v->files[level]) + carry;
+    int64_t limit = (int64_t)v->level_max_bytes[level];
+
+    carry = 0;
+
+    if (size > limit) {
+      /* The excess is rewritten along with its next-level overlap. */
+      carry = size - limit;
+      result += (int64_t)(carry * (ratio + 1));
+    }
+  }
+
+  return result;
+}
+
+double
+ldb_versions_compaction_debt(ldb_versions_t *vset) {
+  int trigger = vset->options->level0_slowdown_writes_trigger;
+  double l0 = vset->current->files[0].length / (double)trigger;
+  double ln = ldb_versions_pending_debt(vset);
+
+  return LDB_MAX(l0, ln);
+}
+
+/* Stores the minimal range that covers all entries in inputs in
+   *smallest, *largest. */
+/* REQUIRES: inputs is not empty */
+static void
+ldb_versions_get_range(ldb_versions_t *vset,
+                       const ldb_vector_t *inputs,
+                       ldb_slice_t *smallest,
+                       ldb_slice_t *largest) {
+  ldb_ikey_t *small = NULL;
+  ldb_ikey_t *large = NULL;
+  size_t i;
+
+  assert(inputs->length > 0);
+
+  for (i = 0; i < inputs->length; i++) {
+    ldb_filemeta_t *f = inputs->items[i];
+
+    if (i == 0) {
+      small = &f->smallest;
+      large = &f->largest;
+    } else {
+      if (ldb_compare(&vset->icmp, &f->smallest, small) < 0)
+        small = &f->smallest;
+
+      if (ldb_compare(&vset->icmp, &f->largest, large) > 0)
+        large = &f->largest;
+    }
+  }
+
+  *smallest = *small;
+  *largest = *large;
+}
+
+/* Stores the minimal range that covers all entries in inputs1 and inputs2
+   in *smallest, *largest. */
+/* REQUIRES: inputs is not empty */
+static void
+ldb_versions_get_range2(ldb_versions_t *vset,
+                        const ldb_vector_t *inputs1,
+                        const ldb_vector_t *inputs2,
+                        ldb_slice_t *smallest,
+                        ldb_slice_t *largest) {
+  ldb_vector_t all;
+  size_t i;
+
+  ldb_vector_init(&all);
+  ldb_vector_grow(&all, inputs1->length + inputs2->length);
+
+  for (i = 0; i < inputs1->length; i++)
+    all.items[all.length++] = inputs1->items[i];
+
+  for (i = 0; i < inputs2->length; i++)
+    all.items[all.length++] = inputs2->items[i];
+
+  ldb_versions_get_range(vset, &all, smallest, largest);
+
+  ldb_vector_clear(&all);
+}
+
+/* Finds the largest key in a vector of files. Returns true if files is not
+   empty. */
+static int
+find_largest_key(const ldb_comparator_t *icmp,
+                 const ldb_vector_t *files,
+                 ldb_slice_t *largest_key) {
+  ldb_ikey_t *large = NULL;
+  size_t i;
+
+  if (files->length == 0)
+    return 0;
+
+  for (i = 0; i < files->length; i++) {
+    ldb_filemeta_t *f = files->items[i];
+
+    if (i == 0) {
+      large = &f->largest;
+    } else {
+      if (ldb_compare(icmp, &f->largest, large) > 0)
+        large = &f->largest;
+    }
+  }
+
+  *largest_key = *large;
+
+  return 1;
+}
+
+/* Finds minimum file b2=(l2, u2) in level file for which l2 > u1 and
+   user_key(l2) = user_key(u1). */
+static ldb_filemeta_t *
+find_smallest_boundary_file(const ldb_comparator_t *icmp,
+                            const ldb_vector_t *level_files,
+                            const ldb_ikey_t *largest_key) {
+  const ldb_comparator_t *user_cmp = icmp->user_comparator;
+  ldb_slice_t user_key = ldb_ikey_user_key(largest_key);
+  ldb_filemeta_t *res = NULL;
+  ldb_slice_t file_key;
+  size_t i;
+
+  for (i = 0; i < level_files->length; ++i) {
+    ldb_filemeta_t *f = level_files->items[i];
+
+    if (ldb_compare(icmp, &f->smallest, largest_key) <= 0)
+      continue;
+
+    file_key = ldb_ikey_user_key(&f->smallest);
+
+    if (ldb_compare(user_cmp, &file_key, &user_key) == 0) {
+      if (res == NULL || ldb_compare(icmp, &f->smallest, &res->smallest) < 0)
+        res = f;
+    }
+  }
+
+  return res;
+}
+
+/* Extracts the largest file b1 from |compaction_files| and then searches for a
+ * b2 in |level_files| for which user_key(u1) = user_key(l2). If it finds such a
+ * file b2 (known as a boundary file) it adds it to |compaction_files| and then
+ * searches again using this new upper bound.
+ *
+ * If there are two blocks, b1=(l1, u1) and b2=(l2, u2) and
+ * user_key(u1) = user_key(l2), and if we compact b1 but not b2 then a
+ * subsequent get operation will yield an incorrect result because it will
+ * return the record from b2 in level i rather than from b1 because it searches
+ * level by level for records matching the supplied user key.
+ *
+ * parameters:
+ *   in     level_files:      List of files to search for boundary files.
+ *   in/out compaction_files: List of files to extend by adding boundary files.
+ */
+void
+add_boundary_inputs(const ldb_comparator_t *icmp,
+                    const ldb_vector_t *level_files,
+                    ldb_vector_t *compaction_files) {
+  ldb_slice_t largest_key;
+  int search = 1;
+
+  /* Quick return if compaction_files is empty. */
+  if (!find_largest_key(icmp, compaction_files, &largest_key))
+    return;
 
-static void
-ldb_versions_finalize(ldb_versions_t *vset, ldb_version_t *v) {
-  /* Precomputed best level for next compaction. */
-  int best_level = -1;
-  double best_score = -1;
-  int level;
+  while (search) {
+    ldb_filemeta_t *file = find_smallest_boundary_file(icmp,
+                                                       level_files,
+                                                       &largest_key);
 
-  for (level = 0; level < LDB_NUM_LEVELS - 1; level++) {
-    double score;
-
-    if (level == 0) {
-      /* We treat level-0 specially by bounding the number of files
-       * instead of number of bytes for two reasons:
-       *
-       * (1) With larger write-buffer sizes, it is nice not to do too
-       * many level-0 compactions.
-       *
-       * (2) The files in level-0 are merged on every read and
-       * therefore we wish to avoid too many files when the individual
-       * file size is small (perhaps because of a small write-buffer
-       * setting, or very high compression ratios, or lots of
-       * overwrites/deletions).
-       */
-      score = v->files[level].length / (double)(LDB_L0_COMPACTION_TRIGGER);
+    /* If a boundary file was found advance
+       largest_key, otherwise we're done. */
+    if (file != NULL) {
+      ldb_vector_push(compaction_files, file);
+      largest_key = file->largest;
     } else {
-      /* Compute the ratio of current size to size limit. */
-      int64_t level_bytes = total_file_size(&v->files[level]);
-
-      score = (double)level_bytes / max_bytes_for_level(vset->options, level);
-    }
-
-    if (score > best_score) {
-      best_level = level;
-      best_score = score;
+      search = 0;
     }
   }
-
-  v->compaction_level = best_level;
-  v->compaction_score = best_score;
 }
 
-static int
-ldb_versions_write_snapshot(ldb_versions_t *vset, ldb_writer_t *log) {
-  ldb_buffer_t record;
-  ldb_edit_t edit;
-  int level, rc;
+static void
+ldb_versions_setup_other_inputs(ldb_versions_t *vset, ldb_compaction_t *c) {
+  ldb_slice_t smallest, largest;
+  ldb_slice_t all_start, all_limit;
+  const int level = c->level;
+  int output;
 
-  /* Save metadata. */
-  ldb_edit_init(&edit);
-  ldb_edit_set_comparator_name(&edit, vset->icmp.user_comparator->name);
+  /* Level-0 skips the empty levels above the base level. */
+  if (level == 0 && vset->options->level_compaction_dynamic_level_bytes)
+    c->output_level = LDB_MAX(vset->current->base_level, 1);
+  else
+    c->output_level = level + 1;
 
-  /* Save compaction pointers. */
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    if (vset->compact_pointer[level].size > 0) {
-      ldb_edit_set_compact_pointer(&edit, level,
-                                   &vset->compact_pointer[level]);
-    }
-  }
+  output = c->output_level;
 
-  /* Save files. */
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    const ldb_vector_t *files = &vset->current->files[level];
-    size_t i;
+  c->max_output_file_size = max_file_size_for_level(vset->options, output);
 
-    for (i = 0; i < files->length; i++) {
-      const ldb_filemeta_t *f = files->items[i];
+  add_boundary_inputs(&vset->icmp,
+                      &vset->current->files[level],
+                      &c->inputs[0]);
 
-      ldb_edit_add_file(&edit, level,
-                               f->number,
-                               f->file_size,
-                               &f->smallest,
-                               &f->largest);
-    }
-  }
+  ldb_versions_get_range(vset, &c->inputs[0], &smallest, &largest);
 
-  ldb_buffer_init(&record);
-  ldb_edit_export(&record, &edit);
-  ldb_edit_clear(&edit);
+  ldb_version_get_overlapping_inputs(vset->current, output,
+                                     &smallest, &largest,
+                                     &c->inputs[1]);
 
-  rc = ldb_writer_add_record(log, &record);
+  add_boundary_inputs(&vset->icmp,
+                      &vset->current->files[output],
+                      &c->inputs[1]);
 
-  ldb_buffer_clear(&record);
+  /* Get entire range covered by compaction. */
+  ldb_versions_get_range2(vset, &c->inputs[0], &c->inputs[1],
+                                &all_start, &all_limit);
 
-  return rc;
-}
+  /* See if we can grow the number of inputs in "level" without
+     changing the number of output level files we pick up. */
+  if (c->inputs[1].length > 0) {
+    ldb_vector_t expanded0;
+    int64_t inputs0_size;
+    int64_t inputs1_size;
+    int64_t expanded0_size;
 
-int
-ldb_versions_apply(ldb_versions_t *vset, ldb_edit_t *edit, ldb_mutex_t *mu) {
-  char fname[LDB_PATH_MAX];
-  ldb_version_t *v;
-  int rc = LDB_OK;
+    ldb_vector_init(&expanded0);
 
-  fname[0] = '\0';
+    ldb_version_get_overlapping_inputs(vset->current, level,
+                                       &all_start, &all_limit,
+                                       &expanded0);
 
-  if (edit->has_log_number) {
-    assert(edit->log_number >= vset->log_number);
-    assert(edit->log_number < vset->next_file_number);
-  } else {
-    ldb_edit_set_log_number(edit, vset->log_number);
-  }
+    add_boundary_inputs(&vset->icmp, &vset->current->files[level], &expanded0);
 
-  if (!edit->has_prev_log_number)
-    ldb_edit_set_prev_log_number(edit, vset->prev_log_number);
+    inputs0_size = total_file_size(&c->inputs[0]);
+    inputs1_size = total_file_size(&c->inputs[1]);
+    expanded0_size = total_file_size(&expanded0);
 
-  ldb_edit_set_next_file(edit, vset->next_file_number);
-  ldb_edit_set_last_sequence(edit, vset->last_sequence);
+    if (expanded0.length > c->inputs[0].length &&
+        inputs1_size + expanded0_size <
+            expanded_compaction_byte_size_limit(vset->options)) {
+      ldb_slice_t new_start, new_limit;
+      ldb_vector_t expanded1;
 
-  v = ldb_version_create(vset);
+      ldb_vector_init(&expanded1);
 
-  {
-    builder_t b;
+      ldb_versions_get_range(vset, &expanded0, &new_start, &new_limit);
 
-    builder_init(&b, vset, vset->current);
-    builder_apply(&b, edit);
-    builder_save_to(&b, v);
-    builder_clear(&b);
-  }
+      ldb_version_get_overlapping_inputs(vset->current,
+                                         output,
+                                         &new_start,
+                                         &new_limit,
+                                         &expanded1);
 
-  ldb_versions_finalize(vset, v);
+      add_boundary_inputs(&vset->icmp,
+                          &vset->current->files[output],
+                          &expanded1);
 
-  /* Initialize new descriptor log file if necessary by creating
-     a temporary file that contains a snapshot of the current version. */
-  if (vset->descriptor_log == NULL) {
-    /* No reason to unlock *mu here since we only hit this path in the
-       first call to apply (when opening the database). */
-    assert(vset->descriptor_file == NULL);
+      if (expanded1.length == c->inputs[1].length) {
+        ldb_log(vset->options->info_log,
+                "Expanding@%d %d+%d (%ld+%ld bytes) "
+                "to %d+%d (%ld+%ld bytes)", level,
+                (int)c->inputs[0].length,
+                (int)c->inputs[1].length,
+                (long)inputs0_size,
+                (long)inputs1_size,
+                (int)expanded0.length,
+                (int)expanded1.length,
+                (long)expanded0_size,
+                (long)inputs1_size);
 
-    if (ldb_desc_filename(fname, sizeof(fname), vset->dbname,
-                                                vset->manifest_file_number)) {
-      rc = ldb_truncfile_create(fname, &vset->descriptor_file);
-    } else {
-      rc = LDB_INVALID;
-    }
+        smallest = new_start;
+        largest = new_limit;
 
-    if (rc == LDB_OK) {
-      vset->descriptor_log = ldb_writer_create(vset->descriptor_file, 0);
+        ldb_vector_swap(&c->inputs[0], &expanded0);
+        ldb_vector_swap(&c->inputs[1], &expanded1);
 
-      rc = ldb_versions_write_snapshot(vset, vset->descriptor_log);
+        ldb_versions_get_range2(vset, &c->inputs[0], &c->inputs[1],
+                                      &all_start, &all_limit);
+      }
+
+      ldb_vector_clear(&expanded1);
     }
+
+    ldb_vector_clear(&expanded0);
   }
 
-  /* Unlock during expensive MANIFEST log write. */
-  {
-    ldb_mutex_unlock(mu);
+  /* Compute the set of grandparent files that overlap this compaction
+     (parent == output; grandparent == output+1). */
+  if (output + 1 < vset->options->num_levels) {
+    ldb_version_get_overlapping_inputs(vset->current, output + 1,
+                                       &all_start, &all_limit,
+                                       &c->grandparents);
+  }
+}
 
-    /* Write new record to MANIFEST log. */
-    if (rc == LDB_OK) {
-      ldb_buffer_t record;
+static void
+ldb_versions_advance_pointer(ldb_versions_t *vset, ldb_compaction_t *c) {
+  ldb_slice_t smallest, largest;
 
-      ldb_buffer_init(&record);
-      ldb_edit_export(&record, edit);
+  ldb_versions_get_range(vset, &c->inputs[0], &smallest, &largest);
 
-      rc = ldb_writer_add_record(vset->descriptor_log, &record);
+  /* Update the place where we will do the next compaction for this level.
+     We update this immediately instead of waiting for the VersionEdit
+     to be applied so that if the compaction fails, we will try a different
+     key range next time. */
+  ldb_buffer_copy(&vset->compact_pointer[c->level], &largest);
 
-      if (rc == LDB_OK)
-        rc = ldb_wfile_sync(vset->descriptor_file);
+  ldb_edit_set_compact_pointer(&c->edit, c->level, &largest);
+}
 
-      if (rc != LDB_OK) {
-        ldb_log(vset->options->info_log, "MANIFEST write: %s",
-                                         ldb_strerror(rc));
-      }
+static int
+ldb_compaction_is_busy(const ldb_compaction_t *c) {
+  int which;
+  size_t i;
 
-      ldb_buffer_clear(&record);
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      const ldb_filemeta_t *f = c->inputs[which].items[i];
+
+      if (f->being_compacted)
+        return 1;
     }
+  }
 
-    /* If we just created a new descriptor file, install it by writing a
-       new CURRENT file that points to it. */
-    if (rc == LDB_OK && fname[0])
-      rc = ldb_set_current_file(vset->dbname, vset->manifest_file_number);
+  return 0;
+}
 
-    ldb_mutex_lock(mu);
-  }
+static void
+ldb_compaction_mark_inputs(ldb_compaction_t *c, int value) {
+  int which;
+  size_t i;
 
-  /* Install the new version. */
-  if (rc == LDB_OK) {
-    ldb_versions_append_version(vset, v);
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      ldb_filemeta_t *f = c->inputs[which].items[i];
 
-    vset->log_number = edit->log_number;
-    vset->prev_log_number = edit->prev_log_number;
-  } else {
-    ldb_version_destroy(v);
+      f->being_compacted = value;
+    }
+  }
+}
 
-    if (fname[0]) {
-      ldb_writer_destroy(vset->descriptor_log);
-      ldb_wfile_destroy(vset->descriptor_file);
+/* The file of "level" which starts first after "key", if any. */
+static ldb_filemeta_t *
+next_file_after(ldb_versions_t *vset, int level, const ldb_ikey_t *key) {
+  const ldb_vector_t *files = &vset->current->files[level];
+  ldb_filemeta_t *res = NULL;
+  size_t i;
 
-      vset->descriptor_log = NULL;
-      vset->descriptor_file = NULL;
+  for (i = 0; i < files->length; i++) {
+    ldb_filemeta_t *f = files->items[i];
 
-      ldb_remove_file(fname);
+    if (ldb_compare(&vset->icmp, &f->smallest, key) <= 0)
+      continue;
+
+    if (res == NULL || ldb_compare(&vset->icmp, &f->smallest,
+                                               &res->smallest) < 0) {
+      res = f;
     }
+
+    /* Files of the other levels are sorted. */
+    if (level > 0)
+      break;
   }
 
-  return rc;
+  return res;
 }
 
-static int
-ldb_versions_reuse_manifest(ldb_versions_t *vset, const char *dscname) {
-  ldb_filetype_t manifest_type;
-  uint64_t manifest_number;
-  uint64_t manifest_size;
-  const char *dscbase;
-  int rc;
+/* A compaction which would move a single file, with nothing to merge it
+   with, picks up the files after it for as long as they can be moved
+   along with it, until enough has been picked to bring the level back
+   under its target size. Each must not be busy, must hold no deletions
+   (those are better merged with what they delete), must not overlap
+   the output level or any file left behind, and the move must stay
+   within the limits of a normal compaction. Sequential writes leave
+   long runs of such files, which can then go down a level in one edit. */
+static void
+ldb_versions_expand_move(ldb_versions_t *vset, ldb_compaction_t *c) {
+  const ldb_dbopt_t *options = vset->options;
+  int64_t limit = expanded_compaction_byte_size_limit(options);
+  int64_t max_overlap = max_grandparent_overlap_bytes(options);
+  int output = c->output_level;
+  ldb_vector_t expanded, overlap;
+  ldb_slice_t smallest, largest;
+  ldb_filemeta_t *first, *next;
+  int64_t size, excess;
 
-  if (!vset->options->reuse_logs)
-    return 0;
+  if (c->level == 0 || output <= c->level)
+    return;
 
-  dscbase = ldb_basename(dscname);
+  if (c->inputs[0].length != 1 || c->inputs[1].length != 0)
+    return;
 
-  if (!ldb_parse_filename(&manifest_type, &manifest_number, dscbase) ||
-      manifest_type != LDB_FILE_DESC ||
-      ldb_file_size(dscname, &manifest_size) != LDB_OK ||
-      /* Make new compacted MANIFEST if old one is too big. */
-      manifest_size >= target_file_size(vset->options)) {
-    return 0;
-  }
+  first = c->inputs[0].items[0];
 
-  assert(vset->descriptor_file == NULL);
-  assert(vset->descriptor_log == NULL);
+  if (first->path_id != ldb_level_path_id(options, output))
+    return;
 
-  rc = ldb_appendfile_create(dscname, &vset->descriptor_file);
+  if (first->deletions > 0)
+    return;
 
-  if (rc != LDB_OK) {
-    ldb_log(vset->options->info_log, "Reuse MANIFEST: %s",
-                                     ldb_strerror(rc));
+  if (total_file_size(&c->grandparents) > max_overlap)
+    return;
+
+  excess = total_file_size(&vset->current->files[c->level])
+         - (int64_t)vset->current->level_max_bytes[c->level];
+
+  smallest = first->smallest;
+  largest = first->largest;
+  size = first->file_size;
+
+  ldb_vector_init(&expanded);
+  ldb_vector_init(&overlap);
 
-    assert(vset->descriptor_file == NULL);
+  while (size < excess) {
+    next = next_file_after(vset, c->level, &largest);
 
-    return 0;
-  }
+    if (next == NULL || next->being_compacted)
+      break;
 
-  ldb_log(vset->options->info_log, "Reusing MANIFEST %s", dscname);
+    if (next->path_id != first->path_id)
+      break;
 
-  vset->descriptor_log = ldb_writer_create(vset->descriptor_file,
-                                           manifest_size);
+    if (next->deletions > 0)
+      break;
 
-  vset->manifest_file_number = manifest_number;
+    if (size + (int64_t)next->file_size > limit)
+      break;
 
-  return 1;
-}
+    /* Nothing else of the level may fall in the range (which also
+       keeps boundary files together). */
+    ldb_version_get_overlapping_inputs(vset->current, c->level,
+                                       &smallest, &next->largest,
+                                       &expanded);
 
-static void
-report_corruption(ldb_reporter_t *reporter, size_t bytes, int status) {
-  (void)bytes;
+    add_boundary_inputs(&vset->icmp,
+                        &vset->current->files[c->level],
+                        &expanded);
 
-  if (*reporter->status == LDB_OK)
-    *reporter->status = status;
-}
+    if (expanded.length != c->inputs[0].length + 1)
+      break;
 
-static int
-read_current_filename(char *path, size_t size, const char *dbname) {
-  ldb_buffer_t data;
-  size_t len;
-  char *name;
-  int rc;
+    ldb_version_get_overlapping_inputs(vset->current, output,
+                                       &smallest, &next->largest,
+                                       &overlap);
 
-  if (!ldb_current_filename(path, size, dbname))
-    return LDB_INVALID;
+    if (overlap.length > 0)
+      break;
 
-  ldb_buffer_init(&data);
+    if (output + 1 < options->num_levels) {
+      ldb_version_get_overlapping_inputs(vset->current, output + 1,
+                                         &smallest, &next->largest,
+                                         &overlap);
 
-  rc = ldb_read_file(path, &data);
+      if (total_file_size(&overlap) > max_overlap)
+        break;
 
-  if (rc != LDB_OK)
-    goto fail;
+      ldb_vector_swap(&c->grandparents, &overlap);
+    }
 
-  name = (char *)data.data;
-  len = data.size;
+    ldb_vector_swap(&c->inputs[0], &expanded);
 
-  if (len == 0 || name[len - 1] != '\n') {
-    rc = LDB_CORRUPTION; /* "CURRENT file does not end with newline" */
-    goto fail;
+    largest = next->largest;
+    size += next->file_size;
   }
 
-  name[len - 1] = '\0';
-
-  if (!ldb_join(path, size, dbname, name)) {
-    rc = LDB_INVALID;
-    goto fail;
+  if (c->inputs[0].length > 1) {
+    ldb_log(options->info_log, "Expanding@%d move to %d files (%ld bytes)",
+                               c->level,
+                               (int)c->inputs[0].length,
+                               (long)size);
   }
 
-fail:
-  ldb_buffer_clear(&data);
-  return rc;
+  ldb_vector_clear(&expanded);
+  ldb_vector_clear(&overlap);
 }
 
-int
-ldb_versions_recover(ldb_versions_t *vset, int *save_manifest) {
-  const ldb_comparator_t *ucmp = vset->icmp.user_comparator;
-  char fname[LDB_PATH_MAX];
-  int have_log_number = 0;
-  int have_prev_log_number = 0;
-  int have_next_file = 0;
-  int have_last_sequence = 0;
-  uint64_t next_file = 0;
-  uint64_t last_sequence = 0;
-  uint64_t log_number = 0;
-  uint64_t prev_log_number = 0;
-  int read_records = 0;
-  builder_t builder;
-  ldb_rfile_t *file;
-  int rc;
+/* Finish setting up a compaction whose inputs[0] has been seeded. Returns
+   NULL (and destroys the compaction) if any of the resulting inputs are
+   already being compacted. Compactions picked for the size of a level
+   "expand" into runs of files to move (see expand_move()). */
+static ldb_compaction_t *
+ldb_versions_setup_inputs(ldb_versions_t *vset,
+                          ldb_compaction_t *c,
+                          int expand) {
+  c->input_version = vset->current;
 
-  /* Read "CURRENT" file, which contains a
-     pointer to the current manifest file. */
-  rc = read_current_filename(fname, sizeof(fname), vset->dbname);
+  ldb_version_ref(c->input_version);
 
-  if (rc != LDB_OK)
-    return rc;
+  /* Files in level 0 may overlap each other,
+     so pick up all overlapping ones. */
+  if (c->level == 0) {
+    ldb_slice_t smallest, largest;
 
-  rc = ldb_seqfile_create(fname, &file);
+    ldb_versions_get_range(vset, &c->inputs[0], &smallest, &largest);
 
-  if (rc != LDB_OK) {
-    if (rc == LDB_ENOENT)
-      return LDB_CORRUPTION; /* "CURRENT points to a non-existent file" */
+    /* Note that the next call will discard the file we placed in
+       c->inputs[0] earlier and replace it with an overlapping set
+       which will include the picked file. */
+    ldb_version_get_overlapping_inputs(vset->current, 0,
+                                       &smallest, &largest,
+                                       &c->inputs[0]);
 
-    return rc;
+    assert(c->inputs[0].length > 0);
   }
 
-  builder_init(&builder, vset, vset->current);
+  ldb_versions_setup_other_inputs(vset, c);
 
-  {
-    ldb_slice_t name = ldb_string(ucmp->name);
-    ldb_reporter_t reporter;
-    ldb_reader_t reader;
-    ldb_slice_t record;
-    ldb_buffer_t buf;
-    ldb_edit_t edit;
+  if (expand)
+    ldb_versions_expand_move(vset, c);
 
-    reporter.status = &rc;
-    reporter.corruption = report_corruption;
+  if (ldb_compaction_is_busy(c)) {
+    /* Drop the version first so the busy inputs are not unmarked. */
+    ldb_version_unref(c->input_version);
+    c->input_version = NULL;
+    ldb_compaction_destroy(c);
+    return NULL;
+  }
 
-    ldb_reader_init(&reader, file, &reporter, 1, 0);
-    ldb_slice_init(&record);
-    ldb_buffer_init(&buf);
-    ldb_edit_init(&edit);
+  ldb_versions_advance_pointer(vset, c);
+  ldb_compaction_mark_inputs(c, 1);
 
-    while (ldb_reader_read_record(&reader, &record, &buf) && rc == LDB_OK) {
-      ++read_records;
+  return c;
+}
 
-      /* Calls ldb_edit_reset() internally. */
-      if (!ldb_edit_import(&edit, &record))
-        rc = LDB_CORRUPTION;
+/* A file of a level, ranked by compaction priority. */
+typedef struct rank_s {
+  uint64_t key;
+  size_t index;
+} rank_t;
 
-      if (rc == LDB_OK) {
-        if (edit.has_comparator && !ldb_slice_equal(&edit.comparator, &name)) {
-          rc = LDB_INVALID; /* "[edit.comparator] does not match
-                                existing comparator [vset.user_comparator]" */
-        }
-      }
+static int
+rank_compare(void *x, void *y) {
+  const rank_t *a = x;
+  const rank_t *b = y;
 
-      if (rc == LDB_OK)
-        builder_apply(&builder, &edit);
+  if (a->key != b->key)
+    return LDB_CMP(a->key, b->key);
 
-      if (edit.has_log_number) {
-        log_number = edit.log_number;
-        have_log_number = 1;
-      }
+  return LDB_CMP(a->index, b->index);
+}
 
-      if (edit.has_prev_log_number) {
-        prev_log_number = edit.prev_log_number;
-        have_prev_log_number = 1;
-      }
+/* Bytes of the next level overlapped by each byte of `f` (scaled by
+   1024). `j` is the first file of the next level which may overlap;
+   it only moves forward as `f` does. */
+static uint64_t
+overlapping_ratio(ldb_versions_t *vset,
+                  const ldb_vector_t *next,
+                  const ldb_filemeta_t *f,
+                  size_t *j) {
+  const ldb_comparator_t *ucmp = vset->icmp.user_comparator;
+  ldb_slice_t smallest = ldb_ikey_user_key(&f->smallest);
+  ldb_slice_t largest = ldb_ikey_user_key(&f->largest);
+  uint64_t overlap = 0;
+  size_t k;
 
-      if (edit.has_next_file_number) {
-        next_file = edit.next_file_number;
-        have_next_file = 1;
-      }
+  while (*j < next->length) {
+    const ldb_filemeta_t *g = next->items[*j];
+    ldb_slice_t key = ldb_ikey_user_key(&g->largest);
 
-      if (edit.has_last_sequence) {
-        last_sequence = edit.last_sequence;
-        have_last_sequence = 1;
-      }
-    }
+    if (ldb_compare(ucmp, &key, &smallest) >= 0)
+      break;
 
-    ldb_edit_clear(&edit);
-    ldb_buffer_clear(&buf);
-    ldb_reader_clear(&reader);
+    *j += 1;
   }
 
-  ldb_rfile_destroy(file);
-  file = NULL;
-
-  if (rc == LDB_OK) {
-    if (!have_next_file)
-      rc = LDB_CORRUPTION; /* "no meta-nextfile entry in descriptor" */
-    else if (!have_log_number)
-      rc = LDB_CORRUPTION; /* "no meta-lognumber entry in descriptor" */
-    else if (!have_last_sequence)
-      rc = LDB_CORRUPTION; /* "no last-sequence-number entry in descriptor" */
+  for (k = *j; k < next->length; k++) {
+    const ldb_filemeta_t *g = next->items[k];
+    ldb_slice_t key = ldb_ikey_user_key(&g->smallest);
 
-    if (!have_prev_log_number)
-      prev_log_number = 0;
+    if (ldb_compare(ucmp, &key, &largest) > 0)
+      break;
 
-    ldb_versions_mark_file_number(vset, prev_log_number);
-    ldb_versions_mark_file_number(vset, log_number);
+    overlap += g->file_size;
   }
 
-  if (rc == LDB_OK) {
-    ldb_version_t *v = ldb_version_create(vset);
+  return (overlap << 10) / LDB_MAX(f->file_size, 1);
+}
 
-    builder_save_to(&builder, v);
+/* Attempt a size compaction at the specified level, trying files in
+   order of compaction priority (see enum ldb_compaction_pri). */
+static ldb_compaction_t *
+ldb_versions_pick_ranked(ldb_versions_t *vset, int level) {
+  const ldb_vector_t *files = &vset->current->files[level];
+  const ldb_vector_t *next = &vset->current->files[level + 1];
+  rank_t *ranks = ldb_malloc(files->length * sizeof(rank_t));
+  ldb_compaction_t *c = NULL;
+  ldb_vector_t order;
+  size_t i, j = 0;
 
-    /* Install recovered version. */
-    ldb_versions_finalize(vset, v);
-    ldb_versions_append_version(vset, v);
+  ldb_vector_init(&order);
 
-    vset->manifest_file_number = next_file;
-    vset->next_file_number = next_file + 1;
-    vset->last_sequence = last_sequence;
-    vset->log_number = log_number;
-    vset->prev_log_number = prev_log_number;
+  for (i = 0; i < files->length; i++) {
+    const ldb_filemeta_t *f = files->items[i];
+    rank_t *r = &ranks[i];
 
-    /* See if we can reuse the existing MANIFEST file. */
-    if (ldb_versions_reuse_manifest(vset, fname)) {
-      /* No need to save new manifest. */
+    if (vset->options->compaction_pri == LDB_PRI_OLDEST_FIRST) {
+      /* Files of unknown age go last. */
+      r->key = f->creation_time != 0 ? f->creation_time : UINT64_MAX;
     } else {
-      *save_manifest = 1;
+      r->key = overlapping_ratio(vset, next, f, &j);
     }
-  } else {
-    ldb_log(vset->options->info_log,
-            "Error recovering version set with %d records: %s",
-            read_records, ldb_strerror(rc));
+
+    r->index = i;
+
+    ldb_vector_push(&order, r);
   }
 
-  builder_clear(&builder);
+  ldb_vector_sort(&order, rank_compare);
 
-  return rc;
-}
+  for (i = 0; i < order.length; i++) {
+    const rank_t *r = order.items[i];
+    ldb_filemeta_t *f = files->items[r->index];
 
-void
-ldb_versions_mark_file_number(ldb_versions_t *vset, uint64_t number) {
-  if (vset->next_file_number <= number)
-    vset->next_file_number = number + 1;
-}
+    if (f->being_compacted)
+      continue;
 
-int
-ldb_versions_files(const ldb_versions_t *vset, int level) {
-  assert(level >= 0);
-  assert(level < LDB_NUM_LEVELS);
-  return vset->current->files[level].length;
-}
+    c = ldb_compaction_create(vset->options, level);
 
-const char *
-ldb_versions_summary(const ldb_versions_t *vset, char *scratch) {
-  const ldb_version_t *c = vset->current;
+    ldb_vector_push(&c->inputs[0], f);
 
-  /* Update code if LDB_NUM_LEVELS changes. */
-  STATIC_ASSERT(LDB_NUM_LEVELS == 7);
+    c = ldb_versions_setup_inputs(vset, c, 1);
 
-  sprintf(scratch, "files[ %d %d %d %d %d %d %d ]",
-                   (int)c->files[0].length,
-                   (int)c->files[1].length,
-                   (int)c->files[2].length,
-                   (int)c->files[3].length,
-                   (int)c->files[4].length,
-                   (int)c->files[5].length,
-                   (int)c->files[6].length);
+    if (c != NULL)
+      break;
+  }
 
-  return scratch;
+  ldb_vector_clear(&order);
+  ldb_free(ranks);
+
+  return c;
 }
 
-uint64_t
-ldb_versions_approximate_offset(ldb_versions_t *vset,
-                                ldb_version_t *v,
-                                const ldb_ikey_t *ikey) {
-  uint64_t result = 0;
-  int level;
+/* Attempt a size compaction at the specified level, skipping over
+   files which are currently being compacted. */
+static ldb_compaction_t *
+ldb_versions_pick_level(ldb_versions_t *vset, int level) {
+  const ldb_vector_t *files = &vset->current->files[level];
+  ldb_compaction_t *c;
+  size_t i, start;
 
-  for (level = 0; level < LDB_NUM_LEVELS; level++) {
-    const ldb_vector_t *files = &v->files[level];
-    size_t i;
+  if (files->length == 0)
+    return NULL;
 
+  /* Level-0 files may overlap; never compact them concurrently. */
+  if (level == 0) {
     for (i = 0; i < files->length; i++) {
-      const ldb_filemeta_t *file = files->items[i];
+      const ldb_filemeta_t *f = files->items[i];
 
-      if (ldb_compare(&vset->icmp, &file->largest, ikey) <= 0) {
-        /* Entire file is before "ikey", so just add the file size. */
-        result += file->file_size;
-      } else if (ldb_compare(&vset->icmp, &file->smallest, ikey) > 0) {
-        /* Entire file is after "ikey", so ignore. */
-        if (level > 0) {
-          /* Files other than level 0 are sorted by meta->smallest, so
-             no further files in this level will contain data for
-             "ikey". */
-          break;
-        }
-      } else {
-        /* "ikey" falls in the range for this table. Add the
-           approximate offset of "ikey" within the table. */
-        ldb_table_t *tableptr;
-        ldb_iter_t *iter;
+      if (f->being_compacted)
+        return NULL;
+    }
+  }
 
-        iter = ldb_tables_iterate(vset->table_cache,
-                                  ldb_readopt_default,
-                                  file->number,
-                                  file->file_size,
-                                  &tableptr);
+  if (level > 0 && vset->options->compaction_pri != LDB_PRI_ROUND_ROBIN)
+    return ldb_versions_pick_ranked(vset, level);
 
-        if (tableptr != NULL)
-          result += ldb_table_approximate_offset(tableptr, ikey);
+  /* Pick the first file that comes after compact_pointer[level]. */
+  /* Wrap-around to the beginning of the key space if there is none. */
+  start = 0;
 
-        ldb_iter_destroy(iter);
-      }
+  for (i = 0; i < files->length; i++) {
+    const ldb_filemeta_t *f = files->items[i];
+
+    if (vset->compact_pointer[level].size == 0 ||
+        ldb_compare(&vset->icmp, &f->largest,
+                    &vset->compact_pointer[level]) > 0) {
+      start = i;
+      break;
     }
   }
 
-  return result;
+  for (i = 0; i < files->length; i++) {
+    ldb_filemeta_t *f = files->items[(start + i) % files->length];
+
+    if (f->being_compacted)
+      continue;
+
+    c = ldb_compaction_create(vset->options, level);
+
+    ldb_vector_push(&c->inputs[0], f);
+
+    c = ldb_versions_setup_inputs(vset, c, 1);
+
+    if (c != NULL)
+      return c;
+  }
+
+  return NULL;
 }
 
-void
-ldb_versions_add_files(ldb_versions_t *vset, rb_set64_t *live) {
-  ldb_version_t *list = &vset->dummy_versions;
-  ldb_version_t *v;
+/*
+ * Universal Compaction
+ */
+
+typedef struct run_s {
   int level;
-  size_t i;
+  ldb_filemeta_t *file; /* Level-0 only. */
+  uint64_t size;
+} run_t;
+
+/* Adjust the window runs[start, end) so that the merged output can be
+   placed below the runs newer than it and above the ones older than it.
+   Level-0 files are newer than any level, so a window containing one
+   has to take every older level-0 file as well, and cannot output to
+   level-0. Returns the new end, or -1 if the window cannot be used. */
+static int
+universal_window(const run_t *runs, int n, int n0, int start, int end) {
+  if (runs[start].level == 0 && end < n0)
+    return -1;
 
-  for (v = list->next; v != list; v = v->next) {
-    for (level = 0; level < LDB_NUM_LEVELS; level++) {
-      const ldb_vector_t *files = &v->files[level];
+  if (runs[end - 1].level == 0 && end < n && runs[end].level == 1)
+    end++;
 
-      for (i = 0; i < files->length; i++) {
-        const ldb_filemeta_t *file = files->items[i];
+  return end;
+}
 
-        rb_set64_put(live, file->number);
-      }
+static ldb_compaction_t *
+ldb_versions_pick_universal(ldb_versions_t *vset) {
+  const ldb_dbopt_t *options = vset->options;
+  ldb_version_t *current = vset->current;
+  int trigger = universal_trigger(options);
+  ldb_compaction_t *c = NULL;
+  int start = -1, end = -1;
+  ldb_vector_t files;
+  int i, j, n0, n = 0;
+  int level, output;
+  run_t *runs;
+  size_t k;
+
+  ldb_vector_init(&files);
+  ldb_vector_copy(&files, &current->files[0]);
+  ldb_vector_sort(&files, newest_first);
+
+  runs = ldb_malloc((files.length + LDB_MAX_LEVELS) * sizeof(run_t));
+
+  /* Sorted runs from newest to oldest. */
+  for (k = 0; k < files.length; k++) {
+    ldb_filemeta_t *f = files.items[k];
+
+    runs[n].level = 0;
+    runs[n].file = f;
+    runs[n].size = f->file_size;
+
+    n++;
+  }
+
+  n0 = n;
+
+  for (level = 1; level < options->num_levels; level++) {
+    if (current->files[level].length > 0) {
+      runs[n].level = level;
+      runs[n].file = NULL;
+      runs[n].size = total_file_size(&current->files[level]);
+
+      n++;
     }
   }
-}
 
-int64_t
-ldb_versions_bytes(const ldb_versions_t *vset, int level) {
-  assert(level >= 0);
-  assert(level < LDB_NUM_LEVELS);
-  return total_file_size(&vset->current->files[level]);
-}
+  /* Only one universal compaction runs at a time: every pick depends
+     on the whole set of runs. */
+  for (level = 0; level < options->num_levels; level++) {
+    for (k = 0; k < current->files[level].length; k++) {
+      const ldb_filemeta_t *f = current->files[level].items[k];
 
-int64_t
-ldb_versions_max_next_level_overlapping_bytes(ldb_versions_t *vset) {
-  ldb_vector_t overlaps;
-  int64_t result = 0;
-  int level;
-  size_t i;
+      if (f->being_compacted)
+        n = 0;
+    }
+  }
 
-  ldb_vector_init(&overlaps);
+  if (n < trigger)
+    goto done;
 
-  for (level = 1; level < LDB_NUM_LEVELS - 1; level++) {
-    for (i = 0; i < vset->current->files[level].length; i++) {
-      const ldb_filemeta_t *f = vset->current->files[level].items[i];
-      int64_t sum;
+  /* Merge everything if the newer runs take up too much space
+     compared to the oldest one. */
+  {
+    double older = 0;
 
-      ldb_version_get_overlapping_inputs(vset->current,
-                                         level + 1,
-                                         &f->smallest,
-                                         &f->largest,
-                                         &overlaps);
+    for (i = 0; i < n - 1; i++)
+      older += runs[i].size;
 
-      sum = total_file_size(&overlaps);
+    if (older * 100 > (double)options->universal_max_size_amplification_percent
+                    * runs[n - 1].size) {
+      ldb_log(options->info_log, "Universal: space amplification, %d runs",
+              n);
+      start = 0;
+      end = n;
+    }
+  }
 
-      if (sum > result)
-        result = sum;
+  /* Merge runs of similar size, starting from the newest. */
+  for (i = 0; i < n - 1 && start < 0; i++) {
+    double sum = runs[i].size;
+
+    for (j = i + 1; j < n; j++) {
+      if (sum * (100 + options->universal_size_ratio) / 100 < runs[j].size)
+        break;
+
+      sum += runs[j].size;
+    }
+
+    if (j - i >= 2 && (j = universal_window(runs, n, n0, i, j)) > 0) {
+      ldb_log(options->info_log, "Universal: size ratio %d runs from %d",
+              j - i, i);
+      start = i;
+      end = j;
     }
   }
 
-  ldb_vector_clear(&overlaps);
+  /* Otherwise bring the number of runs back under the trigger. */
+  if (start < 0) {
+    start = 0;
+    end = universal_window(runs, n, n0, 0, LDB_MAX(n - trigger + 2, n0));
 
-  return result;
-}
+    ldb_log(options->info_log, "Universal: merging %d of %d runs", end, n);
+  }
 
-/* Stores the minimal range that covers all entries in inputs in
-   *smallest, *largest. */
-/* REQUIRES: inputs is not empty */
-static void
-ldb_versions_get_range(ldb_versions_t *vset,
-                       const ldb_vector_t *inputs,
-                       ldb_slice_t *smallest,
-                       ldb_slice_t *largest) {
-  ldb_ikey_t *small = NULL;
-  ldb_ikey_t *large = NULL;
-  size_t i;
+  assert(end > start + 1 && end <= n);
 
-  assert(inputs->length > 0);
+  /* Output goes right above the next older run. */
+  output = (end == n ? options->num_levels - 1 : runs[end].level - 1);
 
-  for (i = 0; i < inputs->length; i++) {
-    ldb_filemeta_t *f = inputs->items[i];
+  assert(output >= 1 && output >= runs[end - 1].level);
 
-    if (i == 0) {
-      small = &f->smallest;
-      large = &f->largest;
+  c = ldb_compaction_create(options, runs[start].level);
+
+  c->output_level = output;
+  c->max_output_file_size = max_file_size_for_level(options, output);
+  c->tiered = 1;
+
+  for (i = start; i < end; i++) {
+    if (runs[i].level == 0) {
+      ldb_vector_push(&c->inputs[0], runs[i].file);
+      c->level0_inputs++;
     } else {
-      if (ldb_compare(&vset->icmp, &f->smallest, small) < 0)
-        small = &f->smallest;
+      const ldb_vector_t *v = &current->files[runs[i].level];
+      int which = (runs[i].level == output);
 
-      if (ldb_compare(&vset->icmp, &f->largest, large) > 0)
-        large = &f->largest;
+      for (k = 0; k < v->length; k++)
+        ldb_vector_push(&c->inputs[which], v->items[k]);
     }
   }
 
-  *smallest = *small;
-  *largest = *large;
-}
+  c->input_version = current;
 
-/* Stores the minimal range that covers all entries in inputs1 and inputs2
-   in *smallest, *largest. */
-/* REQUIRES: inputs is not empty */
-static void
-ldb_versions_get_range2(ldb_versions_t *vset,
-                        const ldb_vector_t *inputs1,
-                        const ldb_vector_t *inputs2,
-                        ldb_slice_t *smallest,
-                        ldb_slice_t *largest) {
-  ldb_vector_t all;
-  size_t i;
+  ldb_version_ref(c->input_version);
 
-  ldb_vector_init(&all);
-  ldb_vector_grow(&all, inputs1->length + inputs2->length);
+  ldb_compaction_mark_inputs(c, 1);
 
-  for (i = 0; i < inputs1->length; i++)
-    all.items[all.length++] = inputs1->items[i];
+done:
+  ldb_vector_clear(&files);
+  ldb_free(runs);
 
-  for (i = 0; i < inputs2->length; i++)
-    all.items[all.length++] = inputs2->items[i];
+  return c;
+}
 
-  ldb_versions_get_range(vset, &all, smallest, largest);
+/*
+ * FIFO Compaction
+ */
 
-  ldb_vector_clear(&all);
+static int
+oldest_first(void *x, void *y) {
+  return newest_first(y, x);
 }
 
-/* Finds the largest key in a vector of files. Returns true if files is not
-   empty. */
-static int
-find_largest_key(const ldb_comparator_t *icmp,
-                 const ldb_vector_t *files,
-                 ldb_slice_t *largest_key) {
-  ldb_ikey_t *large = NULL;
+static ldb_compaction_t *
+ldb_versions_pick_fifo(ldb_versions_t *vset) {
+  const ldb_dbopt_t *options = vset->options;
+  ldb_version_t *current = vset->current;
+  uint64_t total = total_file_size(&current->files[0]);
+  uint64_t now = ldb_now_usec() / 1000000;
+  ldb_compaction_t *c;
+  ldb_vector_t files;
   size_t i;
 
-  if (files->length == 0)
-    return 0;
-
-  for (i = 0; i < files->length; i++) {
-    ldb_filemeta_t *f = files->items[i];
+  ldb_vector_init(&files);
+  ldb_vector_copy(&files, &current->files[0]);
+  ldb_vector_sort(&files, oldest_first);
 
-    if (i == 0) {
-      large = &f->largest;
-    } else {
-      if (ldb_compare(icmp, &f->largest, large) > 0)
-        large = &f->largest;
-    }
-  }
+  c = ldb_compaction_create(options, 0);
 
-  *largest_key = *large;
+  /* Files reach the size limit and expire oldest first. */
+  for (i = 0; i < files.length; i++) {
+    ldb_filemeta_t *f = files.items[i];
+    int expired = options->ttl > 0 && f->creation_time != 0
+               && f->creation_time + options->ttl <= now;
 
-  return 1;
-}
+    if (total <= options->fifo_max_table_files_size && !expired)
+      break;
 
-/* Finds minimum file b2=(l2, u2) in level file for which l2 > u1 and
-   user_key(l2) = user_key(u1). */
-static ldb_filemeta_t *
-find_smallest_boundary_file(const ldb_comparator_t *icmp,
-                            const ldb_vector_t *level_files,
-                            const ldb_ikey_t *largest_key) {
-  const ldb_comparator_t *user_cmp = icmp->user_comparator;
-  ldb_slice_t user_key = ldb_ikey_user_key(largest_key);
-  ldb_filemeta_t *res = NULL;
-  ldb_slice_t file_key;
-  size_t i;
+    if (f->being_compacted) {
+      ldb_vector_reset(&c->inputs[0]);
+      break;
+    }
 
-  for (i = 0; i < level_files->length; ++i) {
-    ldb_filemeta_t *f = level_files->items[i];
+    ldb_vector_push(&c->inputs[0], f);
 
-    if (ldb_compare(icmp, &f->smallest, largest_key) <= 0)
-      continue;
+    total -= f->file_size;
+  }
 
-    file_key = ldb_ikey_user_key(&f->smallest);
+  ldb_vector_clear(&files);
 
-    if (ldb_compare(user_cmp, &file_key, &user_key) == 0) {
-      if (res == NULL || ldb_compare(icmp, &f->smallest, &res->smallest) < 0)
-        res = f;
-    }
+  if (c->inputs[0].length == 0) {
+    ldb_compaction_destroy(c);
+    return NULL;
   }
 
-  return res;
-}
+  ldb_log(options->info_log, "FIFO: deleting %d files",
+          (int)c->inputs[0].length);
 
-/* Extracts the largest file b1 from |compaction_files| and then searches for a
- * b2 in |level_files| for which user_key(u1) = user_key(l2). If it finds such a
- * file b2 (known as a boundary file) it adds it to |compaction_files| and then
- * searches again using this new upper bound.
- *
- * If there are two blocks, b1=(l1, u1) and b2=(l2, u2) and
- * user_key(u1) = user_key(l2), and if we compact b1 but not b2 then a
- * subsequent get operation will yield an incorrect result because it will
- * return the record from b2 in level i rather than from b1 because it searches
- * level by level for records matching the supplied user key.
- *
- * parameters:
- *   in     level_files:      List of files to search for boundary files.
- *   in/out compaction_files: List of files to extend by adding boundary files.
- */
-void
-add_boundary_inputs(const ldb_comparator_t *icmp,
-                    const ldb_vector_t *level_files,
-                    ldb_vector_t *compaction_files) {
-  ldb_slice_t largest_key;
-  int search = 1;
+  c->deletion = 1;
+  c->input_version = current;
 
-  /* Quick return if compaction_files is empty. */
-  if (!find_largest_key(icmp, compaction_files, &largest_key))
-    return;
+  ldb_version_ref(c->input_version);
 
-  while (search) {
-    ldb_filemeta_t *file = find_smallest_boundary_file(icmp,
-                                                       level_files,
-                                                       &largest_key);
+  ldb_compaction_mark_inputs(c, 1);
 
-    /* If a boundary file was found advance
-       largest_key, otherwise we're done. */
-    if (file != NULL) {
-      ldb_vector_push(compaction_files, file);
-      largest_key = file->largest;
-    } else {
-      search = 0;
-    }
-  }
+  return c;
 }
 
-static void
-ldb_versions_setup_other_inputs(ldb_versions_t *vset, ldb_compaction_t *c) {
-  ldb_slice_t smallest, largest;
-  ldb_slice_t all_start, all_limit;
-  const int level = c->level;
+/*
+ * Periodic Compaction
+ */
 
-  add_boundary_inputs(&vset->icmp,
-                      &vset->current->files[level],
-                      &c->inputs[0]);
+static ldb_compaction_t *
+ldb_versions_pick_periodic(ldb_versions_t *vset) {
+  ldb_filemeta_t *f;
+  ldb_compaction_t *c;
+  int level;
 
-  ldb_versions_get_range(vset, &c->inputs[0], &smallest, &largest);
+  f = ldb_version_periodic_file(vset->current, &level);
 
-  ldb_version_get_overlapping_inputs(vset->current, level + 1,
-                                     &smallest, &largest,
-                                     &c->inputs[1]);
+  if (f == NULL)
+    return NULL;
 
-  add_boundary_inputs(&vset->icmp,
-                      &vset->current->files[level + 1],
-                      &c->inputs[1]);
+  /* Level-0 files may overlap; never compact them concurrently. */
+  if (level == 0) {
+    const ldb_vector_t *files = &vset->current->files[0];
+    size_t i;
 
-  /* Get entire range covered by compaction. */
-  ldb_versions_get_range2(vset, &c->inputs[0], &c->inputs[1],
-                                &all_start, &all_limit);
+    for (i = 0; i < files->length; i++) {
+      const ldb_filemeta_t *g = files->items[i];
 
-  /* See if we can grow the number of inputs in "level" without
-     changing the number of "level+1" files we pick up. */
-  if (c->inputs[1].length > 0) {
-    ldb_vector_t expanded0;
-    int64_t inputs0_size;
-    int64_t inputs1_size;
-    int64_t expanded0_size;
+      if (g->being_compacted)
+        return NULL;
+    }
+  }
 
-    ldb_vector_init(&expanded0);
+  c = ldb_compaction_create(vset->options, level);
+  c->periodic = 1;
 
-    ldb_version_get_overlapping_inputs(vset->current, level,
-                                       &all_start, &all_limit,
-                                       &expanded0);
+  ldb_vector_push(&c->inputs[0], f);
 
-    add_boundary_inputs(&vset->icmp, &vset->current->files[level], &expanded0);
+  if (level < vset->options->num_levels - 1)
+    return ldb_versions_setup_inputs(vset, c, 0);
 
-    inputs0_size = total_file_size(&c->inputs[0]);
-    inputs1_size = total_file_size(&c->inputs[1]);
-    expanded0_size = total_file_size(&expanded0);
+  /* Nothing lies below the last level: rewrite the file in place. */
+  c->output_level = level;
+  c->max_output_file_size = max_file_size_for_level(vset->options, level);
+  c->input_version = vset->current;
 
-    if (expanded0.length > c->inputs[0].length &&
-        inputs1_size + expanded0_size <
-            expanded_compaction_byte_size_limit(vset->options)) {
-      ldb_slice_t new_start, new_limit;
-      ldb_vector_t expanded1;
+  ldb_version_ref(c->input_version);
 
-      ldb_vector_init(&expanded1);
+  ldb_compaction_mark_inputs(c, 1);
 
-      ldb_versions_get_range(vset, &expanded0, &new_start, &new_limit);
+  return c;
+}
 
-      ldb_version_get_overlapping_inputs(vset->current,
-                                         level + 1,
-                                         &new_start,
-                                         &new_limit,
-                                         &expanded1);
+/* Merge the newest level-0 files into a single level-0 file, for when
+   the level-0 compaction is held up by a running one. Only files newer
+   than every busy file are taken, so the output (numbered after them)
+   keeps their place among the others. Nothing is read from level-1,
+   which may stay busy for a while; in the meantime the number of
+   level-0 files, which writes stall on and every read has to merge,
+   goes down. */
+static ldb_compaction_t *
+ldb_versions_pick_intra_l0(ldb_versions_t *vset) {
+  const ldb_dbopt_t *options = vset->options;
+  int64_t limit = expanded_compaction_byte_size_limit(options);
+  size_t min_files = LDB_MAX(options->level0_file_num_compaction_trigger, 2);
+  ldb_compaction_t *c;
+  ldb_vector_t files;
+  int64_t size = 0;
+  size_t i;
 
-      add_boundary_inputs(&vset->icmp,
-                          &vset->current->files[level + 1],
-                          &expanded1);
+  if (vset->current->files[0].length < min_files)
+    return NULL;
 
-      if (expanded1.length == c->inputs[1].length) {
-        ldb_log(vset->options->info_log,
-                "Expanding@%d %d+%d (%ld+%ld bytes) "
-                "to %d+%d (%ld+%ld bytes)", level,
-                (int)c->inputs[0].length,
-                (int)c->inputs[1].length,
-                (long)inputs0_size,
-                (long)inputs1_size,
-                (int)expanded0.length,
-                (int)expanded1.length,
-                (long)expanded0_size,
-                (long)inputs1_size);
+  ldb_vector_init(&files);
+  ldb_vector_copy(&files, &vset->current->files[0]);
+  ldb_vector_sort(&files, newest_first);
 
-        smallest = new_start;
-        largest = new_limit;
+  c = ldb_compaction_create(options, 0);
 
-        ldb_vector_swap(&c->inputs[0], &expanded0);
-        ldb_vector_swap(&c->inputs[1], &expanded1);
+  for (i = 0; i < files.length; i++) {
+    ldb_filemeta_t *f = files.items[i];
 
-        ldb_versions_get_range2(vset, &c->inputs[0], &c->inputs[1],
-                                      &all_start, &all_limit);
-      }
+    if (f->being_compacted)
+      break;
 
-      ldb_vector_clear(&expanded1);
-    }
+    if (size + (int64_t)f->file_size > limit)
+      break;
 
-    ldb_vector_clear(&expanded0);
+    ldb_vector_push(&c->inputs[0], f);
+
+    size += f->file_size;
   }
 
-  /* Compute the set of grandparent files that overlap this compaction
-     (parent == level+1; grandparent == level+2). */
-  if (level + 2 < LDB_NUM_LEVELS) {
-    ldb_version_get_overlapping_inputs(vset->current, level + 2,
-                                       &all_start, &all_limit,
-                                       &c->grandparents);
+  ldb_vector_clear(&files);
+
+  if (c->inputs[0].length < min_files) {
+    ldb_compaction_destroy(c);
+    return NULL;
   }
 
-  /* Update the place where we will do the next compaction for this level.
-     We update this immediately instead of waiting for the VersionEdit
-     to be applied so that if the compaction fails, we will try a different
-     key range next time. */
-  ldb_buffer_copy(&vset->compact_pointer[level], &largest);
+  /* The output must be a single file (see ldb_background_compaction()),
+     and cannot be much larger than the inputs. */
+  c->output_level = 0;
+  c->max_output_file_size = 2 * limit;
+  c->input_version = vset->current;
 
-  ldb_edit_set_compact_pointer(&c->edit, level, &largest);
+  ldb_version_ref(c->input_version);
+
+  ldb_compaction_mark_inputs(c, 1);
+
+  return c;
 }
 
 ldb_compaction_t *
-ldb_versions_pick_compaction(ldb_versions_t *vset) {
+ldb_versions_pick_compaction(ldb_versions_t *vset, int flushing) {
+  ldb_version_t *current = vset->current;
+  double scores[LDB_MAX_LEVELS];
+  int levels[LDB_MAX_LEVELS];
   ldb_compaction_t *c;
-  int level;
-  size_t i;
-
-  /* We prefer compactions triggered by too much data in a level over
-     the compactions triggered by seeks. */
-  int size_compaction = (vset->current->compaction_score >= 1);
-  int seek_compaction = (vset->current->file_to_compact != NULL);
+  int i, j, n = 0;
 
-  if (size_compaction) {
-    level = vset->current->compaction_level;
+  if (vset->options->compaction_style == LDB_COMPACTION_UNIVERSAL)
+    return ldb_versions_pick_universal(vset);
 
-    assert(level >= 0);
-    assert(level + 1 < LDB_NUM_LEVELS);
+  if (vset->options->compaction_style == LDB_COMPACTION_FIFO)
+    return ldb_versions_pick_fifo(vset);
 
-    c = ldb_compaction_create(vset->options, level);
+  /* We prefer compactions triggered by too much data in a level over
+     the compactions triggered by seeks. Levels which need compacting
+     are tried in order of decreasing score. A level is passed over
+     only when all of its candidate inputs are already being compacted. */
+  for (i = 0; i < vset->options->num_levels - 1; i++) {
+    double score = ldb_versions_score(vset, current, i);
 
-    /* Pick the first file that comes after compact_pointer[level]. */
-    for (i = 0; i < vset->current->files[level].length; i++) {
-      ldb_filemeta_t *f = vset->current->files[level].items[i];
+    if (score < 1)
+      continue;
 
-      if (vset->compact_pointer[level].size == 0 ||
-          ldb_compare(&vset->icmp, &f->largest,
-                      &vset->compact_pointer[level]) > 0) {
-        ldb_vector_push(&c->inputs[0], f);
-        break;
-      }
+    for (j = n; j > 0 && scores[j - 1] < score; j--) {
+      scores[j] = scores[j - 1];
+      levels[j] = levels[j - 1];
     }
 
-    if (c->inputs[0].length == 0) {
-      /* Wrap-around to the beginning of the key space. */
-      ldb_vector_push(&c->inputs[0], vset->current->files[level].items[0]);
-    }
-  } else if (seek_compaction) {
-    level = vset->current->file_to_compact_level;
-    c = ldb_compaction_create(vset->options, level);
-    ldb_vector_push(&c->inputs[0], vset->current->file_to_compact);
-  } else {
-    return NULL;
+    scores[j] = score;
+    levels[j] = i;
+
+    n++;
   }
 
-  c->input_version = vset->current;
+  for (i = 0; i < n; i++) {
+    c = ldb_versions_pick_level(vset, levels[i]);
 
-  ldb_version_ref(c->input_version);
+    /* A flush already holds a file number below that of the output. */
+    if (c == NULL && levels[i] == 0 && !flushing)
+      c = ldb_versions_pick_intra_l0(vset);
 
-  /* Files in level 0 may overlap each other,
-     so pick up all overlapping ones. */
-  if (level == 0) {
-    ldb_slice_t smallest, largest;
+    if (c != NULL)
+      return c;
+  }
 
-    ldb_versions_get_range(vset, &c->inputs[0], &smallest, &largest);
+  if (current->file_to_compact != NULL &&
+      !current->file_to_compact->being_compacted) {
+    int level = current->file_to_compact_level;
 
-    /* Note that the next call will discard the file we placed in
-       c->inputs[0] earlier and replace it with an overlapping set
-       which will include the picked file. */
-    ldb_version_get_overlapping_inputs(vset->current, 0,
-                                       &smallest, &largest,
-                                       &c->inputs[0]);
+    c = ldb_compaction_create(vset->options, level);
 
-    assert(c->inputs[0].length > 0);
+    ldb_vector_push(&c->inputs[0], current->file_to_compact);
+
+    c = ldb_versions_setup_inputs(vset, c, 0);
+
+    if (c != NULL)
+      return c;
   }
 
-  ldb_versions_setup_other_inputs(vset, c);
+  if (current->file_to_purge != NULL &&
+      !current->file_to_purge->being_compacted) {
+    int level = current->file_to_purge_level;
 
-  return c;
+    c = ldb_compaction_create(vset->options, level);
+
+    ldb_vector_push(&c->inputs[0], current->file_to_purge);
+
+    c = ldb_versions_setup_inputs(vset, c, 0);
+
+    if (c != NULL)
+      return c;
+  }
+
+  return ldb_versions_pick_periodic(vset);
 }
 
 ldb_compaction_t *
 ldb_versions_compact_range(ldb_versions_t *vset,
                            int level,
                            const ldb_ikey_t *begin,
-                           const ldb_ikey_t *end) {
+                           const ldb_ikey_t *end,
+                           int *busy) {
   ldb_vector_t inputs;
   ldb_compaction_t *c;
 
+  *busy = 0;
+
+  /* Moving files out of level-0 would hide them from FIFO deletion. */
+  if (vset->options->compaction_style == LDB_COMPACTION_FIFO)
+    return NULL;
+
   ldb_vector_init(&inputs);
 
   ldb_version_get_overlapping_inputs(vset->current, level, begin, end, &inputs);
@@ -2146,10 +4601,21 @@ ldb_versions_compact_range(ldb_versions_t *vset,
   ldb_version_ref(c->input_version);
 
   ldb_vector_swap(&c->inputs[0], &inputs);
+  ldb_vector_clear(&inputs);
 
   ldb_versions_setup_other_inputs(vset, c);
 
-  ldb_vector_clear(&inputs);
+  /* Another part of a manual compaction may hold some of the files. */
+  if (ldb_compaction_is_busy(c)) {
+    ldb_version_unref(c->input_version);
+    c->input_version = NULL;
+    ldb_compaction_destroy(c);
+    *busy = 1;
+    return NULL;
+  }
+
+  ldb_versions_advance_pointer(vset, c);
+  ldb_compaction_mark_inputs(c, 1);
 
   return c;
 }
@@ -2169,13 +4635,52 @@ ldb_inputiter_create(ldb_versions_t *vset, ldb_compaction_t *c) {
 
   options.verify_checksums = vset->options->paranoid_checks;
   options.fill_cache = 0;
+  options.readahead_size = vset->options->compaction_readahead_size;
+  options.rate_limited = 1;
 
   /* Level-0 files have to be merged together. For other levels,
      we will make a concatenating iterator per level. */
   space = (c->level == 0 ? c->inputs[0].length + 1 : 2);
+
+  if (c->tiered)
+    space = c->level0_inputs + LDB_MAX_LEVELS;
+
   list = ldb_malloc(space * sizeof(ldb_iter_t *));
 
-  for (which = 0; which < 2; which++) {
+  if (c->tiered) {
+    int level;
+
+    /* A table iterator per level-0 file, then one per level. */
+    for (i = 0; i < c->level0_inputs; i++) {
+      const ldb_filemeta_t *file = c->inputs[0].items[i];
+
+      list[num++] = ldb_tables_iterate(vset->table_cache,
+                                       &options,
+                                       file->number,
+                                       file->file_size,
+                                       file->path_id,
+                                       0,
+                                       file->global_sequence,
+                                       NULL);
+    }
+
+    for (level = LDB_MAX(c->level, 1); level <= c->output_level; level++) {
+      ldb_vector_t *files = &c->input_version->files[level];
+
+      if (files->length == 0)
+        continue;
+
+      if (level == c->output_level && c->inputs[1].length == 0)
+        break;
+
+      list[num++] = ldb_twoiter_create(ldb_numiter_create(&vset->icmp, files),
+                                       &get_file_iterator,
+                                       vset->table_cache,
+                                       &options);
+    }
+  }
+
+  for (which = 0; which < 2 && !c->tiered; which++) {
     if (c->inputs[which].length > 0) {
       if (c->level + which == 0) {
         const ldb_vector_t *files = &c->inputs[which];
@@ -2187,6 +4692,9 @@ ldb_inputiter_create(ldb_versions_t *vset, ldb_compaction_t *c) {
                                            &options,
                                            file->number,
                                            file->file_size,
+                                           file->path_id,
+                                           0,
+                                           file->global_sequence,
                                            NULL);
         }
       } else {
@@ -2220,13 +4728,18 @@ ldb_compaction_init(ldb_compaction_t *c,
   int i;
 
   c->level = level;
-  c->max_output_file_size = max_file_size_for_level(options, level);
+  c->output_level = level + 1;
+  c->tiered = 0;
+  c->level0_inputs = 0;
+  c->deletion = 0;
+  c->periodic = 0;
+  c->max_output_file_size = max_file_size_for_level(options, level + 1);
   c->input_version = NULL;
   c->grandparent_index = 0;
   c->seen_key = 0;
   c->overlapped_bytes = 0;
 
-  for (i = 0; i < LDB_NUM_LEVELS; i++)
+  for (i = 0; i < LDB_MAX_LEVELS; i++)
     c->level_ptrs[i] = 0;
 
   ldb_edit_init(&c->edit);
@@ -2237,8 +4750,10 @@ ldb_compaction_init(ldb_compaction_t *c,
 
 static void
 ldb_compaction_clear(ldb_compaction_t *c) {
-  if (c->input_version != NULL)
+  if (c->input_version != NULL) {
+    ldb_compaction_mark_inputs(c, 0);
     ldb_version_unref(c->input_version);
+  }
 
   ldb_edit_clear(&c->edit);
   ldb_vector_clear(&c->inputs[0]);
@@ -2259,17 +4774,68 @@ ldb_compaction_destroy(ldb_compaction_t *c) {
   ldb_free(c);
 }
 
+/* Whether no two of the files share a user key. */
+static int
+files_disjoint(const ldb_comparator_t *ucmp, const ldb_vector_t *files) {
+  size_t i, j;
+
+  for (i = 0; i < files->length; i++) {
+    const ldb_filemeta_t *x = files->items[i];
+    ldb_slice_t x_start = ldb_ikey_user_key(&x->smallest);
+    ldb_slice_t x_limit = ldb_ikey_user_key(&x->largest);
+
+    for (j = i + 1; j < files->length; j++) {
+      const ldb_filemeta_t *y = files->items[j];
+      ldb_slice_t y_start = ldb_ikey_user_key(&y->smallest);
+      ldb_slice_t y_limit = ldb_ikey_user_key(&y->largest);
+
+      if (ldb_compare(ucmp, &x_limit, &y_start) >= 0 &&
+          ldb_compare(ucmp, &y_limit, &x_start) >= 0) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
 int
 ldb_compaction_is_trivial_move(const ldb_compaction_t *c) {
   const ldb_versions_t *vset = c->input_version->vset;
+  size_t i;
+
+  if (c->output_level <= c->level)
+    return 0;
+
+  if (c->inputs[0].length == 0 || c->inputs[1].length != 0)
+    return 0;
+
+  /* Several files move together only if they were picked as a run
+     (see ldb_versions_expand_move()). Level-0 files must not overlap
+     one another once they reach a sorted level. */
+  if (c->inputs[0].length > 1) {
+    if (c->tiered)
+      return 0;
+
+    if (c->level == 0 &&
+        !files_disjoint(vset->icmp.user_comparator, &c->inputs[0])) {
+      return 0;
+    }
+  }
+
+  for (i = 0; i < c->inputs[0].length; i++) {
+    const ldb_filemeta_t *f = c->inputs[0].items[i];
+
+    /* A file can only be moved within the directory it is in. */
+    if (f->path_id != ldb_level_path_id(vset->options, c->output_level))
+      return 0;
+  }
 
   /* Avoid a move if there is lots of overlapping grandparent data.
      Otherwise, the move could create a parent file that will require
      a very expensive merge later on. */
-  return c->inputs[0].length == 1 &&
-         c->inputs[1].length == 0 &&
-         total_file_size(&c->grandparents) <=
-           max_grandparent_overlap_bytes(vset->options);
+  return total_file_size(&c->grandparents) <=
+         max_grandparent_overlap_bytes(vset->options);
 }
 
 void
@@ -2277,11 +4843,38 @@ ldb_compaction_add_input_deletions(ldb_compaction_t *c, ldb_edit_t *edit) {
   int which;
   size_t i;
 
+  if (c->tiered) {
+    int level;
+
+    for (i = 0; i < c->level0_inputs; i++) {
+      const ldb_filemeta_t *file = c->inputs[0].items[i];
+
+      ldb_edit_remove_file(edit, 0, file->number);
+    }
+
+    /* The remaining inputs are whole levels. */
+    for (level = LDB_MAX(c->level, 1); level <= c->output_level; level++) {
+      const ldb_vector_t *files = &c->input_version->files[level];
+
+      if (level == c->output_level && c->inputs[1].length == 0)
+        break;
+
+      for (i = 0; i < files->length; i++) {
+        const ldb_filemeta_t *file = files->items[i];
+
+        ldb_edit_remove_file(edit, level, file->number);
+      }
+    }
+
+    return;
+  }
+
   for (which = 0; which < 2; which++) {
     for (i = 0; i < c->inputs[which].length; i++) {
       const ldb_filemeta_t *file = c->inputs[which].items[i];
 
-      ldb_edit_remove_file(edit, c->level + which, file->number);
+      ldb_edit_remove_file(edit, which ? c->output_level : c->level,
+                                 file->number);
     }
   }
 }
@@ -2294,7 +4887,11 @@ ldb_compaction_is_base_level_for_key(ldb_compaction_t *c,
   const ldb_comparator_t *user_cmp = vset->icmp.user_comparator;
   int lvl;
 
-  for (lvl = c->level + 2; lvl < LDB_NUM_LEVELS; lvl++) {
+  /* Older level-0 files may lie outside the inputs. */
+  if (c->output_level == 0)
+    return 0;
+
+  for (lvl = c->output_level + 1; lvl < vset->options->num_levels; lvl++) {
     ldb_vector_t *files = &c->input_version->files[lvl];
 
     while (c->level_ptrs[lvl] < files->length) {
@@ -2320,11 +4917,32 @@ ldb_compaction_is_base_level_for_key(ldb_compaction_t *c,
   return 1;
 }
 
+int
+ldb_compaction_is_base_level_for_range(ldb_compaction_t *c,
+                                       const ldb_slice_t *start,
+                                       const ldb_slice_t *end) {
+  const ldb_versions_t *vset = c->input_version->vset;
+  int lvl;
+
+  if (c->output_level == 0)
+    return 0;
+
+  for (lvl = c->output_level + 1; lvl < vset->options->num_levels; lvl++) {
+    if (ldb_version_overlap_in_level(c->input_version, lvl, start, end))
+      return 0;
+  }
+
+  return 1;
+}
+
 int
 ldb_compaction_should_stop_before(ldb_compaction_t *c,
-                                  const ldb_slice_t *ikey) {
+                                  const ldb_slice_t *ikey,
+                                  uint64_t output_size) {
   const ldb_versions_t *vset = c->input_version->vset;
   const ldb_comparator_t *icmp = &vset->icmp;
+  int64_t max_overlap = 10 * (int64_t)c->max_output_file_size;
+  int crossed = 0;
 
   /* Scan to find earliest grandparent file that contains key. */
   while (c->grandparent_index < c->grandparents.length) {
@@ -2333,26 +4951,185 @@ ldb_compaction_should_stop_before(ldb_compaction_t *c,
     if (ldb_compare(icmp, ikey, &f->largest) <= 0)
       break;
 
-    if (c->seen_key)
+    if (c->seen_key) {
       c->overlapped_bytes += f->file_size;
+      crossed = 1;
+    }
 
     c->grandparent_index++;
   }
 
   c->seen_key = 1;
 
-  if (c->overlapped_bytes > max_grandparent_overlap_bytes(vset->options)) {
+  /* As max_grandparent_overlap_bytes(), for outputs of this size. */
+  if (c->overlapped_bytes > max_overlap) {
     /* Too much overlap for current output; start new output. */
     c->overlapped_bytes = 0;
     return 1;
   }
 
+  /* The key lies past a grandparent file which the current output
+     overlaps: end the output with that file if it is big enough. */
+  if (crossed && vset->options->align_compaction_outputs &&
+      output_size >= c->max_output_file_size / 2) {
+    c->overlapped_bytes = 0;
+    return 1;
+  }
+
   return 0;
 }
 
+uint64_t
+ldb_compaction_creation_time(const ldb_compaction_t *c) {
+  uint64_t oldest = 0;
+  int which;
+  size_t i;
+
+  if (c->periodic)
+    return ldb_now_usec() / 1000000;
+
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      const ldb_filemeta_t *f = c->inputs[which].items[i];
+
+      if (f->creation_time != 0 && (oldest == 0 || f->creation_time < oldest))
+        oldest = f->creation_time;
+    }
+  }
+
+  if (oldest == 0)
+    oldest = ldb_now_usec() / 1000000;
+
+  return oldest;
+}
+
+uint64_t
+ldb_compaction_input_offset(const ldb_compaction_t *c,
+                            const ldb_slice_t *ikey) {
+  ldb_versions_t *vset = c->input_version->vset;
+  uint64_t result = 0;
+  int which;
+  size_t i;
+
+  for (which = 0; which < 2; which++) {
+    int level = (which == 0 ? c->level : c->output_level);
+
+    for (i = 0; i < c->inputs[which].length; i++) {
+      const ldb_filemeta_t *file = c->inputs[which].items[i];
+
+      if (ldb_compare(&vset->icmp, &file->largest, ikey) <= 0) {
+        result += file->file_size;
+      } else if (ldb_compare(&vset->icmp, &file->smallest, ikey) <= 0) {
+        ldb_table_t *tableptr;
+        ldb_iter_t *iter;
+
+        iter = ldb_tables_iterate(vset->table_cache,
+                                  ldb_readopt_default,
+                                  file->number,
+                                  file->file_size,
+                                  file->path_id,
+                                  level,
+                                  file->global_sequence,
+                                  &tableptr);
+
+        if (tableptr != NULL)
+          result += ldb_table_approximate_offset(tableptr, ikey);
+
+        ldb_iter_destroy(iter);
+      }
+    }
+  }
+
+  return result;
+}
+
+ldb_compaction_t *
+ldb_compaction_fork(const ldb_compaction_t *c) {
+  const ldb_versions_t *vset = c->input_version->vset;
+  ldb_compaction_t *sub = ldb_compaction_create(vset->options, c->level);
+
+  sub->output_level = c->output_level;
+  sub->max_output_file_size = c->max_output_file_size;
+  sub->input_version = c->input_version;
+
+  ldb_version_ref(sub->input_version);
+
+  ldb_vector_copy(&sub->grandparents, &c->grandparents);
+
+  return sub;
+}
+
+void
+ldb_compaction_split_points(const ldb_compaction_t *c,
+                            int max_parts,
+                            ldb_vector_t *result) {
+  const ldb_versions_t *vset = c->input_version->vset;
+  const ldb_comparator_t *user_cmp = vset->icmp.user_comparator;
+  ldb_vector_t bounds; /* ldb_filemeta_t */
+  size_t i, j, k, step;
+  int which;
+
+  ldb_vector_reset(result);
+
+  if (max_parts <= 1)
+    return;
+
+  ldb_vector_init(&bounds);
+
+  /* Collect the distinct largest user keys of all inputs in order.
+     Level-0 inputs may be unsorted, hence the insertion sort. */
+  for (which = 0; which < 2; which++) {
+    for (i = 0; i < c->inputs[which].length; i++) {
+      ldb_filemeta_t *f = c->inputs[which].items[i];
+      ldb_slice_t key = ldb_ikey_user_key(&f->largest);
+      int cmp = 1;
+
+      for (j = bounds.length; j > 0; j--) {
+        const ldb_filemeta_t *x = bounds.items[j - 1];
+        ldb_slice_t xkey = ldb_ikey_user_key(&x->largest);
+
+        cmp = ldb_compare(user_cmp, &key, &xkey);
+
+        if (cmp >= 0)
+          break;
+      }
+
+      if (cmp == 0)
+        continue;
+
+      ldb_vector_push(&bounds, f);
+
+      for (k = bounds.length - 1; k > j; k--)
+        bounds.items[k] = bounds.items[k - 1];
+
+      bounds.items[j] = f;
+    }
+  }
+
+  /* The largest key is the end of the last range. */
+  if (bounds.length > 0)
+    bounds.length--;
+
+  /* Spread the split points evenly over the file boundaries. */
+  step = (bounds.length + max_parts - 1) / max_parts;
+
+  if (step == 0)
+    step = 1;
+
+  for (i = step - 1; i < bounds.length; i += step) {
+    if (result->length + 1 >= (size_t)max_parts)
+      break;
+
+    ldb_vector_push(result, bounds.items[i]);
+  }
+
+  ldb_vector_clear(&bounds);
+}
+
 void
 ldb_compaction_release_inputs(ldb_compaction_t *c) {
   if (c->input_version != NULL) {
+    ldb_compaction_mark_inputs(c, 0);
     ldb_version_unref(c->input_version);
     c->input_version = NULL;
   }
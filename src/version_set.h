@@ -25,11 +25,21 @@
 #include "dbformat.h"
 #include "version_edit.h"
 
+/*
+ * Constants
+ */
+
+/* Size of the scratch buffer passed to ldb_versions_summary. */
+#define LDB_SUMMARY_SIZE (16 + LDB_MAX_LEVELS * 11)
+
 /*
  * Types
  */
 
 struct ldb_iter_s;
+struct ldb_l0index_s;
+struct ldb_mergectx_s;
+struct ldb_pinned_s;
 struct ldb_writer_s;
 struct ldb_tables_s;
 struct ldb_wfile_s;
@@ -50,17 +60,40 @@ struct ldb_version_s {
   int refs;             /* Number of live refs to this version. */
 
   /* List of files per level. */
-  ldb_vector_t files[LDB_NUM_LEVELS]; /* ldb_filemeta_t[] */
+  ldb_vector_t files[LDB_MAX_LEVELS]; /* ldb_filemeta_t[] */
+
+  /* Reference count of files[level] when it is shared with
+     other versions (copy-on-write), or NULL if it is not. */
+  int *level_refs[LDB_MAX_LEVELS];
 
   /* Next file to compact based on seek stats. */
   ldb_filemeta_t *file_to_compact;
   int file_to_compact_level;
 
+  /* File most dense in deletions, if over deletion_compaction_ratio.
+     Initialized by finalize(). */
+  ldb_filemeta_t *file_to_purge;
+  int file_to_purge_level;
+
   /* Level that should be compacted next and its compaction score.
      Score < 1 means compaction is not strictly needed. These fields
      are initialized by finalize(). */
   double compaction_score;
   int compaction_level;
+
+  /* Target size of each level and the level level-0 compacts into.
+     Fixed unless level_compaction_dynamic_level_bytes is set. */
+  double level_max_bytes[LDB_MAX_LEVELS];
+  int base_level;
+
+  /* The level-0 files overlapping each user key, newest first (NULL
+     if not built). Initialized by finalize(). */
+  struct ldb_l0index_s *l0_index;
+
+  /* For each file above level-0, the search range of a lookup in the
+     next non-empty level (NULL if not built), shared with versions
+     holding the same files in both. Initialized by finalize(). */
+  struct ldb_cascade_s *cascade[LDB_MAX_LEVELS];
 };
 
 struct ldb_versions_s {
@@ -77,25 +110,56 @@ struct ldb_versions_s {
   /* Opened lazily. */
   struct ldb_wfile_s *descriptor_file;
   struct ldb_writer_s *descriptor_log;
+  uint64_t manifest_size; /* Approximate bytes in descriptor_log. */
+
+  /* MANIFEST records replayed by recover() and the time it took. */
+  uint64_t recover_records;
+  int64_t recover_micros;
+
+  /* WAL block size recorded in the descriptor (0 if none). */
+  uint32_t log_block_size;
+
   ldb_version_t dummy_versions; /* Circular doubly-linked list of versions. */
   ldb_version_t *current;       /* == dummy_versions.prev */
 
   /* Per-level key at which the next compaction at that level should start.
      Either an empty string, or a valid InternalKey. */
-  ldb_buffer_t compact_pointer[LDB_NUM_LEVELS];
+  ldb_buffer_t compact_pointer[LDB_MAX_LEVELS];
+
+  /* Threads waiting in apply(). Once no group is being written, the
+     first of them takes the whole queue and writes its edits as one
+     group, under a single sync; the others wait on manifest_cv. */
+  ldb_vector_t manifest_queue; /* (ldb_mwaiter_t *) */
+  int manifest_busy;
+  ldb_cond_t manifest_cv;
 };
 
 struct ldb_compaction_s {
   int level;
+  int output_level; /* level + 1, the base level for level-0, or level
+                       for level-0 merged into itself. */
   uint64_t max_output_file_size;
   ldb_version_t *input_version;
   ldb_edit_t edit;
 
-  /* Each compaction reads inputs from "level" and "level+1". */
+  /* Each compaction reads inputs from "level" and "output_level". */
   ldb_vector_t inputs[2]; /* The two sets of inputs. */
 
+  /* Universal compactions take whole sorted runs: inputs[0] then holds
+     the level-0 files first (level0_inputs of them), followed by every
+     file of each level between "level" and "output_level". */
+  int tiered;
+  size_t level0_inputs;
+
+  /* FIFO compactions delete inputs[0] without reading or writing. */
+  int deletion;
+
+  /* Triggered by the age of its input (periodic_compaction_seconds).
+     The last level is then rewritten in place (output_level == level). */
+  int periodic;
+
   /* State used to check for number of overlapping grandparent files
-     (parent == level + 1, grandparent == level + 2) */
+     (parent == output_level, grandparent == output_level + 1) */
   ldb_vector_t grandparents;
   size_t grandparent_index;   /* Index in grandparent_starts. */
   int seen_key;               /* Some output key has been seen. */
@@ -107,8 +171,8 @@ struct ldb_compaction_s {
   /* level_ptrs holds indices into input_version->levels: our state
      is that we are positioned at one of the file ranges for each
      higher level than the ones involved in this compaction (i.e. for
-     all L >= level + 2). */
-  size_t level_ptrs[LDB_NUM_LEVELS];
+     all L > output_level). */
+  size_t level_ptrs[LDB_MAX_LEVELS];
 };
 
 /*
@@ -139,6 +203,11 @@ some_file_overlaps_range(const ldb_comparator_t *icmp,
                          const ldb_slice_t *smallest_user_key,
                          const ldb_slice_t *largest_user_key);
 
+/* Return the index into db_paths of the directory new tables
+   at "level" are written to. */
+int
+ldb_level_path_id(const ldb_dbopt_t *options, int level);
+
 /*
  * Version
  */
@@ -157,15 +226,52 @@ ldb_version_add_iterators(ldb_version_t *ver,
                           const ldb_readopt_t *options,
                           ldb_vector_t *iters);
 
-/* Lookup the value for key. If found, store it in *val and
-   return OK. Else return a non-OK status. Fills *stats. */
+/* As above, but a level-0 file whose number is in *numbers reuses the
+   iterator at the same index of *tables (left by an earlier call)
+   rather than opening a new one. On return, *numbers and *tables list
+   the level-0 iterators which were added. Iterators not reused are
+   left to the caller. */
+void
+ldb_version_readd_iterators(ldb_version_t *ver,
+                            const ldb_readopt_t *options,
+                            ldb_vector_t *iters,
+                            ldb_array_t *numbers,
+                            ldb_vector_t *tables);
+
+/* Lookup the value for key. If found, store it in *val (or point
+   *pin at it, if non-null and no merging is needed) and return OK.
+   Else return a non-OK status. Fills *stats. Merge
+   operands found on the way (and those already in *merge) are
+   applied to the value beneath them. */
 /* REQUIRES: lock is not held */
 int
 ldb_version_get(ldb_version_t *ver,
                 const ldb_readopt_t *options,
                 const ldb_lkey_t *k,
                 ldb_buffer_t *value,
-                ldb_getstats_t *stats);
+                struct ldb_pinned_s *pin,
+                ldb_getstats_t *stats,
+                struct ldb_mergectx_s *merge);
+
+/* Batched form of ldb_version_get. Looks up keys[0..count-1], storing
+   each result in statuses[i] (and *values[i] if found) and filling
+   stats[i]. Entries of values may be NULL. Keys should be sorted so
+   that files and data blocks can be shared between lookups. */
+/* REQUIRES: lock is not held */
+void
+ldb_version_multiget(ldb_version_t *ver,
+                     const ldb_readopt_t *options,
+                     const ldb_lkey_t **keys,
+                     ldb_buffer_t **values,
+                     int *statuses,
+                     ldb_getstats_t *stats,
+                     size_t count);
+
+/* Charges the seek recorded in "stats" to its file. Needs no lock.
+   Returns true if the file has run out of seeks, in which case
+   "stats" should be passed to ldb_version_update_stats(). */
+int
+ldb_version_charge_seek(const ldb_getstats_t *stats);
 
 /* Adds "stats" into the current state. Returns true if a new
    compaction may need to be triggered, false otherwise. */
@@ -175,10 +281,27 @@ ldb_version_update_stats(ldb_version_t *ver, const ldb_getstats_t *stats);
 
 /* Record a sample of bytes read at the specified internal key.
    Samples are taken approximately once every LDB_READ_BYTES_PERIOD
-   bytes. Returns true if a new compaction may need to be triggered. */
+   bytes. Needs no lock: the seek is charged as by
+   ldb_version_charge_seek(), whose result is returned. */
+int
+ldb_version_record_read_sample(ldb_version_t *ver,
+                               const ldb_slice_t *ikey,
+                               ldb_getstats_t *stats);
+
+/* Record a long run of deleted entries found by an iterator at the
+   specified internal key: the newest table covering the key is picked
+   for compaction. Returns true if a new compaction may need to be
+   triggered. */
 /* REQUIRES: lock is held */
 int
-ldb_version_record_read_sample(ldb_version_t *ver, const ldb_slice_t *ikey);
+ldb_version_record_deletions(ldb_version_t *ver, const ldb_slice_t *ikey);
+
+/* Append to *result the files which may hold the user key of the
+   internal key "ikey", in the order a lookup searches them. */
+void
+ldb_version_overlapping(ldb_version_t *ver,
+                        const ldb_slice_t *ikey,
+                        ldb_vector_t *result);
 
 /* Reference count management (so Versions do not disappear out from
    under live iterators). */
@@ -244,9 +367,11 @@ ldb_versions_needs_compaction(const ldb_versions_t *vset);
 
 /* Apply *edit to the current version to form a new descriptor that
    is both saved to persistent state and installed as the new
-   current version. Will release *mu while actually writing to the file. */
+   current version. Will release *mu while actually writing to the file.
+   Concurrent callers are grouped: edits queued while a MANIFEST write
+   is in progress are written together by the next caller, applied in
+   order to a single new version, with one sync for the whole group. */
 /* REQUIRES: *mu is held on entry. */
-/* REQUIRES: no other thread concurrently calls apply() */
 int
 ldb_versions_apply(ldb_versions_t *vset, ldb_edit_t *edit, ldb_mutex_t *mu);
 
@@ -254,6 +379,13 @@ ldb_versions_apply(ldb_versions_t *vset, ldb_edit_t *edit, ldb_mutex_t *mu);
 int
 ldb_versions_recover(ldb_versions_t *vset, int *save_manifest);
 
+/* Re-read the descriptor named by CURRENT without taking ownership of
+   it, installing the state it describes as the current version. Used
+   by read-only instances to follow a database being written by another
+   process. */
+int
+ldb_versions_reload(ldb_versions_t *vset);
+
 /* Mark the specified file number as used. */
 void
 ldb_versions_mark_file_number(ldb_versions_t *vset, uint64_t number);
@@ -262,6 +394,12 @@ ldb_versions_mark_file_number(ldb_versions_t *vset, uint64_t number);
 int
 ldb_versions_files(const ldb_versions_t *vset, int level);
 
+/* Recompute the level targets and compaction score of the current
+   version after a change to the options. */
+/* REQUIRES: lock is held */
+void
+ldb_versions_refresh(ldb_versions_t *vset);
+
 /* Return a human-readable short (single-line) summary of the number
    of files per level. Uses *scratch as backing store. */
 const char *
@@ -274,11 +412,42 @@ ldb_versions_approximate_offset(ldb_versions_t *vset,
                                 ldb_version_t *v,
                                 const ldb_ikey_t *ikey);
 
+/* Return the approximate size of the data in ["start", "limit") as
+   of version "v", judged from the boundaries of its files alone. No
+   table is opened: a file which the range only partly overlaps is
+   counted as half its size. */
+uint64_t
+ldb_versions_approximate_size(ldb_versions_t *vset,
+                              ldb_version_t *v,
+                              const ldb_ikey_t *start,
+                              const ldb_ikey_t *limit);
+
+/* Push onto *result (as allocated ldb_buffer_t's) up to n - 1 user
+   keys, in increasing order, which split the table data of version
+   "v" into n ranges of about equal size. The index blocks of the
+   tables are read to find them; the memtables are not considered. */
+int
+ldb_versions_split_keys(ldb_versions_t *vset,
+                        ldb_version_t *v,
+                        size_t n,
+                        ldb_vector_t *result);
+
 /* Add all files listed in any live version to *live.
    May also mutate some internal state. */
 void
 ldb_versions_add_files(ldb_versions_t *vset, rb_set64_t *live);
 
+/* Return the oldest blob file referenced by a file of any live
+   version (zero if there are none). Blob files from there on may
+   still be in use. */
+uint64_t
+ldb_versions_oldest_blob(ldb_versions_t *vset);
+
+/* Export a descriptor record describing the current version in full
+   (the first record of a new MANIFEST) to *record. */
+void
+ldb_versions_snapshot(ldb_versions_t *vset, ldb_buffer_t *record);
+
 /* Return the combined file size of all files at the specified level. */
 int64_t
 ldb_versions_bytes(const ldb_versions_t *vset, int level);
@@ -288,6 +457,23 @@ ldb_versions_bytes(const ldb_versions_t *vset, int level);
 int64_t
 ldb_versions_max_next_level_overlapping_bytes(ldb_versions_t *vset);
 
+/* The largest next-level overlap against the compaction size limit.
+   Above one, compactions are larger than they are meant to be. */
+double
+ldb_versions_pending_debt(ldb_versions_t *vset);
+
+/* Estimate the bytes compactions must rewrite to bring the level-0
+   file count and every level's size back under their targets. */
+int64_t
+ldb_versions_pending_bytes(ldb_versions_t *vset);
+
+/* Estimate how far compactions are behind: the level-0 file count
+   against the write slowdown trigger, or the largest next-level
+   overlap against the compaction size limit, whichever is worse.
+   One or more means writes are about to be slowed down. */
+double
+ldb_versions_compaction_debt(ldb_versions_t *vset);
+
 #define add_boundary_inputs ldb_add_boundary_inputs
 
 void
@@ -298,19 +484,26 @@ add_boundary_inputs(const ldb_comparator_t *icmp,
 /* Pick level and inputs for a new compaction.
    Returns NULL if there is no compaction to be done.
    Otherwise returns a pointer to a heap-allocated object that
-   describes the compaction. Caller should delete the result. */
+   describes the compaction. Caller should delete the result.
+   Files which are inputs to a running compaction are never picked,
+   so the result may run concurrently with any outstanding compaction.
+   Level-0 files are merged into a new level-0 file when level-0 cannot
+   be compacted, unless a memtable is "flushing". */
+/* REQUIRES: lock is held */
 ldb_compaction_t *
-ldb_versions_pick_compaction(ldb_versions_t *vset);
+ldb_versions_pick_compaction(ldb_versions_t *vset, int flushing);
 
 /* Return a compaction object for compacting the range [begin,end] in
    the specified level. Returns NULL if there is nothing in that
-   level that overlaps the specified range. Caller should delete
-   the result. */
+   level that overlaps the specified range. Also returns NULL, and
+   sets *busy, if some of the inputs are already being compacted.
+   Caller should delete the result. */
 ldb_compaction_t *
 ldb_versions_compact_range(ldb_versions_t *vset,
                            int level,
                            const ldb_ikey_t *begin,
-                           const ldb_ikey_t *end);
+                           const ldb_ikey_t *end,
+                           int *busy);
 
 /*
  * VersionSet::MakeInputIterator
@@ -347,14 +540,52 @@ int
 ldb_compaction_is_base_level_for_key(ldb_compaction_t *c,
                                      const ldb_slice_t *user_key);
 
-/* Returns true iff we should stop building the current output
-   before processing "internal_key". */
+/* Like is_base_level_for_key, but for the user key range [start,end].
+   Unlike is_base_level_for_key, the keys may be passed in any order. */
+int
+ldb_compaction_is_base_level_for_range(ldb_compaction_t *c,
+                                       const ldb_slice_t *start,
+                                       const ldb_slice_t *end);
+
+/* Returns true iff we should stop building the current output (of
+   "output_size" bytes so far) before processing "internal_key". */
 int
 ldb_compaction_should_stop_before(ldb_compaction_t *c,
-                                  const ldb_slice_t *ikey);
+                                  const ldb_slice_t *ikey,
+                                  uint64_t output_size);
+
+/* Creation time for the outputs of "c": that of its oldest input, so
+   data does not look younger for having been rewritten. Periodic
+   compactions are the exception, lest their outputs be due again. */
+uint64_t
+ldb_compaction_creation_time(const ldb_compaction_t *c);
+
+/* Return the approximate number of input bytes of "c" which sort
+   before "ikey" (for reporting the progress of the compaction). */
+uint64_t
+ldb_compaction_input_offset(const ldb_compaction_t *c,
+                            const ldb_slice_t *ikey);
+
+/* Create an input-less compaction with the same level, input version
+   and grandparents as "c", but with its own output state. Used to
+   compact disjoint key ranges of "c" in parallel. */
+/* REQUIRES: lock is held */
+ldb_compaction_t *
+ldb_compaction_fork(const ldb_compaction_t *c);
+
+/* Choose up to max_parts - 1 user keys at which to split the key range
+   of the compaction, taken from the largest keys of its input files.
+   The files holding the keys are stored in *result in increasing order.
+   Part i covers the user keys in (result[i - 1], result[i]]. */
+void
+ldb_compaction_split_points(const ldb_compaction_t *c,
+                            int max_parts,
+                            ldb_vector_t *result);
 
 /* Release the input version for the compaction, once the compaction
-   is successful. */
+   is successful. Also makes the input files available to other
+   compactions again. */
+/* REQUIRES: lock is held */
 void
 ldb_compaction_release_inputs(ldb_compaction_t *c);
 
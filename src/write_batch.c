@@ -31,7 +31,9 @@
  *    data: record[count]
  * record :=
  *    LDB_TYPE_VALUE varstring varstring |
- *    LDB_TYPE_DELETION varstring
+ *    LDB_TYPE_DELETION varstring |
+ *    LDB_TYPE_MERGE varstring varstring |
+ *    LDB_TYPE_RANGE_DELETION varstring varstring
  * varstring :=
  *    len: varint32
  *    data: uint8[len]
@@ -79,28 +81,31 @@ ldb_batch_reset(ldb_batch_t *batch) {
   memset(batch->rep.data, 0, LDB_HEADER);
 }
 
+void
+ldb_batch_reserve(ldb_batch_t *batch, size_t size) {
+  ldb_buffer_grow(&batch->rep, batch->rep.size + size);
+}
+
 size_t
 ldb_batch_approximate_size(const ldb_batch_t *batch) {
   return batch->rep.size;
 }
 
-int
-ldb_batch_iterate(const ldb_batch_t *batch, ldb_handler_t *handler) {
-  ldb_slice_t input = batch->rep;
+static int
+iterate_records(const ldb_slice_t *records,
+                ldb_handler_t *handler,
+                int *found) {
+  ldb_slice_t input = *records;
   ldb_slice_t key, value;
-  int found = 0;
 
-  if (input.size < LDB_HEADER)
-    return LDB_CORRUPTION; /* "malformed WriteBatch (too small)" */
-
-  ldb_slice_eat(&input, LDB_HEADER);
+  *found = 0;
 
   while (input.size > 0) {
     int tag = input.data[0];
 
     ldb_slice_eat(&input, 1);
 
-    found++;
+    (*found)++;
 
     switch (tag) {
       case LDB_TYPE_VALUE: {
@@ -124,12 +129,60 @@ ldb_batch_iterate(const ldb_batch_t *batch, ldb_handler_t *handler) {
         break;
       }
 
+      case LDB_TYPE_MERGE: {
+        if (!ldb_slice_slurp(&key, &input))
+          return LDB_CORRUPTION; /* "bad WriteBatch Merge" */
+
+        if (!ldb_slice_slurp(&value, &input))
+          return LDB_CORRUPTION; /* "bad WriteBatch Merge" */
+
+        if (handler->merge == NULL)
+          return LDB_NOSUPPORT; /* "WriteBatch Merge not supported" */
+
+        handler->merge(handler, &key, &value);
+
+        break;
+      }
+
+      case LDB_TYPE_RANGE_DELETION: {
+        if (!ldb_slice_slurp(&key, &input))
+          return LDB_CORRUPTION; /* "bad WriteBatch DeleteRange" */
+
+        if (!ldb_slice_slurp(&value, &input))
+          return LDB_CORRUPTION; /* "bad WriteBatch DeleteRange" */
+
+        if (handler->del_range == NULL)
+          return LDB_NOSUPPORT; /* "WriteBatch DeleteRange not supported" */
+
+        handler->del_range(handler, &key, &value);
+
+        break;
+      }
+
       default: {
         return LDB_CORRUPTION; /* "unknown WriteBatch tag" */
       }
     }
   }
 
+  return LDB_OK;
+}
+
+int
+ldb_batch_iterate(const ldb_batch_t *batch, ldb_handler_t *handler) {
+  ldb_slice_t input = batch->rep;
+  int found, rc;
+
+  if (input.size < LDB_HEADER)
+    return LDB_CORRUPTION; /* "malformed WriteBatch (too small)" */
+
+  ldb_slice_eat(&input, LDB_HEADER);
+
+  rc = iterate_records(&input, handler, &found);
+
+  if (rc != LDB_OK)
+    return rc;
+
   if (found != ldb_batch_count(batch))
     return LDB_CORRUPTION; /* "WriteBatch has wrong count" */
 
@@ -173,6 +226,26 @@ ldb_batch_del(ldb_batch_t *batch, const ldb_slice_t *key) {
   ldb_slice_export(&batch->rep, key);
 }
 
+void
+ldb_batch_merge(ldb_batch_t *batch,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value) {
+  ldb_batch_set_count(batch, ldb_batch_count(batch) + 1);
+  ldb_buffer_push(&batch->rep, LDB_TYPE_MERGE);
+  ldb_slice_export(&batch->rep, key);
+  ldb_slice_export(&batch->rep, value);
+}
+
+void
+ldb_batch_del_range(ldb_batch_t *batch,
+                    const ldb_slice_t *start,
+                    const ldb_slice_t *end) {
+  ldb_batch_set_count(batch, ldb_batch_count(batch) + 1);
+  ldb_buffer_push(&batch->rep, LDB_TYPE_RANGE_DELETION);
+  ldb_slice_export(&batch->rep, start);
+  ldb_slice_export(&batch->rep, end);
+}
+
 void
 ldb_batch_append(ldb_batch_t *dst, const ldb_batch_t *src) {
   assert(src->rep.size >= LDB_HEADER);
@@ -206,6 +279,30 @@ memtable_del(ldb_handler_t *handler, const ldb_slice_t *key) {
   handler->number++;
 }
 
+static void
+memtable_merge(ldb_handler_t *handler,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value) {
+  ldb_memtable_t *table = handler->state;
+  ldb_seqnum_t seq = handler->number;
+
+  ldb_memtable_add(table, seq, LDB_TYPE_MERGE, key, value);
+
+  handler->number++;
+}
+
+static void
+memtable_del_range(ldb_handler_t *handler,
+                   const ldb_slice_t *start,
+                   const ldb_slice_t *end) {
+  ldb_memtable_t *table = handler->state;
+  ldb_seqnum_t seq = handler->number;
+
+  ldb_memtable_add(table, seq, LDB_TYPE_RANGE_DELETION, start, end);
+
+  handler->number++;
+}
+
 int
 ldb_batch_insert_into(const ldb_batch_t *batch, ldb_memtable_t *table) {
   ldb_handler_t handler;
@@ -214,10 +311,181 @@ ldb_batch_insert_into(const ldb_batch_t *batch, ldb_memtable_t *table) {
   handler.number = ldb_batch_sequence(batch);
   handler.put = memtable_put;
   handler.del = memtable_del;
+  handler.merge = memtable_merge;
+  handler.del_range = memtable_del_range;
 
   return ldb_batch_iterate(batch, &handler);
 }
 
+static void
+memtable_put_concurrently(ldb_handler_t *handler,
+                          const ldb_slice_t *key,
+                          const ldb_slice_t *value) {
+  ldb_memtable_t *table = handler->state;
+  ldb_seqnum_t seq = handler->number;
+
+  ldb_memtable_add_concurrently(table, seq, LDB_TYPE_VALUE, key, value);
+
+  handler->number++;
+}
+
+static void
+memtable_del_concurrently(ldb_handler_t *handler, const ldb_slice_t *key) {
+  static const ldb_slice_t value = {NULL, 0, 0};
+  ldb_memtable_t *table = handler->state;
+  ldb_seqnum_t seq = handler->number;
+
+  ldb_memtable_add_concurrently(table, seq, LDB_TYPE_DELETION, key, &value);
+
+  handler->number++;
+}
+
+static void
+memtable_merge_concurrently(ldb_handler_t *handler,
+                            const ldb_slice_t *key,
+                            const ldb_slice_t *value) {
+  ldb_memtable_t *table = handler->state;
+  ldb_seqnum_t seq = handler->number;
+
+  ldb_memtable_add_concurrently(table, seq, LDB_TYPE_MERGE, key, value);
+
+  handler->number++;
+}
+
+static void
+memtable_del_range_concurrently(ldb_handler_t *handler,
+                                const ldb_slice_t *start,
+                                const ldb_slice_t *end) {
+  ldb_memtable_t *table = handler->state;
+  ldb_seqnum_t seq = handler->number;
+
+  ldb_memtable_add_concurrently(table, seq, LDB_TYPE_RANGE_DELETION,
+                                start, end);
+
+  handler->number++;
+}
+
+int
+ldb_batch_insert_concurrently(const ldb_batch_t *batch,
+                              ldb_memtable_t *table) {
+  ldb_handler_t handler;
+
+  handler.state = table;
+  handler.number = ldb_batch_sequence(batch);
+  handler.put = memtable_put_concurrently;
+  handler.del = memtable_del_concurrently;
+  handler.merge = memtable_merge_concurrently;
+  handler.del_range = memtable_del_range_concurrently;
+
+  return ldb_batch_iterate(batch, &handler);
+}
+
+typedef struct splitter_s {
+  ldb_batchpart_t *parts;
+  int max;
+  int length;
+  size_t target;
+  const uint8_t *end; /* End of the last record seen. */
+} splitter_t;
+
+static void
+splitter_add(ldb_handler_t *handler, const ldb_slice_t *last) {
+  splitter_t *sp = handler->state;
+  ldb_batchpart_t *part = &sp->parts[sp->length];
+
+  sp->end = last->data + last->size;
+
+  part->count++;
+
+  handler->number++;
+
+  /* Close the run once it is big enough, unless it is the last. */
+  if ((size_t)(sp->end - part->data.data) >= sp->target
+      && sp->length + 1 < sp->max) {
+    part->data.size = sp->end - part->data.data;
+
+    part = &sp->parts[++sp->length];
+
+    ldb_slice_set(&part->data, sp->end, 0);
+
+    part->sequence = handler->number;
+    part->count = 0;
+  }
+}
+
+static void
+splitter_put(ldb_handler_t *handler,
+             const ldb_slice_t *key,
+             const ldb_slice_t *value) {
+  (void)key;
+  splitter_add(handler, value);
+}
+
+static void
+splitter_del(ldb_handler_t *handler, const ldb_slice_t *key) {
+  splitter_add(handler, key);
+}
+
+int
+ldb_batch_split(const ldb_batch_t *batch,
+                ldb_batchpart_t *parts,
+                int max,
+                int *length) {
+  ldb_handler_t handler;
+  splitter_t sp;
+  int rc;
+
+  assert(max > 0);
+
+  if (batch->rep.size < LDB_HEADER)
+    return LDB_CORRUPTION; /* "malformed WriteBatch (too small)" */
+
+  sp.parts = parts;
+  sp.max = max;
+  sp.length = 0;
+  sp.target = (batch->rep.size - LDB_HEADER) / max + 1;
+  sp.end = batch->rep.data + LDB_HEADER;
+
+  ldb_slice_set(&parts[0].data, sp.end, 0);
+
+  parts[0].sequence = ldb_batch_sequence(batch);
+  parts[0].count = 0;
+
+  handler.state = &sp;
+  handler.number = parts[0].sequence;
+  handler.put = splitter_put;
+  handler.del = splitter_del;
+  handler.merge = splitter_put;
+  handler.del_range = splitter_put;
+
+  rc = ldb_batch_iterate(batch, &handler);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  parts[sp.length].data.size = sp.end - parts[sp.length].data.data;
+
+  *length = sp.length + (parts[sp.length].count > 0);
+
+  return LDB_OK;
+}
+
+int
+ldb_batchpart_insert_concurrently(const ldb_batchpart_t *part,
+                                  ldb_memtable_t *table) {
+  ldb_handler_t handler;
+  int found;
+
+  handler.state = table;
+  handler.number = part->sequence;
+  handler.put = memtable_put_concurrently;
+  handler.del = memtable_del_concurrently;
+  handler.merge = memtable_merge_concurrently;
+  handler.del_range = memtable_del_range_concurrently;
+
+  return iterate_records(&part->data, &handler, &found);
+}
+
 void
 ldb_batch_set_contents(ldb_batch_t *batch, const ldb_slice_t *contents) {
   assert(contents->size >= LDB_HEADER);
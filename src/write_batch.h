@@ -54,12 +54,31 @@ typedef struct ldb_handler_s {
 
   void (*del)(struct ldb_handler_s *handler,
               const ldb_slice_t *key);
+
+  /* May be NULL, in which case batches containing
+     merge operands fail to iterate with LDB_NOSUPPORT. */
+  void (*merge)(struct ldb_handler_s *handler,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value);
+
+  /* May be NULL, in which case batches containing
+     range deletions fail to iterate with LDB_NOSUPPORT. */
+  void (*del_range)(struct ldb_handler_s *handler,
+                    const ldb_slice_t *start,
+                    const ldb_slice_t *end);
 } ldb_handler_t;
 
 typedef struct ldb_batch_s {
   ldb_buffer_t rep; /* See comment in write_batch.c for the format of rep. */
 } ldb_batch_t;
 
+/* A run of consecutive updates in a batch (see ldb_batch_split()). */
+typedef struct ldb_batchpart_s {
+  ldb_slice_t data; /* The records, without the batch header. */
+  ldb__seqnum_t sequence; /* Sequence number of the first record. */
+  int count;
+} ldb_batchpart_t;
+
 /*
  * WriteBatch
  */
@@ -80,6 +99,12 @@ ldb_batch_clear(ldb_batch_t *batch);
 LDB_EXTERN void
 ldb_batch_reset(ldb_batch_t *batch);
 
+/* Make room for "size" more bytes of updates, so that adding them does
+   not grow the batch piecemeal. Each update takes about the size of its
+   key and value, plus a few bytes. */
+LDB_EXTERN void
+ldb_batch_reserve(ldb_batch_t *batch, size_t size);
+
 /* The size of the database changes caused by this batch.
  *
  * This number is tied to implementation details, and may change across
@@ -119,6 +144,20 @@ ldb_batch_put(ldb_batch_t *batch,
 LDB_EXTERN void
 ldb_batch_del(ldb_batch_t *batch, const ldb_slice_t *key);
 
+/* Merge "value" into the existing value of "key" using the database's
+   merge operator. */
+LDB_EXTERN void
+ldb_batch_merge(ldb_batch_t *batch,
+                const ldb_slice_t *key,
+                const ldb_slice_t *value);
+
+/* Erase every key in the range ["start", "end"). This is a single
+   record no matter how many keys the range holds. */
+LDB_EXTERN void
+ldb_batch_del_range(ldb_batch_t *batch,
+                    const ldb_slice_t *start,
+                    const ldb_slice_t *end);
+
 /* Copies the operations in "src" to this batch.
  *
  * This runs in O(source size) time. However, the constant factor is better
@@ -131,6 +170,27 @@ ldb_batch_append(ldb_batch_t *dst, const ldb_batch_t *src);
 int
 ldb_batch_insert_into(const ldb_batch_t *batch, struct ldb_memtable_s *table);
 
+/* Like insert_into(), but other threads may be inserting
+   into the same memtable at the same time. */
+int
+ldb_batch_insert_concurrently(const ldb_batch_t *batch,
+                              struct ldb_memtable_s *table);
+
+/* Cut the updates of a batch into at most "max" runs of about the same
+   size, numbered from the batch's sequence, so that they may be inserted
+   by several threads. The runs point into the batch. Stores the number
+   of runs in *length. */
+int
+ldb_batch_split(const ldb_batch_t *batch,
+                ldb_batchpart_t *parts,
+                int max,
+                int *length);
+
+/* Like insert_concurrently(), for a run made by ldb_batch_split(). */
+int
+ldb_batchpart_insert_concurrently(const ldb_batchpart_t *part,
+                                  struct ldb_memtable_s *table);
+
 void
 ldb_batch_set_contents(ldb_batch_t *batch, const ldb_slice_t *contents);
 
@@ -14,12 +14,14 @@
 #include <stdlib.h>
 
 #include "util/arena.h"
+#include "util/atomic.h"
 #include "util/random.h"
 #include "util/slice.h"
 #include "util/testutil.h"
 
-int
-main(void) {
+static void
+test_arena_simple(ldb_arenapool_t *pool) {
+  size_t page_size = pool != NULL ? pool->page_size : 0;
   const size_t N = 100000;
   ldb_slice_t *allocated;
   size_t bytes = 0;
@@ -27,7 +29,11 @@ main(void) {
   ldb_rand_t rnd;
   size_t i, length;
 
-  ldb_arena_init(&arena);
+  if (pool != NULL)
+    ldb_arena_init_pool(&arena, pool);
+  else
+    ldb_arena_init(&arena);
+
   ldb_rand_init(&rnd, 301);
 
   allocated = ldb_malloc(N * sizeof(ldb_slice_t));
@@ -68,8 +74,9 @@ main(void) {
 
     ASSERT(ldb_arena_usage(&arena) >= bytes);
 
+    /* A mapped region is charged in full. */
     if (i > N / 10)
-      ASSERT(ldb_arena_usage(&arena) <= bytes * 1.10);
+      ASSERT(ldb_arena_usage(&arena) <= bytes * 1.10 + page_size);
   }
 
   for (i = 0; i < length; i++) {
@@ -85,6 +92,103 @@ main(void) {
 
   ldb_arena_clear(&arena);
   ldb_free(allocated);
+}
+
+static void
+test_arena_pool(size_t page_size) {
+  ldb_arenapool_t pool;
+
+  ldb_arenapool_init(&pool, page_size, 4 << 20);
+
+  test_arena_simple(&pool);
+
+  /* Memory is kept up to the capacity... */
+  ASSERT(ldb_arenapool_size(&pool) > 0);
+  ASSERT(ldb_arenapool_size(&pool) <= (4 << 20));
+
+  /* ...and taken back by the next arena. */
+  test_arena_simple(&pool);
+
+  ASSERT(ldb_arenapool_size(&pool) > 0);
+  ASSERT(ldb_arenapool_size(&pool) <= (4 << 20));
+
+  ldb_arenapool_clear(&pool);
+}
+
+static int alloc_live = 0;
+static int alloc_calls = 0;
+
+static void *
+test_alloc(size_t size) {
+  alloc_live++;
+  alloc_calls++;
+  return malloc(size);
+}
+
+static void *
+test_resize(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    alloc_live++;
+    alloc_calls++;
+  }
+
+  return realloc(ptr, size);
+}
+
+static void
+test_release(void *ptr) {
+  alloc_live--;
+  free(ptr);
+}
+
+static void
+test_arena_allocator(void) {
+  ldb_arena_t arena;
+  void *x, *y, *z;
+  int calls;
+
+  ldb_set_allocator(test_alloc, test_resize, test_release);
+
+  ldb_arena_init(&arena);
+  ldb_arena_alloc(&arena, 100);
+
+  ASSERT(alloc_live > 0);
+
+  ldb_arena_clear(&arena);
+
+  ASSERT(alloc_live == 0);
+
+  /* Freed small objects are reused within their size class. */
+  calls = alloc_calls;
 
+  x = ldb_small_alloc(40);
+  y = ldb_small_alloc(200);
+
+  ldb_small_free(x, 40);
+
+  z = ldb_small_alloc(33);
+
+#ifdef LDB_HAVE_ATOMIC_PTR_CAS
+  ASSERT(z == x);
+  ASSERT(alloc_calls == calls + 2);
+#else
+  (void)calls;
+#endif
+
+  ldb_small_free(z, 33);
+  ldb_small_free(y, 200);
+
+  /* Pooled objects go back to the allocator they came from. */
+  ldb_set_allocator(NULL, NULL, NULL);
+
+  ASSERT(alloc_live == 0);
+}
+
+int
+main(void) {
+  test_arena_allocator();
+  test_arena_simple(NULL);
+  test_arena_pool(0);
+  test_arena_pool(2 << 20);
   return 0;
 }
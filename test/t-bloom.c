@@ -42,8 +42,7 @@ test_empty_filter(void) {
 }
 
 static void
-test_small_filter(void) {
-  const ldb_bloom_t *bloom = ldb_bloom_default;
+test_small_filter(const ldb_bloom_t *bloom) {
   ldb_slice_t keys[2];
   ldb_buffer_t filter;
   ldb_slice_t key;
@@ -81,9 +80,8 @@ next_length(int length) {
 }
 
 static void
-test_varying_lengths(int verbose) {
+test_varying_lengths(const ldb_bloom_t *bloom, size_t slop, int verbose) {
   ldb_slice_t *keys = ldb_malloc(10000 * sizeof(ldb_slice_t));
-  const ldb_bloom_t *bloom = ldb_bloom_default;
   uint8_t *bufs = ldb_malloc(10000 * 4);
   int mediocre_filters = 0;
   int good_filters = 0;
@@ -105,7 +103,7 @@ test_varying_lengths(int verbose) {
     ldb_buffer_reset(&filter);
     ldb_bloom_build(bloom, &filter, keys, length);
 
-    ASSERT(filter.size <= ((size_t)length * 10 / 8) + 40);
+    ASSERT(filter.size <= ((size_t)length * 10 / 8) + slop);
 
     /* All added keys must match. */
     for (i = 0; i < length; i++) {
@@ -153,10 +151,97 @@ test_varying_lengths(int verbose) {
   ldb_free(bufs);
 }
 
+static void
+test_blocked_empty_filter(void) {
+  ldb_bloom_t *bloom = ldb_bloom_create_blocked(10);
+  static uint8_t filter_[65] = {0};
+  static const ldb_slice_t filter = {filter_, 65, 0};
+  ldb_slice_t key;
+
+  filter_[64] = 6;
+
+  key = ldb_string("hello");
+  ASSERT(!ldb_bloom_match(bloom, &filter, &key));
+
+  key = ldb_string("world");
+  ASSERT(!ldb_bloom_match(bloom, &filter, &key));
+
+  ldb_bloom_destroy(bloom);
+}
+
+static void
+test_blocked_filter(void) {
+  ldb_bloom_t *bloom = ldb_bloom_create_blocked(10);
+
+  ASSERT(strcmp(bloom->name, ldb_bloom_default->name) != 0);
+
+  test_small_filter(bloom);
+
+  /* Every filter is at least one 64 byte line. */
+  test_varying_lengths(bloom, 40 + 64, 1);
+
+  ldb_bloom_destroy(bloom);
+}
+
+static void
+test_xor_empty_filter(void) {
+  ldb_bloom_t *bloom = ldb_bloom_create_xor();
+  ldb_buffer_t filter;
+  ldb_slice_t key;
+
+  ldb_buffer_init(&filter);
+  ldb_bloom_build(bloom, &filter, NULL, 0);
+
+  key = ldb_string("hello");
+  ASSERT(!ldb_bloom_match(bloom, &filter, &key));
+
+  key = ldb_string("world");
+  ASSERT(!ldb_bloom_match(bloom, &filter, &key));
+
+  ldb_buffer_clear(&filter);
+  ldb_bloom_destroy(bloom);
+}
+
+static void
+test_xor_filter(void) {
+  ldb_bloom_t *bloom = ldb_bloom_create_xor();
+  ldb_slice_t keys[2];
+
+  ASSERT(strcmp(bloom->name, ldb_bloom_default->name) != 0);
+
+  test_small_filter(bloom);
+
+  /* Duplicate keys must not break construction. */
+  {
+    ldb_buffer_t filter;
+    ldb_slice_t key;
+
+    keys[0] = ldb_string("hello");
+    keys[1] = ldb_string("hello");
+
+    ldb_buffer_init(&filter);
+    ldb_bloom_build(bloom, &filter, keys, 2);
+
+    key = ldb_string("hello");
+    ASSERT(ldb_bloom_match(bloom, &filter, &key));
+
+    ldb_buffer_clear(&filter);
+  }
+
+  /* Fixed overhead of 32 slots plus a 9 byte trailer. */
+  test_varying_lengths(bloom, 40 + 9, 1);
+
+  ldb_bloom_destroy(bloom);
+}
+
 int
 main(void) {
   test_empty_filter();
-  test_small_filter();
-  test_varying_lengths(1);
+  test_small_filter(ldb_bloom_default);
+  test_varying_lengths(ldb_bloom_default, 40, 1);
+  test_blocked_empty_filter();
+  test_blocked_filter();
+  test_xor_empty_filter();
+  test_xor_filter();
   return 0;
 }
@@ -226,6 +226,51 @@ int main(void) {
   CheckNoError(err);
   CheckGet(db, roptions, "foo", "hello");
 
+  StartPhase("get_pinned");
+  {
+    leveldb_pinnableslice_t* pin;
+    const char* val;
+    size_t val_len;
+    char buf[8];
+    pin = leveldb_get_pinned(db, roptions, "foo", 3, &err);
+    CheckNoError(err);
+    val = leveldb_pinnableslice_value(pin, &val_len);
+    CheckEqual("hello", val, val_len);
+    leveldb_pinnableslice_destroy(pin);
+    pin = leveldb_get_pinned(db, roptions, "box", 3, &err);
+    CheckNoError(err);
+    CheckCondition(pin == NULL);
+    CheckCondition(leveldb_get_into_buffer(db, roptions, "foo", 3, buf,
+                                           sizeof(buf), &val_len, &err));
+    CheckNoError(err);
+    CheckEqual("hello", buf, val_len);
+    CheckCondition(leveldb_get_into_buffer(db, roptions, "foo", 3, buf,
+                                           2, &val_len, &err));
+    CheckCondition(val_len == 5);
+    CheckCondition(!leveldb_get_into_buffer(db, roptions, "box", 3, buf,
+                                            sizeof(buf), &val_len, &err));
+    CheckNoError(err);
+  }
+
+  StartPhase("multi_get");
+  {
+    const char* keys[3] = { "box", "foo", "notfound" };
+    const size_t keys_sizes[3] = { 3, 3, 8 };
+    char* vals[3];
+    size_t vals_sizes[3];
+    char* errs[3];
+    size_t i;
+    leveldb_multi_get(db, roptions, 3, keys, keys_sizes,
+                      vals, vals_sizes, errs);
+    for (i = 0; i < 3; i++) {
+      CheckNoError(errs[i]);
+    }
+    CheckEqual(NULL, vals[0], vals_sizes[0]);
+    CheckEqual("hello", vals[1], vals_sizes[1]);
+    CheckEqual(NULL, vals[2], vals_sizes[2]);
+    Free(&vals[1]);
+  }
+
   StartPhase("compactall");
   leveldb_compact_range(db, NULL, 0, NULL, 0);
   CheckGet(db, roptions, "foo", "hello");
@@ -15,10 +15,12 @@
 #include <string.h>
 
 #include "util/array.h"
+#include "util/atomic.h"
 #include "util/cache.h"
 #include "util/coding.h"
 #include "util/slice.h"
 #include "util/testutil.h"
+#include "util/thread_pool.h"
 #include "util/vector.h"
 
 /*
@@ -142,6 +144,23 @@ test_insert2(test_t *t, int key, int value, int charge) {
                         &test_deleter);
 }
 
+static void
+test_insert3(test_t *t, int key, int value, enum ldb_lru_priority priority) {
+  ldb_entry_t *h;
+  uint8_t buf[4];
+  ldb_slice_t k;
+
+  k = encode_key(key, buf);
+
+  h = ldb_lru_insert_priority(t->cache, &k,
+                              encode_value(value),
+                              1,
+                              &test_deleter,
+                              priority);
+
+  ldb_lru_release(t->cache, h);
+}
+
 static void
 test_erase(test_t *t, int key) {
   uint8_t buf[4];
@@ -418,6 +437,217 @@ test_cache_zero_size_cache(void) {
   test_clear(&t);
 }
 
+static void
+test_cache_stats(void) {
+  ldb_lrustats_t total, stats;
+  int bits, i, n;
+
+  for (bits = 0; bits <= 6; bits += 2) {
+    test_t t;
+
+    test_init(&t);
+
+    ldb_lru_destroy(t.cache);
+
+    t.cache = ldb_lru_create_sharded(CACHE_SIZE, bits);
+
+    n = ldb_lru_shards(t.cache);
+
+    ASSERT(n == (1 << bits));
+
+    for (i = 0; i < CACHE_SIZE + 100; i++)
+      test_insert(&t, i, 1000 + i, 1);
+
+    for (i = 0; i < 200; i++)
+      test_lookup(&t, CACHE_SIZE + 100 - 1 - i);
+
+    ASSERT(-1 == test_lookup(&t, -1));
+
+    memset(&total, 0, sizeof(total));
+
+    for (i = 0; i < n; i++) {
+      ldb_lru_stats(t.cache, i, &stats);
+
+      ASSERT(stats.usage <= stats.capacity);
+
+      total.hits += stats.hits;
+      total.misses += stats.misses;
+      total.inserts += stats.inserts;
+      total.evictions += stats.evictions;
+    }
+
+    ASSERT(total.inserts == CACHE_SIZE + 100);
+    ASSERT(total.hits + total.misses == 201);
+    ASSERT(total.hits > 0);
+    ASSERT(total.evictions > 0);
+    ASSERT(total.evictions == t.deleted_keys.length);
+
+    test_clear(&t);
+  }
+}
+
+static void
+test_cache_scan_resistance(void) {
+  int policy, i;
+
+  for (policy = LDB_LRU_DEFAULT; policy <= LDB_LRU_MIDPOINT; policy++) {
+    int found = 0;
+    test_t t;
+
+    test_init(&t);
+
+    ldb_lru_destroy(t.cache);
+
+    t.cache = ldb_lru_create_policy(CACHE_SIZE, 0,
+                                    (enum ldb_lru_policy)policy);
+
+    /* Working set which is read repeatedly. */
+    for (i = 0; i < 100; i++)
+      test_insert(&t, i, 1000 + i, 1);
+
+    for (i = 0; i < 100; i++)
+      ASSERT(1000 + i == test_lookup(&t, i));
+
+    /* A scan touching each key once. */
+    for (i = 0; i < 2 * CACHE_SIZE; i++)
+      test_insert(&t, 1000 + i, 2000 + i, 1);
+
+    for (i = 0; i < 100; i++)
+      found += (test_lookup(&t, i) == 1000 + i);
+
+    if (policy == LDB_LRU_MIDPOINT)
+      ASSERT(found == 100);
+    else
+      ASSERT(found == 0);
+
+    /* Scanned entries can still be cached. */
+    i = 2 * CACHE_SIZE - 1;
+
+    ASSERT(2000 + i == test_lookup(&t, 1000 + i));
+
+    test_clear(&t);
+  }
+}
+
+static void
+test_cache_priority(void) {
+  int policy, i;
+
+  for (policy = LDB_LRU_DEFAULT; policy <= LDB_LRU_MIDPOINT; policy++) {
+    test_t t;
+
+    test_init(&t);
+
+    ldb_lru_destroy(t.cache);
+
+    t.cache = ldb_lru_create_policy(CACHE_SIZE, 0,
+                                    (enum ldb_lru_policy)policy);
+
+    for (i = 0; i < CACHE_SIZE; i++)
+      test_insert(&t, i, 1000 + i, 1);
+
+    /* A low priority entry is the next to be evicted. */
+    test_insert3(&t, 5000, 5001, LDB_LRU_LOW);
+    test_insert(&t, 6000, 6001, 1);
+
+    ASSERT(-1 == test_lookup(&t, 5000));
+    ASSERT(1002 == test_lookup(&t, 2));
+
+    /* High priority entries outlive a scan of normal ones. */
+    for (i = 0; i < 10; i++)
+      test_insert3(&t, 7000 + i, 8000 + i, LDB_LRU_HIGH);
+
+    for (i = 0; i < CACHE_SIZE; i++)
+      test_insert(&t, 10000 + i, 20000 + i, 1);
+
+    for (i = 0; i < 10; i++)
+      ASSERT(8000 + i == test_lookup(&t, 7000 + i));
+
+    ASSERT(-1 == test_lookup(&t, 3));
+
+    test_clear(&t);
+  }
+}
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+
+static ldb_atomic(int) concurrent_inserts;
+static ldb_atomic(int) concurrent_deletes;
+
+static void
+concurrent_deleter(const ldb_slice_t *key, void *value) {
+  ASSERT(decode_key(key) == decode_value(value));
+  ldb_atomic_fetch_add(&concurrent_deletes, 1, ldb_order_relaxed);
+}
+
+typedef struct worker_s {
+  ldb_lru_t *cache;
+  int offset;
+} worker_t;
+
+static void
+concurrent_worker(void *arg) {
+  worker_t *w = arg;
+  ldb_entry_t *h;
+  uint8_t buf[4];
+  ldb_slice_t k;
+  int i, key;
+
+  for (i = 0; i < 20000; i++) {
+    key = (i * 7 + w->offset) % 300;
+
+    k = encode_key(key, buf);
+    h = ldb_lru_lookup(w->cache, &k);
+
+    if (h == NULL) {
+      h = ldb_lru_insert(w->cache, &k, encode_value(key), 1,
+                         &concurrent_deleter);
+
+      ldb_atomic_fetch_add(&concurrent_inserts, 1, ldb_order_relaxed);
+    }
+
+    ASSERT(key == decode_value(ldb_lru_value(h)));
+
+    ldb_lru_release(w->cache, h);
+  }
+}
+
+static void
+test_cache_concurrent(void) {
+  ldb_pool_t *pool = ldb_pool_create(4);
+  int policy, i;
+
+  for (policy = LDB_LRU_DEFAULT; policy <= LDB_LRU_MIDPOINT; policy++) {
+    worker_t workers[4];
+    ldb_lru_t *cache;
+
+    ldb_atomic_store(&concurrent_inserts, 0, ldb_order_relaxed);
+    ldb_atomic_store(&concurrent_deletes, 0, ldb_order_relaxed);
+
+    cache = ldb_lru_create_policy(100, 1, (enum ldb_lru_policy)policy);
+
+    for (i = 0; i < 4; i++) {
+      workers[i].cache = cache;
+      workers[i].offset = i * 31;
+
+      ldb_pool_schedule(pool, &concurrent_worker, &workers[i]);
+    }
+
+    ldb_pool_wait(pool);
+
+    ASSERT(ldb_lru_usage(cache) <= 100);
+
+    ldb_lru_destroy(cache);
+
+    ASSERT(ldb_atomic_load(&concurrent_inserts, ldb_order_relaxed) ==
+           ldb_atomic_load(&concurrent_deletes, ldb_order_relaxed));
+  }
+
+  ldb_pool_destroy(pool);
+}
+
+#endif /* _WIN32 || LDB_PTHREAD */
+
 /*
  * Execute
  */
@@ -433,5 +663,11 @@ main(void) {
   test_cache_id();
   test_cache_prune();
   test_cache_zero_size_cache();
+  test_cache_stats();
+  test_cache_scan_resistance();
+  test_cache_priority();
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+  test_cache_concurrent();
+#endif
   return 0;
 }
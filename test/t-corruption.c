@@ -33,6 +33,7 @@
 #include "dbformat.h"
 #include "filename.h"
 #include "log_format.h"
+#include "verify.h"
 #include "write_batch.h"
 
 /*
@@ -411,6 +412,49 @@ test_corrupt_table_file(ctest_t *t) {
   ctest_check(t, 90, 99);
 }
 
+static void
+test_corrupt_cached_block(ctest_t *t) {
+  /* A block cached by an unverified read must still be checked
+     once a verifying read asks for it. */
+  ldb_lru_t *cache = ldb_lru_create(1 << 20);
+  ldb_readopt_t options = *ldb_readopt_default;
+  ldb_buffer_t storage;
+  ldb_slice_t val;
+
+  ldb_buffer_init(&storage);
+
+  t->options.block_cache = cache;
+
+  ctest_reopen(t);
+  ctest_build(t, 100);
+
+  ldb_test_compact_memtable(t->db);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
+  ldb_test_compact_range(t->db, 1, NULL, NULL);
+
+  ctest_check(t, 100, 100);
+  ctest_corrupt(t, LDB_FILE_TABLE, 100, 1);
+
+  options.verify_checksums = 0;
+
+  ASSERT(ldb_get(t->db, ctest_key(0, &storage), &val, &options) == LDB_OK);
+
+  ldb_free(val.data);
+
+  options.verify_checksums = 1;
+
+  ASSERT(ldb_get(t->db, ctest_key(0, &storage),
+                 &val, &options) == LDB_CORRUPTION);
+
+  ldb_close(t->db);
+
+  t->db = NULL;
+  t->options.block_cache = t->tiny_cache;
+
+  ldb_lru_destroy(cache);
+  ldb_buffer_clear(&storage);
+}
+
 static void
 test_corrupt_table_file_repair(ctest_t *t) {
   t->options.block_size = 2 * ctest_value_size; /* Limit scope of corruption. */
@@ -448,6 +492,46 @@ test_corrupt_missing_descriptor(ctest_t *t) {
   ctest_check(t, 1000, 1000);
 }
 
+static void
+test_corrupt_parallel_repair(ctest_t *t) {
+  t->options.write_buffer_size = 64 << 10; /* Many tables. */
+  t->options.max_file_opening_threads = 4;
+  t->options.paranoid_checks = 1;
+
+  ctest_reopen(t);
+  ctest_build(t, 1000);
+  ctest_corrupt(t, LDB_FILE_TABLE, 100, 1);
+  ctest_repair(t);
+  ctest_reopen(t);
+  ctest_check(t, 990, 1000);
+}
+
+static void
+test_corrupt_verify(ctest_t *t) {
+  FILE *dst = tmpfile();
+
+  ASSERT(dst != NULL);
+
+  t->options.write_buffer_size = 64 << 10; /* Many tables. */
+
+  ctest_reopen(t);
+  ctest_build(t, 1000);
+
+  ldb_test_compact_memtable(t->db);
+  ldb_close(t->db);
+
+  t->db = NULL;
+
+  ASSERT(ldb_verify_db(t->dbname, &t->options, 4, 1, dst) == LDB_OK);
+
+  ctest_corrupt(t, LDB_FILE_TABLE, 100, 1);
+
+  ASSERT(ldb_verify_db(t->dbname, &t->options, 4, 1, dst) == LDB_CORRUPTION);
+  ASSERT(ldb_verify_db(t->dbname, &t->options, 4, 0, dst) == LDB_OK);
+
+  fclose(dst);
+}
+
 static void
 test_corrupt_sequence_number_recovery(ctest_t *t) {
   ASSERT(ctest_put(t, "foo", "v1") == LDB_OK);
@@ -599,9 +683,12 @@ main(void) {
     test_corrupt_new_file_error_during_write,
 #endif
     test_corrupt_table_file,
+    test_corrupt_cached_block,
     test_corrupt_table_file_repair,
     test_corrupt_table_file_index_data,
     test_corrupt_missing_descriptor,
+    test_corrupt_parallel_repair,
+    test_corrupt_verify,
     test_corrupt_sequence_number_recovery,
     test_corrupt_corrupted_descriptor,
     test_corrupt_compaction_input_error,
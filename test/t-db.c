@@ -11,6 +11,7 @@
  */
 
 #include <limits.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,24 +23,41 @@
 #include "util/bloom.h"
 #include "util/buffer.h"
 #include "util/cache.h"
+#include "util/cfilter.h"
 #include "util/comparator.h"
 #include "util/env.h"
 #include "util/internal.h"
+#include "util/listener.h"
+#include "util/mergeop.h"
 #include "util/options.h"
+#include "util/pcache.h"
+#include "util/perf.h"
+#include "util/pinned.h"
 #include "util/port.h"
+#include "util/prefix.h"
 #include "util/random.h"
+#include "util/ratelimit.h"
 #include "util/rbt.h"
 #include "util/slice.h"
+#include "util/statistics.h"
 #include "util/status.h"
 #include "util/strutil.h"
 #include "util/testutil.h"
+#include "util/thread_pool.h"
+#include "util/trace.h"
 #include "util/vector.h"
+#include "util/wbm.h"
 
+#include "backup.h"
+#include "cachesim.h"
 #include "db_impl.h"
 #include "dbformat.h"
+#include "family.h"
 #include "filename.h"
+#include "indexed_batch.h"
 #include "log_format.h"
 #include "snapshot.h"
+#include "sst_writer.h"
 #include "write_batch.h"
 
 /*
@@ -61,6 +79,13 @@ enum option_config {
   CONFIG_REUSE,
   CONFIG_FILTER,
   CONFIG_UNCOMPRESSED,
+  CONFIG_PIPELINED,
+  CONFIG_CONCURRENT,
+  CONFIG_PARTITIONED,
+  CONFIG_MEMTABLE_BLOOM,
+  CONFIG_VECTOR_MEMTABLE,
+  CONFIG_HASH_MEMTABLE,
+  CONFIG_PARALLEL_COMPRESSION,
   CONFIG_END
 };
 
@@ -69,6 +94,7 @@ typedef struct test_s {
   ldb_dbopt_t last_options;
   int config;
   ldb_bloom_t *policy;
+  ldb_prefix_t *prefix;
   ldb_t *db;
   ldb_vector_t arena;
 } test_t;
@@ -88,6 +114,7 @@ test_init(test_t *t) {
 
   t->config = CONFIG_DEFAULT;
   t->policy = ldb_bloom_create(10);
+  t->prefix = ldb_prefix_create_fixed(1);
   t->db = NULL;
 
   ldb_vector_init(&t->arena);
@@ -106,6 +133,7 @@ test_clear(test_t *t) {
 
   ldb_destroy(t->dbname, NULL);
   ldb_bloom_destroy(t->policy);
+  ldb_prefix_destroy(t->prefix);
 
   for (i = 0; i < t->arena.length; i++)
     ldb_free(t->arena.items[i]);
@@ -240,6 +268,32 @@ test_current_options(test_t *t) {
     case CONFIG_UNCOMPRESSED:
       options.compression = LDB_NO_COMPRESSION;
       break;
+    case CONFIG_PIPELINED:
+      options.pipelined_write = 1;
+      break;
+    case CONFIG_CONCURRENT:
+      options.concurrent_memtable_write = 1;
+      break;
+    case CONFIG_PARTITIONED:
+      options.filter_policy = t->policy;
+      options.partition_index = 1;
+      options.partition_filters = 1;
+      break;
+    case CONFIG_MEMTABLE_BLOOM:
+      options.memtable_bloom_size = 64 << 10;
+      options.memtable_inline_prefix = 1;
+      break;
+    case CONFIG_VECTOR_MEMTABLE:
+      options.memtable_rep = LDB_MEMTABLE_VECTOR;
+      break;
+    case CONFIG_HASH_MEMTABLE:
+      options.memtable_rep = LDB_MEMTABLE_HASH_SKIPLIST;
+      options.prefix_extractor = t->prefix;
+      break;
+    case CONFIG_PARALLEL_COMPRESSION:
+      options.filter_policy = t->policy;
+      options.compression_threads = 4;
+      break;
     default:
       break;
   }
@@ -488,6 +542,17 @@ test_all_entries(test_t *t, const char *user_key) {
           case LDB_TYPE_DELETION:
             ldb_buffer_string(&z, "DEL");
             break;
+          case LDB_TYPE_MERGE:
+            val = ldb_iter_value(iter);
+            ldb_buffer_string(&z, "MERGE ");
+            ldb_buffer_concat(&z, &val);
+            break;
+          case LDB_TYPE_BLOB:
+            ldb_buffer_string(&z, "BLOB");
+            break;
+          default:
+            ldb_buffer_string(&z, "CORRUPTED");
+            break;
         }
       }
 
@@ -680,6 +745,89 @@ test_delete_an_sst_file(test_t *t) {
   return found;
 }
 
+static int
+test_count_blob_files(test_t *t) {
+  ldb_filetype_t type;
+  uint64_t number;
+  int count = 0;
+  char **names;
+  int i, len;
+
+  len = ldb_get_children(t->dbname, &names);
+
+  ASSERT(len >= 0);
+
+  for (i = 0; i < len; i++) {
+    if (!ldb_parse_filename(&type, &number, names[i]))
+      continue;
+
+    if (type == LDB_FILE_BLOB)
+      count++;
+  }
+
+  ldb_free_children(names, len);
+
+  return count;
+}
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+static int
+test_count_table_files(test_t *t) {
+  ldb_filetype_t type;
+  uint64_t number;
+  int count = 0;
+  char **names;
+  int i, len;
+
+  len = ldb_get_children(t->dbname, &names);
+
+  ASSERT(len >= 0);
+
+  for (i = 0; i < len; i++) {
+    if (!ldb_parse_filename(&type, &number, names[i]))
+      continue;
+
+    if (type == LDB_FILE_TABLE)
+      count++;
+  }
+
+  ldb_free_children(names, len);
+
+  return count;
+}
+#endif
+
+static uint64_t
+test_log_bytes(test_t *t) {
+  char fname[LDB_PATH_MAX];
+  ldb_filetype_t type;
+  uint64_t number, size;
+  uint64_t total = 0;
+  char **names;
+  int i, len;
+
+  len = ldb_get_children(t->dbname, &names);
+
+  ASSERT(len >= 0);
+
+  for (i = 0; i < len; i++) {
+    if (!ldb_parse_filename(&type, &number, names[i]))
+      continue;
+
+    if (type != LDB_FILE_LOG)
+      continue;
+
+    ASSERT(ldb_log_filename(fname, sizeof(fname), t->dbname, number));
+    ASSERT(ldb_file_size(fname, &size) == LDB_OK);
+
+    total += size;
+  }
+
+  ldb_free_children(names, len);
+
+  return total;
+}
+
 /* Returns number of files renamed. */
 static int
 test_rename_ldb_to_sst(test_t *t) {
@@ -812,1884 +960,8751 @@ test_db_get_from_versions(test_t *t) {
 }
 
 static void
-test_db_get_memusage(test_t *t) {
-  int mem_usage;
-  char *val;
+test_db_memtable_bloom(test_t *t) {
+  static const size_t sizes[] = { 64, 64 << 10 };
+  size_t j;
+
+  for (j = 0; j < lengthof(sizes); j++) {
+    ldb_dbopt_t options = test_current_options(t);
+    int i;
+
+    options.create_if_missing = 1;
+    options.memtable_bloom_size = sizes[j];
+
+    test_destroy_and_reopen(t, &options);
 
-  do {
     ASSERT(test_put(t, "foo", "v1") == LDB_OK);
-    ASSERT(ldb_property(t->db, "leveldb.approximate-memory-usage", &val));
+    ASSERT(test_put(t, "bar", "v2") == LDB_OK);
+    ldb_test_compact_memtable(t->db);
 
-    mem_usage = atoi(val);
+    /* Memtable entries shadow the tables. */
+    ASSERT(test_put(t, "foo", "v3") == LDB_OK);
+    ASSERT(test_del(t, "bar") == LDB_OK);
 
-    ldb_free(val);
+    for (i = 0; i < 1000; i++)
+      ASSERT(test_put(t, test_key(t, i), "v") == LDB_OK);
 
-    ASSERT(mem_usage > 0);
-    ASSERT(mem_usage < 5 * 1024 * 1024);
-  } while (test_change_options(t));
+    ASSERT_EQ("v3", test_get(t, "foo"));
+    ASSERT_EQ("NOT_FOUND", test_get(t, "bar"));
+    ASSERT_EQ("NOT_FOUND", test_get(t, "baz"));
+
+    for (i = 0; i < 1000; i++) {
+      ASSERT_EQ("v", test_get(t, test_key(t, i)));
+      ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, i + 1000)));
+      test_reset(t);
+    }
+  }
 }
 
 static void
-test_db_get_snapshot(test_t *t) {
-  do {
-    /* Try with both a short key and a long key */
-    int i;
+test_db_data_block_hash_index(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const ldb_snapshot_t *snap;
+  int i;
 
-    for (i = 0; i < 2; i++) {
-      const char *key = (i == 0) ? "foo" : string_fill(t, 'x', 200);
-      const ldb_snapshot_t *s1;
+  options.create_if_missing = 1;
+  options.block_restart_interval = 2;
+  options.data_block_hash_index = 1;
 
-      ASSERT(test_put(t, key, "v1") == LDB_OK);
+  test_destroy_and_reopen(t, &options);
 
-      s1 = ldb_snapshot(t->db);
+  for (i = 0; i < 500; i++)
+    ASSERT(test_put(t, test_key(t, i), "v1") == LDB_OK);
 
-      ASSERT(test_put(t, key, "v2") == LDB_OK);
-      ASSERT_EQ("v2", test_get(t, key));
-      ASSERT_EQ("v1", test_get2(t, key, s1));
+  snap = ldb_snapshot(t->db);
 
-      ldb_test_compact_memtable(t->db);
+  /* Keep both versions of every overwritten key in the table. */
+  for (i = 0; i < 500; i++) {
+    if (i % 3 == 0)
+      ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
+    else if (i % 2 == 0)
+      ASSERT(test_put(t, test_key(t, i), "v2") == LDB_OK);
+  }
 
-      ASSERT_EQ("v2", test_get(t, key));
-      ASSERT_EQ("v1", test_get2(t, key, s1));
+  ldb_test_compact_memtable(t->db);
 
-      ldb_release(t->db, s1);
-    }
-  } while (test_change_options(t));
+  for (i = 0; i < 500; i++) {
+    const char *expect = (i % 3 == 0) ? "NOT_FOUND"
+                       : (i % 2 == 0) ? "v2" : "v1";
+
+    ASSERT_EQ(expect, test_get(t, test_key(t, i)));
+    ASSERT_EQ("v1", test_get2(t, test_key(t, i), snap));
+    ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, i + 500)));
+    test_reset(t);
+  }
+
+  ldb_release(t->db, snap);
 }
 
 static void
-test_db_get_identical_snapshots(test_t *t) {
-  do {
-    /* Try with both a short key and a long key */
-    int i;
+test_db_separate_block_values(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_iter_t *iter;
+  char expect[64];
+  char key[32];
+  int i;
 
-    for (i = 0; i < 2; i++) {
-      const char *key = (i == 0) ? "foo" : string_fill(t, 'x', 200);
-      const ldb_snapshot_t *s1;
-      const ldb_snapshot_t *s2;
-      const ldb_snapshot_t *s3;
+  options.create_if_missing = 1;
+  options.block_restart_interval = 4;
+  options.separate_block_values = 1;
+  options.restart_key_prefixes = 1;
+  options.data_block_hash_index = 1;
 
-      ASSERT(test_put(t, key, "v1") == LDB_OK);
+  test_destroy_and_reopen(t, &options);
 
-      s1 = ldb_snapshot(t->db);
-      s2 = ldb_snapshot(t->db);
-      s3 = ldb_snapshot(t->db);
+  for (i = 0; i < 500; i++) {
+    sprintf(key, "v%d", i);
+    ASSERT(test_put(t, test_key(t, i), key) == LDB_OK);
+  }
 
-      ASSERT(test_put(t, key, "v2") == LDB_OK);
+  ldb_test_compact_memtable(t->db);
 
-      ASSERT_EQ("v2", test_get(t, key));
-      ASSERT_EQ("v1", test_get2(t, key, s1));
-      ASSERT_EQ("v1", test_get2(t, key, s2));
-      ASSERT_EQ("v1", test_get2(t, key, s3));
+  for (i = 0; i < 500; i++) {
+    sprintf(key, "v%d", i);
+    ASSERT_EQ(key, test_get(t, test_key(t, i)));
+    ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, i + 500)));
+    test_reset(t);
+  }
 
-      ldb_release(t->db, s1);
+  iter = ldb_iterator(t->db, ldb_readopt_default);
 
-      ldb_test_compact_memtable(t->db);
+  i = 0;
 
-      ASSERT_EQ("v2", test_get(t, key));
-      ASSERT_EQ("v1", test_get2(t, key, s2));
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    sprintf(expect, "%s->v%d", test_key(t, i), i);
+    ASSERT_EQ(expect, iter_status(t, iter));
+    i++;
+  }
 
-      ldb_release(t->db, s2);
+  ASSERT(i == 500);
 
-      ASSERT_EQ("v1", test_get2(t, key, s3));
+  for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter)) {
+    i--;
+    sprintf(expect, "%s->v%d", test_key(t, i), i);
+    ASSERT_EQ(expect, iter_status(t, iter));
+  }
 
-      ldb_release(t->db, s3);
-    }
-  } while (test_change_options(t));
+  ASSERT(i == 0);
+
+  for (i = 0; i < 500; i += 7) {
+    iter_seek(iter, test_key(t, i));
+    sprintf(expect, "%s->v%d", test_key(t, i), i);
+    ASSERT_EQ(expect, iter_status(t, iter));
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+  test_reset(t);
+
+  ldb_iter_destroy(iter);
 }
 
 static void
-test_db_iterate_over_empty_snapshot(test_t *t) {
-  do {
-    ldb_readopt_t options = *ldb_readopt_default;
-    const ldb_snapshot_t *snapshot;
-    ldb_iter_t *iter;
+test_db_plain_table(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_iter_t *iter;
+  char expect[64];
+  char value[32];
+  int pass, i, n;
 
-    snapshot = ldb_snapshot(t->db);
+  options.create_if_missing = 1;
+  options.plain_key_size = 9; /* "key%06d" */
 
-    options.snapshot = snapshot;
+  test_destroy_and_reopen(t, &options);
 
-    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
-    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+  ASSERT(test_put(t, "short", "x") == LDB_INVALID);
+  ASSERT(test_del(t, "key0000000") == LDB_INVALID);
+  ASSERT_EQ("NOT_FOUND", test_get(t, "short"));
 
-    iter = ldb_iterator(t->db, &options);
+  for (i = 0; i < 500; i++) {
+    sprintf(value, "v%d", i);
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+  }
 
-    ldb_iter_first(iter);
+  ldb_test_compact_memtable(t->db);
 
-    ASSERT(!ldb_iter_valid(iter));
+  for (i = 0; i < 500; i += 2) {
+    sprintf(value, "w%d", i);
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+  }
 
-    ldb_iter_destroy(iter);
+  for (i = 0; i < 500; i += 5)
+    ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
 
-    ldb_test_compact_memtable(t->db);
+  ldb_test_compact_memtable(t->db);
 
-    iter = ldb_iterator(t->db, &options);
+  /* Once over two tables, once after compacting them,
+     and once more without mapped files. */
+  for (pass = 0; pass < 3; pass++) {
+    for (i = 0; i < 500; i++) {
+      if (i % 5 == 0)
+        strcpy(value, "NOT_FOUND");
+      else
+        sprintf(value, "%c%d", i % 2 ? 'v' : 'w', i);
+
+      ASSERT_EQ(value, test_get(t, test_key(t, i)));
+      ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, i + 500)));
+      test_reset(t);
+    }
 
-    ldb_iter_first(iter);
+    iter = ldb_iterator(t->db, ldb_readopt_default);
+    n = 0;
 
-    ASSERT(!ldb_iter_valid(iter));
+    for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+      n++;
 
-    ldb_iter_destroy(iter);
+    ASSERT(n == 400);
 
-    ldb_release(t->db, snapshot);
-  } while (test_change_options(t));
-}
+    for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter))
+      n--;
 
-static void
-test_db_get_level0_ordering(test_t *t) {
-  do {
-    /* Check that we process level-0 files in correct order. The code
-       below generates two level-0 files where the earlier one comes
-       before the later one in the level-0 file list since the earlier
-       one has a smaller "smallest" key. */
-    ASSERT(test_put(t, "bar", "b") == LDB_OK);
-    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+    ASSERT(n == 0);
 
-    ldb_test_compact_memtable(t->db);
+    for (i = 0; i < 500; i += 7) {
+      n = (i % 5 == 0) ? i + 1 : i;
+      sprintf(expect, "%s->%c%d", test_key(t, n), n % 2 ? 'v' : 'w', n);
+      iter_seek(iter, test_key(t, i));
+      ASSERT_EQ(expect, iter_status(t, iter));
+    }
 
-    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
 
-    ldb_test_compact_memtable(t->db);
+    test_reset(t);
 
-    ASSERT_EQ("v2", test_get(t, "foo"));
-  } while (test_change_options(t));
+    ldb_iter_destroy(iter);
+
+    if (pass == 0)
+      ldb_compact(t->db, NULL, NULL);
+
+    if (pass == 1) {
+      options.use_mmap = 0;
+      test_reopen(t, &options);
+    }
+  }
 }
 
 static void
-test_db_get_ordered_by_levels(test_t *t) {
-  do {
-    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+test_db_parallel_insert(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_slice_t key, val;
+  ldb_batch_t batch;
+  char value[1000];
+  char expect[1000];
+  int pass, i;
 
-    test_compact(t, "a", "z");
+  options.create_if_missing = 1;
+  options.write_buffer_size = 64 << 20;
+  options.concurrent_memtable_write = 1;
+  options.max_insert_threads = 4;
 
-    ASSERT_EQ("v1", test_get(t, "foo"));
-    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
-    ASSERT_EQ("v2", test_get(t, "foo"));
+  test_destroy_and_reopen(t, &options);
 
-    ldb_test_compact_memtable(t->db);
+  ldb_batch_init(&batch);
+  ldb_batch_reserve(&batch, 5000 * 1020);
 
-    ASSERT_EQ("v2", test_get(t, "foo"));
-  } while (test_change_options(t));
-}
+  /* About 5mb, in several runs. Later updates of a key must win
+     no matter which thread inserts them. */
+  for (i = 0; i < 5000; i++) {
+    memset(value, 'a' + i % 26, sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
 
-static void
-test_db_get_picks_correct_file(test_t *t) {
-  do {
-    /* Arrange to have multiple files in a non-level-0 level. */
-    ASSERT(test_put(t, "a", "va") == LDB_OK);
+    key = ldb_string(test_key(t, i % 4000));
+    val = ldb_string(value);
 
-    test_compact(t, "a", "b");
+    ldb_batch_put(&batch, &key, &val);
 
-    ASSERT(test_put(t, "x", "vx") == LDB_OK);
-
-    test_compact(t, "x", "y");
+    if (i % 7 == 0)
+      ldb_batch_del(&batch, &key);
+  }
 
-    ASSERT(test_put(t, "f", "vf") == LDB_OK);
+  ASSERT(ldb_write(t->db, &batch, NULL) == LDB_OK);
 
-    test_compact(t, "f", "g");
+  /* Once from the memtable, once after replaying the log. */
+  for (pass = 0; pass < 2; pass++) {
+    for (i = 0; i < 4000; i++) {
+      int last = (i < 1000) ? i + 4000 : i;
 
-    ASSERT_EQ("va", test_get(t, "a"));
-    ASSERT_EQ("vf", test_get(t, "f"));
-    ASSERT_EQ("vx", test_get(t, "x"));
-  } while (test_change_options(t));
-}
+      if (last % 7 == 0) {
+        strcpy(expect, "NOT_FOUND");
+      } else {
+        memset(expect, 'a' + last % 26, sizeof(expect) - 1);
+        expect[sizeof(expect) - 1] = '\0';
+      }
 
-static void
-test_db_get_encounters_empty_level(test_t *t) {
-  do {
-    /* Arrange for the following to happen:
-     *
-     *   - sstable A in level 0
-     *   - nothing in level 1
-     *   - sstable B in level 2
-     *
-     * Then do enough get() calls to arrange for an automatic compaction
-     * of sstable A. A bug would cause the compaction to be marked as
-     * occurring at level 1 (instead of the correct level 0).
-     */
-    int i;
+      ASSERT_EQ(expect, test_get(t, test_key(t, i)));
+      test_reset(t);
+    }
 
-    /* Step 1: First place sstables in levels 0 and 2 */
-    int compaction_count = 0;
+    test_reopen(t, &options);
+  }
 
-    while (test_files_at_level(t, 0) == 0 || test_files_at_level(t, 2) == 0) {
-      ASSERT(compaction_count <= 100);
+  ldb_batch_clear(&batch);
+}
 
-      compaction_count++;
+static void
+test_db_cuckoo_table(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const ldb_snapshot_t *snap;
+  ldb_iter_t *iter;
+  char value[32];
+  char key[32];
+  int pass, i, n;
 
-      test_put(t, "a", "begin");
-      test_put(t, "z", "end");
+  options.create_if_missing = 1;
+  options.cuckoo_table = 1;
 
-      ldb_test_compact_memtable(t->db);
-    }
+  test_destroy_and_reopen(t, &options);
 
-    /* Step 2: clear level 1 if necessary. */
-    ldb_test_compact_range(t->db, 1, NULL, NULL);
+  /* Keys of every size. */
+  for (i = 0; i < 500; i++) {
+    sprintf(key, "k%d", i);
+    sprintf(value, "v%d", i);
+    ASSERT(test_put(t, key, value) == LDB_OK);
+  }
 
-    ASSERT(test_files_at_level(t, 0) == 1);
-    ASSERT(test_files_at_level(t, 1) == 0);
-    ASSERT(test_files_at_level(t, 2) == 1);
+  ldb_test_compact_memtable(t->db);
 
-    /* Step 3: read a bunch of times */
-    for (i = 0; i < 1000; i++)
-      ASSERT_EQ("NOT_FOUND", test_get(t, "missing"));
+  snap = ldb_snapshot(t->db);
 
-    /* Step 4: Wait for compaction to finish */
-    ldb_sleep_msec(1000);
+  for (i = 0; i < 500; i += 2) {
+    sprintf(key, "k%d", i);
+    sprintf(value, "w%d", i);
+    ASSERT(test_put(t, key, value) == LDB_OK);
+  }
 
-    ASSERT(test_files_at_level(t, 0) == 0);
-  } while (test_change_options(t));
-}
+  for (i = 0; i < 500; i += 5) {
+    sprintf(key, "k%d", i);
+    ASSERT(test_del(t, key) == LDB_OK);
+  }
 
-static void
-test_db_iter_empty(test_t *t) {
-  ldb_iter_t *iter = ldb_iterator(t->db, ldb_readopt_default);
+  ldb_test_compact_memtable(t->db);
 
-  ldb_iter_first(iter);
+  /* Once over two tables, once after compacting them (keeping
+     the versions seen by the snapshot), and once more without
+     mapped files. */
+  for (pass = 0; pass < 3; pass++) {
+    for (i = 0; i < 500; i++) {
+      sprintf(key, "k%d", i);
 
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+      if (i % 5 == 0)
+        strcpy(value, "NOT_FOUND");
+      else
+        sprintf(value, "%c%d", i % 2 ? 'v' : 'w', i);
 
-  ldb_iter_last(iter);
+      ASSERT_EQ(value, test_get(t, key));
 
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+      if (pass < 2) {
+        sprintf(value, "v%d", i);
+        ASSERT_EQ(value, test_get2(t, key, snap));
+      }
 
-  iter_seek(iter, "foo");
+      sprintf(key, "k%d", i + 500);
+      ASSERT_EQ("NOT_FOUND", test_get(t, key));
+      test_reset(t);
+    }
 
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    iter = ldb_iterator(t->db, ldb_readopt_default);
+    n = 0;
 
-  ldb_iter_destroy(iter);
-}
+    for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+      n++;
 
-static void
-test_db_iter_single(test_t *t) {
-  ldb_iter_t *iter;
+    ASSERT(n == 400);
 
-  ASSERT(test_put(t, "a", "va") == LDB_OK);
+    for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter))
+      n--;
 
-  iter = ldb_iterator(t->db, ldb_readopt_default);
+    ASSERT(n == 0);
 
-  ldb_iter_first(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
-  ldb_iter_first(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    iter_seek(iter, "k10");
+    ASSERT_EQ("k101->v101", iter_status(t, iter));
 
-  ldb_iter_last(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
-  ldb_iter_last(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
 
-  iter_seek(iter, "");
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    test_reset(t);
 
-  iter_seek(iter, "a");
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    ldb_iter_destroy(iter);
 
-  iter_seek(iter, "b");
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    if (pass == 0)
+      ldb_compact(t->db, NULL, NULL);
 
-  ldb_iter_destroy(iter);
+    if (pass == 1) {
+      ldb_release(t->db, snap);
+      options.use_mmap = 0;
+      test_reopen(t, &options);
+    }
+  }
 }
 
 static void
-test_db_iter_multi(test_t *t) {
-  ldb_iter_t *iter;
+test_db_compression_per_level(test_t *t) {
+  static const enum ldb_compression levels[] = {
+    LDB_NO_COMPRESSION,
+    LDB_SNAPPY_COMPRESSION
+  };
+  ldb_dbopt_t options = test_current_options(t);
+  uint64_t before, after;
+  ldb_buffer_t value;
+  ldb_rand_t rnd;
+  int i, level;
 
-  ASSERT(test_put(t, "a", "va") == LDB_OK);
-  ASSERT(test_put(t, "b", "vb") == LDB_OK);
-  ASSERT(test_put(t, "c", "vc") == LDB_OK);
+  options.create_if_missing = 1;
+  options.compression_per_level = levels;
+  options.compression_levels = lengthof(levels);
 
-  iter = ldb_iterator(t->db, ldb_readopt_default);
+  test_destroy_and_reopen(t, &options);
 
-  ldb_iter_first(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
-  ldb_iter_first(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_rand_init(&rnd, 301);
+  ldb_buffer_init(&value);
 
-  ldb_iter_last(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
-  ldb_iter_last(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  for (i = 0; i < 20; i++) {
+    ldb_buffer_reset(&value);
+    ldb_compressible_string(&value, &rnd, 0.25, 10000);
+    ldb_buffer_push(&value, 0);
 
-  iter_seek(iter, "");
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  iter_seek(iter, "a");
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  iter_seek(iter, "ax");
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
-  iter_seek(iter, "b");
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
-  iter_seek(iter, "z");
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+    ASSERT(test_put(t, test_key(t, i), (char *)value.data) == LDB_OK);
+  }
 
-  /* Switch from reverse to forward */
-  ldb_iter_last(iter);
-  ldb_iter_prev(iter);
-  ldb_iter_prev(iter);
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  /* Flushes always use the level 0 entry. */
+  ldb_test_compact_memtable(t->db);
 
-  /* Switch from forward to reverse */
-  ldb_iter_first(iter);
-  ldb_iter_next(iter);
-  ldb_iter_next(iter);
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  for (level = 0; level < LDB_NUM_LEVELS - 1; level++) {
+    if (test_files_at_level(t, level) > 0)
+      break;
+  }
 
-  /* Make sure iter stays at snapshot */
-  ASSERT(test_put(t, "a", "va2") == LDB_OK);
-  ASSERT(test_put(t, "a2", "va3") == LDB_OK);
-  ASSERT(test_put(t, "b", "vb2") == LDB_OK);
-  ASSERT(test_put(t, "c", "vc2") == LDB_OK);
-  ASSERT(test_del(t, "b") == LDB_OK);
+  ASSERT(level < LDB_NUM_LEVELS - 1);
 
-  ldb_iter_first(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
-  ldb_iter_last(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "b->vb");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  before = test_size(t, "", "~");
 
-  ldb_iter_destroy(iter);
-}
+  ASSERT(before >= 200000);
 
-static void
-test_db_iter_small_and_large_mix(test_t *t) {
-  ldb_iter_t *iter;
+  /* Deeper levels fall back to the last entry. */
+  ldb_test_compact_range(t->db, level, NULL, NULL);
 
-  ASSERT(test_put(t, "a", "va") == LDB_OK);
-  ASSERT(test_put(t, "b", string_fill(t, 'b', 100000)) == LDB_OK);
-  ASSERT(test_put(t, "c", "vc") == LDB_OK);
-  ASSERT(test_put(t, "d", string_fill(t, 'd', 100000)) == LDB_OK);
-  ASSERT(test_put(t, "e", string_fill(t, 'e', 100000)) == LDB_OK);
+  ASSERT(test_files_at_level(t, level + 1) > 0);
 
-  iter = ldb_iterator(t->db, ldb_readopt_default);
+  after = test_size(t, "", "~");
 
-  ldb_iter_first(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "b->", 'b', 100000));
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "d->", 'd', 100000));
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "e->", 'e', 100000));
-  ldb_iter_next(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ASSERT(after < before / 2);
 
-  ldb_iter_last(iter);
-  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "e->", 'e', 100000));
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "d->", 'd', 100000));
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "c->vc");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "b->", 'b', 100000));
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "a->va");
-  ldb_iter_prev(iter);
-  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  for (i = 0; i < 20; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 10000);
 
-  ldb_iter_destroy(iter);
+  ldb_buffer_clear(&value);
 }
 
-static void
-test_db_iter_multi_with_delete(test_t *t) {
-  do {
-    ldb_iter_t *iter;
-
-    ASSERT(test_put(t, "a", "va") == LDB_OK);
-    ASSERT(test_put(t, "b", "vb") == LDB_OK);
-    ASSERT(test_put(t, "c", "vc") == LDB_OK);
-    ASSERT(test_del(t, "b") == LDB_OK);
-
-    ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+/* Total data blocks of the tables, from "leveldb.table-properties". */
+static unsigned long
+test_data_blocks(test_t *t) {
+  unsigned long total = 0;
+  const char *p;
+  char *value;
 
-    iter = ldb_iterator(t->db, ldb_readopt_default);
+  ASSERT(ldb_property(t->db, "leveldb.table-properties", &value));
 
-    iter_seek(iter, "c");
-    ASSERT_EQ(iter_status(t, iter), "c->vc");
+  for (p = strstr(value, " data_blocks="); p != NULL;
+       p = strstr(p + 1, " data_blocks=")) {
+    total += strtoul(p + 13, NULL, 10);
+  }
 
-    ldb_iter_prev(iter);
-    ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_free(value);
 
-    ldb_iter_destroy(iter);
-  } while (test_change_options(t));
+  return total;
 }
 
 static void
-test_db_iter_multi_with_delete_and_compaction(test_t *t) {
-  do {
-    ldb_iter_t *iter;
+test_db_block_size_per_level(test_t *t) {
+  static const size_t sizes[] = { 1 << 10, 64 << 10 };
+  static const int intervals[] = { 1, 16 };
+  ldb_dbopt_t options = test_current_options(t);
+  unsigned long before, after;
+  int i, level;
 
-    ASSERT(test_put(t, "b", "vb") == LDB_OK);
-    ASSERT(test_put(t, "c", "vc") == LDB_OK);
-    ASSERT(test_put(t, "a", "va") == LDB_OK);
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.block_size_per_level = sizes;
+  options.block_size_levels = lengthof(sizes);
+  options.restart_interval_per_level = intervals;
+  options.restart_interval_levels = lengthof(intervals);
 
-    ldb_test_compact_memtable(t->db);
+  test_destroy_and_reopen(t, &options);
 
-    ASSERT(test_del(t, "b") == LDB_OK);
-    ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+  for (i = 0; i < 200; i++)
+    ASSERT(test_put(t, test_key(t, i), string_fill(t, 'v', 1000)) == LDB_OK);
 
-    iter = ldb_iterator(t->db, ldb_readopt_default);
+  /* Flushes always use the level 0 entry. */
+  ldb_test_compact_memtable(t->db);
 
-    iter_seek(iter, "c");
-    ASSERT_EQ(iter_status(t, iter), "c->vc");
+  for (level = 0; level < LDB_NUM_LEVELS - 1; level++) {
+    if (test_files_at_level(t, level) > 0)
+      break;
+  }
 
-    ldb_iter_prev(iter);
-    ASSERT_EQ(iter_status(t, iter), "a->va");
+  ASSERT(level < LDB_NUM_LEVELS - 1);
 
-    iter_seek(iter, "b");
-    ASSERT_EQ(iter_status(t, iter), "c->vc");
+  before = test_data_blocks(t);
 
-    ldb_iter_destroy(iter);
-  } while (test_change_options(t));
-}
+  ASSERT(before >= 150);
 
-static void
-test_db_recover(test_t *t) {
-  do {
-    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
-    ASSERT(test_put(t, "baz", "v5") == LDB_OK);
+  /* Deeper levels fall back to the last entry. */
+  ldb_test_compact_range(t->db, level, NULL, NULL);
 
-    test_reopen(t, 0);
+  ASSERT(test_files_at_level(t, level + 1) > 0);
 
-    ASSERT_EQ("v1", test_get(t, "foo"));
-    ASSERT_EQ("v1", test_get(t, "foo"));
-    ASSERT_EQ("v5", test_get(t, "baz"));
-    ASSERT(test_put(t, "bar", "v2") == LDB_OK);
-    ASSERT(test_put(t, "foo", "v3") == LDB_OK);
+  after = test_data_blocks(t);
 
-    test_reopen(t, 0);
+  ASSERT(after <= 5);
 
-    ASSERT_EQ("v3", test_get(t, "foo"));
-    ASSERT(test_put(t, "foo", "v4") == LDB_OK);
-    ASSERT_EQ("v4", test_get(t, "foo"));
-    ASSERT_EQ("v2", test_get(t, "bar"));
-    ASSERT_EQ("v5", test_get(t, "baz"));
-  } while (test_change_options(t));
+  for (i = 0; i < 200; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 1000);
 }
 
 static void
-test_db_recover_with_empty_log(test_t *t) {
-  do {
-    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
-    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+test_db_zstd_dictionary(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_buffer_t value;
+  ldb_rand_t rnd;
+  int i, level;
 
-    test_reopen(t, 0);
-    test_reopen(t, 0);
+  /* Falls back to uncompressed blocks when zstd is not built. */
+  options.create_if_missing = 1;
+  options.compression = LDB_ZSTD_COMPRESSION;
+  options.zstd_max_dict_bytes = 4096;
 
-    ASSERT(test_put(t, "foo", "v3") == LDB_OK);
+  test_destroy_and_reopen(t, &options);
 
-    test_reopen(t, 0);
+  ldb_rand_init(&rnd, 301);
+  ldb_buffer_init(&value);
 
-    ASSERT_EQ("v3", test_get(t, "foo"));
-  } while (test_change_options(t));
-}
+  for (i = 0; i < 200; i++) {
+    ldb_buffer_reset(&value);
+    ldb_compressible_string(&value, &rnd, 0.25, 1000);
+    ldb_buffer_push(&value, 0);
 
-/* Check that writes done during a memtable compaction are recovered
-   if the database is shutdown during the memtable compaction. */
-static void
-test_db_recover_during_memtable_compaction(test_t *t) {
-  do {
-    ldb_dbopt_t options = test_current_options(t);
+    ASSERT(test_put(t, test_key(t, i), (char *)value.data) == LDB_OK);
+  }
 
-    options.write_buffer_size = 1000000;
+  ldb_test_compact_memtable(t->db);
 
-    test_reopen(t, &options);
+  for (level = 0; level < LDB_NUM_LEVELS - 1; level++) {
+    if (test_files_at_level(t, level) > 0)
+      break;
+  }
 
-    /* Trigger a long memtable compaction and reopen the database during it */
-    ASSERT(test_put(t, "foo", "v1") == LDB_OK); /* Goes to 1st log file */
-    ASSERT(test_put(t, "big1", string_fill(t, 'x', 10000000)) == LDB_OK); /* Fills memtable */
-    ASSERT(test_put(t, "big2", string_fill(t, 'y', 1000)) == LDB_OK); /* Triggers compaction */
-    ASSERT(test_put(t, "bar", "v2") == LDB_OK); /* Goes to new log file */
+  ASSERT(level < LDB_NUM_LEVELS - 1);
 
-    test_reopen(t, &options);
+  /* Compaction outputs carry a trained dictionary. */
+  ldb_test_compact_range(t->db, level, NULL, NULL);
 
-    ASSERT_EQ("v1", test_get(t, "foo"));
-    ASSERT_EQ("v2", test_get(t, "bar"));
-    ASSERT_EQ(string_fill(t, 'x', 10000000), test_get(t, "big1"));
-    ASSERT_EQ(string_fill(t, 'y', 1000), test_get(t, "big2"));
-  } while (test_change_options(t));
+  ASSERT(test_files_at_level(t, level + 1) > 0);
+
+  for (i = 0; i < 200; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 1000);
+
+  /* Tables still decode after reopening. */
+  test_reopen(t, &options);
+
+  for (i = 0; i < 200; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 1000);
+
+  ldb_buffer_clear(&value);
 }
 
 static void
-test_db_minor_compactions_happen(test_t *t) {
+test_db_multiget(test_t *t) {
   ldb_dbopt_t options = test_current_options(t);
-  int starting_num_tables;
-  int ending_num_tables;
-  const int N = 500;
-  int i;
-
-  options.write_buffer_size = 10000;
+  ldb_slice_t keys[400];
+  ldb_slice_t values[400];
+  int statuses[400];
+  const ldb_snapshot_t *snap;
+  ldb_readopt_t opt;
+  char val[32];
+  int i, pass;
+
+  /* Small blocks, read with pread, so batches span several reads. */
+  options.create_if_missing = 1;
+  options.write_buffer_size = 100000;
+  options.block_size = 256;
+  options.use_mmap = 0;
 
-  test_reopen(t, &options);
+  test_destroy_and_reopen(t, &options);
 
-  starting_num_tables = test_total_files(t);
+  /* Oldest values end up below level 0. */
+  for (i = 0; i < 200; i++) {
+    sprintf(val, "v%d", i);
+    ASSERT(test_put(t, test_key(t, i), val) == LDB_OK);
+  }
 
-  for (i = 0; i < N; i++) {
-    const char *key = test_key(t, i);
-    const char *val = string_fill2(t, key, 'v', 1000);
+  ldb_test_compact_memtable(t->db);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-    ASSERT(test_put(t, key, val) == LDB_OK);
+  /* Overwrites in a level-0 file. */
+  for (i = 0; i < 200; i += 2) {
+    sprintf(val, "w%d", i);
+    ASSERT(test_put(t, test_key(t, i), val) == LDB_OK);
   }
 
-  ending_num_tables = test_total_files(t);
+  ldb_test_compact_memtable(t->db);
 
-  ASSERT(ending_num_tables > starting_num_tables);
+  snap = ldb_snapshot(t->db);
 
-  for (i = 0; i < N; i++) {
-    const char *key = test_key(t, i);
-    const char *val = string_fill2(t, key, 'v', 1000);
+  /* Deletions and new keys in the memtable. */
+  for (i = 0; i < 200; i += 5)
+    ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
 
-    ASSERT_EQ(val, test_get(t, key));
+  for (i = 300; i < 350; i++) {
+    sprintf(val, "m%d", i);
+    ASSERT(test_put(t, test_key(t, i), val) == LDB_OK);
   }
 
-  test_reopen(t, 0);
+  for (i = 0; i < 400; i++)
+    keys[i] = ldb_string(test_key(t, i));
 
-  for (i = 0; i < N; i++) {
-    const char *key = test_key(t, i);
-    const char *val = string_fill2(t, key, 'v', 1000);
+  for (pass = 0; pass < 2; pass++) {
+    opt = *ldb_readopt_default;
+    opt.snapshot = pass ? snap : NULL;
 
-    ASSERT_EQ(val, test_get(t, key));
+    ASSERT(ldb_multiget(t->db, keys, values, statuses, 400, &opt) == LDB_OK);
+
+    for (i = 0; i < 400; i++) {
+      const char *expect = test_get2(t, test_key(t, i), opt.snapshot);
+
+      if (statuses[i] == LDB_NOTFOUND) {
+        ASSERT_EQ("NOT_FOUND", expect);
+      } else {
+        ASSERT(statuses[i] == LDB_OK);
+        ASSERT(values[i].size == strlen(expect));
+        ASSERT(memcmp(values[i].data, expect, values[i].size) == 0);
+        ldb_free(values[i].data);
+      }
+    }
   }
+
+  /* Existence checks only. */
+  ASSERT(ldb_multiget(t->db, keys, NULL, statuses, 400, NULL) == LDB_OK);
+
+  ASSERT(statuses[0] == LDB_NOTFOUND);
+  ASSERT(statuses[1] == LDB_OK);
+  ASSERT(statuses[300] == LDB_OK);
+  ASSERT(statuses[399] == LDB_NOTFOUND);
+
+  ldb_release(t->db, snap);
 }
 
 static void
-test_db_recover_with_large_log(test_t *t) {
-  {
-    ldb_dbopt_t options = test_current_options(t);
+test_db_packed(test_t *t) {
+  ldb_slice_t key, val, data;
+  ldb_buffer_t buf, keys;
+  unsigned char out[64];
+  size_t i, len, total;
+  uint32_t size;
+  ldb_iter_t *it;
+  void *result;
+  char tmp[32];
+
+  ldb_buffer_init(&buf);
+  ldb_buffer_init(&keys);
 
-    test_reopen(t, &options);
+  for (i = 0; i < 100; i++) {
+    sprintf(tmp, "key%03d", (int)i);
 
-    ASSERT(test_put(t, "big1", string_fill(t, '1', 200000)) == LDB_OK);
-    ASSERT(test_put(t, "big2", string_fill(t, '2', 200000)) == LDB_OK);
-    ASSERT(test_put(t, "small3", string_fill(t, '3', 10)) == LDB_OK);
-    ASSERT(test_put(t, "small4", string_fill(t, '4', 10)) == LDB_OK);
-    ASSERT(test_files_at_level(t, 0) == 0);
+    key = ldb_string(tmp);
+    val = ldb_string(i % 10 == 0 ? "" : "value");
+
+    ldb_slice_export(&buf, &key);
+    ldb_slice_export(&buf, &val);
+
+    /* Look up every other key, plus some that are missing. */
+    if (i % 2 == 0)
+      ldb_slice_export(&keys, &key);
   }
 
-  /* Make sure that if we re-open with a small write buffer size that
-     we flush table files in the middle of a large log file. */
-  {
-    ldb_dbopt_t options = test_current_options(t);
+  key = ldb_string("nope");
+  ldb_slice_export(&keys, &key);
 
-    options.write_buffer_size = 100000;
+  ASSERT(ldb_put_packed(t->db, buf.data, buf.size, NULL) == LDB_OK);
+  ASSERT(ldb_put_packed(t->db, buf.data, buf.size - 1, NULL) == LDB_INVALID);
 
-    test_reopen(t, &options);
+  ASSERT_EQ("value", test_get(t, "key001"));
+  ASSERT_EQ("", test_get(t, "key090"));
 
-    ASSERT(test_files_at_level(t, 0) == 3);
-    ASSERT_EQ(string_fill(t, '1', 200000), test_get(t, "big1"));
-    ASSERT_EQ(string_fill(t, '2', 200000), test_get(t, "big2"));
-    ASSERT_EQ(string_fill(t, '3', 10), test_get(t, "small3"));
-    ASSERT_EQ(string_fill(t, '4', 10), test_get(t, "small4"));
-    ASSERT(test_files_at_level(t, 0) > 1);
+  ASSERT(ldb_get_packed(t->db, keys.data, keys.size,
+                        &result, &len, NULL) == LDB_OK);
+
+  ldb_slice_set(&data, result, len);
+
+  for (i = 0; i < 100; i += 2) {
+    ASSERT(ldb_varint32_slurp(&size, &data));
+    ASSERT(size == (i % 10 == 0 ? 1 : 6));
+    ASSERT(data.size >= size - 1);
+
+    data.data += size - 1;
+    data.size -= size - 1;
   }
-}
 
-static void
-test_db_compactions_generate_multiple_files(test_t *t) {
-  ldb_dbopt_t options = test_current_options(t);
-  ldb_vector_t values;
-  ldb_rand_t rnd;
-  int i;
+  ASSERT(ldb_varint32_slurp(&size, &data));
+  ASSERT(size == 0);
+  ASSERT(data.size == 0);
 
-  ldb_vector_init(&values);
-  ldb_rand_init(&rnd, 301);
+  ldb_free(result);
 
-  options.write_buffer_size = 100000000; /* Large write buffer */
+  /* Read everything back in buffer-sized chunks. */
+  it = ldb_iterator(t->db, NULL);
+  ldb_iter_first(it);
 
-  test_reopen(t, &options);
+  total = 0;
 
-  /* Write 8MB (80 values, each 100K) */
-  ASSERT(test_files_at_level(t, 0) == 0);
+  while (ldb_iter_valid(it)) {
+    len = ldb_iter_fill(it, out, sizeof(out), 3);
 
-  for (i = 0; i < 80; i++) {
-    const char *value = random_string(t, &rnd, 100000);
+    ASSERT(len > 0);
 
-    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+    ldb_slice_set(&data, out, len);
 
-    ldb_vector_push(&values, value);
+    while (data.size > 0) {
+      ASSERT(ldb_slice_slurp(&key, &data));
+      ASSERT(ldb_slice_slurp(&val, &data));
+
+      sprintf(tmp, "key%03d", (int)total);
+
+      ASSERT(key.size == 6 && memcmp(key.data, tmp, 6) == 0);
+
+      total++;
+    }
   }
 
-  /* Reopening moves updates to level-0 */
-  test_reopen(t, &options);
+  ASSERT(total == 100);
 
-  ldb_test_compact_range(t->db, 0, NULL, NULL);
+  /* An entry larger than the buffer is not skipped. */
+  ldb_iter_first(it);
 
-  ASSERT(test_files_at_level(t, 0) == 0);
-  ASSERT(test_files_at_level(t, 1) > 1);
+  ASSERT(ldb_iter_fill(it, out, 4, 10) == 0);
+  ASSERT(ldb_iter_valid(it));
+  ASSERT(ldb_iter_fill(it, out, sizeof(out), 0) == 0);
 
-  for (i = 0; i < 80; i++)
-    ASSERT_EQ(test_get(t, test_key(t, i)), values.items[i]);
+  ldb_iter_destroy(it);
 
-  ldb_vector_clear(&values);
+  ldb_buffer_clear(&keys);
+  ldb_buffer_clear(&buf);
 }
 
 static void
-test_db_repeated_writes_to_same_key(test_t *t) {
-  ldb_dbopt_t options = test_current_options(t);
-  const char *value;
-  int i, max_files;
-  ldb_rand_t rnd;
+test_db_next_batch(test_t *t) {
+  ldb_slice_t keys[8], values[8];
+  unsigned char buf[100];
+  size_t i, n, total;
+  ldb_iter_t *it;
+  char tmp[32];
+
+  for (i = 0; i < 50; i++) {
+    sprintf(tmp, "key%03d", (int)i);
+    ASSERT(test_put(t, tmp, tmp + 3) == LDB_OK);
+  }
 
-  ldb_rand_init(&rnd, 301);
+  ldb_test_compact_memtable(t->db);
 
-  options.write_buffer_size = 100000; /* Small write buffer */
+  ASSERT(test_put(t, "key049", "last") == LDB_OK);
 
-  test_reopen(t, &options);
+  it = ldb_iterator(t->db, NULL);
 
-  /* We must have at most one file per level except for level-0,
-     which may have up to LDB_L0_STOP_WRITES_TRIGGER files. */
-  max_files = LDB_NUM_LEVELS + LDB_L0_STOP_WRITES_TRIGGER;
+  total = 0;
 
-  value = random_string(t, &rnd, 2 * options.write_buffer_size);
+  for (ldb_iter_first(it); ldb_iter_valid(it); total += n) {
+    n = ldb_iter_next_batch(it, keys, values, 8, buf, sizeof(buf));
 
-  for (i = 0; i < 5 * max_files; i++) {
-    test_put(t, "key", value);
+    /* 9 bytes per entry. */
+    ASSERT(n == LDB_MIN(50 - total, 8));
 
-    ASSERT(test_total_files(t) <= max_files);
+    for (i = 0; i < n; i++) {
+      sprintf(tmp, "key%03d", (int)(total + i));
 
-    fprintf(stderr, "after %d: %d files\n", i + 1, test_total_files(t));
+      ASSERT(keys[i].size == 6 && memcmp(keys[i].data, tmp, 6) == 0);
+
+      if (total + i == 49)
+        ASSERT(values[i].size == 4 && memcmp(values[i].data, "last", 4) == 0);
+      else
+        ASSERT(values[i].size == 3 && memcmp(values[i].data, tmp + 3, 3) == 0);
+    }
   }
-}
 
-static void
-test_db_sparse_merge(test_t *t) {
-  ldb_dbopt_t options = test_current_options(t);
-  const char *value;
-  int i;
+  ASSERT(total == 50);
+  ASSERT(ldb_iter_next_batch(it, keys, values, 8, buf, sizeof(buf)) == 0);
 
-  options.compression = LDB_NO_COMPRESSION;
+  /* Stops at the first entry that does not fit. */
+  ldb_iter_first(it);
 
-  test_reopen(t, &options);
+  ASSERT(ldb_iter_next_batch(it, keys, values, 8, buf, 20) == 2);
+  ASSERT(ldb_iter_next_batch(it, keys, values, 8, buf, 5) == 0);
+  ASSERT(ldb_iter_valid(it));
+  ASSERT(ldb_iter_compare(it, &keys[1]) > 0);
 
-  test_fill_levels(t, "A", "Z");
+  ldb_iter_destroy(it);
+}
 
-  /* Suppose there is:
-   *    small amount of data with prefix A
-   *    large amount of data with prefix B
-   *    small amount of data with prefix C
-   * and that recent updates have made small changes to all three prefixes.
-   * Check that we do not do a compaction that merges all of B in one shot.
-   */
-  value = string_fill(t, 'x', 1000);
+static void
+test_db_read_state(test_t *t) {
+  const ldb_snapshot_t *snap = NULL;
+  char key[32], val[32];
+  int i;
 
-  test_put(t, "A", "va");
+  /* Reads must follow memtable switches and new versions. */
+  for (i = 0; i < 200; i++) {
+    sprintf(key, "key%03d", i);
+    sprintf(val, "v%d", i);
 
-  /* Write approximately 100MB of "B" values */
-  for (i = 0; i < 100000; i++) {
-    char key[100];
-    sprintf(key, "B%010d", i);
-    test_put(t, key, value);
-  }
+    test_put(t, key, val);
 
-  test_put(t, "C", "vc");
+    ASSERT_EQ(val, test_get(t, key));
 
-  ldb_test_compact_memtable(t->db);
-  ldb_test_compact_range(t->db, 0, NULL, NULL);
+    if (i % 25 == 24)
+      ldb_test_compact_memtable(t->db);
 
-  /* Make sparse update */
-  test_put(t, "A", "va2");
-  test_put(t, "B100", "bvalue2");
-  test_put(t, "C", "vc2");
+    if (i % 50 == 49)
+      ldb_compact(t->db, NULL, NULL);
 
-  ldb_test_compact_memtable(t->db);
+    if (i == 100)
+      snap = ldb_snapshot(t->db);
+  }
 
-  /* Compactions should not cause us to create a situation where
-     a file overlaps too much data at the next level. */
-  ASSERT(ldb_test_max_next_level_overlapping_bytes(t->db) <= 20 * 1048576);
+  for (i = 0; i < 200; i++) {
+    sprintf(key, "key%03d", i);
+    sprintf(val, "v%d", i);
 
-  ldb_test_compact_range(t->db, 0, NULL, NULL);
-  ASSERT(ldb_test_max_next_level_overlapping_bytes(t->db) <= 20 * 1048576);
+    ASSERT_EQ(val, test_get(t, key));
 
-  ldb_test_compact_range(t->db, 1, NULL, NULL);
-  ASSERT(ldb_test_max_next_level_overlapping_bytes(t->db) <= 20 * 1048576);
-}
+    test_put(t, key, "x");
 
-static int
-check_range(uint64_t val, uint64_t low, uint64_t high) {
-  int result = (val >= low) && (val <= high);
+    ASSERT_EQ("x", test_get(t, key));
 
-  if (!result) {
-    fprintf(stderr, "Value %lu is not in range [%lu, %lu]\n",
-                    (unsigned long)val, (unsigned long)low,
-                                        (unsigned long)high);
+    if (i <= 100)
+      ASSERT_EQ(val, test_get2(t, key, snap));
+    else
+      ASSERT_EQ("NOT_FOUND", test_get2(t, key, snap));
   }
 
-  return result;
+  ldb_release(t->db, snap);
 }
 
-#define ASSERT_RANGE(x, y, z) ASSERT(check_range(x, y, z))
-
 static void
-test_db_approximate_sizes(test_t *t) {
-  static const int N = 80;
-  static const int S1 = 100000;
-  static const int S2 = 105000; /* Allow some expansion from metadata */
-  int i, run, compact_start;
+test_db_compaction_readahead(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_readopt_t opt = *ldb_readopt_default;
+  ldb_buffer_t value;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  int i, mmap, count;
 
-  do {
-    ldb_dbopt_t options = test_current_options(t);
-    ldb_rand_t rnd;
+  for (mmap = 0; mmap < 2; mmap++) {
+    /* Windows smaller than the tables, so scans cross several. */
+    options.create_if_missing = 1;
+    options.compaction_readahead_size = 8192;
+    options.use_mmap = mmap;
 
-    options.write_buffer_size = 100000000; /* Large write buffer */
-    options.compression = LDB_NO_COMPRESSION;
+    test_destroy_and_reopen(t, &options);
 
-    test_destroy_and_reopen(t, 0);
+    ldb_rand_init(&rnd, 301);
+    ldb_buffer_init(&value);
 
-    ASSERT_RANGE(test_size(t, "", "xyz"), 0, 0);
+    for (i = 0; i < 500; i++) {
+      ldb_buffer_reset(&value);
+      ldb_random_string(&value, &rnd, 1000);
+      ldb_buffer_push(&value, 0);
 
-    test_reopen(t, &options);
+      ASSERT(test_put(t, test_key(t, i), (char *)value.data) == LDB_OK);
 
-    ASSERT_RANGE(test_size(t, "", "xyz"), 0, 0);
+      if (i % 100 == 99)
+        ldb_test_compact_memtable(t->db);
+    }
+
+    ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-    /* Write 8MB (80 values, each 100K) */
     ASSERT(test_files_at_level(t, 0) == 0);
 
-    ldb_rand_init(&rnd, 301);
+    for (i = 0; i < 500; i++)
+      ASSERT(strlen(test_get(t, test_key(t, i))) == 1000);
 
-    for (i = 0; i < N; i++)
-      ASSERT(test_put(t, test_key(t, i), random_string(t, &rnd, S1)) == LDB_OK);
+    /* Scans may ask for readahead as well. */
+    opt.readahead_size = 4096;
 
-    /* 0 because approximate_sizes() does not account for memtable space */
-    ASSERT_RANGE(test_size(t, "", test_key(t, 50)), 0, 0);
+    iter = ldb_iterator(t->db, &opt);
+    count = 0;
 
-    if (options.reuse_logs) {
-      /* Recovery will reuse memtable, and approximate_sizes() does not
-         account for memtable usage; */
-      test_reopen(t, &options);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 50)), 0, 0);
-      continue;
-    }
+    for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+      count++;
 
-    /* Check sizes across recovery by reopening a few times */
-    for (run = 0; run < 3; run++) {
-      test_reopen(t, &options);
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
+    ASSERT(count == 500);
 
-      for (compact_start = 0; compact_start < N; compact_start += 10) {
-        ldb_slice_t cstart = ldb_string(test_key(t, compact_start));
-        ldb_slice_t cend = ldb_string(test_key(t, compact_start + 9));
+    ldb_iter_destroy(iter);
 
-        for (i = 0; i < N; i += 10) {
-          const char *k1 = test_key(t, i);
-          const char *k2 = test_key2(t, i, ".suffix");
-          const char *k3 = test_key(t, i + 10);
+    /* Otherwise they read ahead once they notice a sequential scan. */
+    opt.readahead_size = 0;
 
-          ASSERT_RANGE(test_size(t, "", k1), S1 * i, S2 * i);
-          ASSERT_RANGE(test_size(t, "", k2), S1 * (i + 1), S2 * (i + 1));
-          ASSERT_RANGE(test_size(t, k1, k3), S1 * 10, S2 * 10);
-        }
+    iter = ldb_iterator(t->db, &opt);
+    count = 0;
 
-        {
-          const char *k1 = test_key(t, 50);
-          const char *k2 = test_key2(t, 50, ".suffix");
+    for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+      count++;
 
-          ASSERT_RANGE(test_size(t, "", k1), S1 * 50, S2 * 50);
-          ASSERT_RANGE(test_size(t, "", k2), S1 * 50, S2 * 50);
-        }
+    ASSERT(count == 500);
 
-        ldb_test_compact_range(t->db, 0, &cstart, &cend);
-      }
+    for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter))
+      count--;
 
-      ASSERT(test_files_at_level(t, 0) == 0);
-      ASSERT(test_files_at_level(t, 1) > 0);
-    }
-  } while (test_change_options(t));
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
+    ASSERT(count == 0);
+
+    ldb_iter_destroy(iter);
+    ldb_buffer_clear(&value);
+  }
 }
 
 static void
-test_db_approximate_sizes_mix_of_small_and_large(test_t *t) {
-  do {
-    ldb_dbopt_t options = test_current_options(t);
-    const char *big1;
-    ldb_rand_t rnd;
-    int run;
+test_db_direct_io(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_buffer_t value;
+  ldb_rand_t rnd;
+  int i;
 
-    options.compression = LDB_NO_COMPRESSION;
+  options.create_if_missing = 1;
+  options.use_direct_reads = 1;
+  options.use_direct_io_for_flush_and_compaction = 1;
 
-    test_reopen(t, 0);
+  test_destroy_and_reopen(t, &options);
 
-    ldb_rand_init(&rnd, 301);
+  ldb_rand_init(&rnd, 301);
+  ldb_buffer_init(&value);
 
-    big1 = random_string(t, &rnd, 100000);
+  for (i = 0; i < 500; i++) {
+    ldb_buffer_reset(&value);
+    ldb_random_string(&value, &rnd, 1000);
+    ldb_buffer_push(&value, 0);
 
-    ASSERT(test_put(t, test_key(t, 0), random_string(t, &rnd, 10000)) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 1), random_string(t, &rnd, 10000)) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 2), big1) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 3), random_string(t, &rnd, 10000)) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 4), big1) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 5), random_string(t, &rnd, 10000)) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 6), random_string(t, &rnd, 300000)) == LDB_OK);
-    ASSERT(test_put(t, test_key(t, 7), random_string(t, &rnd, 10000)) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, i), (char *)value.data) == LDB_OK);
 
-    if (options.reuse_logs) {
-      /* Need to force a memtable compaction since recovery does not do so. */
-      ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
-    }
+    if (i % 100 == 99)
+      ldb_test_compact_memtable(t->db);
+  }
 
-    /* Check sizes across recovery by reopening a few times */
-    for (run = 0; run < 3; run++) {
-      test_reopen(t, &options);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-      ASSERT_RANGE(test_size(t, "", test_key(t, 0)), 0, 0);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 1)), 10000, 11000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 2)), 20000, 21000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 3)), 120000, 121000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 4)), 130000, 131000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 5)), 230000, 231000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 6)), 240000, 241000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 7)), 540000, 541000);
-      ASSERT_RANGE(test_size(t, "", test_key(t, 8)), 550000, 560000);
+  ASSERT(test_files_at_level(t, 0) == 0);
 
-      ASSERT_RANGE(test_size(t, test_key(t, 3), test_key(t, 5)), 110000,
-                                                                 111000);
+  test_reopen(t, &options);
 
-      ldb_test_compact_range(t->db, 0, NULL, NULL);
-    }
-  } while (test_change_options(t));
+  for (i = 0; i < 500; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 1000);
+
+  ldb_buffer_clear(&value);
 }
 
 static void
-test_db_iterator_pins_ref(test_t *t) {
-  ldb_iter_t *iter;
+test_db_rate_limiter(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_ratelimit_t *lim = ldb_ratelimit_create(64 << 20);
+  ldb_buffer_t value;
+  ldb_rand_t rnd;
   int i;
 
-  test_put(t, "foo", "hello");
+  options.create_if_missing = 1;
+  options.rate_limiter = lim;
 
-  /* Get iterator that will yield the current contents of the DB. */
-  iter = ldb_iterator(t->db, ldb_readopt_default);
+  test_destroy_and_reopen(t, &options);
 
-  /* Write to force compactions */
-  test_put(t, "foo", "newvalue1");
+  ldb_rand_init(&rnd, 301);
+  ldb_buffer_init(&value);
 
-  for (i = 0; i < 100; i++) {
-    const char *key = test_key(t, i);
-    const char *val = string_fill2(t, key, 'v', 100000);
+  for (i = 0; i < 500; i++) {
+    ldb_buffer_reset(&value);
+    ldb_random_string(&value, &rnd, 1000);
+    ldb_buffer_push(&value, 0);
 
-    ASSERT(test_put(t, key, val) == LDB_OK); /* 100K values */
+    /* Every flush spans the whole key range, so nothing is moved. */
+    ASSERT(test_put(t, test_key(t, (i * 7) % 500),
+                    (char *)value.data) == LDB_OK);
+
+    if (i % 100 == 99)
+      ldb_test_compact_memtable(t->db);
   }
 
-  test_put(t, "foo", "newvalue2");
+  /* Flushes are charged at high priority. */
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_HIGH) >= 500 * 1000);
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_LOW) == 0);
 
-  ldb_iter_first(iter);
+  /* Compactions are charged at low priority, for reads and writes. */
+  ldb_compact(t->db, NULL, NULL);
 
-  ASSERT(ldb_iter_valid(iter));
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_LOW) >= 2 * 500 * 1000);
 
-  ASSERT_EQ(iter_status(t, iter), "foo->hello");
+  /* The rate can change at runtime. */
+  ldb_ratelimit_set_rate(lim, 128 << 20);
 
-  ldb_iter_next(iter);
+  ASSERT(test_put(t, "foo", "bar") == LDB_OK);
 
-  ASSERT(!ldb_iter_valid(iter));
+  ldb_test_compact_memtable(t->db);
 
-  ldb_iter_destroy(iter);
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_HIGH) > 500 * 1000);
+
+  for (i = 0; i < 500; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 1000);
+
+  ldb_buffer_clear(&value);
+
+  test_close(t);
+
+  ldb_ratelimit_destroy(lim);
 }
 
 static void
-test_db_snapshot(test_t *t) {
-  const ldb_snapshot_t *s1, *s2, *s3;
+test_db_rate_limiter_auto(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_ratelimit_t *lim = ldb_ratelimit_create_auto(1 << 30);
+  int i;
 
-  do {
-    test_put(t, "foo", "v1");
+  options.create_if_missing = 1;
+  options.rate_limiter = lim;
 
-    s1 = ldb_snapshot(t->db);
+  test_destroy_and_reopen(t, &options);
 
-    test_put(t, "foo", "v2");
+  /* A handful of small flushes leave no compaction debt. */
+  for (i = 0; i < 3; i++) {
+    ASSERT(test_put(t, "foo", "bar") == LDB_OK);
 
-    s2 = ldb_snapshot(t->db);
+    ldb_test_compact_memtable(t->db);
+  }
 
-    test_put(t, "foo", "v3");
+  ASSERT(ldb_ratelimit_rate(lim) < (1 << 30));
 
-    s3 = ldb_snapshot(t->db);
+  test_close(t);
 
-    test_put(t, "foo", "v4");
+  ldb_ratelimit_destroy(lim);
+}
 
-    ASSERT_EQ("v1", test_get2(t, "foo", s1));
-    ASSERT_EQ("v2", test_get2(t, "foo", s2));
-    ASSERT_EQ("v3", test_get2(t, "foo", s3));
-    ASSERT_EQ("v4", test_get(t, "foo"));
+static void
+test_db_delayed_write(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int64_t start, elapsed;
+  char value[1000];
+  int i;
 
-    ldb_release(t->db, s3);
+  options.create_if_missing = 1;
+  options.level0_file_num_compaction_trigger = 100;
+  options.level0_slowdown_writes_trigger = 2;
+  options.level0_stop_writes_trigger = 100;
+  options.delayed_write_rate = 1 << 20;
 
-    ASSERT_EQ("v1", test_get2(t, "foo", s1));
-    ASSERT_EQ("v2", test_get2(t, "foo", s2));
-    ASSERT_EQ("v4", test_get(t, "foo"));
+  test_destroy_and_reopen(t, &options);
 
-    ldb_release(t->db, s1);
+  /* Overlapping flushes end up in level-0 once the levels below
+     are taken. Two reach the slowdown trigger. */
+  while (test_files_at_level(t, 0) < 2) {
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+    ASSERT(test_put(t, "z", "vz") == LDB_OK);
 
-    ASSERT_EQ("v2", test_get2(t, "foo", s2));
-    ASSERT_EQ("v4", test_get(t, "foo"));
+    ldb_test_compact_memtable(t->db);
+  }
 
-    ldb_release(t->db, s2);
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
 
-    ASSERT_EQ("v4", test_get(t, "foo"));
-  } while (test_change_options(t));
+  /* 200KB at ~1MB/s. */
+  start = ldb_now_usec();
+
+  for (i = 0; i < 200; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+
+  elapsed = ldb_now_usec() - start;
+
+  ASSERT(elapsed >= 100000);
+  ASSERT(test_files_at_level(t, 0) == 2);
+
+  for (i = 0; i < 200; i++)
+    ASSERT(strcmp(test_get(t, test_key(t, i)), value) == 0);
 }
 
 static void
-test_db_hidden_values_are_removed(test_t *t) {
-  do {
-    const ldb_snapshot_t *snapshot;
-    ldb_slice_t x = ldb_string("x");
-    const char *big;
-    ldb_rand_t rnd;
-    char *expect;
-
-    ldb_rand_init(&rnd, 301);
+test_db_parallel_manual_compaction(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char value[1000];
+  int i;
 
-    test_fill_levels(t, "a", "z");
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.write_buffer_size = 1 << 20;
+  options.max_file_size = 1 << 20;
+  options.num_levels = 3;
+  options.max_background_compactions = 4;
+  options.max_manual_compactions = 4;
 
-    big = random_string(t, &rnd, 50000);
+  test_destroy_and_reopen(t, &options);
 
-    test_put(t, "foo", big);
-    test_put(t, "pastfoo", "v");
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
 
-    snapshot = ldb_snapshot(t->db);
+  for (i = 0; i < 10000; i++)
+    ASSERT(test_put(t, test_key(t, (i * 7) % 10000), value) == LDB_OK);
 
-    test_put(t, "foo", "tiny");
-    test_put(t, "pastfoo2", "v2"); /* Advance sequence number one more */
+  ldb_compact(t->db, NULL, NULL);
 
-    ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
-    ASSERT(test_files_at_level(t, 0) > 0);
+  ASSERT(test_files_at_level(t, 0) == 0);
+  ASSERT(test_files_at_level(t, 1) == 0);
+  ASSERT(test_files_at_level(t, 2) > 0);
 
-    ASSERT_EQ(big, test_get2(t, "foo", snapshot));
-    ASSERT_RANGE(test_size(t, "", "pastfoo"), 50000, 60000);
+  /* Parts of level-1 share level-2 files at their edges. */
+  memset(value, 'y', sizeof(value) - 1);
 
-    ldb_release(t->db, snapshot);
+  for (i = 0; i < 10000; i += 2)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
 
-    expect = ldb_malloc(50100);
+  ldb_test_compact_memtable(t->db);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-    sprintf(expect, "[ tiny, %s ]", big);
+  ASSERT(test_files_at_level(t, 1) > 2);
 
-    ASSERT_EQ(test_all_entries(t, "foo"), expect);
+  ldb_test_compact_range(t->db, 1, NULL, NULL);
 
-    ldb_free(expect);
+  ASSERT(test_files_at_level(t, 0) == 0);
+  ASSERT(test_files_at_level(t, 1) == 0);
 
-    ldb_test_compact_range(t->db, 0, NULL, &x);
+  for (i = 0; i < 10000; i++) {
+    memset(value, i % 2 == 0 ? 'y' : 'x', sizeof(value) - 1);
 
-    ASSERT_EQ(test_all_entries(t, "foo"), "[ tiny ]");
-    ASSERT(test_files_at_level(t, 0) == 0);
-    ASSERT(test_files_at_level(t, 1) >= 1);
+    ASSERT(strcmp(test_get(t, test_key(t, i)), value) == 0);
+  }
 
-    ldb_test_compact_range(t->db, 1, NULL, &x);
+  test_reopen(t, &options);
 
-    ASSERT_EQ(test_all_entries(t, "foo"), "[ tiny ]");
+  for (i = 0; i < 10000; i++) {
+    memset(value, i % 2 == 0 ? 'y' : 'x', sizeof(value) - 1);
 
-    ASSERT_RANGE(test_size(t, "", "pastfoo"), 0, 1000);
-  } while (test_change_options(t));
+    ASSERT(strcmp(test_get(t, test_key(t, i)), value) == 0);
+  }
 }
 
+/* Records the largest number of files moved at once. */
 static void
-test_db_deletion_markers_1(test_t *t) {
-  const int last = LDB_MAX_MEM_COMPACT_LEVEL;
-  ldb_slice_t z = ldb_string("z");
+test_move_logv(void *state, const char *fmt, va_list ap) {
+  int *most = state;
+  char line[1024];
+  int count;
 
-  test_put(t, "foo", "v1");
+  vsprintf(line, fmt, ap);
 
-  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
-  ASSERT(test_files_at_level(t, last) == 1); /* foo => v1 is now in last level */
+  if (sscanf(line, "Moved #%*d (%d files)", &count) == 1 && count > *most)
+    *most = count;
+}
 
-  /* Place a table at level last-1 to prevent merging with preceding mutation */
-  test_put(t, "a", "begin");
-  test_put(t, "z", "end");
+static void
+test_db_multi_file_move(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_logger_t *logger;
+  char value[1000];
+  int most = 0;
+  int i;
 
-  ldb_test_compact_memtable(t->db);
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.max_bytes_for_level_base = 10 << 20;
 
-  ASSERT(test_files_at_level(t, last) == 1);
-  ASSERT(test_files_at_level(t, last - 1) == 1);
+  test_destroy_and_reopen(t, &options);
 
-  test_del(t, "foo");
-  test_put(t, "foo", "v2");
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
 
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2, DEL, v1 ]");
-  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK); /* Moves to level last-2 */
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2, DEL, v1 ]");
+  /* Sequential writes leave a run of disjoint files. */
+  for (i = 0; i < 400; i++) {
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
 
-  ldb_test_compact_range(t->db, last - 2, NULL, &z);
+    if (i % 50 == 49)
+      ldb_test_compact_memtable(t->db);
+  }
 
-  /* DEL eliminated, but v1 remains because we aren't compacting
-     that level (DEL can be eliminated because v2 hides v1). */
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2, v1 ]");
-  ldb_test_compact_range(t->db, last - 1, NULL, NULL);
+  ASSERT_EQ("0,0,8", test_files_per_level(t));
 
-  /* Merging last-1 w/ last, so we are the base level
-     for "foo", so DEL is removed. (as is v1). */
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2 ]");
-}
+  /* Shrinking the levels moves as much of the run as is over each
+     level's target down in one edit: six files to level-3, then one
+     of those on to level-4. */
+  logger = ldb_logger_create(test_move_logv, &most);
 
-static void
-test_db_deletion_markers_2(test_t *t) {
-  const int last = LDB_MAX_MEM_COMPACT_LEVEL;
+  options.info_log = logger;
+  options.max_bytes_for_level_base = 64 << 10;
+  options.max_bytes_for_level_multiplier = 2;
 
-  test_put(t, "foo", "v1");
+  test_reopen(t, &options);
 
-  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
-  ASSERT(test_files_at_level(t, last) == 1); /* foo => v1 is now in last level */
+  for (i = 0; i < 1000 && test_files_at_level(t, 4) < 1; i++)
+    ldb_sleep_msec(10);
 
-  /* Place a table at level last-1 to prevent merging with preceding mutation */
-  test_put(t, "a", "begin");
-  test_put(t, "z", "end");
+  test_close(t);
 
-  ldb_test_compact_memtable(t->db);
+  ASSERT(most == 6);
 
-  ASSERT(test_files_at_level(t, last) == 1);
-  ASSERT(test_files_at_level(t, last - 1) == 1);
+  options.info_log = NULL;
 
-  test_del(t, "foo");
+  test_reopen(t, &options);
 
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ DEL, v1 ]");
-  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK); /* Moves to level last-2 */
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ DEL, v1 ]");
+  ASSERT_EQ("0,0,2,5,1", test_files_per_level(t));
 
-  ldb_test_compact_range(t->db, last - 2, NULL, NULL);
+  for (i = 0; i < 400; i++)
+    ASSERT_EQ(value, test_get(t, test_key(t, i)));
 
-  /* DEL kept: "last" file overlaps */
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ DEL, v1 ]");
-  ldb_test_compact_range(t->db, last - 1, NULL, NULL);
+  test_close(t);
 
-  /* Merging last-1 w/ last, so we are the base level
-     for "foo", so DEL is removed. (as is v1). */
-  ASSERT_EQ(test_all_entries(t, "foo"), "[ ]");
+  ldb_logger_destroy(logger);
 }
 
+/* Write "count" keys with values of "size" bytes and compact them
+   into level-3. */
 static void
-test_db_overlap_in_level0(test_t *t) {
-  do {
-    ASSERT(LDB_MAX_MEM_COMPACT_LEVEL == 2);
+test_fill_level3(test_t *t, int count, size_t size) {
+  char *value = ldb_malloc(size + 1);
+  int level, i;
 
-    /* Fill levels 1 and 2 to disable the pushing
-       of new memtables to levels > 0. */
-    ASSERT(test_put(t, "100", "v100") == LDB_OK);
-    ASSERT(test_put(t, "999", "v999") == LDB_OK);
-
-    ldb_test_compact_memtable(t->db);
-
-    ASSERT(test_del(t, "100") == LDB_OK);
-    ASSERT(test_del(t, "999") == LDB_OK);
+  memset(value, 'x', size);
+  value[size] = '\0';
 
-    ldb_test_compact_memtable(t->db);
+  for (i = 0; i < count; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
 
-    ASSERT_EQ("0,1,1", test_files_per_level(t));
+  ldb_test_compact_memtable(t->db);
 
-    /* Make files spanning the following ranges in level-0:
-     *
-     *   files[0]  200 .. 900
-     *   files[1]  300 .. 500
-     *
-     * Note that files are sorted by smallest key.
-     */
-    ASSERT(test_put(t, "300", "v300") == LDB_OK);
-    ASSERT(test_put(t, "500", "v500") == LDB_OK);
+  for (level = 0; level < 3; level++)
+    ldb_test_compact_range(t->db, level, NULL, NULL);
 
-    ldb_test_compact_memtable(t->db);
+  ldb_free(value);
+}
 
-    ASSERT(test_put(t, "200", "v200") == LDB_OK);
-    ASSERT(test_put(t, "600", "v600") == LDB_OK);
-    ASSERT(test_put(t, "900", "v900") == LDB_OK);
+static void
+test_db_output_file_sizes(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int64_t unaligned, aligned;
 
-    ldb_test_compact_memtable(t->db);
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.write_buffer_size = 100 << 20;
+  options.max_file_size = 1 << 20;
 
-    ASSERT_EQ("2,1,1", test_files_per_level(t));
+  test_destroy_and_reopen(t, &options);
+  test_fill_level3(t, 6000, 1000);
 
-    /* Compact away the placeholder files we created initially */
-    ldb_test_compact_range(t->db, 1, NULL, NULL);
-    ldb_test_compact_range(t->db, 2, NULL, NULL);
+  ASSERT_EQ("0,0,0,6", test_files_per_level(t));
 
-    ASSERT_EQ("2", test_files_per_level(t));
+  /* Files of level-3 target four times the size of level-1 files. */
+  options.max_file_size_multiplier = 2;
 
-    /* Do a memtable compaction. Before bug-fix, the compaction
-       would not detect the overlap with level-0 files and would
-       incorrectly place the deletion in a deeper level. */
-    ASSERT(test_del(t, "600") == LDB_OK);
+  test_destroy_and_reopen(t, &options);
+  test_fill_level3(t, 6000, 1000);
 
-    ldb_test_compact_memtable(t->db);
+  ASSERT_EQ("0,0,0,2", test_files_per_level(t));
 
-    ASSERT_EQ("3", test_files_per_level(t));
-    ASSERT_EQ("NOT_FOUND", test_get(t, "600"));
-  } while (test_change_options(t));
-}
+  /* Rewrite the keys above level-4 with smaller values, so that
+     outputs cut by size alone end in the middle of level-4 files. */
+  options.max_file_size_multiplier = 1;
 
-static void
-test_db_l0_compaction_bug_issue44_a(test_t *t) {
-  test_reopen(t, 0);
+  test_destroy_and_reopen(t, &options);
+  test_fill_level3(t, 6000, 1000);
+  ldb_test_compact_range(t->db, 3, NULL, NULL);
+  test_fill_level3(t, 6000, 700);
 
-  ASSERT(test_put(t, "b", "v") == LDB_OK);
+  unaligned = ldb_test_max_next_level_overlapping_bytes(t->db);
 
-  test_reopen(t, 0);
+  /* Aligned outputs end with the level-4 files instead. */
+  options.align_compaction_outputs = 1;
 
-  ASSERT(test_del(t, "b") == LDB_OK);
-  ASSERT(test_del(t, "a") == LDB_OK);
+  test_destroy_and_reopen(t, &options);
+  test_fill_level3(t, 6000, 1000);
+  ldb_test_compact_range(t->db, 3, NULL, NULL);
+  test_fill_level3(t, 6000, 700);
 
-  test_reopen(t, 0);
+  aligned = ldb_test_max_next_level_overlapping_bytes(t->db);
 
-  ASSERT(test_del(t, "a") == LDB_OK);
+  ASSERT(aligned * 2 < unaligned);
+}
 
-  test_reopen(t, 0);
+static void
+test_db_num_levels(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char value[1000];
+  char *tmp;
+  int i;
 
-  ASSERT(test_put(t, "a", "v") == LDB_OK);
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.write_buffer_size = 64 << 10;
+  options.num_levels = 3;
+  options.max_bytes_for_level_base = 64 << 10;
+  options.max_bytes_for_level_multiplier = 2;
 
-  test_reopen(t, 0);
-  test_reopen(t, 0);
+  test_destroy_and_reopen(t, &options);
 
-  ASSERT_EQ("(a->v)", test_contents(t));
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
 
-  ldb_sleep_msec(1000); /* Wait for compaction to finish */
+  for (i = 0; i < 2000; i++)
+    ASSERT(test_put(t, test_key(t, (i * 7) % 2000), value) == LDB_OK);
 
-  ASSERT_EQ("(a->v)", test_contents(t));
-}
+  ldb_compact(t->db, NULL, NULL);
 
-static void
-test_db_l0_compaction_bug_issue44_b(test_t *t) {
-  test_reopen(t, 0);
-  test_put(t, "", "");
-  test_reopen(t, 0);
-  test_del(t, "e");
-  test_put(t, "", "");
-  test_reopen(t, 0);
-  test_put(t, "c", "cv");
-  test_reopen(t, 0);
-  test_put(t, "", "");
-  test_reopen(t, 0);
-  test_put(t, "", "");
+  ASSERT(test_files_at_level(t, 0) == 0);
+  ASSERT(test_files_at_level(t, 1) == 0);
+  ASSERT(test_files_at_level(t, 2) > 0);
+  ASSERT(!ldb_property(t->db, "leveldb.num-files-at-level3", &tmp));
 
-  ldb_sleep_msec(1000); /* Wait for compaction to finish */
+  /* Level-2 holds files. */
+  options.num_levels = 2;
 
-  test_reopen(t, 0);
-  test_put(t, "d", "dv");
-  test_reopen(t, 0);
-  test_put(t, "", "");
-  test_reopen(t, 0);
-  test_del(t, "d");
-  test_del(t, "b");
-  test_reopen(t, 0);
+  ASSERT(test_try_reopen(t, &options) == LDB_INVALID);
 
-  ASSERT_EQ("(->)(c->cv)", test_contents(t));
+  options.num_levels = 3;
 
-  ldb_sleep_msec(1000); /* Wait for compaction to finish */
+  test_reopen(t, &options);
 
-  ASSERT_EQ("(->)(c->cv)", test_contents(t));
+  for (i = 0; i < 2000; i++)
+    ASSERT(strcmp(test_get(t, test_key(t, i)), value) == 0);
 }
 
 static void
-test_db_fflush_issue474(test_t *t) {
-  static const int num = 100000;
-  ldb_rand_t rnd;
+test_db_dynamic_level_bytes(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char value[1000];
   int i;
 
-  ldb_rand_init(&rnd, ldb_random_seed());
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.level0_file_num_compaction_trigger = 100;
+  options.max_bytes_for_level_base = 64 << 10;
+  options.level_compaction_dynamic_level_bytes = 1;
 
-  for (i = 0; i < num; i++) {
-    const char *key = random_key(t, &rnd);
-    const char *val = random_string(t, &rnd, 100);
+  test_destroy_and_reopen(t, &options);
 
-    fflush(NULL);
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
 
-    ASSERT(test_put(t, key, val) == LDB_OK);
-  }
-}
+  /* Flushes stay in level-0 and an empty database compacts
+     level-0 straight into the last level. */
+  ASSERT(test_put(t, "a", "va") == LDB_OK);
+  ASSERT(test_put(t, "z", "vz") == LDB_OK);
 
-static void
-test_db_comparator_check(test_t *t) {
-  ldb_comparator_t comparator = *ldb_bytewise_comparator;
-  ldb_dbopt_t options = test_current_options(t);
+  ldb_test_compact_memtable(t->db);
 
-  comparator.name = "leveldb.NewComparator";
+  ASSERT_EQ("1", test_files_per_level(t));
 
-  options.comparator = &comparator;
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-  ASSERT(test_try_reopen(t, &options) != LDB_OK);
-}
+  ASSERT_EQ("0,0,0,0,0,0,1", test_files_per_level(t));
 
-static int
-test_to_number(const ldb_slice_t *x) {
-  /* Check that there are no extra characters. */
-  char xp[100];
-  char ignored;
-  int val;
+  /* 300KB in the last level: level-5 (64KB) becomes the base. */
+  for (i = 0; i < 300; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
 
-  ASSERT(x->size < sizeof(xp));
-  ASSERT(x->size >= 2 && x->data[0] == '[' && x->data[x->size - 1] == ']');
+  ldb_test_compact_memtable(t->db);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-  memcpy(xp, x->data, x->size);
+  ASSERT(test_files_at_level(t, 6) > 0);
 
-  xp[x->size] = '\0';
+  for (i = 0; i < 20; i++)
+    ASSERT(test_put(t, test_key(t, i * 10), "v2") == LDB_OK);
 
-  ASSERT(sscanf(xp, "[%i]%c", &val, &ignored) == 1);
+  ldb_test_compact_memtable(t->db);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
 
-  return val;
-}
+  for (i = 0; i < 5; i++)
+    ASSERT(test_files_at_level(t, i) == 0);
 
-static int
-slice_compare(const ldb_comparator_t *comparator,
-              const ldb_slice_t *x,
-              const ldb_slice_t *y) {
-  (void)comparator;
-  return test_to_number(x) - test_to_number(y);
-}
+  ASSERT(test_files_at_level(t, 5) == 1);
 
-static void
-shortest_separator(const ldb_comparator_t *comparator,
-                   ldb_buffer_t *start,
-                   const ldb_slice_t *limit) {
-  (void)comparator;
-  test_to_number(start); /* Check format */
-  test_to_number(limit); /* Check format */
+  for (i = 0; i < 300; i++) {
+    const char *v = test_get(t, test_key(t, i));
+
+    ASSERT(strcmp(v, (i % 10 == 0 && i < 200) ? "v2" : value) == 0);
+  }
 }
 
+/* Wait for background compactions to empty level-0. */
 static void
-short_successor(const ldb_comparator_t *comparator, ldb_buffer_t *key) {
-  (void)comparator;
-  test_to_number(key); /* Check format */
+test_wait_level0(test_t *t) {
+  int i;
+
+  for (i = 0; i < 1000 && test_files_at_level(t, 0) > 0; i++)
+    ldb_sleep_msec(10);
 }
 
 static void
-test_db_custom_comparator(test_t *t) {
-  static const ldb_comparator_t comparator = {
-    /* .name = */ "test.NumberComparator",
-    /* .compare = */ slice_compare,
-    /* .shortest_separator = */ shortest_separator,
-    /* .short_successor = */ short_successor,
-    /* .user_comparator = */ NULL,
-    /* .state = */ NULL
-  };
-
+test_db_universal_compaction(test_t *t) {
   ldb_dbopt_t options = test_current_options(t);
-  int i, run;
+  char value[1000];
+  char vbuf[200];
+  int i, round;
 
   options.create_if_missing = 1;
-  options.comparator = &comparator;
-  options.filter_policy = NULL;     /* Cannot use bloom filters */
-  options.write_buffer_size = 1000; /* Compact more often */
+  options.compression = LDB_NO_COMPRESSION;
+  options.compaction_style = LDB_COMPACTION_UNIVERSAL;
+  options.level0_file_num_compaction_trigger = 2;
 
   test_destroy_and_reopen(t, &options);
 
-  ASSERT(test_put(t, "[10]", "ten") == LDB_OK);
-  ASSERT(test_put(t, "[0x14]", "twenty") == LDB_OK);
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
 
-  for (i = 0; i < 2; i++) {
-    ASSERT_EQ("ten", test_get(t, "[10]"));
-    ASSERT_EQ("ten", test_get(t, "[0xa]"));
-    ASSERT_EQ("twenty", test_get(t, "[20]"));
-    ASSERT_EQ("twenty", test_get(t, "[0x14]"));
-    ASSERT_EQ("NOT_FOUND", test_get(t, "[15]"));
-    ASSERT_EQ("NOT_FOUND", test_get(t, "[0xf]"));
+  /* Two runs reach the trigger: they are merged into the last level. */
+  for (i = 0; i < 200; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
 
-    test_compact(t, "[0]", "[9999]");
-  }
+  ldb_test_compact_memtable(t->db);
 
-  for (run = 0; run < 2; run++) {
-    for (i = 0; i < 1000; i++) {
-      char buf[100];
-      sprintf(buf, "[%d]", i * 10);
-      ASSERT(test_put(t, buf, buf) == LDB_OK);
+  for (i = 0; i < 200; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+  test_wait_level0(t);
+
+  ASSERT_EQ("0,0,0,0,0,0,1", test_files_per_level(t));
+
+  /* Small runs are merged with each other and stay above it. */
+  options.level0_file_num_compaction_trigger = 3;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, test_key(t, 10), "v1") == LDB_OK);
+  ASSERT(test_put(t, test_key(t, 20), "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, test_key(t, 20), "v2") == LDB_OK);
+  ASSERT(test_put(t, test_key(t, 30), "v2") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+  test_wait_level0(t);
+
+  ASSERT_EQ("0,0,0,0,0,1,1", test_files_per_level(t));
+
+  ASSERT_EQ("v1", test_get(t, test_key(t, 10)));
+  ASSERT_EQ("v2", test_get(t, test_key(t, 20)));
+  ASSERT_EQ("v2", test_get(t, test_key(t, 30)));
+  ASSERT(strcmp(test_get(t, test_key(t, 40)), value) == 0);
+
+  /* Overwrite everything a few times with more runs. */
+  options.write_buffer_size = 64 << 10;
+  options.level0_file_num_compaction_trigger = 4;
+
+  test_reopen(t, &options);
+
+  for (round = 0; round < 4; round++) {
+    for (i = 0; i < 2000; i++) {
+      int k = (i * 7919) % 2000;
+
+      sprintf(vbuf, "%d.%d.%-100d", k, round, i);
+
+      ASSERT(test_put(t, test_key(t, k), vbuf) == LDB_OK);
     }
+  }
 
-    test_compact(t, "[0]", "[1000000]");
+  for (i = 0; i < 2000; i += 2)
+    ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 2000; i++) {
+    const char *val = test_get(t, test_key(t, i));
+    int k, r;
+
+    if (i % 2 == 0) {
+      ASSERT_EQ("NOT_FOUND", val);
+    } else {
+      ASSERT(2 == sscanf(val, "%d.%d.", &k, &r));
+      ASSERT(k == i);
+      ASSERT(r == 3);
+    }
   }
 }
 
 static void
-test_db_manual_compaction(test_t *t) {
-  ASSERT(LDB_MAX_MEM_COMPACT_LEVEL == 2);
+test_db_fifo_compaction(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char value[1000];
+  int i, j;
 
-  test_make_tables(t, 3, "p", "q");
-  ASSERT_EQ("1,1,1", test_files_per_level(t));
+  options.create_if_missing = 1;
+  options.compression = LDB_NO_COMPRESSION;
+  options.compaction_style = LDB_COMPACTION_FIFO;
+  options.fifo_max_table_files_size = 350 << 10;
 
-  /* Compaction range falls before files */
-  test_compact(t, "", "c");
-  ASSERT_EQ("1,1,1", test_files_per_level(t));
+  test_destroy_and_reopen(t, &options);
 
-  /* Compaction range falls after files */
-  test_compact(t, "r", "z");
-  ASSERT_EQ("1,1,1", test_files_per_level(t));
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+
+  /* About 100KB per table; the oldest are dropped past 350KB. */
+  for (i = 0; i < 6; i++) {
+    for (j = 0; j < 100; j++)
+      ASSERT(test_put(t, test_key(t, i * 100 + j), value) == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  for (i = 0; i < 1000 && test_files_at_level(t, 0) > 3; i++)
+    ldb_sleep_msec(10);
+
+  ASSERT_EQ("3", test_files_per_level(t));
+  ASSERT(test_size(t, "", "~") <= (350 << 10));
+
+  ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, 0)));
+  ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, 299)));
+  ASSERT(strcmp(test_get(t, test_key(t, 300)), value) == 0);
+  ASSERT(strcmp(test_get(t, test_key(t, 599)), value) == 0);
+
+  /* Manual compactions leave the tables alone. */
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT_EQ("3", test_files_per_level(t));
+
+  /* Expired tables are dropped once compactions are considered. */
+  options.ttl = 2;
+
+  test_reopen(t, &options);
+
+  ldb_sleep_msec(3000);
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  for (i = 0; i < 1000 && test_files_at_level(t, 0) > 1; i++)
+    ldb_sleep_msec(10);
+
+  ASSERT_EQ("1", test_files_per_level(t));
+  ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, 300)));
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+}
+
+static int
+test_cfilter(const ldb_cfilter_t *filt,
+             int level,
+             const ldb_slice_t *key,
+             const ldb_slice_t *value,
+             ldb_slice_t *new_value) {
+  (void)filt;
+  (void)level;
+  (void)value;
+
+  if (key->size >= 4 && memcmp(key->data, "drop", 4) == 0)
+    return LDB_CFILTER_REMOVE;
+
+  if (key->size >= 2 && memcmp(key->data, "up", 2) == 0) {
+    new_value->data = ldb_malloc(3);
+    new_value->size = 3;
+
+    memcpy(new_value->data, "new", 3);
+
+    return LDB_CFILTER_CHANGE;
+  }
+
+  return LDB_CFILTER_KEEP;
+}
+
+static void
+test_compact_bottom(test_t *t) {
+  int level = 0;
+
+  while (test_files_at_level(t, level) == 0)
+    level++;
+
+  ldb_test_compact_range(t->db, level, NULL, NULL);
+}
+
+/* Sequence number of the newest entry for "user_key" (or -1). */
+static int64_t
+test_sequence(test_t *t, const char *user_key) {
+  ldb_slice_t ukey = ldb_string(user_key);
+  int64_t result = -1;
+  ldb_iter_t *iter;
+  ldb_ikey_t ikey;
+
+  ldb_ikey_init(&ikey);
+  ldb_ikey_set(&ikey, &ukey, LDB_MAX_SEQUENCE, LDB_TYPE_VALUE);
+
+  iter = ldb_test_internal_iterator(t->db);
+
+  ldb_iter_seek(iter, &ikey);
+
+  if (ldb_iter_valid(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_pkey_t pkey;
+
+    if (ldb_pkey_import(&pkey, &key) &&
+        ldb_compare(t->last_options.comparator, &pkey.user_key, &ukey) == 0) {
+      result = pkey.sequence;
+    }
+  }
+
+  ldb_iter_destroy(iter);
+  ldb_ikey_clear(&ikey);
+
+  return result;
+}
+
+static void
+test_db_bottommost_sequence(test_t *t) {
+  const ldb_snapshot_t *snap;
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+  ASSERT(test_put(t, "b", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_sequence(t, "a") > 0);
+
+  test_compact_bottom(t);
+
+  ASSERT(test_sequence(t, "a") == 0);
+  ASSERT(test_sequence(t, "b") == 0);
+  ASSERT_EQ("v1", test_get(t, "a"));
+
+  /* A value newer than a snapshot keeps its sequence number. */
+  snap = ldb_snapshot(t->db);
+
+  ASSERT(test_put(t, "a", "v2") == LDB_OK);
+
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT(test_sequence(t, "a") > 0);
+  ASSERT_EQ("[ v2, v1 ]", test_all_entries(t, "a"));
+  ASSERT_EQ("v1", test_get2(t, "a", snap));
+  ASSERT_EQ("v2", test_get(t, "a"));
+
+  ldb_release(t->db, snap);
+
+  test_compact_bottom(t);
+
+  ASSERT(test_sequence(t, "a") == 0);
+  ASSERT_EQ("[ v2 ]", test_all_entries(t, "a"));
+  ASSERT_EQ("v2", test_get(t, "a"));
+
+  test_reopen(t, NULL);
+
+  ASSERT_EQ("v2", test_get(t, "a"));
+  ASSERT_EQ("v1", test_get(t, "b"));
+}
+
+static void
+test_db_compaction_pri(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char value[1000];
+  char key[16];
+  int i;
+
+  options.compression = LDB_NO_COMPRESSION;
+
+  test_reopen(t, &options);
+
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+
+  /* Level-1 gets a small file ("b") over 1MB of level-2 data and a
+     1MB file ("x*") over almost none. */
+  for (i = 0; i < 1000; i++) {
+    sprintf(key, "a%04d", i);
+    ASSERT(test_put(t, key, value) == LDB_OK);
+  }
+
+  ASSERT(test_put(t, "c", "v") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, "b", "v") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, "w", "v") == LDB_OK);
+  ASSERT(test_put(t, "y", "v") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(key, "x%04d", i);
+    ASSERT(test_put(t, key, value) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("0,2,2", test_files_per_level(t));
+
+  /* Level-1 is over its target until the large file moves down. Round
+     robin would compact "b" first (and then the large file too); the
+     minimum overlapping ratio picks the large file alone. */
+  options.max_bytes_for_level_base = 512 << 10;
+  options.compaction_pri = LDB_PRI_MIN_OVERLAPPING_RATIO;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 1000 && test_files_at_level(t, 1) > 1; i++)
+    ldb_sleep_msec(10);
+
+  test_reopen(t, &options);
+
+  ASSERT(test_files_at_level(t, 1) == 1);
+  ASSERT_EQ("v", test_get(t, "b"));
+  ASSERT_EQ("v", test_get(t, "w"));
+  ASSERT(strcmp(test_get(t, "x0500"), value) == 0);
+}
+
+static void
+test_db_periodic_compaction(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const ldb_snapshot_t *snap;
+  int i;
+
+  options.create_if_missing = 1;
+  options.num_levels = 3;
+
+  test_destroy_and_reopen(t, &options);
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+  ASSERT(test_put(t, "b", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  /* A snapshot keeps the old versions in the last level. */
+  snap = ldb_snapshot(t->db);
+
+  ASSERT(test_put(t, "b", "v2") == LDB_OK);
+  ASSERT(test_del(t, "a") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  test_compact_bottom(t);
+
+  ldb_release(t->db, snap);
+
+  ASSERT(test_files_at_level(t, 1) == 0);
+  ASSERT(test_files_at_level(t, 2) == 1);
+  ASSERT_EQ("[ DEL, v1 ]", test_all_entries(t, "a"));
+  ASSERT_EQ("[ v2, v1 ]", test_all_entries(t, "b"));
+
+  /* Nothing else would ever compact the last level again. */
+  ldb_sleep_msec(1100);
+
+  options.periodic_compaction_seconds = 1;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 1000; i++) {
+    if (strcmp(test_all_entries(t, "b"), "[ v2 ]") == 0)
+      break;
+
+    ldb_sleep_msec(10);
+  }
+
+  ASSERT_EQ("[ v2 ]", test_all_entries(t, "b"));
+  ASSERT_EQ("[ ]", test_all_entries(t, "a"));
+  ASSERT(test_files_at_level(t, 2) == 1);
+  ASSERT_EQ("NOT_FOUND", test_get(t, "a"));
+  ASSERT_EQ("v2", test_get(t, "b"));
+}
+
+static void
+test_db_deletion_compaction(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char key[16];
+  int i;
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "k%04d", i);
+    ASSERT(test_put(t, key, "v") == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  for (i = 0; i < 90; i++) {
+    sprintf(key, "k%04d", i);
+    ASSERT(test_del(t, key) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("0,1,1", test_files_per_level(t));
+  ASSERT_EQ("[ DEL, v ]", test_all_entries(t, "k0000"));
+
+  /* The counts are kept in the manifest: the file is found on open. */
+  options.deletion_compaction_ratio = 0.5;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 1000 && test_files_at_level(t, 1) > 0; i++)
+    ldb_sleep_msec(10);
+
+  ASSERT_EQ("0,0,1", test_files_per_level(t));
+  ASSERT_EQ("[ ]", test_all_entries(t, "k0000"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "k0089"));
+  ASSERT_EQ("v", test_get(t, "k0090"));
+}
+
+static void
+test_db_table_properties(test_t *t) {
+  char key[16];
+  char *value;
+  int i;
+
+  for (i = 0; i < 10; i++) {
+    sprintf(key, "k%04d", i);
+    ASSERT(test_put(t, key, "v") == LDB_OK);
+  }
+
+  for (i = 0; i < 3; i++) {
+    sprintf(key, "k%04d", i);
+    ASSERT(test_del(t, key) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
 
-  /* Compaction range overlaps files */
-  test_compact(t, "p1", "p9");
   ASSERT_EQ("0,0,1", test_files_per_level(t));
 
-  /* Populate a different range */
-  test_make_tables(t, 3, "c", "e");
-  ASSERT_EQ("1,1,2", test_files_per_level(t));
+  ASSERT(ldb_property(t->db, "leveldb.table-properties", &value));
+
+  ldb_vector_push(&t->arena, value);
+
+  /* Internal keys are 13 bytes. */
+  ASSERT(strstr(value, "--- level 2 ---\n") != NULL);
+  ASSERT(strstr(value, "entries=13 deletions=3 tombstones=0"
+                       " raw_key_size=169 raw_value_size=10"
+                       " data_blocks=1 ") != NULL);
+  ASSERT(strstr(value, " sequences=1..13 ") != NULL);
+  ASSERT(strstr(value, " created=0\n") == NULL);
+}
+
+static void
+test_db_blob_files(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const char *values[20];
+  ldb_iter_t *iter;
+  char key[16];
+  ldb_rand_t rnd;
+  int i;
+
+  options.create_if_missing = 1;
+  options.min_blob_size = 100;
+  options.blob_gc_age_cutoff = 1.0;
+
+  test_destroy_and_reopen(t, &options);
+
+  ldb_rand_init(&rnd, 301);
+
+  for (i = 0; i < 20; i++) {
+    sprintf(key, "k%04d", i);
+    values[i] = (i & 1) ? "small" : random_string(t, &rnd, 1000);
+    ASSERT(test_put(t, key, values[i]) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_count_blob_files(t) == 1);
+  ASSERT_EQ("[ BLOB ]", test_all_entries(t, "k0000"));
+  ASSERT_EQ("[ small ]", test_all_entries(t, "k0001"));
+
+  for (i = 0; i < 20; i++) {
+    sprintf(key, "k%04d", i);
+    ASSERT_EQ(values[i], test_get(t, key));
+  }
+
+  /* Iterate in both directions. */
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  for (i = 0, ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+    ASSERT(ldb_iter_value(iter).size == strlen(values[i++]));
+
+  ASSERT(i == 20);
+
+  for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter)) {
+    ldb_slice_t val = ldb_iter_value(iter);
+    ASSERT(val.size == strlen(values[--i]));
+    ASSERT(memcmp(val.data, values[i], val.size) == 0);
+  }
+
+  ASSERT(i == 0);
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+  ldb_iter_destroy(iter);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ(values[4], test_get(t, "k0004"));
+
+  /* Rewriting the old blobs lets their file be deleted. */
+  for (i = 0; i < 20; i += 2) {
+    sprintf(key, "k%04d", i);
+    values[i] = random_string(t, &rnd, 1000);
+    ASSERT(test_put(t, key, values[i]) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_count_blob_files(t) == 2);
+
+  test_compact(t, "a", "z");
+
+  ASSERT(test_count_blob_files(t) == 1);
+
+  for (i = 0; i < 20; i++) {
+    sprintf(key, "k%04d", i);
+    ASSERT_EQ(values[i], test_get(t, key));
+  }
+
+  /* Without blobs, compaction moves values back into tables. */
+  options.min_blob_size = 0;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "k0001", "small") == LDB_OK);
+
+  test_compact(t, "a", "z");
+
+  ASSERT(test_count_blob_files(t) == 0);
+  ASSERT_EQ(values[0], test_get(t, "k0000"));
+  ASSERT_EQ("[ small ]", test_all_entries(t, "k0001"));
+}
+
+static void
+test_db_checkpoint(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_readopt_t ropt = *ldb_readopt_default;
+  char dbname[LDB_PATH_MAX];
+  ldb_slice_t key, val;
+  ldb_t *db;
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_checkpoint"));
+  ASSERT(ldb_destroy(dbname, NULL) == LDB_OK);
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+  ASSERT(test_put(t, "b", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  /* Unflushed writes are carried by the log. */
+  ASSERT(test_put(t, "b", "v2") == LDB_OK);
+  ASSERT(test_put(t, "c", "v2") == LDB_OK);
+
+  ASSERT(ldb_checkpoint(t->db, dbname) == LDB_OK);
+
+  ASSERT(test_put(t, "d", "v3") == LDB_OK);
+
+  test_compact(t, "a", "z");
+
+  ASSERT(ldb_open(dbname, &options, &db) == LDB_OK);
+
+  key = ldb_string("a");
+  ASSERT(ldb_get(db, &key, &val, &ropt) == LDB_OK);
+  ASSERT(val.size == 2 && memcmp(val.data, "v1", 2) == 0);
+  ldb_free(val.data);
+
+  key = ldb_string("b");
+  ASSERT(ldb_get(db, &key, &val, &ropt) == LDB_OK);
+  ASSERT(val.size == 2 && memcmp(val.data, "v2", 2) == 0);
+  ldb_free(val.data);
+
+  key = ldb_string("c");
+  ASSERT(ldb_get(db, &key, &val, &ropt) == LDB_OK);
+  ldb_free(val.data);
+
+  key = ldb_string("d");
+  ASSERT(ldb_get(db, &key, &val, &ropt) == LDB_NOTFOUND);
+
+  ldb_close(db);
+
+  ASSERT_EQ("v1", test_get(t, "a"));
+  ASSERT_EQ("v3", test_get(t, "d"));
+
+  ASSERT(ldb_destroy(dbname, NULL) == LDB_OK);
+}
+
+static void
+test_check_value(ldb_t *db, const char *k, const char *v) {
+  ldb_readopt_t ropt = *ldb_readopt_default;
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val;
+
+  if (v == NULL) {
+    ASSERT(ldb_get(db, &key, &val, &ropt) == LDB_NOTFOUND);
+    return;
+  }
+
+  ASSERT(ldb_get(db, &key, &val, &ropt) == LDB_OK);
+  ASSERT(val.size == strlen(v) && memcmp(val.data, v, val.size) == 0);
+
+  ldb_free(val.data);
+}
+
+static void
+test_db_copy_threaded(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char from[LDB_PATH_MAX];
+  char to[LDB_PATH_MAX];
+  char key[100];
+  ldb_t *db;
+  int i;
+
+  ASSERT(ldb_test_filename(from, sizeof(from), "db_copy_from"));
+  ASSERT(ldb_test_filename(to, sizeof(to), "db_copy_to"));
+
+  options.create_if_missing = 1;
+  options.max_file_opening_threads = 4;
+
+  ASSERT(ldb_destroy(from, &options) == LDB_OK);
+  ASSERT(ldb_destroy(to, &options) == LDB_OK);
+
+  ASSERT(ldb_open(from, &options, &db) == LDB_OK);
+
+  for (i = 0; i < 20; i++) {
+    ldb_slice_t k;
+
+    sprintf(key, "k%02d", i);
+
+    k = ldb_string(key);
+
+    ASSERT(ldb_put(db, &k, &k, ldb_writeopt_default) == LDB_OK);
+    ASSERT(ldb_flush(db, 1, 1) == LDB_OK);
+  }
+
+  ldb_close(db);
+
+  /* Files are copied and removed on several threads. */
+  ASSERT(ldb_copy(from, to, &options) == LDB_OK);
+  ASSERT(ldb_destroy(from, &options) == LDB_OK);
+  ASSERT(!ldb_file_exists(from));
+
+  options.create_if_missing = 0;
+
+  ASSERT(ldb_open(to, &options, &db) == LDB_OK);
+
+  for (i = 0; i < 20; i++) {
+    sprintf(key, "k%02d", i);
+    test_check_value(db, key, key);
+  }
+
+  ldb_close(db);
+
+  ASSERT(ldb_destroy(to, &options) == LDB_OK);
+  ASSERT(!ldb_file_exists(to));
+}
+
+static void
+test_db_wal_compression(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const char *value = string_fill(t, 'v', 10000);
+  char key[20];
+  int i;
+
+  options.wal_compression = LDB_SNAPPY_COMPRESSION;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+    ASSERT(test_put(t, key, value) == LDB_OK);
+  }
+
+  ASSERT(test_log_bytes(t) < 100 * 10000 / 4);
+
+  /* Recover from the compressed log. */
+  test_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+    ASSERT_EQ(value, test_get(t, key));
+  }
+
+  /* Logs can be read without the option. */
+  options.wal_compression = LDB_NO_COMPRESSION;
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+  ASSERT_EQ(value, test_get(t, "key000099"));
+}
+
+/* Returns the number of log files, and the size of the newest. */
+static int
+test_count_log_files(test_t *t, uint64_t *newest_size) {
+  char fname[LDB_PATH_MAX];
+  uint64_t number, newest = 0;
+  ldb_filetype_t type;
+  int count = 0;
+  char **names;
+  int i, len;
+
+  len = ldb_get_children(t->dbname, &names);
+
+  ASSERT(len >= 0);
+
+  for (i = 0; i < len; i++) {
+    if (!ldb_parse_filename(&type, &number, names[i]))
+      continue;
+
+    if (type == LDB_FILE_LOG) {
+      if (number > newest)
+        newest = number;
+
+      count++;
+    }
+  }
+
+  ldb_free_children(names, len);
+
+  if (newest_size != NULL) {
+    ASSERT(ldb_log_filename(fname, sizeof(fname), t->dbname, newest));
+    ASSERT(ldb_file_size(fname, newest_size) == LDB_OK);
+  }
+
+  return count;
+}
+
+static void
+test_db_recycle_logs(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const char *value = string_fill(t, 'v', 5000);
+  uint64_t size;
+  int i;
+
+  options.recycle_log_file_num = 1;
+  options.allow_fallocate = 0; /* Keep the stale tails. */
+  options.paranoid_checks = 1;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 5; i++) {
+    ASSERT(test_put(t, "foo", value) == LDB_OK);
+    ASSERT(test_put(t, "bar", value) == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    /* The current log, and the one kept for reuse. */
+    ASSERT(test_count_log_files(t, NULL) <= 2);
+  }
+
+  ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+  ASSERT(test_del(t, "bar") == LDB_OK);
+
+  /* The current log is a reused file, still holding records of the
+     previous log past the new ones. */
+  ASSERT(test_count_log_files(t, &size) == 2);
+  ASSERT(size > 10000);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v2", test_get(t, "foo"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "bar"));
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v2", test_get(t, "foo"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "bar"));
+}
+
+static void
+test_db_manual_wal_flush(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  uint64_t size;
+
+  options.manual_wal_flush = 1;
+
+  test_reopen(t, &options);
+
+  size = test_log_bytes(t);
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+#ifndef LDB_MEMENV
+  /* Still buffered. */
+  ASSERT(test_log_bytes(t) == size);
+#endif
+
+  ASSERT(ldb_flush_wal(t->db, 0) == LDB_OK);
+  ASSERT(test_log_bytes(t) > size);
+
+  ASSERT(test_put(t, "bar", "v2") == LDB_OK);
+  ASSERT(ldb_flush_wal(t->db, 1) == LDB_OK);
+  ASSERT(test_put(t, "baz", "v3") == LDB_OK);
+
+  /* Buffered records are written out on close. */
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+  ASSERT_EQ("v2", test_get(t, "bar"));
+  ASSERT_EQ("v3", test_get(t, "baz"));
+}
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+static void
+test_db_wal_sync_interval(test_t *t) {
+  ldb_statistics_t *stats = ldb_statistics_create();
+  ldb_dbopt_t options = test_current_options(t);
+  int i;
+
+  options.statistics = stats;
+  options.wal_sync_interval = 1;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  for (i = 0; i < 1000; i++) {
+    if (ldb_statistics_get(stats, LDB_WAL_SYNCS) > 0)
+      break;
+
+    ldb_sleep_usec(1000);
+  }
+
+  ASSERT(ldb_statistics_get(stats, LDB_WAL_SYNCS) > 0);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+  test_reopen(t, NULL);
+
+  ldb_statistics_destroy(stats);
+}
+#endif
+
+static void
+test_db_flush(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 0) == LDB_OK);
+  ASSERT(test_total_files(t) == 1);
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+  ASSERT(test_put(t, "bar", "v2") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 0, 1) == LDB_OK);
+
+  /* Waits out the flush above. */
+  ASSERT(test_put(t, "baz", "v3") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 0) == LDB_OK);
+  ASSERT(test_total_files(t) == 3);
+
+  /* Nothing left to replay. */
+  ASSERT(test_log_bytes(t) == 0);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+  ASSERT_EQ("v2", test_get(t, "bar"));
+  ASSERT_EQ("v3", test_get(t, "baz"));
+}
+
+static void
+test_db_mapped_tables(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char *value;
+  int i;
+
+  options.use_mmap = 1;
+  options.use_direct_reads = 0;
+  options.max_mapped_tables = 2;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 1) == LDB_OK);
+  ASSERT(test_put(t, "b", "v2") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 1) == LDB_OK);
+  ASSERT(test_put(t, "c", "v3") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 1) == LDB_OK);
+
+  for (i = 0; i < 2; i++) {
+    ASSERT_EQ("v1", test_get(t, "a"));
+    ASSERT_EQ("v2", test_get(t, "b"));
+    ASSERT_EQ("v3", test_get(t, "c"));
+
+    ASSERT(ldb_property(t->db, "leveldb.table-readers", &value));
+
+#ifndef LDB_MEMENV
+    if (i == 0)
+      ASSERT_EQ("Mapped: 2\nPread: 1\n", value);
+    else
+      ASSERT_EQ("Mapped: 3\nPread: 0\n", value);
+#endif
+
+    ldb_free(value);
+
+    options.max_mapped_tables = -1;
+
+    test_reopen(t, &options);
+  }
+}
+
+static void
+test_db_mapped_blocks(test_t *t) {
+  ldb_statistics_t *stats = ldb_statistics_create();
+  ldb_dbopt_t options = test_current_options(t);
+
+  options.use_mmap = 1;
+  options.use_direct_reads = 0;
+  options.cache_index_and_filter_blocks = 0;
+  options.compression = LDB_NO_COMPRESSION;
+  options.statistics = stats;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 1) == LDB_OK);
+
+  ldb_statistics_reset(stats);
+
+  ASSERT_EQ("v1", test_get(t, "a"));
+
+#ifndef LDB_MEMENV
+  /* Read in place, without going through the block cache. */
+  ASSERT(ldb_statistics_get(stats, LDB_BLOCK_CACHE_HIT) == 0);
+  ASSERT(ldb_statistics_get(stats, LDB_BLOCK_CACHE_MISS) == 0);
+#endif
+
+  options.compression = LDB_SNAPPY_COMPRESSION;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "b", string_fill(t, 'x', 1000)) == LDB_OK);
+  ASSERT(ldb_flush(t->db, 1, 1) == LDB_OK);
+
+  ldb_statistics_reset(stats);
+
+  ASSERT_EQ("v1", test_get(t, "a"));
+  ASSERT_EQ(string_fill(t, 'x', 1000), test_get(t, "b"));
+
+  /* Compressed blocks are decoded into the cache. */
+#ifndef LDB_MEMENV
+  ASSERT(ldb_statistics_get(stats, LDB_BLOCK_CACHE_MISS) == 1);
+#endif
+
+  test_reopen(t, NULL);
+
+  ldb_statistics_destroy(stats);
+}
+
+static void
+test_db_read_only(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_slice_t key = ldb_string("x");
+  char dbname[LDB_PATH_MAX];
+  ldb_t *db;
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_read_only"));
+  ASSERT(ldb_destroy(dbname, NULL) == LDB_OK);
+  ASSERT(ldb_open_readonly(dbname, &options, &db) == LDB_INVALID);
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+  ASSERT(test_put(t, "b", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, "c", "v1") == LDB_OK);
+
+  /* The writer still holds the database. */
+  ASSERT(ldb_open_readonly(t->dbname, &options, &db) == LDB_OK);
+
+  test_check_value(db, "a", "v1");
+  test_check_value(db, "c", "v1");
+
+  ASSERT(ldb_put(db, &key, &key, 0) == LDB_NOSUPPORT);
+  ASSERT(ldb_catch_up(t->db) == LDB_NOSUPPORT);
+
+  ASSERT(test_del(t, "a") == LDB_OK);
+  ASSERT(test_put(t, "d", "v2") == LDB_OK);
+
+  test_compact(t, "a", "z");
+
+  ASSERT(test_put(t, "e", "v2") == LDB_OK);
+
+  test_check_value(db, "d", NULL);
+
+  ASSERT(ldb_catch_up(db) == LDB_OK);
+
+  test_check_value(db, "a", NULL);
+  test_check_value(db, "b", "v1");
+  test_check_value(db, "d", "v2");
+  test_check_value(db, "e", "v2");
+
+  ldb_close(db);
+
+  ASSERT_EQ("v2", test_get(t, "e"));
+}
+
+static int
+test_count_children(const char *path) {
+  char **names;
+  int len;
+
+  len = ldb_get_children(path, &names);
+
+  if (len >= 0)
+    ldb_free_children(names, len);
+
+  return len;
+}
+
+static void
+test_db_in_memory(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_slice_t key = ldb_string("a");
+  ldb_slice_t val = ldb_string("v1");
+  ldb_writeopt_t wo = *ldb_writeopt_default;
+  char dbname[LDB_PATH_MAX];
+  ldb_slice_t tmp;
+  ldb_t *db;
+  int i;
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_in_memory"));
+  ASSERT(ldb_destroy(dbname, NULL) == LDB_OK);
+
+  options.create_if_missing = 1;
+
+  ASSERT(ldb_open(dbname, &options, &db) == LDB_OK);
+  ASSERT(ldb_put(db, &key, &val, 0) == LDB_OK);
+
+  ldb_close(db);
+
+  /* Whatever was there before is discarded. */
+  options.in_memory = 1;
+  options.create_if_missing = 0;
+  options.error_if_exists = 1;
+  options.write_buffer_size = 10000;
+
+  ASSERT(ldb_open(dbname, &options, &db) == LDB_OK);
+  ASSERT(ldb_get(db, &key, &tmp, 0) == LDB_NOTFOUND);
+
+  wo.sync = 1;
+
+  for (i = 0; i < 1000; i++) {
+    char kbuf[32];
+    ldb_slice_t k, v;
+
+    sprintf(kbuf, "key%06d", i);
+
+    k = ldb_string(kbuf);
+    v = ldb_string(kbuf);
+
+    ASSERT(ldb_put(db, &k, &v, &wo) == LDB_OK);
+  }
+
+  ldb_compact(db, NULL, NULL);
+
+  key = ldb_string("key000500");
+
+  ASSERT(ldb_get(db, &key, &tmp, 0) == LDB_OK);
+  ASSERT(ldb_slice_equal(&tmp, &key));
+
+  ldb_free(tmp.data);
+
+  /* Nothing is left behind. */
+  ldb_close(db);
+
+  ASSERT(test_count_children(dbname) < 0);
+}
+
+static void
+test_db_backups(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char shared[LDB_PATH_MAX];
+  char restored[LDB_PATH_MAX];
+  char dir[LDB_PATH_MAX];
+  ldb_backups_t *bk;
+  int id1, id2;
+  ldb_t *db;
+
+  ASSERT(ldb_test_filename(dir, sizeof(dir), "db_backups"));
+  ASSERT(ldb_test_filename(restored, sizeof(restored), "db_restored"));
+  ASSERT(ldb_join(shared, sizeof(shared), dir, "shared"));
+
+  ldb_destroy(restored, NULL);
+
+  ASSERT(ldb_backups_open(dir, 4, &bk) == LDB_OK);
+  ASSERT(ldb_backups_purge(bk, 0) == LDB_OK);
+
+  ASSERT(test_put(t, "a", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(ldb_backups_create(bk, t->db, &id1) == LDB_OK);
+  ASSERT(test_count_children(shared) == 1);
+
+  /* Only the new table is copied. */
+  ASSERT(test_put(t, "b", "v2") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, "c", "v3") == LDB_OK);
+
+  ASSERT(ldb_backups_create(bk, t->db, &id2) == LDB_OK);
+  ASSERT(test_count_children(shared) == 2);
+  ASSERT(id2 == id1 + 1);
+
+  ASSERT(ldb_backups_restore(bk, id1, restored) == LDB_OK);
+  ASSERT(ldb_backups_restore(bk, id1, restored) == LDB_INVALID);
+  ASSERT(ldb_open(restored, &options, &db) == LDB_OK);
+
+  test_check_value(db, "a", "v1");
+  test_check_value(db, "b", NULL);
+
+  ldb_close(db);
+
+  ASSERT(ldb_destroy(restored, NULL) == LDB_OK);
+
+  /* The first table is still needed by the second backup. */
+  ASSERT(ldb_backups_delete(bk, id1) == LDB_OK);
+  ASSERT(test_count_children(shared) == 2);
+
+  ldb_backups_close(bk);
+
+  ASSERT(ldb_backups_open(dir, 1, &bk) == LDB_OK);
+  ASSERT(ldb_backups_length(bk) == 1);
+  ASSERT(ldb_backups_id(bk, 0) == id2);
+
+  ASSERT(ldb_backups_restore(bk, id2, restored) == LDB_OK);
+  ASSERT(ldb_open(restored, &options, &db) == LDB_OK);
+
+  test_check_value(db, "a", "v1");
+  test_check_value(db, "b", "v2");
+  test_check_value(db, "c", "v3");
+
+  ldb_close(db);
+
+  ASSERT(ldb_backups_purge(bk, 0) == LDB_OK);
+  ASSERT(ldb_backups_length(bk) == 0);
+  ASSERT(test_count_children(shared) == 0);
+
+  ldb_backups_close(bk);
+
+  ASSERT(ldb_destroy(restored, NULL) == LDB_OK);
+}
+
+typedef struct test_progress_s {
+  ldb_t *db;
+  int calls;
+  char *value;
+} test_progress_t;
+
+/* Capture the compaction's progress once it is well under way. */
+static int
+test_progress_filter(const ldb_cfilter_t *filt,
+                     int level,
+                     const ldb_slice_t *key,
+                     const ldb_slice_t *value,
+                     ldb_slice_t *new_value) {
+  test_progress_t *p = filt->state;
+
+  (void)level;
+  (void)key;
+  (void)value;
+  (void)new_value;
+
+  if (++p->calls == 1500)
+    ASSERT(ldb_property(p->db, "leveldb.compaction-progress", &p->value));
+
+  return LDB_CFILTER_KEEP;
+}
+
+static int
+test_count_lines(const char *str) {
+  int lines = 0;
+
+  for (; *str; str++)
+    lines += (*str == '\n');
+
+  return lines;
+}
+
+static void
+test_db_compaction_progress(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int level, output_level, files, outputs;
+  double input, done, elapsed;
+  test_progress_t state;
+  ldb_cfilter_t filter;
+  const char *line;
+  char value[1000];
+  char *tmp;
+  int i;
+
+  filter.name = "test.Progress";
+  filter.filter = test_progress_filter;
+  filter.state = &state;
+
+  options.compaction_filter = &filter;
+  options.compression = LDB_NO_COMPRESSION;
+
+  test_reopen(t, &options);
+
+  state.db = t->db;
+  state.calls = 0;
+  state.value = NULL;
+
+  /* Nothing is running. */
+  ASSERT(ldb_property(t->db, "leveldb.compaction-progress", &tmp));
+  ASSERT(test_count_lines(tmp) == 2);
+
+  ldb_free(tmp);
+
+  memset(value, 'x', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+
+  for (i = 0; i < 2000; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  test_compact_bottom(t);
+
+  ASSERT(state.value != NULL);
+  ASSERT(test_count_lines(state.value) == 3);
+
+  line = strchr(strchr(state.value, '\n') + 1, '\n') + 1;
+
+  ASSERT(sscanf(line, "%d->%d %d %lf %lf %d %*f %lf",
+                      &level, &output_level, &files, &input,
+                      &done, &outputs, &elapsed) == 7);
+
+  ASSERT(output_level == level + 1);
+  ASSERT(files > 0);
+  ASSERT(input > 1.5);
+  ASSERT(done > 0 && done <= input);
+  ASSERT(outputs >= 0);
+  ASSERT(elapsed >= 0);
+
+  ldb_free(state.value);
+
+  ASSERT(ldb_property(t->db, "leveldb.compaction-progress", &tmp));
+  ASSERT(test_count_lines(tmp) == 2);
+
+  ldb_free(tmp);
+}
+
+static void
+test_db_compaction_filter(test_t *t) {
+  static const ldb_cfilter_t filter = {"test.Filter", test_cfilter, NULL};
+  ldb_dbopt_t options = test_current_options(t);
+  const ldb_snapshot_t *snap;
+
+  options.compaction_filter = &filter;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "keep1", "v1") == LDB_OK);
+  ASSERT(test_put(t, "drop1", "v1") == LDB_OK);
+  ASSERT(test_put(t, "up1", "v1") == LDB_OK);
+  ASSERT(test_put(t, "drop2", "a") == LDB_OK);
+
+  snap = ldb_snapshot(t->db);
+
+  ASSERT(test_put(t, "drop2", "b") == LDB_OK);
+  ASSERT(test_put(t, "up2", "v2") == LDB_OK);
+
+  /* Flushes leave the values alone. */
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("b", test_get(t, "drop2"));
+  ASSERT_EQ("v2", test_get(t, "up2"));
+
+  /* Only values newer than the snapshot are filtered. A removed
+     value must not uncover the older one. */
+  test_compact_bottom(t);
+
+  ASSERT_EQ("v1", test_get(t, "keep1"));
+  ASSERT_EQ("v1", test_get(t, "drop1"));
+  ASSERT_EQ("v1", test_get(t, "up1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "drop2"));
+  ASSERT_EQ("new", test_get(t, "up2"));
+
+  ASSERT_EQ("a", test_get2(t, "drop2", snap));
+  ASSERT_EQ("NOT_FOUND", test_get2(t, "up2", snap));
+
+  ldb_release(t->db, snap);
+
+  test_compact_bottom(t);
+
+  ASSERT_EQ("v1", test_get(t, "keep1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "drop1"));
+  ASSERT_EQ("new", test_get(t, "up1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "drop2"));
+  ASSERT_EQ("new", test_get(t, "up2"));
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v1", test_get(t, "keep1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "drop1"));
+  ASSERT_EQ("new", test_get(t, "up1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "drop2"));
+}
+
+static int
+test_append_merge(const ldb_mergeop_t *op,
+                  const ldb_slice_t *key,
+                  const ldb_slice_t *existing,
+                  const ldb_slice_t *operands,
+                  size_t count,
+                  ldb_slice_t *result) {
+  ldb_buffer_t z;
+  size_t i;
+
+  (void)op;
+  (void)key;
+
+  ldb_buffer_init(&z);
+
+  if (existing != NULL)
+    ldb_buffer_concat(&z, existing);
+
+  for (i = 0; i < count; i++) {
+    if (z.size > 0)
+      ldb_buffer_push(&z, ',');
+
+    ldb_buffer_concat(&z, &operands[i]);
+  }
+
+  ldb_buffer_push(&z, 0);
+
+  result->data = z.data;
+  result->size = z.size - 1;
+
+  return 1;
+}
+
+static int
+test_merge(test_t *t, const char *k, const char *v) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val = ldb_string(v);
+
+  return ldb_merge(t->db, &key, &val, ldb_writeopt_default);
+}
+
+static void
+test_db_merge_operator(test_t *t) {
+  static const ldb_mergeop_t op = {"test.Append", test_append_merge, NULL};
+  ldb_dbopt_t options = test_current_options(t);
+  const ldb_snapshot_t *snap;
+  ldb_slice_t keys[3];
+  ldb_slice_t values[3];
+  int statuses[3];
+  ldb_iter_t *iter;
+
+  /* Merging requires an operator. */
+  ASSERT(test_merge(t, "a", "1") == LDB_NOSUPPORT);
+
+  options.merge_operator = &op;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "a", "1") == LDB_OK);
+  ASSERT(test_merge(t, "a", "2") == LDB_OK);
+  ASSERT(test_merge(t, "a", "3") == LDB_OK);
+  ASSERT(test_merge(t, "b", "x") == LDB_OK);
+  ASSERT(test_put(t, "c", "old") == LDB_OK);
+  ASSERT(test_del(t, "c") == LDB_OK);
+  ASSERT(test_merge(t, "c", "new") == LDB_OK);
+
+  ASSERT_EQ("1,2,3", test_get(t, "a"));
+  ASSERT_EQ("x", test_get(t, "b"));
+  ASSERT_EQ("new", test_get(t, "c"));
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  iter_seek(iter, "a");
+  ASSERT_EQ("a->1,2,3", iter_status(t, iter));
+  ldb_iter_next(iter);
+  ASSERT_EQ("b->x", iter_status(t, iter));
+  ldb_iter_next(iter);
+  ASSERT_EQ("c->new", iter_status(t, iter));
+  ldb_iter_prev(iter);
+  ASSERT_EQ("b->x", iter_status(t, iter));
+  ldb_iter_prev(iter);
+  ASSERT_EQ("a->1,2,3", iter_status(t, iter));
+
+  ldb_iter_destroy(iter);
+
+  ASSERT_EQ("(a->1,2,3)(b->x)(c->new)", test_contents(t));
+
+  /* Operands in one table file, base in the same file. */
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("1,2,3", test_get(t, "a"));
+  ASSERT_EQ("x", test_get(t, "b"));
+  ASSERT_EQ("new", test_get(t, "c"));
+
+  snap = ldb_snapshot(t->db);
+
+  /* Operands in the memtable, base in a table. */
+  ASSERT(test_merge(t, "a", "4") == LDB_OK);
+  ASSERT(test_merge(t, "b", "y") == LDB_OK);
+
+  ASSERT_EQ("1,2,3,4", test_get(t, "a"));
+  ASSERT_EQ("x,y", test_get(t, "b"));
+  ASSERT_EQ("1,2,3", test_get2(t, "a", snap));
+  ASSERT_EQ("x", test_get2(t, "b", snap));
+  ASSERT_EQ("(a->1,2,3,4)(b->x,y)(c->new)", test_contents(t));
+
+  keys[0] = ldb_string("a");
+  keys[1] = ldb_string("b");
+  keys[2] = ldb_string("z");
+
+  ASSERT(ldb_multiget(t->db, keys, values, statuses, 3, NULL) == LDB_OK);
+
+  ASSERT(statuses[0] == LDB_OK);
+  ASSERT(statuses[1] == LDB_OK);
+  ASSERT(statuses[2] == LDB_NOTFOUND);
+  ASSERT(values[0].size == 7 && memcmp(values[0].data, "1,2,3,4", 7) == 0);
+  ASSERT(values[1].size == 3 && memcmp(values[1].data, "x,y", 3) == 0);
+
+  ldb_free(values[0].data);
+  ldb_free(values[1].data);
+
+  /* Operands spread across files. */
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("1,2,3,4", test_get(t, "a"));
+  ASSERT_EQ("x,y", test_get(t, "b"));
+
+  /* Compaction collapses the operands every snapshot agrees on. */
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT_EQ("[ MERGE 4, 1,2,3 ]", test_all_entries(t, "a"));
+  ASSERT_EQ("[ MERGE y, x ]", test_all_entries(t, "b"));
+  ASSERT_EQ("[ new ]", test_all_entries(t, "c"));
+  ASSERT_EQ("1,2,3", test_get2(t, "a", snap));
+
+  ldb_release(t->db, snap);
+
+  test_compact_bottom(t);
+
+  ASSERT_EQ("[ 1,2,3,4 ]", test_all_entries(t, "a"));
+  ASSERT_EQ("[ x,y ]", test_all_entries(t, "b"));
+
+  /* Operands survive a reopen through the log. */
+  ASSERT(test_merge(t, "a", "5") == LDB_OK);
+  ASSERT(test_merge(t, "d", "z") == LDB_OK);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("1,2,3,4,5", test_get(t, "a"));
+  ASSERT_EQ("x,y", test_get(t, "b"));
+  ASSERT_EQ("new", test_get(t, "c"));
+  ASSERT_EQ("z", test_get(t, "d"));
+}
+
+static int test_merge_calls = 0;
+
+static int
+test_counting_merge(const ldb_mergeop_t *op,
+                    const ldb_slice_t *key,
+                    const ldb_slice_t *existing,
+                    const ldb_slice_t *operands,
+                    size_t count,
+                    ldb_slice_t *result) {
+  test_merge_calls++;
+  return test_append_merge(op, key, existing, operands, count, result);
+}
+
+static const char *
+keys_only_contents(test_t *t, const ldb_readopt_t *options) {
+  ldb_iter_t *iter = ldb_iterator(t->db, options);
+  ldb_buffer_t z;
+  int count = 0;
+
+  ldb_buffer_init(&z);
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ASSERT(ldb_iter_value(iter).size == 0);
+    ldb_buffer_concat(&z, &key);
+    count++;
+  }
+
+  for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter)) {
+    ASSERT(ldb_iter_value(iter).size == 0);
+    count--;
+  }
+
+  ASSERT(count == 0);
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+  ldb_iter_destroy(iter);
+
+  ldb_buffer_push(&z, 0);
+  ldb_vector_push(&t->arena, z.data);
+
+  return (char *)z.data;
+}
+
+static void
+test_db_keys_only(test_t *t) {
+  static const ldb_mergeop_t op = {"test.Append", test_counting_merge, NULL};
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_readopt_t ropt = *ldb_readopt_default;
+  ldb_slice_t key, value;
+  ldb_rand_t rnd;
+  int round;
+
+  options.create_if_missing = 1;
+  options.merge_operator = &op;
+  options.min_blob_size = 100;
+
+  test_destroy_and_reopen(t, &options);
+
+  ldb_rand_init(&rnd, 301);
+
+  ASSERT(test_put(t, "a", "1") == LDB_OK);
+  ASSERT(test_merge(t, "a", "2") == LDB_OK);
+  ASSERT(test_merge(t, "b", "x") == LDB_OK);
+  ASSERT(test_put(t, "c", "old") == LDB_OK);
+  ASSERT(test_del(t, "c") == LDB_OK);
+  ASSERT(test_merge(t, "c", "new") == LDB_OK);
+  ASSERT(test_put(t, "d", random_string(t, &rnd, 1000)) == LDB_OK);
+  ASSERT(test_put(t, "e", "gone") == LDB_OK);
+  ASSERT(test_del(t, "e") == LDB_OK);
+
+  ropt.keys_only = 1;
+
+  /* Once in the memtable, once in a table. */
+  for (round = 0; round < 2; round++) {
+    test_merge_calls = 0;
+
+    ASSERT(test_has(t, "a"));
+    ASSERT(test_has(t, "b"));
+    ASSERT(test_has(t, "c"));
+    ASSERT(test_has(t, "d"));
+    ASSERT(!test_has(t, "e"));
+    ASSERT(!test_has(t, "f"));
+
+    key = ldb_string("a");
+
+    ASSERT(ldb_get(t->db, &key, &value, &ropt) == LDB_OK);
+    ASSERT(value.size == 0);
+
+    ldb_free(value.data);
+
+    ASSERT_EQ("abcd", keys_only_contents(t, &ropt));
+    ASSERT(test_merge_calls == 0);
+
+    /* Reading the values still applies the operands. */
+    ASSERT_EQ("1,2", test_get(t, "a"));
+    ASSERT(test_merge_calls == 1);
+
+    test_reset(t);
+
+    ldb_test_compact_memtable(t->db);
+  }
+}
+
+static int
+test_del_range(test_t *t, const char *s, const char *e) {
+  ldb_slice_t start = ldb_string(s);
+  ldb_slice_t end = ldb_string(e);
+
+  return ldb_del_range(t->db, &start, &end, ldb_writeopt_default);
+}
+
+static void
+test_db_delete_range(test_t *t) {
+  const ldb_snapshot_t *snap;
+  ldb_slice_t keys[3];
+  ldb_slice_t values[3];
+  int statuses[3];
+  ldb_iter_t *iter;
+
+  ASSERT(test_del_range(t, "b", "a") == LDB_INVALID);
+
+  ASSERT(test_put(t, "a", "1") == LDB_OK);
+  ASSERT(test_put(t, "b", "2") == LDB_OK);
+  ASSERT(test_put(t, "c", "3") == LDB_OK);
+  ASSERT(test_put(t, "d", "4") == LDB_OK);
+  ASSERT(test_put(t, "e", "5") == LDB_OK);
+
+  snap = ldb_snapshot(t->db);
+
+  /* Tombstone and keys in the memtable. */
+  ASSERT(test_del_range(t, "b", "d") == LDB_OK);
+  ASSERT(test_put(t, "c", "new") == LDB_OK);
+
+  ASSERT_EQ("1", test_get(t, "a"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+  ASSERT_EQ("new", test_get(t, "c"));
+  ASSERT_EQ("4", test_get(t, "d"));
+  ASSERT_EQ("2", test_get2(t, "b", snap));
+  ASSERT_EQ("(a->1)(c->new)(d->4)(e->5)", test_contents(t));
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  iter_seek(iter, "b");
+  ASSERT_EQ("c->new", iter_status(t, iter));
+  ldb_iter_prev(iter);
+  ASSERT_EQ("a->1", iter_status(t, iter));
+  ldb_iter_next(iter);
+  ASSERT_EQ("c->new", iter_status(t, iter));
+  ldb_iter_next(iter);
+  ASSERT_EQ("d->4", iter_status(t, iter));
+
+  ldb_iter_destroy(iter);
+
+  /* Tombstone and keys in the same table. */
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+  ASSERT_EQ("new", test_get(t, "c"));
+  ASSERT_EQ("2", test_get2(t, "b", snap));
+  ASSERT_EQ("3", test_get2(t, "c", snap));
+  ASSERT_EQ("(a->1)(c->new)(d->4)(e->5)", test_contents(t));
+
+  keys[0] = ldb_string("a");
+  keys[1] = ldb_string("b");
+  keys[2] = ldb_string("c");
+
+  ASSERT(ldb_multiget(t->db, keys, values, statuses, 3, NULL) == LDB_OK);
+
+  ASSERT(statuses[0] == LDB_OK);
+  ASSERT(statuses[1] == LDB_NOTFOUND);
+  ASSERT(statuses[2] == LDB_OK);
+  ASSERT(values[0].size == 1 && memcmp(values[0].data, "1", 1) == 0);
+  ASSERT(values[2].size == 3 && memcmp(values[2].data, "new", 3) == 0);
+
+  ldb_free(values[0].data);
+  ldb_free(values[2].data);
+
+  /* Tombstone in the memtable, keys in a table. */
+  ASSERT(test_del_range(t, "d", "f") == LDB_OK);
+
+  ASSERT_EQ("NOT_FOUND", test_get(t, "d"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "e"));
+  ASSERT_EQ("(a->1)(c->new)", test_contents(t));
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("(a->1)(c->new)", test_contents(t));
+
+  /* Compaction keeps what the snapshot can see. */
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT_EQ("(a->1)(c->new)", test_contents(t));
+  ASSERT_EQ("[ 2 ]", test_all_entries(t, "b"));
+  ASSERT_EQ("2", test_get2(t, "b", snap));
+  ASSERT_EQ("4", test_get2(t, "d", snap));
+
+  ldb_release(t->db, snap);
+
+  test_compact_bottom(t);
+
+  ASSERT_EQ("[ ]", test_all_entries(t, "b"));
+  ASSERT_EQ("[ new ]", test_all_entries(t, "c"));
+  ASSERT_EQ("[ ]", test_all_entries(t, "d"));
+  ASSERT_EQ("(a->1)(c->new)", test_contents(t));
+
+  /* Newer writes are not affected. */
+  ASSERT(test_put(t, "b", "again") == LDB_OK);
+  ASSERT(test_del_range(t, "a", "b") == LDB_OK);
+
+  ASSERT_EQ("again", test_get(t, "b"));
+
+  /* Tombstones survive a reopen through the log. */
+  test_reopen(t, NULL);
+
+  ASSERT_EQ("NOT_FOUND", test_get(t, "a"));
+  ASSERT_EQ("(b->again)(c->new)", test_contents(t));
+}
+
+static void
+test_db_delete_files_in_range(test_t *t) {
+  ldb_slice_t begin = ldb_string("a");
+  ldb_slice_t end = ldb_string("d");
+  int files;
+
+  ASSERT(test_put(t, "a1", "v") == LDB_OK);
+  ASSERT(test_put(t, "a2", "v") == LDB_OK);
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, "c1", "v") == LDB_OK);
+  ASSERT(test_put(t, "c2", "v") == LDB_OK);
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_put(t, "b1", "v") == LDB_OK);
+  ASSERT(test_put(t, "e1", "v") == LDB_OK);
+  ldb_test_compact_memtable(t->db);
+
+  /* Not yet in a table. */
+  ASSERT(test_put(t, "a3", "v") == LDB_OK);
+
+  ASSERT(test_total_files(t) == 3);
+
+  files = test_count_files(t);
+
+  /* Only the tables inside the range are dropped. */
+  ASSERT(ldb_delete_files_in_range(t->db, &begin, &end) == LDB_OK);
+
+  ASSERT(test_total_files(t) == 1);
+  ASSERT(test_count_files(t) == files - 2);
+  ASSERT_EQ("(a3->v)(b1->v)(e1->v)", test_contents(t));
+
+  test_reopen(t, NULL);
+
+  ASSERT_EQ("(a3->v)(b1->v)(e1->v)", test_contents(t));
+
+  /* Unbounded. */
+  ASSERT(ldb_delete_files_in_range(t->db, NULL, NULL) == LDB_OK);
+
+  ASSERT(test_total_files(t) == 0);
+  ASSERT_EQ("", test_contents(t));
+}
+
+static void
+test_db_delete_files_in_range_refs(test_t *t) {
+  ldb_iter_t *iter;
+  int i;
+
+  ASSERT(test_put(t, "a", "va") == LDB_OK);
+  ASSERT(test_put(t, "b", "vb") == LDB_OK);
+  ldb_test_compact_memtable(t->db);
+
+  /* An open iterator keeps the dropped tables alive. */
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ASSERT(ldb_delete_files_in_range(t->db, NULL, NULL) == LDB_OK);
+  ASSERT(test_total_files(t) == 0);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ("a->va", iter_status(t, iter));
+  ldb_iter_next(iter);
+  ASSERT_EQ("b->vb", iter_status(t, iter));
+  ldb_iter_next(iter);
+  ASSERT_EQ("(invalid)", iter_status(t, iter));
+
+  ldb_iter_destroy(iter);
+
+  /* With no readers, the swap frees the dropped tables. */
+  for (i = 0; i < 3; i++) {
+    ASSERT(test_put(t, "c", "vc") == LDB_OK);
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(ldb_delete_files_in_range(t->db, NULL, NULL) == LDB_OK);
+    ASSERT(test_total_files(t) == 0);
+  }
+
+  ASSERT_EQ("", test_contents(t));
+}
+
+/* Build an external table from key/value pairs ending in NULL.
+   A NULL value is a deletion. */
+static int
+test_build_sst(test_t *t, const char *fname, const char *const *kvs) {
+  ldb_sstwriter_t *sst;
+  int rc;
+
+  rc = ldb_sstwriter_open(fname, &t->last_options, &sst);
+
+  if (rc != LDB_OK)
+    return rc;
+
+  for (; rc == LDB_OK && kvs[0] != NULL; kvs += 2) {
+    ldb_slice_t key = ldb_string(kvs[0]);
+
+    if (kvs[1] != NULL) {
+      ldb_slice_t val = ldb_string(kvs[1]);
+
+      rc = ldb_sstwriter_put(sst, &key, &val);
+    } else {
+      rc = ldb_sstwriter_del(sst, &key);
+    }
+  }
+
+  if (rc == LDB_OK)
+    rc = ldb_sstwriter_finish(sst);
+
+  ldb_sstwriter_close(sst);
+
+  return rc;
+}
+
+static void
+test_db_ingest(test_t *t) {
+  static const char *const first[] = {
+    "a", "v1", "b", "v1", "c", "v1", NULL
+  };
+  static const char *const second[] = {
+    "b", "v3", "c", NULL, "d", "v3", NULL
+  };
+  static const char *const unordered[] = {
+    "b", "v", "a", "v", NULL
+  };
+  static const char *const empty[] = { NULL };
+  const ldb_snapshot_t *snap;
+  char fname[LDB_PATH_MAX];
+
+  ASSERT(ldb_test_filename(fname, sizeof(fname), "db_test.sst"));
+
+  ASSERT(test_build_sst(t, fname, unordered) == LDB_INVALID);
+  ASSERT(!ldb_file_exists(fname));
+  ASSERT(test_build_sst(t, fname, empty) == LDB_INVALID);
+  ASSERT(!ldb_file_exists(fname));
+  ASSERT(ldb_ingest(t->db, fname) != LDB_OK);
+
+  /* Nothing overlaps: straight to the bottommost level. */
+  ASSERT(test_build_sst(t, fname, first) == LDB_OK);
+  ASSERT(ldb_ingest(t->db, fname) == LDB_OK);
+  ASSERT(ldb_file_exists(fname));
+  ASSERT(ldb_remove_file(fname) == LDB_OK);
+
+  ASSERT_EQ("0,0,0,0,0,0,1", test_files_per_level(t));
+  ASSERT_EQ("(a->v1)(b->v1)(c->v1)", test_contents(t));
+
+  /* Overlapping writes in the memtable are flushed first. */
+  ASSERT(test_put(t, "b", "v2") == LDB_OK);
+  ASSERT(test_put(t, "z", "v2") == LDB_OK);
+
+  snap = ldb_snapshot(t->db);
+
+  ASSERT(test_build_sst(t, fname, second) == LDB_OK);
+  ASSERT(ldb_ingest(t->db, fname) == LDB_OK);
+  ASSERT(ldb_remove_file(fname) == LDB_OK);
+
+  ASSERT(test_total_files(t) == 3);
+  ASSERT_EQ("v3", test_get(t, "b"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "c"));
+  ASSERT_EQ("(a->v1)(b->v3)(d->v3)(z->v2)", test_contents(t));
+  ASSERT_EQ("[ v3, v2, v1 ]", test_all_entries(t, "b"));
+
+  /* The snapshot predates the ingested keys. */
+  ASSERT_EQ("v2", test_get2(t, "b", snap));
+  ASSERT_EQ("v1", test_get2(t, "c", snap));
+  ASSERT_EQ("NOT_FOUND", test_get2(t, "d", snap));
+
+  ldb_release(t->db, snap);
+
+  /* The global sequence number is kept in the manifest. */
+  test_reopen(t, NULL);
+
+  ASSERT_EQ("v3", test_get(t, "b"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "c"));
+  ASSERT_EQ("(a->v1)(b->v3)(d->v3)(z->v2)", test_contents(t));
+
+  /* And written out by compactions. */
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT_EQ("[ v3 ]", test_all_entries(t, "b"));
+  ASSERT_EQ("(a->v1)(b->v3)(d->v3)(z->v2)", test_contents(t));
+
+  test_reopen(t, NULL);
+
+  ASSERT_EQ("(a->v1)(b->v3)(d->v3)(z->v2)", test_contents(t));
+}
+
+static void
+test_db_bulk_load(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_slice_t key, val;
+  ldb_loader_t *ld;
+  char value[10000];
+  int i;
+
+  /* The load (3mb) is cut into several files. */
+  options.create_if_missing = 1;
+  options.max_file_size = 1 << 20;
+  options.compression = LDB_NO_COMPRESSION;
+
+  test_destroy_and_reopen(t, &options);
+
+  memset(value, 'x', sizeof(value));
+
+  val = ldb_slice((unsigned char *)value, sizeof(value));
+
+  /* Abandoned loads leave nothing behind. */
+  ld = ldb_loader_create(t->db);
+
+  key = ldb_string(test_key(t, 0));
+
+  ASSERT(ldb_loader_put(ld, &key, &val) == LDB_OK);
+  ASSERT(ldb_loader_put(ld, &key, &val) == LDB_INVALID);
+
+  ldb_loader_destroy(ld);
+
+  ASSERT(test_total_files(t) == 0);
+  ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, 0)));
+
+  ld = ldb_loader_create(t->db);
+
+  for (i = 0; i < 300; i++) {
+    key = ldb_string(test_key(t, i));
+
+    ASSERT(ldb_loader_put(ld, &key, &val) == LDB_OK);
+  }
+
+  /* Nothing is visible before the load is finished. */
+  ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, 0)));
+  ASSERT(test_total_files(t) == 0);
+
+  ASSERT(ldb_loader_finish(ld) == LDB_OK);
+  ASSERT(ldb_loader_finish(ld) == LDB_INVALID);
+
+  ldb_loader_destroy(ld);
+
+  /* Every table went straight to the bottommost level. */
+  ASSERT(test_total_files(t) > 1);
+  ASSERT(test_total_files(t) == test_files_at_level(t, 6));
+
+  for (i = 0; i < 300; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == sizeof(value));
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 300; i++)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == sizeof(value));
+
+  /* A load over existing data goes on top of it. */
+  ASSERT(test_put(t, test_key(t, 500), "v1") == LDB_OK);
+
+  ld = ldb_loader_create(t->db);
+
+  key = ldb_string(test_key(t, 500));
+  val = ldb_string("v2");
+
+  ASSERT(ldb_loader_put(ld, &key, &val) == LDB_OK);
+  ASSERT(ldb_loader_finish(ld) == LDB_OK);
+
+  ldb_loader_destroy(ld);
+
+  ASSERT_EQ("v2", test_get(t, test_key(t, 500)));
+  ASSERT_EQ("[ v2, v1 ]", test_all_entries(t, test_key(t, 500)));
+}
+
+static int
+test_txn_get(ldb_txn_t *txn, const char *k) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val;
+  int rc;
+
+  rc = ldb_txn_get(txn, &key, &val, NULL);
+
+  if (rc == LDB_OK)
+    ldb_free(val.data);
+
+  return rc;
+}
+
+static int
+test_txn_put(ldb_txn_t *txn, const char *k, const char *v) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val = ldb_string(v);
+  ldb_batch_t batch;
+  int rc;
+
+  ldb_batch_init(&batch);
+  ldb_batch_put(&batch, &key, &val);
+
+  rc = ldb_txn_commit(txn, &batch, NULL);
+
+  ldb_batch_clear(&batch);
+
+  return rc;
+}
+
+static void
+test_db_optimistic_txn(test_t *t) {
+  ldb_txn_t *txn1, *txn2;
+
+  do {
+    /* Two transactions read the same key; the second to commit loses. */
+    txn1 = ldb_txn_create(t->db);
+    txn2 = ldb_txn_create(t->db);
+
+    ASSERT(test_txn_get(txn1, "a") == LDB_NOTFOUND);
+    ASSERT(test_txn_get(txn2, "a") == LDB_NOTFOUND);
+
+    ASSERT(test_txn_put(txn1, "a", "v1") == LDB_OK);
+    ASSERT(test_txn_put(txn2, "a", "v2") == LDB_CONFLICT);
+
+    ldb_txn_destroy(txn1);
+    ldb_txn_destroy(txn2);
+
+    ASSERT_EQ("v1", test_get(t, "a"));
+
+    /* Writes to keys which were not read do not conflict. */
+    txn1 = ldb_txn_create(t->db);
+
+    ASSERT(test_txn_get(txn1, "a") == LDB_OK);
+    ASSERT(test_put(t, "b", "v1") == LDB_OK);
+    ASSERT(test_txn_put(txn1, "a", "v2") == LDB_OK);
+
+    ldb_txn_destroy(txn1);
+
+    ASSERT_EQ("v2", test_get(t, "a"));
+
+    /* Conflicts are found after the write has been flushed. */
+    txn1 = ldb_txn_create(t->db);
+
+    ASSERT(test_txn_get(txn1, "b") == LDB_OK);
+    ASSERT(test_put(t, "b", "v2") == LDB_OK);
+    ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+    ASSERT(test_txn_put(txn1, "b", "v3") == LDB_CONFLICT);
+
+    ldb_txn_destroy(txn1);
+
+    /* Range deletions conflict with the keys they cover. */
+    txn1 = ldb_txn_create(t->db);
+
+    ASSERT(test_txn_get(txn1, "b") == LDB_OK);
+    ASSERT(test_del_range(t, "a", "c") == LDB_OK);
+    ASSERT(test_txn_put(txn1, "b", "v3") == LDB_CONFLICT);
+
+    ldb_txn_destroy(txn1);
+
+    ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+  } while (test_change_options(t));
+}
+
+static const char *
+test_ibatch_get(test_t *t, ldb_ibatch_t *ib, const char *k) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val;
+  char *zp;
+  int rc;
+
+  rc = ldb_ibatch_get(ib, t->db, &key, &val, NULL);
+
+  if (rc == LDB_NOTFOUND)
+    return "NOT_FOUND";
+
+  if (rc != LDB_OK)
+    return ldb_strerror(rc);
+
+  zp = ldb_malloc(val.size + 1);
+
+  memcpy(zp, val.data, val.size);
+
+  zp[val.size] = '\0';
+
+  ldb_free(val.data);
+
+  ldb_vector_push(&t->arena, zp);
+
+  return zp;
+}
+
+static void
+test_ibatch_put(ldb_ibatch_t *ib, const char *k, const char *v) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val = ldb_string(v);
+
+  ldb_ibatch_put(ib, &key, &val);
+}
+
+static void
+test_ibatch_del(ldb_ibatch_t *ib, const char *k) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_ibatch_del(ib, &key);
+}
+
+static void
+test_db_indexed_batch(test_t *t) {
+  ldb_ibatch_t *ib;
+  ldb_iter_t *iter;
+
+  do {
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+    ASSERT(test_put(t, "c", "vc") == LDB_OK);
+    ASSERT(test_put(t, "e", "ve") == LDB_OK);
+    ASSERT(test_put(t, "g", "vg") == LDB_OK);
+
+    ib = ldb_ibatch_create(NULL);
+
+    test_ibatch_put(ib, "a", "x1");
+    test_ibatch_del(ib, "a");
+    test_ibatch_put(ib, "a", "xa");
+    test_ibatch_put(ib, "b", "xb");
+    test_ibatch_put(ib, "c", "xc");
+    test_ibatch_del(ib, "e");
+    test_ibatch_put(ib, "h", "xh");
+    test_ibatch_del(ib, "z");
+
+    /* Reads see the batch first. */
+    ASSERT_EQ("xa", test_ibatch_get(t, ib, "a"));
+    ASSERT_EQ("xb", test_ibatch_get(t, ib, "b"));
+    ASSERT_EQ("xc", test_ibatch_get(t, ib, "c"));
+    ASSERT_EQ("NOT_FOUND", test_ibatch_get(t, ib, "e"));
+    ASSERT_EQ("vg", test_ibatch_get(t, ib, "g"));
+    ASSERT_EQ("NOT_FOUND", test_ibatch_get(t, ib, "z"));
+    ASSERT_EQ("va", test_get(t, "a"));
+
+    /* Iteration merges the batch with the database. */
+    iter = ldb_ibatch_iterator(ib, ldb_iterator(t->db, NULL));
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->xa");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->xb");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->xc");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "g->vg");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "h->xh");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    ldb_iter_last(iter);
+    ASSERT_EQ(iter_status(t, iter), "h->xh");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "g->vg");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->xc");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->xb");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->xa");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    /* Changing direction. */
+    iter_seek(iter, "d");
+    ASSERT_EQ(iter_status(t, iter), "g->vg");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->xc");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "g->vg");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "h->xh");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "g->vg");
+
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+    ldb_iter_destroy(iter);
+
+    /* The batch alone. */
+    iter = ldb_ibatch_iterator(ib, NULL);
+
+    ldb_iter_last(iter);
+    ASSERT_EQ(iter_status(t, iter), "h->xh");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->xc");
+
+    ldb_iter_destroy(iter);
+
+    /* Writing the batch makes its updates visible. */
+    ASSERT(ldb_write(t->db, ldb_ibatch_batch(ib), NULL) == LDB_OK);
+
+    ASSERT_EQ("(a->xa)(b->xb)(c->xc)(g->vg)(h->xh)", test_contents(t));
+
+    ldb_ibatch_reset(ib);
+
+    ASSERT_EQ("vg", test_ibatch_get(t, ib, "g"));
+
+    ldb_ibatch_destroy(ib);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_get_memusage(test_t *t) {
+  int mem_usage;
+  char *val;
+
+  do {
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+    ASSERT(ldb_property(t->db, "leveldb.approximate-memory-usage", &val));
+
+    mem_usage = atoi(val);
+
+    ldb_free(val);
+
+    ASSERT(mem_usage > 0);
+    ASSERT(mem_usage < 5 * 1024 * 1024);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_block_cache_stats(test_t *t) {
+  char *val;
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+  ASSERT(ldb_property(t->db, "leveldb.block-cache-stats", &val));
+  ASSERT(strstr(val, "Total") != NULL);
+
+  ldb_free(val);
+}
+
+static void
+test_db_stats_json(test_t *t) {
+  char *val;
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  ASSERT(ldb_property(t->db, "leveldb.stats-json", &val));
+  ASSERT(strncmp(val, "{\"levels\":[{\"level\":0,\"files\":0,", 30) == 0);
+  ASSERT(strstr(val, "\"flush_bytes\":0,") != NULL);
+  ASSERT(strstr(val, "\"write_amplification\":0.00,") != NULL);
+  ASSERT(strstr(val, ",\"memtable_bytes\":0,") == NULL);
+  ASSERT(val[strlen(val) - 1] == '}');
+
+  ldb_free(val);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(ldb_property(t->db, "leveldb.stats-json", &val));
+  ASSERT(strstr(val, "\"flush_bytes\":0,") == NULL);
+  ASSERT(strstr(val, "\"write_amplification\":1.00,") != NULL);
+  ASSERT(strstr(val, "\"pending_compaction_bytes\":0,") != NULL);
+  ASSERT(strstr(val, "\"immutable_memtable_bytes\":0,") != NULL);
+
+  ldb_free(val);
+
+  ASSERT(ldb_property(t->db, "leveldb.estimate-pending-compaction-bytes",
+                      &val));
+  ASSERT(strcmp(val, "0") == 0);
+
+  ldb_free(val);
+}
+
+static void
+test_db_get_snapshot(test_t *t) {
+  do {
+    /* Try with both a short key and a long key */
+    int i;
+
+    for (i = 0; i < 2; i++) {
+      const char *key = (i == 0) ? "foo" : string_fill(t, 'x', 200);
+      const ldb_snapshot_t *s1;
+
+      ASSERT(test_put(t, key, "v1") == LDB_OK);
+
+      s1 = ldb_snapshot(t->db);
+
+      ASSERT(test_put(t, key, "v2") == LDB_OK);
+      ASSERT_EQ("v2", test_get(t, key));
+      ASSERT_EQ("v1", test_get2(t, key, s1));
+
+      ldb_test_compact_memtable(t->db);
+
+      ASSERT_EQ("v2", test_get(t, key));
+      ASSERT_EQ("v1", test_get2(t, key, s1));
+
+      ldb_release(t->db, s1);
+    }
+  } while (test_change_options(t));
+}
+
+static void
+test_db_get_identical_snapshots(test_t *t) {
+  do {
+    /* Try with both a short key and a long key */
+    int i;
+
+    for (i = 0; i < 2; i++) {
+      const char *key = (i == 0) ? "foo" : string_fill(t, 'x', 200);
+      const ldb_snapshot_t *s1;
+      const ldb_snapshot_t *s2;
+      const ldb_snapshot_t *s3;
+
+      ASSERT(test_put(t, key, "v1") == LDB_OK);
+
+      s1 = ldb_snapshot(t->db);
+      s2 = ldb_snapshot(t->db);
+      s3 = ldb_snapshot(t->db);
+
+      ASSERT(test_put(t, key, "v2") == LDB_OK);
+
+      ASSERT_EQ("v2", test_get(t, key));
+      ASSERT_EQ("v1", test_get2(t, key, s1));
+      ASSERT_EQ("v1", test_get2(t, key, s2));
+      ASSERT_EQ("v1", test_get2(t, key, s3));
+
+      ldb_release(t->db, s1);
+
+      ldb_test_compact_memtable(t->db);
+
+      ASSERT_EQ("v2", test_get(t, key));
+      ASSERT_EQ("v1", test_get2(t, key, s2));
+
+      ldb_release(t->db, s2);
+
+      ASSERT_EQ("v1", test_get2(t, key, s3));
+
+      ldb_release(t->db, s3);
+    }
+  } while (test_change_options(t));
+}
+
+static void
+test_db_iterate_over_empty_snapshot(test_t *t) {
+  do {
+    ldb_readopt_t options = *ldb_readopt_default;
+    const ldb_snapshot_t *snapshot;
+    ldb_iter_t *iter;
+
+    snapshot = ldb_snapshot(t->db);
+
+    options.snapshot = snapshot;
+
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+
+    iter = ldb_iterator(t->db, &options);
+
+    ldb_iter_first(iter);
+
+    ASSERT(!ldb_iter_valid(iter));
+
+    ldb_iter_destroy(iter);
+
+    ldb_test_compact_memtable(t->db);
+
+    iter = ldb_iterator(t->db, &options);
+
+    ldb_iter_first(iter);
+
+    ASSERT(!ldb_iter_valid(iter));
+
+    ldb_iter_destroy(iter);
+
+    ldb_release(t->db, snapshot);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_get_level0_ordering(test_t *t) {
+  do {
+    /* Check that we process level-0 files in correct order. The code
+       below generates two level-0 files where the earlier one comes
+       before the later one in the level-0 file list since the earlier
+       one has a smaller "smallest" key. */
+    ASSERT(test_put(t, "bar", "b") == LDB_OK);
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT_EQ("v2", test_get(t, "foo"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_get_ordered_by_levels(test_t *t) {
+  do {
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+    test_compact(t, "a", "z");
+
+    ASSERT_EQ("v1", test_get(t, "foo"));
+    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+    ASSERT_EQ("v2", test_get(t, "foo"));
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT_EQ("v2", test_get(t, "foo"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_get_picks_correct_file(test_t *t) {
+  do {
+    /* Arrange to have multiple files in a non-level-0 level. */
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+
+    test_compact(t, "a", "b");
+
+    ASSERT(test_put(t, "x", "vx") == LDB_OK);
+
+    test_compact(t, "x", "y");
+
+    ASSERT(test_put(t, "f", "vf") == LDB_OK);
+
+    test_compact(t, "f", "g");
+
+    ASSERT_EQ("va", test_get(t, "a"));
+    ASSERT_EQ("vf", test_get(t, "f"));
+    ASSERT_EQ("vx", test_get(t, "x"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_get_encounters_empty_level(test_t *t) {
+  do {
+    /* Arrange for the following to happen:
+     *
+     *   - sstable A in level 0
+     *   - nothing in level 1
+     *   - sstable B in level 2
+     *
+     * Then do enough get() calls to arrange for an automatic compaction
+     * of sstable A. A bug would cause the compaction to be marked as
+     * occurring at level 1 (instead of the correct level 0).
+     */
+    int i;
+
+    /* Step 1: First place sstables in levels 0 and 2 */
+    int compaction_count = 0;
+
+    while (test_files_at_level(t, 0) == 0 || test_files_at_level(t, 2) == 0) {
+      ASSERT(compaction_count <= 100);
+
+      compaction_count++;
+
+      test_put(t, "a", "begin");
+      test_put(t, "z", "end");
+
+      ldb_test_compact_memtable(t->db);
+    }
+
+    /* Step 2: clear level 1 if necessary. */
+    ldb_test_compact_range(t->db, 1, NULL, NULL);
+
+    ASSERT(test_files_at_level(t, 0) == 1);
+    ASSERT(test_files_at_level(t, 1) == 0);
+    ASSERT(test_files_at_level(t, 2) == 1);
+
+    /* Step 3: read a bunch of times */
+    for (i = 0; i < 1000; i++)
+      ASSERT_EQ("NOT_FOUND", test_get(t, "missing"));
+
+    /* Step 4: Wait for compaction to finish */
+    ldb_sleep_msec(1000);
+
+    ASSERT(test_files_at_level(t, 0) == 0);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_iter_empty(test_t *t) {
+  ldb_iter_t *iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ldb_iter_first(iter);
+
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_last(iter);
+
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  iter_seek(iter, "foo");
+
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_destroy(iter);
+}
+
+static void
+test_db_iter_single(test_t *t) {
+  ldb_iter_t *iter;
+
+  ASSERT(test_put(t, "a", "va") == LDB_OK);
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  iter_seek(iter, "");
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  iter_seek(iter, "a");
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  iter_seek(iter, "b");
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_destroy(iter);
+}
+
+static void
+test_db_iter_multi(test_t *t) {
+  ldb_iter_t *iter;
+
+  ASSERT(test_put(t, "a", "va") == LDB_OK);
+  ASSERT(test_put(t, "b", "vb") == LDB_OK);
+  ASSERT(test_put(t, "c", "vc") == LDB_OK);
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  iter_seek(iter, "");
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  iter_seek(iter, "a");
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  iter_seek(iter, "ax");
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  iter_seek(iter, "b");
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  iter_seek(iter, "z");
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  /* Switch from reverse to forward */
+  ldb_iter_last(iter);
+  ldb_iter_prev(iter);
+  ldb_iter_prev(iter);
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+
+  /* Switch from forward to reverse */
+  ldb_iter_first(iter);
+  ldb_iter_next(iter);
+  ldb_iter_next(iter);
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+
+  /* Make sure iter stays at snapshot */
+  ASSERT(test_put(t, "a", "va2") == LDB_OK);
+  ASSERT(test_put(t, "a2", "va3") == LDB_OK);
+  ASSERT(test_put(t, "b", "vb2") == LDB_OK);
+  ASSERT(test_put(t, "c", "vc2") == LDB_OK);
+  ASSERT(test_del(t, "b") == LDB_OK);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "b->vb");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_destroy(iter);
+}
+
+static void
+test_db_iter_small_and_large_mix(test_t *t) {
+  ldb_iter_t *iter;
+
+  ASSERT(test_put(t, "a", "va") == LDB_OK);
+  ASSERT(test_put(t, "b", string_fill(t, 'b', 100000)) == LDB_OK);
+  ASSERT(test_put(t, "c", "vc") == LDB_OK);
+  ASSERT(test_put(t, "d", string_fill(t, 'd', 100000)) == LDB_OK);
+  ASSERT(test_put(t, "e", string_fill(t, 'e', 100000)) == LDB_OK);
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "b->", 'b', 100000));
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "d->", 'd', 100000));
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "e->", 'e', 100000));
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "e->", 'e', 100000));
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "d->", 'd', 100000));
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), string_fill2(t, "b->", 'b', 100000));
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "a->va");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_destroy(iter);
+}
+
+static void
+test_db_iter_bounds(test_t *t) {
+  ldb_slice_t lower = ldb_string("b");
+  ldb_slice_t upper = ldb_string("e");
+  ldb_readopt_t options = *ldb_readopt_default;
+  ldb_iter_t *iter;
+  int pass;
+
+  options.iterate_lower_bound = &lower;
+  options.iterate_upper_bound = &upper;
+
+  ASSERT(test_put(t, "a", "va") == LDB_OK);
+  ASSERT(test_put(t, "b", "vb") == LDB_OK);
+  ASSERT(test_put(t, "c", "vc") == LDB_OK);
+  ASSERT(test_put(t, "d", "vd") == LDB_OK);
+  ASSERT(test_put(t, "e", "ve") == LDB_OK);
+  ASSERT(test_put(t, "f", "vf") == LDB_OK);
+
+  for (pass = 0; pass < 2; pass++) {
+    iter = ldb_iterator(t->db, &options);
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "d->vd");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    ldb_iter_last(iter);
+    ASSERT_EQ(iter_status(t, iter), "d->vd");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    iter_seek(iter, "b");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    iter_seek(iter, "a");
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+    iter_seek(iter, "c");
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+    iter_seek(iter, "e");
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    ldb_iter_destroy(iter);
+
+    /* Move everything into tables so that pruning comes into play. */
+    test_compact(t, "a", "f");
+  }
+
+  /* Deletions outside of the bounds do not matter. */
+  ASSERT(test_del(t, "b") == LDB_OK);
+  ASSERT(test_del(t, "d") == LDB_OK);
+
+  iter = ldb_iterator(t->db, &options);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "c->vc");
+  ldb_iter_prev(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_destroy(iter);
+
+  /* A range holding nothing. */
+  lower = ldb_string("x");
+  upper = ldb_string("z");
+
+  iter = ldb_iterator(t->db, &options);
+
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  ldb_iter_destroy(iter);
+}
+
+static void
+test_db_iter_pin_data(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_readopt_t ro = *ldb_readopt_default;
+  ldb_lru_t *cache = ldb_lru_create(0);
+  ldb_slice_t values[1000];
+  ldb_iter_t *iter;
+  char vbuf[200];
+  int i;
+
+  /* Blocks leave the cache as soon as they are released. */
+  options.create_if_missing = 1;
+  options.block_cache = cache;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(vbuf, "%0150d", i);
+    ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+
+    if (i == 499)
+      ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  }
+
+  ro.pin_data = 1;
+
+  iter = ldb_iterator(t->db, &ro);
+
+  /* Values outlive the positions they were read at. */
+  i = 0;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+    values[i++] = ldb_iter_value(iter);
+
+  ASSERT(i == 1000);
+
+  for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter)) {
+    ldb_slice_t value = ldb_iter_value(iter);
+
+    ASSERT(ldb_slice_equal(&value, &values[--i]));
+
+    values[i] = value;
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+  ASSERT(i == 0);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(vbuf, "%0150d", i);
+
+    ASSERT(values[i].size == 150);
+    ASSERT(memcmp(values[i].data, vbuf, 150) == 0);
+  }
+
+  ldb_iter_destroy(iter);
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ldb_lru_destroy(cache);
+}
+
+static int
+test_get_pinned(test_t *t, const char *k, ldb_pinned_t **pin) {
+  ldb_slice_t key = ldb_string(k);
+  return ldb_get_pinned(t->db, &key, pin, ldb_readopt_default);
+}
+
+static void
+test_db_get_pinned(test_t *t) {
+  static const ldb_mergeop_t op = {"test.Append", test_append_merge, NULL};
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_lru_t *cache = ldb_lru_create(0);
+  ldb_pinned_t *mem, *table, *merged, *missing;
+  ldb_slice_t value;
+  char vbuf[200];
+  int i;
+
+  /* Blocks leave the cache as soon as they are released. */
+  options.create_if_missing = 1;
+  options.block_cache = cache;
+  options.merge_operator = &op;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(vbuf, "%0150d", i);
+    ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+  }
+
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+
+  ASSERT(test_put(t, "foo", "memtable") == LDB_OK);
+  ASSERT(test_put(t, "bar", "1") == LDB_OK);
+  ASSERT(test_merge(t, "bar", "2") == LDB_OK);
+
+  ASSERT(test_get_pinned(t, "foo", &mem) == LDB_OK);
+  ASSERT(test_get_pinned(t, test_key(t, 50), &table) == LDB_OK);
+  ASSERT(test_get_pinned(t, "bar", &merged) == LDB_OK);
+  ASSERT(test_get_pinned(t, "baz", &missing) == LDB_NOTFOUND);
+  ASSERT(missing == NULL);
+
+  /* Values outlive the memtable and blocks they were read from. */
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_put(t, "foo", "overwritten") == LDB_OK);
+
+  value = ldb_pinned_value(mem);
+  ASSERT(value.size == 8 && memcmp(value.data, "memtable", 8) == 0);
+
+  sprintf(vbuf, "%0150d", 50);
+
+  value = ldb_pinned_value(table);
+  ASSERT(value.size == 150 && memcmp(value.data, vbuf, 150) == 0);
+
+  value = ldb_pinned_value(merged);
+  ASSERT(value.size == 3 && memcmp(value.data, "1,2", 3) == 0);
+
+  ldb_pinned_destroy(mem);
+  ldb_pinned_destroy(table);
+  ldb_pinned_destroy(merged);
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ldb_lru_destroy(cache);
+}
+
+static void
+test_db_iter_deletion_trigger(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_iter_t *iter;
+  int i;
+
+  options.iter_deletion_trigger = 100;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 500; i++)
+    ASSERT(test_put(t, test_key(t, i), "v") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  for (i = 0; i < 500; i++)
+    ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_total_files(t) == 2);
+
+  /* Scanning past the deletions has them compacted away. */
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ldb_iter_first(iter);
+
+  ASSERT(!ldb_iter_valid(iter));
+
+  ldb_iter_destroy(iter);
+
+  for (i = 0; i < 1000 && test_total_files(t) > 0; i++)
+    ldb_sleep_msec(10);
+
+  ASSERT(test_total_files(t) == 0);
+}
+
+static void
+test_db_iter_multi_with_delete(test_t *t) {
+  do {
+    ldb_iter_t *iter;
+
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+    ASSERT(test_put(t, "b", "vb") == LDB_OK);
+    ASSERT(test_put(t, "c", "vc") == LDB_OK);
+    ASSERT(test_del(t, "b") == LDB_OK);
+
+    ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+
+    iter = ldb_iterator(t->db, ldb_readopt_default);
+
+    iter_seek(iter, "c");
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+
+    ldb_iter_destroy(iter);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_iter_multi_with_delete_and_compaction(test_t *t) {
+  do {
+    ldb_iter_t *iter;
+
+    ASSERT(test_put(t, "b", "vb") == LDB_OK);
+    ASSERT(test_put(t, "c", "vc") == LDB_OK);
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(test_del(t, "b") == LDB_OK);
+    ASSERT_EQ("NOT_FOUND", test_get(t, "b"));
+
+    iter = ldb_iterator(t->db, ldb_readopt_default);
+
+    iter_seek(iter, "c");
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+
+    iter_seek(iter, "b");
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+
+    ldb_iter_destroy(iter);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_iter_refresh(test_t *t) {
+  do {
+    const ldb_snapshot_t *snap;
+    ldb_readopt_t options;
+    ldb_iter_t *iter;
+
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+
+    iter = ldb_iterator(t->db, ldb_readopt_default);
+
+    ASSERT(test_put(t, "b", "vb") == LDB_OK);
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    /* New writes become visible. */
+    ASSERT(ldb_iter_refresh(iter) == LDB_OK);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+
+    /* As do flushed memtables and deletions. */
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(test_put(t, "c", "vc") == LDB_OK);
+    ASSERT(test_del(t, "a") == LDB_OK);
+    ASSERT(ldb_iter_refresh(iter) == LDB_OK);
+
+    ldb_iter_last(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    ASSERT(test_del_range(t, "b", "c") == LDB_OK);
+    ASSERT(ldb_iter_refresh(iter) == LDB_OK);
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+    ldb_iter_destroy(iter);
+
+    /* Iterators reading a snapshot cannot be refreshed. */
+    snap = ldb_snapshot(t->db);
+    options = *ldb_readopt_default;
+    options.snapshot = snap;
+
+    iter = ldb_iterator(t->db, &options);
+
+    ASSERT(ldb_iter_refresh(iter) == LDB_INVALID);
+
+    ldb_iter_destroy(iter);
+    ldb_release(t->db, snap);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_iter_tailing(test_t *t) {
+  do {
+    ldb_readopt_t options = *ldb_readopt_default;
+    ldb_iter_t *iter;
+    ldb_slice_t key;
+
+    options.tailing = 1;
+
+    iter = ldb_iterator(t->db, &options);
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+    /* Each seek sees the writes made before it. */
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+
+    ldb_iter_first(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+
+    ASSERT(test_put(t, "b", "vb") == LDB_OK);
+
+    iter_seek(iter, "b");
+    ASSERT_EQ(iter_status(t, iter), "b->vb");
+
+    /* Including those flushed and compacted since. */
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(test_put(t, "c", "vc") == LDB_OK);
+    ASSERT(test_del(t, "b") == LDB_OK);
+
+    iter_seek(iter, "b");
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+
+    ldb_compact(t->db, NULL, NULL);
+
+    ASSERT(test_put(t, "d", "vd") == LDB_OK);
+
+    ldb_iter_last(iter);
+    ASSERT_EQ(iter_status(t, iter), "d->vd");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+    ldb_iter_prev(iter);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+
+    /* Seeking to a key of the iterator itself. */
+    ASSERT(test_put(t, "e", "ve") == LDB_OK);
+
+    key = ldb_iter_key(iter);
+
+    ldb_iter_seek(iter, &key);
+    ASSERT_EQ(iter_status(t, iter), "a->va");
+    ldb_iter_next(iter);
+    ASSERT_EQ(iter_status(t, iter), "c->vc");
+
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+    ldb_iter_destroy(iter);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_recover(test_t *t) {
+  do {
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+    ASSERT(test_put(t, "baz", "v5") == LDB_OK);
+
+    test_reopen(t, 0);
+
+    ASSERT_EQ("v1", test_get(t, "foo"));
+    ASSERT_EQ("v1", test_get(t, "foo"));
+    ASSERT_EQ("v5", test_get(t, "baz"));
+    ASSERT(test_put(t, "bar", "v2") == LDB_OK);
+    ASSERT(test_put(t, "foo", "v3") == LDB_OK);
+
+    test_reopen(t, 0);
+
+    ASSERT_EQ("v3", test_get(t, "foo"));
+    ASSERT(test_put(t, "foo", "v4") == LDB_OK);
+    ASSERT_EQ("v4", test_get(t, "foo"));
+    ASSERT_EQ("v2", test_get(t, "bar"));
+    ASSERT_EQ("v5", test_get(t, "baz"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_recover_with_empty_log(test_t *t) {
+  do {
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+
+    test_reopen(t, 0);
+    test_reopen(t, 0);
+
+    ASSERT(test_put(t, "foo", "v3") == LDB_OK);
+
+    test_reopen(t, 0);
+
+    ASSERT_EQ("v3", test_get(t, "foo"));
+  } while (test_change_options(t));
+}
+
+/* Check that writes done during a memtable compaction are recovered
+   if the database is shutdown during the memtable compaction. */
+static void
+test_db_disable_wal(test_t *t) {
+  ldb_writeopt_t options = *ldb_writeopt_default;
+  ldb_slice_t key = ldb_string("foo");
+  ldb_slice_t val = ldb_string("v1");
+
+  options.disable_wal = 1;
+  options.sync = 1;
+
+  ASSERT(ldb_put(t->db, &key, &val, &options) == LDB_INVALID);
+
+  options.sync = 0;
+
+  do {
+    ASSERT(ldb_put(t->db, &key, &val, &options) == LDB_OK);
+    ASSERT(test_put(t, "bar", "v2") == LDB_OK);
+    ASSERT(ldb_put(t->db, &val, &key, &options) == LDB_OK);
+
+    ASSERT_EQ("v1", test_get(t, "foo"));
+    ASSERT_EQ("foo", test_get(t, "v1"));
+
+    /* Unlogged writes are flushed by a clean shutdown. */
+    test_reopen(t, 0);
+
+    ASSERT_EQ("v1", test_get(t, "foo"));
+    ASSERT_EQ("v2", test_get(t, "bar"));
+    ASSERT_EQ("foo", test_get(t, "v1"));
+
+    ASSERT(test_del(t, "v1") == LDB_OK);
+
+    test_reopen(t, 0);
+
+    ASSERT_EQ("NOT_FOUND", test_get(t, "v1"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_memtable_huge_pages(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char buf[32];
+  int i;
+
+  options.create_if_missing = 1;
+  options.write_buffer_size = 16 << 20;
+  options.memtable_huge_page_size = 2 << 20;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 100000; i++) {
+    sprintf(buf, "v%d", i);
+    ASSERT(test_put(t, test_key(t, i), buf) == LDB_OK);
+  }
+
+  for (i = 0; i < 100000; i += 997) {
+    sprintf(buf, "v%d", i);
+    ASSERT_EQ(buf, test_get(t, test_key(t, i)));
+  }
+
+  test_reset(t);
+  test_reopen(t, &options);
+
+  for (i = 0; i < 100000; i += 997) {
+    sprintf(buf, "v%d", i);
+    ASSERT_EQ(buf, test_get(t, test_key(t, i)));
+  }
+
+  test_reset(t);
+}
+
+static void
+test_db_write_buffer_manager(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_wbm_t *wbm = ldb_wbm_create(512 << 10);
+  char dbname[LDB_PATH_MAX];
+  ldb_slice_t key, val;
+  ldb_t *db = NULL;
+  char kbuf[20];
+  int i;
+
+  /* Neither memtable fills up on its own. */
+  options.create_if_missing = 1;
+  options.write_buffer_size = 8 << 20;
+  options.write_buffer_manager = wbm;
+
+  test_destroy_and_reopen(t, &options);
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_wbm_test"));
+
+  ldb_destroy(dbname, NULL);
+
+  ASSERT(ldb_open(dbname, &options, &db) == LDB_OK);
+
+  /* Within budget. */
+  for (i = 0; i < 40; i++)
+    ASSERT(test_put(t, test_key(t, i), string_fill(t, 'x', 10000)) == LDB_OK);
+
+  /* Charged as of the last write. */
+  ASSERT(ldb_wbm_usage(wbm) >= 350000);
+  ASSERT(test_total_files(t) == 0);
+
+  /* Over budget: the other database has the largest memtable... */
+  val = ldb_string(string_fill(t, 'y', 10000));
+
+  for (i = 0; i < 20; i++) {
+    sprintf(kbuf, "%06d", i);
+
+    key = ldb_string(kbuf);
+
+    ASSERT(ldb_put(db, &key, &val, NULL) == LDB_OK);
+  }
+
+  /* ...and flushes it at its next write. */
+  ASSERT(test_put(t, "foo", "bar") == LDB_OK);
+
+  for (i = 0; i < 1000 && test_total_files(t) == 0; i++)
+    ldb_sleep_msec(10);
+
+  ASSERT(test_total_files(t) > 0);
+  ASSERT(ldb_wbm_usage(wbm) < (512 << 10));
+
+  ASSERT_EQ("bar", test_get(t, "foo"));
+  ASSERT(strlen(test_get(t, test_key(t, 0))) == 10000);
+
+  ldb_close(db);
+  ldb_destroy(dbname, NULL);
+
+  test_close(t);
+
+  ASSERT(ldb_wbm_usage(wbm) == 0);
+
+  ldb_wbm_destroy(wbm);
+}
+
+static void
+test_db_memory_limit(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_wbm_t *wbm = ldb_wbm_create(8 << 20);
+  ldb_lru_t *cache = ldb_lru_create(1 << 20);
+  ldb_memusage_t usage;
+  int i;
+
+  options.create_if_missing = 1;
+  options.write_buffer_size = 8 << 20;
+  options.write_buffer_manager = wbm;
+  options.block_cache = cache;
+
+  ldb_wbm_set_limit(wbm, 1 << 20, cache);
+
+  test_destroy_and_reopen(t, &options);
+
+  /* The cache gives way to the memtable. */
+  for (i = 0; i < 40; i++)
+    ASSERT(test_put(t, test_key(t, i), string_fill(t, 'x', 10000)) == LDB_OK);
+
+  ASSERT(test_total_files(t) == 0);
+  ASSERT(ldb_lru_capacity(cache) < (1 << 20));
+  ASSERT(ldb_lru_capacity(cache) >= (1 << 18));
+
+  ldb_memory_usage(t->db, &usage);
+
+  ASSERT(usage.memtables >= 400000);
+  ASSERT(usage.table_readers == 0);
+  ASSERT(usage.write_batches == 0);
+  ASSERT(usage.total >= usage.memtables + usage.block_cache);
+
+  /* The memtable is flushed before it takes the cache's last quarter. */
+  for (i = 40; i < 100; i++)
+    ASSERT(test_put(t, test_key(t, i), string_fill(t, 'x', 10000)) == LDB_OK);
+
+  for (i = 0; i < 1000 && test_total_files(t) == 0; i++)
+    ldb_sleep_msec(10);
+
+  ASSERT(test_total_files(t) > 0);
+  ASSERT(ldb_wbm_usage(wbm) < (1 << 20));
+
+  for (i = 0; i < 100; i += 9)
+    ASSERT(strlen(test_get(t, test_key(t, i))) == 10000);
+
+  ldb_memory_usage(t->db, &usage);
+
+  ASSERT(usage.table_readers > 0);
+  ASSERT(usage.block_cache > 0);
+  ASSERT(usage.block_cache <= ldb_lru_capacity(cache));
+
+  test_close(t);
+
+  /* The cache gets its capacity back along with the manager. */
+  ldb_wbm_destroy(wbm);
+
+  ASSERT(ldb_lru_capacity(cache) == (1 << 20));
+
+  ldb_lru_destroy(cache);
+}
+
+static void
+test_db_index_user_keys(test_t *t) {
+  int pass;
+
+  /* Also with the index entries added as compressed blocks are written. */
+  for (pass = 0; pass < 2; pass++) {
+    ldb_dbopt_t options = test_current_options(t);
+    const ldb_snapshot_t *snap;
+    ldb_iter_t *iter;
+    int i, count;
+
+    options.create_if_missing = 1;
+    options.block_size = 1024;
+    options.index_block_restart_interval = 4;
+    options.index_user_keys = 1;
+    options.compression_threads = pass ? 4 : 1;
+
+    test_destroy_and_reopen(t, &options);
+
+    for (i = 0; i < 500; i++)
+      ASSERT(test_put(t, test_key(t, i), string_fill(t, 'x', 200)) == LDB_OK);
+
+    /* Versions of a key may now span a block boundary. */
+    snap = ldb_snapshot(t->db);
+
+    for (i = 0; i < 500; i += 2)
+      ASSERT(test_put(t, test_key(t, i), "v2") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    for (i = 0; i < 500; i++) {
+      ASSERT_EQ((i & 1) ? string_fill(t, 'x', 200) : "v2",
+                test_get(t, test_key(t, i)));
+      ASSERT_EQ(string_fill(t, 'x', 200), test_get2(t, test_key(t, i), snap));
+      test_reset(t);
+    }
+
+    ldb_release(t->db, snap);
+
+    /* One version per key: indexed by user key. */
+    test_fill_levels(t, "a", "z");
+    ldb_compact(t->db, NULL, NULL);
+
+    for (i = 0; i < 500; i++) {
+      ASSERT_EQ((i & 1) ? string_fill(t, 'x', 200) : "v2",
+                test_get(t, test_key(t, i)));
+      test_reset(t);
+    }
+
+    ASSERT_EQ("NOT_FOUND", test_get(t, "key000100x"));
+
+    iter = ldb_iterator(t->db, 0);
+
+    count = 0;
+
+    for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+      count++;
+
+    ASSERT(count == 500 + 2);
+
+    count = 0;
+
+    for (ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter))
+      count++;
+
+    ASSERT(count == 500 + 2);
+
+    iter_seek(iter, "key000250");
+    ASSERT_EQ("key000250->v2", iter_status(t, iter));
+
+    iter_seek(iter, "key0002505");
+    ASSERT(ldb_iter_valid(iter));
+
+    {
+      ldb_slice_t key = ldb_iter_key(iter);
+      ldb_slice_t expect = ldb_string("key000251");
+
+      ASSERT(ldb_slice_equal(&key, &expect));
+    }
+
+    ldb_iter_destroy(iter);
+  }
+}
+
+static void
+test_db_shared_thread_pool(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_pool_t *pool = ldb_pool_create(2);
+  char dbname[LDB_PATH_MAX];
+  ldb_slice_t key, val;
+  ldb_t *db = NULL;
+  char kbuf[20];
+  int i;
+
+  /* Both databases flush and compact on the same two threads. */
+  options.create_if_missing = 1;
+  options.write_buffer_size = 100000;
+  options.thread_pool = pool;
+
+  test_destroy_and_reopen(t, &options);
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_pool_test"));
+
+  ldb_destroy(dbname, NULL);
+
+  ASSERT(ldb_open(dbname, &options, &db) == LDB_OK);
+
+  val = ldb_string(string_fill(t, 'y', 1000));
+
+  for (i = 0; i < 1000; i++) {
+    ASSERT(test_put(t, test_key(t, i), string_fill(t, 'x', 1000)) == LDB_OK);
+
+    sprintf(kbuf, "%06d", i);
+
+    key = ldb_string(kbuf);
+
+    ASSERT(ldb_put(db, &key, &val, NULL) == LDB_OK);
+  }
+
+  ldb_compact(db, NULL, NULL);
+
+  key = ldb_string("000500");
+
+  ASSERT(ldb_get(db, &key, &val, NULL) == LDB_OK);
+  ASSERT(val.size == 1000);
+
+  ldb_free(val.data);
+
+  /* The pool outlives either database. */
+  ldb_close(db);
+  ldb_destroy(dbname, NULL);
+
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT(test_total_files(t) > 0);
+  ASSERT(strlen(test_get(t, test_key(t, 500))) == 1000);
+
+  test_close(t);
+
+  ldb_pool_destroy(pool);
+}
+
+static void
+test_db_recover_during_memtable_compaction(test_t *t) {
+  do {
+    ldb_dbopt_t options = test_current_options(t);
+
+    options.write_buffer_size = 1000000;
+
+    test_reopen(t, &options);
+
+    /* Trigger a long memtable compaction and reopen the database during it */
+    ASSERT(test_put(t, "foo", "v1") == LDB_OK); /* Goes to 1st log file */
+    ASSERT(test_put(t, "big1", string_fill(t, 'x', 10000000)) == LDB_OK); /* Fills memtable */
+    ASSERT(test_put(t, "big2", string_fill(t, 'y', 1000)) == LDB_OK); /* Triggers compaction */
+    ASSERT(test_put(t, "bar", "v2") == LDB_OK); /* Goes to new log file */
+
+    test_reopen(t, &options);
+
+    ASSERT_EQ("v1", test_get(t, "foo"));
+    ASSERT_EQ("v2", test_get(t, "bar"));
+    ASSERT_EQ(string_fill(t, 'x', 10000000), test_get(t, "big1"));
+    ASSERT_EQ(string_fill(t, 'y', 1000), test_get(t, "big2"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_minor_compactions_happen(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int starting_num_tables;
+  int ending_num_tables;
+  const int N = 500;
+  int i;
+
+  options.write_buffer_size = 10000;
+
+  test_reopen(t, &options);
+
+  starting_num_tables = test_total_files(t);
+
+  for (i = 0; i < N; i++) {
+    const char *key = test_key(t, i);
+    const char *val = string_fill2(t, key, 'v', 1000);
+
+    ASSERT(test_put(t, key, val) == LDB_OK);
+  }
+
+  ending_num_tables = test_total_files(t);
+
+  ASSERT(ending_num_tables > starting_num_tables);
+
+  for (i = 0; i < N; i++) {
+    const char *key = test_key(t, i);
+    const char *val = string_fill2(t, key, 'v', 1000);
+
+    ASSERT_EQ(val, test_get(t, key));
+  }
+
+  test_reopen(t, 0);
+
+  for (i = 0; i < N; i++) {
+    const char *key = test_key(t, i);
+    const char *val = string_fill2(t, key, 'v', 1000);
+
+    ASSERT_EQ(val, test_get(t, key));
+  }
+}
+
+static void
+test_db_recover_with_large_log(test_t *t) {
+  {
+    ldb_dbopt_t options = test_current_options(t);
+
+    test_reopen(t, &options);
+
+    ASSERT(test_put(t, "big1", string_fill(t, '1', 200000)) == LDB_OK);
+    ASSERT(test_put(t, "big2", string_fill(t, '2', 200000)) == LDB_OK);
+    ASSERT(test_put(t, "small3", string_fill(t, '3', 10)) == LDB_OK);
+    ASSERT(test_put(t, "small4", string_fill(t, '4', 10)) == LDB_OK);
+    ASSERT(test_files_at_level(t, 0) == 0);
+  }
+
+  /* Make sure that if we re-open with a small write buffer size that
+     we flush table files in the middle of a large log file. */
+  {
+    ldb_dbopt_t options = test_current_options(t);
+
+    options.write_buffer_size = 100000;
+
+    test_reopen(t, &options);
+
+    ASSERT(test_files_at_level(t, 0) == 3);
+    ASSERT_EQ(string_fill(t, '1', 200000), test_get(t, "big1"));
+    ASSERT_EQ(string_fill(t, '2', 200000), test_get(t, "big2"));
+    ASSERT_EQ(string_fill(t, '3', 10), test_get(t, "small3"));
+    ASSERT_EQ(string_fill(t, '4', 10), test_get(t, "small4"));
+    ASSERT(test_files_at_level(t, 0) > 1);
+  }
+}
+
+static void
+test_db_recover_in_parallel(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char vbuf[128];
+  int i, pass;
+
+  options.write_buffer_size = 1 << 20;
+
+  test_reopen(t, &options);
+
+  /* Later passes overwrite (or delete) keys from earlier memtables. */
+  for (pass = 0; pass < 3; pass++) {
+    for (i = 0; i < 2000; i++) {
+      sprintf(vbuf, "%d-%0100d", pass, i);
+
+      if (pass == 2 && i % 7 == 0)
+        ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
+      else
+        ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+    }
+  }
+
+  ASSERT(test_files_at_level(t, 0) == 0);
+
+  /* Batches are inserted by several threads, and tables are written
+     while the next memtable fills. */
+  options.write_buffer_size = 100000;
+  options.max_background_compactions = 4;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 2000; i++) {
+    sprintf(vbuf, "2-%0100d", i);
+
+    if (i % 7 == 0)
+      ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, i)));
+    else
+      ASSERT_EQ(vbuf, test_get(t, test_key(t, i)));
+  }
+}
+
+static int
+test_manifest_records(test_t *t) {
+  int result = -1;
+  char *value;
+
+  ASSERT(ldb_property(t->db, "leveldb.manifest-stats", &value));
+  ASSERT(sscanf(value, "MANIFEST-%*u\nSize(KB): %*f\nReplayed: %d",
+                       &result) == 1);
+
+  ldb_free(value);
+
+  return result;
+}
+
+static void
+test_db_manifest_rollover(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char key[20];
+  int i;
+
+  options.reuse_logs = 1;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 10; i++) {
+    sprintf(key, "key%d", i);
+
+    ASSERT(test_put(t, key, "v") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  /* Every flush was appended to the reused MANIFEST. */
+  test_reopen(t, &options);
+
+  ASSERT(test_manifest_records(t) > 10);
+
+  /* Now every edit starts a new one. */
+  options.max_manifest_file_size = 1;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 10; i++) {
+    sprintf(key, "key%d", i);
+
+    ASSERT(test_put(t, key, "w") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  test_reopen(t, &options);
+
+  ASSERT(test_manifest_records(t) <= 2);
+
+  for (i = 0; i < 10; i++) {
+    sprintf(key, "key%d", i);
+
+    ASSERT_EQ("w", test_get(t, key));
+  }
+}
+
+static double
+test_latency_count(test_t *t, const char *op) {
+  double count = -1;
+  char *value, *line;
+
+  if (!ldb_property(t->db, "leveldb.latency-stats", &value))
+    return -1;
+
+  for (line = value; line != NULL; line = strchr(line, '\n')) {
+    if (*line == '\n')
+      line++;
+
+    if (strncmp(line, op, strlen(op)) == 0 && line[strlen(op)] == ' ') {
+      ASSERT(sscanf(line + strlen(op), "%lf", &count) == 1);
+      break;
+    }
+  }
+
+  ldb_free(value);
+
+  return count;
+}
+
+static void
+test_db_latency_stats(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_writeopt_t wo = *ldb_writeopt_default;
+  ldb_slice_t key = ldb_string("k");
+  ldb_iter_t *iter;
+  int i;
+
+  /* Not tracked by default. */
+  ASSERT(test_latency_count(t, "get") == -1);
+
+  options.track_latency = 1;
+
+  test_reopen(t, &options);
+
+  wo.sync = 1;
+
+  ASSERT(ldb_put(t->db, &key, &key, &wo) == LDB_OK);
+
+  for (i = 0; i < 10; i++) {
+    ASSERT(test_put(t, "foo", "v") == LDB_OK);
+    ASSERT_EQ("v", test_get(t, "foo"));
+  }
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  iter_seek(iter, "foo");
+  ASSERT(ldb_iter_valid(iter));
+
+  ldb_iter_next(iter);
+  ASSERT(ldb_iter_valid(iter));
+
+  ldb_iter_destroy(iter);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_latency_count(t, "get") == 10);
+  ASSERT(test_latency_count(t, "write") == 11);
+  ASSERT(test_latency_count(t, "seek") == 1);
+  ASSERT(test_latency_count(t, "next") == 1);
+  ASSERT(test_latency_count(t, "wal-sync") == 1);
+  ASSERT(test_latency_count(t, "flush") == 1);
+
+  ldb_reset_stats(t->db);
+
+  ASSERT(test_latency_count(t, "get") == 0);
+  ASSERT(test_latency_count(t, "write") == 0);
+
+  ASSERT_EQ("v", test_get(t, "foo"));
+  ASSERT(test_latency_count(t, "get") == 1);
+}
+
+static void
+test_db_perf_context(test_t *t) {
+  ldb_perfctx_t *ctx = ldb_perf_context();
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  ldb_perf_enable(1);
+  ldb_perf_reset();
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+#ifdef LDB_TLS
+  ASSERT(ctx->memtable_count == 1);
+  ASSERT(ctx->table_count == 0);
+  ASSERT(ctx->get_nanos >= ctx->memtable_nanos);
+#endif
+
+  ldb_test_compact_memtable(t->db);
+
+  ldb_perf_reset();
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+#ifdef LDB_TLS
+  ASSERT(ctx->memtable_count == 1);
+  ASSERT(ctx->table_count == 1);
+  ASSERT(ctx->block_cache_hits + ctx->block_cache_misses >= 1);
+  ASSERT(ctx->block_read_bytes >= ctx->block_read_count);
+  ASSERT(ctx->get_nanos >= ctx->files_nanos);
+#endif
+
+  ldb_perf_enable(0);
+  ldb_perf_reset();
+
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+  ASSERT(ctx->memtable_count == 0);
+  ASSERT(ctx->table_count == 0);
+  ASSERT(ctx->get_nanos == 0);
+}
+
+static void
+test_db_statistics(test_t *t) {
+  ldb_statistics_t *stats = ldb_statistics_create();
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_writeopt_t wo = *ldb_writeopt_default;
+  ldb_slice_t key = ldb_string("foo");
+  char *value;
+
+  options.statistics = stats;
+
+  test_reopen(t, &options);
+
+  wo.sync = 1;
+
+  ASSERT(ldb_put(t->db, &key, &key, &wo) == LDB_OK);
+  ASSERT(test_put(t, "bar", "v") == LDB_OK);
+
+  ASSERT(ldb_statistics_get(stats, LDB_KEYS_WRITTEN) == 2);
+  ASSERT(ldb_statistics_get(stats, LDB_WAL_SYNCS) == 1);
+  ASSERT(ldb_statistics_get(stats, LDB_WAL_BYTES) > 0);
+
+  ASSERT_EQ("foo", test_get(t, "foo"));
+
+  ASSERT(ldb_statistics_get(stats, LDB_MEMTABLE_HIT) == 1);
+  ASSERT(ldb_statistics_get(stats, LDB_BYTES_READ) == 3);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(ldb_statistics_get(stats, LDB_FLUSH_WRITE_BYTES) > 0);
+
+  ASSERT_EQ("foo", test_get(t, "foo"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "baz"));
+
+  ASSERT(ldb_statistics_get(stats, LDB_MEMTABLE_MISS) == 2);
+  ASSERT(ldb_statistics_get(stats, LDB_KEYS_READ) == 3);
+  ASSERT(ldb_statistics_get(stats, LDB_GET_HIT_L0)
+       + ldb_statistics_get(stats, LDB_GET_HIT_L1)
+       + ldb_statistics_get(stats, LDB_GET_HIT_L2_AND_UP) == 1);
+  ASSERT(ldb_statistics_get(stats, LDB_BLOCK_CACHE_HIT)
+       + ldb_statistics_get(stats, LDB_BLOCK_CACHE_MISS) > 0);
+
+  ASSERT(ldb_property(t->db, "leveldb.statistics", &value));
+  ASSERT(strstr(value, "number.keys.read: 3\n") != NULL);
+  ldb_free(value);
+
+  value = ldb_statistics_string(stats, 1);
+  ASSERT(strstr(value, "\"number.keys.written\":2,") != NULL);
+  ldb_free(value);
+
+  ldb_statistics_reset(stats);
+
+  ASSERT(ldb_statistics_get(stats, LDB_KEYS_READ) == 0);
+
+  test_reopen(t, NULL);
+
+  ASSERT(!ldb_property(t->db, "leveldb.statistics", &value));
+
+  ldb_statistics_destroy(stats);
+}
+
+typedef struct test_events_s {
+  int flushes, flushed, compactions, compacted, stalls, stalled;
+  uint64_t flush_bytes, input_bytes, output_bytes;
+  int last_cause;
+} test_events_t;
+
+static void
+test_flush_begin(const ldb_listener_t *lis, const ldb_flushinfo_t *info) {
+  test_events_t *ev = lis->state;
+
+  ASSERT(info->memtable_bytes > 0);
+
+  ev->flushes++;
+}
+
+static void
+test_flush_end(const ldb_listener_t *lis, const ldb_flushinfo_t *info) {
+  test_events_t *ev = lis->state;
+
+  ASSERT(info->status == LDB_OK);
+  ASSERT(info->file_number > 0);
+
+  ev->flushed++;
+  ev->flush_bytes += info->file_size;
+}
+
+static void
+test_compaction_begin(const ldb_listener_t *lis,
+                      const ldb_compactinfo_t *info) {
+  test_events_t *ev = lis->state;
+
+  ASSERT(info->input_files > 0);
+  ASSERT(info->output_level >= info->level);
+
+  ev->compactions++;
+  ev->input_bytes += info->input_bytes;
+}
+
+static void
+test_compaction_end(const ldb_listener_t *lis,
+                    const ldb_compactinfo_t *info) {
+  test_events_t *ev = lis->state;
+
+  ASSERT(info->status == LDB_OK);
+
+  ev->compacted++;
+  ev->output_bytes += info->output_bytes;
+}
+
+static void
+test_stall_begin(const ldb_listener_t *lis, const ldb_stallinfo_t *info) {
+  test_events_t *ev = lis->state;
+
+  ev->stalls++;
+  ev->last_cause = info->cause;
+}
+
+static void
+test_stall_end(const ldb_listener_t *lis, const ldb_stallinfo_t *info) {
+  test_events_t *ev = lis->state;
+
+  ASSERT(info->cause == ev->last_cause);
+
+  ev->stalled++;
+}
+
+static void
+test_db_event_listener(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_listener_t lis;
+  test_events_t ev;
+  char value[1000];
+  int i;
+
+  memset(&ev, 0, sizeof(ev));
+  memset(value, 'x', sizeof(value) - 1);
+
+  value[sizeof(value) - 1] = '\0';
+
+  lis.flush_begin = test_flush_begin;
+  lis.flush_end = test_flush_end;
+  lis.compaction_begin = test_compaction_begin;
+  lis.compaction_end = test_compaction_end;
+  lis.stall_begin = test_stall_begin;
+  lis.stall_end = test_stall_end;
+  lis.state = &ev;
+
+  options.create_if_missing = 1;
+  options.level0_file_num_compaction_trigger = 100;
+  options.level0_slowdown_writes_trigger = 2;
+  options.level0_stop_writes_trigger = 100;
+  options.delayed_write_rate = 1 << 20;
+  options.listener = &lis;
+
+  test_destroy_and_reopen(t, &options);
+
+  while (test_files_at_level(t, 0) < 2) {
+    ASSERT(test_put(t, "a", "va") == LDB_OK);
+    ASSERT(test_put(t, "z", "vz") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  ASSERT(ev.flushes > 2);
+  ASSERT(ev.flushed == ev.flushes);
+  ASSERT(ev.flush_bytes > 0);
+
+  /* Writes are paced past the slowdown trigger. */
+  for (i = 0; i < 10; i++)
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+
+  ASSERT(ev.stalls > 0);
+  ASSERT(ev.stalled == ev.stalls);
+  ASSERT(ev.last_cause == LDB_STALL_DELAY);
+
+  test_compact(t, "a", "z");
+
+  ASSERT(ev.compactions > 0);
+  ASSERT(ev.compacted == ev.compactions);
+  ASSERT(ev.input_bytes > 0);
+  ASSERT(ev.output_bytes > 0);
+}
+
+static void
+test_db_level0_lookup(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int newest[400];
+  char value[20];
+  int i, j, k;
+
+  options.create_if_missing = 1;
+  options.level0_file_num_compaction_trigger = 100;
+  options.level0_slowdown_writes_trigger = 100;
+  options.level0_stop_writes_trigger = 101;
+
+  test_destroy_and_reopen(t, &options);
+
+  /* Level-0 files of staggered, overlapping ranges, some sharing
+     their bounds. Odd keys are never written. */
+  for (i = 0; i < 400; i++)
+    newest[i] = -1;
+
+  for (i = 0; i < 40; i++) {
+    int start = (i * 37) % 300;
+    int length = 10 + (i * 13) % 90;
+
+    sprintf(value, "v%d", i);
+
+    for (k = start & ~1; k < start + length; k += 2) {
+      ASSERT(test_put(t, test_key(t, k), value) == LDB_OK);
+      newest[k] = i;
+    }
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  ASSERT(test_files_at_level(t, 0) > 30);
+
+  for (j = 0; j < 2; j++) {
+    for (k = 0; k < 400; k++) {
+      if (newest[k] < 0) {
+        ASSERT_EQ("NOT_FOUND", test_get(t, test_key(t, k)));
+      } else {
+        sprintf(value, "v%d", newest[k]);
+        ASSERT_EQ(value, test_get(t, test_key(t, k)));
+      }
+    }
+
+    test_reopen(t, &options);
+  }
+}
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+/* Holds up compactions out of level-0 until released, counting the
+   level-0 files merged back into level-0 meanwhile. */
+typedef struct test_intra_s {
+  ldb_atomic(int) blocked;
+  ldb_atomic(int) release;
+  ldb_atomic(int) merged;
+} test_intra_t;
+
+static void
+test_intra_begin(const ldb_listener_t *lis, const ldb_compactinfo_t *info) {
+  test_intra_t *st = lis->state;
+
+  if (info->level == 0 && info->output_level == 0) {
+    ldb_atomic_fetch_add(&st->merged, 1, ldb_order_relaxed);
+    return;
+  }
+
+  ldb_atomic_store(&st->blocked, 1, ldb_order_release);
+
+  while (!ldb_atomic_load(&st->release, ldb_order_acquire))
+    ldb_sleep_msec(1);
+}
+
+static void
+test_db_intra_l0_compaction(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_listener_t lis;
+  test_intra_t st;
+  char value[100];
+  int i;
+
+  memset(&lis, 0, sizeof(lis));
+
+  ldb_atomic_init(&st.blocked, 0);
+  ldb_atomic_init(&st.release, 0);
+  ldb_atomic_init(&st.merged, 0);
+
+  lis.compaction_begin = test_intra_begin;
+  lis.state = &st;
+
+  options.create_if_missing = 1;
+  options.level0_file_num_compaction_trigger = 2;
+  options.level0_slowdown_writes_trigger = 100;
+  options.level0_stop_writes_trigger = 101;
+  options.max_background_compactions = 2;
+  options.listener = &lis;
+
+  test_destroy_and_reopen(t, &options);
+
+  /* Overlapping flushes until a compaction out of level-0 is held. */
+  for (i = 0; !ldb_atomic_load(&st.blocked, ldb_order_acquire); i++) {
+    ASSERT(i < 1000);
+
+    sprintf(value, "v%d", i);
+
+    ASSERT(test_put(t, "a", value) == LDB_OK);
+    ASSERT(test_put(t, "z", value) == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    if (i >= 10)
+      ldb_sleep_msec(10);
+  }
+
+  /* The files flushed in the meantime are merged into one. */
+  for (; ldb_atomic_load(&st.merged, ldb_order_relaxed) == 0; i++) {
+    ASSERT(i < 1000);
+
+    sprintf(value, "v%d", i);
+
+    ASSERT(test_put(t, "a", value) == LDB_OK);
+    ASSERT(test_put(t, "z", value) == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+    ldb_sleep_msec(10);
+  }
+
+  /* Later flushes stay in front of the merged file. */
+  sprintf(value, "v%d", i);
+
+  ASSERT(test_put(t, "a", value) == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ(value, test_get(t, "a"));
+
+  ldb_atomic_store(&st.release, 1, ldb_order_release);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ(value, test_get(t, "a"));
+
+  sprintf(value, "v%d", i - 1);
+
+  ASSERT_EQ(value, test_get(t, "z"));
+
+  options.listener = NULL;
+
+  test_reopen(t, &options);
+}
+#endif
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+static void
+test_db_background_deletes(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int live;
+
+  options.create_if_missing = 1;
+  options.background_deletes = 1;
+  options.delete_rate = 1; /* Stall after the first removal. */
+
+  test_destroy_and_reopen(t, &options);
+
+  test_make_tables(t, 3, "a", "z");
+  test_compact(t, "a", "z");
+
+  /* The compaction does not wait for its inputs to be removed. */
+  live = test_total_files(t);
+
+  ASSERT(test_count_table_files(t) > live);
+  ASSERT_EQ("end", test_get(t, "z"));
+
+  /* Closing removes the rest without regard to the rate. */
+  test_close(t);
+
+  ASSERT(test_count_table_files(t) == live);
+}
+#endif
+
+/* Data block cache misses of reading back 100 keys after a compaction
+   of the tables they were last read from. */
+static uint64_t
+test_warm_misses(test_t *t, int warm_reads) {
+  ldb_statistics_t *stats = ldb_statistics_create();
+  ldb_dbopt_t options = test_current_options(t);
+  uint64_t misses;
+  char key[16];
+  int i, j;
+
+  options.create_if_missing = 1;
+  options.use_mmap = 0;
+  options.compaction_warm_reads = warm_reads;
+  options.statistics = stats;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (j = 0; j < 2; j++) {
+    for (i = 0; i < 100; i++) {
+      sprintf(key, "key%06d", i);
+
+      ASSERT(test_put(t, key, string_fill(t, 'a' + j, 100)) == LDB_OK);
+    }
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT_EQ(string_fill(t, 'b', 100), test_get(t, key));
+  }
+
+  test_compact(t, "key", "kez");
+
+  ldb_statistics_reset(stats);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT_EQ(string_fill(t, 'b', 100), test_get(t, key));
+  }
+
+  misses = ldb_statistics_get(stats, LDB_BLOCK_CACHE_DATA_MISS);
+
+  test_reopen(t, NULL);
+
+  ldb_statistics_destroy(stats);
+
+  return misses;
+}
+
+static void
+test_db_compaction_warm(test_t *t) {
+  ASSERT(test_warm_misses(t, 1) == 0);
+#ifndef LDB_MEMENV
+  ASSERT(test_warm_misses(t, 0) > 0);
+#endif
+}
+
+/* Data block cache misses of reading back 100 keys right after
+   they are flushed. */
+static uint64_t
+test_prepopulate_misses(test_t *t, int prepopulate) {
+  ldb_statistics_t *stats = ldb_statistics_create();
+  ldb_dbopt_t options = test_current_options(t);
+  uint64_t misses;
+  char key[16];
+  int i;
+
+  options.create_if_missing = 1;
+  options.use_mmap = 0;
+  options.prepopulate_block_cache = prepopulate;
+  options.statistics = stats;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT(test_put(t, key, string_fill(t, 'a', 100)) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  ldb_statistics_reset(stats);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT_EQ(string_fill(t, 'a', 100), test_get(t, key));
+  }
+
+  misses = ldb_statistics_get(stats, LDB_BLOCK_CACHE_DATA_MISS);
+
+  test_reopen(t, NULL);
+
+  ldb_statistics_destroy(stats);
+
+  return misses;
+}
+
+static void
+test_db_prepopulate_block_cache(test_t *t) {
+  ASSERT(test_prepopulate_misses(t, 1) == 0);
+#ifndef LDB_MEMENV
+  ASSERT(test_prepopulate_misses(t, 0) > 0);
+#endif
+}
+
+/* Data block cache misses of reading back 100 keys after a reopen,
+   having read them before closing. */
+static uint64_t
+test_reopen_misses(test_t *t, int dump) {
+  ldb_statistics_t *stats = ldb_statistics_create();
+  ldb_dbopt_t options = test_current_options(t);
+  uint64_t misses;
+  char key[16];
+  int i;
+
+  options.create_if_missing = 1;
+  options.use_mmap = 0;
+  options.block_cache_dump = dump;
+  options.statistics = stats;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT(test_put(t, key, string_fill(t, 'a', 100)) == LDB_OK);
+  }
+
+  ldb_test_compact_memtable(t->db);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT_EQ(string_fill(t, 'a', 100), test_get(t, key));
+  }
+
+  /* The database has a block cache of its own, which starts empty. */
+  test_reopen(t, &options);
+
+  ldb_test_wait_for_warmup(t->db);
+
+  ldb_statistics_reset(stats);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%06d", i);
+
+    ASSERT_EQ(string_fill(t, 'a', 100), test_get(t, key));
+  }
+
+  misses = ldb_statistics_get(stats, LDB_BLOCK_CACHE_DATA_MISS);
+
+  test_reopen(t, NULL);
+
+  ldb_statistics_destroy(stats);
+
+  return misses;
+}
+
+static void
+test_db_block_cache_dump(test_t *t) {
+  ASSERT(test_reopen_misses(t, 1) == 0);
+#ifndef LDB_MEMENV
+  ASSERT(test_reopen_misses(t, 0) > 0);
+#endif
+}
+
+static void
+test_db_set_options(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char value[100];
+  int i;
+
+  options.create_if_missing = 1;
+  options.level0_file_num_compaction_trigger = 100;
+  options.level0_slowdown_writes_trigger = 200;
+  options.level0_stop_writes_trigger = 300;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 8; i++) {
+    sprintf(value, "v%d", i);
+
+    ASSERT(test_put(t, "a", value) == LDB_OK);
+    ASSERT(test_put(t, "z", value) == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  ASSERT(test_files_at_level(t, 0) >= 4);
+
+  /* A lower trigger compacts level-0 without a reopen. */
+  options.level0_file_num_compaction_trigger = 2;
+
+  ldb_set_options(t->db, &options);
+
+  for (i = 0; test_files_at_level(t, 0) >= 2; i++) {
+    ASSERT(i < 1000);
+    ldb_sleep_msec(10);
+  }
+
+  ASSERT_EQ("v7", test_get(t, "a"));
+  ASSERT_EQ("v7", test_get(t, "z"));
+}
+
+static void
+test_db_trace(test_t *t) {
+  static const int ops[] = {
+    LDB_TRACE_PUT,
+    LDB_TRACE_DEL,
+    LDB_TRACE_GET,
+    LDB_TRACE_GET,
+    LDB_TRACE_SEEK,
+    LDB_TRACE_NEXT
+  };
+  ldb_slice_t key = ldb_string("foo");
+  ldb_tracereader_t *reader;
+  char fname[LDB_PATH_MAX];
+  uint64_t last = 0;
+  ldb_tracerec_t rec;
+  ldb_iter_t *iter;
+  int n = 0;
+
+  ASSERT(ldb_test_filename(fname, sizeof(fname), "db_trace"));
+
+  ASSERT(test_put(t, "untraced", "v") == LDB_OK);
+
+  ASSERT(ldb_start_trace(t->db, fname) == LDB_OK);
+  ASSERT(ldb_start_trace(t->db, fname) == LDB_INVALID);
+
+  ASSERT(test_put(t, "foo", "hello") == LDB_OK);
+  ASSERT(test_del(t, "bar") == LDB_OK);
+  ASSERT_EQ("hello", test_get(t, "foo"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "bar"));
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  ldb_iter_seek(iter, &key);
+  ldb_iter_next(iter);
+
+  ASSERT(ldb_end_trace(t->db) == LDB_OK);
+  ASSERT(ldb_end_trace(t->db) == LDB_INVALID);
+
+  ldb_iter_next(iter);
+  ldb_iter_destroy(iter);
+
+  ASSERT(ldb_tracereader_open(fname, &reader) == LDB_OK);
+
+  while (ldb_tracereader_next(reader, &rec)) {
+    ASSERT(n < (int)lengthof(ops));
+    ASSERT(rec.op == ops[n]);
+    ASSERT(rec.micros >= last);
+
+    switch (rec.op) {
+      case LDB_TRACE_PUT:
+      case LDB_TRACE_GET:
+        if (n == 3) {
+          ASSERT(rec.key.size == 3 && rec.value_size == 0);
+        } else {
+          ASSERT(ldb_slice_equal(&rec.key, &key));
+          ASSERT(rec.value_size == 5);
+        }
+        break;
+      case LDB_TRACE_SEEK:
+        ASSERT(ldb_slice_equal(&rec.key, &key));
+        break;
+      case LDB_TRACE_NEXT:
+        ASSERT(rec.key.size == 0);
+        break;
+    }
+
+    last = rec.micros;
+    n++;
+  }
+
+  ASSERT(n == (int)lengthof(ops));
+
+  ldb_tracereader_close(reader);
+
+  ASSERT(ldb_remove_file(fname) == LDB_OK);
+}
+
+static void
+test_db_block_trace(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_tracer_t *tracer = ldb_tracer_create();
+  size_t capacities[2] = {0, 1 << 20};
+  ldb_tracereader_t *reader;
+  char fname[LDB_PATH_MAX];
+  int hits = 0, misses = 0;
+  ldb_tracerec_t rec;
+  FILE *dst;
+  int i;
+
+  ASSERT(ldb_test_filename(fname, sizeof(fname), "db_block_trace"));
+
+  options.block_tracer = tracer;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 100; i++)
+    ASSERT(test_put(t, test_key(t, i), "v") == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(ldb_tracer_start(tracer, fname) == LDB_OK);
+
+  for (i = 0; i < 100; i++)
+    ASSERT_EQ("v", test_get(t, test_key(t, i)));
+
+  ASSERT(ldb_tracer_stop(tracer) == LDB_OK);
+
+  ASSERT(ldb_tracereader_open(fname, &reader) == LDB_OK);
+
+  while (ldb_tracereader_next(reader, &rec)) {
+    ASSERT(rec.op == LDB_TRACE_BLOCK);
+    ASSERT(rec.key.size > 0);
+    ASSERT(rec.value_size > 0);
+    ASSERT(rec.fill);
+#ifdef LDB_TLS
+    ASSERT(rec.caller == LDB_CALLER_GET);
+#endif
+
+    if (rec.block_type != LDB_BLOCK_DATA)
+      continue;
+
+    if (rec.hit)
+      hits++;
+    else
+      misses++;
+  }
+
+  ldb_tracereader_close(reader);
+
+  /* The data block is read once, then found in the cache. */
+  ASSERT(misses == 1);
+  ASSERT(hits == 99);
+
+  dst = tmpfile();
+
+  ASSERT(dst != NULL);
+  ASSERT(ldb_simulate_cache(fname, capacities, 2, LDB_LRU_DEFAULT, dst)
+         == LDB_OK);
+
+  fclose(dst);
+
+  test_close(t);
+
+  ldb_tracer_destroy(tracer);
+
+  ASSERT(ldb_remove_file(fname) == LDB_OK);
+}
+
+static void
+test_db_compactions_generate_multiple_files(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_vector_t values;
+  ldb_rand_t rnd;
+  int i;
+
+  ldb_vector_init(&values);
+  ldb_rand_init(&rnd, 301);
+
+  options.write_buffer_size = 100000000; /* Large write buffer */
+
+  test_reopen(t, &options);
+
+  /* Write 8MB (80 values, each 100K) */
+  ASSERT(test_files_at_level(t, 0) == 0);
+
+  for (i = 0; i < 80; i++) {
+    const char *value = random_string(t, &rnd, 100000);
+
+    ASSERT(test_put(t, test_key(t, i), value) == LDB_OK);
+
+    ldb_vector_push(&values, value);
+  }
+
+  /* Reopening moves updates to level-0 */
+  test_reopen(t, &options);
+
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
+
+  ASSERT(test_files_at_level(t, 0) == 0);
+  ASSERT(test_files_at_level(t, 1) > 1);
+
+  for (i = 0; i < 80; i++)
+    ASSERT_EQ(test_get(t, test_key(t, i)), values.items[i]);
+
+  ldb_vector_clear(&values);
+}
+
+static void
+test_db_repeated_writes_to_same_key(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const char *value;
+  int i, max_files;
+  ldb_rand_t rnd;
+
+  ldb_rand_init(&rnd, 301);
+
+  options.write_buffer_size = 100000; /* Small write buffer */
+
+  test_reopen(t, &options);
+
+  /* We must have at most one file per level except for level-0,
+     which may have up to LDB_L0_STOP_WRITES_TRIGGER files. */
+  max_files = LDB_NUM_LEVELS + LDB_L0_STOP_WRITES_TRIGGER;
+
+  value = random_string(t, &rnd, 2 * options.write_buffer_size);
+
+  for (i = 0; i < 5 * max_files; i++) {
+    test_put(t, "key", value);
+
+    ASSERT(test_total_files(t) <= max_files);
+
+    fprintf(stderr, "after %d: %d files\n", i + 1, test_total_files(t));
+  }
+}
+
+static void
+test_db_sparse_merge(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const char *value;
+  int i;
+
+  options.compression = LDB_NO_COMPRESSION;
+
+  test_reopen(t, &options);
+
+  test_fill_levels(t, "A", "Z");
+
+  /* Suppose there is:
+   *    small amount of data with prefix A
+   *    large amount of data with prefix B
+   *    small amount of data with prefix C
+   * and that recent updates have made small changes to all three prefixes.
+   * Check that we do not do a compaction that merges all of B in one shot.
+   */
+  value = string_fill(t, 'x', 1000);
+
+  test_put(t, "A", "va");
+
+  /* Write approximately 100MB of "B" values */
+  for (i = 0; i < 100000; i++) {
+    char key[100];
+    sprintf(key, "B%010d", i);
+    test_put(t, key, value);
+  }
+
+  test_put(t, "C", "vc");
+
+  ldb_test_compact_memtable(t->db);
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
+
+  /* Make sparse update */
+  test_put(t, "A", "va2");
+  test_put(t, "B100", "bvalue2");
+  test_put(t, "C", "vc2");
+
+  ldb_test_compact_memtable(t->db);
+
+  /* Compactions should not cause us to create a situation where
+     a file overlaps too much data at the next level. */
+  ASSERT(ldb_test_max_next_level_overlapping_bytes(t->db) <= 20 * 1048576);
+
+  ldb_test_compact_range(t->db, 0, NULL, NULL);
+  ASSERT(ldb_test_max_next_level_overlapping_bytes(t->db) <= 20 * 1048576);
+
+  ldb_test_compact_range(t->db, 1, NULL, NULL);
+  ASSERT(ldb_test_max_next_level_overlapping_bytes(t->db) <= 20 * 1048576);
+}
+
+static int
+check_range(uint64_t val, uint64_t low, uint64_t high) {
+  int result = (val >= low) && (val <= high);
+
+  if (!result) {
+    fprintf(stderr, "Value %lu is not in range [%lu, %lu]\n",
+                    (unsigned long)val, (unsigned long)low,
+                                        (unsigned long)high);
+  }
+
+  return result;
+}
+
+#define ASSERT_RANGE(x, y, z) ASSERT(check_range(x, y, z))
+
+static void
+test_db_approximate_sizes(test_t *t) {
+  static const int N = 80;
+  static const int S1 = 100000;
+  static const int S2 = 105000; /* Allow some expansion from metadata */
+  int i, run, compact_start;
+
+  do {
+    ldb_dbopt_t options = test_current_options(t);
+    ldb_rand_t rnd;
+
+    options.write_buffer_size = 100000000; /* Large write buffer */
+    options.compression = LDB_NO_COMPRESSION;
+
+    test_destroy_and_reopen(t, 0);
+
+    ASSERT_RANGE(test_size(t, "", "xyz"), 0, 0);
+
+    test_reopen(t, &options);
+
+    ASSERT_RANGE(test_size(t, "", "xyz"), 0, 0);
+
+    /* Write 8MB (80 values, each 100K) */
+    ASSERT(test_files_at_level(t, 0) == 0);
+
+    ldb_rand_init(&rnd, 301);
+
+    for (i = 0; i < N; i++)
+      ASSERT(test_put(t, test_key(t, i), random_string(t, &rnd, S1)) == LDB_OK);
+
+    /* 0 because approximate_sizes() does not account for memtable space */
+    ASSERT_RANGE(test_size(t, "", test_key(t, 50)), 0, 0);
+
+    if (options.reuse_logs) {
+      /* Recovery will reuse memtable, and approximate_sizes() does not
+         account for memtable usage; */
+      test_reopen(t, &options);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 50)), 0, 0);
+      continue;
+    }
+
+    /* Check sizes across recovery by reopening a few times */
+    for (run = 0; run < 3; run++) {
+      test_reopen(t, &options);
+
+      for (compact_start = 0; compact_start < N; compact_start += 10) {
+        ldb_slice_t cstart = ldb_string(test_key(t, compact_start));
+        ldb_slice_t cend = ldb_string(test_key(t, compact_start + 9));
+
+        for (i = 0; i < N; i += 10) {
+          const char *k1 = test_key(t, i);
+          const char *k2 = test_key2(t, i, ".suffix");
+          const char *k3 = test_key(t, i + 10);
+
+          ASSERT_RANGE(test_size(t, "", k1), S1 * i, S2 * i);
+          ASSERT_RANGE(test_size(t, "", k2), S1 * (i + 1), S2 * (i + 1));
+          ASSERT_RANGE(test_size(t, k1, k3), S1 * 10, S2 * 10);
+        }
+
+        {
+          const char *k1 = test_key(t, 50);
+          const char *k2 = test_key2(t, 50, ".suffix");
+
+          ASSERT_RANGE(test_size(t, "", k1), S1 * 50, S2 * 50);
+          ASSERT_RANGE(test_size(t, "", k2), S1 * 50, S2 * 50);
+        }
+
+        ldb_test_compact_range(t->db, 0, &cstart, &cend);
+      }
+
+      ASSERT(test_files_at_level(t, 0) == 0);
+      ASSERT(test_files_at_level(t, 1) > 0);
+    }
+  } while (test_change_options(t));
+}
+
+static uint64_t
+test_size_ex(test_t *t, const char *start, const char *limit, int flags) {
+  ldb_range_t r;
+  uint64_t size;
+
+  r.start = ldb_string(start);
+  r.limit = ldb_string(limit);
+
+  ldb_approximate_sizes_ex(t->db, &r, 1, flags, &size);
+
+  return size;
+}
+
+static void
+test_db_approximate_sizes_ex(test_t *t) {
+  static const int N = 2000;
+  static const int S1 = 1000;
+  static const int S2 = 1050; /* Allow some expansion from metadata */
+  int i;
+
+  do {
+    ldb_dbopt_t options = test_current_options(t);
+    const char *mid = test_key(t, N / 2);
+    const char *end = test_key(t, N);
+    uint64_t total;
+    ldb_rand_t rnd;
+
+    options.create_if_missing = 1;
+    options.write_buffer_size = 100000000; /* Large write buffer */
+    options.compression = LDB_NO_COMPRESSION;
+
+    test_destroy_and_reopen(t, &options);
+
+    ldb_rand_init(&rnd, 301);
+
+    for (i = 0; i < N; i++)
+      ASSERT(test_put(t, test_key(t, i), random_string(t, &rnd, S1)) == LDB_OK);
+
+    /* Memtables are counted only if asked for. */
+    ASSERT_RANGE(test_size_ex(t, "", end, LDB_SIZE_TABLES), 0, 0);
+    ASSERT_RANGE(test_size_ex(t, "", end, LDB_SIZE_MEMTABLES),
+                 S1 * N, S2 * N);
+    ASSERT_RANGE(test_size_ex(t, "", mid, LDB_SIZE_MEMTABLES),
+                 S1 * N / 4, S2 * N * 3 / 4);
+    ASSERT_RANGE(test_size_ex(t, end, "~", LDB_SIZE_MEMTABLES), 0, 0);
+
+    ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+
+    total = test_size_ex(t, "", end, LDB_SIZE_TABLES);
+
+    ASSERT_RANGE(total, S1 * N, S2 * N);
+    ASSERT_RANGE(test_size_ex(t, "", end, LDB_SIZE_MEMTABLES), 0, 0);
+    ASSERT_RANGE(test_size_ex(t, "", end, LDB_SIZE_TABLES
+                                        | LDB_SIZE_MEMTABLES),
+                 S1 * N, S2 * N);
+
+    /* Judged from file boundaries, the whole file is in the first
+       range, and half of it is assumed to be in the second. */
+    ASSERT(test_size_ex(t, "", "~", LDB_SIZE_FILES_ONLY) >= total);
+    ASSERT(test_size_ex(t, "", "~", LDB_SIZE_FILES_ONLY) <= total * 11 / 10);
+    ASSERT_RANGE(test_size_ex(t, "", mid, LDB_SIZE_FILES_ONLY),
+                 total / 2, total * 11 / 20);
+    ASSERT_RANGE(test_size_ex(t, "~", "~~", LDB_SIZE_FILES_ONLY), 0, 0);
+    ASSERT_RANGE(test_size_ex(t, mid, "", LDB_SIZE_FILES_ONLY), 0, 0);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_split_keys(test_t *t) {
+  static const int N = 4000;
+  ldb_slice_t *keys;
+  size_t i, length;
+  int counts[4];
+  ldb_iter_t *it;
+  ldb_rand_t rnd;
+  int j;
+
+  test_destroy_and_reopen(t, 0);
+
+  ASSERT(ldb_split_keys(t->db, 4, &keys, &length) == LDB_OK);
+  ASSERT(keys == NULL && length == 0);
+
+  ldb_rand_init(&rnd, 301);
+
+  for (j = 0; j < N; j++)
+    ASSERT(test_put(t, test_key(t, j), random_string(t, &rnd, 200)) == LDB_OK);
+
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+
+  ASSERT(ldb_split_keys(t->db, 1, &keys, &length) == LDB_OK);
+  ASSERT(length == 0);
+
+  ASSERT(ldb_split_keys(t->db, 4, &keys, &length) == LDB_OK);
+  ASSERT(length == 3);
+
+  for (i = 1; i < length; i++)
+    ASSERT(ldb_compare(ldb_bytewise_comparator, &keys[i - 1], &keys[i]) < 0);
+
+  /* Every range holds about a quarter of the keys. */
+  memset(counts, 0, sizeof(counts));
+
+  it = ldb_iterator(t->db, 0);
+  i = 0;
+
+  for (ldb_iter_first(it); ldb_iter_valid(it); ldb_iter_next(it)) {
+    ldb_slice_t key = ldb_iter_key(it);
+
+    while (i < length && ldb_compare(ldb_bytewise_comparator,
+                                     &key, &keys[i]) >= 0) {
+      i++;
+    }
+
+    counts[i]++;
+  }
+
+  ASSERT(ldb_iter_status(it) == LDB_OK);
+
+  ldb_iter_destroy(it);
+
+  for (j = 0; j < 4; j++)
+    ASSERT(counts[j] > N / 5 && counts[j] < N * 3 / 10);
+
+  ldb_free(keys);
+}
+
+typedef struct scan_state_s {
+  ldb_atomic(int) entries;
+  ldb_atomic(long) sum; /* Of the key numbers. */
+  int stop_after;
+} scan_state_t;
+
+static int
+scan_count(void *arg, const ldb_slice_t *key, const ldb_slice_t *value) {
+  scan_state_t *state = arg;
+  int n;
+
+  ASSERT(key->size == 9 && memcmp(key->data, "key", 3) == 0);
+  ASSERT(value->size == 100);
+
+  n = ldb_atomic_fetch_add(&state->entries, 1, ldb_order_relaxed);
+
+  ldb_atomic_fetch_add(&state->sum, atoi((const char *)key->data + 3),
+                       ldb_order_relaxed);
+
+  if (state->stop_after > 0 && n + 1 >= state->stop_after)
+    return 7;
+
+  return LDB_OK;
+}
+
+static void
+test_db_parallel_scan(test_t *t) {
+  static const int N = 5000;
+  scan_state_t state;
+  const ldb_snapshot_t *snap;
+  ldb_readopt_t options;
+  ldb_rand_t rnd;
+  int i, threads;
+
+  test_destroy_and_reopen(t, 0);
+
+  ldb_rand_init(&rnd, 301);
+
+  /* Half of the data is in tables, and half in the memtable. */
+  for (i = 0; i < N; i++) {
+    ASSERT(test_put(t, test_key(t, i), random_string(t, &rnd, 100)) == LDB_OK);
+
+    if (i == N / 2)
+      ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  }
+
+  snap = ldb_snapshot(t->db);
+
+  ASSERT(test_put(t, test_key(t, N), random_string(t, &rnd, 100)) == LDB_OK);
+
+  options = *ldb_readopt_default;
+  options.snapshot = snap;
+
+  for (threads = 1; threads <= 4; threads++) {
+    ldb_atomic_init(&state.entries, 0);
+    ldb_atomic_init(&state.sum, 0);
+    state.stop_after = 0;
+
+    ASSERT(ldb_parallel_scan(t->db, &options, threads,
+                             scan_count, &state) == LDB_OK);
+
+    ASSERT(ldb_atomic_load(&state.entries, ldb_order_relaxed) == N);
+    ASSERT(ldb_atomic_load(&state.sum, ldb_order_relaxed)
+           == (long)N * (N - 1) / 2);
+  }
+
+  ldb_release(t->db, snap);
+
+  /* Without options, the latest state is read. */
+  ldb_atomic_init(&state.entries, 0);
+  ldb_atomic_init(&state.sum, 0);
+  state.stop_after = 0;
+
+  ASSERT(ldb_parallel_scan(t->db, 0, 4, scan_count, &state) == LDB_OK);
+  ASSERT(ldb_atomic_load(&state.entries, ldb_order_relaxed) == N + 1);
+
+  /* A callback can stop the scan. */
+  ldb_atomic_init(&state.entries, 0);
+  ldb_atomic_init(&state.sum, 0);
+  state.stop_after = 10;
+
+  ASSERT(ldb_parallel_scan(t->db, 0, 4, scan_count, &state) == 7);
+  ASSERT(ldb_atomic_load(&state.entries, ldb_order_relaxed) < N);
+}
+
+static void
+test_db_approximate_sizes_mix_of_small_and_large(test_t *t) {
+  do {
+    ldb_dbopt_t options = test_current_options(t);
+    const char *big1;
+    ldb_rand_t rnd;
+    int run;
+
+    options.compression = LDB_NO_COMPRESSION;
+
+    test_reopen(t, 0);
+
+    ldb_rand_init(&rnd, 301);
+
+    big1 = random_string(t, &rnd, 100000);
+
+    ASSERT(test_put(t, test_key(t, 0), random_string(t, &rnd, 10000)) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 1), random_string(t, &rnd, 10000)) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 2), big1) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 3), random_string(t, &rnd, 10000)) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 4), big1) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 5), random_string(t, &rnd, 10000)) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 6), random_string(t, &rnd, 300000)) == LDB_OK);
+    ASSERT(test_put(t, test_key(t, 7), random_string(t, &rnd, 10000)) == LDB_OK);
+
+    if (options.reuse_logs) {
+      /* Need to force a memtable compaction since recovery does not do so. */
+      ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+    }
+
+    /* Check sizes across recovery by reopening a few times */
+    for (run = 0; run < 3; run++) {
+      test_reopen(t, &options);
+
+      ASSERT_RANGE(test_size(t, "", test_key(t, 0)), 0, 0);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 1)), 10000, 11000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 2)), 20000, 21000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 3)), 120000, 121000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 4)), 130000, 131000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 5)), 230000, 231000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 6)), 240000, 241000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 7)), 540000, 541000);
+      ASSERT_RANGE(test_size(t, "", test_key(t, 8)), 550000, 560000);
+
+      ASSERT_RANGE(test_size(t, test_key(t, 3), test_key(t, 5)), 110000,
+                                                                 111000);
+
+      ldb_test_compact_range(t->db, 0, NULL, NULL);
+    }
+  } while (test_change_options(t));
+}
+
+static void
+test_db_iterator_pins_ref(test_t *t) {
+  ldb_iter_t *iter;
+  int i;
+
+  test_put(t, "foo", "hello");
+
+  /* Get iterator that will yield the current contents of the DB. */
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  /* Write to force compactions */
+  test_put(t, "foo", "newvalue1");
+
+  for (i = 0; i < 100; i++) {
+    const char *key = test_key(t, i);
+    const char *val = string_fill2(t, key, 'v', 100000);
+
+    ASSERT(test_put(t, key, val) == LDB_OK); /* 100K values */
+  }
+
+  test_put(t, "foo", "newvalue2");
+
+  ldb_iter_first(iter);
+
+  ASSERT(ldb_iter_valid(iter));
+
+  ASSERT_EQ(iter_status(t, iter), "foo->hello");
+
+  ldb_iter_next(iter);
+
+  ASSERT(!ldb_iter_valid(iter));
+
+  ldb_iter_destroy(iter);
+}
+
+static void
+test_db_snapshot(test_t *t) {
+  const ldb_snapshot_t *s1, *s2, *s3;
+
+  do {
+    test_put(t, "foo", "v1");
+
+    s1 = ldb_snapshot(t->db);
+
+    test_put(t, "foo", "v2");
+
+    s2 = ldb_snapshot(t->db);
+
+    test_put(t, "foo", "v3");
+
+    s3 = ldb_snapshot(t->db);
+
+    test_put(t, "foo", "v4");
+
+    ASSERT_EQ("v1", test_get2(t, "foo", s1));
+    ASSERT_EQ("v2", test_get2(t, "foo", s2));
+    ASSERT_EQ("v3", test_get2(t, "foo", s3));
+    ASSERT_EQ("v4", test_get(t, "foo"));
+
+    ldb_release(t->db, s3);
+
+    ASSERT_EQ("v1", test_get2(t, "foo", s1));
+    ASSERT_EQ("v2", test_get2(t, "foo", s2));
+    ASSERT_EQ("v4", test_get(t, "foo"));
+
+    ldb_release(t->db, s1);
+
+    ASSERT_EQ("v2", test_get2(t, "foo", s2));
+    ASSERT_EQ("v4", test_get(t, "foo"));
+
+    ldb_release(t->db, s2);
+
+    ASSERT_EQ("v4", test_get(t, "foo"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_hidden_values_are_removed(test_t *t) {
+  do {
+    const ldb_snapshot_t *snapshot;
+    ldb_slice_t x = ldb_string("x");
+    const char *big;
+    ldb_rand_t rnd;
+    char *expect;
+
+    ldb_rand_init(&rnd, 301);
+
+    test_fill_levels(t, "a", "z");
+
+    big = random_string(t, &rnd, 50000);
+
+    test_put(t, "foo", big);
+    test_put(t, "pastfoo", "v");
+
+    snapshot = ldb_snapshot(t->db);
+
+    test_put(t, "foo", "tiny");
+    test_put(t, "pastfoo2", "v2"); /* Advance sequence number one more */
+
+    ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+    ASSERT(test_files_at_level(t, 0) > 0);
+
+    ASSERT_EQ(big, test_get2(t, "foo", snapshot));
+    ASSERT_RANGE(test_size(t, "", "pastfoo"), 50000, 60000);
+
+    ldb_release(t->db, snapshot);
+
+    expect = ldb_malloc(50100);
+
+    sprintf(expect, "[ tiny, %s ]", big);
+
+    ASSERT_EQ(test_all_entries(t, "foo"), expect);
+
+    ldb_free(expect);
+
+    ldb_test_compact_range(t->db, 0, NULL, &x);
+
+    ASSERT_EQ(test_all_entries(t, "foo"), "[ tiny ]");
+    ASSERT(test_files_at_level(t, 0) == 0);
+    ASSERT(test_files_at_level(t, 1) >= 1);
+
+    ldb_test_compact_range(t->db, 1, NULL, &x);
+
+    ASSERT_EQ(test_all_entries(t, "foo"), "[ tiny ]");
+
+    ASSERT_RANGE(test_size(t, "", "pastfoo"), 0, 1000);
+  } while (test_change_options(t));
+}
+
+static void
+test_db_hidden_values_between_snapshots(test_t *t) {
+  do {
+    const ldb_snapshot_t *s1, *s2;
+
+    /* Keep the compactions below from being trivial moves. */
+    test_fill_levels(t, "a", "z");
+
+    test_put(t, "foo", "v1");
+
+    s1 = ldb_snapshot(t->db);
+
+    test_put(t, "foo", "v2");
+    test_put(t, "foo", "v3");
+
+    s2 = ldb_snapshot(t->db);
+
+    test_put(t, "foo", "v4");
+    test_put(t, "foo", "v5");
+
+    ASSERT_EQ(test_all_entries(t, "foo"), "[ v5, v4, v3, v2, v1 ]");
+
+    /* Only the newest value below each snapshot survives. */
+    ldb_compact(t->db, NULL, NULL);
+
+    ASSERT_EQ(test_all_entries(t, "foo"), "[ v5, v3, v1 ]");
+    ASSERT_EQ("v1", test_get2(t, "foo", s1));
+    ASSERT_EQ("v3", test_get2(t, "foo", s2));
+    ASSERT_EQ("v5", test_get(t, "foo"));
+
+    ldb_release(t->db, s1);
+
+    test_fill_levels(t, "a", "z");
+    ldb_compact(t->db, NULL, NULL);
+
+    ASSERT_EQ(test_all_entries(t, "foo"), "[ v5, v3 ]");
+    ASSERT_EQ("v3", test_get2(t, "foo", s2));
+
+    ldb_release(t->db, s2);
+
+    test_fill_levels(t, "a", "z");
+    ldb_compact(t->db, NULL, NULL);
+
+    ASSERT_EQ(test_all_entries(t, "foo"), "[ v5 ]");
+  } while (test_change_options(t));
+}
+
+static void
+test_db_deletion_markers_1(test_t *t) {
+  const int last = LDB_MAX_MEM_COMPACT_LEVEL;
+  ldb_slice_t z = ldb_string("z");
+
+  test_put(t, "foo", "v1");
+
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_files_at_level(t, last) == 1); /* foo => v1 is now in last level */
+
+  /* Place a table at level last-1 to prevent merging with preceding mutation */
+  test_put(t, "a", "begin");
+  test_put(t, "z", "end");
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_files_at_level(t, last) == 1);
+  ASSERT(test_files_at_level(t, last - 1) == 1);
+
+  test_del(t, "foo");
+  test_put(t, "foo", "v2");
+
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2, DEL, v1 ]");
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK); /* Moves to level last-2 */
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2, DEL, v1 ]");
+
+  ldb_test_compact_range(t->db, last - 2, NULL, &z);
+
+  /* DEL eliminated, but v1 remains because we aren't compacting
+     that level (DEL can be eliminated because v2 hides v1). */
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2, v1 ]");
+  ldb_test_compact_range(t->db, last - 1, NULL, NULL);
+
+  /* Merging last-1 w/ last, so we are the base level
+     for "foo", so DEL is removed. (as is v1). */
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ v2 ]");
+}
+
+static void
+test_db_deletion_markers_2(test_t *t) {
+  const int last = LDB_MAX_MEM_COMPACT_LEVEL;
+
+  test_put(t, "foo", "v1");
+
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_files_at_level(t, last) == 1); /* foo => v1 is now in last level */
+
+  /* Place a table at level last-1 to prevent merging with preceding mutation */
+  test_put(t, "a", "begin");
+  test_put(t, "z", "end");
+
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT(test_files_at_level(t, last) == 1);
+  ASSERT(test_files_at_level(t, last - 1) == 1);
+
+  test_del(t, "foo");
+
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ DEL, v1 ]");
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK); /* Moves to level last-2 */
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ DEL, v1 ]");
+
+  ldb_test_compact_range(t->db, last - 2, NULL, NULL);
+
+  /* DEL kept: "last" file overlaps */
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ DEL, v1 ]");
+  ldb_test_compact_range(t->db, last - 1, NULL, NULL);
+
+  /* Merging last-1 w/ last, so we are the base level
+     for "foo", so DEL is removed. (as is v1). */
+  ASSERT_EQ(test_all_entries(t, "foo"), "[ ]");
+}
+
+static void
+test_db_overlap_in_level0(test_t *t) {
+  do {
+    ASSERT(LDB_MAX_MEM_COMPACT_LEVEL == 2);
+
+    /* Fill levels 1 and 2 to disable the pushing
+       of new memtables to levels > 0. */
+    ASSERT(test_put(t, "100", "v100") == LDB_OK);
+    ASSERT(test_put(t, "999", "v999") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(test_del(t, "100") == LDB_OK);
+    ASSERT(test_del(t, "999") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT_EQ("0,1,1", test_files_per_level(t));
+
+    /* Make files spanning the following ranges in level-0:
+     *
+     *   files[0]  200 .. 900
+     *   files[1]  300 .. 500
+     *
+     * Note that files are sorted by smallest key.
+     */
+    ASSERT(test_put(t, "300", "v300") == LDB_OK);
+    ASSERT(test_put(t, "500", "v500") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT(test_put(t, "200", "v200") == LDB_OK);
+    ASSERT(test_put(t, "600", "v600") == LDB_OK);
+    ASSERT(test_put(t, "900", "v900") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT_EQ("2,1,1", test_files_per_level(t));
+
+    /* Compact away the placeholder files we created initially */
+    ldb_test_compact_range(t->db, 1, NULL, NULL);
+    ldb_test_compact_range(t->db, 2, NULL, NULL);
+
+    ASSERT_EQ("2", test_files_per_level(t));
+
+    /* Do a memtable compaction. Before bug-fix, the compaction
+       would not detect the overlap with level-0 files and would
+       incorrectly place the deletion in a deeper level. */
+    ASSERT(test_del(t, "600") == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT_EQ("3", test_files_per_level(t));
+    ASSERT_EQ("NOT_FOUND", test_get(t, "600"));
+  } while (test_change_options(t));
+}
+
+static void
+test_db_l0_compaction_bug_issue44_a(test_t *t) {
+  test_reopen(t, 0);
+
+  ASSERT(test_put(t, "b", "v") == LDB_OK);
+
+  test_reopen(t, 0);
+
+  ASSERT(test_del(t, "b") == LDB_OK);
+  ASSERT(test_del(t, "a") == LDB_OK);
+
+  test_reopen(t, 0);
+
+  ASSERT(test_del(t, "a") == LDB_OK);
+
+  test_reopen(t, 0);
+
+  ASSERT(test_put(t, "a", "v") == LDB_OK);
+
+  test_reopen(t, 0);
+  test_reopen(t, 0);
+
+  ASSERT_EQ("(a->v)", test_contents(t));
+
+  ldb_sleep_msec(1000); /* Wait for compaction to finish */
+
+  ASSERT_EQ("(a->v)", test_contents(t));
+}
+
+static void
+test_db_l0_compaction_bug_issue44_b(test_t *t) {
+  test_reopen(t, 0);
+  test_put(t, "", "");
+  test_reopen(t, 0);
+  test_del(t, "e");
+  test_put(t, "", "");
+  test_reopen(t, 0);
+  test_put(t, "c", "cv");
+  test_reopen(t, 0);
+  test_put(t, "", "");
+  test_reopen(t, 0);
+  test_put(t, "", "");
+
+  ldb_sleep_msec(1000); /* Wait for compaction to finish */
+
+  test_reopen(t, 0);
+  test_put(t, "d", "dv");
+  test_reopen(t, 0);
+  test_put(t, "", "");
+  test_reopen(t, 0);
+  test_del(t, "d");
+  test_del(t, "b");
+  test_reopen(t, 0);
+
+  ASSERT_EQ("(->)(c->cv)", test_contents(t));
+
+  ldb_sleep_msec(1000); /* Wait for compaction to finish */
+
+  ASSERT_EQ("(->)(c->cv)", test_contents(t));
+}
+
+static void
+test_db_fflush_issue474(test_t *t) {
+  static const int num = 100000;
+  ldb_rand_t rnd;
+  int i;
+
+  ldb_rand_init(&rnd, ldb_random_seed());
+
+  for (i = 0; i < num; i++) {
+    const char *key = random_key(t, &rnd);
+    const char *val = random_string(t, &rnd, 100);
+
+    fflush(NULL);
+
+    ASSERT(test_put(t, key, val) == LDB_OK);
+  }
+}
+
+static void
+test_db_comparator_check(test_t *t) {
+  ldb_comparator_t comparator = *ldb_bytewise_comparator;
+  ldb_dbopt_t options = test_current_options(t);
+
+  comparator.name = "leveldb.NewComparator";
+
+  options.comparator = &comparator;
+
+  ASSERT(test_try_reopen(t, &options) != LDB_OK);
+}
+
+static int
+test_to_number(const ldb_slice_t *x) {
+  /* Check that there are no extra characters. */
+  char xp[100];
+  char ignored;
+  int val;
+
+  ASSERT(x->size < sizeof(xp));
+  ASSERT(x->size >= 2 && x->data[0] == '[' && x->data[x->size - 1] == ']');
+
+  memcpy(xp, x->data, x->size);
+
+  xp[x->size] = '\0';
+
+  ASSERT(sscanf(xp, "[%i]%c", &val, &ignored) == 1);
+
+  return val;
+}
+
+static int
+slice_compare(const ldb_comparator_t *comparator,
+              const ldb_slice_t *x,
+              const ldb_slice_t *y) {
+  (void)comparator;
+  return test_to_number(x) - test_to_number(y);
+}
+
+static void
+shortest_separator(const ldb_comparator_t *comparator,
+                   ldb_buffer_t *start,
+                   const ldb_slice_t *limit) {
+  (void)comparator;
+  test_to_number(start); /* Check format */
+  test_to_number(limit); /* Check format */
+}
+
+static void
+short_successor(const ldb_comparator_t *comparator, ldb_buffer_t *key) {
+  (void)comparator;
+  test_to_number(key); /* Check format */
+}
+
+static void
+test_db_custom_comparator(test_t *t) {
+  static const ldb_comparator_t comparator = {
+    /* .name = */ "test.NumberComparator",
+    /* .compare = */ slice_compare,
+    /* .shortest_separator = */ shortest_separator,
+    /* .short_successor = */ short_successor,
+    /* .user_comparator = */ NULL,
+    /* .state = */ NULL
+  };
+
+  ldb_dbopt_t options = test_current_options(t);
+  int i, run;
+
+  options.create_if_missing = 1;
+  options.comparator = &comparator;
+  options.filter_policy = NULL;     /* Cannot use bloom filters */
+  options.write_buffer_size = 1000; /* Compact more often */
+
+  test_destroy_and_reopen(t, &options);
+
+  ASSERT(test_put(t, "[10]", "ten") == LDB_OK);
+  ASSERT(test_put(t, "[0x14]", "twenty") == LDB_OK);
+
+  for (i = 0; i < 2; i++) {
+    ASSERT_EQ("ten", test_get(t, "[10]"));
+    ASSERT_EQ("ten", test_get(t, "[0xa]"));
+    ASSERT_EQ("twenty", test_get(t, "[20]"));
+    ASSERT_EQ("twenty", test_get(t, "[0x14]"));
+    ASSERT_EQ("NOT_FOUND", test_get(t, "[15]"));
+    ASSERT_EQ("NOT_FOUND", test_get(t, "[0xf]"));
+
+    test_compact(t, "[0]", "[9999]");
+  }
+
+  for (run = 0; run < 2; run++) {
+    for (i = 0; i < 1000; i++) {
+      char buf[100];
+      sprintf(buf, "[%d]", i * 10);
+      ASSERT(test_put(t, buf, buf) == LDB_OK);
+    }
+
+    test_compact(t, "[0]", "[1000000]");
+  }
+}
+
+static const char *
+test_family_get(test_t *t, int family, const char *k) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val;
+  char *zp;
+  int rc;
+
+  rc = ldb_family_get(t->db, family, &key, &val, ldb_readopt_default);
+
+  if (rc == LDB_NOTFOUND)
+    return "NOT_FOUND";
+
+  if (rc != LDB_OK)
+    return ldb_strerror(rc);
+
+  zp = ldb_malloc(val.size + 1);
+
+  memcpy(zp, val.data, val.size);
+
+  zp[val.size] = '\0';
+
+  ldb_free(val.data);
+
+  ldb_vector_push(&t->arena, zp);
+
+  return zp;
+}
+
+static const char *
+test_family_contents(test_t *t, int family) {
+  ldb_iter_t *iter = ldb_family_iterator(t->db, family, ldb_readopt_default);
+  ldb_buffer_t result;
+
+  ldb_buffer_init(&result);
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+
+    ldb_buffer_concat(&result, &key);
+    ldb_buffer_push(&result, '=');
+    ldb_buffer_concat(&result, &val);
+    ldb_buffer_push(&result, ' ');
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+  ldb_iter_destroy(iter);
+
+  ldb_buffer_push(&result, '\0');
+  ldb_vector_push(&t->arena, result.data);
+
+  return (char *)result.data;
+}
+
+static void
+test_db_families(test_t *t) {
+  static const ldb_comparator_t numbers = {
+    /* .name = */ "test.NumberComparator",
+    /* .compare = */ slice_compare,
+    /* .shortest_separator = */ shortest_separator,
+    /* .short_successor = */ short_successor,
+    /* .user_comparator = */ NULL,
+    /* .state = */ NULL
+  };
+
+  const ldb_comparator_t *comparators[2] = { NULL, &numbers };
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_comparator_t *cmp = ldb_family_comparator(comparators, 2);
+  ldb_slice_t key, val;
+  ldb_batch_t batch;
+  int i;
+
+  options.create_if_missing = 1;
+  options.comparator = cmp;
+  options.filter_policy = NULL; /* Numbers have several spellings. */
+
+  test_destroy_and_reopen(t, &options);
+
+  /* One batch spans both families. */
+  ldb_batch_init(&batch);
+
+  key = ldb_string("a");
+  val = ldb_string("1");
+  ldb_batch_family_put(&batch, 0, &key, &val);
+
+  key = ldb_string("[10]");
+  val = ldb_string("ten");
+  ldb_batch_family_put(&batch, 1, &key, &val);
+
+  key = ldb_string("[2]");
+  val = ldb_string("two");
+  ldb_batch_family_put(&batch, 1, &key, &val);
+
+  key = ldb_string("[10]");
+  val = ldb_string("other");
+  ldb_batch_family_put(&batch, 2, &key, &val);
+
+  ASSERT(ldb_write(t->db, &batch, NULL) == LDB_OK);
+
+  ldb_batch_clear(&batch);
+
+  key = ldb_string("b");
+  val = ldb_string("2");
+
+  ASSERT(ldb_family_put(t->db, 0, &key, &val, NULL) == LDB_OK);
+  ASSERT(ldb_family_del(t->db, 0, &key, NULL) == LDB_OK);
+  ASSERT(ldb_family_put(t->db, 256, &key, &val, NULL) == LDB_INVALID);
+
+  for (i = 0; i < 2; i++) {
+    ASSERT_EQ("1", test_family_get(t, 0, "a"));
+    ASSERT_EQ("NOT_FOUND", test_family_get(t, 0, "b"));
+    ASSERT_EQ("NOT_FOUND", test_family_get(t, 0, "[10]"));
+    ASSERT_EQ("ten", test_family_get(t, 1, "[0xa]"));
+    ASSERT_EQ("NOT_FOUND", test_family_get(t, 2, "[0xa]"));
+    ASSERT_EQ("other", test_family_get(t, 2, "[10]"));
+
+    /* Family 1 is ordered numerically, family 2 bytewise. */
+    ASSERT_EQ("a=1 ", test_family_contents(t, 0));
+    ASSERT_EQ("[2]=two [10]=ten ", test_family_contents(t, 1));
+    ASSERT_EQ("[10]=other ", test_family_contents(t, 2));
+    ASSERT_EQ("", test_family_contents(t, 3));
+
+    ldb_test_compact_memtable(t->db);
+
+    test_reopen(t, &options);
+  }
+
+  test_close(t);
+
+  ldb_family_comparator_destroy(cmp);
+}
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+static void
+test_db_parallel_compactions(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char vbuf[200];
+  ldb_rand_t rnd;
+  int i, round;
+
+  ldb_rand_init(&rnd, 301);
+
+  options.write_buffer_size = 64 << 10;
+  options.max_file_size = 64 << 10;
+  options.create_if_missing = 1;
+  options.max_background_compactions = 4;
+
+  test_destroy_and_reopen(t, &options);
+
+  /* Overwrite every key several times to force
+     compactions at multiple levels. */
+  for (round = 0; round < 4; round++) {
+    for (i = 0; i < 4000; i++) {
+      int k = (i * 7919) % 4000;
+
+      sprintf(vbuf, "%d.%d.%-100d", k, round, (int)ldb_rand_next(&rnd));
+
+      ASSERT(test_put(t, test_key(t, k), vbuf) == LDB_OK);
+    }
+
+    test_reset(t);
+  }
+
+  for (i = 0; i < 4000; i++) {
+    const char *val = test_get(t, test_key(t, i));
+    int k, r;
+
+    ASSERT(2 == sscanf(val, "%d.%d.", &k, &r));
+    ASSERT(k == i);
+    ASSERT(r == 3);
+  }
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 4000; i++) {
+    const char *val = test_get(t, test_key(t, i));
+    int k, r;
+
+    ASSERT(2 == sscanf(val, "%d.%d.", &k, &r));
+    ASSERT(k == i);
+    ASSERT(r == 3);
+  }
+}
+#endif
+
+static void
+test_db_subcompactions(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  int expect[1000];
+  char vbuf[100];
+  int i, j;
+
+  options.write_buffer_size = 64 << 10;
+  options.create_if_missing = 1;
+  options.max_subcompactions = 4;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 1000; i++)
+    expect[i] = -1;
+
+  /* Create several level-0 files with staggered key ranges
+     containing overwrites and deletions of the same keys. */
+  for (j = 0; j < 4; j++) {
+    for (i = j * 150; i < j * 150 + 550; i++) {
+      if (i % 7 == j) {
+        ASSERT(test_del(t, test_key(t, i)) == LDB_OK);
+        expect[i] = -1;
+      } else {
+        sprintf(vbuf, "%d.%d", i, j);
+        ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+        expect[i] = j;
+      }
+    }
+
+    ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  }
+
+  ASSERT(test_files_at_level(t, 0) > 1);
+
+  ldb_compact(t->db, NULL, NULL);
+
+  ASSERT(test_files_at_level(t, 0) == 0);
+
+  for (i = 0; i < 1000; i++) {
+    const char *val = test_get(t, test_key(t, i));
+
+    if (expect[i] < 0) {
+      ASSERT_EQ(val, "NOT_FOUND");
+    } else {
+      sprintf(vbuf, "%d.%d", i, expect[i]);
+      ASSERT_EQ(val, vbuf);
+    }
+
+    test_reset(t);
+  }
+
+  sprintf(vbuf, "[ %d.3 ]", 460);
+
+  ASSERT_EQ(test_all_entries(t, test_key(t, 460)), vbuf);
+}
+
+static void
+test_db_compressed_block_cache(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_lru_t *cache = ldb_lru_create(0);
+  ldb_lru_t *compressed = ldb_lru_create(1 << 20);
+  char vbuf[200];
+  int i, pass;
+
+  options.create_if_missing = 1;
+  options.compression = LDB_SNAPPY_COMPRESSION;
+  options.block_cache = cache;
+  options.block_cache_compressed = compressed;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(vbuf, "%0150d", i);
+    ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+  }
+
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(ldb_lru_usage(compressed) == 0);
+
+  /* The second pass is served from the compressed cache. */
+  for (pass = 0; pass < 2; pass++) {
+    for (i = 0; i < 1000; i++) {
+      sprintf(vbuf, "%0150d", i);
+      ASSERT_EQ(vbuf, test_get(t, test_key(t, i)));
+      test_reset(t);
+    }
+
+    ASSERT(ldb_lru_usage(compressed) > 0);
+    ASSERT(ldb_lru_usage(compressed) < 1000 * 150 / 2);
+  }
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ldb_lru_destroy(cache);
+  ldb_lru_destroy(compressed);
+}
+
+static void
+test_db_persistent_cache(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_lru_t *cache = ldb_lru_create(0);
+  char path[LDB_PATH_MAX];
+  uint64_t capacity;
+  ldb_pcache_t *pc;
+  char vbuf[200];
+  int i, pass;
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "pcache_test"));
+
+  for (capacity = 1 << 20; capacity >= (16 << 10); capacity >>= 6) {
+    ASSERT(ldb_pcache_open(path, capacity, &pc) == LDB_OK);
+
+    options.create_if_missing = 1;
+    options.block_cache = cache;
+    options.use_mmap = 0;
+    options.persistent_cache = pc;
+
+    test_destroy_and_reopen(t, &options);
+
+    for (i = 0; i < 1000; i++) {
+      sprintf(vbuf, "%0150d", i);
+      ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+    }
+
+    ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+    ASSERT(ldb_pcache_usage(pc) == 0);
+
+    for (pass = 0; pass < 2; pass++) {
+      for (i = 0; i < 1000; i++) {
+        sprintf(vbuf, "%0150d", i);
+        ASSERT_EQ(vbuf, test_get(t, test_key(t, i)));
+        test_reset(t);
+      }
+
+      ASSERT(ldb_pcache_usage(pc) > 0);
+      ASSERT(ldb_pcache_usage(pc) <= capacity);
+    }
+
+    /* The second pass is served from the persistent cache, as far as
+       it holds the table. */
+    if (capacity >= (1 << 20))
+      ASSERT(ldb_pcache_hits(pc) >= 1000);
+    else
+      ASSERT(ldb_pcache_hits(pc) > 0);
+
+    ldb_close(t->db);
+    t->db = NULL;
+
+    ldb_pcache_close(pc);
+  }
+
+  ldb_remove_dir(path);
+  ldb_lru_destroy(cache);
+}
+
+static int
+test_count_tables(const char *dir) {
+  ldb_filetype_t type;
+  uint64_t number;
+  char **files;
+  int i, len;
+  int count = 0;
+
+  len = ldb_get_children(dir, &files);
+
+  for (i = 0; i < len; i++) {
+    if (ldb_parse_filename(&type, &number, files[i]) &&
+        type == LDB_FILE_TABLE) {
+      count++;
+    }
+  }
+
+  if (len >= 0)
+    ldb_free_children(files, len);
+
+  return count;
+}
+
+static void
+test_db_paths(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char path[LDB_PATH_MAX];
+  ldb_dbpath_t paths[2];
+  char vbuf[200];
+  int i, level;
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "db_paths_test"));
+
+  /* Levels 0 and 1 fit in the database directory. */
+  paths[0].path = t->dbname;
+  paths[0].target_size = 2 * (64 << 10);
+  paths[1].path = path;
+  paths[1].target_size = 0;
+
+  options.create_if_missing = 1;
+  options.max_bytes_for_level_base = 64 << 10;
+  options.db_paths = paths;
+  options.num_db_paths = 2;
+
+  test_destroy_and_reopen(t, &options);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(vbuf, "%0150d", i);
+    ASSERT(test_put(t, test_key(t, i), vbuf) == LDB_OK);
+  }
+
+  /* Flushes go to the path for level-0. */
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_count_tables(t->dbname) > 0);
+  ASSERT(test_count_tables(path) == 0);
+
+  /* Level-3 is past the first path. Moving the table down
+     rewrites it there. */
+  for (level = 0; level < 3; level++)
+    ldb_test_compact_range(t->db, level, NULL, NULL);
+
+  ASSERT_EQ("0,0,0,1", test_files_per_level(t));
+  ASSERT(test_count_tables(t->dbname) == 0);
+  ASSERT(test_count_tables(path) == 1);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(vbuf, "%0150d", i);
+    ASSERT_EQ(vbuf, test_get(t, test_key(t, i)));
+  }
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 1000; i++) {
+    sprintf(vbuf, "%0150d", i);
+    ASSERT_EQ(vbuf, test_get(t, test_key(t, i)));
+  }
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ASSERT(ldb_destroy(t->dbname, &options) == LDB_OK);
+  ASSERT(test_count_tables(path) == 0);
+
+  ldb_remove_dir(path);
+}
+
+static void
+test_db_wal_block_size(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  const char *big;
+  ldb_rand_t rnd;
+  int i;
+
+  ldb_rand_init(&rnd, 301);
+
+  options.create_if_missing = 1;
+  options.wal_block_size = 1 << 20;
+
+  test_destroy_and_reopen(t, &options);
+
+  big = random_string(t, &rnd, 200000);
+
+  for (i = 0; i < 10; i++)
+    ASSERT(test_put(t, test_key(t, i), big) == LDB_OK);
+
+  /* The log is read with the size the database was created with. */
+  options.wal_block_size = 32768;
+
+  for (i = 0; i < 2; i++) {
+    test_reopen(t, &options);
+
+    ASSERT(test_put(t, "foo", i ? "v2" : "v1") == LDB_OK);
+    ASSERT_EQ(big, test_get(t, test_key(t, 9)));
+  }
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("v2", test_get(t, "foo"));
+  ASSERT_EQ(big, test_get(t, test_key(t, 0)));
+}
+
+static void
+test_db_cache_index_and_filter_blocks(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_lru_t *cache = ldb_lru_create(1 << 20);
+
+  options.create_if_missing = 1;
+  options.block_cache = cache;
+  options.filter_policy = t->policy;
+  options.use_mmap = 0;
+  options.cache_index_and_filter_blocks = 1;
+
+  test_destroy_and_reopen(t, &options);
+
+  test_make_tables(t, 3, "p", "q");
+  ASSERT_EQ("1,1,1", test_files_per_level(t));
+
+  ASSERT_EQ("begin", test_get(t, "p"));
+  ASSERT_EQ("end", test_get(t, "q"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "pp"));
+  test_reset(t);
+
+  /* Nothing is held outside of the cache. */
+  ldb_lru_prune(cache);
+  ASSERT(ldb_lru_usage(cache) == 0);
+
+  ASSERT_EQ("begin", test_get(t, "p"));
+  ASSERT_EQ("end", test_get(t, "q"));
+  test_reset(t);
+
+  /* Level-0 metadata survives pruning once pinned. */
+  options.pin_l0_filter_and_index_blocks = 1;
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("1,1,1", test_files_per_level(t));
+  ASSERT_EQ("begin", test_get(t, "p"));
+  test_reset(t);
+
+  ldb_lru_prune(cache);
+#ifndef LDB_MEMENV
+  ASSERT(ldb_lru_usage(cache) > 0);
+#endif
+
+  ASSERT_EQ("end", test_get(t, "q"));
+  test_reset(t);
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ldb_lru_prune(cache);
+  ASSERT(ldb_lru_usage(cache) == 0);
+
+  ldb_lru_destroy(cache);
+}
+
+static void
+test_db_preload_tables(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_lru_t *cache = ldb_lru_create(1 << 20);
+
+  options.create_if_missing = 1;
+  options.block_cache = cache;
+  options.filter_policy = t->policy;
+  options.use_mmap = 0;
+  options.cache_index_and_filter_blocks = 1;
+
+  test_destroy_and_reopen(t, &options);
+
+  test_make_tables(t, 3, "p", "q");
+  ASSERT_EQ("1,1,1", test_files_per_level(t));
+
+  /* Tables are opened on open, but lazily: nothing is cached yet. */
+  options.max_file_opening_threads = 2;
+  options.lazy_table_open = 1;
+
+  test_reopen(t, &options);
+
+  ldb_lru_prune(cache);
+  ASSERT(ldb_lru_usage(cache) == 0);
+
+  ASSERT_EQ("begin", test_get(t, "p"));
+  ASSERT_EQ("end", test_get(t, "q"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "pp"));
+  test_reset(t);
+
+#ifndef LDB_MEMENV
+  ASSERT(ldb_lru_usage(cache) > 0);
+#endif
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ldb_lru_destroy(cache);
+}
+
+static void
+test_db_table_cache_eviction(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char key[20];
+  int i, pass;
+
+  /* Room for 64 open tables. */
+  options.max_open_files = 0;
+  options.level0_file_num_compaction_trigger = 1000;
+  options.level0_slowdown_writes_trigger = 1000;
+  options.level0_stop_writes_trigger = 1001;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%03d", i);
+
+    ASSERT(test_put(t, key, key) == LDB_OK);
+
+    ldb_test_compact_memtable(t->db);
+  }
+
+  ASSERT(test_total_files(t) == 100);
+
+  /* Every pass evicts tables the previous one opened. */
+  for (pass = 0; pass < 3; pass++) {
+    for (i = 0; i < 100; i++) {
+      sprintf(key, "key%03d", pass == 1 ? 99 - i : i);
+
+      ASSERT_EQ(key, test_get(t, key));
+    }
+
+    test_reset(t);
+  }
+}
+
+static void
+test_db_keep_tables_open(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  char key[20];
+  int i;
+
+  options.max_open_files = -1;
+
+  test_reopen(t, &options);
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%03d", i);
+
+    ASSERT(test_put(t, key, key) == LDB_OK);
+
+    if (i % 10 == 9)
+      ldb_test_compact_memtable(t->db);
+  }
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%03d", i);
+    ASSERT_EQ(key, test_get(t, key));
+  }
+
+  test_reset(t);
+
+  /* The kept tables are closed once compacted away. */
+  test_compact(t, "a", "z");
+
+  for (i = 0; i < 100; i++) {
+    sprintf(key, "key%03d", i);
+    ASSERT_EQ(key, test_get(t, key));
+  }
+
+  test_reset(t);
+
+  test_reopen(t, &options);
+
+  ASSERT_EQ("key042", test_get(t, "key042"));
+}
+
+static void
+test_db_manual_compaction(test_t *t) {
+  ASSERT(LDB_MAX_MEM_COMPACT_LEVEL == 2);
+
+  test_make_tables(t, 3, "p", "q");
+  ASSERT_EQ("1,1,1", test_files_per_level(t));
+
+  /* Compaction range falls before files */
+  test_compact(t, "", "c");
+  ASSERT_EQ("1,1,1", test_files_per_level(t));
+
+  /* Compaction range falls after files */
+  test_compact(t, "r", "z");
+  ASSERT_EQ("1,1,1", test_files_per_level(t));
+
+  /* Compaction range overlaps files */
+  test_compact(t, "p1", "p9");
+  ASSERT_EQ("0,0,1", test_files_per_level(t));
+
+  /* Populate a different range */
+  test_make_tables(t, 3, "c", "e");
+  ASSERT_EQ("1,1,2", test_files_per_level(t));
+
+  /* Compact just the new range */
+  test_compact(t, "b", "f");
+  ASSERT_EQ("0,0,2", test_files_per_level(t));
+
+  /* Compact all */
+  test_make_tables(t, 1, "a", "z");
+  ASSERT_EQ("0,1,2", test_files_per_level(t));
+
+  ldb_compact(t->db, NULL, NULL);
+  ASSERT_EQ("0,0,1", test_files_per_level(t));
+}
+
+static void
+test_db_open_options(test_t *t) {
+  ldb_dbopt_t opts = *ldb_dbopt_default;
+  char dbname[LDB_PATH_MAX];
+  ldb_t *db = NULL;
+
+  (void)t;
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_options_test"));
+
+  ldb_destroy(dbname, NULL);
+
+  /* Does not exist, and create_if_missing == 0: error */
+  opts.create_if_missing = 0;
+
+  ASSERT(ldb_open(dbname, &opts, &db) == LDB_INVALID);
+  ASSERT(db == NULL);
+
+  /* Does not exist, and create_if_missing == 1: OK */
+  opts.create_if_missing = 1;
+
+  ASSERT(ldb_open(dbname, &opts, &db) == LDB_OK);
+  ASSERT(db != NULL);
+
+  ldb_close(db);
+  db = NULL;
+
+  /* Does exist, and error_if_exists == 1: error */
+  opts.create_if_missing = 0;
+  opts.error_if_exists = 1;
+
+  ASSERT(ldb_open(dbname, &opts, &db) == LDB_INVALID);
+  ASSERT(db == NULL);
+
+  /* Does exist, and error_if_exists == 0: OK */
+  opts.create_if_missing = 1;
+  opts.error_if_exists = 0;
+
+  ASSERT(ldb_open(dbname, &opts, &db) == LDB_OK);
+  ASSERT(db != NULL);
+
+  ldb_close(db);
+
+  ldb_destroy(dbname, NULL);
+}
+
+static void
+test_db_destroy_empty_dir(test_t *t) {
+  ldb_dbopt_t opts = *ldb_dbopt_default;
+  char dbname[LDB_PATH_MAX];
+  char **names;
+  int len;
+
+  (void)t;
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_empty_dir"));
+
+  ldb_remove_dir(dbname);
+
+  ASSERT(!ldb_file_exists(dbname));
+  ASSERT(ldb_create_dir(dbname) == LDB_OK);
+#ifndef LDB_MEMENV
+  ASSERT(ldb_file_exists(dbname));
+#endif
+  ASSERT((len = ldb_get_children(dbname, &names)) >= 0);
+  ASSERT(0 == len);
+  ASSERT(ldb_destroy(dbname, &opts) == LDB_OK);
+  ASSERT(!ldb_file_exists(dbname));
+
+  ldb_free_children(names, len);
+}
+
+static void
+test_db_destroy_open_db(test_t *t) {
+  ldb_dbopt_t opts = *ldb_dbopt_default;
+  char dbname[LDB_PATH_MAX];
+  ldb_t *db = NULL;
+
+  (void)t;
+
+  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "open_db_dir"));
+
+  /* ldb_remove_dir(dbname); */
+  ldb_destroy(dbname, NULL);
+
+  ASSERT(!ldb_file_exists(dbname));
+
+  opts.create_if_missing = 1;
+
+  ASSERT(ldb_open(dbname, &opts, &db) == LDB_OK);
+  ASSERT(db != NULL);
+
+  /* Must fail to destroy an open db. */
+#ifndef LDB_MEMENV
+  ASSERT(ldb_file_exists(dbname));
+#endif
+  ASSERT(ldb_destroy(dbname, NULL) != LDB_OK);
+#ifndef LDB_MEMENV
+  ASSERT(ldb_file_exists(dbname));
+#endif
+
+  ldb_close(db);
+
+  /* Should succeed destroying a closed db. */
+  ASSERT(ldb_destroy(dbname, NULL) == LDB_OK);
+  ASSERT(!ldb_file_exists(dbname));
+}
+
+static void
+test_db_locking(test_t *t) {
+  ldb_dbopt_t opt = test_current_options(t);
+  ldb_t *db = NULL;
+
+  ASSERT(ldb_open(t->dbname, &opt, &db) != LDB_OK);
+}
+
+#ifndef NDEBUG
+/* Check that number of files does not grow when we are out of space */
+static void
+test_db_no_space(test_t *t) {
+  struct ldb_env_state_s *state = &ldb_env_state;
+  ldb_dbopt_t options = test_current_options(t);
+  int i, level, num_files;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+  ASSERT_EQ("v1", test_get(t, "foo"));
+
+  test_compact(t, "a", "z");
+
+  num_files = test_count_files(t);
+
+  /* Force out-of-space errors. */
+  ldb_atomic_store(&state->no_space, 1, ldb_order_release);
+
+  for (i = 0; i < 10; i++) {
+    for (level = 0; level < LDB_NUM_LEVELS - 1; level++)
+      ldb_test_compact_range(t->db, level, NULL, NULL);
+  }
+
+  ldb_atomic_store(&state->no_space, 0, ldb_order_release);
+
+  ASSERT(test_count_files(t) < num_files + 3);
+}
+
+static void
+test_db_non_writable_filesystem(test_t *t) {
+  struct ldb_env_state_s *state = &ldb_env_state;
+  ldb_dbopt_t options = test_current_options(t);
+  const char *big;
+  int i, errors;
+
+  options.write_buffer_size = 1000;
+
+  test_reopen(t, &options);
+
+  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+
+  /* Force errors for new files. */
+  ldb_atomic_store(&state->non_writable, 1, ldb_order_release);
+
+  big = string_fill(t, 'x', 100000);
+  errors = 0;
+
+  for (i = 0; i < 20; i++) {
+    fprintf(stderr, "iter %d; errors %d\n", i, errors);
+
+    if (test_put(t, "foo", big) != LDB_OK) {
+      errors++;
+      ldb_sleep_msec(100);
+    }
+  }
+
+  ASSERT(errors > 0);
+
+  ldb_atomic_store(&state->non_writable, 0, ldb_order_release);
+}
+
+static void
+test_db_write_sync_error(test_t *t) {
+  /* Check that log sync errors cause the DB to disallow future writes. */
+  struct ldb_env_state_s *state = &ldb_env_state;
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_writeopt_t w = *ldb_writeopt_default;
+  ldb_slice_t k1 = ldb_string("k1");
+  ldb_slice_t k2 = ldb_string("k2");
+  ldb_slice_t k3 = ldb_string("k3");
+  ldb_slice_t v1 = ldb_string("v1");
+  ldb_slice_t v2 = ldb_string("v2");
+  ldb_slice_t v3 = ldb_string("v3");
+
+  /* (a) Cause log sync calls to fail */
+  test_reopen(t, &options);
+  ldb_atomic_store(&state->data_sync_error, 1, ldb_order_release);
+
+  /* (b) Normal write should succeed */
+  w.sync = 0;
+
+  ASSERT(ldb_put(t->db, &k1, &v1, &w) == LDB_OK);
+  ASSERT_EQ("v1", test_get(t, "k1"));
+
+  /* (c) Do a sync write; should fail */
+  w.sync = 1;
+
+  ASSERT(ldb_put(t->db, &k2, &v2, &w) != LDB_OK);
+  ASSERT_EQ("v1", test_get(t, "k1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "k2"));
+
+  /* (d) make sync behave normally */
+  ldb_atomic_store(&state->data_sync_error, 0, ldb_order_release);
+
+  /* (e) Do a non-sync write; should fail */
+  w.sync = 0;
+
+  ASSERT(ldb_put(t->db, &k3, &v3, &w) != LDB_OK);
+  ASSERT_EQ("v1", test_get(t, "k1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "k2"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "k3"));
+}
+
+static void
+test_db_manifest_write_error(test_t *t) {
+  /* Test for the following problem:
+   *
+   *   (a) Compaction produces file F
+   *   (b) Log record containing F is written to MANIFEST file, but sync() fails
+   *   (c) GC deletes F
+   *   (d) After reopening DB, reads fail since deleted F is named in log record
+   */
+  struct ldb_env_state_s *state = &ldb_env_state;
+  const int last = LDB_MAX_MEM_COMPACT_LEVEL;
+  int iter;
+
+  /* We iterate twice. In the second iteration, everything is the
+     same except the log record never makes it to the MANIFEST file. */
+  for (iter = 0; iter < 2; iter++) {
+    ldb_atomic(int) *error_type = (iter == 0) ? &state->manifest_sync_error
+                                              : &state->manifest_write_error;
+
+    /* Insert foo=>bar mapping */
+    ldb_dbopt_t options = test_current_options(t);
+
+    options.create_if_missing = 1;
+    options.error_if_exists = 0;
+
+    test_destroy_and_reopen(t, &options);
+
+    ASSERT(test_put(t, "foo", "bar") == LDB_OK);
+    ASSERT_EQ("bar", test_get(t, "foo"));
+
+    /* Memtable compaction (will succeed) */
+    ldb_test_compact_memtable(t->db);
+
+    ASSERT_EQ("bar", test_get(t, "foo"));
+    ASSERT(test_files_at_level(t, last) == 1); /* foo=>bar is now in last level */
+
+    /* Merging compaction (will fail) */
+    ldb_atomic_store(error_type, 1, ldb_order_release);
+    ldb_test_compact_range(t->db, last, NULL, NULL); /* Should fail */
+
+    ASSERT_EQ("bar", test_get(t, "foo"));
+
+    /* Recovery: should not lose data */
+    ldb_atomic_store(error_type, 0, ldb_order_release);
+    test_reopen(t, &options);
+
+    ASSERT_EQ("bar", test_get(t, "foo"));
+  }
+}
+#endif /* !NDEBUG */
+
+static void
+test_db_missing_sst_file(test_t *t) {
+  ldb_dbopt_t options;
+
+  ASSERT(test_put(t, "foo", "bar") == LDB_OK);
+  ASSERT_EQ("bar", test_get(t, "foo"));
+
+  /* Dump the memtable to disk. */
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("bar", test_get(t, "foo"));
+
+  test_close(t);
+
+  ASSERT(test_delete_an_sst_file(t));
+
+  options = test_current_options(t);
+  options.paranoid_checks = 1;
+
+  ASSERT(test_try_reopen(t, &options) != LDB_OK);
+}
+
+static void
+test_db_still_read_sst(test_t *t) {
+  ldb_dbopt_t options;
+
+  ASSERT(test_put(t, "foo", "bar") == LDB_OK);
+  ASSERT_EQ("bar", test_get(t, "foo"));
+
+  /* Dump the memtable to disk. */
+  ldb_test_compact_memtable(t->db);
+
+  ASSERT_EQ("bar", test_get(t, "foo"));
+
+  test_close(t);
+
+  ASSERT(test_rename_ldb_to_sst(t) > 0);
+
+  options = test_current_options(t);
+  options.paranoid_checks = 1;
+
+  ASSERT(test_try_reopen(t, &options) == LDB_OK);
+
+  ASSERT_EQ("bar", test_get(t, "foo"));
+}
+
+static void
+test_db_files_deleted_after_compaction(test_t *t) {
+  int i, num_files;
+
+  ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+
+  test_compact(t, "a", "z");
+
+  num_files = test_count_files(t);
+
+  for (i = 0; i < 10; i++) {
+    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+    test_compact(t, "a", "z");
+  }
+
+  ASSERT(test_count_files(t) == num_files);
+}
+
+#ifndef NDEBUG
+static void
+test_bloom_filter(test_t *t, int full_filter) {
+  struct ldb_env_state_s *state = &ldb_env_state;
+  ldb_dbopt_t options = test_current_options(t);
+  const int N = 10000;
+  int i, reads;
+
+  state->count_random_reads = 1;
+
+  options.block_cache = ldb_lru_create(0); /* Prevent cache hits */
+  options.filter_policy = ldb_bloom_create(10);
+  options.full_filter = full_filter;
+
+  test_reopen(t, &options);
+
+  /* Populate multiple layers */
+  for (i = 0; i < N; i++)
+    ASSERT(test_put(t, test_key(t, i), test_key(t, i)) == LDB_OK);
+
+  test_compact(t, "a", "z");
+
+  for (i = 0; i < N; i += 100)
+    ASSERT(test_put(t, test_key(t, i), test_key(t, i)) == LDB_OK);
+
+  ldb_test_compact_memtable(t->db);
+
+  /* Prevent auto compactions triggered by seeks */
+  ldb_atomic_store(&state->delay_data_sync, 1, ldb_order_release);
+
+  /* Lookup present keys. Should rarely read from small sstable. */
+  ldb_atomic_store(&state->random_read_counter, 0, ldb_order_seq_cst);
+
+  for (i = 0; i < N; i++)
+    ASSERT_EQ(test_key(t, i), test_get(t, test_key(t, i)));
+
+  reads = ldb_atomic_load(&state->random_read_counter, ldb_order_seq_cst);
+
+  fprintf(stderr, "%d present => %d reads\n", N, reads);
+
+  ASSERT(reads >= N);
+  ASSERT(reads <= N + 2 * N / 100);
+
+  /* Lookup present keys. Should rarely read from either sstable. */
+  ldb_atomic_store(&state->random_read_counter, 0, ldb_order_seq_cst);
+
+  for (i = 0; i < N; i++)
+    ASSERT_EQ("NOT_FOUND", test_get(t, test_key2(t, i, ".missing")));
+
+  reads = ldb_atomic_load(&state->random_read_counter, ldb_order_seq_cst);
+
+  fprintf(stderr, "%d missing => %d reads\n", N, reads);
+
+  ASSERT(reads <= 3 * N / 100);
+
+  ldb_atomic_store(&state->delay_data_sync, 0, ldb_order_release);
+
+  test_close(t);
+
+  ldb_lru_destroy(options.block_cache);
+  ldb_bloom_destroy((ldb_bloom_t *)options.filter_policy);
+
+  state->count_random_reads = 0;
+}
+
+static void
+test_db_bloom_filter(test_t *t) {
+  test_bloom_filter(t, 0);
+}
+
+static void
+test_db_full_filter(test_t *t) {
+  test_bloom_filter(t, 1);
+}
+#endif /* !NDEBUG */
+
+static void
+test_db_prefix_seek(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  ldb_prefix_t *prefix = ldb_prefix_create_fixed(4);
+  ldb_lru_t *cache = ldb_lru_create(1 << 20);
+  ldb_readopt_t ro = *ldb_readopt_default;
+  ldb_iter_t *iter;
+  size_t usage;
+
+  options.create_if_missing = 1;
+  options.block_cache = cache;
+  options.filter_policy = t->policy;
+  options.full_filter = 1;
+  options.prefix_extractor = prefix;
+  options.use_mmap = 0;
+
+  test_destroy_and_reopen(t, &options);
+
+  /* Two tables with overlapping ranges but distinct prefixes. */
+  ASSERT(test_put(t, "aaaa1", "v1") == LDB_OK);
+  ASSERT(test_put(t, "aaaa2", "v2") == LDB_OK);
+  ASSERT(test_put(t, "zzzz1", "v3") == LDB_OK);
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+
+  ASSERT(test_put(t, "abcd1", "v4") == LDB_OK);
+  ASSERT(test_put(t, "mmmm1", "v5") == LDB_OK);
+  ASSERT(test_put(t, "zzzz2", "v6") == LDB_OK);
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+
+  ASSERT_EQ("0,1,1", test_files_per_level(t));
+
+  ro.prefix_seek = 1;
+
+  iter = ldb_iterator(t->db, &ro);
+
+  /* Iteration stops at the end of the prefix. */
+  iter_seek(iter, "aaaa");
+  ASSERT_EQ(iter_status(t, iter), "aaaa1->v1");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "aaaa2->v2");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  iter_seek(iter, "aaaa2");
+  ASSERT_EQ(iter_status(t, iter), "aaaa2->v2");
+
+  iter_seek(iter, "zzzz");
+  ASSERT_EQ(iter_status(t, iter), "zzzz1->v3");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "zzzz2->v6");
+
+  /* Keys too short to have a prefix are not bounded. */
+  iter_seek(iter, "ab");
+  ASSERT_EQ(iter_status(t, iter), "abcd1->v4");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "mmmm1->v5");
+
+  /* Full scans are unaffected. */
+  ldb_iter_first(iter);
+  ASSERT_EQ(iter_status(t, iter), "aaaa1->v1");
+  ldb_iter_last(iter);
+  ASSERT_EQ(iter_status(t, iter), "zzzz2->v6");
+
+  ldb_iter_destroy(iter);
+
+  /* A prefix in neither table reads no data blocks. */
+  ldb_lru_prune(cache);
+  ASSERT(ldb_lru_usage(cache) == 0);
+
+  iter = ldb_iterator(t->db, &ro);
+
+  iter_seek(iter, "bbbb");
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+  ASSERT(ldb_lru_usage(cache) == 0);
+
+  /* A prefix in one table only reads from that table. */
+  iter_seek(iter, "mmmm");
+  ASSERT_EQ(iter_status(t, iter), "mmmm1->v5");
+  ldb_iter_next(iter);
+  ASSERT_EQ(iter_status(t, iter), "(invalid)");
+
+  usage = ldb_lru_usage(cache);
+
+#ifndef LDB_MEMENV
+  ASSERT(usage > 0);
+#else
+  (void)usage;
+#endif
+
+  ldb_iter_destroy(iter);
+
+  ldb_lru_prune(cache);
+
+  iter = ldb_iterator(t->db, ldb_readopt_default);
+
+  iter_seek(iter, "mmmm");
+  ASSERT_EQ(iter_status(t, iter), "mmmm1->v5");
+#ifndef LDB_MEMENV
+  ASSERT(ldb_lru_usage(cache) > usage);
+#endif
+
+  ldb_iter_destroy(iter);
+
+  /* Point lookups still work. */
+  ASSERT_EQ("v5", test_get(t, "mmmm1"));
+  ASSERT_EQ("NOT_FOUND", test_get(t, "mmmm2"));
+  test_reset(t);
+
+  ldb_close(t->db);
+  t->db = NULL;
+
+  ldb_lru_destroy(cache);
+  ldb_prefix_destroy(prefix);
+}
+
+/*
+ * Multi-threaded Testing
+ */
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+
+#define NUM_THREADS 4
+#define TEST_SECONDS 10
+#define NUM_KEYS 1000
+
+typedef struct mt_state {
+  test_t *test;
+  ldb_atomic(int) stop;
+  ldb_atomic(int) counter[NUM_THREADS];
+  ldb_atomic(int) thread_done[NUM_THREADS];
+} mt_state_t;
+
+typedef struct mt_thread {
+  mt_state_t *state;
+  int id;
+} mt_thread_t;
+
+static void
+mt_thread_body(void *arg) {
+  mt_thread_t *ctx = (mt_thread_t *)arg;
+  mt_state_t *state = ctx->state;
+  ldb_t *db = state->test->db;
+  ldb_slice_t key, val;
+  int id = ctx->id;
+  int counter = 0;
+  char vbuf[1500];
+  ldb_rand_t rnd;
+  char kbuf[20];
+
+  ldb_rand_init(&rnd, 1000 + id);
+
+  fprintf(stderr, "... starting thread %d\n", id);
+
+  while (!ldb_atomic_load(&state->stop, ldb_order_acquire)) {
+    int num = ldb_rand_uniform(&rnd, NUM_KEYS);
+
+    sprintf(kbuf, "%016d", num);
+
+    key = ldb_string(kbuf);
+
+    ldb_atomic_store(&state->counter[id], counter, ldb_order_release);
+
+    if (ldb_rand_one_in(&rnd, 2)) {
+      /* Write values of the form <key, my id, counter>. */
+      /* We add some padding for force compactions. */
+      sprintf(vbuf, "%d.%d.%-1000d", num, id, counter);
+
+      val = ldb_string(vbuf);
+
+      ASSERT(ldb_put(db, &key, &val, NULL) == LDB_OK);
+    } else {
+      /* Read a value and verify that it matches the pattern written above. */
+      int rc = ldb_get(db, &key, &val, NULL);
+      int n, w, c;
+
+      if (rc == LDB_NOTFOUND) {
+        /* Key has not yet been written */
+      } else {
+        ASSERT(rc == LDB_OK);
+        ASSERT(val.size < sizeof(vbuf));
+
+        memcpy(vbuf, val.data, val.size);
+
+        vbuf[val.size] = '\0';
+
+        ldb_free(val.data);
+
+        /* Check that the writer thread counter
+           is >= the counter in the value */
+        ASSERT(3 == sscanf(vbuf, "%d.%d.%d", &n, &w, &c));
+        ASSERT(n == num);
+        ASSERT(w >= 0);
+        ASSERT(w < NUM_THREADS);
+        ASSERT(c <= ldb_atomic_load(&state->counter[w], ldb_order_acquire));
+      }
+    }
 
-  /* Compact just the new range */
-  test_compact(t, "b", "f");
-  ASSERT_EQ("0,0,2", test_files_per_level(t));
+    counter++;
+  }
 
-  /* Compact all */
-  test_make_tables(t, 1, "a", "z");
-  ASSERT_EQ("0,1,2", test_files_per_level(t));
+  ldb_atomic_store(&state->thread_done[id], 1, ldb_order_release);
 
-  ldb_compact(t->db, NULL, NULL);
-  ASSERT_EQ("0,0,1", test_files_per_level(t));
+  fprintf(stderr, "... stopping thread %d after %d ops\n", id, counter);
 }
 
 static void
-test_db_open_options(test_t *t) {
-  ldb_dbopt_t opts = *ldb_dbopt_default;
-  char dbname[LDB_PATH_MAX];
-  ldb_t *db = NULL;
+test_db_multi_threaded(test_t *t) {
+  do {
+    mt_thread_t contexts[NUM_THREADS];
+    mt_state_t state;
+    int id;
 
-  (void)t;
+    /* Initialize state */
+    state.test = t;
 
-  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_options_test"));
+    ldb_atomic_store(&state.stop, 0, ldb_order_release);
 
-  ldb_destroy(dbname, NULL);
+    for (id = 0; id < NUM_THREADS; id++) {
+      ldb_atomic_store(&state.counter[id], 0, ldb_order_release);
+      ldb_atomic_store(&state.thread_done[id], 0, ldb_order_release);
+    }
 
-  /* Does not exist, and create_if_missing == 0: error */
-  opts.create_if_missing = 0;
+    /* Start threads */
+    for (id = 0; id < NUM_THREADS; id++) {
+      ldb_thread_t thread;
 
-  ASSERT(ldb_open(dbname, &opts, &db) == LDB_INVALID);
-  ASSERT(db == NULL);
+      contexts[id].state = &state;
+      contexts[id].id = id;
 
-  /* Does not exist, and create_if_missing == 1: OK */
-  opts.create_if_missing = 1;
+      ldb_thread_create(&thread, mt_thread_body, &contexts[id]);
+      ldb_thread_detach(&thread);
+    }
 
-  ASSERT(ldb_open(dbname, &opts, &db) == LDB_OK);
-  ASSERT(db != NULL);
+    /* Let them run for a while */
+    ldb_sleep_msec(TEST_SECONDS * 1000);
 
-  ldb_close(db);
-  db = NULL;
+    /* Stop the threads and wait for them to finish */
+    ldb_atomic_store(&state.stop, 1, ldb_order_release);
 
-  /* Does exist, and error_if_exists == 1: error */
-  opts.create_if_missing = 0;
-  opts.error_if_exists = 1;
+    for (id = 0; id < NUM_THREADS; id++) {
+      while (!ldb_atomic_load(&state.thread_done[id], ldb_order_acquire))
+        ldb_sleep_msec(100);
+    }
+  } while (test_change_options(t));
+}
 
-  ASSERT(ldb_open(dbname, &opts, &db) == LDB_INVALID);
-  ASSERT(db == NULL);
+typedef struct gc_thread {
+  test_t *test;
+  ldb_atomic(int) done;
+  int id;
+} gc_thread_t;
 
-  /* Does exist, and error_if_exists == 0: OK */
-  opts.create_if_missing = 1;
-  opts.error_if_exists = 0;
+static void
+gc_thread_body(void *arg) {
+  gc_thread_t *ctx = (gc_thread_t *)arg;
+  ldb_writeopt_t options = *ldb_writeopt_default;
+  ldb_slice_t key, val;
+  char buf[20];
+  int i;
 
-  ASSERT(ldb_open(dbname, &opts, &db) == LDB_OK);
-  ASSERT(db != NULL);
+  options.sync = 1;
 
-  ldb_close(db);
+  for (i = 0; i < 100; i++) {
+    sprintf(buf, "%d.%d", ctx->id, i);
 
-  ldb_destroy(dbname, NULL);
+    key = ldb_string(buf);
+    val = ldb_string(buf);
+
+    ASSERT(ldb_put(ctx->test->db, &key, &val, &options) == LDB_OK);
+  }
+
+  ldb_atomic_store(&ctx->done, 1, ldb_order_release);
 }
 
 static void
-test_db_destroy_empty_dir(test_t *t) {
-  ldb_dbopt_t opts = *ldb_dbopt_default;
-  char dbname[LDB_PATH_MAX];
-  char **names;
-  int len;
-
-  (void)t;
+test_db_group_commit(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  gc_thread_t contexts[NUM_THREADS];
+  char buf[20];
+  int i, id;
 
-  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "db_empty_dir"));
+  /* Sync writes wait 1ms for each other. */
+  options.create_if_missing = 1;
+  options.write_group_delay = 1000;
+  options.max_write_group_size = 64 << 10;
 
-  ldb_remove_dir(dbname);
+  test_destroy_and_reopen(t, &options);
 
-  ASSERT(!ldb_file_exists(dbname));
-  ASSERT(ldb_create_dir(dbname) == LDB_OK);
-#ifndef LDB_MEMENV
-  ASSERT(ldb_file_exists(dbname));
-#endif
-  ASSERT((len = ldb_get_children(dbname, &names)) >= 0);
-  ASSERT(0 == len);
-  ASSERT(ldb_destroy(dbname, &opts) == LDB_OK);
-  ASSERT(!ldb_file_exists(dbname));
+  for (id = 0; id < NUM_THREADS; id++) {
+    ldb_thread_t thread;
 
-  ldb_free_children(names, len);
-}
+    contexts[id].test = t;
+    contexts[id].id = id;
 
-static void
-test_db_destroy_open_db(test_t *t) {
-  ldb_dbopt_t opts = *ldb_dbopt_default;
-  char dbname[LDB_PATH_MAX];
-  ldb_t *db = NULL;
+    ldb_atomic_store(&contexts[id].done, 0, ldb_order_release);
 
-  (void)t;
+    ldb_thread_create(&thread, gc_thread_body, &contexts[id]);
+    ldb_thread_detach(&thread);
+  }
 
-  ASSERT(ldb_test_filename(dbname, sizeof(dbname), "open_db_dir"));
+  for (id = 0; id < NUM_THREADS; id++) {
+    while (!ldb_atomic_load(&contexts[id].done, ldb_order_acquire))
+      ldb_sleep_msec(10);
+  }
 
-  /* ldb_remove_dir(dbname); */
-  ldb_destroy(dbname, NULL);
+  test_reopen(t, &options);
 
-  ASSERT(!ldb_file_exists(dbname));
+  for (id = 0; id < NUM_THREADS; id++) {
+    for (i = 0; i < 100; i++) {
+      sprintf(buf, "%d.%d", id, i);
 
-  opts.create_if_missing = 1;
+      ASSERT_EQ(buf, test_get(t, buf));
+    }
+  }
+}
 
-  ASSERT(ldb_open(dbname, &opts, &db) == LDB_OK);
-  ASSERT(db != NULL);
+/* Lookups of "block0" and "block1" wait inside the comparator until
+   the test lets them through, so that two readers can be caught
+   holding superversions at chosen moments. */
+typedef struct sv_gate {
+  ldb_mutex_t mu;
+  ldb_cond_t cv;
+  int waiting[2];
+  int open[2];
+  int done[2];
+  int resume;
+  int filled;
+} sv_gate_t;
+
+typedef struct sv_thread {
+  test_t *test;
+  sv_gate_t *gate;
+  char value[20];
+} sv_thread_t;
 
-  /* Must fail to destroy an open db. */
-#ifndef LDB_MEMENV
-  ASSERT(ldb_file_exists(dbname));
-#endif
-  ASSERT(ldb_destroy(dbname, NULL) != LDB_OK);
-#ifndef LDB_MEMENV
-  ASSERT(ldb_file_exists(dbname));
-#endif
+static void
+sv_gate_wait(sv_gate_t *gate, int *var, int value) {
+  ldb_mutex_lock(&gate->mu);
 
-  ldb_close(db);
+  while (*var < value)
+    ldb_cond_wait(&gate->cv, &gate->mu);
 
-  /* Should succeed destroying a closed db. */
-  ASSERT(ldb_destroy(dbname, NULL) == LDB_OK);
-  ASSERT(!ldb_file_exists(dbname));
+  ldb_mutex_unlock(&gate->mu);
 }
 
 static void
-test_db_locking(test_t *t) {
-  ldb_dbopt_t opt = test_current_options(t);
-  ldb_t *db = NULL;
+sv_gate_set(sv_gate_t *gate, int *var, int value) {
+  ldb_mutex_lock(&gate->mu);
 
-  ASSERT(ldb_open(t->dbname, &opt, &db) != LDB_OK);
+  *var = value;
+
+  ldb_cond_broadcast(&gate->cv);
+  ldb_mutex_unlock(&gate->mu);
 }
 
-#ifndef NDEBUG
-/* Check that number of files does not grow when we are out of space */
 static void
-test_db_no_space(test_t *t) {
-  struct ldb_env_state_s *state = &ldb_env_state;
-  ldb_dbopt_t options = test_current_options(t);
-  int i, level, num_files;
+sv_gate_check(sv_gate_t *gate, const ldb_slice_t *x) {
+  int i;
 
-  test_reopen(t, &options);
+  if (x->size != 6 || memcmp(x->data, "block", 5) != 0)
+    return;
 
-  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
-  ASSERT_EQ("v1", test_get(t, "foo"));
+  i = x->data[5] - '0';
 
-  test_compact(t, "a", "z");
+  ldb_mutex_lock(&gate->mu);
 
-  num_files = test_count_files(t);
+  if (!gate->open[i]) {
+    gate->waiting[i] = 1;
 
-  /* Force out-of-space errors. */
-  ldb_atomic_store(&state->no_space, 1, ldb_order_release);
+    ldb_cond_broadcast(&gate->cv);
 
-  for (i = 0; i < 10; i++) {
-    for (level = 0; level < LDB_NUM_LEVELS - 1; level++)
-      ldb_test_compact_range(t->db, level, NULL, NULL);
+    while (!gate->open[i])
+      ldb_cond_wait(&gate->cv, &gate->mu);
   }
 
-  ldb_atomic_store(&state->no_space, 0, ldb_order_release);
+  ldb_mutex_unlock(&gate->mu);
+}
 
-  ASSERT(test_count_files(t) < num_files + 3);
+static int
+sv_gate_compare(const ldb_comparator_t *comparator,
+                const ldb_slice_t *x,
+                const ldb_slice_t *y) {
+  sv_gate_t *gate = (sv_gate_t *)comparator->state;
+
+  sv_gate_check(gate, x);
+  sv_gate_check(gate, y);
+
+  return ldb_compare(ldb_bytewise_comparator, x, y);
 }
 
 static void
-test_db_non_writable_filesystem(test_t *t) {
-  struct ldb_env_state_s *state = &ldb_env_state;
-  ldb_dbopt_t options = test_current_options(t);
-  const char *big;
-  int i, errors;
+sv_get(test_t *t, const char *k, char *value) {
+  ldb_slice_t key = ldb_string(k);
+  ldb_slice_t val;
 
-  options.write_buffer_size = 1000;
+  if (ldb_get(t->db, &key, &val, NULL) == LDB_OK) {
+    ASSERT(val.size < 20);
 
-  test_reopen(t, &options);
+    memcpy(value, val.data, val.size);
 
-  ASSERT(test_put(t, "foo", "v1") == LDB_OK);
+    value[val.size] = '\0';
 
-  /* Force errors for new files. */
-  ldb_atomic_store(&state->non_writable, 1, ldb_order_release);
+    ldb_free(val.data);
+  } else {
+    strcpy(value, "NOT_FOUND");
+  }
+}
 
-  big = string_fill(t, 'x', 100000);
-  errors = 0;
+static void
+sv_first_reader(void *arg) {
+  sv_thread_t *ctx = (sv_thread_t *)arg;
+  sv_gate_t *gate = ctx->gate;
 
-  for (i = 0; i < 20; i++) {
-    fprintf(stderr, "iter %d; errors %d\n", i, errors);
+  /* Cache a superversion, then read while holding it. */
+  sv_get(ctx->test, "k", ctx->value);
+  sv_get(ctx->test, "block0", ctx->value);
 
-    if (test_put(t, "foo", big) != LDB_OK) {
-      errors++;
-      ldb_sleep_msec(100);
-    }
-  }
+  sv_gate_set(gate, &gate->done[0], 1);
+  sv_gate_wait(gate, &gate->resume, 1);
 
-  ASSERT(errors > 0);
+  /* The reader must see its own write. */
+  ASSERT(test_put(ctx->test, "k", "new") == LDB_OK);
 
-  ldb_atomic_store(&state->non_writable, 0, ldb_order_release);
+  sv_get(ctx->test, "k", ctx->value);
+
+  sv_gate_set(gate, &gate->done[0], 2);
 }
 
 static void
-test_db_write_sync_error(test_t *t) {
-  /* Check that log sync errors cause the DB to disallow future writes. */
-  struct ldb_env_state_s *state = &ldb_env_state;
-  ldb_dbopt_t options = test_current_options(t);
-  ldb_writeopt_t w = *ldb_writeopt_default;
-  ldb_slice_t k1 = ldb_string("k1");
-  ldb_slice_t k2 = ldb_string("k2");
-  ldb_slice_t k3 = ldb_string("k3");
-  ldb_slice_t v1 = ldb_string("v1");
-  ldb_slice_t v2 = ldb_string("v2");
-  ldb_slice_t v3 = ldb_string("v3");
-
-  /* (a) Cause log sync calls to fail */
-  test_reopen(t, &options);
-  ldb_atomic_store(&state->data_sync_error, 1, ldb_order_release);
-
-  /* (b) Normal write should succeed */
-  w.sync = 0;
+sv_second_reader(void *arg) {
+  sv_thread_t *ctx = (sv_thread_t *)arg;
 
-  ASSERT(ldb_put(t->db, &k1, &v1, &w) == LDB_OK);
-  ASSERT_EQ("v1", test_get(t, "k1"));
+  sv_get(ctx->test, "block1", ctx->value);
+  sv_gate_set(ctx->gate, &ctx->gate->done[1], 1);
+}
 
-  /* (c) Do a sync write; should fail */
-  w.sync = 1;
+static void
+sv_filler(void *arg) {
+  sv_thread_t *ctx = (sv_thread_t *)arg;
+  sv_gate_t *gate = ctx->gate;
 
-  ASSERT(ldb_put(t->db, &k2, &v2, &w) != LDB_OK);
-  ASSERT_EQ("v1", test_get(t, "k1"));
-  ASSERT_EQ("NOT_FOUND", test_get(t, "k2"));
+  sv_get(ctx->test, "k", ctx->value);
 
-  /* (d) make sync behave normally */
-  ldb_atomic_store(&state->data_sync_error, 0, ldb_order_release);
+  ldb_mutex_lock(&gate->mu);
 
-  /* (e) Do a non-sync write; should fail */
-  w.sync = 0;
+  gate->filled++;
 
-  ASSERT(ldb_put(t->db, &k3, &v3, &w) != LDB_OK);
-  ASSERT_EQ("v1", test_get(t, "k1"));
-  ASSERT_EQ("NOT_FOUND", test_get(t, "k2"));
-  ASSERT_EQ("NOT_FOUND", test_get(t, "k3"));
+  ldb_cond_broadcast(&gate->cv);
+  ldb_mutex_unlock(&gate->mu);
 }
 
 static void
-test_db_manifest_write_error(test_t *t) {
-  /* Test for the following problem:
-   *
-   *   (a) Compaction produces file F
-   *   (b) Log record containing F is written to MANIFEST file, but sync() fails
-   *   (c) GC deletes F
-   *   (d) After reopening DB, reads fail since deleted F is named in log record
-   */
-  struct ldb_env_state_s *state = &ldb_env_state;
-  const int last = LDB_MAX_MEM_COMPACT_LEVEL;
-  int iter;
-
-  /* We iterate twice. In the second iteration, everything is the
-     same except the log record never makes it to the MANIFEST file. */
-  for (iter = 0; iter < 2; iter++) {
-    ldb_atomic(int) *error_type = (iter == 0) ? &state->manifest_sync_error
-                                              : &state->manifest_write_error;
+sv_spawn(void (*start)(void *), sv_thread_t *ctx) {
+  ldb_thread_t thread;
 
-    /* Insert foo=>bar mapping */
-    ldb_dbopt_t options = test_current_options(t);
+  ldb_thread_create(&thread, start, ctx);
+  ldb_thread_detach(&thread);
+}
 
-    options.create_if_missing = 1;
-    options.error_if_exists = 0;
+static void
+test_db_super_version_slots(test_t *t) {
+  ldb_comparator_t comparator = *ldb_bytewise_comparator;
+  ldb_dbopt_t options = test_current_options(t);
+  sv_thread_t first, second, filler;
+  sv_gate_t gate;
+  int i;
 
-    test_destroy_and_reopen(t, &options);
+  memset(&gate, 0, sizeof(gate));
 
-    ASSERT(test_put(t, "foo", "bar") == LDB_OK);
-    ASSERT_EQ("bar", test_get(t, "foo"));
+  ldb_mutex_init(&gate.mu);
+  ldb_cond_init(&gate.cv);
 
-    /* Memtable compaction (will succeed) */
-    ldb_test_compact_memtable(t->db);
+  comparator.name = "test.GateComparator";
+  comparator.compare = sv_gate_compare;
+  comparator.state = &gate;
 
-    ASSERT_EQ("bar", test_get(t, "foo"));
-    ASSERT(test_files_at_level(t, last) == 1); /* foo=>bar is now in last level */
+  options.create_if_missing = 1;
+  options.comparator = &comparator;
 
-    /* Merging compaction (will fail) */
-    ldb_atomic_store(error_type, 1, ldb_order_release);
-    ldb_test_compact_range(t->db, last, NULL, NULL); /* Should fail */
+  test_destroy_and_reopen(t, &options);
 
-    ASSERT_EQ("bar", test_get(t, "foo"));
+  ASSERT(test_put(t, "k", "old") == LDB_OK);
 
-    /* Recovery: should not lose data */
-    ldb_atomic_store(error_type, 0, ldb_order_release);
-    test_reopen(t, &options);
+  first.test = t;
+  first.gate = &gate;
+  second = first;
+  filler = first;
 
-    ASSERT_EQ("bar", test_get(t, "foo"));
+  sv_spawn(sv_first_reader, &first);
+  sv_gate_wait(&gate, &gate.waiting[0], 1);
+
+  /* Threads are given slots in turn: after one reader thread per
+     slot, the next one shares the first reader's slot. */
+  for (i = 0; i < 63; i++) {
+    sv_spawn(sv_filler, &filler);
+    sv_gate_wait(&gate, &gate.filled, i + 1);
   }
-}
-#endif /* !NDEBUG */
 
-static void
-test_db_missing_sst_file(test_t *t) {
-  ldb_dbopt_t options;
+  /* Invalidate the superversion the first reader holds. */
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_put(t, "j", "x") == LDB_OK);
 
-  ASSERT(test_put(t, "foo", "bar") == LDB_OK);
-  ASSERT_EQ("bar", test_get(t, "foo"));
+  /* The second reader finds the slot emptied and takes the mutex. */
+  sv_spawn(sv_second_reader, &second);
+  sv_gate_wait(&gate, &gate.waiting[1], 1);
 
-  /* Dump the memtable to disk. */
-  ldb_test_compact_memtable(t->db);
+  /* The first reader finishes first, while the slot is in use. */
+  sv_gate_set(&gate, &gate.open[0], 1);
+  sv_gate_wait(&gate, &gate.done[0], 1);
 
-  ASSERT_EQ("bar", test_get(t, "foo"));
+  sv_gate_set(&gate, &gate.open[1], 1);
+  sv_gate_wait(&gate, &gate.done[1], 1);
 
-  test_close(t);
+  sv_gate_set(&gate, &gate.resume, 1);
+  sv_gate_wait(&gate, &gate.done[0], 2);
 
-  ASSERT(test_delete_an_sst_file(t));
+  ASSERT(strcmp(first.value, "new") == 0);
 
-  options = test_current_options(t);
-  options.paranoid_checks = 1;
+  test_close(t);
 
-  ASSERT(test_try_reopen(t, &options) != LDB_OK);
+  ldb_cond_destroy(&gate.cv);
+  ldb_mutex_destroy(&gate.mu);
 }
 
-static void
-test_db_still_read_sst(test_t *t) {
-  ldb_dbopt_t options;
+/* A compaction filter that holds the compaction at "block" until the
+   test opens the gate, standing in for a long-running compaction. */
+typedef struct fl_gate {
+  test_t *test;
+  ldb_mutex_t mu;
+  ldb_cond_t cv;
+  int waiting;
+  int open;
+  int done;
+} fl_gate_t;
 
-  ASSERT(test_put(t, "foo", "bar") == LDB_OK);
-  ASSERT_EQ("bar", test_get(t, "foo"));
+static int
+fl_gate_filter(const ldb_cfilter_t *filt,
+               int level,
+               const ldb_slice_t *key,
+               const ldb_slice_t *value,
+               ldb_slice_t *new_value) {
+  fl_gate_t *gate = filt->state;
 
-  /* Dump the memtable to disk. */
-  ldb_test_compact_memtable(t->db);
+  (void)level;
+  (void)value;
+  (void)new_value;
 
-  ASSERT_EQ("bar", test_get(t, "foo"));
+  if (key->size != 5 || memcmp(key->data, "block", 5) != 0)
+    return LDB_CFILTER_KEEP;
 
-  test_close(t);
+  ldb_mutex_lock(&gate->mu);
 
-  ASSERT(test_rename_ldb_to_sst(t) > 0);
+  gate->waiting = 1;
 
-  options = test_current_options(t);
-  options.paranoid_checks = 1;
+  ldb_cond_broadcast(&gate->cv);
 
-  ASSERT(test_try_reopen(t, &options) == LDB_OK);
+  while (!gate->open)
+    ldb_cond_wait(&gate->cv, &gate->mu);
 
-  ASSERT_EQ("bar", test_get(t, "foo"));
+  ldb_mutex_unlock(&gate->mu);
+
+  return LDB_CFILTER_KEEP;
 }
 
 static void
-test_db_files_deleted_after_compaction(test_t *t) {
-  int i, num_files;
-
-  ASSERT(test_put(t, "foo", "v2") == LDB_OK);
+fl_compactor(void *arg) {
+  fl_gate_t *gate = arg;
 
-  test_compact(t, "a", "z");
+  ldb_compact(gate->test->db, NULL, NULL);
 
-  num_files = test_count_files(t);
+  ldb_mutex_lock(&gate->mu);
 
-  for (i = 0; i < 10; i++) {
-    ASSERT(test_put(t, "foo", "v2") == LDB_OK);
-    test_compact(t, "a", "z");
-  }
+  gate->done = 1;
 
-  ASSERT(test_count_files(t) == num_files);
+  ldb_cond_broadcast(&gate->cv);
+  ldb_mutex_unlock(&gate->mu);
 }
 
-#ifndef NDEBUG
 static void
-test_db_bloom_filter(test_t *t) {
-  struct ldb_env_state_s *state = &ldb_env_state;
+test_db_flush_during_compaction(test_t *t) {
   ldb_dbopt_t options = test_current_options(t);
-  const int N = 10000;
-  int i, reads;
+  ldb_cfilter_t filter;
+  ldb_thread_t thread;
+  fl_gate_t gate;
+  int i;
 
-  state->count_random_reads = 1;
+  memset(&gate, 0, sizeof(gate));
 
-  options.block_cache = ldb_lru_create(0); /* Prevent cache hits */
-  options.filter_policy = ldb_bloom_create(10);
+  gate.test = t;
 
-  test_reopen(t, &options);
+  ldb_mutex_init(&gate.mu);
+  ldb_cond_init(&gate.cv);
 
-  /* Populate multiple layers */
-  for (i = 0; i < N; i++)
-    ASSERT(test_put(t, test_key(t, i), test_key(t, i)) == LDB_OK);
+  filter.name = "test.GateFilter";
+  filter.filter = fl_gate_filter;
+  filter.state = &gate;
 
-  test_compact(t, "a", "z");
+  options.compaction_filter = &filter;
 
-  for (i = 0; i < N; i += 100)
-    ASSERT(test_put(t, test_key(t, i), test_key(t, i)) == LDB_OK);
+  test_reopen(t, &options);
 
-  ldb_test_compact_memtable(t->db);
+  /* Two overlapping tables, so the compaction has to merge. */
+  ASSERT(test_put(t, "block", "v1") == LDB_OK);
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_put(t, "block", "v2") == LDB_OK);
+  ASSERT(ldb_test_compact_memtable(t->db) == LDB_OK);
+  ASSERT(test_total_files(t) == 2);
 
-  /* Prevent auto compactions triggered by seeks */
-  ldb_atomic_store(&state->delay_data_sync, 1, ldb_order_release);
+  ldb_thread_create(&thread, fl_compactor, &gate);
+  ldb_thread_detach(&thread);
 
-  /* Lookup present keys. Should rarely read from small sstable. */
-  ldb_atomic_store(&state->random_read_counter, 0, ldb_order_seq_cst);
+  ldb_mutex_lock(&gate.mu);
 
-  for (i = 0; i < N; i++)
-    ASSERT_EQ(test_key(t, i), test_get(t, test_key(t, i)));
+  while (!gate.waiting)
+    ldb_cond_wait(&gate.cv, &gate.mu);
 
-  reads = ldb_atomic_load(&state->random_read_counter, ldb_order_seq_cst);
+  ldb_mutex_unlock(&gate.mu);
 
-  fprintf(stderr, "%d present => %d reads\n", N, reads);
+  /* The compaction is stuck; the memtable is flushed regardless. */
+  ASSERT(test_put(t, "k", "v") == LDB_OK);
+  ASSERT(ldb_flush(t->db, 0, 1) == LDB_OK);
 
-  ASSERT(reads >= N);
-  ASSERT(reads <= N + 2 * N / 100);
+  for (i = 0; i < 1000 && test_total_files(t) < 3; i++)
+    ldb_sleep_msec(10);
 
-  /* Lookup present keys. Should rarely read from either sstable. */
-  ldb_atomic_store(&state->random_read_counter, 0, ldb_order_seq_cst);
+  ASSERT(test_total_files(t) == 3);
+  ASSERT_EQ("v", test_get(t, "k"));
 
-  for (i = 0; i < N; i++)
-    ASSERT_EQ("NOT_FOUND", test_get(t, test_key2(t, i, ".missing")));
+  ldb_mutex_lock(&gate.mu);
 
-  reads = ldb_atomic_load(&state->random_read_counter, ldb_order_seq_cst);
+  gate.open = 1;
 
-  fprintf(stderr, "%d missing => %d reads\n", N, reads);
+  ldb_cond_broadcast(&gate.cv);
 
-  ASSERT(reads <= 3 * N / 100);
+  while (!gate.done)
+    ldb_cond_wait(&gate.cv, &gate.mu);
 
-  ldb_atomic_store(&state->delay_data_sync, 0, ldb_order_release);
+  ldb_mutex_unlock(&gate.mu);
+
+  ASSERT_EQ("(block->v2)(k->v)", test_contents(t));
 
   test_close(t);
 
-  ldb_lru_destroy(options.block_cache);
-  ldb_bloom_destroy((ldb_bloom_t *)options.filter_policy);
+  ldb_cond_destroy(&gate.cv);
+  ldb_mutex_destroy(&gate.mu);
+}
 
-  state->count_random_reads = 0;
+/* Iterator trees are built and destroyed by readers, and by the
+   compactions a writer keeps triggering, all sharing the object pool. */
+#define IT_KEYS 2000
+#define IT_SCANS 2000
+
+static ldb_atomic(int) it_alloc_calls;
+
+static void *
+it_alloc(size_t size) {
+  ldb_atomic_fetch_add(&it_alloc_calls, 1, ldb_order_relaxed);
+  return malloc(size);
 }
-#endif /* !NDEBUG */
 
-/*
- * Multi-threaded Testing
- */
+static void *
+it_resize(void *ptr, size_t size) {
+  if (ptr == NULL)
+    ldb_atomic_fetch_add(&it_alloc_calls, 1, ldb_order_relaxed);
 
-#if defined(_WIN32) || defined(LDB_PTHREAD)
+  return realloc(ptr, size);
+}
 
-#define NUM_THREADS 4
-#define TEST_SECONDS 10
-#define NUM_KEYS 1000
+static void
+it_release(void *ptr) {
+  free(ptr);
+}
 
-typedef struct mt_state {
+typedef struct it_state {
   test_t *test;
   ldb_atomic(int) stop;
-  ldb_atomic(int) counter[NUM_THREADS];
-  ldb_atomic(int) thread_done[NUM_THREADS];
-} mt_state_t;
+  ldb_atomic(int) done[NUM_THREADS + 1];
+} it_state_t;
 
-typedef struct mt_thread {
-  mt_state_t *state;
+typedef struct it_thread {
+  it_state_t *state;
   int id;
-} mt_thread_t;
+} it_thread_t;
 
+/* Seek to a random key and read the next ten entries. Every value
+   starts with its key, whichever generation of it is seen. */
 static void
-mt_thread_body(void *arg) {
-  mt_thread_t *ctx = (mt_thread_t *)arg;
-  mt_state_t *state = ctx->state;
-  ldb_t *db = state->test->db;
+it_scan(ldb_t *db, ldb_rand_t *rnd) {
+  ldb_iter_t *iter = ldb_iterator(db, ldb_readopt_default);
+  char kbuf[20], last[20];
   ldb_slice_t key, val;
-  int id = ctx->id;
-  int counter = 0;
-  char vbuf[1500];
-  ldb_rand_t rnd;
-  char kbuf[20];
+  int i;
 
-  ldb_rand_init(&rnd, 1000 + id);
+  sprintf(kbuf, "key%06d", (int)ldb_rand_uniform(rnd, IT_KEYS));
 
-  fprintf(stderr, "... starting thread %d\n", id);
+  key = ldb_string(kbuf);
 
-  while (!ldb_atomic_load(&state->stop, ldb_order_acquire)) {
-    int num = ldb_rand_uniform(&rnd, NUM_KEYS);
+  ldb_iter_seek(iter, &key);
 
-    sprintf(kbuf, "%016d", num);
+  for (i = 0; i < 10 && ldb_iter_valid(iter); i++) {
+    key = ldb_iter_key(iter);
+    val = ldb_iter_value(iter);
 
-    key = ldb_string(kbuf);
+    ASSERT(key.size == 9);
+    ASSERT(memcmp(key.data, "key", 3) == 0);
+    ASSERT(i == 0 || memcmp(key.data, last, 9) > 0);
+    ASSERT(val.size > 10);
+    ASSERT(memcmp(val.data, key.data, 9) == 0);
+    ASSERT(val.data[9] == '.');
 
-    ldb_atomic_store(&state->counter[id], counter, ldb_order_release);
+    memcpy(last, key.data, 9);
 
-    if (ldb_rand_one_in(&rnd, 2)) {
-      /* Write values of the form <key, my id, counter>. */
-      /* We add some padding for force compactions. */
-      sprintf(vbuf, "%d.%d.%-1000d", num, id, counter);
+    ldb_iter_next(iter);
+  }
 
-      val = ldb_string(vbuf);
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
 
-      ASSERT(ldb_put(db, &key, &val, NULL) == LDB_OK);
-    } else {
-      /* Read a value and verify that it matches the pattern written above. */
-      int rc = ldb_get(db, &key, &val, NULL);
-      int n, w, c;
+  ldb_iter_destroy(iter);
+}
 
-      if (rc == LDB_NOTFOUND) {
-        /* Key has not yet been written */
-      } else {
-        ASSERT(rc == LDB_OK);
-        ASSERT(val.size < sizeof(vbuf));
+static void
+it_reader(void *arg) {
+  it_thread_t *ctx = (it_thread_t *)arg;
+  ldb_t *db = ctx->state->test->db;
+  ldb_rand_t rnd;
+  int i;
 
-        memcpy(vbuf, val.data, val.size);
+  ldb_rand_init(&rnd, 1000 + ctx->id);
 
-        vbuf[val.size] = '\0';
+  for (i = 0; i < IT_SCANS; i++)
+    it_scan(db, &rnd);
 
-        ldb_free(val.data);
+  ldb_atomic_store(&ctx->state->done[ctx->id], 1, ldb_order_release);
+}
 
-        /* Check that the writer thread counter
-           is >= the counter in the value */
-        ASSERT(3 == sscanf(vbuf, "%d.%d.%d", &n, &w, &c));
-        ASSERT(n == num);
-        ASSERT(w >= 0);
-        ASSERT(w < NUM_THREADS);
-        ASSERT(c <= ldb_atomic_load(&state->counter[w], ldb_order_acquire));
-      }
-    }
+/* Write a generation of every key, flushing often enough to keep
+   level-0 compactions going. */
+static void
+it_fill(ldb_t *db, int gen) {
+  char kbuf[20], vbuf[40];
+  ldb_slice_t key, val;
+  int i;
 
-    counter++;
+  for (i = 0; i < IT_KEYS; i++) {
+    sprintf(kbuf, "key%06d", i);
+    sprintf(vbuf, "key%06d.%d", i, gen);
+
+    key = ldb_string(kbuf);
+    val = ldb_string(vbuf);
+
+    ASSERT(ldb_put(db, &key, &val, NULL) == LDB_OK);
+
+    if (i % 500 == 499)
+      ASSERT(ldb_test_compact_memtable(db) == LDB_OK);
   }
+}
 
-  ldb_atomic_store(&state->thread_done[id], 1, ldb_order_release);
+static void
+it_writer(void *arg) {
+  it_thread_t *ctx = (it_thread_t *)arg;
+  it_state_t *state = ctx->state;
+  int gen;
 
-  fprintf(stderr, "... stopping thread %d after %d ops\n", id, counter);
+  for (gen = 2; !ldb_atomic_load(&state->stop, ldb_order_acquire); gen++)
+    it_fill(state->test->db, gen);
+
+  ldb_atomic_store(&state->done[ctx->id], 1, ldb_order_release);
 }
 
 static void
-test_db_multi_threaded(test_t *t) {
-  do {
-    mt_thread_t contexts[NUM_THREADS];
-    mt_state_t state;
-    int id;
+test_db_iterator_trees(test_t *t) {
+  ldb_dbopt_t options = test_current_options(t);
+  it_thread_t contexts[NUM_THREADS + 1];
+  it_state_t state;
+  int calls, i, id;
+  ldb_rand_t rnd;
 
-    /* Initialize state */
-    state.test = t;
+  test_close(t);
 
-    ldb_atomic_store(&state.stop, 0, ldb_order_release);
+  ldb_set_allocator(it_alloc, it_resize, it_release);
 
-    for (id = 0; id < NUM_THREADS; id++) {
-      ldb_atomic_store(&state.counter[id], 0, ldb_order_release);
-      ldb_atomic_store(&state.thread_done[id], 0, ldb_order_release);
-    }
+  options.create_if_missing = 1;
 
-    /* Start threads */
-    for (id = 0; id < NUM_THREADS; id++) {
-      ldb_thread_t thread;
+  test_destroy_and_reopen(t, &options);
 
-      contexts[id].state = &state;
-      contexts[id].id = id;
+  it_fill(t->db, 1);
 
-      ldb_thread_create(&thread, mt_thread_body, &contexts[id]);
-      ldb_thread_detach(&thread);
-    }
+  state.test = t;
 
-    /* Let them run for a while */
-    ldb_sleep_msec(TEST_SECONDS * 1000);
+  ldb_atomic_store(&state.stop, 0, ldb_order_release);
 
-    /* Stop the threads and wait for them to finish */
-    ldb_atomic_store(&state.stop, 1, ldb_order_release);
+  for (id = 0; id <= NUM_THREADS; id++) {
+    ldb_thread_t thread;
 
-    for (id = 0; id < NUM_THREADS; id++) {
-      while (!ldb_atomic_load(&state.thread_done[id], ldb_order_acquire))
-        ldb_sleep_msec(100);
-    }
-  } while (test_change_options(t));
+    contexts[id].state = &state;
+    contexts[id].id = id;
+
+    ldb_atomic_store(&state.done[id], 0, ldb_order_release);
+
+    if (id == NUM_THREADS)
+      ldb_thread_create(&thread, it_writer, &contexts[id]);
+    else
+      ldb_thread_create(&thread, it_reader, &contexts[id]);
+
+    ldb_thread_detach(&thread);
+  }
+
+  for (id = 0; id < NUM_THREADS; id++) {
+    while (!ldb_atomic_load(&state.done[id], ldb_order_acquire))
+      ldb_sleep_msec(10);
+  }
+
+  ldb_atomic_store(&state.stop, 1, ldb_order_release);
+
+  while (!ldb_atomic_load(&state.done[NUM_THREADS], ldb_order_acquire))
+    ldb_sleep_msec(10);
+
+  /* Settle on one table, so the count does not depend on timing. */
+  ldb_compact(t->db, NULL, NULL);
+
+  ldb_rand_init(&rnd, 301);
+
+  it_scan(t->db, &rnd);
+
+  /* Once warm, a scan only allocates its growable buffers. */
+  calls = ldb_atomic_load(&it_alloc_calls, ldb_order_relaxed);
+
+  for (i = 0; i < 100; i++)
+    it_scan(t->db, &rnd);
+
+  calls = ldb_atomic_load(&it_alloc_calls, ldb_order_relaxed) - calls;
+
+#ifdef LDB_HAVE_ATOMIC_PTR_CAS
+  /* About 31 calls per scan without the pool. */
+  ASSERT(calls <= 100 * 12);
+#else
+  (void)calls;
+#endif
+
+  test_close(t);
+
+  ldb_set_allocator(NULL, NULL, NULL);
 }
 
 #endif /* _WIN32 || LDB_PTHREAD */
@@ -2966,7 +9981,71 @@ main(void) {
     test_db_get_from_immutable_layer,
 #endif
     test_db_get_from_versions,
+    test_db_memtable_bloom,
+    test_db_data_block_hash_index,
+    test_db_separate_block_values,
+    test_db_plain_table,
+    test_db_parallel_insert,
+    test_db_cuckoo_table,
+    test_db_compression_per_level,
+    test_db_block_size_per_level,
+    test_db_zstd_dictionary,
+    test_db_multiget,
+    test_db_packed,
+    test_db_next_batch,
+    test_db_read_state,
+    test_db_compaction_readahead,
+    test_db_direct_io,
+    test_db_rate_limiter,
+    test_db_rate_limiter_auto,
+    test_db_delayed_write,
+    test_db_multi_file_move,
+    test_db_output_file_sizes,
+    test_db_num_levels,
+    test_db_parallel_manual_compaction,
+    test_db_dynamic_level_bytes,
+    test_db_universal_compaction,
+    test_db_fifo_compaction,
+    test_db_compaction_filter,
+    test_db_compaction_progress,
+    test_db_bottommost_sequence,
+    test_db_compaction_pri,
+    test_db_periodic_compaction,
+    test_db_deletion_compaction,
+    test_db_table_properties,
+    test_db_blob_files,
+    test_db_checkpoint,
+    test_db_copy_threaded,
+    test_db_backups,
+    test_db_read_only,
+    test_db_in_memory,
+    test_db_wal_compression,
+    test_db_recycle_logs,
+    test_db_manual_wal_flush,
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+    test_db_wal_sync_interval,
+#endif
+    test_db_flush,
+    test_db_mapped_tables,
+    test_db_mapped_blocks,
+    test_db_merge_operator,
+    test_db_keys_only,
+    test_db_delete_range,
+    test_db_delete_files_in_range,
+    test_db_delete_files_in_range_refs,
+    test_db_ingest,
+    test_db_bulk_load,
+    test_db_optimistic_txn,
+    test_db_indexed_batch,
+    test_db_disable_wal,
+    test_db_memtable_huge_pages,
+    test_db_write_buffer_manager,
+    test_db_memory_limit,
+    test_db_index_user_keys,
+    test_db_shared_thread_pool,
     test_db_get_memusage,
+    test_db_block_cache_stats,
+    test_db_stats_json,
     test_db_get_snapshot,
     test_db_get_identical_snapshots,
     test_db_iterate_over_empty_snapshot,
@@ -2978,21 +10057,50 @@ main(void) {
     test_db_iter_single,
     test_db_iter_multi,
     test_db_iter_small_and_large_mix,
+    test_db_iter_bounds,
+    test_db_iter_pin_data,
+    test_db_get_pinned,
+    test_db_iter_deletion_trigger,
     test_db_iter_multi_with_delete,
     test_db_iter_multi_with_delete_and_compaction,
+    test_db_iter_refresh,
+    test_db_iter_tailing,
     test_db_recover,
     test_db_recover_with_empty_log,
     test_db_recover_during_memtable_compaction,
     test_db_minor_compactions_happen,
     test_db_recover_with_large_log,
+    test_db_recover_in_parallel,
+    test_db_manifest_rollover,
+    test_db_latency_stats,
+    test_db_perf_context,
+    test_db_statistics,
+    test_db_event_listener,
+    test_db_level0_lookup,
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+    test_db_intra_l0_compaction,
+#endif
+    test_db_set_options,
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+    test_db_background_deletes,
+#endif
+    test_db_compaction_warm,
+    test_db_prepopulate_block_cache,
+    test_db_block_cache_dump,
+    test_db_trace,
+    test_db_block_trace,
     test_db_compactions_generate_multiple_files,
     test_db_repeated_writes_to_same_key,
     test_db_sparse_merge,
     test_db_approximate_sizes,
+    test_db_approximate_sizes_ex,
     test_db_approximate_sizes_mix_of_small_and_large,
+    test_db_split_keys,
+    test_db_parallel_scan,
     test_db_iterator_pins_ref,
     test_db_snapshot,
     test_db_hidden_values_are_removed,
+    test_db_hidden_values_between_snapshots,
     test_db_deletion_markers_1,
     test_db_deletion_markers_2,
     test_db_overlap_in_level0,
@@ -3001,6 +10109,19 @@ main(void) {
     test_db_fflush_issue474,
     test_db_comparator_check,
     test_db_custom_comparator,
+    test_db_families,
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+    test_db_parallel_compactions,
+#endif
+    test_db_subcompactions,
+    test_db_compressed_block_cache,
+    test_db_persistent_cache,
+    test_db_paths,
+    test_db_wal_block_size,
+    test_db_cache_index_and_filter_blocks,
+    test_db_preload_tables,
+    test_db_table_cache_eviction,
+    test_db_keep_tables_open,
     test_db_manual_compaction,
     test_db_open_options,
     test_db_destroy_empty_dir,
@@ -3017,9 +10138,15 @@ main(void) {
     test_db_files_deleted_after_compaction,
 #ifndef NDEBUG
     test_db_bloom_filter,
+    test_db_full_filter,
 #endif
+    test_db_prefix_seek,
 #if defined(_WIN32) || defined(LDB_PTHREAD)
     test_db_multi_threaded,
+    test_db_group_commit,
+    test_db_super_version_slots,
+    test_db_flush_during_compaction,
+    test_db_iterator_trees,
 #endif
     test_db_randomized
   };
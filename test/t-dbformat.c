@@ -168,6 +168,64 @@ test_ikey_shortest_successor(void) {
   ldb_ikey_clear(&k1);
 }
 
+static int
+sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+static int
+wrapped_compare(const ldb_comparator_t *comparator,
+                const ldb_slice_t *x,
+                const ldb_slice_t *y) {
+  (void)comparator;
+  return ldb_compare(ldb_bytewise_comparator, x, y);
+}
+
+static void
+test_ikey_compare(void) {
+  const char *keys[] = {"", "a", "ab", "b", "ba", "\xff", "\xff\xff"};
+  const uint64_t seq[] = {0, 1, 255, 256, UINT64_C(1) << 40};
+  /* A copy of the bytewise comparator (as a database keeps) is still
+     bytewise, while a wrapped one takes the generic path. */
+  ldb_comparator_t copy = *ldb_bytewise_comparator;
+  ldb_comparator_t user = *ldb_bytewise_comparator;
+  ldb_comparator_t fast, slow;
+  ldb_ikey_t x, y;
+  size_t i, j, k, l;
+
+  user.compare = wrapped_compare;
+
+  ldb_ikc_init(&fast, &copy);
+  ldb_ikc_init(&slow, &user);
+
+  ASSERT(fast.compare == ldb_ikc_bytewise);
+  ASSERT(slow.compare != ldb_ikc_bytewise);
+
+  ldb_ikey_init(&x);
+  ldb_ikey_init(&y);
+
+  for (i = 0; i < lengthof(keys); i++) {
+    for (j = 0; j < lengthof(seq); j++) {
+      ikey_set(&x, keys[i], seq[j], LDB_TYPE_VALUE);
+
+      for (k = 0; k < lengthof(keys); k++) {
+        for (l = 0; l < lengthof(seq); l++) {
+          ikey_set(&y, keys[k], seq[l], LDB_TYPE_DELETION);
+
+          ASSERT(sign(ldb_compare(&fast, &x, &y))
+              == sign(ldb_compare(&slow, &x, &y)));
+
+          ASSERT(sign(ldb_compare_fast(&fast, &x, &y))
+              == sign(ldb_compare(&slow, &x, &y)));
+        }
+      }
+    }
+  }
+
+  ldb_ikey_clear(&x);
+  ldb_ikey_clear(&y);
+}
+
 static void
 test_pkey_debug_string(void) {
   ldb_slice_t key = ldb_string("The \"key\" in 'single quotes'");
@@ -217,6 +275,7 @@ main(void) {
   test_ikey_encode_decode();
   test_ikey_short_separator();
   test_ikey_shortest_successor();
+  test_ikey_compare();
   test_pkey_debug_string();
   test_ikey_debug_string();
   return 0;
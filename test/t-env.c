@@ -221,6 +221,267 @@ test_open_on_read(void) {
   ASSERT(ldb_remove_file(path) == LDB_OK);
 }
 
+static void
+test_multiread(void) {
+  /* More requests than a single submission can hold. */
+  static const int num_reqs = 77;
+  ldb_readreq_t reqs[77];
+  char path[LDB_PATH_MAX];
+  ldb_rfile_t *rfile;
+  ldb_buffer_t data;
+  uint8_t *scratch;
+  ldb_rand_t rnd;
+  int i, mmap;
+
+  ldb_buffer_init(&data);
+
+  ldb_rand_init(&rnd, 301);
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "multiread.txt"));
+
+  ldb_random_string(&data, &rnd, 1 << 20);
+
+  ASSERT(ldb_write_file(path, &data, 0) == LDB_OK);
+
+  scratch = ldb_malloc(num_reqs * 4096);
+
+  for (mmap = 0; mmap < 2; mmap++) {
+    ASSERT(ldb_randfile_create(path, &rfile, mmap) == LDB_OK);
+
+    for (i = 0; i < num_reqs; i++) {
+      reqs[i].offset = ldb_rand_uniform(&rnd, data.size);
+      reqs[i].count = ldb_rand_uniform(&rnd, 4096);
+      reqs[i].buf = scratch + i * 4096;
+
+      /* The last request runs past the end of the file. */
+      if (i == num_reqs - 1)
+        reqs[i].offset = data.size - 10;
+    }
+
+    ldb_rfile_multiread(rfile, reqs, num_reqs);
+
+    for (i = 0; i < num_reqs; i++) {
+      size_t len = LDB_MIN(reqs[i].count, data.size - reqs[i].offset);
+
+      if (mmap && len < reqs[i].count) {
+        ASSERT(reqs[i].status != LDB_OK);
+        continue;
+      }
+
+      ASSERT(reqs[i].status == LDB_OK);
+      ASSERT(reqs[i].result.size == len);
+      ASSERT(memcmp(reqs[i].result.data,
+                    data.data + reqs[i].offset, len) == 0);
+    }
+
+    ldb_rfile_destroy(rfile);
+  }
+
+  ldb_free(scratch);
+
+  ASSERT(ldb_remove_file(path) == LDB_OK);
+
+  ldb_buffer_clear(&data);
+}
+
+static void
+test_sync_append(void) {
+  char path[LDB_PATH_MAX];
+  ldb_buffer_t data, str;
+  ldb_wfile_t *wfile;
+  ldb_rand_t rnd;
+  int i, append;
+
+  ldb_buffer_init(&data);
+  ldb_buffer_init(&str);
+
+  ldb_rand_init(&rnd, 301);
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "sync_append.txt"));
+
+  /* Syncs with and without buffered data, in both open modes. */
+  for (append = 0; append < 2; append++) {
+    if (append)
+      ASSERT(ldb_appendfile_create(path, &wfile) == LDB_OK);
+    else
+      ASSERT(ldb_truncfile_create(path, &wfile) == LDB_OK);
+
+    for (i = 0; i < 100; i++) {
+      ldb_random_string(&str, &rnd, ldb_rand_skewed(&rnd, 17));
+
+      ASSERT(ldb_wfile_append(wfile, &str) == LDB_OK);
+
+      ldb_buffer_concat(&data, &str);
+
+      ASSERT(ldb_wfile_sync(wfile) == LDB_OK);
+
+      if (i % 10 == 0)
+        ASSERT(ldb_wfile_sync(wfile) == LDB_OK);
+    }
+
+    ASSERT(ldb_wfile_close(wfile) == LDB_OK);
+
+    ldb_wfile_destroy(wfile);
+
+    ASSERT(ldb_read_file(path, &str) == LDB_OK);
+    ASSERT(ldb_buffer_equal(&str, &data));
+  }
+
+  ASSERT(ldb_remove_file(path) == LDB_OK);
+
+  ldb_buffer_clear(&data);
+  ldb_buffer_clear(&str);
+}
+
+static void
+test_vectored_append(void) {
+  char path[LDB_PATH_MAX];
+  ldb_buffer_t data, str;
+  ldb_slice_t iov[200];
+  ldb_wfile_t *wfile;
+  ldb_rand_t rnd;
+  size_t off;
+  int i, j;
+
+  ldb_buffer_init(&data);
+  ldb_buffer_init(&str);
+
+  ldb_rand_init(&rnd, 301);
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "vectored_append.txt"));
+  ASSERT(ldb_truncfile_create(path, &wfile) == LDB_OK);
+
+  /* Small batches stay buffered, large ones go out with the buffer. */
+  for (i = 1; i <= 200; i += 13) {
+    ldb_buffer_reset(&str);
+
+    for (j = 0; j < i; j++) {
+      ldb_buffer_t chunk;
+
+      ldb_buffer_init(&chunk);
+      ldb_random_string(&chunk, &rnd, ldb_rand_skewed(&rnd, 12));
+      ldb_buffer_concat(&str, &chunk);
+
+      iov[j].size = chunk.size;
+
+      ldb_buffer_clear(&chunk);
+    }
+
+    for (j = 0, off = 0; j < i; j++) {
+      iov[j].data = str.data + off;
+      off += iov[j].size;
+    }
+
+    ASSERT(ldb_wfile_appendv(wfile, iov, i) == LDB_OK);
+
+    ldb_buffer_concat(&data, &str);
+  }
+
+  ASSERT(ldb_wfile_close(wfile) == LDB_OK);
+
+  ldb_wfile_destroy(wfile);
+
+  ASSERT(ldb_read_file(path, &str) == LDB_OK);
+  ASSERT(ldb_buffer_equal(&str, &data));
+  ASSERT(ldb_remove_file(path) == LDB_OK);
+
+  ldb_buffer_clear(&data);
+  ldb_buffer_clear(&str);
+}
+
+static void
+test_direct_io(void) {
+  char path[LDB_PATH_MAX];
+  ldb_buffer_t data, str;
+  ldb_wfile_t *wfile;
+  ldb_rfile_t *rfile;
+  ldb_slice_t result;
+  ldb_rand_t rnd;
+  uint8_t *scratch;
+  int i;
+
+  ldb_buffer_init(&data);
+  ldb_buffer_init(&str);
+
+  ldb_rand_init(&rnd, 301);
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "direct_io.txt"));
+
+  /* Unaligned appends, flushes and syncs. */
+  ASSERT(ldb_directfile_create(path, &wfile) == LDB_OK);
+
+  for (i = 0; i < 200; i++) {
+    ldb_random_string(&str, &rnd, ldb_rand_skewed(&rnd, 14));
+
+    ASSERT(ldb_wfile_append(wfile, &str) == LDB_OK);
+
+    ldb_buffer_concat(&data, &str);
+
+    if (i % 3 == 0)
+      ASSERT(ldb_wfile_flush(wfile) == LDB_OK);
+
+    if (i % 50 == 0)
+      ASSERT(ldb_wfile_sync(wfile) == LDB_OK);
+  }
+
+  ASSERT(ldb_wfile_close(wfile) == LDB_OK);
+
+  ldb_wfile_destroy(wfile);
+
+  ASSERT(ldb_read_file(path, &str) == LDB_OK);
+  ASSERT(ldb_buffer_equal(&str, &data));
+
+  /* Unaligned reads, including one past the end. */
+  ASSERT(ldb_randfile_create(path, &rfile, LDB_RFILE_DIRECT) == LDB_OK);
+
+  scratch = ldb_malloc(10000);
+
+  for (i = 0; i < 100; i++) {
+    uint64_t offset = ldb_rand_uniform(&rnd, data.size);
+    size_t count = ldb_rand_uniform(&rnd, 10000);
+    size_t len = LDB_MIN(count, data.size - offset);
+
+    ASSERT(ldb_rfile_pread(rfile, &result, scratch, count, offset) == LDB_OK);
+    ASSERT(result.size == len);
+    ASSERT(memcmp(result.data, data.data + offset, len) == 0);
+  }
+
+  ldb_free(scratch);
+  ldb_rfile_destroy(rfile);
+
+  ASSERT(ldb_remove_file(path) == LDB_OK);
+
+  ldb_buffer_clear(&data);
+  ldb_buffer_clear(&str);
+}
+
+static void
+test_evict_file(void) {
+  ldb_slice_t data = ldb_string("evicted");
+  char path[LDB_PATH_MAX];
+  ldb_buffer_t result;
+  int rc;
+
+  ldb_buffer_init(&result);
+
+  ASSERT(ldb_test_filename(path, sizeof(path), "evict_file.txt"));
+  ASSERT(ldb_write_file(path, &data, 0) == LDB_OK);
+
+  /* The contents survive being dropped from the cache. */
+  rc = ldb_evict_file(path);
+
+  ASSERT(rc == LDB_OK || rc == LDB_NOSUPPORT);
+  ASSERT(ldb_read_file(path, &result) == LDB_OK);
+  ASSERT(ldb_buffer_equal(&result, &data));
+
+  ASSERT(ldb_remove_file(path) == LDB_OK);
+
+  if (rc == LDB_OK)
+    ASSERT(ldb_evict_file(path) == LDB_ENOENT);
+
+  ldb_buffer_clear(&result);
+}
+
 /*
  * Threads
  */
@@ -391,6 +652,11 @@ main(void) {
   test_reopen_writable_file();
   test_reopen_appendable_file();
   test_open_on_read();
+  test_multiread();
+  test_sync_append();
+  test_vectored_append();
+  test_direct_io();
+  test_evict_file();
 
 #if defined(_WIN32) || defined(LDB_PTHREAD)
   {
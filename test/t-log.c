@@ -19,6 +19,7 @@
 #include "util/coding.h"
 #include "util/crc32c.h"
 #include "util/internal.h"
+#include "util/options.h"
 #include "util/random.h"
 #include "util/slice.h"
 #include "util/status.h"
@@ -111,6 +112,7 @@ ltest_clear(ltest_t *t) {
 
   ldb_vector_clear(&t->arena);
   ldb_buffer_clear(&t->scratch);
+  ldb_buffer_clear(&t->writer.compressed);
   ldb_reader_clear(&t->reader);
   ldb_buffer_clear(&t->dst);
 }
@@ -660,6 +662,173 @@ test_log_error_joins_records(ltest_t *t) {
   ASSERT(dropped >= 2 * LDB_BLOCK_SIZE);
 }
 
+static void
+test_log_compressed(ltest_t *t) {
+  const char *big = ltest_big_string(t, "bar", 100000);
+  ldb_buffer_t data, chunk;
+  ldb_rand_t rnd;
+  int i;
+
+  ldb_buffer_init(&data);
+  ldb_buffer_init(&chunk);
+  ldb_rand_init(&rnd, 301);
+
+  /* Compresses to several blocks. */
+  for (i = 0; i < 256; i++) {
+    ldb_compressible_string(&chunk, &rnd, 0.5, 1000);
+    ldb_buffer_concat(&data, &chunk);
+  }
+
+  ldb_buffer_push(&data, 0);
+
+  ldb_writer_compress(&t->writer, LDB_SNAPPY_COMPRESSION);
+
+  ltest_write(t, "foo"); /* Stored as is. */
+  ltest_write(t, big);
+  ltest_write(t, "");
+  ltest_write(t, (char *)data.data);
+
+  ASSERT(ltest_written_bytes(t) > 3 * LDB_BLOCK_SIZE);
+  ASSERT(ltest_written_bytes(t) < 5 * LDB_BLOCK_SIZE);
+
+  ASSERT_EQ("foo", ltest_read(t));
+  ASSERT_EQ(big, ltest_read(t));
+  ASSERT_EQ("", ltest_read(t));
+  ASSERT_EQ((char *)data.data, ltest_read(t));
+  ASSERT_EQ("EOF", ltest_read(t));
+  ASSERT(ltest_dropped_bytes(t) == 0);
+
+  ldb_buffer_clear(&chunk);
+  ldb_buffer_clear(&data);
+}
+
+static void
+test_log_add_records(ltest_t *t) {
+  const char *big = ltest_big_string(t, "bar", 3 * LDB_BLOCK_SIZE / 2);
+  ldb_slice_t records[4];
+
+  ldb_writer_compress(&t->writer, LDB_SNAPPY_COMPRESSION);
+
+  records[0] = ldb_string("foo");
+  records[1] = ldb_string(big);
+  records[2] = ldb_string("");
+  records[3] = ldb_string(ltest_big_string(t, "baz", 10000));
+
+  ASSERT(ldb_writer_add_records(&t->writer, records, 4) == LDB_OK);
+
+  ltest_write(t, "qux");
+
+  ASSERT_EQ("foo", ltest_read(t));
+  ASSERT_EQ(big, ltest_read(t));
+  ASSERT_EQ("", ltest_read(t));
+  ASSERT_EQ(ltest_big_string(t, "baz", 10000), ltest_read(t));
+  ASSERT_EQ("qux", ltest_read(t));
+  ASSERT_EQ("EOF", ltest_read(t));
+  ASSERT(ltest_dropped_bytes(t) == 0);
+}
+
+static void
+test_log_bad_compression_type(ltest_t *t) {
+  ldb_writer_compress(&t->writer, LDB_SNAPPY_COMPRESSION);
+
+  ltest_write(t, ltest_big_string(t, "bar", 10000));
+
+  ASSERT(t->dst.data[6] == LDB_TYPE_ZFULL);
+
+  ltest_set_byte(t, LDB_HEADER_SIZE, 100);
+  ltest_fix_checksum(t, 0, ltest_written_bytes(t) - LDB_HEADER_SIZE);
+
+  ASSERT_EQ("EOF", ltest_read(t));
+  ASSERT(ltest_dropped_bytes(t) == ltest_written_bytes(t) - LDB_HEADER_SIZE);
+  ASSERT(t->status == LDB_CORRUPTION);
+}
+
+static void
+test_log_recycled(ltest_t *t) {
+  ldb_buffer_t old;
+
+  ldb_writer_recyclable(&t->writer, 1);
+
+  ltest_write(t, "foo");
+  ltest_write(t, ltest_big_string(t, "bar", 3 * LDB_BLOCK_SIZE / 2));
+  ltest_write(t, "baz");
+
+  ldb_buffer_init(&old);
+  ldb_buffer_copy(&old, &t->dst);
+
+  /* Reuse the file for log 2, overwriting part of it. */
+  ldb_buffer_reset(&t->dst);
+  ldb_writer_init(&t->writer, NULL, 0);
+  ldb_writer_recyclable(&t->writer, 2);
+  t->writer.dst = &t->dst;
+
+  ltest_write(t, ltest_big_string(t, "qux", 1000));
+  ltest_write(t, "quux");
+
+  ASSERT(t->dst.size < old.size);
+
+  ldb_buffer_append(&t->dst, old.data + t->dst.size, old.size - t->dst.size);
+
+  ldb_reader_recyclable(&t->reader, 2);
+
+  ASSERT_EQ(ltest_big_string(t, "qux", 1000), ltest_read(t));
+  ASSERT_EQ("quux", ltest_read(t));
+  ASSERT_EQ("EOF", ltest_read(t));
+  ASSERT(ltest_dropped_bytes(t) == 0);
+  ASSERT(t->status == LDB_OK);
+
+  ldb_buffer_clear(&old);
+}
+
+static void
+test_log_recycled_torn_record(ltest_t *t) {
+  ldb_buffer_t old;
+
+  ldb_writer_recyclable(&t->writer, 1);
+
+  ltest_write(t, ltest_big_string(t, "foo", 1000));
+
+  ldb_buffer_init(&old);
+  ldb_buffer_copy(&old, &t->dst);
+
+  ldb_buffer_reset(&t->dst);
+  ldb_writer_init(&t->writer, NULL, 0);
+  ldb_writer_recyclable(&t->writer, 2);
+  t->writer.dst = &t->dst;
+
+  ltest_write(t, "bar");
+
+  /* The remains of log 1's record follow. */
+  ldb_buffer_append(&t->dst, old.data + t->dst.size, old.size - t->dst.size);
+
+  ldb_reader_recyclable(&t->reader, 2);
+
+  ASSERT_EQ("bar", ltest_read(t));
+  ASSERT_EQ("EOF", ltest_read(t));
+  ASSERT(ltest_dropped_bytes(t) == 0);
+
+  ldb_buffer_clear(&old);
+}
+
+static void
+test_log_large_blocks(ltest_t *t) {
+  const char *big = ltest_big_string(t, "foo", 300000);
+
+  ldb_writer_block_size(&t->writer, 1 << 20);
+  ldb_reader_block_size(&t->reader, 1 << 20);
+
+  ltest_write(t, big);
+  ltest_write(t, "bar");
+
+  /* Five fragments of at most 64kb, no padding. */
+  ASSERT(ltest_written_bytes(t) == 300000 + 3 + 6 * LDB_HEADER_SIZE);
+
+  ASSERT_EQ(big, ltest_read(t));
+  ASSERT_EQ("bar", ltest_read(t));
+  ASSERT_EQ("EOF", ltest_read(t));
+  ASSERT(ltest_dropped_bytes(t) == 0);
+}
+
 static void
 test_log_read_start(ltest_t *t) {
   ltest_check_initial_offset_record(t, 0, 0);
@@ -764,6 +933,12 @@ main(void) {
     test_log_partial_last_is_ignored,
     test_log_skip_into_multi_record,
     test_log_error_joins_records,
+    test_log_compressed,
+    test_log_add_records,
+    test_log_bad_compression_type,
+    test_log_recycled,
+    test_log_recycled_torn_record,
+    test_log_large_blocks,
     test_log_read_start,
     test_log_read_second_one_off,
     test_log_read_second_ten_thousand,
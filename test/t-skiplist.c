@@ -27,6 +27,7 @@
 #include "util/testutil.h"
 #include "util/thread_pool.h"
 
+#include "dbformat.h"
 #include "skiplist.h"
 
 /*
@@ -616,8 +617,291 @@ test_skip_concurrent(ldb_pool_t *pool, int run) {
   }
 }
 
+/* Several writers insert disjoint keys at once. */
+typedef struct inserter_s {
+  skiplist_t *list;
+  int offset;
+  int stride;
+  int count;
+} inserter_t;
+
+static void
+concurrent_inserter(void *arg) {
+  inserter_t *ins = (inserter_t *)arg;
+  int i;
+
+  for (i = 0; i < ins->count; i++) {
+    uint64_t key = (uint64_t)i * ins->stride + ins->offset;
+    uint8_t *buf;
+
+    ldb_mutex_lock(ins->list->mutex);
+
+    buf = ldb_arena_alloc(ins->list->arena, 9);
+
+    ldb_mutex_unlock(ins->list->mutex);
+
+    ldb_skiplist_insert_concurrently(ins->list, encode_key(key, buf));
+  }
+}
+
+static void
+test_skip_concurrent_insert(ldb_pool_t *pool, int threads) {
+  const int N = 20000;
+  inserter_t ins[8];
+  ldb_arena_t arena;
+  ldb_mutex_t mutex;
+  skiplist_t list;
+  skipiter_t iter;
+  uint64_t expect;
+  int i;
+
+  ASSERT(threads <= 8);
+
+  ldb_arena_init(&arena);
+  ldb_mutex_init(&mutex);
+
+  skiplist_init(&list, &integer_comparator, &arena, &mutex);
+
+  for (i = 0; i < threads; i++) {
+    ins[i].list = &list;
+    ins[i].offset = i;
+    ins[i].stride = threads;
+    ins[i].count = N;
+
+    ldb_pool_schedule(pool, &concurrent_inserter, &ins[i]);
+  }
+
+  ldb_pool_wait(pool);
+
+  skipiter_init(&iter, &list);
+  skipiter_first(&iter);
+
+  for (expect = 0; expect < (uint64_t)N * threads; expect++) {
+    ASSERT(skipiter_valid(&iter));
+    ASSERT(skipiter_key(&iter) == expect);
+    skipiter_next(&iter);
+  }
+
+  ASSERT(!skipiter_valid(&iter));
+
+  for (i = 0; i < 100; i++)
+    ASSERT(skiplist_contains(&list, (uint64_t)i * 97));
+
+  ldb_mutex_destroy(&mutex);
+  ldb_arena_clear(&arena);
+}
+
 #endif /* _WIN32 || LDB_PTHREAD */
 
+/*
+ * Sequential Inserts
+ */
+
+static void
+test_skip_sequential(void) {
+  const int N = 1000;
+  ldb_arena_t arena;
+  ldb_mutex_t mutex;
+  skiplist_t list;
+  skipiter_t iter;
+  uint8_t buf[9];
+  int i;
+
+  ldb_arena_init(&arena);
+  ldb_mutex_init(&mutex);
+
+  skiplist_init(&list, &integer_comparator, &arena, &mutex);
+
+  /* Ascending runs (even keys) which restart below the previous run,
+     a descending run, and concurrent inserts in between, so that each
+     insert either extends the last one or has to search. */
+  for (i = 0; i < N; i++)
+    skiplist_insert(&list, (uint64_t)(i % 250) * 8 + (i / 250) * 2);
+
+  for (i = N - 1; i >= 0; i--)
+    skiplist_insert(&list, (uint64_t)N * 5 + i);
+
+  for (i = 0; i < N; i++) {
+    uint8_t *key = ldb_arena_alloc(&arena, 9);
+
+    if (i % 100 < 50) {
+      encode_key((uint64_t)i * 2 + 1, key);
+      ldb_skiplist_insert_concurrently(&list, key);
+    } else {
+      skiplist_insert(&list, (uint64_t)i * 2 + 1);
+    }
+  }
+
+  /* Concurrent inserts between the last insert and its predecessors. */
+  skiplist_insert(&list, (uint64_t)N * 8);
+
+  for (i = 1; i < N; i += 2) {
+    uint8_t *key = ldb_arena_alloc(&arena, 9);
+
+    encode_key((uint64_t)N * 6 + i, key);
+
+    ldb_skiplist_insert_concurrently(&list, key);
+  }
+
+  for (i = 1; i < N; i++)
+    skiplist_insert(&list, (uint64_t)N * 8 + i);
+
+  skipiter_init(&iter, &list);
+  skipiter_first(&iter);
+
+  for (i = 0; i < N * 9; i++) {
+    if (i >= N * 2 && i < N * 5)
+      continue;
+
+    if (i >= N * 6 && i < N * 8 && (i >= N * 7 || !(i & 1)))
+      continue;
+
+    ASSERT(skipiter_valid(&iter));
+    ASSERT(skipiter_key(&iter) == (uint64_t)i);
+    ASSERT(skiplist_contains(&list, i));
+
+    skipiter_next(&iter);
+  }
+
+  ASSERT(!skipiter_valid(&iter));
+
+  /* Backward steps search from the head on every level. */
+  skipiter_last(&iter);
+
+  for (i = N * 9 - 1; i >= 0; i--) {
+    if (i >= N * 2 && i < N * 5)
+      continue;
+
+    if (i >= N * 6 && i < N * 8 && (i >= N * 7 || !(i & 1)))
+      continue;
+
+    ASSERT(skipiter_valid(&iter));
+    ASSERT(skipiter_key(&iter) == (uint64_t)i);
+
+    skipiter_prev(&iter);
+  }
+
+  ASSERT(!skipiter_valid(&iter));
+
+  /* Searches go through the upper levels as well. */
+  for (i = 0; i < N * 9; i += 7) {
+    int found = i < N * 2
+             || (i >= N * 5 && i < N * 6)
+             || (i >= N * 6 && i < N * 7 && (i & 1))
+             || i >= N * 8;
+
+    ASSERT(skiplist_contains(&list, i) == found);
+
+    ldb_skipiter_seek(&iter, encode_key(i, buf));
+
+    if (found) {
+      ASSERT(skipiter_valid(&iter));
+      ASSERT(skipiter_key(&iter) == (uint64_t)i);
+    }
+  }
+
+  ldb_mutex_destroy(&mutex);
+  ldb_arena_clear(&arena);
+}
+
+/*
+ * Key Prefixes
+ */
+
+/* Encode an internal key for a random user key made of a few bytes
+   which include the zero byte, so that short keys often share their
+   padded prefixes with longer ones. */
+static uint8_t *
+random_ikey(ldb_arena_t *arena, ldb_rand_t *rnd, uint64_t sequence) {
+  static const uint8_t alphabet[] = { 0x00, 0x01, 'a', 0xff };
+  size_t len = ldb_rand_uniform(rnd, 13);
+  uint8_t *buf = ldb_arena_alloc(arena, 1 + len + 8);
+  size_t i;
+
+  buf[0] = len + 8;
+
+  for (i = 0; i < len; i++)
+    buf[1 + i] = alphabet[ldb_rand_uniform(rnd, sizeof(alphabet))];
+
+  ldb_fixed64_write(buf + 1 + len, (sequence << 8) | LDB_TYPE_VALUE);
+
+  return buf;
+}
+
+static void
+test_skip_prefix(void) {
+  const int N = 3000;
+  ldb_skiplist_t plain, prefixed;
+  ldb_skipiter_t x, y;
+  ldb_comparator_t icmp;
+  ldb_arena_t arena;
+  ldb_mutex_t mutex;
+  ldb_rand_t rnd;
+  int i;
+
+  ldb_ikc_init(&icmp, ldb_bytewise_comparator);
+  ldb_arena_init(&arena);
+  ldb_mutex_init(&mutex);
+  ldb_rand_init(&rnd, 301);
+
+  ldb_skiplist_init(&plain, &icmp, &arena, &mutex);
+  ldb_skiplist_init(&prefixed, &icmp, &arena, &mutex);
+  ldb_skiplist_use_prefix(&prefixed);
+
+  for (i = 0; i < N; i++) {
+    uint8_t *key = random_ikey(&arena, &rnd, i + 1);
+
+    ldb_skiplist_insert(&plain, key);
+    ldb_skiplist_insert(&prefixed, key);
+  }
+
+  /* Both lists hold the same keys in the same order. */
+  ldb_skipiter_init(&x, &plain);
+  ldb_skipiter_init(&y, &prefixed);
+
+  ldb_skipiter_first(&x);
+  ldb_skipiter_first(&y);
+
+  for (i = 0; i < N; i++) {
+    ASSERT(ldb_skipiter_valid(&x));
+    ASSERT(ldb_skipiter_valid(&y));
+    ASSERT(ldb_skipiter_key(&x) == ldb_skipiter_key(&y));
+    ASSERT(ldb_skiplist_contains(&prefixed, ldb_skipiter_key(&x)));
+
+    ldb_skipiter_next(&x);
+    ldb_skipiter_next(&y);
+  }
+
+  ASSERT(!ldb_skipiter_valid(&x));
+  ASSERT(!ldb_skipiter_valid(&y));
+
+  /* Seeks (and backward steps) to keys which are not in the lists. */
+  for (i = 0; i < N; i++) {
+    uint8_t *key = random_ikey(&arena, &rnd, ldb_rand_uniform(&rnd, N + 2));
+
+    ldb_skipiter_seek(&x, key);
+    ldb_skipiter_seek(&y, key);
+
+    ASSERT(ldb_skipiter_valid(&x) == ldb_skipiter_valid(&y));
+
+    if (!ldb_skipiter_valid(&x))
+      continue;
+
+    ASSERT(ldb_skipiter_key(&x) == ldb_skipiter_key(&y));
+
+    ldb_skipiter_prev(&x);
+    ldb_skipiter_prev(&y);
+
+    ASSERT(ldb_skipiter_valid(&x) == ldb_skipiter_valid(&y));
+
+    if (ldb_skipiter_valid(&x))
+      ASSERT(ldb_skipiter_key(&x) == ldb_skipiter_key(&y));
+  }
+
+  ldb_mutex_destroy(&mutex);
+  ldb_arena_clear(&arena);
+}
+
 /*
  * Execute
  */
@@ -627,6 +911,8 @@ main(void) {
   test_skip_empty();
   test_skip_insert_and_lookup();
   test_skip_concurrent_without_threads();
+  test_skip_sequential();
+  test_skip_prefix();
 
 #if defined(_WIN32) || defined(LDB_PTHREAD)
   {
@@ -640,6 +926,15 @@ main(void) {
 
     ldb_pool_destroy(pool);
   }
+
+  {
+    ldb_pool_t *pool = ldb_pool_create(4);
+
+    test_skip_concurrent_insert(pool, 2);
+    test_skip_concurrent_insert(pool, 4);
+
+    ldb_pool_destroy(pool);
+  }
 #endif /* _WIN32 || LDB_PTHREAD */
 
   return 0;
@@ -15,6 +15,7 @@
 #include <string.h>
 
 #include "util/internal.h"
+#include "util/random.h"
 #include "util/snappy.h"
 #include "util/testutil.h"
 
@@ -98,10 +99,48 @@ test_snappy_3(void) {
   ldb_free(dec);
 }
 
+static void
+test_snappy_patterns(void) {
+  /* Short-period runs exercise the overlapping copies, and the
+     varying sizes the end-of-output fallbacks. */
+  uint8_t data[4096], dec[4096], enc[8192];
+  uint32_t period = 1;
+  ldb_rand_t rnd;
+  size_t i, j;
+
+  ldb_rand_init(&rnd, 301);
+
+  for (i = 0; i < 500; i++) {
+    size_t size = ldb_rand_uniform(&rnd, sizeof(data) + 1);
+    size_t encsize, decsize;
+
+    for (j = 0; j < size; j++) {
+      if (j % 64 == 0)
+        period = 1 + ldb_rand_uniform(&rnd, 20);
+
+      if (j >= period && ldb_rand_uniform(&rnd, 16) != 0)
+        data[j] = data[j - period];
+      else
+        data[j] = ldb_rand_uniform(&rnd, 256);
+    }
+
+    ASSERT(snappy_encode_size(&encsize, size));
+    ASSERT(encsize <= sizeof(enc));
+
+    encsize = snappy_encode(enc, data, size);
+
+    ASSERT(snappy_decode_size(&decsize, enc, encsize));
+    ASSERT(decsize == size);
+    ASSERT(snappy_decode(dec, enc, encsize));
+    ASSERT(memcmp(dec, data, size) == 0);
+  }
+}
+
 int
 main(void) {
   test_snappy_1();
   test_snappy_2();
   test_snappy_3();
+  test_snappy_patterns();
   return 0;
 }
@@ -20,6 +20,7 @@
 #include "util/env.h"
 #include "util/internal.h"
 #include "util/options.h"
+#include "util/prefix.h"
 #include "util/random.h"
 #include "util/rbt.h"
 #include "util/slice.h"
@@ -32,6 +33,7 @@
 #include "table/block.h"
 #include "table/format.h"
 #include "table/iterator.h"
+#include "table/merger.h"
 #include "table/table_builder.h"
 #include "table/table.h"
 
@@ -369,6 +371,7 @@ blockctor_finish(blockctor_t *c,
   contents.data = c->data;
   contents.cachable = 0;
   contents.heap_allocated = 0;
+  contents.verified = 0;
 
   c->block = ldb_block_create(&contents);
 
@@ -615,6 +618,7 @@ conviter_create(ldb_iter_t *it) {
 
 typedef struct memctor_s {
   ldb_comparator_t icmp;
+  ldb_prefix_t *prefix;
   ldb_memtable_t *mt;
 } memctor_t;
 
@@ -622,6 +626,7 @@ static void
 memctor_init(memctor_t *c, const ldb_comparator_t *cmp) {
   ldb_ikc_init(&c->icmp, cmp);
 
+  c->prefix = ldb_prefix_create_fixed(1);
   c->mt = ldb_memtable_create(&c->icmp);
 
   ldb_memtable_ref(c->mt);
@@ -630,6 +635,7 @@ memctor_init(memctor_t *c, const ldb_comparator_t *cmp) {
 static void
 memctor_clear(memctor_t *c) {
   ldb_memtable_unref(c->mt);
+  ldb_prefix_destroy(c->prefix);
 }
 
 static int
@@ -639,11 +645,9 @@ memctor_finish(memctor_t *c,
   rb_iter_t it;
   int seq = 1;
 
-  (void)options;
-
   ldb_memtable_unref(c->mt);
 
-  c->mt = ldb_memtable_create(&c->icmp);
+  c->mt = ldb_memtable_create_ex(&c->icmp, options, c->prefix, NULL);
 
   ldb_memtable_ref(c->mt);
 
@@ -788,30 +792,63 @@ struct test_args {
   enum test_type type;
   int reverse_compare;
   int restart_interval;
+  int partitioned;
+  int hash_index;
+  enum ldb_memtable_rep memtable_rep;
+  int compression_threads;
+  int prefixes;
+  int split;
+  int cuckoo;
 };
 
 static const struct test_args test_arg_list[] = {
-  {TABLE_TEST, 0, 16},
-  {TABLE_TEST, 0, 1},
-  {TABLE_TEST, 0, 1024},
-  {TABLE_TEST, 1, 16},
-  {TABLE_TEST, 1, 1},
-  {TABLE_TEST, 1, 1024},
-
-  {BLOCK_TEST, 0, 16},
-  {BLOCK_TEST, 0, 1},
-  {BLOCK_TEST, 0, 1024},
-  {BLOCK_TEST, 1, 16},
-  {BLOCK_TEST, 1, 1},
-  {BLOCK_TEST, 1, 1024},
+  {TABLE_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 0, 1, 0, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 0, 1024, 0, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 1, 16, 0, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 1, 1, 0, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 1, 1024, 0, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 0, 16, 1, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 1, 16, 1, 0, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 0, 16, 0, 1, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 1, 4, 0, 1, 0, 1, 0, 0, 0},
+  {TABLE_TEST, 0, 16, 0, 0, 0, 4, 0, 0, 0},
+  {TABLE_TEST, 1, 16, 1, 0, 0, 4, 0, 0, 0},
+  {TABLE_TEST, 0, 16, 0, 0, 0, 1, 1, 0, 0},
+  {TABLE_TEST, 0, 4, 1, 1, 0, 1, 1, 0, 0},
+  {TABLE_TEST, 0, 16, 0, 0, 0, 1, 0, 1, 0},
+  {TABLE_TEST, 1, 1, 1, 1, 0, 1, 1, 1, 0},
+  {TABLE_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 1},
+  {TABLE_TEST, 1, 16, 0, 0, 0, 1, 0, 0, 1},
+
+  {BLOCK_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 0, 1, 0, 0, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 0, 1024, 0, 0, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 1, 16, 0, 0, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 1, 1, 0, 0, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 1, 1024, 0, 0, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 0, 16, 0, 1, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 1, 1, 0, 1, 0, 1, 0, 0, 0},
+  {BLOCK_TEST, 0, 16, 0, 0, 0, 1, 1, 0, 0},
+  {BLOCK_TEST, 0, 1, 0, 1, 0, 1, 1, 0, 0},
+  {BLOCK_TEST, 1, 16, 0, 0, 0, 1, 1, 0, 0},
+  {BLOCK_TEST, 0, 16, 0, 0, 0, 1, 0, 1, 0},
+  {BLOCK_TEST, 0, 1, 0, 1, 0, 1, 1, 1, 0},
+  {BLOCK_TEST, 1, 1024, 0, 0, 0, 1, 0, 1, 0},
 
   /* Restart interval does not matter for memtables. */
-  {MEMTABLE_TEST, 0, 16},
-  {MEMTABLE_TEST, 1, 16},
+  {MEMTABLE_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 0},
+  {MEMTABLE_TEST, 1, 16, 0, 0, 0, 1, 0, 0, 0},
+  {MEMTABLE_TEST, 0, 16, 0, 0, LDB_MEMTABLE_VECTOR, 1, 0, 0, 0},
+  {MEMTABLE_TEST, 1, 16, 0, 0, LDB_MEMTABLE_VECTOR, 1, 0, 0, 0},
+  {MEMTABLE_TEST, 0, 16, 0, 0, LDB_MEMTABLE_HASH_SKIPLIST, 1, 0, 0, 0},
+  {MEMTABLE_TEST, 1, 16, 0, 0, LDB_MEMTABLE_HASH_SKIPLIST, 1, 0, 0, 0},
 
   /* Do not bother with restart interval variations for DB. */
-  {DB_TEST, 0, 16},
-  {DB_TEST, 1, 16}
+  {DB_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 0},
+  {DB_TEST, 1, 16, 0, 0, 0, 1, 0, 0, 0},
+  {DB_TEST, 0, 16, 0, 0, 0, 1, 0, 1, 0},
+  {DB_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 1}
 };
 
 #define num_test_args ((int)lengthof(test_arg_list))
@@ -850,6 +887,13 @@ harness_reset(harness_t *h, const struct test_args *args) {
   /* Use shorter block size for tests to exercise
      block boundary conditions more. */
   h->options.block_size = 256;
+  h->options.partition_index = args->partitioned;
+  h->options.data_block_hash_index = args->hash_index;
+  h->options.memtable_rep = args->memtable_rep;
+  h->options.compression_threads = args->compression_threads;
+  h->options.restart_key_prefixes = args->prefixes;
+  h->options.separate_block_values = args->split;
+  h->options.cuckoo_table = args->cuckoo;
 
   if (args->reverse_compare)
     h->options.comparator = &reverse_comparator;
@@ -1144,6 +1188,7 @@ test_zero_restart_points_in_block(void) {
   contents.data = ldb_slice(data, sizeof(data));
   contents.cachable = 0;
   contents.heap_allocated = 0;
+  contents.verified = 0;
 
   ldb_block_init(&block, &contents);
 
@@ -1166,6 +1211,311 @@ test_zero_restart_points_in_block(void) {
 }
 
 /* Test the empty key. */
+/* Point lookups through a block's hash index must agree with a
+   regular seek, including for user keys spanning restart points. */
+static void
+test_block_hash_index(void) {
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_comparator_t icmp;
+  ldb_contents_t contents;
+  ldb_blockgen_t bb;
+  ldb_block_t block;
+  ldb_iter_t *iter;
+  ldb_slice_t value;
+  ldb_buffer_t ikey;
+  char ukey[32];
+  int i, count;
+
+  ldb_ikc_init(&icmp, ldb_bytewise_comparator);
+
+  options.comparator = &icmp;
+  options.block_restart_interval = 4;
+  options.data_block_hash_index = 1;
+
+  ldb_blockgen_init(&bb, &options);
+  ldb_buffer_init(&ikey);
+
+  value = ldb_string("v");
+
+  for (i = 0; i < 100; i++) {
+    ldb_slice_t key;
+    int seq;
+
+    sprintf(ukey, "k%03d", i * 2);
+
+    key = ldb_string(ukey);
+
+    for (seq = 3; seq >= 1; seq--) {
+      ldb_ikey_set(&ikey, &key, seq, LDB_TYPE_VALUE);
+      ldb_blockgen_add(&bb, &ikey, &value);
+    }
+  }
+
+  contents.data = ldb_blockgen_finish(&bb);
+  contents.cachable = 0;
+  contents.heap_allocated = 0;
+  contents.verified = 0;
+
+  ldb_block_init(&block, &contents);
+
+  ASSERT(block.buckets != NULL);
+  ASSERT(block.num_restarts == 75);
+
+  iter = ldb_blockiter_create(&block, &icmp);
+
+  count = 0;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter))
+    count++;
+
+  ASSERT(count == 300);
+
+  for (i = 0; i < 200; i++) {
+    ldb_slice_t key;
+
+    sprintf(ukey, "k%03d", i);
+
+    key = ldb_string(ukey);
+
+    ldb_ikey_set(&ikey, &key, 2, LDB_VALTYPE_SEEK);
+    ldb_blockiter_seek_get(iter, &ikey);
+
+    ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+    if (i & 1) {
+      if (ldb_iter_valid(iter)) {
+        ldb_slice_t found = ldb_iter_key(iter);
+        ldb_slice_t user_key = ldb_extract_user_key(&found);
+
+        ASSERT(!ldb_slice_equal(&user_key, &key));
+      }
+    } else {
+      ldb_slice_t found;
+
+      ASSERT(ldb_iter_valid(iter));
+
+      found = ldb_iter_key(iter);
+
+      ldb_ikey_set(&ikey, &key, 2, LDB_TYPE_VALUE);
+
+      ASSERT(ldb_compare(&icmp, &found, &ikey) == 0);
+    }
+  }
+
+  ldb_iter_destroy(iter);
+  ldb_buffer_clear(&ikey);
+  ldb_blockgen_clear(&bb);
+}
+
+static void
+test_block_restart_prefixes(void) {
+  static const char *prefixes[] = {"", "a", "ab", "abcdefg", "abcdefgh",
+                                   "abcdefghij", "b\xff", "zz"};
+  ldb_dbopt_t options[2];
+  ldb_contents_t contents;
+  ldb_blockgen_t bb[2];
+  ldb_block_t block[2];
+  ldb_iter_t *iter[2];
+  ldb_comparator_t icmp;
+  ldb_slice_t value;
+  ldb_buffer_t ikey;
+  char ukey[32];
+  size_t i;
+  int j, k;
+
+  ldb_ikc_init(&icmp, ldb_bytewise_comparator);
+  ldb_buffer_init(&ikey);
+
+  value = ldb_string("v");
+
+  /* The same keys, with and without prefixes. */
+  for (k = 0; k < 2; k++) {
+    options[k] = *ldb_dbopt_default;
+    options[k].comparator = &icmp;
+    options[k].block_restart_interval = 3;
+    options[k].restart_key_prefixes = k;
+
+    ldb_blockgen_init(&bb[k], &options[k]);
+
+    for (i = 0; i < lengthof(prefixes); i++) {
+      for (j = 0; j < 20; j += 2) {
+        ldb_slice_t key;
+
+        sprintf(ukey, "%s%02d", prefixes[i], j);
+
+        key = ldb_string(ukey);
+
+        ldb_ikey_set(&ikey, &key, 2, LDB_TYPE_VALUE);
+        ldb_blockgen_add(&bb[k], &ikey, &value);
+
+        ldb_ikey_set(&ikey, &key, 1, LDB_TYPE_VALUE);
+        ldb_blockgen_add(&bb[k], &ikey, &value);
+      }
+    }
+
+    contents.data = ldb_blockgen_finish(&bb[k]);
+    contents.cachable = 0;
+    contents.heap_allocated = 0;
+    contents.verified = 0;
+
+    ldb_block_init(&block[k], &contents);
+
+    iter[k] = ldb_blockiter_create(&block[k], &icmp);
+  }
+
+  ASSERT(block[0].prefixes == NULL);
+  ASSERT(block[1].prefixes != NULL);
+  ASSERT(block[0].num_restarts == block[1].num_restarts);
+
+  for (i = 0; i < lengthof(prefixes); i++) {
+    for (j = 0; j < 21; j++) {
+      int seq;
+
+      for (seq = 0; seq <= 3; seq++) {
+        ldb_slice_t key;
+
+        sprintf(ukey, "%s%02d", prefixes[i], j);
+
+        key = ldb_string(ukey);
+
+        ldb_ikey_set(&ikey, &key, seq, LDB_VALTYPE_SEEK);
+
+        ldb_iter_seek(iter[0], &ikey);
+        ldb_iter_seek(iter[1], &ikey);
+
+        ASSERT(ldb_iter_valid(iter[0]) == ldb_iter_valid(iter[1]));
+
+        if (ldb_iter_valid(iter[0])) {
+          ldb_slice_t x = ldb_iter_key(iter[0]);
+          ldb_slice_t y = ldb_iter_key(iter[1]);
+
+          ASSERT(ldb_slice_equal(&x, &y));
+        }
+      }
+    }
+  }
+
+  for (k = 0; k < 2; k++) {
+    ldb_iter_destroy(iter[k]);
+    ldb_blockgen_clear(&bb[k]);
+  }
+
+  ldb_buffer_clear(&ikey);
+}
+
+/* Entry headers with value lengths on either side of the one and two
+   byte varint limits, under one-byte and multi-byte key lengths. */
+static void
+test_block_value_lengths(void) {
+  static const size_t lengths[] = {0, 1, 127, 128, 129,
+                                   16383, 16384, 16385};
+  static const char *formats[] = {
+    "a%02d",      /* One-byte key lengths. */
+    "b%s%02d",    /* Long shared prefix, short suffix. */
+    "c%02d%s"     /* Long suffix. */
+  };
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_buffer_t keys[24], vals[24];
+  ldb_contents_t contents;
+  ldb_blockgen_t bb;
+  ldb_block_t block;
+  ldb_iter_t *iter;
+  char pad[201];
+  char ukey[256];
+  int i, j, n;
+
+  memset(pad, 'x', sizeof(pad) - 1);
+
+  pad[sizeof(pad) - 1] = '\0';
+
+  options.comparator = ldb_bytewise_comparator;
+  options.block_restart_interval = 4;
+
+  ldb_blockgen_init(&bb, &options);
+
+  n = 0;
+
+  for (i = 0; i < (int)lengthof(formats); i++) {
+    for (j = 0; j < (int)lengthof(lengths); j++) {
+      if (i == 0)
+        sprintf(ukey, formats[i], j);
+      else if (i == 1)
+        sprintf(ukey, formats[i], pad, j);
+      else
+        sprintf(ukey, formats[i], j, pad);
+
+      ldb_buffer_init(&keys[n]);
+      ldb_buffer_init(&vals[n]);
+
+      ldb_buffer_string(&keys[n], ukey);
+
+      if (lengths[j] > 0)
+        memset(ldb_buffer_pad(&vals[n], lengths[j]), 'a' + n, lengths[j]);
+
+      ldb_blockgen_add(&bb, &keys[n], &vals[n]);
+
+      n++;
+    }
+  }
+
+  contents.data = ldb_blockgen_finish(&bb);
+  contents.cachable = 0;
+  contents.heap_allocated = 0;
+  contents.verified = 0;
+
+  ldb_block_init(&block, &contents);
+
+  iter = ldb_blockiter_create(&block, ldb_bytewise_comparator);
+
+  for (i = 0, ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+
+    ASSERT(i < n);
+    ASSERT(ldb_slice_equal(&key, &keys[i]));
+    ASSERT(ldb_slice_equal(&val, &vals[i]));
+
+    i++;
+  }
+
+  ASSERT(i == n);
+
+  for (i = n, ldb_iter_last(iter); ldb_iter_valid(iter); ldb_iter_prev(iter)) {
+    ldb_slice_t val = ldb_iter_value(iter);
+
+    ASSERT(i > 0);
+    ASSERT(ldb_slice_equal(&val, &vals[i - 1]));
+
+    i--;
+  }
+
+  ASSERT(i == 0);
+
+  for (i = 0; i < n; i++) {
+    ldb_slice_t key, val;
+
+    ldb_iter_seek(iter, &keys[i]);
+
+    ASSERT(ldb_iter_valid(iter));
+
+    key = ldb_iter_key(iter);
+    val = ldb_iter_value(iter);
+
+    ASSERT(ldb_slice_equal(&key, &keys[i]));
+    ASSERT(ldb_slice_equal(&val, &vals[i]));
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+  ldb_iter_destroy(iter);
+  ldb_blockgen_clear(&bb);
+
+  for (i = 0; i < n; i++) {
+    ldb_buffer_clear(&keys[i]);
+    ldb_buffer_clear(&vals[i]);
+  }
+}
+
 static void
 test_simple_empty_key(harness_t *h) {
   ldb_rand_t rnd;
@@ -1258,7 +1608,7 @@ test_randomized(harness_t *h) {
 
 static void
 test_randomized_long_db(harness_t *h) {
-  struct test_args args = {DB_TEST, 0, 16};
+  struct test_args args = {DB_TEST, 0, 16, 0, 0, 0, 1, 0, 0, 0};
   int num_entries = 100000;
   ldb_buffer_t key, val;
   ldb_rand_t rnd;
@@ -1365,6 +1715,42 @@ test_memtable_simple(void) {
   ldb_batch_clear(&batch);
 }
 
+/* A new memtable with a bloom filter takes only the filter's
+   bytes (rounded up to a whole line) over an empty one. */
+static void
+test_memtable_bloom_usage(void) {
+  static const size_t sizes[] = { 64 << 10, 1 << 20 };
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_memtable_t *memtable;
+  ldb_comparator_t icmp;
+  size_t base, usage, i;
+
+  ldb_ikc_init(&icmp, ldb_bytewise_comparator);
+
+  memtable = ldb_memtable_create(&icmp);
+
+  ldb_memtable_ref(memtable);
+
+  base = ldb_memtable_usage(memtable);
+
+  ldb_memtable_unref(memtable);
+
+  for (i = 0; i < lengthof(sizes); i++) {
+    options.memtable_bloom_size = sizes[i];
+
+    memtable = ldb_memtable_create_ex(&icmp, &options, NULL, NULL);
+
+    ldb_memtable_ref(memtable);
+
+    usage = ldb_memtable_usage(memtable) - base;
+
+    ASSERT(usage >= sizes[i]);
+    ASSERT(usage <= sizes[i] + 256);
+
+    ldb_memtable_unref(memtable);
+  }
+}
+
 static int
 check_range(uint64_t val, uint64_t low, uint64_t high) {
   int result = (val >= low) && (val <= high);
@@ -1487,6 +1873,565 @@ test_approximate_offset_compressed(void) {
   ctor_destroy(c);
 }
 
+static void
+test_compression_type(enum ldb_compression type) {
+  ctor_t *c = tablector_create(ldb_bytewise_comparator);
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_buffer_t vals[20];
+  ldb_vector_t keys;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  char kbuf[16];
+  int i;
+
+  ldb_rand_init(&rnd, 301);
+  ldb_vector_init(&keys);
+
+  for (i = 0; i < 20; i++) {
+    ldb_slice_t key;
+
+    sprintf(kbuf, "k%02d", i);
+
+    key = ldb_string(kbuf);
+
+    ldb_buffer_init(&vals[i]);
+    ldb_compressible_string(&vals[i], &rnd, 0.25, 1000 + i * 100);
+
+    ctor_add(c, &key, &vals[i]);
+  }
+
+  options.block_size = 1024;
+  options.compression = type;
+  options.comparator = ldb_bytewise_comparator;
+
+  ctor_finish(c, &options, &keys);
+
+  /* Blocks are stored uncompressed if the type is not compiled in,
+     so the contents must round-trip either way. */
+  iter = tablector_iterator(c->ptr);
+  i = 0;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+    ldb_slice_t expect;
+
+    sprintf(kbuf, "k%02d", i);
+
+    expect = ldb_string(kbuf);
+
+    ASSERT(i < 20);
+    ASSERT(ldb_slice_equal(&key, &expect));
+    ASSERT(ldb_slice_equal(&val, &vals[i]));
+
+    i++;
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+  ASSERT(i == 20);
+
+  ldb_iter_destroy(iter);
+
+  for (i = 0; i < 20; i++)
+    ldb_buffer_clear(&vals[i]);
+
+  ldb_vector_clear(&keys);
+  ctor_destroy(c);
+}
+
+/* Build a table of incompressible values followed by compressible
+   ones, returning its size. */
+static uint64_t
+adaptive_table_size(int adaptive, int threads) {
+  ctor_t *c = tablector_create(ldb_bytewise_comparator);
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_buffer_t vals[40];
+  ldb_vector_t keys;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  uint64_t size;
+  char kbuf[16];
+  int i;
+
+  ldb_rand_init(&rnd, 301);
+  ldb_vector_init(&keys);
+
+  for (i = 0; i < 40; i++) {
+    ldb_slice_t key;
+
+    sprintf(kbuf, "k%02d", i);
+
+    key = ldb_string(kbuf);
+
+    ldb_buffer_init(&vals[i]);
+
+    if (i < 10)
+      ldb_random_string(&vals[i], &rnd, 1000);
+    else
+      ldb_compressible_string(&vals[i], &rnd, 0.25, 1000);
+
+    ctor_add(c, &key, &vals[i]);
+  }
+
+  options.block_size = 1024;
+  options.compression = LDB_SNAPPY_COMPRESSION;
+  options.comparator = ldb_bytewise_comparator;
+  options.compression_threads = threads;
+  options.adaptive_compression = adaptive;
+
+  ctor_finish(c, &options, &keys);
+
+  iter = tablector_iterator(c->ptr);
+  i = 0;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t val = ldb_iter_value(iter);
+
+    ASSERT(i < 40);
+    ASSERT(ldb_slice_equal(&val, &vals[i]));
+
+    i++;
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+  ASSERT(i == 40);
+
+  size = ctor_approximate_offset(c, "xyz");
+
+  ldb_iter_destroy(iter);
+
+  for (i = 0; i < 40; i++)
+    ldb_buffer_clear(&vals[i]);
+
+  ldb_vector_clear(&keys);
+  ctor_destroy(c);
+
+  return size;
+}
+
+static void
+test_adaptive_compression(int threads) {
+  uint64_t always = adaptive_table_size(0, threads);
+  uint64_t adaptive = adaptive_table_size(1, threads);
+
+  /* Some compressible blocks after the run of incompressible ones
+     are stored without trying. */
+  ASSERT(adaptive > always + 5000);
+  ASSERT(adaptive < 40 * 1100);
+}
+
+/* Build a compressed table from the values, returning the size of its
+   data. One iterator is left on the first entry while another reads
+   every block, so a block left in a reused read buffer would show up
+   as a changed value. */
+static uint64_t
+scratch_table(const ldb_buffer_t *vals, int count, int mapped) {
+  ctor_t *c = tablector_create(ldb_bytewise_comparator);
+  ldb_dbopt_t options = *ldb_dbopt_default;
+  ldb_iter_t *first, *iter;
+  ldb_slice_t key, val;
+  ldb_vector_t keys;
+  uint64_t size;
+  char kbuf[16];
+  int i;
+
+  ldb_vector_init(&keys);
+
+  for (i = 0; i < count; i++) {
+    sprintf(kbuf, "k%02d", i);
+
+    key = ldb_string(kbuf);
+
+    ctor_add(c, &key, &vals[i]);
+  }
+
+  options.block_size = 1024;
+  options.compression = LDB_SNAPPY_COMPRESSION;
+  options.comparator = ldb_bytewise_comparator;
+  options.use_mmap = mapped;
+
+  ctor_finish(c, &options, &keys);
+
+  ASSERT(ldb_rfile_mapped(((tablector_t *)c->ptr)->source) == mapped);
+
+  first = tablector_iterator(c->ptr);
+
+  ldb_iter_first(first);
+
+  ASSERT(ldb_iter_valid(first));
+
+  iter = tablector_iterator(c->ptr);
+  i = 0;
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    val = ldb_iter_value(iter);
+
+    ASSERT(i < count);
+    ASSERT(ldb_slice_equal(&val, &vals[i]));
+
+    i++;
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+  ASSERT(i == count);
+
+  key = ldb_iter_key(first);
+  val = ldb_iter_value(first);
+
+  ASSERT(key.size == 3 && memcmp(key.data, "k00", 3) == 0);
+  ASSERT(ldb_slice_equal(&val, &vals[0]));
+
+  size = ctor_approximate_offset(c, "xyz");
+
+  ldb_iter_destroy(iter);
+  ldb_iter_destroy(first);
+  ldb_vector_clear(&keys);
+  ctor_destroy(c);
+
+  return size;
+}
+
+static void
+test_read_scratch(void) {
+  ldb_buffer_t vals[10];
+  ldb_rand_t rnd;
+  int i;
+
+  ldb_rand_init(&rnd, 301);
+
+  for (i = 0; i < 10; i++)
+    ldb_buffer_init(&vals[i]);
+
+  /* Compressed blocks which fit the 16KB stack buffer. */
+  for (i = 0; i < 10; i++)
+    ldb_compressible_string(&vals[i], &rnd, 0.25, 1000);
+
+  ASSERT(scratch_table(vals, 10, 0) < 10 * 1000);
+
+  /* Compressed blocks too large for it, read into the heap. */
+  for (i = 0; i < 3; i++)
+    ldb_compressible_string(&vals[i], &rnd, 0.25, 100000);
+
+  ASSERT(scratch_table(vals, 3, 0) > 3 * (16 << 10));
+
+  /* Blocks which did not compress, are read into the stack buffer,
+     and have to be copied out of it. */
+  for (i = 0; i < 10; i++)
+    ldb_random_string(&vals[i], &rnd, 1000);
+
+  ASSERT(scratch_table(vals, 10, 0) > 10 * 1000);
+
+  /* Mapped files are read in place, whatever the block. */
+  for (i = 0; i < 10; i++) {
+    if (i & 1)
+      ldb_random_string(&vals[i], &rnd, 1000);
+    else
+      ldb_compressible_string(&vals[i], &rnd, 0.25, 1000);
+  }
+
+  scratch_table(vals, 10, 1);
+
+  for (i = 0; i < 10; i++)
+    ldb_buffer_clear(&vals[i]);
+}
+
+/*
+ * Merger Tests
+ */
+
+#define MERGE_KEYS 2000
+
+typedef struct mergetest_s {
+  ldb_dbopt_t options;
+  ldb_blockgen_t *gens;
+  ldb_block_t *blocks;
+  int n;
+} mergetest_t;
+
+static void
+mergetest_init(mergetest_t *t, int n) {
+  int i;
+
+  t->options = *ldb_dbopt_default;
+  t->options.comparator = ldb_bytewise_comparator;
+  t->options.block_restart_interval = 4;
+  t->gens = ldb_malloc(n * sizeof(ldb_blockgen_t));
+  t->blocks = ldb_malloc(n * sizeof(ldb_block_t));
+  t->n = n;
+
+  for (i = 0; i < n; i++)
+    ldb_blockgen_init(&t->gens[i], &t->options);
+}
+
+static void
+mergetest_clear(mergetest_t *t) {
+  int i;
+
+  for (i = 0; i < t->n; i++) {
+    ldb_block_clear(&t->blocks[i]);
+    ldb_blockgen_clear(&t->gens[i]);
+  }
+
+  ldb_free(t->gens);
+  ldb_free(t->blocks);
+}
+
+/* Keys must be added to each child in order. The value names
+   the child holding the entry. */
+static void
+mergetest_add(mergetest_t *t, int child, int key) {
+  char kbuf[16], vbuf[16];
+  ldb_slice_t k, v;
+
+  sprintf(kbuf, "%06d", key);
+  sprintf(vbuf, "%d", child);
+
+  k = ldb_string(kbuf);
+  v = ldb_string(vbuf);
+
+  ldb_blockgen_add(&t->gens[child], &k, &v);
+}
+
+static ldb_iter_t *
+mergetest_iterator(mergetest_t *t) {
+  ldb_iter_t **children = ldb_malloc(t->n * sizeof(ldb_iter_t *));
+  ldb_iter_t *iter;
+  int i;
+
+  for (i = 0; i < t->n; i++) {
+    ldb_contents_t contents;
+
+    contents.data = ldb_blockgen_finish(&t->gens[i]);
+    contents.cachable = 0;
+    contents.heap_allocated = 0;
+    contents.verified = 0;
+
+    ldb_block_init(&t->blocks[i], &contents);
+
+    children[i] = ldb_blockiter_create(&t->blocks[i],
+                                       ldb_bytewise_comparator);
+  }
+
+  iter = ldb_mergeiter_create(ldb_bytewise_comparator, children, t->n);
+
+  ldb_free(children);
+
+  return iter;
+}
+
+/* Check that the iterator is at entry "key" of child "child". */
+static void
+mergetest_check(ldb_iter_t *iter, int key, int child) {
+  char kbuf[16], vbuf[16];
+  ldb_slice_t k, v;
+
+  ASSERT(ldb_iter_valid(iter));
+
+  sprintf(kbuf, "%06d", key);
+  sprintf(vbuf, "%d", child);
+
+  k = ldb_iter_key(iter);
+  v = ldb_iter_value(iter);
+
+  ASSERT(k.size == strlen(kbuf) && memcmp(k.data, kbuf, k.size) == 0);
+  ASSERT(v.size == strlen(vbuf) && memcmp(v.data, vbuf, v.size) == 0);
+}
+
+/* Walk a merge of many children (some of them empty) at random,
+   switching direction often, and compare with the sorted keys. */
+static void
+test_merger_random(int n) {
+  int *owner = ldb_malloc(MERGE_KEYS * sizeof(int));
+  mergetest_t t;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  int i, pos;
+
+  ldb_rand_init(&rnd, 301 + n);
+
+  mergetest_init(&t, n);
+
+  /* Entry i has key 2 * i, so odd keys seek between entries. */
+  for (i = 0; i < MERGE_KEYS; i++) {
+    do {
+      owner[i] = ldb_rand_uniform(&rnd, n);
+    } while (n > 1 && owner[i] % 8 == 7);
+
+    mergetest_add(&t, owner[i], 2 * i);
+  }
+
+  iter = mergetest_iterator(&t);
+
+  ldb_iter_first(iter);
+
+  for (i = 0; i < MERGE_KEYS; i++) {
+    mergetest_check(iter, 2 * i, owner[i]);
+    ldb_iter_next(iter);
+  }
+
+  ASSERT(!ldb_iter_valid(iter));
+
+  ldb_iter_last(iter);
+
+  for (i = MERGE_KEYS - 1; i >= 0; i--) {
+    mergetest_check(iter, 2 * i, owner[i]);
+    ldb_iter_prev(iter);
+  }
+
+  ASSERT(!ldb_iter_valid(iter));
+
+  pos = -1;
+
+  for (i = 0; i < 20000; i++) {
+    uint32_t op = ldb_rand_uniform(&rnd, 10);
+
+    if (pos < 0 || pos >= MERGE_KEYS)
+      op = ldb_rand_uniform(&rnd, 3);
+
+    switch (op) {
+      case 0: {
+        ldb_iter_first(iter);
+        pos = 0;
+        break;
+      }
+
+      case 1: {
+        ldb_iter_last(iter);
+        pos = MERGE_KEYS - 1;
+        break;
+      }
+
+      case 2: {
+        int key = ldb_rand_uniform(&rnd, 2 * MERGE_KEYS + 1);
+        char kbuf[16];
+        ldb_slice_t k;
+
+        sprintf(kbuf, "%06d", key);
+
+        k = ldb_string(kbuf);
+
+        ldb_iter_seek(iter, &k);
+
+        pos = (key + 1) / 2;
+
+        break;
+      }
+
+      case 3:
+      case 4:
+      case 5:
+      case 6: {
+        ldb_iter_next(iter);
+        pos++;
+        break;
+      }
+
+      default: {
+        ldb_iter_prev(iter);
+        pos--;
+        break;
+      }
+    }
+
+    if (pos < 0 || pos >= MERGE_KEYS)
+      ASSERT(!ldb_iter_valid(iter));
+    else
+      mergetest_check(iter, 2 * pos, owner[pos]);
+  }
+
+  ASSERT(ldb_iter_status(iter) == LDB_OK);
+
+  ldb_iter_destroy(iter);
+
+  mergetest_clear(&t);
+
+  ldb_free(owner);
+}
+
+/* Keys present in several children are yielded once per child:
+   in child order moving forward, and in reverse order backward. */
+static void
+test_merger_duplicates(void) {
+  static const int n = 16;
+  static const int keys = 200;
+  char *present = ldb_malloc(keys * n);
+  mergetest_t t;
+  ldb_iter_t *iter;
+  ldb_rand_t rnd;
+  int key, child;
+
+  ldb_rand_init(&rnd, 301);
+
+  mergetest_init(&t, n);
+
+  for (child = 0; child < n; child++) {
+    for (key = 0; key < keys; key++) {
+      present[key * n + child] = ldb_rand_one_in(&rnd, 3);
+
+      /* Key 0 is in every child. */
+      if (key == 0)
+        present[key * n + child] = 1;
+
+      if (present[key * n + child])
+        mergetest_add(&t, child, key);
+    }
+  }
+
+  iter = mergetest_iterator(&t);
+
+  ldb_iter_first(iter);
+
+  for (key = 0; key < keys; key++) {
+    for (child = 0; child < n; child++) {
+      if (present[key * n + child]) {
+        mergetest_check(iter, key, child);
+        ldb_iter_next(iter);
+      }
+    }
+  }
+
+  ASSERT(!ldb_iter_valid(iter));
+
+  ldb_iter_last(iter);
+
+  for (key = keys - 1; key >= 0; key--) {
+    for (child = n - 1; child >= 0; child--) {
+      if (present[key * n + child]) {
+        mergetest_check(iter, key, child);
+        ldb_iter_prev(iter);
+      }
+    }
+  }
+
+  ASSERT(!ldb_iter_valid(iter));
+
+  /* A seek lands on the first child holding the key. */
+  for (key = 0; key < keys; key++) {
+    char kbuf[16];
+    ldb_slice_t k;
+
+    sprintf(kbuf, "%06d", key);
+
+    k = ldb_string(kbuf);
+
+    ldb_iter_seek(iter, &k);
+
+    for (child = 0; child < n; child++) {
+      if (present[key * n + child])
+        break;
+    }
+
+    if (child < n)
+      mergetest_check(iter, key, child);
+  }
+
+  ldb_iter_destroy(iter);
+
+  mergetest_clear(&t);
+
+  ldb_free(present);
+}
+
 /*
  * Execute
  */
@@ -1499,6 +2444,9 @@ main(void) {
 
   test_empty(&h);
   test_zero_restart_points_in_block();
+  test_block_hash_index();
+  test_block_restart_prefixes();
+  test_block_value_lengths();
   test_simple_empty_key(&h);
   test_simple_single(&h);
   test_simple_multi(&h);
@@ -1506,8 +2454,20 @@ main(void) {
   test_randomized(&h);
   test_randomized_long_db(&h);
   test_memtable_simple();
+  test_memtable_bloom_usage();
   test_approximate_offset_plain();
   test_approximate_offset_compressed();
+  test_compression_type(LDB_NO_COMPRESSION);
+  test_compression_type(LDB_SNAPPY_COMPRESSION);
+  test_compression_type(LDB_LZ4_COMPRESSION);
+  test_compression_type(LDB_ZSTD_COMPRESSION);
+  test_adaptive_compression(1);
+  test_adaptive_compression(4);
+  test_read_scratch();
+  test_merger_random(2);
+  test_merger_random(17);
+  test_merger_random(200);
+  test_merger_duplicates();
 
   harness_clear(&h);
 
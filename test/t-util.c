@@ -9,9 +9,13 @@
 
 #include "util/array.h"
 #include "util/atomic.h"
+#include "util/env.h"
 #include "util/internal.h"
 #include "util/random.h"
+#include "util/ratelimit.h"
+#include "util/slice.h"
 #include "util/testutil.h"
+#include "util/thread_pool.h"
 #include "util/vector.h"
 
 /*
@@ -172,6 +176,183 @@ test_sort_vector(int iter, int max) {
   ldb_vector_clear(&nums);
 }
 
+/*
+ * Slice
+ */
+
+static void
+test_slice_shared(void) {
+  uint8_t xp[100], yp[100];
+  ldb_rand_t rnd;
+  int i, j;
+
+  ldb_rand_init(&rnd, 301);
+
+  for (i = 0; i < 1000; i++) {
+    size_t xn = ldb_rand_uniform(&rnd, sizeof(xp) + 1);
+    size_t yn = ldb_rand_uniform(&rnd, sizeof(yp) + 1);
+    size_t pos = ldb_rand_uniform(&rnd, sizeof(xp) + 1);
+    ldb_slice_t x = ldb_slice(xp, xn);
+    ldb_slice_t y = ldb_slice(yp, yn);
+    size_t expect = 0;
+
+    for (j = 0; j < (int)sizeof(xp); j++)
+      xp[j] = yp[j] = ldb_rand_uniform(&rnd, 256);
+
+    if (pos < sizeof(xp))
+      yp[pos] ^= 1 + ldb_rand_uniform(&rnd, 255);
+
+    while (expect < xn && expect < yn && xp[expect] == yp[expect])
+      expect++;
+
+    ASSERT(ldb_slice_shared(&x, &y) == expect);
+    ASSERT(ldb_slice_shared(&y, &x) == expect);
+  }
+}
+
+/*
+ * Rate Limiter
+ */
+
+static void
+test_ratelimit(void) {
+  ldb_ratelimit_t *lim = ldb_ratelimit_create(10 << 20);
+  int64_t start, elapsed;
+  int i;
+
+  ASSERT(ldb_ratelimit_rate(lim) == (10 << 20));
+
+  /* 3.2MB at 10MB/s with a 1MB bucket: at least ~220ms. */
+  start = ldb_now_usec();
+
+  for (i = 0; i < 50; i++)
+    ldb_ratelimit_request(lim, 64 << 10, LDB_IO_LOW);
+
+  elapsed = ldb_now_usec() - start;
+
+  ASSERT(elapsed >= 150000);
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_LOW) == 50 * (64 << 10));
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_HIGH) == 0);
+
+  /* Unlimited. */
+  ldb_ratelimit_set_rate(lim, 0);
+
+  start = ldb_now_usec();
+
+  for (i = 0; i < 1000; i++)
+    ldb_ratelimit_request(lim, 1 << 20, LDB_IO_HIGH);
+
+  elapsed = ldb_now_usec() - start;
+
+  ASSERT(elapsed < 1000000);
+  ASSERT(ldb_ratelimit_total(lim, LDB_IO_HIGH) == 1000 * (1 << 20));
+
+  ldb_ratelimit_destroy(lim);
+}
+
+static void
+test_ratelimit_auto(void) {
+  ldb_ratelimit_t *lim = ldb_ratelimit_create_auto(20 << 20);
+  int i;
+
+  ASSERT(ldb_ratelimit_tuned(lim));
+  ASSERT(ldb_ratelimit_rate(lim) == (20 << 20));
+
+  /* Falling behind: stay at the maximum. */
+  ldb_ratelimit_tune(lim, 2.0);
+
+  ASSERT(ldb_ratelimit_rate(lim) == (20 << 20));
+
+  /* Keeping up: drop to the minimum. */
+  for (i = 0; i < 100; i++)
+    ldb_ratelimit_tune(lim, 0.1);
+
+  ASSERT(ldb_ratelimit_rate(lim) == (1 << 20));
+
+  /* In between: hold. */
+  ldb_ratelimit_tune(lim, 0.7);
+
+  ASSERT(ldb_ratelimit_rate(lim) == (1 << 20));
+
+  ldb_ratelimit_tune(lim, 1.0);
+
+  ASSERT(ldb_ratelimit_rate(lim) > (1 << 20));
+
+  /* A new maximum also moves the minimum. */
+  ldb_ratelimit_set_rate(lim, 100 << 20);
+
+  for (i = 0; i < 100; i++)
+    ldb_ratelimit_tune(lim, 0.0);
+
+  ASSERT(ldb_ratelimit_rate(lim) == (5 << 20));
+
+  /* A zero rate turns tuning off. */
+  ldb_ratelimit_set_rate(lim, 0);
+
+  ASSERT(!ldb_ratelimit_tuned(lim));
+
+  ldb_ratelimit_destroy(lim);
+}
+
+/*
+ * Thread Pool
+ */
+
+typedef struct pool_state_s {
+  ldb_atomic(int) active;
+  ldb_atomic(int) over;
+  ldb_atomic(int) done;
+} pool_state_t;
+
+static void
+pool_work(void *arg) {
+  pool_state_t *st = arg;
+
+  /* At most two at once. */
+  if (ldb_atomic_fetch_add(&st->active, 1, ldb_order_seq_cst) >= 2)
+    ldb_atomic_fetch_add(&st->over, 1, ldb_order_seq_cst);
+
+  ldb_sleep_usec(1000);
+
+  ldb_atomic_fetch_sub(&st->active, 1, ldb_order_seq_cst);
+  ldb_atomic_fetch_add(&st->done, 1, ldb_order_seq_cst);
+}
+
+static void
+pool_flush(void *arg) {
+  pool_state_t *st = arg;
+  ldb_atomic_fetch_add(&st->done, 1, ldb_order_seq_cst);
+}
+
+static void
+test_thread_pool(void) {
+  ldb_pool_t *pool = ldb_pool_create(4);
+  pool_state_t st;
+  int i;
+
+  ldb_atomic_init(&st.active, 0);
+  ldb_atomic_init(&st.over, 0);
+  ldb_atomic_init(&st.done, 0);
+
+  ldb_pool_set_limit(pool, 2);
+
+  for (i = 0; i < 50; i++) {
+    ldb_pool_schedule(pool, pool_work, &st);
+    ldb_pool_schedule_ex(pool, pool_work, &st, LDB_POOL_LOW);
+  }
+
+  /* Not held back by the limit. */
+  for (i = 0; i < 10; i++)
+    ldb_pool_schedule_ex(pool, pool_flush, &st, LDB_POOL_HIGH);
+
+  ldb_pool_wait(pool);
+
+  ASSERT(ldb_atomic_load(&st.done, ldb_order_seq_cst) == 110);
+  ASSERT(ldb_atomic_load(&st.over, ldb_order_seq_cst) == 0);
+
+  ldb_pool_destroy(pool);
+}
+
 /*
  * Main
  */
@@ -185,5 +366,9 @@ main(void) {
   test_sort_vector(500, 10);
   test_sort_vector(500, 500);
   test_sort_vector(10, 10000);
+  test_slice_shared();
+  test_ratelimit();
+  test_ratelimit_auto();
+  test_thread_pool();
   return 0;
 }
@@ -50,6 +50,7 @@ test_encode_decode(void) {
   ldb_slice_t s2 = ldb_string("zoo");
   ldb_slice_t s3 = ldb_string("x");
   ldb_ikey_t k1, k2, k3;
+  ldb_filemeta_t *f;
   ldb_edit_t edit;
   int i;
 
@@ -67,6 +68,13 @@ test_encode_decode(void) {
     ldb_ikey_set(&k3, &s3, big + 900 + i, LDB_TYPE_VALUE);
 
     ldb_edit_add_file(&edit, 3, big + 300 + i, big + 400 + i, &k1, &k2);
+    ldb_edit_add_file(&edit, 0, big + 800 + i, 100, &k1, &k2)->creation_time =
+      1600000000 + i;
+    f = ldb_edit_add_file(&edit, 1, big + 850 + i, 200, &k1, &k2);
+    f->creation_time = 1600000000 + i;
+    f->entries = 1000 + i;
+    f->deletions = 100 + i;
+    ldb_edit_add_file(&edit, 5, big + 870 + i, 300, &k1, &k2)->path_id = 1 + i;
     ldb_edit_remove_file(&edit, 4, big + 700 + i);
     ldb_edit_set_compact_pointer(&edit, i, &k3);
   }
@@ -79,6 +87,7 @@ test_encode_decode(void) {
   ldb_edit_set_log_number(&edit, big + 100);
   ldb_edit_set_next_file(&edit, big + 200);
   ldb_edit_set_last_sequence(&edit, big + 1000);
+  ldb_edit_set_log_block_size(&edit, 1 << 20);
 
   encode_and_decode(&edit);
 
@@ -11,17 +11,26 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "util/atomic.h"
 #include "util/buffer.h"
 #include "util/comparator.h"
+#include "util/env.h"
 #include "util/internal.h"
+#include "util/options.h"
+#include "util/port.h"
+#include "util/random.h"
 #include "util/slice.h"
+#include "util/status.h"
 #include "util/testutil.h"
 #include "util/vector.h"
 
+#include "db_impl.h"
 #include "dbformat.h"
+#include "table_cache.h"
 #include "version_edit.h"
 #include "version_set.h"
 
@@ -164,6 +173,117 @@ addtest_file(addtest_t *t,
   return f;
 }
 
+/*
+ * VersionSetTest
+ */
+
+typedef struct vstest_s {
+  char dbname[LDB_PATH_MAX];
+  ldb_comparator_t icmp;
+  ldb_dbopt_t options;
+  ldb_tables_t *table_cache;
+  ldb_versions_t *vset;
+  ldb_mutex_t mu;
+} vstest_t;
+
+static void
+vstest_open(vstest_t *t, int recover) {
+  int save_manifest = 0;
+
+  t->table_cache = ldb_tables_create(t->dbname, &t->options, 100);
+  t->vset = ldb_versions_create(t->dbname, &t->options,
+                                t->table_cache, &t->icmp);
+
+  if (recover) {
+    ASSERT(ldb_versions_recover(t->vset, &save_manifest) == LDB_OK);
+  } else {
+    /* As a new database would: its first edit writes the MANIFEST. */
+    t->vset->manifest_file_number = ldb_versions_new_file_number(t->vset);
+  }
+}
+
+static void
+vstest_close(vstest_t *t) {
+  ldb_versions_destroy(t->vset);
+  ldb_tables_destroy(t->table_cache);
+}
+
+static void
+vstest_init(vstest_t *t) {
+  ASSERT(ldb_test_filename(t->dbname, sizeof(t->dbname), "version_set"));
+
+  ldb_destroy(t->dbname, NULL);
+
+  ASSERT(ldb_create_dir(t->dbname) == LDB_OK);
+
+  ldb_ikc_init(&t->icmp, ldb_bytewise_comparator);
+
+  t->options = *ldb_dbopt_default;
+  t->options.comparator = &t->icmp;
+
+  ldb_mutex_init(&t->mu);
+
+  vstest_open(t, 0);
+}
+
+static void
+vstest_clear(vstest_t *t) {
+  vstest_close(t);
+
+  ldb_mutex_destroy(&t->mu);
+
+  ldb_destroy(t->dbname, NULL);
+}
+
+static void
+vstest_reopen(vstest_t *t) {
+  vstest_close(t);
+  vstest_open(t, 1);
+}
+
+/* Add a file at "level" holding the user keys [smallest, largest]. */
+static void
+vstest_add(ldb_edit_t *edit,
+           int level,
+           uint64_t number,
+           const char *smallest,
+           const char *largest) {
+  ldb_slice_t sk = ldb_string(smallest);
+  ldb_slice_t lk = ldb_string(largest);
+  ldb_ikey_t s, l;
+
+  ldb_ikey_init(&s);
+  ldb_ikey_init(&l);
+
+  ldb_ikey_set(&s, &sk, 100, LDB_TYPE_VALUE);
+  ldb_ikey_set(&l, &lk, 100, LDB_TYPE_VALUE);
+
+  ldb_edit_add_file(edit, level, number, 1000 + number, &s, &l);
+
+  ldb_ikey_clear(&s);
+  ldb_ikey_clear(&l);
+}
+
+static int
+vstest_apply(vstest_t *t, ldb_edit_t *edit) {
+  int rc;
+
+  ldb_mutex_lock(&t->mu);
+
+  rc = ldb_versions_apply(t->vset, edit, &t->mu);
+
+  ldb_mutex_unlock(&t->mu);
+
+  return rc;
+}
+
+/* Describe the files of the current version. */
+static void
+vstest_debug(vstest_t *t, ldb_buffer_t *z) {
+  ldb_buffer_reset(z);
+  ldb_version_debug(z, t->vset->current);
+}
+
 /*
  * Find File Tests
  */
@@ -536,6 +656,452 @@ test_boundary_disjoin_file_pointers(addtest_t *t) {
   ldb_ikey_clear(&k1);
 }
 
+/*
+ * VersionSet Tests
+ */
+
+static void
+test_versions_shared_levels(vstest_t *t) {
+  ldb_buffer_t z1, z2, tmp;
+  ldb_version_t *v1, *v2;
+  ldb_filemeta_t *f;
+  ldb_edit_t edit;
+  int order;
+
+  ldb_buffer_init(&z1);
+  ldb_buffer_init(&z2);
+  ldb_buffer_init(&tmp);
+
+  ldb_edit_init(&edit);
+
+  vstest_add(&edit, 1, ldb_versions_new_file_number(t->vset), "a", "b");
+  vstest_add(&edit, 1, ldb_versions_new_file_number(t->vset), "c", "d");
+  vstest_add(&edit, 2, ldb_versions_new_file_number(t->vset), "a", "b");
+  vstest_add(&edit, 2, ldb_versions_new_file_number(t->vset), "c", "d");
+  vstest_add(&edit, 3, ldb_versions_new_file_number(t->vset), "a", "z");
+
+  ASSERT(vstest_apply(t, &edit) == LDB_OK);
+
+  ldb_edit_clear(&edit);
+
+  /* Unref the older version first, then the newer one first. */
+  for (order = 0; order < 2; order++) {
+    v1 = t->vset->current;
+
+    ldb_version_ref(v1);
+    vstest_debug(t, &z1);
+
+    /* Touch level 2 only. */
+    ldb_edit_init(&edit);
+    vstest_add(&edit, 2, ldb_versions_new_file_number(t->vset),
+               order ? "g" : "e", order ? "h" : "f");
+    ASSERT(vstest_apply(t, &edit) == LDB_OK);
+    ldb_edit_clear(&edit);
+
+    v2 = t->vset->current;
+
+    ASSERT(v2 != v1);
+
+    /* The untouched levels are shared, the edited one is not. */
+    ASSERT(v2->files[1].items == v1->files[1].items);
+    ASSERT(v2->files[3].items == v1->files[3].items);
+    ASSERT(v2->level_refs[1] == v1->level_refs[1]);
+    ASSERT(v2->level_refs[3] == v1->level_refs[3]);
+    ASSERT(*v2->level_refs[1] == 2);
+    ASSERT(*v2->level_refs[3] == 2);
+
+    ASSERT(v2->files[2].items != v1->files[2].items);
+    ASSERT(v2->files[2].length == v1->files[2].length + 1);
+
+    /* Level 0 is empty and left alone. */
+    ASSERT(v1->level_refs[0] == NULL);
+    ASSERT(v2->level_refs[0] == NULL);
+
+    /* A shared file is referenced once, by the shared level. */
+    f = v2->files[1].items[0];
+
+    ASSERT(f->refs == 1);
+
+    /* The old version is unchanged. */
+    ldb_buffer_reset(&tmp);
+    ldb_version_debug(&tmp, v1);
+
+    ASSERT(tmp.size == z1.size);
+    ASSERT(memcmp(tmp.data, z1.data, z1.size) == 0);
+
+    if (order == 0) {
+      /* Drop the old version: the new one owns the levels alone. */
+      ldb_version_unref(v1);
+
+      ASSERT(*v2->level_refs[1] == 1);
+      ASSERT(*v2->level_refs[3] == 1);
+      ASSERT(f->refs == 1);
+    } else {
+      /* Replace the new version while the old one is still held. */
+      vstest_debug(t, &z2);
+
+      ldb_edit_init(&edit);
+      ldb_edit_remove_file(&edit, 2, ((ldb_filemeta_t *)
+                                      v2->files[2].items[0])->number);
+      ASSERT(vstest_apply(t, &edit) == LDB_OK);
+      ldb_edit_clear(&edit);
+
+      /* v2 is gone; v1 and the current version share levels 1 and 3. */
+      ASSERT(t->vset->current->level_refs[1] == v1->level_refs[1]);
+      ASSERT(*v1->level_refs[1] == 2);
+      ASSERT(*v1->level_refs[3] == 2);
+      ASSERT(f->refs == 1);
+
+      ldb_buffer_reset(&tmp);
+      ldb_version_debug(&tmp, v1);
+
+      ASSERT(tmp.size == z1.size);
+      ASSERT(memcmp(tmp.data, z1.data, z1.size) == 0);
+
+      ldb_version_unref(v1);
+
+      ASSERT(*t->vset->current->level_refs[1] == 1);
+      ASSERT(t->vset->current->files[2].length == 3);
+    }
+  }
+
+  /* What is left replays the same. */
+  vstest_debug(t, &z1);
+  vstest_reopen(t);
+  vstest_debug(t, &z2);
+
+  ASSERT(z1.size == z2.size);
+  ASSERT(memcmp(z1.data, z2.data, z1.size) == 0);
+
+  ldb_buffer_clear(&z1);
+  ldb_buffer_clear(&z2);
+  ldb_buffer_clear(&tmp);
+}
+
+/* Replace the files at "level" with a random disjoint layout
+   (or none at all). */
+static void
+vstest_layout(vstest_t *t, ldb_edit_t *edit, int level, ldb_rand_t *rnd) {
+  const ldb_vector_t *files = &t->vset->current->files[level];
+  uint32_t count = ldb_rand_one_in(rnd, 4) ? 0 : ldb_rand_uniform(rnd, 40);
+  uint32_t key = ldb_rand_uniform(rnd, 50);
+  char lo[16], hi[16];
+  uint32_t i;
+
+  for (i = 0; i < files->length; i++) {
+    ldb_filemeta_t *f = files->items[i];
+
+    ldb_edit_remove_file(edit, level, f->number);
+  }
+
+  for (i = 0; i < count; i++) {
+    uint32_t width = ldb_rand_uniform(rnd, 50);
+
+    sprintf(lo, "%06u", (unsigned int)key);
+    sprintf(hi, "%06u", (unsigned int)(key + width));
+
+    vstest_add(edit, level, ldb_versions_new_file_number(t->vset), lo, hi);
+
+    key += width + 1 + ldb_rand_uniform(rnd, 50);
+  }
+}
+
+/* Check the files a lookup of "key" visits against a plain binary
+   search of each level. */
+static void
+vstest_check_lookup(vstest_t *t, uint32_t key) {
+  const ldb_comparator_t *ucmp = t->vset->icmp.user_comparator;
+  ldb_version_t *v = t->vset->current;
+  ldb_vector_t expect, result;
+  ldb_slice_t uk;
+  ldb_ikey_t ik;
+  char buf[16];
+  size_t i;
+  int level;
+
+  sprintf(buf, "%06u", (unsigned int)key);
+
+  uk = ldb_string(buf);
+
+  ldb_ikey_init(&ik);
+  ldb_ikey_set(&ik, &uk, LDB_MAX_SEQUENCE, LDB_VALTYPE_SEEK);
+
+  ldb_vector_init(&expect);
+  ldb_vector_init(&result);
+
+  for (level = 1; level < LDB_MAX_LEVELS; level++) {
+    const ldb_vector_t *files = &v->files[level];
+    int index = find_file(&t->vset->icmp, files, &ik);
+
+    if (index < (int)files->length) {
+      ldb_filemeta_t *f = files->items[index];
+      ldb_slice_t small_key = ldb_ikey_user_key(&f->smallest);
+
+      if (ldb_compare(ucmp, &uk, &small_key) >= 0)
+        ldb_vector_push(&expect, f);
+    }
+  }
+
+  ldb_version_overlapping(v, &ik, &result);
+
+  ASSERT(result.length == expect.length);
+
+  for (i = 0; i < expect.length; i++)
+    ASSERT(result.items[i] == expect.items[i]);
+
+  ldb_vector_clear(&expect);
+  ldb_vector_clear(&result);
+  ldb_ikey_clear(&ik);
+}
+
+static void
+test_versions_cascade(vstest_t *t) {
+  ldb_version_t *prev = NULL;
+  int shared = 0;
+  ldb_rand_t rnd;
+  int levels = t->options.num_levels;
+  int round, level;
+  uint32_t key;
+
+  ldb_rand_init(&rnd, ldb_random_seed());
+
+  for (round = 0; round < 100; round++) {
+    ldb_edit_t edit;
+
+    ldb_edit_init(&edit);
+
+    /* Relayout every level at first, a few of them afterwards. */
+    for (level = 1; level < levels; level++) {
+      if (round == 0 || ldb_rand_one_in(&rnd, 3))
+        vstest_layout(t, &edit, level, &rnd);
+    }
+
+    ASSERT(vstest_apply(t, &edit) == LDB_OK);
+
+    ldb_edit_clear(&edit);
+
+    /* Hints over unchanged levels come from the previous version. */
+    if (prev != NULL) {
+      for (level = 1; level < levels; level++) {
+        if (t->vset->current->cascade[level] != NULL &&
+            t->vset->current->cascade[level] == prev->cascade[level]) {
+          shared++;
+        }
+      }
+
+      ldb_version_unref(prev);
+    }
+
+    prev = t->vset->current;
+
+    ldb_version_ref(prev);
+
+    for (key = 0; key < 4500; key += 1 + ldb_rand_uniform(&rnd, 8))
+      vstest_check_lookup(t, key);
+  }
+
+  ASSERT(shared > 0);
+
+  ldb_version_unref(prev);
+
+  /* The hints of a recovered version are built from scratch. */
+  vstest_reopen(t);
+
+  for (key = 0; key < 4500; key++)
+    vstest_check_lookup(t, key);
+}
+
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+
+#define VS_THREADS 8
+
+typedef struct vsthread_s {
+  vstest_t *test;
+  ldb_edit_t edit;
+  int status;
+  int files; /* Files at level 1 right after the edit. */
+} vsthread_t;
+
+static void
+vsthread_body(void *arg) {
+  vsthread_t *ctx = arg;
+  vstest_t *t = ctx->test;
+
+  ldb_mutex_lock(&t->mu);
+
+  ctx->status = ldb_versions_apply(t->vset, &ctx->edit, &t->mu);
+  ctx->files = ldb_versions_files(t->vset, 1);
+
+  ldb_mutex_unlock(&t->mu);
+}
+
+static void
+test_versions_apply_group(vstest_t *t) {
+  vsthread_t ctx[VS_THREADS];
+  ldb_thread_t threads[VS_THREADS];
+  ldb_buffer_t before, after;
+  char lo[16], hi[16];
+  size_t queued = 0;
+  int i;
+
+  ldb_buffer_init(&before);
+  ldb_buffer_init(&after);
+
+  for (i = 0; i < VS_THREADS; i++) {
+    sprintf(lo, "%02da", i);
+    sprintf(hi, "%02dz", i);
+
+    ctx[i].test = t;
+    ctx[i].status = -1;
+    ctx[i].files = 0;
+
+    ldb_edit_init(&ctx[i].edit);
+
+    vstest_add(&ctx[i].edit, 1, ldb_versions_new_file_number(t->vset), lo, hi);
+  }
+
+  /* Hold off the MANIFEST writer until every edit is queued. */
+  ldb_mutex_lock(&t->mu);
+  t->vset->manifest_busy = 1;
+  ldb_mutex_unlock(&t->mu);
+
+  for (i = 0; i < VS_THREADS; i++)
+    ldb_thread_create(&threads[i], vsthread_body, &ctx[i]);
+
+  while (queued < VS_THREADS) {
+    ldb_sleep_usec(1000);
+
+    ldb_mutex_lock(&t->mu);
+    queued = t->vset->manifest_queue.length;
+    ldb_mutex_unlock(&t->mu);
+  }
+
+  ldb_mutex_lock(&t->mu);
+  t->vset->manifest_busy = 0;
+  ldb_cond_broadcast(&t->vset->manifest_cv);
+  ldb_mutex_unlock(&t->mu);
+
+  for (i = 0; i < VS_THREADS; i++)
+    ldb_thread_join(&threads[i]);
+
+  /* One group: every caller saw all of the edits installed at once. */
+  for (i = 0; i < VS_THREADS; i++) {
+    ASSERT(ctx[i].status == LDB_OK);
+    ASSERT(ctx[i].files == VS_THREADS);
+  }
+
+  ASSERT(t->vset->manifest_queue.length == 0);
+
+  /* The grouped records replay to the same version. */
+  vstest_debug(t, &before);
+  vstest_reopen(t);
+  vstest_debug(t, &after);
+
+  ASSERT(ldb_versions_files(t->vset, 1) == VS_THREADS);
+  ASSERT(before.size == after.size);
+  ASSERT(memcmp(before.data, after.data, before.size) == 0);
+
+  /* A later edit still goes through. */
+  {
+    ldb_edit_t edit;
+
+    ldb_edit_init(&edit);
+
+    vstest_add(&edit, 2, ldb_versions_new_file_number(t->vset), "a", "b");
+
+    ASSERT(vstest_apply(t, &edit) == LDB_OK);
+    ASSERT(ldb_versions_files(t->vset, 2) == 1);
+
+    ldb_edit_clear(&edit);
+  }
+
+  for (i = 0; i < VS_THREADS; i++)
+    ldb_edit_clear(&ctx[i].edit);
+
+  ldb_buffer_clear(&before);
+  ldb_buffer_clear(&after);
+}
+
+#define VS_SEEKS 1000
+
+typedef struct vsseek_s {
+  vstest_t *test;
+  ldb_filemeta_t *file;
+  int scheduled; /* Compactions this thread picked the file for. */
+} vsseek_t;
+
+static void
+vsseek_body(void *arg) {
+  vsseek_t *ctx = arg;
+  vstest_t *t = ctx->test;
+  ldb_getstats_t stats;
+  int i;
+
+  stats.seek_file = ctx->file;
+  stats.seek_file_level = 1;
+
+  /* As a read does: charge without the lock, take it once out of seeks. */
+  for (i = 0; i < VS_SEEKS / 2; i++) {
+    if (!ldb_version_charge_seek(&stats))
+      continue;
+
+    ldb_mutex_lock(&t->mu);
+
+    if (ldb_version_update_stats(t->vset->current, &stats))
+      ctx->scheduled++;
+
+    ldb_mutex_unlock(&t->mu);
+  }
+}
+
+static void
+test_versions_charge_seek(vstest_t *t) {
+  vsseek_t ctx[VS_THREADS];
+  ldb_thread_t threads[VS_THREADS];
+  ldb_version_t *v;
+  ldb_filemeta_t *f;
+  ldb_edit_t edit;
+  int scheduled = 0;
+  int i;
+
+  ldb_edit_init(&edit);
+
+  vstest_add(&edit, 1, ldb_versions_new_file_number(t->vset), "a", "b");
+
+  ASSERT(vstest_apply(t, &edit) == LDB_OK);
+
+  ldb_edit_clear(&edit);
+
+  v = t->vset->current;
+  f = v->files[1].items[0];
+
+  ldb_atomic_store(&f->allowed_seeks, VS_SEEKS, ldb_order_relaxed);
+
+  for (i = 0; i < VS_THREADS; i++) {
+    ctx[i].test = t;
+    ctx[i].file = f;
+    ctx[i].scheduled = 0;
+
+    ldb_thread_create(&threads[i], vsseek_body, &ctx[i]);
+  }
+
+  for (i = 0; i < VS_THREADS; i++) {
+    ldb_thread_join(&threads[i]);
+
+    scheduled += ctx[i].scheduled;
+  }
+
+  /* Every charge landed, and the file was picked only once. */
+  ASSERT(ldb_atomic_load(&f->allowed_seeks, ldb_order_relaxed)
+         == VS_SEEKS - VS_THREADS * (VS_SEEKS / 2));
+
+  ASSERT(scheduled == 1);
+  ASSERT(v->file_to_compact == f);
+  ASSERT(v->file_to_compact_level == 1);
+}
+
+#endif /* _WIN32 || LDB_PTHREAD */
+
 /*
  * Execute
  */
@@ -561,6 +1127,16 @@ main(void) {
     test_boundary_disjoin_file_pointers
   };
 
+  static void (*vstests[])(vstest_t *) = {
+    test_versions_shared_levels,
+    test_versions_cascade,
+#if defined(_WIN32) || defined(LDB_PTHREAD)
+    test_versions_apply_group,
+    test_versions_charge_seek,
+#endif
+    NULL
+  };
+
   size_t i;
 
   for (i = 0; i < lengthof(fftests); i++) {
@@ -583,5 +1159,15 @@ main(void) {
     addtest_clear(&t);
   }
 
+  for (i = 0; vstests[i] != NULL; i++) {
+    vstest_t t;
+
+    vstest_init(&t);
+
+    vstests[i](&t);
+
+    vstest_clear(&t);
+  }
+
   return 0;
 }
@@ -11,6 +11,7 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -71,6 +72,17 @@ print_contents(ldb_batch_t *b) {
         ldb_buffer_string(&state, ")");
         count++;
         break;
+      case LDB_TYPE_MERGE:
+        ldb_buffer_string(&state, "Merge(");
+        ldb_buffer_escape(&state, &ikey.user_key);
+        ldb_buffer_string(&state, ", ");
+        ldb_buffer_escape(&state, &val);
+        ldb_buffer_string(&state, ")");
+        count++;
+        break;
+      default:
+        ldb_buffer_string(&state, "Unknown()");
+        break;
     }
 
     ldb_buffer_string(&state, "@");
@@ -79,6 +91,28 @@ print_contents(ldb_batch_t *b) {
 
   ldb_iter_destroy(iter);
 
+  iter = ldb_rangeiter_create(mem);
+
+  for (ldb_iter_first(iter); ldb_iter_valid(iter); ldb_iter_next(iter)) {
+    ldb_slice_t key = ldb_iter_key(iter);
+    ldb_slice_t val = ldb_iter_value(iter);
+    ldb_pkey_t ikey;
+
+    ASSERT(ldb_pkey_import(&ikey, &key));
+    ASSERT(ikey.type == LDB_TYPE_RANGE_DELETION);
+
+    ldb_buffer_string(&state, "DeleteRange(");
+    ldb_buffer_escape(&state, &ikey.user_key);
+    ldb_buffer_string(&state, ", ");
+    ldb_buffer_escape(&state, &val);
+    ldb_buffer_string(&state, ")@");
+    ldb_buffer_number(&state, ikey.sequence);
+
+    count++;
+  }
+
+  ldb_iter_destroy(iter);
+
   if (rc != LDB_OK)
     ldb_buffer_string(&state, "ParseError()");
   else if (count != ldb_batch_count(b))
@@ -134,6 +168,61 @@ test_batch_multiple(void) {
   ldb_batch_clear(&batch);
 }
 
+static void
+test_batch_merge(void) {
+  ldb_slice_t key, val;
+  ldb_batch_t batch;
+
+  ldb_batch_init(&batch);
+
+  key = ldb_string("foo");
+  val = ldb_string("bar");
+  ldb_batch_put(&batch, &key, &val);
+
+  val = ldb_string("baz");
+  ldb_batch_merge(&batch, &key, &val);
+
+  ldb_batch_set_sequence(&batch, 100);
+
+  ASSERT(2 == ldb_batch_count(&batch));
+
+  ASSERT_EQ("Merge(foo, baz)@101"
+            "Put(foo, bar)@100",
+            print_contents(&batch));
+
+  ldb_batch_clear(&batch);
+}
+
+static void
+test_batch_delete_range(void) {
+  ldb_slice_t key, val, end;
+  ldb_batch_t batch;
+
+  ldb_batch_init(&batch);
+
+  key = ldb_string("foo");
+  val = ldb_string("bar");
+  ldb_batch_put(&batch, &key, &val);
+
+  key = ldb_string("a");
+  end = ldb_string("g");
+  ldb_batch_del_range(&batch, &key, &end);
+
+  key = ldb_string("box");
+  ldb_batch_del(&batch, &key);
+
+  ldb_batch_set_sequence(&batch, 100);
+
+  ASSERT(3 == ldb_batch_count(&batch));
+
+  ASSERT_EQ("Delete(box)@102"
+            "Put(foo, bar)@100"
+            "DeleteRange(a, g)@101",
+            print_contents(&batch));
+
+  ldb_batch_clear(&batch);
+}
+
 static void
 test_batch_corruption(void) {
   ldb_slice_t key, val, contents;
@@ -251,12 +340,150 @@ test_batch_approximate_size(void) {
   ldb_batch_clear(&batch);
 }
 
+static void
+test_batch_reserve(void) {
+  ldb_slice_t key, val;
+  ldb_batch_t batch;
+  uint8_t *data;
+  int i;
+
+  ldb_batch_init(&batch);
+  ldb_batch_reserve(&batch, 100 * 16);
+
+  data = batch.rep.data;
+
+  key = ldb_string("foo");
+  val = ldb_string("bar");
+
+  for (i = 0; i < 100; i++)
+    ldb_batch_put(&batch, &key, &val);
+
+  /* The updates fit in the reserved space. */
+  ASSERT(batch.rep.data == data);
+  ASSERT(ldb_batch_count(&batch) == 100);
+
+  ldb_batch_reset(&batch);
+  ldb_batch_reserve(&batch, 0);
+
+  ASSERT(ldb_batch_count(&batch) == 0);
+  ASSERT(batch.rep.data == data);
+
+  ldb_batch_clear(&batch);
+}
+
+static void
+test_batch_split(void) {
+  ldb_memtable_t *mem1, *mem2;
+  ldb_iter_t *iter1, *iter2;
+  ldb_batchpart_t parts[3];
+  ldb_slice_t key, val;
+  ldb_comparator_t cmp;
+  ldb_batch_t batch;
+  int i, n, count;
+  char buf[32];
+
+  ldb_batch_init(&batch);
+
+  for (i = 0; i < 20; i++) {
+    sprintf(buf, "key%02d", i % 8);
+
+    key = ldb_string(buf);
+    val = ldb_string(buf);
+
+    if (i % 5 == 4)
+      ldb_batch_del(&batch, &key);
+    else
+      ldb_batch_put(&batch, &key, &val);
+  }
+
+  ldb_batch_set_sequence(&batch, 100);
+
+  ASSERT(ldb_batch_split(&batch, parts, 3, &n) == LDB_OK);
+  ASSERT(n == 3);
+
+  /* The runs cover every update, in order. */
+  for (i = 0, count = 0; i < n; i++) {
+    ASSERT(parts[i].count > 0);
+    ASSERT(parts[i].sequence == (uint64_t)(100 + count));
+
+    if (i > 0)
+      ASSERT(parts[i].data.data == parts[i - 1].data.data
+                                 + parts[i - 1].data.size);
+
+    count += parts[i].count;
+  }
+
+  ASSERT(count == 20);
+
+  /* Inserting the runs in any order matches inserting the batch. */
+  ldb_ikc_init(&cmp, ldb_bytewise_comparator);
+
+  mem1 = ldb_memtable_create(&cmp);
+  mem2 = ldb_memtable_create(&cmp);
+
+  ldb_memtable_ref(mem1);
+  ldb_memtable_ref(mem2);
+
+  ASSERT(ldb_batch_insert_into(&batch, mem1) == LDB_OK);
+
+  for (i = n - 1; i >= 0; i--)
+    ASSERT(ldb_batchpart_insert_concurrently(&parts[i], mem2) == LDB_OK);
+
+  iter1 = ldb_memiter_create(mem1);
+  iter2 = ldb_memiter_create(mem2);
+
+  ldb_iter_first(iter1);
+  ldb_iter_first(iter2);
+
+  while (ldb_iter_valid(iter1)) {
+    ldb_slice_t k1 = ldb_iter_key(iter1);
+    ldb_slice_t k2;
+
+    ASSERT(ldb_iter_valid(iter2));
+
+    k2 = ldb_iter_key(iter2);
+
+    ASSERT(ldb_slice_equal(&k1, &k2));
+
+    ldb_iter_next(iter1);
+    ldb_iter_next(iter2);
+  }
+
+  ASSERT(!ldb_iter_valid(iter2));
+
+  ldb_iter_destroy(iter1);
+  ldb_iter_destroy(iter2);
+
+  ldb_memtable_unref(mem1);
+  ldb_memtable_unref(mem2);
+
+  /* Fewer runs than asked for if there are few updates. */
+  ldb_batch_reset(&batch);
+
+  key = ldb_string("foo");
+  ldb_batch_del(&batch, &key);
+
+  ASSERT(ldb_batch_split(&batch, parts, 3, &n) == LDB_OK);
+  ASSERT(n == 1 && parts[0].count == 1);
+
+  ldb_batch_reset(&batch);
+
+  ASSERT(ldb_batch_split(&batch, parts, 3, &n) == LDB_OK);
+  ASSERT(n == 0);
+
+  ldb_batch_clear(&batch);
+}
+
 int
 main(void) {
   test_batch_empty();
   test_batch_multiple();
+  test_batch_merge();
+  test_batch_delete_range();
   test_batch_corruption();
   test_batch_append();
   test_batch_approximate_size();
+  test_batch_reserve();
+  test_batch_split();
   return 0;
 }